@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * This file is shared between libc and the kernel, so don't put anything
+ * in here that won't work in both contexts.
+ */
+
+#ifdef _KERNEL
+#include <types.h>
+#include <lib.h>
+#else
+#include <stdint.h>
+#include <string.h>
+#endif
+
+/*
+ * C standard function - copy a block of memory. MIPS version.
+ *
+ * The copy is done by words whatever the alignment of the pointers:
+ * first bytes until the destination is word-aligned, then words, then
+ * whatever bytes are left. If the source is aligned too, the word loop
+ * does a whole cache line (eight words) per pass. If it isn't, each
+ * destination word is made out of two aligned source words; the MIPS
+ * is big-endian, so the first source word supplies the high-order
+ * bytes. (This is what lwl/lwr would do, but gcc does as well from C,
+ * and it keeps the file shared with the kernel readable.) Reading
+ * whole aligned words never touches a word that doesn't hold at least
+ * one byte of the source, so it can't fault where a byte copy wouldn't.
+ *
+ * memcpy does not support overlapping buffers, but memmove relies on
+ * the copy going forwards. Don't change that without adjusting it.
+ */
+
+#define WORD		sizeof(uint32_t)
+#define LINE		(8 * WORD)
+
+void *
+memcpy(void *dst, const void *src, size_t len)
+{
+	char *d = dst;
+	const char *s = src;
+
+	if (len >= LINE) {
+		uint32_t *wd;
+		const uint32_t *ws;
+
+		while ((uintptr_t)d % WORD != 0) {
+			*d++ = *s++;
+			len--;
+		}
+		wd = (uint32_t *)d;
+
+		if ((uintptr_t)s % WORD == 0) {
+			ws = (const uint32_t *)s;
+			while (len >= LINE) {
+				wd[0] = ws[0];
+				wd[1] = ws[1];
+				wd[2] = ws[2];
+				wd[3] = ws[3];
+				wd[4] = ws[4];
+				wd[5] = ws[5];
+				wd[6] = ws[6];
+				wd[7] = ws[7];
+				wd += 8;
+				ws += 8;
+				len -= LINE;
+			}
+			while (len >= WORD) {
+				*wd++ = *ws++;
+				len -= WORD;
+			}
+			s = (const char *)ws;
+		}
+		else {
+			unsigned off = (uintptr_t)s % WORD;
+			unsigned lsh = off * 8, rsh = 32 - lsh;
+			uint32_t w0, w1, w2;
+
+			ws = (const uint32_t *)(s - off);
+			w0 = *ws++;
+			while (len >= 2 * WORD) {
+				w1 = ws[0];
+				w2 = ws[1];
+				wd[0] = (w0 << lsh) | (w1 >> rsh);
+				wd[1] = (w1 << lsh) | (w2 >> rsh);
+				w0 = w2;
+				wd += 2;
+				ws += 2;
+				len -= 2 * WORD;
+			}
+			if (len >= WORD) {
+				w1 = *ws++;
+				*wd++ = (w0 << lsh) | (w1 >> rsh);
+				len -= WORD;
+			}
+			s = (const char *)ws - WORD + off;
+		}
+		d = (char *)wd;
+	}
+
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
+	}
+
+	return dst;
+}
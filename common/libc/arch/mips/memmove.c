@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * This file is shared between libc and the kernel, so don't put anything
+ * in here that won't work in both contexts.
+ */
+
+#ifdef _KERNEL
+#include <types.h>
+#include <lib.h>
+#else
+#include <stdint.h>
+#include <string.h>
+#endif
+
+/*
+ * C standard function - copy a block of memory, handling overlapping
+ * regions correctly. MIPS version.
+ */
+
+#define WORD		sizeof(uint32_t)
+#define LINE		(8 * WORD)
+
+void *
+memmove(void *dst, const void *src, size_t len)
+{
+	char *d;
+	const char *s;
+
+	/*
+	 * If the destination is below the source, copying front to
+	 * back is safe, and memcpy (see memcpy.c) always copies
+	 * forwards. So is it if they don't overlap at all.
+	 */
+	if ((uintptr_t)dst < (uintptr_t)src ||
+	    (uintptr_t)dst >= (uintptr_t)src + len) {
+		return memcpy(dst, src, len);
+	}
+
+	/*
+	 * Otherwise copy back to front. Words are only used if the
+	 * source and destination are equally misaligned, so the ends of
+	 * both can be brought to a word boundary at once; overlapping
+	 * moves by an odd amount are rare enough to do by bytes.
+	 */
+	d = (char *)dst + len;
+	s = (const char *)src + len;
+
+	if ((uintptr_t)d % WORD == (uintptr_t)s % WORD && len >= LINE) {
+		uint32_t *wd;
+		const uint32_t *ws;
+
+		while ((uintptr_t)d % WORD != 0) {
+			*--d = *--s;
+			len--;
+		}
+		wd = (uint32_t *)d;
+		ws = (const uint32_t *)s;
+		while (len >= LINE) {
+			wd -= 8;
+			ws -= 8;
+			wd[7] = ws[7];
+			wd[6] = ws[6];
+			wd[5] = ws[5];
+			wd[4] = ws[4];
+			wd[3] = ws[3];
+			wd[2] = ws[2];
+			wd[1] = ws[1];
+			wd[0] = ws[0];
+			len -= LINE;
+		}
+		while (len >= WORD) {
+			*--wd = *--ws;
+			len -= WORD;
+		}
+		d = (char *)wd;
+		s = (const char *)ws;
+	}
+
+	while (len > 0) {
+		*--d = *--s;
+		len--;
+	}
+
+	return dst;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef _KERNEL
+#include <types.h>
+#include <lib.h>
+#else
+#include <stdint.h>
+#include <string.h>
+#endif
+
+/*
+ * C standard function - initialize a block of memory. MIPS version:
+ * bytes up to a word boundary, then whole words, a cache line (eight
+ * words) per pass, then the bytes that are left.
+ */
+
+#define WORD		sizeof(uint32_t)
+#define LINE		(8 * WORD)
+
+void *
+memset(void *ptr, int ch, size_t len)
+{
+	char *p = ptr;
+
+	if (len >= LINE) {
+		uint32_t w, *wp;
+
+		while ((uintptr_t)p % WORD != 0) {
+			*p++ = ch;
+			len--;
+		}
+
+		w = (unsigned char)ch;
+		w |= w << 8;
+		w |= w << 16;
+
+		wp = (uint32_t *)p;
+		while (len >= LINE) {
+			wp[0] = w;
+			wp[1] = w;
+			wp[2] = w;
+			wp[3] = w;
+			wp[4] = w;
+			wp[5] = w;
+			wp[6] = w;
+			wp[7] = w;
+			wp += 8;
+			len -= LINE;
+		}
+		while (len >= WORD) {
+			*wp++ = w;
+			len -= WORD;
+		}
+		p = (char *)wp;
+	}
+
+	while (len > 0) {
+		*p++ = ch;
+		len--;
+	}
+
+	return ptr;
+}
@@ -36,9 +36,13 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
+/* See strlen.c. */
+#define HASZERO(w) (((w) - 0x01010101U) & ~(w) & 0x80808080U)
+
 /*
  * C standard string function: find leftmost instance of a character
  * in a string.
@@ -48,16 +52,36 @@ strchr(const char *s, int ch_arg)
 {
 	/* avoid sign-extension problems */
 	const char ch = ch_arg;
+	const uint32_t *w;
+	uint32_t pat;
 
-	/* scan from left to right */
-	while (*s) {
-		/* if we hit it, return it */
+	/* scan by bytes up to a word boundary */
+	while ((uintptr_t)s % sizeof(uint32_t) != 0) {
 		if (*s == ch) {
 			return (char *)s;
 		}
+		if (*s == 0) {
+			return NULL;
+		}
 		s++;
 	}
 
+	/* then by words, until one has either the end or CH in it */
+	pat = (unsigned char)ch;
+	pat |= pat << 8;
+	pat |= pat << 16;
+	for (w = (const uint32_t *)s; !HASZERO(*w) && !HASZERO(*w ^ pat); w++) {
+		/* nothing */
+	}
+
+	/* and find which */
+	for (s = (const char *)w; *s; s++) {
+		/* if we hit it, return it */
+		if (*s == ch) {
+			return (char *)s;
+		}
+	}
+
 	/* if we were looking for the 0, return that */
 	if (*s == ch) {
 		return (char *)s;
@@ -36,9 +36,13 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
+/* See strlen.c. */
+#define HASZERO(w) (((w) - 0x01010101U) & ~(w) & 0x80808080U)
+
 /*
  * Standard C string function: compare two strings and return their
  * sort order.
@@ -47,7 +51,7 @@
 int
 strcmp(const char *a, const char *b)
 {
-	size_t i;
+	size_t i = 0;
 
 	/*
 	 * Walk down both strings until either they're different
@@ -63,7 +67,31 @@ strcmp(const char *a, const char *b)
 	 * B.
 	 */
 
-	for (i=0; a[i]!=0 && a[i]==b[i]; i++) {
+	/*
+	 * If A and B are equally aligned, do it a word at a time (see
+	 * strlen.c) once they're word-aligned, for as long as the words
+	 * are the same and A's hasn't got the end of A in it.
+	 */
+	if ((uintptr_t)a % sizeof(uint32_t) == (uintptr_t)b % sizeof(uint32_t)) {
+		const uint32_t *wa, *wb;
+
+		for (; (uintptr_t)(a+i) % sizeof(uint32_t) != 0; i++) {
+			if (a[i] == 0 || a[i] != b[i]) {
+				break;
+			}
+		}
+		if ((uintptr_t)(a+i) % sizeof(uint32_t) == 0) {
+			wa = (const uint32_t *)(a+i);
+			wb = (const uint32_t *)(b+i);
+			while (*wa == *wb && !HASZERO(*wa)) {
+				wa++;
+				wb++;
+			}
+			i = (const char *)wa - a;
+		}
+	}
+
+	for (; a[i]!=0 && a[i]==b[i]; i++) {
 		/* nothing */
 	}
 
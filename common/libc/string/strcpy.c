@@ -36,28 +36,51 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
+/* See strlen.c. */
+#define HASZERO(w) (((w) - 0x01010101U) & ~(w) & 0x80808080U)
+
 /*
  * Standard C string function: copy one string to another.
  */
 char *
 strcpy(char *dest, const char *src)
 {
-	size_t i;
+	char *d = dest;
 
 	/*
-	 * Copy characters until we hit the null terminator.
+	 * If the two are equally aligned, copy bytes up to a word
+	 * boundary and then whole words until one has the null
+	 * terminator in it. Otherwise it's bytes all the way.
 	 */
-	for (i=0; src[i]; i++) {
-		dest[i] = src[i];
+	if ((uintptr_t)d % sizeof(uint32_t) ==
+	    (uintptr_t)src % sizeof(uint32_t)) {
+		uint32_t *wd;
+		const uint32_t *ws;
+
+		while ((uintptr_t)src % sizeof(uint32_t) != 0) {
+			if ((*d++ = *src++) == 0) {
+				return dest;
+			}
+		}
+		wd = (uint32_t *)d;
+		ws = (const uint32_t *)src;
+		while (!HASZERO(*ws)) {
+			*wd++ = *ws++;
+		}
+		d = (char *)wd;
+		src = (const char *)ws;
 	}
 
 	/*
-	 * Add null terminator to result.
+	 * Copy characters up to and including the null terminator.
 	 */
-	dest[i] = 0;
+	while ((*d++ = *src++) != 0) {
+		/* nothing */
+	}
 
 	return dest;
 }
@@ -36,20 +36,48 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
 /*
- * C standard string function: get length of a string
+ * The string functions in this directory go a word at a time where
+ * they can. A word has a zero byte in it exactly when
+ *
+ *    (w - 0x01010101) & ~w & 0x80808080
+ *
+ * is nonzero: subtracting 1 from each byte borrows out of a byte only
+ * if it was 0, or if a lower byte borrowed into it, which needs a 0
+ * below it. Once a word with a 0 (or a difference) in it turns up,
+ * the rest is done by bytes. Words are only ever read at aligned
+ * addresses, so a read past the end of the string never leaves the
+ * word holding its last byte and can't fault where a byte loop
+ * wouldn't.
  */
+#define HASZERO(w) (((w) - 0x01010101U) & ~(w) & 0x80808080U)
 
+/*
+ * C standard string function: get length of a string
+ */
 size_t
 strlen(const char *str)
 {
-	size_t ret = 0;
+	const char *s = str;
+	const uint32_t *w;
+
+	while ((uintptr_t)s % sizeof(uint32_t) != 0) {
+		if (*s == 0) {
+			return s - str;
+		}
+		s++;
+	}
+
+	for (w = (const uint32_t *)s; !HASZERO(*w); w++) {
+		/* nothing */
+	}
 
-	while (str[ret]) {
-		ret++;
+	for (s = (const char *)w; *s; s++) {
+		/* nothing */
 	}
-	return ret;
+	return s - str;
 }
@@ -0,0 +1,94 @@
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * Atomic operations with LL/SC. Each is a load-linked of the word and
+ * a store-conditional of the new value, retried until the store goes
+ * through (SC fails if anybody else stored to the word in between).
+ * The LL and SC have to be in the same asm statement so the compiler
+ * can't put a load or store of its own between them. The syncs
+ * around them make them full barriers, as include/atomic.h promises.
+ *
+ * See include/atomic.h for further information.
+ */
+
+#include <membar.h>
+
+ATOMIC_INLINE
+unsigned
+atomic_add(volatile unsigned *p, int delta)
+{
+	unsigned x, y;
+
+	membar_any_any();
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"addu %0, %0, %3;"	/*   x += delta */
+		"move %1, %0;"		/*   y = x */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   try again if it failed */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (p), "r" (delta) : "memory");
+	membar_any_any();
+	return x;
+}
+
+ATOMIC_INLINE
+bool
+atomic_cas(volatile unsigned *p, unsigned oldval, unsigned newval)
+{
+	unsigned x, y;
+
+	membar_any_any();
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"bne %0, %3, 2f;"	/*   give up if x != oldval */
+		"move %1, %4;"		/*   y = newval */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   try again if it failed */
+		"2:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (oldval), "r" (newval)
+		: "memory");
+	membar_any_any();
+	return x == oldval;
+}
+
+ATOMIC_INLINE
+bool
+atomic_dec_and_test(volatile unsigned *p)
+{
+	return atomic_add(p, -1) == 0;
+}
+
+ATOMIC_INLINE
+bool
+atomic_inc_not_zero(volatile unsigned *p)
+{
+	unsigned x, y;
+
+	membar_any_any();
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"beqz %0, 2f;"		/*   give up if it's 0 */
+		"addiu %1, %0, 1;"	/*   y = x + 1 */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   try again if it failed */
+		"2:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (p) : "memory");
+	membar_any_any();
+	return x != 0;
+}
+
+#endif /* _MIPS_ATOMIC_H_ */
@@ -38,8 +38,27 @@
  * gcc from reordering loads and stores around it.
  *
  * See include/membar.h for further information.
+ *
+ * In a uniprocessor kernel they're only compiler barriers: there's
+ * no other cpu to see our accesses out of order, and System/161
+ * performs a cpu's own accesses, device registers included, in the
+ * order it issues them.
  */
 
+#include "opt-uniprocessor.h"
+
+#if OPT_UNIPROCESSOR
+
+MEMBAR_INLINE
+void
+membar_any_any(void)
+{
+	__asm volatile("" ::: "memory");
+}
+
+#else
+
+
 MEMBAR_INLINE
 void
 membar_any_any(void)
@@ -54,6 +73,8 @@ membar_any_any(void)
 		: "memory");		/* "changes" memory */
 }
 
+#endif /* OPT_UNIPROCESSOR */
+
 MEMBAR_INLINE void membar_load_load(void) { membar_any_any(); }
 MEMBAR_INLINE void membar_store_store(void) { membar_any_any(); }
 MEMBAR_INLINE void membar_store_any(void) { membar_any_any(); }
@@ -117,13 +117,14 @@ paddr_t ram_getfirstfree(void);
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;		/* page to invalidate */
+	uint32_t ts_asid;		/* ASID of the address space it's in */
 };
 
 #define TLBSHOOTDOWN_MAX 16
 
+/* Page table root for the UTLB refill handler in exception-mips1.S, per cpu (see cpu.c) */
+extern vaddr_t cpu_ptroot[];
+
 
 #endif /* _MIPS_VM_H_ */
@@ -42,6 +42,8 @@
 #include <kern/wait.h>
 #include <synch.h>
 #include <proc.h>
+#include <uthread.h>
+#include <stats.h>
 
 
 /* in exception-*.S */
@@ -111,22 +113,12 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 		break;
 	}
 
-	
-	struct proc *p = curproc;
-
 	kprintf("Fatal user mode trap %u sig %d (%s, epc 0x%x, vaddr 0x%x)\n",
 		code, sig, trapcodenames[code], epc, vaddr);
 
 
 	/* encode the signal */
-	lock_acquire(p->p_waitlock);
-	p->p_exitcode = _MKWAIT_SIG(sig);
-	p->p_exited = true;
-
-	cv_broadcast(p->p_waitcv, p->p_waitlock);
-	lock_release(p->p_waitlock);
-
-	thread_exit();
+	exit_process(_MKWAIT_SIG(sig));
 
 
 
@@ -171,6 +163,14 @@ mips_trap(struct trapframe *tf)
 						+ STACK_SIZE));
 	}
 
+	/* Whatever the cpu was doing until now goes on the thread's bill. */
+	if (!iskern) {
+		thread_charge(CT_USER);
+	}
+	else if (curthread != NULL) {
+		thread_charge(curthread->t_in_interrupt ? CT_INTR : CT_SYS);
+	}
+
 	/* Interrupt? Call the interrupt handler and return. */
 	if (code == EX_IRQ) {
 		int old_in;
@@ -202,16 +202,23 @@ mips_trap(struct trapframe *tf)
 			curthread->t_curspl = IPL_HIGH;
 			curthread->t_iplhigh_count++;
 			doadjust = true;
+#if OPT_IRQSTATS
+			stats_irqoff();
+#endif
 		}
 		else {
 			doadjust = false;
 		}
 
 		mainbus_interrupt(tf);
+		thread_charge(CT_INTR);
 
 		if (doadjust) {
 			KASSERT(curthread->t_curspl == IPL_HIGH);
 			KASSERT(curthread->t_iplhigh_count == 1);
+#if OPT_IRQSTATS
+			stats_irqon();
+#endif
 			curthread->t_iplhigh_count--;
 			curthread->t_curspl = 0;
 		}
@@ -344,6 +351,21 @@ mips_trap(struct trapframe *tf)
 	cpu_irqoff();
  done2:
 
+	/*
+	 * Another thread of ours is making the process exit or exec:
+	 * leave instead of going back to user mode. (The interrupt
+	 * state is back to what it was in user mode, so it's safe to
+	 * block on the way out.)
+	 */
+	if (!iskern && curproc->p_thrkill) {
+		thr_leave();
+	}
+
+	/* Going back to user mode: the rest of the trap was system time. */
+	if (!iskern) {
+		thread_charge(CT_SYS);
+	}
+
 	/*
 	 * The boot thread can get here (e.g. on interrupt return) but
 	 * since it doesn't go to userlevel, it can't be returning to
@@ -399,6 +421,9 @@ mips_usermode(struct trapframe *tf)
 	spl0();
 	cpu_irqoff();
 
+	/* Charge the kernel time up to now; from here on it's user time. */
+	thread_charge(CT_SYS);
+
 	cputhreads[curcpu->c_number] = (vaddr_t)curthread;
 	cpustacks[curcpu->c_number] = (vaddr_t)curthread->t_stack + STACK_SIZE;
 
@@ -37,8 +37,483 @@
 #include <syscall.h>
 #include <copyinout.h>
 #include <addrspace.h>
+#include <trace.h>
+#include <mainbus.h>
+#include <proc.h>
+#include <systrace.h>
+#include <cpu.h>
+#include <stats.h>
 
+/*
+ * First, the glue between the trapframe and the sys_ functions: one
+ * sc_ function for each call, which takes its arguments out of the
+ * trapframe (and, past the fourth word, off the user stack) and calls
+ * the real thing. Most calls only take arguments in a0-a3, and for
+ * those SC_n(NAME, T0, ...) makes sc_NAME, which casts the first n
+ * argument registers to the types given and calls sys_NAME. SC_nR
+ * also passes retval, for calls that return something other than 0.
+ */
+#define SC_A(n, t) ((t)tf->tf_a##n)
+
+#define SC_1(name, t0) \
+	static int sc_##name(struct trapframe *tf, int32_t *retval) \
+	{ (void)retval; return sys_##name(SC_A(0, t0)); }
+#define SC_2(name, t0, t1) \
+	static int sc_##name(struct trapframe *tf, int32_t *retval) \
+	{ (void)retval; return sys_##name(SC_A(0, t0), SC_A(1, t1)); }
+#define SC_3(name, t0, t1, t2) \
+	static int sc_##name(struct trapframe *tf, int32_t *retval) \
+	{ (void)retval; \
+	  return sys_##name(SC_A(0, t0), SC_A(1, t1), SC_A(2, t2)); }
+#define SC_4(name, t0, t1, t2, t3) \
+	static int sc_##name(struct trapframe *tf, int32_t *retval) \
+	{ (void)retval; \
+	  return sys_##name(SC_A(0, t0), SC_A(1, t1), SC_A(2, t2), \
+			    SC_A(3, t3)); }
+
+#define SC_0R(name) \
+	static int sc_##name(struct trapframe *tf, int32_t *retval) \
+	{ (void)tf; return sys_##name(retval); }
+#define SC_1R(name, t0) \
+	static int sc_##name(struct trapframe *tf, int32_t *retval) \
+	{ return sys_##name(SC_A(0, t0), retval); }
+#define SC_2R(name, t0, t1) \
+	static int sc_##name(struct trapframe *tf, int32_t *retval) \
+	{ return sys_##name(SC_A(0, t0), SC_A(1, t1), retval); }
+#define SC_3R(name, t0, t1, t2) \
+	static int sc_##name(struct trapframe *tf, int32_t *retval) \
+	{ return sys_##name(SC_A(0, t0), SC_A(1, t1), SC_A(2, t2), retval); }
+#define SC_4R(name, t0, t1, t2, t3) \
+	static int sc_##name(struct trapframe *tf, int32_t *retval) \
+	{ return sys_##name(SC_A(0, t0), SC_A(1, t1), SC_A(2, t2), \
+			    SC_A(3, t3), retval); }
+
+SC_1(reboot, int)
+SC_2(__time, userptr_t, userptr_t)
+SC_2(nanosleep, userptr_t, userptr_t)
+
+/* ==== ADDED SYSCALLS FOR A4 ===== */
+SC_3R(open, userptr_t, int, mode_t)		/* filename, flags, mode bits; returns the fd */
+SC_4R(openat, int, userptr_t, int, mode_t)	/* directory fd (or AT_FDCWD), then as open */
+SC_3R(read, int, userptr_t, size_t)		/* fd, user buffer, bytes; returns how much was read */
+SC_3R(write, int, userptr_t, size_t)		/* fd, user buffer, bytes; returns how much was written */
+SC_1(close, int)
+SC_3R(readv, int, userptr_t, int)		/* fd, user array of iovecs, how many */
+SC_3R(writev, int, userptr_t, int)
+SC_3R(copy_file_range, int, int, size_t)	/* from fd, to fd, most bytes to copy */
+SC_3R(getdirentry, int, userptr_t, size_t)	/* directory fd, user buffer, its length */
+SC_3R(getdirentries, int, userptr_t, size_t)
+SC_2(fstat, int, userptr_t)
+SC_2(stat, userptr_t, userptr_t)
+SC_2(lstat, userptr_t, userptr_t)
+SC_4(fstatat, int, userptr_t, userptr_t, int)	/* directory fd, path, struct stat, AT_ flags */
+SC_2(mkdir, userptr_t, mode_t)
+SC_3(mkdirat, int, userptr_t, mode_t)
+SC_1(remove, userptr_t)
+SC_1(rmdir, userptr_t)
+SC_3(unlinkat, int, userptr_t, int)		/* directory fd, path, AT_REMOVEDIR or 0 */
+SC_1(chdir, userptr_t)
+SC_2R(dup2, int, int)				/* old fd, new fd */
+SC_1(pipe, userptr_t)				/* int[2] for the fds */
+
+/* ======= ADDED FOR A5 ========= */
+SC_0R(getpid)
+SC_2(execv, userptr_t, userptr_t)
+SC_3R(waitpid, pid_t, userptr_t, int)
+
+/* ======= ADDED FOR A6 ========= */
+SC_1R(sbrk, intptr_t)
+SC_2(munmap, userptr_t, size_t)
+SC_3(madvise, userptr_t, size_t, int)
+SC_2(getrusage, int, userptr_t)
+SC_2(getrlimit, int, userptr_t)
+SC_2(setrlimit, int, userptr_t)
+SC_2R(kheapstats, userptr_t, unsigned)
+SC_2(sched_setaffinity, pid_t, uint32_t)
+SC_2(sched_getaffinity, pid_t, userptr_t)
+SC_2(sched_setattr, pid_t, userptr_t)
+SC_2(sched_getattr, pid_t, userptr_t)
+SC_2(ioprio_set, pid_t, int)			/* pid (0 for us), IOPRIO_* class */
+SC_1R(ioprio_get, pid_t)
+SC_2(futex_wait, userptr_t, int)
+SC_2R(futex_wake, userptr_t, int)
+SC_4R(spawn, userptr_t, userptr_t, userptr_t, int)
+SC_3R(__thr_create, userptr_t, userptr_t, userptr_t)
+SC_2(thr_join, int, userptr_t)
+SC_1R(ioring_enter, userptr_t)
+SC_1(aio_read, userptr_t)
+SC_1(aio_write, userptr_t)
+SC_3R(aio_wait, userptr_t, int, int)
+SC_3R(socket, int, int, int)
+SC_3(bind, int, userptr_t, socklen_t)
+SC_3(connect, int, userptr_t, socklen_t)
+SC_3(getsockname, int, userptr_t, userptr_t)
+SC_2(systrace, pid_t, int)
+SC_3R(systrace_read, pid_t, userptr_t, unsigned)
+SC_3R(systrace_stats, pid_t, userptr_t, unsigned)
+SC_2R(dmesg, userptr_t, size_t)
+SC_2(sem_op, int, int)				/* semaphore fd, amount to V (> 0) or P (< 0) */
+SC_3R(shmget, int, size_t, int)			/* key, bytes, IPC_* flags; returns the id */
+SC_3R(shmat, int, userptr_t, int)		/* id, address hint, SHM_RDONLY; returns the address */
+SC_1(shmdt, userptr_t)
+SC_2(shmctl, int, int)
+SC_2(mempressure, int, userptr_t)		/* level last seen, struct mempressure */
+SC_1(fsync, int)
+SC_1(fdatasync, int)
+SC_3(ioctl, int, int, userptr_t)		/* fd, code, user pointer for the code */
+SC_3R(poll, userptr_t, unsigned, int)		/* user array of pollfds, how many, timeout in ms */
+
+/*
+ * The ones that don't fit the pattern.
+ */
+
+/* __getcwd(): retrieves the path of the current working directory */
+static
+int
+sc___getcwd(struct trapframe *tf, int32_t *retval)
+{
+	return sys___get_cwd((userptr_t)tf->tf_a0, /* user buffer that we copy the path into */
+		(size_t)tf->tf_a1, /* buffer length */
+		retval); /* bytes copied */
+}
+
+/* lseek(): changes the current file position by changing the offset. Returns 64 bits (SY_RET64) */
+static
+int
+sc_lseek(struct trapframe *tf, int32_t *retval)
+{
+	off_t offset; /* 64 bit file offset (the position to move to) */
+	int whence; /* int flag that tells the kernel how to interpret the offset argument (SEEK_SET, SEEK_CUR, SEEK_END)*/
+	off_t newpos;
+	int err;
+
+	/* recall that the user call is off_t lseek(int fd, off_t pos, int whence); so a0 = fd, a2/a3 = 64-bit pos, whence = next arg on user stack */
+	/* so we already have a0-a3 in the trapframe and we need to copy whence from the stack (sp + 16) since it's after a0-a3*/
+	err = copyin((userptr_t)tf->tf_sp + 16, &whence, sizeof(whence));
+	if (err) {
+		return err;
+	}
+
+	/* now we rebuild the 64-bit offset tf_a2 holds the high bits and tf_a3 holds the low bits combine them into one 64 bit value*/
+	offset = ((off_t)tf->tf_a2 << 32 | (off_t)tf->tf_a3);
+
+	err = sys_lseek((int)tf->tf_a0, offset, whence, &newpos);
+	if (err) {
+		return err;
+	}
+
+	/* calling convention for MIPS dicatates that we return the 64 bit value in two registers, v0 gets the upper 32 bits */
+	retval[0] = (uint32_t)((uint64_t)newpos >> 32);
+	retval[1] = (uint32_t)((uint64_t)newpos & 0xffffffffu);
+	return 0;
+}
+
+/* pread()/pwrite(): like read/write but at the given offset, the file's own offset isn't touched */
+/* a0 = fd, a1 = buf, a2 = nbytes, and the 64 bit offset goes on the user stack at sp + 16 (a3 is skipped so it's aligned) */
+static
+int
+sc_pread(struct trapframe *tf, int32_t *retval)
+{
+	off_t offset;
+	int err;
+
+	err = copyin((userptr_t)tf->tf_sp + 16, &offset, sizeof(offset));
+	if (err) {
+		return err;
+	}
+	return sys_pread((int)tf->tf_a0, (userptr_t)tf->tf_a1, (size_t)tf->tf_a2, offset, retval);
+}
+
+static
+int
+sc_pwrite(struct trapframe *tf, int32_t *retval)
+{
+	off_t offset;
+	int err;
+
+	err = copyin((userptr_t)tf->tf_sp + 16, &offset, sizeof(offset));
+	if (err) {
+		return err;
+	}
+	return sys_pwrite((int)tf->tf_a0, (userptr_t)tf->tf_a1, (size_t)tf->tf_a2, offset, retval);
+}
+
+/* sync_file_range(): a0 = fd, a1 is skipped, a2/a3 = 64 bit offset (high, low), and the 64 bit length goes on the user stack at sp + 16 */
+static
+int
+sc_sync_file_range(struct trapframe *tf, int32_t *retval)
+{
+	off_t offset, len;
+	int err;
+
+	(void)retval;
+	err = copyin((userptr_t)tf->tf_sp + 16, &len, sizeof(len));
+	if (err) {
+		return err;
+	}
+	offset = ((off_t)tf->tf_a2 << 32 | (off_t)tf->tf_a3);
+	return sys_sync_file_range((int)tf->tf_a0, offset, len);
+}
+
+/* fallocate(): a0 = fd, a1 = mode, a2/a3 = 64 bit offset (high, low), and the 64 bit length goes on the user stack at sp + 16 */
+static
+int
+sc_fallocate(struct trapframe *tf, int32_t *retval)
+{
+	off_t offset, len;
+	int err;
+
+	(void)retval;
+	err = copyin((userptr_t)tf->tf_sp + 16, &len, sizeof(len));
+	if (err) {
+		return err;
+	}
+	offset = ((off_t)tf->tf_a2 << 32 | (off_t)tf->tf_a3);
+	return sys_fallocate((int)tf->tf_a0, (int)tf->tf_a1, offset, len);
+}
+
+static
+int
+sc_fork(struct trapframe *tf, int32_t *retval)
+{
+	return sys_fork(tf, retval);
+}
+
+static
+int
+sc__exit(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	sys__exit((int)tf->tf_a0);
+	/* does not return */
+	return 0;
+}
+
+static
+int
+sc_thr_exit(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	sys_thr_exit((userptr_t)tf->tf_a0);
+	/* does not return */
+}
+
+/* mmap(addr, len, prot, flags, fd, offset): the first four args are in a0-a3, fd is on the user stack at sp+16 */
+/* and the 64 bit offset at sp+24 (64 bit values are 8 byte aligned); both are read in one user_access_begin */
+static
+int
+sc_mmap(struct trapframe *tf, int32_t *retval)
+{
+	const uint32_t *args = (const uint32_t *)(tf->tf_sp + 16);
+	int fd;
+	off_t offset;
+	int err;
+
+	err = user_access_begin((userptr_t)args, 4 * sizeof(uint32_t));
+	if (err) {
+		return err;
+	}
+	fd = (int)args[0];
+	offset = (off_t)((uint64_t)args[2] << 32 | args[3]); /* big-endian: high word first */
+	user_access_end();
+
+	return sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1, (int)tf->tf_a2, (int)tf->tf_a3, fd, offset, retval);
+}
+
+/* sendto()/recvfrom(): the last two args are on the user stack at sp+16 and sp+20 */
+static
+int
+sc_sendto(struct trapframe *tf, int32_t *retval)
+{
+	const uint32_t *args = (const uint32_t *)(tf->tf_sp + 16);
+	userptr_t to;
+	socklen_t tolen;
+	int err;
+
+	err = user_access_begin((userptr_t)args, 2 * sizeof(uint32_t));
+	if (err) {
+		return err;
+	}
+	to = (userptr_t)args[0];
+	tolen = (socklen_t)args[1];
+	user_access_end();
+
+	return sys_sendto((int)tf->tf_a0, (userptr_t)tf->tf_a1, (size_t)tf->tf_a2, (int)tf->tf_a3, to, tolen, retval);
+}
+
+static
+int
+sc_recvfrom(struct trapframe *tf, int32_t *retval)
+{
+	const uint32_t *args = (const uint32_t *)(tf->tf_sp + 16);
+	userptr_t from, fromlen;
+	int err;
+
+	err = user_access_begin((userptr_t)args, 2 * sizeof(uint32_t));
+	if (err) {
+		return err;
+	}
+	from = (userptr_t)args[0];
+	fromlen = (userptr_t)args[1];
+	user_access_end();
+
+	return sys_recvfrom((int)tf->tf_a0, (userptr_t)tf->tf_a1, (size_t)tf->tf_a2, (int)tf->tf_a3, from, fromlen, retval);
+}
+
+/*
+ * The system call table, indexed by call number. sy_nargs is the
+ * number of argument words the call takes, counting the ones on the
+ * stack and the padding that lines 64-bit arguments up. Calls with
+ * SY_RET64 return 64 bits, the high word in retval[0] (for v0) and
+ * the low word in retval[1] (for v1).
+ */
+struct syscall_ent {
+	int (*sy_func)(struct trapframe *tf, int32_t *retval);
+	unsigned char sy_nargs;
+	unsigned char sy_flags;
+};
+
+#define SY_RET64	0x1
+
+#define SY(name, nargs, flags) [SYS_##name] = { sc_##name, nargs, flags }
+
+static const struct syscall_ent syscall_table[] = {
+	SY(reboot, 1, 0),
+	SY(__time, 2, 0),
+	SY(nanosleep, 2, 0),
+
+	SY(open, 3, 0),
+	SY(openat, 4, 0),
+	SY(read, 3, 0),
+	SY(write, 3, 0),
+	SY(close, 1, 0),
+	SY(fsync, 1, 0),
+	SY(fdatasync, 1, 0),
+	SY(sync_file_range, 6, 0),
+	SY(fallocate, 6, 0),
+	SY(poll, 3, 0),
+	SY(ioctl, 3, 0),
+	SY(lseek, 5, SY_RET64),
+	SY(readv, 3, 0),
+	SY(writev, 3, 0),
+	SY(copy_file_range, 3, 0),
+	SY(getdirentry, 3, 0),
+	SY(getdirentries, 3, 0),
+	SY(fstat, 2, 0),
+	SY(stat, 2, 0),
+	SY(lstat, 2, 0),
+	SY(fstatat, 4, 0),
+	SY(mkdir, 2, 0),
+	SY(mkdirat, 3, 0),
+	SY(remove, 1, 0),
+	SY(rmdir, 1, 0),
+	SY(unlinkat, 3, 0),
+	SY(pread, 6, 0),
+	SY(pwrite, 6, 0),
+	SY(chdir, 1, 0),
+	SY(__getcwd, 2, 0),
+	SY(dup2, 2, 0),
+	SY(pipe, 1, 0),
+
+	SY(fork, 0, 0),
+	SY(getpid, 0, 0),
+	SY(execv, 2, 0),
+	SY(_exit, 1, 0),
+	SY(waitpid, 3, 0),
+
+	SY(sbrk, 1, 0),
+	SY(mmap, 8, 0),
+	SY(munmap, 2, 0),
+	SY(madvise, 3, 0),
+	SY(getrusage, 2, 0),
+	SY(getrlimit, 2, 0),
+	SY(setrlimit, 2, 0),
+	SY(kheapstats, 2, 0),
+	SY(sched_setaffinity, 2, 0),
+	SY(sched_getaffinity, 2, 0),
+	SY(sched_setattr, 2, 0),
+	SY(sched_getattr, 2, 0),
+	SY(ioprio_set, 2, 0),
+	SY(ioprio_get, 1, 0),
+	SY(futex_wait, 2, 0),
+	SY(futex_wake, 2, 0),
+	SY(spawn, 4, 0),
+	SY(__thr_create, 3, 0),
+	SY(thr_exit, 1, 0),
+	SY(thr_join, 2, 0),
+	SY(ioring_enter, 1, 0),
+	SY(aio_read, 1, 0),
+	SY(aio_write, 1, 0),
+	SY(aio_wait, 3, 0),
+	SY(socket, 3, 0),
+	SY(bind, 3, 0),
+	SY(connect, 3, 0),
+	SY(sendto, 6, 0),
+	SY(recvfrom, 6, 0),
+	SY(getsockname, 3, 0),
+	SY(systrace, 2, 0),
+	SY(systrace_read, 3, 0),
+	SY(systrace_stats, 3, 0),
+	SY(dmesg, 2, 0),
+	SY(sem_op, 2, 0),
+	SY(shmget, 3, 0),
+	SY(shmat, 3, 0),
+	SY(shmdt, 1, 0),
+	SY(shmctl, 2, 0),
+	SY(mempressure, 2, 0),
+};
+
+#define NSYSCALLS (sizeof(syscall_table) / sizeof(syscall_table[0]))
 
+/*
+ * The fast path. exception-mips1.S looks a syscall from user mode up
+ * in syscall_fast[] before doing anything else, and if there's a
+ * function there, calls it straight away: with only the registers C
+ * code doesn't preserve saved, interrupts still off, and neither
+ * mips_trap nor syscall() involved. ARGS points at the saved a0-a3.
+ * So these must not block, fault, or take spinlocks (releasing the
+ * last one would turn interrupts on), and they don't get the CPU time
+ * accounting and tracing the normal path does; if tracing is on they
+ * return SYSCALL_SLOW, and the call goes the normal way instead.
+ */
+#define SYSCALL_SLOW	(-1)	/* known to exception-mips1.S */
+
+static
+int
+fast_getpid(const uint32_t *args, int32_t *retval)
+{
+	(void)args;
+
+	if (trace_mask != 0 || curproc->p_systrace != NULL) {
+		return SYSCALL_SLOW;
+	}
+	return sys_getpid(retval);
+}
+
+/* Not static: the only users are in exception-mips1.S */
+int (*const syscall_fast[])(const uint32_t *args, int32_t *retval) = {
+	[SYS_getpid] = fast_getpid,
+};
+const unsigned syscall_nfast = sizeof(syscall_fast) / sizeof(syscall_fast[0]);
+
+/*
+ * Hand a finished call of a traced process to systrace_record (see
+ * systrace.h), with the argument registers the call uses. This has to
+ * be before the return registers are set, since a3 is one of them.
+ */
+static
+void
+syscall_systrace(struct systrace *st, struct trapframe *tf, int callno,
+		 unsigned nargs, int32_t retval, int err, uint64_t start)
+{
+	uint32_t args[4];
+
+	args[0] = nargs > 0 ? tf->tf_a0 : 0;
+	args[1] = nargs > 1 ? tf->tf_a1 : 0;
+	args[2] = nargs > 2 ? tf->tf_a2 : 0;
+	args[3] = nargs > 3 ? tf->tf_a3 : 0;
+	systrace_record(st, callno, args, retval, err, start);
+}
 
 /*
  * System call dispatcher.
@@ -82,14 +557,22 @@ void
 syscall(struct trapframe *tf)
 {
 	int callno;
-	int32_t retval;
+	const struct syscall_ent *sy;
+	int32_t retval[2];
 	int err;
+	struct systrace *st;
+	uint64_t start;
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	TRACE(TR_SYSCALL, callno, tf->tf_a0);
+
+	/* time the call if the process is being traced */
+	st = curproc->p_systrace;
+	start = st != NULL ? mainbus_cycles() : 0;
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -100,138 +583,26 @@ syscall(struct trapframe *tf)
 	 * like write.
 	 */
 
-	retval = 0;
-
-	switch (callno) {
-	    case SYS_reboot:
-		err = sys_reboot(tf->tf_a0);
-		break;
-
-	    case SYS___time:
-		err = sys___time((userptr_t)tf->tf_a0,
-				 (userptr_t)tf->tf_a1);
-		break;
-
-	    /* ==== ADDED SYSCALLS FOR A4 =====*/
-
-		/* open(): opens a file file and returns a new fd*/
-		case SYS_open:
-		err = sys_open(
-			(userptr_t)tf->tf_a0, /* filename (user pointer)*/
-			(int)tf->tf_a1,	/* flags */
-			(mode_t)tf->tf_a2, /* mode bits */
-			&retval); /* where fd will be stored */
-		break;
-
-		/* read(): reads data from a file into a user buffer */
-		case SYS_read:
-		err = sys_read((int)tf->tf_a0, /* the fd */
-		    (userptr_t)tf->tf_a1, /* user buffer */
-			(size_t)tf->tf_a2, /* bytes to read */
-			&retval); /* how much is read */
-		break;
-
-		/* write(): writes data from user buffer to file */
-		case SYS_write:
-		err = sys_write((int)tf->tf_a0, /* fd to write to */
-			(userptr_t)tf->tf_a1, /* user buffer */
-			(size_t)tf->tf_a2, /* bytes to write */
-			&retval); /* bytes that were actually written */
-		break; 
-
-		/* close(): closes an open fd */
-		case SYS_close:
-		err = sys_close((int)tf->tf_a0);
-		retval = 0; 
-		break;
-
-		/* lseek(): changes the current file position by changing the offset */
-		case SYS_lseek: {
-			off_t offset; /* 64 bit file offset (the position to move to) */
-			int whence; /* int flag that tells the kernel how to interpret the offset argument (SEEK_SET, SEEK_CUR, SEEK_END)*/
-			
-			off_t newpos;
-
-			/* recall that the user call is off_t lseek(int fd, off_t pos, int whence); so a0 = fd, a2/a3 = 64-bit pos, whence = next arg on user stack */
-			/* so we already have a0-a3 in the trapframe and we need to copy whence from the stack (sp + 16) since it's after a0-a3*/
-			err = copyin((userptr_t)tf->tf_sp + 16, &whence, sizeof(whence));
-			if (err) break;
-			
-			/* now we rebuild the 64-bit offset tf_a2 holds the high bits and tf_a3 holds the low bits combine them into one 64 bit value*/
-			offset = ((off_t)tf->tf_a2 << 32 | (off_t)tf->tf_a3);
-
-			err = sys_lseek((int)tf->tf_a0, offset, whence,(off_t *) &newpos);
-			if (err == 0) {
-        	
-			/* calling convention for MIPS dicatates that we return the 64 bit value in two registers */
-        	tf->tf_v0 = (uint32_t)((uint64_t)newpos >> 32); /* shift the upper 32 bits to the right */
-        	tf->tf_v1 = (uint32_t)((uint64_t)newpos & 0xffffffffu); /* and with a bit mask to get the lower 32 bits*/
-        	tf->tf_a3 = 0;              
-        	tf->tf_epc += 4;
-        	return;
-    	}
-			break;
-		}
-
-		/* changes the current working directory*/
-		case SYS_chdir: 
-		err = sys_chdir((userptr_t)tf->tf_a0);
-		retval = 0;
-		break;
-
-
-		/* __getcwd(): retrieves the path of the current working directory */
-		case SYS___getcwd:
-		err = sys___get_cwd((userptr_t)tf->tf_a0, /* user buffer that we copy the path into */
-			(size_t)tf->tf_a1, /* buffer length */
-			&retval); /* bytes copied */
-		break;
-
-		/* dup2(): duplicates one fd to another */
-		case SYS_dup2:
-		err = sys_dup2((int)tf->tf_a0, /* old fd */
-			(int)tf->tf_a1, /* new fd */
-			&retval); /* new fd returned */
-		break;
-		
-
-		/* ======= ADDED FOR A5 =========*/
-
-		case SYS_fork:
-		err = sys_fork(tf, &retval); 
-		break;
-
-		case SYS_getpid: 
-		err = sys_getpid(&retval); 
-		break;
-		
-		case SYS_execv: {
-    		err = sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
-    		break;
-		}
-
-		case SYS__exit:
-    		sys__exit((int)tf->tf_a0);
-    		/* does not return */
-    		break;
-
-		/* ======= ADDED FOR A6 =========*/
-		case SYS_sbrk: 
-			err = sys_sbrk((intptr_t)tf->tf_a0, &retval); 
-			break;
+	retval[0] = retval[1] = 0;
 
-	    default:
+	if (callno >= 0 && (unsigned)callno < NSYSCALLS &&
+	    syscall_table[callno].sy_func != NULL) {
+		sy = &syscall_table[callno];
+		err = sy->sy_func(tf, retval);
+	}
+	else {
 		kprintf("Unknown syscall %d\n", callno);
+		sy = NULL;
 		err = ENOSYS;
-		break;
-
-		case SYS_waitpid:{
-			err = sys_waitpid((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1, (int)tf->tf_a2, &retval);
-			break;
-		}
 	}
 
-
+	TRACE(TR_SYSRET, callno, err);
+	STAT_INC(STAT_SYSCALLS);
+	if (st != NULL) {
+		syscall_systrace(st, tf, callno, sy != NULL ? sy->sy_nargs : 4,
+				 sy != NULL && (sy->sy_flags & SY_RET64) ?
+				 retval[1] : retval[0], err, start);
+	}
 
 	if (err) {
 		/*
@@ -241,10 +612,14 @@ syscall(struct trapframe *tf)
 		 */
 		tf->tf_v0 = err;
 		tf->tf_a3 = 1;      /* signal an error */
+		STAT_INC(STAT_SYSCALL_ERRORS);
 	}
 	else {
 		/* Success. */
-		tf->tf_v0 = retval;
+		tf->tf_v0 = retval[0];
+		if (sy->sy_flags & SY_RET64) {
+			tf->tf_v1 = retval[1];
+		}
 		tf->tf_a3 = 0;      /* signal no error */
 	}
 
@@ -59,6 +59,13 @@
 vaddr_t cpustacks[MAXCPUS];
 vaddr_t cputhreads[MAXCPUS];
 
+/*
+ * Same trick for the UTLB refill handler: the address of the page
+ * table root (as->pt_l1) of the address space active on each CPU, or
+ * 0 if there is none. Maintained by as_activate and as_deactivate.
+ */
+vaddr_t cpu_ptroot[MAXCPUS];
+
 /*
  * Do machine-dependent initialization of the cpu structure or things
  * associated with a new cpu. Note that we're not running on the new
@@ -220,7 +220,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 struct addrspace *
 as_create(void)
 {
-	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	struct addrspace *as = kmalloc_tagged(sizeof(struct addrspace), KM_VM);
 	if (as==NULL) {
 		return NULL;
 	}
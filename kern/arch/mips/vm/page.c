@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Whole-page copy and zero for the VM system. Both addresses are
+ * page-aligned kernel (KSEG0) addresses, so there's no head or tail to
+ * deal with; each pass of the loop does two cache lines.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+
+void
+pagecopy(void *dst, const void *src)
+{
+	uint32_t *d = dst;
+	const uint32_t *s = src;
+	const uint32_t *end = s + PAGE_SIZE / sizeof(uint32_t);
+
+	KASSERT((vaddr_t)dst % PAGE_SIZE == 0);
+	KASSERT((vaddr_t)src % PAGE_SIZE == 0);
+
+	while (s < end) {
+		d[0] = s[0];   d[1] = s[1];   d[2] = s[2];   d[3] = s[3];
+		d[4] = s[4];   d[5] = s[5];   d[6] = s[6];   d[7] = s[7];
+		d[8] = s[8];   d[9] = s[9];   d[10] = s[10]; d[11] = s[11];
+		d[12] = s[12]; d[13] = s[13]; d[14] = s[14]; d[15] = s[15];
+		d += 16;
+		s += 16;
+	}
+}
+
+void
+pagezero(void *dst)
+{
+	uint32_t *d = dst;
+	uint32_t *end = d + PAGE_SIZE / sizeof(uint32_t);
+
+	KASSERT((vaddr_t)dst % PAGE_SIZE == 0);
+
+	while (d < end) {
+		d[0] = 0;  d[1] = 0;  d[2] = 0;  d[3] = 0;
+		d[4] = 0;  d[5] = 0;  d[6] = 0;  d[7] = 0;
+		d[8] = 0;  d[9] = 0;  d[10] = 0; d[11] = 0;
+		d[12] = 0; d[13] = 0; d[14] = 0; d[15] = 0;
+		d += 16;
+	}
+}
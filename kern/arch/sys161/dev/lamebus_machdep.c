@@ -40,6 +40,8 @@
 #include <membar.h>
 #include <synch.h>
 #include <mainbus.h>
+#include <prof.h>
+#include <stats.h>
 #include <sys161/bus.h>
 #include <lamebus/lamebus.h>
 #include "autoconf.h"
@@ -75,6 +77,22 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -275,6 +293,15 @@ mainbus_send_ipi(struct cpu *target)
 	lamebus_assert_ipi(lamebus, target);
 }
 
+/*
+ * Interrupt routing.
+ */
+int
+mainbus_route_interrupt(int slot, unsigned cpunum)
+{
+	return lamebus_route_interrupt(lamebus, slot, cpunum);
+}
+
 /*
  * Interrupt dispatcher.
  */
@@ -284,6 +311,126 @@ mainbus_send_ipi(struct cpu *target)
 #define LAMEBUS_IPI_BIT  0x00000800	/* inter-processor interrupt */
 #define MIPS_TIMER_BIT   0x00008000	/* on-chip timer */
 
+/*
+ * One hardclock's worth of cycles, and how close to c0_count we'll
+ * set c0_compare: if it were already behind when written we wouldn't
+ * get an interrupt until the count wrapped, minutes later.
+ */
+#define TIMER_PERIOD     (CPU_FREQUENCY / HZ)
+#define TIMER_SLOP       1000
+
+static
+bool
+mips_timer_pending(void)
+{
+	uint32_t cause;
+
+	__asm volatile("mfc0 %0, $13" : "=r" (cause));	/* $13 == c0_cause */
+	return (cause & MIPS_TIMER_BIT) != 0;
+}
+
+/*
+ * Cycle counter. c0_count starts over at every timer interrupt, so
+ * add the whole timer periods counted in curcpu->c_cyclebase. If the
+ * timer has gone off but we haven't taken the interrupt yet, the base
+ * is one period (of c_tickspan ticks) behind; count is read on both
+ * sides of the cause register so that a reset in between can't be
+ * missed.
+ */
+uint64_t
+mainbus_cycles_irqoff(void)
+{
+	uint32_t before, after;
+	bool pending;
+	uint64_t cycles;
+
+	before = mips_timer_get();
+	pending = mips_timer_pending();
+	after = mips_timer_get();
+	if (pending) {
+		/* reset before we read cause, so after is in the new period */
+		cycles = curcpu->c_cyclebase +
+			(uint64_t)curcpu->c_tickspan * TIMER_PERIOD + after;
+	}
+	else {
+		/* no reset before we read cause, so before is in this one */
+		cycles = curcpu->c_cyclebase + before;
+	}
+	return cycles;
+}
+
+uint64_t
+mainbus_cycles(void)
+{
+	uint64_t cycles;
+	int spl;
+
+	spl = splhigh();
+	cycles = mainbus_cycles_irqoff();
+	splx(spl);
+	return cycles;
+}
+
+uint32_t
+mainbus_cyclerate(void)
+{
+	return CPU_FREQUENCY;
+}
+
+/*
+ * Tickless idle. Normally the timer goes off every period; while the
+ * clock is stopped (see hardclock_stop) it's set to go off c_tickspan
+ * periods in, and c_tickdone counts the periods already passed to
+ * hardclock_missed.
+ *
+ * These are called with interrupts off. If the timer has already
+ * gone off, they leave it alone: the interrupt handler is about to
+ * account for the whole span and reset it anyway.
+ */
+void
+mainbus_tickcatchup(void)
+{
+	unsigned done;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	while (!mips_timer_pending()) {
+		done = mips_timer_get() / TIMER_PERIOD;
+		if (done <= curcpu->c_tickdone) {
+			break;
+		}
+		hardclock_missed(done - curcpu->c_tickdone);
+		curcpu->c_tickdone = done;
+	}
+}
+
+void
+mainbus_tickless(unsigned ticks)
+{
+	uint32_t count;
+	unsigned span;
+
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(ticks > 0);
+
+	count = mips_timer_get();
+	if (mips_timer_pending() ||
+	    curcpu->c_tickspan * TIMER_PERIOD < count + TIMER_SLOP) {
+		/* already gone off, or about to */
+		return;
+	}
+
+	if (ticks > 0xffffffff / TIMER_PERIOD - curcpu->c_tickdone) {
+		ticks = 0xffffffff / TIMER_PERIOD - curcpu->c_tickdone;
+	}
+	span = curcpu->c_tickdone + ticks;
+	while ((uint64_t)span * TIMER_PERIOD < (uint64_t)count + TIMER_SLOP) {
+		span++;
+	}
+	curcpu->c_tickspan = span;
+	mips_timer_set(span * TIMER_PERIOD);
+}
+
 void
 mainbus_interrupt(struct trapframe *tf)
 {
@@ -299,14 +446,35 @@ mainbus_interrupt(struct trapframe *tf)
 		seen = true;
 	}
 	if (cause & LAMEBUS_IPI_BIT) {
+#if OPT_IRQSTATS
+		uint64_t start;
+
+		start = mainbus_cycles_irqoff();
+#endif
 		interprocessor_interrupt();
+#if OPT_IRQSTATS
+		stats_hist(STAT_HIST_IPI, mainbus_cycles_irqoff() - start);
+#endif
 		lamebus_clear_ipi(lamebus, curcpu);
 		seen = true;
 	}
 	if (cause & MIPS_TIMER_BIT) {
+		unsigned missed;
+
+		/* Ticks skipped while stopped, besides this one */
+		missed = curcpu->c_tickspan - curcpu->c_tickdone - 1;
 		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
+		mips_timer_set(TIMER_PERIOD);
+		curcpu->c_cyclebase +=
+			(uint64_t)curcpu->c_tickspan * TIMER_PERIOD;
+		curcpu->c_tickspan = 1;
+		curcpu->c_tickdone = 0;
+		/* note where we were for the profiler */
+		prof_sample(tf->tf_epc, (tf->tf_status & CST_KUp) != 0);
 		/* and call hardclock */
+		if (missed > 0) {
+			hardclock_missed(missed);
+		}
 		hardclock();
 		seen = true;
 	}
@@ -7,6 +7,7 @@ static void autoconf_beep(struct beep_softc *, int);
 static void autoconf_con(struct con_softc *, int);
 static void autoconf_emu(struct emu_softc *, int);
 static void autoconf_lhd(struct lhd_softc *, int);
+static void autoconf_lnet(struct lnet_softc *, int);
 static void autoconf_lrandom(struct lrandom_softc *, int);
 static void autoconf_lser(struct lser_softc *, int);
 static void autoconf_ltimer(struct ltimer_softc *, int);
@@ -17,6 +18,7 @@ static int nextunit_beep;
 static int nextunit_con;
 static int nextunit_emu;
 static int nextunit_lhd;
+static int nextunit_lnet;
 static int nextunit_lrandom;
 static int nextunit_lser;
 static int nextunit_ltimer;
@@ -168,6 +170,30 @@ tryattach_lser_to_lamebus(int devunit, struct lamebus_softc *bus, int busunit)
 	return 0;
 }
 
+static
+int
+tryattach_lnet_to_lamebus(int devunit, struct lamebus_softc *bus, int busunit)
+{
+	struct lnet_softc *dev;
+	int result;
+
+	dev = attach_lnet_to_lamebus(devunit, bus);
+	if (dev==NULL) {
+		return -1;
+	}
+	kprintf("lnet%d at lamebus%d", devunit, busunit);
+	result = config_lnet(dev, devunit);
+	if (result != 0) {
+		kprintf(": %s\n", strerror(result));
+		/* should really clean up dev */
+		return result;
+	}
+	kprintf("\n");
+	nextunit_lnet = devunit+1;
+	autoconf_lnet(dev, devunit);
+	return 0;
+}
+
 static
 int
 tryattach_beep_to_ltimer(int devunit, struct ltimer_softc *bus, int busunit)
@@ -267,59 +293,49 @@ tryattach_random_to_lrandom(int devunit, struct lrandom_softc *bus, int busunit)
 
 static
 void
-autoconf_con(struct con_softc *bus, int busunit)
+autoconf_ltrace(struct ltrace_softc *bus, int busunit)
 {
 	(void)bus; (void)busunit;
 }
 
 static
 void
-autoconf_lser(struct lser_softc *bus, int busunit)
+autoconf_lhd(struct lhd_softc *bus, int busunit)
 {
 	(void)bus; (void)busunit;
-	{
-		if (nextunit_con <= 0) {
-			tryattach_con_to_lser(0, bus, busunit);
-		}
-	}
 }
 
 static
 void
-autoconf_lhd(struct lhd_softc *bus, int busunit)
+autoconf_con(struct con_softc *bus, int busunit)
 {
 	(void)bus; (void)busunit;
 }
 
 static
 void
-autoconf_emu(struct emu_softc *bus, int busunit)
+autoconf_beep(struct beep_softc *bus, int busunit)
 {
 	(void)bus; (void)busunit;
 }
 
 static
 void
-autoconf_random(struct random_softc *bus, int busunit)
+autoconf_lser(struct lser_softc *bus, int busunit)
 {
 	(void)bus; (void)busunit;
+	{
+		if (nextunit_con <= 0) {
+			tryattach_con_to_lser(0, bus, busunit);
+		}
+	}
 }
 
 static
 void
-autoconf_ltimer(struct ltimer_softc *bus, int busunit)
+autoconf_random(struct random_softc *bus, int busunit)
 {
 	(void)bus; (void)busunit;
-	{
-		if (nextunit_beep <= 0) {
-			tryattach_beep_to_ltimer(0, bus, busunit);
-		}
-	}
-	{
-		if (nextunit_rtclock <= 0) {
-			tryattach_rtclock_to_ltimer(0, bus, busunit);
-		}
-	}
 }
 
 void
@@ -368,23 +384,42 @@ autoconf_lamebus(struct lamebus_softc *bus, int busunit)
 			devunit++;
 		} while (result==0);
 	}
+	{
+		int result, devunit=nextunit_lnet;
+		do {
+			result = tryattach_lnet_to_lamebus(devunit, bus, busunit);
+			devunit++;
+		} while (result==0);
+	}
 }
 
 static
 void
-autoconf_beep(struct beep_softc *bus, int busunit)
+autoconf_emu(struct emu_softc *bus, int busunit)
 {
 	(void)bus; (void)busunit;
 }
 
 static
 void
-autoconf_lrandom(struct lrandom_softc *bus, int busunit)
+autoconf_lnet(struct lnet_softc *bus, int busunit)
+{
+	(void)bus; (void)busunit;
+}
+
+static
+void
+autoconf_ltimer(struct ltimer_softc *bus, int busunit)
 {
 	(void)bus; (void)busunit;
 	{
-		if (nextunit_random <= 0) {
-			tryattach_random_to_lrandom(0, bus, busunit);
+		if (nextunit_beep <= 0) {
+			tryattach_beep_to_ltimer(0, bus, busunit);
+		}
+	}
+	{
+		if (nextunit_rtclock <= 0) {
+			tryattach_rtclock_to_ltimer(0, bus, busunit);
 		}
 	}
 }
@@ -398,9 +433,14 @@ autoconf_rtclock(struct rtclock_softc *bus, int busunit)
 
 static
 void
-autoconf_ltrace(struct ltrace_softc *bus, int busunit)
+autoconf_lrandom(struct lrandom_softc *bus, int busunit)
 {
 	(void)bus; (void)busunit;
+	{
+		if (nextunit_random <= 0) {
+			tryattach_random_to_lrandom(0, bus, busunit);
+		}
+	}
 }
 
 void
@@ -2,10 +2,6 @@
 SRCS+=$(TOP)/common/libc/printf/__printf.c
 SRCS+=$(TOP)/common/libc/printf/snprintf.c
 SRCS+=$(TOP)/common/libc/stdlib/atoi.c
-SRCS+=$(TOP)/common/libc/string/bzero.c
-SRCS+=$(TOP)/common/libc/string/memcpy.c
-SRCS+=$(TOP)/common/libc/string/memmove.c
-SRCS+=$(TOP)/common/libc/string/memset.c
 SRCS+=$(TOP)/common/libc/string/strcat.c
 SRCS+=$(TOP)/common/libc/string/strchr.c
 SRCS+=$(TOP)/common/libc/string/strcmp.c
@@ -20,19 +16,21 @@ SRCS+=$(KTOP)/dev/generic/random.c
 SRCS+=$(KTOP)/dev/generic/rtclock.c
 SRCS+=$(KTOP)/dev/lamebus/beep_ltimer.c
 SRCS+=$(KTOP)/dev/lamebus/con_lser.c
-SRCS+=$(KTOP)/dev/lamebus/emu_att.c
 SRCS+=$(KTOP)/dev/lamebus/emu.c
+SRCS+=$(KTOP)/dev/lamebus/emu_att.c
 SRCS+=$(KTOP)/dev/lamebus/lamebus.c
-SRCS+=$(KTOP)/dev/lamebus/lhd_att.c
 SRCS+=$(KTOP)/dev/lamebus/lhd.c
-SRCS+=$(KTOP)/dev/lamebus/lrandom_att.c
+SRCS+=$(KTOP)/dev/lamebus/lhd_att.c
+SRCS+=$(KTOP)/dev/lamebus/lnet.c
+SRCS+=$(KTOP)/dev/lamebus/lnet_att.c
 SRCS+=$(KTOP)/dev/lamebus/lrandom.c
-SRCS+=$(KTOP)/dev/lamebus/lser_att.c
+SRCS+=$(KTOP)/dev/lamebus/lrandom_att.c
 SRCS+=$(KTOP)/dev/lamebus/lser.c
-SRCS+=$(KTOP)/dev/lamebus/ltimer_att.c
+SRCS+=$(KTOP)/dev/lamebus/lser_att.c
 SRCS+=$(KTOP)/dev/lamebus/ltimer.c
-SRCS+=$(KTOP)/dev/lamebus/ltrace_att.c
+SRCS+=$(KTOP)/dev/lamebus/ltimer_att.c
 SRCS+=$(KTOP)/dev/lamebus/ltrace.c
+SRCS+=$(KTOP)/dev/lamebus/ltrace_att.c
 SRCS+=$(KTOP)/dev/lamebus/random_lrandom.c
 SRCS+=$(KTOP)/dev/lamebus/rtclock_ltimer.c
 SRCS+=$(KTOP)/fs/semfs/semfs_fsops.c
@@ -44,89 +42,111 @@ SRCS+=$(KTOP)/fs/sfs/sfs_dir.c
 SRCS+=$(KTOP)/fs/sfs/sfs_fsops.c
 SRCS+=$(KTOP)/fs/sfs/sfs_inode.c
 SRCS+=$(KTOP)/fs/sfs/sfs_io.c
+SRCS+=$(KTOP)/fs/sfs/sfs_journal.c
 SRCS+=$(KTOP)/fs/sfs/sfs_vnops.c
+SRCS+=$(KTOP)/fs/statsfs/statsfs.c
+SRCS+=$(KTOP)/fs/tmpfs/tmpfs_fsops.c
+SRCS+=$(KTOP)/fs/tmpfs/tmpfs_vnops.c
 SRCS+=$(KTOP)/lib/array.c
 SRCS+=$(KTOP)/lib/bitmap.c
 SRCS+=$(KTOP)/lib/bswap.c
+SRCS+=$(KTOP)/lib/hashtab.c
 SRCS+=$(KTOP)/lib/kgets.c
 SRCS+=$(KTOP)/lib/kprintf.c
 SRCS+=$(KTOP)/lib/misc.c
+SRCS+=$(KTOP)/lib/radix.c
 SRCS+=$(KTOP)/lib/time.c
 SRCS+=$(KTOP)/lib/uio.c
 SRCS+=$(KTOP)/main/main.c
 SRCS+=$(KTOP)/main/menu.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/locore/trap.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/syscall/syscall.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/cpu.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/switchframe.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/switch.S
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/thread_machdep.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/threadstart.S
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/vm/ram.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/adddi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/anddi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ashldi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ashrdi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/cmpdi2.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/divdi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/iordi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/lshldi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/lshrdi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/moddi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/muldi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/negdi2.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/notdi2.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/qdivrem.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/subdi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ucmpdi2.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/udivdi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/umoddi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/xordi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/libc/arch/mips/setjmp.S
-SRCS.MACHINE.mips+=$(KTOP)/vm/copyinout.c
+SRCS+=$(KTOP)/net/net.c
+SRCS+=$(KTOP)/net/socket.c
 SRCS+=$(KTOP)/proc/proc.c
-SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/locore/cache-mips161.S
-SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/locore/exception-mips1.S
-SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/vm/tlb-mips161.S
-SRCS.PLATFORM.sys161+=$(KTOP)/arch/sys161/dev/lamebus_machdep.c
-SRCS.PLATFORM.sys161+=$(KTOP)/arch/sys161/main/start.S
+SRCS+=$(KTOP)/syscall/aio_syscall.c
+SRCS+=$(KTOP)/syscall/dmesg_syscall.c
 SRCS+=$(KTOP)/syscall/execv_syscall.c
 SRCS+=$(KTOP)/syscall/exit_syscall.c
 SRCS+=$(KTOP)/syscall/file_syscalls/chdir_syscall.c
 SRCS+=$(KTOP)/syscall/file_syscalls/close_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/copy_file_range_syscall.c
 SRCS+=$(KTOP)/syscall/file_syscalls/dup2_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/fallocate_syscall.c
 SRCS+=$(KTOP)/syscall/file_syscalls/file_table.c
+SRCS+=$(KTOP)/syscall/file_syscalls/fsync_syscall.c
 SRCS+=$(KTOP)/syscall/file_syscalls/get_cwd_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/getdirentries_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/ioctl_syscall.c
 SRCS+=$(KTOP)/syscall/file_syscalls/lseek_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/mkdir_syscall.c
 SRCS+=$(KTOP)/syscall/file_syscalls/open_file_handler.c
 SRCS+=$(KTOP)/syscall/file_syscalls/open_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/pipe_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/poll_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/pread_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/pwrite_syscall.c
 SRCS+=$(KTOP)/syscall/file_syscalls/read_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/readv_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/remove_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/sem_op_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/stat_syscall.c
 SRCS+=$(KTOP)/syscall/file_syscalls/uio_helper.c
 SRCS+=$(KTOP)/syscall/file_syscalls/write_syscall.c
+SRCS+=$(KTOP)/syscall/file_syscalls/writev_syscall.c
 SRCS+=$(KTOP)/syscall/fork_syscall.c
+SRCS+=$(KTOP)/syscall/futex_syscall.c
 SRCS+=$(KTOP)/syscall/getpid_syscall.c
+SRCS+=$(KTOP)/syscall/getrusage_syscall.c
+SRCS+=$(KTOP)/syscall/ioring_syscall.c
+SRCS+=$(KTOP)/syscall/kheapstats_syscall.c
 SRCS+=$(KTOP)/syscall/loadelf.c
+SRCS+=$(KTOP)/syscall/mempressure_syscall.c
+SRCS+=$(KTOP)/syscall/mmap_syscall.c
+SRCS+=$(KTOP)/syscall/rlimit_syscall.c
 SRCS+=$(KTOP)/syscall/runprogram.c
 SRCS+=$(KTOP)/syscall/sbrk_syscall.c
+SRCS+=$(KTOP)/syscall/sched_syscall.c
+SRCS+=$(KTOP)/syscall/shm_syscall.c
+SRCS+=$(KTOP)/syscall/socket_syscall.c
+SRCS+=$(KTOP)/syscall/spawn_syscall.c
+SRCS+=$(KTOP)/syscall/systrace_syscall.c
+SRCS+=$(KTOP)/syscall/thr_syscall.c
 SRCS+=$(KTOP)/syscall/time_syscalls.c
 SRCS+=$(KTOP)/syscall/waitpid_syscall.c
 SRCS+=$(KTOP)/test/arraytest.c
 SRCS+=$(KTOP)/test/bitmaptest.c
 SRCS+=$(KTOP)/test/fstest.c
+SRCS+=$(KTOP)/test/hashtabtest.c
+SRCS+=$(KTOP)/test/kmallocbench.c
 SRCS+=$(KTOP)/test/malloctest.c
+SRCS+=$(KTOP)/test/radixtest.c
+SRCS+=$(KTOP)/test/synchbench.c
 SRCS+=$(KTOP)/test/synchtest.c
 SRCS+=$(KTOP)/test/threadlisttest.c
 SRCS+=$(KTOP)/test/threadtest.c
 SRCS+=$(KTOP)/test/tt3.c
 SRCS+=$(KTOP)/thread/clock.c
+SRCS+=$(KTOP)/thread/epoch.c
+SRCS+=$(KTOP)/thread/lockstat.c
+SRCS+=$(KTOP)/thread/prof.c
 SRCS+=$(KTOP)/thread/spinlock.c
 SRCS+=$(KTOP)/thread/spl.c
+SRCS+=$(KTOP)/thread/stats.c
 SRCS+=$(KTOP)/thread/synch.c
 SRCS+=$(KTOP)/thread/thread.c
 SRCS+=$(KTOP)/thread/threadlist.c
+SRCS+=$(KTOP)/thread/timer.c
+SRCS+=$(KTOP)/thread/trace.c
+SRCS+=$(KTOP)/thread/workqueue.c
+SRCS+=$(KTOP)/vfs/blkq.c
+SRCS+=$(KTOP)/vfs/bufcache.c
 SRCS+=$(KTOP)/vfs/device.c
 SRCS+=$(KTOP)/vfs/devnull.c
+SRCS+=$(KTOP)/vfs/devstripe.c
+SRCS+=$(KTOP)/vfs/namecache.c
+SRCS+=$(KTOP)/vfs/pipe.c
+SRCS+=$(KTOP)/vfs/poll.c
 SRCS+=$(KTOP)/vfs/vfscwd.c
+SRCS+=$(KTOP)/vfs/vfsdirent.c
 SRCS+=$(KTOP)/vfs/vfsfail.c
 SRCS+=$(KTOP)/vfs/vfslist.c
 SRCS+=$(KTOP)/vfs/vfslookup.c
@@ -135,4 +155,49 @@ SRCS+=$(KTOP)/vfs/vnode.c
 SRCS+=$(KTOP)/vm/addrspace.c
 SRCS+=$(KTOP)/vm/coremap.c
 SRCS+=$(KTOP)/vm/kmalloc.c
+SRCS+=$(KTOP)/vm/kmem_cache.c
+SRCS+=$(KTOP)/vm/pagemerge.c
+SRCS+=$(KTOP)/vm/shm.c
+SRCS+=$(KTOP)/vm/swap.c
+SRCS+=$(KTOP)/vm/textcache.c
 SRCS+=$(KTOP)/vm/vm.c
+SRCS+=$(KTOP)/vm/zswap.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/adddi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/anddi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ashldi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ashrdi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/cmpdi2.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/divdi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/iordi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/lshldi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/lshrdi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/moddi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/muldi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/negdi2.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/notdi2.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/qdivrem.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/subdi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ucmpdi2.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/udivdi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/umoddi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/xordi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/libc/arch/mips/bzero.c
+SRCS.MACHINE.mips+=$(TOP)/common/libc/arch/mips/memcpy.c
+SRCS.MACHINE.mips+=$(TOP)/common/libc/arch/mips/memmove.c
+SRCS.MACHINE.mips+=$(TOP)/common/libc/arch/mips/memset.c
+SRCS.MACHINE.mips+=$(TOP)/common/libc/arch/mips/setjmp.S
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/locore/trap.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/syscall/syscall.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/cpu.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/switch.S
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/switchframe.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/thread_machdep.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/threadstart.S
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/vm/page.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/vm/ram.c
+SRCS.MACHINE.mips+=$(KTOP)/vm/copyinout.c
+SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/locore/cache-mips161.S
+SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/locore/exception-mips1.S
+SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/vm/tlb-mips161.S
+SRCS.PLATFORM.sys161+=$(KTOP)/arch/sys161/dev/lamebus_machdep.c
+SRCS.PLATFORM.sys161+=$(KTOP)/arch/sys161/main/start.S
@@ -0,0 +1,5 @@
+/* Automatically generated; do not edit */
+#ifndef _OPT_IRQSTATS_H_
+#define _OPT_IRQSTATS_H_
+#define OPT_IRQSTATS 1
+#endif /* _OPT_IRQSTATS_H_ */
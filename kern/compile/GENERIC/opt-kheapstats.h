@@ -0,0 +1,5 @@
+/* Automatically generated; do not edit */
+#ifndef _OPT_KHEAPSTATS_H_
+#define _OPT_KHEAPSTATS_H_
+#define OPT_KHEAPSTATS 1
+#endif /* _OPT_KHEAPSTATS_H_ */
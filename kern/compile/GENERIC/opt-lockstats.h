@@ -0,0 +1,5 @@
+/* Automatically generated; do not edit */
+#ifndef _OPT_LOCKSTATS_H_
+#define _OPT_LOCKSTATS_H_
+#define OPT_LOCKSTATS 1
+#endif /* _OPT_LOCKSTATS_H_ */
@@ -0,0 +1,5 @@
+/* Automatically generated; do not edit */
+#ifndef _OPT_TMPFS_H_
+#define _OPT_TMPFS_H_
+#define OPT_TMPFS 1
+#endif /* _OPT_TMPFS_H_ */
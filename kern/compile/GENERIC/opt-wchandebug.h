@@ -0,0 +1,5 @@
+/* Automatically generated; do not edit */
+#ifndef _OPT_WCHANDEBUG_H_
+#define _OPT_WCHANDEBUG_H_
+#define OPT_WCHANDEBUG 1
+#endif /* _OPT_WCHANDEBUG_H_ */
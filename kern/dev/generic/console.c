@@ -39,6 +39,11 @@
  * supported, although such support could be added without undue
  * difficulty.
  *
+ * Output that doesn't have to be polled goes into a ring buffer, and
+ * each write-done interrupt sends the next character from it, so
+ * writers only wait when the buffer is full. Polled output goes
+ * straight to the device and may get ahead of what's buffered.
+ *
  * Note that nothing happens until we have a device to write to. A
  * buffer of size DELAYBUFSIZE is used to hold output that is
  * generated before this point. This means that (1) using kprintf for
@@ -49,12 +54,14 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/poll.h>
 #include <lib.h>
 #include <uio.h>
 #include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -122,6 +129,56 @@ putch_polled(struct con_softc *cs, int ch)
 
 //////////////////////////////////////////////////
 
+/*
+ * If the device is free, start it on the next buffered character.
+ * Call with cs_outlock held.
+ */
+static
+void
+con_kick(struct con_softc *cs)
+{
+	unsigned char ch;
+
+	if (cs->cs_outbusy || cs->cs_outbuf_head == cs->cs_outbuf_tail) {
+		return;
+	}
+	ch = cs->cs_outbuf[cs->cs_outbuf_tail];
+	cs->cs_outbuf_tail =
+		(cs->cs_outbuf_tail + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	cs->cs_outbusy = true;
+	cs->cs_send(cs->cs_devdata, ch);
+
+	/* there's room now */
+	wchan_wakeall(cs->cs_outwchan, &cs->cs_outlock);
+	pollq_wakeup(&cs->cs_pollq);
+}
+
+/*
+ * Print LEN characters, using interrupts to wait for I/O completion;
+ * that is, put them in the output buffer, waiting for room if need be.
+ */
+static
+void
+putbuf_intr(struct con_softc *cs, const char *buf, size_t len)
+{
+	unsigned nexthead;
+	size_t i;
+
+	spinlock_acquire(&cs->cs_outlock);
+	for (i=0; i<len; i++) {
+		nexthead = (cs->cs_outbuf_head + 1) %
+			CONSOLE_OUTPUT_BUFFER_SIZE;
+		while (nexthead == cs->cs_outbuf_tail) {
+			con_kick(cs);
+			wchan_sleep(cs->cs_outwchan, &cs->cs_outlock);
+		}
+		cs->cs_outbuf[cs->cs_outbuf_head] = buf[i];
+		cs->cs_outbuf_head = nexthead;
+	}
+	con_kick(cs);
+	spinlock_release(&cs->cs_outlock);
+}
+
 /*
  * Print a character, using interrupts to wait for I/O completion.
  */
@@ -129,8 +186,9 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	char c = ch;
+
+	putbuf_intr(cs, &c, 1);
 }
 
 /*
@@ -174,6 +232,7 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 
 	V(cs->cs_rsem);
+	pollq_wakeup(&cs->cs_pollq);
 }
 
 /*
@@ -184,7 +243,10 @@ con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	spinlock_acquire(&cs->cs_outlock);
+	cs->cs_outbusy = false;
+	con_kick(cs);
+	spinlock_release(&cs->cs_outlock);
 }
 
 //////////////////////////////////////////////////
@@ -240,6 +302,42 @@ con_eachopen(struct device *dev, int openflags)
 	return 0;
 }
 
+/*
+ * User output is copied in this many bytes at a time.
+ */
+#define CON_WRITECHUNK 128
+
+/*
+ * Write out the rest of UIO, with \n turned into \r\n.
+ */
+static
+int
+con_write(struct con_softc *cs, struct uio *uio)
+{
+	char in[CON_WRITECHUNK], out[2 * CON_WRITECHUNK];
+	size_t len, i, n;
+	int result;
+
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > sizeof(in)) {
+			len = sizeof(in);
+		}
+		result = uiomove(in, len, uio);
+		if (result) {
+			return result;
+		}
+		for (i=n=0; i<len; i++) {
+			if (in[i]=='\n') {
+				out[n++] = '\r';
+			}
+			out[n++] = in[i];
+		}
+		putbuf_intr(cs, out, n);
+	}
+	return 0;
+}
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
@@ -248,8 +346,6 @@ con_io(struct device *dev, struct uio *uio)
 	char ch;
 	struct lock *lk;
 
-	(void)dev;  // unused
-
 	if (uio->uio_rw==UIO_READ) {
 		lk = con_userlock_read;
 	}
@@ -260,31 +356,24 @@ con_io(struct device *dev, struct uio *uio)
 	KASSERT(lk != NULL);
 	lock_acquire(lk);
 
+	if (uio->uio_rw==UIO_WRITE) {
+		result = con_write(dev->d_data, uio);
+		lock_release(lk);
+		return result;
+	}
+
 	while (uio->uio_resid > 0) {
-		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
-			if (ch=='\r') {
-				ch = '\n';
-			}
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				break;
-			}
+		ch = getch();
+		if (ch=='\r') {
+			ch = '\n';
 		}
-		else {
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
+		result = uiomove(&ch, 1, uio);
+		if (result) {
+			lock_release(lk);
+			return result;
+		}
+		if (ch=='\n') {
+			break;
 		}
 	}
 	lock_release(lk);
@@ -302,10 +391,36 @@ con_ioctl(struct device *dev, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * Poll: readable with input buffered, writable with room in the
+ * output buffer.
+ */
+static
+int
+con_poll(struct device *dev, int events, struct pollset *ps)
+{
+	struct con_softc *cs = dev->d_data;
+	int revents = 0;
+
+	poll_wait(ps, &cs->cs_pollq);
+
+	if (cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+		revents |= events & POLLIN;
+	}
+	spinlock_acquire(&cs->cs_outlock);
+	if ((cs->cs_outbuf_head + 1) % CONSOLE_OUTPUT_BUFFER_SIZE !=
+	    cs->cs_outbuf_tail) {
+		revents |= events & POLLOUT;
+	}
+	spinlock_release(&cs->cs_outlock);
+	return revents;
+}
+
 static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+	.devop_poll = con_poll,
 };
 
 static
@@ -315,7 +430,7 @@ attach_console_to_vfs(struct con_softc *cs)
 	struct device *dev;
 	int result;
 
-	dev = kmalloc(sizeof(*dev));
+	dev = kmalloc_tagged(sizeof(*dev), KM_DEV);
 	if (dev==NULL) {
 		return ENOMEM;
 	}
@@ -323,6 +438,7 @@ attach_console_to_vfs(struct con_softc *cs)
 	dev->d_ops = &console_devops;
 	dev->d_blocks = 0;
 	dev->d_blocksize = 1;
+	dev->d_queue = NULL;
 	dev->d_data = cs;
 
 	result = vfs_adddev("con", dev, 0);
@@ -343,7 +459,8 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
+	struct wchan *wc;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -363,29 +480,34 @@ config_con(struct con_softc *cs, int unit)
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
+	wc = wchan_create("console write");
+	if (wc == NULL) {
 		sem_destroy(rsem);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(wc);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(wc);
 		return ENOMEM;
 	}
 
 	cs->cs_rsem = rsem;
-	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	spinlock_init(&cs->cs_outlock);
+	cs->cs_outwchan = wc;
+	cs->cs_outbuf_head = 0;
+	cs->cs_outbuf_tail = 0;
+	cs->cs_outbusy = false;
+	pollq_init(&cs->cs_pollq);
 
 	the_console = cs;
 	con_userlock_read = rlk;
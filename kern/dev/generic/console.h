@@ -38,6 +38,10 @@
  */
 
 #define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024
+
+#include <spinlock.h>
+#include <poll.h>
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -47,10 +51,19 @@ struct con_softc {
 
 	/* initialized by config routine */
 	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+
+	/* output waiting for the device; same conventions as the above */
+	struct spinlock cs_outlock;	/* for the following */
+	struct wchan *cs_outwchan;	/* writers waiting for room */
+	unsigned char cs_outbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_outbuf_head;
+	unsigned cs_outbuf_tail;
+	bool cs_outbusy;		/* the device is sending a char */
+
+	struct pollq cs_pollq;		/* woken on input and on room */
 };
 
 /*
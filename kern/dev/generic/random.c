@@ -31,6 +31,7 @@
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <uio.h>
 #include <vfs.h>
 #include <generic/random.h>
@@ -45,10 +46,98 @@
  * The kernel config mechanism can be used to explicitly choose which
  * of the available random sources to use, if more than one is
  * available.
+ *
+ * Numbers don't come from the source one at a time: reading it is a
+ * device register access per word, which is slow and serializes on
+ * the bus. Instead the source fills a pool of RANDOM_POOLWORDS words
+ * at a time, and random() and reads of the device come from an
+ * xorshift128 generator that's reseeded from the pool every
+ * RANDOM_RESEED numbers. So the source is touched once per
+ * RANDOM_POOLWORDS * RANDOM_RESEED / 4 numbers handed out.
  */
 
+/* Words read from the source per refill. */
+#define RANDOM_POOLWORDS	64
+
+/* Numbers generated between reseeds. */
+#define RANDOM_RESEED		256
+
 static struct random_softc *the_random = NULL;
 
+/* The pool and the generator, under random_lock. */
+static struct spinlock random_lock = SPINLOCK_INITIALIZER;
+static uint32_t random_pool[RANDOM_POOLWORDS];
+static unsigned random_poolpos = RANDOM_POOLWORDS;	/* empty */
+static uint32_t random_state[4];
+static unsigned random_left;		/* numbers until next reseed */
+
+/*
+ * Refill the pool from the source.
+ */
+static
+void
+random_refill(void)
+{
+	struct random_softc *rs = the_random;
+	unsigned i;
+
+	for (i=0; i<RANDOM_POOLWORDS; i++) {
+		random_pool[i] = rs->rs_random(rs->rs_devdata);
+	}
+	random_poolpos = 0;
+}
+
+/*
+ * Stir the next four pool words into the generator state.
+ */
+static
+void
+random_reseed(void)
+{
+	unsigned i;
+
+	KASSERT(RANDOM_POOLWORDS % 4 == 0);
+	if (random_poolpos == RANDOM_POOLWORDS) {
+		random_refill();
+	}
+	for (i=0; i<4; i++) {
+		random_state[i] ^= random_pool[random_poolpos++];
+	}
+	/* xorshift128 must never be all zero */
+	if ((random_state[0] | random_state[1] |
+	     random_state[2] | random_state[3]) == 0) {
+		random_state[0] = 1;
+	}
+	random_left = RANDOM_RESEED;
+}
+
+/*
+ * Produce the next number. Call with random_lock held.
+ */
+static
+uint32_t
+random_next(void)
+{
+	uint32_t t, s;
+
+	KASSERT(spinlock_do_i_hold(&random_lock));
+
+	if (random_left == 0) {
+		random_reseed();
+	}
+	random_left--;
+
+	t = random_state[3];
+	s = random_state[0];
+	random_state[3] = random_state[2];
+	random_state[2] = random_state[1];
+	random_state[1] = s;
+	t ^= t << 11;
+	t ^= t >> 8;
+	random_state[0] = t ^ s ^ (s >> 19);
+	return random_state[0];
+}
+
 /*
  * VFS device functions.
  * open: allow reading only.
@@ -73,13 +162,35 @@ static
 int
 randio(struct device *dev, struct uio *uio)
 {
-	struct random_softc *rs = dev->d_data;
+	uint32_t buf[16];
+	unsigned i;
+	size_t len;
+	int result;
+
+	(void)dev;
 
 	if (uio->uio_rw != UIO_READ) {
 		return EIO;
 	}
 
-	return rs->rs_read(rs->rs_devdata, uio);
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > sizeof(buf)) {
+			len = sizeof(buf);
+		}
+		spinlock_acquire(&random_lock);
+		for (i=0; i<(len + 3) / 4; i++) {
+			buf[i] = random_next();
+		}
+		spinlock_release(&random_lock);
+
+		result = uiomove(buf, len, uio);
+		if (result) {
+			return result;
+		}
+	}
+
+	return 0;
 }
 
 /*
@@ -123,6 +234,7 @@ config_random(struct random_softc *rs, int unit)
 	rs->rs_dev.d_ops = &random_devops;
 	rs->rs_dev.d_blocks = 0;
 	rs->rs_dev.d_blocksize = 1;
+	rs->rs_dev.d_queue = NULL;
 	rs->rs_dev.d_data = rs;
 
 	/* Add the VFS device structure to the VFS device list. */
@@ -142,10 +254,15 @@ config_random(struct random_softc *rs, int unit)
 uint32_t
 random(void)
 {
+	uint32_t ret;
+
 	if (the_random==NULL) {
 		panic("No random device\n");
 	}
-	return the_random->rs_random(the_random->rs_devdata);
+	spinlock_acquire(&random_lock);
+	ret = random_next();
+	spinlock_release(&random_lock);
+	return ret;
 }
 
 uint32_t
@@ -154,5 +271,6 @@ randmax(void)
 	if (the_random==NULL) {
 		panic("No random device\n");
 	}
-	return the_random->rs_randmax(the_random->rs_devdata);
+	/* the generator's output is all 32 bits, whatever the source's is */
+	return 0xffffffff;
 }
@@ -41,7 +41,8 @@
 struct beep_softc *
 attach_beep_to_ltimer(int beepno, struct ltimer_softc *ls)
 {
-	struct beep_softc *bs = kmalloc(sizeof(struct beep_softc));
+	struct beep_softc *bs = kmalloc_tagged(sizeof(struct beep_softc),
+					       KM_DEV);
 	if (bs==NULL) {
 		return NULL;
 	}
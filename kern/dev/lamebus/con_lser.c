@@ -41,7 +41,7 @@
 struct con_softc *
 attach_con_to_lser(int consno, struct lser_softc *ls)
 {
-	struct con_softc *cs = kmalloc(sizeof(struct con_softc));
+	struct con_softc *cs = kmalloc_tagged(sizeof(struct con_softc), KM_DEV);
 	if (cs==NULL) {
 		return NULL;
 	}
@@ -38,6 +38,16 @@
  * This makes it unnecessary to copy the system files to the simulated
  * disk, although we recommend doing so and trying running without this
  * device as part of testing your filesystem.
+ *
+ * The device does one operation at a time through one buffer, so a
+ * read costs a round trip per buffer-load however little of it is
+ * wanted. Reads of files therefore go through a small per-vnode cache
+ * of pages, filled a whole buffer-load (EMU_MAXIO, several pages) at
+ * a time from a page boundary; loading a program, or reading a file
+ * through a small user buffer, then takes one device operation per
+ * EMU_MAXIO bytes. Writing or truncating a file drops its cache.
+ * Files changed on the host behind our back aren't noticed while the
+ * pages stay cached.
  */
 
 #include <types.h>
@@ -49,6 +59,7 @@
 #include <uio.h>
 #include <membar.h>
 #include <synch.h>
+#include <vm.h>
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
@@ -359,14 +370,19 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 
 /*
  * Get the file size associated with a hardware-level file handle.
+ * Like emu_close, can be called with the lock held or not.
  */
 static
 int
 emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 {
 	int result;
+	bool mine;
 
-	lock_acquire(sc->e_lock);
+	mine = lock_do_i_hold(sc->e_lock);
+	if (!mine) {
+		lock_acquire(sc->e_lock);
+	}
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_OPER, EMU_OP_GETSIZE);
@@ -375,7 +391,9 @@ emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 		*retval = emu_rreg(sc, REG_IOLEN);
 	}
 
-	lock_release(sc->e_lock);
+	if (!mine) {
+		lock_release(sc->e_lock);
+	}
 	return result;
 }
 
@@ -404,6 +422,299 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 //
 ////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////
+//
+// Read cache
+//
+// Page N of a file can only be in slot N % EMUFS_CACHEPAGES of its
+// vnode's cache. It's all under the device lock, which the device
+// operations need anyway.
+//
+
+/*
+ * Drop all of a file's cached pages (keeping the memory), and its
+ * size. Call with e_lock held.
+ */
+static
+void
+emufs_cache_invalidate(struct emufs_vnode *ev)
+{
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(ev->ev_emu->e_lock));
+	ev->ev_sizevalid = false;
+	if (ev->ev_cache == NULL) {
+		return;
+	}
+	for (i=0; i<EMUFS_CACHEPAGES; i++) {
+		ev->ev_cache[i].ec_valid = false;
+	}
+}
+
+/*
+ * Free a file's cache.
+ */
+static
+void
+emufs_cache_destroy(struct emufs_vnode *ev)
+{
+	unsigned i;
+
+	if (ev->ev_cache == NULL) {
+		return;
+	}
+	for (i=0; i<EMUFS_CACHEPAGES; i++) {
+		if (ev->ev_cache[i].ec_data != NULL) {
+			kfree(ev->ev_cache[i].ec_data);
+		}
+	}
+	kfree(ev->ev_cache);
+	ev->ev_cache = NULL;
+}
+
+/*
+ * Make sure the slot for page PAGENO has its memory.
+ */
+static
+int
+emufs_cache_slot(struct emufs_vnode *ev, uint32_t pageno,
+		 struct emufs_cpage **ret)
+{
+	struct emufs_cpage *ec;
+	unsigned i;
+
+	if (ev->ev_cache == NULL) {
+		ev->ev_cache = kmalloc_tagged(EMUFS_CACHEPAGES * sizeof(*ev->ev_cache),
+					      KM_DEV);
+		if (ev->ev_cache == NULL) {
+			return ENOMEM;
+		}
+		for (i=0; i<EMUFS_CACHEPAGES; i++) {
+			ev->ev_cache[i].ec_valid = false;
+			ev->ev_cache[i].ec_data = NULL;
+		}
+	}
+	ec = &ev->ev_cache[pageno % EMUFS_CACHEPAGES];
+	if (ec->ec_data == NULL) {
+		ec->ec_data = kmalloc_tagged(PAGE_SIZE, KM_DEV);
+		if (ec->ec_data == NULL) {
+			return ENOMEM;
+		}
+	}
+	*ret = ec;
+	return 0;
+}
+
+/*
+ * Get page PAGENO of a file into the cache, reading a buffer-load
+ * from the start of it if it isn't there, and return it.
+ * Call with e_lock held.
+ */
+static
+int
+emufs_cache_get(struct emufs_vnode *ev, uint32_t pageno,
+		struct emufs_cpage **ret)
+{
+	struct emu_softc *sc = ev->ev_emu;
+	struct emufs_cpage *ec;
+	uint32_t got, pos;
+	unsigned i;
+	int result;
+
+	KASSERT(lock_do_i_hold(sc->e_lock));
+
+	if (ev->ev_cache != NULL) {
+		ec = &ev->ev_cache[pageno % EMUFS_CACHEPAGES];
+		if (ec->ec_valid && ec->ec_pageno == pageno) {
+			*ret = ec;
+			return 0;
+		}
+	}
+
+	/* the first slot needs to be there; the others may as well be */
+	result = emufs_cache_slot(ev, pageno, ret);
+	if (result) {
+		return result;
+	}
+
+	emu_wreg(sc, REG_HANDLE, ev->ev_handle);
+	emu_wreg(sc, REG_IOLEN, EMU_MAXIO);
+	emu_wreg(sc, REG_OFFSET, pageno * PAGE_SIZE);
+	emu_wreg(sc, REG_OPER, EMU_OP_READ);
+	result = emu_waitdone(sc);
+	if (result) {
+		return result;
+	}
+	membar_load_load();
+	got = emu_rreg(sc, REG_IOLEN);
+
+	/* a short first page (maybe empty) is EOF; stop after it */
+	for (i=0, pos=0; i<EMU_MAXIO/PAGE_SIZE; i++, pos += PAGE_SIZE) {
+		if (i > 0 && (pos >= got ||
+			      emufs_cache_slot(ev, pageno + i, &ec) != 0)) {
+			break;
+		}
+		if (i == 0) {
+			ec = *ret;
+		}
+		ec->ec_pageno = pageno + i;
+		ec->ec_len = got - pos < PAGE_SIZE ? got - pos : PAGE_SIZE;
+		memcpy(ec->ec_data, (char *)sc->e_iobuf + pos, ec->ec_len);
+		ec->ec_valid = true;
+		if (ec->ec_len < PAGE_SIZE) {
+			break;
+		}
+	}
+	return 0;
+}
+
+//
+////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+//
+// Metadata cache
+//
+// Every lookup is an open on the host, which makes a new handle and
+// so a new vnode, and then stat asks the host for the size again;
+// exec and ls do both over and over for the same few names. So
+// directories remember the last EMUFS_NAMES names looked up in them,
+// each with a reference to the vnode it came to, which keeps that
+// vnode (and whatever's cached on it) around for the next lookup.
+// Files remember their size until the kernel writes or truncates
+// them. Changes made on the host side behind our back aren't seen, as
+// with the read cache. It's all under e_lock again; references are
+// dropped without it, as that can reclaim.
+//
+
+/*
+ * Look up NAME in DIR's cache. Returns its vnode, with a reference
+ * for the caller, or NULL.
+ */
+static
+struct emufs_vnode *
+emufs_names_get(struct emufs_vnode *dir, const char *name)
+{
+	struct emufs_vnode *ev;
+	unsigned i;
+
+	ev = NULL;
+	lock_acquire(dir->ev_emu->e_lock);
+	if (dir->ev_names != NULL) {
+		for (i=0; i<EMUFS_NAMES; i++) {
+			if (dir->ev_names[i].en_vnode != NULL &&
+			    !strcmp(dir->ev_names[i].en_name, name)) {
+				ev = dir->ev_names[i].en_vnode;
+				VOP_INCREF(&ev->ev_v);
+				break;
+			}
+		}
+	}
+	lock_release(dir->ev_emu->e_lock);
+	return ev;
+}
+
+/*
+ * Remember that NAME in DIR is EV, replacing the oldest entry. Long
+ * names, and names when there's no memory, just aren't cached.
+ */
+static
+void
+emufs_names_add(struct emufs_vnode *dir, const char *name,
+		struct emufs_vnode *ev)
+{
+	struct emufs_name *en;
+	struct emufs_vnode *old;
+	unsigned i;
+
+	if (strlen(name) + 1 > sizeof(en->en_name)) {
+		return;
+	}
+
+	lock_acquire(dir->ev_emu->e_lock);
+	if (dir->ev_names == NULL) {
+		dir->ev_names = kmalloc_tagged(EMUFS_NAMES * sizeof(*dir->ev_names),
+					       KM_DEV);
+		if (dir->ev_names == NULL) {
+			lock_release(dir->ev_emu->e_lock);
+			return;
+		}
+		for (i=0; i<EMUFS_NAMES; i++) {
+			dir->ev_names[i].en_name[0] = 0;
+			dir->ev_names[i].en_vnode = NULL;
+		}
+		dir->ev_namenext = 0;
+	}
+	for (i=0; i<EMUFS_NAMES; i++) {
+		if (dir->ev_names[i].en_vnode != NULL &&
+		    !strcmp(dir->ev_names[i].en_name, name)) {
+			/* someone else looked it up meanwhile */
+			lock_release(dir->ev_emu->e_lock);
+			return;
+		}
+	}
+
+	en = &dir->ev_names[dir->ev_namenext];
+	dir->ev_namenext = (dir->ev_namenext + 1) % EMUFS_NAMES;
+	old = en->en_vnode;
+	strcpy(en->en_name, name);
+	VOP_INCREF(&ev->ev_v);
+	en->en_vnode = ev;
+	lock_release(dir->ev_emu->e_lock);
+
+	if (old != NULL) {
+		VOP_DECREF(&old->ev_v);
+	}
+}
+
+/*
+ * Forget DIR's names, when it's being reclaimed. Call without e_lock.
+ */
+static
+void
+emufs_names_destroy(struct emufs_vnode *dir)
+{
+	unsigned i;
+
+	if (dir->ev_names == NULL) {
+		return;
+	}
+	for (i=0; i<EMUFS_NAMES; i++) {
+		if (dir->ev_names[i].en_vnode != NULL) {
+			VOP_DECREF(&dir->ev_names[i].en_vnode->ev_v);
+		}
+	}
+	kfree(dir->ev_names);
+	dir->ev_names = NULL;
+}
+
+/*
+ * Get a file's size, from the cache if we can.
+ */
+static
+int
+emufs_getsize(struct emufs_vnode *ev, off_t *ret)
+{
+	struct emu_softc *sc = ev->ev_emu;
+	int result;
+
+	lock_acquire(sc->e_lock);
+	if (!ev->ev_sizevalid) {
+		result = emu_getsize(sc, ev->ev_handle, &ev->ev_size);
+		if (result) {
+			lock_release(sc->e_lock);
+			return result;
+		}
+		ev->ev_sizevalid = true;
+	}
+	*ret = ev->ev_size;
+	lock_release(sc->e_lock);
+	return 0;
+}
+
+//
+////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////
 //
 // vnode functions
@@ -473,31 +784,25 @@ emufs_reclaim(struct vnode *v)
 	int result;
 
 	/*
-	 * Need all of these locks, e_lock to protect the device,
-	 * vfs_biglock to protect the fs-related material, and
-	 * vn_countlock for the reference count.
+	 * Need both of these locks, e_lock to protect the device, and
+	 * vfs_biglock to protect the fs-related material.
 	 */
 
 	vfs_biglock_acquire();
 	lock_acquire(ef->ef_emu->e_lock);
-	spinlock_acquire(&ev->ev_v.vn_countlock);
-
-	if (ev->ev_v.vn_refcount > 1) {
-		/* consume the reference VOP_DECREF passed us */
-		ev->ev_v.vn_refcount--;
 
-		spinlock_release(&ev->ev_v.vn_countlock);
+	if (vnode_decref_unless_last(&ev->ev_v)) {
+		/* that consumed the reference VOP_DECREF passed us */
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
-	KASSERT(ev->ev_v.vn_refcount == 1);
 
 	/*
 	 * Since we hold e_lock and are the last ref, nobody can increment
-	 * the refcount, so we can release vn_countlock.
+	 * the refcount.
 	 */
-	spinlock_release(&ev->ev_v.vn_countlock);
+	KASSERT(ev->ev_v.vn_refcount == 1);
 
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
@@ -529,24 +834,24 @@ emufs_reclaim(struct vnode *v)
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
+	emufs_cache_destroy(ev);
+	emufs_names_destroy(ev);
 	kfree(ev);
 	return 0;
 }
 
 /*
- * VOP_READ
+ * VOP_READ, the slow way: straight from the device, for when there's
+ * no memory for the cache.
  */
 static
 int
-emufs_read(struct vnode *v, struct uio *uio)
+emufs_read_uncached(struct emufs_vnode *ev, struct uio *uio)
 {
-	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
 	size_t oldresid;
 	int result;
 
-	KASSERT(uio->uio_rw==UIO_READ);
-
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -569,6 +874,55 @@ emufs_read(struct vnode *v, struct uio *uio)
 	return 0;
 }
 
+/*
+ * VOP_READ
+ */
+static
+int
+emufs_read(struct vnode *v, struct uio *uio)
+{
+	struct emufs_vnode *ev = v->vn_data;
+	struct emu_softc *sc = ev->ev_emu;
+	struct emufs_cpage *ec;
+	uint32_t pgoff, amt;
+	int result = 0;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	lock_acquire(sc->e_lock);
+	while (uio->uio_resid > 0) {
+		if (uio->uio_offset > (off_t)0xffffffff) {
+			/* beyond the largest size the file can have */
+			break;
+		}
+		result = emufs_cache_get(ev, uio->uio_offset / PAGE_SIZE, &ec);
+		if (result == ENOMEM) {
+			lock_release(sc->e_lock);
+			return emufs_read_uncached(ev, uio);
+		}
+		if (result) {
+			break;
+		}
+
+		pgoff = uio->uio_offset % PAGE_SIZE;
+		if (pgoff >= ec->ec_len) {
+			/* EOF */
+			break;
+		}
+		amt = ec->ec_len - pgoff;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+		result = uiomove(ec->ec_data + pgoff, amt, uio);
+		if (result) {
+			break;
+		}
+	}
+	lock_release(sc->e_lock);
+
+	return result;
+}
+
 /*
  * VOP_READDIR
  */
@@ -612,6 +966,12 @@ emufs_write(struct vnode *v, struct uio *uio)
 		oldresid = uio->uio_resid;
 
 		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
+
+		/* (after; a read in between would cache the old data) */
+		lock_acquire(ev->ev_emu->e_lock);
+		emufs_cache_invalidate(ev);
+		lock_release(ev->ev_emu->e_lock);
+
 		if (result) {
 			return result;
 		}
@@ -655,7 +1015,7 @@ emufs_stat(struct vnode *v, struct stat *statbuf)
 
 	bzero(statbuf, sizeof(struct stat));
 
-	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
+	result = emufs_getsize(ev, &statbuf->st_size);
 	if (result) {
 		return result;
 	}
@@ -725,7 +1085,15 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	int result;
+
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+
+	lock_acquire(ev->ev_emu->e_lock);
+	emufs_cache_invalidate(ev);
+	lock_release(ev->ev_emu->e_lock);
+
+	return result;
 }
 
 /*
@@ -754,6 +1122,7 @@ emufs_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
 		emu_close(ev->ev_emu, handle);
 		return result;
 	}
+	emufs_names_add(ev, name, newguy);
 
 	*ret = &newguy->ev_v;
 	return 0;
@@ -773,6 +1142,12 @@ emufs_lookup(struct vnode *dir, char *pathname, struct vnode **ret)
 	int result;
 	int isdir;
 
+	newguy = emufs_names_get(ev, pathname);
+	if (newguy != NULL) {
+		*ret = &newguy->ev_v;
+		return 0;
+	}
+
 	result = emu_open(ev->ev_emu, ev->ev_handle, pathname, false, false, 0,
 			  &handle, &isdir);
 	if (result) {
@@ -784,6 +1159,7 @@ emufs_lookup(struct vnode *dir, char *pathname, struct vnode **ret)
 		emu_close(ev->ev_emu, handle);
 		return result;
 	}
+	emufs_names_add(ev, pathname, newguy);
 
 	*ret = &newguy->ev_v;
 	return 0;
@@ -845,13 +1221,16 @@ emufs_namefile(struct vnode *v, struct uio *uio)
 
 /*
  * VOP_MMAP
+ *
+ * Files on the emulator filesystem can be mapped; the VM system pages
+ * them in and out through emufs_read and emufs_write.
  */
 static
 int
 emufs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 //////////////////////////////
@@ -1081,12 +1460,17 @@ static const struct vnode_ops emufs_fileops = {
 	.vop_read = emufs_read,
 	.vop_readlink = emufs_readlink_notlink,
 	.vop_getdirentry = emufs_uio_op_notdir,
+	.vop_getdirentries = emufs_uio_op_notdir,
 	.vop_write = emufs_write,
 	.vop_ioctl = emufs_ioctl,
 	.vop_stat = emufs_stat,
 	.vop_gettype = emufs_file_gettype,
 	.vop_isseekable = emufs_isseekable,
 	.vop_fsync = emufs_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = vnode_poll_always,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_nosys,
 	.vop_mmap = emufs_mmap,
 	.vop_truncate = emufs_truncate,
 	.vop_namefile = emufs_uio_op_notdir,
@@ -1115,12 +1499,17 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_read = emufs_uio_op_isdir,
 	.vop_readlink = emufs_uio_op_isdir,
 	.vop_getdirentry = emufs_getdirentry,
+	.vop_getdirentries = vnode_getdirentries_slow,
 	.vop_write = emufs_uio_op_isdir,
 	.vop_ioctl = emufs_ioctl,
 	.vop_stat = emufs_stat,
 	.vop_gettype = emufs_dir_gettype,
 	.vop_isseekable = emufs_isseekable,
 	.vop_fsync = emufs_void_op_isdir,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = vnode_poll_always,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_isdir,
 	.vop_mmap = emufs_void_op_isdir,
 	.vop_truncate = emufs_truncate_isdir,
 	.vop_namefile = emufs_namefile,
@@ -1171,7 +1560,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	/* Didn't have one; create it */
 
-	ev = kmalloc(sizeof(struct emufs_vnode));
+	ev = kmalloc_tagged(sizeof(struct emufs_vnode), KM_DEV);
 	if (ev==NULL) {
 		lock_release(ef->ef_emu->e_lock);
 		return ENOMEM;
@@ -1179,6 +1568,11 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_cache = NULL;
+	ev->ev_names = NULL;
+	ev->ev_namenext = 0;
+	ev->ev_size = 0;
+	ev->ev_sizevalid = false;
 
 	result = vnode_init(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			    &ef->ef_fs, ev);
@@ -1293,7 +1687,7 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 	struct emufs_fs *ef;
 	int result;
 
-	ef = kmalloc(sizeof(struct emufs_fs));
+	ef = kmalloc_tagged(sizeof(struct emufs_fs), KM_DEV);
 	if (ef==NULL) {
 		return ENOMEM;
 	}
@@ -50,7 +50,7 @@ attach_emu_to_lamebus(int emuno, struct lamebus_softc *sc)
 		return NULL;
 	}
 
-	es = kmalloc(sizeof(struct emu_softc));
+	es = kmalloc_tagged(sizeof(struct emu_softc), KM_DEV);
 	if (es==NULL) {
 		return NULL;
 	}
@@ -32,11 +32,14 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <cpu.h>
 #include <membar.h>
 #include <spinlock.h>
 #include <current.h>
+#include <mainbus.h>
+#include <stats.h>
 #include <lamebus/lamebus.h>
 
 /* Register offsets within each config region */
@@ -160,26 +163,26 @@ lamebus_find_cpus(struct lamebus_softc *lamebus)
 		}
 	}
 
+	/* the software numbers they get: boot cpu 0, the rest in order */
+	lamebus->ls_numcpus = 0;
+	lamebus->ls_hwnum[lamebus->ls_numcpus++] = hwnum[bootcpu];
 	for (i=0; i<numcpus; i++) {
 		if (i != bootcpu) {
 			cpu_create(hwnum[i]);
+			lamebus->ls_hwnum[lamebus->ls_numcpus++] = hwnum[i];
 		}
 	}
 
 	/*
-	 * By default, route all interrupts only to the boot cpu. We
-	 * could be arbitrarily more elaborate, up to things like
-	 * dynamic load balancing.
+	 * By default, route all interrupts only to the boot cpu;
+	 * lamebus_route_interrupt can move them one slot at a time.
 	 */
 
 	for (i=0; i<numcpus; i++) {
-		if (i != bootcpu) {
-			val = 0;
-		}
-		else {
-			val = 0xffffffff;
-		}
-		write_ctlcpu_register(lamebus, hwnum[i], CTLCPU_CIRQE, val);
+		val = i == 0 ? 0xffffffff : 0;
+		lamebus->ls_cpuirqs[i] = val;
+		write_ctlcpu_register(lamebus, lamebus->ls_hwnum[i],
+				      CTLCPU_CIRQE, val);
 	}
 }
 
@@ -425,6 +428,57 @@ lamebus_unmask_interrupt(struct lamebus_softc *lamebus, int slot)
 	spinlock_release(&lamebus->ls_lock);
 }
 
+int
+lamebus_route_interrupt(struct lamebus_softc *lamebus, int slot,
+			unsigned cpunum)
+{
+	uint32_t mask = ((uint32_t)1) << slot;
+	unsigned i;
+
+	if (slot < 0 || slot >= LB_NSLOTS) {
+		return EINVAL;
+	}
+	if (lamebus->ls_uniprocessor) {
+		/* nowhere else for them to go */
+		return cpunum == 0 ? 0 : EINVAL;
+	}
+	if (cpunum >= lamebus->ls_numcpus) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&lamebus->ls_lock);
+	for (i=0; i<lamebus->ls_numcpus; i++) {
+		if (i == cpunum) {
+			lamebus->ls_cpuirqs[i] |= mask;
+		}
+		else {
+			lamebus->ls_cpuirqs[i] &= ~mask;
+		}
+		write_ctlcpu_register(lamebus, lamebus->ls_hwnum[i],
+				      CTLCPU_CIRQE, lamebus->ls_cpuirqs[i]);
+	}
+	spinlock_release(&lamebus->ls_lock);
+	return 0;
+}
+
+/*
+ * Number of the lowest set bit in a nonzero word.
+ */
+static
+inline
+int
+lamebus_lowbit(uint32_t x)
+{
+	int n = 0;
+
+	KASSERT(x != 0);
+	if ((x & 0xffff) == 0) { n += 16; x >>= 16; }
+	if ((x & 0xff) == 0)   { n += 8;  x >>= 8; }
+	if ((x & 0xf) == 0)    { n += 4;  x >>= 4; }
+	if ((x & 0x3) == 0)    { n += 2;  x >>= 2; }
+	if ((x & 0x1) == 0)    { n += 1; }
+	return n;
+}
 
 /*
  * LAMEbus interrupt handling function. (Machine-independent!)
@@ -441,13 +495,21 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 	 *
 	 * Note that the entire LAMEbus uses only one on-cpu interrupt line.
 	 * Thus, we do not use any on-cpu interrupt priority system either.
+	 *
+	 * Only slots routed to this cpu are looked at (others may be
+	 * asserting interrupts for other cpus to take), and only the
+	 * ones pending; each pass takes the lowest one above the slot
+	 * just handled, so one busy device can't starve the rest.
 	 */
 
 	int slot;
 	uint32_t mask;
-	uint32_t irqs;
+	uint32_t irqs, mine;
 	void (*handler)(void *);
 	void *data;
+#if OPT_IRQSTATS
+	uint64_t start;
+#endif
 
 	/* For keeping track of how many bogus things happen in a row. */
 	static int duds = 0;
@@ -463,7 +525,13 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 	 * Read the LAMEbus controller register that tells us which
 	 * slots are asserting an interrupt condition.
 	 */
-	irqs = read_ctl_register(lamebus, CTLREG_IRQS);
+	if (lamebus->ls_uniprocessor) {
+		mine = 0xffffffff;
+	}
+	else {
+		mine = lamebus->ls_cpuirqs[curcpu->c_number];
+	}
+	irqs = read_ctl_register(lamebus, CTLREG_IRQS) & mine;
 
 	if (irqs == 0) {
 		/*
@@ -488,15 +556,15 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 	}
 
 	/*
-	 * Go through the bits in the value we got back to see which
-	 * ones are set.
+	 * Go through the bits that are set in the value we got back.
 	 */
 
-	for (mask=1, slot=0; slot<LB_NSLOTS; mask<<=1, slot++) {
-		if ((irqs & mask) == 0) {
-			/* Nope. */
-			continue;
-		}
+	while (irqs != 0) {
+		slot = lamebus_lowbit(irqs);
+		mask = ((uint32_t)1) << slot;
+
+		/* whatever happens, only the slots above are left */
+		irqs &= ~(mask | (mask - 1));
 
 		/*
 		 * This slot is signalling an interrupt.
@@ -530,7 +598,14 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 		data = lamebus->ls_devdata[slot];
 		spinlock_release(&lamebus->ls_lock);
 
+#if OPT_IRQSTATS
+		start = mainbus_cycles_irqoff();
+#endif
 		handler(data);
+#if OPT_IRQSTATS
+		stats_hist(STAT_HIST_SLOT(slot),
+			   mainbus_cycles_irqoff() - start);
+#endif
 
 		spinlock_acquire(&lamebus->ls_lock);
 
@@ -538,9 +613,14 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 		 * Reload the mask of pending IRQs - if we just called
 		 * hardclock, we might not have come back to this
 		 * context for some time, and it might have changed.
+		 * (Our routing might have, too.)
 		 */
 
-		irqs = read_ctl_register(lamebus, CTLREG_IRQS);
+		if (!lamebus->ls_uniprocessor) {
+			mine = lamebus->ls_cpuirqs[curcpu->c_number];
+		}
+		irqs = read_ctl_register(lamebus, CTLREG_IRQS) & mine &
+			~(mask | (mask - 1));
 	}
 
 
@@ -642,7 +722,7 @@ lamebus_init(void)
 	int i;
 
 	/* Allocate space for lamebus data */
-	lamebus = kmalloc(sizeof(struct lamebus_softc));
+	lamebus = kmalloc_tagged(sizeof(struct lamebus_softc), KM_DEV);
 	if (lamebus==NULL) {
 		panic("lamebus_init: Out of memory\n");
 	}
@@ -660,6 +740,11 @@ lamebus_init(void)
 	}
 
 	lamebus->ls_uniprocessor = 0;
+	lamebus->ls_numcpus = 1;
+	lamebus->ls_hwnum[0] = 0;
+	for (i=0; i<LB_NCPUS; i++) {
+		lamebus->ls_cpuirqs[i] = 0xffffffff;
+	}
 
 	return lamebus;
 }
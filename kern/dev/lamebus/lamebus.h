@@ -61,6 +61,9 @@
 /* Number of slots */
 #define LB_NSLOTS            32
 
+/* Most CPUs */
+#define LB_NCPUS             32
+
 /* LAMEbus controller per-slot config space */
 #define LB_CONFIG_SIZE       1024
 
@@ -87,8 +90,13 @@ struct lamebus_softc {
 	void        *ls_devdata[LB_NSLOTS];
 	lb_irqfunc   ls_irqfuncs[LB_NSLOTS];
 
+	/* Slots each cpu takes interrupts from, by software cpu number */
+	uint32_t     ls_cpuirqs[LB_NCPUS];
+
 	/* Read-only once set early in boot */
 	unsigned     ls_uniprocessor;
+	unsigned     ls_numcpus;
+	unsigned     ls_hwnum[LB_NCPUS];	/* by software cpu number */
 };
 
 /*
@@ -142,6 +150,14 @@ void lamebus_detach_interrupt(struct lamebus_softc *, int slot);
 void lamebus_mask_interrupt(struct lamebus_softc *, int slot);
 void lamebus_unmask_interrupt(struct lamebus_softc *, int slot);
 
+/*
+ * Send a slot's interrupts to one cpu (by software number) and no
+ * other. They all go to the boot cpu until this is called. Returns
+ * EINVAL if there's no such cpu or slot.
+ */
+int lamebus_route_interrupt(struct lamebus_softc *, int slot,
+			    unsigned cpunum);
+
 /*
  * Function to call to handle a LAMEbus interrupt.
  */
@@ -39,6 +39,7 @@
 #include <synch.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <blkq.h>
 #include <lamebus/lhd.h>
 #include "autoconf.h"
 
@@ -180,55 +181,38 @@ lhd_reset(struct lhd_softc *lh)
 #endif
 
 /*
- * I/O function (for both reads and writes)
+ * Do one request: called only from the request queue's thread, so
+ * nobody else is using the device.
+ *
+ * The on-card buffer (at LHD_BUFFER in our slot) holds one sector,
+ * and the disk does one sector per command, so this is a command and
+ * an interrupt per sector.
  */
 static
 int
-lhd_io(struct device *d, struct uio *uio)
+lhd_doio(void *vlh, uint32_t sector, uint32_t nsect, void *buf, bool write)
 {
-	struct lhd_softc *lh = d->d_data;
-
-	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
-	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
-	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
-	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
+	struct lhd_softc *lh = vlh;
+	char *data = buf;
 	uint32_t i;
 	uint32_t statval = LHD_WORKING;
 	int result;
 
-	/* Don't allow I/O that isn't sector-aligned. */
-	if (sectoff != 0 || lenoff != 0) {
-		return EINVAL;
-	}
-
-	/* Don't allow I/O past the end of the disk. */
-	/* XXX this check can overflow */
-	if (sector+len > lh->lh_dev.d_blocks) {
-		return EINVAL;
-	}
-
 	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
+	if (write) {
 		statval |= LHD_ISWRITE;
 	}
 
 	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	for (i=0; i<nsect; i++) {
 
 		/*
 		 * Are we writing? If so, transfer the data to the
 		 * on-card buffer.
 		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		if (write) {
+			memcpy(lh->lh_buf, data + i*LHD_SECTSIZE, LHD_SECTSIZE);
 			membar_store_store();
-			if (result) {
-				V(lh->lh_clear);
-				return result;
-			}
 		}
 
 		/* Tell it what sector we want... */
@@ -242,26 +226,55 @@ lhd_io(struct device *d, struct uio *uio)
 
 		/* Get the result value saved by the interrupt handler. */
 		result = lh->lh_result;
+		if (result) {
+			return result;
+		}
 
 		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
+		 * Are we reading? If so, transfer the data out of the
+		 * on-card buffer.
 		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
+		if (!write) {
 			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+			memcpy(data + i*LHD_SECTSIZE, lh->lh_buf, LHD_SECTSIZE);
 		}
+	}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
+	return 0;
+}
 
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
-		}
+/*
+ * I/O function (for both reads and writes). The request goes on the
+ * disk's queue (see blkq.h), which puts requests from everyone using
+ * the disk in an order that saves seeking and sends runs of them to
+ * lhd_doio.
+ */
+static
+int
+lhd_io(struct device *d, struct uio *uio)
+{
+	struct lhd_softc *lh = d->d_data;
+
+	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
+	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
+	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
+	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
+
+	/* Don't allow I/O that isn't sector-aligned. */
+	if (sectoff != 0 || lenoff != 0) {
+		return EINVAL;
 	}
 
-	return 0;
+	/* Don't allow I/O past the end of the disk. */
+	/* XXX this check can overflow */
+	if (sector+len > lh->lh_dev.d_blocks) {
+		return EINVAL;
+	}
+
+	if (len == 0) {
+		return 0;
+	}
+	return blkq_uio(lh->lh_queue, uio);
 }
 
 static const struct device_ops lhd_devops = {
@@ -284,15 +297,16 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
+	/* Create the semaphore and the request queue. */
 	lh->lh_done = sem_create("lhd-done", 0);
 	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+		return ENOMEM;
+	}
+	snprintf(lh->lh_qname, sizeof(lh->lh_qname), "%s-queue", name);
+	lh->lh_queue = blkq_create(lh->lh_qname, lhd_doio, lh, LHD_SECTSIZE);
+	if (lh->lh_queue == NULL) {
+		sem_destroy(lh->lh_done);
+		lh->lh_done = NULL;
 		return ENOMEM;
 	}
 
@@ -301,6 +315,7 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	lh->lh_dev.d_blocks = bus_read_register(lh->lh_busdata, lh->lh_buspos,
 						LHD_REG_NSECT);
 	lh->lh_dev.d_blocksize = LHD_SECTSIZE;
+	lh->lh_dev.d_queue = lh->lh_queue;
 	lh->lh_dev.d_data = lh;
 
 	/* Add the VFS device structure to the VFS device list. */
@@ -32,6 +32,8 @@
 
 #include <device.h>
 
+struct blkq;
+
 /*
  * Our sector size
  */
@@ -52,8 +54,9 @@ struct lhd_softc {
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
 	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct semaphore *lh_done;	/* Synchronization */
+	struct blkq *lh_queue;		/* Requests (see blkq.h) */
+	char lh_qname[16];		/* (the queue's name) */
 
 	struct device lh_dev;		/* VFS device structure */
 };
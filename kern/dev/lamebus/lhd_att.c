@@ -50,7 +50,7 @@ attach_lhd_to_lamebus(int lhdno, struct lamebus_softc *sc)
 		return NULL;
 	}
 
-	lh = kmalloc(sizeof(struct lhd_softc));
+	lh = kmalloc_tagged(sizeof(struct lhd_softc), KM_DEV);
 	if (lh==NULL) {
 		/* Out of memory */
 		return NULL;
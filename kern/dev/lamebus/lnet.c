@@ -27,20 +27,241 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * LAMEbus network card driver.
+ *
+ * The card has one receive buffer and one transmit buffer, each big
+ * enough for a frame. A received frame is copied straight from the
+ * receive buffer into a netbuf, in the interrupt handler, and handed
+ * up; the card can take the next one as soon as the copy is done.
+ * Outgoing frames are queued on a ring and fed to the card one at a
+ * time, each from the transmit-complete interrupt of the one before,
+ * so a sender only waits when the ring is full.
+ */
 #include <types.h>
 #include <kern/errno.h>
+#include <endian.h>
 #include <lib.h>
-/*#include <lamebus/lnet.h>*/ /* not yet */
+#include <spinlock.h>
+#include <wchan.h>
+#include <platform/bus.h>
+#include <lamebus/lnet.h>
 #include "autoconf.h"
 
+/* Registers (offsets within slot) */
+#define LNET_REG_RIRQ    0	/* Receive interrupt */
+#define LNET_REG_WIRQ    4	/* Transmit interrupt */
+#define LNET_REG_CTL     8	/* Control */
+#define LNET_REG_STAT    12	/* Status; low 16 bits are our address */
+
+/* Bits in the interrupt registers */
+#define LNET_IRQ_DONE    1
+
+/* Bits in the control register */
+#define LNET_CTL_PROMISC 1	/* Receive everything */
+#define LNET_CTL_START   2	/* Send the frame in the transmit buffer */
+
+/* Buffers (offsets within slot) */
+#define LNET_RXBUF       32768
+#define LNET_TXBUF       49152
+#define LNET_BUFSIZE     4096
+
+/* Every frame starts with this */
+#define LNET_MAGIC       0xa4b3c2d1
+
+struct lnet_hdr {
+	uint32_t lh_magic;
+	uint16_t lh_from;
+	uint16_t lh_len;		/* of the whole frame */
+	uint16_t lh_to;
+	uint16_t lh_pad;
+};
+
+/*
+ * Shortcut for reading a register.
+ */
+static
+inline
+uint32_t lnet_rdreg(struct lnet_softc *ln, uint32_t reg)
+{
+	return bus_read_register(ln->ln_busdata, ln->ln_buspos, reg);
+}
+
+/*
+ * Shortcut for writing a register.
+ */
+static
+inline
+void lnet_wreg(struct lnet_softc *ln, uint32_t reg, uint32_t val)
+{
+	bus_write_register(ln->ln_busdata, ln->ln_buspos, reg, val);
+}
+
+/*
+ * If the card is idle and there's something on the ring, start it
+ * sending. Call with ln_lock held.
+ */
+static
+void
+lnet_kick(struct lnet_softc *ln)
+{
+	struct netbuf *nb;
+
+	KASSERT(spinlock_do_i_hold(&ln->ln_lock));
+
+	if (ln->ln_txbusy || ln->ln_txcount == 0) {
+		return;
+	}
+
+	nb = ln->ln_txring[ln->ln_txhead];
+	ln->ln_txring[ln->ln_txhead] = NULL;
+	ln->ln_txhead = (ln->ln_txhead + 1) % LNET_TXRING;
+	ln->ln_txcount--;
+
+	memcpy(ln->ln_txbuf, nb->nb_data, nb->nb_len);
+	ln->ln_txbusy = true;
+	lnet_wreg(ln, LNET_REG_CTL, LNET_CTL_START);
+
+	/* The card has its own copy now. */
+	netbuf_put(nb);
+	wchan_wakeall(ln->ln_txwchan, &ln->ln_lock);
+}
+
+/*
+ * Take a received frame off the card. Returns the netbuf it was put
+ * in, or NULL if it was bad or there was nowhere to put it. Call with
+ * ln_lock held.
+ */
+static
+struct netbuf *
+lnet_receive(struct lnet_softc *ln, uint16_t *from)
+{
+	struct lnet_hdr lh;
+	struct netbuf *nb;
+	unsigned len;
+
+	memcpy(&lh, ln->ln_rxbuf, sizeof(lh));
+	len = ntohs(lh.lh_len);
+	if (ntohl(lh.lh_magic) != LNET_MAGIC ||
+	    len < sizeof(lh) || len > LNET_BUFSIZE) {
+		return NULL;
+	}
+
+	nb = netbuf_get(false);
+	if (nb == NULL) {
+		ln->ln_rxdrops++;
+		return NULL;
+	}
+	memcpy(nb->nb_data, ln->ln_rxbuf, len);
+	nb->nb_len = len;
+	*from = ntohs(lh.lh_from);
+	return nb;
+}
+
+/*
+ * Interrupt handler.
+ */
+void
+lnet_irq(void *vln)
+{
+	struct lnet_softc *ln = vln;
+	struct netbuf *nb = NULL;
+	uint16_t from = 0;
+
+	spinlock_acquire(&ln->ln_lock);
+	if (lnet_rdreg(ln, LNET_REG_RIRQ) & LNET_IRQ_DONE) {
+		nb = lnet_receive(ln, &from);
+		/* the receive buffer is free again */
+		lnet_wreg(ln, LNET_REG_RIRQ, 0);
+	}
+	if (lnet_rdreg(ln, LNET_REG_WIRQ) & LNET_IRQ_DONE) {
+		lnet_wreg(ln, LNET_REG_WIRQ, 0);
+		ln->ln_txbusy = false;
+		lnet_kick(ln);
+	}
+	spinlock_release(&ln->ln_lock);
+
+	if (nb != NULL) {
+		net_input(&ln->ln_if, nb, from);
+	}
+}
+
+/*
+ * Send a frame (netif's if_output).
+ */
+static
 int
-config_lnet(struct lnet_softc *sc, int lnetno)
+lnet_output(struct netif *ifp, struct netbuf *nb, uint16_t to)
 {
-	(void)sc;
+	struct lnet_softc *ln = ifp->if_data;
+	struct lnet_hdr lh;
+
+	KASSERT(nb->nb_len >= sizeof(lh) && nb->nb_len <= LNET_BUFSIZE);
+
+	lh.lh_magic = htonl(LNET_MAGIC);
+	lh.lh_from = htons(ifp->if_addr);
+	lh.lh_len = htons(nb->nb_len);
+	lh.lh_to = htons(to);
+	lh.lh_pad = 0;
+	memcpy(nb->nb_data, &lh, sizeof(lh));
 
-	kprintf("lnet%d: No network support in system\n", lnetno);
+	spinlock_acquire(&ln->ln_lock);
+	while (ln->ln_txcount == LNET_TXRING) {
+		wchan_sleep(ln->ln_txwchan, &ln->ln_lock);
+	}
+	ln->ln_txring[(ln->ln_txhead + ln->ln_txcount) % LNET_TXRING] = nb;
+	ln->ln_txcount++;
+	lnet_kick(ln);
+	spinlock_release(&ln->ln_lock);
 
-	return ENODEV;
+	return 0;
 }
 
+/*
+ * Setup routine called by autoconf.c when an lnet is found.
+ */
+int
+config_lnet(struct lnet_softc *ln, int lnetno)
+{
+	unsigned i;
+	int result;
+
+	spinlock_init(&ln->ln_lock);
+	for (i=0; i<LNET_TXRING; i++) {
+		ln->ln_txring[i] = NULL;
+	}
+	ln->ln_txhead = 0;
+	ln->ln_txcount = 0;
+	ln->ln_txbusy = false;
+	ln->ln_rxdrops = 0;
+
+	ln->ln_txwchan = wchan_create("lnet");
+	if (ln->ln_txwchan == NULL) {
+		spinlock_cleanup(&ln->ln_lock);
+		return ENOMEM;
+	}
+
+	ln->ln_rxbuf = bus_map_area(ln->ln_busdata, ln->ln_buspos,
+				    LNET_RXBUF);
+	ln->ln_txbuf = bus_map_area(ln->ln_busdata, ln->ln_buspos,
+				    LNET_TXBUF);
 
+	snprintf(ln->ln_name, sizeof(ln->ln_name), "lnet%d", lnetno);
+	ln->ln_if.if_name = ln->ln_name;
+	ln->ln_if.if_addr = lnet_rdreg(ln, LNET_REG_STAT) & 0xffff;
+	ln->ln_if.if_hdrlen = sizeof(struct lnet_hdr);
+	ln->ln_if.if_mtu = LNET_BUFSIZE;
+	ln->ln_if.if_output = lnet_output;
+	ln->ln_if.if_data = ln;
+
+	/* Not promiscuous; nothing to send yet. */
+	lnet_wreg(ln, LNET_REG_CTL, 0);
+
+	result = net_attach(&ln->ln_if);
+	if (result) {
+		wchan_destroy(ln->ln_txwchan);
+		spinlock_cleanup(&ln->ln_lock);
+		return result;
+	}
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LAMEBUS_LNET_H_
+#define _LAMEBUS_LNET_H_
+
+#include <spinlock.h>
+#include <net.h>
+
+/*
+ * Frames waiting to go out, per card.
+ */
+#define LNET_TXRING  16
+
+/*
+ * Hardware device data associated with lnet (LAMEbus network card)
+ */
+struct lnet_softc {
+	/* Initialized by lower-level attach code */
+	void *ln_busdata;		/* The bus we're on */
+	uint32_t ln_buspos;		/* Our slot on that bus */
+	int ln_unit;			/* What number lnet we are */
+
+	/*
+	 * Initialized by config_lnet
+	 */
+
+	void *ln_rxbuf;			/* On-card receive buffer */
+	void *ln_txbuf;			/* On-card transmit buffer */
+	char ln_name[16];		/* "lnetN" */
+	struct netif ln_if;		/* Network layer's view of us */
+
+	/*
+	 * Transmit ring: frames queued by lnet_output and sent one at
+	 * a time from interrupt handler. Under ln_lock.
+	 */
+	struct spinlock ln_lock;
+	struct netbuf *ln_txring[LNET_TXRING];
+	unsigned ln_txhead;		/* next to send */
+	unsigned ln_txcount;		/* how many are queued */
+	bool ln_txbusy;			/* card is sending one */
+	struct wchan *ln_txwchan;	/* waiting for ring space */
+	unsigned ln_rxdrops;		/* frames lost for lack of netbufs */
+};
+
+/* Functions called by lower-level drivers */
+void lnet_irq(/*struct lnet_softc*/ void *);	/* Interrupt handler */
+
+#endif /* _LAMEBUS_LNET_H_ */
@@ -46,7 +46,7 @@ attach_lrandom_to_lamebus(int lrandomno, struct lamebus_softc *sc)
 		return NULL;
 	}
 
-	lr = kmalloc(sizeof(struct lrandom_softc));
+	lr = kmalloc_tagged(sizeof(struct lrandom_softc), KM_DEV);
 	if (lr==NULL) {
 		return NULL;
 	}
@@ -52,7 +52,7 @@ attach_lscreen_to_lamebus(int lscreenno, struct lamebus_softc *sc)
 		return NULL;
 	}
 
-	ls = kmalloc(sizeof(struct lscreen_softc));
+	ls = kmalloc_tagged(sizeof(struct lscreen_softc), KM_DEV);
 	if (ls==NULL) {
 		/* Out of memory */
 		return NULL;
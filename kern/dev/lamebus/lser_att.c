@@ -46,7 +46,7 @@ attach_lser_to_lamebus(int lserno, struct lamebus_softc *sc)
 		return NULL;
 	}
 
-	ls = kmalloc(sizeof(struct lser_softc));
+	ls = kmalloc_tagged(sizeof(struct lser_softc), KM_DEV);
 	if (ls==NULL) {
 		return NULL;
 	}
@@ -50,7 +50,7 @@ attach_ltimer_to_lamebus(int ltimerno, struct lamebus_softc *sc)
 		return NULL;
 	}
 
-	lt = kmalloc(sizeof(struct ltimer_softc));
+	lt = kmalloc_tagged(sizeof(struct ltimer_softc), KM_DEV);
 	if (lt==NULL) {
 		/* out of memory */
 		return NULL;
@@ -31,6 +31,7 @@
 #include <lib.h>
 #include <platform/bus.h>
 #include <lamebus/ltrace.h>
+#include <trace.h>
 #include "autoconf.h"
 
 /* Registers (offsets within slot) */
@@ -82,5 +83,6 @@ config_ltrace(struct ltrace_softc *sc, int ltraceno)
 {
 	(void)ltraceno;
 	the_trace = sc;
+	trace_setmirror(ltrace_debug);
 	return 0;
 }
@@ -46,7 +46,7 @@ attach_ltrace_to_lamebus(int ltraceno, struct lamebus_softc *sc)
 		return NULL;
 	}
 
-	lt = kmalloc(sizeof(struct ltrace_softc));
+	lt = kmalloc_tagged(sizeof(struct ltrace_softc), KM_DEV);
 	if (lt==NULL) {
 		return NULL;
 	}
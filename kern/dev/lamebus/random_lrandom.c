@@ -41,7 +41,8 @@
 struct random_softc *
 attach_random_to_lrandom(int randomno, struct lrandom_softc *ls)
 {
-	struct random_softc *rs = kmalloc(sizeof(struct random_softc));
+	struct random_softc *rs = kmalloc_tagged(sizeof(struct random_softc),
+						 KM_DEV);
 	if (rs==NULL) {
 		return NULL;
 	}
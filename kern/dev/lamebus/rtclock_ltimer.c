@@ -51,7 +51,8 @@ attach_rtclock_to_ltimer(int rtclockno, struct ltimer_softc *ls)
 	 * No need to probe; ltimer always has a clock.
 	 * Just allocate the rtclock, set our fields, and return it.
 	 */
-	struct rtclock_softc *rtc = kmalloc(sizeof(struct rtclock_softc));
+	struct rtclock_softc *rtc = kmalloc_tagged(sizeof(struct rtclock_softc),
+						   KM_DEV);
 	if (rtc==NULL) {
 		/* Out of memory */
 		return NULL;
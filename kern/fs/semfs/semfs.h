@@ -32,6 +32,7 @@
 
 #include <array.h>
 #include <fs.h>
+#include <poll.h>
 #include <vnode.h>
 
 #ifndef SEMFS_INLINE
@@ -43,6 +44,7 @@
  */
 
 #define SEMFS_ROOTDIR	0xffffffffU		/* semnum for root dir */
+#define SEMFS_HASHSIZE	64			/* name hash buckets; a power of 2 */
 
 /*
  * A user-facing semaphore.
@@ -54,6 +56,7 @@
 struct semfs_sem {
 	struct lock *sems_lock;			/* Lock to protect count */
 	struct cv *sems_cv;			/* CV to wait */
+	struct pollq sems_pollq;		/* Pollers waiting for P */
 	unsigned sems_count;			/* Semaphore count */
 	bool sems_hasvnode;			/* The vnode exists */
 	bool sems_linked;			/* In the directory */
@@ -61,11 +64,16 @@ struct semfs_sem {
 DECLARRAY(semfs_sem, SEMFS_INLINE);
 
 /*
- * Directory entry; name and reference to a semaphore.
+ * Directory entry; name and reference to a semaphore. Entries are in
+ * the directory array (for getdirentry) and also hashed by name (for
+ * lookup, creat and remove).
  */
 struct semfs_direntry {
 	char *semd_name;			/* Name */
 	unsigned semd_semnum;			/* Which semaphore */
+	unsigned semd_hash;			/* semfs_hashname(semd_name) */
+	unsigned semd_slot;			/* Index in semfs_dents */
+	struct semfs_direntry *semd_hnext;	/* Hash chain */
 };
 DECLARRAY(semfs_direntry, SEMFS_INLINE);
 
@@ -80,6 +88,8 @@ struct semfs_vnode {
 	struct vnode semv_absvn;		/* Abstract vnode */
 	struct semfs *semv_semfs;		/* Back-pointer to fs */
 	unsigned semv_semnum;			/* Which semaphore */
+	struct semfs_sem *semv_sem;		/* It (NULL for the root dir);
+						   stays while we exist */
 };
 
 /*
@@ -95,6 +105,7 @@ struct semfs {
 
 	struct lock *semfs_dirlock;		/* Lock for following */
 	struct semfs_direntryarray *semfs_dents; /* The root directory */
+	struct semfs_direntry *semfs_dhash[SEMFS_HASHSIZE]; /* By name */
 };
 
 /*
@@ -113,6 +124,7 @@ DEFARRAY(semfs_direntry, SEMFS_INLINE);
 struct semfs_sem *semfs_sem_create(const char *name);
 int semfs_sem_insert(struct semfs *, struct semfs_sem *, unsigned *);
 void semfs_sem_destroy(struct semfs_sem *);
+unsigned semfs_hashname(const char *name);
 struct semfs_direntry *semfs_direntry_create(const char *name, unsigned semno);
 void semfs_direntry_destroy(struct semfs_direntry *);
 
@@ -158,7 +158,7 @@ semfs_create(void)
 {
 	struct semfs *semfs;
 
-	semfs = kmalloc(sizeof(*semfs));
+	semfs = kmalloc_tagged(sizeof(*semfs), KM_FS);
 	if (semfs == NULL) {
 		goto fail_total;
 	}
@@ -184,6 +184,7 @@ semfs_create(void)
 	if (semfs->semfs_dents == NULL) {
 		goto fail_dirlock;
 	}
+	bzero(semfs->semfs_dhash, sizeof(semfs->semfs_dhash));
 
 	semfs->semfs_absfs.fs_data = semfs;
 	semfs->semfs_absfs.fs_ops = &semfs_fsops;
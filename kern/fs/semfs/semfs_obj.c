@@ -50,7 +50,7 @@ semfs_sem_create(const char *name)
 	snprintf(lockname, sizeof(lockname), "sem:l.%s", name);
 	snprintf(cvname, sizeof(cvname), "sem:%s", name);
 
-	sem = kmalloc(sizeof(*sem));
+	sem = kmalloc_tagged(sizeof(*sem), KM_FS);
 	if (sem == NULL) {
 		goto fail_return;
 	}
@@ -62,6 +62,7 @@ semfs_sem_create(const char *name)
 	if (sem->sems_cv == NULL) {
 		goto fail_lock;
 	}
+	pollq_init(&sem->sems_pollq);
 	sem->sems_count = 0;
 	sem->sems_hasvnode = false;
 	sem->sems_linked = false;
@@ -81,6 +82,7 @@ semfs_sem_create(const char *name)
 void
 semfs_sem_destroy(struct semfs_sem *sem)
 {
+	pollq_cleanup(&sem->sems_pollq);
 	cv_destroy(sem->sems_cv);
 	lock_destroy(sem->sems_lock);
 	kfree(sem);
@@ -113,6 +115,20 @@ semfs_sem_insert(struct semfs *semfs, struct semfs_sem *sem, unsigned *ret)
 ////////////////////////////////////////////////////////////
 // semfs_direntry
 
+/*
+ * Hash function for names.
+ */
+unsigned
+semfs_hashname(const char *name)
+{
+	unsigned h = 0;
+
+	while (*name) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
 /*
  * Constructor for semfs_direntry.
  */
@@ -121,7 +137,7 @@ semfs_direntry_create(const char *name, unsigned semnum)
 {
 	struct semfs_direntry *dent;
 
-	dent = kmalloc(sizeof(*dent));
+	dent = kmalloc_tagged(sizeof(*dent), KM_FS);
 	if (dent == NULL) {
 		return NULL;
 	}
@@ -131,6 +147,9 @@ semfs_direntry_create(const char *name, unsigned semnum)
 		return NULL;
 	}
 	dent->semd_semnum = semnum;
+	dent->semd_hash = semfs_hashname(name);
+	dent->semd_slot = 0;
+	dent->semd_hnext = NULL;
 	return dent;
 }
 
@@ -30,6 +30,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/poll.h>
 #include <stat.h>
 #include <uio.h>
 #include <synch.h>
@@ -106,10 +107,6 @@ semfs_fsync(struct vnode *vn)
 ////////////////////////////////////////////////////////////
 // semaphore ops
 
-/*
- * XXX fold these two together
- */
-
 static
 struct semfs_sem *
 semfs_getsembynum(struct semfs *semfs, unsigned semnum)
@@ -123,20 +120,26 @@ semfs_getsembynum(struct semfs *semfs, unsigned semnum)
 	return sem;
 }
 
+/*
+ * The semaphore of a vnode. It can't go away while the vnode exists
+ * (see semfs_reclaim), so the vnode keeps a pointer to it and P and V
+ * don't have to go through the table.
+ */
 static
 struct semfs_sem *
 semfs_getsem(struct semfs_vnode *semv)
 {
-	struct semfs *semfs = semv->semv_semfs;
-
-	return semfs_getsembynum(semfs, semv->semv_semnum);
+	KASSERT(semv->semv_sem != NULL);
+	return semv->semv_sem;
 }
 
 /*
  * Wakeup helper. We only need to wake up if there are sleepers, which
  * should only be the case if the old count is 0; and we only
  * potentially need to wake more than one sleeper if the new count
- * will be more than 1.
+ * will be more than 1. Pollers are woken the same way; they look at
+ * the count under the lock, so it doesn't matter that it's still the
+ * old one here.
  */
 static
 void
@@ -151,6 +154,65 @@ semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
 	else {
 		cv_broadcast(sem->sems_cv, sem->sems_lock);
 	}
+	pollq_wakeup(&sem->sems_pollq);
+}
+
+/*
+ * P: take AMOUNT from the count, waiting whenever it runs out.
+ */
+static
+void
+semfs_P(struct semfs_vnode *semv, struct semfs_sem *sem, unsigned amount)
+{
+	unsigned consume;
+
+	lock_acquire(sem->sems_lock);
+	while (amount > 0) {
+		if (sem->sems_count > 0) {
+			consume = amount;
+			if (consume > sem->sems_count) {
+				consume = sem->sems_count;
+			}
+			DEBUG(DB_SEMFS, "semfs: sem%u: P, count %u -> %u\n",
+			      semv->semv_semnum, sem->sems_count,
+			      sem->sems_count - consume);
+			sem->sems_count -= consume;
+			amount -= consume;
+		}
+		if (amount == 0) {
+			break;
+		}
+		if (sem->sems_count == 0) {
+			DEBUG(DB_SEMFS, "semfs: sem%u: blocking\n",
+			      semv->semv_semnum);
+			cv_wait(sem->sems_cv, sem->sems_lock);
+		}
+	}
+	lock_release(sem->sems_lock);
+}
+
+/*
+ * V: add AMOUNT to the count. EFBIG if it would overflow.
+ */
+static
+int
+semfs_V(struct semfs_vnode *semv, struct semfs_sem *sem, unsigned amount)
+{
+	unsigned newcount;
+
+	lock_acquire(sem->sems_lock);
+	newcount = sem->sems_count + amount;
+	if (newcount < sem->sems_count) {
+		/* overflow */
+		lock_release(sem->sems_lock);
+		return EFBIG;
+	}
+	DEBUG(DB_SEMFS, "semfs: sem%u: V, count %u -> %u\n",
+	      semv->semv_semnum, sem->sems_count, newcount);
+	semfs_wakeup(sem, newcount);
+	sem->sems_count = newcount;
+	lock_release(sem->sems_lock);
+	return 0;
 }
 
 /*
@@ -181,43 +243,45 @@ semfs_semstat(struct vnode *vn, struct stat *buf)
 }
 
 /*
- * Read. This is P(); decrease the count by the amount read.
- * Don't actually bother to transfer any data.
+ * Poll. Reading (P) is ready when the count isn't 0; writing (V)
+ * never waits.
  */
 static
 int
-semfs_read(struct vnode *vn, struct uio *uio)
+semfs_poll(struct vnode *vn, int events, struct pollset *ps)
 {
 	struct semfs_vnode *semv = vn->vn_data;
 	struct semfs_sem *sem;
-	size_t consume;
+	int revents;
 
 	sem = semfs_getsem(semv);
+	poll_wait(ps, &sem->sems_pollq);
 
+	revents = events & POLLOUT;
 	lock_acquire(sem->sems_lock);
-	while (uio->uio_resid > 0) {
-		if (sem->sems_count > 0) {
-			consume = uio->uio_resid;
-			if (consume > sem->sems_count) {
-				consume = sem->sems_count;
-			}
-			DEBUG(DB_SEMFS, "semfs: sem%u: P, count %u -> %u\n",
-			      semv->semv_semnum, sem->sems_count,
-			      sem->sems_count - consume);
-			sem->sems_count -= consume;
-			/* don't bother advancing the uio data pointers */
-			uio->uio_resid -= consume;
-		}
-		if (uio->uio_resid == 0) {
-			break;
-		}
-		if (sem->sems_count == 0) {
-			DEBUG(DB_SEMFS, "semfs: sem%u: blocking\n",
-			      semv->semv_semnum);
-			cv_wait(sem->sems_cv, sem->sems_lock);
-		}
+	if (sem->sems_count > 0) {
+		revents |= events & POLLIN;
 	}
 	lock_release(sem->sems_lock);
+	return revents;
+}
+
+/*
+ * Read. This is P(); decrease the count by the amount read.
+ * Don't actually bother to transfer any data.
+ */
+static
+int
+semfs_read(struct vnode *vn, struct uio *uio)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+
+	if (uio->uio_resid > (size_t)(unsigned)-1) {
+		return EFBIG;
+	}
+	semfs_P(semv, semfs_getsem(semv), uio->uio_resid);
+	/* don't bother advancing the uio data pointers */
+	uio->uio_resid = 0;
 	return 0;
 }
 
@@ -230,26 +294,16 @@ int
 semfs_write(struct vnode *vn, struct uio *uio)
 {
 	struct semfs_vnode *semv = vn->vn_data;
-	struct semfs_sem *sem;
-	unsigned newcount;
-
-	sem = semfs_getsem(semv);
+	int result;
 
-	lock_acquire(sem->sems_lock);
-	while (uio->uio_resid > 0) {
-		newcount = sem->sems_count + uio->uio_resid;
-		if (newcount < sem->sems_count) {
-			/* overflow */
-			lock_release(sem->sems_lock);
-			return EFBIG;
-		}
-		DEBUG(DB_SEMFS, "semfs: sem%u: V, count %u -> %u\n",
-		      semv->semv_semnum, sem->sems_count, newcount);
-		semfs_wakeup(sem, newcount);
-		sem->sems_count = newcount;
-		uio->uio_resid = 0;
+	if (uio->uio_resid > (size_t)(unsigned)-1) {
+		return EFBIG;
 	}
-	lock_release(sem->sems_lock);
+	result = semfs_V(semv, semfs_getsem(semv), uio->uio_resid);
+	if (result) {
+		return result;
+	}
+	uio->uio_resid = 0;
 	return 0;
 }
 
@@ -292,6 +346,58 @@ semfs_truncate(struct vnode *vn, off_t len)
 ////////////////////////////////////////////////////////////
 // directory ops
 
+/*
+ * Find the directory entry called NAME, or NULL. Call with the
+ * directory locked.
+ */
+static
+struct semfs_direntry *
+semfs_dir_find(struct semfs *semfs, const char *name)
+{
+	struct semfs_direntry *dent;
+	unsigned hash;
+
+	KASSERT(lock_do_i_hold(semfs->semfs_dirlock));
+
+	hash = semfs_hashname(name);
+	for (dent = semfs->semfs_dhash[hash & (SEMFS_HASHSIZE - 1)];
+	     dent != NULL; dent = dent->semd_hnext) {
+		if (dent->semd_hash == hash && !strcmp(dent->semd_name, name)) {
+			return dent;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Put DENT on the hash, or take it off.
+ */
+static
+void
+semfs_dir_hashadd(struct semfs *semfs, struct semfs_direntry *dent)
+{
+	struct semfs_direntry **dp;
+
+	dp = &semfs->semfs_dhash[dent->semd_hash & (SEMFS_HASHSIZE - 1)];
+	dent->semd_hnext = *dp;
+	*dp = dent;
+}
+
+static
+void
+semfs_dir_hashremove(struct semfs *semfs, struct semfs_direntry *dent)
+{
+	struct semfs_direntry **dp;
+
+	dp = &semfs->semfs_dhash[dent->semd_hash & (SEMFS_HASHSIZE - 1)];
+	while (*dp != dent) {
+		KASSERT(*dp != NULL);
+		dp = &(*dp)->semd_hnext;
+	}
+	*dp = dent->semd_hnext;
+	dent->semd_hnext = NULL;
+}
+
 /*
  * Directory read. Note that there's only one directory (the semfs
  * root) that has all the semaphores in it.
@@ -320,6 +426,7 @@ semfs_getdirentry(struct vnode *dirvn, struct uio *uio)
 		dent = semfs_direntryarray_get(semfs->semfs_dents, pos);
 		result = uiomove(dent->semd_name, strlen(dent->semd_name),
 				 uio);
+		uio->uio_offset = pos + 1;
 	}
 
 	lock_release(semfs->semfs_dirlock);
@@ -385,26 +492,25 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	}
 
 	lock_acquire(semfs->semfs_dirlock);
+	dent = semfs_dir_find(semfs, name);
+	if (dent != NULL) {
+		/* found */
+		if (excl) {
+			lock_release(semfs->semfs_dirlock);
+			return EEXIST;
+		}
+		result = semfs_getvnode(semfs, dent->semd_semnum, resultvn);
+		lock_release(semfs->semfs_dirlock);
+		return result;
+	}
+
+	/* not there; find a free slot for it */
 	num = semfs_direntryarray_num(semfs->semfs_dents);
 	empty = num;
 	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			if (empty == num) {
-				empty = i;
-			}
-			continue;
-		}
-		if (!strcmp(dent->semd_name, name)) {
-			/* found */
-			if (excl) {
-				lock_release(semfs->semfs_dirlock);
-				return EEXIST;
-			}
-			result = semfs_getvnode(semfs, dent->semd_semnum,
-						resultvn);
-			lock_release(semfs->semfs_dirlock);
-			return result;
+		if (semfs_direntryarray_get(semfs->semfs_dents, i) == NULL) {
+			empty = i;
+			break;
 		}
 	}
 
@@ -423,6 +529,7 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 
 	dent = semfs_direntry_create(name, semnum);
 	if (dent == NULL) {
+		result = ENOMEM;
 		goto fail_uninsert;
 	}
 
@@ -442,6 +549,8 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 		goto fail_undir;
 	}
 
+	dent->semd_slot = empty;
+	semfs_dir_hashadd(semfs, dent);
 	sem->sems_linked = true;
 	lock_release(semfs->semfs_dirlock);
 	return 0;
@@ -473,47 +582,39 @@ semfs_remove(struct vnode *dirvn, const char *name)
 	struct semfs *semfs = dirsemv->semv_semfs;
 	struct semfs_direntry *dent;
 	struct semfs_sem *sem;
-	unsigned i, num;
-	int result;
 
 	if (!strcmp(name, ".") || !strcmp(name, "..")) {
 		return EINVAL;
 	}
 
 	lock_acquire(semfs->semfs_dirlock);
-	num = semfs_direntryarray_num(semfs->semfs_dents);
-	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			continue;
-		}
-		if (!strcmp(name, dent->semd_name)) {
-			/* found */
-			sem = semfs_getsembynum(semfs, dent->semd_semnum);
-			lock_acquire(sem->sems_lock);
-			KASSERT(sem->sems_linked);
-			sem->sems_linked = false;
-			if (sem->sems_hasvnode == false) {
-				lock_acquire(semfs->semfs_tablelock);
-				semfs_semarray_set(semfs->semfs_sems,
-						   dent->semd_semnum, NULL);
-				lock_release(semfs->semfs_tablelock);
-				lock_release(sem->sems_lock);
-				semfs_sem_destroy(sem);
-			}
-			else {
-				lock_release(sem->sems_lock);
-			}
-			semfs_direntryarray_set(semfs->semfs_dents, i, NULL);
-			semfs_direntry_destroy(dent);
-			result = 0;
-			goto out;
-		}
+	dent = semfs_dir_find(semfs, name);
+	if (dent == NULL) {
+		lock_release(semfs->semfs_dirlock);
+		return ENOENT;
 	}
-	result = ENOENT;
- out:
+
+	sem = semfs_getsembynum(semfs, dent->semd_semnum);
+	lock_acquire(sem->sems_lock);
+	KASSERT(sem->sems_linked);
+	sem->sems_linked = false;
+	if (sem->sems_hasvnode == false) {
+		lock_acquire(semfs->semfs_tablelock);
+		semfs_semarray_set(semfs->semfs_sems, dent->semd_semnum, NULL);
+		lock_release(semfs->semfs_tablelock);
+		lock_release(sem->sems_lock);
+		semfs_sem_destroy(sem);
+	}
+	else {
+		lock_release(sem->sems_lock);
+	}
+	KASSERT(semfs_direntryarray_get(semfs->semfs_dents,
+					dent->semd_slot) == dent);
+	semfs_direntryarray_set(semfs->semfs_dents, dent->semd_slot, NULL);
+	semfs_dir_hashremove(semfs, dent);
+	semfs_direntry_destroy(dent);
 	lock_release(semfs->semfs_dirlock);
-	return result;
+	return 0;
 }
 
 /*
@@ -526,7 +627,6 @@ semfs_lookup(struct vnode *dirvn, char *path, struct vnode **resultvn)
 	struct semfs_vnode *dirsemv = dirvn->vn_data;
 	struct semfs *semfs = dirsemv->semv_semfs;
 	struct semfs_direntry *dent;
-	unsigned i, num;
 	int result;
 
 	if (!strcmp(path, ".") || !strcmp(path, "..")) {
@@ -536,21 +636,14 @@ semfs_lookup(struct vnode *dirvn, char *path, struct vnode **resultvn)
 	}
 
 	lock_acquire(semfs->semfs_dirlock);
-	num = semfs_direntryarray_num(semfs->semfs_dents);
-	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			continue;
-		}
-		if (!strcmp(path, dent->semd_name)) {
-			result = semfs_getvnode(semfs, dent->semd_semnum,
-						resultvn);
-			lock_release(semfs->semfs_dirlock);
-			return result;
-		}
+	dent = semfs_dir_find(semfs, path);
+	if (dent == NULL) {
+		lock_release(semfs->semfs_dirlock);
+		return ENOENT;
 	}
+	result = semfs_getvnode(semfs, dent->semd_semnum, resultvn);
 	lock_release(semfs->semfs_dirlock);
-	return ENOENT;
+	return result;
 }
 
 /*
@@ -601,19 +694,12 @@ semfs_reclaim(struct vnode *vn)
 
 	lock_acquire(semfs->semfs_tablelock);
 
-	/* vnode refcount is protected by the vnode's ->vn_countlock */
-	spinlock_acquire(&vn->vn_countlock);
-	if (vn->vn_refcount > 1) {
-		/* consume the reference VOP_DECREF passed us */
-		vn->vn_refcount--;
-
-		spinlock_release(&vn->vn_countlock);
+	if (vnode_decref_unless_last(vn)) {
+		/* that consumed the reference VOP_DECREF passed us */
 		lock_release(semfs->semfs_tablelock);
 		return EBUSY;
 	}
 
-	spinlock_release(&vn->vn_countlock);
-
 	/* remove from the table */
 	num = vnodearray_num(semfs->semfs_vnodes);
 	for (i=0; i<num; i++) {
@@ -655,12 +741,17 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_isdir,
 	.vop_getdirentry = semfs_getdirentry,
+	.vop_getdirentries = vnode_getdirentries_slow,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_dirstat,
 	.vop_gettype = semfs_gettype,
 	.vop_isseekable = semfs_isseekable,
 	.vop_fsync = semfs_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = vnode_poll_always,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_isdir,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
 	.vop_namefile = semfs_namefile,
@@ -688,12 +779,17 @@ static const struct vnode_ops semfs_semops = {
 	.vop_read = semfs_read,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_uio_notdir,
 	.vop_write = semfs_write,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_semstat,
 	.vop_gettype = semfs_gettype,
 	.vop_isseekable = semfs_isseekable,
 	.vop_fsync = semfs_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = semfs_poll,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_nosys,
 	.vop_mmap = vopfail_mmap_perm,
 	.vop_truncate = semfs_truncate,
 	.vop_namefile = vopfail_uio_notdir,
@@ -727,13 +823,14 @@ semfs_vnode_create(struct semfs *semfs, unsigned semnum)
 		optable = &semfs_semops;
 	}
 
-	semv = kmalloc(sizeof(*semv));
+	semv = kmalloc_tagged(sizeof(*semv), KM_FS);
 	if (semv == NULL) {
 		return NULL;
 	}
 
 	semv->semv_semfs = semfs;
 	semv->semv_semnum = semnum;
+	semv->semv_sem = NULL;
 
 	result = vnode_init(&semv->semv_absvn, optable,
 			    &semfs->semfs_absfs, semv);
@@ -789,9 +886,32 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 		KASSERT(sem != NULL);
 		KASSERT(sem->sems_hasvnode == false);
 		sem->sems_hasvnode = true;
+		semv->semv_sem = sem;
 	}
 	lock_release(semfs->semfs_tablelock);
 
 	*ret = &semv->semv_absvn;
 	return 0;
 }
+
+/*
+ * sem_op(): P of -DELTA if it's negative, V of DELTA if it's positive.
+ * This is read and write without the uio (or, in the syscall, the
+ * open file's lock and offset). EINVAL if VN isn't a semaphore.
+ */
+int
+semfs_semop(struct vnode *vn, int delta)
+{
+	struct semfs_vnode *semv;
+
+	if (vn->vn_ops != &semfs_semops) {
+		return EINVAL;
+	}
+	semv = vn->vn_data;
+
+	if (delta < 0) {
+		semfs_P(semv, semfs_getsem(semv), -(unsigned)delta);
+		return 0;
+	}
+	return semfs_V(semv, semfs_getsem(semv), delta);
+}
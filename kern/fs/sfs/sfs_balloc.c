@@ -33,58 +33,412 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <synch.h>
+#include <bufcache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Zero out a disk block.
+ * Zero out a disk block. (Not through sfs_writeblock: nothing points
+ * to the block yet, so the zeros needn't be journaled.)
  */
 static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct buf *b;
+	int result;
+
+	result = buf_get(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	bzero(buf_data(b), SFS_BLOCKSIZE);
+	buf_markdirty(b);
+	buf_release(b);
+	return 0;
+}
+
+/*
+ * Note that the freemap block holding the bit for BLOCK needs
+ * writing. Call with the freemap lock.
+ */
+static
+void
+sfs_fmdirty(struct sfs_fs *sfs, daddr_t block)
+{
+	uint32_t fmblock = block / SFS_BITSPERBLOCK;
+
+	if (!bitmap_isset(sfs->sfs_fmdirty, fmblock)) {
+		bitmap_mark(sfs->sfs_fmdirty, fmblock);
+	}
+	sfs->sfs_freemapdirty = true;
+}
+
+/*
+ * Note that the freemap bit for BLOCK has changed. Call with the
+ * freemap lock.
+ */
+static
+void
+sfs_fmchanged(struct sfs_fs *sfs, daddr_t block)
+{
+	sfs_fmdirty(sfs, block);
+	sfs_jfreemap(sfs, block);
+}
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+/*
+ * Mark a block free, with the freemap lock held. On a journaled
+ * volume it stays in use until the journal says it can go (see
+ * sfs_journal.c).
+ */
+static
+void
+sfs_bunmark(struct sfs_fs *sfs, daddr_t block)
+{
+	if (sfs->sfs_journal != NULL) {
+		sfs_jfree(sfs, block);
+	}
+	else {
+		bitmap_unmark(sfs->sfs_freemap, block);
+		sfs->sfs_nfree++;
+	}
+	sfs_fmdirty(sfs, block);
 }
 
+/* How far past the goal block to look for a free one. */
+#define SFS_BALLOC_NEAR	64
+
+/* Blocks set aside at a time for a file being written. */
+#define SFS_PREALLOC	8
+
 /*
- * Allocate a block.
+ * Find a free block and mark it in use: GOAL if it's free, else the
+ * first free one after it (not too far after), else the first free
+ * one anywhere. GOAL 0 means anywhere. Call with the freemap lock.
  */
+static
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_bfind(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
 {
+	daddr_t b;
 	int result;
 
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	if (goal != 0 && goal < sfs->sfs_sb.sb_nblocks) {
+		for (b = goal; b < sfs->sfs_sb.sb_nblocks &&
+			     b < goal + SFS_BALLOC_NEAR; b++) {
+			if (!bitmap_isset(sfs->sfs_freemap, b)) {
+				bitmap_mark(sfs->sfs_freemap, b);
+				sfs_fmchanged(sfs, b);
+				sfs->sfs_nfree--;
+				*diskblock = b;
+				return 0;
+			}
+		}
+	}
+
 	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
 	if (result) {
 		return result;
 	}
-	sfs->sfs_freemapdirty = true;
+	sfs_fmchanged(sfs, *diskblock);
+	sfs->sfs_nfree--;
+	return 0;
+}
+
+/*
+ * Allocate a block, at or near GOAL if that's not 0.
+ */
+int
+sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
+{
+	int result;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	result = sfs_bfind(sfs, goal, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	if (result) {
+		return result;
+	}
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: balloc: invalid block %u\n", *diskblock);
 	}
 
-	/* Clear block before returning it */
+	/*
+	 * Clear block before returning it. (It's ours now, so this
+	 * doesn't need the freemap lock.)
+	 */
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
-		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		sfs_bfree(sfs, *diskblock);
 	}
 	return result;
 }
 
+/*
+ * Allocate a data block for file SV, at or near GOAL, which should
+ * be the block after the one that comes before it in the file.
+ *
+ * To keep files together on disk when several are being written at
+ * once, each file gets a few blocks set aside at a time: allocating
+ * one also reserves the free blocks right after it, up to
+ * SFS_PREALLOC, and the file's next allocations take those as long as
+ * they carry on in order. (Or, after sfs_balloc_run, whatever comes
+ * next takes them.) Call with the vnode locked exclusive, which covers
+ * the reservation.
+ */
+int
+sfs_balloc_file(struct sfs_vnode *sv, daddr_t goal, daddr_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t b;
+	int result;
+
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
+
+	if (sv->sv_nprealloc > 0 &&
+	    (goal == 0 || goal == sv->sv_prealloc || sv->sv_preany)) {
+		/* carrying on: it's set aside for us already */
+		*diskblock = sv->sv_prealloc;
+		sv->sv_prealloc++;
+		sv->sv_nprealloc--;
+		sv->sv_preany = false;
+	}
+	else {
+		/* starting somewhere new; let the old ones go */
+		sfs_prealloc_release(sv);
+
+		lock_acquire(sfs->sfs_freemaplock);
+		result = sfs_bfind(sfs, goal, diskblock);
+		if (result) {
+			lock_release(sfs->sfs_freemaplock);
+			return result;
+		}
+		for (b = *diskblock + 1; b < sfs->sfs_sb.sb_nblocks &&
+			     b < *diskblock + SFS_PREALLOC; b++) {
+			if (bitmap_isset(sfs->sfs_freemap, b)) {
+				break;
+			}
+			bitmap_mark(sfs->sfs_freemap, b);
+			sfs_fmchanged(sfs, b);
+			sfs->sfs_nfree--;
+		}
+		sv->sv_prealloc = *diskblock + 1;
+		sv->sv_nprealloc = b - (*diskblock + 1);
+		lock_release(sfs->sfs_freemaplock);
+	}
+
+	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
+		panic("sfs: balloc: invalid block %u\n", *diskblock);
+	}
+
+	result = sfs_clearblock(sfs, *diskblock);
+	if (result) {
+		sfs_bfree(sfs, *diskblock);
+	}
+	return result;
+}
+
+/*
+ * Give back the blocks set aside for a file (on truncate, and when
+ * the vnode goes). Call with the vnode locked exclusive. (Nothing
+ * points to them, so they needn't wait for the journal.)
+ */
+void
+sfs_prealloc_release(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	unsigned i;
+
+	if (sv->sv_nprealloc == 0) {
+		return;
+	}
+	lock_acquire(sfs->sfs_freemaplock);
+	for (i = 0; i < sv->sv_nprealloc; i++) {
+		bitmap_unmark(sfs->sfs_freemap, sv->sv_prealloc + i);
+		sfs_fmchanged(sfs, sv->sv_prealloc + i);
+	}
+	sfs->sfs_nfree += sv->sv_nprealloc;
+	lock_release(sfs->sfs_freemaplock);
+	sv->sv_nprealloc = 0;
+	sv->sv_preany = false;
+}
+
+/*
+ * Set aside N consecutive blocks for file SV's next N allocations, the
+ * first run of them that's free at GOAL or after it (or before it,
+ * going round); or if there's no run that long, the longest there is.
+ * This is for blocks whose allocation was put off (see sfs_io.c), all
+ * of which are known by the time it's done. Call with the vnode
+ * locked exclusive.
+ */
+int
+sfs_balloc_run(struct sfs_vnode *sv, daddr_t goal, unsigned n)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t nblocks = sfs->sfs_sb.sb_nblocks;
+	daddr_t b, start, best;
+	unsigned len, bestlen, scanned;
+
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
+	KASSERT(n > 0);
+
+	sfs_prealloc_release(sv);
+	if (goal == 0 || goal >= nblocks) {
+		goal = 1;
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
+	best = 0;
+	bestlen = 0;
+	start = 0;
+	len = 0;
+	b = goal;
+	for (scanned = 0; scanned < nblocks && bestlen < n; scanned++) {
+		if (b == 0) {
+			/* went round; a run doesn't wrap */
+			len = 0;
+		}
+		else if (bitmap_isset(sfs->sfs_freemap, b)) {
+			len = 0;
+		}
+		else {
+			if (len == 0) {
+				start = b;
+			}
+			len++;
+			if (len > bestlen) {
+				best = start;
+				bestlen = len;
+			}
+		}
+		b = b + 1 < nblocks ? b + 1 : 0;
+	}
+	if (bestlen == 0) {
+		lock_release(sfs->sfs_freemaplock);
+		return ENOSPC;
+	}
+
+	for (b = best; b < best + bestlen; b++) {
+		bitmap_mark(sfs->sfs_freemap, b);
+		sfs_fmchanged(sfs, b);
+	}
+	sfs->sfs_nfree -= bestlen;
+	lock_release(sfs->sfs_freemaplock);
+
+	sv->sv_prealloc = best;
+	sv->sv_nprealloc = bestlen;
+	sv->sv_preany = true;
+	return 0;
+}
+
+/* Free blocks kept back for indirect blocks when putting writes off. */
+#define SFS_DLRESERVE	32
+
+/* Most blocks waiting to be allocated on a volume at once. */
+#define SFS_DLTOTAL	256
+
+/*
+ * Count one more block as waiting to be allocated, if there's surely
+ * room for it (there's no telling the writer later that there isn't).
+ * Returns false if it should be allocated now instead.
+ */
+bool
+sfs_dlreserve(struct sfs_fs *sfs)
+{
+	bool ok;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	ok = sfs->sfs_ndelayed < SFS_DLTOTAL &&
+		sfs->sfs_nfree > sfs->sfs_ndelayed + SFS_DLRESERVE;
+	if (ok) {
+		sfs->sfs_ndelayed++;
+	}
+	lock_release(sfs->sfs_freemaplock);
+	return ok;
+}
+
+/*
+ * Whether there's room for N more blocks besides the ones waiting to
+ * be allocated and those kept back for their indirect blocks. Only a
+ * guess, as nothing is set aside; for fallocate, to fail before
+ * starting rather than partway.
+ */
+bool
+sfs_bavail(struct sfs_fs *sfs, unsigned n)
+{
+	bool ok;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	ok = sfs->sfs_nfree >= sfs->sfs_ndelayed + SFS_DLRESERVE &&
+		sfs->sfs_nfree - sfs->sfs_ndelayed - SFS_DLRESERVE >= n;
+	lock_release(sfs->sfs_freemaplock);
+	return ok;
+}
+
+/* N blocks are no longer waiting: allocated, or thrown away. */
+void
+sfs_dlunreserve(struct sfs_fs *sfs, unsigned n)
+{
+	lock_acquire(sfs->sfs_freemaplock);
+	KASSERT(sfs->sfs_ndelayed >= n);
+	sfs->sfs_ndelayed -= n;
+	lock_release(sfs->sfs_freemaplock);
+}
+
 /*
  * Free a block.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
-	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs_bunmark(sfs, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * Free blocks a batch at a time, with one trip through the freemap
+ * lock for each batch instead of one for each block (truncating a big
+ * file frees thousands). Call sfs_freebatch_flush when done; until
+ * then, the blocks are still in use.
+ */
+void
+sfs_freebatch_init(struct sfs_freebatch *fb)
+{
+	fb->fb_n = 0;
+}
+
+void
+sfs_freebatch_add(struct sfs_fs *sfs, struct sfs_freebatch *fb,
+		  daddr_t diskblock)
+{
+	if (fb->fb_n == SFS_FREEBATCH) {
+		sfs_freebatch_flush(sfs, fb);
+	}
+	fb->fb_blocks[fb->fb_n++] = diskblock;
+}
+
+void
+sfs_freebatch_flush(struct sfs_fs *sfs, struct sfs_freebatch *fb)
+{
+	unsigned i;
+
+	if (fb->fb_n == 0) {
+		return;
+	}
+	lock_acquire(sfs->sfs_freemaplock);
+	for (i = 0; i < fb->fb_n; i++) {
+		sfs_bunmark(sfs, fb->fb_blocks[i]);
+	}
+	lock_release(sfs->sfs_freemaplock);
+	fb->fb_n = 0;
 }
 
 /*
@@ -93,10 +447,15 @@ sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 int
 sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: sfs_bused called on out of range block %u\n",
 		      diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return ret;
 }
 
@@ -34,11 +34,404 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/ioctl.h>
 #include <lib.h>
-#include <vfs.h>
+#include <synch.h>
+#include <thread.h>
+#include <bufcache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+////////////////////////////////////////////////////////////
+// Extent inodes
+
+/*
+ * On a volume with SFS_FEATURE_EXTENTS, an inode maps its file with
+ * a list of extents (see kern/sfs.h) instead of block pointers: each
+ * is a run of consecutive disk blocks, or a hole. A file written from
+ * start to end in blocks sfs_balloc_file hands out one after another
+ * needs one extent, however long it is, and finding a block means
+ * going down the list, not reading an indirect block. Files can be
+ * as big as their extents can cover; a write that would need more
+ * than SFS_NEXTENTS fails with EFBIG.
+ */
+
+/*
+ * Find the extent FILEBLOCK is in: its index, and the offset of the
+ * block in it. Returns the index sfi_nextents if it's past the last
+ * extent.
+ */
+static
+unsigned
+sfs_ext_find(const struct sfs_dinode *di, uint32_t fileblock, uint32_t *off)
+{
+	uint32_t base = 0;
+	unsigned i;
+
+	for (i = 0; i < di->sfi_nextents; i++) {
+		if (fileblock - base < di->sfi_extents[i].sfe_len) {
+			*off = fileblock - base;
+			return i;
+		}
+		base += di->sfi_extents[i].sfe_len;
+	}
+	*off = fileblock - base;
+	return i;
+}
+
+/* Disk block for FILEBLOCK, or 0 */
+static
+daddr_t
+sfs_ext_lookup(const struct sfs_dinode *di, uint32_t fileblock)
+{
+	const struct sfs_extent *e;
+	uint32_t off;
+	unsigned i;
+
+	i = sfs_ext_find(di, fileblock, &off);
+	if (i == di->sfi_nextents) {
+		return 0;
+	}
+	e = &di->sfi_extents[i];
+	return e->sfe_start == 0 ? 0 : e->sfe_start + off;
+}
+
+/* Make room for an extent at index AT (there must be room) */
+static
+void
+sfs_ext_insert(struct sfs_dinode *di, unsigned at, uint32_t start,
+	       uint32_t len)
+{
+	unsigned i;
+
+	KASSERT(di->sfi_nextents < SFS_NEXTENTS);
+	for (i = di->sfi_nextents; i > at; i--) {
+		di->sfi_extents[i] = di->sfi_extents[i - 1];
+	}
+	di->sfi_extents[at].sfe_start = start;
+	di->sfi_extents[at].sfe_len = len;
+	di->sfi_nextents++;
+}
+
+static
+void
+sfs_ext_delete(struct sfs_dinode *di, unsigned at)
+{
+	unsigned i;
+
+	for (i = at; i + 1 < di->sfi_nextents; i++) {
+		di->sfi_extents[i] = di->sfi_extents[i + 1];
+	}
+	di->sfi_nextents--;
+	di->sfi_extents[di->sfi_nextents].sfe_start = 0;
+	di->sfi_extents[di->sfi_nextents].sfe_len = 0;
+}
+
+/* sfs_bmap for extent inodes */
+static
+int
+sfs_ext_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+	     daddr_t *diskblock)
+{
+	struct sfs_dinode *di = &sv->sv_i;
+	struct sfs_extent *e;
+	daddr_t block, goal;
+	uint32_t off;
+	unsigned i, n;
+	int result;
+
+	if (di->sfi_nextents > SFS_NEXTENTS) {
+		panic("sfs: inode %u has %u extents\n", sv->sv_ino,
+		      di->sfi_nextents);
+	}
+
+	block = sfs_ext_lookup(di, fileblock);
+	if (block != 0 || !doalloc) {
+		*diskblock = block;
+		return 0;
+	}
+
+	/* Right after the block before it, if we can */
+	goal = fileblock > 0 ? sfs_ext_lookup(di, fileblock - 1) : sv->sv_ino;
+	if (goal != 0) {
+		goal++;
+	}
+	result = sfs_balloc_file(sv, goal, &block);
+	if (result) {
+		return result;
+	}
+
+	n = di->sfi_nextents;
+	i = sfs_ext_find(di, fileblock, &off);
+
+	/* The usual case: writing on at the end, right where we left off */
+	if (i == n && off == 0 && n > 0) {
+		e = &di->sfi_extents[n - 1];
+		if (e->sfe_start != 0 && e->sfe_start + e->sfe_len == block) {
+			e->sfe_len++;
+			sfs_dirty(sv);
+			*diskblock = block;
+			return 0;
+		}
+	}
+
+	/* Otherwise it can take two more extents (it can't take more) */
+	if (n + 2 > SFS_NEXTENTS) {
+		sfs_bfree(sv->sv_absvn.vn_fs->fs_data, block);
+		return EFBIG;
+	}
+
+	/* Past the end: a hole up to and including it, to fill below */
+	if (i == n) {
+		if (n > 0 && di->sfi_extents[n - 1].sfe_start == 0) {
+			/* there's one there already; make it longer */
+			i = n - 1;
+			e = &di->sfi_extents[i];
+			off += e->sfe_len;
+			e->sfe_len = off + 1;
+		}
+		else {
+			sfs_ext_insert(di, n, 0, off + 1);
+		}
+	}
+
+	/* Split the hole so that FILEBLOCK is an extent of its own */
+	if (off > 0) {
+		sfs_ext_insert(di, i, 0, off);
+		i++;
+		di->sfi_extents[i].sfe_len -= off;
+	}
+	if (di->sfi_extents[i].sfe_len > 1) {
+		sfs_ext_insert(di, i + 1, 0, di->sfi_extents[i].sfe_len - 1);
+		di->sfi_extents[i].sfe_len = 1;
+	}
+	di->sfi_extents[i].sfe_start = block;
+
+	/* and join it to its neighbours, if they're next to it on disk */
+	if (i > 0) {
+		e = &di->sfi_extents[i - 1];
+		if (e->sfe_start != 0 && e->sfe_start + e->sfe_len == block) {
+			e->sfe_len++;
+			sfs_ext_delete(di, i);
+			i--;
+		}
+	}
+	if (i + 1 < di->sfi_nextents) {
+		e = &di->sfi_extents[i];
+		if (e[1].sfe_start != 0 &&
+		    e->sfe_start + e->sfe_len == e[1].sfe_start) {
+			e->sfe_len += e[1].sfe_len;
+			sfs_ext_delete(di, i + 1);
+		}
+	}
+
+	sfs_dirty(sv);
+	*diskblock = block;
+	return 0;
+}
+
+/* sfs_itrunc for extent inodes: cut the map down to BLOCKLEN blocks */
+static
+void
+sfs_ext_itrunc(struct sfs_vnode *sv, uint32_t blocklen,
+	       struct sfs_freebatch *fb)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dinode *di = &sv->sv_i;
+	struct sfs_extent *e;
+	uint32_t base, keep, j;
+	unsigned i;
+
+	base = 0;
+	for (i = 0; i < di->sfi_nextents; i++) {
+		e = &di->sfi_extents[i];
+		if (base + e->sfe_len > blocklen) {
+			keep = base < blocklen ? blocklen - base : 0;
+			if (e->sfe_start != 0) {
+				for (j = keep; j < e->sfe_len; j++) {
+					sfs_freebatch_add(sfs, fb,
+							  e->sfe_start + j);
+				}
+			}
+			e->sfe_len = keep;
+			sfs_dirty(sv);
+		}
+		base += e->sfe_len;
+	}
+
+	/* drop what's empty now, and any hole left at the end */
+	while (di->sfi_nextents > 0) {
+		e = &di->sfi_extents[di->sfi_nextents - 1];
+		if (e->sfe_len != 0 && e->sfe_start != 0) {
+			break;
+		}
+		sfs_ext_delete(di, di->sfi_nextents - 1);
+		sfs_dirty(sv);
+	}
+}
+
+/* Put LEN blocks from START (0 for a hole) on the end of a new list */
+static
+void
+sfs_ext_append(struct sfs_extent *ext, unsigned *n, uint32_t start,
+	       uint32_t len)
+{
+	struct sfs_extent *e;
+
+	if (len == 0) {
+		return;
+	}
+	if (*n > 0) {
+		e = &ext[*n - 1];
+		if ((e->sfe_start == 0 && start == 0) ||
+		    (e->sfe_start != 0 && e->sfe_start + e->sfe_len == start)) {
+			e->sfe_len += len;
+			return;
+		}
+	}
+	ext[*n].sfe_start = start;
+	ext[*n].sfe_len = len;
+	(*n)++;
+}
+
+/*
+ * sfs_punch for extent inodes: make file blocks FROM up to TO a hole.
+ * That splits at most the extents at the two ends, so the new list
+ * is built on the side, two longer; if it doesn't fit after all, fail
+ * with EFBIG before changing anything.
+ */
+static
+int
+sfs_ext_punch(struct sfs_vnode *sv, uint32_t from, uint32_t to,
+	      struct sfs_freebatch *fb)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dinode *di = &sv->sv_i;
+	struct sfs_extent ext[SFS_NEXTENTS + 2];
+	const struct sfs_extent *e;
+	uint32_t base, end, lo, hi, j;
+	unsigned i, n;
+
+	n = 0;
+	base = 0;
+	for (i = 0; i < di->sfi_nextents; i++) {
+		e = &di->sfi_extents[i];
+		end = base + e->sfe_len;
+		lo = from < base ? base : from > end ? end : from;
+		hi = to < lo ? lo : to > end ? end : to;
+
+		sfs_ext_append(ext, &n, e->sfe_start, lo - base);
+		sfs_ext_append(ext, &n, 0, hi - lo);
+		sfs_ext_append(ext, &n, e->sfe_start == 0 ? 0 :
+			       e->sfe_start + (hi - base), end - hi);
+		base = end;
+	}
+	/* (as in sfs_ext_itrunc, no hole at the end) */
+	if (n > 0 && ext[n - 1].sfe_start == 0) {
+		n--;
+	}
+	if (n > SFS_NEXTENTS) {
+		return EFBIG;
+	}
+
+	base = 0;
+	for (i = 0; i < di->sfi_nextents; i++) {
+		e = &di->sfi_extents[i];
+		end = base + e->sfe_len;
+		lo = from < base ? base : from > end ? end : from;
+		hi = to < lo ? lo : to > end ? end : to;
+		if (e->sfe_start != 0) {
+			for (j = lo; j < hi; j++) {
+				sfs_freebatch_add(sfs, fb,
+						  e->sfe_start + (j - base));
+			}
+		}
+		base = end;
+	}
+
+	bzero(di->sfi_extents, sizeof(di->sfi_extents));
+	memcpy(di->sfi_extents, ext, n * sizeof(ext[0]));
+	di->sfi_nextents = n;
+	sfs_dirty(sv);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Inline inodes
+
+/*
+ * On a volume with SFS_FEATURE_INLINE, a new regular file starts out
+ * with its contents in its inode (see kern/sfs.h), so a small file
+ * costs no data block, and reading it costs no disk read past the
+ * inode's. sfs_io and sfs_itrunc deal with such files themselves;
+ * when one is about to grow past SFS_INLINESIZE, sfs_inline_evict
+ * moves its contents out to a block and from then on it is mapped
+ * like any other. (It doesn't move back in if it shrinks again.)
+ */
+
+/*
+ * Move an inline file's contents out to block 0 of the file and make
+ * the inode map blocks.
+ */
+int
+sfs_inline_evict(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t size = sv->sv_i.sfi_size;
+	struct buf *b;
+	daddr_t block;
+	char *data;
+	int result;
+
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
+	KASSERT(SFS_ISINLINE(sv));
+	KASSERT(size <= SFS_INLINESIZE);
+
+	data = NULL;
+	if (size > 0) {
+		data = kmalloc_tagged(size, KM_FS);
+		if (data == NULL) {
+			return ENOMEM;
+		}
+		memcpy(data, sv->sv_i.sfi_data, size);
+	}
+
+	/* the block pointers (or extents) are all 0: no blocks yet */
+	bzero(sv->sv_i.sfi_data, sizeof(sv->sv_i.sfi_data));
+	sv->sv_i.sfi_flags &= ~SFS_INODE_INLINE;
+	sfs_dirty(sv);
+	if (size == 0) {
+		return 0;
+	}
+
+	result = sfs_bmap(sv, 0, true, &block);
+	if (result == 0) {
+		result = buf_get(sfs->sfs_device, block, &b);
+		if (result) {
+			(void)sfs_itrunc(sv, 0);
+		}
+	}
+	if (result) {
+		/* put it back the way it was */
+		bzero(sv->sv_i.sfi_data, sizeof(sv->sv_i.sfi_data));
+		memcpy(sv->sv_i.sfi_data, data, size);
+		sv->sv_i.sfi_size = size;
+		sv->sv_i.sfi_flags |= SFS_INODE_INLINE;
+		kfree(data);
+		return result;
+	}
+
+	memcpy(buf_data(b), data, size);
+	bzero((char *)buf_data(b) + size, SFS_BLOCKSIZE - size);
+	buf_markdirty(b);
+	buf_release(b);
+	kfree(data);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Block mapping
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
@@ -49,25 +442,35 @@ int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	 daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t block;
+	struct buf *idbuf;
+	uint32_t *idptrs;
+	daddr_t block, goal;
 	daddr_t idblock;
 	uint32_t idnum, idoff;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	COMPILE_ASSERT(SFS_DBPERIDB * sizeof(uint32_t) == SFS_BLOCKSIZE);
+
+	/*
+	 * We need the vnode locked, shared to look, exclusive to
+	 * change the mapping.
+	 */
+	KASSERT(!doalloc || rwlock_do_i_hold_write(sv->sv_lock));
+	KASSERT(!SFS_ISINLINE(sv));
 
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	if (SFS_EXTENTS(sfs)) {
+		result = sfs_ext_bmap(sv, fileblock, doalloc, &block);
+		if (result) {
+			return result;
+		}
+		if (block != 0 && !sfs_bused(sfs, block)) {
+			panic("sfs: Data block %u (block %u of file %u) "
+			      "marked free\n", block, fileblock, sv->sv_ino);
+		}
+		*diskblock = block;
+		return 0;
+	}
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -82,14 +485,20 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			/* Right after the block before it, if we can */
+			goal = fileblock > 0 ? sv->sv_i.sfi_direct[fileblock-1]
+				: sv->sv_ino;
+			if (goal != 0) {
+				goal++;
+			}
+			result = sfs_balloc_file(sv, goal, &block);
 			if (result) {
 				return result;
 			}
 
 			/* Remember what we allocated; mark inode dirty */
 			sv->sv_i.sfi_direct[fileblock] = block;
-			sv->sv_dirty = true;
+			sfs_dirty(sv);
 		}
 
 		/*
@@ -140,9 +549,10 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * There's no indirect block allocated, but we need to
 		 * allocate a block whose number needs to be stored in
 		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
+		 * indirect block. (sfs_balloc zeroes it.) Put it
+		 * anywhere: not in the way of the data blocks.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		result = sfs_balloc(sfs, 0, &idblock);
 		if (result) {
 			return result;
 		}
@@ -151,40 +561,42 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		sv->sv_i.sfi_indirect = idblock;
 
 		/* Mark the inode dirty */
-		sv->sv_dirty = true;
-
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+		sfs_dirty(sv);
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+
+	/*
+	 * Load the indirect block; we work on it in the buffer cache.
+	 */
+	result = buf_read(sfs->sfs_device, idblock, &idbuf);
+	if (result) {
+		return result;
 	}
+	idptrs = buf_data(idbuf);
 
 	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	block = idptrs[idoff];
 
 	/* If there's no block there, allocate one */
 	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+		goal = idoff > 0 ? idptrs[idoff-1]
+			: sv->sv_i.sfi_direct[SFS_NDIRECT-1];
+		if (goal != 0) {
+			goal++;
+		}
+		result = sfs_balloc_file(sv, goal, &block);
 		if (result) {
+			buf_release(idbuf);
 			return result;
 		}
 
 		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+		idptrs[idoff] = block;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+		/* The indirect block is now dirty */
+		sfs_jdirty(sfs, idblock, idbuf);
+		sv->sv_syncdirty = true;
 	}
+	buf_release(idbuf);
 
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
@@ -196,21 +608,75 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Look up the disk blocks for the NBLOCKS file blocks from FILEBLOCK
+ * on, without allocating anything, and put them in DISKBLOCKS (0 for
+ * a hole, or past the largest file). The same as calling sfs_bmap for
+ * each, but the indirect block is fetched only once.
  */
 int
-sfs_itrunc(struct sfs_vnode *sv, off_t len)
+sfs_bmap_range(struct sfs_vnode *sv, uint32_t fileblock, uint32_t nblocks,
+	       daddr_t *diskblocks)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *idbuf = NULL;
+	uint32_t *idptrs = NULL;
+	uint32_t i, fb, idoff;
+	daddr_t block;
+	int result;
+
+	KASSERT(!SFS_ISINLINE(sv));
+
+	for (i = 0; i < nblocks; i++) {
+		fb = fileblock + i;
+		if (SFS_EXTENTS(sfs)) {
+			block = sfs_ext_lookup(&sv->sv_i, fb);
+		}
+		else if (fb < SFS_NDIRECT) {
+			block = sv->sv_i.sfi_direct[fb];
+		}
+		else if (fb - SFS_NDIRECT >= SFS_NINDIRECT * SFS_DBPERIDB ||
+			 sv->sv_i.sfi_indirect == 0) {
+			block = 0;
+		}
+		else {
+			/* (there's only the one indirect block) */
+			if (idbuf == NULL) {
+				result = buf_read(sfs->sfs_device,
+						  sv->sv_i.sfi_indirect,
+						  &idbuf);
+				if (result) {
+					return result;
+				}
+				idptrs = buf_data(idbuf);
+			}
+			idoff = (fb - SFS_NDIRECT) % SFS_DBPERIDB;
+			block = idptrs[idoff];
+		}
 
+		if (block != 0 && !sfs_bused(sfs, block)) {
+			panic("sfs: Data block %u (block %u of file %u) "
+			      "marked free\n", block, fb, sv->sv_ino);
+		}
+		diskblocks[i] = block;
+	}
+
+	if (idbuf != NULL) {
+		buf_release(idbuf);
+	}
+	return 0;
+}
+
+/*
+ * Called for ftruncate() and from sfs_reclaim (or the orphan reaper).
+ * The blocks are freed in batches (see sfs_freebatch_add).
+ */
+int
+sfs_itrunc(struct sfs_vnode *sv, off_t len)
+{
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_freebatch fb;
+	struct buf *idbuf;
+	uint32_t *idptrs;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
@@ -221,9 +687,37 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	int result;
 	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
+
+	sfs_dl_truncate(sv, len);
+	sfs_prealloc_release(sv);
 
-	vfs_biglock_acquire();
+	if (SFS_ISINLINE(sv)) {
+		if (len <= SFS_INLINESIZE) {
+			/* keep the bytes past the end 0 */
+			if (len < sv->sv_i.sfi_size) {
+				bzero(sv->sv_i.sfi_data + len,
+				      sv->sv_i.sfi_size - len);
+			}
+			sv->sv_i.sfi_size = len;
+			sfs_dirty(sv);
+			return 0;
+		}
+		result = sfs_inline_evict(sv);
+		if (result) {
+			return result;
+		}
+	}
+
+	sfs_freebatch_init(&fb);
+
+	if (SFS_EXTENTS(sfs)) {
+		sfs_ext_itrunc(sv, blocklen, &fb);
+		sfs_freebatch_flush(sfs, &fb);
+		sv->sv_i.sfi_size = len;
+		sfs_dirty(sv);
+		return 0;
+	}
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -232,9 +726,9 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	for (i=0; i<SFS_NDIRECT; i++) {
 		block = sv->sv_i.sfi_direct[i];
 		if (i >= blocklen && block != 0) {
-			sfs_bfree(sfs, block);
+			sfs_freebatch_add(sfs, &fb, block);
 			sv->sv_i.sfi_direct[i] = 0;
-			sv->sv_dirty = true;
+			sfs_dirty(sv);
 		}
 	}
 
@@ -251,51 +745,769 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		/* We're past the proposed EOF; may need to free stuff */
 
 		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = buf_read(sfs->sfs_device, idblock, &idbuf);
 		if (result) {
-			vfs_biglock_release();
+			sfs_freebatch_flush(sfs, &fb);
 			return result;
 		}
+		idptrs = buf_data(idbuf);
 
 		hasnonzero = 0;
 		iddirty = 0;
 		for (j=0; j<SFS_DBPERIDB; j++) {
 			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
+			if (blocklen < baseblock+j && idptrs[j] != 0) {
+				sfs_freebatch_add(sfs, &fb, idptrs[j]);
+				idptrs[j] = 0;
 				iddirty = 1;
+				/* don't hog the cpu over a big file */
+				cond_resched();
 			}
 			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
+			if (idptrs[j]!=0) {
 				hasnonzero=1;
 			}
 		}
 
+		if (iddirty) {
+			/* The indirect block is dirty */
+			sfs_jdirty(sfs, idblock, idbuf);
+			sv->sv_syncdirty = true;
+		}
+		buf_release(idbuf);
+
 		if (!hasnonzero) {
 			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
+			sfs_freebatch_add(sfs, &fb, idblock);
 			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
+			sfs_dirty(sv);
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
+	}
+	sfs_freebatch_flush(sfs, &fb);
+
+	/* Set the file size */
+	sv->sv_i.sfi_size = len;
+
+	/* Mark the inode dirty */
+	sfs_dirty(sv);
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Holes and preallocation
+
+/*
+ * A file's holes are the blocks its map has none for; they read as
+ * zeros. sfs_findhole (for SEEK_HOLE and SEEK_DATA) finds where they
+ * start and end, going over an extent at a time rather than a block
+ * at a time where there are extents, so that a copy can skip them.
+ * sfs_punch (fallocate, FALLOC_FL_PUNCH_HOLE) makes one, freeing the
+ * blocks. sfs_allocrange (fallocate otherwise) fills them in ahead of
+ * the writes, each hole from one run of free blocks if there's one
+ * that long (sfs_balloc_run), so that a file can be laid out in one
+ * piece before it's written in any order. SFS has no way to mark a
+ * block allocated but not written, so the new blocks are zeroed, as
+ * any newly allocated block is. Blocks written but still waiting for
+ * allocation (see sfs_io.c) count as data; the two that change the
+ * map allocate them first.
+ */
+
+/*
+ * Whether file block FILEBLOCK is data, and how many blocks from it
+ * on, before NBLOCKS, are the same (at least 1).
+ */
+static
+int
+sfs_blockrun(struct sfs_vnode *sv, uint32_t fileblock, uint32_t nblocks,
+	     bool *isdata, uint32_t *run)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	const struct sfs_extent *e;
+	uint32_t off, n, dlend;
+	daddr_t block;
+	unsigned i;
+	int result;
+
+	KASSERT(fileblock < nblocks);
+
+	if (SFS_EXTENTS(sfs)) {
+		i = sfs_ext_find(&sv->sv_i, fileblock, &off);
+		if (i == sv->sv_i.sfi_nextents) {
+			*isdata = false;
+			n = nblocks - fileblock;
+		}
+		else {
+			e = &sv->sv_i.sfi_extents[i];
+			*isdata = e->sfe_start != 0;
+			n = e->sfe_len - off;
+		}
+	}
+	else {
+		result = sfs_bmap(sv, fileblock, false, &block);
+		if (result) {
+			return result;
+		}
+		*isdata = block != 0;
+		n = 1;
+	}
+	if (n > nblocks - fileblock) {
+		n = nblocks - fileblock;
+	}
+
+	/* the blocks waiting for allocation are all in holes */
+	if (!*isdata && sv->sv_dlcount > 0) {
+		dlend = sv->sv_dlfirst + sv->sv_dlcount;
+		if (fileblock >= sv->sv_dlfirst && fileblock < dlend) {
+			*isdata = true;
+			if (n > dlend - fileblock) {
+				n = dlend - fileblock;
+			}
+		}
+		else if (sv->sv_dlfirst > fileblock &&
+			 sv->sv_dlfirst - fileblock < n) {
+			n = sv->sv_dlfirst - fileblock;
+		}
+	}
+	*run = n;
+	return 0;
+}
+
+/*
+ * Find the first hole (if HOLE) or data at or after byte POS, as
+ * vop_seekhole. Call with the vnode locked, shared will do.
+ */
+int
+sfs_findhole(struct sfs_vnode *sv, off_t pos, bool hole, off_t *ret)
+{
+	off_t size = sv->sv_i.sfi_size;
+	uint32_t fileblock, nblocks, run;
+	bool isdata;
+	int result;
+
+	if (pos < 0 || pos >= size) {
+		return ENXIO;
+	}
+	if (SFS_ISINLINE(sv)) {
+		/* no blocks, so no holes */
+		*ret = hole ? size : pos;
+		return 0;
+	}
+
+	nblocks = DIVROUNDUP(size, SFS_BLOCKSIZE);
+	for (fileblock = pos / SFS_BLOCKSIZE; fileblock < nblocks;
+	     fileblock += run) {
+		result = sfs_blockrun(sv, fileblock, nblocks, &isdata, &run);
+		if (result) {
+			return result;
+		}
+		if (isdata != hole) {
+			*ret = (off_t)fileblock * SFS_BLOCKSIZE;
+			if (*ret < pos) {
+				*ret = pos;
+			}
+			return 0;
+		}
+	}
+
+	/* there's always the hole at the end */
+	if (hole) {
+		*ret = size;
+		return 0;
+	}
+	return ENXIO;
+}
+
+/*
+ * Zero LEN bytes from OFFSET in file block FILEBLOCK, if it has a
+ * disk block.
+ */
+static
+int
+sfs_zeropart(struct sfs_vnode *sv, uint32_t fileblock, uint32_t offset,
+	     uint32_t len)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *b;
+	daddr_t block;
+	int result;
+
+	KASSERT(offset + len <= SFS_BLOCKSIZE);
+
+	result = sfs_bmap(sv, fileblock, false, &block);
+	if (result || block == 0) {
+		return result;
+	}
+	result = buf_read(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	bzero((char *)buf_data(b) + offset, len);
+	buf_markdirty(b);
+	buf_release(b);
+	return 0;
+}
+
+/* sfs_punch for block pointers: free file blocks FROM up to TO */
+static
+int
+sfs_blk_punch(struct sfs_vnode *sv, uint32_t from, uint32_t to,
+	      struct sfs_freebatch *fb)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *idbuf;
+	uint32_t *idptrs;
+	uint32_t i, j;
+	bool hasnonzero, iddirty;
+	int result;
+
+	for (i = from; i < to && i < SFS_NDIRECT; i++) {
+		if (sv->sv_i.sfi_direct[i] != 0) {
+			sfs_freebatch_add(sfs, fb, sv->sv_i.sfi_direct[i]);
+			sv->sv_i.sfi_direct[i] = 0;
+			sfs_dirty(sv);
+		}
+	}
+	if (to <= SFS_NDIRECT || sv->sv_i.sfi_indirect == 0) {
+		return 0;
+	}
+
+	result = buf_read(sfs->sfs_device, sv->sv_i.sfi_indirect, &idbuf);
+	if (result) {
+		return result;
+	}
+	idptrs = buf_data(idbuf);
+
+	hasnonzero = false;
+	iddirty = false;
+	for (j = 0; j < SFS_DBPERIDB; j++) {
+		i = SFS_NDIRECT + j;
+		if (i >= from && i < to && idptrs[j] != 0) {
+			sfs_freebatch_add(sfs, fb, idptrs[j]);
+			idptrs[j] = 0;
+			iddirty = true;
+		}
+		if (idptrs[j] != 0) {
+			hasnonzero = true;
+		}
+	}
+	if (iddirty) {
+		sfs_jdirty(sfs, sv->sv_i.sfi_indirect, idbuf);
+		sv->sv_syncdirty = true;
+	}
+	buf_release(idbuf);
+
+	if (!hasnonzero) {
+		/* as in sfs_itrunc: all empty, so it can go too */
+		sfs_freebatch_add(sfs, fb, sv->sv_i.sfi_indirect);
+		sv->sv_i.sfi_indirect = 0;
+		sfs_dirty(sv);
+	}
+	return 0;
+}
+
+/*
+ * Make the bytes from START to START+LEN (or to the end of the file)
+ * a hole: free the blocks wholly inside, and zero the parts of the
+ * ones at the ends. The size stays the same. Call with the vnode
+ * locked exclusive, within a handle.
+ */
+int
+sfs_punch(struct sfs_vnode *sv, off_t start, off_t len)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_freebatch fb;
+	off_t end, size;
+	uint32_t first, last;
+	int result;
+
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
+
+	size = sv->sv_i.sfi_size;
+	end = start + len;
+	if (end > size) {
+		end = size;
+	}
+	if (start >= end) {
+		return 0;
+	}
+
+	if (SFS_ISINLINE(sv)) {
+		bzero(sv->sv_i.sfi_data + start, end - start);
+		sfs_dirty(sv);
+		return 0;
+	}
+
+	result = sfs_dl_flush(sv);
+	if (result) {
+		return result;
+	}
+
+	/* the whole blocks */
+	first = DIVROUNDUP(start, SFS_BLOCKSIZE);
+	last = end / SFS_BLOCKSIZE;
+
+	if (first > last) {
+		/* it's all in the one block */
+		return sfs_zeropart(sv, last, start % SFS_BLOCKSIZE,
+				    end - start);
+	}
+	if (start % SFS_BLOCKSIZE != 0) {
+		result = sfs_zeropart(sv, first - 1, start % SFS_BLOCKSIZE,
+				      SFS_BLOCKSIZE - start % SFS_BLOCKSIZE);
+		if (result) {
+			return result;
+		}
+	}
+	if (end % SFS_BLOCKSIZE != 0) {
+		result = sfs_zeropart(sv, last, 0, end % SFS_BLOCKSIZE);
+		if (result) {
+			return result;
+		}
+	}
+	if (first == last) {
+		return 0;
+	}
+
+	sfs_freebatch_init(&fb);
+	if (SFS_EXTENTS(sfs)) {
+		result = sfs_ext_punch(sv, first, last, &fb);
+	}
+	else {
+		result = sfs_blk_punch(sv, first, last, &fb);
+	}
+	sfs_freebatch_flush(sfs, &fb);
+	return result;
+}
+
+/*
+ * Allocate blocks for the holes from byte START to START+LEN, and
+ * unless KEEPSIZE make the file that long if it isn't. Fails with
+ * ENOSPC up front if there surely isn't room; if it runs out partway
+ * anyway, what it did allocate stays. Call with the vnode locked
+ * exclusive, within a handle.
+ */
+int
+sfs_allocrange(struct sfs_vnode *sv, off_t start, off_t len, bool keepsize)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t fileblock, first, last, run, need, i;
+	daddr_t goal, block;
+	off_t end;
+	bool isdata;
+	int result;
+
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
+
+	end = start + len;
+	if (end > (off_t)0xffffffff) {
+		/* (sfi_size is 32 bits) */
+		return EFBIG;
+	}
+
+	if (SFS_ISINLINE(sv)) {
+		if (end <= SFS_INLINESIZE || (keepsize &&
+		    start >= (off_t)sv->sv_i.sfi_size)) {
+			/* the room's there already, or nothing's wanted */
+			goto done;
+		}
+		result = sfs_inline_evict(sv);
+		if (result) {
+			return result;
+		}
+	}
+
+	result = sfs_dl_flush(sv);
+	if (result) {
+		return result;
+	}
+
+	first = start / SFS_BLOCKSIZE;
+	last = DIVROUNDUP(end, SFS_BLOCKSIZE);
+
+	need = 0;
+	for (fileblock = first; fileblock < last; fileblock += run) {
+		result = sfs_blockrun(sv, fileblock, last, &isdata, &run);
+		if (result) {
+			return result;
+		}
+		if (!isdata) {
+			need += run;
+		}
+	}
+	if (need == 0) {
+		goto done;
+	}
+	if (!sfs_bavail(sfs, need)) {
+		return ENOSPC;
+	}
+
+	for (fileblock = first; fileblock < last; fileblock += run) {
+		result = sfs_blockrun(sv, fileblock, last, &isdata, &run);
+		if (result) {
+			return result;
+		}
+		if (isdata) {
+			continue;
+		}
+
+		/* a run for the hole, right after the block before it */
+		goal = sv->sv_ino + 1;
+		if (fileblock > 0) {
+			result = sfs_bmap(sv, fileblock - 1, false, &block);
 			if (result) {
-				vfs_biglock_release();
 				return result;
 			}
+			if (block != 0) {
+				goal = block + 1;
+			}
+		}
+		result = sfs_balloc_run(sv, goal, run);
+		if (result) {
+			return result;
 		}
+		for (i = 0; i < run; i++) {
+			result = sfs_bmap(sv, fileblock + i, true, &block);
+			if (result) {
+				sfs_prealloc_release(sv);
+				return result;
+			}
+		}
+		/* don't hog the cpu over a big file */
+		cond_resched();
 	}
 
-	/* Set the file size */
-	sv->sv_i.sfi_size = len;
+ done:
+	if (!keepsize && end > (off_t)sv->sv_i.sfi_size) {
+		sv->sv_i.sfi_size = end;
+		sfs_dirty(sv);
+	}
+	return 0;
+}
 
-	/* Mark the inode dirty */
-	sv->sv_dirty = true;
+////////////////////////////////////////////////////////////
+// Defragmenting
+
+/*
+ * A file whose blocks are scattered reads slowly even with readahead,
+ * as every jump between runs is a seek and a separate device request.
+ * sfs_defrag (SFS_IOC_DEFRAG) copies such a file's blocks to one free
+ * run, in file order, and points the inode (and indirect block) at
+ * the copies. The new blocks are written out before the map changes;
+ * the map change and the frees then go in one transaction, so after a
+ * crash the file is in the old blocks or the new ones, and the old
+ * ones can't be reused before the change is on the disk. Holes stay
+ * holes.
+ */
+
+/*
+ * Get the whole of SV's block map (0 for a hole) into a new array,
+ * and its length.
+ */
+static
+int
+sfs_getmap(struct sfs_vnode *sv, daddr_t **ret, uint32_t *retn)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t *blocks;
+	uint32_t n;
+	unsigned i;
+	int result;
+
+	if (SFS_EXTENTS(sfs)) {
+		/* (they cover the file; maybe not right to its end) */
+		n = 0;
+		for (i = 0; i < sv->sv_i.sfi_nextents; i++) {
+			n += sv->sv_i.sfi_extents[i].sfe_len;
+		}
+	}
+	else {
+		n = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+		if (n > SFS_NDIRECT + SFS_NINDIRECT * SFS_DBPERIDB) {
+			n = SFS_NDIRECT + SFS_NINDIRECT * SFS_DBPERIDB;
+		}
+	}
 
-	vfs_biglock_release();
+	blocks = NULL;
+	if (n > 0) {
+		blocks = kmalloc_tagged(n * sizeof(*blocks), KM_FS);
+		if (blocks == NULL) {
+			return ENOMEM;
+		}
+		result = sfs_bmap_range(sv, 0, n, blocks);
+		if (result) {
+			kfree(blocks);
+			return result;
+		}
+	}
+	*ret = blocks;
+	*retn = n;
 	return 0;
 }
 
+/* Count the blocks in a map, and the runs of consecutive ones. */
+static
+void
+sfs_fragcount(const daddr_t *blocks, uint32_t n, struct sfs_fragstat *st)
+{
+	daddr_t prev;
+	uint32_t i;
+
+	st->sfs_blocks = 0;
+	st->sfs_runs = 0;
+	prev = 0;
+	for (i = 0; i < n; i++) {
+		if (blocks[i] == 0) {
+			/* a hole doesn't break a run */
+			continue;
+		}
+		st->sfs_blocks++;
+		if (prev == 0 || blocks[i] != prev + 1) {
+			st->sfs_runs++;
+		}
+		prev = blocks[i];
+	}
+}
+
+/*
+ * Copy the blocks of the map BLOCKS, in order, to the ones from START
+ * on, and write the copies out.
+ */
+static
+int
+sfs_defrag_copy(struct sfs_fs *sfs, const daddr_t *blocks, uint32_t n,
+		daddr_t start)
+{
+	daddr_t done[BUF_MAXRUN];
+	struct buf *from, *to;
+	uint32_t i, j, k;
+	unsigned ndone;
+	int result;
+
+	k = 0;
+	ndone = 0;
+	for (i = 0; i < n; i++) {
+		if (blocks[i] == 0) {
+			continue;
+		}
+
+		/* At the start of an old run, read all of it in at once */
+		if (i == 0 || blocks[i - 1] == 0 ||
+		    blocks[i] != blocks[i - 1] + 1) {
+			for (j = 1; i + j < n && j < BUF_MAXRUN &&
+				     blocks[i + j] == blocks[i] + j; j++) {
+				/* nothing */
+			}
+			(void)buf_readrun(sfs->sfs_device, blocks[i], j);
+		}
+
+		result = buf_read(sfs->sfs_device, blocks[i], &from);
+		if (result) {
+			return result;
+		}
+		result = buf_get(sfs->sfs_device, start + k, &to);
+		if (result) {
+			buf_release(from);
+			return result;
+		}
+		memcpy(buf_data(to), buf_data(from), SFS_BLOCKSIZE);
+		buf_markdirty(to);
+		buf_release(to);
+		buf_release(from);
+
+		done[ndone++] = start + k;
+		k++;
+		if (ndone == BUF_MAXRUN) {
+			result = buf_flushblocks(sfs->sfs_device, done, ndone);
+			if (result) {
+				return result;
+			}
+			ndone = 0;
+			/* don't hog the cpu over a big file */
+			cond_resched();
+		}
+	}
+	if (ndone > 0) {
+		return buf_flushblocks(sfs->sfs_device, done, ndone);
+	}
+	return 0;
+}
+
+/*
+ * Point SV's map at the blocks from START on instead of the ones in
+ * BLOCKS, in order. Fails only before changing anything.
+ */
+static
+int
+sfs_defrag_remap(struct sfs_vnode *sv, const daddr_t *blocks, uint32_t n,
+		 daddr_t start)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dinode *di = &sv->sv_i;
+	struct sfs_extent *e;
+	struct buf *idbuf;
+	uint32_t *idptrs;
+	daddr_t block;
+	uint32_t i, k;
+	int result;
+
+	if (SFS_EXTENTS(sfs)) {
+		/*
+		 * Build the list again. A new extent starts only where a
+		 * hole starts or ends, and an old one had to as well, so
+		 * it's no longer.
+		 */
+		bzero(di->sfi_extents, sizeof(di->sfi_extents));
+		di->sfi_nextents = 0;
+		k = 0;
+		for (i = 0; i < n; i++) {
+			block = blocks[i] == 0 ? 0 : start + k++;
+			if (di->sfi_nextents > 0) {
+				e = &di->sfi_extents[di->sfi_nextents - 1];
+				if ((e->sfe_start == 0 && block == 0) ||
+				    (e->sfe_start != 0 &&
+				     e->sfe_start + e->sfe_len == block)) {
+					e->sfe_len++;
+					continue;
+				}
+			}
+			KASSERT(di->sfi_nextents < SFS_NEXTENTS);
+			sfs_ext_insert(di, di->sfi_nextents, block, 1);
+		}
+		sfs_dirty(sv);
+		return 0;
+	}
+
+	idbuf = NULL;
+	idptrs = NULL;
+	if (n > SFS_NDIRECT && di->sfi_indirect != 0) {
+		/* (if there's none, past the direct blocks is all hole) */
+		result = buf_read(sfs->sfs_device, di->sfi_indirect, &idbuf);
+		if (result) {
+			return result;
+		}
+		idptrs = buf_data(idbuf);
+	}
+
+	k = 0;
+	for (i = 0; i < n; i++) {
+		if (blocks[i] == 0) {
+			continue;
+		}
+		if (i < SFS_NDIRECT) {
+			di->sfi_direct[i] = start + k;
+		}
+		else {
+			idptrs[i - SFS_NDIRECT] = start + k;
+		}
+		k++;
+	}
+	if (idbuf != NULL) {
+		sfs_jdirty(sfs, di->sfi_indirect, idbuf);
+		buf_release(idbuf);
+	}
+	sv->sv_syncdirty = true;
+	sfs_dirty(sv);
+	return 0;
+}
+
+/*
+ * Say how file SV lies on the disk. Call with the vnode locked.
+ */
+int
+sfs_getfrags(struct sfs_vnode *sv, struct sfs_fragstat *st)
+{
+	daddr_t *blocks;
+	uint32_t n;
+	int result;
+
+	bzero(st, sizeof(*st));
+	if (SFS_ISINLINE(sv)) {
+		/* it's all in the inode */
+		return 0;
+	}
+	result = sfs_getmap(sv, &blocks, &n);
+	if (result) {
+		return result;
+	}
+	sfs_fragcount(blocks, n, st);
+	kfree(blocks);
+	return 0;
+}
+
+/*
+ * Move file SV's blocks to one free run, and say how it lies then.
+ * Does nothing if they're in one already; fails with ENOSPC if there
+ * isn't a free run that long. Call with the vnode locked exclusive,
+ * within a handle.
+ */
+int
+sfs_defrag(struct sfs_vnode *sv, struct sfs_fragstat *st)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_freebatch fb;
+	daddr_t *blocks, start;
+	uint32_t n, nmove, i;
+	int result;
+
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
+
+	bzero(st, sizeof(*st));
+	if (SFS_ISINLINE(sv)) {
+		return 0;
+	}
+
+	/* blocks still waiting for allocation get some first */
+	result = sfs_dl_flush(sv);
+	if (result) {
+		return result;
+	}
+	result = sfs_getmap(sv, &blocks, &n);
+	if (result) {
+		return result;
+	}
+	sfs_fragcount(blocks, n, st);
+	if (st->sfs_runs <= 1) {
+		kfree(blocks);
+		return 0;
+	}
+
+	/* Set the new blocks aside (sfs_balloc_run takes the longest) */
+	nmove = st->sfs_blocks;
+	result = sfs_balloc_run(sv, sv->sv_ino + 1, nmove);
+	if (result == 0 && sv->sv_nprealloc < nmove) {
+		sfs_prealloc_release(sv);
+		result = ENOSPC;
+	}
+	if (result) {
+		kfree(blocks);
+		return result;
+	}
+	start = sv->sv_prealloc;
+
+	result = sfs_defrag_copy(sfs, blocks, n, start);
+	if (result == 0) {
+		result = sfs_defrag_remap(sv, blocks, n, start);
+	}
+	if (result) {
+		/* nothing points to them */
+		sfs_prealloc_release(sv);
+		kfree(blocks);
+		return result;
+	}
+	sv->sv_nprealloc = 0;
+	sv->sv_preany = false;
+
+	sfs_freebatch_init(&fb);
+	for (i = 0; i < n; i++) {
+		if (blocks[i] != 0) {
+			sfs_freebatch_add(sfs, &fb, blocks[i]);
+		}
+	}
+	sfs_freebatch_flush(sfs, &fb);
+	kfree(blocks);
+
+	st->sfs_runs = 1;
+	st->sfs_moved = nmove;
+	return 0;
+}
@@ -35,7 +35,11 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <stat.h>
+#include <synch.h>
+#include <uio.h>
 #include <vfs.h>
+#include <vnode.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -94,18 +98,361 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+////////////////////////////////////////////////////////////
+// Name index
+
+/*
+ * So that looking a name up doesn't mean reading every entry in the
+ * directory, each directory vnode gets a hash table from names (by
+ * hash value) to slots, and a stack of its empty slots, the first
+ * time it's searched. After that the table is kept up to date as
+ * names are linked and unlinked, and a lookup reads only the slots
+ * whose names hash the same, to check the name. If memory runs out
+ * while updating it the index is thrown away; the next lookup will
+ * build it again.
+ *
+ * The index is in memory only; it goes when the vnode does.
+ */
+
+/* Starting number of hash buckets (a power of two). */
+#define SFS_DIRIX_MINBUCKETS	16
+
+struct sfs_dirix_entry {
+	struct sfs_dirix_entry *de_next;
+	uint32_t de_hash;
+	uint32_t de_ino;
+	int de_slot;
+};
+
+struct sfs_dirindex {
+	struct sfs_dirix_entry **di_buckets;
+	unsigned di_nbuckets;
+	unsigned di_nentries;
+	int *di_free;			/* empty slots, as a stack */
+	unsigned di_nfree, di_maxfree;
+};
+
+static
+uint32_t
+sfs_dirix_hash(const char *name)
+{
+	uint32_t h = 2166136261U;	/* FNV-1a */
+
+	for (; *name != 0; name++) {
+		h = (h ^ (unsigned char)*name) * 16777619U;
+	}
+	return h;
+}
+
+static
+void
+sfs_dirix_destroy(struct sfs_dirindex *di)
+{
+	struct sfs_dirix_entry *de;
+	unsigned i;
+
+	for (i = 0; i < di->di_nbuckets; i++) {
+		while ((de = di->di_buckets[i]) != NULL) {
+			di->di_buckets[i] = de->de_next;
+			kfree(de);
+		}
+	}
+	kfree(di->di_buckets);
+	kfree(di->di_free);
+	kfree(di);
+}
+
+/* Make the table twice as big, if there's memory for it */
+static
+void
+sfs_dirix_grow(struct sfs_dirindex *di)
+{
+	struct sfs_dirix_entry **nb, *de;
+	unsigned n, i;
+
+	n = di->di_nbuckets * 2;
+	nb = kmalloc_tagged(n * sizeof(*nb), KM_FS);
+	if (nb == NULL) {
+		/* it'll just be slower */
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		nb[i] = NULL;
+	}
+	for (i = 0; i < di->di_nbuckets; i++) {
+		while ((de = di->di_buckets[i]) != NULL) {
+			di->di_buckets[i] = de->de_next;
+			de->de_next = nb[de->de_hash & (n - 1)];
+			nb[de->de_hash & (n - 1)] = de;
+		}
+	}
+	kfree(di->di_buckets);
+	di->di_buckets = nb;
+	di->di_nbuckets = n;
+}
+
+static
+int
+sfs_dirix_insert(struct sfs_dirindex *di, const char *name, uint32_t ino,
+		 int slot)
+{
+	struct sfs_dirix_entry *de, **bucket;
+
+	de = kmalloc_tagged(sizeof(*de), KM_FS);
+	if (de == NULL) {
+		return ENOMEM;
+	}
+	de->de_hash = sfs_dirix_hash(name);
+	de->de_ino = ino;
+	de->de_slot = slot;
+	bucket = &di->di_buckets[de->de_hash & (di->di_nbuckets - 1)];
+	de->de_next = *bucket;
+	*bucket = de;
+	di->di_nentries++;
+	if (di->di_nentries > 2 * di->di_nbuckets) {
+		sfs_dirix_grow(di);
+	}
+	return 0;
+}
+
+static
+int
+sfs_dirix_pushfree(struct sfs_dirindex *di, int slot)
+{
+	int *nf;
+	unsigned n;
+
+	if (di->di_nfree == di->di_maxfree) {
+		n = di->di_maxfree ? di->di_maxfree * 2 : 8;
+		nf = kmalloc_tagged(n * sizeof(*nf), KM_FS);
+		if (nf == NULL) {
+			return ENOMEM;
+		}
+		if (di->di_nfree > 0) {
+			memcpy(nf, di->di_free, di->di_nfree * sizeof(*nf));
+		}
+		kfree(di->di_free);
+		di->di_free = nf;
+		di->di_maxfree = n;
+	}
+	di->di_free[di->di_nfree++] = slot;
+	return 0;
+}
+
+/* Read every slot of the directory and index it */
+static
+int
+sfs_dirix_build(struct sfs_vnode *sv, struct sfs_dirindex **ret)
+{
+	struct sfs_dirindex *di;
+	struct sfs_direntry tsd;
+	int nentries, i, result;
+	unsigned j;
+
+	di = kmalloc_tagged(sizeof(*di), KM_FS);
+	if (di == NULL) {
+		return ENOMEM;
+	}
+	di->di_nbuckets = SFS_DIRIX_MINBUCKETS;
+	di->di_nentries = 0;
+	di->di_free = NULL;
+	di->di_nfree = di->di_maxfree = 0;
+	di->di_buckets = kmalloc_tagged(di->di_nbuckets * sizeof(*di->di_buckets),
+					KM_FS);
+	if (di->di_buckets == NULL) {
+		kfree(di);
+		return ENOMEM;
+	}
+	for (j = 0; j < di->di_nbuckets; j++) {
+		di->di_buckets[j] = NULL;
+	}
+
+	nentries = sfs_dir_nentries(sv);
+	for (i=0; i<nentries; i++) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result == 0 && tsd.sfd_ino == SFS_NOINO) {
+			result = sfs_dirix_pushfree(di, i);
+		}
+		else if (result == 0) {
+			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+			result = sfs_dirix_insert(di, tsd.sfd_name,
+						  tsd.sfd_ino, i);
+		}
+		if (result) {
+			sfs_dirix_destroy(di);
+			return result;
+		}
+	}
+
+	*ret = di;
+	return 0;
+}
+
+/*
+ * Get the directory's index, building it if need be. Returns NULL
+ * if it couldn't be built. Call with sv_lock held, shared or not.
+ */
+static
+struct sfs_dirindex *
+sfs_dirix_get(struct sfs_vnode *sv)
+{
+	struct sfs_dirindex *di;
+
+	spinlock_acquire(&sv->sv_spinlock);
+	di = sv->sv_dirindex;
+	spinlock_release(&sv->sv_spinlock);
+	if (di != NULL) {
+		return di;
+	}
+
+	if (sfs_dirix_build(sv, &di)) {
+		return NULL;
+	}
+
+	/* another lookup may have beaten us to it */
+	spinlock_acquire(&sv->sv_spinlock);
+	if (sv->sv_dirindex == NULL) {
+		sv->sv_dirindex = di;
+		spinlock_release(&sv->sv_spinlock);
+		return di;
+	}
+	spinlock_release(&sv->sv_spinlock);
+	sfs_dirix_destroy(di);
+	return sfs_dirix_get(sv);
+}
+
+/*
+ * Get the index only if it's there, to update it. Call with sv_lock
+ * held exclusive.
+ */
+static
+struct sfs_dirindex *
+sfs_dirix_peek(struct sfs_vnode *sv)
+{
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
+	return sv->sv_dirindex;
+}
+
+void
+sfs_dir_dropindex(struct sfs_vnode *sv)
+{
+	if (sv->sv_dirindex != NULL) {
+		sfs_dirix_destroy(sv->sv_dirindex);
+		sv->sv_dirindex = NULL;
+	}
+}
+
+/* Look NAME up with the index */
+static
+int
+sfs_dirix_find(struct sfs_vnode *sv, struct sfs_dirindex *di,
+	       const char *name, uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dirix_entry *de;
+	struct sfs_direntry tsd;
+	uint32_t h;
+	int result;
+
+	if (emptyslot != NULL && di->di_nfree > 0) {
+		*emptyslot = di->di_free[di->di_nfree - 1];
+	}
+
+	h = sfs_dirix_hash(name);
+	for (de = di->di_buckets[h & (di->di_nbuckets - 1)]; de != NULL;
+	     de = de->de_next) {
+		if (de->de_hash != h) {
+			continue;
+		}
+		result = sfs_readdir(sv, de->de_slot, &tsd);
+		if (result) {
+			return result;
+		}
+		tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+		if (!strcmp(tsd.sfd_name, name)) {
+			KASSERT(tsd.sfd_ino == de->de_ino);
+			if (slot != NULL) {
+				*slot = de->de_slot;
+			}
+			if (ino != NULL) {
+				*ino = de->de_ino;
+			}
+			return 0;
+		}
+	}
+	return ENOENT;
+}
+
+/* NAME was linked into SLOT */
+static
+void
+sfs_dirix_linked(struct sfs_vnode *sv, const char *name, uint32_t ino,
+		 int slot)
+{
+	struct sfs_dirindex *di = sfs_dirix_peek(sv);
+	unsigned i;
+
+	if (di == NULL) {
+		return;
+	}
+	for (i = di->di_nfree; i-- > 0; ) {
+		if (di->di_free[i] == slot) {
+			di->di_free[i] = di->di_free[--di->di_nfree];
+			break;
+		}
+	}
+	if (sfs_dirix_insert(di, name, ino, slot)) {
+		sfs_dir_dropindex(sv);
+	}
+}
+
+/* SLOT, which held NAME, was emptied */
+static
+void
+sfs_dirix_unlinked(struct sfs_vnode *sv, const char *name, int slot)
+{
+	struct sfs_dirindex *di = sfs_dirix_peek(sv);
+	struct sfs_dirix_entry *de, **dep;
+	uint32_t h;
+
+	if (di == NULL) {
+		return;
+	}
+	h = sfs_dirix_hash(name);
+	dep = &di->di_buckets[h & (di->di_nbuckets - 1)];
+	while ((de = *dep) != NULL && de->de_slot != slot) {
+		dep = &de->de_next;
+	}
+	KASSERT(de != NULL);
+	*dep = de->de_next;
+	kfree(de);
+	di->di_nentries--;
+	if (sfs_dirix_pushfree(di, slot)) {
+		sfs_dir_dropindex(sv);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Directory operations
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
- * empty directory slot if one is found.
+ * empty directory slot if one is found. This uses the name index if
+ * it can be had, and reads every slot if not.
  */
 int
 sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 		uint32_t *ino, int *slot, int *emptyslot)
 {
+	struct sfs_dirindex *di;
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
 
+	di = sfs_dirix_get(sv);
+	if (di != NULL) {
+		return sfs_dirix_find(sv, di, name, ino, slot, emptyslot);
+	}
+
 	nentries = sfs_dir_nentries(sv);
 
 	/* For each slot... */
@@ -185,7 +532,12 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, emptyslot, &sd);
+	result = sfs_writedir(sv, emptyslot, &sd);
+	if (result) {
+		return result;
+	}
+	sfs_dirix_linked(sv, name, ino, emptyslot);
+	return 0;
 }
 
 /*
@@ -194,14 +546,129 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
-	struct sfs_direntry sd;
+	struct sfs_direntry sd, old;
+	int result;
+
+	/* Get the name, for the index */
+	result = sfs_readdir(sv, slot, &old);
+	if (result) {
+		return result;
+	}
+	old.sfd_name[sizeof(old.sfd_name)-1] = 0;
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, slot, &sd);
+	result = sfs_writedir(sv, slot, &sd);
+	if (result) {
+		return result;
+	}
+	sfs_dirix_unlinked(sv, old.sfd_name, slot);
+	return 0;
+}
+
+/* Directory slots in a block. */
+#define SFS_DIRPERBLOCK	(SFS_BLOCKSIZE / sizeof(struct sfs_direntry))
+
+/*
+ * Read entries out of a directory from slot uio_offset on, for
+ * getdirentry: if ONENAME, just the first name, by itself; otherwise
+ * as many dirent records as fit (see vnode_putdirent). Whole blocks
+ * of slots are read at a time, and the rest of the directory is got
+ * into the buffer cache in as few device requests as it takes, rather
+ * than a slot per sfs_readdir. The type only comes back for files
+ * that are in memory already; finding it out for the others would
+ * mean reading each one's inode. Sets uio_offset to the next slot to
+ * look at. Call with sv_lock held, shared or not.
+ */
+int
+sfs_dir_read(struct sfs_vnode *sv, struct uio *uio, bool onename)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_direntry *sds, *sd;
+	uint32_t vnblock, nblocks, runend;
+	daddr_t diskblock;
+	int nentries, slot;
+	mode_t type;
+	bool done = false;
+	int result = 0;
+
+	KASSERT(uio->uio_offset >= 0);
+
+	nentries = sfs_dir_nentries(sv);
+	if (uio->uio_offset >= nentries) {
+		/* EOF */
+		return 0;
+	}
+	slot = uio->uio_offset;
+	nblocks = (nentries + SFS_DIRPERBLOCK - 1) / SFS_DIRPERBLOCK;
+
+	sds = kmalloc_tagged(SFS_BLOCKSIZE, KM_FS);
+	if (sds == NULL) {
+		return ENOMEM;
+	}
+
+	runend = 0;
+	while (slot < nentries && !done) {
+		vnblock = slot / SFS_DIRPERBLOCK;
+		if (!onename && vnblock >= runend) {
+			runend = vnblock +
+				sfs_readrun(sv, vnblock, nblocks - vnblock);
+		}
+
+		result = sfs_bmap(sv, vnblock, false, &diskblock);
+		if (result) {
+			break;
+		}
+		if (diskblock == 0) {
+			/* a hole: all empty slots */
+			slot = (vnblock + 1) * SFS_DIRPERBLOCK;
+			continue;
+		}
+		result = sfs_readblock(sfs, diskblock, sds, SFS_BLOCKSIZE);
+		if (result) {
+			break;
+		}
+
+		for (; slot < nentries && slot / SFS_DIRPERBLOCK == vnblock;
+		     slot++) {
+			sd = &sds[slot % SFS_DIRPERBLOCK];
+			if (sd->sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			sd->sfd_name[sizeof(sd->sfd_name)-1] = 0;
+
+			if (onename) {
+				result = uiomove(sd->sfd_name,
+						 strlen(sd->sfd_name), uio);
+				slot++;
+				done = true;
+				break;
+			}
+
+			switch (sfs_peektype(sfs, sd->sfd_ino)) {
+			    case SFS_TYPE_FILE: type = S_IFREG; break;
+			    case SFS_TYPE_DIR: type = S_IFDIR; break;
+			    default: type = 0; break;
+			}
+			result = vnode_putdirent(uio, sd->sfd_ino, type,
+						 sd->sfd_name);
+			if (result) {
+				/* ENOSPC: this one starts the next batch */
+				done = true;
+				break;
+			}
+		}
+	}
+
+	kfree(sds);
+	if (result == ENOSPC) {
+		result = 0;
+	}
+	uio->uio_offset = slot;
+	return result;
 }
 
 /*
@@ -39,8 +39,11 @@
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
+#include <synch.h>
+#include <thread.h>
 #include <vfs.h>
 #include <device.h>
+#include <bufcache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -66,6 +69,12 @@
  *
  * The sectors used by the superblock and the bitmap itself are
  * likewise marked in use by mksfs.
+ *
+ * Only the blocks marked in sfs_fmdirty are written, so a sync after
+ * a few allocations writes a block or two, not the whole bitmap.
+ *
+ * Call with sfs_freemaplock held (or during mount, before anyone else
+ * can see the volume).
  */
 static
 int
@@ -92,9 +101,15 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 			result = sfs_readblock(sfs, SFS_FREEMAP_START+j, ptr,
 					       SFS_BLOCKSIZE);
 		}
-		else {
+		else if (bitmap_isset(sfs->sfs_fmdirty, j)) {
 			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
 						SFS_BLOCKSIZE);
+			if (result == 0) {
+				bitmap_unmark(sfs->sfs_fmdirty, j);
+			}
+		}
+		else {
+			result = 0;
 		}
 
 		/* If we failed, stop. */
@@ -105,6 +120,25 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 	return 0;
 }
 
+/*
+ * Forget which freemap blocks changed; the journal has written them.
+ * Call with sfs_freemaplock held.
+ */
+static
+void
+sfs_freemapclean(struct sfs_fs *sfs)
+{
+	uint32_t j, freemapblocks;
+
+	freemapblocks = SFS_FS_FREEMAPBLOCKS(sfs);
+	for (j=0; j<freemapblocks; j++) {
+		if (bitmap_isset(sfs->sfs_fmdirty, j)) {
+			bitmap_unmark(sfs->sfs_fmdirty, j);
+		}
+	}
+	sfs->sfs_freemapdirty = false;
+}
+
 /*
  * Sync routine. This is what gets invoked if you do FS_SYNC on the
  * sfs filesystem structure.
@@ -114,11 +148,11 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs;
+	struct sfs_vnode *sv;
+	struct vnode **vns;
 	unsigned i, num;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -151,18 +185,68 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
+	if (sfs->sfs_readonly) {
+		/* nothing can have changed */
+		return 0;
+	}
+
+	/*
+	 * Go over the vnodes on the dirty list, syncing as we go. (Not
+	 * with VOP_FSYNC, which would flush the buffer cache for each
+	 * one; we do that once, below.) Each one comes off the list,
+	 * and goes back on if it's still dirty afterwards (or again).
+	 */
+	result = sfs_dirtylist_take(sfs, false, true, &vns, &num);
+	if (result) {
+		return result;
+	}
+
+	sfs_jbegin(sfs);
 	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		sv = vns[i]->vn_data;
+
+		rwlock_acquire_write(sv->sv_lock);
+		sfs_dl_flush(sv);
+		sfs_sync_inode(sv);
+		if (sv->sv_dirty || sv->sv_dlcount > 0) {
+			sfs_dirtylist_add(sv);
+		}
+		rwlock_release_write(sv->sv_lock);
+		VOP_DECREF(vns[i]);
 	}
+	sfs_jend(sfs);
+	kfree(vns);
+
+	/*
+	 * Free the orphans still waiting for the reaper (some may have
+	 * just come from the VOP_DECREFs above), so the freemap we
+	 * write has them.
+	 */
+	sfs_reap_orphans(sfs);
+
+	if (sfs->sfs_journal != NULL) {
+		/*
+		 * The freemap goes through the journal with the rest;
+		 * commit, and checkpoint everything, which puts it all
+		 * in place and lets the deferred frees go.
+		 */
+		result = sfs_jsync(sfs);
+		if (result) {
+			return result;
+		}
+		lock_acquire(sfs->sfs_freemaplock);
+		sfs_freemapclean(sfs);
+		lock_release(sfs->sfs_freemaplock);
+		return buf_flush(sfs->sfs_device);
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
 
 	/* If the free block map needs to be written, write it. */
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_freemapio(sfs, UIO_WRITE);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
@@ -173,14 +257,16 @@ sfs_sync(struct fs *fs)
 		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 					sizeof(sfs->sfs_sb));
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
 
-	vfs_biglock_release();
-	return 0;
+	lock_release(sfs->sfs_freemaplock);
+
+	/* Everything above went to the buffer cache; now to the disk. */
+	return buf_flush(sfs->sfs_device);
 }
 
 /*
@@ -193,13 +279,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
-
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
 
-	return ret;
+	/* (set at mount and never changed, so no lock) */
+	return sfs->sfs_sb.sb_volname;
 }
 
 /*
@@ -212,11 +294,44 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
-	vnodearray_destroy(sfs->sfs_vnodes);
+	if (sfs->sfs_fmdirty != NULL) {
+		bitmap_destroy(sfs->sfs_fmdirty);
+	}
+	KASSERT(sfs->sfs_numvnodes == 0);
+	KASSERT(sfs->sfs_ninactive == 0);
+	KASSERT(sfs->sfs_ndirty == 0);
+	KASSERT(sfs->sfs_orphans == NULL);
+	KASSERT(!sfs->sfs_reaperrunning);
+	KASSERT(!sfs->sfs_flusherrunning);
+	KASSERT(sfs->sfs_ndelayed == 0);
+	KASSERT(sfs->sfs_journal == NULL);
+	lock_destroy(sfs->sfs_vnlock);
+	lock_destroy(sfs->sfs_freemaplock);
+	lock_destroy(sfs->sfs_orphanlock);
+	cv_destroy(sfs->sfs_orphancv);
+	lock_destroy(sfs->sfs_reaplock);
+	spinlock_cleanup(&sfs->sfs_dirtylock);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
 
+/*
+ * Stop the reaper and the flusher, whichever are running.
+ */
+static
+void
+sfs_stopthreads(struct sfs_fs *sfs)
+{
+	lock_acquire(sfs->sfs_orphanlock);
+	sfs->sfs_reaperexit = true;
+	sfs->sfs_flusherexit = true;
+	cv_broadcast(sfs->sfs_orphancv, sfs->sfs_orphanlock);
+	while (sfs->sfs_reaperrunning || sfs->sfs_flusherrunning) {
+		cv_wait(sfs->sfs_orphancv, sfs->sfs_orphanlock);
+	}
+	lock_release(sfs->sfs_orphanlock);
+}
+
 /*
  * Unmount code.
  *
@@ -228,18 +343,35 @@ sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
 
-	vfs_biglock_acquire();
-
-	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+	/*
+	 * Do we have any files open? If so, can't unmount. (Nobody
+	 * can open one now without a reference to one we have, like
+	 * a current directory, so once this is zero it stays zero.
+	 * The inactive vnodes don't count; nobody can get at those
+	 * either, and they can go.)
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	if (sfs->sfs_numvnodes > sfs->sfs_ninactive) {
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
+	sfs_inactive_purge(sfs, true);
+
+	/* Stop the reaper and the flusher; the sync left them nothing */
+	KASSERT(sfs->sfs_orphans == NULL);
+	sfs_stopthreads(sfs);
+
+	/* The same for the journal thread; the sync emptied the log */
+	sfs_jshutdown(sfs);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Drop our blocks from the buffer cache (the sync wrote them) */
+	buf_invalidate(sfs->sfs_device);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -247,7 +379,6 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -271,6 +402,7 @@ struct sfs_fs *
 sfs_fs_create(void)
 {
 	struct sfs_fs *sfs;
+	unsigned i;
 
 	/*
 	 * Make sure our on-disk structures aren't messed up
@@ -280,7 +412,7 @@ sfs_fs_create(void)
 	COMPILE_ASSERT(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
 
 	/* Allocate object */
-	sfs = kmalloc(sizeof(struct sfs_fs));
+	sfs = kmalloc_tagged(sizeof(struct sfs_fs), KM_FS);
 	if (sfs==NULL) {
 		goto fail;
 	}
@@ -301,23 +433,77 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
+	for (i=0; i<SFS_VNHASHSIZE; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+	sfs->sfs_numvnodes = 0;
+	sfs->sfs_inactive = NULL;
+	sfs->sfs_inactivetail = &sfs->sfs_inactive;
+	sfs->sfs_ninactive = 0;
+	sfs->sfs_vnlock = lock_create("sfs_vnodes");
+	if (sfs->sfs_vnlock == NULL) {
 		goto cleanup_object;
 	}
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_fmdirty = NULL;
+	sfs->sfs_nfree = 0;
+	sfs->sfs_ndelayed = 0;
+	sfs->sfs_freemaplock = lock_create("sfs_freemap");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnlock;
+	}
+
+	/* unlinked files waiting to be freed */
+	sfs->sfs_orphans = NULL;
+	sfs->sfs_reaperexit = false;
+	sfs->sfs_reaperrunning = false;
+	sfs->sfs_flusherexit = false;
+	sfs->sfs_flusherrunning = false;
+	sfs->sfs_orphanlock = lock_create("sfs_orphans");
+	if (sfs->sfs_orphanlock == NULL) {
+		goto cleanup_freemaplock;
+	}
+	sfs->sfs_orphancv = cv_create("sfs_orphans");
+	if (sfs->sfs_orphancv == NULL) {
+		goto cleanup_orphanlock;
+	}
+	sfs->sfs_reaplock = lock_create("sfs_reap");
+	if (sfs->sfs_reaplock == NULL) {
+		goto cleanup_orphancv;
+	}
+
+	/* journal (set up by sfs_jinit, if the volume has one) */
+	sfs->sfs_journal = NULL;
+
+	/* vnodes with something for sync to do */
+	spinlock_init(&sfs->sfs_dirtylock);
+	sfs->sfs_dirtyvns = NULL;
+	sfs->sfs_ndirty = 0;
+
+	sfs->sfs_readonly = false;
 
 	return sfs;
 
+cleanup_orphancv:
+	cv_destroy(sfs->sfs_orphancv);
+cleanup_orphanlock:
+	lock_destroy(sfs->sfs_orphanlock);
+cleanup_freemaplock:
+	lock_destroy(sfs->sfs_freemaplock);
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
 cleanup_object:
 	kfree(sfs);
 fail:
 	return NULL;
 }
 
+/* Mount flags, passed to sfs_domount through vfs_mount */
+#define SFS_MOUNT_RDONLY	0x1
+
 /*
  * Mount routine.
  *
@@ -336,12 +522,9 @@ int
 sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
+	uint32_t i;
 	struct sfs_fs *sfs;
-
-	vfs_biglock_acquire();
-
-	/* We don't pass any options through mount */
-	(void)options;
+	unsigned flags = *(unsigned *)options;
 
 	/*
 	 * We can't mount on devices with the wrong sector size.
@@ -352,7 +535,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
@@ -360,19 +542,18 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
 	/* Set the device so we can use sfs_readblock() */
 	sfs->sfs_device = dev;
+	sfs->sfs_readonly = (flags & SFS_MOUNT_RDONLY) != 0;
 
 	/* Load superblock */
 	result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 			       sizeof(sfs->sfs_sb));
 	if (result) {
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -384,7 +565,13 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			sfs->sfs_sb.sb_magic,
 			SFS_MAGIC);
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
+		return EINVAL;
+	}
+
+	if (sfs->sfs_sb.sb_features & ~SFS_FEATURES_KNOWN) {
+		kprintf("sfs: Unsupported features in superblock (0x%x)\n",
+			sfs->sfs_sb.sb_features & ~SFS_FEATURES_KNOWN);
+		sfs_fs_destroy(sfs);
 		return EINVAL;
 	}
 
@@ -396,32 +583,85 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
 
+	/*
+	 * Replay the journal, if any, before reading anything it
+	 * covers. (Even read-only: the lockless readers need the
+	 * volume consistent, and that's the only way it gets there.)
+	 */
+	result = sfs_jinit(sfs);
+	if (result) {
+		sfs_fs_destroy(sfs);
+		return result;
+	}
+
 	/* Load free block bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
-	if (sfs->sfs_freemap == NULL) {
+	sfs->sfs_fmdirty = bitmap_create(SFS_FS_FREEMAPBLOCKS(sfs));
+	if (sfs->sfs_freemap == NULL || sfs->sfs_fmdirty == NULL) {
+		sfs_jshutdown(sfs);
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_freemapio(sfs, UIO_READ);
 	if (result) {
+		sfs_jshutdown(sfs);
+		sfs_fs_destroy(sfs);
+		return result;
+	}
+	for (i=0; i<SFS_FS_NBLOCKS(sfs); i++) {
+		if (!bitmap_isset(sfs->sfs_freemap, i)) {
+			sfs->sfs_nfree++;
+		}
+	}
+
+	/* A read-only volume won't have anything for the threads to do */
+	if (sfs->sfs_readonly) {
+		*ret = &sfs->sfs_absfs;
+		return 0;
+	}
+
+	/* Start the thread that frees big unlinked files */
+	sfs->sfs_reaperrunning = true;
+	result = thread_fork("sfsreaper", NULL, sfs_reaper, sfs, 0);
+	if (result) {
+		sfs->sfs_reaperrunning = false;
+		sfs_jshutdown(sfs);
+		sfs_fs_destroy(sfs);
+		return result;
+	}
+
+	/* and the one that allocates the blocks of delayed writes */
+	sfs->sfs_flusherrunning = true;
+	result = thread_fork("sfsflusher", NULL, sfs_flusher, sfs, 0);
+	if (result) {
+		sfs->sfs_flusherrunning = false;
+		sfs_stopthreads(sfs);
+		sfs_jshutdown(sfs);
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
 /*
- * Actual function called from high-level code to mount an sfs.
+ * Actual functions called from high-level code to mount an sfs.
  */
 int
 sfs_mount(const char *device)
 {
-	return vfs_mount(device, NULL, sfs_domount);
+	unsigned flags = 0;
+
+	return vfs_mount(device, &flags, sfs_domount);
+}
+
+int
+sfs_mount_ro(const char *device)
+{
+	unsigned flags = SFS_MOUNT_RDONLY;
+
+	return vfs_mount(device, &flags, sfs_domount);
 }
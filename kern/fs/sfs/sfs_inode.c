@@ -35,13 +35,18 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
+#include <thread.h>
 #include <vfs.h>
+#include <coremap.h>
+#include <swap.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
 /*
- * Write an on-disk inode structure back out to disk.
+ * Write an on-disk inode structure back out to disk. The vnode must
+ * be locked exclusive.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
@@ -49,6 +54,8 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int result;
 
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
+
 	if (sv->sv_dirty) {
 		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
 					sizeof(sv->sv_i));
@@ -60,88 +67,547 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	return 0;
 }
 
+/*
+ * On a journaled volume, write the inode back within the handle that
+ * changed it, so it goes in the same transaction. (If that fails, it
+ * stays dirty and goes in with a later one.) Otherwise leave it for
+ * fsync, reclaim, or sync, as ever.
+ */
+void
+sfs_jsync_inode(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	if (sfs->sfs_journal != NULL) {
+		(void)sfs_sync_inode(sv);
+	}
+}
+
+/*
+ * The list of vnodes sfs_sync has something to do for (see sfs.h).
+ * Call with sfs_dirtylock held.
+ */
+static
+void
+sfs_dirtylist_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(spinlock_do_i_hold(&sfs->sfs_dirtylock));
+
+	if (sv->sv_dprevp == NULL) {
+		return;
+	}
+	*sv->sv_dprevp = sv->sv_dnext;
+	if (sv->sv_dnext != NULL) {
+		sv->sv_dnext->sv_dprevp = sv->sv_dprevp;
+	}
+	sv->sv_dnext = NULL;
+	sv->sv_dprevp = NULL;
+	sfs->sfs_ndirty--;
+}
+
+/*
+ * Put SV on the list, if it isn't already. Call with sv_lock held
+ * exclusive (or while loading it).
+ */
+void
+sfs_dirtylist_add(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	spinlock_acquire(&sfs->sfs_dirtylock);
+	if (sv->sv_dprevp == NULL && !sv->sv_gone) {
+		sv->sv_dnext = sfs->sfs_dirtyvns;
+		if (sv->sv_dnext != NULL) {
+			sv->sv_dnext->sv_dprevp = &sv->sv_dnext;
+		}
+		sv->sv_dprevp = &sfs->sfs_dirtyvns;
+		sfs->sfs_dirtyvns = sv;
+		sfs->sfs_ndirty++;
+	}
+	spinlock_release(&sfs->sfs_dirtylock);
+}
+
+/*
+ * Note that the in-memory inode has changed. Call with sv_lock held
+ * exclusive.
+ */
+void
+sfs_dirty(struct sfs_vnode *sv)
+{
+	sv->sv_dirty = true;
+	sv->sv_syncdirty = true;
+	sfs_dirtylist_add(sv);
+}
+
+/*
+ * Take a reference to each vnode on the list (only the ones with
+ * blocks waiting, if DLONLY), and with REMOVE take them off it too.
+ * Hands back a kmalloc'd array of them, NULL if there were none.
+ * Vnodes that come along while we're at it wait for the next time.
+ * (As everywhere, the references are taken under sfs_vnlock, and the
+ * caller locks the vnodes one at a time without it.)
+ */
+int
+sfs_dirtylist_take(struct sfs_fs *sfs, bool dlonly, bool remove,
+		   struct vnode ***ret, unsigned *numret)
+{
+	struct sfs_vnode *sv, *next;
+	struct vnode **vns;
+	unsigned i, num;
+
+	*ret = NULL;
+	*numret = 0;
+
+	lock_acquire(sfs->sfs_vnlock);
+	spinlock_acquire(&sfs->sfs_dirtylock);
+	num = sfs->sfs_ndirty;
+	spinlock_release(&sfs->sfs_dirtylock);
+	if (num == 0) {
+		lock_release(sfs->sfs_vnlock);
+		return 0;
+	}
+	vns = kmalloc_tagged(num * sizeof(*vns), KM_FS);
+	if (vns == NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+
+	i = 0;
+	spinlock_acquire(&sfs->sfs_dirtylock);
+	for (sv = sfs->sfs_dirtyvns; sv != NULL && i < num; sv = next) {
+		next = sv->sv_dnext;
+		/* (a peek; looked at again with the vnode locked) */
+		if (dlonly && sv->sv_dlcount == 0) {
+			continue;
+		}
+		if (remove) {
+			sfs_dirtylist_remove(sfs, sv);
+		}
+		vns[i] = &sv->sv_absvn;
+		VOP_INCREF(vns[i]);
+		i++;
+	}
+	spinlock_release(&sfs->sfs_dirtylock);
+	lock_release(sfs->sfs_vnlock);
+
+	if (i == 0) {
+		kfree(vns);
+		return 0;
+	}
+	*ret = vns;
+	*numret = i;
+	return 0;
+}
+
+/*
+ * The table of loaded vnodes: a hash on the inode number. Call with
+ * sfs_vnlock held.
+ */
+static
+struct sfs_vnode **
+sfs_vnhash_bucket(struct sfs_fs *sfs, uint32_t ino)
+{
+	return &sfs->sfs_vnhash[ino & (SFS_VNHASHSIZE - 1)];
+}
+
+static
+struct sfs_vnode *
+sfs_vnhash_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	for (sv = *sfs_vnhash_bucket(sfs, ino); sv != NULL; sv = sv->sv_hnext) {
+		if (sv->sv_ino == ino) {
+			return sv;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+sfs_vnhash_insert(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **bucket = sfs_vnhash_bucket(sfs, sv->sv_ino);
+
+	sv->sv_hnext = *bucket;
+	*bucket = sv;
+	sfs->sfs_numvnodes++;
+}
+
+static
+void
+sfs_vnhash_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **svp = sfs_vnhash_bucket(sfs, sv->sv_ino);
+
+	while (*svp != sv) {
+		if (*svp == NULL) {
+			panic("sfs: reclaim vnode %u not in vnode pool\n",
+			      sv->sv_ino);
+		}
+		svp = &(*svp)->sv_hnext;
+	}
+	*svp = sv->sv_hnext;
+	sv->sv_hnext = NULL;
+	sfs->sfs_numvnodes--;
+
+	/* and off the dirty list, for good (it's synced, or an orphan) */
+	spinlock_acquire(&sfs->sfs_dirtylock);
+	sfs_dirtylist_remove(sfs, sv);
+	sv->sv_gone = true;
+	spinlock_release(&sfs->sfs_dirtylock);
+}
+
+/*
+ * Release the storage for a vnode structure that's out of the table.
+ */
+static
+void
+sfs_vnode_free(struct sfs_vnode *sv)
+{
+	KASSERT(sv->sv_dlcount == 0);
+	kfree(sv->sv_dldata);
+	sfs_dir_dropindex(sv);
+	spinlock_cleanup(&sv->sv_spinlock);
+	rwlock_destroy(sv->sv_lock);
+	kfree(sv);
+}
+
+/*
+ * Inactive vnodes. Opening the same files over and over (a script
+ * running the same programs, say) would otherwise read each inode
+ * afresh every time, and lose the directory's name index and the
+ * program's cached text with the vnode. So sfs_reclaim keeps up to
+ * SFS_INACTIVEMAX vnodes of files it need not free, oldest first on
+ * sfs_inactive, for sfs_loadvnode to find in the table as if they
+ * were in use. They go, oldest first, to make room for more; all of
+ * them when memory runs low (checked at each reclaim, and once a
+ * second by the flusher); and at unmount. See also sfs.h.
+ */
+
+/* Whether there's memory enough to keep vnodes nobody's using. */
+static
+bool
+sfs_inactive_ok(void)
+{
+	return coremap_freecount() >= PAGER_LOW_WATER;
+}
+
+/* Put SV on the end of the list. Call with sfs_vnlock held. */
+static
+void
+sfs_inactive_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+	KASSERT(sv->sv_iprevp == NULL);
+
+	/* it's clean, and nobody can dirty it */
+	spinlock_acquire(&sfs->sfs_dirtylock);
+	sfs_dirtylist_remove(sfs, sv);
+	spinlock_release(&sfs->sfs_dirtylock);
+
+	sv->sv_inext = NULL;
+	sv->sv_iprevp = sfs->sfs_inactivetail;
+	*sfs->sfs_inactivetail = sv;
+	sfs->sfs_inactivetail = &sv->sv_inext;
+	sfs->sfs_ninactive++;
+}
+
+/* Take SV off the list. Call with sfs_vnlock held. */
+static
+void
+sfs_inactive_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+	KASSERT(sv->sv_iprevp != NULL);
+
+	*sv->sv_iprevp = sv->sv_inext;
+	if (sv->sv_inext != NULL) {
+		sv->sv_inext->sv_iprevp = sv->sv_iprevp;
+	}
+	else {
+		sfs->sfs_inactivetail = sv->sv_iprevp;
+	}
+	sv->sv_inext = NULL;
+	sv->sv_iprevp = NULL;
+	sfs->sfs_ninactive--;
+}
+
+/*
+ * Take the oldest inactive vnodes out of the table until there are no
+ * more than MAX left. Call with sfs_vnlock held; hands them back
+ * chained on sv_hnext, for sfs_inactive_free once it's let go.
+ */
+static
+struct sfs_vnode *
+sfs_inactive_take(struct sfs_fs *sfs, unsigned max)
+{
+	struct sfs_vnode *sv, *list;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	list = NULL;
+	while (sfs->sfs_ninactive > max) {
+		sv = sfs->sfs_inactive;
+		sfs_inactive_remove(sfs, sv);
+		sfs_vnhash_remove(sfs, sv);
+		vnode_cleanup(&sv->sv_absvn);
+		sv->sv_hnext = list;
+		list = sv;
+	}
+	return list;
+}
+
+static
+void
+sfs_inactive_free(struct sfs_vnode *list)
+{
+	struct sfs_vnode *sv;
+
+	while (list != NULL) {
+		sv = list;
+		list = sv->sv_hnext;
+		sfs_vnode_free(sv);
+	}
+}
+
+/*
+ * Let inactive vnodes go: all of them, or with ALL false, just as
+ * many as need to for the memory that's free. For the flusher, and
+ * unmount.
+ */
+void
+sfs_inactive_purge(struct sfs_fs *sfs, bool all)
+{
+	struct sfs_vnode *list;
+
+	if (!all && sfs_inactive_ok()) {
+		return;
+	}
+	lock_acquire(sfs->sfs_vnlock);
+	list = sfs_inactive_take(sfs, 0);
+	lock_release(sfs->sfs_vnlock);
+	sfs_inactive_free(list);
+}
+
 /*
  * Called when the vnode refcount (in-memory usage count) hits zero.
  *
  * This function should try to avoid returning errors other than EBUSY.
+ *
+ * The journal handle is ended only once sfs_vnlock is let go: ending
+ * it may commit, which waits for other handles, and their owners may
+ * be waiting for sfs_vnlock.
  */
 int
 sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
+	struct sfs_vnode *evict;
+	bool orphan;
 	int result;
 
-	vfs_biglock_acquire();
+	sfs_jbegin(sfs);
+	lock_acquire(sfs->sfs_vnlock);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. (sfs_loadvnode hands out
+	 * references only with sfs_vnlock held.)
 	 */
-	spinlock_acquire(&v->vn_countlock);
-	if (v->vn_refcount != 1) {
-
-		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
-
-		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
+	if (vnode_decref_unless_last(v)) {
+		/* that consumed the reference VOP_DECREF gave us */
+		lock_release(sfs->sfs_vnlock);
+		sfs_jend(sfs);
 		return EBUSY;
 	}
-	spinlock_release(&v->vn_countlock);
 
-	/* If there are no on-disk references to the file either, erase it. */
+	/* Nobody else can be holding this now (see sfs.h) */
+	rwlock_acquire_write(sv->sv_lock);
+
+	/*
+	 * If there are no on-disk references to the file either, erase
+	 * it: right away if it's small, else leave it to the reaper.
+	 */
+	orphan = false;
 	if (sv->sv_i.sfi_linkcount == 0) {
-		result = sfs_itrunc(sv, 0);
-		if (result) {
-			vfs_biglock_release();
-			return result;
+		if (!SFS_ISINLINE(sv) &&
+		    sv->sv_i.sfi_size > SFS_REAPMIN * SFS_BLOCKSIZE) {
+			orphan = true;
+		}
+		else {
+			result = sfs_itrunc(sv, 0);
+			if (result) {
+				rwlock_release_write(sv->sv_lock);
+				lock_release(sfs->sfs_vnlock);
+				sfs_jend(sfs);
+				return result;
+			}
 		}
 	}
 
-	/* Sync the inode to disk */
-	result = sfs_sync_inode(sv);
+	/*
+	 * Allocate the blocks still waiting for it (an orphan's can
+	 * just go), and sync the inode
+	 */
+	if (orphan) {
+		sfs_dl_truncate(sv, 0);
+	}
+	result = sfs_dl_flush(sv);
+	if (result == 0) {
+		result = sfs_sync_inode(sv);
+	}
 	if (result) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
+		lock_release(sfs->sfs_vnlock);
+		sfs_jend(sfs);
 		return result;
 	}
 
+	/* Give back any blocks set aside for writing it */
+	sfs_prealloc_release(sv);
+
+	/*
+	 * If it's still there, keep it for next time; but if memory
+	 * is short, let it go, and the others too.
+	 */
+	evict = NULL;
+	if (!sfs_inactive_ok()) {
+		evict = sfs_inactive_take(sfs, 0);
+	}
+	else if (sv->sv_i.sfi_linkcount > 0) {
+		evict = sfs_inactive_take(sfs, SFS_INACTIVEMAX - 1);
+		sfs_inactive_add(sfs, sv);
+
+		rwlock_release_write(sv->sv_lock);
+		lock_release(sfs->sfs_vnlock);
+		sfs_jend(sfs);
+		sfs_inactive_free(evict);
+		return 0;
+	}
+
 	/* If there are no on-disk references, discard the inode */
-	if (sv->sv_i.sfi_linkcount==0) {
+	if (sv->sv_i.sfi_linkcount==0 && !orphan) {
 		sfs_bfree(sfs, sv->sv_ino);
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
-		panic("sfs: reclaim vnode %u not in vnode pool\n",
-		      sv->sv_ino);
+	sfs_vnhash_remove(sfs, sv);
+
+	if (orphan) {
+		/* The reaper gets it, reference and all */
+		lock_acquire(sfs->sfs_orphanlock);
+		sv->sv_hnext = sfs->sfs_orphans;
+		sfs->sfs_orphans = sv;
+		cv_signal(sfs->sfs_orphancv, sfs->sfs_orphanlock);
+		lock_release(sfs->sfs_orphanlock);
+
+		rwlock_release_write(sv->sv_lock);
+		lock_release(sfs->sfs_vnlock);
+		sfs_jend(sfs);
+		sfs_inactive_free(evict);
+		return 0;
 	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
 
 	vnode_cleanup(&sv->sv_absvn);
 
-	vfs_biglock_release();
+	rwlock_release_write(sv->sv_lock);
+	lock_release(sfs->sfs_vnlock);
+	sfs_jend(sfs);
 
-	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	sfs_vnode_free(sv);
+	sfs_inactive_free(evict);
 
 	/* Done */
 	return 0;
 }
 
+/*
+ * Free one orphan: its blocks, its inode, and the vnode. If the
+ * blocks can't all be freed, the inode stays allocated (with no links
+ * on disk), and sfsck will find what's left.
+ */
+static
+void
+sfs_reap(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	int result;
+
+	sfs_jbegin(sfs);
+	rwlock_acquire_write(sv->sv_lock);
+	result = sfs_itrunc(sv, 0);
+	if (result) {
+		kprintf("sfs: %s: Couldn't free unlinked inode %u: %s\n",
+			sfs->sfs_sb.sb_volname, sv->sv_ino, strerror(result));
+	}
+	else {
+		sfs_bfree(sfs, sv->sv_ino);
+	}
+	vnode_cleanup(&sv->sv_absvn);
+	rwlock_release_write(sv->sv_lock);
+	sfs_jend(sfs);
+
+	sfs_vnode_free(sv);
+}
+
+/*
+ * Free all the orphans there are, including any that come along
+ * while we're at it.
+ */
+void
+sfs_reap_orphans(struct sfs_fs *sfs)
+{
+	struct sfs_vnode *sv;
+
+	lock_acquire(sfs->sfs_reaplock);
+	while (1) {
+		lock_acquire(sfs->sfs_orphanlock);
+		sv = sfs->sfs_orphans;
+		if (sv != NULL) {
+			sfs->sfs_orphans = sv->sv_hnext;
+			sv->sv_hnext = NULL;
+		}
+		lock_release(sfs->sfs_orphanlock);
+		if (sv == NULL) {
+			break;
+		}
+		sfs_reap(sfs, sv);
+	}
+	lock_release(sfs->sfs_reaplock);
+}
+
+/*
+ * The reaper thread: free orphans as they come, until told to quit
+ * (at unmount), and then the rest.
+ */
+void
+sfs_reaper(void *data, unsigned long unused)
+{
+	struct sfs_fs *sfs = data;
+
+	(void)unused;
+
+	lock_acquire(sfs->sfs_orphanlock);
+	while (1) {
+		while (sfs->sfs_orphans == NULL && !sfs->sfs_reaperexit) {
+			cv_wait(sfs->sfs_orphancv, sfs->sfs_orphanlock);
+		}
+		if (sfs->sfs_orphans == NULL) {
+			break;
+		}
+		lock_release(sfs->sfs_orphanlock);
+		sfs_reap_orphans(sfs);
+		lock_acquire(sfs->sfs_orphanlock);
+	}
+	sfs->sfs_reaperrunning = false;
+	cv_broadcast(sfs->sfs_orphancv, sfs->sfs_orphanlock);
+	lock_release(sfs->sfs_orphanlock);
+
+	thread_exit();
+}
+
 /*
  * Function to load a inode into memory as a vnode, or dig up one
  * that's already resident.
@@ -150,42 +616,47 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	sv = sfs_vnhash_find(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: Found inode %u in unallocated block\n",
 			      sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
+		if (sv->sv_iprevp != NULL) {
+			/* inactive: it has the reference reclaim left it */
+			sfs_inactive_remove(sfs, sv);
+		}
+		else {
 			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
 		}
+		lock_release(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kmalloc_tagged(sizeof(struct sfs_vnode), KM_FS);
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+	sv->sv_lock = rwlock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -198,12 +669,15 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
+		rwlock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
+	sv->sv_syncdirty = false;
 
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
@@ -213,7 +687,17 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	if (forcetype != SFS_TYPE_INVAL) {
 		KASSERT(sv->sv_i.sfi_type == SFS_TYPE_INVAL);
 		sv->sv_i.sfi_type = forcetype;
+		if (forcetype == SFS_TYPE_FILE && SFS_INLINE(sfs)) {
+			sv->sv_i.sfi_flags = SFS_INODE_INLINE;
+		}
 		sv->sv_dirty = true;
+		sv->sv_syncdirty = true;
+	}
+	if (SFS_ISINLINE(sv) && (sv->sv_i.sfi_type != SFS_TYPE_FILE ||
+				 sv->sv_i.sfi_size > SFS_INLINESIZE)) {
+		panic("sfs: loadvnode: Bad inline inode %u "
+		      "(type %u, size %u)\n", ino, sv->sv_i.sfi_type,
+		      sv->sv_i.sfi_size);
 	}
 
 	/*
@@ -235,21 +719,40 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		rwlock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
-
-	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
+	spinlock_init(&sv->sv_spinlock);
+	sv->sv_ranext = 0;
+	sv->sv_rapos = 0;
+	sv->sv_rawin = 0;
+	sv->sv_dirindex = NULL;
+	sv->sv_prealloc = 0;
+	sv->sv_nprealloc = 0;
+	sv->sv_preany = false;
+	sv->sv_dlfirst = 0;
+	sv->sv_dlcount = 0;
+	sv->sv_dldata = NULL;
+	sv->sv_dltime = 0;
+	sv->sv_dnext = NULL;
+	sv->sv_dprevp = NULL;
+	sv->sv_gone = false;
+	sv->sv_inext = NULL;
+	sv->sv_iprevp = NULL;
+
+	/* Add it to our table (and a new one to the dirty list) */
+	sfs_vnhash_insert(sfs, sv);
+	if (sv->sv_dirty) {
+		sfs_dirtylist_add(sv);
 	}
 
+	lock_release(sfs->sfs_vnlock);
+
 	/* Hand it back */
 	*ret = sv;
 	return 0;
@@ -269,7 +772,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, 0, &ino);
 	if (result) {
 		return result;
 	}
@@ -285,6 +788,23 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	return result;
 }
 
+/*
+ * The type of inode INO if it's in memory, or SFS_TYPE_INVAL if it
+ * isn't, for callers that would rather not read it in to find out.
+ */
+int
+sfs_peektype(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+	int type;
+
+	lock_acquire(sfs->sfs_vnlock);
+	sv = sfs_vnhash_find(sfs, ino);
+	type = (sv != NULL) ? (int)sv->sv_i.sfi_type : SFS_TYPE_INVAL;
+	lock_release(sfs->sfs_vnlock);
+	return type;
+}
+
 /*
  * Get vnode for the root of the filesystem.
  * The root vnode is always found in block 1 (SFS_ROOTDIR_INO).
@@ -296,8 +816,6 @@ sfs_getroot(struct fs *fs)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		panic("sfs: getroot: Cannot load root vnode\n");
@@ -308,7 +826,5 @@ sfs_getroot(struct fs *fs)
 		      sv->sv_i.sfi_type);
 	}
 
-	vfs_biglock_release();
-
 	return &sv->sv_absvn;
 }
@@ -36,8 +36,12 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
 #include <vfs.h>
 #include <device.h>
+#include <bufcache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -50,82 +54,340 @@
  * early in mount, before sfs is fully (or even mostly)
  * initialized, and so may not use anything from sfs
  * except sfs_device.
+ *
+ * Blocks go through the buffer cache, so a write only reaches the
+ * disk when the cache writes it back: at the latest when the volume
+ * is synced. sfs_partialio, sfs_blockio and sfs_metaio use cache
+ * buffers in place; these copy in and out of them.
+ */
+
+/*
+ * Read a block.
+ */
+int
+sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(len == SFS_BLOCKSIZE);
+
+	DEBUG(DB_SFS, "sfs: read %u\n", block);
+
+	result = buf_read(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(data, buf_data(b), len);
+	buf_release(b);
+	return 0;
+}
+
+/*
+ * Write a metadata block (for data, file I/O uses the cache directly).
+ * On a journaled volume it goes in the running transaction.
+ */
+int
+sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(len == SFS_BLOCKSIZE);
+
+	DEBUG(DB_SFS, "sfs: write %u\n", block);
+
+	result = buf_get(sfs->sfs_device, block, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(buf_data(b), data, len);
+	sfs_jdirty(sfs, block, b);
+	buf_release(b);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Delayed allocation
+
+/*
+ * Blocks written past the end of a file don't get disk blocks right
+ * away. They wait in memory (sv_dldata), up to SFS_DLMAX of them in a
+ * row from sv_dlfirst, and are allocated all together, in one run of
+ * consecutive blocks if there's one free, when they're flushed: when
+ * the window is full or a write goes somewhere else past the end, at
+ * fsync, sync and reclaim, and from the flusher thread once they've
+ * waited SFS_DLMAXAGE seconds. So a file written in many small
+ * appends, or alongside others, still ends up in one piece. Reads
+ * look in the window first.
+ *
+ * A write only waits if sfs_dlreserve says there will be room for it,
+ * as by the time it's flushed it has long since succeeded.
  */
 
+/* How long blocks may wait (seconds). */
+#define SFS_DLMAXAGE	3
+
 /*
- * Read or write a block, retrying I/O errors.
+ * The waiting copy of FILEBLOCK, or NULL. Call with sv_lock held
+ * (shared will do).
  */
 static
+char *
+sfs_dl_find(struct sfs_vnode *sv, uint32_t fileblock)
+{
+	if (sv->sv_dlcount == 0 || fileblock < sv->sv_dlfirst ||
+	    fileblock - sv->sv_dlfirst >= sv->sv_dlcount) {
+		return NULL;
+	}
+	return sv->sv_dldata + (fileblock - sv->sv_dlfirst) * SFS_BLOCKSIZE;
+}
+
+/* Forget the waiting blocks from the KEEPth on. */
+static
+void
+sfs_dl_drop(struct sfs_vnode *sv, unsigned keep)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	KASSERT(keep <= sv->sv_dlcount);
+	if (keep == sv->sv_dlcount) {
+		return;
+	}
+	sfs_dlunreserve(sfs, sv->sv_dlcount - keep);
+	sv->sv_dlcount = keep;
+	if (keep == 0) {
+		kfree(sv->sv_dldata);
+		sv->sv_dldata = NULL;
+	}
+}
+
+/*
+ * Allocate the waiting blocks and put them in the buffer cache, which
+ * writes them out like any others. If that goes wrong partway, the
+ * ones not done yet keep waiting. Call with sv_lock held exclusive
+ * (and, on a journaled volume, within a handle).
+ */
 int
-sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
+sfs_dl_flush(struct sfs_vnode *sv)
 {
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *b;
+	daddr_t prev, block;
+	unsigned i, n;
 	int result;
-	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
 
-	DEBUG(DB_SFS, "sfs: %s %llu\n",
-	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
+	n = sv->sv_dlcount;
+	if (n == 0) {
+		return 0;
+	}
 
- retry:
-	result = DEVOP_IO(sfs->sfs_device, uio);
-	if (result == EINVAL) {
-		/*
-		 * This means the sector we requested was out of range,
-		 * or the seek address we gave wasn't sector-aligned,
-		 * or a couple of other things that are our fault.
-		 */
-		panic("sfs: DEVOP_IO returned EINVAL\n");
-	}
-	if (result == EIO) {
-		if (tries == 0) {
-			tries++;
-			kprintf("sfs: block %llu I/O error, retrying\n",
-				uio->uio_offset / SFS_BLOCKSIZE);
-			goto retry;
+	/* Right after the block before them, if that's free */
+	prev = 0;
+	if (sv->sv_dlfirst > 0) {
+		result = sfs_bmap(sv, sv->sv_dlfirst - 1, false, &prev);
+		if (result) {
+			return result;
 		}
-		else if (tries < 10) {
-			tries++;
-			goto retry;
+	}
+	result = sfs_balloc_run(sv, prev != 0 ? prev + 1 : sv->sv_ino, n);
+	if (result) {
+		return result;
+	}
+
+	/* (sfs_bmap takes them from the run it set aside) */
+	for (i = 0; i < n; i++) {
+		result = sfs_bmap(sv, sv->sv_dlfirst + i, true, &block);
+		if (result == 0) {
+			result = buf_get(sfs->sfs_device, block, &b);
 		}
-		else {
-			kprintf("sfs: block %llu I/O error, giving up after "
-				"%d retries\n",
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
+		if (result) {
+			break;
 		}
+		memcpy(buf_data(b), sv->sv_dldata + i * SFS_BLOCKSIZE,
+		       SFS_BLOCKSIZE);
+		buf_markdirty(b);
+		buf_release(b);
 	}
-	return result;
+
+	if (result) {
+		if (i > 0) {
+			memmove(sv->sv_dldata,
+				sv->sv_dldata + i * SFS_BLOCKSIZE,
+				(n - i) * SFS_BLOCKSIZE);
+			sv->sv_dlfirst += i;
+			sv->sv_dlcount -= i;
+			sfs_dlunreserve(sfs, i);
+		}
+		return result;
+	}
+	sfs_dl_drop(sv, 0);
+	return 0;
 }
 
 /*
- * Read a block.
+ * The file is being cut down to LEN bytes: forget the waiting blocks
+ * past that, and zero what's past it in the last one kept. Call with
+ * sv_lock held exclusive.
  */
-int
-sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+void
+sfs_dl_truncate(struct sfs_vnode *sv, off_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
+	uint32_t tail = len % SFS_BLOCKSIZE;
+	unsigned keep;
 
-	KASSERT(len == SFS_BLOCKSIZE);
+	KASSERT(rwlock_do_i_hold_write(sv->sv_lock));
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	if (sv->sv_dlcount == 0) {
+		return;
+	}
+	if (blocklen <= sv->sv_dlfirst) {
+		sfs_dl_drop(sv, 0);
+		return;
+	}
+	keep = blocklen - sv->sv_dlfirst;
+	if (keep > sv->sv_dlcount) {
+		return;
+	}
+	sfs_dl_drop(sv, keep);
+	if (tail != 0) {
+		bzero(sv->sv_dldata + (keep - 1) * SFS_BLOCKSIZE + tail,
+		      SFS_BLOCKSIZE - tail);
+	}
 }
 
 /*
- * Write a block.
+ * For a write to FILEBLOCK: the waiting copy to write into (a new one
+ * is zero), or NULL to write through the cache as usual. Call with
+ * sv_lock held exclusive.
  */
+static
 int
-sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+sfs_dl_get(struct sfs_vnode *sv, uint32_t fileblock, char **ret)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct timespec now;
+	daddr_t block;
+	int result;
 
-	KASSERT(len == SFS_BLOCKSIZE);
+	*ret = sfs_dl_find(sv, fileblock);
+	if (*ret != NULL) {
+		return 0;
+	}
+
+	/* Only past the end */
+	if (fileblock < DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE)) {
+		return 0;
+	}
+
+	/* Carrying on, with room? Else start again. */
+	if (sv->sv_dlcount > 0 &&
+	    (fileblock != sv->sv_dlfirst + sv->sv_dlcount ||
+	     sv->sv_dlcount == SFS_DLMAX)) {
+		result = sfs_dl_flush(sv);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* (a failed write can leave a block mapped past the end) */
+	result = sfs_bmap(sv, fileblock, false, &block);
+	if (result) {
+		return result;
+	}
+	if (block != 0 || !sfs_dlreserve(sfs)) {
+		return 0;
+	}
+
+	if (sv->sv_dldata == NULL) {
+		sv->sv_dldata = kmalloc_tagged(SFS_DLMAX * SFS_BLOCKSIZE, KM_FS);
+		if (sv->sv_dldata == NULL) {
+			sfs_dlunreserve(sfs, 1);
+			return 0;
+		}
+	}
+	if (sv->sv_dlcount == 0) {
+		sv->sv_dlfirst = fileblock;
+		gettime(&now);
+		sv->sv_dltime = now.tv_sec;
+		sfs_dirtylist_add(sv);
+	}
+	*ret = sv->sv_dldata + sv->sv_dlcount * SFS_BLOCKSIZE;
+	bzero(*ret, SFS_BLOCKSIZE);
+	sv->sv_dlcount++;
+	return 0;
+}
+
+/*
+ * Flush the blocks of every loaded file that have been waiting since
+ * before CUTOFF. (The files with any waiting are on the dirty list;
+ * they stay there, their inodes have changed.)
+ */
+static
+void
+sfs_dl_flushold(struct sfs_fs *sfs, time_t cutoff)
+{
+	struct sfs_vnode *sv;
+	struct vnode **vns;
+	unsigned i, num;
+
+	if (sfs_dirtylist_take(sfs, true, false, &vns, &num)) {
+		/* try again next time */
+		return;
+	}
+
+	for (i=0; i<num; i++) {
+		sv = vns[i]->vn_data;
+
+		sfs_jbegin(sfs);
+		rwlock_acquire_write(sv->sv_lock);
+		if (sv->sv_dlcount > 0 && sv->sv_dltime < cutoff) {
+			/* (if it fails, they wait for the next try) */
+			(void)sfs_dl_flush(sv);
+			sfs_jsync_inode(sv);
+		}
+		rwlock_release_write(sv->sv_lock);
+		VOP_DECREF(vns[i]);
+		sfs_jend(sfs);
+	}
+	kfree(vns);
+}
+
+/*
+ * The flusher thread: once a second, flush the blocks that have been
+ * waiting long enough, and let the inactive vnodes go if memory is
+ * short, until told to quit (at unmount).
+ */
+void
+sfs_flusher(void *data, unsigned long unused)
+{
+	struct sfs_fs *sfs = data;
+	struct timespec now;
+
+	(void)unused;
+
+	while (1) {
+		clocksleep(1);
+
+		lock_acquire(sfs->sfs_orphanlock);
+		if (sfs->sfs_flusherexit) {
+			break;
+		}
+		lock_release(sfs->sfs_orphanlock);
+
+		gettime(&now);
+		sfs_dl_flushold(sfs, now.tv_sec - SFS_DLMAXAGE + 1);
+		sfs_inactive_purge(sfs, false);
+	}
+	sfs->sfs_flusherrunning = false;
+	cv_broadcast(sfs->sfs_orphancv, sfs->sfs_orphanlock);
+	lock_release(sfs->sfs_orphanlock);
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	thread_exit();
 }
 
 ////////////////////////////////////////////////////////////
@@ -133,10 +395,12 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 // File-level I/O
 
 /*
- * Do I/O to a block of a file that doesn't cover the whole block.  We
- * need to read in the original block first, even if we're writing, so
- * we don't clobber the portion of the block we're not intending to
- * write over.
+ * Do I/O to a block of a file that doesn't cover the whole block.  A
+ * read needs the original block, of course. A write goes into the
+ * cache's buffer for the block without reading it first if it can
+ * (see buf_getrange), so small writes one after another in the same
+ * block cost no read at all if between them they cover all of it, or
+ * one read, when it's written back, if they don't.
  *
  * SKIPSTART is the number of bytes to skip past at the beginning of
  * the sector; LEN is the number of bytes to actually read or write.
@@ -147,18 +411,12 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
+	size_t resid;
+	char *data;
 	int result;
 
 	/* Allocate missing blocks if and only if we're writing */
@@ -166,12 +424,23 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
+	/* A block waiting to be allocated, or one that can wait */
+	if (uio->uio_rw == UIO_WRITE) {
+		result = sfs_dl_get(sv, fileblock, &data);
+		if (result) {
+			return result;
+		}
+	}
+	else {
+		data = sfs_dl_find(sv, fileblock);
+	}
+	if (data != NULL) {
+		return uiomove(data + skipstart, len, uio);
+	}
+
 	/* Get the disk block number */
 	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
 	if (result) {
@@ -181,40 +450,37 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		return uiomovezeros(len, uio);
 	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
+
+	if (uio->uio_rw == UIO_READ) {
+		result = buf_read(sfs->sfs_device, diskblock, &b);
 		if (result) {
 			return result;
 		}
+		result = uiomove((char *)buf_data(b) + skipstart, len, uio);
+		buf_release(b);
+		return result;
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * The cache writes back the modified part (even if the copy
+	 * failed partway: we have moved the part the uio says we
+	 * have), merged with the rest of the block.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = buf_getrange(sfs->sfs_device, diskblock, skipstart, &b);
 	if (result) {
 		return result;
 	}
+	resid = uio->uio_resid;
+	result = uiomove((char *)buf_data(b) + skipstart, len, uio);
+	buf_markrange(b, skipstart, resid - uio->uio_resid);
+	buf_release(b);
 
-	/*
-	 * If it was a write, write back the modified block.
-	 */
-	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
-	}
-
-	return 0;
+	return result;
 }
 
 /*
@@ -225,18 +491,32 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
+	size_t resid;
+	char *data;
 	int result;
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
+	/* A block waiting to be allocated, or one that can wait */
+	if (uio->uio_rw == UIO_WRITE) {
+		result = sfs_dl_get(sv, fileblock, &data);
+		if (result) {
+			return result;
+		}
+	}
+	else {
+		data = sfs_dl_find(sv, fileblock);
+	}
+	if (data != NULL) {
+		/* (if the copy fails partway, the rest stays as it was) */
+		return uiomove(data, SFS_BLOCKSIZE, uio);
+	}
+
 	/* Look up the disk block number */
 	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
 	if (result) {
@@ -254,34 +534,109 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
-	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
-
-	/*
-	 * Temporarily set the residue to be one block size.
-	 */
 	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
 
-	result = sfs_rwblock(sfs, uio);
+	if (uio->uio_rw == UIO_READ) {
+		result = buf_read(sfs->sfs_device, diskblock, &b);
+		if (result) {
+			return result;
+		}
+		result = uiomove(buf_data(b), SFS_BLOCKSIZE, uio);
+		buf_release(b);
+		return result;
+	}
 
 	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
+	 * Writing the whole block, so there's no need to read it
+	 * first. If the copy from the caller fails partway, the rest
+	 * of the buffer could be anything (another block, even), so
+	 * zero it: the block ends up as though the write were short.
 	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
-
+	result = buf_get(sfs->sfs_device, diskblock, &b);
+	if (result) {
+		return result;
+	}
+	resid = uio->uio_resid;
+	result = uiomove(buf_data(b), SFS_BLOCKSIZE, uio);
+	if (result) {
+		size_t done = resid - uio->uio_resid;
+		bzero((char *)buf_data(b) + done, SFS_BLOCKSIZE - done);
+	}
+	buf_markdirty(b);
+	buf_release(b);
 	return result;
 }
 
+/* File blocks mapped at a time by sfs_diskrun. */
+#define SFS_MAPCHUNK	16
+
+/*
+ * How many of the NBLOCKS file blocks from FILEBLOCK on are in
+ * consecutive disk blocks (at least one, even if that one isn't), and
+ * the first of those disk blocks, in FIRST (0 if it's a hole or
+ * something went wrong).
+ */
+static
+uint32_t
+sfs_diskrun(struct sfs_vnode *sv, uint32_t fileblock, uint32_t nblocks,
+	    daddr_t *first)
+{
+	daddr_t map[SFS_MAPCHUNK];
+	uint32_t n, c, j;
+
+	*first = 0;
+	n = 0;
+	while (n < nblocks) {
+		c = nblocks - n;
+		if (c > SFS_MAPCHUNK) {
+			c = SFS_MAPCHUNK;
+		}
+		if (sfs_bmap_range(sv, fileblock + n, c, map)) {
+			break;
+		}
+		for (j = 0; j < c; j++, n++) {
+			if (n == 0) {
+				*first = map[0];
+				if (*first == 0) {
+					return 1;
+				}
+			}
+			else if (map[j] != *first + n) {
+				return n;
+			}
+		}
+	}
+	return n > 0 ? n : 1;
+}
+
+/*
+ * Reading NBLOCKS whole blocks of a file from FILEBLOCK on: find how
+ * many of them in a row sit in consecutive disk blocks, and get those
+ * into the buffer cache with one device request, so sfs_blockio (or
+ * whoever) finds them there. Returns how many blocks that covered (at
+ * least one); if anything goes wrong, the caller will just read them
+ * one at a time.
+ */
+uint32_t
+sfs_readrun(struct sfs_vnode *sv, uint32_t fileblock, uint32_t nblocks)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t first;
+	uint32_t n;
+
+	if (nblocks > BUF_MAXRUN) {
+		nblocks = BUF_MAXRUN;
+	}
+	if (nblocks < 2) {
+		return 1;
+	}
+	n = sfs_diskrun(sv, fileblock, nblocks, &first);
+	if (first != 0 && n > 1) {
+		(void)buf_readrun(sfs->sfs_device, first, n);
+	}
+	return n;
+}
+
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
  */
@@ -289,7 +644,7 @@ int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
+	uint32_t nblocks, i, run;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
 
@@ -316,6 +671,27 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		}
 	}
 
+	/*
+	 * An inline file's contents are right in the inode, unless
+	 * this write takes it past what fits. Then move them out to a
+	 * block first and carry on as usual.
+	 */
+	if (SFS_ISINLINE(sv)) {
+		if (uio->uio_rw == UIO_READ ||
+		    uio->uio_offset + uio->uio_resid <= SFS_INLINESIZE) {
+			result = uiomove(sv->sv_i.sfi_data + uio->uio_offset,
+					 uio->uio_resid, uio);
+			if (uio->uio_rw == UIO_WRITE) {
+				sfs_dirty(sv);
+			}
+			goto out;
+		}
+		result = sfs_inline_evict(sv);
+		if (result) {
+			goto out;
+		}
+	}
+
 	/*
 	 * First, do any leading partial block.
 	 */
@@ -349,7 +725,20 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	 */
 	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
+	run = 0;
 	for (i=0; i<nblocks; i++) {
+		/*
+		 * When reading, bring each stretch of blocks that are
+		 * together on disk into the cache all at once first.
+		 */
+		if (uio->uio_rw == UIO_READ && run == 0) {
+			run = sfs_readrun(sv,
+					  uio->uio_offset / SFS_BLOCKSIZE,
+					  nblocks - i);
+		}
+		if (run > 0) {
+			run--;
+		}
 		result = sfs_blockio(sv, uio);
 		if (result) {
 			goto out;
@@ -375,7 +764,7 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	    uio->uio_rw == UIO_WRITE &&
 	    uio->uio_offset > (off_t)sv->sv_i.sfi_size) {
 		sv->sv_i.sfi_size = uio->uio_offset;
-		sv->sv_dirty = true;
+		sfs_dirty(sv);
 	}
 
 	/* Add in any extra amount we couldn't read because of EOF */
@@ -385,6 +774,75 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	return result;
 }
 
+////////////////////////////////////////////////////////////
+// Readahead
+
+/* Readahead window: where it starts, and how big it can grow. */
+#define SFS_RAMIN	4
+#define SFS_RAMAX	BUF_MAXRUN
+
+/*
+ * After a read of [START, END) of a file: if it carried on from
+ * where the last one left off (or is the first, at the start of the
+ * file), double the readahead window and ask the buffer cache for
+ * the blocks in the window past END that haven't been asked for yet.
+ * Otherwise it's a seek, and the window goes back to nothing until
+ * reads are sequential again. Call with sv_lock held (shared will
+ * do), for sfs_bmap.
+ */
+void
+sfs_readahead(struct sfs_vnode *sv, off_t start, off_t end)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t first, last, eofblock, from, to, n;
+	daddr_t rundisk;
+
+	first = start / SFS_BLOCKSIZE;
+	last = (end + SFS_BLOCKSIZE - 1) / SFS_BLOCKSIZE;
+	eofblock = (sv->sv_i.sfi_size + SFS_BLOCKSIZE - 1) / SFS_BLOCKSIZE;
+
+	/* (an inline file came in with its inode) */
+	if (SFS_ISINLINE(sv)) {
+		return;
+	}
+
+	spinlock_acquire(&sv->sv_spinlock);
+	/* (a read that ended partway through a block continues in it) */
+	if (first == sv->sv_ranext || first + 1 == sv->sv_ranext) {
+		if (sv->sv_rawin == 0) {
+			sv->sv_rawin = SFS_RAMIN;
+		}
+		else if (sv->sv_rawin < SFS_RAMAX) {
+			sv->sv_rawin *= 2;
+		}
+	}
+	else {
+		sv->sv_rawin = 0;
+		sv->sv_rapos = 0;
+	}
+	sv->sv_ranext = last;
+
+	from = last > sv->sv_rapos ? last : sv->sv_rapos;
+	to = last + sv->sv_rawin;
+	if (to > eofblock) {
+		to = eofblock;
+	}
+	if (from < to) {
+		sv->sv_rapos = to;
+	}
+	spinlock_release(&sv->sv_spinlock);
+
+	/* one request for each stretch that's together on disk */
+	while (from < to) {
+		n = sfs_diskrun(sv, from, to - from, &rundisk);
+		/* (holes need no reading) */
+		if (rundisk != 0) {
+			buf_prefetch(sfs->sfs_device, rundisk, n);
+		}
+		from += n;
+	}
+}
+
 ////////////////////////////////////////////////////////////
 // Metadata I/O
 
@@ -404,6 +862,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *b;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -411,18 +870,6 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
 	blockoffset = actualpos % SFS_BLOCKSIZE;
@@ -443,32 +890,28 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = buf_read(sfs->sfs_device, diskblock, &b);
 	if (result) {
 		return result;
 	}
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, (char *)buf_data(b) + blockoffset, len);
+		buf_release(b);
 	}
 	else {
-		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		/* Update the selected region; the cache writes it back */
+		memcpy((char *)buf_data(b) + blockoffset, data, len);
+		sfs_jdirty(sfs, diskblock, b);
+		buf_release(b);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
 		if (endpos > (off_t)sv->sv_i.sfi_size) {
 			sv->sv_i.sfi_size = endpos;
-			sv->sv_dirty = true;
+			sfs_dirty(sv);
 		}
 	}
 
@@ -0,0 +1,1266 @@
+/*
+ * SFS filesystem
+ *
+ * Metadata journal (for volumes with SFS_FEATURE_JOURNAL; see
+ * kern/sfs.h for the on-disk format).
+ *
+ * Every change to metadata (inodes, indirect blocks, directories, the
+ * freemap) is made within a handle, from sfs_jbegin to sfs_jend, and
+ * belongs to the running transaction. Changed buffers are pinned in
+ * the buffer cache for it (sfs_jdirty), so none reaches its home on
+ * disk early; changed freemap blocks are just noted, and copied from
+ * the bitmap when the time comes.
+ *
+ * Committing waits for the open handles to end, copies everything the
+ * transaction changed into the in-memory shadow of the log, starts a
+ * new transaction, and writes the records to the log in one
+ * sequential device request (two, if it wraps), commit block last.
+ * Then the buffers are unpinned, and the cache writes them home as
+ * usual. The journal thread commits once a second, batching whatever
+ * has been done since (group commit); fsync and sync commit at once.
+ *
+ * A committed transaction stays in the log until it is checkpointed:
+ * its blocks are written home from the shadow (those a later one has
+ * changed again are left for that one) and the header moves past it.
+ * That happens when the log needs the room, when it's a few seconds
+ * old, and at sync. Mounting replays what's in the log from the
+ * header's tail on, up to the first transaction that isn't complete.
+ *
+ * A freed block stays marked in use in memory until the transaction
+ * that freed it is checkpointed, so it can't be reused, and written
+ * to, while a crash could still bring back metadata that points to
+ * it. (The freemap copies in the log show it free already.)
+ *
+ * Only metadata is journaled; file data goes home through the cache
+ * as before, so after a crash a file may have stale contents in
+ * blocks it was given just before. fsync writes the data out before
+ * committing.
+ *
+ * If a transaction changes more blocks than it can pin or the log can
+ * hold, it isn't journaled: commit checkpoints everything else and
+ * writes it home directly, which is no more atomic than SFS without a
+ * journal.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <device.h>
+#include <bufcache.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* How often the journal thread commits (seconds). */
+#define SFS_JCOMMITSECS	1
+
+/* Committed transactions older than this (seconds) get checkpointed. */
+#define SFS_JMAXAGE	5
+
+/* Fewest blocks a transaction must be able to pin. */
+#define SFS_JMINPIN	8
+
+/* A committed transaction that hasn't been checkpointed. */
+struct sfs_jtxn {
+	uint32_t jt_seq;		/* sequence number */
+	uint32_t jt_start;		/* log position of its first block */
+	uint32_t jt_len;		/* log blocks, commit block included */
+	time_t jt_committed;		/* when */
+	daddr_t *jt_frees;		/* blocks it freed, still marked used */
+	unsigned jt_nfrees;
+};
+
+struct sfs_journal {
+	struct lock *j_lock;
+	struct cv *j_cv;		/* handles, commits, the thread */
+
+	/* The log; these change only with j_busy set. */
+	bool j_busy;			/* commit or checkpoint going on */
+	daddr_t j_hdrblock;		/* disk block of the header */
+	uint32_t j_size;		/* log blocks (after the header) */
+	void **j_shadow;		/* contents of each log block */
+	struct sfs_jheader *j_hdr;	/* the header */
+	struct iovec *j_iov;		/* for device requests */
+	void **j_run;			/* blocks going home in one request */
+	daddr_t *j_tags;		/* a transaction's blocks, sorted */
+	uint32_t j_head;		/* where the next transaction goes */
+	uint32_t j_used;		/* log blocks the live ones use */
+	uint32_t j_commitseq;		/* number of the next one written */
+	struct sfs_jtxn *j_live;	/* ring of live ones, oldest first */
+	unsigned j_livemax, j_livefirst, j_nlive;
+
+	/* The running transaction (j_lock). */
+	uint32_t j_seq;			/* its number, which pins its buffers */
+	unsigned j_nactive;		/* open handles */
+	daddr_t *j_blocks;		/* buffers it has pinned */
+	daddr_t *j_oldblocks;		/* the last one's, to unpin */
+	unsigned j_nblocks, j_maxblocks;
+	bool j_overflow;		/* changed more than it could pin */
+
+	/* The running transaction again (sfs_freemaplock). */
+	struct bitmap *j_fmdirty;	/* freemap blocks it changed */
+	uint32_t j_nfm;			/* freemap blocks on the volume */
+	daddr_t *j_frees;		/* blocks it freed */
+	unsigned j_nfrees, j_maxfrees;
+
+	/* The journal thread (j_lock). */
+	bool j_exit;			/* true to make it quit */
+	bool j_running;			/* false once it has */
+
+	bool j_warned;			/* said a transaction was too big */
+};
+
+/* Disk block of log position POS */
+#define SFS_JBLOCK(j, pos) ((j)->j_hdrblock + 1 + (pos))
+
+/* Log position N blocks after POS */
+#define SFS_JNEXT(j, pos, n) (((pos) + (n)) % (j)->j_size)
+
+////////////////////////////////////////////////////////////
+// Device I/O
+
+/*
+ * Read or write the N consecutive disk blocks from BLOCK on, to or
+ * from the blocks of memory in DATA, with one device request. The
+ * blocks don't go through the buffer cache: the log is never cached,
+ * and for home blocks whatever the cache has is the same or newer.
+ * Call with j_busy set (or during mount).
+ */
+static
+int
+sfs_jdevio(struct sfs_fs *sfs, daddr_t block, void **data, unsigned n,
+	   enum uio_rw rw)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct uio ku;
+	unsigned i;
+
+	KASSERT(n > 0 && n <= j->j_size);
+
+	for (i = 0; i < n; i++) {
+		j->j_iov[i].iov_kbase = data[i];
+		j->j_iov[i].iov_len = SFS_BLOCKSIZE;
+	}
+	ku.uio_iov = j->j_iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = ((off_t)block) * SFS_BLOCKSIZE;
+	ku.uio_resid = n * SFS_BLOCKSIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = rw;
+	ku.uio_space = NULL;
+	ku.uio_flags = 0;
+	return DEVOP_IO(sfs->sfs_device, &ku);
+}
+
+/*
+ * Read or write N log blocks from position POS on, which may wrap
+ * around the end of the log, to or from their shadows.
+ */
+static
+int
+sfs_jlogio(struct sfs_fs *sfs, uint32_t pos, uint32_t n, enum uio_rw rw)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	uint32_t first;
+	int result;
+
+	KASSERT(n <= j->j_size);
+
+	first = j->j_size - pos;
+	if (first > n) {
+		first = n;
+	}
+	result = sfs_jdevio(sfs, SFS_JBLOCK(j, pos), &j->j_shadow[pos],
+			    first, rw);
+	if (result == 0 && n > first) {
+		result = sfs_jdevio(sfs, SFS_JBLOCK(j, 0), &j->j_shadow[0],
+				    n - first, rw);
+	}
+	return result;
+}
+
+/*
+ * Point the header at the oldest live transaction, or where the next
+ * one will go if there are none, and write it out.
+ */
+static
+int
+sfs_jwriteheader(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	void *data;
+
+	bzero(j->j_hdr, sizeof(*j->j_hdr));
+	j->j_hdr->jh_magic = SFS_JMAGIC_HEADER;
+	if (j->j_nlive > 0) {
+		j->j_hdr->jh_tail = j->j_live[j->j_livefirst].jt_start;
+		j->j_hdr->jh_seq = j->j_live[j->j_livefirst].jt_seq;
+	}
+	else {
+		j->j_hdr->jh_tail = j->j_head;
+		j->j_hdr->jh_seq = j->j_commitseq;
+	}
+	data = j->j_hdr;
+	return sfs_jdevio(sfs, j->j_hdrblock, &data, 1, UIO_WRITE);
+}
+
+////////////////////////////////////////////////////////////
+// Transactions in the log
+
+/* Fold a block into a transaction's checksum */
+static
+uint32_t
+sfs_jsum(uint32_t sum, const void *block)
+{
+	const uint32_t *words = block;
+	unsigned i;
+
+	for (i = 0; i < SFS_BLOCKSIZE / sizeof(uint32_t); i++) {
+		sum = ((sum << 1) | (sum >> 31)) + words[i];
+	}
+	return sum;
+}
+
+/* Whether live transaction K (counting from the oldest) changes BLOCK */
+static
+bool
+sfs_jchanges(struct sfs_journal *j, unsigned k, daddr_t block)
+{
+	struct sfs_jtxn *t = &j->j_live[(j->j_livefirst + k) % j->j_livemax];
+	struct sfs_jdesc *d;
+	uint32_t pos, end;
+	unsigned i;
+
+	pos = t->jt_start;
+	end = SFS_JNEXT(j, t->jt_start, t->jt_len - 1);
+	while (pos != end) {
+		d = j->j_shadow[pos];
+		for (i = 0; i < d->jd_ntags; i++) {
+			if (d->jd_tags[i] == block) {
+				return true;
+			}
+		}
+		pos = SFS_JNEXT(j, pos, 1 + d->jd_ntags);
+	}
+	return false;
+}
+
+/*
+ * Write home the blocks of the transaction whose descriptors start at
+ * log position POS and whose commit block is at END, from their
+ * shadows, in runs of consecutive blocks. If it's live transaction K,
+ * leave out the blocks a later live one changes; if it's being
+ * replayed (K is -1) there's no later one yet.
+ */
+static
+int
+sfs_jputback(struct sfs_fs *sfs, uint32_t pos, uint32_t end, int k)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jdesc *d;
+	daddr_t block, runstart = 0;
+	unsigned i, m, n = 0;
+	bool later;
+	int result;
+
+	while (pos != end) {
+		d = j->j_shadow[pos];
+		for (i = 0; i < d->jd_ntags; i++) {
+			block = d->jd_tags[i];
+			later = false;
+			for (m = k + 1; k >= 0 && m < j->j_nlive && !later;
+			     m++) {
+				later = sfs_jchanges(j, m, block);
+			}
+			if (later) {
+				continue;
+			}
+			if (n > 0 && (block != runstart + n ||
+				      n == BUF_MAXRUN)) {
+				result = sfs_jdevio(sfs, runstart, j->j_run,
+						    n, UIO_WRITE);
+				if (result) {
+					return result;
+				}
+				n = 0;
+			}
+			if (n == 0) {
+				runstart = block;
+			}
+			j->j_run[n++] = j->j_shadow[SFS_JNEXT(j, pos, 1 + i)];
+		}
+		pos = SFS_JNEXT(j, pos, 1 + d->jd_ntags);
+	}
+	if (n > 0) {
+		return sfs_jdevio(sfs, runstart, j->j_run, n, UIO_WRITE);
+	}
+	return 0;
+}
+
+/*
+ * Checkpoint the oldest COUNT live transactions: write their blocks
+ * home, let the blocks they freed go, and move the header past them.
+ * Call with j_busy set and j_lock not held.
+ */
+static
+int
+sfs_jcheckpoint(struct sfs_fs *sfs, unsigned count)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jtxn *t;
+	unsigned i, done;
+	int result = 0;
+
+	KASSERT(j->j_busy);
+	KASSERT(count <= j->j_nlive);
+
+	for (done = 0; done < count; done++) {
+		t = &j->j_live[j->j_livefirst];
+		result = sfs_jputback(sfs, t->jt_start,
+				      SFS_JNEXT(j, t->jt_start, t->jt_len - 1),
+				      0);
+		if (result) {
+			break;
+		}
+
+		lock_acquire(sfs->sfs_freemaplock);
+		for (i = 0; i < t->jt_nfrees; i++) {
+			bitmap_unmark(sfs->sfs_freemap, t->jt_frees[i]);
+		}
+		sfs->sfs_nfree += t->jt_nfrees;
+		lock_release(sfs->sfs_freemaplock);
+		kfree(t->jt_frees);
+		t->jt_frees = NULL;
+
+		j->j_used -= t->jt_len;
+		j->j_livefirst = (j->j_livefirst + 1) % j->j_livemax;
+		j->j_nlive--;
+	}
+
+	if (done > 0) {
+		/* the blocks are home; now the log can forget them */
+		int result2 = sfs_jwriteheader(sfs);
+		if (result == 0) {
+			result = result2;
+		}
+	}
+	return result;
+}
+
+/* Take the log for a commit or checkpoint. Call with j_lock held. */
+static
+void
+sfs_jbusy(struct sfs_journal *j)
+{
+	while (j->j_busy) {
+		cv_wait(j->j_cv, j->j_lock);
+	}
+	j->j_busy = true;
+}
+
+/* Give it back. Call with j_lock held. */
+static
+void
+sfs_junbusy(struct sfs_journal *j)
+{
+	KASSERT(j->j_busy);
+	j->j_busy = false;
+	cv_broadcast(j->j_cv, j->j_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Commit
+
+/*
+ * Clear the bits of the blocks in FREES, which are still marked in use
+ * in memory, from IMAGE, a copy of freemap block FMBLOCK.
+ */
+static
+void
+sfs_jclearfrees(uint8_t *image, uint32_t fmblock, const daddr_t *frees,
+		unsigned nfrees)
+{
+	daddr_t bit;
+	unsigned i;
+
+	for (i = 0; i < nfrees; i++) {
+		if (frees[i] / SFS_BITSPERBLOCK != fmblock) {
+			continue;
+		}
+		bit = frees[i] % SFS_BITSPERBLOCK;
+		image[bit / CHAR_BIT] &= ~(1 << (bit % CHAR_BIT));
+	}
+}
+
+/*
+ * Copy a block for the transaction being committed into its shadow
+ * in the log: a freemap block from the bitmap, as it will be once
+ * every live transaction's frees are done, or anything else from its
+ * pinned buffer.
+ */
+static
+void
+sfs_jsnapshot(struct sfs_fs *sfs, daddr_t block, void *shadow)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jtxn *t;
+	struct buf *b;
+	uint32_t fmblock;
+	unsigned k;
+	int result;
+
+	if (block >= SFS_FREEMAP_START && block < SFS_FREEMAP_START + j->j_nfm) {
+		fmblock = block - SFS_FREEMAP_START;
+		memcpy(shadow, (char *)bitmap_getdata(sfs->sfs_freemap) +
+		       fmblock * SFS_BLOCKSIZE, SFS_BLOCKSIZE);
+		sfs_jclearfrees(shadow, fmblock, j->j_frees, j->j_nfrees);
+		for (k = 0; k < j->j_nlive; k++) {
+			t = &j->j_live[(j->j_livefirst + k) % j->j_livemax];
+			sfs_jclearfrees(shadow, fmblock, t->jt_frees,
+					t->jt_nfrees);
+		}
+		return;
+	}
+
+	/* (pinned buffers stay in the cache, so this can't need I/O) */
+	result = buf_read(sfs->sfs_device, block, &b);
+	if (result) {
+		panic("sfs: journal: pinned block %u not cached: %s\n",
+		      block, strerror(result));
+	}
+	memcpy(shadow, buf_data(b), SFS_BLOCKSIZE);
+	buf_release(b);
+}
+
+/* Sort the first N of j_tags (shell sort) */
+static
+void
+sfs_jsorttags(struct sfs_journal *j, unsigned n)
+{
+	daddr_t t;
+	unsigned i, k, gap;
+
+	for (gap = n / 2; gap > 0; gap /= 2) {
+		for (i = gap; i < n; i++) {
+			t = j->j_tags[i];
+			for (k = i; k >= gap && t < j->j_tags[k - gap];
+			     k -= gap) {
+				j->j_tags[k] = j->j_tags[k - gap];
+			}
+			j->j_tags[k] = t;
+		}
+	}
+}
+
+/*
+ * Take the running transaction's blocks: the pinned ones and the
+ * changed freemap blocks, into j_tags, sorted. Hand back how many.
+ * Call with j_lock and sfs_freemaplock held.
+ */
+static
+unsigned
+sfs_jgettags(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	unsigned i, n;
+
+	n = 0;
+	for (i = 0; i < j->j_nblocks; i++) {
+		j->j_tags[n++] = j->j_blocks[i];
+	}
+	for (i = 0; i < j->j_nfm; i++) {
+		if (bitmap_isset(j->j_fmdirty, i)) {
+			j->j_tags[n++] = SFS_FREEMAP_START + i;
+		}
+	}
+	sfs_jsorttags(j, n);
+	return n;
+}
+
+/*
+ * End the running transaction and start the next: the pinned blocks
+ * move to j_oldblocks (for unpinning), and the frees are handed back.
+ * Call with j_lock and sfs_freemaplock held.
+ */
+static
+void
+sfs_jnexttxn(struct sfs_journal *j, daddr_t **frees, unsigned *nfrees)
+{
+	daddr_t *tmp;
+	unsigned i;
+
+	tmp = j->j_oldblocks;
+	j->j_oldblocks = j->j_blocks;
+	j->j_blocks = tmp;
+	j->j_nblocks = 0;
+	j->j_overflow = false;
+
+	for (i = 0; i < j->j_nfm; i++) {
+		if (bitmap_isset(j->j_fmdirty, i)) {
+			bitmap_unmark(j->j_fmdirty, i);
+		}
+	}
+	*frees = j->j_frees;
+	*nfrees = j->j_nfrees;
+	j->j_frees = NULL;
+	j->j_nfrees = j->j_maxfrees = 0;
+
+	j->j_seq++;
+	if (j->j_seq == 0) {
+		/* 0 means not pinned */
+		j->j_seq = 1;
+	}
+}
+
+/*
+ * The running transaction was too big to journal (see the top of the
+ * file). It has been ended, with NOLD pinned blocks in j_oldblocks,
+ * and FREES are the blocks it freed. Put everything in place without
+ * the log. Call with j_busy set and no locks.
+ */
+static
+int
+sfs_jwritedirect(struct sfs_fs *sfs, unsigned nold, uint32_t seq,
+		 daddr_t *frees, unsigned nfrees, unsigned nfm)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	unsigned i;
+	int result;
+
+	if (!j->j_warned) {
+		kprintf("sfs: %s: transaction too big for the journal; "
+			"writing it in place\n", sfs->sfs_sb.sb_volname);
+		j->j_warned = true;
+	}
+
+	/*
+	 * The older ones first, so nothing can bring them back over
+	 * it, then its blocks (and, no matter, the data). If that goes
+	 * wrong, let its blocks go anyway (for the cache to write when
+	 * it can) and leave its frees undone; sfsck will find them.
+	 */
+	result = sfs_jcheckpoint(sfs, j->j_nlive);
+	for (i = 0; i < nold; i++) {
+		buf_unpin(sfs->sfs_device, j->j_oldblocks[i], seq);
+	}
+	if (result == 0) {
+		result = buf_flush(sfs->sfs_device);
+	}
+	if (result) {
+		kfree(frees);
+		return result;
+	}
+
+	/*
+	 * Then the freemap blocks it changed, with its frees done, now
+	 * that nothing on disk points to those. (The log is empty, so
+	 * its shadows are free to copy into.)
+	 */
+	lock_acquire(sfs->sfs_freemaplock);
+	for (i = 0; i < nfrees; i++) {
+		bitmap_unmark(sfs->sfs_freemap, frees[i]);
+	}
+	sfs->sfs_nfree += nfrees;
+	for (i = 0; i < nfm; i++) {
+		memcpy(j->j_shadow[i], (char *)bitmap_getdata(sfs->sfs_freemap)
+		       + (j->j_tags[i] - SFS_FREEMAP_START) * SFS_BLOCKSIZE,
+		       SFS_BLOCKSIZE);
+	}
+	lock_release(sfs->sfs_freemaplock);
+	kfree(frees);
+	for (i = 0; i < nfm; i++) {
+		result = sfs_jdevio(sfs, j->j_tags[i], &j->j_shadow[i], 1,
+				    UIO_WRITE);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* it never went in the log, so its number is the next one's */
+	j->j_commitseq = seq + 1;
+	return sfs_jwriteheader(sfs);
+}
+
+/*
+ * Commit the running transaction, and wait until it's in the log.
+ */
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jtxn *t;
+	struct sfs_jdesc *d;
+	struct sfs_jcommit *c;
+	struct timespec now;
+	daddr_t *frees;
+	unsigned i, n, nold, nfrees, ndesc, nfm;
+	uint32_t seq, pos, len, sum;
+	int result;
+
+	if (j == NULL) {
+		return 0;
+	}
+
+	lock_acquire(j->j_lock);
+	sfs_jbusy(j);
+
+	/*
+	 * Wait for the handles to end and for there to be room in the
+	 * log; making room means letting go of j_lock, after which
+	 * there may be new handles, so check again.
+	 */
+	while (1) {
+		while (j->j_nactive > 0) {
+			cv_wait(j->j_cv, j->j_lock);
+		}
+		lock_acquire(sfs->sfs_freemaplock);
+		n = sfs_jgettags(sfs);
+		if (n == 0 && j->j_nfrees == 0 && !j->j_overflow) {
+			/* nothing to commit */
+			lock_release(sfs->sfs_freemaplock);
+			sfs_junbusy(j);
+			lock_release(j->j_lock);
+			return 0;
+		}
+		ndesc = DIVROUNDUP(n, SFS_JTAGS);
+		if (ndesc == 0) {
+			/* (even with only frees, write a descriptor) */
+			ndesc = 1;
+		}
+		len = ndesc + n + 1;
+		if (j->j_overflow || (len <= j->j_size - j->j_used &&
+				      j->j_nlive < j->j_livemax)) {
+			break;
+		}
+		lock_release(sfs->sfs_freemaplock);
+		/* (j_maxblocks is small enough for an empty log to do) */
+		KASSERT(j->j_nlive > 0);
+		lock_release(j->j_lock);
+		result = sfs_jcheckpoint(sfs, 1);
+		lock_acquire(j->j_lock);
+		if (result) {
+			sfs_junbusy(j);
+			lock_release(j->j_lock);
+			return result;
+		}
+	}
+
+	seq = j->j_seq;
+	nold = j->j_nblocks;
+
+	if (j->j_overflow) {
+		/* pick out the freemap blocks */
+		nfm = 0;
+		for (i = 0; i < n; i++) {
+			if (j->j_tags[i] >= SFS_FREEMAP_START &&
+			    j->j_tags[i] < SFS_FREEMAP_START + j->j_nfm) {
+				j->j_tags[nfm++] = j->j_tags[i];
+			}
+		}
+		sfs_jnexttxn(j, &frees, &nfrees);
+		lock_release(sfs->sfs_freemaplock);
+		lock_release(j->j_lock);
+
+		result = sfs_jwritedirect(sfs, nold, seq, frees, nfrees, nfm);
+
+		lock_acquire(j->j_lock);
+		sfs_junbusy(j);
+		lock_release(j->j_lock);
+		return result;
+	}
+
+	/*
+	 * Lay the transaction out in the shadow from j_head on:
+	 * descriptors, each followed by the blocks it lists, and the
+	 * commit block.
+	 */
+	pos = j->j_head;
+	d = NULL;
+	for (i = 0; i < n || d == NULL; i++) {
+		if (i % SFS_JTAGS == 0) {
+			d = j->j_shadow[pos];
+			bzero(d, SFS_BLOCKSIZE);
+			d->jd_magic = SFS_JMAGIC_DESC;
+			d->jd_seq = seq;
+			d->jd_ntags = n - i < SFS_JTAGS ? n - i : SFS_JTAGS;
+			pos = SFS_JNEXT(j, pos, 1);
+		}
+		if (i < n) {
+			d->jd_tags[i % SFS_JTAGS] = j->j_tags[i];
+			sfs_jsnapshot(sfs, j->j_tags[i], j->j_shadow[pos]);
+			pos = SFS_JNEXT(j, pos, 1);
+		}
+	}
+
+	sum = 0;
+	for (i = 0; i < len - 1; i++) {
+		sum = sfs_jsum(sum, j->j_shadow[SFS_JNEXT(j, j->j_head, i)]);
+	}
+	c = j->j_shadow[pos];
+	bzero(c, SFS_BLOCKSIZE);
+	c->jc_magic = SFS_JMAGIC_COMMIT;
+	c->jc_seq = seq;
+	c->jc_nblocks = n;
+	c->jc_checksum = sum;
+
+	/* it's live now (once it's written, which is next) */
+	sfs_jnexttxn(j, &frees, &nfrees);
+	lock_release(sfs->sfs_freemaplock);
+
+	t = &j->j_live[(j->j_livefirst + j->j_nlive) % j->j_livemax];
+	t->jt_seq = seq;
+	t->jt_start = j->j_head;
+	t->jt_len = len;
+	t->jt_committed = 0;
+	t->jt_frees = frees;
+	t->jt_nfrees = nfrees;
+	j->j_nlive++;
+	j->j_used += len;
+	pos = j->j_head;
+	j->j_head = SFS_JNEXT(j, j->j_head, len);
+	j->j_commitseq = seq + 1;
+
+	/* let new handles go ahead while we write */
+	lock_release(j->j_lock);
+
+	result = sfs_jlogio(sfs, pos, len, UIO_WRITE);
+	if (result) {
+		/*
+		 * It's still in memory, and checkpointing will put it
+		 * in place; but until then a crash loses it and those
+		 * after it.
+		 */
+		kprintf("sfs: %s: journal write failed: %s\n",
+			sfs->sfs_sb.sb_volname, strerror(result));
+	}
+
+	for (i = 0; i < nold; i++) {
+		buf_unpin(sfs->sfs_device, j->j_oldblocks[i], seq);
+	}
+
+	lock_acquire(j->j_lock);
+	if (result == 0) {
+		gettime(&now);
+		t->jt_committed = now.tv_sec;
+	}
+	/* (otherwise it stays 0, so the thread checkpoints it next) */
+	sfs_junbusy(j);
+	lock_release(j->j_lock);
+
+	return result;
+}
+
+/*
+ * Checkpoint the live transactions committed before CUTOFF, or all
+ * of them if ALL.
+ */
+static
+int
+sfs_jcheckpoint_old(struct sfs_fs *sfs, time_t cutoff, bool all)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	unsigned count;
+	int result;
+
+	lock_acquire(j->j_lock);
+	sfs_jbusy(j);
+	for (count = 0; count < j->j_nlive; count++) {
+		if (!all && j->j_live[(j->j_livefirst + count) %
+				      j->j_livemax].jt_committed >= cutoff) {
+			break;
+		}
+	}
+	lock_release(j->j_lock);
+
+	result = count > 0 ? sfs_jcheckpoint(sfs, count) : 0;
+
+	lock_acquire(j->j_lock);
+	sfs_junbusy(j);
+	lock_release(j->j_lock);
+	return result;
+}
+
+/*
+ * Commit, and put everything committed in place, so the log is empty
+ * (for sync).
+ */
+int
+sfs_jsync(struct sfs_fs *sfs)
+{
+	int result;
+
+	if (sfs->sfs_journal == NULL) {
+		return 0;
+	}
+	result = sfs_jcommit(sfs);
+	if (result) {
+		return result;
+	}
+	return sfs_jcheckpoint_old(sfs, 0, true);
+}
+
+/*
+ * The journal thread: commit once in a while, and checkpoint what's
+ * been in the log for long enough, until told to quit (at unmount).
+ */
+static
+void
+sfs_journaler(void *data, unsigned long unused)
+{
+	struct sfs_fs *sfs = data;
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct timespec now;
+
+	(void)unused;
+
+	while (1) {
+		clocksleep(SFS_JCOMMITSECS);
+
+		lock_acquire(j->j_lock);
+		if (j->j_exit) {
+			break;
+		}
+		lock_release(j->j_lock);
+
+		/* (errors were reported; sync will see them too) */
+		(void)sfs_jcommit(sfs);
+		gettime(&now);
+		(void)sfs_jcheckpoint_old(sfs, now.tv_sec - SFS_JMAXAGE + 1,
+					  false);
+	}
+	j->j_running = false;
+	cv_broadcast(j->j_cv, j->j_lock);
+	lock_release(j->j_lock);
+
+	thread_exit();
+}
+
+////////////////////////////////////////////////////////////
+// Handles and changes
+
+/*
+ * Start a handle: the changes made until the matching sfs_jend go in
+ * the running transaction (or a later one), all or nothing. Handles
+ * may nest, and don't wait for a commit, so one can be started with
+ * locks held; but they hold commits up, so they should be short.
+ */
+void
+sfs_jbegin(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	if (j == NULL) {
+		return;
+	}
+	lock_acquire(j->j_lock);
+	j->j_nactive++;
+	lock_release(j->j_lock);
+}
+
+/*
+ * End a handle. If that leaves the running transaction idle and it
+ * has pinned half of what it may, commit it now rather than wait for
+ * the thread; so don't hold vnode locks.
+ */
+void
+sfs_jend(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	bool commit;
+
+	if (j == NULL) {
+		return;
+	}
+	lock_acquire(j->j_lock);
+	KASSERT(j->j_nactive > 0);
+	j->j_nactive--;
+	commit = false;
+	if (j->j_nactive == 0) {
+		cv_broadcast(j->j_cv, j->j_lock);
+		commit = !j->j_busy && (j->j_overflow ||
+					j->j_nblocks >= j->j_maxblocks / 2);
+	}
+	lock_release(j->j_lock);
+
+	if (commit) {
+		/* (if it fails, the thread will try again) */
+		(void)sfs_jcommit(sfs);
+	}
+}
+
+/*
+ * Mark buffer B, holding metadata block BLOCK, changed, within a
+ * handle; on a journaled volume pin it for the running transaction.
+ */
+void
+sfs_jdirty(struct sfs_fs *sfs, daddr_t block, struct buf *b)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	buf_markdirty(b);
+	if (j == NULL) {
+		return;
+	}
+
+	lock_acquire(j->j_lock);
+	KASSERT(j->j_nactive > 0);
+	if (buf_pinned(b) != j->j_seq) {
+		if (j->j_nblocks < j->j_maxblocks) {
+			buf_pin(b, j->j_seq);
+			j->j_blocks[j->j_nblocks++] = block;
+		}
+		else {
+			/* no room; see sfs_jcommit */
+			j->j_overflow = true;
+		}
+	}
+	lock_release(j->j_lock);
+}
+
+/*
+ * Note that the freemap bit for BLOCK has changed. Call with
+ * sfs_freemaplock held.
+ */
+void
+sfs_jfreemap(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	uint32_t fmblock;
+
+	if (j == NULL) {
+		return;
+	}
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+	fmblock = block / SFS_BITSPERBLOCK;
+	if (!bitmap_isset(j->j_fmdirty, fmblock)) {
+		bitmap_mark(j->j_fmdirty, fmblock);
+	}
+}
+
+/*
+ * Free BLOCK once the running transaction is checkpointed; until then
+ * it stays marked in use. Call with sfs_freemaplock held.
+ */
+void
+sfs_jfree(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	daddr_t *frees;
+	unsigned max;
+
+	KASSERT(j != NULL);
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	if (j->j_nfrees == j->j_maxfrees) {
+		max = j->j_maxfrees == 0 ? SFS_FREEBATCH : j->j_maxfrees * 2;
+		frees = kmalloc_tagged(max * sizeof(*frees), KM_FS);
+		if (frees == NULL) {
+			/*
+			 * Free it now and hope. (It can only be reused
+			 * too early if we crash at just the wrong time.)
+			 */
+			bitmap_unmark(sfs->sfs_freemap, block);
+			sfs_jfreemap(sfs, block);
+			sfs->sfs_nfree++;
+			return;
+		}
+		if (j->j_nfrees > 0) {
+			memcpy(frees, j->j_frees,
+			       j->j_nfrees * sizeof(*frees));
+		}
+		kfree(j->j_frees);
+		j->j_frees = frees;
+		j->j_maxfrees = max;
+	}
+	j->j_frees[j->j_nfrees++] = block;
+	sfs_jfreemap(sfs, block);
+}
+
+////////////////////////////////////////////////////////////
+// Mount and unmount
+
+/*
+ * Check whether there's a complete transaction numbered SEQ at log
+ * position POS, reading it into the shadow; hand back its length, or
+ * 0 if there isn't. There are at most ROOM log blocks to look in.
+ */
+static
+uint32_t
+sfs_jreadtxn(struct sfs_fs *sfs, uint32_t pos, uint32_t seq, uint32_t room)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_jdesc *d;
+	struct sfs_jcommit *c;
+	uint32_t len, n, sum, i, k;
+
+	len = n = sum = 0;
+	while (1) {
+		if (len + 1 > room) {
+			return 0;
+		}
+		if (sfs_jlogio(sfs, SFS_JNEXT(j, pos, len), 1, UIO_READ)) {
+			return 0;
+		}
+		d = j->j_shadow[SFS_JNEXT(j, pos, len)];
+		c = j->j_shadow[SFS_JNEXT(j, pos, len)];
+		if (c->jc_magic == SFS_JMAGIC_COMMIT && c->jc_seq == seq) {
+			break;
+		}
+		if (d->jd_magic != SFS_JMAGIC_DESC || d->jd_seq != seq ||
+		    d->jd_ntags > SFS_JTAGS ||
+		    len + 1 + d->jd_ntags + 1 > room) {
+			return 0;
+		}
+		for (k = 0; k < d->jd_ntags; k++) {
+			/* none of them belongs in the superblock or log */
+			if (d->jd_tags[k] == SFS_SUPER_BLOCK ||
+			    d->jd_tags[k] >= sfs->sfs_sb.sb_nblocks ||
+			    (d->jd_tags[k] >= j->j_hdrblock &&
+			     d->jd_tags[k] <= j->j_hdrblock + j->j_size)) {
+				return 0;
+			}
+		}
+		if (d->jd_ntags > 0 &&
+		    sfs_jlogio(sfs, SFS_JNEXT(j, pos, len + 1), d->jd_ntags,
+			       UIO_READ)) {
+			return 0;
+		}
+		for (i = 0; i < 1 + d->jd_ntags; i++) {
+			sum = sfs_jsum(sum, j->j_shadow[SFS_JNEXT(j, pos,
+								 len + i)]);
+		}
+		n += d->jd_ntags;
+		len += 1 + d->jd_ntags;
+	}
+
+	if (len == 0 || c->jc_nblocks != n || c->jc_checksum != sum) {
+		return 0;
+	}
+	return len + 1;
+}
+
+/*
+ * Put in place what's in the log, then start it over empty.
+ */
+static
+int
+sfs_jreplay(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	uint32_t pos, seq, len, scanned;
+	unsigned count;
+	void *data;
+	int result;
+
+	data = j->j_hdr;
+	result = sfs_jdevio(sfs, j->j_hdrblock, &data, 1, UIO_READ);
+	if (result) {
+		return result;
+	}
+	if (j->j_hdr->jh_magic != SFS_JMAGIC_HEADER ||
+	    j->j_hdr->jh_tail >= j->j_size) {
+		kprintf("sfs: %s: Bad journal header\n",
+			sfs->sfs_sb.sb_volname);
+		return EINVAL;
+	}
+
+	pos = j->j_hdr->jh_tail;
+	seq = j->j_hdr->jh_seq;
+	scanned = 0;
+	count = 0;
+	while ((len = sfs_jreadtxn(sfs, pos, seq, j->j_size - scanned)) > 0) {
+		result = sfs_jputback(sfs, pos, SFS_JNEXT(j, pos, len - 1),
+				      -1);
+		if (result) {
+			return result;
+		}
+		pos = SFS_JNEXT(j, pos, len);
+		seq++;
+		scanned += len;
+		count++;
+	}
+	if (count > 0) {
+		kprintf("sfs: %s: replayed %u journal transaction%s\n",
+			sfs->sfs_sb.sb_volname, count, count == 1 ? "" : "s");
+	}
+
+	/* (anything left in the log has an older number, or isn't whole) */
+	j->j_head = 0;
+	j->j_used = 0;
+	j->j_seq = seq == 0 ? 1 : seq;
+	j->j_commitseq = j->j_seq;
+	return sfs_jwriteheader(sfs);
+}
+
+/* Free what sfs_jinit allocated. */
+static
+void
+sfs_jdestroy(struct sfs_journal *j)
+{
+	uint32_t i;
+
+	if (j->j_shadow != NULL) {
+		for (i = 0; i < j->j_size; i++) {
+			kfree(j->j_shadow[i]);
+		}
+	}
+	kfree(j->j_shadow);
+	kfree(j->j_hdr);
+	kfree(j->j_iov);
+	kfree(j->j_run);
+	kfree(j->j_tags);
+	kfree(j->j_live);
+	kfree(j->j_blocks);
+	kfree(j->j_oldblocks);
+	kfree(j->j_frees);
+	if (j->j_fmdirty != NULL) {
+		bitmap_destroy(j->j_fmdirty);
+	}
+	if (j->j_cv != NULL) {
+		cv_destroy(j->j_cv);
+	}
+	if (j->j_lock != NULL) {
+		lock_destroy(j->j_lock);
+	}
+	kfree(j);
+}
+
+/*
+ * Set up the journal at mount, if the volume has one: replay it and
+ * start the journal thread. Call after loading the superblock and
+ * before loading the freemap.
+ */
+int
+sfs_jinit(struct sfs_fs *sfs)
+{
+	struct sfs_superblock *sb = &sfs->sfs_sb;
+	struct sfs_journal *j;
+	uint32_t i, maxtags;
+	int result;
+
+	sfs->sfs_journal = NULL;
+	if ((sb->sb_features & SFS_FEATURE_JOURNAL) == 0) {
+		return 0;
+	}
+
+	if (sb->sb_journalstart < SFS_FREEMAP_START +
+	    SFS_FREEMAPBLOCKS(sb->sb_nblocks) ||
+	    sb->sb_journalblocks < SFS_JMINBLOCKS ||
+	    sb->sb_journalblocks > sb->sb_nblocks - sb->sb_journalstart) {
+		kprintf("sfs: %s: Bad journal location (%u blocks at %u)\n",
+			sb->sb_volname, sb->sb_journalblocks,
+			sb->sb_journalstart);
+		return EINVAL;
+	}
+
+	j = kmalloc_tagged(sizeof(*j), KM_FS);
+	if (j == NULL) {
+		return ENOMEM;
+	}
+	bzero(j, sizeof(*j));
+	j->j_hdrblock = sb->sb_journalstart;
+	j->j_size = sb->sb_journalblocks - 1;
+	j->j_nfm = SFS_FREEMAPBLOCKS(sb->sb_nblocks);
+
+	/*
+	 * A transaction always has to fit in an empty log: its blocks,
+	 * every freemap block, the descriptors, the commit block.
+	 */
+	maxtags = j->j_size - 1 - DIVROUNDUP(j->j_size, SFS_JTAGS);
+	j->j_maxblocks = maxtags > j->j_nfm ? maxtags - j->j_nfm : 0;
+	if (j->j_maxblocks > buf_pinmax()) {
+		j->j_maxblocks = buf_pinmax();
+	}
+	if (j->j_maxblocks < SFS_JMINPIN) {
+		kprintf("sfs: %s: Journal too small (%u blocks)\n",
+			sb->sb_volname, sb->sb_journalblocks);
+		kfree(j);
+		return EINVAL;
+	}
+
+	/* each live one takes at least a descriptor and a commit block */
+	j->j_livemax = j->j_size / 2;
+
+	j->j_lock = lock_create("sfs_journal");
+	j->j_cv = cv_create("sfs_journal");
+	j->j_shadow = kmalloc_tagged(j->j_size * sizeof(*j->j_shadow), KM_FS);
+	j->j_hdr = kmalloc_tagged(sizeof(*j->j_hdr), KM_FS);
+	j->j_iov = kmalloc_tagged(j->j_size * sizeof(*j->j_iov), KM_FS);
+	j->j_run = kmalloc_tagged(j->j_size * sizeof(*j->j_run), KM_FS);
+	j->j_tags = kmalloc_tagged(maxtags * sizeof(*j->j_tags), KM_FS);
+	j->j_live = kmalloc_tagged(j->j_livemax * sizeof(*j->j_live), KM_FS);
+	j->j_blocks = kmalloc_tagged(j->j_maxblocks * sizeof(*j->j_blocks),
+				     KM_FS);
+	j->j_oldblocks = kmalloc_tagged(j->j_maxblocks * sizeof(*j->j_oldblocks),
+					KM_FS);
+	j->j_fmdirty = bitmap_create(j->j_nfm);
+	if (j->j_lock == NULL || j->j_cv == NULL || j->j_shadow == NULL ||
+	    j->j_hdr == NULL || j->j_iov == NULL || j->j_run == NULL ||
+	    j->j_tags == NULL || j->j_live == NULL || j->j_blocks == NULL ||
+	    j->j_oldblocks == NULL || j->j_fmdirty == NULL) {
+		kfree(j->j_shadow);
+		j->j_shadow = NULL;
+		sfs_jdestroy(j);
+		return ENOMEM;
+	}
+	for (i = 0; i < j->j_size; i++) {
+		j->j_shadow[i] = NULL;
+	}
+	for (i = 0; i < j->j_size; i++) {
+		j->j_shadow[i] = kmalloc_tagged(SFS_BLOCKSIZE, KM_FS);
+		if (j->j_shadow[i] == NULL) {
+			sfs_jdestroy(j);
+			return ENOMEM;
+		}
+	}
+
+	sfs->sfs_journal = j;
+	result = sfs_jreplay(sfs);
+	if (result) {
+		sfs->sfs_journal = NULL;
+		sfs_jdestroy(j);
+		return result;
+	}
+
+	j->j_running = true;
+	result = thread_fork("sfsjournal", NULL, sfs_journaler, sfs, 0);
+	if (result) {
+		sfs->sfs_journal = NULL;
+		sfs_jdestroy(j);
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * Stop the journal thread and let the journal go, at unmount (after
+ * sync, which emptied the log) or when mount fails.
+ */
+void
+sfs_jshutdown(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	if (j == NULL) {
+		return;
+	}
+
+	lock_acquire(j->j_lock);
+	j->j_exit = true;
+	while (j->j_running) {
+		cv_wait(j->j_cv, j->j_lock);
+	}
+	KASSERT(j->j_nactive == 0);
+	KASSERT(!j->j_busy);
+	lock_release(j->j_lock);
+
+	/* (a mount that failed later on never changed anything) */
+	KASSERT(j->j_nlive == 0);
+	KASSERT(j->j_nblocks == 0 && j->j_nfrees == 0);
+
+	sfs->sfs_journal = NULL;
+	sfs_jdestroy(j);
+}
@@ -35,16 +35,51 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/ioctl.h>
 #include <stat.h>
 #include <lib.h>
 #include <uio.h>
+#include <copyinout.h>
+#include <synch.h>
 #include <vfs.h>
+#include <vm.h>
+#include <bufcache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 ////////////////////////////////////////////////////////////
 // Vnode operations.
 
+/*
+ * Shared locking for the operations that only look: read, lookup,
+ * stat, reading directories. On a read-only volume nothing can change
+ * the inode or the contents under them (what they do change for
+ * themselves, readahead state and directory indexes, is under
+ * sv_spinlock), so they go without, and readers of one file on
+ * different cpus don't all pass through the one lock.
+ */
+static
+void
+sfs_readlock(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	if (!sfs->sfs_readonly) {
+		rwlock_acquire_read(sv->sv_lock);
+	}
+}
+
+static
+void
+sfs_readunlock(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	if (!sfs->sfs_readonly) {
+		rwlock_release_read(sv->sv_lock);
+	}
+}
+
 /*
  * This is called on *each* open().
  */
@@ -52,16 +87,19 @@ static
 int
 sfs_eachopen(struct vnode *v, int openflags)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+
 	/*
 	 * At this level we do not need to handle O_CREAT, O_EXCL,
 	 * O_TRUNC, or O_APPEND.
 	 *
-	 * Any of O_RDONLY, O_WRONLY, and O_RDWR are valid, so we don't need
-	 * to check that either.
+	 * Any of O_RDONLY, O_WRONLY, and O_RDWR are valid, except
+	 * that a read-only volume can only be read.
 	 */
 
-	(void)v;
-	(void)openflags;
+	if (sfs->sfs_readonly && (openflags & O_ACCMODE) != O_RDONLY) {
+		return EROFS;
+	}
 
 	return 0;
 }
@@ -91,20 +129,30 @@ sfs_eachopendir(struct vnode *v, int openflags)
 }
 
 /*
- * Called for read(). sfs_io() does the work.
+ * Called for read(). sfs_io() does the work; then start reading
+ * ahead, if the file is being read sequentially.
  */
 static
 int
 sfs_read(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	off_t pos;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	sfs_readlock(sv);
+	pos = uio->uio_offset;
+	/* pages that are mapped somewhere are already in memory */
+	result = textcache_read(v, uio);
+	if (result == 0 && uio->uio_resid > 0) {
+		result = sfs_io(sv, uio);
+	}
+	if (result == 0 && uio->uio_offset > pos) {
+		sfs_readahead(sv, pos, uio->uio_offset);
+	}
+	sfs_readunlock(sv);
 
 	return result;
 }
@@ -116,34 +164,99 @@ static
 int
 sfs_write(struct vnode *v, struct uio *uio)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
-	vfs_biglock_acquire();
+	if (sfs->sfs_readonly) {
+		return EROFS;
+	}
+
+	sfs_jbegin(sfs);
+	rwlock_acquire_write(sv->sv_lock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	sfs_jsync_inode(sv);
+	rwlock_release_write(sv->sv_lock);
+	sfs_jend(sfs);
 
 	return result;
 }
 
 /*
- * Called for ioctl()
+ * Called for ioctl(). The only ones are for finding out how a file
+ * lies on the disk and for moving it together (see sfs_bmap.c).
  */
 static
 int
 sfs_ioctl(struct vnode *v, int op, userptr_t data)
 {
-	/*
-	 * No ioctls.
-	 */
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fragstat st;
+	int result;
 
-	(void)v;
-	(void)op;
-	(void)data;
+	if (sv->sv_i.sfi_type != SFS_TYPE_FILE) {
+		return EINVAL;
+	}
 
-	return EINVAL;
+	switch (op) {
+	    case SFS_IOC_FRAGS:
+		sfs_readlock(sv);
+		result = sfs_getfrags(sv, &st);
+		sfs_readunlock(sv);
+		break;
+	    case SFS_IOC_DEFRAG:
+		if (sfs->sfs_readonly) {
+			return EROFS;
+		}
+		sfs_jbegin(sfs);
+		rwlock_acquire_write(sv->sv_lock);
+		result = sfs_defrag(sv, &st);
+		sfs_jsync_inode(sv);
+		rwlock_release_write(sv->sv_lock);
+		sfs_jend(sfs);
+		break;
+	    default:
+		return EINVAL;
+	}
+	if (result) {
+		return result;
+	}
+	return copyout(&st, data, sizeof(st));
+}
+
+/*
+ * Called for getdirentry().
+ */
+static
+int
+sfs_getdirentry(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	sfs_readlock(sv);
+	result = sfs_dir_read(sv, uio, true);
+	sfs_readunlock(sv);
+	return result;
+}
+
+/*
+ * Called for getdirentries().
+ */
+static
+int
+sfs_getdirentries(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	sfs_readlock(sv);
+	result = sfs_dir_read(sv, uio, false);
+	sfs_readunlock(sv);
+	return result;
 }
 
 /*
@@ -164,13 +277,17 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	/* (all from the inode in memory; nothing needs reading) */
+	sfs_readlock(sv);
 	statbuf->st_size = sv->sv_i.sfi_size;
 	statbuf->st_nlink = sv->sv_i.sfi_linkcount;
+	sfs_readunlock(sv);
 
 	/* We don't support this yet */
 	statbuf->st_blocks = 0;
 
-	/* Fill in other fields as desired/possible... */
+	statbuf->st_ino = sv->sv_ino;
+	statbuf->st_blksize = SFS_BLOCKSIZE;
 
 	return 0;
 }
@@ -184,16 +301,13 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
+	/* (the type doesn't change, so no lock) */
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -220,25 +334,139 @@ static
 int
 sfs_fsync(struct vnode *v)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
-	vfs_biglock_acquire();
-	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	if (sfs->sfs_readonly) {
+		/* nothing to get to the disk */
+		return 0;
+	}
+
+	sfs_jbegin(sfs);
+	rwlock_acquire_write(sv->sv_lock);
+	result = sfs_dl_flush(sv);
+	if (result == 0) {
+		result = sfs_sync_inode(sv);
+	}
+	if (result == 0) {
+		sv->sv_syncdirty = false;
+	}
+	rwlock_release_write(sv->sv_lock);
+	sfs_jend(sfs);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * The inode and the file's blocks are in the buffer cache; get
+	 * them to the disk. (This writes out the rest of the volume's
+	 * changed blocks too.) With a journal, that leaves out the
+	 * changed metadata, which then goes in one commit, after the
+	 * data it points to.
+	 */
+	result = buf_flush(sfs->sfs_device);
+	if (result == 0) {
+		result = sfs_jcommit(sfs);
+	}
+	if (result) {
+		/* the next fsync or fdatasync has to do it all again */
+		rwlock_acquire_write(sv->sv_lock);
+		sv->sv_syncdirty = true;
+		rwlock_release_write(sv->sv_lock);
+	}
 
 	return result;
 }
 
 /*
- * Called for mmap().
+ * Sync LEN bytes of the file's data from START (to the end, if LEN is
+ * 0). If nothing but data has changed since the last fsync -- not the
+ * size, the block map, or anything else in the inode -- that means
+ * writing just the range's changed blocks, and not the inode or the
+ * rest of the volume. Otherwise it's a full fsync. On a journaled
+ * volume, file blocks written in place are pinned along with the
+ * metadata, so those get to the disk with a commit afterwards.
+ */
+static
+int
+sfs_datasync(struct vnode *v, off_t start, off_t len)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_vnode *sv = v->vn_data;
+	daddr_t blocks[BUF_MAXRUN];
+	uint32_t fileblock, endblock, n;
+	off_t end;
+	bool full;
+	int result;
+
+	if (sfs->sfs_readonly) {
+		return 0;
+	}
+
+	/* blocks still waiting for allocation change the map first */
+	sfs_jbegin(sfs);
+	rwlock_acquire_write(sv->sv_lock);
+	result = sfs_dl_flush(sv);
+	full = sv->sv_syncdirty;
+	end = sv->sv_i.sfi_size;
+	rwlock_release_write(sv->sv_lock);
+	sfs_jend(sfs);
+	if (result) {
+		return result;
+	}
+	if (full) {
+		return sfs_fsync(v);
+	}
+
+	if (len > 0 && start + len < end) {
+		end = start + len;
+	}
+	if (start >= end) {
+		return 0;
+	}
+	fileblock = start / SFS_BLOCKSIZE;
+	endblock = DIVROUNDUP(end, SFS_BLOCKSIZE);
+
+	while (fileblock < endblock) {
+		n = endblock - fileblock;
+		if (n > BUF_MAXRUN) {
+			n = BUF_MAXRUN;
+		}
+
+		rwlock_acquire_read(sv->sv_lock);
+		if (SFS_ISINLINE(sv)) {
+			/* the data's in the inode, unchanged since the fsync */
+			rwlock_release_read(sv->sv_lock);
+			break;
+		}
+		result = sfs_bmap_range(sv, fileblock, n, blocks);
+		rwlock_release_read(sv->sv_lock);
+		if (result) {
+			return result;
+		}
+
+		result = buf_flushblocks(sfs->sfs_device, blocks, n);
+		if (result) {
+			return result;
+		}
+		fileblock += n;
+	}
+
+	return sfs_jcommit(sfs);
+}
+
+/*
+ * Called for mmap(). Regular files can always be mapped; the VM system
+ * pages them in with VOP_READ and writes shared mappings back with
+ * VOP_WRITE, so there is nothing to set up here.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 /*
@@ -248,9 +476,70 @@ static
 int
 sfs_truncate(struct vnode *v, off_t len)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
+	int result;
 
-	return sfs_itrunc(sv, len);
+	if (sfs->sfs_readonly) {
+		return EROFS;
+	}
+
+	sfs_jbegin(sfs);
+	rwlock_acquire_write(sv->sv_lock);
+	result = sfs_itrunc(sv, len);
+	sfs_jsync_inode(sv);
+	rwlock_release_write(sv->sv_lock);
+	sfs_jend(sfs);
+
+	return result;
+}
+
+/*
+ * Called for lseek() with SEEK_HOLE or SEEK_DATA.
+ */
+static
+int
+sfs_seekhole(struct vnode *v, off_t pos, bool hole, off_t *ret)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	sfs_readlock(sv);
+	result = sfs_findhole(sv, pos, hole, ret);
+	sfs_readunlock(sv);
+	return result;
+}
+
+/*
+ * Called for fallocate(). Preallocating or punching a hole is one
+ * transaction, like truncating.
+ */
+static
+int
+sfs_fallocate(struct vnode *v, int mode, off_t start, off_t len)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	if (sfs->sfs_readonly) {
+		return EROFS;
+	}
+
+	sfs_jbegin(sfs);
+	rwlock_acquire_write(sv->sv_lock);
+	if (mode & FALLOC_FL_PUNCH_HOLE) {
+		result = sfs_punch(sv, start, len);
+	}
+	else {
+		result = sfs_allocrange(sv, start, len,
+					(mode & FALLOC_FL_KEEP_SIZE) != 0);
+	}
+	sfs_jsync_inode(sv);
+	rwlock_release_write(sv->sv_lock);
+	sfs_jend(sfs);
+
+	return result;
 }
 
 /*
@@ -288,37 +577,45 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
+	if (sfs->sfs_readonly) {
+		return EROFS;
+	}
+
+	sfs_jbegin(sfs);
+	rwlock_acquire_write(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
+		sfs_jend(sfs);
 		return EEXIST;
 	}
 
 	if (result==0) {
 		/* We got something; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
+		rwlock_release_write(sv->sv_lock);
+		sfs_jend(sfs);
 		if (result) {
-			vfs_biglock_release();
 			return result;
 		}
 		*ret = &newguy->sv_absvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
 	/* Didn't exist - create it */
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
@@ -328,20 +625,28 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	/* Link it into the directory */
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
+		rwlock_release_write(sv->sv_lock);
 		VOP_DECREF(&newguy->sv_absvn);
-		vfs_biglock_release();
+		sfs_jend(sfs);
 		return result;
 	}
 
-	/* Update the linkcount of the new file */
+	/*
+	 * Update the linkcount of the new file and consequently mark
+	 * it dirty. (Nobody can find it until we let go of the
+	 * directory, but sync can get at it through the vnode table.)
+	 */
+	rwlock_acquire_write(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
+	sfs_dirty(newguy);
+	sfs_jsync_inode(newguy);
+	rwlock_release_write(newguy->sv_lock);
 
-	/* and consequently mark it dirty. */
-	newguy->sv_dirty = true;
+	sfs_jsync_inode(sv);
+	rwlock_release_write(sv->sv_lock);
+	sfs_jend(sfs);
 
 	*ret = &newguy->sv_absvn;
-
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -354,32 +659,42 @@ static
 int
 sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 {
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *f = file->vn_data;
 	int result;
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
-	vfs_biglock_acquire();
-
 	/* Hard links to directories aren't allowed. */
 	if (f->sv_i.sfi_type == SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return EINVAL;
 	}
+	if (sfs->sfs_readonly) {
+		return EROFS;
+	}
+
+	sfs_jbegin(sfs);
+	rwlock_acquire_write(sv->sv_lock);
 
 	/* Create the link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
+	rwlock_acquire_write(f->sv_lock);
 	f->sv_i.sfi_linkcount++;
-	f->sv_dirty = true;
+	sfs_dirty(f);
+	sfs_jsync_inode(f);
+	rwlock_release_write(f->sv_lock);
 
-	vfs_biglock_release();
+	sfs_jsync_inode(sv);
+	rwlock_release_write(sv->sv_lock);
+	sfs_jend(sfs);
 	return 0;
 }
 
@@ -390,17 +705,24 @@ static
 int
 sfs_remove(struct vnode *dir, const char *name)
 {
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *victim;
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	if (sfs->sfs_readonly) {
+		return EROFS;
+	}
+
+	sfs_jbegin(sfs);
+	rwlock_acquire_write(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
@@ -408,15 +730,26 @@ sfs_remove(struct vnode *dir, const char *name)
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
+		rwlock_acquire_write(victim->sv_lock);
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
-		victim->sv_dirty = true;
+		sfs_dirty(victim);
+		sfs_jsync_inode(victim);
+		rwlock_release_write(victim->sv_lock);
 	}
 
-	/* Discard the reference that sfs_lookonce got us */
+	sfs_jsync_inode(sv);
+	rwlock_release_write(sv->sv_lock);
+
+	/*
+	 * Discard the reference that sfs_lookonce got us. (If that
+	 * was the last one, this reclaims the file, which doesn't
+	 * need the directory locked.) The reclaim goes in the same
+	 * transaction as the unlink.
+	 */
 	VOP_DECREF(&victim->sv_absvn);
+	sfs_jend(sfs);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -424,27 +757,36 @@ sfs_remove(struct vnode *dir, const char *name)
  * Rename a file.
  *
  * Since we don't support subdirectories, assumes that the two
- * directories passed are the same.
+ * directories passed are the same. So we lock the directory and then
+ * the file we're renaming (see sfs.h for the lock order). The new
+ * name can't already exist, so there's no second file to lock.
  */
 static
 int
 sfs_rename(struct vnode *d1, const char *n1,
 	   struct vnode *d2, const char *n2)
 {
+	struct sfs_fs *sfs = d1->vn_fs->fs_data;
 	struct sfs_vnode *sv = d1->vn_data;
 	struct sfs_vnode *g1;
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
-
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOTDIR_INO);
 
+	if (sfs->sfs_readonly) {
+		return EROFS;
+	}
+
+	sfs_jbegin(sfs);
+	rwlock_acquire_write(sv->sv_lock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		rwlock_release_write(sv->sv_lock);
+		sfs_jend(sfs);
 		return result;
 	}
 
@@ -465,8 +807,10 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 
 	/* Increment the link count, and mark inode dirty */
+	rwlock_acquire_write(g1->sv_lock);
 	g1->sv_i.sfi_linkcount++;
-	g1->sv_dirty = true;
+	sfs_dirty(g1);
+	rwlock_release_write(g1->sv_lock);
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -478,14 +822,20 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * Decrement the link count again, and mark the inode dirty again,
 	 * in case it's been synced behind our back.
 	 */
+	rwlock_acquire_write(g1->sv_lock);
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
-	g1->sv_dirty = true;
+	sfs_dirty(g1);
+	sfs_jsync_inode(g1);
+	rwlock_release_write(g1->sv_lock);
+
+	sfs_jsync_inode(sv);
+	rwlock_release_write(sv->sv_lock);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
+	sfs_jend(sfs);
 
-	vfs_biglock_release();
 	return 0;
 
  puke_harder:
@@ -499,11 +849,14 @@ sfs_rename(struct vnode *d1, const char *n1,
 			strerror(result2));
 		panic("sfs: rename: Cannot recover\n");
 	}
+	rwlock_acquire_write(g1->sv_lock);
 	g1->sv_i.sfi_linkcount--;
+	rwlock_release_write(g1->sv_lock);
  puke:
+	rwlock_release_write(sv->sv_lock);
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
-	vfs_biglock_release();
+	sfs_jend(sfs);
 	return result;
 }
 
@@ -521,15 +874,11 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -537,7 +886,6 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_absvn);
 	*ret = &sv->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -555,22 +903,19 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 	struct sfs_vnode *final;
 	int result;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
+	sfs_readlock(sv);
 	result = sfs_lookonce(sv, path, &final, NULL);
+	sfs_readunlock(sv);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	*ret = &final->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -589,12 +934,17 @@ const struct vnode_ops sfs_fileops = {
 	.vop_read = sfs_read,
 	.vop_readlink = vopfail_uio_notdir,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_uio_notdir,
 	.vop_write = sfs_write,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
 	.vop_gettype = sfs_gettype,
 	.vop_isseekable = sfs_isseekable,
 	.vop_fsync = sfs_fsync,
+	.vop_datasync = sfs_datasync,
+	.vop_poll = vnode_poll_always,
+	.vop_seekhole = sfs_seekhole,
+	.vop_fallocate = sfs_fallocate,
 	.vop_mmap = sfs_mmap,
 	.vop_truncate = sfs_truncate,
 	.vop_namefile = vopfail_uio_notdir,
@@ -622,13 +972,18 @@ const struct vnode_ops sfs_dirops = {
 
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_inval,
-	.vop_getdirentry = vopfail_uio_nosys,
+	.vop_getdirentry = sfs_getdirentry,
+	.vop_getdirentries = sfs_getdirentries,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
 	.vop_gettype = sfs_gettype,
 	.vop_isseekable = sfs_isseekable,
 	.vop_fsync = sfs_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = vnode_poll_always,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_isdir,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
 	.vop_namefile = sfs_namefile,
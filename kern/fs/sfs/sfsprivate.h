@@ -32,6 +32,9 @@
 
 #include <uio.h> /* for uio_rw */
 
+struct buf;
+struct sfs_fragstat;
+
 
 /* ops tables (in sfs_vnops.c) */
 extern const struct vnode_ops sfs_fileops;
@@ -42,15 +45,48 @@ extern const struct vnode_ops sfs_dirops;
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
 
+/* Blocks being freed together (sfs_balloc.c) */
+#define SFS_FREEBATCH	32
+struct sfs_freebatch {
+	unsigned fb_n;
+	daddr_t fb_blocks[SFS_FREEBATCH];
+};
+
 /* Functions in sfs_balloc.c */
-int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock);
+int sfs_balloc_file(struct sfs_vnode *sv, daddr_t goal, daddr_t *diskblock);
+void sfs_prealloc_release(struct sfs_vnode *sv);
+int sfs_balloc_run(struct sfs_vnode *sv, daddr_t goal, unsigned n);
+bool sfs_dlreserve(struct sfs_fs *sfs);
+void sfs_dlunreserve(struct sfs_fs *sfs, unsigned n);
+bool sfs_bavail(struct sfs_fs *sfs, unsigned n);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
+void sfs_freebatch_init(struct sfs_freebatch *fb);
+void sfs_freebatch_add(struct sfs_fs *sfs, struct sfs_freebatch *fb,
+		       daddr_t diskblock);
+void sfs_freebatch_flush(struct sfs_fs *sfs, struct sfs_freebatch *fb);
+
+/* Whether the volume's inodes hold extents */
+#define SFS_EXTENTS(sfs) (((sfs)->sfs_sb.sb_features & SFS_FEATURE_EXTENTS) != 0)
+
+/* Whether new files start out inline, and whether this one is */
+#define SFS_INLINE(sfs) (((sfs)->sfs_sb.sb_features & SFS_FEATURE_INLINE) != 0)
+#define SFS_ISINLINE(sv) (((sv)->sv_i.sfi_flags & SFS_INODE_INLINE) != 0)
 
 /* Functions in sfs_bmap.c */
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
+int sfs_bmap_range(struct sfs_vnode *sv, uint32_t fileblock, uint32_t nblocks,
+		   daddr_t *diskblocks);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
+int sfs_inline_evict(struct sfs_vnode *sv);
+int sfs_getfrags(struct sfs_vnode *sv, struct sfs_fragstat *st);
+int sfs_defrag(struct sfs_vnode *sv, struct sfs_fragstat *st);
+int sfs_findhole(struct sfs_vnode *sv, off_t pos, bool hole, off_t *ret);
+int sfs_punch(struct sfs_vnode *sv, off_t start, off_t len);
+int sfs_allocrange(struct sfs_vnode *sv, off_t start, off_t len,
+		   bool keepsize);
 
 /* Functions in sfs_dir.c */
 int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
@@ -58,24 +94,51 @@ int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 int sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino,
 		int *slot);
 int sfs_dir_unlink(struct sfs_vnode *sv, int slot);
+void sfs_dir_dropindex(struct sfs_vnode *sv);
+int sfs_dir_read(struct sfs_vnode *sv, struct uio *uio, bool onename);
 int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
 
 /* Functions in sfs_inode.c */
 int sfs_sync_inode(struct sfs_vnode *sv);
+void sfs_jsync_inode(struct sfs_vnode *sv);
+void sfs_dirty(struct sfs_vnode *sv);
+void sfs_dirtylist_add(struct sfs_vnode *sv);
+int sfs_dirtylist_take(struct sfs_fs *sfs, bool dlonly, bool remove,
+		       struct vnode ***ret, unsigned *numret);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		struct sfs_vnode **ret);
 int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
+int sfs_peektype(struct sfs_fs *sfs, uint32_t ino);
 struct vnode *sfs_getroot(struct fs *fs);
+void sfs_reap_orphans(struct sfs_fs *sfs);
+void sfs_inactive_purge(struct sfs_fs *sfs, bool all);
+void sfs_reaper(void *sfs, unsigned long unused);
 
 /* Functions in sfs_io.c */
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
+int sfs_dl_flush(struct sfs_vnode *sv);
+void sfs_dl_truncate(struct sfs_vnode *sv, off_t len);
+void sfs_flusher(void *sfs, unsigned long unused);
+uint32_t sfs_readrun(struct sfs_vnode *sv, uint32_t fileblock,
+		     uint32_t nblocks);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
+void sfs_readahead(struct sfs_vnode *sv, off_t start, off_t end);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
 
+/* Functions in sfs_journal.c */
+int sfs_jinit(struct sfs_fs *sfs);
+void sfs_jshutdown(struct sfs_fs *sfs);
+void sfs_jbegin(struct sfs_fs *sfs);
+void sfs_jend(struct sfs_fs *sfs);
+void sfs_jdirty(struct sfs_fs *sfs, daddr_t block, struct buf *b);
+void sfs_jfreemap(struct sfs_fs *sfs, daddr_t block);
+void sfs_jfree(struct sfs_fs *sfs, daddr_t block);
+int sfs_jcommit(struct sfs_fs *sfs);
+int sfs_jsync(struct sfs_fs *sfs);
 
 #endif /* _SFSPRIVATE_H_ */
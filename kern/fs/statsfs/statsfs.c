@@ -0,0 +1,494 @@
+/*
+ * statsfs: the system's event counters (see stats.h) as text files.
+ *
+ * It's attached as "stats:" at boot, like semfs. The root directory
+ * has one file for each group of counters, vm, sched and so on, and
+ * reading one prints its counters then and there, a "name value" line
+ * each; so cat stats:vm works, and monitoring doesn't need a syscall
+ * per number. Nothing can be written, created or removed.
+ *
+ * The vnodes are all made at boot and never go away: the fs keeps a
+ * reference to each. Reads format the whole file into a buffer and
+ * copy out the part at the uio's offset; a read that spans two calls
+ * may get halves of two different samples, which for counters that
+ * only go up is harmless.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <lib.h>
+#include <stat.h>
+#include <uio.h>
+#include <vfs.h>
+#include <fs.h>
+#include <vnode.h>
+#include <stats.h>
+
+#define STATSFS_ROOTDIR	0xffffffffU	/* sv_group of the root dir */
+#define STATSFS_BUFSIZE	512		/* first guess at a file's size */
+
+struct statsfs_vnode {
+	struct vnode sv_absvn;
+	unsigned sv_group;		/* which file, or STATSFS_ROOTDIR */
+};
+
+struct statsfs {
+	struct fs sf_absfs;
+	struct statsfs_vnode sf_root;
+	struct statsfs_vnode *sf_files;	/* one per group */
+	unsigned sf_nfiles;
+};
+
+/* There's only the one. */
+static struct statsfs *statsfs;
+
+////////////////////////////////////////////////////////////
+// basic ops
+
+static
+int
+statsfs_eachopen(struct vnode *vn, int openflags)
+{
+	struct statsfs_vnode *sv = vn->vn_data;
+
+	if ((openflags & O_ACCMODE) != O_RDONLY ||
+	    (openflags & (O_TRUNC | O_APPEND))) {
+		return sv->sv_group == STATSFS_ROOTDIR ? EISDIR : EROFS;
+	}
+	return 0;
+}
+
+/*
+ * The fs's own reference keeps every vnode past its last VOP_DECREF
+ * from anyone else, so this is never the last one, and there's
+ * nothing to do.
+ */
+static
+int
+statsfs_reclaim(struct vnode *vn)
+{
+	(void)vn;
+	return EBUSY;
+}
+
+static
+int
+statsfs_ioctl(struct vnode *vn, int op, userptr_t data)
+{
+	(void)vn;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+statsfs_gettype(struct vnode *vn, mode_t *ret)
+{
+	struct statsfs_vnode *sv = vn->vn_data;
+
+	*ret = sv->sv_group == STATSFS_ROOTDIR ? S_IFDIR : S_IFREG;
+	return 0;
+}
+
+static
+bool
+statsfs_isseekable(struct vnode *vn)
+{
+	(void)vn;
+	return true;
+}
+
+static
+int
+statsfs_fsync(struct vnode *vn)
+{
+	(void)vn;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// files
+
+/*
+ * Format group G into a new buffer; *LEN gets the length. If it
+ * doesn't fit, try again with room for what it came to (plus some,
+ * as it may have grown by the time we get back).
+ */
+static
+char *
+statsfs_format(unsigned g, size_t *len)
+{
+	char *buf;
+	size_t size;
+
+	size = STATSFS_BUFSIZE;
+	while (1) {
+		buf = kmalloc_tagged(size, KM_FS);
+		if (buf == NULL) {
+			return NULL;
+		}
+		*len = stats_format(g, buf, size);
+		if (*len < size) {
+			return buf;
+		}
+		kfree(buf);
+		size = *len + STATSFS_BUFSIZE;
+	}
+}
+
+static
+int
+statsfs_read(struct vnode *vn, struct uio *uio)
+{
+	struct statsfs_vnode *sv = vn->vn_data;
+	char *buf;
+	size_t len;
+	int result;
+
+	KASSERT(uio->uio_offset >= 0);
+
+	buf = statsfs_format(sv->sv_group, &len);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	result = 0;
+	if (uio->uio_offset < (off_t)len) {
+		result = uiomove(buf + uio->uio_offset,
+				 len - uio->uio_offset, uio);
+	}
+	kfree(buf);
+	return result;
+}
+
+static
+int
+statsfs_write(struct vnode *vn, struct uio *uio)
+{
+	(void)vn;
+	(void)uio;
+	return EROFS;
+}
+
+static
+int
+statsfs_truncate(struct vnode *vn, off_t len)
+{
+	(void)vn;
+	(void)len;
+	return EROFS;
+}
+
+/*
+ * The size is what a read would get now.
+ */
+static
+int
+statsfs_filestat(struct vnode *vn, struct stat *buf)
+{
+	struct statsfs_vnode *sv = vn->vn_data;
+	char *text;
+	size_t len;
+
+	text = statsfs_format(sv->sv_group, &len);
+	if (text == NULL) {
+		return ENOMEM;
+	}
+	kfree(text);
+
+	bzero(buf, sizeof(*buf));
+	buf->st_size = len;
+	buf->st_mode = S_IFREG | 0444;
+	buf->st_nlink = 1;
+	buf->st_ino = sv->sv_group + 1;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// the directory
+
+static
+int
+statsfs_getdirentry(struct vnode *dirvn, struct uio *uio)
+{
+	const char *name;
+	unsigned pos;
+
+	(void)dirvn;
+
+	KASSERT(uio->uio_offset >= 0);
+	if (uio->uio_offset >= statsfs->sf_nfiles) {
+		/* EOF */
+		return 0;
+	}
+	pos = uio->uio_offset;
+	name = stats_group(pos);
+	uio->uio_offset = pos + 1;
+	return uiomove((char *)name, strlen(name), uio);
+}
+
+static
+int
+statsfs_dirstat(struct vnode *vn, struct stat *buf)
+{
+	(void)vn;
+
+	bzero(buf, sizeof(*buf));
+	buf->st_size = statsfs->sf_nfiles;
+	buf->st_mode = S_IFDIR | 0555;
+	buf->st_nlink = 2;
+	buf->st_ino = 0;
+	return 0;
+}
+
+/*
+ * getcwd. There are no subdirectories, so the root's name is empty.
+ */
+static
+int
+statsfs_namefile(struct vnode *vn, struct uio *uio)
+{
+	(void)vn;
+	(void)uio;
+	return 0;
+}
+
+static
+int
+statsfs_lookup(struct vnode *dirvn, char *path, struct vnode **ret)
+{
+	unsigned i;
+
+	if (!strcmp(path, ".") || !strcmp(path, "..")) {
+		VOP_INCREF(dirvn);
+		*ret = dirvn;
+		return 0;
+	}
+	for (i = 0; i < statsfs->sf_nfiles; i++) {
+		if (!strcmp(path, stats_group(i))) {
+			VOP_INCREF(&statsfs->sf_files[i].sv_absvn);
+			*ret = &statsfs->sf_files[i].sv_absvn;
+			return 0;
+		}
+	}
+	return ENOENT;
+}
+
+static
+int
+statsfs_lookparent(struct vnode *dirvn, char *path,
+		   struct vnode **retdir, char *namebuf, size_t bufmax)
+{
+	if (strlen(path) + 1 > bufmax) {
+		return ENAMETOOLONG;
+	}
+	strcpy(namebuf, path);
+
+	VOP_INCREF(dirvn);
+	*retdir = dirvn;
+	return 0;
+}
+
+/*
+ * open(O_CREAT) of a file that's there gets it (unless O_EXCL);
+ * nothing new can be made.
+ */
+static
+int
+statsfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
+	      struct vnode **ret)
+{
+	char buf[NAME_MAX + 1];
+	int result;
+
+	(void)mode;
+	if (strlen(name) > NAME_MAX) {
+		return ENAMETOOLONG;
+	}
+	strcpy(buf, name);
+	result = statsfs_lookup(dirvn, buf, ret);
+	if (result == ENOENT) {
+		return EROFS;
+	}
+	if (result == 0 && excl) {
+		VOP_DECREF(*ret);
+		return EEXIST;
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// ops tables
+
+static const struct vnode_ops statsfs_dirops = {
+	.vop_magic = VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	.vop_eachopen = statsfs_eachopen,
+	.vop_reclaim = statsfs_reclaim,
+
+	.vop_read = vopfail_uio_isdir,
+	.vop_readlink = vopfail_uio_isdir,
+	.vop_getdirentry = statsfs_getdirentry,
+	.vop_getdirentries = vnode_getdirentries_slow,
+	.vop_write = vopfail_uio_isdir,
+	.vop_ioctl = statsfs_ioctl,
+	.vop_stat = statsfs_dirstat,
+	.vop_gettype = statsfs_gettype,
+	.vop_isseekable = statsfs_isseekable,
+	.vop_fsync = statsfs_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = vnode_poll_always,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_isdir,
+	.vop_mmap = vopfail_mmap_isdir,
+	.vop_truncate = vopfail_truncate_isdir,
+	.vop_namefile = statsfs_namefile,
+
+	.vop_creat = statsfs_creat,
+	.vop_symlink = vopfail_symlink_nosys,
+	.vop_mkdir = vopfail_mkdir_nosys,
+	.vop_link = vopfail_link_nosys,
+	.vop_remove = vopfail_string_nosys,
+	.vop_rmdir = vopfail_string_nosys,
+	.vop_rename = vopfail_rename_nosys,
+	.vop_lookup = statsfs_lookup,
+	.vop_lookparent = statsfs_lookparent,
+};
+
+static const struct vnode_ops statsfs_fileops = {
+	.vop_magic = VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	.vop_eachopen = statsfs_eachopen,
+	.vop_reclaim = statsfs_reclaim,
+
+	.vop_read = statsfs_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_uio_notdir,
+	.vop_write = statsfs_write,
+	.vop_ioctl = statsfs_ioctl,
+	.vop_stat = statsfs_filestat,
+	.vop_gettype = statsfs_gettype,
+	.vop_isseekable = statsfs_isseekable,
+	.vop_fsync = statsfs_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = vnode_poll_always,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_nosys,
+	.vop_mmap = vopfail_mmap_perm,
+	.vop_truncate = statsfs_truncate,
+	.vop_namefile = vopfail_uio_notdir,
+
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+////////////////////////////////////////////////////////////
+// fs-level operations
+
+static
+int
+statsfs_sync(struct fs *fs)
+{
+	(void)fs;
+	return 0;
+}
+
+static
+const char *
+statsfs_getvolname(struct fs *fs)
+{
+	(void)fs;
+	return "stats";
+}
+
+static
+struct vnode *
+statsfs_getroot(struct fs *fs)
+{
+	struct statsfs *sf = fs->fs_data;
+
+	VOP_INCREF(&sf->sf_root.sv_absvn);
+	return &sf->sf_root.sv_absvn;
+}
+
+/*
+ * Attached with vfs_addfs, so there's no detaching it.
+ */
+static
+int
+statsfs_unmount(struct fs *fs)
+{
+	(void)fs;
+	return EBUSY;
+}
+
+static const struct fs_ops statsfs_fsops = {
+	.fsop_sync = statsfs_sync,
+	.fsop_getvolname = statsfs_getvolname,
+	.fsop_getroot = statsfs_getroot,
+	.fsop_unmount = statsfs_unmount,
+};
+
+static
+void
+statsfs_vnode_init(struct statsfs *sf, struct statsfs_vnode *sv,
+		   unsigned group)
+{
+	int result;
+
+	sv->sv_group = group;
+	result = vnode_init(&sv->sv_absvn,
+			    group == STATSFS_ROOTDIR ?
+			    &statsfs_dirops : &statsfs_fileops,
+			    &sf->sf_absfs, sv);
+	/* vnode_init doesn't actually fail */
+	KASSERT(result == 0);
+}
+
+/*
+ * Make the statsfs and attach it as "stats:". Called during boot.
+ */
+void
+statsfs_bootstrap(void)
+{
+	struct statsfs *sf;
+	unsigned i, n;
+	int result;
+
+	for (n = 0; stats_group(n) != NULL; n++) {
+		/* count them */
+	}
+
+	sf = kmalloc_tagged(sizeof(*sf), KM_FS);
+	if (sf == NULL) {
+		panic("Out of memory creating statsfs\n");
+	}
+	sf->sf_files = kmalloc_tagged(n * sizeof(sf->sf_files[0]), KM_FS);
+	if (sf->sf_files == NULL) {
+		panic("Out of memory creating statsfs\n");
+	}
+	sf->sf_nfiles = n;
+	sf->sf_absfs.fs_data = sf;
+	sf->sf_absfs.fs_ops = &statsfs_fsops;
+
+	statsfs_vnode_init(sf, &sf->sf_root, STATSFS_ROOTDIR);
+	for (i = 0; i < n; i++) {
+		statsfs_vnode_init(sf, &sf->sf_files[i], i);
+	}
+	statsfs = sf;
+
+	result = vfs_addfs("stats", &sf->sf_absfs);
+	if (result) {
+		panic("Attaching statsfs: %s\n", strerror(result));
+	}
+}
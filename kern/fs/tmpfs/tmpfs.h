@@ -0,0 +1,85 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+/*
+ * tmpfs: a file system kept entirely in memory, for scratch files.
+ * File data lives in whole pages from the coremap, allocated as it's
+ * written, up to the limit the file system was made with; nothing is
+ * ever written anywhere, and it's all gone at reboot.
+ *
+ * Every object is one tmpfs_node, which is also its vnode. A
+ * directory entry holds a reference to the node it names, so a node
+ * stays as long as it has a name or anyone is using it, and is
+ * destroyed by VOP_RECLAIM when neither is true any more. The root
+ * is held by the file system itself.
+ *
+ * Locking: tf_lock covers the name space - every directory's entries,
+ * tn_nlink and tn_parent. A node's tn_lock covers its size and data
+ * pages, and the fs-wide page count is under tf_countlock. tn_lock
+ * comes before tf_lock; nothing holds tf_lock while dropping a
+ * reference, since that can reclaim and reclaim takes it.
+ */
+
+#include <array.h>
+#include <spinlock.h>
+#include <fs.h>
+#include <vnode.h>
+
+#ifndef TMPFS_INLINE
+#define TMPFS_INLINE INLINE
+#endif
+
+struct tmpfs_node;
+
+/*
+ * Directory entry.
+ */
+struct tmpfs_dirent {
+	char *td_name;
+	struct tmpfs_node *td_node;		/* holds a reference */
+};
+DECLARRAY(tmpfs_dirent, TMPFS_INLINE);
+DEFARRAY(tmpfs_dirent, TMPFS_INLINE);
+
+/*
+ * A file, directory, or symlink.
+ */
+struct tmpfs_node {
+	struct vnode tn_absvn;			/* abstract vnode */
+	struct tmpfs *tn_fs;
+	mode_t tn_type;				/* S_IFREG, S_IFDIR, S_IFLNK */
+	uint32_t tn_ino;
+	unsigned tn_nlink;			/* names it has */
+
+	/* files and symlinks */
+	struct rwlock *tn_lock;
+	off_t tn_size;
+	vaddr_t *tn_pages;			/* 0 for a hole */
+	unsigned tn_npages;			/* entries in tn_pages */
+	char *tn_link;				/* a symlink's contents */
+
+	/* directories */
+	struct tmpfs_direntarray *tn_dents;	/* NULL entries are free */
+	struct tmpfs_node *tn_parent;		/* NULL once removed */
+};
+
+/*
+ * The file system.
+ */
+struct tmpfs {
+	struct fs tf_absfs;			/* abstract fs */
+	char *tf_name;				/* volume name */
+	struct tmpfs_node *tf_root;
+
+	struct lock *tf_lock;			/* the name space */
+	uint32_t tf_nextino;
+
+	struct spinlock tf_countlock;		/* for the following */
+	unsigned tf_npages;			/* pages of data in use */
+	unsigned tf_maxpages;			/* most there can be */
+};
+
+/* in tmpfs_vnops.c */
+int tmpfs_node_create(struct tmpfs *tf, mode_t type, struct tmpfs_node **ret);
+
+#endif /* TMPFS_H */
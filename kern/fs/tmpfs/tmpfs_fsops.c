@@ -0,0 +1,138 @@
+/*
+ * tmpfs file system operations and mounting (see tmpfs.h).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <stat.h>
+#include <lib.h>
+#include <synch.h>
+#include <coremap.h>
+#include <vm.h>
+#include <vfs.h>
+#include <fs.h>
+#include <vnode.h>
+
+#include "tmpfs.h"
+
+/* The share of the free memory at mount that a tmpfs may use (1/N). */
+#define TMPFS_MEMSHARE	4
+
+////////////////////////////////////////////////////////////
+// fs-level operations
+
+/*
+ * Nothing is ever anywhere but in memory.
+ */
+static
+int
+tmpfs_sync(struct fs *fs)
+{
+	(void)fs;
+	return 0;
+}
+
+static
+const char *
+tmpfs_getvolname(struct fs *fs)
+{
+	struct tmpfs *tf = fs->fs_data;
+
+	return tf->tf_name;
+}
+
+static
+struct vnode *
+tmpfs_getroot(struct fs *fs)
+{
+	struct tmpfs *tf = fs->fs_data;
+
+	VOP_INCREF(&tf->tf_root->tn_absvn);
+	return &tf->tf_root->tn_absvn;
+}
+
+/*
+ * A tmpfs is attached with vfs_addfs, like emufs, and there's no way
+ * to detach one of those; and its files would be lost if there were.
+ */
+static
+int
+tmpfs_unmount(struct fs *fs)
+{
+	(void)fs;
+	return EBUSY;
+}
+
+static const struct fs_ops tmpfs_fsops = {
+	.fsop_sync = tmpfs_sync,
+	.fsop_getvolname = tmpfs_getvolname,
+	.fsop_getroot = tmpfs_getroot,
+	.fsop_unmount = tmpfs_unmount,
+};
+
+////////////////////////////////////////////////////////////
+// mounting
+
+static
+void
+tmpfs_destroy(struct tmpfs *tf)
+{
+	spinlock_cleanup(&tf->tf_countlock);
+	if (tf->tf_lock != NULL) {
+		lock_destroy(tf->tf_lock);
+	}
+	kfree(tf->tf_name);
+	kfree(tf);
+}
+
+/*
+ * Make an empty tmpfs and attach it as NAME:. Its data may use up to
+ * 1/TMPFS_MEMSHARE of the memory free now.
+ */
+int
+tmpfs_mount(const char *name)
+{
+	struct tmpfs *tf;
+	struct tmpfs_node *root;
+	int result;
+
+	tf = kmalloc_tagged(sizeof(*tf), KM_FS);
+	if (tf == NULL) {
+		return ENOMEM;
+	}
+	tf->tf_absfs.fs_data = tf;
+	tf->tf_absfs.fs_ops = &tmpfs_fsops;
+	tf->tf_root = NULL;
+	tf->tf_nextino = 1;
+	spinlock_init(&tf->tf_countlock);
+	tf->tf_npages = 0;
+	tf->tf_maxpages = coremap_freecount() / TMPFS_MEMSHARE;
+	tf->tf_lock = lock_create("tmpfs");
+	tf->tf_name = kstrdup(name);
+	if (tf->tf_lock == NULL || tf->tf_name == NULL) {
+		tmpfs_destroy(tf);
+		return ENOMEM;
+	}
+
+	result = tmpfs_node_create(tf, S_IFDIR, &root);
+	if (result) {
+		tmpfs_destroy(tf);
+		return result;
+	}
+	tf->tf_root = root;
+
+	result = vfs_addfs(name, &tf->tf_absfs);
+	if (result) {
+		/* nobody else has seen it; take the root apart by hand */
+		tmpfs_direntarray_destroy(root->tn_dents);
+		rwlock_destroy(root->tn_lock);
+		vnode_cleanup(&root->tn_absvn);
+		kfree(root);
+		tmpfs_destroy(tf);
+		return result;
+	}
+
+	kprintf("tmpfs: %s: up to %u KB\n", name,
+		tf->tf_maxpages * (PAGE_SIZE / 1024));
+	return 0;
+}
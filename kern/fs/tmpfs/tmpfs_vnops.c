@@ -0,0 +1,1279 @@
+/*
+ * tmpfs vnode operations (see tmpfs.h).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vm.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#define TMPFS_INLINE
+#include "tmpfs.h"
+
+static const struct vnode_ops tmpfs_fileops;
+static const struct vnode_ops tmpfs_dirops;
+static const struct vnode_ops tmpfs_linkops;
+
+////////////////////////////////////////////////////////////
+// Pages
+
+/*
+ * Count one more page against the file system's limit, if there's
+ * room.
+ */
+static
+bool
+tmpfs_takepage(struct tmpfs *tf)
+{
+	bool ok;
+
+	spinlock_acquire(&tf->tf_countlock);
+	ok = tf->tf_npages < tf->tf_maxpages;
+	if (ok) {
+		tf->tf_npages++;
+	}
+	spinlock_release(&tf->tf_countlock);
+	return ok;
+}
+
+static
+void
+tmpfs_givepages(struct tmpfs *tf, unsigned n)
+{
+	spinlock_acquire(&tf->tf_countlock);
+	KASSERT(tf->tf_npages >= n);
+	tf->tf_npages -= n;
+	spinlock_release(&tf->tf_countlock);
+}
+
+/*
+ * Get page PAGENO of a file, allocating it (zeroed) if it's a hole.
+ * Call with the node's lock held for writing.
+ */
+static
+int
+tmpfs_getpage(struct tmpfs_node *tn, unsigned pageno, vaddr_t *ret)
+{
+	struct tmpfs *tf = tn->tn_fs;
+	vaddr_t *newpages, page;
+	unsigned newnum;
+
+	if (pageno >= tf->tf_maxpages) {
+		/* the file couldn't ever be that big */
+		return ENOSPC;
+	}
+
+	if (pageno >= tn->tn_npages) {
+		newnum = tn->tn_npages < 8 ? 8 : tn->tn_npages * 2;
+		if (newnum <= pageno) {
+			newnum = pageno + 1;
+		}
+		newpages = kmalloc_tagged(newnum * sizeof(vaddr_t), KM_FS);
+		if (newpages == NULL) {
+			return ENOMEM;
+		}
+		if (tn->tn_npages > 0) {
+			memcpy(newpages, tn->tn_pages,
+			       tn->tn_npages * sizeof(vaddr_t));
+		}
+		bzero(newpages + tn->tn_npages,
+		      (newnum - tn->tn_npages) * sizeof(vaddr_t));
+		kfree(tn->tn_pages);
+		tn->tn_pages = newpages;
+		tn->tn_npages = newnum;
+	}
+
+	if (tn->tn_pages[pageno] == 0) {
+		if (!tmpfs_takepage(tf)) {
+			return ENOSPC;
+		}
+		page = alloc_kpages(1);
+		if (page == 0) {
+			tmpfs_givepages(tf, 1);
+			return ENOMEM;
+		}
+		pagezero((void *)page);
+		tn->tn_pages[pageno] = page;
+	}
+
+	*ret = tn->tn_pages[pageno];
+	return 0;
+}
+
+/*
+ * Throw away the data past LEN bytes into the file: the pages wholly
+ * past it are freed, and the rest of the page it ends in is zeroed,
+ * so that if the file grows again it reads back as zeros. Call with
+ * the node's lock held for writing (or no other references).
+ */
+static
+void
+tmpfs_discard(struct tmpfs_node *tn, off_t len)
+{
+	unsigned i, first, freed = 0;
+
+	first = DIVROUNDUP(len, PAGE_SIZE);
+	for (i = first; i < tn->tn_npages; i++) {
+		if (tn->tn_pages[i] != 0) {
+			free_kpages(tn->tn_pages[i]);
+			tn->tn_pages[i] = 0;
+			freed++;
+		}
+	}
+	if (freed > 0) {
+		tmpfs_givepages(tn->tn_fs, freed);
+	}
+
+	if (len % PAGE_SIZE != 0 && first - 1 < tn->tn_npages &&
+	    tn->tn_pages[first - 1] != 0) {
+		bzero((char *)tn->tn_pages[first - 1] + len % PAGE_SIZE,
+		      PAGE_SIZE - len % PAGE_SIZE);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Nodes
+
+/*
+ * Make a node of type TYPE, with no names yet. Hands back the one
+ * reference to it. Call with tf_lock held (for tf_nextino), except
+ * at mount.
+ */
+int
+tmpfs_node_create(struct tmpfs *tf, mode_t type, struct tmpfs_node **ret)
+{
+	const struct vnode_ops *ops;
+	struct tmpfs_node *tn;
+	int result;
+
+	switch (type) {
+	    case S_IFREG: ops = &tmpfs_fileops; break;
+	    case S_IFDIR: ops = &tmpfs_dirops; break;
+	    case S_IFLNK: ops = &tmpfs_linkops; break;
+	    default: panic("tmpfs: bad node type %u\n", (unsigned)type);
+	}
+
+	tn = kmalloc_tagged(sizeof(*tn), KM_FS);
+	if (tn == NULL) {
+		return ENOMEM;
+	}
+	tn->tn_fs = tf;
+	tn->tn_type = type;
+	tn->tn_ino = tf->tf_nextino++;
+	tn->tn_nlink = 0;
+	tn->tn_size = 0;
+	tn->tn_pages = NULL;
+	tn->tn_npages = 0;
+	tn->tn_link = NULL;
+	tn->tn_dents = NULL;
+	tn->tn_parent = NULL;
+
+	tn->tn_lock = rwlock_create("tmpfs_node");
+	if (tn->tn_lock == NULL) {
+		kfree(tn);
+		return ENOMEM;
+	}
+	if (type == S_IFDIR) {
+		tn->tn_dents = tmpfs_direntarray_create();
+		if (tn->tn_dents == NULL) {
+			rwlock_destroy(tn->tn_lock);
+			kfree(tn);
+			return ENOMEM;
+		}
+	}
+
+	result = vnode_init(&tn->tn_absvn, ops, &tf->tf_absfs, tn);
+	/* vnode_init doesn't actually fail */
+	KASSERT(result == 0);
+
+	*ret = tn;
+	return 0;
+}
+
+/*
+ * Destroy a node nobody can get at any more.
+ */
+static
+void
+tmpfs_node_destroy(struct tmpfs_node *tn)
+{
+	KASSERT(tn->tn_nlink == 0);
+
+	tmpfs_discard(tn, 0);
+	kfree(tn->tn_pages);
+	kfree(tn->tn_link);
+	if (tn->tn_dents != NULL) {
+		KASSERT(tmpfs_direntarray_num(tn->tn_dents) == 0);
+		tmpfs_direntarray_destroy(tn->tn_dents);
+	}
+	rwlock_destroy(tn->tn_lock);
+	vnode_cleanup(&tn->tn_absvn);
+	kfree(tn);
+}
+
+////////////////////////////////////////////////////////////
+// Directories (all with tf_lock held)
+
+/* Whether a directory has been removed (the root never is). */
+static
+bool
+tmpfs_dir_gone(struct tmpfs_node *dir)
+{
+	return dir->tn_nlink == 0 && dir != dir->tn_fs->tf_root;
+}
+
+static
+bool
+tmpfs_dir_empty(struct tmpfs_node *dir)
+{
+	unsigned i, num;
+
+	num = tmpfs_direntarray_num(dir->tn_dents);
+	for (i=0; i<num; i++) {
+		if (tmpfs_direntarray_get(dir->tn_dents, i) != NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Find NAME in DIR; hand back its slot. */
+static
+struct tmpfs_dirent *
+tmpfs_dir_find(struct tmpfs_node *dir, const char *name, unsigned *slot)
+{
+	struct tmpfs_dirent *td;
+	unsigned i, num;
+
+	num = tmpfs_direntarray_num(dir->tn_dents);
+	for (i=0; i<num; i++) {
+		td = tmpfs_direntarray_get(dir->tn_dents, i);
+		if (td != NULL && !strcmp(td->td_name, name)) {
+			if (slot != NULL) {
+				*slot = i;
+			}
+			return td;
+		}
+	}
+	return NULL;
+}
+
+/* Give TN the name NAME in DIR (which must not have it yet). */
+static
+int
+tmpfs_dir_link(struct tmpfs_node *dir, const char *name,
+	       struct tmpfs_node *tn)
+{
+	struct tmpfs_dirent *td;
+	unsigned i, num;
+	int result;
+
+	td = kmalloc_tagged(sizeof(*td), KM_FS);
+	if (td == NULL) {
+		return ENOMEM;
+	}
+	td->td_name = kstrdup(name);
+	if (td->td_name == NULL) {
+		kfree(td);
+		return ENOMEM;
+	}
+	td->td_node = tn;
+
+	num = tmpfs_direntarray_num(dir->tn_dents);
+	for (i=0; i<num; i++) {
+		if (tmpfs_direntarray_get(dir->tn_dents, i) == NULL) {
+			break;
+		}
+	}
+	if (i < num) {
+		tmpfs_direntarray_set(dir->tn_dents, i, td);
+	}
+	else {
+		result = tmpfs_direntarray_add(dir->tn_dents, td, NULL);
+		if (result) {
+			kfree(td->td_name);
+			kfree(td);
+			return result;
+		}
+	}
+
+	VOP_INCREF(&tn->tn_absvn);
+	tn->tn_nlink++;
+	return 0;
+}
+
+/*
+ * Take away the name in SLOT of DIR. Hands back the node it named,
+ * with the reference the name had, for the caller to drop once it
+ * has let go of tf_lock.
+ */
+static
+struct tmpfs_node *
+tmpfs_dir_unlink(struct tmpfs_node *dir, unsigned slot)
+{
+	struct tmpfs_dirent *td;
+	struct tmpfs_node *tn;
+	unsigned num;
+
+	td = tmpfs_direntarray_get(dir->tn_dents, slot);
+	KASSERT(td != NULL);
+	tn = td->td_node;
+	KASSERT(tn->tn_nlink > 0);
+	tn->tn_nlink--;
+
+	num = tmpfs_direntarray_num(dir->tn_dents);
+	if (slot == num - 1) {
+		/* keep the array from growing without end */
+		tmpfs_direntarray_setsize(dir->tn_dents, slot);
+	}
+	else {
+		tmpfs_direntarray_set(dir->tn_dents, slot, NULL);
+	}
+	kfree(td->td_name);
+	kfree(td);
+	return tn;
+}
+
+/*
+ * Check a name to be created or removed.
+ */
+static
+int
+tmpfs_checkname(const char *name)
+{
+	if (name[0] == 0 || strchr(name, '/') != NULL ||
+	    !strcmp(name, ".") || !strcmp(name, "..")) {
+		return EINVAL;
+	}
+	if (strlen(name) > NAME_MAX) {
+		return ENAMETOOLONG;
+	}
+	return 0;
+}
+
+/*
+ * Follow PATH from DIR. Symlinks aren't followed, as elsewhere in
+ * the VFS.
+ */
+static
+int
+tmpfs_walk(struct tmpfs_node *dir, char *path, struct tmpfs_node **ret)
+{
+	struct tmpfs_dirent *td;
+	char *name, *next;
+
+	while (path != NULL) {
+		next = strchr(path, '/');
+		if (next != NULL) {
+			*next++ = 0;
+		}
+		name = path;
+		path = next;
+
+		if (dir->tn_type != S_IFDIR) {
+			return ENOTDIR;
+		}
+		if (name[0] == 0 || !strcmp(name, ".")) {
+			continue;
+		}
+		if (!strcmp(name, "..")) {
+			if (dir == dir->tn_fs->tf_root) {
+				continue;
+			}
+			if (dir->tn_parent == NULL) {
+				return ENOENT;
+			}
+			dir = dir->tn_parent;
+			continue;
+		}
+		td = tmpfs_dir_find(dir, name, NULL);
+		if (td == NULL) {
+			return ENOENT;
+		}
+		dir = td->td_node;
+	}
+	*ret = dir;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Basic operations
+
+static
+int
+tmpfs_eachopen(struct vnode *v, int openflags)
+{
+	struct tmpfs_node *tn = v->vn_data;
+
+	if (tn->tn_type == S_IFDIR) {
+		if ((openflags & O_ACCMODE) != O_RDONLY ||
+		    (openflags & O_APPEND)) {
+			return EISDIR;
+		}
+	}
+	return 0;
+}
+
+static
+int
+tmpfs_reclaim(struct vnode *v)
+{
+	struct tmpfs_node *tn = v->vn_data;
+	struct tmpfs *tf = tn->tn_fs;
+
+	lock_acquire(tf->tf_lock);
+	if (vnode_decref_unless_last(v)) {
+		/* that consumed the reference VOP_DECREF passed us */
+		lock_release(tf->tf_lock);
+		return EBUSY;
+	}
+	/* names hold references, so it has none */
+	KASSERT(tn->tn_nlink == 0);
+	KASSERT(tn != tf->tf_root);
+	lock_release(tf->tf_lock);
+
+	tmpfs_node_destroy(tn);
+	return 0;
+}
+
+static
+int
+tmpfs_read(struct vnode *v, struct uio *uio)
+{
+	struct tmpfs_node *tn = v->vn_data;
+	unsigned pageno;
+	size_t skip, len;
+	vaddr_t page;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	rwlock_acquire_read(tn->tn_lock);
+	while (uio->uio_resid > 0 && uio->uio_offset < tn->tn_size) {
+		pageno = uio->uio_offset / PAGE_SIZE;
+		skip = uio->uio_offset % PAGE_SIZE;
+		len = PAGE_SIZE - skip;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		if (len > tn->tn_size - uio->uio_offset) {
+			len = tn->tn_size - uio->uio_offset;
+		}
+
+		page = pageno < tn->tn_npages ? tn->tn_pages[pageno] : 0;
+		if (page == 0) {
+			result = uiomovezeros(len, uio);
+		}
+		else {
+			result = uiomove((char *)page + skip, len, uio);
+		}
+		if (result) {
+			break;
+		}
+	}
+	rwlock_release_read(tn->tn_lock);
+	return result;
+}
+
+static
+int
+tmpfs_write(struct vnode *v, struct uio *uio)
+{
+	struct tmpfs_node *tn = v->vn_data;
+	size_t skip, len, resid;
+	vaddr_t page;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	rwlock_acquire_write(tn->tn_lock);
+	resid = uio->uio_resid;
+	while (uio->uio_resid > 0) {
+		result = tmpfs_getpage(tn, uio->uio_offset / PAGE_SIZE, &page);
+		if (result) {
+			break;
+		}
+		skip = uio->uio_offset % PAGE_SIZE;
+		len = PAGE_SIZE - skip;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove((char *)page + skip, len, uio);
+		if (uio->uio_offset > tn->tn_size) {
+			tn->tn_size = uio->uio_offset;
+		}
+		if (result) {
+			break;
+		}
+	}
+	rwlock_release_write(tn->tn_lock);
+
+	/* if some of it got written, report that */
+	if (result == ENOSPC && uio->uio_resid < resid) {
+		result = 0;
+	}
+	return result;
+}
+
+static
+int
+tmpfs_readlink(struct vnode *v, struct uio *uio)
+{
+	struct tmpfs_node *tn = v->vn_data;
+
+	/* (the contents never change) */
+	return uiomove(tn->tn_link, strlen(tn->tn_link), uio);
+}
+
+/*
+ * Directory positions are slot numbers; free slots are skipped.
+ */
+static
+int
+tmpfs_getdirentry(struct vnode *v, struct uio *uio)
+{
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_dirent *td = NULL;
+	unsigned i, num;
+	int result = 0;
+
+	KASSERT(uio->uio_offset >= 0);
+
+	lock_acquire(tf->tf_lock);
+	num = tmpfs_direntarray_num(dir->tn_dents);
+	for (i = uio->uio_offset; i < num; i++) {
+		td = tmpfs_direntarray_get(dir->tn_dents, i);
+		if (td != NULL) {
+			break;
+		}
+	}
+	if (i < num) {
+		result = uiomove(td->td_name, strlen(td->td_name), uio);
+		uio->uio_offset = i + 1;
+	}
+	/* else EOF: send back nothing */
+	lock_release(tf->tf_lock);
+	return result;
+}
+
+/*
+ * The same, as many at a time as fit.
+ */
+static
+int
+tmpfs_getdirentries(struct vnode *v, struct uio *uio)
+{
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_dirent *td;
+	unsigned i, num;
+	int result = 0;
+
+	KASSERT(uio->uio_offset >= 0);
+
+	lock_acquire(tf->tf_lock);
+	num = tmpfs_direntarray_num(dir->tn_dents);
+	for (i = uio->uio_offset; i < num; i++) {
+		td = tmpfs_direntarray_get(dir->tn_dents, i);
+		if (td == NULL) {
+			continue;
+		}
+		result = vnode_putdirent(uio, td->td_node->tn_ino,
+					 td->td_node->tn_type, td->td_name);
+		if (result) {
+			break;
+		}
+	}
+	lock_release(tf->tf_lock);
+
+	if (result == ENOSPC) {
+		/* the rest next time */
+		result = 0;
+	}
+	uio->uio_offset = i;
+	return result;
+}
+
+static
+int
+tmpfs_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+tmpfs_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct tmpfs_node *tn = v->vn_data;
+	struct tmpfs *tf = tn->tn_fs;
+	unsigned i, pages = 0;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = tn->tn_type;
+	statbuf->st_ino = tn->tn_ino;
+	statbuf->st_blksize = PAGE_SIZE;
+
+	lock_acquire(tf->tf_lock);
+	statbuf->st_nlink = tn->tn_nlink;
+	if (tn->tn_type == S_IFDIR) {
+		statbuf->st_size = tmpfs_direntarray_num(tn->tn_dents);
+	}
+	lock_release(tf->tf_lock);
+
+	if (tn->tn_type == S_IFLNK) {
+		statbuf->st_size = strlen(tn->tn_link);
+	}
+	else if (tn->tn_type == S_IFREG) {
+		rwlock_acquire_read(tn->tn_lock);
+		statbuf->st_size = tn->tn_size;
+		for (i=0; i<tn->tn_npages; i++) {
+			if (tn->tn_pages[i] != 0) {
+				pages++;
+			}
+		}
+		rwlock_release_read(tn->tn_lock);
+	}
+	/* in 512-byte units, as usual */
+	statbuf->st_blocks = pages * (PAGE_SIZE / 512);
+
+	return 0;
+}
+
+static
+int
+tmpfs_gettype(struct vnode *v, mode_t *ret)
+{
+	struct tmpfs_node *tn = v->vn_data;
+
+	*ret = tn->tn_type;
+	return 0;
+}
+
+static
+bool
+tmpfs_isseekable(struct vnode *v)
+{
+	(void)v;
+	return true;
+}
+
+/*
+ * There's nowhere more stable to put anything.
+ */
+static
+int
+tmpfs_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+/*
+ * Files can be mapped; pages go through tmpfs_read and tmpfs_write.
+ */
+static
+int
+tmpfs_mmap(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+tmpfs_truncate(struct vnode *v, off_t len)
+{
+	struct tmpfs_node *tn = v->vn_data;
+
+	if (len < 0) {
+		return EINVAL;
+	}
+
+	rwlock_acquire_write(tn->tn_lock);
+	if (len < tn->tn_size) {
+		tmpfs_discard(tn, len);
+	}
+	tn->tn_size = len;
+	rwlock_release_write(tn->tn_lock);
+	return 0;
+}
+
+/*
+ * The path from the root to a directory, built backwards by
+ * following tn_parent and finding each directory's name in its
+ * parent.
+ */
+static
+int
+tmpfs_namefile(struct vnode *v, struct uio *uio)
+{
+	struct tmpfs_node *tn = v->vn_data;
+	struct tmpfs *tf = tn->tn_fs;
+	struct tmpfs_dirent *td;
+	struct tmpfs_node *parent;
+	char *buf;
+	size_t pos, len;
+	unsigned i, num;
+	int result;
+
+	buf = kmalloc_tagged(PATH_MAX, KM_FS);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	pos = PATH_MAX;
+
+	lock_acquire(tf->tf_lock);
+	while (tn != tf->tf_root) {
+		parent = tn->tn_parent;
+		if (parent == NULL) {
+			lock_release(tf->tf_lock);
+			kfree(buf);
+			return ENOENT;
+		}
+		td = NULL;
+		num = tmpfs_direntarray_num(parent->tn_dents);
+		for (i=0; i<num; i++) {
+			td = tmpfs_direntarray_get(parent->tn_dents, i);
+			if (td != NULL && td->td_node == tn) {
+				break;
+			}
+		}
+		KASSERT(i < num);
+
+		len = strlen(td->td_name);
+		if (len + 1 > pos) {
+			lock_release(tf->tf_lock);
+			kfree(buf);
+			return ENAMETOOLONG;
+		}
+		if (pos < PATH_MAX) {
+			buf[--pos] = '/';
+		}
+		pos -= len;
+		memcpy(buf + pos, td->td_name, len);
+		tn = parent;
+	}
+	lock_release(tf->tf_lock);
+
+	result = uiomove(buf + pos, PATH_MAX - pos, uio);
+	kfree(buf);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Name space operations
+
+static
+int
+tmpfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	    struct vnode **ret)
+{
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_dirent *td;
+	struct tmpfs_node *tn;
+	int result;
+
+	/* no permissions */
+	(void)mode;
+
+	result = tmpfs_checkname(name);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(tf->tf_lock);
+	if (tmpfs_dir_gone(dir)) {
+		lock_release(tf->tf_lock);
+		return ENOENT;
+	}
+	td = tmpfs_dir_find(dir, name, NULL);
+	if (td != NULL) {
+		if (excl) {
+			lock_release(tf->tf_lock);
+			return EEXIST;
+		}
+		VOP_INCREF(&td->td_node->tn_absvn);
+		*ret = &td->td_node->tn_absvn;
+		lock_release(tf->tf_lock);
+		return 0;
+	}
+
+	result = tmpfs_node_create(tf, S_IFREG, &tn);
+	if (result) {
+		lock_release(tf->tf_lock);
+		return result;
+	}
+	result = tmpfs_dir_link(dir, name, tn);
+	lock_release(tf->tf_lock);
+	if (result) {
+		/* no names and no other references */
+		VOP_DECREF(&tn->tn_absvn);
+		return result;
+	}
+
+	*ret = &tn->tn_absvn;
+	return 0;
+}
+
+/*
+ * Common code for making a directory or a symlink: create a node of
+ * type TYPE and name it NAME in DIR.
+ */
+static
+int
+tmpfs_makename(struct tmpfs_node *dir, const char *name, mode_t type,
+	       const char *contents)
+{
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_node *tn;
+	char *link = NULL;
+	int result;
+
+	result = tmpfs_checkname(name);
+	if (result) {
+		return result;
+	}
+	if (contents != NULL) {
+		link = kstrdup(contents);
+		if (link == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	lock_acquire(tf->tf_lock);
+	if (tmpfs_dir_gone(dir)) {
+		result = ENOENT;
+		goto fail;
+	}
+	if (tmpfs_dir_find(dir, name, NULL) != NULL) {
+		result = EEXIST;
+		goto fail;
+	}
+	result = tmpfs_node_create(tf, type, &tn);
+	if (result) {
+		goto fail;
+	}
+	tn->tn_link = link;
+	if (type == S_IFDIR) {
+		tn->tn_parent = dir;
+	}
+	result = tmpfs_dir_link(dir, name, tn);
+	lock_release(tf->tf_lock);
+
+	/* drop the creation reference; the name has its own if it worked */
+	VOP_DECREF(&tn->tn_absvn);
+	return result;
+
+ fail:
+	lock_release(tf->tf_lock);
+	kfree(link);
+	return result;
+}
+
+static
+int
+tmpfs_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	return tmpfs_makename(v->vn_data, name, S_IFLNK, contents);
+}
+
+static
+int
+tmpfs_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)mode;
+	return tmpfs_makename(v->vn_data, name, S_IFDIR, NULL);
+}
+
+static
+int
+tmpfs_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs_node *tn = file->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	int result;
+
+	if (tn->tn_type == S_IFDIR) {
+		return EISDIR;
+	}
+	result = tmpfs_checkname(name);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(tf->tf_lock);
+	if (tmpfs_dir_gone(dir)) {
+		result = ENOENT;
+	}
+	else if (tmpfs_dir_find(dir, name, NULL) != NULL) {
+		result = EEXIST;
+	}
+	else {
+		result = tmpfs_dir_link(dir, name, tn);
+	}
+	lock_release(tf->tf_lock);
+	return result;
+}
+
+static
+int
+tmpfs_remove(struct vnode *v, const char *name)
+{
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_dirent *td;
+	struct tmpfs_node *victim;
+	unsigned slot;
+	int result;
+
+	result = tmpfs_checkname(name);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(tf->tf_lock);
+	td = tmpfs_dir_find(dir, name, &slot);
+	if (td == NULL) {
+		lock_release(tf->tf_lock);
+		return ENOENT;
+	}
+	if (td->td_node->tn_type == S_IFDIR) {
+		lock_release(tf->tf_lock);
+		return EISDIR;
+	}
+	victim = tmpfs_dir_unlink(dir, slot);
+	lock_release(tf->tf_lock);
+
+	VOP_DECREF(&victim->tn_absvn);
+	return 0;
+}
+
+static
+int
+tmpfs_rmdir(struct vnode *v, const char *name)
+{
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_dirent *td;
+	struct tmpfs_node *victim;
+	unsigned slot;
+	int result;
+
+	if (!strcmp(name, "..")) {
+		return ENOTEMPTY;
+	}
+	result = tmpfs_checkname(name);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(tf->tf_lock);
+	td = tmpfs_dir_find(dir, name, &slot);
+	if (td == NULL) {
+		result = ENOENT;
+	}
+	else if (td->td_node->tn_type != S_IFDIR) {
+		result = ENOTDIR;
+	}
+	else if (!tmpfs_dir_empty(td->td_node)) {
+		result = ENOTEMPTY;
+	}
+	if (result) {
+		lock_release(tf->tf_lock);
+		return result;
+	}
+	victim = tmpfs_dir_unlink(dir, slot);
+	victim->tn_parent = NULL;
+	/* drop the trailing free slots too, so reclaim finds it empty */
+	tmpfs_direntarray_setsize(victim->tn_dents, 0);
+	lock_release(tf->tf_lock);
+
+	VOP_DECREF(&victim->tn_absvn);
+	return 0;
+}
+
+static
+int
+tmpfs_rename(struct vnode *v1, const char *n1, struct vnode *v2,
+	     const char *n2)
+{
+	struct tmpfs_node *dir1 = v1->vn_data;
+	struct tmpfs_node *dir2 = v2->vn_data;
+	struct tmpfs *tf = dir1->tn_fs;
+	struct tmpfs_dirent *td1, *td2;
+	struct tmpfs_node *tn, *p, *old = NULL;
+	unsigned slot1, slot2;
+	int result;
+
+	result = tmpfs_checkname(n1);
+	if (result == 0) {
+		result = tmpfs_checkname(n2);
+	}
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(tf->tf_lock);
+	td1 = tmpfs_dir_find(dir1, n1, &slot1);
+	if (td1 == NULL || tmpfs_dir_gone(dir2)) {
+		result = ENOENT;
+		goto out;
+	}
+	tn = td1->td_node;
+
+	if (tn->tn_type == S_IFDIR) {
+		/* it can't go inside itself */
+		for (p = dir2; p != NULL && p != tf->tf_root; p = p->tn_parent) {
+			if (p == tn) {
+				result = EINVAL;
+				goto out;
+			}
+		}
+	}
+
+	td2 = tmpfs_dir_find(dir2, n2, &slot2);
+	if (td2 != NULL) {
+		old = td2->td_node;
+		if (old == tn) {
+			/* two names for the same thing: nothing to do */
+			old = NULL;
+			goto out;
+		}
+		if (tn->tn_type == S_IFDIR && old->tn_type != S_IFDIR) {
+			result = ENOTDIR;
+		}
+		else if (tn->tn_type != S_IFDIR && old->tn_type == S_IFDIR) {
+			result = EISDIR;
+		}
+		else if (old->tn_type == S_IFDIR && !tmpfs_dir_empty(old)) {
+			result = ENOTEMPTY;
+		}
+		if (result) {
+			old = NULL;
+			goto out;
+		}
+
+		/* point the existing name at the new thing */
+		VOP_INCREF(&tn->tn_absvn);
+		tn->tn_nlink++;
+		td2->td_node = tn;
+		KASSERT(old->tn_nlink > 0);
+		old->tn_nlink--;
+		if (old->tn_type == S_IFDIR) {
+			old->tn_parent = NULL;
+			tmpfs_direntarray_setsize(old->tn_dents, 0);
+		}
+	}
+	else {
+		result = tmpfs_dir_link(dir2, n2, tn);
+		if (result) {
+			goto out;
+		}
+	}
+
+	/* linking didn't disturb dir1's slots, so slot1 is still right */
+	KASSERT(tmpfs_direntarray_get(dir1->tn_dents, slot1)->td_node == tn);
+	p = tmpfs_dir_unlink(dir1, slot1);
+	KASSERT(p == tn);
+	if (tn->tn_type == S_IFDIR) {
+		tn->tn_parent = dir2;
+	}
+	lock_release(tf->tf_lock);
+
+	/* the old name's reference */
+	VOP_DECREF(&tn->tn_absvn);
+	if (old != NULL) {
+		VOP_DECREF(&old->tn_absvn);
+	}
+	return 0;
+
+ out:
+	lock_release(tf->tf_lock);
+	return result;
+}
+
+static
+int
+tmpfs_lookup(struct vnode *v, char *path, struct vnode **ret)
+{
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	struct tmpfs_node *tn;
+	int result;
+
+	lock_acquire(tf->tf_lock);
+	result = tmpfs_walk(dir, path, &tn);
+	if (result == 0) {
+		VOP_INCREF(&tn->tn_absvn);
+		*ret = &tn->tn_absvn;
+	}
+	lock_release(tf->tf_lock);
+	return result;
+}
+
+static
+int
+tmpfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
+		 char *buf, size_t buflen)
+{
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs *tf = dir->tn_fs;
+	char *name;
+	int result;
+
+	name = strrchr(path, '/');
+	if (name != NULL) {
+		*name++ = 0;
+	}
+	else {
+		name = path;
+		path = NULL;
+	}
+	if (strlen(name) + 1 > buflen) {
+		return ENAMETOOLONG;
+	}
+
+	lock_acquire(tf->tf_lock);
+	if (path != NULL) {
+		result = tmpfs_walk(dir, path, &dir);
+		if (result) {
+			lock_release(tf->tf_lock);
+			return result;
+		}
+	}
+	if (dir->tn_type != S_IFDIR) {
+		lock_release(tf->tf_lock);
+		return ENOTDIR;
+	}
+	VOP_INCREF(&dir->tn_absvn);
+	lock_release(tf->tf_lock);
+
+	strcpy(buf, name);
+	*ret = &dir->tn_absvn;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Ops tables
+
+static const struct vnode_ops tmpfs_fileops = {
+	.vop_magic = VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	.vop_eachopen = tmpfs_eachopen,
+	.vop_reclaim = tmpfs_reclaim,
+
+	.vop_read = tmpfs_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_uio_notdir,
+	.vop_write = tmpfs_write,
+	.vop_ioctl = tmpfs_ioctl,
+	.vop_stat = tmpfs_stat,
+	.vop_gettype = tmpfs_gettype,
+	.vop_isseekable = tmpfs_isseekable,
+	.vop_fsync = tmpfs_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = vnode_poll_always,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_nosys,
+	.vop_mmap = tmpfs_mmap,
+	.vop_truncate = tmpfs_truncate,
+	.vop_namefile = vopfail_uio_notdir,
+
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+static const struct vnode_ops tmpfs_dirops = {
+	.vop_magic = VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	.vop_eachopen = tmpfs_eachopen,
+	.vop_reclaim = tmpfs_reclaim,
+
+	.vop_read = vopfail_uio_isdir,
+	.vop_readlink = vopfail_uio_isdir,
+	.vop_getdirentry = tmpfs_getdirentry,
+	.vop_getdirentries = tmpfs_getdirentries,
+	.vop_write = vopfail_uio_isdir,
+	.vop_ioctl = tmpfs_ioctl,
+	.vop_stat = tmpfs_stat,
+	.vop_gettype = tmpfs_gettype,
+	.vop_isseekable = tmpfs_isseekable,
+	.vop_fsync = tmpfs_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = vnode_poll_always,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_isdir,
+	.vop_mmap = vopfail_mmap_isdir,
+	.vop_truncate = vopfail_truncate_isdir,
+	.vop_namefile = tmpfs_namefile,
+
+	.vop_creat = tmpfs_creat,
+	.vop_symlink = tmpfs_symlink,
+	.vop_mkdir = tmpfs_mkdir,
+	.vop_link = tmpfs_link,
+	.vop_remove = tmpfs_remove,
+	.vop_rmdir = tmpfs_rmdir,
+	.vop_rename = tmpfs_rename,
+
+	.vop_lookup = tmpfs_lookup,
+	.vop_lookparent = tmpfs_lookparent,
+};
+
+static const struct vnode_ops tmpfs_linkops = {
+	.vop_magic = VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	.vop_eachopen = tmpfs_eachopen,
+	.vop_reclaim = tmpfs_reclaim,
+
+	.vop_read = vopfail_uio_inval,
+	.vop_readlink = tmpfs_readlink,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_uio_notdir,
+	.vop_write = vopfail_uio_inval,
+	.vop_ioctl = tmpfs_ioctl,
+	.vop_stat = tmpfs_stat,
+	.vop_gettype = tmpfs_gettype,
+	.vop_isseekable = tmpfs_isseekable,
+	.vop_fsync = tmpfs_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = vnode_poll_always,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_nosys,
+	.vop_mmap = vopfail_mmap_perm,
+	.vop_truncate = vopfail_truncate_isdir,
+	.vop_namefile = vopfail_uio_notdir,
+
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
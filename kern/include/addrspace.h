@@ -39,6 +39,7 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct shmseg;
 
 
 #define MAX_REGIONS 3
@@ -49,11 +50,48 @@ struct vnode;
 #define PT_L1_SIZE 1024
 #define PT_L2_SIZE 1024
 
+/* vaddr bits [31:22] index the L1 table, bits [21:12] the L2 table */
+#define PT_L1_SHIFT   22
+#define PT_L2_SHIFT   12
+#define PT_INDEX_MASK 0x3ff  /* 10 bits set */
+
+/* 
+ * A page table entry is the page's physical frame address, 0 if it was never touched, or, once the pager has
+ * written it out, a swap slot number shifted up by a page with the low bit set (frame addresses are page aligned
+ * so that bit is never set for a present page).
+ */
+#define PTE_SWAPPED         0x1
+#define PTE_IS_SWAPPED(pte) (((pte) & PTE_SWAPPED) != 0)
+#define PTE_SWAPSLOT(pte)   ((unsigned)((pte) >> PT_L2_SHIFT))
+#define PTE_MKSWAP(slot)    ((((paddr_t)(slot)) << PT_L2_SHIFT) | PTE_SWAPPED)
+
+/*
+ * The pager's clock sets PTE_UNREF on a present entry when it clears the frame's referenced bit. The UTLB refill
+ * handler in exception-mips1.S only loads entries with none of the low bits set, so the next access to the page
+ * goes through vm_fault, which sees the reference (pte_get clears the bit again) and waits if the frame is busy.
+ */
+#define PTE_UNREF           0x2
+#define PTE_FLAGS           (PAGE_SIZE - 1)
+
+/*
+ * mmap() regions are placed downward from here, leaving room between it and USERSTACK for the stack. The page at
+ * MMAP_TOP itself is the time page (see kern/time.h), which vm_fault maps without any region.
+ */
+#define MMAP_TOP (USERSTACK - 16 * 1024 * 1024)
+
+/*
+ * The stack starts out as the page below USERSTACK (plus the exec arguments) and vm_fault grows it down a page at
+ * a time as it is touched, up to the process's RLIMIT_STACK (STACK_LIMIT_DEFAULT unless changed) and never further
+ * than STACK_LIMIT_MAX, which keeps it above the time page at MMAP_TOP and the mmap regions below that.
+ */
+#define STACK_LIMIT_MAX     (USERSTACK - MMAP_TOP - PAGE_SIZE)
+#define STACK_LIMIT_DEFAULT (8 * 1024 * 1024)
+
 
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
- * It contains a list of regions describing the layout of the processe's vm and a linear pt.
+ * It contains an array of regions describing the layout of the processe's vm and a linear pt.
  * 
  */
 
@@ -68,8 +106,24 @@ struct region{
         int readable; 
         int writeable; 
 
-        /* pointer to next region */
-        struct region *next; 
+        /* 
+         * File backing for demand paging (vn is NULL for anonymous regions). The bytes [seg_vaddr, seg_vaddr + filesz)
+         * come from vn at file_offset, the rest of the region is zero filled. Pages are read in by vm_fault on first touch.
+         */
+        struct vnode *vn; 
+        vaddr_t seg_vaddr; 
+        off_t file_offset; 
+        size_t filesz; 
+
+        /* set for regions created by mmap() (only those can be munmapped); shared ones write back to vn and skip copy-on-write */
+        bool mmapped; 
+        bool shared; 
+
+        /* shared memory segment the region maps (shm.h), NULL for everything but shmat and anonymous MAP_SHARED */
+        struct shmseg *shm;
+
+        /* a page two ELF segments share (see region_boundary): anonymous, filled in by as_define_file at exec */
+        bool boundary;
 };
         
 struct addrspace {
@@ -83,10 +137,15 @@ struct addrspace {
         paddr_t as_stackpbase;
 #else
         /* Put stuff here for your VM system */
+        /* regions sorted by vbase so vm_fault can binary search them, plus the index of the last one it hit */
         struct region *regions;
+        unsigned nregions;
+        unsigned maxregions;
+        unsigned last_region;
 
-        /* processes 2 lvl page table. pt_l1[i] points to a level 2 table (array of PT_L2_SIZE paddr_t) */
-        paddr_t *pt_l1[PT_L1_SIZE];
+        /* processes 2 lvl page table. pt_l1[i] points to a level 2 table (array of PT_L2_SIZE paddr_t). Both levels */
+        /* are single coremap pages allocated on demand, pt_l1 is NULL until the first page is mapped */
+        paddr_t **pt_l1;
 
         /* heap data structures */
         vaddr_t heap_base; 
@@ -97,6 +156,33 @@ struct addrspace {
         vaddr_t stack_end; 
 
         bool loading; /* this is set true while load_elf is filling pages */
+
+        /* lowest address used by mmap regions (MMAP_TOP when there are none), the heap can't grow past it */
+        vaddr_t mmap_low; 
+
+        /*
+         * Serializes faults and changes to the layout (regions, heap, page table) between the threads of a process.
+         * Nothing may do file system I/O while holding it: a thread inside read() holds the file's lock when it
+         * faults on its buffer. vm_fault lets it go around reading a page from a file, and munmap around writing
+         * shared mappings back.
+         */
+        struct lock *as_lock;
+
+        /* one bit per cpu number that has run this as (and so may hold TLB entries for it), used to aim shootdowns */
+        volatile unsigned as_cpus;
+
+        /* TLB address space ID, only valid while as_asid_gen matches the current ASID generation (see addrspace.c) */
+        uint32_t as_asid;
+        uint32_t as_asid_gen;
+
+        /* next address space waiting for the reaper (see as_destroy_later) */
+        struct addrspace *as_reapnext;
+
+        /* the page after the last one vm_fault copied on write, to spot sequential dirtying passes (see vm.c) */
+        vaddr_t as_cownext;
+
+        /* fault counters and resident set size, see vm.h */
+        struct vmstats as_stats;
 #endif
 
 };
@@ -122,9 +208,18 @@ struct addrspace {
  *                avoid potentially "seeing" it while it's being
  *                destroyed.
  *
+ *    as_tlbshootdown - invalidate a batch of pages of an address space
+ *                in the TLB of every cpu that has run it. Must be
+ *                called with interrupts enabled.
+ *
  *    as_destroy - dispose of an address space. You may need to change
  *                the way this works if implementing user-level threads.
  *
+ *    as_destroy_later - queue an address space for the reaper, a work
+ *                item (workqueue.h) that destroys it in the background.
+ *
+ *    as_bootstrap - set up the reaper, called once during boot.
+ *
  *    as_define_region - set up a region of memory within the address
  *                space.
  *
@@ -135,9 +230,50 @@ struct addrspace {
  *                is complete.
  *
  *    as_define_stack - set up the stack region in the address space.
+ *
+ *    as_define_stack_args - set up the stack region with the NFRAMES
+ *                frames in FRAMES mapped at the very top of it, in
+ *                order, and EXTRA more bytes of room below them. Hands
+ *                back where the first frame went. The frames belong to
+ *                the address space afterwards. Used by exec to hand
+ *                over the argument strings without copying them (not
+ *                in dumbvm).
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_file - make the region containing VADDR demand paged from
+ *                FILESZ bytes of VN at OFFSET, starting at VADDR. Takes
+ *                a reference to VN, dropped by as_destroy. Bytes that
+ *                fall in a page shared with another segment are read
+ *                in right away instead.
+ *
+ *    as_mmap   - create a new region of LEN bytes below MMAP_TOP, backed
+ *                by FILESZ bytes of VN at OFFSET (VN may be NULL for
+ *                anonymous memory). Hands back its address in RET.
+ *
+ *    as_mmap_shm - create a new region mapping all of the shared memory
+ *                segment SEG (shm.h), which takes a reference to it.
+ *
+ *    as_munmap - remove a region created by as_mmap, writing shared
+ *                pages back to the file and freeing its frames. Call
+ *                with as_lock held; it's let go around the writes.
+ *
+ *    as_release - unmap the pages between START and END, freeing their
+ *                frames and swap slots. Used when the heap shrinks and
+ *                for MADV_DONTNEED. Fails (ENOMEM, with nothing unmapped)
+ *                only if a page table shared since fork can't be copied.
+ *
+ *    as_l2table - return the level 2 page table covering VADDR. With
+ *                CREATE, missing tables are allocated and tables still
+ *                shared with a parent or child are copied (NULL then
+ *                means out of memory); use it to change entries. Without,
+ *                the table may be shared and is only to be read, and
+ *                NULL means nothing is mapped.
+ *
+ *    as_find_region - return the region containing VADDR, or NULL if it
+ *                isn't in one (the heap and stack aren't regions).
+ *                Repeated lookups in the same region are O(1).
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -146,7 +282,11 @@ struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret);
 void              as_activate(void);
 void              as_deactivate(void);
+void              as_tlbshootdown(struct addrspace *as,
+                                  const vaddr_t *vaddrs, unsigned num);
 void              as_destroy(struct addrspace *);
+void              as_destroy_later(struct addrspace *);
+void              as_bootstrap(void);
 
 int               as_define_region(struct addrspace *as,
                                    vaddr_t vaddr, size_t sz,
@@ -156,6 +296,22 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_stack_args(struct addrspace *as,
+                                       const paddr_t *frames,
+                                       unsigned nframes, size_t extra,
+                                       vaddr_t *argbase);
+struct region    *as_find_region(struct addrspace *as, vaddr_t vaddr);
+int               as_define_file(struct addrspace *as, vaddr_t vaddr,
+                                 struct vnode *vn, off_t offset,
+                                 size_t filesz);
+int               as_mmap(struct addrspace *as, size_t len, int prot,
+                          bool shared, struct vnode *vn, off_t offset,
+                          size_t filesz, vaddr_t *ret);
+int               as_mmap_shm(struct addrspace *as, struct shmseg *seg,
+                              int prot, vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_release(struct addrspace *as, vaddr_t start, vaddr_t end);
+paddr_t          *as_l2table(struct addrspace *as, vaddr_t vaddr, bool create);
 
 
 /*
@@ -0,0 +1,15 @@
+#ifndef _AIO_H_
+#define _AIO_H_
+
+/*
+ * Asynchronous I/O (see syscall/aio_syscall.c). aio_bootstrap starts the I/O threads, once during boot.
+ * aio_killproc wakes every thread of a process waiting in aio_wait, so it sees p_thrkill (see uthread.h).
+ * aio_detach drops a process's requests (exit and exec): ones still running finish and are thrown away.
+ */
+struct proc;
+
+void aio_bootstrap(void);
+void aio_killproc(struct proc *p);
+void aio_detach(struct proc *p);
+
+#endif /* _AIO_H_ */
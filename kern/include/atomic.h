@@ -0,0 +1,57 @@
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on an unsigned word in memory, for counters and
+ * reference counts that would otherwise need a lock around every
+ * update. The guts are machine-dependent.
+ *
+ * atomic_add adds DELTA (which may be negative) and returns the new
+ * value.
+ *
+ * atomic_cas stores NEWVAL if the word holds OLDVAL, and returns true
+ * if it did.
+ *
+ * atomic_dec_and_test subtracts 1 and returns true if that made the
+ * word 0. This is the usual way to drop a reference: whoever gets
+ * true had the last one.
+ *
+ * atomic_inc_not_zero adds 1 unless the word is 0, and returns true
+ * if it did. This takes a new reference only if the object hasn't
+ * already lost its last one.
+ *
+ * atomic_cas_ptr is atomic_cas on a pointer, for lists that are
+ * pushed onto without a lock. (A pointer is a word here.)
+ *
+ * All of these are full memory barriers (see membar.h): nothing before
+ * them is ordered after them or the other way around. That way the
+ * thread that drops the last reference sees every store made while
+ * the other references were held.
+ */
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+ATOMIC_INLINE unsigned atomic_add(volatile unsigned *p, int delta);
+ATOMIC_INLINE bool atomic_cas(volatile unsigned *p, unsigned oldval,
+			      unsigned newval);
+ATOMIC_INLINE bool atomic_dec_and_test(volatile unsigned *p);
+ATOMIC_INLINE bool atomic_inc_not_zero(volatile unsigned *p);
+ATOMIC_INLINE bool atomic_cas_ptr(void *volatile *p, void *oldval,
+				  void *newval);
+
+/* Get the implementation. */
+#include <machine/atomic.h>
+
+ATOMIC_INLINE
+bool
+atomic_cas_ptr(void *volatile *p, void *oldval, void *newval)
+{
+	COMPILE_ASSERT(sizeof(void *) == sizeof(unsigned));
+	return atomic_cas((volatile unsigned *)p, (uintptr_t)oldval,
+			  (uintptr_t)newval);
+}
+
+#endif /* _ATOMIC_H_ */
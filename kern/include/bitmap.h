@@ -37,7 +37,9 @@
  *     bitmap_create  - allocate a new bitmap object.
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
- *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *                      Load it before allocating from the bitmap.
+ *     bitmap_alloc   - locate the lowest cleared bit, set it, and
+ *                      return its index.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
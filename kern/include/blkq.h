@@ -0,0 +1,101 @@
+#ifndef _BLKQ_H_
+#define _BLKQ_H_
+
+/*
+ * Block device request queue: sits between the users of a disk and
+ * its driver. Requests are queued with blkq_submit, which returns
+ * right away; each queue has a thread of its own that hands them to
+ * the driver one at a time and calls each request's br_done when it
+ * has been done. So requests from several threads at once can be put
+ * in a better order than the one they came in:
+ *
+ *  - The queue is served C-LOOK: in order of sector, upwards from
+ *    where the disk head was left, then back to the lowest one.
+ *  - Requests that carry on exactly where the one being served ends
+ *    (same direction) go to the disk right behind it, as one run.
+ *  - Each request is in the I/O priority class of the process that
+ *    queued it (see <kern/ioprio.h>), and each pick serves the best
+ *    class that has requests waiting and a run left of its budget
+ *    for the round (BLKQ_BUDGET_*), C-LOOK among that class's own;
+ *    when no class with requests has any left, the round starts
+ *    again. IOPRIO_IDLE has none, so it only goes when it's alone.
+ *  - So that nothing waits forever behind a stream of requests at
+ *    other sectors or of better classes, one that has been passed
+ *    over BLKQ_DEADLINE times (four times that for IOPRIO_IDLE) is
+ *    served next, wherever it is.
+ *
+ * The driver's part is a function that does one request, start to
+ * finish, which is only ever called from the queue's thread.
+ *
+ * Functions:
+ *    blkq_create - make a queue for a driver; IOFN(DATA, ...) does
+ *                  the requests. SECTSIZE is the device's sector size.
+ *    blkq_submit - queue a request. br_done is called, from the
+ *                  queue's thread, with the result.
+ *    blkq_io     - do a request and wait for it.
+ *    blkq_uio    - do a whole uio's worth, starting at the sector
+ *                  its offset names, for devop_io (the offset and
+ *                  length have to be whole sectors).
+ *    blkq_format - print the queue's counters into BUF of size LEN
+ *                  from POS on, for stats:disk (see vfs_devstats),
+ *                  and return the new POS (as stats_format).
+ *
+ * Each queue counts what goes through it: requests and bytes each
+ * way, requests that went to the disk behind another as one run
+ * (merged), the requests queued or being done now (inflight), the
+ * sum over requests of how many there were, counting it, when it was
+ * queued (depthsum; over the number of requests, the average queue
+ * depth), and the time the disk was busy. There are histograms in
+ * microseconds like the irqstats ones (see stats.h): the driver's
+ * time for each request (svc), and each request's time from
+ * blkq_submit until it was done (lat), which counts the wait; and
+ * lat again for each class on its own (rtlat, belat, idlelat).
+ */
+
+#include <types.h>
+
+struct uio;
+struct blkq;
+
+struct blkreq {
+	uint32_t br_sector;			/* first sector */
+	uint32_t br_nsect;			/* how many */
+	void *br_data;				/* br_nsect sectors (kernel) */
+	bool br_write;
+	void (*br_done)(struct blkreq *br, int result);
+	void *br_arg;				/* for br_done */
+
+	/* private to the queue */
+	unsigned br_when;			/* dispatch count at submit */
+	uint64_t br_start;			/* mainbus_cycles at submit */
+	int br_class;				/* IOPRIO_*, the submitter's */
+	int br_result;
+	struct blkreq *br_next;
+};
+
+typedef int (*blkq_iofn)(void *data, uint32_t sector, uint32_t nsect,
+			 void *buf, bool write);
+
+/* How many requests may go ahead of one before it goes next anyway. */
+#define BLKQ_DEADLINE	16
+
+/* Runs each class may have in a round, when others are waiting. */
+#define BLKQ_BUDGET_RT	8
+#define BLKQ_BUDGET_BE	4
+
+/* Most sectors sent as one run. */
+#define BLKQ_MAXRUN	128
+
+/* Buckets in each histogram (the last one up to 2^24 us, 16s). */
+#define BLKQ_NBUCKETS	24
+
+struct blkq *blkq_create(const char *name, blkq_iofn iofn, void *data,
+			 size_t sectsize);
+void blkq_submit(struct blkq *bq, struct blkreq *br);
+int blkq_io(struct blkq *bq, uint32_t sector, uint32_t nsect, void *buf,
+	    bool write);
+int blkq_uio(struct blkq *bq, struct uio *uio);
+size_t blkq_format(struct blkq *bq, const char *name, char *buf, size_t len,
+		   size_t pos);
+
+#endif /* _BLKQ_H_ */
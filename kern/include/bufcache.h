@@ -0,0 +1,94 @@
+#ifndef _BUFCACHE_H_
+#define _BUFCACHE_H_
+
+/*
+ * Buffer cache: copies of disk blocks kept in memory, for file
+ * systems. Buffers are named by (device, block number) and hold
+ * BUF_BLOCKSIZE bytes. A buffer is held by one thread at a time,
+ * from buf_read or buf_get until buf_release; anyone else asking for
+ * the same block waits. Changes stay in the cache (write-back) until
+ * they're a few seconds old, when a background thread writes them,
+ * or until the buffer is thrown out to make room or the device is
+ * flushed.
+ * Runs of consecutive dirty blocks go out in one request, and
+ * buf_readrun brings runs in the same way.
+ *
+ * Small writes needn't read the block first: a buffer can hold just
+ * the part of a block that has been written, as long as the writes
+ * each start inside it or right at its end, so a run of small
+ * writes in order fills it up and then it's whole without a read.
+ * The rest is only read in (and merged under what was written) if
+ * the block is read, written somewhere else, or written back first.
+ *
+ * A file system with a journal pins the buffers it has changed until
+ * the changes are in the journal: nothing writes a pinned buffer back
+ * or throws it out. A pin carries the number of the transaction that
+ * took it, so only that transaction's unpin lets the buffer go.
+ *
+ * Functions:
+ *    buf_bootstrap - set up the cache, sized from the free memory.
+ *    buf_read      - get the buffer for a block, reading it in if
+ *                    it isn't cached.
+ *    buf_get       - get the buffer for a block without reading it,
+ *                    for a caller that will overwrite all of it.
+ *    buf_getrange  - get the buffer for a block to change part of it,
+ *                    from byte OFF on, without reading it if it can
+ *                    be helped; then say what was changed with
+ *                    buf_markrange (not buf_markdirty).
+ *    buf_data      - the buffer's data.
+ *    buf_markdirty - note the data has been changed.
+ *    buf_markrange - note LEN bytes from OFF have been changed, after
+ *                    buf_getrange.
+ *    buf_release   - done with the buffer.
+ *    buf_readrun   - read a run of consecutive blocks into the cache
+ *                    ahead of use, in as few device requests as it
+ *                    can, for sequential reads.
+ *    buf_prefetch  - the same, but in the background (readahead).
+ *    buf_flush     - write out every changed buffer of a device
+ *                    (but the pinned ones).
+ *    buf_flushblocks - write out just the given blocks, if they've
+ *                    changed (but the pinned ones), for syncing part
+ *                    of a file.
+ *    buf_pin       - pin a held buffer for transaction ID.
+ *    buf_pinned    - the transaction a held buffer is pinned for,
+ *                    or 0.
+ *    buf_unpin     - let a block's buffer go, if ID still has it.
+ *    buf_pinmax    - most buffers one user should keep pinned.
+ *    buf_invalidate - forget every buffer of a device (unmount);
+ *                    flush it first.
+ */
+
+#include <types.h>
+
+struct device;
+struct buf;
+
+/* Size of a cached block: the SFS block size. */
+#define BUF_BLOCKSIZE	512
+
+/* Most blocks moved in one device request (32K). */
+#define BUF_MAXRUN	64
+
+void buf_bootstrap(void);
+
+int buf_read(struct device *dev, daddr_t block, struct buf **ret);
+int buf_get(struct device *dev, daddr_t block, struct buf **ret);
+int buf_getrange(struct device *dev, daddr_t block, unsigned off,
+		 struct buf **ret);
+void *buf_data(struct buf *b);
+void buf_markdirty(struct buf *b);
+void buf_markrange(struct buf *b, unsigned off, unsigned len);
+void buf_release(struct buf *b);
+int buf_readrun(struct device *dev, daddr_t block, unsigned n);
+void buf_prefetch(struct device *dev, daddr_t block, unsigned n);
+
+void buf_pin(struct buf *b, unsigned id);
+unsigned buf_pinned(struct buf *b);
+void buf_unpin(struct device *dev, daddr_t block, unsigned id);
+unsigned buf_pinmax(void);
+
+int buf_flush(struct device *dev);
+int buf_flushblocks(struct device *dev, const daddr_t *blocks, unsigned n);
+void buf_invalidate(struct device *dev);
+
+#endif /* _BUFCACHE_H_ */
@@ -63,6 +63,19 @@
 void hardclock_bootstrap(void);
 void hardclock(void);
 
+/*
+ * An idle cpu stops its hardclock (hardclock_stop) until it has work
+ * again (hardclock_start); both are called from the idle loop with
+ * interrupts off. The ticks it didn't take are made up with
+ * hardclock_missed, which keeps the time and the timer wheel right.
+ * hardclock_kick wakes cpu 0 if it has stopped its clock, for
+ * timer_add and for cpus that must see the time move.
+ */
+void hardclock_stop(void);
+void hardclock_start(void);
+void hardclock_missed(unsigned ticks);
+void hardclock_kick(void);
+
 /*
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
@@ -70,9 +83,24 @@ void hardclock(void);
 void timerclock(void);
 
 /*
- * gettime() may be used to fetch the current time of day.
+ * gettime() may be used to fetch the current time of day from the
+ * clock device.
+ *
+ * getclocktime() fetches the time of day as the kernel keeps it,
+ * which is cheap (no locks, no device access) but only good to a
+ * hardclock tick. getuptime() fetches the time since boot the same
+ * way. time_bootstrap() starts the kernel's clock once the clock
+ * device is there.
+ *
+ * time_pagepaddr() returns where the user-visible copy of the clock
+ * (struct timepage, see kern/time.h) is, for vm_fault to map at
+ * TIMEPAGE; 0 before time_bootstrap.
  */
 void gettime(struct timespec *ret);
+void getclocktime(struct timespec *ret);
+void getuptime(struct timespec *ret);
+void time_bootstrap(void);
+paddr_t time_pagepaddr(void);
 
 /*
  * arithmetic on times
@@ -88,11 +116,19 @@ void timespec_sub(const struct timespec *t1,
 		  const struct timespec *t2,
 		  struct timespec *ret);
 
+/*
+ * cycles_to_timespec() converts a count of cpu cycles (see
+ * mainbus_cycles) to a time.
+ */
+void cycles_to_timespec(uint64_t cycles, struct timespec *ret);
+
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * clocksleep_ticks() does the same for a number of hardclock ticks.
  */
 void clocksleep(int seconds);
+void clocksleep_ticks(unsigned ticks);
 
 
 #endif /* _CLOCK_H_ */
@@ -30,6 +30,7 @@
 #ifndef _COPYINOUT_H_
 #define _COPYINOUT_H_
 
+#include <setjmp.h>
 
 /*
  * copyin/copyout/copyinstr/copyoutstr are standard BSD kernel functions.
@@ -69,5 +70,38 @@ int copyout(const void *src, userptr_t userdest, size_t len);
 int copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *got);
 int copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *got);
 
+/*
+ * user_access_begin and user_access_end bracket code that loads from
+ * and stores to the user region USERPTR..USERPTR+LEN-1 directly,
+ * through ordinary pointers, instead of calling copyin or copyout for
+ * each piece of it: the region is checked and the fault recovery
+ * turned on once for the lot. user_access_begin returns 0, or EFAULT
+ * if the region isn't all user memory. It's a setjmp underneath, so
+ * if one of the accesses faults it returns again, with EFAULT and
+ * recovery already off; use it only as the whole of an assignment
+ * "result = user_access_begin(...)" or of an if condition. Between
+ * the two:
+ *
+ *    - touch only the region that was checked;
+ *    - don't call copyin, copyout and friends (or anything that
+ *      might), since they use the same recovery;
+ *    - after a fault, local variables changed since
+ *      user_access_begin don't reliably have their new values (the
+ *      usual setjmp rule), unless they're volatile.
+ *
+ * Page faults on the region are handled as usual, and may sleep.
+ *
+ * useraccess_arm, useraccess_jmpbuf and useraccess_fault are the
+ * insides of user_access_begin.
+ */
+#define user_access_begin(userptr, len) \
+	(useraccess_arm(userptr, len) != 0 ? EFAULT : \
+	 setjmp(*useraccess_jmpbuf()) == 0 ? 0 : useraccess_fault())
+void user_access_end(void);
+
+int useraccess_arm(const_userptr_t userptr, size_t len);
+jmp_buf *useraccess_jmpbuf(void);
+int useraccess_fault(void);
+
 
 #endif /* _COPYINOUT_H_ */
@@ -3,6 +3,8 @@
 
 #include <types.h>
 
+struct addrspace;
+
 
 /* Physical memory allocator interface */
 
@@ -12,9 +14,64 @@ void vm_bootstrap(void);
 /* allocate a single page returns physical address of the allocated page */
 paddr_t alloc_page(void);
 
-/* frees a single page (takes in the paddr_t returned by alloc page) */
+/* allocate a single page that is guaranteed to be zero filled (usually taken from the pre-zeroed pool) */
+paddr_t alloc_zeroed_page(void);
+
+/* frees a single page (takes in the paddr_t returned by alloc page). If the page is shared copy-on-write this only drops a reference */
 void free_page(paddr_t pa);
 
+/* copy-on-write reference counting for user frames: page_incref adds a mapping, page_is_shared is true while more than one exists */
+void page_incref(paddr_t pa);
+bool page_is_shared(paddr_t pa);
+
+/* the shared zero page: page_zero_ref hands out a new reference to it, page_is_zero tells it apart */
+paddr_t page_zero_ref(void);
+bool page_is_zero(paddr_t pa);
+
+/*
+ * Paging support (see the comments in coremap.c). pte_get, pte_share and pte_take read, share or clear a user page
+ * table entry, waiting first if the pager is busy with the frame it maps. page_setowner records the reverse mapping
+ * that makes a frame pageable; page_is_busy is vm_fault's last minute check before loading a frame into the TLB.
+ * pte_pin holds a frame resident for a moment and page_unpin lets it go again, see vm_pagemove; pte_wire and
+ * page_unwire do the same for the length of a transfer, see vm_prefault.
+ */
+paddr_t pte_get(paddr_t *pte);
+paddr_t pte_share(paddr_t *pte);
+paddr_t pte_pin(paddr_t *pte, bool write);
+void page_unpin(paddr_t pa);
+paddr_t pte_wire(paddr_t *pte, bool write);
+void page_unwire(paddr_t pa);
+paddr_t pte_take(paddr_t *pte);
+bool page_is_busy(paddr_t pa);
+void page_setowner(paddr_t pa, struct addrspace *as, vaddr_t va);
+
+/* A frame the pager's clock picked: the owner's mapping and whether to evict it (or just give it a second chance) */
+struct pageout {
+    paddr_t pa;
+    struct addrspace *as;
+    vaddr_t va;
+    bool evict;
+};
+
+/* free_page on a whole vector of frames, and pte_take plus freeing on a vector of page table entries, under one lock hold */
+void free_page_vec(const paddr_t *frames, unsigned n);
+void pte_free_vec(paddr_t *ptes, unsigned n);
+
+/* a level 2 table shared after fork is released by each address space with this one, see coremap.c */
+bool pte_table_release(paddr_t *l2, struct addrspace *as);
+
+unsigned coremap_freecount(void);
+unsigned coremap_zeroedcount(void);
+unsigned coremap_pageout_select(struct pageout *list, unsigned max, struct addrspace *as);
+void coremap_pageout_cancel(const struct pageout *po);
+bool coremap_pageout_done(const struct pageout *po, paddr_t *pte, paddr_t newpte);
+
+/* same-page merging (see vm/pagemerge.c) */
+unsigned coremap_merge_select(struct pageout *list, unsigned max);
+bool coremap_merge_grab(paddr_t pa, struct pageout *po);
+void coremap_merge_keep(const struct pageout *po);
+bool coremap_merge_done(const struct pageout *po, paddr_t *pte, paddr_t target);
+
 /*
  *  Allocate/free a contiguous block of kernel pages.
  *   - alloc_kpages(npages) returns a *kernel virtual address*
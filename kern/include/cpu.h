@@ -31,10 +31,50 @@
 #define _CPU_H_
 
 
+#include <kern/sched.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <schedtrace.h>
+#include <stats.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct work;	/* in workqueue.h */
+struct wchan;	/* in wchan.h */
+
+/*
+ * Number of free physical frames each cpu keeps on hand so the page
+ * allocator doesn't have to take the coremap lock on every call.
+ */
+#define CPU_PAGECACHE_SIZE 32
+
+/*
+ * Number of free blocks each cpu keeps on hand for each of the
+ * CPU_KMCACHE_NSIZES subpage size classes of kmalloc (see kmalloc.c).
+ */
+#define CPU_KMCACHE_SIZE 16
+#define CPU_KMCACHE_NSIZES 8
+
+/*
+ * Number of scheduler priority levels, each with its own run queue
+ * (see schedule() in thread.c). Level 0 is the highest. The first
+ * CPU_RUNQUEUE_RTLEVELS are the real-time classes (kern/sched.h):
+ * SCHED_DEADLINE at level 0, kept in deadline order, then a level for
+ * each SCHED_FIFO priority, best first. The time-sharing levels the
+ * feedback queue moves threads between come after those.
+ */
+#define CPU_RUNQUEUE_RTLEVELS (1 + SCHED_FIFO_MAXPRIO)
+#define CPU_RUNQUEUE_LEVELS (CPU_RUNQUEUE_RTLEVELS + 4)
+
+/*
+ * Number of spare thread stacks each cpu keeps (see thread.c).
+ */
+#define CPU_STACKCACHE_SIZE 8
+
+/*
+ * Size of each cpu's kprintf ring (see kprintf.c). Must be a power
+ * of 2.
+ */
+#define CPU_LOGSIZE 2048
 
 /*
  * Per-cpu structure
@@ -61,15 +101,72 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	paddr_t c_pagecache[CPU_PAGECACHE_SIZE]; /* Free frames (coremap.c) */
+	unsigned c_npagecache;		/* Number of frames in c_pagecache */
+	void *c_kmcache[CPU_KMCACHE_NSIZES][CPU_KMCACHE_SIZE]; /* Free kmalloc blocks */
+	unsigned c_nkmcache[CPU_KMCACHE_NSIZES]; /* Blocks in each c_kmcache[] */
+	void *c_stacks[CPU_STACKCACHE_SIZE]; /* Spare thread stacks (thread.c) */
+	unsigned c_nstacks;		/* Number of stacks in c_stacks */
+	uint32_t c_asid;		/* ASID currently loaded in the MMU */
+	uint32_t c_asid_generation;	/* ASID generation of our TLB */
+	unsigned c_tlb_victim;		/* Next TLB slot to replace (vm.c) */
+	uint64_t c_cyclebase;		/* Cycles before this timer period (mainbus) */
+	unsigned c_tickspan;		/* Ticks this timer period is (mainbus) */
+	unsigned c_tickdone;		/* ... of which already accounted for */
+
+	/*
+	 * Written only by this cpu, read by others (see schedtrace.h).
+	 */
+	struct schedtrace_event c_trace[SCHEDTRACE_SIZE]; /* Event ring */
+	unsigned c_tracecount;		/* Events ever written to c_trace */
+	unsigned c_wakelat[SL_NKINDS][SCHEDLAT_NBUCKETS]; /* Wakeup latency */
+	volatile unsigned c_epochseen;	/* Last grace period seen (epoch.c) */
+	uint64_t c_stats[STAT_NCOUNTERS]; /* Event counters (stats.h) */
+	uint64_t c_idlecycles;		/* Cycles spent in cpu_idle (thread.c) */
+	volatile uint64_t c_idlestart;	/* When this cpu_idle began, or 0 */
+#if OPT_IRQSTATS
+	uint32_t c_hists[STAT_NHISTS][STAT_NBUCKETS]; /* (stats.h) */
+	uint64_t c_irqoff;		/* When interrupts went off, or 0 */
+#endif
+
+	/*
+	 * Written by this cpu at splhigh, drained by the logger thread
+	 * (see kprintf.c), which alone writes c_logtail and
+	 * c_logreported.
+	 */
+	char c_log[CPU_LOGSIZE];	/* kprintf output not yet printed */
+	volatile unsigned c_loghead;	/* Bytes ever written to c_log */
+	volatile unsigned c_logtail;	/* Bytes ever taken out of it */
+	volatile unsigned c_logdropped;	/* Bytes thrown away, it was full */
+	unsigned c_logreported;		/* c_logdropped when last told */
+
+	/*
+	 * Pushed onto by other cpus without a lock (atomic_cas_ptr),
+	 * and taken all at once by this cpu, into its run queue (see
+	 * thread_make_runnable).
+	 */
+	struct thread *volatile c_wakeups; /* Threads woken from afar */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[CPU_RUNQUEUE_LEVELS]; /* Run queues for this cpu */
+	unsigned c_runcount;		/* Threads on all of c_runqueue[] */
+	uint64_t c_release;		/* Tick a throttled deadline thread
+					   queued here gets its budget back */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by this cpu's interrupt handlers and worker thread.
+	 * Protected by the work lock.
+	 */
+	struct work *c_workhead;	/* Queued work (workqueue.c) */
+	struct work **c_worktail;	/* Where the next one goes */
+	struct wchan *c_workwchan;	/* The worker waits here */
+	struct spinlock c_work_lock;
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -83,10 +180,14 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * c_shootdown_done counts batches of shootdowns this cpu has
+	 * processed, so a sender can wait for its request to finish.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	unsigned c_shootdown_done;
 	struct spinlock c_ipi_lock;
 };
 
@@ -153,6 +254,11 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_cpus queues a batch of mappings on each cpu in a
+ * bitmask of cpu numbers, with a single IPI per cpu, and waits until
+ * all of them have invalidated the batch. It must be called with
+ * interrupts enabled, so that two cpus shooting each other down can
+ * still service each other's requests.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -167,6 +273,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_cpus(uint32_t cpus,
+			   const struct tlbshootdown *mappings, unsigned num);
 
 void interprocessor_interrupt(void);
 
@@ -36,6 +36,8 @@
 
 
 struct uio;  /* in <uio.h> */
+struct blkq; /* in <blkq.h> */
+struct pollset; /* in <poll.h> */
 
 /*
  * Filesystem-namespace-accessible device.
@@ -48,6 +50,8 @@ struct device {
 
 	dev_t d_devnumber;	/* serial number for this device */
 
+	struct blkq *d_queue;	/* request queue, if it has one */
+
 	void *d_data;		/* device-specific data */
 };
 
@@ -56,11 +60,14 @@ struct device {
  *      devop_eachopen - called on each open call to allow denying the open
  *      devop_io - for both reads and writes (the uio indicates the direction)
  *      devop_ioctl - miscellaneous control operations
+ *      devop_poll - as vop_poll (optional; without it the device is
+ *                   always ready)
  */
 struct device_ops {
 	int (*devop_eachopen)(struct device *, int flags_from_open);
 	int (*devop_io)(struct device *, struct uio *);
 	int (*devop_ioctl)(struct device *, int op, userptr_t data);
+	int (*devop_poll)(struct device *, int events, struct pollset *);
 };
 
 /*
@@ -77,6 +84,7 @@ struct vnode *dev_create_vnode(struct device *dev);
 
 /* Initialization functions for builtin vfs-level devices. */
 void devnull_create(void);
+int stripe_create(unsigned unit, unsigned ndisks, char **disks);
 
 /* Function that kicks off device probe and attach. */
 void dev_bootstrap(void);
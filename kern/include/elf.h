@@ -193,8 +193,59 @@ typedef struct {
 #define	PF_X		0x1	/* Segment is executable */
 
 
+/*
+ * "Section Header" - link-time section header. The kernel only uses
+ * these to find the symbol table (see prof.c).
+ * There are Ehdr.e_shnum of these located at Ehdr.e_shoff.
+ */
+typedef struct {
+	uint32_t	sh_name;     /* Offset of name in shstrtab section */
+	uint32_t	sh_type;     /* Type of section */
+	uint32_t	sh_flags;    /* Flags */
+	uint32_t	sh_addr;     /* Virtual address, if loaded */
+	uint32_t	sh_offset;   /* Location of data within file */
+	uint32_t	sh_size;     /* Size of data within file */
+	uint32_t	sh_link;     /* Related section; strtab for a symtab */
+	uint32_t	sh_info;     /* Extra information */
+	uint32_t	sh_addralign; /* Required alignment */
+	uint32_t	sh_entsize;  /* Size of entries, for tables */
+} Elf32_Shdr;
+
+/* values for sh_type (the ones we care about) */
+#define	SHT_NULL	0		/* Section header entry unused */
+#define	SHT_PROGBITS	1		/* Program data */
+#define	SHT_SYMTAB	2		/* Symbol table */
+#define	SHT_STRTAB	3		/* String table */
+#define	SHT_NOBITS	8		/* Zero-filled data (bss) */
+
+/*
+ * Symbol table entry.
+ */
+typedef struct {
+	uint32_t	st_name;     /* Offset of name in the strtab */
+	uint32_t	st_value;    /* Address */
+	uint32_t	st_size;     /* Size of object, in bytes */
+	unsigned char	st_info;     /* Type and binding */
+	unsigned char	st_other;    /* Visibility */
+	uint16_t	st_shndx;    /* Section it's in */
+} Elf32_Sym;
+
+/* parts of st_info */
+#define	ELF32_ST_BIND(i)	((i) >> 4)
+#define	ELF32_ST_TYPE(i)	((i) & 0xf)
+
+/* values for ELF32_ST_TYPE */
+#define	STT_NOTYPE	0		/* Unspecified */
+#define	STT_OBJECT	1		/* Data */
+#define	STT_FUNC	2		/* Code */
+#define	STT_SECTION	3		/* A section */
+#define	STT_FILE	4		/* A source file */
+
+
 typedef Elf32_Ehdr Elf_Ehdr;
 typedef Elf32_Phdr Elf_Phdr;
+typedef Elf32_Shdr Elf_Shdr;
+typedef Elf32_Sym Elf_Sym;
 
 
 #endif /* _ELF_H_ */
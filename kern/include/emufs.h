@@ -41,10 +41,40 @@
  * Our structures
  */
 
+/*
+ * One page of a file's contents, cached (see emu.c).
+ */
+struct emufs_cpage {
+	bool ec_valid;
+	uint32_t ec_pageno;		/* which page of the file */
+	uint32_t ec_len;		/* bytes in it; less than a page at EOF */
+	char *ec_data;			/* PAGE_SIZE bytes, or NULL */
+};
+
+/* Pages cached per file. */
+#define EMUFS_CACHEPAGES 16
+
+/*
+ * A name looked up in a directory and the vnode it found, which the
+ * entry holds a reference to (see emu.c).
+ */
+struct emufs_name {
+	char en_name[48];		/* "" if the entry is free */
+	struct emufs_vnode *en_vnode;
+};
+
+/* Names cached per directory. */
+#define EMUFS_NAMES 8
+
 struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+	struct emufs_cpage *ev_cache;	/* EMUFS_CACHEPAGES, or NULL */
+	struct emufs_name *ev_names;	/* EMUFS_NAMES, or NULL */
+	unsigned ev_namenext;		/* entry to replace next */
+	off_t ev_size;			/* file size, if ev_sizevalid */
+	bool ev_sizevalid;
 };
 
 struct emufs_fs {
@@ -0,0 +1,100 @@
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+/*
+ * Deferred reclamation for lock-free readers.
+ *
+ * Readers of a structure that's updated under a lock can skip the
+ * lock if the writer, after unlinking something, doesn't free it
+ * until every reader that might have been looking at it is done. A
+ * reader brackets its lookup with epoch_enter and epoch_exit, takes
+ * no locks, and may not sleep or yield in between; the writer unlinks
+ * the object (with a membar_store_store or equivalent before the
+ * store that unlinks it, so readers never see a half-built one) and
+ * hands it to defer_free or epoch_defer instead of freeing it.
+ *
+ * This is quiescent-state based: a cpu that switches threads, or
+ * takes a clock tick or idles without a read section open, can't
+ * still be in one that started earlier. A grace period begins when
+ * something is deferred and ends once every cpu has passed through
+ * such a state; then what was deferred before it began is released,
+ * by a work item. Readers pay for almost nothing: bumping a
+ * per-thread count, which also keeps hardclock from preempting them.
+ *
+ *    epoch_enter       - start a read section. They nest.
+ *    epoch_exit        - end one.
+ *    epoch_defer       - call FUNC(ARG) in a thread once the current
+ *                        readers are done. EI is the caller's, usually
+ *                        part of the object, so this never allocates
+ *                        and may be called from anywhere.
+ *    defer_free        - kfree PTR once the current readers are done.
+ *                        May sleep (it allocates).
+ *    epoch_synchronize - wait until the current readers are done.
+ *    epoch_quiescent   - this cpu is in a quiescent state; called by
+ *                        the thread and clock code.
+ *    epoch_bootstrap   - set up; called once during boot.
+ */
+
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <membar.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef EPOCH_INLINE
+#define EPOCH_INLINE INLINE
+#endif
+
+struct epoch_item {
+	struct epoch_item *ei_next;
+	void (*ei_func)(void *);
+	void *ei_arg;
+};
+
+/* Current grace period; compared with each cpu's c_epochseen. */
+extern volatile unsigned epoch_gen;
+
+EPOCH_INLINE void epoch_enter(void);
+EPOCH_INLINE void epoch_exit(void);
+EPOCH_INLINE void epoch_quiescent(void);
+
+void epoch_defer(struct epoch_item *ei, void (*func)(void *), void *arg);
+void defer_free(void *ptr);
+void epoch_synchronize(void);
+void epoch_bootstrap(void);
+
+/* Slow path of epoch_quiescent (epoch.c). */
+void epoch_report(void);
+
+EPOCH_INLINE
+void
+epoch_enter(void)
+{
+	/*
+	 * Only this thread writes the count. The barrier is for the
+	 * clock interrupt on this cpu: it mustn't find the count still
+	 * zero once the section's loads have started.
+	 */
+	curthread->t_epochnest++;
+	membar_any_any();
+}
+
+EPOCH_INLINE
+void
+epoch_exit(void)
+{
+	KASSERT(curthread->t_epochnest > 0);
+	membar_any_store();
+	curthread->t_epochnest--;
+}
+
+EPOCH_INLINE
+void
+epoch_quiescent(void)
+{
+	if (curcpu->c_epochseen != epoch_gen) {
+		epoch_report();
+	}
+}
+
+#endif /* _EPOCH_H_ */
@@ -3,18 +3,24 @@
 
 #include <types.h>
 #include <synch.h>
+#include <bitmap.h>
 #include <open_file_handler.h>
 #include <limits.h>
 
 
 
 
+/* The slots of a file table, see file_table.c */
+struct file_slots;
+
 /* File table struct that each process has. Our file table will be represented by an array of file handle structs */
+/* The array starts small and doubles (up to __OPEN_MAX slots) when a new fd doesn't fit. After fork, parent and child
+ * share it until either changes it */
 struct file_table{
-    /* Figure out what to set the size of the array to */
-    struct open_file_handler *files[__OPEN_MAX];
-    /* Lock for the file table to prevent concurrent access */
-    struct lock *lock;
+    /* read/write/lseek/mmap read the slots without the lock (see file_table_get), so the pointer is volatile */
+    struct file_slots *volatile slots;
+    /* Lock for the file table. open/close/dup2 write it, fork's copy reads it */
+    struct rwlock *lock;
 };
 
 /* Create process’s file table */
@@ -23,7 +29,25 @@ struct file_table *create_file_table(void);
 /* Function destroys a process's file table */
 void destroy_file_table(struct file_table *ft);
 
-/* function for copying file table */
+/* function for copying file table (for fork: the copy shares the slots until one side changes them) */
 struct file_table *copy_file_table(struct file_table *ft);
 
-#endif
\ No newline at end of file
+/* Returns the file open on fd with a reference taken (the caller decrefs it), or NULL if there's none. No lock */
+struct open_file_handler *file_table_get(struct file_table *ft, int fd);
+
+/* For the *at calls: the vnode of the directory open on fd, with a reference taken (the caller decrefs it), or NULL
+ * for AT_FDCWD. EBADF if nothing's open there, ENOTDIR if it isn't a directory. No lock */
+int file_table_getdir(struct file_table *ft, int fd, struct vnode **dirp);
+
+/* The rest need the lock held for writing (or a table nobody else can see yet) */
+
+/* Returns the file open on fd, or NULL. No reference is taken */
+struct open_file_handler *file_table_lookup(struct file_table *ft, int fd);
+
+/* Puts f in the lowest free fd and returns it in *fdp. EMFILE if all __OPEN_MAX are taken, ENOMEM if we can't grow */
+int file_table_add(struct file_table *ft, struct open_file_handler *f, int *fdp);
+
+/* Puts f (or NULL to clear it) in slot fd and hands back what was there in *oldp. fd must be below __OPEN_MAX */
+int file_table_set(struct file_table *ft, int fd, struct open_file_handler *f, struct open_file_handler **oldp);
+
+#endif
@@ -84,6 +84,14 @@ struct fs_ops {
 
 /* Initialization functions for builtin fake file systems. */
 void semfs_bootstrap(void);
+void statsfs_bootstrap(void);
+
+/* P (DELTA < 0) or V (DELTA > 0) on a semfs semaphore; EINVAL if VN isn't one. */
+struct vnode;
+int semfs_semop(struct vnode *vn, int delta);
+
+/* Make a new, empty in-memory file system and attach it as NAME:. */
+int tmpfs_mount(const char *name);
 
 
 #endif /* _FS_H_ */
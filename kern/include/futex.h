@@ -0,0 +1,15 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+/*
+ * Futexes (see syscall/futex_syscall.c). futex_bootstrap sets up the hash table of wait channels, once during boot.
+ * futex_pageout is called by the pager after it evicts a frame, to wake anybody waiting on a word in it.
+ * futex_killproc wakes every thread of a process waiting on any futex, so it sees p_thrkill (see uthread.h).
+ */
+struct proc;
+
+void futex_bootstrap(void);
+void futex_pageout(paddr_t frame);
+void futex_killproc(struct proc *p);
+
+#endif /* _FUTEX_H_ */
@@ -0,0 +1,164 @@
+#ifndef _HASHTAB_H_
+#define _HASHTAB_H_
+
+/*
+ * Hash table: a resizeable map from keys (strings of bytes) to void
+ * pointers, with a typed version declared by macros the same way as
+ * array.h's.
+ *
+ * The table keeps its own copy of each key, in the same allocation as
+ * the entry, so the caller's key can be on the stack. Integer keys
+ * are passed as their bytes (&pid, sizeof(pid)). There is no locking;
+ * that's up to the user, as with arrays. The number of buckets is a
+ * power of 2 and doubles once there are more entries than buckets, so
+ * chains stay short; it starts out with none, so an empty table costs
+ * nothing but the struct.
+ *
+ * create  - allocate a table.
+ * destroy - destroy an allocated table; it must be empty.
+ * init    - initialize a table in space externally allocated.
+ * cleanup - clean up a table in space externally allocated.
+ * num     - return the number of entries.
+ * get     - return the value for KEY (KEYLEN bytes), or NULL.
+ * add     - add KEY with value VAL (which may not be NULL). EEXIST if
+ *           KEY is already there; may fail and return ENOMEM.
+ * remove  - take KEY out and return its value, or NULL if it isn't
+ *           there.
+ *
+ * To go through all the entries (in no particular order), set up a
+ * struct hashtab_iter with iter_init and call iter_next until it
+ * returns NULL. The table must not be changed meanwhile, except by
+ * removing the entry iter_next just returned.
+ *
+ * hashtab_hash is the hash function (32-bit FNV-1a), for users with
+ * tables of their own.
+ */
+
+struct hashtab_entry;
+
+struct hashtab {
+	struct hashtab_entry **ht_buckets;
+	unsigned ht_nbuckets;		/* 0, or a power of 2 */
+	unsigned ht_num;		/* entries */
+};
+
+struct hashtab_iter {
+	const struct hashtab *hi_table;
+	unsigned hi_bucket;		/* next bucket to look at */
+	struct hashtab_entry *hi_next;	/* next entry in the one before */
+};
+
+uint32_t hashtab_hash(const void *key, size_t keylen);
+
+struct hashtab *hashtab_create(void);
+void hashtab_destroy(struct hashtab *);
+void hashtab_init(struct hashtab *);
+void hashtab_cleanup(struct hashtab *);
+unsigned hashtab_num(const struct hashtab *);
+void *hashtab_get(const struct hashtab *, const void *key, size_t keylen);
+int hashtab_add(struct hashtab *, const void *key, size_t keylen, void *val);
+void *hashtab_remove(struct hashtab *, const void *key, size_t keylen);
+void hashtab_iter_init(struct hashtab_iter *, const struct hashtab *);
+void *hashtab_iter_next(struct hashtab_iter *);
+
+/*
+ * Typed hash tables.
+ *
+ * DECLHASH_BYTYPE(foo, bar, INLINE) declares "struct foo", a hash
+ * table of pointers to "bar", plus the operations on it (foo_get and
+ * so on, the same as above but typed). DEFHASH_BYTYPE defines them.
+ * DECLHASH(foo, INLINE) is DECLHASH_BYTYPE(foohash, struct foo,
+ * INLINE). INLINE is used as for DECLARRAY (see array.h).
+ */
+
+#define DECLHASH_BYTYPE(HASH, T, INLINE) \
+	struct HASH {						\
+		struct hashtab ht;				\
+	};							\
+								\
+	INLINE struct HASH *HASH##_create(void);		\
+	INLINE void HASH##_destroy(struct HASH *h);		\
+	INLINE void HASH##_init(struct HASH *h);		\
+	INLINE void HASH##_cleanup(struct HASH *h);		\
+	INLINE unsigned HASH##_num(const struct HASH *h);	\
+	INLINE T *HASH##_get(const struct HASH *h,		\
+			     const void *key, size_t keylen);	\
+	INLINE int HASH##_add(struct HASH *h,			\
+			      const void *key, size_t keylen, T *val); \
+	INLINE T *HASH##_remove(struct HASH *h,			\
+				const void *key, size_t keylen); \
+	INLINE void HASH##_iter_init(struct hashtab_iter *it,	\
+				     const struct HASH *h);	\
+	INLINE T *HASH##_iter_next(struct hashtab_iter *it)
+
+#define DEFHASH_BYTYPE(HASH, T, INLINE) \
+	INLINE struct HASH *					\
+	HASH##_create(void)					\
+	{							\
+		struct HASH *h = kmalloc(sizeof(*h));		\
+		if (h == NULL) {				\
+			return NULL;				\
+		}						\
+		hashtab_init(&h->ht);				\
+		return h;					\
+	}							\
+								\
+	INLINE void						\
+	HASH##_destroy(struct HASH *h)				\
+	{							\
+		hashtab_cleanup(&h->ht);			\
+		kfree(h);					\
+	}							\
+								\
+	INLINE void						\
+	HASH##_init(struct HASH *h)				\
+	{							\
+		hashtab_init(&h->ht);				\
+	}							\
+								\
+	INLINE void						\
+	HASH##_cleanup(struct HASH *h)				\
+	{							\
+		hashtab_cleanup(&h->ht);			\
+	}							\
+								\
+	INLINE unsigned						\
+	HASH##_num(const struct HASH *h)			\
+	{							\
+		return hashtab_num(&h->ht);			\
+	}							\
+								\
+	INLINE T *						\
+	HASH##_get(const struct HASH *h, const void *key, size_t keylen) \
+	{							\
+		return (T *)hashtab_get(&h->ht, key, keylen);	\
+	}							\
+								\
+	INLINE int						\
+	HASH##_add(struct HASH *h, const void *key, size_t keylen, T *val) \
+	{							\
+		return hashtab_add(&h->ht, key, keylen, (void *)val); \
+	}							\
+								\
+	INLINE T *						\
+	HASH##_remove(struct HASH *h, const void *key, size_t keylen) \
+	{							\
+		return (T *)hashtab_remove(&h->ht, key, keylen); \
+	}							\
+								\
+	INLINE void						\
+	HASH##_iter_init(struct hashtab_iter *it, const struct HASH *h) \
+	{							\
+		hashtab_iter_init(it, &h->ht);			\
+	}							\
+								\
+	INLINE T *						\
+	HASH##_iter_next(struct hashtab_iter *it)		\
+	{							\
+		return (T *)hashtab_iter_next(it);		\
+	}
+
+#define DECLHASH(T, INLINE) DECLHASH_BYTYPE(T##hash, struct T, INLINE)
+#define DEFHASH(T, INLINE) DEFHASH_BYTYPE(T##hash, struct T, INLINE)
+
+#endif /* _HASHTAB_H_ */
@@ -0,0 +1,39 @@
+#ifndef _KERN_AIO_H_
+#define _KERN_AIO_H_
+
+/*
+ * Definitions for asynchronous I/O.
+ *
+ * aio_read and aio_write queue a read or write of aio_nbytes at
+ * aio_offset in the open file aio_fildes and return right away; a
+ * pool of kernel threads does the I/O. aio_wait hands back finished
+ * ones as aio_events: the aio_data the request was queued with, and
+ * what pread/pwrite would have returned (0 or more) or minus the
+ * error number. A read's data is in aio_buf by the time aio_wait
+ * returns its event; a write's data is taken from aio_buf when it is
+ * queued, so the buffer can be reused right away.
+ */
+
+struct aiocb {
+	off_t aio_offset;	/* where in the file */
+	int aio_fildes;		/* the open file */
+	void *aio_buf;
+	size_t aio_nbytes;	/* at most AIO_MAXBYTES */
+	unsigned aio_data;	/* not used, copied to the event */
+};
+
+struct aio_event {
+	unsigned ae_data;	/* aio_data of the request */
+	int ae_res;		/* result, or -errno */
+};
+
+/* aio_wait flags. */
+#define AIO_NOWAIT	1	/* don't wait if nothing has finished yet */
+
+/* Most requests a process can have queued, running or uncollected (EAGAIN past that). */
+#define AIO_MAX		32
+
+/* Most bytes one request can move. */
+#define AIO_MAXBYTES	(64 * 1024)
+
+#endif /* _KERN_AIO_H_ */
@@ -0,0 +1,43 @@
+#ifndef _KERN_DIRENT_H_
+#define _KERN_DIRENT_H_
+
+/*
+ * Directory entries, as getdirentries() hands them back: packed one
+ * after another in the caller's buffer, each d_reclen bytes long
+ * (a multiple of 4, so the next one is aligned too). d_ino is 0 and
+ * d_type DT_UNKNOWN when the file system can't tell without more I/O
+ * than reading the directory itself.
+ */
+
+#include <kern/limits.h>
+#include <kern/stattypes.h>
+
+struct dirent {
+	__u32 d_ino;		/* inode number */
+	__u16 d_reclen;		/* length of this record */
+	__u8 d_type;		/* DT_* */
+	__u8 d_namlen;		/* length of d_name, not counting the null */
+	char d_name[];		/* null-terminated */
+};
+
+/* Types for d_type: the _S_IF* values, shifted down. */
+#define DT_UNKNOWN	0
+#define DT_REG		(_S_IFREG >> 12)
+#define DT_DIR		(_S_IFDIR >> 12)
+#define DT_LNK		(_S_IFLNK >> 12)
+#define DT_FIFO		(_S_IFIFO >> 12)
+#define DT_SOCK		(_S_IFSOCK >> 12)
+#define DT_CHR		(_S_IFCHR >> 12)
+#define DT_BLK		(_S_IFBLK >> 12)
+
+/* Record length for a name of length NAMLEN. */
+#define DIRENT_RECLEN(namlen) \
+	((sizeof(struct dirent) + (namlen) + 1 + 3) & ~(size_t)3)
+
+/*
+ * The longest record there can be; getdirentries wants a buffer at
+ * least this big, so there's always room for the next entry.
+ */
+#define DIRENT_MAXRECLEN	DIRENT_RECLEN(__NAME_MAX)
+
+#endif /* _KERN_DIRENT_H_ */
@@ -53,6 +53,16 @@
 /* Additional related definition */
 #define O_ACCMODE     3      /* mask for O_RDONLY/O_WRONLY/O_RDWR */
 
+/* For openat() and friends: the directory fd meaning the current directory */
+#define AT_FDCWD       -100
+/* and flags */
+#define AT_SYMLINK_NOFOLLOW 1 /* fstatat: don't follow a symlink (lookup never does) */
+#define AT_REMOVEDIR    2    /* unlinkat: remove a directory, like rmdir */
+
+/* Modes for fallocate(): 0 allocates, and makes the file longer if need be */
+#define FALLOC_FL_KEEP_SIZE  1 /* allocate, but leave the size alone */
+#define FALLOC_FL_PUNCH_HOLE 2 /* free the range instead (with KEEP_SIZE) */
+
 /*
  * Not so important
  */
@@ -34,6 +34,21 @@
  * ioctl operation codes
  */
 
-/* (none yet) */
+/*
+ * SFS files. SFS_IOC_FRAGS reports how the file lies on the disk;
+ * SFS_IOC_DEFRAG moves its blocks to one free run, if there is one
+ * big enough and it isn't in one already, and then reports the same.
+ * (That is one metadata transaction: after a crash the file is in
+ * one place or the other.) Both take a struct sfs_fragstat, to fill
+ * in. They fail with EINVAL on other files.
+ */
+#define SFS_IOC_FRAGS	1
+#define SFS_IOC_DEFRAG	2
+
+struct sfs_fragstat {
+	__u32 sfs_blocks;		/* data blocks the file has */
+	__u32 sfs_runs;		/* runs of consecutive ones */
+	__u32 sfs_moved;		/* how many DEFRAG moved */
+};
 
 #endif /* _KERN_IOCTL_H_*/
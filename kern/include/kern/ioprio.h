@@ -0,0 +1,26 @@
+#ifndef _KERN_IOPRIO_H_
+#define _KERN_IOPRIO_H_
+
+/*
+ * I/O priority classes, for ioprio_set and ioprio_get. Each process
+ * has one, which its children get at fork and spawn; every request it
+ * puts on a disk's queue goes there in that class (see blkq.h).
+ *
+ * IOPRIO_RT requests go before the others, up to a budget of runs in
+ * each round, so they can't keep the disk to themselves. IOPRIO_BE is
+ * the default, best effort, also with a budget per round, a smaller
+ * one. IOPRIO_IDLE requests only go when nothing else is waiting, or
+ * when they've waited long enough that they go anyway, so a bulk job
+ * in this class stays out of everyone else's way.
+ *
+ * Writes the kernel does later, in the background (the buffer
+ * cache's and the filesystems' flushers), are in IOPRIO_BE, whoever
+ * wrote the data.
+ */
+
+#define IOPRIO_RT		0
+#define IOPRIO_BE		1
+#define IOPRIO_IDLE		2
+#define IOPRIO_NCLASSES		3
+
+#endif /* _KERN_IOPRIO_H_ */
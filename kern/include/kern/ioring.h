@@ -0,0 +1,63 @@
+#ifndef _KERN_IORING_H_
+#define _KERN_IORING_H_
+
+/*
+ * Definitions for ioring_enter().
+ *
+ * A process that does lots of small file operations can queue them up
+ * in a submission ring and hand the whole lot to the kernel with one
+ * ioring_enter call, instead of trapping once per operation. The
+ * kernel does them in order and posts one completion for each in the
+ * completion ring: the sqe_data of the submission, and what the
+ * system call would have returned (0 or more) or minus the error
+ * number it would have set.
+ *
+ * Both rings and the struct ioring that describes them are in the
+ * process's own memory. They have ir_entries slots each (a power of
+ * two, at most IORING_MAX_ENTRIES). The heads and tails count up
+ * forever and wrap; the slot for count C is C & (ir_entries - 1).
+ * The process fills in submissions at ir_sqtail and moves it on, and
+ * takes completions from ir_cqhead and moves that on; the kernel does
+ * the other two. ioring_enter takes as many submissions as there is
+ * room for completions and returns how many it did.
+ */
+
+/* Operations. The fields each one uses are the ones its system call takes. */
+#define IORING_OP_NOP		0	/* nothing; completes with 0 */
+#define IORING_OP_READ		1	/* read(sqe_fd, sqe_buf, sqe_len) */
+#define IORING_OP_WRITE		2	/* write(sqe_fd, sqe_buf, sqe_len) */
+#define IORING_OP_PREAD		3	/* pread(... , sqe_offset) */
+#define IORING_OP_PWRITE	4	/* pwrite(... , sqe_offset) */
+#define IORING_OP_OPEN		5	/* open(sqe_buf, sqe_flags, sqe_mode) */
+#define IORING_OP_CLOSE		6	/* close(sqe_fd) */
+
+struct ioring_sqe {
+	off_t sqe_offset;	/* PREAD/PWRITE only */
+	int sqe_op;		/* IORING_OP_* */
+	int sqe_fd;
+	void *sqe_buf;		/* the buffer, or the path for OPEN */
+	size_t sqe_len;
+	int sqe_flags;		/* OPEN only */
+	mode_t sqe_mode;	/* OPEN only */
+	unsigned sqe_data;	/* not used, copied to the completion */
+};
+
+struct ioring_cqe {
+	unsigned cqe_data;	/* sqe_data of the submission */
+	int cqe_res;		/* result, or -errno */
+};
+
+struct ioring {
+	volatile unsigned ir_sqhead;	/* next submission the kernel takes */
+	volatile unsigned ir_sqtail;	/* next free submission slot */
+	volatile unsigned ir_cqhead;	/* next completion the process takes */
+	volatile unsigned ir_cqtail;	/* next free completion slot */
+	unsigned ir_entries;		/* slots in each ring */
+	struct ioring_sqe *ir_sq;
+	struct ioring_cqe *ir_cq;
+};
+
+/* Most slots a ring can have. */
+#define IORING_MAX_ENTRIES	256
+
+#endif /* _KERN_IORING_H_ */
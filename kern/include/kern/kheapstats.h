@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2004, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_KHEAPSTATS_H_
+#define _KERN_KHEAPSTATS_H_
+
+/*
+ * Kernel heap counters, as returned by the kheapstats() system call.
+ *
+ * There is one entry for each kmalloc size class, smallest first,
+ * followed by one for allocations of whole pages, which has ks_size
+ * 0. Live and peak are counted in blocks (allocations, for the
+ * whole-page entry), so the subpage classes use ks_size times that
+ * much memory.
+ */
+struct kheapstats {
+	__size_t ks_size;		/* block size (0 for whole pages) */
+	__u32 ks_allocs;		/* successful allocations */
+	__u32 ks_frees;			/* frees */
+	__u32 ks_live;			/* blocks allocated now */
+	__u32 ks_peak;			/* most blocks allocated at once */
+	__u32 ks_failures;		/* allocations refused for lack of pages */
+};
+
+#endif /* _KERN_KHEAPSTATS_H_ */
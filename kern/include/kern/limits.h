@@ -79,8 +79,8 @@
 /* Max value for a process ID (change this to match your implementation) */
 #define __PID_MAX       32767
 
-/* Max open files per process */
-#define __OPEN_MAX      32
+/* Max open files per process (the file table grows to this as needed) */
+#define __OPEN_MAX      1024
 
 /* Max bytes for atomic pipe I/O -- see description in the pipe() man page */
 #define __PIPE_BUF      512
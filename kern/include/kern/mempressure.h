@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2004, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_MEMPRESSURE_H_
+#define _KERN_MEMPRESSURE_H_
+
+/*
+ * Memory pressure, as reported by the mempressure() system call.
+ *
+ * The level goes up as soon as free memory falls under one of the
+ * pager's watermarks and back to MEMPRESSURE_NONE once the pager has
+ * refilled it. Programs that keep caches can wait for it to change
+ * and shrink them while it is raised, before anybody actually runs
+ * out. Passing a level that can't be current (MEMPRESSURE_ANY)
+ * returns the state straight away.
+ */
+#define MEMPRESSURE_ANY		(-1)	/* don't wait */
+#define MEMPRESSURE_NONE	0	/* plenty of free memory */
+#define MEMPRESSURE_LOW		1	/* the pager is reclaiming */
+#define MEMPRESSURE_CRITICAL	2	/* nearly out, allocations wait */
+
+struct mempressure {
+	int mp_level;			/* MEMPRESSURE_* */
+	__u32 mp_free;			/* free page frames */
+	__u32 mp_lowater;		/* frames free at MEMPRESSURE_LOW */
+	__u32 mp_minwater;		/* frames free at MEMPRESSURE_CRITICAL */
+};
+
+#endif /* _KERN_MEMPRESSURE_H_ */
@@ -0,0 +1,29 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Flags for mmap(), shared between the kernel and libc's <sys/mman.h>.
+ */
+
+/* Page protection (the prot argument) */
+#define PROT_NONE     0x0     /* Pages may not be accessed */
+#define PROT_READ     0x1     /* Pages may be read */
+#define PROT_WRITE    0x2     /* Pages may be written */
+#define PROT_EXEC     0x4     /* Pages may be executed */
+
+/* Mapping type (the flags argument); exactly one of these is required */
+#define MAP_SHARED    0x0001  /* Writes go back to the file (and are seen by forked children) */
+#define MAP_PRIVATE   0x0002  /* Writes are private to this process */
+
+/* Additional flags */
+#define MAP_FIXED     0x0010  /* Use addr exactly (not supported) */
+#define MAP_ANON      0x1000  /* Not backed by a file, fd is ignored */
+
+/* Advice for madvise() */
+#define MADV_NORMAL     0     /* No particular access pattern */
+#define MADV_RANDOM     1     /* Expect random accesses */
+#define MADV_SEQUENTIAL 2     /* Expect sequential accesses */
+#define MADV_WILLNEED   3     /* Will be needed soon */
+#define MADV_DONTNEED   4     /* Contents can be dropped, reads give zeroes (or the file) afterwards */
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,34 @@
+#ifndef _KERN_POLL_H_
+#define _KERN_POLL_H_
+
+/*
+ * Definitions for poll.
+ *
+ * poll waits until one of the open files in an array of pollfds is
+ * ready for what its events ask (or TIMEOUT milliseconds go by; -1 is
+ * forever, 0 is just look) and returns how many are, each with
+ * revents set to what it's ready for. POLLERR, POLLHUP and POLLNVAL
+ * are reported whether they were asked for or not. A negative fd is
+ * skipped and gets revents 0.
+ *
+ * Readiness is what a read or write would do: not wait. That's so
+ * for regular files and directories always; for pipes, the console,
+ * semfs semaphores (POLLIN once the count isn't 0) and sockets it
+ * depends. A pipe whose other end has gone is POLLHUP (and POLLIN,
+ * as a read would return 0) for reading and POLLERR for writing.
+ */
+
+struct pollfd {
+	int fd;
+	short events;		/* what to wait for */
+	short revents;		/* what it's ready for */
+};
+
+#define POLLIN		0x0001	/* can read without waiting */
+#define POLLPRI		0x0002	/* (never set) */
+#define POLLOUT		0x0004	/* can write without waiting */
+#define POLLERR		0x0008	/* a write would fail */
+#define POLLHUP		0x0010	/* the other end is gone */
+#define POLLNVAL	0x0020	/* fd isn't open */
+
+#endif /* _KERN_POLL_H_ */
@@ -67,6 +67,12 @@ struct rusage {
 	__counter_t ru_nsignals;	/* signals delivered (count) */
 	__counter_t ru_nvcsw;		/* voluntary context switches (count)*/
 	__counter_t ru_nivcsw;		/* involuntary ditto (count) */
+
+	/* OS/161 extensions: VM counters that have no field above */
+	__counter_t ru_tlbmiss;		/* TLB misses handled by vm_fault (count) */
+	__counter_t ru_zerofill;	/* pages zero filled on first write (count) */
+	__counter_t ru_cowcopy;		/* copy-on-write copies (count) */
+	__size_t ru_rss;		/* current resident set (kb) */
 };
 
 /* limit codes for getrusage/setrusage */
@@ -0,0 +1,42 @@
+#ifndef _KERN_SCHED_H_
+#define _KERN_SCHED_H_
+
+/*
+ * Scheduling classes, for sched_setattr and sched_getattr.
+ *
+ * SCHED_OTHER is the usual time sharing: a multi-level feedback queue
+ * that moves CPU-bound threads down and keeps interactive ones up.
+ * The other two are real-time, and always run before any of it:
+ *
+ * SCHED_FIFO threads run at a fixed priority, from 1 up to
+ * SCHED_FIFO_MAXPRIO (the best), until they block or yield or one of
+ * better priority wants the cpu; there's no time slice. They can keep
+ * everything below them off the cpu, so use them for short bursts.
+ *
+ * SCHED_DEADLINE threads get sa_budget milliseconds of cpu in every
+ * sa_period, before every FIFO thread, earliest deadline (the end of
+ * the period) first. A thread that has used up its budget is time
+ * shared like a SCHED_OTHER one until its next period. Setting it
+ * fails with EBUSY if all the deadline threads together would ask
+ * for more than SCHED_DEADLINE_MAXUTIL thousandths of the cpus, so
+ * the ones admitted can all be given what they asked for.
+ *
+ * The kernel works in clock ticks, so times are rounded up to whole
+ * ticks: 1000/HZ milliseconds, 10ms on System/161.
+ */
+
+#define SCHED_OTHER		0
+#define SCHED_FIFO		1
+#define SCHED_DEADLINE		2
+
+#define SCHED_FIFO_MAXPRIO	4
+#define SCHED_DEADLINE_MAXUTIL	900	/* of 1000 per cpu */
+
+struct sched_attr {
+	int sa_policy;		/* SCHED_* */
+	unsigned sa_priority;	/* SCHED_FIFO: 1 to SCHED_FIFO_MAXPRIO */
+	unsigned sa_budget;	/* SCHED_DEADLINE: ms per period */
+	unsigned sa_period;	/* SCHED_DEADLINE: ms */
+};
+
+#endif /* _KERN_SCHED_H_ */
@@ -43,5 +43,9 @@
 #define SEEK_CUR      1      /* Seek relative to current position in file */
 #define SEEK_END      2      /* Seek relative to end of file */
 
+/* Where the data or holes of a sparse file are */
+#define SEEK_DATA     3      /* Next data at or after the offset */
+#define SEEK_HOLE     4      /* Next hole at or after the offset */
+
 
 #endif /* _KERN_SEEK_H_ */
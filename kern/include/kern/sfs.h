@@ -44,6 +44,8 @@
 #define SFS_NDINDIRECT    0             /* # of 2x indirect blocks in inode */
 #define SFS_NTINDIRECT    0             /* # of 3x indirect blocks in inode */
 #define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
+#define SFS_NEXTENTS      62            /* # of extents in extent inode */
+#define SFS_INLINESIZE    500           /* bytes of data in inline inode */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SUPER_BLOCK   0             /* block the superblock lives in */
 #define SFS_FREEMAP_START 2             /* 1st block of the freemap */
@@ -62,11 +64,21 @@
 /* Size of free block bitmap (in blocks) */
 #define SFS_FREEMAPBLOCKS(nblocks)  (SFS_FREEMAPBITS(nblocks)/SFS_BITSPERBLOCK)
 
+/* Superblock feature flags, for sb_features */
+#define SFS_FEATURE_EXTENTS  0x1  /* inodes hold extents, not block lists */
+#define SFS_FEATURE_INLINE   0x2  /* small files may live in their inode */
+#define SFS_FEATURE_JOURNAL  0x4  /* metadata changes go through a journal */
+#define SFS_FEATURES_KNOWN   (SFS_FEATURE_EXTENTS | SFS_FEATURE_INLINE | \
+			      SFS_FEATURE_JOURNAL)
+
 /* File types for sfi_type */
 #define SFS_TYPE_INVAL    0       /* Should not appear on disk */
 #define SFS_TYPE_FILE     1
 #define SFS_TYPE_DIR      2
 
+/* Inode flags for sfi_flags */
+#define SFS_INODE_INLINE  0x1     /* contents are in sfi_data */
+
 /*
  * On-disk superblock
  */
@@ -74,19 +86,88 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_features;			/* SFS_FEATURE_* flags */
+	uint32_t sb_journalstart;		/* First journal block, or 0 */
+	uint32_t sb_journalblocks;		/* Journal size in blocks */
+	uint32_t reserved[115];			/* unused, set to 0 */
+};
+
+/*
+ * A run of file blocks in an extent inode: LEN blocks from disk
+ * block START on, or a hole of LEN blocks if START is 0. The extents
+ * map the file from its first block on, in order.
+ */
+struct sfs_extent {
+	uint32_t sfe_start;			/* First disk block, or 0 */
+	uint32_t sfe_len;			/* Number of blocks */
 };
 
 /*
- * On-disk inode
+ * On-disk inode. On a volume with SFS_FEATURE_EXTENTS every inode
+ * holds extents; otherwise every inode holds direct blocks and an
+ * indirect block. On a volume with SFS_FEATURE_INLINE a regular file
+ * may instead hold its contents (up to SFS_INLINESIZE bytes) in the
+ * same space, if SFS_INODE_INLINE is set; the bytes past the end of
+ * the file are then 0.
  */
 struct sfs_dinode {
 	uint32_t sfi_size;			/* Size of this file (bytes) */
 	uint16_t sfi_type;			/* One of SFS_TYPE_* above */
 	uint16_t sfi_linkcount;			/* # hard links to this file */
-	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
-	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	union {
+		struct {
+			uint32_t sfi_direct[SFS_NDIRECT];  /* Direct blocks */
+			uint32_t sfi_indirect;		   /* Indirect block */
+			uint32_t sfi_waste[128-4-SFS_NDIRECT]; /* unused, 0 */
+		};
+		struct {
+			uint32_t sfi_nextents;		   /* Extents in use */
+			struct sfs_extent sfi_extents[SFS_NEXTENTS];
+		};
+		char sfi_data[SFS_INLINESIZE];		/* Inline contents */
+	};
+	uint32_t sfi_flags;			/* SFS_INODE_* flags */
+};
+
+/*
+ * The journal, on a volume with SFS_FEATURE_JOURNAL: sb_journalblocks
+ * blocks from sb_journalstart on. The first is a header; the rest are
+ * the log, used as a ring. The log holds transactions, each one or
+ * more descriptor blocks that each list the disk blocks whose new
+ * contents follow it, and then a commit block. A transaction counts
+ * only if its commit block is there and the checksum in it matches.
+ *
+ * The header gives the log position (0 is the block after the
+ * header) and sequence number of the oldest transaction that may not
+ * be in place yet; the ones after it, if any, follow it in the log
+ * with the numbers after its. Mounting the volume puts them in place.
+ */
+#define SFS_JMAGIC_HEADER 0x4a484452    /* "JHDR" */
+#define SFS_JMAGIC_DESC   0x4a445343    /* "JDSC" */
+#define SFS_JMAGIC_COMMIT 0x4a434d54    /* "JCMT" */
+#define SFS_JTAGS         125           /* blocks listed per descriptor */
+#define SFS_JMINBLOCKS    16            /* smallest journal allowed */
+
+struct sfs_jheader {
+	uint32_t jh_magic;			/* SFS_JMAGIC_HEADER */
+	uint32_t jh_tail;			/* Log position of oldest */
+	uint32_t jh_seq;			/* ... and its sequence number */
+	uint32_t jh_waste[125];			/* unused, 0 */
+};
+
+struct sfs_jdesc {
+	uint32_t jd_magic;			/* SFS_JMAGIC_DESC */
+	uint32_t jd_seq;			/* Transaction sequence number */
+	uint32_t jd_ntags;			/* Blocks listed in jd_tags */
+	uint32_t jd_tags[SFS_JTAGS];		/* Where they go, in order */
+};
+
+struct sfs_jcommit {
+	uint32_t jc_magic;			/* SFS_JMAGIC_COMMIT */
+	uint32_t jc_seq;			/* Transaction sequence number */
+	uint32_t jc_nblocks;			/* Blocks in the transaction */
+	uint32_t jc_checksum;			/* Of descriptors and blocks */
+	uint32_t jc_waste[124];			/* unused, 0 */
 };
 
 /*
@@ -0,0 +1,22 @@
+#ifndef _KERN_SHM_H_
+#define _KERN_SHM_H_
+
+/*
+ * Flags for shmget(), shmat() and shmctl(), shared between the kernel
+ * and libc's <sys/shm.h>.
+ */
+
+/* Key that always makes a new segment, one only its id can find */
+#define IPC_PRIVATE   0
+
+/* shmget flags (the low 9 bits are permission bits, which are ignored) */
+#define IPC_CREAT     001000  /* Create the segment if the key has none */
+#define IPC_EXCL      002000  /* With IPC_CREAT, fail if it already exists */
+
+/* shmat flags */
+#define SHM_RDONLY    010000  /* Attach read only */
+
+/* shmctl commands */
+#define IPC_RMID      0       /* Remove the id; memory goes with the last detach */
+
+#endif /* _KERN_SHM_H_ */
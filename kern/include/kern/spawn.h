@@ -0,0 +1,31 @@
+#ifndef _KERN_SPAWN_H_
+#define _KERN_SPAWN_H_
+
+/*
+ * Definitions for spawn().
+ *
+ * spawn starts a new process running a program, without copying the
+ * caller the way fork does. The child's file table starts as a copy
+ * of the caller's, and then the file actions are done to it in order,
+ * as if by the child calling open, close and dup2. If any of them
+ * fails, so does spawn.
+ */
+
+/* File actions. */
+#define SPAWN_OPEN	1	/* open sa_path with sa_flags/sa_mode on sa_fd */
+#define SPAWN_CLOSE	2	/* close sa_fd */
+#define SPAWN_DUP2	3	/* dup2(sa_fd, sa_newfd) */
+
+struct spawn_action {
+	int sa_op;		/* SPAWN_* */
+	int sa_fd;
+	int sa_newfd;		/* SPAWN_DUP2 only */
+	int sa_flags;		/* SPAWN_OPEN only */
+	mode_t sa_mode;		/* SPAWN_OPEN only */
+	const char *sa_path;	/* SPAWN_OPEN only */
+};
+
+/* Most file actions one spawn can take. */
+#define SPAWN_ACTIONS_MAX	64
+
+#endif /* _KERN_SPAWN_H_ */
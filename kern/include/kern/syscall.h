@@ -59,7 +59,7 @@
 #define SYS_mmap         8
 #define SYS_munmap       9
 #define SYS_mprotect     10
-//#define SYS_madvise    11
+#define SYS_madvise      11
 //#define SYS_mincore    12
 //#define SYS_mlock      13
 //#define SYS_munlock    14
@@ -86,10 +86,10 @@
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
 //#define SYS_wait4      34
-//#define SYS_getrusage  35
+#define SYS_getrusage    35
 //                              (resource limits)
-//#define SYS_getrlimit  36
-//#define SYS_setrlimit  37
+#define SYS_getrlimit    36
+#define SYS_setrlimit    37
 //                              (process priority control)
 //#define SYS_getpriority 38
 //#define SYS_setpriority 39
@@ -109,12 +109,12 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
+#define SYS_readv        52
 //#define SYS_preadv     53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
+#define SYS_writev       57
 //#define SYS_pwritev    58
 #define SYS_lseek        59
 #define SYS_flock        60
@@ -180,8 +180,8 @@
 #define SYS_getpeername  106
 #define SYS_getsockopt   107
 #define SYS_setsockopt   108
-//#define SYS_recvfrom   109
-//#define SYS_sendto     110
+#define SYS_recvfrom     109
+#define SYS_sendto       110
 //#define SYS_recvmsg    111
 //#define SYS_sendmsg    112
 
@@ -196,6 +196,42 @@
 #define SYS_sync         118
 #define SYS_reboot       119
 //#define SYS___sysctl   120
+#define SYS_kheapstats   121
+#define SYS_sched_setaffinity 122
+#define SYS_sched_getaffinity 123
+#define SYS_futex_wait   124
+#define SYS_futex_wake   125
+#define SYS_spawn        126
+#define SYS___thr_create 127
+#define SYS_thr_exit     128
+#define SYS_thr_join     129
+#define SYS_copy_file_range 130
+#define SYS_ioring_enter 131
+#define SYS_aio_read     132
+#define SYS_aio_write    133
+#define SYS_aio_wait     134
+#define SYS_getdirentries 135
+#define SYS_systrace     136
+#define SYS_systrace_read 137
+#define SYS_systrace_stats 138
+#define SYS_dmesg        139
+#define SYS_sem_op       140
+#define SYS_shmget       141
+#define SYS_shmat        142
+#define SYS_shmdt        143
+#define SYS_shmctl       144
+#define SYS_mempressure  145
+#define SYS_fdatasync    146
+#define SYS_sync_file_range 147
+#define SYS_sched_setattr 148
+#define SYS_sched_getattr 149
+#define SYS_openat       150
+#define SYS_mkdirat      151
+#define SYS_unlinkat     152
+#define SYS_fstatat      153
+#define SYS_fallocate    154
+#define SYS_ioprio_set   155
+#define SYS_ioprio_get   156
 
 /*CALLEND*/
 
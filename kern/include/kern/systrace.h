@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_SYSTRACE_H_
+#define _KERN_SYSTRACE_H_
+
+/*
+ * Per-process system call tracing, for systrace(), systrace_read()
+ * and systrace_stats().
+ *
+ * systrace(pid, flags) turns tracing of a process (0 for the caller,
+ * otherwise one of its children) on or off. It stays on across
+ * execv, but a forked child starts without it. With SYSTRACE_RECORDS
+ * every call that returns is put in a record for systrace_read,
+ * which takes them oldest first; if the reader falls behind, records
+ * are lost, and the next read starts with a SYSTRACE_DROPPED record
+ * saying how many. systrace_read waits until there is something to
+ * read, and returns 0 only once the process has exited and
+ * everything has been read (so read first, then waitpid). With
+ * SYSTRACE_STATS the time every call takes goes in a histogram for
+ * its call number, which systrace_stats copies out.
+ *
+ * Calls that don't return (_exit, a successful execv) have no record.
+ * Times are from when the call entered the kernel until it was about
+ * to return, so they include any time spent waiting.
+ */
+
+#define SYSTRACE_RECORDS	1	/* keep records for systrace_read */
+#define SYSTRACE_STATS		2	/* keep latency histograms */
+
+/* sr_callno of the record that says sr_retval records were lost */
+#define SYSTRACE_DROPPED	0xffffffff
+
+struct systrace_rec {
+	__u32 sr_callno;		/* SYS_* */
+	__u32 sr_args[4];		/* a0-a3 as they were passed */
+	__i32 sr_retval;		/* return value, if sr_err is 0 */
+	__i32 sr_err;			/* errno, or 0 */
+	__u32 sr_nsecs;			/* how long the call took */
+};
+
+/*
+ * Bucket 0 counts calls that took under 1 microsecond, bucket N
+ * (from 1) ones that took at least 2^(N-1) and under 2^N, and the
+ * last one everything longer.
+ */
+#define SYSTRACE_NBUCKETS	16
+
+struct systrace_stat {
+	__u32 ss_callno;		/* SYS_* */
+	__u32 ss_count;			/* calls */
+	__u32 ss_errors;		/* of which failed */
+	__u32 ss_maxns;			/* slowest */
+	__u64 ss_totalns;		/* all of them */
+	__u32 ss_hist[SYSTRACE_NBUCKETS];
+};
+
+#endif /* _KERN_SYSTRACE_H_ */
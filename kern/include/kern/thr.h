@@ -0,0 +1,11 @@
+#ifndef _KERN_THR_H_
+#define _KERN_THR_H_
+
+/*
+ * Size of the user stack of each thread thr_create makes (the first
+ * thread of a process has the usual one). The stack is mmap'd, so it
+ * starts and ends on a page boundary.
+ */
+#define THR_STACKSIZE	(64 * 1024)
+
+#endif /* _KERN_THR_H_ */
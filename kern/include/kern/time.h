@@ -51,6 +51,32 @@ struct timespec {
 };
 
 
+/*
+ * Clocks for clock_gettime.
+ */
+#define CLOCK_REALTIME	0	/* Time of day. */
+#define CLOCK_MONOTONIC	1	/* Time since boot; never goes back. */
+
+/*
+ * The time page. The kernel keeps its clock (the time of day and the
+ * time since boot, each good to a clock tick) in this page and maps
+ * it read-only at TIMEPAGE in every user address space, so reading
+ * the time doesn't need a system call. tp_seq is odd while the kernel
+ * is changing the page; a reader reads tp_seq, the times, and tp_seq
+ * again, and tries again unless both reads got the same even number.
+ *
+ * TIMEPAGE is the page above the highest mmap address, in the gap
+ * below the stack.
+ */
+#define TIMEPAGE	0x7f000000
+
+struct timepage {
+	volatile __u32 tp_seq;
+	__u32 tp_hz;			/* clock ticks per second */
+	struct timespec tp_now;		/* time of day */
+	struct timespec tp_uptime;	/* time since boot */
+};
+
 /*
  * Bits for interval timers. Obscure and not really that important.
  */
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_TRACE_H_
+#define _KERN_TRACE_H_
+
+/*
+ * Format of the kernel trace log written by "trace save" (see
+ * trace.h), for programs that read it offline.
+ *
+ * The file is a struct tracefile_header and then th_nrecs records of
+ * th_recsize bytes, one cpu after another with each cpu's oldest
+ * first. All fields are in the machine's byte order (big-endian on
+ * System/161). tr_time is cycles since that cpu started; th_cyclerate
+ * gives cycles per second. On System/161 all the cpus start together,
+ * so the times of different cpus can be compared.
+ */
+
+#define TRACEFILE_MAGIC		0x4b545243	/* "KTRC" */
+#define TRACEFILE_VERSION	1
+
+struct tracefile_header {
+	__u32 th_magic;			/* TRACEFILE_MAGIC */
+	__u32 th_version;		/* TRACEFILE_VERSION */
+	__u32 th_cyclerate;		/* cycles per second */
+	__u32 th_ncpus;
+	__u32 th_nrecs;			/* records after the header */
+	__u32 th_recsize;		/* sizeof(struct trace_rec) */
+};
+
+struct trace_rec {
+	__u64 tr_time;			/* cycles, on cpu tr_cpu */
+	__u16 tr_type;			/* TR_* */
+	__u16 tr_cpu;
+	__i32 tr_pid;			/* current process, or -1 */
+	__u32 tr_arg1;			/* see below */
+	__u32 tr_arg2;
+};
+
+/*
+ * Record types. The high nibble is the class, which is what gets
+ * turned on and off: class N is bit N of the trace mask.
+ *
+ *                         arg1             arg2
+ */
+#define TR_SYSCALL	0x10	/* call number      first argument */
+#define TR_SYSRET	0x11	/* call number      errno, or 0 */
+#define TR_FAULT	0x20	/* fault address    fault type */
+#define TR_FAULTDONE	0x21	/* fault address    errno, or 0 */
+#define TR_BIOSUBMIT	0x30	/* first sector     sectors; top bit set if write */
+#define TR_BIODONE	0x31	/* first sector     errno, or 0 */
+#define TR_SWITCH	0x40	/* old thread       new thread (tr_pid is new's) */
+#define TR_LOCKWAIT	0x50	/* lock             caller's return address */
+#define TR_LOCKGOT	0x51	/* lock             0 if got spinning, 1 if queued */
+
+#define TR_CLASS(type)	((type) >> 4)
+
+#define TRACE_SYSCALLS	(1U << TR_CLASS(TR_SYSCALL))
+#define TRACE_FAULTS	(1U << TR_CLASS(TR_FAULT))
+#define TRACE_BIO	(1U << TR_CLASS(TR_BIOSUBMIT))
+#define TRACE_SWITCHES	(1U << TR_CLASS(TR_SWITCH))
+#define TRACE_LOCKS	(1U << TR_CLASS(TR_LOCKWAIT))
+#define TRACE_ALL	(TRACE_SYSCALLS | TRACE_FAULTS | TRACE_BIO | \
+			 TRACE_SWITCHES | TRACE_LOCKS)
+
+#endif /* _KERN_TRACE_H_ */
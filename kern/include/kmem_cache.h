@@ -0,0 +1,54 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+#include <types.h>
+#include <spinlock.h>
+
+/*
+ * Typed object caches (see vm/kmem_cache.c). A cache hands out objects of one size that its constructor has already
+ * set up (allocated their locks, wait channels, ...). kmem_cache_free keeps the object as it is, so the next
+ * kmem_cache_alloc gets it back still constructed and the constructor only runs for objects made from scratch. The
+ * destructor runs when an object really goes back to kmalloc. Objects must be freed in their constructed state.
+ *
+ * A type safe cache never gives its objects back to kmalloc, so memory that once held one of them always holds one
+ * (live or free). Code that looks an object up without a lock and then takes a reference with atomic_inc_not_zero
+ * relies on this: if the object was freed meanwhile the count is 0 and the increment fails, and if it was reused the
+ * caller finds out when it checks the object is still the one it looked up.
+ */
+struct kmem_obj;
+
+struct kmem_cache {
+    const char *kc_name;
+    size_t kc_size;                /* object size */
+    int (*kc_ctor)(void *obj);     /* constructor (may be NULL), returns 0 or an errno */
+    void (*kc_dtor)(void *obj);    /* destructor (may be NULL) */
+    unsigned kc_tag;               /* kmalloc_tagged tag the objects are charged to */
+
+    struct spinlock kc_lock;       /* protects the rest */
+    struct kmem_obj *kc_free;      /* constructed free objects */
+    unsigned kc_nfree;             /* number of objects on kc_free */
+    unsigned kc_nlive;             /* number of objects handed out */
+    bool kc_typesafe;              /* keep every free object, see above */
+};
+
+/* free objects a cache keeps before it starts giving them back to kmalloc */
+#define KMEM_CACHE_MAXFREE 16
+
+/* caches used before the allocator is up (thread, proc, lock, ...) are static and set up with this */
+#define KMEM_CACHE_INITIALIZER(name, type, ctor, dtor, tag) \
+    { name, sizeof(type), ctor, dtor, tag, SPINLOCK_INITIALIZER, NULL, 0, 0, false }
+#define KMEM_CACHE_TYPESAFE_INITIALIZER(name, type, ctor, dtor, tag) \
+    { name, sizeof(type), ctor, dtor, tag, SPINLOCK_INITIALIZER, NULL, 0, 0, true }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, int (*ctor)(void *), void (*dtor)(void *),
+                                     unsigned tag);
+void kmem_cache_destroy(struct kmem_cache *kc);
+
+/* get a constructed object (NULL if out of memory or the constructor failed) / give it back */
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+
+/* destruct and release every free object the cache is holding (not for type safe caches, those keep them) */
+void kmem_cache_reap(struct kmem_cache *kc);
+
+#endif /* _KMEM_CACHE_H_ */
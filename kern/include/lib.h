@@ -125,10 +125,41 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ *
+ * kheap_getstats and kheap_printcounts report the per-size-class
+ * counters of options kheapstats; kheap_getstats returns 0 without it.
+ * kheap_printfrag prints how much of the subpage allocator's pages is
+ * free, by size class.
+ *
+ * kmalloc_tagged is kmalloc charged to subsystem TAG (one of the KM_
+ * values, not a mask); plain kmalloc charges KM_OTHER. With options
+ * kmtags the live bytes and allocs and frees of each tag are kept,
+ * and kheap_formattags prints them in the style of the stats groups
+ * (see stats.h) at POS of BUF, returning the new end. Without the
+ * option it prints nothing. kheap_printtags prints each tag's live
+ * bytes on the console, on one line.
  */
+#define KM_OTHER	0	/* untagged */
+#define KM_THREAD	1	/* threads, cpus, synchronization */
+#define KM_PROC		2	/* processes, file tables, syscalls */
+#define KM_VM		3	/* address spaces, swap, shared memory */
+#define KM_VFS		4	/* vnodes, names, pipes, device queues */
+#define KM_BUFCACHE	5	/* the buffer cache */
+#define KM_FS		6	/* file systems */
+#define KM_DEV		7	/* device drivers */
+#define KM_NET		8	/* networking */
+#define KM_NTAGS	9
+
+struct kheapstats;
 void *kmalloc(size_t size);
+void *kmalloc_tagged(size_t size, unsigned tag);
 void kfree(void *ptr);
+size_t kheap_formattags(char *buf, size_t len, size_t pos);
+void kheap_printtags(void);
 void kheap_printstats(void);
+unsigned kheap_getstats(struct kheapstats *ks, unsigned max);
+void kheap_printcounts(void);
+void kheap_printfrag(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
@@ -174,10 +205,19 @@ void beep(void);
  * badassert calls panic in a way suitable for an assertion failure.
  * kgets is like gets, only with a buffer size argument.
  *
- * kprintf_bootstrap sets up a lock for kprintf and should be called
+ * kprintf_bootstrap sets up a lock for kprintf and starts the thread
+ * that prints kprintf output (see kprintf.c), and should be called
  * during boot once malloc is available and before any additional
- * threads are created.
+ * threads are created. kprintf_shutdown waits for all the output to
+ * be printed and makes kprintf print directly again; it's called
+ * during shutdown.
+ *
+ * klog_read copies the last LEN bytes printed on the console (the
+ * kernel log, which keeps KLOG_SIZE bytes) into BUF and returns how
+ * many there were. klog_dump prints the log on the console.
  */
+#define KLOG_SIZE 8192	/* must be a power of 2 */
+
 int kprintf(const char *format, ...) __PF(1,2);
 __DEAD void panic(const char *format, ...) __PF(1,2);
 __DEAD void badassert(const char *expr, const char *file,
@@ -186,6 +226,9 @@ __DEAD void badassert(const char *expr, const char *file,
 void kgets(char *buf, size_t maxbuflen);
 
 void kprintf_bootstrap(void);
+void kprintf_shutdown(void);
+size_t klog_read(char *buf, size_t len);
+int klog_dump(void);
 
 /*
  * Other miscellaneous stuff
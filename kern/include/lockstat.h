@@ -0,0 +1,79 @@
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics (options lockstats).
+ *
+ * Counters are kept per lock class: all the locks set up from one call
+ * site (the caller of spinlock_init, lock_create or cv_create) share a
+ * class. A spinlock set up with SPINLOCK_INITIALIZER is a class of its
+ * own. Classes live in a fixed table and are never freed, so a lock
+ * that goes away without being cleaned up leaves nothing dangling.
+ * A lock finds its class the first time it is taken after curcpu
+ * exists; nothing is recorded before that.
+ *
+ * For spinlocks and locks a class counts acquisitions, how many of
+ * them had to wait, the total time spent waiting, and the longest time
+ * one was held. It also remembers where a lock was taken the last time
+ * somebody had to wait for it. For CVs, acquisitions are waits and the
+ * wait time is the time spent asleep. Times are in cycles (see
+ * mainbus_cycles).
+ *
+ * This header is included by spinlock.h; don't include it directly.
+ *
+ * Functions (in lockstat.c):
+ *    lockstat_acquired - record that the lock owning LH was just taken
+ *                        from SITE. If WAITED, we started waiting at
+ *                        START, and BLOCKER was where its holder had
+ *                        taken it.
+ *    lockstat_released - record that the lock owning LH is being let
+ *                        go.
+ *    lockstat_slept    - record a CV wait that started at START.
+ *    lockstat_dump     - print the N classes with the most wait time.
+ */
+
+#include "opt-lockstats.h"
+
+#define LS_SPINLOCK	0
+#define LS_LOCK		1
+#define LS_CV		2
+
+#define LOCKSTAT_NAMELEN 16
+
+#if OPT_LOCKSTATS
+
+/* One lock class. The counters are protected by ls_busy. */
+struct lockstat {
+	const void *ls_site;		/* where they're set up (the key) */
+	unsigned ls_kind;		/* LS_* */
+	char ls_name[LOCKSTAT_NAMELEN];	/* name of the first one, if any */
+	volatile spinlock_data_t ls_busy;
+	const void *ls_blocker;		/* holder's site when we last waited */
+	uint64_t ls_acquires;
+	uint64_t ls_contended;
+	uint64_t ls_waittime;
+	uint64_t ls_maxhold;
+};
+
+/* What each lock carries around. */
+struct lockstat_hold {
+	struct lockstat *lh_class;	/* NULL until first taken */
+	unsigned lh_kind;		/* LS_* */
+	const char *lh_name;		/* the lock's own name, or NULL */
+	const void *lh_site;		/* setup site, then while held the */
+					/* site that took it */
+	uint64_t lh_stamp;		/* when it was taken */
+};
+
+#define LOCKSTAT_HOLD_INITIALIZER { NULL, LS_SPINLOCK, NULL, NULL, 0 }
+
+void lockstat_acquired(struct lockstat_hold *lh, bool waited,
+		       uint64_t start, const void *blocker, const void *site);
+void lockstat_released(struct lockstat_hold *lh);
+void lockstat_slept(struct lockstat_hold *lh, uint64_t start);
+
+#endif /* OPT_LOCKSTATS */
+
+void lockstat_dump(unsigned n);
+
+#endif /* _LOCKSTAT_H_ */
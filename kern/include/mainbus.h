@@ -55,6 +55,26 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/* Send the interrupts of device slot SLOT only to cpu CPUNUM. */
+int mainbus_route_interrupt(int slot, unsigned cpunum);
+
+/* Cycles this cpu has run since it started, and cycles per second. */
+uint64_t mainbus_cycles(void);
+uint32_t mainbus_cyclerate(void);
+/* mainbus_cycles for when interrupts are already off, without any spl. */
+uint64_t mainbus_cycles_irqoff(void);
+
+/*
+ * Stopping this cpu's hardclock while it's idle (see clock.c). Call
+ * with interrupts off. mainbus_tickcatchup calls hardclock_missed
+ * for the whole ticks that have gone by without an interrupt;
+ * mainbus_tickless has the next interrupt come TICKS ticks after the
+ * last one accounted for (or as soon as it can, if that's past), and
+ * 1 is the normal periodic tick.
+ */
+void mainbus_tickcatchup(void);
+void mainbus_tickless(unsigned ticks);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
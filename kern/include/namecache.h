@@ -0,0 +1,37 @@
+#ifndef _NAMECACHE_H_
+#define _NAMECACHE_H_
+
+/*
+ * Name cache: the results of recent lookups, so that looking the same
+ * path up again doesn't go to the file system. An entry is named by
+ * the directory the lookup started from and the path looked up in
+ * it, and holds the vnode found (with a reference) or, for a
+ * negative entry, the fact that the name doesn't exist.
+ *
+ * The VFS layer keeps the cache right by purging entries after every
+ * operation that changes names: whatever it creates or removes, all
+ * entries whose path goes through that name, and for rename and rmdir
+ * every entry of the file system. Unmount purges the file system's
+ * entries first, so they don't keep it busy.
+ *
+ * Only paths of plain names are cached; one with "." or ".." in it,
+ * or longer than the cache's limit, is always looked up.
+ *
+ * Functions:
+ *    ncache_bootstrap - set up the cache.
+ *    ncache_lookup    - VOP_LOOKUP, through the cache. May destroy
+ *                       the path, like VOP_LOOKUP.
+ *    ncache_purgename - forget the entries of DIR's file system
+ *                       whose path has NAME as a component.
+ *    ncache_purgefs   - forget every entry of a file system.
+ */
+
+struct fs;
+struct vnode;
+
+void ncache_bootstrap(void);
+int ncache_lookup(struct vnode *dir, char *path, struct vnode **ret);
+void ncache_purgename(struct vnode *dir, const char *name);
+void ncache_purgefs(struct fs *fs);
+
+#endif /* _NAMECACHE_H_ */
@@ -0,0 +1,127 @@
+#ifndef _NET_H_
+#define _NET_H_
+
+/*
+ * Network layer: packet buffers, the network interface, and datagram
+ * sockets (AF_LNET, SOCK_DGRAM) on top of them.
+ *
+ * Packets live in netbufs from a fixed pool that's allocated at boot.
+ * A received frame is put into one by the driver, at interrupt time,
+ * and that same netbuf is what gets queued on the socket it's for and
+ * handed to recvfrom, which copies the data out and frees it. Sending
+ * works the same way downwards: sendto copies the data into a netbuf
+ * and it goes to the driver as it is. So data is copied only across
+ * the user/kernel boundary and in and out of the device's buffers.
+ *
+ * A datagram is a small header (ports and length) after the link
+ * header, then the data. There's at most one interface; datagrams to
+ * this node's own address (or LNADDR_LOCAL) don't go near it, so
+ * sockets work between processes on one machine even without one.
+ *
+ *    netbuf_get    - take a netbuf from the pool. If it's empty,
+ *                    wait for one if WAIT, else return NULL (which
+ *                    is what interrupt handlers have to do).
+ *    netbuf_put    - give one back.
+ *    net_attach    - make IFP the interface; called by its driver.
+ *                    EBUSY if there already is one.
+ *    net_input     - hand up a frame received by IFP (from an
+ *                    interrupt handler); the netbuf is the net
+ *                    layer's after this.
+ *    net_bootstrap - set up the pool; called once during boot,
+ *                    before devices are probed. The buffers are
+ *                    allocated later, by a work item.
+ */
+
+#include <kern/socket.h>
+
+/* Largest frame. One netbuf's data is one page. */
+#define NETBUF_SIZE	4096
+
+/* Number of netbufs in the pool. */
+#define NETBUF_COUNT	32
+
+struct netbuf {
+	struct netbuf *nb_next;		/* on a free list or queue */
+	char *nb_data;			/* NETBUF_SIZE bytes of frame */
+	unsigned nb_len;		/* bytes of frame in nb_data */
+
+	/* filled in on input, for recvfrom */
+	unsigned nb_off;		/* where the data starts */
+	unsigned nb_datalen;		/* how much there is */
+	uint16_t nb_fromaddr;
+	uint16_t nb_fromport;
+};
+
+struct netif {
+	const char *if_name;
+	uint16_t if_addr;		/* our hardware address */
+	unsigned if_hdrlen;		/* link header size */
+	unsigned if_mtu;		/* largest frame, with link header */
+
+	/*
+	 * Send NB, whose link header space is at the front and not
+	 * filled in yet, to hardware address TO. The netbuf is the
+	 * driver's either way. Called in a thread; may wait for room.
+	 */
+	int (*if_output)(struct netif *ifp, struct netbuf *nb, uint16_t to);
+	void *if_data;
+};
+
+struct netbuf *netbuf_get(bool wait);
+void netbuf_put(struct netbuf *nb);
+int net_attach(struct netif *ifp);
+void net_input(struct netif *ifp, struct netbuf *nb, uint16_t from);
+void net_bootstrap(void);
+
+/*
+ * Between net.c and socket.c.
+ *
+ *    net_localaddr - this node's address.
+ *    net_hdrlen    - link header space to leave in front of a frame.
+ *    net_mtu       - largest frame, link header included.
+ *    net_output    - send the frame in NB to address TO; NB is gone
+ *                    afterwards, whatever happens.
+ *    socket_input  - deliver a received frame to its socket, or drop
+ *                    it. Callable from interrupt handlers.
+ */
+uint16_t net_localaddr(void);
+unsigned net_hdrlen(void);
+unsigned net_mtu(void);
+int net_output(struct netbuf *nb, uint16_t to);
+void socket_input(struct netbuf *nb, uint16_t from);
+
+/*
+ * Sockets. A socket is a vnode (with no file system), so it goes in
+ * the file table like anything else; read and write on it are
+ * recvfrom and sendto without addresses.
+ *
+ *    socket_create   - make a socket of the given domain, type and
+ *                      protocol (AF_LNET, SOCK_DGRAM, 0 are all
+ *                      there are).
+ *    socket_get      - the socket a vnode is, or NULL if it isn't.
+ *    socket_bind     - give a socket a local port; port 0 picks one.
+ *    socket_connect  - set the address datagrams go to by default, and
+ *                      the only one they're received from.
+ *    socket_sendto   - send UIO as a datagram to TO, or to the
+ *                      connected address if TO is NULL.
+ *    socket_recvfrom - wait for a datagram, move it into UIO (any
+ *                      that doesn't fit is lost), and return where it
+ *                      came from in FROM unless that's NULL.
+ *    socket_getname  - the socket's local address.
+ */
+
+struct vnode;
+struct uio;
+struct socket;
+
+int socket_create(int domain, int type, int protocol, struct vnode **ret);
+struct socket *socket_get(struct vnode *v);
+int socket_bind(struct socket *so, const struct sockaddr_ln *addr);
+int socket_connect(struct socket *so, const struct sockaddr_ln *addr);
+int socket_sendto(struct socket *so, struct uio *uio,
+		  const struct sockaddr_ln *to);
+int socket_recvfrom(struct socket *so, struct uio *uio,
+		    struct sockaddr_ln *from);
+void socket_getname(struct socket *so, struct sockaddr_ln *addr);
+
+#endif /* _NET_H_ */
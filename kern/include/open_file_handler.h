@@ -12,15 +12,19 @@ struct open_file_handler {
     int flags; /* file status flags */
     struct vnode *file_vn; /* pointer to the file's vnode */
     struct lock *lock; /* lock for synchronizing access to this file descriptor */
-    int reference_count; /* reference count for this file descriptor */
+    volatile unsigned reference_count; /* reference count for this file descriptor, only changed with atomic.h */
+    struct open_file_handler *reap_next; /* on the list of files waiting to be closed, see open_file_destroy_later */
 };
 
 /* constructors and destructors */
 struct open_file_handler *create_open_file(struct vnode *vn, int flags);
 void open_file_destroy(struct open_file_handler *file);
+void open_file_destroy_later(struct open_file_handler *list);
+void open_file_bootstrap(void);
 
 /* reference managment */
 void open_file_incref(struct open_file_handler *file);
+bool open_file_tryref(struct open_file_handler *file);
 void open_file_decref(struct open_file_handler *file);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef _PAGEMERGE_H_
+#define _PAGEMERGE_H_
+
+#include <types.h>
+
+/* Same-page merging (see vm/pagemerge.c) */
+
+/* start the scanner thread, which sleeps until merging is turned on. Called once during boot after swap_bootstrap */
+void pagemerge_bootstrap(void);
+
+/* turn the scanner on or off (off at boot) / print what it has merged so far */
+void pagemerge_enable(bool on);
+void pagemerge_dump(void);
+
+#endif
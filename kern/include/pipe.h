@@ -0,0 +1,23 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Pipes. A pipe is a one-page ring buffer with two vnodes (with no
+ * file system), one for each end, so the ends go in file tables like
+ * anything else and are shared across fork and dup2 the same way. The
+ * pipe goes away when both ends have been closed.
+ *
+ * Reading an empty pipe waits for data, or returns 0 (end of file) if
+ * the write end is closed. Writing waits for room as long as the read
+ * end is open, and fails with EPIPE once it isn't. Reads return
+ * whatever is there; writes don't return until all of it has gone in.
+ *
+ *    pipe_create - make a pipe; the read end goes in *READER and the
+ *                  write end in *WRITER, each with one reference.
+ */
+
+struct vnode;
+
+int pipe_create(struct vnode **reader, struct vnode **writer);
+
+#endif /* _PIPE_H_ */
@@ -0,0 +1,72 @@
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Waiting for files to be ready (for poll; see kern/poll.h).
+ *
+ * Anything whose readiness can change has a pollq, a wait queue for
+ * pollers, and calls pollq_wakeup whenever it might have become
+ * ready. A poll call has a pollset with an entry for each queue it's
+ * on, so it can sleep on all of them at once: the first pass over the
+ * files puts it on each one's queue (vop_poll calls poll_wait), then
+ * it sleeps until some queue wakes it, looks again, and takes itself
+ * off all of them at the end.
+ *
+ * vop_poll has to call poll_wait before it looks at the state, and
+ * the waker has to change the state before calling pollq_wakeup, so
+ * neither can miss the other. pollq_wakeup may be called from an
+ * interrupt handler and with spinlocks held.
+ *
+ *    pollq_init       - set up a queue.
+ *    pollq_cleanup    - tear one down; nobody can be on it.
+ *    pollq_wakeup     - wake everyone on PQ.
+ *
+ *    pollset_init     - set up a set for up to MAX queues.
+ *    pollset_cleanup  - take it off all its queues and tear it down.
+ *    pollset_sleep    - sleep until woken or TICKS go by (0 is
+ *                       forever); returns true on timeout. It doesn't
+ *                       sleep if there was a wakeup since last time.
+ *    poll_wait        - for vop_poll: put PS on PQ, unless PS is NULL
+ *                       (which means just look).
+ *    poll_killproc    - wake PROC's threads sleeping in poll, so they
+ *                       see p_thrkill (see uthread.h).
+ */
+
+#include <spinlock.h>
+
+struct proc;
+struct pollset;
+
+struct pollent {
+	struct pollset *pe_set;
+	struct pollq *pe_q;
+	struct pollent *pe_next;	/* on pe_q, under its lock */
+	struct pollent **pe_prevp;
+};
+
+struct pollq {
+	struct spinlock pq_lock;
+	struct pollent *pq_first;
+};
+
+struct pollset {
+	struct spinlock ps_lock;
+	struct wchan *ps_wchan;
+	bool ps_woken;			/* under ps_lock */
+	struct proc *ps_proc;		/* who's polling */
+	struct pollset *ps_next;	/* on the sleepers list */
+	unsigned ps_nents, ps_maxents;
+	struct pollent *ps_ents;
+};
+
+void pollq_init(struct pollq *pq);
+void pollq_cleanup(struct pollq *pq);
+void pollq_wakeup(struct pollq *pq);
+
+int pollset_init(struct pollset *ps, unsigned max);
+void pollset_cleanup(struct pollset *ps);
+bool pollset_sleep(struct pollset *ps, unsigned ticks);
+void poll_wait(struct pollset *ps, struct pollq *pq);
+void poll_killproc(struct proc *p);
+
+#endif /* _POLL_H_ */
@@ -36,11 +36,16 @@
  * Note: curproc is defined by <current.h>.
  */
 
+#include <kern/time.h>
+#include <kern/resource.h> /* for struct rlimit */
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
+#include <vm.h> /* for struct vmstats */
 
 struct addrspace;
 struct vnode;
+struct aio_ctx;
+struct systrace;
 
 /*
  * Process structure.
@@ -55,6 +60,8 @@ struct proc {
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
+	char *p_cwdpath;		/* its name for getcwd, or NULL (vfscwd.c) */
+	unsigned p_cwdgen;		/* vfs_cwdgen p_cwdpath is from */
 
 	/* ADDED FOR A4 */
 	/* each process gets its own file table */
@@ -69,7 +76,38 @@ struct proc {
 	bool p_exited; /* indicates whether the process has terminated */
 
 	struct lock *p_waitlock; /* lock to prevent concurrent access to exit fields */
-	struct cv *p_waitcv; /* A condition variable which will be used by the parent to wait for child to exit */
+	struct cv *p_waitcv; /* A condition variable which will be used to wait for this process to exit (the menu uses it) */
+
+	/* The family, all protected by the family lock in proc.c (see proc_addchild) */
+	struct proc *p_parentproc; /* our parent, or NULL if we have none (any more) */
+	struct proc *p_children; /* children still running */
+	struct proc *p_zombies; /* children that have exited and wait to be reaped, latest first */
+	struct proc *p_sibling; /* next on our parent's p_children or p_zombies */
+	struct proc **p_siblingp; /* whatever points at us on that list */
+	struct cv *p_childcv; /* broadcast when one of our children exits */
+
+	struct vmstats p_vmstats; /* the address space's VM counters, saved by _exit() before the as goes to the reaper */
+	struct vmstats p_childstats; /* totals of the children reaped by waitpid() (getrusage(RUSAGE_CHILDREN)) */
+
+	/* User threads (syscall/thr_syscall.c), under p_thrlock */
+	struct lock *p_thrlock;
+	struct cv *p_thrcv; /* broadcast when a user thread leaves, and when they are all told to (p_thrkill) */
+	struct uthread *p_uthreads; /* threads made by thr_create, running or exited and waiting for thr_join */
+	struct uthread *p_thrfree; /* joined ones, kept for their stacks */
+	unsigned p_nthr; /* user threads still running, the first one included */
+	int p_nexttid;
+	volatile bool p_thrkill; /* one thread is making the others leave (_exit, execv); read without the lock */
+
+	struct aio_ctx *p_aio; /* asynchronous I/O (syscall/aio_syscall.c), made on first use, under p_lock */
+	struct systrace *p_systrace; /* syscall tracing (syscall/systrace_syscall.c), made when first turned on */
+
+	struct rlimit p_rlimit[__RLIMIT_NUM]; /* getrlimit/setrlimit, under p_lock; inherited by fork, kept by execv */
+	int p_ioprio; /* I/O priority class (IOPRIO_*, <kern/ioprio.h>), for the disk queues; inherited by fork and spawn */
+
+	struct cputimes p_times; /* CPU time of the threads that have left, under p_lock (see proc_gettimes) */
+	struct cputimes p_childtimes; /* CPU time of the children reaped by waitpid() */
+
+	struct proc *p_reapnext; /* on the reaper's list, see proc_destroy_later */
 };
 
 struct proc *proc_create(const char *name);
@@ -85,6 +123,9 @@ struct proc *proc_create_runprogram(const char *name);
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
+/* Destroy an exited process that has been reaped (or orphaned) soon, in the reaper rather than the caller. */
+void proc_destroy_later(struct proc *proc);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
@@ -104,13 +145,35 @@ struct addrspace *proc_setas(struct addrspace *);
 /* Return the process pointer for a given pid, or NULL if invalid */
 struct proc *proc_get(pid_t pid); 
 
-/* Allocate a new PID and insert it into the global PID table */
+/* Allocate a new PID and insert it into the global PID table (and p_pid); -1 if there are none left */
 pid_t proc_allocpid(struct proc *p);
 
 /* Frees a pid once the process is dead */
 void proc_freepid(pid_t pid); 
 
+/* 
+ * Parents and children. proc_addchild makes CHILD a child of PARENT (fork and spawn do this before the child can
+ * run). proc_exit records that PROC has exited with EXITCODE (an encoded wait status), wakes whoever waits for it and
+ * orphans its children; its caller then calls thread_exit. proc_waitchild finds an exited child of PARENT, with pid PID
+ * or any if PID is -1, and takes it off PARENT's lists; it sleeps until there is one unless NOHANG, in which case
+ * *CHILDP may come back NULL. proc_waitthreads waits for the last thread of an exited process to finish leaving it,
+ * so it can be destroyed.
+ */
+void proc_addchild(struct proc *parent, struct proc *child);
+void proc_exit(struct proc *proc, int exitcode);
+int proc_waitchild(struct proc *parent, pid_t pid, bool nohang, struct proc **childp);
+void proc_waitthreads(struct proc *proc);
+
+/* Wake threads of PROC sleeping in proc_waitchild, so they see p_thrkill (which makes it return EINTR) */
+void proc_wakewaiters(struct proc *proc);
+
 void pid_bootstrap(void); 
 
+/* CPU time used by the threads of the process so far, the ones gone and the ones still running */
+void proc_gettimes(struct proc *proc, struct cputimes *ret);
+
+/* Print every process with its CPU times, for the ps menu command */
+void proc_printall(void);
+
 
 #endif /* _PROC_H_ */
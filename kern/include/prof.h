@@ -0,0 +1,37 @@
+#ifndef _PROF_H_
+#define _PROF_H_
+
+/*
+ * Sampling profiler.
+ *
+ * While it's on, each timer interrupt (HZ times a second on every
+ * cpu) records where the interrupted code was: its program counter,
+ * whether that was user or kernel code, and the current process. A
+ * cpu only writes its own sample buffer, with interrupts off, so this
+ * takes no locks; once a buffer is full further samples on that cpu
+ * are only counted.
+ *
+ * Functions:
+ *    prof_start    - throw away the old samples and start sampling.
+ *                    ENOMEM if there's no memory for the buffers.
+ *    prof_stop     - stop sampling.
+ *    prof_sample   - record a sample; called by the timer interrupt
+ *                    with the interrupted pc and whether it was in
+ *                    user mode.
+ *    prof_dump     - stop, and print a histogram of the kernel
+ *                    samples by function, using the symbol table of
+ *                    the kernel's ELF file KERNELPATH. If that can't
+ *                    be read, by address (for addr2line).
+ *    prof_dumpuser - stop, and print the user samples of each process
+ *                    with its commonest pcs.
+ */
+
+#define PROF_SAMPLES	4096	/* per cpu; 40 seconds at HZ=100 */
+
+int prof_start(void);
+void prof_stop(void);
+void prof_sample(vaddr_t pc, bool user);
+void prof_dump(const char *kernelpath);
+void prof_dumpuser(void);
+
+#endif /* _PROF_H_ */
@@ -0,0 +1,136 @@
+#ifndef _RADIX_H_
+#define _RADIX_H_
+
+/*
+ * Radix tree: a sparse array of void pointers indexed by any 32-bit
+ * unsigned number, for things with small integer names that aren't
+ * dense enough for an array (pids, inode numbers, page numbers).
+ *
+ * Each level of the tree takes RADIX_BITS bits of the index. The tree
+ * is only as tall as the largest index set needs, so with small
+ * indexes a lookup is one or two array references. Interior nodes are
+ * freed when they become empty. As with arrays and hash tables there
+ * is no locking; that's up to the user.
+ *
+ * create  - allocate a tree.
+ * destroy - destroy an allocated tree; it must be empty.
+ * init    - initialize a tree in space externally allocated.
+ * cleanup - clean up a tree in space externally allocated.
+ * num     - return the number of non-NULL entries.
+ * get     - return the entry at INDEX, or NULL.
+ * set     - set the entry at INDEX to VAL, which may not be NULL. May
+ *           fail and return ENOMEM, in which case nothing changes.
+ * remove  - set the entry at INDEX to NULL and return what it was.
+ * next    - find the first non-NULL entry at *INDEX or after; return
+ *           it and put its index in *INDEX, or return NULL if there
+ *           are none. For going through the tree in order:
+ *               for (i=0; (v = radix_next(r, &i)) != NULL; i++) ...
+ *           (which stops at 0xffffffff, since i++ would wrap).
+ */
+
+#define RADIX_BITS	6
+#define RADIX_FANOUT	(1U << RADIX_BITS)
+
+struct radix {
+	void *r_root;			/* top node, NULL if empty */
+	unsigned r_height;		/* levels of nodes */
+	unsigned r_num;			/* non-NULL entries */
+};
+
+struct radix *radix_create(void);
+void radix_destroy(struct radix *);
+void radix_init(struct radix *);
+void radix_cleanup(struct radix *);
+unsigned radix_num(const struct radix *);
+void *radix_get(const struct radix *, uint32_t index);
+int radix_set(struct radix *, uint32_t index, void *val);
+void *radix_remove(struct radix *, uint32_t index);
+void *radix_next(const struct radix *, uint32_t *index);
+
+/*
+ * Typed radix trees, declared and defined as for hash tables (see
+ * hashtab.h): DECLRADIX_BYTYPE(foo, bar, INLINE) declares "struct foo"
+ * of pointers to "bar", and DECLRADIX(foo, INLINE) is
+ * DECLRADIX_BYTYPE(fooradix, struct foo, INLINE).
+ */
+
+#define DECLRADIX_BYTYPE(RADIX, T, INLINE) \
+	struct RADIX {						\
+		struct radix r;					\
+	};							\
+								\
+	INLINE struct RADIX *RADIX##_create(void);		\
+	INLINE void RADIX##_destroy(struct RADIX *t);		\
+	INLINE void RADIX##_init(struct RADIX *t);		\
+	INLINE void RADIX##_cleanup(struct RADIX *t);		\
+	INLINE unsigned RADIX##_num(const struct RADIX *t);	\
+	INLINE T *RADIX##_get(const struct RADIX *t, uint32_t index); \
+	INLINE int RADIX##_set(struct RADIX *t, uint32_t index, T *val); \
+	INLINE T *RADIX##_remove(struct RADIX *t, uint32_t index); \
+	INLINE T *RADIX##_next(const struct RADIX *t, uint32_t *index)
+
+#define DEFRADIX_BYTYPE(RADIX, T, INLINE) \
+	INLINE struct RADIX *					\
+	RADIX##_create(void)					\
+	{							\
+		struct RADIX *t = kmalloc(sizeof(*t));		\
+		if (t == NULL) {				\
+			return NULL;				\
+		}						\
+		radix_init(&t->r);				\
+		return t;					\
+	}							\
+								\
+	INLINE void						\
+	RADIX##_destroy(struct RADIX *t)			\
+	{							\
+		radix_cleanup(&t->r);				\
+		kfree(t);					\
+	}							\
+								\
+	INLINE void						\
+	RADIX##_init(struct RADIX *t)				\
+	{							\
+		radix_init(&t->r);				\
+	}							\
+								\
+	INLINE void						\
+	RADIX##_cleanup(struct RADIX *t)			\
+	{							\
+		radix_cleanup(&t->r);				\
+	}							\
+								\
+	INLINE unsigned						\
+	RADIX##_num(const struct RADIX *t)			\
+	{							\
+		return radix_num(&t->r);			\
+	}							\
+								\
+	INLINE T *						\
+	RADIX##_get(const struct RADIX *t, uint32_t index)	\
+	{							\
+		return (T *)radix_get(&t->r, index);		\
+	}							\
+								\
+	INLINE int						\
+	RADIX##_set(struct RADIX *t, uint32_t index, T *val)	\
+	{							\
+		return radix_set(&t->r, index, (void *)val);	\
+	}							\
+								\
+	INLINE T *						\
+	RADIX##_remove(struct RADIX *t, uint32_t index)		\
+	{							\
+		return (T *)radix_remove(&t->r, index);		\
+	}							\
+								\
+	INLINE T *						\
+	RADIX##_next(const struct RADIX *t, uint32_t *index)	\
+	{							\
+		return (T *)radix_next(&t->r, index);		\
+	}
+
+#define DECLRADIX(T, INLINE) DECLRADIX_BYTYPE(T##radix, struct T, INLINE)
+#define DEFRADIX(T, INLINE) DEFRADIX_BYTYPE(T##radix, struct T, INLINE)
+
+#endif /* _RADIX_H_ */
@@ -0,0 +1,81 @@
+#ifndef _SCHEDTRACE_H_
+#define _SCHEDTRACE_H_
+
+/*
+ * Scheduler event trace.
+ *
+ * Every cpu remembers the last SCHEDTRACE_SIZE scheduler events it
+ * saw, in a ring in its struct cpu, each stamped with the cpu's cycle
+ * counter. A cpu only ever writes its own ring, with interrupts off,
+ * so recording takes no locks: fill in the next slot, then bump the
+ * count. Readers copy a ring and use the count to drop any slots that
+ * were overwritten while they were copying. This is cheap enough to
+ * leave on all the time.
+ *
+ * Functions (in thread.c):
+ *    schedtrace_record - note an event of TYPE about thread T on the
+ *                        current cpu. ARG is a cpu number for
+ *                        ST_WAKEUP and ST_MIGRATE, the thread's new
+ *                        state for ST_SWITCHOUT, its priority level
+ *                        for ST_SWITCHIN, and 0 for ST_IDLE and
+ *                        ST_RESCHED.
+ *    schedtrace_dump   - print the rings of all cpus, or only of cpu
+ *                        CPUNUM, oldest event first.
+ */
+
+#define SCHEDTRACE_SIZE 256		/* events per cpu; a power of 2 */
+
+#define ST_SWITCHOUT	0	/* thread stops running */
+#define ST_SWITCHIN	1	/* thread starts running */
+#define ST_WAKEUP	2	/* thread made runnable on cpu ARG */
+#define ST_MIGRATE	3	/* thread moved to cpu ARG's run queue */
+#define ST_IDLE		4	/* nothing to run, cpu going idle */
+#define ST_RESCHED	5	/* thread yields in cond_resched */
+
+struct thread;
+
+struct schedtrace_event {
+	uint64_t se_time;		/* cycles (see mainbus_cycles) */
+	const struct thread *se_thread;	/* just an id; may be gone now */
+	pid_t se_pid;			/* its process, or -1 */
+	uint8_t se_type;		/* ST_* */
+	uint8_t se_arg;			/* depends on se_type */
+};
+
+void schedtrace_record(unsigned type, const struct thread *t, unsigned arg);
+
+#define SCHEDTRACE_ALLCPUS ((unsigned)-1)
+void schedtrace_dump(unsigned cpunum);
+
+/*
+ * Wakeup latency: how long threads made runnable wait until they run.
+ *
+ * While it's on, thread_make_runnable stamps the thread with the time
+ * (from the clock device, since the cpus' cycle counters don't agree
+ * with one another) and the cpu that runs it next puts the wait in
+ * one of its histograms, by how the wakeup got there: made by that
+ * cpu itself, by another cpu that found it idle and sent it an
+ * IPI_UNIDLE, or by another cpu while it was busy (no IPI; it picks
+ * the thread up at its next switch). Only the cpu itself writes its
+ * histograms, under its run queue lock.
+ *
+ * Bucket 0 counts waits under 1 microsecond, bucket N (from 1) ones of
+ * at least 2^(N-1) and under 2^N, the last one everything longer.
+ *
+ * Functions (in thread.c):
+ *    schedlat_enable - turn it on (clearing the histograms) or off.
+ *                      Off at boot; the clock device must be there.
+ *    schedlat_dump   - print every cpu's histograms.
+ */
+
+#define SCHEDLAT_NBUCKETS 16
+
+#define SL_LOCAL	0	/* woken by the cpu it ran on */
+#define SL_IPI		1	/* woken on an idle cpu, with an IPI */
+#define SL_REMOTE	2	/* woken on another cpu that was busy */
+#define SL_NKINDS	3
+
+void schedlat_enable(bool on);
+void schedlat_dump(void);
+
+#endif /* _SCHEDTRACE_H_ */
@@ -0,0 +1,98 @@
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+/*
+ * Sequence locks, for data that is read far more often than it is
+ * written and is too big to read or write atomically (a struct
+ * timespec, a block of counters).
+ *
+ * Writers take the spinlock, so they exclude each other and run with
+ * interrupts off, and bump the sequence number before and after they
+ * change anything; it is odd while a write is in progress. Readers
+ * take no locks and write nothing. They note the sequence number,
+ * copy the data out, and try again if the number was odd or has
+ * changed since:
+ *
+ *     do {
+ *             seq = seqlock_read_begin(&sq);
+ *             copy = data;
+ *     } while (seqlock_read_retry(&sq, seq));
+ *
+ * A reader may see a half-written copy, so it must not do anything
+ * with it (like follow a pointer) until seqlock_read_retry says it's
+ * good. Readers can't hold up writers; a steady stream of writers can
+ * hold up readers.
+ *
+ * Functions:
+ *    seqlock_init        - initialize.
+ *    seqlock_cleanup     - clean up.
+ *    seqlock_write_begin - start changing the data.
+ *    seqlock_write_end   - done changing it.
+ *    seqlock_read_begin  - start reading; returns the sequence number.
+ *    seqlock_read_retry  - true if what was read since read_begin
+ *                          returned SEQ can't be trusted.
+ */
+
+#include <spinlock.h>
+#include <membar.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef SEQLOCK_INLINE
+#define SEQLOCK_INLINE INLINE
+#endif
+
+struct seqlock {
+	struct spinlock sq_lock;	/* serializes writers */
+	volatile unsigned sq_seq;	/* odd while being written */
+};
+
+#define SEQLOCK_INITIALIZER	{ SPINLOCK_INITIALIZER, 0 }
+
+void seqlock_init(struct seqlock *sq);
+void seqlock_cleanup(struct seqlock *sq);
+
+SEQLOCK_INLINE void seqlock_write_begin(struct seqlock *sq);
+SEQLOCK_INLINE void seqlock_write_end(struct seqlock *sq);
+SEQLOCK_INLINE unsigned seqlock_read_begin(const struct seqlock *sq);
+SEQLOCK_INLINE bool seqlock_read_retry(const struct seqlock *sq,
+				       unsigned seq);
+
+SEQLOCK_INLINE
+void
+seqlock_write_begin(struct seqlock *sq)
+{
+	spinlock_acquire(&sq->sq_lock);
+	sq->sq_seq++;
+	/* readers must see the odd number before any of the new data */
+	membar_store_store();
+}
+
+SEQLOCK_INLINE
+void
+seqlock_write_end(struct seqlock *sq)
+{
+	membar_store_store();
+	sq->sq_seq++;
+	spinlock_release(&sq->sq_lock);
+}
+
+SEQLOCK_INLINE
+unsigned
+seqlock_read_begin(const struct seqlock *sq)
+{
+	unsigned seq;
+
+	seq = sq->sq_seq;
+	membar_load_load();
+	return seq;
+}
+
+SEQLOCK_INLINE
+bool
+seqlock_read_retry(const struct seqlock *sq, unsigned seq)
+{
+	membar_load_load();
+	return (seq & 1) != 0 || sq->sq_seq != seq;
+}
+
+#endif /* _SEQLOCK_H_ */
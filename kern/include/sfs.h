@@ -48,6 +48,12 @@
  */
 #include <kern/sfs.h>
 
+struct lock;
+struct rwlock;
+struct cv;
+struct sfs_dirindex;
+struct sfs_journal;
+
 /*
  * In-memory inode
  */
@@ -56,8 +62,32 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	bool sv_syncdirty;              /* sv_i or block map modified */
+					/* ... since the last fsync */
+	struct rwlock *sv_lock;         /* for sv_i, sv_dirty, the contents */
+	struct spinlock sv_spinlock;    /* for the readahead state: */
+	uint32_t sv_ranext;             /* block a sequential read starts at */
+	uint32_t sv_rapos;              /* blocks before this are prefetched */
+	uint32_t sv_rawin;              /* readahead window, in blocks */
+	struct sfs_dirindex *sv_dirindex; /* directory name index, if built */
+	struct sfs_vnode *sv_hnext;     /* sfs_vnhash (or sfs_orphans) chain */
+	daddr_t sv_prealloc;            /* blocks set aside for writing it, */
+	unsigned sv_nprealloc;          /* ... under sv_lock (sfs_balloc.c) */
+	bool sv_preany;                 /* next block takes them, wherever */
+	uint32_t sv_dlfirst;            /* file blocks written but not yet */
+	unsigned sv_dlcount;            /* ... allocated, under sv_lock */
+	char *sv_dldata;                /* ... their contents */
+	time_t sv_dltime;               /* ... since when (sfs_io.c) */
+	struct sfs_vnode *sv_dnext;     /* sfs_dirtyvns chain, under */
+	struct sfs_vnode **sv_dprevp;   /* ... sfs_dirtylock; NULL if off */
+	bool sv_gone;                   /* out of the table: never listed */
+	struct sfs_vnode *sv_inext;     /* sfs_inactive chain, under */
+	struct sfs_vnode **sv_iprevp;   /* ... sfs_vnlock; NULL if in use */
 };
 
+/* Buckets in the table of loaded vnodes (a power of two). */
+#define SFS_VNHASHSIZE	128
+
 /*
  * In-memory info for a whole fs volume
  */
@@ -66,15 +96,138 @@ struct sfs_fs {
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode *sfs_vnhash[SFS_VNHASHSIZE]; /* vnodes loaded
+					   into memory, by inode number */
+	unsigned sfs_numvnodes;         /* how many there are */
+	struct sfs_vnode *sfs_inactive; /* those nobody has, oldest first */
+	struct sfs_vnode **sfs_inactivetail; /* ... the end of the list */
+	unsigned sfs_ninactive;         /* ... how many there are */
+	struct lock *sfs_vnlock;        /* for sfs_vnhash, sfs_numvnodes,
+					   and the inactive list */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct bitmap *sfs_fmdirty;     /* which freemap blocks, 1 each */
+	struct lock *sfs_freemaplock;   /* for the freemap and superblock */
+	unsigned sfs_nfree;             /* free blocks in the freemap */
+	unsigned sfs_ndelayed;          /* blocks waiting to be allocated */
+	struct sfs_vnode *sfs_orphans;  /* unlinked files waiting to be freed */
+	struct lock *sfs_orphanlock;    /* for sfs_orphans, the threads */
+	struct cv *sfs_orphancv;        /* orphans to free, or thread gone */
+	bool sfs_reaperexit;            /* true to make the reaper quit */
+	bool sfs_reaperrunning;         /* false once it has */
+	bool sfs_flusherexit;           /* the same for the flusher */
+	bool sfs_flusherrunning;
+	struct lock *sfs_reaplock;      /* held while freeing orphans */
+	struct sfs_journal *sfs_journal; /* NULL if the volume has none */
+	struct spinlock sfs_dirtylock;  /* for sfs_dirtyvns, sfs_ndirty */
+	struct sfs_vnode *sfs_dirtyvns; /* vnodes sync has work for */
+	unsigned sfs_ndirty;            /* how many there are */
+	bool sfs_readonly;              /* mounted read-only; never changes */
 };
 
 /*
- * Function for mounting a sfs (calls vfs_mount)
+ * Most vnodes kept in memory per volume after their last reference
+ * goes, in case they're wanted again (see sfs_inode.c).
+ */
+#define SFS_INACTIVEMAX	64
+
+/* Unlinked files bigger than this many blocks are freed by the reaper. */
+#define SFS_REAPMIN	16
+
+/*
+ * Blocks written past the end of a file may wait in memory, up to
+ * this many per file, to be allocated all together (see sfs_io.c).
+ */
+#define SFS_DLMAX	16
+
+/*
+ * Locking.
+ *
+ * Each vnode's sv_lock covers its inode and its contents (file data,
+ * or directory entries): reads and lookups take it shared, anything
+ * that changes the inode or the contents takes it exclusive. The
+ * inode type never changes once the vnode is loaded, so checking it
+ * needs no lock. sfs_vnlock covers the table of loaded vnodes (and so
+ * the decision to load or reclaim one), and sfs_freemaplock the free
+ * block bitmap and the superblock.
+ *
+ * The order is:
+ *    a directory's sv_lock, before
+ *    the sv_lock of a file named in it, before
+ *    sfs_vnlock, before
+ *    sfs_freemaplock, before
+ *    the buffer cache.
+ * Two vnodes with no order between them (say the two directories of
+ * a rename, or two files in one directory) are locked lowest inode
+ * number first. Rename only renames within one directory, so it takes
+ * the directory and then the file it moves.
+ *
+ * sfs_reclaim takes sfs_vnlock and then the dying vnode's sv_lock,
+ * against the order: that's safe because nobody else has a reference
+ * left to be holding it with, and nobody can get one without
+ * sfs_vnlock.
+ *
+ * Reads and lookups hold sv_lock only shared, so the readahead state
+ * has a spinlock of its own, sv_spinlock. A directory's name index is
+ * built by the first lookup that wants it, also with sv_lock shared,
+ * so setting sv_dirindex (and reading it) takes sv_spinlock too; once
+ * it's there, the index is changed only with sv_lock held exclusive.
+ *
+ * When the last reference to an unlinked file bigger than SFS_REAPMIN
+ * blocks goes, sfs_reclaim doesn't free its blocks itself (that would
+ * hold up whoever called remove or close): it takes the vnode out of
+ * the table and puts it on sfs_orphans, under sfs_vnlock and then
+ * sfs_orphanlock, and the volume's reaper thread frees it later. The
+ * reaper, and sfs_sync, take sfs_reaplock while they free orphans, so
+ * once sync has it nobody is halfway through one. An orphan's sv_lock
+ * comes after sfs_reaplock, and nobody else can reach it.
+ *
+ * On a journaled volume, each operation that changes metadata does so
+ * within a journal handle (sfs_jbegin/sfs_jend; see sfs_journal.c),
+ * started before it takes any vnode lock. The journal's own lock comes
+ * after the vnode locks and before sfs_freemaplock; committing takes
+ * it and then sfs_freemaplock and buffers, but only once no handle is
+ * open, so nobody making changes can be in its way.
+ *
+ * Blocks of file data not yet allocated belong to the vnode, under its
+ * sv_lock; sfs_ndelayed, which counts them against sfs_nfree so that
+ * there will be room for them, is under sfs_freemaplock. The flusher
+ * thread finds vnodes that have them the way sfs_sync does.
+ *
+ * A vnode whose inode is dirty, or that has blocks waiting, is on
+ * sfs_dirtyvns (sfs_dirty, sfs_dirtylist_add), so sfs_sync and the
+ * flusher only look at vnodes with something to do rather than the
+ * whole table. The list is under the spinlock sfs_dirtylock, which
+ * comes after everything else; taking a vnode off it, or a reference
+ * to one on it, also needs sfs_vnlock, so that sfs_reclaim (which has
+ * it) can take the vnode off for good. An orphan, out of the table,
+ * is never put back on.
+ *
+ * When the last reference to a file that still has links goes,
+ * sfs_reclaim writes it back and leaves it in the table, on the list
+ * of inactive vnodes, still holding the reference count of 1 that
+ * VOP_DECREF left it; sfs_loadvnode hands that reference out again
+ * if it's looked up, and takes it off. The list is under sfs_vnlock,
+ * like the table. An inactive vnode is clean and off sfs_dirtyvns,
+ * so only that lock's holders can get at it, and freeing one needs
+ * nothing else either.
+ *
+ * A read or write holds the vnode's lock while it copies to or from
+ * the user's buffer, and the page faults on the buffer may read
+ * files. So the buffer must not be a mapping of the same file.
+ *
+ * On a volume mounted read-only (sfs_mount_ro) everything that would
+ * change it fails with EROFS, so nothing takes a vnode's lock
+ * exclusive but sfs_reclaim, which only gets a vnode nobody else has.
+ * The shared lockers skip sv_lock altogether there.
+ */
+
+/*
+ * Functions for mounting a sfs (call vfs_mount), read-write or
+ * read-only
  */
 int sfs_mount(const char *device);
+int sfs_mount_ro(const char *device);
 
 
 #endif /* _SFS_H_ */
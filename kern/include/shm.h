@@ -0,0 +1,41 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include <types.h>
+
+/*
+ * Shared memory segments (shm.c). A segment is a run of zero filled pages that several address spaces map at once,
+ * through regions whose shm field points at it. It owns a reference to each of its frames and hands out another one
+ * for each page table entry, so a frame goes when the segment and all its mappings have. Frames are allocated on first
+ * touch and never paged out, like the rest of MAP_SHARED memory.
+ *
+ * Segments made by shmget have an id (and a key, unless it was IPC_PRIVATE) until shmctl(IPC_RMID); anonymous
+ * MAP_SHARED mmaps make segments with neither, which only fork can pass on.
+ */
+struct shmseg;
+
+/* set up the id and key tables, called once during boot */
+void shm_bootstrap(void);
+
+/* make an anonymous segment of npages pages, with one reference for the caller */
+int shm_create(size_t npages, struct shmseg **ret);
+
+/* references: one per region mapping the segment, plus the id's while it has one */
+void shm_incref(struct shmseg *seg);
+void shm_decref(struct shmseg *seg);
+
+size_t shm_npages(const struct shmseg *seg);
+
+/* the frame for page index of the segment (allocating it on first use), with a new reference for a page table entry */
+int shm_getpage(struct shmseg *seg, size_t index, paddr_t *ret);
+
+/* shmget: find or create the segment for key as IPC_CREAT and IPC_EXCL in flags say, and return its id */
+int shm_get(int key, size_t size, int flags, int *id);
+
+/* the segment with this id, with a reference for the caller */
+int shm_lookup(int id, struct shmseg **ret);
+
+/* shmctl(IPC_RMID): take the id (and key) away; the segment lasts until its last mapping goes */
+int shm_remove(int id);
+
+#endif /* _SHM_H_ */
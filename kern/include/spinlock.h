@@ -45,6 +45,8 @@
 /* Get the machine-dependent bits. */
 #include <machine/spinlock.h>
 
+#include <lockstat.h>
+
 /*
  * Basic spinlock.
  *
@@ -57,12 +59,20 @@
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+#if OPT_LOCKSTATS
+	struct lockstat_hold splk_stat;	    /* Contention statistics. */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
+#if OPT_LOCKSTATS
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+				  LOCKSTAT_HOLD_INITIALIZER }
+#else
 #define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#endif
 
 /*
  * Spinlock functions.
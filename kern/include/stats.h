@@ -0,0 +1,104 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+/*
+ * System-wide event counters.
+ *
+ * Every cpu has its own copy of each counter (c_stats in struct cpu)
+ * and only bumps that one, so counting is a plain increment: no lock,
+ * no atomic operation, and no cache line moving between cpus. Reading
+ * adds up the copies of all the cpus. That sum isn't taken at one
+ * instant, which doesn't matter for counters that only go up.
+ *
+ * Interrupts aren't turned off either, so once in a long while an
+ * increment is lost: when an interrupt handler on the same cpu counts
+ * the same thing between the load and the store, or the thread moves
+ * to another cpu right there. That's the price of being cheap enough
+ * to count anything; don't use these for what has to be exact.
+ *
+ * The counters come in groups, and each group is a text file in
+ * stats: (see fs/statsfs), with a "name value" line per counter.
+ * stats:disk is another sort: each disk's own counters, which its
+ * request queue keeps (see blkq.h), as "lhd0.reads 12" and so on.
+ * stats:kmem is kmalloc's, per kmalloc_tagged tag (see lib.h), as
+ * "vfs.bytes 40960"; it's empty without options kmtags.
+ *
+ * Macros (need <cpu.h> and <current.h>):
+ *    STAT_INC(c)     - count one of C (a STAT_* below) on this cpu.
+ *    STAT_ADD(c, n)  - count N.
+ *
+ * Functions (in thread/stats.c):
+ *    stats_total     - the count of C over all cpus.
+ *    stats_group     - the name of group G (from 0), or NULL past the
+ *                      last one.
+ *    stats_format    - print group G into BUF of size LEN, and return
+ *                      the length of the whole text (as snprintf: BUF
+ *                      holds only what fits).
+ *
+ * With options irqstats there are also latency histograms, per cpu
+ * like the counters: how long interrupts stay off at a stretch, and
+ * how long each interrupt source's handler runs (each device slot
+ * apart, and interprocessor interrupts). Bucket K counts times (in
+ * cycles, see mainbus_cycles) from 2^K up to 2^(K+1); bucket 0 has 0
+ * and 1 as well. They're shown in stats:intr, a line per histogram
+ * that has anything in it: its name, then "K:count" for each bucket
+ * that isn't empty.
+ *
+ *    stats_hist      - count TIME in histogram H (a STAT_HIST_*) on
+ *                      this cpu. Call with interrupts off.
+ *    stats_irqoff    - interrupts just went off on this cpu.
+ *    stats_irqon     - they're about to go back on; counts the time
+ *                      since stats_irqoff in STAT_HIST_IRQOFF.
+ */
+
+#include "opt-irqstats.h"
+
+/* vm */
+#define STAT_VM_FAULTS		0	/* faults that reached vm_fault */
+#define STAT_VM_ZEROFILLS	1	/* pages zero filled */
+#define STAT_VM_COWCOPIES	2	/* copy-on-write copies */
+#define STAT_VM_PAGEINS		3	/* pages read from swap or a file */
+#define STAT_VM_PAGEOUTS	4	/* pages the pager wrote to swap */
+/* sched */
+#define STAT_SCHED_SWITCHES	5	/* thread switches */
+#define STAT_SCHED_PREEMPTS	6	/* of which forced by hardclock */
+#define STAT_SCHED_MIGRATIONS	7	/* threads pushed to other cpus */
+#define STAT_SCHED_STEALS	8	/* threads pulled from other cpus */
+#define STAT_SCHED_IDLES	9	/* times a cpu went idle */
+/* bio */
+#define STAT_BIO_READS		10	/* device read requests */
+#define STAT_BIO_READBLOCKS	11	/* blocks in them */
+#define STAT_BIO_WRITES		12	/* device write requests */
+#define STAT_BIO_WRITEBLOCKS	13	/* blocks in them */
+#define STAT_BIO_RETRIES	14	/* requests retried after EIO */
+/* cache */
+#define STAT_CACHE_BUFHITS	15	/* buf_read found the block */
+#define STAT_CACHE_BUFMISSES	16	/* ... and had to read it */
+#define STAT_CACHE_NAMEHITS	17	/* name cache hits */
+#define STAT_CACHE_NAMEMISSES	18	/* ... and misses */
+/* syscall */
+#define STAT_SYSCALLS		19	/* system calls */
+#define STAT_SYSCALL_ERRORS	20	/* ... that failed */
+#define STAT_NCOUNTERS		21
+
+#define STAT_HIST_IRQOFF	0		/* interrupts off */
+#define STAT_HIST_IPI		1		/* IPI handler */
+#define STAT_HIST_SLOT(n)	(2 + (n))	/* device slot N's handler */
+#define STAT_NSLOTS		32
+#define STAT_NHISTS		(2 + STAT_NSLOTS)
+#define STAT_NBUCKETS		32
+
+#define STAT_INC(c) (curcpu->c_stats[(c)]++)
+#define STAT_ADD(c, n) (curcpu->c_stats[(c)] += (n))
+
+uint64_t stats_total(unsigned c);
+const char *stats_group(unsigned g);
+size_t stats_format(unsigned g, char *buf, size_t len);
+
+#if OPT_IRQSTATS
+void stats_hist(unsigned h, uint64_t time);
+void stats_irqoff(void);
+void stats_irqon(void);
+#endif
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,55 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+#include <types.h>
+
+struct addrspace;
+
+/* Swap space and the pager (see vm/swap.c) */
+
+/* name of the raw disk used as swap space, paging is simply off if it doesn't exist */
+#define SWAP_DEVICE "lhd1raw:"
+
+/* the pager starts evicting when fewer than PAGER_LOW_WATER frames are free and stops once PAGER_HIGH_WATER are */
+#define PAGER_LOW_WATER  32
+#define PAGER_HIGH_WATER 64
+
+/* under PAGER_MIN_WATER user allocations wait for the pager before taking a frame, which leaves the rest to the kernel */
+#define PAGER_MIN_WATER  16
+
+/* open the swap device and start the pager thread, called once during boot after vm_bootstrap */
+void swap_bootstrap(void);
+
+/* read swap slot into the frame at pa / give the slot back */
+int swap_in(unsigned slot, paddr_t pa);
+void swap_free(unsigned slot);
+
+/* memory is getting low: wake the pager so it evicts ahead of demand (cheap, safe to call from alloc_page) */
+void swap_kick(void);
+
+/* allocate a frame for a user page (zero filled if zeroed is set), waiting for the pager if memory is full. 0 means we're really out */
+paddr_t alloc_user_page(bool zeroed);
+
+/* page out up to about max of as's own frames (RLIMIT_RSS, see vm_fault). Returns how many went, 0 without swap */
+unsigned swap_trim(struct addrspace *as, unsigned max);
+
+/*
+ * The memory pressure level (MEMPRESSURE_* in kern/mempressure.h). Waits up to ticks hardclock ticks for it to be
+ * something other than seen, and returns it. Rises are reported as the watermarks are crossed; the return to normal
+ * is only noticed when somebody looks, which is what the timeout is for.
+ */
+int swap_pressure(int seen, unsigned ticks);
+
+/*
+ * The compressed pool in front of the swap device (see vm/zswap.c). Its slots are numbered from first, after the
+ * disk's, and swap_in/swap_free pass those on here. zswap_store compresses the page at pa into the pool and
+ * returns its slot, or fails with ENOSPC (pool full) or EFBIG (doesn't compress well enough); only the pager
+ * stores. zswap_free has the same locking rules as swap_free.
+ */
+void zswap_bootstrap(unsigned first);
+bool zswap_owns(unsigned slot);
+int zswap_store(paddr_t pa, unsigned *slotp);
+void zswap_load(unsigned slot, paddr_t pa);
+void zswap_free(unsigned slot);
+
+#endif
@@ -58,9 +58,13 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * sem_timedP is P that gives up after TICKS hardclock ticks, returning
+ * ETIMEDOUT. It returns 0 if it got the semaphore.
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
+int sem_timedP(struct semaphore *, unsigned ticks);
 
 
 /*
@@ -75,13 +79,17 @@ void V(struct semaphore *);
 struct lock {
         char *lk_name;
 
-        struct semaphore *lk_sem;
-       volatile struct thread *lk_owner; 
-    
-
-
-
-
+        volatile spinlock_data_t lk_held; /* nonzero while the lock is held, test-and-set to take it */
+        volatile struct thread *lk_owner; 
+        struct spinlock lk_lock; /* protects lk_waiters and sleeping on lk_wchan */
+        struct wchan *lk_wchan; /* where waiters sleep once spinning gets them nowhere */
+        volatile unsigned lk_waiters; /* threads sleeping (or about to) on lk_wchan */
+        unsigned lk_prio; /* best level lent to the owner through this lock, or THREAD_NOINHERIT */
+        struct thread *lk_pithread; /* thread whose t_pilocks it's on (under lock_pilock, see synch.c) */
+        struct lock *lk_pinext; /* next on that chain */
+#if OPT_LOCKSTATS
+        struct lockstat_hold lk_stat; /* contention statistics, see lockstat.h */
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -90,9 +98,15 @@ void lock_destroy(struct lock *);
 /*
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
- *                   same time.
+ *                   same time. A free lock is taken without blocking or
+ *                   any other locking; a held one is spun on briefly if
+ *                   its owner is running on another cpu, then slept on.
+ *                   A sleeper lends its scheduling level to the owner
+ *                   (and on down a chain of owners asleep for other
+ *                   locks) until the owner lets go.
  *    lock_release - Free the lock. Only the thread holding the lock may do
- *                   this.
+ *                   this. If somebody is sleeping on it, the oldest
+ *                   sleeper is made the owner directly.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
@@ -122,6 +136,9 @@ struct cv {
 
         struct wchan *cv_wchan;
 	struct spinlock cv_lock;
+#if OPT_LOCKSTATS
+        struct lockstat_hold cv_stat; /* waits and time asleep, see lockstat.h */
+#endif
         
 
 
@@ -138,16 +155,72 @@ void cv_destroy(struct cv *);
  *                   waking up again, re-acquire the lock.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *                   The threads are moved onto the lock's queue rather
+ *                   than woken, and get the lock handed to them in turn
+ *                   once the caller lets it go.
+ *    cv_timedwait - cv_wait, but stop sleeping after TICKS hardclock
+ *                   ticks; returns ETIMEDOUT if that's what happened.
  *
  * For all three operations, the current thread must hold the lock passed
- * in. Note that under normal circumstances the same lock should be used
- * on all operations with any particular CV.
+ * in. The same lock must be used on all operations with any particular
+ * CV, since signalled waiters end up waiting for the signaller's lock.
  *
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers, or one writer, may hold it at a time. Writers
+ * are preferred: once one is waiting, new readers wait behind it. So
+ * that a stream of writers can't shut readers out, after
+ * RWLOCK_WRITER_STREAK writers in a row with readers waiting, the
+ * readers waiting at that point get in ahead of the next writer.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+#define RWLOCK_WRITER_STREAK 4
+
+struct rwlock {
+        char *rw_name;
+        struct spinlock rw_lock;        /* protects everything below */
+        struct wchan *rw_readwchan;     /* readers wait here */
+        struct wchan *rw_writewchan;    /* writers wait here */
+        unsigned rw_readers;            /* readers holding the lock */
+        volatile struct thread *rw_writer; /* writer holding it, or NULL */
+        unsigned rw_waitreaders;        /* readers waiting */
+        unsigned rw_waitwriters;        /* writers waiting */
+        unsigned rw_streak;             /* writers in a row while readers waited */
+        unsigned rw_passes;             /* readers that may still go ahead of waiting writers */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading; other readers may
+ *                           hold it at the same time.
+ *    rwlock_release_read  - Free a read hold.
+ *    rwlock_acquire_write - Get the lock for writing, alone.
+ *    rwlock_release_write - Free the write hold. Only the thread holding
+ *                           it may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing.
+ *
+ * Read holds aren't tied to a thread, so there is no do_i_hold for them.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
\ No newline at end of file
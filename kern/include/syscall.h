@@ -32,7 +32,10 @@
 
 
 #include <cdefs.h> /* for __DEAD */
+#include <kern/limits.h> /* for __ARG_MAX */
+#include <vm.h> /* for PAGE_SIZE */
 struct trapframe; /* from <machine/trapframe.h> */
+struct addrspace; /* from <addrspace.h> */
 
 /*
  * The system call dispatcher.
@@ -47,6 +50,27 @@ void syscall(struct trapframe *tf);
 /* Helper for fork(). You write this. */
 void enter_forked_process(struct trapframe *tf);
 
+/* 
+ * Argument copying and program loading shared by execv and spawn (in execv_syscall.c). An argblock is a program's
+ * arguments packed into whole frames, ab_argc strings back to back, ab_len bytes with their nulls, running on from one
+ * frame into the next. load_program maps the frames straight into the top of the new stack, so they are never copied
+ * again; once it has, they belong to the address space and ab_npages is 0.
+ */
+#define ARGBLOCK_MAXPAGES (__ARG_MAX / PAGE_SIZE)
+struct argblock {
+	paddr_t ab_frames[ARGBLOCK_MAXPAGES];
+	unsigned ab_npages;
+	size_t ab_len;
+	int ab_argc;
+};
+int copyin_args(userptr_t argv, struct argblock *ab);
+void argblock_free(struct argblock *ab);
+int load_program(char *kpath, struct argblock *ab, struct addrspace **asp, vaddr_t *entrypointp,
+                 vaddr_t *stackptrp, userptr_t *argvp);
+
+/* End the current process with an encoded wait status, from any of its threads (exit_syscall.c). Does not return. */
+__DEAD void exit_process(int status);
+
 /* Enter user mode. Does not return. */
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
@@ -58,12 +82,37 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(userptr_t req, userptr_t rem);
 int sys_open(userptr_t filename, int flags, mode_t mode, int *retval);
+int sys_openat(int dirfd, userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_read(int fd, userptr_t buf, size_t nbytes, int *retval);
 int sys_write(int fd, userptr_t buf, size_t nbytes, int *retval);
 int sys_close(int fd);
+int sys_fsync(int fd);
+int sys_fdatasync(int fd);
+int sys_sync_file_range(int fd, off_t offset, off_t len);
+int sys_fallocate(int fd, int mode, off_t offset, off_t len);
+int sys_ioctl(int fd, int code, userptr_t data);
+int sys_poll(userptr_t fds, unsigned nfds, int timeout, int *retval);
 int sys_lseek(int fd, off_t pos, int whence, off_t *retval);
+int sys_pread(int fd, userptr_t buf, size_t nbytes, off_t offset, int *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t nbytes, off_t offset, int *retval);
+int sys_readv(int fd, userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, userptr_t iov, int iovcnt, int *retval);
+int sys_copy_file_range(int fd_in, int fd_out, size_t len, int *retval);
+int sys_getdirentry(int fd, userptr_t buf, size_t buflen, int *retval);
+int sys_getdirentries(int fd, userptr_t buf, size_t buflen, int *retval);
+int sys_fstat(int fd, userptr_t buf);
+int sys_stat(userptr_t path, userptr_t buf);
+int sys_lstat(userptr_t path, userptr_t buf);
+int sys_fstatat(int dirfd, userptr_t path, userptr_t buf, int flags);
+int sys_mkdir(userptr_t path, mode_t mode);
+int sys_mkdirat(int dirfd, userptr_t path, mode_t mode);
+int sys_remove(userptr_t path);
+int sys_rmdir(userptr_t path);
+int sys_unlinkat(int dirfd, userptr_t path, int flags);
 int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_pipe(userptr_t fds);
 int sys_chdir(userptr_t pathname);
 int sys___get_cwd(userptr_t buf, size_t buflen, int *retval);
 int sys_fork(struct trapframe *parent_tf, pid_t *retval); 
@@ -72,4 +121,43 @@ void sys__exit(int code);
 int sys_getpid(pid_t *retval); 
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 int sys_sbrk(intptr_t amount, int32_t *retval); 
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd, off_t offset, int32_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_madvise(userptr_t addr, size_t len, int advice);
+int sys_getrusage(int who, userptr_t usage);
+int sys_getrlimit(int resource, userptr_t rlp);
+int sys_setrlimit(int resource, userptr_t rlp);
+int sys_kheapstats(userptr_t buf, unsigned nclasses, int32_t *retval);
+int sys_sched_setaffinity(pid_t pid, uint32_t mask);
+int sys_sched_getaffinity(pid_t pid, userptr_t maskp);
+int sys_sched_setattr(pid_t pid, userptr_t attrp);
+int sys_sched_getattr(pid_t pid, userptr_t attrp);
+int sys_ioprio_set(pid_t pid, int ioprio);
+int sys_ioprio_get(pid_t pid, int32_t *retval);
+int sys_futex_wait(userptr_t addr, int val);
+int sys_futex_wake(userptr_t addr, int n, int32_t *retval);
+int sys_spawn(userptr_t path, userptr_t argv, userptr_t actions, int nactions, pid_t *retval);
+int sys___thr_create(userptr_t entry, userptr_t func, userptr_t arg, int32_t *retval);
+__DEAD void sys_thr_exit(userptr_t value);
+int sys_thr_join(int tid, userptr_t valuep);
+int sys_ioring_enter(userptr_t ring, int32_t *retval);
+int sys_aio_read(userptr_t cb);
+int sys_aio_write(userptr_t cb);
+int sys_aio_wait(userptr_t events, int max, int flags, int32_t *retval);
+int sys_socket(int domain, int type, int protocol, int *retval);
+int sys_bind(int fd, userptr_t addr, socklen_t len);
+int sys_connect(int fd, userptr_t addr, socklen_t len);
+int sys_sendto(int fd, userptr_t buf, size_t len, int flags, userptr_t to, socklen_t tolen, int32_t *retval);
+int sys_recvfrom(int fd, userptr_t buf, size_t len, int flags, userptr_t from, userptr_t fromlen, int32_t *retval);
+int sys_getsockname(int fd, userptr_t addr, userptr_t lenp);
+int sys_systrace(pid_t pid, int flags);
+int sys_systrace_read(pid_t pid, userptr_t buf, unsigned nrecs, int32_t *retval);
+int sys_systrace_stats(pid_t pid, userptr_t buf, unsigned max, int32_t *retval);
+int sys_dmesg(userptr_t buf, size_t len, int32_t *retval);
+int sys_sem_op(int fd, int delta);
+int sys_shmget(int key, size_t size, int flags, int *retval);
+int sys_shmat(int id, userptr_t addr, int flags, int32_t *retval);
+int sys_shmdt(userptr_t addr);
+int sys_shmctl(int id, int cmd);
+int sys_mempressure(int seen, userptr_t ump);
 #endif /* _SYSCALL_H_ */
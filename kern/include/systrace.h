@@ -0,0 +1,18 @@
+#ifndef _SYSTRACE_H_
+#define _SYSTRACE_H_
+
+/*
+ * Per-process system call tracing (see kern/systrace.h and syscall/systrace_syscall.c). syscall() times every call of
+ * a process whose p_systrace is set and hands it to systrace_record when it returns, with the cycle count (see
+ * mainbus_cycles) from when it started. systrace_exit tells anyone reading the records that there won't be any more
+ * (_exit), and systrace_destroy frees them with the process.
+ */
+struct proc;
+struct systrace;
+
+void systrace_record(struct systrace *st, int callno, const uint32_t args[4], int32_t retval, int err,
+                     uint64_t start);
+void systrace_exit(struct proc *p);
+void systrace_destroy(struct proc *p);
+
+#endif /* _SYSTRACE_H_ */
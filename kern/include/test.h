@@ -50,6 +50,8 @@ int airballoon(int, char **);
 int arraytest(int, char **);
 int bitmaptest(int, char **);
 int threadlisttest(int, char **);
+int hashtabtest(int, char **);
+int radixtest(int, char **);
 
 /* thread tests */
 int threadtest(int, char **);
@@ -60,6 +62,13 @@ int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
 
+/* synchronization benchmarks */
+int lockbench(int, char **);
+int lockbench2(int, char **);
+int sembench(int, char **);
+int cvbench(int, char **);
+int spinbench(int, char **);
+
 /* filesystem tests */
 int fstest(int, char **);
 int readstress(int, char **);
@@ -74,6 +83,8 @@ int malloctest(int, char **);
 int mallocstress(int, char **);
 int malloctest3(int, char **);
 int malloctest4(int, char **);
+int kmallocbench(int, char **);
+int kmallocfrag(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
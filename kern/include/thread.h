@@ -41,6 +41,10 @@
 #include <threadlist.h>
 
 struct cpu;
+struct addrspace;
+struct lock;
+struct proc;
+struct sched_attr;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -56,6 +60,21 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/*
+ * CPU time, in cycles (see mainbus_cycles). Interrupt time is what
+ * interrupt handlers used while the thread was the current one.
+ */
+struct cputimes {
+	uint64_t ct_utime;		/* in user mode */
+	uint64_t ct_stime;		/* in the kernel */
+	uint64_t ct_itime;		/* in interrupt handlers */
+};
+
+/* What thread_charge charges the time since its last call to */
+#define CT_USER		0
+#define CT_SYS		1
+#define CT_INTR		2
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -82,7 +101,34 @@ struct thread {
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
+	struct thread *t_wakenext;	/* On its cpu's c_wakeups */
 	struct proc *t_proc;		/* Process thread belongs to */
+	struct addrspace *t_loadas;	/* Being loaded by exec, in place of
+					   the process's (see proc_getas) */
+	int t_policy;			/* Scheduling class (kern/sched.h) */
+	unsigned t_priority;		/* Run queue level, 0 is highest */
+	unsigned t_inherit;		/* Better level lent by lock waiters,
+					   or THREAD_NOINHERIT (synch.c) */
+	struct lock *t_blockedon;	/* Lock it's asleep for, or NULL */
+	struct lock *t_pilocks;		/* Held locks it was lent a level
+					   through (lk_pinext chain) */
+	unsigned t_ticks;		/* Hardclocks used at this level */
+	unsigned t_budget;		/* SCHED_DEADLINE: ticks per period */
+	unsigned t_period;		/* ... of this many ticks */
+	unsigned t_used;		/* Ticks used this period */
+	uint64_t t_deadline;		/* Tick this period ends at */
+	bool t_throttled;		/* Used it up; time shared until the
+					   period ends */
+	struct cpu *t_lastcpu;		/* CPU thread last ran on */
+	unsigned t_lastran;		/* Its c_hardclocks when we stopped */
+	uint32_t t_cpumask;		/* CPUs it may run on (bit N: cpu N) */
+	struct cputimes t_times;	/* CPU time used so far */
+	uint64_t t_timestamp;		/* Cycle count when t_times was updated */
+	uint64_t t_wakeat;		/* Nanoseconds when woken, or 0 (see
+					   schedlat_enable) */
+	unsigned t_wakekind;		/* SL_* for that wakeup */
+	unsigned t_epochnest;		/* Open read sections (epoch.h) */
+	bool t_resched;			/* Preemption put off by hardclock */
 
 	/*
 	 * Interrupt state fields.
@@ -108,6 +154,18 @@ struct thread {
 	/* add more here as needed */
 };
 
+/* Affinity masks: every cpu, and whether T may run on cpu C */
+#define THREAD_ALLCPUS 0xffffffff
+#define THREAD_CPU_OK(t, c) (((t)->t_cpumask & (1U << (c)->c_number)) != 0)
+
+/*
+ * The level T is scheduled at: its own, or the better one lent to it
+ * by threads waiting for a lock it holds (priority inheritance).
+ */
+#define THREAD_NOINHERIT (~0U)
+#define THREAD_LEVEL(t) \
+	((t)->t_inherit < (t)->t_priority ? (t)->t_inherit : (t)->t_priority)
+
 /*
  * Array of threads.
  */
@@ -121,8 +179,13 @@ DEFARRAY(thread, THREADINLINE);
 /* Call once during system startup to allocate data structures. */
 void thread_bootstrap(void);
 
-/* Call late in system startup to get secondary CPUs running. */
+/*
+ * Call in system startup to get secondary CPUs running. They come up
+ * while the rest of startup goes on; thread_wait_cpus waits until
+ * they all have, and is called at the end of it.
+ */
 void thread_start_cpus(void);
+void thread_wait_cpus(void);
 
 /* Call during panic to stop other threads in their tracks */
 void thread_panic(void);
@@ -157,16 +220,77 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Yield if the current thread ought to give up the cpu: hardclock
+ * wanted to preempt it but couldn't at the time, or a thread at a
+ * better level is waiting here. Otherwise (and where it isn't safe to
+ * switch: holding spinlocks, in an interrupt or a read section) it
+ * does nothing. For long loops in the kernel to call between steps.
+ */
+void cond_resched(void);
+
+/*
+ * Lend thread T the scheduling level LEVEL, if that's better than the
+ * one it's been lent already, moving it up its cpu's run queue if it's
+ * waiting there. For priority inheritance in synch.c.
+ */
+void thread_lend(struct thread *t, unsigned level);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
+/*
+ * Charge the current thread for one hardclock. Returns true if it
+ * should give up the cpu. Called from the timer interrupt.
+ */
+bool thread_tick(void);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
  */
 void thread_consider_migration(void);
 
+/*
+ * Restrict thread T to the cpus in MASK (bit N for cpu number N).
+ * Bits for cpus that don't exist are dropped; if none are left,
+ * returns EINVAL. New threads get the mask of the thread that forked
+ * them. A thread that is on a cpu it may no longer use is moved the
+ * next time it is switched out or wakes up.
+ */
+int thread_setaffinity(struct thread *t, uint32_t mask);
+
+/*
+ * Put thread T in the scheduling class SA describes (see kern/sched.h),
+ * or for thread_setsched_proc, all the threads of process P at once.
+ * Returns EINVAL if SA doesn't make sense, or for SCHED_DEADLINE,
+ * EBUSY if there isn't the cpu time left to promise it. New threads
+ * start out in SCHED_OTHER, whatever forked them. thread_getsched
+ * fills in SA with T's class.
+ */
+int thread_setsched(struct thread *t, const struct sched_attr *sa);
+int thread_setsched_proc(struct proc *p, const struct sched_attr *sa);
+void thread_getsched(struct thread *t, struct sched_attr *sa);
+
+/*
+ * The number of cpus; they are numbered 0 to one less than that.
+ * thread_getcpu returns cpu number NUM.
+ */
+unsigned thread_numcpus(void);
+struct cpu *thread_getcpu(unsigned num);
+
+/*
+ * Add the time since the last call to the current thread's user,
+ * system or interrupt time (WHAT is CT_USER, CT_SYS or CT_INTR).
+ * Called with interrupts off, by the trap code when the cpu changes
+ * modes and by thread_switch.
+ */
+void thread_charge(unsigned what);
+
+/* DST += SRC */
+void cputimes_add(struct cputimes *dst, const struct cputimes *src);
+
 
 #endif /* _THREAD_H_ */
@@ -0,0 +1,46 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/*
+ * Kernel timers.
+ *
+ * A timer calls its function once, a given number of hardclock ticks
+ * (1/HZ of a second each) after it is added. Pending timers sit in a
+ * hierarchical timer wheel (see timer.c) and cost nothing until they
+ * are due. The function is called from the timer interrupt, with no
+ * locks held, so it may not sleep; it usually wakes somebody up.
+ *
+ *    timer_init   - set up T to call FUNC(ARG).
+ *    timer_add    - fire T TICKS ticks from now (T must not be pending).
+ *    timer_cancel - take T off the wheel. Returns false if T wasn't
+ *                   pending, that is, it has fired or is firing now.
+ *    timer_now    - ticks since boot.
+ *    timer_ticks  - number of ticks that is at least TS long.
+ *    timer_tick   - advance the wheel; called from hardclock on cpu 0.
+ *    timer_idle   - cpu 0 is stopping its clock: how many ticks (at
+ *                   most MAX) until the wheel has something to do.
+ *                   Until timer_busy, adding a timer due sooner
+ *                   kicks cpu 0 (hardclock_kick).
+ *    timer_busy   - cpu 0's clock is running again.
+ */
+
+#include <kern/time.h>
+
+struct timer {
+	struct timer *tm_next;		/* next timer in the same slot */
+	struct timer **tm_prevp;	/* what points at us; NULL if not pending */
+	uint64_t tm_expires;		/* tick we fire at */
+	void (*tm_func)(void *);	/* what to call */
+	void *tm_arg;			/* argument for tm_func */
+};
+
+void timer_init(struct timer *t, void (*func)(void *), void *arg);
+void timer_add(struct timer *t, unsigned ticks);
+bool timer_cancel(struct timer *t);
+uint64_t timer_now(void);
+unsigned timer_ticks(const struct timespec *ts);
+void timer_tick(void);
+unsigned timer_idle(unsigned max);
+void timer_busy(void);
+
+#endif /* _TIMER_H_ */
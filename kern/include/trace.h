@@ -0,0 +1,51 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/*
+ * Kernel tracepoints.
+ *
+ * TRACE(type, arg1, arg2) in a hot path records an event (a TR_* from
+ * kern/trace.h, which also says what the args are) if its class is
+ * turned on; when it isn't, all it costs is testing a bit. Records
+ * go into a ring of TRACE_SIZE on each cpu, which only that cpu
+ * writes, with interrupts off, so no locks are taken and tracepoints
+ * can go anywhere, interrupt handlers included. Once a ring is full
+ * the oldest records are overwritten.
+ *
+ * If there's a trace161 control device (ltrace) each record can also
+ * be sent to it with ltrace_debug, as (type << 24) | (arg1 & 0xffffff),
+ * so System/161 prints and timestamps it as it happens.
+ *
+ * Functions:
+ *    trace_start     - clear the rings and start recording the classes
+ *                      in MASK (TRACE_* bits), also to ltrace if
+ *                      MIRROR. ENOMEM if there's no memory for rings.
+ *    trace_stop      - stop recording.
+ *    trace_save      - stop, and write the rings to the file PATH in
+ *                      the format in kern/trace.h.
+ *    trace_setmirror - called by the ltrace driver with the function
+ *                      to mirror records with.
+ *    trace_record    - record an event; use TRACE instead.
+ */
+
+#include <kern/trace.h>
+
+#define TRACE_SIZE	4096	/* records per cpu; a power of 2 */
+
+extern volatile uint32_t trace_mask;
+
+#define TRACE(type, arg1, arg2) \
+	do { \
+		if (trace_mask & (1U << TR_CLASS(type))) { \
+			trace_record(type, (uint32_t)(arg1), \
+				     (uint32_t)(arg2)); \
+		} \
+	} while (0)
+
+int trace_start(uint32_t mask, bool mirror);
+void trace_stop(void);
+int trace_save(const char *path);
+void trace_setmirror(void (*fn)(uint32_t code));
+void trace_record(unsigned type, uint32_t arg1, uint32_t arg2);
+
+#endif /* _TRACE_H_ */
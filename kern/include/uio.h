@@ -78,8 +78,22 @@ struct uio {
 	enum uio_seg      uio_segflg;	/* What kind of pointer we have */
 	enum uio_rw       uio_rw;	/* Whether op is a read or write */
 	struct addrspace *uio_space;	/* Address space for user pointer */
+	unsigned          uio_flags;	/* UIO_* flags below */
 };
 
+/*
+ * Flags.
+ *
+ * UIO_PAGEMOVE lets uiomove move whole pages of a user buffer through
+ * the address space's page table: when the kernel buffer and the user
+ * address are both page aligned and at least a page is left, resident
+ * pages are copied frame to frame with pagecopy (see vm_pagemove in
+ * vm.c) and only the rest goes through copyin/copyout. That's what
+ * reads and writes of whole pages from page-backed files (tmpfs, the
+ * emufs page cache) get. It only makes a difference to user uios.
+ */
+#define UIO_PAGEMOVE	0x1
+
 
 /*
  * Copy data from a kernel buffer to a data region defined by a uio struct,
@@ -95,14 +109,15 @@ struct uio {
  *   (4) set up uio_seg and uio_rw correctly;
  *   (5) if uio_seg is UIO_SYSSPACE, set uio_space to NULL; otherwise,
  *       initialize uio_space to the address space in which the buffer
- *       should be found.
+ *       should be found;
+ *   (6) set uio_flags (0 if in doubt).
  *
  * After calling,
  *   (1) the contents of uio_iov and uio_iovcnt may be altered and
  *       should not be interpreted;
  *   (2) uio_offset will have been incremented by the amount transferred;
  *   (3) uio_resid will have been decremented by the amount transferred;
- *   (4) uio_segflg, uio_rw, and uio_space will be unchanged.
+ *   (4) uio_segflg, uio_rw, uio_space, and uio_flags will be unchanged.
  *
  * uiomove() may be called repeatedly on the same uio to transfer
  * additional data until the available buffer space the uio refers to
@@ -3,10 +3,35 @@
 
 #include <types.h>
 #include <uio.h>
+#include <vm.h>
 
 /* helper for setting up a uio/iovec for read and write operations*/
 void uio_init(struct uio *u, struct iovec *iov,
     userptr_t buf, size_t len,
     off_t offset, enum uio_rw rw_type);
 
+/* helpers for readv/writev: copy in the user's iovec array, and set up a uio over all of it */
+int uio_copyin_iovecs(userptr_t uiov, int iovcnt,
+    struct iovec **iovp, size_t *lenp);
+void uio_init_iovecs(struct uio *u, struct iovec *iov,
+    int iovcnt, size_t len,
+    off_t offset, enum uio_rw rw_type);
+
+/*
+ * Pre-faulting for large transfers: uio_prefault faults in and wires
+ * the user pages of a uio of at least UIO_PREFAULT_MIN bytes (its
+ * first UIO_PREFAULT_MAX pages) before the caller takes any file
+ * locks, and uio_unwire lets them go once the transfer is done.
+ */
+#define UIO_PREFAULT_MIN	(4 * PAGE_SIZE)
+#define UIO_PREFAULT_MAX	64
+
+struct uio_wired {
+	paddr_t uw_frames[UIO_PREFAULT_MAX];
+	unsigned uw_n;
+};
+
+void uio_prefault(const struct uio *u, struct uio_wired *uw);
+void uio_unwire(struct uio_wired *uw);
+
 #endif
\ No newline at end of file
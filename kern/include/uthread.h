@@ -0,0 +1,40 @@
+#ifndef _UTHREAD_H_
+#define _UTHREAD_H_
+
+/*
+ * User threads: more than one thread running in a process, sharing its address space and file table (see
+ * syscall/thr_syscall.c). Each thread made by thr_create has a record on its process's p_uthreads, with its own
+ * user stack, THR_STACKSIZE bytes of mmap'd memory. The first thread of a process has no record and can't be joined.
+ *
+ * When a thread calls _exit or execv (or dies of a fatal trap) the others have to go first. thr_killothers sets
+ * p_thrkill, wakes whoever of them sleeps somewhere it knows about (thr_join, futex_wait, waitpid, poll) and waits
+ * until they have all left, each through thr_leave on its way back to user mode. A thread blocked anywhere else in the
+ * kernel (a console read, say) leaves when that call finishes. thr_killothers returns false if another thread is
+ * already doing it, in which case the caller must leave too.
+ *
+ * thr_reset forgets the other threads after an exec (their stacks were in the old address space); thr_forget frees
+ * what is left of the records when the process is destroyed.
+ */
+
+#include <cdefs.h>
+#include <kern/thr.h>
+
+struct proc;
+struct thread;
+
+struct uthread {
+	int ut_tid;
+	struct thread *ut_thread;	/* NULL until it starts, and again once it has exited */
+	vaddr_t ut_stack;		/* lowest address of its user stack */
+	bool ut_exited;
+	bool ut_joining;		/* somebody is already waiting in thr_join */
+	userptr_t ut_value;		/* what it passed to thr_exit */
+	struct uthread *ut_next;
+};
+
+bool thr_killothers(struct proc *p);
+__DEAD void thr_leave(void);
+void thr_reset(struct proc *p);
+void thr_forget(struct proc *p);
+
+#endif /* _UTHREAD_H_ */
@@ -57,6 +57,10 @@ struct vnode;  /* abstract structure for an on-disk file (vnode.h) */
  *    vfs_sync      - force all dirty buffers to disk
  *    vfs_getroot   - get root vnode for the filesystem named DEVNAME
  *    vfs_getdevname - get mounted device name for the filesystem passed in
+ *    vfs_forgetcwds - make every process find the name of its current
+ *                    directory again on its next getcwd (call after
+ *                    anything that can rename directories)
+ *    vfs_devstats  - print every disk's I/O counters (see blkq.h)
  */
 
 int vfs_setcurdir(struct vnode *dir);
@@ -65,6 +69,8 @@ int vfs_getcurdir(struct vnode **retdir);
 int vfs_sync(void);
 int vfs_getroot(const char *devname, struct vnode **result);
 const char *vfs_getdevname(struct fs *fs);
+void vfs_forgetcwds(void);
+size_t vfs_devstats(char *buf, size_t len, size_t pos);
 
 /*
  * VFS layer mid-level operations.
@@ -74,12 +80,18 @@ const char *vfs_getdevname(struct fs *fs);
  *                     goes to the correct filesystem.
  *    vfs_lookparent - Likewise, for VOP_LOOKPARENT.
  *
- * Both of these may destroy the path passed in.
+ * Both of these may destroy the path passed in. The -at versions
+ * start a relative name from directory DIR instead of the current
+ * directory (or from it too, if DIR is NULL); with a directory
+ * already in hand that's a lookup of just the names after it.
  */
 
 int vfs_lookup(char *path, struct vnode **result);
 int vfs_lookparent(char *path, struct vnode **result,
 		   char *buf, size_t buflen);
+int vfs_lookupat(struct vnode *dir, char *path, struct vnode **result);
+int vfs_lookparentat(struct vnode *dir, char *path, struct vnode **result,
+		     char *buf, size_t buflen);
 
 /*
  * VFS layer high-level operations on pathnames
@@ -99,6 +111,9 @@ int vfs_lookparent(char *path, struct vnode **result,
  *
  *    vfs_close  - Close a vnode opened with vfs_open. Does not fail.
  *                 (See vfspath.c for a discussion of why.)
+ *
+ * vfs_openat, vfs_mkdirat, vfs_removeat and vfs_rmdirat are the same
+ * with relative paths starting from DIR, as for vfs_lookupat.
  */
 
 int vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret);
@@ -111,6 +126,12 @@ int vfs_remove(char *path);
 int vfs_rmdir(char *path);
 int vfs_rename(char *oldpath, char *newpath);
 
+int vfs_openat(struct vnode *dir, char *path, int openflags, mode_t mode,
+	       struct vnode **ret);
+int vfs_mkdirat(struct vnode *dir, char *path, mode_t mode);
+int vfs_removeat(struct vnode *dir, char *path);
+int vfs_rmdirat(struct vnode *dir, char *path);
+
 int vfs_chdir(char *path);
 int vfs_getcwd(struct uio *buf);
 
@@ -157,6 +178,13 @@ int vfs_getcwd(struct uio *buf);
  *                    specified device.
  *
  *    vfs_unmountall - Unmount all mounted filesystems.
+ *
+ *    vfs_claimdev  - Get the device behind the mountable name DEVNAME,
+ *                    for another device built on top of it (such as
+ *                    a stripe set). It must not have a filesystem
+ *                    mounted, and none can be mounted on it after.
+ *
+ *    vfs_unclaimdev - Give back a device claimed with vfs_claimdev.
  */
 
 void vfs_bootstrap(void);
@@ -173,6 +201,8 @@ int vfs_mount(const char *devname, void *data,
 			       struct fs **result));
 int vfs_unmount(const char *devname);
 int vfs_unmountall(void);
+int vfs_claimdev(const char *devname, struct device **ret);
+void vfs_unclaimdev(const char *devname);
 
 /*
  * Array of vnodes.
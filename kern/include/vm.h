@@ -66,6 +66,62 @@ void vm_tlbshootdown(const struct tlbshootdown *);
 
 /* A6 */
 paddr_t alloc_page(void);
+paddr_t alloc_zeroed_page(void);
 void free_page(paddr_t pa);
+void page_incref(paddr_t pa);
+bool page_is_shared(paddr_t pa);
+paddr_t page_zero_ref(void);
+bool page_is_zero(paddr_t pa);
+
+/* copy or zero one whole page, given page-aligned kernel addresses (see arch/mips/vm/page.c) */
+void pagecopy(void *dst, const void *src);
+void pagezero(void *dst);
+
+/* move whole resident pages between a kernel buffer and an address space by their frames, for uiomove (see vm.c) */
+struct addrspace;
+unsigned vm_pagemove(struct addrspace *as, vaddr_t uva, void *kbuf, unsigned npages, bool touser);
+
+/* fault in and wire up to max pages of the user buffer at uva (for writing to it if touser) ahead of a transfer, so
+   the copy doesn't fault with filesystem locks held. The frames go in wired for vm_unwire; returns how many */
+unsigned vm_prefault(struct addrspace *as, vaddr_t uva, size_t len, bool touser, paddr_t *wired, unsigned max);
+void vm_unwire(const paddr_t *wired, unsigned n);
+
+/* number of neighbouring resident pages vm_fault preloads into the TLB on a miss (see vm.c), at most VM_FAULTAROUND_MAX */
+#define VM_FAULTAROUND_MAX 16
+extern unsigned vm_faultaround;
+
+/* number of following shared pages vm_fault copies along with a sequential copy-on-write fault (see vm.c), at most
+   VM_COWBATCH_MAX; batches of VM_COWFARM_MIN pages or more are split with an idle cpu */
+#define VM_COWBATCH_MAX 16
+#define VM_COWFARM_MIN 8
+extern unsigned vm_cowbatch;
+
+/*
+ * Per address space VM counters, reported by getrusage() and the kernel menu. Everything is updated by the thread
+ * running in the as (vm_fault, as_copy, as_release) except vs_evictions, which only the pager touches. So
+ * vs_resident counts the pages the as brought in minus the ones it gave back, and the pages actually resident
+ * are vs_resident - vs_evictions (VMSTATS_RESIDENT); a swapped out page that gets released changes neither.
+ */
+struct vmstats {
+	unsigned vs_tlbmisses;    /* misses that reached vm_fault (not the ones the UTLB handler refilled) */
+	unsigned vs_zerofills;    /* pages zero filled on first write */
+	unsigned vs_cowcopies;    /* copy-on-write copies */
+	unsigned vs_pageins;      /* pages read from swap or the executable */
+	unsigned vs_evictions;    /* pages the pager wrote out to swap */
+	unsigned vs_resident;     /* see above */
+	unsigned vs_maxresident;  /* high water mark of VMSTATS_RESIDENT */
+};
+#define VMSTATS_RESIDENT(vs) ((vs)->vs_resident - (vs)->vs_evictions)
+
+void vmstats_add(struct vmstats *to, const struct vmstats *from);
+void vmstats_print(const char *name, const struct vmstats *vs);
+
+/* shared file page frames, see vm/textcache.c (textcache_purge is in vnode.h) */
+struct vnode;
+struct uio;
+paddr_t textcache_lookup(struct vnode *vn, off_t offset);
+unsigned textcache_gen(struct vnode *vn);
+void textcache_insert(struct vnode *vn, off_t offset, paddr_t pa, unsigned gen);
+int textcache_read(struct vnode *vn, struct uio *uio);
 
 #endif /* _VM_H_ */
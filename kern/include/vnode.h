@@ -32,7 +32,10 @@
 
 #include <spinlock.h>
 struct uio;
+struct textcache;
+struct elfimage;
 struct stat;
+struct pollset;
 
 
 /*
@@ -49,14 +52,17 @@ struct stat;
  * Note: vn_fs may be null if the vnode refers to a device.
  */
 struct vnode {
-	int vn_refcount;                /* Reference count */
-	struct spinlock vn_countlock;   /* Lock for vn_refcount */
+	volatile unsigned vn_refcount;  /* Reference count (atomic.h) */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
 	void *vn_data;                  /* Filesystem-specific data */
 
 	const struct vnode_ops *vn_ops; /* Functions on this vnode */
+
+	struct textcache *vn_text;      /* Shared text frames (vm/textcache.c) */
+	unsigned vn_textgen;            /* Bumped by each textcache_purge */
+	struct elfimage *vn_elf;        /* Parsed ELF layout (loadelf.c) */
 };
 
 /*
@@ -98,6 +104,17 @@ struct vnode {
  *                      handled in the normal fashion.
  *                      On non-directory objects, return ENOTDIR.
  *
+ *    vop_getdirentries - Read as many entries from a directory as fit
+ *                      into a uio, starting from the one the offset
+ *                      names (the same positions as vop_getdirentry),
+ *                      as struct dirent records (kern/dirent.h); set
+ *                      the offset to the first one that didn't fit.
+ *                      Only whole records are transferred; nothing
+ *                      means the end of the directory, provided there
+ *                      was room for DIRENT_MAXRECLEN. See
+ *                      vnode_putdirent below.
+ *                      On non-directory objects, return ENOTDIR.
+ *
  *    vop_write       - Write data from uio to file at offset specified
  *                      in the uio, updating uio_resid to reflect the
  *                      amount written, and updating uio_offset to match.
@@ -120,9 +137,41 @@ struct vnode {
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
- *    vop_mmap        - Map file into memory. If you implement this
- *                      feature, you're responsible for choosing the
- *                      arguments for this operation.
+ *    vop_datasync    - Force the file's data from START to START+LEN
+ *                      (to the end of the file if LEN is 0) to stable
+ *                      storage, along with whatever it takes to read
+ *                      it back, such as the size and block map, but
+ *                      not other changes to the inode.
+ *
+ *    vop_poll        - Return which of EVENTS (POLLIN, POLLOUT, ...;
+ *                      see kern/poll.h) the file is ready for right
+ *                      now, plus POLLERR and POLLHUP if they apply.
+ *                      Unless PS is NULL, first put PS on the wait
+ *                      queue that's woken when that might change
+ *                      (with poll_wait; see poll.h).
+ *
+ *    vop_seekhole    - Find where the first hole (if HOLE is true) or
+ *                      the first data (if not) at or after byte POS
+ *                      is, and hand it back in RESULT. The end of the
+ *                      file counts as a hole. If POS is at or past the
+ *                      end, or there's no data after it, return ENXIO.
+ *                      See vnode_seekhole_none below for files
+ *                      without holes.
+ *
+ *    vop_fallocate   - Make sure there are blocks for the bytes from
+ *                      START to START+LEN, allocating them (as zeros)
+ *                      where there are none, and make the file that
+ *                      long if it's shorter, unless MODE has
+ *                      FALLOC_FL_KEEP_SIZE. With FALLOC_FL_PUNCH_HOLE
+ *                      instead free the blocks in the range and zero
+ *                      the bytes of any it only partly covers; the
+ *                      size stays the same. The modes are in
+ *                      kern/fcntl.h.
+ *
+ *    vop_mmap        - Check whether the file can be mapped into memory.
+ *                      Returns 0 if so; mapped pages are then read with
+ *                      vop_read and shared mappings written back with
+ *                      vop_write.
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
@@ -187,12 +236,19 @@ struct vnode_ops {
 	int (*vop_read)(struct vnode *file, struct uio *uio);
 	int (*vop_readlink)(struct vnode *link, struct uio *uio);
 	int (*vop_getdirentry)(struct vnode *dir, struct uio *uio);
+	int (*vop_getdirentries)(struct vnode *dir, struct uio *uio);
 	int (*vop_write)(struct vnode *file, struct uio *uio);
 	int (*vop_ioctl)(struct vnode *object, int op, userptr_t data);
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
 	int (*vop_gettype)(struct vnode *object, mode_t *result);
 	bool (*vop_isseekable)(struct vnode *object);
 	int (*vop_fsync)(struct vnode *object);
+	int (*vop_datasync)(struct vnode *file, off_t start, off_t len);
+	int (*vop_poll)(struct vnode *object, int events, struct pollset *ps);
+	int (*vop_seekhole)(struct vnode *file, off_t pos, bool hole,
+			    off_t *result);
+	int (*vop_fallocate)(struct vnode *file, int mode,
+			     off_t start, off_t len);
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
 	int (*vop_truncate)(struct vnode *file, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
@@ -231,14 +287,19 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_GETDIRENTRIES(vn, uio)      (__VOP(vn,getdirentries)(vn, uio))
+#define VOP_WRITE(vn, uio)              (textcache_purge(vn), loadelf_purge(vn), textcache_repurge(vn, __VOP(vn, write)(vn, uio)))
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
+#define VOP_DATASYNC(vn, start, len)    (__VOP(vn, datasync)(vn, start, len))
+#define VOP_POLL(vn, events, ps)        (__VOP(vn, poll)(vn, events, ps))
+#define VOP_SEEKHOLE(vn, pos, hole, res) (__VOP(vn, seekhole)(vn, pos, hole, res))
+#define VOP_FALLOCATE(vn, mode, start, len) (textcache_purge(vn), loadelf_purge(vn), textcache_repurge(vn, __VOP(vn, fallocate)(vn, mode, start, len)))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_TRUNCATE(vn, pos)           (textcache_purge(vn), loadelf_purge(vn), textcache_repurge(vn, __VOP(vn, truncate)(vn, pos)))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -252,6 +313,19 @@ struct vnode_ops {
 #define VOP_LOOKUP(vn, name, res)       (__VOP(vn, lookup)(vn, name, res))
 #define VOP_LOOKPARENT(vn,nm,res,bf,ln) (__VOP(vn,lookparent)(vn,nm,res,bf,ln))
 
+/*
+ * Drop the vnode's cached text frames (see vm/textcache.c). Done on
+ * every write and truncate so later execs see the new contents, and
+ * when the vnode is cleaned up. It's done both before and after the
+ * change (textcache_repurge purges again and passes RESULT on), as a
+ * page read while the change is in progress may be cached meanwhile.
+ */
+void textcache_purge(struct vnode *);
+int textcache_repurge(struct vnode *, int result);
+
+/* The same for the vnode's parsed ELF headers (see syscall/loadelf.c). */
+void loadelf_purge(struct vnode *);
+
 /*
  * Consistency check
  */
@@ -259,13 +333,39 @@ void vnode_check(struct vnode *, const char *op);
 
 /*
  * Reference count manipulation (handled above filesystem level)
+ *
+ * vnode_decref_unless_last drops a reference if it isn't the last one
+ * and returns true; if it is, it leaves the count at 1 and returns
+ * false. VOP_DECREF uses it to hand the last reference to VOP_RECLAIM,
+ * and VOP_RECLAIM uses it to give up if somebody picked the vnode up
+ * again in the meantime.
  */
 void vnode_incref(struct vnode *);
 void vnode_decref(struct vnode *);
+bool vnode_decref_unless_last(struct vnode *);
 
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
 
+/*
+ * A vop_datasync that syncs the whole file with vop_fsync, for file
+ * systems that can't do any better (vnode.c).
+ */
+int vnode_datasync_slow(struct vnode *file, off_t start, off_t len);
+
+/*
+ * A vop_poll for files that are always ready to read and write, like
+ * regular files and directories (vnode.c).
+ */
+int vnode_poll_always(struct vnode *object, int events, struct pollset *ps);
+
+/*
+ * A vop_seekhole for files that are all data, with only the hole at
+ * the end (vnode.c).
+ */
+int vnode_seekhole_none(struct vnode *file, off_t pos, bool hole,
+			off_t *result);
+
 /*
  * Vnode initialization (intended for use by filesystem code)
  * The reference count is initialized to 1.
@@ -279,6 +379,20 @@ int vnode_init(struct vnode *, const struct vnode_ops *ops,
  */
 void vnode_cleanup(struct vnode *);
 
+/*
+ * For implementing vop_getdirentries (vfsdirent.c).
+ *
+ *    vnode_putdirent - Add a record for NAME to the uio, unless it
+ *                      doesn't fit, which gives ENOSPC. TYPE is an
+ *                      S_IF* value, or 0 if not known.
+ *    vnode_getdirentries_slow - A vop_getdirentries made of calls to
+ *                      vop_getdirentry, for file systems that don't
+ *                      have anything better.
+ */
+int vnode_putdirent(struct uio *uio, uint32_t ino, mode_t type,
+		    const char *name);
+int vnode_getdirentries_slow(struct vnode *dir, struct uio *uio);
+
 /*
  * Common stubs for vnode functions that just fail, in various ways.
  */
@@ -290,6 +404,10 @@ int vopfail_mmap_isdir(struct vnode *vn /* add stuff */);
 int vopfail_mmap_perm(struct vnode *vn /* add stuff */);
 int vopfail_mmap_nosys(struct vnode *vn /* add stuff */);
 int vopfail_truncate_isdir(struct vnode *vn, off_t pos);
+int vopfail_fallocate_isdir(struct vnode *vn, int mode, off_t start,
+			    off_t len);
+int vopfail_fallocate_nosys(struct vnode *vn, int mode, off_t start,
+			    off_t len);
 int vopfail_creat_notdir(struct vnode *vn, const char *name, bool excl,
 			 mode_t mode, struct vnode **result);
 int vopfail_symlink_notdir(struct vnode *vn, const char *contents,
@@ -36,6 +36,7 @@
 
 
 struct spinlock; /* in spinlock.h */
+struct thread; /* in thread.h */
 struct wchan; /* Opaque */
 
 /*
@@ -66,15 +67,41 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_sleep, but give up after TICKS hardclock ticks if nobody
+ * has woken us by then. Returns true on timeout.
+ */
+bool wchan_timedsleep(struct wchan *wc, struct spinlock *lk, unsigned ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
- * The associated spinlock should be locked.
+ * The associated spinlock should be locked. wchan_wakeone returns the
+ * thread it woke (or NULL); since the thread has to get LK back
+ * before wchan_sleep returns, the caller can still tell it something
+ * while it holds LK.
  *
  * The current implementation is FIFO but this is not promised by the
  * interface.
  */
-void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
+struct thread *wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * The best scheduling level (THREAD_LEVEL) of the threads sleeping on
+ * the channel, or THREAD_NOINHERIT if there are none. The associated
+ * spinlock must be locked.
+ */
+unsigned wchan_toplevel(struct wchan *wc, struct spinlock *lk);
+
+/*
+ * Move up to MAX sleeping threads from FROM to TO without waking
+ * them (oldest first), and return how many moved. Both spinlocks must
+ * be held. The threads still relock FROMLK when they wake, so they
+ * must expect to have been moved. This is for wait morphing: see
+ * cv_broadcast.
+ */
+unsigned wchan_move(struct wchan *from, struct spinlock *fromlk,
+		    struct wchan *to, struct spinlock *tolk, unsigned max);
+
 
 #endif /* _WCHAN_H_ */
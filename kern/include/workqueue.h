@@ -0,0 +1,45 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Deferred work.
+ *
+ * A work item is a function to be called soon, in a thread, rather
+ * than right now. It can be queued from anywhere, interrupt handlers
+ * included, and is run by the worker thread of the cpu that queued
+ * it (or that it was queued on), so the function may sleep, take
+ * locks, allocate memory, and so on; an interrupt handler does the
+ * part that must be done at once and leaves the rest to it. Each cpu's items are run in the order
+ * they were queued.
+ *
+ * The item belongs to the caller (usually it's embedded in whatever
+ * it works on), so queueing never allocates. An item is queued at
+ * most once: queueing it again before it has started running does
+ * nothing, and the one run does the work for both. It may be queued
+ * again, even by its own function, once it has started.
+ *
+ *    work_init          - set up W to call FUNC(ARG).
+ *    workqueue_submit   - queue W on this cpu. Returns false if it
+ *                         was already queued.
+ *    workqueue_submit_cpu - queue W on cpu C instead, to hand work
+ *                         to one that's idle.
+ *    workqueue_startcpu - start this cpu's worker; called by the
+ *                         thread code as each cpu comes up. Items
+ *                         queued before that wait for it.
+ */
+
+struct cpu;
+
+struct work {
+	struct work *w_next;		/* next on the cpu's queue */
+	volatile unsigned w_queued;	/* 1 from submit until it starts */
+	void (*w_func)(void *);		/* what to call */
+	void *w_arg;			/* argument for w_func */
+};
+
+void work_init(struct work *w, void (*func)(void *), void *arg);
+bool workqueue_submit(struct work *w);
+bool workqueue_submit_cpu(struct cpu *c, struct work *w);
+void workqueue_startcpu(void);
+
+#endif /* _WORKQUEUE_H_ */
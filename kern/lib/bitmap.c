@@ -47,11 +47,45 @@
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+/*
+ * Words before HINT are known to be full, so searches start there.
+ * bitmap_alloc still hands out the lowest clear bit (the fd table and
+ * the swap map count on that), so this is a low-water mark rather
+ * than a rotating cursor: allocating moves it up past full words,
+ * and clearing a bit moves it back down.
+ */
 struct bitmap {
         unsigned nbits;
+        unsigned hint;
         WORD_TYPE *v;
 };
 
+/* Words looked at at once while skipping full ones. */
+#define CHUNK_TYPE      uint32_t
+#define CHUNK_WORDS     (sizeof(CHUNK_TYPE) / sizeof(WORD_TYPE))
+#define CHUNK_ALLBITS   (0xffffffff)
+
+/*
+ * Index of the lowest clear bit of a word that isn't all ones. (The
+ * lowest bit is bit 0; that's what ((WORD_TYPE)1 << offset) is.)
+ * The table is the answer for each value of the low four bits.
+ */
+static
+inline
+unsigned
+bitmap_ffz(WORD_TYPE w)
+{
+        static const unsigned char ffz4[16] = {
+                0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4,
+        };
+
+        KASSERT(w != WORD_ALLBITS);
+        if ((w & 0xf) != 0xf) {
+                return ffz4[w & 0xf];
+        }
+        return 4 + ffz4[(w >> 4) & 0xf];
+}
+
 
 struct bitmap *
 bitmap_create(unsigned nbits)
@@ -72,6 +106,7 @@ bitmap_create(unsigned nbits)
 
         bzero(b->v, words*sizeof(WORD_TYPE));
         b->nbits = nbits;
+        b->hint = 0;
 
         /* Mark any leftover bits at the end in use */
         if (words > nbits / BITS_PER_WORD) {
@@ -102,21 +137,27 @@ bitmap_alloc(struct bitmap *b, unsigned *index)
         unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
         unsigned offset;
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
-                        }
-                        KASSERT(0);
+        ix = b->hint;
+        while (ix < maxix) {
+                /* skip full words a chunk at a time, where aligned */
+                if (ix % CHUNK_WORDS == 0 && ix + CHUNK_WORDS <= maxix &&
+                    *(CHUNK_TYPE *)&b->v[ix] == CHUNK_ALLBITS) {
+                        ix += CHUNK_WORDS;
+                        continue;
                 }
+                if (b->v[ix] == WORD_ALLBITS) {
+                        ix++;
+                        continue;
+                }
+
+                offset = bitmap_ffz(b->v[ix]);
+                b->v[ix] |= ((WORD_TYPE)1) << offset;
+                *index = (ix*BITS_PER_WORD)+offset;
+                KASSERT(*index < b->nbits);
+                b->hint = ix;
+                return 0;
         }
+        b->hint = maxix;
         return ENOSPC;
 }
 
@@ -155,6 +196,9 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+        if (ix < b->hint) {
+                b->hint = ix;
+        }
 }
 
 
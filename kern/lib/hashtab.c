@@ -0,0 +1,256 @@
+/*
+ * Hash table (see hashtab.h).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <hashtab.h>
+
+/* The key is copied in right after the struct. */
+struct hashtab_entry {
+	struct hashtab_entry *he_next;
+	uint32_t he_hash;
+	size_t he_keylen;
+	void *he_val;
+};
+
+#define HE_KEY(he) ((const void *)((he) + 1))
+
+/* Buckets in a table's first allocation. */
+#define HASHTAB_MINBUCKETS 8
+
+uint32_t
+hashtab_hash(const void *key, size_t keylen)
+{
+	const unsigned char *p = key;
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for (i=0; i<keylen; i++) {
+		h ^= p[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+struct hashtab *
+hashtab_create(void)
+{
+	struct hashtab *h;
+
+	h = kmalloc(sizeof(*h));
+	if (h != NULL) {
+		hashtab_init(h);
+	}
+	return h;
+}
+
+void
+hashtab_destroy(struct hashtab *h)
+{
+	hashtab_cleanup(h);
+	kfree(h);
+}
+
+void
+hashtab_init(struct hashtab *h)
+{
+	h->ht_buckets = NULL;
+	h->ht_nbuckets = 0;
+	h->ht_num = 0;
+}
+
+void
+hashtab_cleanup(struct hashtab *h)
+{
+	/*
+	 * Require the table to be empty to help avoid memory leaks.
+	 */
+	KASSERT(h->ht_num == 0);
+
+	kfree(h->ht_buckets);
+	h->ht_buckets = NULL;
+	h->ht_nbuckets = 0;
+}
+
+unsigned
+hashtab_num(const struct hashtab *h)
+{
+	return h->ht_num;
+}
+
+/*
+ * Compare keys of the same length. (There's no memcmp in the kernel.)
+ */
+static
+bool
+hashtab_keyeq(const void *a, const void *b, size_t len)
+{
+	const unsigned char *pa = a, *pb = b;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if (pa[i] != pb[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Find the link that points at the entry for KEY, or at the NULL that
+ * ends its chain if there isn't one.
+ */
+static
+struct hashtab_entry **
+hashtab_find(const struct hashtab *h, const void *key, size_t keylen,
+	     uint32_t hash)
+{
+	struct hashtab_entry **hep, *he;
+
+	hep = &h->ht_buckets[hash & (h->ht_nbuckets - 1)];
+	while ((he = *hep) != NULL) {
+		if (he->he_hash == hash && he->he_keylen == keylen &&
+		    hashtab_keyeq(HE_KEY(he), key, keylen)) {
+			break;
+		}
+		hep = &he->he_next;
+	}
+	return hep;
+}
+
+void *
+hashtab_get(const struct hashtab *h, const void *key, size_t keylen)
+{
+	struct hashtab_entry *he;
+
+	if (h->ht_num == 0) {
+		return NULL;
+	}
+	he = *hashtab_find(h, key, keylen, hashtab_hash(key, keylen));
+	return he != NULL ? he->he_val : NULL;
+}
+
+/*
+ * Rehash into NUM buckets. The entries stay where they are; only the
+ * bucket array is new.
+ */
+static
+int
+hashtab_resize(struct hashtab *h, unsigned num)
+{
+	struct hashtab_entry **nb, *he;
+	unsigned i;
+
+	nb = kmalloc(num * sizeof(*nb));
+	if (nb == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<num; i++) {
+		nb[i] = NULL;
+	}
+	for (i=0; i<h->ht_nbuckets; i++) {
+		while ((he = h->ht_buckets[i]) != NULL) {
+			h->ht_buckets[i] = he->he_next;
+			he->he_next = nb[he->he_hash & (num - 1)];
+			nb[he->he_hash & (num - 1)] = he;
+		}
+	}
+	kfree(h->ht_buckets);
+	h->ht_buckets = nb;
+	h->ht_nbuckets = num;
+	return 0;
+}
+
+int
+hashtab_add(struct hashtab *h, const void *key, size_t keylen, void *val)
+{
+	struct hashtab_entry **hep, *he;
+	uint32_t hash;
+	int result;
+
+	KASSERT(val != NULL);
+
+	if (h->ht_nbuckets == 0) {
+		result = hashtab_resize(h, HASHTAB_MINBUCKETS);
+		if (result) {
+			return result;
+		}
+	}
+
+	hash = hashtab_hash(key, keylen);
+	hep = hashtab_find(h, key, keylen, hash);
+	if (*hep != NULL) {
+		return EEXIST;
+	}
+
+	he = kmalloc(sizeof(*he) + keylen);
+	if (he == NULL) {
+		return ENOMEM;
+	}
+	he->he_next = NULL;
+	he->he_hash = hash;
+	he->he_keylen = keylen;
+	he->he_val = val;
+	memcpy(he + 1, key, keylen);
+	*hep = he;
+	h->ht_num++;
+
+	if (h->ht_num > h->ht_nbuckets) {
+		/* If this fails the chains just get longer; not fatal. */
+		(void)hashtab_resize(h, h->ht_nbuckets * 2);
+	}
+	return 0;
+}
+
+void *
+hashtab_remove(struct hashtab *h, const void *key, size_t keylen)
+{
+	struct hashtab_entry **hep, *he;
+	void *val;
+
+	if (h->ht_num == 0) {
+		return NULL;
+	}
+	hep = hashtab_find(h, key, keylen, hashtab_hash(key, keylen));
+	he = *hep;
+	if (he == NULL) {
+		return NULL;
+	}
+	*hep = he->he_next;
+	h->ht_num--;
+
+	val = he->he_val;
+	kfree(he);
+	return val;
+}
+
+void
+hashtab_iter_init(struct hashtab_iter *it, const struct hashtab *h)
+{
+	it->hi_table = h;
+	it->hi_bucket = 0;
+	it->hi_next = NULL;
+}
+
+void *
+hashtab_iter_next(struct hashtab_iter *it)
+{
+	const struct hashtab *h = it->hi_table;
+	struct hashtab_entry *he;
+
+	/*
+	 * Remember the entry after the one returned, rather than the
+	 * entry itself, so the caller can remove the one it got.
+	 */
+	while (it->hi_next == NULL) {
+		if (it->hi_bucket >= h->ht_nbuckets) {
+			return NULL;
+		}
+		it->hi_next = h->ht_buckets[it->hi_bucket++];
+	}
+	he = it->hi_next;
+	it->hi_next = he->he_next;
+	return he->he_val;
+}
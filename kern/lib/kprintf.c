@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <kern/unistd.h>
 #include <stdarg.h>
 #include <lib.h>
@@ -36,6 +37,9 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
+#include <membar.h>
+#include <clock.h>
 #include <mainbus.h>
 #include <vfs.h>          // for vfs_sync()
 
@@ -57,12 +61,319 @@ static struct spinlock kprintf_spinlock;
 
 
 /*
- * Create the kprintf lock. Must be called before creating a second
- * thread or enabling a second CPU.
+ * The kernel log.
+ *
+ * Once the logger thread is running, kprintf doesn't print anything
+ * itself. It formats into its own cpu's ring (c_log in struct cpu)
+ * with interrupts off, which needs no lock, and the logger thread
+ * takes the text out of the rings and prints it. So kprintf only
+ * waits for the console when its ring is full and it is allowed to
+ * sleep; in an interrupt handler, holding a spinlock, or at raised
+ * spl it throws the rest of the message away instead, and the logger
+ * says how much was lost. Output from different cpus comes out in
+ * the order the logger finds it, up to a ring at a time.
+ *
+ * The logger is woken when there is something to print, except by
+ * kprintfs holding a spinlock (the wakeup takes run queue locks);
+ * it looks at the rings every KLOG_POLL ticks anyway to pick those
+ * up.
+ *
+ * Everything that reaches the console also goes into klog_hist,
+ * which keeps the last KLOG_SIZE bytes (see lib.h) for dmesg.
+ *
+ * Until the logger is running, after kprintf_shutdown, in the logger
+ * itself, and in panic, kprintf prints synchronously as it always
+ * did.
+ */
+
+#define KLOG_CHUNK	128		/* Bytes copied at a time */
+#define KLOG_POLL	(HZ / 20)	/* Ticks between looks at the rings */
+
+static char klog_hist[KLOG_SIZE];
+static unsigned klog_histend;		/* Bytes ever put in klog_hist */
+static struct spinlock klog_histlock = SPINLOCK_INITIALIZER;
+
+static struct thread *volatile klog_thread; /* The logger, once running */
+static volatile bool klog_sync;		/* Print synchronously again */
+
+static struct spinlock klog_lock = SPINLOCK_INITIALIZER;
+static struct wchan *klog_wchan;	/* The logger sleeps here */
+static struct wchan *klog_roomwchan;	/* Waiting for the logger to drain */
+static volatile bool klog_asleep;	/* The logger is on klog_wchan */
+
+/*
+ * Send characters to the console. Backend for __printf.
+ */
+static
+void
+console_send(void *junk, const char *data, size_t len)
+{
+	size_t i;
+
+	(void)junk;
+
+	for (i=0; i<len; i++) {
+		putch(data[i]);
+	}
+}
+
+/*
+ * Add characters to klog_hist.
+ */
+static
+void
+klog_save(const char *data, size_t len)
+{
+	size_t i;
+
+	spinlock_acquire(&klog_histlock);
+	for (i=0; i<len; i++) {
+		klog_hist[(klog_histend + i) & (KLOG_SIZE - 1)] = data[i];
+	}
+	klog_histend += len;
+	spinlock_release(&klog_histlock);
+}
+
+/*
+ * Send characters to the console and the log.
+ */
+static
+void
+klog_send(void *junk, const char *data, size_t len)
+{
+	klog_save(data, len);
+	console_send(junk, data, len);
+}
+
+/*
+ * Print characters taken out of a ring. The logger is the only one
+ * doing this, but klog_dump shares the console with it.
+ */
+static
+void
+klog_print(void *junk, const char *data, size_t len)
+{
+	lock_acquire(kprintf_lock);
+	klog_send(junk, data, len);
+	lock_release(kprintf_lock);
+}
+
+/*
+ * True if any cpu's ring has something in it.
+ */
+static
+bool
+klog_pending(void)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = thread_numcpus();
+	for (i=0; i<numcpus; i++) {
+		c = thread_getcpu(i);
+		if (c->c_loghead != c->c_logtail ||
+		    c->c_logdropped != c->c_logreported) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Empty every cpu's ring through OUT, and report anything that was
+ * thrown away. Returns true if there was anything.
+ */
+static
+bool
+klog_drain(void (*out)(void *, const char *, size_t))
+{
+	char buf[KLOG_CHUNK];
+	unsigned i, j, n, head, tail, dropped, numcpus;
+	struct cpu *c;
+	bool any;
+
+	any = false;
+	numcpus = thread_numcpus();
+	for (i=0; i<numcpus; i++) {
+		c = thread_getcpu(i);
+		while ((head = c->c_loghead) != (tail = c->c_logtail)) {
+			/* the text is there once we've seen the head move */
+			membar_load_load();
+			n = head - tail;
+			if (n > sizeof(buf)) {
+				n = sizeof(buf);
+			}
+			for (j=0; j<n; j++) {
+				buf[j] = c->c_log[(tail + j) & (CPU_LOGSIZE - 1)];
+			}
+			/* and our copy is done before the space is reused */
+			membar_any_store();
+			c->c_logtail = tail + n;
+			out(NULL, buf, n);
+			any = true;
+		}
+
+		dropped = c->c_logdropped;
+		if (dropped != c->c_logreported) {
+			snprintf(buf, sizeof(buf),
+				 "[cpu%u: %u bytes of kprintf output lost]\n",
+				 c->c_number, dropped - c->c_logreported);
+			c->c_logreported = dropped;
+			out(NULL, buf, strlen(buf));
+			any = true;
+		}
+	}
+	return any;
+}
+
+/*
+ * Wake the logger if it's asleep. Must not hold any spinlocks.
+ */
+static
+void
+klog_wakeup(void)
+{
+	/* pairs with the barrier in klog_logger, see there */
+	membar_any_any();
+	if (klog_asleep) {
+		spinlock_acquire(&klog_lock);
+		if (klog_asleep) {
+			klog_asleep = false;
+			wchan_wakeone(klog_wchan, &klog_lock);
+		}
+		spinlock_release(&klog_lock);
+	}
+}
+
+/*
+ * The logger thread.
+ */
+static
+void
+klog_logger(void *junk1, unsigned long junk2)
+{
+	bool any;
+
+	(void)junk1;
+	(void)junk2;
+
+	klog_thread = curthread;
+	while (1) {
+		any = klog_drain(klog_print);
+
+		spinlock_acquire(&klog_lock);
+		wchan_wakeall(klog_roomwchan, &klog_lock);
+		if (!any) {
+			/*
+			 * klog_put fills a ring and then looks at
+			 * klog_asleep; we set klog_asleep and then look at
+			 * the rings. With a barrier in between on both
+			 * sides, one of us sees the other.
+			 */
+			klog_asleep = true;
+			membar_any_any();
+			if (!klog_pending()) {
+				wchan_timedsleep(klog_wchan, &klog_lock,
+						 KLOG_POLL);
+			}
+			klog_asleep = false;
+		}
+		spinlock_release(&klog_lock);
+	}
+}
+
+/*
+ * Put LEN characters into the current cpu's ring. When it's full,
+ * wait for the logger to make room if CANWAIT, else drop the rest.
+ */
+static
+void
+klog_put(const char *data, size_t len, bool canwait)
+{
+	struct cpu *c;
+	unsigned i, n;
+	int spl;
+
+	while (len > 0) {
+		spl = splhigh();
+		c = curcpu->c_self;
+		n = CPU_LOGSIZE - (c->c_loghead - c->c_logtail);
+		if (n > len) {
+			n = len;
+		}
+		/* don't write over what the logger may still be copying */
+		membar_any_store();
+		for (i=0; i<n; i++) {
+			c->c_log[(c->c_loghead + i) & (CPU_LOGSIZE - 1)] =
+				data[i];
+		}
+		membar_store_store();
+		c->c_loghead += n;
+		data += n;
+		len -= n;
+		if (len > 0 && !canwait) {
+			c->c_logdropped += len;
+			len = 0;
+		}
+		splx(spl);
+
+		if (len > 0) {
+			/* full; the logger wakes us after each pass */
+			spinlock_acquire(&klog_lock);
+			if (klog_asleep) {
+				klog_asleep = false;
+				wchan_wakeone(klog_wchan, &klog_lock);
+			}
+			if (c->c_loghead - c->c_logtail == CPU_LOGSIZE) {
+				wchan_sleep(klog_roomwchan, &klog_lock);
+			}
+			spinlock_release(&klog_lock);
+		}
+	}
+}
+
+/* What kprintf formats into for klog_put, a chunk at a time. */
+struct klog_out {
+	bool ko_canwait;
+	size_t ko_len;
+	char ko_buf[KLOG_CHUNK];
+};
+
+/*
+ * Backend for __printf when going through the rings.
+ */
+static
+void
+klog_send_ring(void *data, const char *str, size_t len)
+{
+	struct klog_out *ko = data;
+	size_t n;
+
+	while (len > 0) {
+		if (ko->ko_len == sizeof(ko->ko_buf)) {
+			klog_put(ko->ko_buf, ko->ko_len, ko->ko_canwait);
+			ko->ko_len = 0;
+		}
+		n = sizeof(ko->ko_buf) - ko->ko_len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(ko->ko_buf + ko->ko_len, str, n);
+		ko->ko_len += n;
+		str += n;
+		len -= n;
+	}
+}
+
+/*
+ * Create the kprintf lock and start the logger. Must be called
+ * before creating a second thread or enabling a second CPU.
  */
 void
 kprintf_bootstrap(void)
 {
+	int result;
+
 	KASSERT(kprintf_lock == NULL);
 
 	kprintf_lock = lock_create("kprintf_lock");
@@ -70,22 +381,83 @@ kprintf_bootstrap(void)
 		panic("Could not create kprintf_lock\n");
 	}
 	spinlock_init(&kprintf_spinlock);
+
+	klog_wchan = wchan_create("klog");
+	klog_roomwchan = wchan_create("klogroom");
+	if (klog_wchan == NULL || klog_roomwchan == NULL) {
+		panic("Could not create the kernel log's wchans\n");
+	}
+	result = thread_fork("logger", NULL, klog_logger, NULL, 0);
+	if (result) {
+		panic("Could not start the logger: %s\n", strerror(result));
+	}
 }
 
 /*
- * Send characters to the console. Backend for __printf.
+ * Wait until everything kprintf'd so far has been printed, then go
+ * back to printing synchronously. Called during shutdown, while the
+ * logger can still run.
  */
-static
 void
-console_send(void *junk, const char *data, size_t len)
+kprintf_shutdown(void)
 {
-	size_t i;
+	if (klog_thread != NULL && !klog_sync) {
+		spinlock_acquire(&klog_lock);
+		while (klog_pending()) {
+			if (klog_asleep) {
+				klog_asleep = false;
+				wchan_wakeone(klog_wchan, &klog_lock);
+			}
+			wchan_sleep(klog_roomwchan, &klog_lock);
+		}
+		spinlock_release(&klog_lock);
+	}
+	klog_sync = true;
+}
 
-	(void)junk;
+/*
+ * Copy the most recent LEN bytes of the kernel log, or all of it if
+ * there's less, into BUF. Returns how many were copied.
+ */
+size_t
+klog_read(char *buf, size_t len)
+{
+	unsigned start, i;
 
+	spinlock_acquire(&klog_histlock);
+	if (len > KLOG_SIZE) {
+		len = KLOG_SIZE;
+	}
+	if (len > klog_histend) {
+		len = klog_histend;
+	}
+	start = klog_histend - len;
 	for (i=0; i<len; i++) {
-		putch(data[i]);
+		buf[i] = klog_hist[(start + i) & (KLOG_SIZE - 1)];
+	}
+	spinlock_release(&klog_histlock);
+	return len;
+}
+
+/*
+ * Print the kernel log on the console (without logging it again).
+ */
+int
+klog_dump(void)
+{
+	char *buf;
+	size_t len;
+
+	buf = kmalloc(KLOG_SIZE);
+	if (buf == NULL) {
+		return ENOMEM;
 	}
+	len = klog_read(buf, KLOG_SIZE);
+	lock_acquire(kprintf_lock);
+	console_send(NULL, buf, len);
+	lock_release(kprintf_lock);
+	kfree(buf);
+	return 0;
 }
 
 /*
@@ -94,6 +466,7 @@ console_send(void *junk, const char *data, size_t len)
 int
 kprintf(const char *fmt, ...)
 {
+	struct klog_out ko;
 	int chars;
 	va_list ap;
 	bool dolock;
@@ -103,6 +476,19 @@ kprintf(const char *fmt, ...)
 		&& curthread->t_curspl == 0
 		&& curcpu->c_spinlocks == 0;
 
+	if (klog_thread != NULL && !klog_sync && curthread != klog_thread) {
+		ko.ko_canwait = dolock;
+		ko.ko_len = 0;
+		va_start(ap, fmt);
+		chars = __vprintf(klog_send_ring, &ko, fmt, ap);
+		va_end(ap);
+		klog_put(ko.ko_buf, ko.ko_len, ko.ko_canwait);
+		if (curcpu->c_spinlocks == 0) {
+			klog_wakeup();
+		}
+		return chars;
+	}
+
 	if (dolock) {
 		lock_acquire(kprintf_lock);
 	}
@@ -111,7 +497,7 @@ kprintf(const char *fmt, ...)
 	}
 
 	va_start(ap, fmt);
-	chars = __vprintf(console_send, NULL, fmt, ap);
+	chars = __vprintf(klog_send, NULL, fmt, ap);
 	va_end(ap);
 
 	if (dolock) {
@@ -169,7 +555,12 @@ panic(const char *fmt, ...)
 	if (evil == 2) {
 		evil = 3;
 
-		/* Print the message. */
+		/*
+		 * Print whatever the logger hadn't got to yet, then
+		 * the message.
+		 */
+		klog_sync = true;
+		klog_drain(console_send);
 		kprintf("panic: ");
 		va_start(ap, fmt);
 		__vprintf(console_send, NULL, fmt, ap);
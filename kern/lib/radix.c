@@ -0,0 +1,320 @@
+/*
+ * Radix tree (see radix.h).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <radix.h>
+
+/* Levels needed for any 32-bit index. */
+#define RADIX_MAXHEIGHT ((32 + RADIX_BITS - 1) / RADIX_BITS)
+
+struct radix_node {
+	void *rn_slots[RADIX_FANOUT];	/* nodes, or entries at the bottom */
+	unsigned rn_used;		/* non-NULL slots */
+};
+
+/* Largest index a tree of HEIGHT levels can hold. */
+static
+uint32_t
+radix_maxindex(unsigned height)
+{
+	if (height * RADIX_BITS >= 32) {
+		return 0xffffffff;
+	}
+	return (1U << (height * RADIX_BITS)) - 1;
+}
+
+static
+unsigned
+radix_slot(uint32_t index, unsigned level)
+{
+	return (index >> (level * RADIX_BITS)) & (RADIX_FANOUT - 1);
+}
+
+static
+struct radix_node *
+radix_node_create(void)
+{
+	struct radix_node *n;
+	unsigned i;
+
+	n = kmalloc(sizeof(*n));
+	if (n == NULL) {
+		return NULL;
+	}
+	for (i=0; i<RADIX_FANOUT; i++) {
+		n->rn_slots[i] = NULL;
+	}
+	n->rn_used = 0;
+	return n;
+}
+
+struct radix *
+radix_create(void)
+{
+	struct radix *r;
+
+	r = kmalloc(sizeof(*r));
+	if (r != NULL) {
+		radix_init(r);
+	}
+	return r;
+}
+
+void
+radix_destroy(struct radix *r)
+{
+	radix_cleanup(r);
+	kfree(r);
+}
+
+void
+radix_init(struct radix *r)
+{
+	r->r_root = NULL;
+	r->r_height = 0;
+	r->r_num = 0;
+}
+
+void
+radix_cleanup(struct radix *r)
+{
+	/*
+	 * Require the tree to be empty to help avoid memory leaks.
+	 * (Empty nodes are always freed, so then there's no root.)
+	 */
+	KASSERT(r->r_num == 0);
+	KASSERT(r->r_root == NULL);
+}
+
+unsigned
+radix_num(const struct radix *r)
+{
+	return r->r_num;
+}
+
+void *
+radix_get(const struct radix *r, uint32_t index)
+{
+	struct radix_node *n;
+	unsigned level;
+
+	if (r->r_root == NULL || index > radix_maxindex(r->r_height)) {
+		return NULL;
+	}
+	n = r->r_root;
+	for (level = r->r_height - 1; level > 0; level--) {
+		n = n->rn_slots[radix_slot(index, level)];
+		if (n == NULL) {
+			return NULL;
+		}
+	}
+	return n->rn_slots[radix_slot(index, 0)];
+}
+
+/*
+ * Free the empty nodes at the bottom of PATH (DEPTH nodes from the
+ * root down; SLOTS[i] is the slot of PATH[i] that leads to PATH[i+1]).
+ */
+static
+void
+radix_prune(struct radix *r, struct radix_node **path, unsigned *slots,
+	    unsigned depth)
+{
+	struct radix_node *n;
+
+	while (depth > 0) {
+		depth--;
+		n = path[depth];
+		if (n->rn_used > 0) {
+			break;
+		}
+		kfree(n);
+		if (depth == 0) {
+			r->r_root = NULL;
+			r->r_height = 0;
+		}
+		else {
+			path[depth-1]->rn_slots[slots[depth-1]] = NULL;
+			path[depth-1]->rn_used--;
+		}
+	}
+}
+
+/*
+ * Take off top nodes that only have a slot 0, so the tree is no
+ * taller than its largest index needs.
+ */
+static
+void
+radix_shrink(struct radix *r)
+{
+	struct radix_node *n;
+
+	while (r->r_height > 1) {
+		n = r->r_root;
+		if (n->rn_used != 1 || n->rn_slots[0] == NULL) {
+			break;
+		}
+		r->r_root = n->rn_slots[0];
+		r->r_height--;
+		kfree(n);
+	}
+}
+
+int
+radix_set(struct radix *r, uint32_t index, void *val)
+{
+	struct radix_node *path[RADIX_MAXHEIGHT];
+	unsigned slots[RADIX_MAXHEIGHT];
+	struct radix_node *n, *child;
+	unsigned level, depth, slot;
+
+	KASSERT(val != NULL);
+
+	if (r->r_root == NULL) {
+		/* Start out as tall as INDEX needs. */
+		n = radix_node_create();
+		if (n == NULL) {
+			return ENOMEM;
+		}
+		r->r_root = n;
+		r->r_height = 1;
+		while (index > radix_maxindex(r->r_height)) {
+			r->r_height++;
+		}
+	}
+	while (index > radix_maxindex(r->r_height)) {
+		n = radix_node_create();
+		if (n == NULL) {
+			radix_shrink(r);
+			return ENOMEM;
+		}
+		n->rn_slots[0] = r->r_root;
+		n->rn_used = 1;
+		r->r_root = n;
+		r->r_height++;
+	}
+
+	n = r->r_root;
+	depth = 0;
+	for (level = r->r_height - 1; level > 0; level--) {
+		slot = radix_slot(index, level);
+		path[depth] = n;
+		slots[depth] = slot;
+		depth++;
+		child = n->rn_slots[slot];
+		if (child == NULL) {
+			child = radix_node_create();
+			if (child == NULL) {
+				radix_prune(r, path, slots, depth);
+				if (r->r_root != NULL) {
+					radix_shrink(r);
+				}
+				return ENOMEM;
+			}
+			n->rn_slots[slot] = child;
+			n->rn_used++;
+		}
+		n = child;
+	}
+
+	slot = radix_slot(index, 0);
+	if (n->rn_slots[slot] == NULL) {
+		n->rn_used++;
+		r->r_num++;
+	}
+	n->rn_slots[slot] = val;
+	return 0;
+}
+
+void *
+radix_remove(struct radix *r, uint32_t index)
+{
+	struct radix_node *path[RADIX_MAXHEIGHT];
+	unsigned slots[RADIX_MAXHEIGHT];
+	struct radix_node *n;
+	unsigned level, depth;
+	void *val;
+
+	if (r->r_root == NULL || index > radix_maxindex(r->r_height)) {
+		return NULL;
+	}
+
+	n = r->r_root;
+	depth = 0;
+	for (level = r->r_height - 1; ; level--) {
+		path[depth] = n;
+		slots[depth] = radix_slot(index, level);
+		depth++;
+		if (level == 0) {
+			break;
+		}
+		n = n->rn_slots[slots[depth-1]];
+		if (n == NULL) {
+			return NULL;
+		}
+	}
+
+	val = n->rn_slots[slots[depth-1]];
+	if (val == NULL) {
+		return NULL;
+	}
+	n->rn_slots[slots[depth-1]] = NULL;
+	n->rn_used--;
+	r->r_num--;
+
+	radix_prune(r, path, slots, depth);
+	if (r->r_root != NULL) {
+		radix_shrink(r);
+	}
+	return val;
+}
+
+/*
+ * First entry at or after START under node N, which is at LEVEL and
+ * whose first slot covers index BASE. (BASE is 64 bits because the
+ * top node of a full-height tree spans more than 32.)
+ */
+static
+void *
+radix_nextnode(struct radix_node *n, unsigned level, uint64_t base,
+	       uint32_t start, uint32_t *index)
+{
+	unsigned shift = level * RADIX_BITS;
+	uint64_t childbase;
+	unsigned slot;
+	void *v;
+
+	slot = start > base ? (unsigned)((start - base) >> shift) : 0;
+	for (; slot < RADIX_FANOUT; slot++) {
+		childbase = base + ((uint64_t)slot << shift);
+		if (childbase > 0xffffffff) {
+			break;
+		}
+		if (n->rn_slots[slot] == NULL) {
+			continue;
+		}
+		if (level == 0) {
+			*index = childbase;
+			return n->rn_slots[slot];
+		}
+		v = radix_nextnode(n->rn_slots[slot], level - 1, childbase,
+				   start, index);
+		if (v != NULL) {
+			return v;
+		}
+	}
+	return NULL;
+}
+
+void *
+radix_next(const struct radix *r, uint32_t *index)
+{
+	if (r->r_root == NULL || *index > radix_maxindex(r->r_height)) {
+		return NULL;
+	}
+	return radix_nextnode(r->r_root, r->r_height - 1, 0, *index, index);
+}
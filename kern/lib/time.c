@@ -29,6 +29,7 @@
 
 #include <types.h>
 #include <clock.h>
+#include <mainbus.h>
 
 /*
  * ts1 + ts2
@@ -67,3 +68,16 @@ timespec_sub(const struct timespec *ts1,
 	r.tv_sec -= ts2->tv_sec;
 	*ret = r;
 }
+
+/*
+ * cycles -> seconds and nanoseconds
+ */
+void
+cycles_to_timespec(uint64_t cycles, struct timespec *ret)
+{
+	uint32_t rate;
+
+	rate = mainbus_cyclerate();
+	ret->tv_sec = cycles / rate;
+	ret->tv_nsec = (cycles % rate) * 1000000000ULL / rate;
+}
@@ -33,6 +33,7 @@
 #include <proc.h>
 #include <current.h>
 #include <copyinout.h>
+#include <vm.h>
 
 /*
  * See uio.h for a description.
@@ -43,6 +44,7 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 {
 	struct iovec *iov;
 	size_t size;
+	unsigned npages;
 	int result;
 
 	if (uio->uio_rw != UIO_READ && uio->uio_rw != UIO_WRITE) {
@@ -93,7 +95,29 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 			    break;
 		    case UIO_USERSPACE:
 		    case UIO_USERISPACE:
-			    if (uio->uio_rw == UIO_READ) {
+			    npages = 0;
+			    if ((uio->uio_flags & UIO_PAGEMOVE) &&
+				size >= PAGE_SIZE &&
+				((vaddr_t)ptr | (vaddr_t)iov->iov_ubase)
+				% PAGE_SIZE == 0) {
+				    /*
+				     * Whole aligned pages: move what's
+				     * resident frame to frame. A page
+				     * that needs a fault first goes
+				     * through copyin/copyout by itself,
+				     * and then we try again.
+				     */
+				    npages = vm_pagemove(uio->uio_space,
+					(vaddr_t)iov->iov_ubase, ptr,
+					size / PAGE_SIZE,
+					uio->uio_rw == UIO_READ);
+				    size = (npages > 0 ? npages : 1)
+					    * PAGE_SIZE;
+			    }
+			    if (npages > 0) {
+				    result = 0;
+			    }
+			    else if (uio->uio_rw == UIO_READ) {
 				    result = copyout(ptr, iov->iov_ubase,size);
 			    }
 			    else {
@@ -162,4 +186,5 @@ uio_kinit(struct iovec *iov, struct uio *u,
 	u->uio_segflg = UIO_SYSSPACE;
 	u->uio_rw = rw;
 	u->uio_space = NULL;
+	u->uio_flags = 0;
 }
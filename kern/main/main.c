@@ -43,9 +43,19 @@
 #include <current.h>
 #include <synch.h>
 #include <vm.h>
+#include <swap.h>
+#include <pagemerge.h>
+#include <futex.h>
+#include <aio.h>
+#include <addrspace.h>
+#include <shm.h>
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
+#include <bufcache.h>
+#include <net.h>
+#include <epoch.h>
+#include <open_file_handler.h>
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
@@ -109,8 +119,10 @@ boot(void)
 	ram_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
+	epoch_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
+	net_bootstrap();
 	kheap_nextgeneration();
 
 	/* Probe and initialize devices. Interrupts should come on. */
@@ -120,17 +132,33 @@ boot(void)
 	KASSERT(curthread->t_curspl == 0);
 	/* Now do pseudo-devices. */
 	pseudoconfig();
+	time_bootstrap();
 	kprintf("\n");
 	kheap_nextgeneration();
 
-	/* Late phase of initialization. */
+	/*
+	 * Late phase of initialization. The other cpus are started as
+	 * soon as there's a real page allocator for them, so they come
+	 * up while the rest of this runs, and threads forked from here
+	 * on (and work items, which have been waiting for the workers
+	 * since early boot) can already run on them.
+	 */
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	swap_bootstrap();
+	pagemerge_bootstrap();
+	as_bootstrap();
+	shm_bootstrap();
+	open_file_bootstrap();
+	buf_bootstrap();
+	futex_bootstrap();
+	aio_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
 
+	thread_wait_cpus();
 	kheap_nextgeneration();
 
 	/*
@@ -154,6 +182,7 @@ shutdown(void)
 	vfs_clearcurdir();
 	vfs_unmountall();
 
+	kprintf_shutdown();
 	thread_shutdown();
 
 	splhigh();
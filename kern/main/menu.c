@@ -35,9 +35,20 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <platform/maxcpus.h>
+#include <cpu.h>
 #include <thread.h>
+#include <stats.h>
+#include <coremap.h>
+#include <schedtrace.h>
+#include <prof.h>
+#include <trace.h>
 #include <proc.h>
+#include <vm.h>
+#include <pagemerge.h>
+#include <mainbus.h>
 #include <vfs.h>
+#include <device.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
@@ -46,6 +57,7 @@
 #include "opt-synchprobs.h"
 
 #include "opt-sfs.h"
+#include "opt-tmpfs.h"
 #include "opt-net.h"
 #include <synch.h> 
 
@@ -57,6 +69,9 @@
 
 #define MAXMENUARGS  16
 
+/* VM counters of the programs run from the menu, see cmd_vmstats */
+static struct vmstats menu_vmstats;
+
 ////////////////////////////////////////////////////////////
 //
 // Command menu functions
@@ -151,21 +166,15 @@ common_prog(int nargs, char **args)
         cv_wait(proc->p_waitcv, proc->p_waitlock);
     }
 
-	/* check that the process has no running threads left */
-	for (;;) {
-		spinlock_acquire(&proc->p_lock);
-		int thread_number = threadarray_num(&proc->p_threads);
-		spinlock_release(&proc->p_lock);
-
-		if (thread_number == 0) {
-			break;
-		}
+    lock_release(proc->p_waitlock);
 
-		cv_wait(proc->p_waitcv, proc->p_waitlock);
-	}
+	/* check that the process has no running threads left */
+	proc_waitthreads(proc);
 
     /* the process is done, so we reap it */
-    lock_release(proc->p_waitlock);
+    vmstats_print(args[0], &proc->p_vmstats);
+    vmstats_add(&menu_vmstats, &proc->p_vmstats);
+    vmstats_add(&menu_vmstats, &proc->p_childstats);
     proc_destroy(proc);	
 
 	/*
@@ -315,6 +324,11 @@ static const struct {
 } mounttable[] = {
 #if OPT_SFS
 	{ "sfs", sfs_mount },
+	{ "sfsro", sfs_mount_ro },	/* read-only */
+#endif
+#if OPT_TMPFS
+	/* (no device; "mount tmpfs tmp" makes tmp:) */
+	{ "tmpfs", tmpfs_mount },
 #endif
 };
 
@@ -369,6 +383,59 @@ cmd_unmount(int nargs, char **args)
 	return vfs_unmount(device);
 }
 
+/*
+ * Command for sending a device's interrupts to one cpu.
+ */
+static
+int
+cmd_irqroute(int nargs, char **args)
+{
+	int result;
+
+	if (nargs != 3) {
+		kprintf("Usage: irqroute slot cpu\n");
+		return EINVAL;
+	}
+
+	result = mainbus_route_interrupt(atoi(args[1]), atoi(args[2]));
+	if (result) {
+		kprintf("irqroute: No slot %s or cpu %s\n", args[1], args[2]);
+	}
+	return result;
+}
+
+/*
+ * Command for making a stripe set out of disks.
+ */
+static
+int
+cmd_stripe(int nargs, char **args)
+{
+	char *device;
+	int i, unit;
+
+	if (nargs < 4) {
+		kprintf("Usage: stripe unit-in-sectors device: device: ...\n");
+		return EINVAL;
+	}
+
+	unit = atoi(args[1]);
+	if (unit <= 0) {
+		kprintf("stripe: Bad stripe unit %s\n", args[1]);
+		return EINVAL;
+	}
+
+	for (i=2; i<nargs; i++) {
+		/* Allow (but do not require) colon after device name */
+		device = args[i];
+		if (device[strlen(device)-1]==':') {
+			device[strlen(device)-1] = 0;
+		}
+	}
+
+	return stripe_create(unit, nargs - 2, args + 2);
+}
+
 /*
  * Command to set the "boot fs".
  *
@@ -401,11 +468,202 @@ cmd_bootfs(int nargs, char **args)
 static
 int
 cmd_kheapstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kheap_printcounts();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "pages")) {
+		kheap_printcounts();
+		kheap_printstats();
+	}
+	else {
+		kprintf("Usage: kh [pages]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_ps(int nargs, char **args)
 {
 	(void)nargs;
 	(void)args;
 
-	kheap_printstats();
+	proc_printall();
+	return 0;
+}
+
+/* how many lock classes "lk" shows by default */
+#define LOCKSTAT_DEFAULT_TOP 10
+
+static
+int
+cmd_lockstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockstat_dump(LOCKSTAT_DEFAULT_TOP);
+	}
+	else if (nargs == 2) {
+		lockstat_dump(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: lk [count]\n");
+	}
+
+	return 0;
+}
+
+/* the kernel "prof dump" symbolizes against, by default */
+#define PROF_DEFAULT_KERNEL "emu0:kernel"
+
+/*
+ * Command for the sampling profiler.
+ */
+static
+int
+cmd_prof(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		result = prof_start();
+		if (result) {
+			kprintf("prof: %s\n", strerror(result));
+		}
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		prof_stop();
+	}
+	else if ((nargs == 2 || nargs == 3) && !strcmp(args[1], "dump")) {
+		prof_dump(nargs == 3 ? args[2] : PROF_DEFAULT_KERNEL);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "user")) {
+		prof_dumpuser();
+	}
+	else {
+		kprintf("Usage: prof on | off | dump [kernelfile] | user\n");
+	}
+
+	return 0;
+}
+
+/* where "trace save" writes, by default */
+#define TRACE_DEFAULT_FILE "emu0:trace.out"
+
+/*
+ * Command for the kernel tracepoints. The classes to record are
+ * letters: s(yscalls), f(aults), b(lock I/O), c(ontext switches) and
+ * l(ocks); all of them by default.
+ */
+static
+int
+cmd_trace(int nargs, char **args)
+{
+	static const struct {
+		char letter;
+		uint32_t mask;
+	} classes[] = {
+		{ 's', TRACE_SYSCALLS },
+		{ 'f', TRACE_FAULTS },
+		{ 'b', TRACE_BIO },
+		{ 'c', TRACE_SWITCHES },
+		{ 'l', TRACE_LOCKS },
+	};
+	uint32_t mask;
+	bool mirror;
+	unsigned i, k;
+	int j, result;
+
+	if (nargs >= 2 && nargs <= 4 && !strcmp(args[1], "on")) {
+		mask = 0;
+		mirror = false;
+		for (j=2; j<nargs; j++) {
+			if (!strcmp(args[j], "ltrace")) {
+				mirror = true;
+				continue;
+			}
+			for (i=0; args[j][i] != '\0'; i++) {
+				for (k=0; k<ARRAYCOUNT(classes); k++) {
+					if (classes[k].letter == args[j][i]) {
+						mask |= classes[k].mask;
+						break;
+					}
+				}
+				if (k == ARRAYCOUNT(classes)) {
+					kprintf("trace: No class %c\n",
+						args[j][i]);
+					return 0;
+				}
+			}
+		}
+		if (mask == 0) {
+			mask = TRACE_ALL;
+		}
+		result = trace_start(mask, mirror);
+		if (result) {
+			kprintf("trace: %s\n", strerror(result));
+		}
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		trace_stop();
+	}
+	else if ((nargs == 2 || nargs == 3) && !strcmp(args[1], "save")) {
+		result = trace_save(nargs == 3 ? args[2] : TRACE_DEFAULT_FILE);
+		if (result) {
+			kprintf("trace: %s\n", strerror(result));
+		}
+	}
+	else {
+		kprintf("Usage: trace on [sfbcl] [ltrace] | off | save [file]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_dmesg(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	return klog_dump();
+}
+
+static
+int
+cmd_schedtrace(int nargs, char **args)
+{
+	if (nargs == 1) {
+		schedtrace_dump(SCHEDTRACE_ALLCPUS);
+	}
+	else if (nargs == 2) {
+		schedtrace_dump(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: st [cpu]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_wakelat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		schedlat_dump();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "on")) {
+		schedlat_enable(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		schedlat_enable(false);
+	}
+	else {
+		kprintf("Usage: wl [on|off]\n");
+	}
 
 	return 0;
 }
@@ -439,6 +697,264 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for showing or setting how many neighbouring pages vm_fault
+ * preloads into the TLB.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	if (nargs == 2) {
+		unsigned n = atoi(args[1]);
+		if (n > VM_FAULTAROUND_MAX) {
+			kprintf("fa: at most %u pages\n", VM_FAULTAROUND_MAX);
+			return EINVAL;
+		}
+		vm_faultaround = n;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: fa [npages]\n");
+		return EINVAL;
+	}
+
+	kprintf("VM fault-around: %u pages\n", vm_faultaround);
+	return 0;
+}
+
+/*
+ * Command for showing or setting how many pages a sequential
+ * copy-on-write fault copies ahead.
+ */
+static
+int
+cmd_cowbatch(int nargs, char **args)
+{
+	if (nargs == 2) {
+		unsigned n = atoi(args[1]);
+		if (n > VM_COWBATCH_MAX) {
+			kprintf("cb: at most %u pages\n", VM_COWBATCH_MAX);
+			return EINVAL;
+		}
+		vm_cowbatch = n;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: cb [npages]\n");
+		return EINVAL;
+	}
+
+	kprintf("VM copy-on-write batch: %u pages\n", vm_cowbatch);
+	return 0;
+}
+
+/*
+ * Command for turning same-page merging on or off, or showing what it
+ * has merged.
+ */
+static
+int
+cmd_pagemerge(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		pagemerge_enable(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		pagemerge_enable(false);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: pm [on|off]\n");
+		return EINVAL;
+	}
+
+	pagemerge_dump();
+	return 0;
+}
+
+/*
+ * Command for the VM counters of everything run from the menu (each
+ * program and the children it waited for) since the last reset.
+ */
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		bzero(&menu_vmstats, sizeof(menu_vmstats));
+		return 0;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: vs [reset]\n");
+		return EINVAL;
+	}
+
+	vmstats_print("vs", &menu_vmstats);
+	return 0;
+}
+
+/* how many lock classes "perf" shows */
+#define PERF_LOCKS 5
+
+/*
+ * What "perf" saw last time, so "perf d" can show what changed since.
+ * Before the first call it's all zero, which makes "perf d" the same
+ * as "perf": averages since boot.
+ */
+static struct {
+	struct timespec pf_uptime;
+	uint64_t pf_idle[MAXCPUS];
+	uint64_t pf_switches;
+	uint64_t pf_faults;
+	uint64_t pf_bufhits;
+	uint64_t pf_bufmisses;
+} perf_last;
+
+static
+uint64_t
+perf_usecs(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000ULL + ts->tv_nsec / 1000;
+}
+
+/*
+ * Save the count in *NOW as the last one seen, in *LAST, and with
+ * DELTA change *NOW to what it's gone up by since the one before.
+ */
+static
+void
+perf_swap(uint64_t *last, uint64_t *now, bool delta)
+{
+	uint64_t prev;
+
+	prev = *last;
+	*last = *now;
+	if (delta) {
+		*now -= prev;
+	}
+}
+
+/* COUNT events in USECS, per second. */
+static
+unsigned long
+perf_rate(uint64_t count, uint64_t usecs)
+{
+	if (usecs == 0) {
+		return 0;
+	}
+	return count * 1000000 / usecs;
+}
+
+/*
+ * Cycles cpu C has been idle, counting the stretch it's in now. Its
+ * cycle counter isn't ours, but they all start at boot and run at the
+ * same rate, so ours is close enough to measure that stretch by.
+ */
+static
+uint64_t
+perf_idlecycles(struct cpu *c, uint64_t now)
+{
+	uint64_t idle, start;
+
+	idle = c->c_idlecycles;
+	start = c->c_idlestart;
+	if (start != 0 && start < now) {
+		idle += now - start;
+	}
+	return idle;
+}
+
+/*
+ * Command for one snapshot of how the system is doing: cpu time and
+ * run queues, scheduling and faulting rates, free memory, the buffer
+ * cache, kmalloc, and the most contended locks. Rates are averages
+ * since boot, or with "d" since the last "perf".
+ */
+static
+int
+cmd_perf(int nargs, char **args)
+{
+	struct timespec now, span, idlets;
+	uint64_t usecs, idleusecs, idle, cycles;
+	uint64_t switches, faults, hits, misses;
+	unsigned i, ncpus, busy;
+	struct cpu *c;
+	bool delta;
+
+	if (nargs == 2 && !strcmp(args[1], "d")) {
+		delta = true;
+	}
+	else if (nargs == 1) {
+		delta = false;
+	}
+	else {
+		kprintf("Usage: perf [d]\n");
+		return EINVAL;
+	}
+
+	getuptime(&now);
+	cycles = mainbus_cycles();
+	switches = stats_total(STAT_SCHED_SWITCHES);
+	faults = stats_total(STAT_VM_FAULTS);
+	hits = stats_total(STAT_CACHE_BUFHITS);
+	misses = stats_total(STAT_CACHE_BUFMISSES);
+
+	if (delta) {
+		timespec_sub(&now, &perf_last.pf_uptime, &span);
+	}
+	else {
+		span = now;
+	}
+	usecs = perf_usecs(&span);
+	kprintf("uptime %llu.%03lu s", (unsigned long long)now.tv_sec,
+		(unsigned long)(now.tv_nsec / 1000000));
+	if (delta) {
+		kprintf(", rates over the last %llu.%03lu s\n",
+			(unsigned long long)span.tv_sec,
+			(unsigned long)(span.tv_nsec / 1000000));
+	}
+	else {
+		kprintf(", rates since boot\n");
+	}
+
+	ncpus = thread_numcpus();
+	for (i=0; i<ncpus; i++) {
+		c = thread_getcpu(i);
+		idle = perf_idlecycles(c, cycles);
+		cycles_to_timespec(idle - (delta ? perf_last.pf_idle[i] : 0),
+				   &idlets);
+		idleusecs = perf_usecs(&idlets);
+		busy = 0;
+		if (usecs > idleusecs) {
+			busy = (usecs - idleusecs) * 100 / usecs;
+		}
+		kprintf("cpu%u: %3u%% busy, %3u%% idle, %u runnable\n",
+			i, busy, 100 - busy, c->c_runcount);
+		if (i < MAXCPUS) {
+			perf_last.pf_idle[i] = idle;
+		}
+	}
+
+	perf_last.pf_uptime = now;
+	perf_swap(&perf_last.pf_switches, &switches, delta);
+	perf_swap(&perf_last.pf_faults, &faults, delta);
+	perf_swap(&perf_last.pf_bufhits, &hits, delta);
+	perf_swap(&perf_last.pf_bufmisses, &misses, delta);
+
+	kprintf("%lu switches/s, %lu faults/s\n",
+		perf_rate(switches, usecs), perf_rate(faults, usecs));
+	kprintf("coremap: %u pages free, %u zeroed\n",
+		coremap_freecount(), coremap_zeroedcount());
+	kprintf("bufcache: %llu hits, %llu misses",
+		(unsigned long long)hits, (unsigned long long)misses);
+	if (hits + misses > 0) {
+		kprintf(", %u%% hit rate",
+			(unsigned)(hits * 100 / (hits + misses)));
+	}
+	kprintf("\n");
+	kheap_printtags();
+	lockstat_dump(PERF_LOCKS);
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -473,6 +989,8 @@ static const char *opsmenu[] = {
 	"[p]       Other program             ",
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
+	"[stripe]  Stripe disks together     ",
+	"[irqroute] Route interrupts to a cpu",
 	"[bootfs]  Set \"boot\" filesystem     ",
 	"[pf]      Print a file              ",
 	"[cd]      Change directory          ",
@@ -498,10 +1016,14 @@ static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[bt]  Bitmap test                   ",
 	"[tlt] Threadlist test               ",
+	"[ht]  Hash table test               ",
+	"[rt]  Radix tree test               ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[kb1] kmalloc throughput benchmark  ",
+	"[kb2] kmalloc fragmentation test    ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -512,6 +1034,11 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sb1] Lock benchmark                ",
+	"[sb2] Contended lock benchmark      ",
+	"[sb3] Semaphore ping-pong benchmark ",
+	"[sb4] CV wakeup benchmark           ",
+	"[sb5] Spinlock handoff benchmark    ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
 	"[fs3] FS write stress               ",
@@ -545,9 +1072,21 @@ static const char *mainmenu[] = {
 	"[sp1] Air Balloon                   ",
 #endif
 
-	"[kh] Kernel heap stats              ",
+	"[kh] Kernel heap stats [pages]      ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[fa] VM fault-around [npages]       ",
+	"[cb] VM COW batch [npages]          ",
+	"[pm] Same-page merging [on|off]     ",
+	"[vs] VM stats of programs [reset]   ",
+	"[st] Scheduler event trace [cpu]    ",
+	"[wl] Wakeup latency [on|off]        ",
+	"[ps] Processes and their CPU time   ",
+	"[lk] Most contended locks [count]   ",
+	"[perf] Performance snapshot [d]     ",
+	"[prof] Profiler on|off|dump|user    ",
+	"[trace] Tracepoints on|off|save     ",
+	"[dmesg] Print the kernel log        ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -583,6 +1122,8 @@ static struct {
 	{ "p",		cmd_prog },
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
+	{ "stripe",	cmd_stripe },
+	{ "irqroute",	cmd_irqroute },
 	{ "bootfs",	cmd_bootfs },
 	{ "pf",		printfile },
 	{ "cd",		cmd_chdir },
@@ -605,15 +1146,31 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "fa",         cmd_faultaround },
+	{ "cb",         cmd_cowbatch },
+	{ "pm",         cmd_pagemerge },
+	{ "vs",         cmd_vmstats },
+	{ "st",         cmd_schedtrace },
+	{ "wl",         cmd_wakelat },
+	{ "ps",         cmd_ps },
+	{ "lk",         cmd_lockstats },
+	{ "perf",       cmd_perf },
+	{ "prof",       cmd_prof },
+	{ "trace",      cmd_trace },
+	{ "dmesg",      cmd_dmesg },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "bt",		bitmaptest },
 	{ "tlt",	threadlisttest },
+	{ "ht",		hashtabtest },
+	{ "rt",		radixtest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
 	{ "km3",	malloctest3 },
 	{ "km4",	malloctest4 },
+	{ "kb1",	kmallocbench },
+	{ "kb2",	kmallocfrag },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -627,6 +1184,13 @@ static struct {
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
 
+	/* synchronization benchmarks */
+	{ "sb1",	lockbench },
+	{ "sb2",	lockbench2 },
+	{ "sb3",	sembench },
+	{ "sb4",	cvbench },
+	{ "sb5",	spinbench },
+
 	/* file system assignment tests */
 	{ "fs1",	fstest },
 	{ "fs2",	readstress },
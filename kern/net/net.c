@@ -0,0 +1,151 @@
+/*
+ * Network layer: the netbuf pool, the interface, and getting frames
+ * between it and the sockets (see net.h).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <workqueue.h>
+#include <net.h>
+
+/* The pool. */
+static struct spinlock netbuf_lock = SPINLOCK_INITIALIZER;
+static struct netbuf *netbuf_free;
+static struct wchan *netbuf_wchan;	/* waiting for netbuf_free */
+static struct work netbuf_fillwork;	/* allocates the pool, see net_bootstrap */
+
+/* The interface, or NULL. Set once, while probing devices. */
+static struct netif *net_if;
+
+/*
+ * Fill the pool. Nothing needs the network to boot, so this is a work
+ * item that runs once the workers are up: the pages then come from
+ * the real page allocator rather than being stolen for good before
+ * it exists, and boot doesn't wait for them. Until it has run,
+ * received frames are dropped and senders wait in netbuf_get.
+ */
+static
+void
+netbuf_fill(void *unused)
+{
+	struct netbuf *nb;
+	unsigned i;
+
+	(void)unused;
+
+	for (i=0; i<NETBUF_COUNT; i++) {
+		nb = kmalloc_tagged(sizeof(*nb), KM_NET);
+		if (nb == NULL) {
+			break;
+		}
+		nb->nb_data = kmalloc_tagged(NETBUF_SIZE, KM_NET);
+		if (nb->nb_data == NULL) {
+			kfree(nb);
+			break;
+		}
+		netbuf_put(nb);
+	}
+	if (i < NETBUF_COUNT) {
+		kprintf("net: Only %u packet buffers\n", i);
+	}
+}
+
+void
+net_bootstrap(void)
+{
+	netbuf_wchan = wchan_create("netbuf");
+	if (netbuf_wchan == NULL) {
+		panic("net_bootstrap: Out of memory\n");
+	}
+
+	work_init(&netbuf_fillwork, netbuf_fill, NULL);
+	workqueue_submit(&netbuf_fillwork);
+}
+
+struct netbuf *
+netbuf_get(bool wait)
+{
+	struct netbuf *nb;
+
+	spinlock_acquire(&netbuf_lock);
+	while (netbuf_free == NULL && wait) {
+		wchan_sleep(netbuf_wchan, &netbuf_lock);
+	}
+	nb = netbuf_free;
+	if (nb != NULL) {
+		netbuf_free = nb->nb_next;
+		nb->nb_next = NULL;
+	}
+	spinlock_release(&netbuf_lock);
+	return nb;
+}
+
+void
+netbuf_put(struct netbuf *nb)
+{
+	spinlock_acquire(&netbuf_lock);
+	nb->nb_next = netbuf_free;
+	netbuf_free = nb;
+	wchan_wakeone(netbuf_wchan, &netbuf_lock);
+	spinlock_release(&netbuf_lock);
+}
+
+int
+net_attach(struct netif *ifp)
+{
+	if (net_if != NULL) {
+		kprintf("%s: Only one network interface is supported\n",
+			ifp->if_name);
+		return EBUSY;
+	}
+	KASSERT(ifp->if_hdrlen < ifp->if_mtu && ifp->if_mtu <= NETBUF_SIZE);
+	net_if = ifp;
+	kprintf("net: %s is address %u\n", ifp->if_name,
+		(unsigned)ifp->if_addr);
+	return 0;
+}
+
+void
+net_input(struct netif *ifp, struct netbuf *nb, uint16_t from)
+{
+	KASSERT(ifp == net_if);
+	socket_input(nb, from);
+}
+
+uint16_t
+net_localaddr(void)
+{
+	return net_if != NULL ? net_if->if_addr : LNADDR_LOCAL;
+}
+
+unsigned
+net_hdrlen(void)
+{
+	return net_if != NULL ? net_if->if_hdrlen : 0;
+}
+
+unsigned
+net_mtu(void)
+{
+	return net_if != NULL ? net_if->if_mtu : NETBUF_SIZE;
+}
+
+int
+net_output(struct netbuf *nb, uint16_t to)
+{
+	uint16_t self = net_localaddr();
+
+	if (to == LNADDR_LOCAL || to == self) {
+		/* it's for us; turn it straight round */
+		socket_input(nb, self);
+		return 0;
+	}
+	if (net_if == NULL) {
+		netbuf_put(nb);
+		return ENETDOWN;
+	}
+	return net_if->if_output(net_if, nb, to);
+}
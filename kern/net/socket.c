@@ -0,0 +1,555 @@
+/*
+ * Datagram sockets (see net.h).
+ *
+ * A datagram on the wire is a struct dgram_hdr right after the link
+ * header, then the data; the header is in network byte order. Bound
+ * sockets are on one list, by port, and each one has a queue of the
+ * netbufs received for it. The list and all the queues are under
+ * socket_lock, a spinlock, since frames come in at interrupt time.
+ * A socket takes at most SOCKET_RXMAX datagrams before dropping more,
+ * so one that nobody reads can't eat the whole netbuf pool. Pollers
+ * are woken with the readers, still under socket_lock: once that's
+ * dropped the socket may be gone.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/poll.h>
+#include <endian.h>
+#include <stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <uio.h>
+#include <poll.h>
+#include <vnode.h>
+#include <net.h>
+
+/* Datagrams queued per socket. */
+#define SOCKET_RXMAX	8
+
+/* Ports handed out by bind to port 0, and to unbound sockets. */
+#define SOCKET_FIRSTANON	49152
+#define SOCKET_NANON		16384
+
+struct dgram_hdr {
+	uint16_t dh_dstport;
+	uint16_t dh_srcport;
+	uint16_t dh_len;		/* of the data that follows */
+	uint16_t dh_pad;
+};
+
+struct socket {
+	struct vnode so_vnode;
+	uint16_t so_port;		/* 0 until bound */
+	bool so_connected;
+	uint16_t so_peeraddr;		/* if so_connected */
+	uint16_t so_peerport;
+
+	/* under socket_lock */
+	struct socket *so_next;		/* on socket_bound */
+	struct netbuf *so_rxhead;
+	struct netbuf **so_rxtail;
+	unsigned so_rxcount;
+	struct wchan *so_rxwchan;	/* waiting for so_rxhead */
+	struct pollq so_pollq;		/* polling for so_rxhead */
+};
+
+static struct spinlock socket_lock = SPINLOCK_INITIALIZER;
+static struct socket *socket_bound;
+static unsigned socket_nextanon;
+
+static const struct vnode_ops socket_vnops;
+
+////////////////////////////////////////////////////////////
+// ports
+
+/* The socket bound to PORT, or NULL. Call with socket_lock. */
+static
+struct socket *
+socket_findport(uint16_t port)
+{
+	struct socket *so;
+
+	KASSERT(spinlock_do_i_hold(&socket_lock));
+	for (so = socket_bound; so != NULL; so = so->so_next) {
+		if (so->so_port == port) {
+			return so;
+		}
+	}
+	return NULL;
+}
+
+/* Bind SO to PORT, or to a free anonymous port if that's 0. */
+static
+int
+socket_setport(struct socket *so, uint16_t port)
+{
+	unsigned i;
+
+	spinlock_acquire(&socket_lock);
+	if (so->so_port != 0) {
+		spinlock_release(&socket_lock);
+		return EINVAL;
+	}
+	if (port == 0) {
+		for (i=0; i<SOCKET_NANON; i++) {
+			port = SOCKET_FIRSTANON + socket_nextanon;
+			socket_nextanon = (socket_nextanon + 1) % SOCKET_NANON;
+			if (socket_findport(port) == NULL) {
+				break;
+			}
+		}
+		if (i == SOCKET_NANON) {
+			spinlock_release(&socket_lock);
+			return EADDRNOTAVAIL;
+		}
+	}
+	else if (socket_findport(port) != NULL) {
+		spinlock_release(&socket_lock);
+		return EADDRINUSE;
+	}
+	so->so_port = port;
+	so->so_next = socket_bound;
+	socket_bound = so;
+	spinlock_release(&socket_lock);
+	return 0;
+}
+
+/* Check that ADDR is an lnet address. */
+static
+int
+socket_checkaddr(const struct sockaddr_ln *addr)
+{
+	if (addr->sln_family != AF_LNET) {
+		return EAFNOSUPPORT;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// input
+
+void
+socket_input(struct netbuf *nb, uint16_t from)
+{
+	struct dgram_hdr dh;
+	struct socket *so;
+	unsigned hdrlen = net_hdrlen();
+
+	if (nb->nb_len < hdrlen + sizeof(dh)) {
+		netbuf_put(nb);
+		return;
+	}
+	memcpy(&dh, nb->nb_data + hdrlen, sizeof(dh));
+	nb->nb_off = hdrlen + sizeof(dh);
+	nb->nb_datalen = ntohs(dh.dh_len);
+	nb->nb_fromaddr = from;
+	nb->nb_fromport = ntohs(dh.dh_srcport);
+	if (nb->nb_off + nb->nb_datalen > nb->nb_len) {
+		netbuf_put(nb);
+		return;
+	}
+
+	spinlock_acquire(&socket_lock);
+	so = socket_findport(ntohs(dh.dh_dstport));
+	if (so == NULL || so->so_rxcount >= SOCKET_RXMAX ||
+	    (so->so_connected && (from != so->so_peeraddr ||
+				  nb->nb_fromport != so->so_peerport))) {
+		spinlock_release(&socket_lock);
+		netbuf_put(nb);
+		return;
+	}
+	nb->nb_next = NULL;
+	*so->so_rxtail = nb;
+	so->so_rxtail = &nb->nb_next;
+	so->so_rxcount++;
+	wchan_wakeone(so->so_rxwchan, &socket_lock);
+	pollq_wakeup(&so->so_pollq);
+	spinlock_release(&socket_lock);
+}
+
+////////////////////////////////////////////////////////////
+// operations
+
+int
+socket_bind(struct socket *so, const struct sockaddr_ln *addr)
+{
+	int result;
+
+	result = socket_checkaddr(addr);
+	if (result) {
+		return result;
+	}
+	if (addr->sln_addr != LNADDR_LOCAL &&
+	    addr->sln_addr != net_localaddr()) {
+		return EADDRNOTAVAIL;
+	}
+	return socket_setport(so, addr->sln_port);
+}
+
+int
+socket_connect(struct socket *so, const struct sockaddr_ln *addr)
+{
+	int result;
+
+	result = socket_checkaddr(addr);
+	if (result) {
+		return result;
+	}
+	if (addr->sln_port == 0) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&socket_lock);
+	so->so_peeraddr = addr->sln_addr;
+	so->so_peerport = addr->sln_port;
+	so->so_connected = true;
+	spinlock_release(&socket_lock);
+	return 0;
+}
+
+int
+socket_sendto(struct socket *so, struct uio *uio,
+	      const struct sockaddr_ln *to)
+{
+	struct dgram_hdr dh;
+	struct netbuf *nb;
+	uint16_t toaddr, toport;
+	unsigned hdrlen, len;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	if (to != NULL) {
+		result = socket_checkaddr(to);
+		if (result) {
+			return result;
+		}
+		toaddr = to->sln_addr;
+		toport = to->sln_port;
+	}
+	else if (so->so_connected) {
+		toaddr = so->so_peeraddr;
+		toport = so->so_peerport;
+	}
+	else {
+		return ENOTCONN;
+	}
+
+	hdrlen = net_hdrlen() + sizeof(dh);
+	if (uio->uio_resid > net_mtu() - hdrlen) {
+		return EMSGSIZE;
+	}
+	len = uio->uio_resid;
+
+	/* replies need somewhere to go */
+	if (so->so_port == 0) {
+		socket_setport(so, 0);
+		if (so->so_port == 0) {
+			return EADDRNOTAVAIL;
+		}
+	}
+
+	nb = netbuf_get(true);
+	result = uiomove(nb->nb_data + hdrlen, len, uio);
+	if (result) {
+		netbuf_put(nb);
+		return result;
+	}
+	dh.dh_dstport = htons(toport);
+	dh.dh_srcport = htons(so->so_port);
+	dh.dh_len = htons(len);
+	dh.dh_pad = 0;
+	memcpy(nb->nb_data + net_hdrlen(), &dh, sizeof(dh));
+	nb->nb_len = hdrlen + len;
+
+	return net_output(nb, toaddr);
+}
+
+int
+socket_recvfrom(struct socket *so, struct uio *uio, struct sockaddr_ln *from)
+{
+	struct netbuf *nb;
+	size_t len;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	/* otherwise nothing could ever arrive */
+	if (so->so_port == 0) {
+		socket_setport(so, 0);
+		if (so->so_port == 0) {
+			return EADDRNOTAVAIL;
+		}
+	}
+
+	spinlock_acquire(&socket_lock);
+	while (so->so_rxhead == NULL) {
+		wchan_sleep(so->so_rxwchan, &socket_lock);
+	}
+	nb = so->so_rxhead;
+	so->so_rxhead = nb->nb_next;
+	if (so->so_rxhead == NULL) {
+		so->so_rxtail = &so->so_rxhead;
+	}
+	so->so_rxcount--;
+	spinlock_release(&socket_lock);
+
+	len = nb->nb_datalen;
+	if (len > uio->uio_resid) {
+		len = uio->uio_resid;
+	}
+	result = uiomove(nb->nb_data + nb->nb_off, len, uio);
+	if (result == 0 && from != NULL) {
+		bzero(from, sizeof(*from));
+		from->sln_len = sizeof(*from);
+		from->sln_family = AF_LNET;
+		from->sln_addr = nb->nb_fromaddr;
+		from->sln_port = nb->nb_fromport;
+	}
+	netbuf_put(nb);
+	return result;
+}
+
+void
+socket_getname(struct socket *so, struct sockaddr_ln *addr)
+{
+	bzero(addr, sizeof(*addr));
+	addr->sln_len = sizeof(*addr);
+	addr->sln_family = AF_LNET;
+	addr->sln_addr = net_localaddr();
+	addr->sln_port = so->so_port;
+}
+
+////////////////////////////////////////////////////////////
+// vnode operations
+
+static
+int
+socket_eachopen(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return 0;
+}
+
+/*
+ * Only the open file the socket was made for has a reference, so this
+ * is always the last one.
+ */
+static
+int
+socket_reclaim(struct vnode *v)
+{
+	struct socket *so = v->vn_data;
+	struct socket **sop;
+	struct netbuf *nb, *list;
+
+	if (vnode_decref_unless_last(v)) {
+		return EBUSY;
+	}
+
+	spinlock_acquire(&socket_lock);
+	if (so->so_port != 0) {
+		for (sop = &socket_bound; *sop != so; sop = &(*sop)->so_next) {
+			KASSERT(*sop != NULL);
+		}
+		*sop = so->so_next;
+	}
+	list = so->so_rxhead;
+	so->so_rxhead = NULL;
+	spinlock_release(&socket_lock);
+
+	while (list != NULL) {
+		nb = list;
+		list = nb->nb_next;
+		netbuf_put(nb);
+	}
+
+	pollq_cleanup(&so->so_pollq);
+	wchan_destroy(so->so_rxwchan);
+	vnode_cleanup(&so->so_vnode);
+	kfree(so);
+	return 0;
+}
+
+static
+int
+socket_read(struct vnode *v, struct uio *uio)
+{
+	return socket_recvfrom(v->vn_data, uio, NULL);
+}
+
+static
+int
+socket_write(struct vnode *v, struct uio *uio)
+{
+	return socket_sendto(v->vn_data, uio, NULL);
+}
+
+static
+int
+socket_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+socket_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFSOCK;
+	return 0;
+}
+
+static
+int
+socket_stat(struct vnode *v, struct stat *st)
+{
+	bzero(st, sizeof(*st));
+	st->st_mode = S_IFSOCK | 0666;
+	st->st_nlink = 1;
+	(void)v;
+	return 0;
+}
+
+static
+bool
+socket_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+static
+int
+socket_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+/*
+ * Readable with a datagram queued; sending never waits.
+ */
+static
+int
+socket_poll(struct vnode *v, int events, struct pollset *ps)
+{
+	struct socket *so = v->vn_data;
+	int revents;
+
+	poll_wait(ps, &so->so_pollq);
+
+	revents = events & POLLOUT;
+	spinlock_acquire(&socket_lock);
+	if (so->so_rxhead != NULL) {
+		revents |= events & POLLIN;
+	}
+	spinlock_release(&socket_lock);
+	return revents;
+}
+
+static
+int
+socket_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static const struct vnode_ops socket_vnops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = socket_eachopen,
+	.vop_reclaim = socket_reclaim,
+	.vop_read = socket_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_uio_notdir,
+	.vop_write = socket_write,
+	.vop_ioctl = socket_ioctl,
+	.vop_stat = socket_stat,
+	.vop_gettype = socket_gettype,
+	.vop_isseekable = socket_isseekable,
+	.vop_fsync = socket_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = socket_poll,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_nosys,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = socket_truncate,
+	.vop_namefile = vopfail_uio_inval,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+////////////////////////////////////////////////////////////
+// creation
+
+int
+socket_create(int domain, int type, int protocol, struct vnode **ret)
+{
+	struct socket *so;
+	int result;
+
+	if (domain != PF_LNET) {
+		return EAFNOSUPPORT;
+	}
+	if (type != SOCK_DGRAM) {
+		return ESOCKTNOSUPPORT;
+	}
+	if (protocol != 0) {
+		return EPROTONOSUPPORT;
+	}
+
+	so = kmalloc_tagged(sizeof(*so), KM_NET);
+	if (so == NULL) {
+		return ENOMEM;
+	}
+	so->so_port = 0;
+	so->so_connected = false;
+	so->so_peeraddr = 0;
+	so->so_peerport = 0;
+	so->so_next = NULL;
+	so->so_rxhead = NULL;
+	so->so_rxtail = &so->so_rxhead;
+	so->so_rxcount = 0;
+	so->so_rxwchan = wchan_create("socket");
+	if (so->so_rxwchan == NULL) {
+		kfree(so);
+		return ENOMEM;
+	}
+	pollq_init(&so->so_pollq);
+	result = vnode_init(&so->so_vnode, &socket_vnops, NULL, so);
+	if (result) {
+		pollq_cleanup(&so->so_pollq);
+		wchan_destroy(so->so_rxwchan);
+		kfree(so);
+		return result;
+	}
+	*ret = &so->so_vnode;
+	return 0;
+}
+
+struct socket *
+socket_get(struct vnode *v)
+{
+	if (v->vn_ops != &socket_vnops) {
+		return NULL;
+	}
+	return v->vn_data;
+}
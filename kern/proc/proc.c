@@ -46,14 +46,22 @@
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
+#include <clock.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <file_table.h> 
 #include <open_file_handler.h>
 #include <vfs.h>
 #include <kern/fcntl.h>
+#include <kern/ioprio.h>
 #include <limits.h>
 #include <kern/errno.h>
+#include <kmem_cache.h>
+#include <membar.h>
+#include <uthread.h>
+#include <aio.h>
+#include <systrace.h>
+#include <workqueue.h>
 
 
 
@@ -64,51 +72,305 @@
 struct proc *kproc;
 
 /* ADDED FOR A5 */
-static struct proc *pid_table[__PID_MAX]; /* PID table that keeps track of all the live processes (maps PIDs to the proc struct) */
-static struct lock *pid_lk; /* lock for the pid table */
+static struct proc *volatile pid_table[__PID_MAX]; /* PID table that keeps track of all the live processes (maps PIDs to the proc struct) */
+static struct rwlock *pid_lk; /* lock for the pid table; taken to write it and to walk it, not for lookups */
+
+/* 
+ * Free PIDs wait in a ring, oldest freed first, so allocating and freeing are constant time and a PID that was just
+ * freed is the last one to be handed out again (a stale PID held by a waitpid caller stays stale as long as possible).
+ * PIDs fit in 16 bits. Protected by pid_lk.
+ */
+#define PID_NFREE (__PID_MAX - __PID_MIN)
+static uint16_t pid_free[PID_NFREE];
+static unsigned pid_freehead; /* next one to hand out */
+static unsigned pid_nfree;
+
+/* 
+ * The family lock protects every process's family fields (p_parentproc, the child lists and the sibling links) and
+ * is the lock for every p_childcv. One lock for all of them means a process can't go away between its child looking
+ * up its parent and telling it about an exit. It's only held for a few pointer updates at a time.
+ */
+static struct lock *family_lk;
 
 /* Initialize the global PID system. This is called once in proc_bootstrap() */
 void pid_bootstrap(void){
-	pid_lk = lock_create("pid_lk"); 
+	family_lk = lock_create("family_lk");
+	if (family_lk == NULL){
+		panic("pid_bootstrap: Out of memory\n");
+	}
+	pid_lk = rwlock_create("pid_lk"); 
 	for (int i = __PID_MIN; i < __PID_MAX; i++){
 		pid_table[i] = NULL; 
+		pid_free[i - __PID_MIN] = i;
 	}
+	pid_freehead = 0;
+	pid_nfree = PID_NFREE;
 }
 
-/* This function uses the PID table to find a free PID and asssigns it to the given process and returns the PID. If there are no free PIDS it returns ENPROC */
+/* This function takes the oldest free PID, assigns it to the given process and returns the PID. If there are no free PIDS it returns -1 */
 pid_t proc_allocpid(struct proc *p){
+	pid_t pid;
+
 	/* First we acquire the lock for the pid table */
-	lock_acquire(pid_lk);
-	for (pid_t i = __PID_MIN; i < __PID_MAX; i++){
-		/* Check if the entry is free */
-		if (pid_table[i] == NULL){
-			pid_table[i] = p; /* if the slot is free then we assign the given proc to it */
-			lock_release(pid_lk);
-			return i; 
-		}
+	rwlock_acquire_write(pid_lk);
+	if (pid_nfree == 0){
+		rwlock_release_write(pid_lk);
+		return -1; 
 	}
-	lock_release(pid_lk);
-	return ENPROC; 
+	pid = pid_free[pid_freehead];
+	pid_freehead = (pid_freehead + 1) % PID_NFREE;
+	pid_nfree--;
+	KASSERT(pid_table[pid] == NULL);
+
+	/* proc_get doesn't lock, so the proc has to be all there (its pid too) before it goes in */
+	p->p_pid = pid;
+	membar_store_store();
+	pid_table[pid] = p;
+	rwlock_release_write(pid_lk);
+	return pid; 
 }
 
-/* Function returns a pointer to the proc struct of the corresponding PID. */
+/* 
+ * Function returns a pointer to the proc struct of the corresponding PID. This is a single read of the table, without
+ * locking; like before, nothing stops the process going away afterwards, so callers must know it can't (a parent
+ * looking at its own child: only the parent reaps it).
+ */
 struct proc *proc_get(pid_t pid){
-	struct proc *p = NULL;
-	lock_acquire(pid_lk);
-	if (pid >= __PID_MIN && pid < __PID_MAX){
-		p = pid_table[pid];
+	if (pid < __PID_MIN || pid >= __PID_MAX){
+		return NULL;
 	}
-	lock_release(pid_lk);
-	return p;
+	return pid_table[pid];
 }
 
 /* Helper function that releases a PID (frees the corresponding slot in the pid table) once a process has been terminated and reaped by its parent */
 void proc_freepid(pid_t pid){
-	lock_acquire(pid_lk);
+	KASSERT(pid >= __PID_MIN && pid < __PID_MAX);
+
+	rwlock_acquire_write(pid_lk);
+	KASSERT(pid_table[pid] != NULL);
 	pid_table[pid] = NULL; 
-	lock_release(pid_lk);
+	pid_free[(pid_freehead + pid_nfree) % PID_NFREE] = pid;
+	pid_nfree++;
+	rwlock_release_write(pid_lk);
+}
+
+/* Put P at the head of the list at *HEADP / take it off whichever list it is on. Call with family_lk held */
+static void family_link(struct proc **headp, struct proc *p){
+	KASSERT(lock_do_i_hold(family_lk));
+	p->p_sibling = *headp;
+	if (*headp != NULL){
+		(*headp)->p_siblingp = &p->p_sibling;
+	}
+	*headp = p;
+	p->p_siblingp = headp;
+}
+
+static void family_unlink(struct proc *p){
+	KASSERT(lock_do_i_hold(family_lk));
+	KASSERT(p->p_siblingp != NULL);
+	*p->p_siblingp = p->p_sibling;
+	if (p->p_sibling != NULL){
+		p->p_sibling->p_siblingp = p->p_siblingp;
+	}
+	p->p_sibling = NULL;
+	p->p_siblingp = NULL;
+}
+
+void proc_addchild(struct proc *parent, struct proc *child){
+	lock_acquire(family_lk);
+	KASSERT(child->p_parentproc == NULL);
+	child->p_parent = parent->p_pid;
+	child->p_parentproc = parent;
+	family_link(&parent->p_children, child);
+	lock_release(family_lk);
+}
+
+/* 
+ * Exited children of an exiting process have nobody left to reap them, so we do it here. Children still running are
+ * orphaned: nobody can wait for them any more, and with no init process to adopt them they're never reaped.
+ */
+void proc_exit(struct proc *proc, int exitcode){
+	struct proc *zombies, *c;
+
+	lock_acquire(family_lk);
+	while ((c = proc->p_children) != NULL){
+		family_unlink(c);
+		c->p_parentproc = NULL;
+		c->p_parent = -1;
+	}
+	zombies = proc->p_zombies;
+	proc->p_zombies = NULL;
+	for (c = zombies; c != NULL; c = c->p_sibling){
+		c->p_parentproc = NULL;
+		c->p_siblingp = NULL;
+	}
+
+	/* the exit fields are also under p_waitlock, for those waiting for this process in particular */
+	lock_acquire(proc->p_waitlock);
+	proc->p_exitcode = exitcode;
+	proc->p_exited = true;
+	cv_broadcast(proc->p_waitcv, proc->p_waitlock);
+	lock_release(proc->p_waitlock);
+
+	if (proc->p_parentproc != NULL){
+		family_unlink(proc);
+		family_link(&proc->p_parentproc->p_zombies, proc);
+		cv_broadcast(proc->p_parentproc->p_childcv, family_lk);
+	}
+	lock_release(family_lk);
+
+	while ((c = zombies) != NULL){
+		zombies = c->p_sibling;
+		c->p_sibling = NULL;
+		proc_destroy_later(c);
+	}
+}
+
+/* CHILD must be on PARENT's zombie list. Take it off */
+static struct proc *family_reap(struct proc *child){
+	family_unlink(child);
+	child->p_parentproc = NULL;
+	return child;
+}
+
+int proc_waitchild(struct proc *parent, pid_t pid, bool nohang, struct proc **childp){
+	struct proc *c;
+
+	lock_acquire(family_lk);
+	for (;;){
+		if (pid == -1){
+			if (parent->p_zombies != NULL){
+				*childp = family_reap(parent->p_zombies);
+				break;
+			}
+			if (parent->p_children == NULL){
+				lock_release(family_lk);
+				return ECHILD;
+			}
+		}
+		else {
+			/* 
+			 * If C isn't ours it may be going away under us, but then it can't point at PARENT (only a
+			 * proc that really is our child can, and we're the one who'd destroy it).
+			 */
+			c = proc_get(pid);
+			if (c == NULL){
+				lock_release(family_lk);
+				return ESRCH;
+			}
+			if (c->p_parentproc != parent){
+				lock_release(family_lk);
+				return ECHILD;
+			}
+			if (c->p_exited){
+				*childp = family_reap(c);
+				break;
+			}
+		}
+		if (nohang){
+			*childp = NULL;
+			break;
+		}
+		if (parent->p_thrkill){
+			/* another thread is making the process exit or exec, we're about to leave */
+			lock_release(family_lk);
+			return EINTR;
+		}
+		cv_wait(parent->p_childcv, family_lk);
+	}
+	lock_release(family_lk);
+	return 0;
+}
+
+void proc_wakewaiters(struct proc *proc){
+	lock_acquire(family_lk);
+	cv_broadcast(proc->p_childcv, family_lk);
+	lock_release(family_lk);
 }
 
+/* 
+ * proc_exit comes just before the last thread's thread_exit, so this doesn't wait long; p_lock is a spinlock and
+ * nobody signals when the thread has gone, so yield until it has.
+ */
+void proc_waitthreads(struct proc *proc){
+	unsigned n;
+
+	KASSERT(proc->p_exited);
+	for (;;){
+		spinlock_acquire(&proc->p_lock);
+		n = threadarray_num(&proc->p_threads);
+		spinlock_release(&proc->p_lock);
+		if (n == 0){
+			return;
+		}
+		thread_yield();
+	}
+}
+
+/*
+ * Proc structures are cached with their wait lock and cv, the thread
+ * array and the spinlock already set up. proc_destroy puts them back
+ * that way (no threads, nobody waiting).
+ */
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	proc->p_waitlock = lock_create("proc_waitlock");
+	if (proc->p_waitlock == NULL) {
+		return ENOMEM;
+	}
+	proc->p_waitcv = cv_create("proc_waitcv");
+	if (proc->p_waitcv == NULL) {
+		lock_destroy(proc->p_waitlock);
+		return ENOMEM;
+	}
+	proc->p_childcv = cv_create("proc_childcv");
+	if (proc->p_childcv == NULL) {
+		cv_destroy(proc->p_waitcv);
+		lock_destroy(proc->p_waitlock);
+		return ENOMEM;
+	}
+	proc->p_thrlock = lock_create("proc_thrlock");
+	if (proc->p_thrlock == NULL) {
+		cv_destroy(proc->p_childcv);
+		cv_destroy(proc->p_waitcv);
+		lock_destroy(proc->p_waitlock);
+		return ENOMEM;
+	}
+	proc->p_thrcv = cv_create("proc_thrcv");
+	if (proc->p_thrcv == NULL) {
+		lock_destroy(proc->p_thrlock);
+		cv_destroy(proc->p_childcv);
+		cv_destroy(proc->p_waitcv);
+		lock_destroy(proc->p_waitlock);
+		return ENOMEM;
+	}
+
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+	cv_destroy(proc->p_thrcv);
+	lock_destroy(proc->p_thrlock);
+	cv_destroy(proc->p_childcv);
+	cv_destroy(proc->p_waitcv);
+	lock_destroy(proc->p_waitlock);
+}
+
+static struct kmem_cache proc_cache = KMEM_CACHE_INITIALIZER("proc", struct proc, proc_ctor, proc_dtor, KM_PROC);
+
 /*
  * Create a proc structure.
  */
@@ -117,41 +379,70 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(&proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(&proc_cache, proc);
 		return NULL;
 	}
-
-	threadarray_init(&proc->p_threads);
-	spinlock_init(&proc->p_lock);
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+	proc->p_cwdpath = NULL;
+	proc->p_cwdgen = 0;
+	proc->file_table = NULL;
 
 	/* ADDED FOR A5 */
 
 	/* Initialize new pid managmenet fields */
-
-	/* The kernel process should not recieve a user PID (pid 1 is reserved for kernel proc) */
+	proc->p_parent = -1; /* this will be set by fork set to -1 for now*/
+	proc->p_exitcode = 0; 
+	proc->p_exited = false;
+	proc->p_parentproc = NULL;
+	proc->p_children = NULL;
+	proc->p_zombies = NULL;
+	proc->p_sibling = NULL;
+	proc->p_siblingp = NULL;
+	proc->p_uthreads = NULL;
+	proc->p_thrfree = NULL;
+	proc->p_nthr = 1;
+	proc->p_nexttid = 1;
+	proc->p_thrkill = false;
+	proc->p_aio = NULL;
+	proc->p_systrace = NULL;
+	bzero(&proc->p_vmstats, sizeof(proc->p_vmstats));
+	bzero(&proc->p_childstats, sizeof(proc->p_childstats));
+	for (unsigned i = 0; i < __RLIMIT_NUM; i++) {
+		proc->p_rlimit[i].rlim_cur = RLIM_INFINITY;
+		proc->p_rlimit[i].rlim_max = RLIM_INFINITY;
+	}
+	proc->p_rlimit[RLIMIT_STACK].rlim_cur = STACK_LIMIT_DEFAULT;
+	proc->p_ioprio = IOPRIO_BE;
+	bzero(&proc->p_times, sizeof(proc->p_times));
+	bzero(&proc->p_childtimes, sizeof(proc->p_childtimes));
+
+	/* 
+	 * The kernel process should not recieve a user PID (pid 1 is reserved for kernel proc). This comes last, since
+	 * the proc can be looked up as soon as it has one.
+	 */
 	if (strcmp(name, "[kernel]") != 0){
-		proc->p_pid = proc_allocpid(proc);
+		if (proc_allocpid(proc) < 0){
+			/* out of pids */
+			kfree(proc->p_name);
+			kmem_cache_free(&proc_cache, proc);
+			return NULL;
+		}
 	}
 	else {
 		proc->p_pid = 1;
 	}
-	proc->p_parent = -1; /* this will be set by fork set to -1 for now*/
-	proc->p_exitcode = 0; 
-	proc->p_exited = false; 
-	proc->p_waitlock = lock_create("proc_waitlock");
-	proc->p_waitcv = cv_create("proc_waitcv");
 
 	return proc;
 }
@@ -182,11 +473,22 @@ proc_destroy(struct proc *proc)
 	 * incorrect to destroy it.)
 	 */
 
+	/* Family: reaped children are already off their parent's lists, this is for a fork that failed */
+	if (proc->p_parentproc != NULL) {
+		lock_acquire(family_lk);
+		family_unlink(proc);
+		proc->p_parentproc = NULL;
+		lock_release(family_lk);
+	}
+	KASSERT(proc->p_children == NULL && proc->p_zombies == NULL);
+
 	/* VFS fields */
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
 	}
+	kfree(proc->p_cwdpath);
+	proc->p_cwdpath = NULL;
 
 	/* VM fields */
 	if (proc->p_addrspace) {
@@ -236,26 +538,75 @@ proc_destroy(struct proc *proc)
 		as_destroy(as);
 	}
 
+	/* records of user threads nobody joined, and the spare stacks (those went with the address space) */
+	thr_forget(proc);
+
+	/* aio requests still going finish without us */
+	aio_detach(proc);
+
+	/* syscall records nobody read */
+	systrace_destroy(proc);
+
 	if (proc->file_table != NULL) {
 		destroy_file_table(proc->file_table);
 		proc->file_table = NULL;
 	}
 
 	/* ADDED FOR A5 */
-	if (proc->p_waitcv != NULL){
-		cv_destroy(proc->p_waitcv);
-	}
-	if (proc->p_waitlock != NULL){
-		lock_destroy(proc->p_waitlock);
-	}
-	
 	proc_freepid(proc->p_pid);
 
-	threadarray_cleanup(&proc->p_threads);
-	spinlock_cleanup(&proc->p_lock);
+	/* the wait lock and cv, thread array and spinlock stay with the proc in the cache */
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(&proc_cache, proc);
+}
+
+/*
+ * The reaper. Exited processes nobody will look at again go on its
+ * list and a work item destroys them all in one run, so neither the
+ * exit path nor the parent's waitpid waits for that. The threads may
+ * still be on their way out (see proc_waitthreads); the reaper waits
+ * for them.
+ */
+static struct spinlock reaper_lock = SPINLOCK_INITIALIZER;
+static struct proc *reaper_list;
+static struct work reaper_work;
+
+void
+proc_destroy_later(struct proc *proc)
+{
+	KASSERT(proc->p_exited);
+	KASSERT(proc->p_parentproc == NULL);
+
+	spinlock_acquire(&reaper_lock);
+	proc->p_reapnext = reaper_list;
+	reaper_list = proc;
+	spinlock_release(&reaper_lock);
+
+	/* if it's already queued, that run will find this one too */
+	workqueue_submit(&reaper_work);
+}
+
+static
+void
+proc_reaper(void *unused)
+{
+	struct proc *list, *proc;
+
+	(void)unused;
+
+	spinlock_acquire(&reaper_lock);
+	list = reaper_list;
+	reaper_list = NULL;
+	spinlock_release(&reaper_lock);
+
+	while (list != NULL) {
+		proc = list;
+		list = proc->p_reapnext;
+		proc_waitthreads(proc);
+		proc_destroy(proc);
+	}
 }
 
 /*
@@ -271,6 +622,8 @@ proc_bootstrap(void)
 
 	/* Initialize pid managmenet system for user processes. */
 	pid_bootstrap();
+
+	work_init(&reaper_work, proc_reaper, NULL);
 }
 
 /*
@@ -284,6 +637,7 @@ proc_create_runprogram(const char *name)
 {
 	struct proc *newproc;
 	struct vnode *v0, *v1, *v2;
+	struct open_file_handler *f, *old;
 	int result;
 
 	newproc = proc_create(name);
@@ -331,12 +685,15 @@ proc_create_runprogram(const char *name)
 	}
 
 	/* wrap the vnode in an open_file struct and store it in fd0 */
-	newproc->file_table->files[0] = create_open_file(v0, O_RDONLY);
-	if (newproc->file_table->files[0] == NULL) {
+	f = create_open_file(v0, O_RDONLY);
+	if (f == NULL) {
 		vfs_close(v0);
 		proc_destroy(newproc);
 		return NULL;
 	}
+	/* (a new table always has room for the first few fds) */
+	result = file_table_set(newproc->file_table, 0, f, &old);
+	KASSERT(result == 0 && old == NULL);
 
 	/* fd 1 is stdout so this also goes to the console but for writing only. Allows the process to print to the terminal using printf(), write(), etc. */
 	path_copy = kstrdup("con:");
@@ -350,12 +707,15 @@ proc_create_runprogram(const char *name)
 		proc_destroy(newproc);
 		return NULL;
 	}
-	newproc->file_table->files[1] = create_open_file(v1, O_WRONLY);
-	if (newproc->file_table->files[1] == NULL) {
+	f = create_open_file(v1, O_WRONLY);
+	if (f == NULL) {
 		vfs_close(v1);
 		proc_destroy(newproc);
 		return NULL;
 	}
+	/* (a new table always has room for the first few fds) */
+	result = file_table_set(newproc->file_table, 1, f, &old);
+	KASSERT(result == 0 && old == NULL);
 
 	/* fd 2 is stderr behaves like stdout but is kept separate so err messegases don't interfere with regular outputs */
 	path_copy = kstrdup("con:");
@@ -369,12 +729,15 @@ proc_create_runprogram(const char *name)
 		proc_destroy(newproc);
 		return NULL;
 	}
-	newproc->file_table->files[2] = create_open_file(v2, O_WRONLY);
-	if (newproc->file_table->files[2] == NULL) {
+	f = create_open_file(v2, O_WRONLY);
+	if (f == NULL) {
 		vfs_close(v2);
 		proc_destroy(newproc);
 		return NULL;
 	}
+	/* (a new table always has room for the first few fds) */
+	result = file_table_set(newproc->file_table, 2, f, &old);
+	KASSERT(result == 0 && old == NULL);
 
 	/* Now this process has a valid ft and can perform standard I/O operatiosn */
 
@@ -435,6 +798,8 @@ proc_remthread(struct thread *t)
 	for (i=0; i<num; i++) {
 		if (threadarray_get(&proc->p_threads, i) == t) {
 			threadarray_remove(&proc->p_threads, i);
+			/* its time stays with the process */
+			cputimes_add(&proc->p_times, &t->t_times);
 			spinlock_release(&proc->p_lock);
 			spl = splhigh();
 			t->t_proc = NULL;
@@ -465,6 +830,11 @@ proc_getas(void)
 		return NULL;
 	}
 
+	/* exec loads the new program with only the loading thread looking at it, the others go on in the old one */
+	if (curthread->t_loadas != NULL) {
+		return curthread->t_loadas;
+	}
+
 	spinlock_acquire(&proc->p_lock);
 	as = proc->p_addrspace;
 	spinlock_release(&proc->p_lock);
@@ -489,3 +859,75 @@ proc_setas(struct addrspace *newas)
 	spinlock_release(&proc->p_lock);
 	return oldas;
 }
+
+/*
+ * Add up the CPU time of PROC: what its exited threads left in
+ * p_times plus what the live ones have used so far. Holding p_lock
+ * keeps a thread from being counted twice or not at all as it leaves.
+ */
+void
+proc_gettimes(struct proc *proc, struct cputimes *ret)
+{
+	unsigned i, num;
+
+	spinlock_acquire(&proc->p_lock);
+	*ret = proc->p_times;
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		cputimes_add(ret, &threadarray_get(&proc->p_threads, i)->t_times);
+	}
+	spinlock_release(&proc->p_lock);
+}
+
+/* Print CYCLES as seconds with milliseconds, in a field of width 10 */
+static
+void
+proc_printtime(uint64_t cycles)
+{
+	struct timespec ts;
+
+	cycles_to_timespec(cycles, &ts);
+	kprintf(" %6llu.%03u", (unsigned long long)ts.tv_sec,
+		(unsigned)(ts.tv_nsec / 1000000));
+}
+
+static
+void
+proc_printone(struct proc *proc)
+{
+	struct cputimes ct;
+	unsigned nthreads;
+
+	proc_gettimes(proc, &ct);
+	spinlock_acquire(&proc->p_lock);
+	nthreads = threadarray_num(&proc->p_threads);
+	spinlock_release(&proc->p_lock);
+
+	kprintf("%5d %5d %3u %-6s", (int)proc->p_pid, (int)proc->p_parent,
+		nthreads, proc->p_exited ? "zombie" : "run");
+	proc_printtime(ct.ct_utime);
+	proc_printtime(ct.ct_stime);
+	proc_printtime(ct.ct_itime);
+	kprintf("  %s\n", proc->p_name);
+}
+
+/*
+ * Print every process (the kernel's first) with its CPU times in
+ * seconds. The pid table lock keeps them from being destroyed while
+ * we look.
+ */
+void
+proc_printall(void)
+{
+	pid_t pid;
+
+	kprintf("  PID  PPID THR STATE        USER        SYS       INTR  NAME\n");
+	proc_printone(kproc);
+	rwlock_acquire_read(pid_lk);
+	for (pid = __PID_MIN; pid < __PID_MAX; pid++) {
+		if (pid_table[pid] != NULL) {
+			proc_printone(pid_table[pid]);
+		}
+	}
+	rwlock_release_read(pid_lk);
+}
@@ -0,0 +1,389 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/aio.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <copyinout.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <aio.h>
+#include <syscall.h>
+
+
+/*
+ * Asynchronous I/O (see kern/aio.h). Requests from every process go on one queue that AIO_NTHREADS kernel threads
+ * take them from, so a process can have up to AIO_MAX of them going while it does something else, and the disk sees
+ * several at once. The I/O threads belong to the kernel, not to the process, so they move the data to and from a
+ * kernel buffer: aio_write copies it in when the request is queued, and aio_wait copies a read's data out when it
+ * hands back the event (it runs in the process, so it can).
+ *
+ * Each process that has used aio has a context with its finished requests on it. The context lives until the process
+ * is gone (aio_detach) and its last request has finished, whichever is later: a request holds its own reference to
+ * the open file, so it can finish even after the process closed the file or exited.
+ */
+
+#define AIO_NTHREADS 4
+
+#define AIO_READ 0
+#define AIO_WRITE 1
+
+struct aio_ctx;
+
+struct aio_req {
+    struct aio_req *ar_next; /* on the queue, then on ac_done */
+    struct aio_ctx *ar_ctx;
+    int ar_op; /* AIO_READ or AIO_WRITE */
+    struct open_file_handler *ar_file;
+    off_t ar_offset;
+    size_t ar_len;
+    char *ar_kbuf;
+    userptr_t ar_ubuf; /* where a read's data goes */
+    unsigned ar_data;
+    int ar_res;
+};
+
+struct aio_ctx {
+    struct lock *ac_lock;
+    struct cv *ac_cv; /* broadcast when a request finishes */
+    struct aio_req *ac_done; /* finished and not yet collected, oldest first */
+    struct aio_req **ac_donetail;
+    unsigned ac_inflight; /* requests not yet collected: queued, running or on ac_done */
+    bool ac_dead; /* the process has gone, throw requests away as they finish */
+};
+
+/* The queue the I/O threads work from */
+static struct lock *aio_lock;
+static struct cv *aio_cv;
+static struct aio_req *aio_head;
+static struct aio_req **aio_tail = &aio_head;
+
+static void aio_ctx_free(struct aio_ctx *ac){
+    cv_destroy(ac->ac_cv);
+    lock_destroy(ac->ac_lock);
+    kfree(ac);
+}
+
+static void aio_req_free(struct aio_req *ar){
+    kfree(ar->ar_kbuf);
+    kfree(ar);
+}
+
+/* The process's context, made on first use */
+static struct aio_ctx *aio_getctx(struct proc *p){
+    spinlock_acquire(&p->p_lock);
+    struct aio_ctx *ac = p->p_aio;
+    spinlock_release(&p->p_lock);
+    if (ac != NULL){
+        return ac;
+    }
+
+    ac = kmalloc_tagged(sizeof(*ac), KM_PROC);
+    if (ac == NULL){
+        return NULL;
+    }
+    ac->ac_lock = lock_create("aio_ctx");
+    ac->ac_cv = cv_create("aio_ctx");
+    if (ac->ac_lock == NULL || ac->ac_cv == NULL){
+        if (ac->ac_lock != NULL){
+            lock_destroy(ac->ac_lock);
+        }
+        if (ac->ac_cv != NULL){
+            cv_destroy(ac->ac_cv);
+        }
+        kfree(ac);
+        return NULL;
+    }
+    ac->ac_done = NULL;
+    ac->ac_donetail = &ac->ac_done;
+    ac->ac_inflight = 0;
+    ac->ac_dead = false;
+
+    /* another thread of ours may have beaten us to it */
+    spinlock_acquire(&p->p_lock);
+    if (p->p_aio == NULL){
+        p->p_aio = ac;
+        ac = NULL;
+    }
+    struct aio_ctx *ret = p->p_aio;
+    spinlock_release(&p->p_lock);
+    if (ac != NULL){
+        aio_ctx_free(ac);
+    }
+    return ret;
+}
+
+/* A request is done: hand it to its process, or throw it away if the process is gone */
+static void aio_finish(struct aio_req *ar){
+    struct aio_ctx *ac = ar->ar_ctx;
+    bool freectx = false;
+
+    lock_acquire(ac->ac_lock);
+    if (ac->ac_dead){
+        ac->ac_inflight--;
+        freectx = (ac->ac_inflight == 0);
+        lock_release(ac->ac_lock);
+        aio_req_free(ar);
+    }
+    else {
+        ar->ar_next = NULL;
+        *ac->ac_donetail = ar;
+        ac->ac_donetail = &ar->ar_next;
+        cv_broadcast(ac->ac_cv, ac->ac_lock);
+        lock_release(ac->ac_lock);
+    }
+
+    if (freectx){
+        aio_ctx_free(ac);
+    }
+}
+
+static void aio_thread(void *unused1, unsigned long unused2){
+    (void)unused1;
+    (void)unused2;
+
+    while (1){
+        lock_acquire(aio_lock);
+        while (aio_head == NULL){
+            cv_wait(aio_cv, aio_lock);
+        }
+        struct aio_req *ar = aio_head;
+        aio_head = ar->ar_next;
+        if (aio_head == NULL){
+            aio_tail = &aio_head;
+        }
+        lock_release(aio_lock);
+
+        /* like pread/pwrite: at the request's offset, and the file's own offset isn't touched */
+        struct iovec iov;
+        struct uio u;
+        uio_kinit(&iov, &u, ar->ar_kbuf, ar->ar_len, ar->ar_offset, ar->ar_op == AIO_READ ? UIO_READ : UIO_WRITE);
+        int result;
+        if (ar->ar_op == AIO_READ){
+            result = VOP_READ(ar->ar_file->file_vn, &u);
+        }
+        else {
+            result = VOP_WRITE(ar->ar_file->file_vn, &u);
+        }
+        ar->ar_res = result ? -result : (int)(ar->ar_len - u.uio_resid);
+
+        open_file_decref(ar->ar_file);
+        ar->ar_file = NULL;
+        aio_finish(ar);
+    }
+}
+
+void aio_bootstrap(void){
+    aio_lock = lock_create("aio");
+    aio_cv = cv_create("aio");
+    if (aio_lock == NULL || aio_cv == NULL){
+        panic("aio_bootstrap: out of memory\n");
+    }
+    for (int i = 0; i < AIO_NTHREADS; i++){
+        if (thread_fork("aio", NULL, aio_thread, NULL, 0)){
+            panic("aio_bootstrap: could not start the I/O threads\n");
+        }
+    }
+}
+
+void aio_killproc(struct proc *p){
+    spinlock_acquire(&p->p_lock);
+    struct aio_ctx *ac = p->p_aio;
+    spinlock_release(&p->p_lock);
+
+    if (ac != NULL){
+        lock_acquire(ac->ac_lock);
+        cv_broadcast(ac->ac_cv, ac->ac_lock);
+        lock_release(ac->ac_lock);
+    }
+}
+
+void aio_detach(struct proc *p){
+    spinlock_acquire(&p->p_lock);
+    struct aio_ctx *ac = p->p_aio;
+    p->p_aio = NULL;
+    spinlock_release(&p->p_lock);
+    if (ac == NULL){
+        return;
+    }
+
+    lock_acquire(ac->ac_lock);
+    ac->ac_dead = true;
+    struct aio_req *list = ac->ac_done;
+    ac->ac_done = NULL;
+    ac->ac_donetail = &ac->ac_done;
+    for (struct aio_req *ar = list; ar != NULL; ar = ar->ar_next){
+        ac->ac_inflight--;
+    }
+    bool freectx = (ac->ac_inflight == 0);
+    lock_release(ac->ac_lock);
+
+    while (list != NULL){
+        struct aio_req *ar = list;
+        list = ar->ar_next;
+        aio_req_free(ar);
+    }
+    /* otherwise the last request to finish frees it */
+    if (freectx){
+        aio_ctx_free(ac);
+    }
+}
+
+/* Queues a request for what ucb describes */
+static int aio_submit(int op, userptr_t ucb){
+    struct aiocb cb;
+    int result;
+
+    result = copyin(ucb, &cb, sizeof(cb));
+    if (result){
+        return result;
+    }
+    if (cb.aio_nbytes > AIO_MAXBYTES || cb.aio_offset < 0){
+        return EINVAL;
+    }
+
+    struct aio_ctx *ac = aio_getctx(curproc);
+    if (ac == NULL){
+        return ENOMEM;
+    }
+
+    struct open_file_handler *file = file_table_get(curproc->file_table, cb.aio_fildes);
+    if (file == NULL){
+        return EBADF;
+    }
+    int accmode = file->flags & O_ACCMODE;
+    if ((op == AIO_READ && accmode == O_WRONLY) || (op == AIO_WRITE && accmode == O_RDONLY)){
+        open_file_decref(file);
+        return EBADF;
+    }
+
+    struct aio_req *ar = kmalloc_tagged(sizeof(*ar), KM_PROC);
+    if (ar == NULL){
+        open_file_decref(file);
+        return ENOMEM;
+    }
+    /* (at least a byte, so a zero length request still has a buffer) */
+    ar->ar_kbuf = kmalloc_tagged(cb.aio_nbytes > 0 ? cb.aio_nbytes : 1, KM_PROC);
+    if (ar->ar_kbuf == NULL){
+        kfree(ar);
+        open_file_decref(file);
+        return ENOMEM;
+    }
+    if (op == AIO_WRITE){
+        result = copyin((const_userptr_t)cb.aio_buf, ar->ar_kbuf, cb.aio_nbytes);
+        if (result){
+            aio_req_free(ar);
+            open_file_decref(file);
+            return result;
+        }
+    }
+    ar->ar_ctx = ac;
+    ar->ar_op = op;
+    ar->ar_file = file;
+    ar->ar_offset = cb.aio_offset;
+    ar->ar_len = cb.aio_nbytes;
+    ar->ar_ubuf = (userptr_t)cb.aio_buf;
+    ar->ar_data = cb.aio_data;
+    ar->ar_res = 0;
+
+    lock_acquire(ac->ac_lock);
+    if (ac->ac_inflight >= AIO_MAX){
+        lock_release(ac->ac_lock);
+        aio_req_free(ar);
+        open_file_decref(file);
+        return EAGAIN;
+    }
+    ac->ac_inflight++;
+    lock_release(ac->ac_lock);
+
+    lock_acquire(aio_lock);
+    ar->ar_next = NULL;
+    *aio_tail = ar;
+    aio_tail = &ar->ar_next;
+    cv_signal(aio_cv, aio_lock);
+    lock_release(aio_lock);
+    return 0;
+}
+
+int sys_aio_read(userptr_t ucb){
+    return aio_submit(AIO_READ, ucb);
+}
+
+int sys_aio_write(userptr_t ucb){
+    return aio_submit(AIO_WRITE, ucb);
+}
+
+/*
+ * Hands back up to max finished requests as events at uevents and returns how many. Waits for one to finish if none
+ * has yet (unless AIO_NOWAIT); returns 0 straight away if there are none to wait for.
+ */
+int sys_aio_wait(userptr_t uevents, int max, int flags, int32_t *retval){
+    struct proc *p = curproc;
+
+    if (max <= 0 || (flags & ~AIO_NOWAIT) != 0){
+        return EINVAL;
+    }
+
+    spinlock_acquire(&p->p_lock);
+    struct aio_ctx *ac = p->p_aio;
+    spinlock_release(&p->p_lock);
+    if (ac == NULL){
+        *retval = 0;
+        return 0;
+    }
+
+    lock_acquire(ac->ac_lock);
+    while (ac->ac_done == NULL && ac->ac_inflight > 0 && !(flags & AIO_NOWAIT)){
+        if (p->p_thrkill){
+            /* another thread is making the process exit or exec */
+            lock_release(ac->ac_lock);
+            return EINTR;
+        }
+        cv_wait(ac->ac_cv, ac->ac_lock);
+    }
+    struct aio_req *list = ac->ac_done;
+    int n = 0;
+    struct aio_req **arp = &list;
+    while (*arp != NULL && n < max){
+        arp = &(*arp)->ar_next;
+        n++;
+    }
+    ac->ac_done = *arp;
+    if (ac->ac_done == NULL){
+        ac->ac_donetail = &ac->ac_done;
+    }
+    *arp = NULL;
+    ac->ac_inflight -= n;
+    lock_release(ac->ac_lock);
+
+    /* the data of the reads goes out first, so it's there when the caller sees the event */
+    int result = 0;
+    struct aio_event ev;
+    for (int i = 0; list != NULL; i++){
+        struct aio_req *ar = list;
+        list = ar->ar_next;
+
+        if (ar->ar_op == AIO_READ && ar->ar_res > 0){
+            if (copyout(ar->ar_kbuf, ar->ar_ubuf, ar->ar_res)){
+                ar->ar_res = -EFAULT;
+            }
+        }
+        ev.ae_data = ar->ar_data;
+        ev.ae_res = ar->ar_res;
+        if (result == 0){
+            result = copyout(&ev, (userptr_t)((struct aio_event *)uevents + i), sizeof(ev));
+        }
+        aio_req_free(ar);
+    }
+    if (result){
+        return result;
+    }
+
+    *retval = n;
+    return 0;
+}
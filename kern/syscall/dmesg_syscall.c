@@ -0,0 +1,32 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+
+/* ssize_t dmesg(char *buf, size_t len): copies the most recent len bytes of the kernel log (everything kprintf has */
+/* printed, see kprintf.c) out to buf, or all of it if there is less, and returns how many. At most KLOG_SIZE are kept */
+int sys_dmesg(userptr_t buf, size_t len, int32_t *retval){
+    if (len > KLOG_SIZE){
+        len = KLOG_SIZE;
+    }
+    if (len == 0){
+        *retval = 0;
+        return 0;
+    }
+
+    char *kbuf = kmalloc(len);
+    if (kbuf == NULL){
+        return ENOMEM;
+    }
+    len = klog_read(kbuf, len);
+    int result = copyout(kbuf, buf, len);
+    kfree(kbuf);
+    if (result){
+        return result;
+    }
+
+    *retval = len;
+    return 0;
+}
@@ -7,161 +7,181 @@
 #include <kern/errno.h>    
 #include <proc.h>          
 #include <current.h>       
+#include <thread.h>
 #include <kern/limits.h>    
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <uthread.h>
+#include <aio.h>
 #include <syscall.h>       
 
-/* This implements the execv system call. */
+/* This implements the execv system call, and the argument copying and program loading that spawn shares with it. */
 
 /* execv replaces the current proccess image with a new process image */
 /* the new programs entry point is determined b*/
 
-int sys_execv(userptr_t path, userptr_t argv) {
-    /* implementation of execv system call */
-
-    if (path == NULL) {
+/* argv pointers read at a time */
+#define ARGPTR_BATCH 32
+
+/*
+ * Reads pointers from the user array UARGV into PTRS, up to MAX of them or up to and including the NULL, whichever
+ * comes first, and sets *GOT to how many. It's one user_access_begin for the lot rather than a copyin each. The batch
+ * stops short of the end of user space (argv is usually on the stack, right below it) so it isn't refused for that.
+ */
+static int copyin_argptrs(userptr_t uargv, userptr_t *ptrs, unsigned max, unsigned *got) {
+    vaddr_t addr = (vaddr_t)uargv;
+    if (addr >= USERSPACETOP) {
         return EFAULT;
     }
-
-    if (argv == NULL) {
+    if (max > (USERSPACETOP - addr) / sizeof(userptr_t)) {
+        max = (USERSPACETOP - addr) / sizeof(userptr_t);
+    }
+    if (max == 0) {
         return EFAULT;
     }
-    
-    /* copy in the path from user space */
-    char kpath[__PATH_MAX];
-    memset(kpath, 0, sizeof(kpath)); /* zero the buffer */
-    int result = copyinstr((const_userptr_t)path, kpath, __PATH_MAX, NULL);
 
+    int result = user_access_begin(uargv, max * sizeof(userptr_t));
     if (result) {
         return result;
     }
-
-    if (kpath[0] == '\0') {
-        return EINVAL;
+    const userptr_t *src = (const userptr_t *)uargv;
+    unsigned i = 0;
+    while (i < max) {
+        ptrs[i] = src[i];
+        if (ptrs[i++] == NULL) {
+            break;
+        }
     }
+    user_access_end();
 
-    /* we allocate a single buffer */
-    char *karg = kmalloc(__ARG_MAX);
-    if (karg == NULL) {
-        return ENOMEM;
-    }
+    *got = i;
+    return 0;
+}
 
-  
-    /* copy in the argv from user space */
-    int argc = 0;
-    /* keep track of the total number of bytes used so we can stay under the max*/
-    size_t total_bytes = 0;
+/* 
+ * Packs the NULL-terminated argument vector ARGV from user space into fresh frames, the strings back to back with
+ * their nulls, in one pass: copyinstr goes straight into the current frame at the next free byte, and when a string
+ * doesn't fit in what's left of it (ENAMETOOLONG) we take another frame and carry on where it stopped. The strings and
+ * the argv pointers they'll need must fit in __ARG_MAX, or it's E2BIG. The unused end of the last frame is zeroed, as
+ * the frames are handed to the new program as they are. On success AB holds the frames; argblock_free frees them
+ * unless load_program has taken them.
+ */
+int copyin_args(userptr_t argv, struct argblock *ab) {
+    int result;
+
+    ab->ab_npages = 0;
+    ab->ab_len = 0;
+    ab->ab_argc = 0;
 
-    /* reuse one scratch buffer for both passes to avoid repeated __ARG_MAX allocations */
+    if (argv == NULL) {
+        return EFAULT;
+    }
 
-    while (1) {
-        userptr_t current_argument;
+    userptr_t ptrs[ARGPTR_BATCH];
+    unsigned nptrs = 0, next = 0;
 
-        /* copy in the current argument, incrementing based on the number of arguments so far */
-        result = copyin((userptr_t)((uintptr_t)argv + (size_t)argc * sizeof(userptr_t)), &current_argument, sizeof(userptr_t));
-        if (result) {
-            kfree(karg);
-            return result;
+    while (1) {
+        /* the next argument pointer, reading another batch of them when we're through this one */
+        if (next == nptrs) {
+            result = copyin_argptrs((userptr_t)((uintptr_t)argv + (size_t)ab->ab_argc * sizeof(userptr_t)), ptrs,
+                                    ARGPTR_BATCH, &nptrs);
+            if (result) {
+                goto fail;
+            }
+            next = 0;
         }
+        userptr_t current_argument = ptrs[next++];
 
         if (current_argument == NULL) {
             break;
         }
 
-        /* measure length byte-by-byte from user space (including the null) */
-        size_t arglen = 0;
-        char ch;
-        do {
-            result = copyin((userptr_t)((uintptr_t)current_argument + arglen), &ch, 1);
-            if (result) {
-                kfree(karg);
-                return result;
-            }
-            arglen++;
-            if (arglen > __ARG_MAX) { /* exceeded per-arg bound before copying */
-                kfree(karg);
-                return E2BIG;
+        /* the pointers this one, and the NULL at the end, will take */
+        size_t pointers = (size_t)(ab->ab_argc + 2) * sizeof(userptr_t);
+        const char *src = (const char *)current_argument;
+
+        while (1) {
+            if (ab->ab_len + pointers >= __ARG_MAX) {
+                result = E2BIG;
+                goto fail;
             }
-        } while (ch != '\0');
 
-        total_bytes += arglen; /* includes the null byte */
+            /* current frame full (or none yet): take a new one */
+            if (ab->ab_len == ab->ab_npages * PAGE_SIZE) {
+                KASSERT(ab->ab_npages < ARGBLOCK_MAXPAGES);
+                paddr_t pa = alloc_user_page(false);
+                if (pa == 0) {
+                    result = ENOMEM;
+                    goto fail;
+                }
+                ab->ab_frames[ab->ab_npages++] = pa;
+            }
 
-        /* check if the total bytes exceed the max (include space for argv pointers) */
-        if (total_bytes + (size_t)((argc + 1) * sizeof(userptr_t)) > __ARG_MAX) {
-            kfree(karg);
-            return E2BIG;
-        }
+            size_t room = ab->ab_npages * PAGE_SIZE - ab->ab_len;
+            size_t limit = __ARG_MAX - ab->ab_len - pointers;
+            if (limit > room) {
+                limit = room;
+            }
 
-        argc++;
-    }
+            char *dest = (char *)PADDR_TO_KVADDR(ab->ab_frames[ab->ab_npages - 1]) + ab->ab_len % PAGE_SIZE;
+            size_t arg_length;
+            result = copyinstr((const_userptr_t)src, dest, limit, &arg_length);
+            if (result == 0) {
+                ab->ab_len += arg_length; /* includes the null byte */
+                break;
+            }
+            if (result != ENAMETOOLONG) {
+                goto fail;
+            }
+            if (limit < room) {
+                /* out of __ARG_MAX, not out of frame */
+                result = E2BIG;
+                goto fail;
+            }
 
+            /* filled the frame: the rest of this string goes in the next one */
+            ab->ab_len += limit;
+            src += limit;
+        }
 
-    /* copy the arguments into the kernel */
-    char **kargv = kmalloc((argc + 1) * sizeof(char *));
-    if (kargv == NULL) {
-        kfree(karg);
-        return ENOMEM;
+        ab->ab_argc++;
     }
 
-    /* one packed buffer for all strings */
-    char *kargs_block = kmalloc(total_bytes > 0 ? total_bytes : 1);
-    if (kargs_block == NULL) {
-        kfree(kargv);
-        kfree(karg);
-        return ENOMEM;
+    if (ab->ab_len % PAGE_SIZE != 0) {
+        size_t used = ab->ab_len % PAGE_SIZE;
+        memset((char *)PADDR_TO_KVADDR(ab->ab_frames[ab->ab_npages - 1]) + used, 0, PAGE_SIZE - used);
     }
+    return 0;
 
-    size_t offset = 0;
-
-    for (int i = 0; i < argc; i++) {
-        userptr_t current_argument;
-
-        /* copy in the current argument pointer */
-        result = copyin((userptr_t)((uintptr_t)argv + (size_t)i * sizeof(userptr_t)),
-                        &current_argument, sizeof(userptr_t));
-        if (result) {
-            kfree(kargs_block);
-            kfree(kargv);
-            kfree(karg);
-            return result;
-        }
-
-        /* copy in the actual argument string (second pass) */
-        result = copyinstr((const_userptr_t)current_argument, karg, __ARG_MAX, NULL);
-        if (result) {
-            if (result == ENAMETOOLONG) {
-                result = E2BIG;
-            }
-            kfree(kargs_block);
-            kfree(kargv);
-            kfree(karg);
-            return result;
-        }
-
-        size_t arg_length = strlen(karg) + 1;
-        if (arg_length > __ARG_MAX) {
-            kfree(kargs_block);
-            kfree(kargv);
-            kfree(karg);
-            return E2BIG;
-        }
+fail:
+    argblock_free(ab);
+    return result;
+}
 
-        memcpy(kargs_block + offset, karg, arg_length);
-        kargv[i] = kargs_block + offset;
-        offset += arg_length;
-    }
-    kargv[argc] = NULL;
+void argblock_free(struct argblock *ab) {
+    free_page_vec(ab->ab_frames, ab->ab_npages);
+    ab->ab_npages = 0;
+}
 
-    /* done with the scratch buffer */
-    kfree(karg);
+/* 
+ * Builds a new address space with the program at KPATH loaded and the arguments in AB at the top of its stack, and
+ * hands back the address space, the entry point, the stack pointer and the user argv. The frames holding the strings
+ * are mapped in as they are, so the strings aren't copied again, and the address space owns them from then on; only
+ * the argv pointers go out with a copyout. The current thread runs in the new address space while we fill it in
+ * (load_elf and copyout work on the current one, see t_loadas) and is back in its own when this returns, whether or
+ * not it worked.
+ */
+int load_program(char *kpath, struct argblock *ab, struct addrspace **asp, vaddr_t *entrypointp,
+                 vaddr_t *stackptrp, userptr_t *argvp) {
+    int result;
+    int argc = ab->ab_argc;
+    size_t pointers = (argc + 1) * sizeof(vaddr_t);
 
     /* now, we proceed similarly to runprogram, opening the file*/
-    /* the main difference here being that we destroy our current one*/
-
     struct vnode *v;
     result = vfs_open(kpath, O_RDONLY, 0, &v);
     if (result) {
-        kfree(kargs_block);
-        kfree(kargv);
         return result;
     }
 
@@ -170,105 +190,136 @@ int sys_execv(userptr_t path, userptr_t argv) {
     as = as_create();
     if (as == NULL) {
         vfs_close(v);
-        kfree(kargs_block);
-        kfree(kargv);
         return ENOMEM;
     }
 
-    /* switch to the new address space */
-    struct addrspace *old_as = proc_setas(as);
+    /* switch to the new address space, just this thread: any others of ours go on in the old one */
+    curthread->t_loadas = as;
     as_activate();
 
     /* load the executable */
     vaddr_t entrypoint;
     result = load_elf(v, &entrypoint);
-    if (result) {
-        /* return to the old address space */
-        proc_setas(old_as);
-        as_activate();
-
-        as_destroy(as);
-        vfs_close(v);
-        kfree(kargs_block);
-        kfree(kargv);
-        return result;
-    }
 
     /* done with the file now */
     vfs_close(v);
-
-    /* create the user stack in the new address space */
-    vaddr_t stackptr;
-    result = as_define_stack(as, &stackptr);
     if (result) {
-        proc_setas(old_as);
-        as_activate();
-
-        as_destroy(as);
-        kfree(kargs_block);
-        kfree(kargv);
-        return result;
+        goto fail;
     }
 
-    /* copy the arguments onto the user stack */
-    vaddr_t *arg_pointers = kmalloc((argc + 1) * sizeof(vaddr_t));
+    /*
+     * the argv pointers, worked out from where each string will land. Do it before the frames are mapped: after that
+     * they're ordinary user pages and the pager may take them
+     */
+    vaddr_t *arg_pointers = kmalloc_tagged(pointers, KM_PROC);
     if (arg_pointers == NULL) {
-        proc_setas(old_as);
-        as_activate();
-
-        as_destroy(as);
-        kfree(kargs_block);
-        kfree(kargv);
-        return ENOMEM;
+        result = ENOMEM;
+        goto fail;
     }
 
-    for (int i = argc - 1; i >= 0; i--) {
-        size_t arg_length = strlen(kargv[i]) + 1;
-        stackptr -= arg_length;
-        result = copyout(kargv[i], (userptr_t)stackptr, arg_length);
-        if (result) {
-            proc_setas(old_as);
-            as_activate();
-
-            as_destroy(as);
-            kfree(kargs_block);
-            kfree(kargv);
-            kfree(arg_pointers);
-            return result;
+    vaddr_t argbase = USERSTACK - ab->ab_npages * PAGE_SIZE;
+    size_t offset = 0;
+    for (int i = 0; i < argc; i++) {
+        arg_pointers[i] = argbase + offset;
+        /* a string can run on into the next frame, so walk it a byte at a time */
+        while (((char *)PADDR_TO_KVADDR(ab->ab_frames[offset / PAGE_SIZE]))[offset % PAGE_SIZE] != '\0') {
+            offset++;
         }
-        arg_pointers[i] = stackptr;
+        offset++;
+    }
+    arg_pointers[argc] = 0; // null terminate the argv array
+
+    /* create the user stack in the new address space, with the strings already at the top of it */
+    result = as_define_stack_args(as, ab->ab_frames, ab->ab_npages, pointers, &argbase);
+    if (result) {
+        kfree(arg_pointers);
+        goto fail;
     }
+    ab->ab_npages = 0;
 
-    /* align the stack pointer to a multiple of 8 */
+    /* the argv array goes right below the strings, which start page aligned (so aligned to 8) */
+    vaddr_t stackptr = argbase - pointers;
     stackptr &= ~7;
+    result = copyout(arg_pointers, (userptr_t)stackptr, pointers);
+    kfree(arg_pointers);
+    if (result) {
+        goto fail;
+    }
 
-    arg_pointers[argc] = 0; // null terminate the argv array
+    /* back to our own address space */
+    curthread->t_loadas = NULL;
+    as_activate();
+
+    *asp = as;
+    *entrypointp = entrypoint;
+    *stackptrp = stackptr;
+    *argvp = (userptr_t)stackptr;
+    return 0;
+
+fail:
+    /* return to the old address space */
+    curthread->t_loadas = NULL;
+    as_activate();
+    as_destroy(as);
+    return result;
+}
+
+int sys_execv(userptr_t path, userptr_t argv) {
+    /* implementation of execv system call */
+
+    if (path == NULL) {
+        return EFAULT;
+    }
+
+    if (argv == NULL) {
+        return EFAULT;
+    }
     
-    /* now copy out the argv array itself */
-    for (int i = argc; i >= 0; i--) {
-        stackptr -= sizeof(vaddr_t);
-        result = copyout(&arg_pointers[i], (userptr_t)stackptr, sizeof(vaddr_t));
-        if (result) {
-            proc_setas(old_as);
-            as_activate();
-
-            as_destroy(as);
-            kfree(kargs_block);
-            kfree(kargv);
-            kfree(arg_pointers);
-            return result;
-        }
+    /* copy in the path from user space */
+    char kpath[__PATH_MAX];
+    memset(kpath, 0, sizeof(kpath)); /* zero the buffer */
+    int result = copyinstr((const_userptr_t)path, kpath, __PATH_MAX, NULL);
+
+    if (result) {
+        return result;
+    }
+
+    if (kpath[0] == '\0') {
+        return EINVAL;
     }
 
-    userptr_t argv_userptr = (userptr_t)stackptr;
+    struct argblock ab;
+    result = copyin_args(argv, &ab);
+    if (result) {
+        return result;
+    }
+    int argc = ab.ab_argc;
 
-    /* free the kernel argument copies */
-    kfree(kargs_block);
-    kfree(kargv);
-    kfree(arg_pointers);
+    /* build the new image; the difference from spawn is that we then throw our current one away */
+    struct addrspace *as;
+    vaddr_t entrypoint, stackptr;
+    userptr_t argv_userptr;
+    result = load_program(kpath, &ab, &as, &entrypoint, &stackptr, &argv_userptr);
 
-    /* destroy the old address space */
-    as_destroy(old_as);
+    /* free the kernel argument copy */
+    argblock_free(&ab);
+    if (result) {
+        return result;
+    }
+
+    /* the other threads of the process go now (if one of them is already exiting or exec'ing, that one wins) */
+    if (!thr_killothers(curproc)) {
+        as_destroy(as);
+        thr_leave();
+    }
+    thr_reset(curproc);
+    /* reads still going were for the old image's memory */
+    aio_detach(curproc);
+
+    /* switch for good and destroy the old address space (in the background, the new program can start right away) */
+    struct addrspace *old_as = proc_setas(as);
+    as_activate();
+    as_destroy_later(old_as);
 
     /* finally enter user mode */
     enter_new_process(argc, argv_userptr, NULL, stackptr, entrypoint);
@@ -7,21 +7,44 @@
 #include <thread.h>
 #include <syscall.h>
 #include <lib.h>
-void sys__exit(int code) {
+#include <addrspace.h>
+#include <uthread.h>
+#include <systrace.h>
+/*
+ * Ends the current process with STATUS (an encoded wait status), for _exit and for fatal traps in user mode. The
+ * other threads of the process leave first; if one of them is already ending it (or exec'ing) we just leave instead.
+ */
+void exit_process(int status) {
     struct proc *p = curproc;
 
     KASSERT(p != NULL); 
 
-    /* mark exit status and wake any waiters */
-    lock_acquire(p->p_waitlock);
-    p->p_exitcode = _MKWAIT_EXIT(code & 0xff); /* pack as an exit status */
-    p->p_exited = true;
-    cv_broadcast(p->p_waitcv, p->p_waitlock);
-    lock_release(p->p_waitlock);
+    if (!thr_killothers(p)){
+        thr_leave();
+    }
+
+    /* give our memory back now rather than when the parent waits for us, the reaper thread does the actual work */
+    struct addrspace *as = proc_setas(NULL);
+    as_deactivate();
+    if (as != NULL){
+        p->p_vmstats = as->as_stats; /* for getrusage(RUSAGE_CHILDREN) in the parent and the menu */
+        as_destroy_later(as);
+    }
+
+    /* a tracer reading our calls has had them all */
+    systrace_exit(p);
+
+    /* mark exit status and wake our parent */
+    proc_exit(p, status);
 
     /* detach this thread from its process before exiting */
     thread_exit();
 
     /* not reached */
-    panic("sys__exit: thread_exit returned");
+    panic("exit_process: thread_exit returned");
+}
+
+void sys__exit(int code) {
+    /* the exit status is packed as a wait status */
+    exit_process(_MKWAIT_EXIT(code & 0xff));
 }
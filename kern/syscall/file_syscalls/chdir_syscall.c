@@ -18,8 +18,8 @@ int sys_chdir(userptr_t pathname) {
 
 
     /* we copy the pathname from user space through a buffer */
-    char pathbuf[OPEN_MAX];
-    int result = copyinstr(pathname, pathbuf, OPEN_MAX, NULL);
+    char pathbuf[PATH_MAX];
+    int result = copyinstr(pathname, pathbuf, PATH_MAX, NULL);
     if (result) {
         return result; /* return error from copyinstr */
     }
@@ -29,21 +29,21 @@ int sys_close(int fd){
     struct file_table *ft = curproc->file_table;
 
     /* acquire file table lock before accessing */
-    lock_acquire(ft->lock);
+    rwlock_acquire_write(ft->lock);
 
 
     /* get the pointer for the file */
-    struct open_file_handler *f = ft->files[fd];
+    struct open_file_handler *f = file_table_lookup(ft, fd);
     if (f == NULL) {
         /* if it's already null then we release lock and return the bad file descriptor error */
-        lock_release(ft->lock);
+        rwlock_release_write(ft->lock);
         return EBADF;
     }
 
 
-    /* clear the slot and release the file references */
-    ft->files[fd] = NULL;
-    lock_release(ft->lock);
+    /* clear the slot and release the file references (clearing never has to grow the table, so it can't fail) */
+    file_table_set(ft, fd, NULL, &f);
+    rwlock_release_write(ft->lock);
 
 
     /* decrement the reference count for the file */
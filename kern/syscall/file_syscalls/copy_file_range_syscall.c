@@ -0,0 +1,137 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <synch.h>
+#include <uio.h>
+#include <vm.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <syscall.h>
+
+
+/* sys_copy_file_range: copies data from one open file to another without going through user space */
+
+
+/* Overview: from user program: ssize_t copy_file_range(int fd_in, int fd_out, size_t len); this reads up to len bytes */
+/* from fd_in at its seek position and writes them to fd_out at its seek position (or its end, with O_APPEND), and */
+/* moves both positions on by the number of bytes copied, which it returns. That is what a read() into a buffer */
+/* followed by a write() of it would do, but the data goes through a kernel buffer, so it is moved by uiomove once */
+/* each way instead of out to the user and back, and a big copy is one system call instead of two per chunk. */
+/* 0 means fd_in is at end of file. Like read it may copy less than len (a short read from a device, a full disk). */
+
+/* how much we move per VOP_READ/VOP_WRITE */
+#define COPY_CHUNK PAGE_SIZE
+
+/* the most we copy in one call: the largest ssize_t */
+#define COPY_LEN_MAX ((size_t)-1 >> 1)
+
+int sys_copy_file_range(int fd_in, int fd_out, size_t len, ssize_t *retval){
+    struct file_table *ft = curproc->file_table;
+    int result = 0;
+
+    /* 1. look up both files (this takes a reference to each, no file table lock needed) */
+    struct open_file_handler *in = file_table_get(ft, fd_in);
+    if (in == NULL){
+        return EBADF;
+    }
+    struct open_file_handler *out = file_table_get(ft, fd_out);
+    if (out == NULL){
+        open_file_decref(in);
+        return EBADF;
+    }
+
+    /* 2. in must be readable and out writable, and copying a file onto itself isn't allowed (a device like the */
+    /* console is fine: stdin and stdout are the same vnode, but reading and writing it aren't the same data) */
+    if ((in->flags & O_ACCMODE) == O_WRONLY || (out->flags & O_ACCMODE) == O_RDONLY){
+        result = EBADF;
+        goto out;
+    }
+    if (in->file_vn == out->file_vn && VOP_ISSEEKABLE(in->file_vn)){
+        result = EINVAL;
+        goto out;
+    }
+    if (len > COPY_LEN_MAX){
+        len = COPY_LEN_MAX;
+    }
+
+    char *buf = kmalloc_tagged(COPY_CHUNK, KM_PROC);
+    if (buf == NULL){
+        result = ENOMEM;
+        goto out;
+    }
+
+    /* 3. copy a chunk at a time: read it under in's lock, then write it under out's lock, like a read() and a */
+    /* write() would (we never hold both, so a blocking read from the console doesn't hold up writers on out) */
+    size_t copied = 0;
+    while (copied < len){
+        size_t want = (len - copied < COPY_CHUNK) ? len - copied : COPY_CHUNK;
+        struct iovec iov;
+        struct uio u;
+
+        lock_acquire(in->lock);
+        off_t inpos = in->offset;
+        uio_kinit(&iov, &u, buf, want, inpos, UIO_READ);
+        result = VOP_READ(in->file_vn, &u);
+        if (result == 0){
+            in->offset = u.uio_offset;
+        }
+        lock_release(in->lock);
+        if (result){
+            break;
+        }
+        size_t got = want - u.uio_resid;
+        if (got == 0){
+            /* end of file */
+            break;
+        }
+
+        lock_acquire(out->lock);
+        off_t outpos = out->offset;
+        if (out->flags & O_APPEND){
+            struct stat st;
+            result = VOP_STAT(out->file_vn, &st);
+            if (result){
+                lock_release(out->lock);
+                break;
+            }
+            outpos = st.st_size;
+        }
+        uio_kinit(&iov, &u, buf, got, outpos, UIO_WRITE);
+        result = VOP_WRITE(out->file_vn, &u);
+        out->offset = u.uio_offset;
+        lock_release(out->lock);
+        size_t put = got - u.uio_resid;
+        copied += put;
+
+        if (put < got){
+            /* give back what didn't make it out, so the next read gets it again (unless someone moved in meanwhile) */
+            lock_acquire(in->lock);
+            if (in->offset == inpos + (off_t)got){
+                in->offset -= got - put;
+            }
+            lock_release(in->lock);
+        }
+        if (result || put < got || got < want){
+            break;
+        }
+    }
+
+    kfree(buf);
+
+    /* like read and write: once something has been copied, that's what we report */
+    if (copied > 0){
+        result = 0;
+    }
+    *retval = (ssize_t) copied;
+
+ out:
+    open_file_decref(out);
+    open_file_decref(in);
+    return result;
+}
@@ -46,22 +46,22 @@ int sys_dup2(int oldfd, int newfd, int *retval) {
 
 
     /* acquire the file table lock */
-    lock_acquire(ft->lock);
+    rwlock_acquire_write(ft->lock);
 
 
-    struct open_file_handler *old_fh = ft->files[oldfd];
-    struct open_file_handler *new_fh = ft->files[newfd];
+    struct open_file_handler *old_fh = file_table_lookup(ft, oldfd);
+    struct open_file_handler *new_fh = file_table_lookup(ft, newfd);
 
 
     if (old_fh == NULL) {
-        lock_release(ft->lock);
+        rwlock_release_write(ft->lock);
         return EBADF;
     }
 
 
     if (new_fh == old_fh) {
         /* they point to the same open file already, nothing to do */
-        lock_release(ft->lock);
+        rwlock_release_write(ft->lock);
         *retval = newfd;
         return 0;
     }
@@ -71,20 +71,24 @@ int sys_dup2(int oldfd, int newfd, int *retval) {
     open_file_incref(old_fh);
 
 
-    /* if newfd is already open, close it first */
+    /* reassign the pointer in the file table at newfd to point towards the same open entry as oldfd */
+    /* (newfd may be past the end of the table, then it grows) */
+    int result = file_table_set(ft, newfd, old_fh, &new_fh);
+    if (result) {
+        /* the slot still holds its reference, so this can't be the last one */
+        open_file_decref(old_fh);
+        rwlock_release_write(ft->lock);
+        return result;
+    }
+    rwlock_release_write(ft->lock);
+
+
+    /* if newfd was open, close it now that it's out of the table (lookups without the lock never find it dead) */
     if (new_fh != NULL) {
         /* decrement the reference count for the new file */
         open_file_decref(new_fh);
-
-
-        /* clear the slot */
-        ft->files[newfd] = NULL;
     }
 
-
-    /* reassign the pointer in the file table at newfd to point towards the same open entry as oldfd */
-    ft->files[newfd] = old_fh;
-    lock_release(ft->lock);
     *retval = newfd;
     return 0;
 }
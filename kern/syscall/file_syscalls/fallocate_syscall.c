@@ -0,0 +1,62 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <current.h>
+#include <proc.h>
+#include <synch.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <syscall.h>
+
+
+/* sys_fallocate: allocate a file's blocks ahead of time, or free them */
+
+
+/* With mode 0, fallocate makes sure the bytes from offset to offset + len have blocks on the disk (holes in the range get zeroed blocks) and makes the file that long if it's shorter. */
+/* With FALLOC_FL_KEEP_SIZE it does the same but leaves the size alone. */
+/* With FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE it frees the blocks in the range instead, so it reads back as zeros and takes no space; the size doesn't change. */
+/* The file system does the work (VOP_FALLOCATE); ones that can't fail with ENOSYS. */
+
+
+int sys_fallocate(int fd, int mode, off_t offset, off_t len) {
+
+    /* the range has to have something in it, not start before the file, and not run past the largest offset */
+    if (offset < 0 || len <= 0 || offset + len < offset) {
+        return EINVAL;
+    }
+
+    /* no other modes, and punching a hole never changes the size so it has to say so */
+    if ((mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) != 0) {
+        return EINVAL;
+    }
+    if ((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE)) {
+        return EINVAL;
+    }
+
+    /* look up the file for fd (this takes a reference to it) */
+    struct open_file_handler *f = file_table_get(curproc->file_table, fd);
+    if (f == NULL) {
+        return EBADF;
+    }
+
+    /* it changes the file, so it has to be open for writing */
+    if ((f->flags & O_ACCMODE) == O_RDONLY) {
+        open_file_decref(f);
+        return EBADF;
+    }
+
+    /* a range only means something for a file you can seek in */
+    if (!VOP_ISSEEKABLE(f->file_vn)) {
+        open_file_decref(f);
+        return ESPIPE;
+    }
+
+    /* no need for the file lock; the offset isn't used and the file system locks the vnode itself */
+    int result = VOP_FALLOCATE(f->file_vn, mode, offset, len);
+
+    open_file_decref(f);
+    return result;
+}
@@ -1,77 +1,348 @@
-
 #include <types.h>         
 #include <lib.h>          
 #include <synch.h>        
+#include <membar.h>
+#include <epoch.h>
+#include <atomic.h>
+#include <bitmap.h>
 #include <open_file_handler.h>  
 #include <file_table.h>   
 #include <syscall.h>
 #include <limits.h>
+#include <vnode.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stattypes.h>
 
 
-/* initialize a new file table. This is called whenever a new process is created as each process gets their own file table */
-struct file_table *create_file_table(void){
+/* How many slots a new file table has (stdin, stdout, stderr and a few more) */
+#define FILE_TABLE_MINSLOTS 8
+
+/* 
+ * The slots live in their own block, which fork shares: the child's table points at the parent's block and neither
+ * copies anything until one of them changes it. Then that one makes itself a private copy first (file_table_own),
+ * taking its own reference to each file, and drops its use of the shared one. Growing the table is the same copy,
+ * just into a bigger block. Since only the blocks are shared, each process keeps its own table and lock, and
+ * curproc->file_table never changes.
+ *
+ * file_table_get may still be looking at a block when its table moves off it, so blocks aren't freed until those
+ * readers are done (they're in an epoch section, see epoch.h). The files in a block hold one reference between all
+ * the tables using it; the last table to go drops them.
+ */
+struct file_slots {
+    unsigned nfiles; /* number of slots */
+    volatile unsigned refcount; /* tables using this block (atomic.h) */
+    unsigned nopen; /* fds in use (exit and copies stop looking once they've seen them all) */
+    struct bitmap *used; /* which fds are in use, so open finds the lowest free one without looking at every slot */
+    struct epoch_item ei; /* for freeing it once readers are done */
+    struct open_file_handler *volatile *files; /* the slots themselves, right after this header */
+};
+
+/* a block of n empty slots, used by one table */
+static struct file_slots *file_slots_create(unsigned n){
+    struct file_slots *fs = kmalloc_tagged(sizeof(*fs) + n * sizeof(fs->files[0]), KM_PROC);
+    if (fs == NULL){
+        return NULL;
+    }
+    fs->used = bitmap_create(n);
+    if (fs->used == NULL){
+        kfree(fs);
+        return NULL;
+    }
+    fs->nfiles = n;
+    fs->refcount = 1;
+    fs->nopen = 0;
+    fs->files = (struct open_file_handler *volatile *)(fs + 1);
+    for (unsigned i = 0; i < n; i++){
+        fs->files[i] = NULL;
+    }
+    return fs;
+}
+
+/* epoch callback: nobody can be looking at the block any more */
+static void file_slots_free(void *arg){
+    struct file_slots *fs = arg;
 
-    struct file_table *ft = kmalloc(sizeof(struct file_table));
+    bitmap_destroy(fs->used);
+    kfree(fs);
+}
+
+/* A table is done with fs. If it was the last one, drop the references to the open files. The ones nobody else has
+ * open are collected and closed together by the reaper rather than one at a time here. The slots are left as they
+ * are, for file_table_get to notice the table has moved on */
+static void file_slots_decref(struct file_slots *fs){
+    if (!atomic_dec_and_test(&fs->refcount)){
+        return;
+    }
+
+    struct open_file_handler *dead = NULL;
+    unsigned seen = 0;
+    for (unsigned i = 0; seen < fs->nopen; i++){
+        KASSERT(i < fs->nfiles);
+        struct open_file_handler *file = fs->files[i];
+        if (file != NULL){
+            seen++;
+            if (atomic_dec_and_test(&file->reference_count)){
+                file->reap_next = dead;
+                dead = file;
+            }
+        }
+    }
+    open_file_destroy_later(dead);
+    epoch_defer(&fs->ei, file_slots_free, fs);
+}
+
+/* a table with room for n fds */
+static struct file_table *file_table_create_sized(unsigned n){
+
+    struct file_table *ft = kmalloc_tagged(sizeof(struct file_table), KM_PROC);
     if (ft == NULL){
         return NULL;
     }
 
 
-    ft->lock = lock_create("ft_lk");
+    ft->lock = rwlock_create("ft_lk");
     if (ft->lock == NULL){
 	  kfree(ft);
       return NULL;
     }
 
 
-    /* loop through and initialize all the slots (set to NULL at initialization) */
-    /* again figure out what upper bound is */
-    for (int i = 0; i < __OPEN_MAX; i++){
-        ft->files[i] = NULL;
+    /* all the slots are NULL (and their bits clear) at initialization */
+    ft->slots = file_slots_create(n);
+    if (ft->slots == NULL){
+        rwlock_destroy(ft->lock);
+        kfree(ft);
+        return NULL;
     }
    
          return ft;
 }
 
 
+/* initialize a new file table. This is called whenever a new process is created as each process gets their own file table */
+struct file_table *create_file_table(void){
+    return file_table_create_sized(FILE_TABLE_MINSLOTS);
+}
+
+
 /* Destroy function for ft */
 void destroy_file_table(struct file_table *ft){
     if (ft == NULL) return;
 
-    /* First we loop through the table and free all the open files */
-    for (int i = 0; i < __OPEN_MAX; i++){
-        if (ft->files[i] != NULL){
-            /* first make sure to decrement the reference count of the corresponding file before setting the entry to NULL */
-            ft->files[i] = NULL;
-
-            open_file_decref(ft->files[i]);
-        }
-    }
-    /* now that we're done with the table entries we release the lock and deallocate the corresponding memory */
-    lock_destroy(ft->lock);
+    /* drop our use of the slots (and, if nobody shares them, our references to the open files), then the rest */
+    file_slots_decref(ft->slots);
+    rwlock_destroy(ft->lock);
     kfree(ft);
 }
 
 
 /* ADDED FOR A5 */
-/* This function is called by fork to copy a parents file table for the child process. Returns pointer to the new file table */
+/* This function is called by fork to copy a parents file table for the child process. Returns pointer to the new file
+ * table. The child shares our slots until one of us changes them, so nothing is copied and no file is touched here */
 struct file_table *copy_file_table(struct file_table *ft){
 
-    struct file_table *new_ft = create_file_table(); 
+    struct file_table *new_ft = kmalloc_tagged(sizeof(struct file_table), KM_PROC);
     if (new_ft == NULL){
-        return NULL; 
+        return NULL;
     }
-
-    /* Acquire the parents file table lock since we will be accessing its entries and coping the file handles over */
-    lock_acquire(ft->lock); 
-    for(int i = 0; i < __OPEN_MAX; i++){
-        if (ft->files[i] != NULL){
-            new_ft->files[i] = ft->files[i]; 
-            /* Make sure to increment ref count on the shared file objects */
-            open_file_incref(ft->files[i]); 
-        }       
+    new_ft->lock = rwlock_create("ft_lk");
+    if (new_ft->lock == NULL){
+        kfree(new_ft);
+        return NULL;
     }
-    lock_release(ft->lock); 
+
+    /* The read lock keeps our slots from being replaced (or thought unshared, see file_table_own) meanwhile */
+    rwlock_acquire_read(ft->lock); 
+    new_ft->slots = ft->slots;
+    atomic_add(&ft->slots->refcount, 1);
+    rwlock_release_read(ft->lock); 
     return new_ft; 
-}
\ No newline at end of file
+}
+
+
+/* Makes ft's slots its own, with room for fd n - 1 (which is below __OPEN_MAX): if they're shared, or too small, they
+ * are copied into a new block. Needs the write lock. A count of 1 can't go up meanwhile, since only a fork of this
+ * table would take another; a bigger one may come down, and then the decref below does what the last table does */
+static int file_table_own(struct file_table *ft, unsigned n){
+    struct file_slots *old = ft->slots;
+    bool shared = old->refcount > 1;
+
+    KASSERT(n <= __OPEN_MAX);
+    if (!shared && n <= old->nfiles){
+        return 0;
+    }
+    unsigned size = old->nfiles;
+    while (size < n){
+        size *= 2;
+    }
+    if (size > __OPEN_MAX){
+        size = __OPEN_MAX;
+    }
+
+    struct file_slots *fs = file_slots_create(size);
+    if (fs == NULL){
+        return ENOMEM;
+    }
+    unsigned seen = 0;
+    for (unsigned i = 0; seen < old->nopen; i++){
+        KASSERT(i < old->nfiles);
+        struct open_file_handler *file = old->files[i];
+        if (file != NULL){
+            seen++;
+            fs->files[i] = file;
+            bitmap_mark(fs->used, i);
+            /* a shared block keeps its references; a private one hands them over */
+            if (shared){
+                open_file_incref(file);
+            }
+        }
+    }
+    fs->nopen = old->nopen;
+
+    /* the new block has to be all filled in before a lookup can find it */
+    membar_store_store();
+    ft->slots = fs;
+    if (shared){
+        file_slots_decref(old);
+    }
+    else {
+        epoch_defer(&old->ei, file_slots_free, old);
+    }
+    return 0;
+}
+
+
+struct open_file_handler *file_table_lookup(struct file_table *ft, int fd){
+    if (fd < 0 || (unsigned)fd >= ft->slots->nfiles){
+        return NULL;
+    }
+    return ft->slots->files[fd];
+}
+
+
+int file_table_add(struct file_table *ft, struct open_file_handler *f, int *fdp){
+    unsigned fd;
+
+    int result = file_table_own(ft, 0);
+    if (result){
+        return result;
+    }
+    if (bitmap_alloc(ft->slots->used, &fd)){
+        /* full: the first slot past the end is the lowest free one */
+        fd = ft->slots->nfiles;
+        if (fd >= __OPEN_MAX){
+            return EMFILE;
+        }
+        result = file_table_own(ft, fd + 1);
+        if (result){
+            return result;
+        }
+        bitmap_mark(ft->slots->used, fd);
+    }
+
+    /* a lookup without the lock may find it as soon as it's in the slot, so it must be all set up first */
+    membar_store_store();
+    ft->slots->files[fd] = f;
+    ft->slots->nopen++;
+    *fdp = fd;
+    return 0;
+}
+
+
+int file_table_set(struct file_table *ft, int fd, struct open_file_handler *f, struct open_file_handler **oldp){
+    KASSERT(fd >= 0 && fd < __OPEN_MAX);
+
+    if (f == NULL && file_table_lookup(ft, fd) == NULL){
+        /* nothing there to clear */
+        *oldp = NULL;
+        return 0;
+    }
+    int result = file_table_own(ft, fd + 1);
+    if (result){
+        return result;
+    }
+
+    struct file_slots *fs = ft->slots;
+    struct open_file_handler *old = fs->files[fd];
+    if (old == NULL && f != NULL){
+        bitmap_mark(fs->used, fd);
+        fs->nopen++;
+    }
+    else if (old != NULL && f == NULL){
+        bitmap_unmark(fs->used, fd);
+        fs->nopen--;
+    }
+
+    membar_store_store();
+    fs->files[fd] = f;
+    *oldp = old;
+    return 0;
+}
+
+
+/* Looks up fd without the table lock, so read() and write() don't all line up on it. A slot can be closed (or dup2'd
+ * over) at any moment, so the file we load may lose its last reference before we take ours; tryref fails then, since
+ * the cache keeps freed files around with a count of 0. If it succeeds the file is live, but it may be a new open of
+ * some other file that reuses the same struct, so we check the slot still holds it and start over if not. The table
+ * may also have moved to a new block meanwhile (grown, or stopped sharing with a fork), and then later changes only
+ * show up in the new one, so we start over then too. The epoch section keeps the old block from being freed while
+ * we look at it */
+struct open_file_handler *file_table_get(struct file_table *ft, int fd){
+    if (fd < 0 || fd >= __OPEN_MAX){
+        return NULL;
+    }
+
+    for (;;){
+        epoch_enter();
+        struct file_slots *fs = ft->slots;
+        /* pairs with the barrier in file_table_own */
+        membar_load_load();
+        if ((unsigned)fd >= fs->nfiles){
+            epoch_exit();
+            return NULL;
+        }
+        struct open_file_handler *f = fs->files[fd];
+        if (f == NULL){
+            epoch_exit();
+            return NULL;
+        }
+        if (!open_file_tryref(f)){
+            /* closed under us, the slot has changed (or will be NULL) */
+            epoch_exit();
+            continue;
+        }
+        bool same = ft->slots == fs && fs->files[fd] == f;
+        epoch_exit();
+        if (same){
+            return f;
+        }
+        open_file_decref(f);
+    }
+}
+
+/* The file table reference only lasts while we look; the vnode one we hand back keeps the directory itself around
+ * even if the fd is closed meanwhile */
+int file_table_getdir(struct file_table *ft, int fd, struct vnode **dirp){
+    if (fd == AT_FDCWD){
+        *dirp = NULL;
+        return 0;
+    }
+
+    struct open_file_handler *f = file_table_get(ft, fd);
+    if (f == NULL){
+        return EBADF;
+    }
+    struct vnode *vn = f->file_vn;
+    mode_t type;
+    int result = VOP_GETTYPE(vn, &type);
+    if (result == 0 && type != _S_IFDIR){
+        result = ENOTDIR;
+    }
+    if (result == 0){
+        VOP_INCREF(vn);
+        *dirp = vn;
+    }
+    open_file_decref(f);
+    return result;
+}
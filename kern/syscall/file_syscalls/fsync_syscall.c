@@ -0,0 +1,76 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <current.h>
+#include <proc.h>
+#include <synch.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <syscall.h>
+
+
+/* sys_fsync, sys_fdatasync, sys_sync_file_range: get a file's changes to the disk */
+
+
+/* fsync writes out everything about the file: its data and its inode. */
+/* fdatasync writes out the data and only what it takes to read it back (the size and the block map), so when only the contents changed the inode write is skipped. */
+/* sync_file_range does the same as fdatasync for the bytes from offset to offset + len only (len 0 means to the end of the file). */
+
+
+int sys_fsync(int fd) {
+
+    /* look up the file for fd (this takes a reference to it) */
+    struct open_file_handler *f = file_table_get(curproc->file_table, fd);
+    if (f == NULL) {
+        return EBADF;
+    }
+
+    /* no need for the file lock; the file system locks the vnode itself */
+    int result = VOP_FSYNC(f->file_vn);
+
+    open_file_decref(f);
+    return result;
+}
+
+
+int sys_fdatasync(int fd) {
+
+    struct open_file_handler *f = file_table_get(curproc->file_table, fd);
+    if (f == NULL) {
+        return EBADF;
+    }
+
+    /* the whole file */
+    int result = VOP_DATASYNC(f->file_vn, 0, 0);
+
+    open_file_decref(f);
+    return result;
+}
+
+
+int sys_sync_file_range(int fd, off_t offset, off_t len) {
+
+    /* the range can't start before the file or run backwards (or past the largest offset) */
+    if (offset < 0 || len < 0 || offset + len < offset) {
+        return EINVAL;
+    }
+
+    struct open_file_handler *f = file_table_get(curproc->file_table, fd);
+    if (f == NULL) {
+        return EBADF;
+    }
+
+    /* a range only means something for a file you can seek in */
+    if (!VOP_ISSEEKABLE(f->file_vn)) {
+        open_file_decref(f);
+        return ESPIPE;
+    }
+
+    int result = VOP_DATASYNC(f->file_vn, offset, len);
+
+    open_file_decref(f);
+    return result;
+}
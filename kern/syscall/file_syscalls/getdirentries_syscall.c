@@ -0,0 +1,76 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/dirent.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <uio.h>
+#include <uio_helper.h>
+#include <syscall.h>
+
+
+/* sys_getdirentry / sys_getdirentries: read the names in an open directory */
+
+
+/* Overview: from user program: ssize_t getdirentry(int fd, char *buf, size_t buflen); reads the next name in the */
+/* directory (not null-terminated) and returns its length, or 0 at the end. ssize_t getdirentries(int fd, char *buf, */
+/* size_t buflen); fills buf with as many struct dirent records (see kern/dirent.h) as fit instead, and returns how many */
+/* bytes of them there are, so a directory can be listed in a few calls rather than one per name. Both carry on from */
+/* the file's offset, which only means something to the file system, and leave it at the next entry. */
+
+/* Input:
+            - fd : file descriptor identifying an open directory
+            - buf : pointer (in user space) to the buffer to put the name(s) in
+            - buflen: size of the buffer; for getdirentries at least DIRENT_MAXRECLEN, so the next record always fits
+            - retval: pointer where the kernel writes the number of bytes put in buf (0 means the end of the directory)
+*/
+
+static int getdirentries_common(int fd, userptr_t buf, size_t buflen, bool records, ssize_t *retval){
+    /* 1. Look up the open file handler for the given fd (this takes a reference to it, no file table lock needed) */
+    struct open_file_handler *file = file_table_get(curproc->file_table, fd);
+    if (file == NULL) {
+        return EBADF;
+    }
+    if ((file->flags & O_ACCMODE) == O_WRONLY) {
+        open_file_decref(file);
+        return EBADF;
+    }
+
+    /* 2. the offset is shared, so hold the file's lock while we use and update it */
+    lock_acquire(file->lock);
+
+    struct iovec iov;
+    struct uio u;
+    uio_init(&u, &iov, buf, buflen, file->offset, UIO_READ);
+    int result = records ? VOP_GETDIRENTRIES(file->file_vn, &u) : VOP_GETDIRENTRY(file->file_vn, &u);
+    if (result) {
+        lock_release(file->lock);
+        open_file_decref(file);
+        return result;
+    }
+
+    /* 3. the file system left the offset at the next entry */
+    file->offset = u.uio_offset;
+    *retval = (ssize_t) (buflen - u.uio_resid);
+
+    lock_release(file->lock);
+    open_file_decref(file);
+    return 0;
+}
+
+int sys_getdirentry(int fd, userptr_t buf, size_t buflen, ssize_t *retval){
+    return getdirentries_common(fd, buf, buflen, false, retval);
+}
+
+int sys_getdirentries(int fd, userptr_t buf, size_t buflen, ssize_t *retval){
+    /* a buffer too small for the next entry would look like the end of the directory */
+    if (buflen < DIRENT_MAXRECLEN) {
+        return EINVAL;
+    }
+    return getdirentries_common(fd, buf, buflen, true, retval);
+}
@@ -0,0 +1,28 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vnode.h>
+#include <current.h>
+#include <proc.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <syscall.h>
+
+
+/* sys_ioctl: a control operation on a file, passed through to whatever it's on */
+/* DATA is the user's pointer; what it points to (if anything) is up to the code, so the file system copies it itself. */
+
+
+int sys_ioctl(int fd, int code, userptr_t data) {
+
+    struct open_file_handler *f = file_table_get(curproc->file_table, fd);
+    if (f == NULL) {
+        return EBADF;
+    }
+
+    /* like fsync, the file lock isn't needed; nothing here uses the offset */
+    int result = VOP_IOCTL(f->file_vn, code, data);
+
+    open_file_decref(f);
+    return result;
+}
@@ -20,6 +20,8 @@
 #define SEEK_SET 0 /* Seek relative to beginning of file */
 #define SEEK_CUR 1 /* Seek relative to current position in file */
 #define SEEK_END 2 /* Seek relative to end of file */
+#define SEEK_DATA 3 /* Seek to the next data at or after pos */
+#define SEEK_HOLE 4 /* Seek to the next hole at or after pos */
 
 
 /* sys_lseek: changes current position in a file */
@@ -30,6 +32,9 @@
 /*      SEEK_SET, the new position is pos. */
 /*      SEEK_CUR, the new position is the current position plus pos. */
 /*      SEEK_END, the new position is the position of end-of-file plus pos. */
+/*      SEEK_DATA, the new position is the start of the first data at or after pos. */
+/*      SEEK_HOLE, the new position is the start of the first hole at or after pos (the end of the file counts as one). */
+/*      Either of those fails with ENXIO if pos is at or past the end of the file, or for SEEK_DATA if there's only hole after it. */
 /*      anything else, lseek fails. */
 
 
@@ -38,33 +43,12 @@
 
 int sys_lseek(int fd, off_t pos, int whence, off_t *retval) {
    
-    /* check if fd is valid */
-    if (fd < 0 || fd >= __OPEN_MAX) {
-        return EBADF;
-    }
-
-
-    /* get the file table */
-    struct file_table *ft = curproc->file_table;
-
-
-    /* acquire the file table lock */
-    lock_acquire(ft->lock);
-
-
-    struct open_file_handler *f = ft->files[fd];
+    /* look up the file for fd (this takes a reference to it, no file table lock needed) */
+    struct open_file_handler *f = file_table_get(curproc->file_table, fd);
    
     if (f == NULL) {
-        lock_release(ft->lock);
         return EBADF;
     }
-   
-    /* increment the reference count for the file */
-    open_file_incref(f);
-
-
-    /* release the file table lock as we have the open file handler now */
-    lock_release(ft->lock);
 
 
     /* acquire the file lock */
@@ -103,6 +87,17 @@ int sys_lseek(int fd, off_t pos, int whence, off_t *retval) {
             new_offset = st.st_size + pos;
             break;
         }
+        case SEEK_DATA:
+        case SEEK_HOLE: {
+            /* the file system knows where its holes are (file systems without any say the file is all data) */
+            int result = VOP_SEEKHOLE(f->file_vn, pos, whence == SEEK_HOLE, &new_offset);
+            if (result) {
+                lock_release(f->lock);
+                open_file_decref(f);
+                return result;
+            }
+            break;
+        }
         default: {
             /* whence is invalid */
             lock_release(f->lock);
@@ -0,0 +1,40 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <lib.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <current.h>
+#include <proc.h>
+#include <copyinout.h>
+#include <file_table.h>
+#include <syscall.h>
+
+/* sys_mkdir / sys_mkdirat: make a new directory */
+/* The directory named by path is created, with mode bits mode (sfs ignores them). mkdirat takes a dirfd as openat */
+/* does: a relative path starts from the directory open on it, or the current directory for AT_FDCWD. */
+
+int sys_mkdir(userptr_t path, mode_t mode){
+    return sys_mkdirat(AT_FDCWD, path, mode);
+}
+
+int sys_mkdirat(int dirfd, userptr_t path, mode_t mode){
+    /* copy the path in (lookup may destroy it, which is fine since it's ours) */
+    char pathbuf[PATH_MAX];
+    int result = copyinstr(path, pathbuf, PATH_MAX, NULL);
+    if (result) {
+        return result;
+    }
+
+    struct vnode *dir;
+    result = file_table_getdir(curproc->file_table, dirfd, &dir);
+    if (result) {
+        return result;
+    }
+    result = vfs_mkdirat(dir, pathbuf, mode);
+    if (dir != NULL) {
+        VOP_DECREF(dir);
+    }
+    return result;
+}
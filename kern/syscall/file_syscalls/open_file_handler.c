@@ -1,20 +1,52 @@
 
 #include <types.h>         
+#include <kern/errno.h>
 #include <lib.h>           
+#include <kmem_cache.h>
+#include <atomic.h>
 #include <synch.h>         
+#include <spinlock.h>
+#include <workqueue.h>
 #include <vfs.h>          
 #include <vnode.h>         
 #include <open_file_handler.h>  
 #include <syscall.h>
 
+/* Open files are cached together with their lock, so open() doesn't have to create a new one each time. The cache is
+ * type safe: file_table_get looks files up without the table lock, so a file it finds may already have been closed
+ * and freed, and it has to still be an open_file (with a lock and a reference count of 0) when that happens */
+static int open_file_ctor(void *obj){
+    struct open_file_handler *file = obj;
+
+    file->lock = lock_create("file_lock");
+    if (file->lock == NULL){
+        return ENOMEM;
+    }
+    return 0;
+}
+
+static void open_file_dtor(void *obj){
+    struct open_file_handler *file = obj;
+
+    lock_destroy(file->lock);
+}
+
+static struct kmem_cache open_file_cache =
+    KMEM_CACHE_TYPESAFE_INITIALIZER("open_file", struct open_file_handler, open_file_ctor, open_file_dtor, KM_PROC);
+
+/* Files whose last reference went away in destroy_file_table, waiting for the reaper (linked on reap_next) */
+static struct spinlock reap_lock = SPINLOCK_INITIALIZER;
+static struct open_file_handler *reap_list;
+static struct work reap_work;
+
 /* Helper functions for the file handle of each processor */
 /* Create a new open file struct */
 /* This function would be called after a thread calls vfs_open() and it succeeds */
 struct open_file_handler *create_open_file(struct vnode *vn, int flags){
 
 
-    /* Allocate memory for the struct */
-    struct open_file_handler *file = kmalloc(sizeof(struct open_file_handler));
+    /* Get a struct from the cache (its lock is already there) */
+    struct open_file_handler *file = kmem_cache_alloc(&open_file_cache);
     if (file == NULL){
         return NULL;
     }
@@ -24,11 +56,6 @@ struct open_file_handler *create_open_file(struct vnode *vn, int flags){
     file->flags = flags;
     file->file_vn = vn;
     file->reference_count = 1;
-    file->lock = lock_create("file_lock");
-    if (file->lock == NULL){
-        kfree(file);
-        return NULL;
-    }
     return file;
 
 
@@ -41,34 +68,72 @@ void open_file_destroy(struct open_file_handler *file){
     /* first we close the vnode */
     vfs_close(file->file_vn);
    
-    /* Then we free the file lock */
-    lock_destroy(file->lock);
+    /* Lastly, give the struct (and its lock) back to the cache */
+    kmem_cache_free(&open_file_cache, file);
+}
 
 
-    /* Lastly, free the associated memory of the file */
-    kfree(file);
+/* Hand a list of files (linked on reap_next) that nobody refers to any more to the reaper, which closes them all in
+ * one go. A process exiting with a lot of files open doesn't wait for each of them to be closed, which for a file on
+ * disk can mean writing its inode out or erasing it */
+void open_file_destroy_later(struct open_file_handler *list){
+    if (list == NULL) return;
+
+    struct open_file_handler *last = list;
+    while (last->reap_next != NULL){
+        last = last->reap_next;
+    }
+
+    spinlock_acquire(&reap_lock);
+    last->reap_next = reap_list;
+    reap_list = list;
+    spinlock_release(&reap_lock);
+
+    /* if it's already queued, that run will find these too */
+    workqueue_submit(&reap_work);
 }
 
+/* the work item: close everything on the list */
+static void open_file_reap(void *unused){
+    (void)unused;
+
+    spinlock_acquire(&reap_lock);
+    struct open_file_handler *list = reap_list;
+    reap_list = NULL;
+    spinlock_release(&reap_lock);
+
+    while (list != NULL){
+        struct open_file_handler *file = list;
+        list = file->reap_next;
+        open_file_destroy(file);
+    }
+}
 
-/* Increment ref count of file handle */
+/* set up the reaper, called once during boot */
+void open_file_bootstrap(void){
+    work_init(&reap_work, open_file_reap, NULL);
+}
+
+
+/* Increment ref count of file handle (no lock: the caller already has a reference, so it can't drop to 0 under us) */
 void open_file_incref(struct open_file_handler *file){
-    lock_acquire(file->lock);
-    file->reference_count++;
-    lock_release(file->lock);
+    atomic_add(&file->reference_count, 1);
+}
+
+
+/* Takes a reference to a file that was found without holding one, unless it has already lost its last one (returns
+ * false then). The file may have been freed and even reused since it was found, the caller checks for that */
+bool open_file_tryref(struct open_file_handler *file){
+    return atomic_inc_not_zero(&file->reference_count);
 }
 
 
 /* Decrement ref count of file handle (if a reference count of a file reaches zero then we destroy the file) */
 void open_file_decref(struct open_file_handler *file){
     if (file == NULL) return; 
-    
-    lock_acquire(file->lock);
-    file->reference_count--;
-    lock_release(file->lock);
 
-    /* once the referecne count reaches 0 we destroy the open file */
-    if (file->reference_count == 0){
+    /* only the one who takes it to 0 destroys it, so two last closes can't both free it */
+    if (atomic_dec_and_test(&file->reference_count)){
         open_file_destroy(file);
-    }   
-
+    }
 }
\ No newline at end of file
@@ -35,8 +35,16 @@
 
 /* The syscall dispatcher copies will copy file_d (our return value) back to user space if this function returns 0, else it sets errno and returns -1 to the user program */
 
+/* openat is the same with one more input, dirfd: a relative filename starts from the directory open on dirfd instead */
+/* of the current directory (AT_FDCWD means the current directory after all), so a program working through a tree only */
+/* has the lookup of the names below the directory to pay for */
+
 
 int sys_open(userptr_t filename, int flags, mode_t mode, int *retval){
+    return sys_openat(AT_FDCWD, filename, flags, mode, retval);
+}
+
+int sys_openat(int dirfd, userptr_t filename, int flags, mode_t mode, int *retval){
 
 
     /* 1. Copy file name from user space into kernel butter */
@@ -51,9 +59,17 @@ int sys_open(userptr_t filename, int flags, mode_t mode, int *retval){
     }
 
 
-    /* 2. Now we ask the VFS to open the file and get the vnode */
+    /* 2. Now we ask the VFS to open the file (from dirfd's directory if it's relative) and get the vnode */
+    struct vnode *dir;
+    result = file_table_getdir(curproc->file_table, dirfd, &dir);
+    if (result){
+        return result;
+    }
     struct vnode *vn;
-    result = vfs_open(kern_file_name, flags, mode, &vn);
+    result = vfs_openat(dir, kern_file_name, flags, mode, &vn);
+    if (dir != NULL){
+        VOP_DECREF(dir);
+    }
     if (result){
         return result;
     }
@@ -73,27 +89,22 @@ int sys_open(userptr_t filename, int flags, mode_t mode, int *retval){
     /* first retrieve a pointer to this processes file table */
     struct file_table *ft = curproc->file_table;
     /* then we acquire the file tables lock */
-    lock_acquire(ft->lock);
+    rwlock_acquire_write(ft->lock);
 
 
-    /* Now we can insert it into the first open slot that isn't pointing to a file */
+    /* Now we can insert it into the first open slot that isn't pointing to a file (the table grows if they're all taken) */
     int fd;
-    for (fd = 0; fd < __OPEN_MAX; fd++){
-        if (ft->files[fd] == NULL){
-            ft->files[fd] = f;
-            break;
-        }
-    }
+    result = file_table_add(ft, f, &fd);
 
 
-    lock_release(ft->lock);
+    rwlock_release_write(ft->lock);
 
 
     /* make sure we take care of the case where we couldn’t find an empty slot in the file table */
-    /* if this occured we must free the file and return EMFILE which means too many open files */
-    if (fd == __OPEN_MAX){
+    /* if this occured we must free the file and return the error (EMFILE means too many open files) */
+    if (result){
         open_file_destroy(f);
-        return EMFILE;
+        return result;
     }
 
     /* 5. Store the new file descriptor in our return pointer (sys call dispatcher will copy this value back to user space by setting err to retval must add this in syscall.c) and then return 0 to indiccate success */
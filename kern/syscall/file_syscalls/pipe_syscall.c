@@ -0,0 +1,88 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <vfs.h>
+#include <current.h>
+#include <proc.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <pipe.h>
+#include <syscall.h>
+
+
+/* sys_pipe: make a pipe */
+
+
+/* int pipe(int fds[2]) makes a pipe (see pipe.h) and puts its read end in fds[0], its write end in fds[1]. */
+/* Either both fds are made or neither is. */
+
+int sys_pipe(userptr_t ufds) {
+
+    /* make the pipe and an open file for each end */
+    struct vnode *rvn, *wvn;
+    int result = pipe_create(&rvn, &wvn);
+    if (result) {
+        return result;
+    }
+
+    struct open_file_handler *rf = create_open_file(rvn, O_RDONLY);
+    if (rf == NULL) {
+        vfs_close(rvn);
+        vfs_close(wvn);
+        return ENOMEM;
+    }
+    struct open_file_handler *wf = create_open_file(wvn, O_WRONLY);
+    if (wf == NULL) {
+        open_file_destroy(rf);
+        vfs_close(wvn);
+        return ENOMEM;
+    }
+
+    /* put both in the file table */
+    struct file_table *ft = curproc->file_table;
+    int fds[2];
+    rwlock_acquire_write(ft->lock);
+    result = file_table_add(ft, rf, &fds[0]);
+    if (result) {
+        rwlock_release_write(ft->lock);
+        open_file_destroy(rf);
+        open_file_destroy(wf);
+        return result;
+    }
+    result = file_table_add(ft, wf, &fds[1]);
+    if (result) {
+        struct open_file_handler *old;
+        file_table_set(ft, fds[0], NULL, &old);
+        rwlock_release_write(ft->lock);
+        open_file_decref(rf);
+        open_file_destroy(wf);
+        return result;
+    }
+    rwlock_release_write(ft->lock);
+
+    /* and tell the user where they are; if that fails, close them again (unless another thread already has) */
+    result = copyout(fds, ufds, sizeof(fds));
+    if (result) {
+        struct open_file_handler *old0 = NULL, *old1 = NULL;
+        rwlock_acquire_write(ft->lock);
+        if (file_table_lookup(ft, fds[0]) == rf) {
+            file_table_set(ft, fds[0], NULL, &old0);
+        }
+        if (file_table_lookup(ft, fds[1]) == wf) {
+            file_table_set(ft, fds[1], NULL, &old1);
+        }
+        rwlock_release_write(ft->lock);
+        if (old0 != NULL) {
+            open_file_decref(old0);
+        }
+        if (old1 != NULL) {
+            open_file_decref(old1);
+        }
+        return result;
+    }
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <kern/poll.h>
+#include <kern/time.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <poll.h>
+#include <timer.h>
+#include <copyinout.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <syscall.h>
+
+
+/* sys_poll: wait for any of several files to be ready */
+
+
+/* Overview: from user program: int poll(struct pollfd *fds, nfds_t nfds, int timeout); it looks at each file for the */
+/* events asked for and returns how many entries have revents set, waiting until at least one does or timeout ms go by */
+/* (forever if timeout is negative, not at all if it's 0). Entries with a negative fd are skipped; a closed fd gets */
+/* POLLNVAL. POLLERR and POLLHUP are reported whether asked for or not. */
+
+/* How the waiting works is in poll.h: the first pass over the files puts us on each one's wait queue, and after */
+/* that we only sleep until one of them is woken and look again. */
+
+
+/* One pass over the files; returns how many have something to report. PS is NULL after the first pass. */
+static int poll_scan(struct pollfd *pfds, struct open_file_handler **files, unsigned nfds, struct pollset *ps) {
+    int count = 0;
+    for (unsigned i = 0; i < nfds; i++) {
+        if (pfds[i].fd < 0) {
+            pfds[i].revents = 0;
+            continue;
+        }
+        if (files[i] == NULL) {
+            pfds[i].revents = POLLNVAL;
+        } else {
+            int events = pfds[i].events | POLLERR | POLLHUP;
+            pfds[i].revents = VOP_POLL(files[i]->file_vn, events, ps) & events;
+        }
+        if (pfds[i].revents != 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int sys_poll(userptr_t ufds, unsigned nfds, int timeout, int *retval) {
+    /* 1. a file can only be in the table once per slot, so more than a table's worth is certainly a mistake */
+    if (nfds > __OPEN_MAX) {
+        return EINVAL;
+    }
+
+    /* 2. bring the pollfds into the kernel, and look up their files (this takes a reference to each) */
+    struct pollfd *pfds = NULL;
+    struct open_file_handler **files = NULL;
+    if (nfds > 0) {
+        pfds = kmalloc_tagged(nfds * sizeof(*pfds), KM_PROC);
+        files = kmalloc_tagged(nfds * sizeof(*files), KM_PROC);
+        if (pfds == NULL || files == NULL) {
+            kfree(pfds);
+            kfree(files);
+            return ENOMEM;
+        }
+    }
+    int result = copyin(ufds, pfds, nfds * sizeof(*pfds));
+    if (result) {
+        kfree(pfds);
+        kfree(files);
+        return result;
+    }
+    for (unsigned i = 0; i < nfds; i++) {
+        files[i] = pfds[i].fd < 0 ? NULL : file_table_get(curproc->file_table, pfds[i].fd);
+    }
+
+    /* 3. look once; with no timeout that's all */
+    struct pollset ps;
+    int count;
+    if (timeout == 0) {
+        count = poll_scan(pfds, files, nfds, NULL);
+    } else {
+        result = pollset_init(&ps, nfds);
+        if (result) {
+            goto out;
+        }
+
+        /* the deadline is fixed up front, so wakeups that turn out to be for nothing don't extend it */
+        uint64_t deadline = 0;
+        if (timeout > 0) {
+            struct timespec ts;
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000;
+            deadline = timer_now() + timer_ticks(&ts);
+        }
+
+        /* 4. look, sleep, and look again until something is ready, time is up, or (_exit, execv) we're told to go */
+        count = poll_scan(pfds, files, nfds, &ps);
+        while (count == 0) {
+            if (curproc->p_thrkill) {
+                result = EINTR;
+                break;
+            }
+            unsigned ticks = 0;
+            if (timeout > 0) {
+                uint64_t now = timer_now();
+                if (now >= deadline) {
+                    break;
+                }
+                ticks = deadline - now;
+            }
+            pollset_sleep(&ps, ticks);
+            count = poll_scan(pfds, files, nfds, NULL);
+        }
+        pollset_cleanup(&ps);
+        if (result) {
+            goto out;
+        }
+    }
+
+    /* 5. hand back the revents */
+    result = copyout(pfds, ufds, nfds * sizeof(*pfds));
+    if (result == 0) {
+        *retval = count;
+    }
+
+ out:
+    for (unsigned i = 0; i < nfds; i++) {
+        if (files[i] != NULL) {
+            open_file_decref(files[i]);
+        }
+    }
+    kfree(pfds);
+    kfree(files);
+    return result;
+}
@@ -0,0 +1,69 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <uio.h>
+#include <uio_helper.h>
+#include <syscall.h>
+
+
+/* sys_pread: reads from a file at a given offset */
+
+
+/* Overview: from user program: ssize_t pread(int fd, void *buf, size_t buflen, off_t offset); this works like read() */
+/* except that it reads starting at offset instead of at the file's current seek position, and it doesn't change the */
+/* seek position. Since the shared offset isn't involved we don't take the file's lock either, so threads (or processes */
+/* sharing the file through fork) doing pread on different parts of one file don't wait for each other. */
+
+/* Input:
+            - fd : file descriptor identifying an open file
+            - buf : pointer (in user space) to the buffer to read data into
+            - buflen: number of bytes to read
+            - offset: where in the file to start reading
+            - retval: pointer where the kernel writes the number of bytes read
+*/
+
+int sys_pread(int fd, userptr_t buf, size_t buflen, off_t offset, ssize_t *retval){
+    /* 1. Look up the open file handler for the given fd (this takes a reference to it, no file table lock needed) */
+    struct open_file_handler *file = file_table_get(curproc->file_table, fd);
+    if (file == NULL) {
+        return EBADF;
+    }
+
+    /* 2. it must be open for reading, and an offset only means something for files we can seek in */
+    if ((file->flags & O_ACCMODE) == O_WRONLY) {
+        open_file_decref(file);
+        return EBADF;
+    }
+    if (!VOP_ISSEEKABLE(file->file_vn)) {
+        open_file_decref(file);
+        return ESPIPE;
+    }
+    if (offset < 0) {
+        open_file_decref(file);
+        return EINVAL;
+    }
+
+    /* 3. read straight from offset (the file system does its own locking on the vnode) */
+    struct iovec iov;
+    struct uio u;
+    uio_init(&u, &iov, buf, buflen, offset, UIO_READ);
+    struct uio_wired uw;
+    uio_prefault(&u, &uw);
+    int result = VOP_READ(file->file_vn, &u);
+    uio_unwire(&uw);
+    open_file_decref(file);
+    if (result) {
+        return result;
+    }
+
+    /* file->offset is left alone */
+    *retval = (ssize_t) (buflen - u.uio_resid);
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <uio.h>
+#include <uio_helper.h>
+#include <syscall.h>
+
+
+/* sys_pwrite: writes to a file at a given offset */
+
+
+/* Overview: from user program: ssize_t pwrite(int fd, const void *buf, size_t nbytes, off_t offset); this works like */
+/* write() except that it writes starting at offset, and the file's seek position stays where it was. Like pread it */
+/* doesn't take the file's lock. O_APPEND doesn't apply: the data goes at offset, which is what POSIX asks for. */
+
+/* Input:
+            - fd: file descriptor number of the open file
+            - buf: pointer (in user space) to data to write
+            - nbytes: size of bytes to write
+            - offset: where in the file to start writing
+            - retval: pointer to where the kernel stores bytes actually written
+*/
+
+int sys_pwrite(int fd, userptr_t buf, size_t nbytes, off_t offset, ssize_t *retval){
+    /* 1. Look up the file for fd (this takes a reference to it, no file table lock needed) */
+    struct open_file_handler *f = file_table_get(curproc->file_table, fd);
+    if (f == NULL) {
+        return EBADF;
+    }
+
+    /* 2. it must be open for writing, and seekable */
+    if ((f->flags & O_ACCMODE) == O_RDONLY) {
+        open_file_decref(f);
+        return EBADF;
+    }
+    if (!VOP_ISSEEKABLE(f->file_vn)) {
+        open_file_decref(f);
+        return ESPIPE;
+    }
+    if (offset < 0) {
+        open_file_decref(f);
+        return EINVAL;
+    }
+
+    /* 3. write at offset */
+    struct iovec iov;
+    struct uio u;
+    uio_init(&u, &iov, buf, nbytes, offset, UIO_WRITE);
+    int result = VOP_WRITE(f->file_vn, &u);
+    open_file_decref(f);
+    if (result) {
+        return result;
+    }
+
+    /* f->offset is left alone */
+    *retval = (ssize_t) (nbytes - u.uio_resid);
+    return 0;
+}
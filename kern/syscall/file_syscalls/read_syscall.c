@@ -35,49 +35,23 @@
 
 
 int sys_read(int fd, userptr_t buf, size_t buflen, ssize_t *retval){
-    /* 1. Validate the file descriptor */
-    if (fd >= __OPEN_MAX || fd < 0) {
-        return EBADF;
-    }
-
-
-    /* get the current process's file table */
-    struct file_table *ft = curproc->file_table;
-   
-    /* acquire the file table lock before accessing */
-    lock_acquire(ft->lock);
-
-
-    /* get the open file handler for the given fd */
-    struct open_file_handler *file = ft->files[fd];
+    /* 1. Look up the open file handler for the given fd (this takes a reference to it, no file table lock needed) */
+    struct open_file_handler *file = file_table_get(curproc->file_table, fd);
 
 
     if (file == NULL) {
-        /* release the lock and return bad file descriptor error */
-        lock_release(ft->lock);
+        /* return bad file descriptor error */
         return EBADF;
     }
    
     /* check flags */
     /* O_WRONLY if its write only you return error */
     if ((file->flags & O_ACCMODE) == (O_WRONLY)) {
-        lock_release(ft->lock);
+        open_file_decref(file);
         return EBADF;
     }
 
 
-    /* increment the reference count for the file */
-    open_file_incref(file);
-
-
-    /* release the file table lock as we have the open file handler now */
-    lock_release(ft->lock);
-
-
-    /* get the file lock */
-    lock_acquire(file->lock);
-
-
     /* iovec describes the user buffer that we'll be writing to */
     struct iovec iov;
 
@@ -86,8 +60,18 @@ int sys_read(int fd, userptr_t buf, size_t buflen, ssize_t *retval){
     struct uio u;
 
 
-    /* use the helper function */
-    uio_init(&u, &iov, buf, buflen, file->offset, UIO_READ);
+    /* use the helper function (the offset is filled in under the file lock) */
+    uio_init(&u, &iov, buf, buflen, 0, UIO_READ);
+
+
+    /* fault in a large buffer now rather than page by page in the middle of the read, with the locks held */
+    struct uio_wired uw;
+    uio_prefault(&u, &uw);
+
+
+    /* get the file lock */
+    lock_acquire(file->lock);
+    u.uio_offset = file->offset;
 
 
     /* perform the read operation */
@@ -99,6 +83,7 @@ int sys_read(int fd, userptr_t buf, size_t buflen, ssize_t *retval){
     if (result) {
         /* error during read */
         lock_release(file->lock);
+        uio_unwire(&uw);
         open_file_decref(file);
         return result;
     }
@@ -114,6 +99,7 @@ int sys_read(int fd, userptr_t buf, size_t buflen, ssize_t *retval){
    
     /* release the file lock */
     lock_release(file->lock);
+    uio_unwire(&uw);
 
 
     /* decrement the reference count for the file */
@@ -0,0 +1,68 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <synch.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <uio.h>
+#include <uio_helper.h>
+#include <syscall.h>
+
+
+/* sys_readv: scatter read */
+
+
+/* Overview: from user program: ssize_t readv(int fd, const struct iovec *iov, int iovcnt); this works like read() but */
+/* fills the iovcnt buffers described by iov one after the other, with one VOP_READ on the whole lot (uiomove moves on */
+/* to the next buffer when one is full). Same return value as read: the total number of bytes read, 0 at end of file. */
+
+int sys_readv(int fd, userptr_t uiov, int iovcnt, ssize_t *retval){
+    /* 1. Look up the open file handler for the given fd (this takes a reference to it, no file table lock needed) */
+    struct open_file_handler *file = file_table_get(curproc->file_table, fd);
+    if (file == NULL) {
+        return EBADF;
+    }
+    if ((file->flags & O_ACCMODE) == O_WRONLY) {
+        open_file_decref(file);
+        return EBADF;
+    }
+
+    /* 2. bring the iovec array into the kernel */
+    struct iovec *iov;
+    size_t len;
+    int result = uio_copyin_iovecs(uiov, iovcnt, &iov, &len);
+    if (result) {
+        open_file_decref(file);
+        return result;
+    }
+
+    /* 3. one read for all of them, from the file's offset (under the file lock, like read, with the buffers faulted in first) */
+    struct uio u;
+    uio_init_iovecs(&u, iov, iovcnt, len, 0, UIO_READ);
+    struct uio_wired uw;
+    uio_prefault(&u, &uw);
+    lock_acquire(file->lock);
+    u.uio_offset = file->offset;
+    result = VOP_READ(file->file_vn, &u);
+    if (result) {
+        lock_release(file->lock);
+        uio_unwire(&uw);
+        open_file_decref(file);
+        kfree(iov);
+        return result;
+    }
+    file->offset = u.uio_offset;
+    lock_release(file->lock);
+    uio_unwire(&uw);
+
+    open_file_decref(file);
+    kfree(iov);
+
+    *retval = (ssize_t) (len - u.uio_resid);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <lib.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <current.h>
+#include <proc.h>
+#include <copyinout.h>
+#include <file_table.h>
+#include <syscall.h>
+
+/* sys_remove / sys_rmdir / sys_unlinkat: delete a name */
+/* remove deletes a file's name (the file goes when nothing has it open any more) and rmdir an empty directory. */
+/* unlinkat is either one, rmdir if flags has AT_REMOVEDIR, with a relative path starting from the directory open on */
+/* dirfd (or the current directory for AT_FDCWD), as for openat. */
+
+int sys_remove(userptr_t path){
+    return sys_unlinkat(AT_FDCWD, path, 0);
+}
+
+int sys_rmdir(userptr_t path){
+    return sys_unlinkat(AT_FDCWD, path, AT_REMOVEDIR);
+}
+
+int sys_unlinkat(int dirfd, userptr_t path, int flags){
+    if (flags & ~AT_REMOVEDIR) {
+        return EINVAL;
+    }
+
+    /* copy the path in (lookup may destroy it, which is fine since it's ours) */
+    char pathbuf[PATH_MAX];
+    int result = copyinstr(path, pathbuf, PATH_MAX, NULL);
+    if (result) {
+        return result;
+    }
+
+    struct vnode *dir;
+    result = file_table_getdir(curproc->file_table, dirfd, &dir);
+    if (result) {
+        return result;
+    }
+    if (flags & AT_REMOVEDIR) {
+        result = vfs_rmdirat(dir, pathbuf);
+    }
+    else {
+        result = vfs_removeat(dir, pathbuf);
+    }
+    if (dir != NULL) {
+        VOP_DECREF(dir);
+    }
+    return result;
+}
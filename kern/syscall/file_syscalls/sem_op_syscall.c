@@ -0,0 +1,44 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <fs.h>
+#include <vnode.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <syscall.h>
+
+
+/* sys_sem_op: P or V on a semfs semaphore ("sem:name") without going through read or write */
+
+
+/* Overview: from user program: int sem_op(int fd, int delta); a negative delta takes -delta from the count (waiting */
+/* while it is 0, like a read of -delta bytes), a positive one adds delta (like a write of delta bytes). There is no */
+/* data to move, so this skips the uio and the open file's lock and offset that read and write need: a P that waits */
+/* doesn't hold up everyone else using the same open file. P needs fd to be open for reading and V for writing, */
+/* EINVAL if fd isn't a semaphore or delta is 0 */
+
+int sys_sem_op(int fd, int delta){
+    if (delta == 0){
+        return EINVAL;
+    }
+
+    /* look up the file (this takes a reference to it, no file table lock needed) */
+    struct open_file_handler *file = file_table_get(curproc->file_table, fd);
+    if (file == NULL){
+        return EBADF;
+    }
+
+    /* same access check as read (for P) and write (for V) */
+    int mode = file->flags & O_ACCMODE;
+    if ((delta < 0 && mode == O_WRONLY) || (delta > 0 && mode == O_RDONLY)){
+        open_file_decref(file);
+        return EBADF;
+    }
+
+    int result = semfs_semop(file->file_vn, delta);
+    open_file_decref(file);
+    return result;
+}
@@ -0,0 +1,94 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <limits.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <syscall.h>
+
+
+/* sys_fstat / sys_stat / sys_lstat: get a file's attributes */
+
+
+/* Overview: from user program: int fstat(int fd, struct stat *buf); int stat(const char *path, struct stat *buf); */
+/* int lstat(const char *path, struct stat *buf); int fstatat(int dirfd, const char *path, struct stat *buf, int flags); */
+/* fill in buf with the size, type, link count and so on (kern/stat.h) */
+/* of the open file fd, or of the file path names. These come from VOP_STAT, which the file systems answer out of */
+/* what they keep in memory for the vnode (sfs from its copy of the inode), so looking at a file this way doesn't */
+/* mean opening it (no file table slot, no open file handler) or reading it to find out how big it is. */
+
+/* Input:
+            - fd : file descriptor identifying an open file (fstat)
+            - path : pointer (in user space) to the name of the file (stat, lstat)
+            - buf : pointer (in user space) to the struct stat to fill in
+*/
+
+
+/* copy the attributes of VN out to the user's buffer */
+static int stat_vnode(struct vnode *vn, userptr_t buf){
+    struct stat st;
+    int result = VOP_STAT(vn, &st);
+    if (result) {
+        return result;
+    }
+    return copyout(&st, buf, sizeof(st));
+}
+
+int sys_fstat(int fd, userptr_t buf){
+    /* the file table reference keeps the vnode alive, no need for the file's lock since the offset isn't involved */
+    struct open_file_handler *file = file_table_get(curproc->file_table, fd);
+    if (file == NULL) {
+        return EBADF;
+    }
+    int result = stat_vnode(file->file_vn, buf);
+    open_file_decref(file);
+    return result;
+}
+
+int sys_stat(userptr_t path, userptr_t buf){
+    return sys_fstatat(AT_FDCWD, path, buf, 0);
+}
+
+/* as stat, but a relative path starts from the directory open on dirfd */
+int sys_fstatat(int dirfd, userptr_t path, userptr_t buf, int flags){
+    if (flags & ~AT_SYMLINK_NOFOLLOW) {
+        return EINVAL;
+    }
+
+    /* copy in the path (lookup may destroy it, which is fine since it's ours) */
+    char pathbuf[PATH_MAX];
+    int result = copyinstr(path, pathbuf, PATH_MAX, NULL);
+    if (result) {
+        return result;
+    }
+
+    /* look it up (this goes through the name cache) and ask the file system, without opening anything */
+    struct vnode *dir;
+    result = file_table_getdir(curproc->file_table, dirfd, &dir);
+    if (result) {
+        return result;
+    }
+    struct vnode *vn;
+    result = vfs_lookupat(dir, pathbuf, &vn);
+    if (dir != NULL) {
+        VOP_DECREF(dir);
+    }
+    if (result) {
+        return result;
+    }
+    result = stat_vnode(vn, buf);
+    VOP_DECREF(vn);
+    return result;
+}
+
+/* Lookup never follows symlinks in this tree (a name that is one gets the link itself), so this is just stat */
+int sys_lstat(userptr_t path, userptr_t buf){
+    return sys_stat(path, buf);
+}
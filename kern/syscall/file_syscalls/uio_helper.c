@@ -1,11 +1,19 @@
 #include <types.h>       
+#include <kern/errno.h>
+#include <limits.h>
+#include <lib.h>
 #include <uio.h>         
+#include <copyinout.h>
 #include <current.h>     
 #include <proc.h>       
 #include <uio_helper.h>  
 #include <syscall.h>
 
 
+/* the most readv/writev can move at once: the largest ssize_t */
+#define UIO_LEN_MAX ((size_t)-1 >> 1)
+
+
 /* uio_init: helper function that prepares an iovec/uio pair for either a read or write sys call*/
 void uio_init(struct uio *u, struct iovec *iov, userptr_t buf, size_t len, off_t offset, enum uio_rw rw_type){
     iov->iov_ubase = buf;
@@ -19,6 +27,73 @@ void uio_init(struct uio *u, struct iovec *iov, userptr_t buf, size_t len, off_t
     u->uio_segflg = UIO_USERSPACE;
     u->uio_rw = rw_type;
     u->uio_space = curproc->p_addrspace;
+    u->uio_flags = UIO_PAGEMOVE;
+}
+
+
+/* uio_copyin_iovecs: copies in the user's array of iovcnt iovecs (for readv/writev) into a kmalloc'd array that the */
+/* caller kfrees, and adds up their lengths into *lenp. The buffers themselves are checked by uiomove as it goes */
+int uio_copyin_iovecs(userptr_t uiov, int iovcnt, struct iovec **iovp, size_t *lenp){
+    if (iovcnt <= 0 || iovcnt > IOV_MAX){
+        return EINVAL;
+    }
+
+    struct iovec *iov = kmalloc_tagged(iovcnt * sizeof(*iov), KM_PROC);
+    if (iov == NULL){
+        return ENOMEM;
+    }
+    /* the user's struct iovec has the same layout as ours (iov_base is our iov_ubase) */
+    int result = copyin(uiov, iov, iovcnt * sizeof(*iov));
+    if (result){
+        kfree(iov);
+        return result;
+    }
+
+    /* the total has to fit in the ssize_t we return */
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++){
+        if (iov[i].iov_len > UIO_LEN_MAX - len){
+            kfree(iov);
+            return EINVAL;
+        }
+        len += iov[i].iov_len;
+    }
+
+    *iovp = iov;
+    *lenp = len;
+    return 0;
+}
+
+
+/* uio_init_iovecs: like uio_init, but for an array of iovcnt iovecs holding len bytes in all */
+void uio_init_iovecs(struct uio *u, struct iovec *iov, int iovcnt, size_t len, off_t offset, enum uio_rw rw_type){
+    u->uio_iov = iov;
+    u->uio_iovcnt = iovcnt;
+    u->uio_offset = offset;
+    u->uio_resid = len;
+    u->uio_segflg = UIO_USERSPACE;
+    u->uio_rw = rw_type;
+    u->uio_space = curproc->p_addrspace;
+    u->uio_flags = UIO_PAGEMOVE;
 }
 
 
+/* uio_prefault: wire the user pages of a large uio ahead of the transfer (see vm_prefault), uio_unwire undoes it */
+void uio_prefault(const struct uio *u, struct uio_wired *uw){
+    uw->uw_n = 0;
+    if (u->uio_segflg != UIO_USERSPACE || u->uio_resid < UIO_PREFAULT_MIN){
+        return;
+    }
+
+    for (unsigned i = 0; i < u->uio_iovcnt && uw->uw_n < UIO_PREFAULT_MAX; i++){
+        const struct iovec *iov = &u->uio_iov[i];
+        uw->uw_n += vm_prefault(u->uio_space, (vaddr_t)iov->iov_ubase, iov->iov_len, u->uio_rw == UIO_READ,
+                                uw->uw_frames + uw->uw_n, UIO_PREFAULT_MAX - uw->uw_n);
+    }
+}
+
+
+void uio_unwire(struct uio_wired *uw){
+    vm_unwire(uw->uw_frames, uw->uw_n);
+    uw->uw_n = 0;
+}
@@ -35,38 +35,20 @@
 
 int sys_write(int fd, userptr_t buf, size_t nbytes, ssize_t *retval){
 
-         /* 1. Validate the file descriptor */
-        if (fd < 0 || fd > __OPEN_MAX){
-                return EBADF;
-        }
-
-        struct file_table *ft = curproc->file_table;
-
-        /* get the file table lock */
-        lock_acquire(ft->lock);
-
-        struct open_file_handler *f = ft->files[fd];
+         /* 1. Look up the file for fd (this takes a reference to it, no file table lock needed) */
+        struct open_file_handler *f = file_table_get(curproc->file_table, fd);
        
         if(f == NULL){
-                lock_release(ft->lock);
                 return EBADF;
         }
 
         /* 2. Then check the if the right permission bits are set (apply the mask and if the file is in read only then return error)*/
         if ((f->flags & O_ACCMODE) == O_RDONLY){
-                lock_release(ft->lock);
+                open_file_decref(f);
                 return EBADF;
         }
 
 
-        /* increment the reference count for the file */
-        open_file_incref(f);
-
-
-        /* release the file table lock as we have the open file handler now */
-        lock_release(ft->lock);
-
-
         /* 3. acquire the lock to ensure atomicity */
         lock_acquire(f->lock);
 
@@ -0,0 +1,75 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <synch.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <uio.h>
+#include <uio_helper.h>
+#include <syscall.h>
+
+
+/* sys_writev: gather write */
+
+
+/* Overview: from user program: ssize_t writev(int fd, const struct iovec *iov, int iovcnt); this works like write() */
+/* but takes the data from the iovcnt buffers described by iov in order, with one VOP_WRITE for all of them. So a */
+/* header and a payload (say) are written together in one go, at the same offset a single write would have used. */
+
+int sys_writev(int fd, userptr_t uiov, int iovcnt, ssize_t *retval){
+    /* 1. Look up the file for fd (this takes a reference to it, no file table lock needed) */
+    struct open_file_handler *f = file_table_get(curproc->file_table, fd);
+    if (f == NULL) {
+        return EBADF;
+    }
+    if ((f->flags & O_ACCMODE) == O_RDONLY) {
+        open_file_decref(f);
+        return EBADF;
+    }
+
+    /* 2. bring the iovec array into the kernel */
+    struct iovec *iov;
+    size_t len;
+    int result = uio_copyin_iovecs(uiov, iovcnt, &iov, &len);
+    if (result) {
+        open_file_decref(f);
+        return result;
+    }
+
+    /* 3. one write for all of them, at the file's offset or (O_APPEND) its end, under the file lock like write */
+    lock_acquire(f->lock);
+    struct uio u;
+    uio_init_iovecs(&u, iov, iovcnt, len, f->offset, UIO_WRITE);
+    if (f->flags & O_APPEND) {
+        struct stat st;
+        result = VOP_STAT(f->file_vn, &st);
+        if (result) {
+            lock_release(f->lock);
+            open_file_decref(f);
+            kfree(iov);
+            return result;
+        }
+        u.uio_offset = st.st_size;
+    }
+    result = VOP_WRITE(f->file_vn, &u);
+    if (result) {
+        lock_release(f->lock);
+        open_file_decref(f);
+        kfree(iov);
+        return result;
+    }
+    f->offset = u.uio_offset;
+    lock_release(f->lock);
+
+    open_file_decref(f);
+    kfree(iov);
+
+    *retval = (ssize_t) (len - u.uio_resid);
+    return 0;
+}
@@ -41,6 +41,8 @@ struct vnode *pcwd = curproc->p_cwd;
 if (pcwd != NULL) {
     VOP_INCREF(pcwd);          /* take a ref for the child */
 }
+memcpy(child->p_rlimit, curproc->p_rlimit, sizeof(child->p_rlimit)); /* the child inherits the resource limits */
+child->p_ioprio = curproc->p_ioprio; /* and the I/O priority */
 spinlock_release(&curproc->p_lock);
 
 child->p_cwd = pcwd;
@@ -57,14 +59,14 @@ child->p_cwd = pcwd;
 
     /* Note that each process needs to know who its parent is so that later when the child calls _exit(), the parent can use waitpid() to collect */
     /* its exit status. Without this link, the parent would have no way of knowing which child exited or when */
-    child->p_parent = curproc->p_pid; 
+    proc_addchild(curproc, child); 
 
     /* 4. Copy parents tf onto child. The tf represents the exact cpu reg state when the parent process entered the kernel to execute the fork() sys call */
     /* this includes pc, sp, and other general purpose registers. We make a copy of it for the child since the parents tf lives on its kernel stack and will */
     /* soon be reused when returning to user mode. If we don't copy it both the parent and chile processes will share the same reg snapshots and this is bad */
 
     /* so first we allocate a heap copy of the parents tf that will survive after sys_fork() returns. And then we pass this heap copy into thread_fork()*/
-    struct trapframe *child_tf = kmalloc(sizeof(struct trapframe)); 
+    struct trapframe *child_tf = kmalloc_tagged(sizeof(struct trapframe), KM_PROC); 
     if (child_tf == NULL){
         destroy_file_table(child->file_table); 
         as_destroy(child_as); 
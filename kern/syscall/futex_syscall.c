@@ -0,0 +1,252 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <futex.h>
+#include <syscall.h>
+
+
+/*
+ * Futexes: wait on and wake a word of user memory. The word is named by its physical address, so two processes that
+ * map the same frame (MAP_SHARED, including across fork) use the same futex. Waiters hash by that address into
+ * FUTEX_NBUCKETS buckets, each with a spinlock, a wait channel and a list of who is waiting on what. A wake marks up
+ * to n matching waiters and wakes the bucket's channel; the others find themselves not marked and go back to sleep.
+ *
+ * The pager can move a page while someone waits on it. When it evicts a frame it calls futex_pageout, which wakes
+ * everyone waiting in that frame, so nobody sleeps on an address a waker can no longer find. Like any futex wakeup
+ * that is allowed to be spurious: the caller re-checks its word and waits again.
+ */
+#define FUTEX_NBUCKETS 64
+
+struct futex_waiter {
+    paddr_t fw_addr;
+    struct proc *fw_proc;
+    bool fw_woken;
+    struct futex_waiter *fw_next;
+};
+
+struct futex_bucket {
+    struct spinlock fb_lock;
+    struct wchan *fb_wchan;
+    struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_buckets[FUTEX_NBUCKETS];
+
+void futex_bootstrap(void){
+    for (unsigned i = 0; i < FUTEX_NBUCKETS; i++){
+        spinlock_init(&futex_buckets[i].fb_lock);
+        futex_buckets[i].fb_wchan = wchan_create("futex");
+        if (futex_buckets[i].fb_wchan == NULL){
+            panic("futex_bootstrap: Out of memory\n");
+        }
+        futex_buckets[i].fb_waiters = NULL;
+    }
+}
+
+static struct futex_bucket *futex_bucket(paddr_t pa){
+    return &futex_buckets[((pa >> 2) * 2654435761U) % FUTEX_NBUCKETS];
+}
+
+/*
+ * Finds the frame behind the user word at va, faulting it in for writing first if it isn't there or is still shared
+ * copy-on-write (or is the zero page), so that it stays put until the pager evicts it. Hands back the page table
+ * entry and the frame; the caller re-checks the entry under its bucket lock.
+ */
+static int futex_frame(vaddr_t va, paddr_t **ptep, paddr_t *framep){
+    struct addrspace *as = proc_getas();
+    if (as == NULL){
+        return EFAULT;
+    }
+
+    for (;;){
+        lock_acquire(as->as_lock);
+        /* a table shared since fork would make the frame look private when it isn't, get our own */
+        paddr_t *l2_table = as_l2table(as, va, true);
+        if (l2_table != NULL){
+            paddr_t *pte = &l2_table[(va >> PT_L2_SHIFT) & PT_INDEX_MASK];
+            paddr_t frame = pte_get(pte);
+            if (frame != 0 && !PTE_IS_SWAPPED(frame)){
+                struct region *r = as_find_region(as, va);
+                if (!page_is_shared(frame) || (r != NULL && r->shared)){
+                    lock_release(as->as_lock);
+                    *ptep = pte;
+                    *framep = frame;
+                    return 0;
+                }
+            }
+        }
+        lock_release(as->as_lock);
+
+        int result = vm_fault(VM_FAULT_WRITE, va);
+        if (result){
+            return result;
+        }
+    }
+}
+
+/* true if the entry still maps frame and the pager isn't about to take it. Call with the bucket lock held */
+static bool futex_frame_ok(paddr_t *pte, paddr_t frame){
+    paddr_t v = *pte;
+    return !PTE_IS_SWAPPED(v) && (v & PAGE_FRAME) == frame && !page_is_busy(frame);
+}
+
+/* sleeps until woken by futex_wake, as long as the word at addr holds val when we get there (EAGAIN if it doesn't) */
+int sys_futex_wait(userptr_t addr, int val){
+    vaddr_t va = (vaddr_t)addr;
+
+    if ((va & 3) != 0){
+        return EINVAL;
+    }
+    if (va >= USERSPACETOP){
+        return EFAULT;
+    }
+
+    for (;;){
+        paddr_t *pte, frame;
+        int result = futex_frame(va, &pte, &frame);
+        if (result){
+            return result;
+        }
+
+        paddr_t pa = frame | (va & ~PAGE_FRAME);
+        struct futex_bucket *fb = futex_bucket(pa);
+
+        spinlock_acquire(&fb->fb_lock);
+        if (!futex_frame_ok(pte, frame)){
+            /* the pager got to it, look again */
+            spinlock_release(&fb->fb_lock);
+            continue;
+        }
+
+        /* we hold the bucket, so a waker that changed the word after this read can't miss us */
+        if (*(volatile int *)PADDR_TO_KVADDR(pa) != val){
+            spinlock_release(&fb->fb_lock);
+            return EAGAIN;
+        }
+
+        /* another thread is making the process exit or exec (futex_killproc takes this lock after setting it) */
+        if (curproc->p_thrkill){
+            spinlock_release(&fb->fb_lock);
+            return EINTR;
+        }
+
+        struct futex_waiter fw;
+        fw.fw_addr = pa;
+        fw.fw_proc = curproc;
+        fw.fw_woken = false;
+        fw.fw_next = fb->fb_waiters;
+        fb->fb_waiters = &fw;
+        while (!fw.fw_woken){
+            wchan_sleep(fb->fb_wchan, &fb->fb_lock);
+        }
+        spinlock_release(&fb->fb_lock);
+        return 0;
+    }
+}
+
+/* Marks up to max waiters on pa (any address in its page if whole_page) woken, takes them off the list, and returns how many */
+static unsigned futex_wake_locked(struct futex_bucket *fb, paddr_t pa, unsigned max, bool whole_page){
+    struct futex_waiter **fwp = &fb->fb_waiters;
+    unsigned n = 0;
+
+    KASSERT(spinlock_do_i_hold(&fb->fb_lock));
+    while (*fwp != NULL && n < max){
+        struct futex_waiter *fw = *fwp;
+        bool match = whole_page ? (fw->fw_addr & PAGE_FRAME) == pa : fw->fw_addr == pa;
+        if (!match){
+            fwp = &fw->fw_next;
+            continue;
+        }
+        *fwp = fw->fw_next;
+        fw->fw_woken = true;
+        n++;
+    }
+    if (n > 0){
+        wchan_wakeall(fb->fb_wchan, &fb->fb_lock);
+    }
+    return n;
+}
+
+/* wakes up to n threads waiting on the word at addr and returns how many it woke */
+int sys_futex_wake(userptr_t addr, int n, int32_t *retval){
+    vaddr_t va = (vaddr_t)addr;
+
+    if ((va & 3) != 0 || n < 0){
+        return EINVAL;
+    }
+    if (va >= USERSPACETOP){
+        return EFAULT;
+    }
+
+    for (;;){
+        paddr_t *pte, frame;
+        int result = futex_frame(va, &pte, &frame);
+        if (result){
+            return result;
+        }
+
+        paddr_t pa = frame | (va & ~PAGE_FRAME);
+        struct futex_bucket *fb = futex_bucket(pa);
+
+        spinlock_acquire(&fb->fb_lock);
+        if (!futex_frame_ok(pte, frame)){
+            spinlock_release(&fb->fb_lock);
+            continue;
+        }
+        *retval = futex_wake_locked(fb, pa, n, false);
+        spinlock_release(&fb->fb_lock);
+        return 0;
+    }
+}
+
+/*
+ * The pager has evicted frame (its owner's entry already points at swap): wake everybody waiting anywhere in it.
+ * Waiters in one frame can be in any bucket. A waiter checks the entry under its bucket lock, so once we have had
+ * each lock it is either on a list here or has seen the new entry and gone to look again.
+ */
+void futex_pageout(paddr_t frame){
+    KASSERT((frame & ~PAGE_FRAME) == 0);
+
+    for (unsigned i = 0; i < FUTEX_NBUCKETS; i++){
+        struct futex_bucket *fb = &futex_buckets[i];
+
+        spinlock_acquire(&fb->fb_lock);
+        futex_wake_locked(fb, frame, (unsigned)-1, true);
+        spinlock_release(&fb->fb_lock);
+    }
+}
+
+/* Wakes all the threads of p waiting on any futex. p_thrkill is set, so none of them goes back to sleep */
+void futex_killproc(struct proc *p){
+    KASSERT(p->p_thrkill);
+
+    for (unsigned i = 0; i < FUTEX_NBUCKETS; i++){
+        struct futex_bucket *fb = &futex_buckets[i];
+        struct futex_waiter **fwp = &fb->fb_waiters;
+        bool woke = false;
+
+        spinlock_acquire(&fb->fb_lock);
+        while (*fwp != NULL){
+            struct futex_waiter *fw = *fwp;
+            if (fw->fw_proc != p){
+                fwp = &fw->fw_next;
+                continue;
+            }
+            *fwp = fw->fw_next;
+            fw->fw_woken = true;
+            woke = true;
+        }
+        if (woke){
+            wchan_wakeall(fb->fb_wchan, &fb->fb_lock);
+        }
+        spinlock_release(&fb->fb_lock);
+    }
+}
@@ -0,0 +1,69 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+
+
+/* kilobytes in npages pages, for the ru_*rss fields */
+#define PAGES_TO_KB(npages) ((npages) * (PAGE_SIZE / 1024))
+
+/* cycles of CPU time to a timeval */
+static void cycles_to_timeval(uint64_t cycles, struct timeval *tv){
+    struct timespec ts;
+
+    cycles_to_timespec(cycles, &ts);
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+}
+
+/* Reports the CPU times and VM counters of the calling process (RUSAGE_SELF) or of the children it has waited for */
+/* (RUSAGE_CHILDREN). Interrupt time is counted as system time. The I/O, message, signal and context switch counts */
+/* are always 0. The VM fields get what fits: minor faults are the misses vm_fault resolved without I/O, major ones */
+/* the pageins, and ru_nswap counts evicted pages rather than whole process swaps. The rest is in the OS/161 fields */
+/* at the end */
+int sys_getrusage(int who, userptr_t usage){
+    struct vmstats vs;
+    struct cputimes ct;
+
+    if (who == RUSAGE_SELF){
+        struct addrspace *as = proc_getas();
+        if (as == NULL){
+            bzero(&vs, sizeof(vs));
+        }
+        else {
+            vs = as->as_stats;
+        }
+        proc_gettimes(curproc, &ct);
+    }
+    else if (who == RUSAGE_CHILDREN){
+        vs = curproc->p_childstats;
+        ct = curproc->p_childtimes;
+    }
+    else {
+        return EINVAL;
+    }
+
+    struct rusage ru;
+    bzero(&ru, sizeof(ru));
+    cycles_to_timeval(ct.ct_utime, &ru.ru_utime);
+    cycles_to_timeval(ct.ct_stime + ct.ct_itime, &ru.ru_stime);
+    ru.ru_maxrss = PAGES_TO_KB(vs.vs_maxresident);
+    ru.ru_minflt = vs.vs_tlbmisses > vs.vs_pageins ? vs.vs_tlbmisses - vs.vs_pageins : 0; /* fork's pageins aren't misses */
+    ru.ru_majflt = vs.vs_pageins;
+    ru.ru_nswap = vs.vs_evictions;
+    ru.ru_tlbmiss = vs.vs_tlbmisses;
+    ru.ru_zerofill = vs.vs_zerofills;
+    ru.ru_cowcopy = vs.vs_cowcopies;
+    ru.ru_rss = PAGES_TO_KB(VMSTATS_RESIDENT(&vs));
+
+    /* copy it out to the user's buffer */
+    return copyout(&ru, usage, sizeof(ru));
+}
@@ -0,0 +1,111 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/ioring.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+
+/*
+ * ioring_enter: does a batch of file operations queued up in the caller's submission ring (see kern/ioring.h) and
+ * posts their results in its completion ring. Each one goes through the same code as the system call it stands for,
+ * so it behaves exactly the same; what's saved is a trap per operation.
+ *
+ * The rings are in user memory, so we get at them with copyin/copyout like any other user data (the caller is in
+ * here, not changing them). The description is read once up front and the two counters the kernel owns are written
+ * back at the end; if something faults part way, what was done is still reported.
+ */
+
+/* Does one submission and returns what goes in its completion */
+static int ioring_do(const struct ioring_sqe *sqe){
+    int32_t retval = 0;
+    int err;
+
+    switch (sqe->sqe_op){
+        case IORING_OP_NOP:
+            err = 0;
+            break;
+        case IORING_OP_READ:
+            err = sys_read(sqe->sqe_fd, (userptr_t)sqe->sqe_buf, sqe->sqe_len, &retval);
+            break;
+        case IORING_OP_WRITE:
+            err = sys_write(sqe->sqe_fd, (userptr_t)sqe->sqe_buf, sqe->sqe_len, &retval);
+            break;
+        case IORING_OP_PREAD:
+            err = sys_pread(sqe->sqe_fd, (userptr_t)sqe->sqe_buf, sqe->sqe_len, sqe->sqe_offset, &retval);
+            break;
+        case IORING_OP_PWRITE:
+            err = sys_pwrite(sqe->sqe_fd, (userptr_t)sqe->sqe_buf, sqe->sqe_len, sqe->sqe_offset, &retval);
+            break;
+        case IORING_OP_OPEN:
+            err = sys_open((userptr_t)sqe->sqe_buf, sqe->sqe_flags, sqe->sqe_mode, &retval);
+            break;
+        case IORING_OP_CLOSE:
+            err = sys_close(sqe->sqe_fd);
+            break;
+        default:
+            err = EINVAL;
+            break;
+    }
+    return err ? -err : retval;
+}
+
+/* Returns how many submissions were done */
+int sys_ioring_enter(userptr_t uring, int32_t *retval){
+    struct ioring *ur = (struct ioring *)uring;
+    struct ioring ring;
+    int result;
+
+    result = copyin(uring, &ring, sizeof(ring));
+    if (result){
+        return result;
+    }
+    unsigned n = ring.ir_entries;
+    if (n == 0 || n > IORING_MAX_ENTRIES || (n & (n - 1)) != 0){
+        return EINVAL;
+    }
+    unsigned pending = ring.ir_sqtail - ring.ir_sqhead;
+    unsigned inuse = ring.ir_cqtail - ring.ir_cqhead;
+    if (pending > n || inuse > n){
+        /* the counters are garbage */
+        return EINVAL;
+    }
+    unsigned todo = (pending < n - inuse) ? pending : n - inuse;
+
+    unsigned done;
+    for (done = 0; done < todo; done++){
+        struct ioring_sqe sqe;
+        struct ioring_cqe cqe;
+
+        result = copyin((userptr_t)&ring.ir_sq[(ring.ir_sqhead + done) & (n - 1)], &sqe, sizeof(sqe));
+        if (result){
+            break;
+        }
+        cqe.cqe_res = ioring_do(&sqe);
+        cqe.cqe_data = sqe.sqe_data;
+        result = copyout(&cqe, (userptr_t)&ring.ir_cq[(ring.ir_cqtail + done) & (n - 1)], sizeof(cqe));
+        if (result){
+            /* it was done, but nobody will hear about it */
+            done++;
+            break;
+        }
+    }
+
+    /* move our two counters on past what we did */
+    if (done > 0){
+        unsigned sqhead = ring.ir_sqhead + done;
+        unsigned cqtail = ring.ir_cqtail + done;
+        int err1 = copyout(&sqhead, (userptr_t)&ur->ir_sqhead, sizeof(sqhead));
+        int err2 = copyout(&cqtail, (userptr_t)&ur->ir_cqtail, sizeof(cqtail));
+        if (err1 || err2){
+            return err1 ? err1 : err2;
+        }
+        result = 0;
+    }
+    if (result){
+        return result;
+    }
+
+    *retval = done;
+    return 0;
+}
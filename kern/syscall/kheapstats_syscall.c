@@ -0,0 +1,36 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/kheapstats.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+
+/* most size classes kmalloc can have (8 subpage sizes plus whole pages, see kmalloc.c) */
+#define KHEAPSTATS_MAX 16
+
+/* Copies the kmalloc counters of up to nclasses size classes out to buf and returns how many classes there are, */
+/* so a caller can pass 0 first to find out. Without options kheapstats there are no counters and we return ENOSYS */
+int sys_kheapstats(userptr_t buf, unsigned nclasses, int32_t *retval){
+    struct kheapstats ks[KHEAPSTATS_MAX];
+
+    unsigned n = kheap_getstats(ks, KHEAPSTATS_MAX);
+    if (n == 0){
+        return ENOSYS;
+    }
+    KASSERT(n <= KHEAPSTATS_MAX);
+
+    /* only copy what the user has room for */
+    if (nclasses > n){
+        nclasses = n;
+    }
+    if (nclasses > 0){
+        int err = copyout(ks, buf, nclasses * sizeof(ks[0]));
+        if (err){
+            return err;
+        }
+    }
+
+    *retval = n;
+    return 0;
+}
@@ -34,7 +34,8 @@
  * It makes the following address space calls:
  *    - first, as_define_region once for each segment of the program;
  *    - then, as_prepare_load;
- *    - then it loads each chunk of the program;
+ *    - then it maps each chunk of the program (as_define_file), to be
+ *      paged in by vm_fault;
  *    - finally, as_complete_load.
  *
  * This gives the VM code enough flexibility to deal with even grossly
@@ -48,11 +49,19 @@
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
  * linker). And you'd have to write a dynamic linker...
+ *
+ * The file's layout, the entry point and the loadable segments, is
+ * only read and checked the first time; it's kept hung off the vnode
+ * (vn_elf) for the execs after, which go straight to setting up the
+ * address space. Like the shared text pages (vm/textcache.c) it goes
+ * away on any write or truncate (loadelf_purge, from VOP_WRITE and
+ * VOP_TRUNCATE) and when the vnode is reclaimed.
  */
 
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <uio.h>
 #include <proc.h>
 #include <current.h>
@@ -69,98 +78,144 @@
  * FILESIZE may be less than MEMSIZE; if so the remaining portion of
  * the in-memory segment should be zero-filled.
  *
- * Note that uiomove will catch it if someone tries to load an
- * executable whose load address is in kernel space. If you should
- * change this code to not use uiomove, be sure to check for this case
- * explicitly.
+ * Nothing is read here: the segment's region is marked as backed by
+ * the file, and vm_fault reads each page in (or zero-fills it) the
+ * first time it is touched. Since we don't go through uiomove, check
+ * explicitly that the segment doesn't reach into kernel space.
  */
 static
 int
 load_segment(struct addrspace *as, struct vnode *v,
 	     off_t offset, vaddr_t vaddr,
-	     size_t memsize, size_t filesize,
-	     int is_executable)
+	     size_t memsize, size_t filesize)
 {
-	struct iovec iov;
-	struct uio u;
-	int result;
-
 	if (filesize > memsize) {
 		kprintf("ELF: warning: segment filesize > segment memsize\n");
 		filesize = memsize;
 	}
 
-	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n",
+	if (vaddr >= USERSPACETOP || memsize > USERSPACETOP - vaddr) {
+		return ENOEXEC;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
 	      (unsigned long) filesize, (unsigned long) vaddr);
 
-	iov.iov_ubase = (userptr_t)vaddr;
-	iov.iov_len = memsize;		 // length of the memory space
-	u.uio_iov = &iov;
-	u.uio_iovcnt = 1;
-	u.uio_resid = filesize;          // amount to read from the file
-	u.uio_offset = offset;
-	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
-	u.uio_rw = UIO_READ;
-	u.uio_space = as;
-
-	result = VOP_READ(v, &u);
+	if (filesize == 0) {
+		/* all bss, plain zero-fill on demand */
+		return 0;
+	}
+
+	return as_define_file(as, vaddr, v, offset, filesize);
+}
+
+/*
+ * One loadable segment, and a parsed executable. An elfimage doesn't
+ * change once ei_ready is set; who has a reference can use it without
+ * locking. While it's being parsed it's already in vn_elf, unready,
+ * so that a purge in the meantime is noticed: it takes it out, and
+ * the exec parsing it uses it that once.
+ */
+struct elfseg {
+	off_t es_offset;	/* where in the file */
+	vaddr_t es_vaddr;	/* where in memory */
+	size_t es_memsize;
+	size_t es_filesize;
+	uint32_t es_flags;	/* PF_* */
+};
+
+struct elfimage {
+	unsigned ei_refcount;	/* protected by loadelf_lock */
+	bool ei_ready;		/* parsed and checked */
+	vaddr_t ei_entry;
+	unsigned ei_nsegs;
+	struct elfseg *ei_segs;
+};
+
+/* Protects vn_elf of all vnodes, and the refcounts. */
+static struct spinlock loadelf_lock = SPINLOCK_INITIALIZER;
+
+static
+void
+elfimage_decref(struct elfimage *ei)
+{
+	bool last;
+
+	spinlock_acquire(&loadelf_lock);
+	KASSERT(ei->ei_refcount > 0);
+	ei->ei_refcount--;
+	last = ei->ei_refcount == 0;
+	spinlock_release(&loadelf_lock);
+
+	if (last) {
+		kfree(ei->ei_segs);
+		kfree(ei);
+	}
+}
+
+/*
+ * Drop V's parsed layout, if it has one. Called on every write, so
+ * don't lock unless there's something there.
+ */
+void
+loadelf_purge(struct vnode *v)
+{
+	struct elfimage *ei;
+
+	if (v->vn_elf == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&loadelf_lock);
+	ei = v->vn_elf;
+	v->vn_elf = NULL;
+	spinlock_release(&loadelf_lock);
+
+	if (ei != NULL) {
+		elfimage_decref(ei);
+	}
+}
+
+/*
+ * Read a program header from the file.
+ */
+static
+int
+load_phdr(struct vnode *v, const Elf_Ehdr *eh, int i, Elf_Phdr *ph)
+{
+	struct iovec iov;
+	struct uio ku;
+	off_t offset;
+	int result;
+
+	offset = eh->e_phoff + i*eh->e_phentsize;
+	uio_kinit(&iov, &ku, ph, sizeof(*ph), offset, UIO_READ);
+
+	result = VOP_READ(v, &ku);
 	if (result) {
 		return result;
 	}
 
-	if (u.uio_resid != 0) {
+	if (ku.uio_resid != 0) {
 		/* short read; problem with executable? */
-		kprintf("ELF: short read on segment - file truncated?\n");
+		kprintf("ELF: short read on phdr - file truncated?\n");
 		return ENOEXEC;
 	}
-
-	/*
-	 * If memsize > filesize, the remaining space should be
-	 * zero-filled. There is no need to do this explicitly,
-	 * because the VM system should provide pages that do not
-	 * contain other processes' data, i.e., are already zeroed.
-	 *
-	 * During development of your VM system, it may have bugs that
-	 * cause it to (maybe only sometimes) not provide zero-filled
-	 * pages, which can cause user programs to fail in strange
-	 * ways. Explicitly zeroing program BSS may help identify such
-	 * bugs, so the following disabled code is provided as a
-	 * diagnostic tool. Note that it must be disabled again before
-	 * you submit your code for grading.
-	 */
-#if 0
-	{
-		size_t fillamt;
-
-		fillamt = memsize - filesize;
-		if (fillamt > 0) {
-			DEBUG(DB_EXEC, "ELF: Zero-filling %lu more bytes\n",
-			      (unsigned long) fillamt);
-			u.uio_resid += fillamt;
-			result = uiomovezeros(fillamt, &u);
-		}
-	}
-#endif
-
-	return result;
+	return 0;
 }
 
 /*
- * Load an ELF executable user program into the current address space.
- *
- * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ * Read and check the executable's headers into EI.
  */
+static
 int
-load_elf(struct vnode *v, vaddr_t *entrypoint)
+load_elf_parse(struct vnode *v, struct elfimage *ei)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
 	int result, i;
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
-
-	as = proc_getas();
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -203,7 +258,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Go through the list of segments and set up the address space.
+	 * Go through the list of segments and keep the loadable ones.
 	 *
 	 * Ordinarily there will be one code segment, one read-only
 	 * data segment, and one data/bss segment, but there might
@@ -217,21 +272,19 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * to find where the phdr starts.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
+	if (eh.e_phnum > 0) {
+		ei->ei_segs = kmalloc_tagged(eh.e_phnum * sizeof(ei->ei_segs[0]), KM_PROC);
+		if (ei->ei_segs == NULL) {
+			return ENOMEM;
+		}
+	}
 
-		result = VOP_READ(v, &ku);
+	for (i=0; i<eh.e_phnum; i++) {
+		result = load_phdr(v, &eh, i, &ph);
 		if (result) {
 			return result;
 		}
 
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
-
 		switch (ph.p_type) {
 		    case PT_NULL: /* skip */ continue;
 		    case PT_PHDR: /* skip */ continue;
@@ -243,65 +296,146 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
-		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
+		ei->ei_segs[ei->ei_nsegs].es_offset = ph.p_offset;
+		ei->ei_segs[ei->ei_nsegs].es_vaddr = ph.p_vaddr;
+		ei->ei_segs[ei->ei_nsegs].es_memsize = ph.p_memsz;
+		ei->ei_segs[ei->ei_nsegs].es_filesize = ph.p_filesz;
+		ei->ei_segs[ei->ei_nsegs].es_flags = ph.p_flags;
+		ei->ei_nsegs++;
+	}
+
+	ei->ei_entry = eh.e_entry;
+	return 0;
+}
+
+/*
+ * Get V's parsed layout, with a reference: the cached one if there is
+ * one, else a new one, which is cached if nothing got in the way.
+ */
+static
+int
+load_elf_image(struct vnode *v, struct elfimage **ret)
+{
+	struct elfimage *ei;
+	int result;
+
+	spinlock_acquire(&loadelf_lock);
+	ei = v->vn_elf;
+	if (ei != NULL && ei->ei_ready) {
+		ei->ei_refcount++;
+		spinlock_release(&loadelf_lock);
+		*ret = ei;
+		return 0;
+	}
+	spinlock_release(&loadelf_lock);
+
+	ei = kmalloc_tagged(sizeof(*ei), KM_PROC);
+	if (ei == NULL) {
+		return ENOMEM;
+	}
+	ei->ei_refcount = 1;
+	ei->ei_ready = false;
+	ei->ei_entry = 0;
+	ei->ei_nsegs = 0;
+	ei->ei_segs = NULL;
+
+	/* Put it in while we parse, unless someone else already is. */
+	spinlock_acquire(&loadelf_lock);
+	if (v->vn_elf == NULL) {
+		v->vn_elf = ei;
+		ei->ei_refcount++;
+	}
+	spinlock_release(&loadelf_lock);
+
+	result = load_elf_parse(v, ei);
+
+	spinlock_acquire(&loadelf_lock);
+	if (v->vn_elf == ei) {
 		if (result) {
-			return result;
+			/* don't keep failures */
+			v->vn_elf = NULL;
+			ei->ei_refcount--;
+		}
+		else {
+			ei->ei_ready = true;
 		}
 	}
+	spinlock_release(&loadelf_lock);
 
-	result = as_prepare_load(as);
+	if (result) {
+		elfimage_decref(ei);
+		return result;
+	}
+	*ret = ei;
+	return 0;
+}
+
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ */
+int
+load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	struct elfimage *ei;
+	struct elfseg *es;
+	struct addrspace *as;
+	unsigned i;
+	int result;
+
+	as = proc_getas();
+
+	result = load_elf_image(v, &ei);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * Now actually load each segment.
+	 * Set up a region for each segment.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
-
-		result = VOP_READ(v, &ku);
+	for (i=0; i<ei->ei_nsegs; i++) {
+		es = &ei->ei_segs[i];
+		result = as_define_region(as,
+					  es->es_vaddr, es->es_memsize,
+					  es->es_flags & PF_R,
+					  es->es_flags & PF_W,
+					  es->es_flags & PF_X);
 		if (result) {
-			return result;
+			goto fail;
 		}
+	}
 
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
+	result = as_prepare_load(as);
+	if (result) {
+		goto fail;
+	}
 
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n",
-				ph.p_type);
-			return ENOEXEC;
-		}
+	/*
+	 * Now attach each segment's file data to its region.
+	 */
 
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+	for (i=0; i<ei->ei_nsegs; i++) {
+		es = &ei->ei_segs[i];
+		result = load_segment(as, v, es->es_offset, es->es_vaddr,
+				      es->es_memsize, es->es_filesize);
 		if (result) {
-			return result;
+			goto fail;
 		}
 	}
 
 	result = as_complete_load(as);
 	if (result) {
-		return result;
+		goto fail;
 	}
 
-	*entrypoint = eh.e_entry;
+	*entrypoint = ei->ei_entry;
+	elfimage_decref(ei);
 
 	return 0;
+
+ fail:
+	elfimage_decref(ei);
+	return result;
 }
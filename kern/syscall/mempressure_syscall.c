@@ -0,0 +1,37 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mempressure.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <proc.h>
+#include <current.h>
+#include <coremap.h>
+#include <swap.h>
+
+/*
+ * Wait for the memory pressure level to be something other than seen and report it. The level is looked at again
+ * once a second even if nobody wakes us, since going back to normal only shows when somebody checks.
+ */
+int sys_mempressure(int seen, userptr_t ump){
+    struct mempressure mp;
+    int level;
+
+    for (;;){
+        level = swap_pressure(seen, HZ);
+        if (level != seen){
+            break;
+        }
+        if (curproc->p_thrkill){
+            /* another thread is making the process exit or exec */
+            return EINTR;
+        }
+    }
+
+    mp.mp_level = level;
+    mp.mp_free = coremap_freecount();
+    mp.mp_lowater = PAGER_LOW_WATER;
+    mp.mp_minwater = PAGER_MIN_WATER;
+    return copyout(&mp, ump, sizeof(mp));
+}
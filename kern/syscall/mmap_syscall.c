@@ -0,0 +1,184 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <stat.h>
+#include <syscall.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <vnode.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <shm.h>
+
+
+/* Syscall implementation of mmap. Per the man page: void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset) */
+/* maps len bytes of the file open on fd, starting at offset, into the address space and returns where it put them. Nothing is */
+/* read here: the new region is demand paged, vm_fault reads each page from the vnode the first time it is touched. With */
+/* MAP_SHARED writes are written back to the file on munmap/exit (and forked children see the same pages), with MAP_PRIVATE */
+/* they stay private. MAP_ANON gives zero filled memory without a file; shared, it is a shared memory segment of its own */
+/* (see shm.h), so children forked later see even the pages nobody had touched yet. Without PROT_READ (PROT_NONE, or */
+/* PROT_WRITE alone) the pages can't be touched at all, see vm_fault. addr is only a hint and we ignore it */
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd, off_t offset, int32_t *retval){
+    (void)addr;
+
+    struct addrspace *as = proc_getas();
+    if (as == NULL){
+        return ENOMEM;
+    }
+
+    /* exactly one of MAP_SHARED and MAP_PRIVATE, and we can't place mappings at fixed addresses */
+    int type = flags & (MAP_SHARED | MAP_PRIVATE);
+    if (len == 0 || (type != MAP_SHARED && type != MAP_PRIVATE) || (flags & MAP_FIXED)){
+        return EINVAL;
+    }
+
+    /* mappings start on a page boundary of the file */
+    if (offset < 0 || (offset & ~(off_t)PAGE_FRAME) != 0){
+        return EINVAL;
+    }
+
+    /* private anonymous memory is just a demand zero region, shared anonymous memory an unnamed segment */
+    if (flags & MAP_ANON){
+        vaddr_t va;
+        int result;
+        if (type == MAP_SHARED){
+            struct shmseg *seg;
+            result = shm_create((len + PAGE_SIZE - 1) / PAGE_SIZE, &seg);
+            if (result){
+                return result;
+            }
+            lock_acquire(as->as_lock);
+            result = as_mmap_shm(as, seg, prot, &va);
+            lock_release(as->as_lock);
+            shm_decref(seg);
+        }
+        else {
+            lock_acquire(as->as_lock);
+            result = as_mmap(as, len, prot, false, NULL, 0, 0, &va);
+            lock_release(as->as_lock);
+        }
+        if (result){
+            return result;
+        }
+        *retval = (int32_t)va;
+        return 0;
+    }
+
+    /* look up the open file the same way read/write do */
+    struct open_file_handler *file = file_table_get(curproc->file_table, fd);
+    if (file == NULL){
+        return EBADF;
+    }
+
+    /* reading the pages in needs read access, writing a shared mapping back needs write access too */
+    int accmode = file->flags & O_ACCMODE;
+    if (accmode == O_WRONLY || (type == MAP_SHARED && (prot & PROT_WRITE) && accmode != O_RDWR)){
+        open_file_decref(file);
+        return EACCES;
+    }
+
+    struct vnode *vn = file->file_vn;
+
+    /* let the file system say whether the file can be mapped at all (devices can't) */
+    int result = VOP_MMAP(vn);
+    if (result){
+        open_file_decref(file);
+        return result == ENOSYS ? ENODEV : result;
+    }
+
+    /* only the part of the mapping that lies within the file is read from it, the rest of the last pages is zero */
+    struct stat st;
+    result = VOP_STAT(vn, &st);
+    if (result){
+        open_file_decref(file);
+        return result;
+    }
+    size_t filesz = 0;
+    if (offset < st.st_size){
+        filesz = (st.st_size - offset < (off_t)len) ? (size_t)(st.st_size - offset) : len;
+    }
+
+    /* the region keeps its own vnode reference so the file can be closed while it is mapped */
+    vaddr_t va;
+    lock_acquire(as->as_lock);
+    result = as_mmap(as, len, prot, type == MAP_SHARED, vn, offset, filesz, &va);
+    lock_release(as->as_lock);
+    open_file_decref(file);
+    if (result){
+        return result;
+    }
+
+    *retval = (int32_t)va;
+    return 0;
+}
+
+
+/* Syscall implementation of munmap: int munmap(void *addr, size_t len). Removes a mapping made by mmap, writing shared */
+/* pages back to the file first. We only support unmapping a whole mapping at once */
+int sys_munmap(userptr_t addr, size_t len){
+    struct addrspace *as = proc_getas();
+    if (as == NULL){
+        return EINVAL;
+    }
+
+    if (len == 0 || ((vaddr_t)addr & ~(vaddr_t)PAGE_FRAME) != 0){
+        return EINVAL;
+    }
+
+    /* as_munmap lets go of as_lock while it writes shared pages back */
+    lock_acquire(as->as_lock);
+    int result = as_munmap(as, (vaddr_t)addr, len);
+    lock_release(as->as_lock);
+    return result;
+}
+
+
+/* Syscall implementation of madvise: int madvise(void *addr, size_t len, int advice). The only advice we act on is */
+/* MADV_DONTNEED, which unmaps the pages so their frames go back to the system right away (malloc uses it for big free */
+/* blocks). The next touch faults them in again zero filled, or from the file for private file mappings. Dropping pages */
+/* of a MAP_SHARED mapping would lose writes that haven't been written back, so that isn't allowed */
+int sys_madvise(userptr_t addr, size_t len, int advice){
+    struct addrspace *as = proc_getas();
+    if (as == NULL){
+        return EINVAL;
+    }
+
+    vaddr_t start = (vaddr_t)addr;
+    if ((start & ~(vaddr_t)PAGE_FRAME) != 0 || len > USERSPACETOP - start){
+        return EINVAL;
+    }
+    vaddr_t end = ROUNDUP(start + len, PAGE_SIZE);
+
+    switch (advice){
+        case MADV_NORMAL:
+        case MADV_RANDOM:
+        case MADV_SEQUENTIAL:
+        case MADV_WILLNEED:
+            /* hints only */
+            return 0;
+
+        case MADV_DONTNEED:
+            break;
+
+        default:
+            return EINVAL;
+    }
+
+    lock_acquire(as->as_lock);
+    for (unsigned i = 0; i < as->nregions; i++){
+        struct region *r = &as->regions[i];
+        if (r->shared && r->vbase < end && start < r->vbase + r->npages * PAGE_SIZE){
+            lock_release(as->as_lock);
+            return EINVAL;
+        }
+    }
+
+    int result = as_release(as, start, end);
+    lock_release(as->as_lock);
+    return result;
+}
@@ -0,0 +1,57 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <proc.h>
+#include <current.h>
+
+/* the limits the kernel does something with; the others can't be read or set */
+static bool rlimit_supported(int resource){
+    switch (resource){
+        case RLIMIT_STACK:
+        case RLIMIT_RSS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+int sys_getrlimit(int resource, userptr_t rlp){
+    struct rlimit rl;
+
+    if (!rlimit_supported(resource)){
+        return EINVAL;
+    }
+    spinlock_acquire(&curproc->p_lock);
+    rl = curproc->p_rlimit[resource];
+    spinlock_release(&curproc->p_lock);
+    return copyout(&rl, rlp, sizeof(rl));
+}
+
+/* The soft limit may be set anywhere up to the hard one, which can only be lowered (there are no privileged users) */
+int sys_setrlimit(int resource, userptr_t rlp){
+    struct rlimit rl;
+
+    if (!rlimit_supported(resource)){
+        return EINVAL;
+    }
+    int result = copyin(rlp, &rl, sizeof(rl));
+    if (result){
+        return result;
+    }
+    if (rl.rlim_cur > rl.rlim_max){
+        return EINVAL;
+    }
+
+    spinlock_acquire(&curproc->p_lock);
+    if (rl.rlim_max > curproc->p_rlimit[resource].rlim_max){
+        spinlock_release(&curproc->p_lock);
+        return EPERM;
+    }
+    curproc->p_rlimit[resource] = rl;
+    spinlock_release(&curproc->p_lock);
+    return 0;
+}
@@ -6,18 +6,15 @@
 #include <current.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <synch.h>
 
 
 
 /* Syscall implementation of subrk. Per the syscall manuals: sbrks functinoality is to adjust the size of the heap */
 /* It does not allocate any pages, and only adjusts the boundarys. The "break" is the end address of a process's heap region */
-/* the sbrk call adjusts the "break" by the amount "amount". It returns the old "break" */
-int sys_sbrk(intptr_t amount, int32_t *retval){
-    struct addrspace *as = proc_getas(); 
-    if (as == NULL){
-        return ENOMEM; 
-    }
-
+/* the sbrk call adjusts the "break" by the amount "amount". It returns the old "break". When the heap shrinks the */
+/* pages that are now entirely above the break are unmapped and their frames freed right away */
+static int sbrk_locked(struct addrspace *as, intptr_t amount, int32_t *retval){
     /* our return value is the old break value so save that before applying any further changes */ 
     *retval = as->heap_end; 
 
@@ -51,7 +48,33 @@ int sys_sbrk(intptr_t amount, int32_t *retval){
         return ENOMEM;
     }
 
+    /* or into the mmap() area, which sits below the stack */
+    if (new_end > as->mmap_low) {
+        return ENOMEM;
+    }
+
+    /* give back the pages past the new break (the page the break now falls in is still partly heap so it stays) */
+    if (new_end < old_end){
+        int result = as_release(as, ROUNDUP(new_end, PAGE_SIZE), ROUNDUP(old_end, PAGE_SIZE));
+        if (result){
+            return result;
+        }
+    }
+
     /* Now we update the heap end */
     as->heap_end = new_end; 
     return 0; 
 }
+
+int sys_sbrk(intptr_t amount, int32_t *retval){
+    struct addrspace *as = proc_getas(); 
+    if (as == NULL){
+        return ENOMEM; 
+    }
+
+    /* the other threads may be faulting on the heap or growing it too */
+    lock_acquire(as->as_lock);
+    int result = sbrk_locked(as, amount, retval);
+    lock_release(as->as_lock);
+    return result;
+}
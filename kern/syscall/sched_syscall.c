@@ -0,0 +1,128 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/sched.h>
+#include <kern/ioprio.h>
+#include <proc.h>
+#include <current.h>
+#include <thread.h>
+#include <spinlock.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+
+/* Finds the process a sched_*() call is about. pid 0 (or our own pid) means us, otherwise it has to be one */
+/* of our children: only we can reap those with waitpid, so they can't be destroyed while we look at them */
+static int affinity_proc(pid_t pid, struct proc **ret){
+    if (pid == 0 || pid == curproc->p_pid){
+        *ret = curproc;
+        return 0;
+    }
+
+    struct proc *p = proc_get(pid);
+    if (p == NULL || p->p_parent != curproc->p_pid){
+        return ESRCH;
+    }
+    *ret = p;
+    return 0;
+}
+
+/* Restricts every thread of the process to the cpus set in mask (bit N is cpu number N) */
+int sys_sched_setaffinity(pid_t pid, uint32_t mask){
+    struct proc *p;
+    int err = affinity_proc(pid, &p);
+    if (err){
+        return err;
+    }
+
+    /* the mask is checked the same way for each thread, so either all of them get it or none */
+    spinlock_acquire(&p->p_lock);
+    unsigned num = threadarray_num(&p->p_threads);
+    for (unsigned i = 0; i < num && !err; i++){
+        err = thread_setaffinity(threadarray_get(&p->p_threads, i), mask);
+    }
+    spinlock_release(&p->p_lock);
+    return err;
+}
+
+/* Copies the cpu mask of the process (of its first thread, they all get the same one) out to maskp */
+int sys_sched_getaffinity(pid_t pid, userptr_t maskp){
+    struct proc *p;
+    int err = affinity_proc(pid, &p);
+    if (err){
+        return err;
+    }
+
+    uint32_t mask;
+    spinlock_acquire(&p->p_lock);
+    if (threadarray_num(&p->p_threads) == 0){
+        /* it has exited, only the zombie proc is left */
+        spinlock_release(&p->p_lock);
+        return ESRCH;
+    }
+    mask = threadarray_get(&p->p_threads, 0)->t_cpumask;
+    spinlock_release(&p->p_lock);
+
+    return copyout(&mask, maskp, sizeof(mask));
+}
+
+/* Puts every thread of the process in the scheduling class *attrp describes, or none of them if it doesn't fit */
+int sys_sched_setattr(pid_t pid, userptr_t attrp){
+    struct sched_attr sa;
+    int err = copyin(attrp, &sa, sizeof(sa));
+    if (err){
+        return err;
+    }
+
+    struct proc *p;
+    err = affinity_proc(pid, &p);
+    if (err){
+        return err;
+    }
+    return thread_setsched_proc(p, &sa);
+}
+
+/* Copies the scheduling class of the process (of its first thread, as for the cpu mask) out to attrp */
+int sys_sched_getattr(pid_t pid, userptr_t attrp){
+    struct proc *p;
+    int err = affinity_proc(pid, &p);
+    if (err){
+        return err;
+    }
+
+    struct sched_attr sa;
+    spinlock_acquire(&p->p_lock);
+    if (threadarray_num(&p->p_threads) == 0){
+        spinlock_release(&p->p_lock);
+        return ESRCH;
+    }
+    thread_getsched(threadarray_get(&p->p_threads, 0), &sa);
+    spinlock_release(&p->p_lock);
+
+    return copyout(&sa, attrp, sizeof(sa));
+}
+
+/* Puts the process in I/O priority class ioprio; its requests already on a disk queue keep the class they went in with */
+int sys_ioprio_set(pid_t pid, int ioprio){
+    if (ioprio < 0 || ioprio >= IOPRIO_NCLASSES){
+        return EINVAL;
+    }
+
+    struct proc *p;
+    int err = affinity_proc(pid, &p);
+    if (err){
+        return err;
+    }
+    p->p_ioprio = ioprio;
+    return 0;
+}
+
+/* Returns the I/O priority class of the process in *retval */
+int sys_ioprio_get(pid_t pid, int32_t *retval){
+    struct proc *p;
+    int err = affinity_proc(pid, &p);
+    if (err){
+        return err;
+    }
+    *retval = p->p_ioprio;
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <kern/shm.h>
+#include <lib.h>
+#include <syscall.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <shm.h>
+
+
+/* Syscall implementations of the System V style shared memory calls. A segment (see shm.h) is named by a key that */
+/* unrelated processes agree on, shmget turns that into an id, and shmat maps the whole segment the way mmap does, */
+/* so a write by one process is seen by every other one that has it attached. There are no permissions to check */
+
+
+/* int shmget(int key, size_t size, int flags): the id of the segment for key, created if IPC_CREAT is set and there */
+/* is none (IPC_PRIVATE always makes a new one). size is rounded up to pages and can't be more than an existing one's */
+int sys_shmget(int key, size_t size, int flags, int *retval){
+    if (flags & ~(IPC_CREAT | IPC_EXCL | 0777)){
+        return EINVAL;
+    }
+    return shm_get(key, size, flags, retval);
+}
+
+/* void *shmat(int id, const void *addr, int flags): map the segment and return where. Like mmap's, addr is only a */
+/* hint and we ignore it */
+int sys_shmat(int id, userptr_t addr, int flags, int32_t *retval){
+    (void)addr;
+
+    if (flags & ~SHM_RDONLY){
+        return EINVAL;
+    }
+
+    struct addrspace *as = proc_getas();
+    if (as == NULL){
+        return EINVAL;
+    }
+
+    struct shmseg *seg;
+    int result = shm_lookup(id, &seg);
+    if (result){
+        return result;
+    }
+
+    int prot = PROT_READ | ((flags & SHM_RDONLY) ? 0 : PROT_WRITE);
+    vaddr_t va;
+    lock_acquire(as->as_lock);
+    result = as_mmap_shm(as, seg, prot, &va);
+    lock_release(as->as_lock);
+    shm_decref(seg);
+    if (result){
+        return result;
+    }
+
+    *retval = (int32_t)va;
+    return 0;
+}
+
+/* int shmdt(const void *addr): unmap the segment shmat put at addr. as_munmap drops the pages from every TLB */
+int sys_shmdt(userptr_t addr){
+    struct addrspace *as = proc_getas();
+    if (as == NULL){
+        return EINVAL;
+    }
+
+    lock_acquire(as->as_lock);
+    struct region *r = as_find_region(as, (vaddr_t)addr);
+    int result;
+    if (r == NULL || r->shm == NULL || r->vbase != (vaddr_t)addr){
+        result = EINVAL;
+    }
+    else {
+        result = as_munmap(as, r->vbase, r->npages * PAGE_SIZE);
+    }
+    lock_release(as->as_lock);
+    return result;
+}
+
+/* int shmctl(int id, int cmd): only IPC_RMID, which removes the id; attached processes keep the memory until shmdt */
+int sys_shmctl(int id, int cmd){
+    if (cmd != IPC_RMID){
+        return EINVAL;
+    }
+    return shm_remove(id);
+}
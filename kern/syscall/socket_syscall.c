@@ -0,0 +1,221 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/socket.h>
+#include <lib.h>
+#include <uio.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <uio_helper.h>
+#include <net.h>
+#include <syscall.h>
+
+
+/* Syscall implementations of the socket calls. A socket is a vnode made by the network layer (see net.h), so once */
+/* socket() has put it in the file table it's closed, dup'd and inherited across fork like any other file; these just */
+/* find the socket behind an fd and copy addresses in and out. Only AF_LNET datagram sockets exist */
+
+
+/* look up fd and make sure it's a socket. On success *filep holds a reference the caller must drop */
+static int socket_fd(int fd, struct open_file_handler **filep, struct socket **sop){
+    struct open_file_handler *file = file_table_get(curproc->file_table, fd);
+    if (file == NULL){
+        return EBADF;
+    }
+    struct socket *so = socket_get(file->file_vn);
+    if (so == NULL){
+        open_file_decref(file);
+        return ENOTSOCK;
+    }
+    *filep = file;
+    *sop = so;
+    return 0;
+}
+
+/* copy a user sockaddr of length len into *addr */
+static int socket_copyinaddr(userptr_t uaddr, socklen_t len, struct sockaddr_ln *addr){
+    if (len < (socklen_t)sizeof(*addr)){
+        return EINVAL;
+    }
+    return copyin(uaddr, addr, sizeof(*addr));
+}
+
+/* copy *addr out to a user sockaddr whose buffer length is in *ulenp, and store the real length there */
+static int socket_copyoutaddr(const struct sockaddr_ln *addr, userptr_t uaddr, userptr_t ulenp){
+    socklen_t len;
+    int result = copyin(ulenp, &len, sizeof(len));
+    if (result){
+        return result;
+    }
+    if (len < 0){
+        return EINVAL;
+    }
+    if (len > (socklen_t)sizeof(*addr)){
+        len = sizeof(*addr);
+    }
+    result = copyout(addr, uaddr, len);
+    if (result){
+        return result;
+    }
+    len = sizeof(*addr);
+    return copyout(&len, ulenp, sizeof(len));
+}
+
+
+/* int socket(int domain, int type, int protocol): make a socket and return an fd for it */
+int sys_socket(int domain, int type, int protocol, int *retval){
+    struct vnode *vn;
+    int result = socket_create(domain, type, protocol, &vn);
+    if (result){
+        return result;
+    }
+
+    struct open_file_handler *f = create_open_file(vn, O_RDWR);
+    if (f == NULL){
+        vfs_close(vn);
+        return ENOMEM;
+    }
+
+    struct file_table *ft = curproc->file_table;
+    int fd;
+    rwlock_acquire_write(ft->lock);
+    result = file_table_add(ft, f, &fd);
+    rwlock_release_write(ft->lock);
+    if (result){
+        open_file_destroy(f);
+        return result;
+    }
+
+    *retval = fd;
+    return 0;
+}
+
+/* int bind(int fd, const struct sockaddr *addr, socklen_t len) */
+int sys_bind(int fd, userptr_t uaddr, socklen_t len){
+    struct sockaddr_ln addr;
+    int result = socket_copyinaddr(uaddr, len, &addr);
+    if (result){
+        return result;
+    }
+
+    struct open_file_handler *file;
+    struct socket *so;
+    result = socket_fd(fd, &file, &so);
+    if (result){
+        return result;
+    }
+    result = socket_bind(so, &addr);
+    open_file_decref(file);
+    return result;
+}
+
+/* int connect(int fd, const struct sockaddr *addr, socklen_t len): for datagrams this only sets the default peer */
+int sys_connect(int fd, userptr_t uaddr, socklen_t len){
+    struct sockaddr_ln addr;
+    int result = socket_copyinaddr(uaddr, len, &addr);
+    if (result){
+        return result;
+    }
+
+    struct open_file_handler *file;
+    struct socket *so;
+    result = socket_fd(fd, &file, &so);
+    if (result){
+        return result;
+    }
+    result = socket_connect(so, &addr);
+    open_file_decref(file);
+    return result;
+}
+
+/* ssize_t sendto(int fd, const void *buf, size_t len, int flags, const struct sockaddr *to, socklen_t tolen) */
+/* to may be NULL on a connected socket. No flags are supported */
+int sys_sendto(int fd, userptr_t buf, size_t len, int flags, userptr_t uto, socklen_t tolen, int32_t *retval){
+    if (flags != 0){
+        return EINVAL;
+    }
+
+    struct sockaddr_ln to;
+    int result;
+    if (uto != NULL){
+        result = socket_copyinaddr(uto, tolen, &to);
+        if (result){
+            return result;
+        }
+    }
+
+    struct open_file_handler *file;
+    struct socket *so;
+    result = socket_fd(fd, &file, &so);
+    if (result){
+        return result;
+    }
+
+    struct iovec iov;
+    struct uio u;
+    uio_init(&u, &iov, buf, len, 0, UIO_WRITE);
+    result = socket_sendto(so, &u, uto != NULL ? &to : NULL);
+    open_file_decref(file);
+    if (result){
+        return result;
+    }
+
+    *retval = len;
+    return 0;
+}
+
+/* ssize_t recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *from, socklen_t *fromlen) */
+/* waits for one datagram; from (and fromlen) may be NULL */
+int sys_recvfrom(int fd, userptr_t buf, size_t len, int flags, userptr_t ufrom, userptr_t ufromlen, int32_t *retval){
+    if (flags != 0){
+        return EINVAL;
+    }
+
+    struct open_file_handler *file;
+    struct socket *so;
+    int result = socket_fd(fd, &file, &so);
+    if (result){
+        return result;
+    }
+
+    struct sockaddr_ln from;
+    struct iovec iov;
+    struct uio u;
+    uio_init(&u, &iov, buf, len, 0, UIO_READ);
+    result = socket_recvfrom(so, &u, ufrom != NULL ? &from : NULL);
+    open_file_decref(file);
+    if (result){
+        return result;
+    }
+
+    if (ufrom != NULL){
+        result = socket_copyoutaddr(&from, ufrom, ufromlen);
+        if (result){
+            return result;
+        }
+    }
+
+    *retval = len - u.uio_resid;
+    return 0;
+}
+
+/* int getsockname(int fd, struct sockaddr *addr, socklen_t *len) */
+int sys_getsockname(int fd, userptr_t uaddr, userptr_t ulenp){
+    struct open_file_handler *file;
+    struct socket *so;
+    int result = socket_fd(fd, &file, &so);
+    if (result){
+        return result;
+    }
+
+    struct sockaddr_ln addr;
+    socket_getname(so, &addr);
+    open_file_decref(file);
+    return socket_copyoutaddr(&addr, uaddr, ulenp);
+}
@@ -0,0 +1,226 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/limits.h>
+#include <kern/spawn.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <thread.h>
+#include <copyinout.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <file_table.h>
+#include <open_file_handler.h>
+#include <syscall.h>
+
+
+/*
+ * spawn: start a new process running the program at path with arguments argv, without fork's copy of the caller's
+ * address space that an execv would throw away straight after. The program is loaded into a fresh address space by
+ * the caller (so a bad path or a bad program is reported to it), and the child's only thread starts right in user
+ * mode. The child's file table is a copy of the caller's with the file actions done to it (see kern/spawn.h).
+ */
+
+/* What the child's thread needs to get to user mode */
+struct spawn_start {
+    userptr_t ss_argv;
+    vaddr_t ss_stackptr;
+    vaddr_t ss_entrypoint;
+};
+
+static void spawn_entry(void *data, unsigned long argc){
+    struct spawn_start ss = *(struct spawn_start *)data;
+    kfree(data);
+
+    as_activate();
+    enter_new_process(argc, ss.ss_argv, NULL, ss.ss_stackptr, ss.ss_entrypoint);
+}
+
+/* Puts f in slot fd of ft, closing whatever was there. The table is the child's and nobody else can see it yet */
+static int spawn_setfd(struct file_table *ft, int fd, struct open_file_handler *f){
+    struct open_file_handler *old;
+
+    rwlock_acquire_write(ft->lock);
+    int result = file_table_set(ft, fd, f, &old);
+    rwlock_release_write(ft->lock);
+    if (result){
+        return result;
+    }
+
+    if (old != NULL){
+        open_file_decref(old);
+    }
+    return 0;
+}
+
+/* Does one file action to the child's table */
+static int spawn_action(struct file_table *ft, struct spawn_action *sa){
+    struct open_file_handler *f;
+    int result;
+
+    if (sa->sa_fd < 0 || sa->sa_fd >= __OPEN_MAX){
+        return EBADF;
+    }
+
+    switch (sa->sa_op){
+        case SPAWN_OPEN: {
+            char kpath[__PATH_MAX];
+            result = copyinstr((const_userptr_t)sa->sa_path, kpath, sizeof(kpath), NULL);
+            if (result){
+                return result;
+            }
+
+            struct vnode *vn;
+            result = vfs_open(kpath, sa->sa_flags, sa->sa_mode, &vn);
+            if (result){
+                return result;
+            }
+            f = create_open_file(vn, sa->sa_flags);
+            if (f == NULL){
+                vfs_close(vn);
+                return ENOMEM;
+            }
+            result = spawn_setfd(ft, sa->sa_fd, f);
+            if (result){
+                open_file_destroy(f);
+            }
+            return result;
+        }
+
+        case SPAWN_CLOSE:
+            if (file_table_lookup(ft, sa->sa_fd) == NULL){
+                return EBADF;
+            }
+            return spawn_setfd(ft, sa->sa_fd, NULL);
+
+        case SPAWN_DUP2:
+            if (sa->sa_newfd < 0 || sa->sa_newfd >= __OPEN_MAX){
+                return EBADF;
+            }
+            f = file_table_lookup(ft, sa->sa_fd);
+            if (f == NULL){
+                return EBADF;
+            }
+            if (sa->sa_newfd == sa->sa_fd || file_table_lookup(ft, sa->sa_newfd) == f){
+                return 0;
+            }
+            open_file_incref(f);
+            result = spawn_setfd(ft, sa->sa_newfd, f);
+            if (result){
+                open_file_decref(f);
+            }
+            return result;
+    }
+    return EINVAL;
+}
+
+/* Returns the child's pid. The child is ours to waitpid for exactly as if we had forked it */
+int sys_spawn(userptr_t path, userptr_t argv, userptr_t actions, int nactions, pid_t *retval){
+    struct spawn_action *kactions = NULL;
+    int result;
+
+    if (path == NULL || argv == NULL){
+        return EFAULT;
+    }
+    if (nactions < 0 || nactions > SPAWN_ACTIONS_MAX){
+        return EINVAL;
+    }
+
+    /* 1. Copy everything in from the caller: path, actions, arguments */
+    char kpath[__PATH_MAX];
+    result = copyinstr((const_userptr_t)path, kpath, sizeof(kpath), NULL);
+    if (result){
+        return result;
+    }
+    if (kpath[0] == '\0'){
+        return EINVAL;
+    }
+
+    if (nactions > 0){
+        kactions = kmalloc_tagged(nactions * sizeof(*kactions), KM_PROC);
+        if (kactions == NULL){
+            return ENOMEM;
+        }
+        result = copyin(actions, kactions, nactions * sizeof(*kactions));
+        if (result){
+            kfree(kactions);
+            return result;
+        }
+    }
+
+    struct argblock ab;
+    result = copyin_args(argv, &ab);
+    if (result){
+        kfree(kactions);
+        return result;
+    }
+    int argc = ab.ab_argc;
+
+    /* 2. Load the program into the child's address space (just like execv, but we keep our own) */
+    struct addrspace *child_as;
+    vaddr_t entrypoint, stackptr;
+    userptr_t argv_userptr;
+    result = load_program(kpath, &ab, &child_as, &entrypoint, &stackptr, &argv_userptr);
+    argblock_free(&ab);
+    if (result){
+        kfree(kactions);
+        return result;
+    }
+
+    /* 3. The child itself. From here on proc_destroy cleans up whatever we've given it */
+    struct proc *child = proc_create(kpath);
+    if (child == NULL){
+        as_destroy(child_as);
+        kfree(kactions);
+        return ENOMEM;
+    }
+    child->p_addrspace = child_as;
+
+    spinlock_acquire(&curproc->p_lock);
+    if (curproc->p_cwd != NULL){
+        VOP_INCREF(curproc->p_cwd);
+        child->p_cwd = curproc->p_cwd;
+    }
+    child->p_ioprio = curproc->p_ioprio;
+    spinlock_release(&curproc->p_lock);
+
+    child->file_table = copy_file_table(curproc->file_table);
+    if (child->file_table == NULL){
+        proc_destroy(child);
+        kfree(kactions);
+        return ENOMEM;
+    }
+    for (int i = 0; i < nactions; i++){
+        result = spawn_action(child->file_table, &kactions[i]);
+        if (result){
+            proc_destroy(child);
+            kfree(kactions);
+            return result;
+        }
+    }
+    kfree(kactions);
+
+    proc_addchild(curproc, child);
+
+    /* 4. Start its thread. It goes straight to user mode at the program's entry point */
+    struct spawn_start *ss = kmalloc_tagged(sizeof(*ss), KM_PROC);
+    if (ss == NULL){
+        proc_destroy(child);
+        return ENOMEM;
+    }
+    ss->ss_argv = argv_userptr;
+    ss->ss_stackptr = stackptr;
+    ss->ss_entrypoint = entrypoint;
+
+    result = thread_fork(kpath, child, spawn_entry, ss, argc);
+    if (result){
+        kfree(ss);
+        proc_destroy(child);
+        return result;
+    }
+
+    *retval = child->p_pid;
+    return 0;
+}
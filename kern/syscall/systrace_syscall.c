@@ -0,0 +1,304 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/syscall.h>
+#include <kern/systrace.h>
+#include <lib.h>
+#include <clock.h>
+#include <mainbus.h>
+#include <proc.h>
+#include <current.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <copyinout.h>
+#include <systrace.h>
+#include <syscall.h>
+
+
+/*
+ * System call tracing (see kern/systrace.h). A process that has been traced once has a struct systrace from then on,
+ * until it's destroyed; turning tracing off only clears the flags, so syscall() can look at p_systrace without a lock
+ * and the records and counts are still there to read. Records go in a ring that drops the oldest when it's full, and
+ * the counts are kept by call number, so neither needs memory once tracing is on.
+ */
+
+/* records kept for systrace_read */
+#define SYSTRACE_NREC 128
+
+/* call numbers that get counts: all of them (see kern/syscall.h) */
+#define SYSTRACE_MAXCALL 160
+#if SYS_shmctl >= SYSTRACE_MAXCALL
+#error "SYSTRACE_MAXCALL is too small"
+#endif
+
+/* records systrace_read copies out at a time, through the stack */
+#define SYSTRACE_READMAX 16
+
+struct systrace {
+    struct spinlock st_lock;
+    struct wchan *st_wchan; /* readers waiting for records */
+    volatile unsigned st_flags; /* SYSTRACE_* */
+    bool st_exited; /* the process has made its last call */
+    unsigned st_head; /* oldest record */
+    unsigned st_count; /* records in the ring */
+    unsigned st_dropped; /* lost since the last read */
+    struct systrace_rec st_recs[SYSTRACE_NREC];
+    struct systrace_stat st_stats[SYSTRACE_MAXCALL]; /* by call number; ss_callno is filled in when copied out */
+};
+
+/* The process a call is about. pid 0 (or our own) means us, otherwise it has to be one of our children, which only */
+/* we can reap, so it stays there while we look at it (as in sched_syscall.c) */
+static int systrace_proc(pid_t pid, struct proc **ret){
+    if (pid == 0 || pid == curproc->p_pid){
+        *ret = curproc;
+        return 0;
+    }
+
+    struct proc *p = proc_get(pid);
+    if (p == NULL || p->p_parent != curproc->p_pid){
+        return ESRCH;
+    }
+    *ret = p;
+    return 0;
+}
+
+/* The process's tracing state, made on first use */
+static struct systrace *systrace_get(struct proc *p){
+    spinlock_acquire(&p->p_lock);
+    struct systrace *st = p->p_systrace;
+    spinlock_release(&p->p_lock);
+    if (st != NULL){
+        return st;
+    }
+
+    st = kmalloc(sizeof(*st));
+    if (st == NULL){
+        return NULL;
+    }
+    st->st_wchan = wchan_create("systrace");
+    if (st->st_wchan == NULL){
+        kfree(st);
+        return NULL;
+    }
+    spinlock_init(&st->st_lock);
+    st->st_flags = 0;
+    st->st_exited = false;
+    st->st_head = 0;
+    st->st_count = 0;
+    st->st_dropped = 0;
+    bzero(st->st_stats, sizeof(st->st_stats));
+
+    /* another thread of ours may have beaten us to it */
+    spinlock_acquire(&p->p_lock);
+    if (p->p_systrace == NULL){
+        p->p_systrace = st;
+        st = NULL;
+    }
+    struct systrace *ret = p->p_systrace;
+    spinlock_release(&p->p_lock);
+    if (st != NULL){
+        wchan_destroy(st->st_wchan);
+        spinlock_cleanup(&st->st_lock);
+        kfree(st);
+    }
+    return ret;
+}
+
+/* Only a process's own threads and its parent's look at p_systrace, and neither can be there once it's destroyed */
+void systrace_destroy(struct proc *p){
+    struct systrace *st = p->p_systrace;
+    if (st == NULL){
+        return;
+    }
+    p->p_systrace = NULL;
+    wchan_destroy(st->st_wchan);
+    spinlock_cleanup(&st->st_lock);
+    kfree(st);
+}
+
+void systrace_exit(struct proc *p){
+    struct systrace *st = p->p_systrace;
+    if (st == NULL){
+        return;
+    }
+    spinlock_acquire(&st->st_lock);
+    st->st_exited = true;
+    wchan_wakeall(st->st_wchan, &st->st_lock);
+    spinlock_release(&st->st_lock);
+}
+
+/* Histogram bucket for a call that took nsecs (see kern/systrace.h) */
+static unsigned systrace_bucket(uint32_t nsecs){
+    uint32_t usecs = nsecs / 1000;
+    unsigned b = 0;
+    while (usecs != 0 && b < SYSTRACE_NBUCKETS - 1){
+        usecs >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void systrace_record(struct systrace *st, int callno, const uint32_t args[4], int32_t retval, int err,
+                     uint64_t start){
+    unsigned flags = st->st_flags;
+    if (flags == 0){
+        return;
+    }
+
+    /* work out the time before taking the lock, it's a division */
+    struct timespec ts;
+    cycles_to_timespec(mainbus_cycles() - start, &ts);
+    uint64_t ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    uint32_t nsecs = ns > 0xffffffff ? 0xffffffff : (uint32_t)ns;
+
+    spinlock_acquire(&st->st_lock);
+    if (flags & SYSTRACE_RECORDS){
+        struct systrace_rec *sr;
+        if (st->st_count == SYSTRACE_NREC){
+            /* full, the oldest goes */
+            sr = &st->st_recs[st->st_head];
+            st->st_head = (st->st_head + 1) % SYSTRACE_NREC;
+            st->st_dropped++;
+        }
+        else {
+            sr = &st->st_recs[(st->st_head + st->st_count) % SYSTRACE_NREC];
+            st->st_count++;
+        }
+        sr->sr_callno = callno;
+        memcpy(sr->sr_args, args, sizeof(sr->sr_args));
+        sr->sr_retval = err ? -1 : retval;
+        sr->sr_err = err;
+        sr->sr_nsecs = nsecs;
+        /* readers only wait while there's nothing */
+        if (st->st_count == 1){
+            wchan_wakeall(st->st_wchan, &st->st_lock);
+        }
+    }
+    if ((flags & SYSTRACE_STATS) && callno >= 0 && callno < SYSTRACE_MAXCALL){
+        struct systrace_stat *ss = &st->st_stats[callno];
+        ss->ss_count++;
+        if (err){
+            ss->ss_errors++;
+        }
+        if (nsecs > ss->ss_maxns){
+            ss->ss_maxns = nsecs;
+        }
+        ss->ss_totalns += nsecs;
+        ss->ss_hist[systrace_bucket(nsecs)]++;
+    }
+    spinlock_release(&st->st_lock);
+}
+
+
+/* int systrace(pid_t pid, int flags): set the tracing flags of the process pid (see kern/systrace.h) */
+int sys_systrace(pid_t pid, int flags){
+    if (flags & ~(SYSTRACE_RECORDS | SYSTRACE_STATS)){
+        return EINVAL;
+    }
+
+    struct proc *p;
+    int err = systrace_proc(pid, &p);
+    if (err){
+        return err;
+    }
+
+    /* turning it off for a process that never had it is nothing to do */
+    if (flags == 0 && p->p_systrace == NULL){
+        return 0;
+    }
+    struct systrace *st = systrace_get(p);
+    if (st == NULL){
+        return ENOMEM;
+    }
+    spinlock_acquire(&st->st_lock);
+    st->st_flags = flags;
+    spinlock_release(&st->st_lock);
+    return 0;
+}
+
+/* int systrace_read(pid_t pid, struct systrace_rec *buf, unsigned nrecs): take up to nrecs records, oldest first, */
+/* waiting for there to be one; returns how many, which is 0 only when the process has exited and they're all read */
+int sys_systrace_read(pid_t pid, userptr_t buf, unsigned nrecs, int32_t *retval){
+    if (nrecs == 0){
+        return EINVAL;
+    }
+
+    struct proc *p;
+    int err = systrace_proc(pid, &p);
+    if (err){
+        return err;
+    }
+    struct systrace *st = p->p_systrace;
+    if (st == NULL){
+        return EINVAL;
+    }
+
+    struct systrace_rec recs[SYSTRACE_READMAX];
+    unsigned n = 0;
+    if (nrecs > SYSTRACE_READMAX){
+        nrecs = SYSTRACE_READMAX;
+    }
+
+    spinlock_acquire(&st->st_lock);
+    while (st->st_count == 0 && st->st_dropped == 0 && !st->st_exited){
+        wchan_sleep(st->st_wchan, &st->st_lock);
+    }
+    if (st->st_dropped > 0){
+        bzero(&recs[0], sizeof(recs[0]));
+        recs[0].sr_callno = SYSTRACE_DROPPED;
+        recs[0].sr_retval = st->st_dropped;
+        st->st_dropped = 0;
+        n++;
+    }
+    while (n < nrecs && st->st_count > 0){
+        recs[n++] = st->st_recs[st->st_head];
+        st->st_head = (st->st_head + 1) % SYSTRACE_NREC;
+        st->st_count--;
+    }
+    spinlock_release(&st->st_lock);
+
+    if (n > 0){
+        err = copyout(recs, buf, n * sizeof(recs[0]));
+        if (err){
+            return err;
+        }
+    }
+    *retval = n;
+    return 0;
+}
+
+/* int systrace_stats(pid_t pid, struct systrace_stat *buf, unsigned max): copy out the counts of up to max call */
+/* numbers that have been made, lowest first, and return how many there are, so a caller can pass 0 to find out */
+int sys_systrace_stats(pid_t pid, userptr_t buf, unsigned max, int32_t *retval){
+    struct proc *p;
+    int err = systrace_proc(pid, &p);
+    if (err){
+        return err;
+    }
+    struct systrace *st = p->p_systrace;
+    if (st == NULL){
+        return EINVAL;
+    }
+
+    /* one at a time, so the big array doesn't have to be copied anywhere first */
+    unsigned n = 0;
+    for (unsigned i = 0; i < SYSTRACE_MAXCALL; i++){
+        struct systrace_stat ss;
+        spinlock_acquire(&st->st_lock);
+        ss = st->st_stats[i];
+        spinlock_release(&st->st_lock);
+        if (ss.ss_count == 0){
+            continue;
+        }
+        if (n < max){
+            ss.ss_callno = i;
+            err = copyout(&ss, (userptr_t)((struct systrace_stat *)buf + n), sizeof(ss));
+            if (err){
+                return err;
+            }
+        }
+        n++;
+    }
+
+    *retval = n;
+    return 0;
+}
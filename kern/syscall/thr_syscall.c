@@ -0,0 +1,298 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <kern/wait.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <copyinout.h>
+#include <futex.h>
+#include <aio.h>
+#include <poll.h>
+#include <uthread.h>
+#include <syscall.h>
+
+
+/*
+ * User threads (see uthread.h). __thr_create starts a new thread in the calling process at ENTRY, with FUNC and ARG
+ * as its first two arguments and a stack of its own; libc's thr_create passes a small start routine as ENTRY that
+ * calls FUNC(ARG) and then thr_exit with what it returns. thr_exit leaves the value for thr_join, which waits for the
+ * thread with that id and collects it. The process ends (with status 0) when its last thread calls thr_exit, and
+ * right away when any of them calls _exit.
+ *
+ * A thread's stack pages are freed as soon as it exits, but the stack range stays mapped, and once the thread is
+ * joined its record goes on p_thrfree so the next thread made gets the stack without another mmap.
+ */
+
+/* What a new thread needs to get to user mode */
+struct thr_start {
+    struct uthread *ts_ut;
+    vaddr_t ts_entry;
+    userptr_t ts_func;
+    userptr_t ts_arg;
+};
+
+/* Our own record, or NULL for the first thread of the process. Call with p_thrlock held */
+static struct uthread *thr_self(struct proc *p){
+    for (struct uthread *ut = p->p_uthreads; ut != NULL; ut = ut->ut_next){
+        if (ut->ut_thread == curthread){
+            return ut;
+        }
+    }
+    return NULL;
+}
+
+/* Takes UT off p_uthreads. Call with p_thrlock held */
+static void thr_unlink(struct proc *p, struct uthread *ut){
+    struct uthread **utp = &p->p_uthreads;
+    while (*utp != ut){
+        KASSERT(*utp != NULL);
+        utp = &(*utp)->ut_next;
+    }
+    *utp = ut->ut_next;
+}
+
+static void thr_freelist(struct uthread *ut){
+    while (ut != NULL){
+        struct uthread *next = ut->ut_next;
+        kfree(ut);
+        ut = next;
+    }
+}
+
+static void thr_entry(void *data, unsigned long unused){
+    struct thr_start ts = *(struct thr_start *)data;
+    struct proc *p = curproc;
+
+    (void)unused;
+    kfree(data);
+
+    lock_acquire(p->p_thrlock);
+    ts.ts_ut->ut_thread = curthread;
+    lock_release(p->p_thrlock);
+    if (p->p_thrkill){
+        thr_leave();
+    }
+
+    /* the start routine gets FUNC and ARG in a0 and a1, and the argument save area the ABI wants above sp */
+    as_activate();
+    enter_new_process((int)ts.ts_func, ts.ts_arg, NULL, ts.ts_ut->ut_stack + THR_STACKSIZE - 16, ts.ts_entry);
+}
+
+/* curthread leaves the process, leaving VALUE for thr_join. The last thread out ends the process */
+static __DEAD void thr_depart(userptr_t value){
+    struct proc *p = curproc;
+
+    lock_acquire(p->p_thrlock);
+    struct uthread *ut = thr_self(p);
+    lock_release(p->p_thrlock);
+
+    /* our stack's pages can go now (nobody else should be using them); the range stays mapped for the next owner */
+    if (ut != NULL){
+        struct addrspace *as = proc_getas();
+        lock_acquire(as->as_lock);
+        /* if that fails (out of memory) the pages just stay until the process goes */
+        (void)as_release(as, ut->ut_stack, ut->ut_stack + THR_STACKSIZE);
+        lock_release(as->as_lock);
+    }
+
+    lock_acquire(p->p_thrlock);
+    if (p->p_nthr == 1 && !p->p_thrkill){
+        /* the last one: same as returning from main */
+        lock_release(p->p_thrlock);
+        exit_process(_MKWAIT_EXIT(0));
+    }
+    if (ut != NULL){
+        ut->ut_thread = NULL;
+        ut->ut_value = value;
+        ut->ut_exited = true;
+    }
+    p->p_nthr--;
+    cv_broadcast(p->p_thrcv, p->p_thrlock);
+    lock_release(p->p_thrlock);
+
+    thread_exit();
+}
+
+void thr_leave(void){
+    thr_depart(NULL);
+}
+
+bool thr_killothers(struct proc *p){
+    lock_acquire(p->p_thrlock);
+    if (p->p_thrkill){
+        lock_release(p->p_thrlock);
+        return false;
+    }
+    if (p->p_nthr == 1){
+        /* the usual case, we're alone */
+        lock_release(p->p_thrlock);
+        return true;
+    }
+
+    /* those asleep in thr_join see the flag under p_thrlock, the others under their own locks (see uthread.h) */
+    p->p_thrkill = true;
+    cv_broadcast(p->p_thrcv, p->p_thrlock);
+    lock_release(p->p_thrlock);
+    futex_killproc(p);
+    aio_killproc(p);
+    poll_killproc(p);
+    proc_wakewaiters(p);
+
+    lock_acquire(p->p_thrlock);
+    while (p->p_nthr > 1){
+        cv_wait(p->p_thrcv, p->p_thrlock);
+    }
+    lock_release(p->p_thrlock);
+    return true;
+}
+
+void thr_reset(struct proc *p){
+    lock_acquire(p->p_thrlock);
+    KASSERT(p->p_nthr == 1);
+    thr_freelist(p->p_uthreads);
+    thr_freelist(p->p_thrfree);
+    p->p_uthreads = NULL;
+    p->p_thrfree = NULL;
+    p->p_thrkill = false;
+    lock_release(p->p_thrlock);
+}
+
+void thr_forget(struct proc *p){
+    thr_freelist(p->p_uthreads);
+    thr_freelist(p->p_thrfree);
+    p->p_uthreads = NULL;
+    p->p_thrfree = NULL;
+}
+
+/* Returns the new thread's id */
+int sys___thr_create(userptr_t entry, userptr_t func, userptr_t arg, int32_t *retval){
+    struct proc *p = curproc;
+    struct addrspace *as = proc_getas();
+    int result;
+
+    if (entry == NULL || (vaddr_t)entry >= USERSPACETOP){
+        return EFAULT;
+    }
+
+    struct thr_start *ts = kmalloc_tagged(sizeof(*ts), KM_PROC);
+    if (ts == NULL){
+        return ENOMEM;
+    }
+
+    /* a record with a stack: a joined thread's if there is one, else a new one */
+    lock_acquire(p->p_thrlock);
+    struct uthread *ut = p->p_thrfree;
+    if (ut != NULL){
+        p->p_thrfree = ut->ut_next;
+    }
+    lock_release(p->p_thrlock);
+
+    if (ut == NULL){
+        ut = kmalloc_tagged(sizeof(*ut), KM_PROC);
+        if (ut == NULL){
+            kfree(ts);
+            return ENOMEM;
+        }
+        lock_acquire(as->as_lock);
+        result = as_mmap(as, THR_STACKSIZE, PROT_READ | PROT_WRITE, false, NULL, 0, 0, &ut->ut_stack);
+        lock_release(as->as_lock);
+        if (result){
+            kfree(ut);
+            kfree(ts);
+            return result;
+        }
+    }
+
+    lock_acquire(p->p_thrlock);
+    if (p->p_thrkill){
+        /* the process is going away (or exec'ing) */
+        ut->ut_next = p->p_thrfree;
+        p->p_thrfree = ut;
+        lock_release(p->p_thrlock);
+        kfree(ts);
+        return EINTR;
+    }
+    int tid = p->p_nexttid++;
+    ut->ut_tid = tid;
+    ut->ut_thread = NULL;
+    ut->ut_exited = false;
+    ut->ut_joining = false;
+    ut->ut_value = NULL;
+    ut->ut_next = p->p_uthreads;
+    p->p_uthreads = ut;
+    p->p_nthr++;
+    lock_release(p->p_thrlock);
+
+    ts->ts_ut = ut;
+    ts->ts_entry = (vaddr_t)entry;
+    ts->ts_func = func;
+    ts->ts_arg = arg;
+
+    result = thread_fork(p->p_name, p, thr_entry, ts, 0);
+    if (result){
+        lock_acquire(p->p_thrlock);
+        thr_unlink(p, ut);
+        ut->ut_next = p->p_thrfree;
+        p->p_thrfree = ut;
+        p->p_nthr--;
+        cv_broadcast(p->p_thrcv, p->p_thrlock);
+        lock_release(p->p_thrlock);
+        kfree(ts);
+        return result;
+    }
+
+    /* (not ut->ut_tid: the thread may already be gone and its record reused) */
+    *retval = tid;
+    return 0;
+}
+
+void sys_thr_exit(userptr_t value){
+    thr_depart(value);
+}
+
+/* Waits for thread TID of our process to exit and stores what it passed to thr_exit at VALUEP (unless NULL) */
+int sys_thr_join(int tid, userptr_t valuep){
+    struct proc *p = curproc;
+    struct uthread *ut;
+
+    lock_acquire(p->p_thrlock);
+    for (ut = p->p_uthreads; ut != NULL && ut->ut_tid != tid; ut = ut->ut_next){
+        /* nothing */
+    }
+    if (ut == NULL){
+        lock_release(p->p_thrlock);
+        return ESRCH;
+    }
+    if (ut->ut_thread == curthread || ut->ut_joining){
+        lock_release(p->p_thrlock);
+        return EINVAL;
+    }
+
+    ut->ut_joining = true;
+    while (!ut->ut_exited && !p->p_thrkill){
+        cv_wait(p->p_thrcv, p->p_thrlock);
+    }
+    if (!ut->ut_exited){
+        /* another thread is making the process exit or exec, we're about to leave */
+        ut->ut_joining = false;
+        lock_release(p->p_thrlock);
+        return EINTR;
+    }
+
+    /* collected: its record (and stack) is free for the next thr_create */
+    userptr_t value = ut->ut_value;
+    thr_unlink(p, ut);
+    ut->ut_next = p->p_thrfree;
+    p->p_thrfree = ut;
+    lock_release(p->p_thrlock);
+
+    if (valuep != NULL){
+        return copyout(&value, valuep, sizeof(value));
+    }
+    return 0;
+}
@@ -28,12 +28,15 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
+#include <timer.h>
 
 /*
- * Example system call: get the time of day.
+ * Example system call: get the time of day. This reads the kernel's
+ * clock (see clock.c) rather than the clock device.
  */
 int
 sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
@@ -41,7 +44,7 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 	struct timespec ts;
 	int result;
 
-	gettime(&ts);
+	getclocktime(&ts);
 
 	result = copyout(&ts.tv_sec, user_seconds_ptr, sizeof(ts.tv_sec));
 	if (result) {
@@ -56,3 +59,35 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time in *REQ, rounded up to whole clock ticks. Nothing
+ * cuts a sleep short (there are no signals), so if REM isn't NULL the
+ * time left is always zero.
+ */
+int
+sys_nanosleep(userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	int result;
+
+	result = copyin(user_req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	clocksleep_ticks(timer_ticks(&ts));
+
+	if (user_rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, user_rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
@@ -8,47 +8,56 @@
 #include <copyinout.h>
 #include <syscall.h>
 
-/* Waits for a specific child process to terminate, retrieves its exit status and then cleans up the childs resources */
+/* 
+ * Waits for a child process to terminate, retrieves its exit status and then cleans up the childs resources. PID is a
+ * specific child or -1 for any of them. With WNOHANG we don't wait: if no child (that we'd wait for) has exited yet
+ * we return 0.
+ */
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval){
     
-    /* optinos is not supported so we will just make sure its set to 0 */
-    if (options != 0){
+    /* WNOHANG is the only option we support */
+    if ((options & ~WNOHANG) != 0){
         return EINVAL;
     }
-
-    /* get a pointer to the child process */
-    struct proc *child = proc_get(pid); 
-    if (child == NULL){
-        return ESRCH; 
+    if (pid != WAIT_ANY && pid <= 0){
+        /* no process groups */
+        return EINVAL;
     }
 
-    /* confirm that the cur proc (calling process) is in fact the parent of the process we're waiting for */
-    if (child->p_parent != curproc->p_pid){
-        return ECHILD; 
+    /* find (and take) an exited child; our children tell us on our own cv when they exit, so this is one wakeup each */
+    struct proc *child;
+    int result = proc_waitchild(curproc, pid, (options & WNOHANG) != 0, &child);
+    if (result){
+        return result;
     }
-
-    /* acquire the childs wait lock before waiting on exit status. _exit() uses the same lock so this prevents any cases that could lead to incorrect behaviour */
-    lock_acquire(child->p_waitlock);
-
-    /* We wait until the child has called _exit(). cv_wait will realese the lock while sleeping and then reacquire before returning */
-    while (!child->p_exited){
-        cv_wait(child->p_waitcv, child->p_waitlock); 
+    if (child == NULL){
+        /* WNOHANG and nobody's done yet */
+        *retval = 0;
+        return 0;
     }
 
-    /* child has exited */
+    /* child has exited, its thread may still be on its way out */
+    proc_waitthreads(child);
     int exitcode = child->p_exitcode; 
-    lock_release(child->p_waitlock); 
+    pid = child->p_pid;
 
-    /* copy the exit code to user space. If status is null we skip this step */
+    /* copy the exit code to user space. If status is null we skip this step. (It's reaped either way, we've taken it) */
+    int err = 0;
     if (status != NULL){
-        int err = copyout(&exitcode, status, sizeof(int));
-        if (err){
-            return err; 
-        }
+        err = copyout(&exitcode, status, sizeof(int));
     }
 
-    /* child process ahs now been fullly reaped so we call destoroy */
-    proc_destroy(child);
+    /* child process ahs now been fullly reaped so the reaper destroys it, its VM counters and CPU time count towards ours first */
+    vmstats_add(&curproc->p_childstats, &child->p_vmstats);
+    vmstats_add(&curproc->p_childstats, &child->p_childstats);
+    struct cputimes ct;
+    proc_gettimes(child, &ct);
+    cputimes_add(&curproc->p_childtimes, &ct);
+    cputimes_add(&curproc->p_childtimes, &child->p_childtimes);
+    proc_destroy_later(child);
+    if (err){
+        return err; 
+    }
 
     *retval = pid; /* retval is the pid of the child */
     return 0; 
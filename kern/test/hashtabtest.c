@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <hashtab.h>
+#include <test.h>
+
+#define TESTSIZE 300
+
+struct hthing {
+	int key;
+	char name[16];
+};
+
+DECLHASH(hthing, static __UNUSED inline);
+DEFHASH(hthing, static __UNUSED inline);
+
+static
+void
+testh(struct hthinghash *h, struct hthing *things)
+{
+	struct hashtab_iter it;
+	struct hthing *t;
+	unsigned n;
+	int i, r;
+
+	n = hthinghash_num(h);
+	KASSERT(n==0);
+
+	/* integer keys */
+	for (i=0; i<TESTSIZE; i++) {
+		r = hthinghash_add(h, &things[i].key, sizeof(int), &things[i]);
+		KASSERT(r==0);
+		n = hthinghash_num(h);
+		KASSERT(n==(unsigned)i+1);
+	}
+	for (i=0; i<TESTSIZE; i++) {
+		r = hthinghash_add(h, &things[i].key, sizeof(int), &things[i]);
+		KASSERT(r==EEXIST);
+	}
+	for (i=0; i<TESTSIZE*4; i++) {
+		int k = random()%(TESTSIZE*2);
+		t = hthinghash_get(h, &k, sizeof(k));
+		if (k < TESTSIZE) {
+			KASSERT(t == &things[k]);
+		}
+		else {
+			KASSERT(t == NULL);
+		}
+	}
+
+	/* every entry comes out of the iterator exactly once */
+	for (i=0; i<TESTSIZE; i++) {
+		things[i].name[15] = 0;
+	}
+	hthinghash_iter_init(&it, h);
+	n = 0;
+	while ((t = hthinghash_iter_next(&it)) != NULL) {
+		KASSERT(t->name[15] == 0);
+		t->name[15] = 1;
+		n++;
+	}
+	KASSERT(n==TESTSIZE);
+
+	/* remove the odd ones */
+	for (i=1; i<TESTSIZE; i+=2) {
+		t = hthinghash_remove(h, &i, sizeof(i));
+		KASSERT(t == &things[i]);
+		t = hthinghash_remove(h, &i, sizeof(i));
+		KASSERT(t == NULL);
+	}
+	n = hthinghash_num(h);
+	KASSERT(n==TESTSIZE/2);
+	for (i=0; i<TESTSIZE; i++) {
+		t = hthinghash_get(h, &i, sizeof(i));
+		KASSERT(t == (i%2 ? NULL : &things[i]));
+	}
+
+	/* remove the rest while iterating */
+	hthinghash_iter_init(&it, h);
+	while ((t = hthinghash_iter_next(&it)) != NULL) {
+		KASSERT(t->key % 2 == 0);
+		hthinghash_remove(h, &t->key, sizeof(int));
+	}
+	n = hthinghash_num(h);
+	KASSERT(n==0);
+
+	/* string keys, of different lengths */
+	for (i=0; i<TESTSIZE; i++) {
+		r = hthinghash_add(h, things[i].name, strlen(things[i].name),
+				   &things[i]);
+		KASSERT(r==0);
+	}
+	for (i=0; i<TESTSIZE; i++) {
+		t = hthinghash_get(h, things[i].name, strlen(things[i].name));
+		KASSERT(t == &things[i]);
+		/* a prefix of a key isn't the key */
+		t = hthinghash_get(h, things[i].name,
+				   strlen(things[i].name) - 1);
+		KASSERT(t != &things[i]);
+	}
+	for (i=0; i<TESTSIZE; i++) {
+		t = hthinghash_remove(h, things[i].name,
+				      strlen(things[i].name));
+		KASSERT(t == &things[i]);
+	}
+	n = hthinghash_num(h);
+	KASSERT(n==0);
+}
+
+int
+hashtabtest(int nargs, char **args)
+{
+	struct hthinghash *h;
+	struct hthing *things;
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Beginning hash table test...\n");
+
+	things = kmalloc(TESTSIZE * sizeof(*things));
+	KASSERT(things != NULL);
+	for (i=0; i<TESTSIZE; i++) {
+		things[i].key = i;
+		snprintf(things[i].name, sizeof(things[i].name), "thing-%d", i);
+	}
+
+	h = hthinghash_create();
+	KASSERT(h != NULL);
+
+	testh(h, things);
+	testh(h, things);
+
+	hthinghash_destroy(h);
+	kfree(things);
+
+	kprintf("Hash table test complete\n");
+	return 0;
+}
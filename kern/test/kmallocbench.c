@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * kmalloc benchmarks. kmalloctest.c checks that kmalloc works; these
+ * measure how fast it is and how well it packs.
+ *
+ *    kb1 [loops]   allocations per second for each size class, in one
+ *                  thread and then in one thread per cpu at once. Each
+ *                  loop allocates KB_BATCH blocks and frees them again.
+ *    kb2 [rounds]  fragmentation: allocate KB_NOBJS blocks of random
+ *                  sizes, then ROUNDS times free a random one and
+ *                  allocate another, and print how much of the
+ *                  subpage allocator's memory is free in pages that
+ *                  are partly in use (kheap_printfrag) along the way.
+ *
+ * As in synchbench.c, thread N runs on cpu N mod the number of cpus
+ * and the menu thread waits on cpu 0, where the time is taken.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <mainbus.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <vm.h> /* for PAGE_SIZE */
+#include <test.h>
+
+#define KB_LOOPS	2000
+#define KB_BATCH	16
+#define KB_ROUNDS	20000
+#define KB_NOBJS	1000
+#define KB_MAXSIZE	2048
+
+static const size_t kb_sizes[] = {
+	16, 32, 64, 128, 256, 512, 1024, 2048, PAGE_SIZE
+};
+#define KB_NSIZES (sizeof(kb_sizes) / sizeof(kb_sizes[0]))
+
+static struct semaphore *kb_ready;
+static struct semaphore *kb_done;
+static volatile bool kb_go;
+static unsigned kb_loops;
+static size_t kb_size;
+
+static
+void
+kb_init(void)
+{
+	if (kb_ready == NULL) {
+		kb_ready = sem_create("kb_ready", 0);
+		kb_done = sem_create("kb_done", 0);
+		if (kb_ready == NULL || kb_done == NULL) {
+			panic("kmallocbench: Out of memory\n");
+		}
+	}
+}
+
+static
+void
+kb_pin(unsigned long num)
+{
+	thread_setaffinity(curthread, 1U << (num % thread_numcpus()));
+	thread_yield();
+}
+
+static
+uint64_t
+kb_ns(uint64_t cycles)
+{
+	struct timespec ts;
+
+	cycles_to_timespec(cycles, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* allocate and free kb_size blocks kb_loops times */
+static
+void
+kb_churn(void)
+{
+	void *ptrs[KB_BATCH];
+	unsigned i, j;
+
+	for (i=0; i<kb_loops; i++) {
+		for (j=0; j<KB_BATCH; j++) {
+			ptrs[j] = kmalloc(kb_size);
+			if (ptrs[j] == NULL) {
+				panic("kmallocbench: kmalloc(%zu) failed\n",
+				      kb_size);
+			}
+		}
+		for (j=0; j<KB_BATCH; j++) {
+			kfree(ptrs[j]);
+		}
+	}
+}
+
+static
+void
+kb_thread(void *junk, unsigned long num)
+{
+	(void)junk;
+
+	kb_pin(num);
+	V(kb_ready);
+	while (!kb_go) {
+		thread_yield();
+	}
+	kb_churn();
+	V(kb_done);
+}
+
+/* run kb_churn in NTHREADS threads at once; returns the time in ns */
+static
+uint64_t
+kb_run(unsigned nthreads)
+{
+	uint64_t start;
+	unsigned i;
+	int result;
+
+	kb_go = false;
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("kmallocbench", NULL, kb_thread, NULL, i);
+		if (result) {
+			panic("kmallocbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(kb_ready);
+	}
+	start = mainbus_cycles();
+	kb_go = true;
+	for (i=0; i<nthreads; i++) {
+		P(kb_done);
+	}
+	return kb_ns(mainbus_cycles() - start);
+}
+
+/* allocations per second */
+static
+unsigned long
+kb_rate(unsigned nallocs, uint64_t ns)
+{
+	return (unsigned long)(nallocs * 1000000000ULL / (ns > 0 ? ns : 1));
+}
+
+int
+kmallocbench(int nargs, char **args)
+{
+	uint32_t oldmask;
+	unsigned ncpus, nallocs, i;
+	uint64_t ns1, nsn;
+	unsigned long rate1, raten;
+
+	kb_init();
+	kb_loops = nargs > 1 ? (unsigned)atoi(args[1]) : KB_LOOPS;
+	ncpus = thread_numcpus();
+	nallocs = kb_loops * KB_BATCH;
+
+	oldmask = curthread->t_cpumask;
+	kb_pin(0);
+
+	kprintf("kmalloc and kfree, %u per size and thread\n", nallocs);
+	kprintf("size   1 cpu ns/op  1 cpu allocs/s  %2u cpus allocs/s  "
+		"speedup\n", ncpus);
+	for (i=0; i<KB_NSIZES; i++) {
+		kb_size = kb_sizes[i];
+		ns1 = kb_run(1);
+		nsn = kb_run(ncpus);
+		rate1 = kb_rate(nallocs, ns1);
+		raten = kb_rate(nallocs * ncpus, nsn);
+		kprintf("%-5lu  %11llu  %14lu  %16lu  %4lu.%02lu\n",
+			(unsigned long)kb_size,
+			(unsigned long long)(ns1 / nallocs), rate1, raten,
+			raten / rate1, raten * 100 / rate1 % 100);
+	}
+
+	thread_setaffinity(curthread, oldmask);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// kb2
+
+/* a random size up to KB_MAXSIZE, most of them small like the kernel's */
+static
+size_t
+kb_randsize(void)
+{
+	uint32_t r;
+
+	r = random();
+	return ((r % KB_MAXSIZE) >> (r / KB_MAXSIZE % 4 * 2)) + 1;
+}
+
+int
+kmallocfrag(int nargs, char **args)
+{
+	void **ptrs;
+	unsigned rounds, i, slot;
+
+	rounds = nargs > 1 ? (unsigned)atoi(args[1]) : KB_ROUNDS;
+
+	ptrs = kmalloc(KB_NOBJS * sizeof(*ptrs));
+	if (ptrs == NULL) {
+		panic("kmallocfrag: Out of memory\n");
+	}
+
+	kprintf("Before:\n");
+	kheap_printfrag();
+
+	for (i=0; i<KB_NOBJS; i++) {
+		ptrs[i] = kmalloc(kb_randsize());
+		if (ptrs[i] == NULL) {
+			panic("kmallocfrag: kmalloc failed\n");
+		}
+	}
+	kprintf("\n%u blocks allocated:\n", KB_NOBJS);
+	kheap_printfrag();
+
+	for (i=0; i<rounds; i++) {
+		slot = random() % KB_NOBJS;
+		kfree(ptrs[slot]);
+		ptrs[slot] = kmalloc(kb_randsize());
+		if (ptrs[slot] == NULL) {
+			panic("kmallocfrag: kmalloc failed\n");
+		}
+	}
+	kprintf("\nAfter %u rounds of churn:\n", rounds);
+	kheap_printfrag();
+
+	for (i=0; i<KB_NOBJS; i+=2) {
+		kfree(ptrs[i]);
+		ptrs[i] = NULL;
+	}
+	kprintf("\nWith every other block freed:\n");
+	kheap_printfrag();
+
+	for (i=1; i<KB_NOBJS; i+=2) {
+		kfree(ptrs[i]);
+	}
+	kfree(ptrs);
+	kprintf("\nAll freed:\n");
+	kheap_printfrag();
+	return 0;
+}
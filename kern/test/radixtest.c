@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <radix.h>
+#include <test.h>
+
+#define TESTSIZE 200
+
+DECLRADIX_BYTYPE(intradix, int, static __UNUSED inline);
+DEFRADIX_BYTYPE(intradix, int, static __UNUSED inline);
+
+/* Indexes spread out so every tree height gets used. */
+static
+uint32_t
+testindex(int i)
+{
+	return (uint32_t)i * 21474836U + (uint32_t)i;
+}
+
+static
+void
+testr(struct intradix *r)
+{
+	int testarray[TESTSIZE];
+	uint32_t idx, prev;
+	unsigned n;
+	int i, res, *p;
+
+	for (i=0; i<TESTSIZE; i++) {
+		testarray[i]=i;
+	}
+
+	n = intradix_num(r);
+	KASSERT(n==0);
+
+	/* small dense indexes first, then large sparse ones */
+	for (i=0; i<TESTSIZE; i++) {
+		res = intradix_set(r, i, &testarray[i]);
+		KASSERT(res==0);
+		n = intradix_num(r);
+		KASSERT(n==(unsigned)i+1);
+	}
+	for (i=0; i<TESTSIZE; i++) {
+		p = intradix_get(r, i);
+		KASSERT(*p == i);
+	}
+	p = intradix_get(r, TESTSIZE);
+	KASSERT(p == NULL);
+	p = intradix_get(r, 0xffffffff);
+	KASSERT(p == NULL);
+
+	for (i=0; i<TESTSIZE; i++) {
+		p = intradix_remove(r, i);
+		KASSERT(*p == i);
+	}
+	n = intradix_num(r);
+	KASSERT(n==0);
+
+	for (i=TESTSIZE-1; i>=0; i--) {
+		res = intradix_set(r, testindex(i), &testarray[i]);
+		KASSERT(res==0);
+	}
+	res = intradix_set(r, 0xffffffff, &testarray[0]);
+	KASSERT(res==0);
+	n = intradix_num(r);
+	KASSERT(n==TESTSIZE+1);
+
+	for (i=0; i<TESTSIZE*4; i++) {
+		int k = random()%TESTSIZE;
+		p = intradix_get(r, testindex(k));
+		KASSERT(*p == k);
+		p = intradix_get(r, testindex(k) + 1);
+		KASSERT(p == NULL);
+	}
+
+	/* replacing doesn't change the count */
+	res = intradix_set(r, testindex(5), &testarray[6]);
+	KASSERT(res==0);
+	p = intradix_get(r, testindex(5));
+	KASSERT(*p == 6);
+	res = intradix_set(r, testindex(5), &testarray[5]);
+	KASSERT(res==0);
+	n = intradix_num(r);
+	KASSERT(n==TESTSIZE+1);
+
+	/* next goes through them in order */
+	i = 0;
+	for (idx=0; (p = intradix_next(r, &idx)) != NULL; idx++) {
+		if (i == TESTSIZE) {
+			KASSERT(idx == 0xffffffff);
+			break;
+		}
+		KASSERT(idx == testindex(i));
+		KASSERT(*p == i);
+		i++;
+	}
+	KASSERT(i==TESTSIZE);
+
+	p = intradix_remove(r, 0xffffffff);
+	KASSERT(p == &testarray[0]);
+	p = intradix_remove(r, 0xffffffff);
+	KASSERT(p == NULL);
+
+	/* remove every other one and make sure next skips them */
+	for (i=0; i<TESTSIZE; i+=2) {
+		p = intradix_remove(r, testindex(i));
+		KASSERT(*p == i);
+	}
+	prev = 0;
+	n = 0;
+	for (idx=0; (p = intradix_next(r, &idx)) != NULL; idx++) {
+		KASSERT(*p % 2 == 1);
+		KASSERT(n == 0 || idx > prev);
+		prev = idx;
+		n++;
+	}
+	KASSERT(n==TESTSIZE/2);
+
+	for (i=1; i<TESTSIZE; i+=2) {
+		p = intradix_remove(r, testindex(i));
+		KASSERT(*p == i);
+	}
+	n = intradix_num(r);
+	KASSERT(n==0);
+	idx = 0;
+	p = intradix_next(r, &idx);
+	KASSERT(p == NULL);
+}
+
+int
+radixtest(int nargs, char **args)
+{
+	struct intradix *r;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Beginning radix tree test...\n");
+	r = intradix_create();
+	KASSERT(r != NULL);
+
+	testr(r);
+	testr(r);
+
+	intradix_destroy(r);
+
+	kprintf("Radix tree test complete\n");
+	return 0;
+}
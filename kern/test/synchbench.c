@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Synchronization benchmarks. synchtest.c checks that the primitives
+ * work; these time them, alone and with threads on other cpus going
+ * for them at the same time.
+ *
+ *    sb1 [loops]            lock_acquire and lock_release in one
+ *                           thread, so never contended
+ *    sb2 [threads [loops]]  the same in THREADS threads (default one
+ *                           per cpu), each on its own cpu
+ *    sb3 [loops]            semaphore ping-pong between threads on
+ *                           cpus 0 and 1: each Vs the other's
+ *                           semaphore and Ps its own
+ *    sb4 [waiters [loops]]  cv_signal round trips between two
+ *                           threads, then cv_broadcast to WAITERS
+ *                           threads (default one per other cpu) and
+ *                           wait for the last of them to wake
+ *    sb5 [threads [loops]]  spinlock_acquire and spinlock_release in
+ *                           THREADS threads, as for sb2
+ *
+ * Thread N runs on cpu N mod the number of cpus, and the menu thread
+ * stays on cpu 0 meanwhile, so the times (from its cycle counter) are
+ * wall times. Each benchmark checks that its counts came out right, so
+ * it doubles as a stress test.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <mainbus.h>
+#include <spinlock.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define SB_LOOPS	10000
+#define SB_MAXTHREADS	32
+
+static struct semaphore *sb_ready;	/* a thread is ready to go */
+static struct semaphore *sb_done;	/* a thread has finished */
+static struct lock *sb_lock;
+static struct spinlock sb_spinlock = SPINLOCK_INITIALIZER;
+static struct semaphore *sb_ping, *sb_pong;
+static struct cv *sb_cv, *sb_donecv;
+
+static volatile bool sb_go;		/* the threads may start */
+static unsigned sb_loops;
+static unsigned sb_nthreads;
+static volatile unsigned sb_count;
+static volatile unsigned sb_turn;	/* sb4: whose go it is */
+static volatile unsigned sb_gen;	/* sb4: broadcasts so far */
+
+static
+void
+sb_init(void)
+{
+	if (sb_ready == NULL) {
+		sb_ready = sem_create("sb_ready", 0);
+		sb_done = sem_create("sb_done", 0);
+		sb_ping = sem_create("sb_ping", 0);
+		sb_pong = sem_create("sb_pong", 0);
+		sb_lock = lock_create("sb_lock");
+		sb_cv = cv_create("sb_cv");
+		sb_donecv = cv_create("sb_donecv");
+		if (sb_ready == NULL || sb_done == NULL || sb_ping == NULL ||
+		    sb_pong == NULL || sb_lock == NULL || sb_cv == NULL ||
+		    sb_donecv == NULL) {
+			panic("synchbench: Out of memory\n");
+		}
+	}
+}
+
+/* argument N as a number, or DEF if there isn't one */
+static
+unsigned
+sb_arg(int nargs, char **args, int n, unsigned def)
+{
+	return nargs > n ? (unsigned)atoi(args[n]) : def;
+}
+
+/* move the current thread to cpu NUM mod the number of cpus */
+static
+void
+sb_pin(unsigned long num)
+{
+	thread_setaffinity(curthread, 1U << (num % thread_numcpus()));
+	thread_yield();
+}
+
+static
+uint64_t
+sb_ns(uint64_t cycles)
+{
+	struct timespec ts;
+
+	cycles_to_timespec(cycles, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static
+void
+sb_report(const char *name, unsigned ops, uint64_t cycles)
+{
+	uint64_t ns;
+
+	ns = sb_ns(cycles);
+	kprintf("%s: %u ops in %llu ns, %llu ns/op\n", name, ops,
+		(unsigned long long)ns,
+		(unsigned long long)(ops > 0 ? ns / ops : 0));
+}
+
+/*
+ * Start of each benchmark thread: go to our cpu, say we're ready, and
+ * wait for the others.
+ */
+static
+void
+sb_begin(unsigned long num)
+{
+	sb_pin(num);
+	V(sb_ready);
+	while (!sb_go) {
+		thread_yield();
+	}
+}
+
+/*
+ * Run FUNC in NTHREADS threads, SB_LOOPS times (which FUNC does
+ * itself), and return how many cycles it took from when they were all
+ * ready to go until the last one finished.
+ */
+static
+uint64_t
+sb_run(const char *name, void (*func)(void *, unsigned long),
+       unsigned nthreads)
+{
+	uint32_t oldmask;
+	uint64_t start, end;
+	unsigned i;
+	int result;
+
+	oldmask = curthread->t_cpumask;
+	sb_pin(0);
+
+	sb_go = false;
+	sb_nthreads = nthreads;
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork(name, NULL, func, NULL, i);
+		if (result) {
+			panic("%s: thread_fork failed: %s\n", name,
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(sb_ready);
+	}
+	start = mainbus_cycles();
+	sb_go = true;
+	for (i=0; i<nthreads; i++) {
+		P(sb_done);
+	}
+	end = mainbus_cycles();
+
+	thread_setaffinity(curthread, oldmask);
+	return end - start;
+}
+
+/* how many threads to use, from the argument or the number of cpus */
+static
+unsigned
+sb_threads(int nargs, char **args, unsigned def)
+{
+	unsigned n;
+
+	n = sb_arg(nargs, args, 1, def);
+	if (n < 1) {
+		n = 1;
+	}
+	if (n > SB_MAXTHREADS) {
+		n = SB_MAXTHREADS;
+	}
+	return n;
+}
+
+////////////////////////////////////////////////////////////
+// sb1, sb2: locks
+
+int
+lockbench(int nargs, char **args)
+{
+	uint64_t start;
+	unsigned loops, i;
+
+	sb_init();
+	loops = sb_arg(nargs, args, 1, SB_LOOPS);
+
+	start = mainbus_cycles();
+	for (i=0; i<loops; i++) {
+		lock_acquire(sb_lock);
+		lock_release(sb_lock);
+	}
+	sb_report("lock, uncontended", loops, mainbus_cycles() - start);
+	return 0;
+}
+
+static
+void
+lockbenchthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+
+	sb_begin(num);
+	for (i=0; i<sb_loops; i++) {
+		lock_acquire(sb_lock);
+		sb_count++;
+		lock_release(sb_lock);
+	}
+	V(sb_done);
+}
+
+int
+lockbench2(int nargs, char **args)
+{
+	unsigned nthreads;
+	uint64_t cycles;
+
+	sb_init();
+	nthreads = sb_threads(nargs, args, thread_numcpus());
+	sb_loops = sb_arg(nargs, args, 2, SB_LOOPS);
+
+	sb_count = 0;
+	cycles = sb_run("lockbench2", lockbenchthread, nthreads);
+	if (sb_count != nthreads * sb_loops) {
+		panic("lockbench2: count %u, should be %u\n",
+		      sb_count, nthreads * sb_loops);
+	}
+	kprintf("%u threads\n", nthreads);
+	sb_report("lock, contended", nthreads * sb_loops, cycles);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sb3: semaphore ping-pong
+
+static
+void
+sembenchthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+
+	sb_begin(num);
+	for (i=0; i<sb_loops; i++) {
+		if (num == 0) {
+			V(sb_ping);
+			P(sb_pong);
+		}
+		else {
+			P(sb_ping);
+			V(sb_pong);
+		}
+	}
+	V(sb_done);
+}
+
+int
+sembench(int nargs, char **args)
+{
+	uint64_t cycles;
+
+	sb_init();
+	sb_loops = sb_arg(nargs, args, 1, SB_LOOPS);
+	if (thread_numcpus() < 2) {
+		kprintf("sembench: Only one cpu, so no cross-cpu wakeups\n");
+	}
+
+	cycles = sb_run("sembench", sembenchthread, 2);
+	/* each round trip is two wakeups */
+	sb_report("semaphore wakeup", 2 * sb_loops, cycles);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sb4: cv wakeups
+
+static
+void
+cvbenchthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+
+	sb_begin(num);
+	lock_acquire(sb_lock);
+	for (i=0; i<sb_loops; i++) {
+		while (sb_turn != num) {
+			cv_wait(sb_cv, sb_lock);
+		}
+		sb_turn = !num;
+		cv_signal(sb_cv, sb_lock);
+	}
+	lock_release(sb_lock);
+	V(sb_done);
+}
+
+/*
+ * Thread 0 broadcasts, the others wait for each broadcast and the last
+ * one to wake up tells thread 0.
+ */
+static
+void
+cvbenchthread2(void *junk, unsigned long num)
+{
+	unsigned nwaiters, i;
+
+	(void)junk;
+
+	nwaiters = sb_nthreads - 1;
+	sb_begin(num);
+	lock_acquire(sb_lock);
+	for (i=1; i<=sb_loops; i++) {
+		if (num == 0) {
+			sb_count = 0;
+			sb_gen = i;
+			cv_broadcast(sb_cv, sb_lock);
+			while (sb_count < nwaiters) {
+				cv_wait(sb_donecv, sb_lock);
+			}
+		}
+		else {
+			while (sb_gen < i) {
+				cv_wait(sb_cv, sb_lock);
+			}
+			if (++sb_count == nwaiters) {
+				cv_signal(sb_donecv, sb_lock);
+			}
+		}
+	}
+	lock_release(sb_lock);
+	V(sb_done);
+}
+
+int
+cvbench(int nargs, char **args)
+{
+	unsigned nwaiters;
+	uint64_t cycles;
+
+	sb_init();
+	nwaiters = sb_threads(nargs, args,
+			      thread_numcpus() > 1 ? thread_numcpus() - 1 : 1);
+	if (nwaiters == SB_MAXTHREADS) {
+		nwaiters--;
+	}
+	sb_loops = sb_arg(nargs, args, 2, SB_LOOPS);
+
+	sb_turn = 0;
+	cycles = sb_run("cvbench", cvbenchthread, 2);
+	sb_report("cv_signal wakeup", 2 * sb_loops, cycles);
+
+	sb_gen = 0;
+	cycles = sb_run("cvbench2", cvbenchthread2, nwaiters + 1);
+	kprintf("%u waiters\n", nwaiters);
+	sb_report("cv_broadcast, until all awake", sb_loops, cycles);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sb5: spinlocks
+
+static
+void
+spinbenchthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+
+	sb_begin(num);
+	for (i=0; i<sb_loops; i++) {
+		spinlock_acquire(&sb_spinlock);
+		sb_count++;
+		spinlock_release(&sb_spinlock);
+	}
+	V(sb_done);
+}
+
+int
+spinbench(int nargs, char **args)
+{
+	unsigned nthreads;
+	uint64_t cycles;
+
+	sb_init();
+	nthreads = sb_threads(nargs, args, thread_numcpus());
+	sb_loops = sb_arg(nargs, args, 2, SB_LOOPS);
+
+	sb_count = 0;
+	cycles = sb_run("spinbench", spinbenchthread, nthreads);
+	if (sb_count != nthreads * sb_loops) {
+		panic("spinbench: count %u, should be %u\n",
+		      sb_count, nthreads * sb_loops);
+	}
+	kprintf("%u threads\n", nthreads);
+	sb_report("spinlock handoff", nthreads * sb_loops, cycles);
+	return 0;
+}
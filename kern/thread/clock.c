@@ -29,29 +29,48 @@
 
 #include <types.h>
 #include <lib.h>
+#include <atomic.h>
+#include <membar.h>
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <timer.h>
+#include <seqlock.h>
+#include <epoch.h>
+#include <vm.h>
+#include <mainbus.h>
+#include <stats.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Callbacks at specific points in the future, with a resolution of
+ * one hardclock tick, are in timer.c.
  *
- * A real kernel also has to maintain the time of day; in OS/161 we
- * skimp on that because we have a known-good hardware clock.
+ * We also keep the time of day and the time since boot, so that
+ * reading them (as __time does) is a memory read and not a trip to
+ * the clock device. CPU 0 advances both by a tick in hardclock, and
+ * timerclock pulls the time of day forward to what the clock device
+ * says once a second, to make up for ticks that were lost while
+ * interrupts were off. Neither ever goes backwards. They're protected
+ * by a seqlock, so readers take no locks.
+ *
+ * Every update is also copied into the time page (see kern/time.h),
+ * which vm_fault maps into user address spaces so user programs can
+ * read the clock without a system call. Its sequence number works
+ * like the seqlock's, and since it's only changed by writers holding
+ * the seqlock they're already serialized.
  */
 
 /*
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	HZ	/* Boost priorities once a second. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define TICKLESS_MAX		(10 * HZ) /* Longest an idle cpu goes without. */
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
@@ -59,6 +78,25 @@
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+/*
+ * Nobody wakes up clocksleep's channel; its sleepers all time out.
+ */
+static struct wchan *sleep_wchan;
+static struct spinlock sleep_lock;
+
+static volatile unsigned clock_nstopped;	/* other cpus with no clock */
+static volatile bool clock_cpu0stopped;		/* cpu 0 has none either */
+static struct cpu *clock_cpu0;
+
+/*
+ * The time of day and the time since boot, advanced by hardclock.
+ */
+static struct seqlock time_seqlock = SEQLOCK_INITIALIZER;
+static struct timespec time_now;
+static struct timespec time_uptime;
+static volatile bool time_running = false;
+static struct timepage *time_page;
+
 /*
  * Setup.
  */
@@ -70,6 +108,135 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	spinlock_init(&sleep_lock);
+	sleep_wchan = wchan_create("clocksleep");
+	if (sleep_wchan == NULL) {
+		panic("Couldn't create clocksleep wchan\n");
+	}
+	clock_cpu0 = curcpu->c_self;
+}
+
+/*
+ * Copy the time into the time page. Call inside a seqlock write.
+ */
+static
+void
+time_publish(void)
+{
+	time_page->tp_seq++;
+	membar_store_store();
+	time_page->tp_now = time_now;
+	time_page->tp_uptime = time_uptime;
+	membar_store_store();
+	time_page->tp_seq++;
+}
+
+/*
+ * Start keeping time. Called once the clock device is attached.
+ */
+void
+time_bootstrap(void)
+{
+	struct timespec ts;
+	vaddr_t page;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		panic("time_bootstrap: Out of memory\n");
+	}
+	bzero((void *)page, PAGE_SIZE);
+	time_page = (struct timepage *)page;
+	time_page->tp_hz = HZ;
+
+	gettime(&ts);
+	seqlock_write_begin(&time_seqlock);
+	time_now = ts;
+	time_uptime.tv_sec = 0;
+	time_uptime.tv_nsec = 0;
+	time_publish();
+	seqlock_write_end(&time_seqlock);
+	time_running = true;
+}
+
+/*
+ * The physical address of the time page, or 0 if there isn't one yet.
+ */
+paddr_t
+time_pagepaddr(void)
+{
+	if (time_page == NULL) {
+		return 0;
+	}
+	return KVADDR_TO_PADDR((vaddr_t)time_page);
+}
+
+/*
+ * Advance the time by one hardclock tick.
+ */
+static
+void
+time_tick(void)
+{
+	static const struct timespec tick = { 0, 1000000000 / HZ };
+
+	seqlock_write_begin(&time_seqlock);
+	timespec_add(&time_now, &tick, &time_now);
+	timespec_add(&time_uptime, &tick, &time_uptime);
+	time_publish();
+	seqlock_write_end(&time_seqlock);
+}
+
+/*
+ * Catch the time of day up with the clock device, if we've fallen
+ * behind it.
+ */
+static
+void
+time_resync(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	seqlock_write_begin(&time_seqlock);
+	if (ts.tv_sec > time_now.tv_sec ||
+	    (ts.tv_sec == time_now.tv_sec && ts.tv_nsec > time_now.tv_nsec)) {
+		time_now = ts;
+		time_publish();
+	}
+	seqlock_write_end(&time_seqlock);
+}
+
+/*
+ * Read the time of day as we keep it: good to a tick, and no locks.
+ */
+void
+getclocktime(struct timespec *ret)
+{
+	unsigned seq;
+
+	if (!time_running) {
+		/* too early; ask the device */
+		gettime(ret);
+		return;
+	}
+	do {
+		seq = seqlock_read_begin(&time_seqlock);
+		*ret = time_now;
+	} while (seqlock_read_retry(&time_seqlock, seq));
+}
+
+/*
+ * Read the time since time_bootstrap.
+ */
+void
+getuptime(struct timespec *ret)
+{
+	unsigned seq;
+
+	do {
+		seq = seqlock_read_begin(&time_seqlock);
+		*ret = time_uptime;
+	} while (seqlock_read_retry(&time_seqlock, seq));
 }
 
 /*
@@ -79,6 +246,10 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
+	if (time_running) {
+		time_resync();
+	}
+
 	/* Just broadcast on lbolt */
 	spinlock_acquire(&lbolt_lock);
 	wchan_wakeall(lbolt, &lbolt_lock);
@@ -97,13 +268,122 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	if (curcpu->c_number == 0) {
+		if (time_running) {
+			time_tick();
+		}
+		timer_tick();
+	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	/* see epoch.h */
+	if (curthread->t_epochnest == 0) {
+		epoch_quiescent();
+	}
+	if (thread_tick()) {
+		if (curthread->t_epochnest == 0) {
+			STAT_INC(STAT_SCHED_PREEMPTS);
+			thread_yield();
+		}
+		else {
+			/* can't in a read section; see cond_resched */
+			curthread->t_resched = true;
+		}
+	}
+}
+
+/*
+ * Tickless idle. An idle cpu has nothing for hardclock to do but
+ * count, so it stops its clock until it has to wake up anyway, and
+ * then makes up the missed ticks in one go. cpu 0 does the counting
+ * that matters, of the time and the timer wheel, so it only stops
+ * while all the other cpus have also stopped (there's nobody to read
+ * the clock), and only until the wheel next has a timer due. The
+ * first of the others to wake up kicks it so the time gets caught up
+ * straight away. (The check and the kick are ordered with membars so
+ * that one of cpu 0 and the waking cpu always sees the other.) Until
+ * time_bootstrap has set the clock going, everybody just ticks.
+ */
+void
+hardclock_stop(void)
+{
+	unsigned ticks;
+
+	if (!time_running) {
+		return;
+	}
+	mainbus_tickcatchup();
+
+	if (curcpu->c_number != 0) {
+		atomic_add(&clock_nstopped, 1);
+		mainbus_tickless(TICKLESS_MAX);
+		return;
+	}
+
+	clock_cpu0stopped = true;
+	membar_any_any();
+	if (clock_nstopped + 1 < thread_numcpus()) {
+		/* somebody's still running and may look at the time */
+		clock_cpu0stopped = false;
+		return;
+	}
+	ticks = timer_idle(TICKLESS_MAX);
+	mainbus_tickless(ticks);
+}
+
+void
+hardclock_start(void)
+{
+	if (!time_running) {
+		return;
+	}
+
+	if (curcpu->c_number != 0) {
+		atomic_add(&clock_nstopped, -1);
+		membar_any_any();
+		mainbus_tickcatchup();
+		mainbus_tickless(1);
+		if (clock_cpu0stopped) {
+			hardclock_kick();
+		}
+		return;
+	}
+
+	if (clock_cpu0stopped) {
+		clock_cpu0stopped = false;
+		timer_busy();
+		mainbus_tickcatchup();
+		mainbus_tickless(1);
+	}
+}
+
+/*
+ * Make up for TICKS ticks that went by with the clock stopped.
+ */
+void
+hardclock_missed(unsigned ticks)
+{
+	curcpu->c_hardclocks += ticks;
+	if (curcpu->c_number == 0) {
+		while (ticks-- > 0) {
+			if (time_running) {
+				time_tick();
+			}
+			timer_tick();
+		}
+	}
+}
+
+void
+hardclock_kick(void)
+{
+	if (curcpu->c_self != clock_cpu0) {
+		ipi_send(clock_cpu0, IPI_UNIDLE);
+	}
 }
 
 /*
@@ -112,10 +392,18 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	if (num_secs > 0) {
+		clocksleep_ticks(num_secs * HZ);
 	}
-	spinlock_release(&lbolt_lock);
+}
+
+/*
+ * Suspend execution for the given number of ticks.
+ */
+void
+clocksleep_ticks(unsigned ticks)
+{
+	spinlock_acquire(&sleep_lock);
+	wchan_timedsleep(sleep_wchan, &sleep_lock, ticks);
+	spinlock_release(&sleep_lock);
 }
@@ -0,0 +1,242 @@
+/*
+ * Deferred reclamation (see epoch.h).
+ *
+ * Deferred items collect on epoch_next. Starting a grace period moves
+ * them to epoch_cur, bumps epoch_gen, and notes in epoch_waitmask
+ * which cpus have to pass through a quiescent state before it's over.
+ * Each cpu notices the new generation the next time it is quiescent,
+ * records it in c_epochseen and takes itself out of the mask; the one
+ * that empties the mask moves epoch_cur to epoch_done, for the work
+ * item to run, and starts the next grace period if anything has been
+ * deferred meanwhile. So a grace period only runs while there's
+ * something waiting for it, and at most two batches are in flight.
+ *
+ * Idle cpus can't be holding anything, and won't pass through a
+ * quiescent state until something wakes them, so a new grace period
+ * counts them as having passed already. A cpu that starts idling a
+ * moment later checks in from the idle loop.
+ */
+
+#define EPOCH_INLINE	/* empty */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <membar.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+#include <epoch.h>
+
+volatile unsigned epoch_gen;
+
+static struct spinlock epoch_lock = SPINLOCK_INITIALIZER;
+static struct epoch_item *epoch_next;	/* deferred since epoch_cur began */
+static struct epoch_item *epoch_cur;	/* waiting for this grace period */
+static struct epoch_item *epoch_done;	/* ready to run */
+static uint32_t epoch_waitmask;		/* cpus it's waiting for, or 0 */
+static struct work epoch_work;		/* runs epoch_done */
+
+/* For epoch_synchronize. */
+static struct spinlock epoch_synclock = SPINLOCK_INITIALIZER;
+static struct wchan *epoch_syncwchan;
+
+/*
+ * Start a grace period for what's on epoch_next. Called with
+ * epoch_lock held and no grace period running.
+ */
+static
+void
+epoch_start(void)
+{
+	struct cpu *c;
+	uint32_t mask;
+	unsigned i, num;
+
+	KASSERT(epoch_waitmask == 0);
+	KASSERT(epoch_cur == NULL);
+
+	epoch_cur = epoch_next;
+	epoch_next = NULL;
+	epoch_gen++;
+	/* the new generation must be visible before we look at c_isidle */
+	membar_any_any();
+
+	mask = 0;
+	num = thread_numcpus();
+	for (i=0; i<num; i++) {
+		c = thread_getcpu(i);
+		if (c != curcpu->c_self && c->c_isidle) {
+			c->c_epochseen = epoch_gen;
+		}
+		else {
+			mask |= 1U << c->c_number;
+		}
+	}
+	epoch_waitmask = mask;
+}
+
+/*
+ * The grace period is over: hand epoch_cur to the work item, and
+ * start the next one if there's anything for it. Called with
+ * epoch_lock held.
+ */
+static
+void
+epoch_end(void)
+{
+	struct epoch_item **eip;
+
+	eip = &epoch_done;
+	while (*eip != NULL) {
+		eip = &(*eip)->ei_next;
+	}
+	*eip = epoch_cur;
+	epoch_cur = NULL;
+
+	if (epoch_next != NULL) {
+		epoch_start();
+	}
+}
+
+/*
+ * A cpu in a quiescent state has seen a generation it hadn't. Called
+ * with interrupts off or from the clock interrupt, so we stay on this
+ * cpu.
+ */
+void
+epoch_report(void)
+{
+	uint32_t bit;
+	bool ended = false;
+
+	bit = 1U << curcpu->c_number;
+	spinlock_acquire(&epoch_lock);
+	curcpu->c_epochseen = epoch_gen;
+	if (epoch_waitmask & bit) {
+		epoch_waitmask &= ~bit;
+		if (epoch_waitmask == 0) {
+			epoch_end();
+			ended = true;
+		}
+	}
+	spinlock_release(&epoch_lock);
+
+	if (ended) {
+		workqueue_submit(&epoch_work);
+	}
+}
+
+void
+epoch_defer(struct epoch_item *ei, void (*func)(void *), void *arg)
+{
+	ei->ei_func = func;
+	ei->ei_arg = arg;
+
+	spinlock_acquire(&epoch_lock);
+	ei->ei_next = epoch_next;
+	epoch_next = ei;
+	if (epoch_waitmask == 0) {
+		epoch_start();
+	}
+	spinlock_release(&epoch_lock);
+}
+
+/*
+ * defer_free's bookkeeping: the item and what to free.
+ */
+struct epoch_free {
+	struct epoch_item ef_item;
+	void *ef_ptr;
+};
+
+static
+void
+epoch_dofree(void *arg)
+{
+	struct epoch_free *ef = arg;
+
+	kfree(ef->ef_ptr);
+	kfree(ef);
+}
+
+void
+defer_free(void *ptr)
+{
+	struct epoch_free *ef;
+
+	if (ptr == NULL) {
+		return;
+	}
+	ef = kmalloc_tagged(sizeof(*ef), KM_THREAD);
+	if (ef == NULL) {
+		/* do it the slow way */
+		epoch_synchronize();
+		kfree(ptr);
+		return;
+	}
+	ef->ef_ptr = ptr;
+	epoch_defer(&ef->ef_item, epoch_dofree, ef);
+}
+
+static
+void
+epoch_syncdone(void *arg)
+{
+	volatile bool *done = arg;
+
+	spinlock_acquire(&epoch_synclock);
+	*done = true;
+	wchan_wakeall(epoch_syncwchan, &epoch_synclock);
+	spinlock_release(&epoch_synclock);
+}
+
+void
+epoch_synchronize(void)
+{
+	struct epoch_item ei;
+	volatile bool done = false;
+
+	KASSERT(curthread->t_epochnest == 0);
+
+	epoch_defer(&ei, epoch_syncdone, (void *)&done);
+	spinlock_acquire(&epoch_synclock);
+	while (!done) {
+		wchan_sleep(epoch_syncwchan, &epoch_synclock);
+	}
+	spinlock_release(&epoch_synclock);
+}
+
+/*
+ * Run what's ready.
+ */
+static
+void
+epoch_run(void *unused)
+{
+	struct epoch_item *ei, *next;
+
+	(void)unused;
+
+	spinlock_acquire(&epoch_lock);
+	ei = epoch_done;
+	epoch_done = NULL;
+	spinlock_release(&epoch_lock);
+
+	for (; ei != NULL; ei = next) {
+		next = ei->ei_next;
+		ei->ei_func(ei->ei_arg);
+	}
+}
+
+void
+epoch_bootstrap(void)
+{
+	epoch_syncwchan = wchan_create("epoch");
+	if (epoch_syncwchan == NULL) {
+		panic("epoch_bootstrap: Out of memory\n");
+	}
+	work_init(&epoch_work, epoch_run, NULL);
+}
@@ -0,0 +1,272 @@
+/*
+ * Lock contention statistics. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <mainbus.h>
+#include <current.h>
+
+#if OPT_LOCKSTATS
+
+/* Size of the class table. The last slot catches whatever doesn't fit. */
+#define LOCKSTAT_NCLASSES 512
+
+static struct lockstat lockstat_classes[LOCKSTAT_NCLASSES];
+static volatile spinlock_data_t lockstat_tablebusy;
+
+/*
+ * The table and each class are protected by a bare spinlock word
+ * rather than a struct spinlock, because taking a struct spinlock is
+ * what we're recording. Callers have interrupts off.
+ */
+static
+void
+lockstat_busy(volatile spinlock_data_t *d)
+{
+	while (spinlock_data_get(d) != 0 ||
+	       spinlock_data_testandset(d) != 0) {
+		/* spin */
+	}
+	membar_store_any();
+}
+
+static
+void
+lockstat_unbusy(volatile spinlock_data_t *d)
+{
+	membar_any_store();
+	spinlock_data_set(d, 0);
+}
+
+/*
+ * Find or make the class for a lock, keyed by its setup site (or by
+ * the lock itself for a statically initialized spinlock). Open
+ * addressing; classes are never removed, so an empty slot ends the
+ * search.
+ */
+static
+struct lockstat *
+lockstat_class(struct lockstat_hold *lh)
+{
+	const void *key;
+	struct lockstat *ls;
+	unsigned i, n;
+	size_t len;
+
+	key = lh->lh_site != NULL ? lh->lh_site : lh;
+	i = ((uint32_t)(uintptr_t)key >> 2) * 2654435761U;
+	i %= LOCKSTAT_NCLASSES - 1;
+
+	lockstat_busy(&lockstat_tablebusy);
+	for (n = 0; n < LOCKSTAT_NCLASSES - 1; n++) {
+		ls = &lockstat_classes[i];
+		if (ls->ls_site == key) {
+			goto done;
+		}
+		if (ls->ls_site == NULL) {
+			ls->ls_site = key;
+			ls->ls_kind = lh->lh_kind;
+			if (lh->lh_name != NULL) {
+				/* ls_name starts zeroed, so this stays terminated */
+				len = strlen(lh->lh_name);
+				if (len >= LOCKSTAT_NAMELEN) {
+					len = LOCKSTAT_NAMELEN - 1;
+				}
+				memcpy(ls->ls_name, lh->lh_name, len);
+			}
+			goto done;
+		}
+		i = (i + 1) % (LOCKSTAT_NCLASSES - 1);
+	}
+	/* full */
+	ls = &lockstat_classes[LOCKSTAT_NCLASSES - 1];
+	if (ls->ls_site == NULL) {
+		ls->ls_site = lockstat_classes;
+		strcpy(ls->ls_name, "(overflow)");
+	}
+ done:
+	lockstat_unbusy(&lockstat_tablebusy);
+	return ls;
+}
+
+/*
+ * The lock is ours now. Must be called while holding it, so nobody
+ * else is touching LH.
+ */
+void
+lockstat_acquired(struct lockstat_hold *lh, bool waited, uint64_t start,
+		  const void *blocker, const void *site)
+{
+	struct lockstat *ls;
+	uint64_t now;
+	int spl;
+
+	spl = splhigh();
+	if (lh->lh_class == NULL) {
+		lh->lh_class = lockstat_class(lh);
+	}
+	ls = lh->lh_class;
+	now = mainbus_cycles();
+
+	lockstat_busy(&ls->ls_busy);
+	ls->ls_acquires++;
+	if (waited) {
+		ls->ls_contended++;
+		ls->ls_waittime += now - start;
+		ls->ls_blocker = blocker;
+	}
+	lockstat_unbusy(&ls->ls_busy);
+
+	lh->lh_site = site;
+	lh->lh_stamp = now;
+	splx(spl);
+}
+
+/*
+ * The lock is about to be let go. Must be called while still holding
+ * it.
+ */
+void
+lockstat_released(struct lockstat_hold *lh)
+{
+	struct lockstat *ls;
+	uint64_t held;
+	int spl;
+
+	ls = lh->lh_class;
+	if (ls == NULL) {
+		/* taken before we were recording */
+		return;
+	}
+
+	spl = splhigh();
+	held = mainbus_cycles() - lh->lh_stamp;
+	lockstat_busy(&ls->ls_busy);
+	if (held > ls->ls_maxhold) {
+		ls->ls_maxhold = held;
+	}
+	lockstat_unbusy(&ls->ls_busy);
+	splx(spl);
+}
+
+/*
+ * A CV wait is over. The caller holds the cv's spinlock, so nobody
+ * else is touching LH.
+ */
+void
+lockstat_slept(struct lockstat_hold *lh, uint64_t start)
+{
+	struct lockstat *ls;
+	uint64_t now;
+	int spl;
+
+	spl = splhigh();
+	if (lh->lh_class == NULL) {
+		lh->lh_class = lockstat_class(lh);
+	}
+	ls = lh->lh_class;
+	now = mainbus_cycles();
+
+	lockstat_busy(&ls->ls_busy);
+	ls->ls_acquires++;
+	ls->ls_waittime += now - start;
+	lockstat_unbusy(&ls->ls_busy);
+	splx(spl);
+}
+
+/*
+ * Cycles to microseconds, for printing.
+ */
+static
+unsigned long long
+lockstat_usec(uint64_t cycles)
+{
+	return cycles / (mainbus_cyclerate() / 1000000);
+}
+
+/*
+ * Print the N classes that spent the most time waiting. We keep the
+ * top N in a sorted array while copying each class out under its
+ * busy word, and print only once we're done looking at the table.
+ */
+void
+lockstat_dump(unsigned n)
+{
+	static const char *const kinds[] = { "spinlock", "lock", "cv" };
+	struct lockstat *top, copy;
+	unsigned i, j, ntop;
+	int spl;
+
+	if (n == 0) {
+		return;
+	}
+	if (n > LOCKSTAT_NCLASSES) {
+		n = LOCKSTAT_NCLASSES;
+	}
+	top = kmalloc(n * sizeof(*top));
+	if (top == NULL) {
+		kprintf("lockstat: Out of memory\n");
+		return;
+	}
+
+	ntop = 0;
+	for (i = 0; i < LOCKSTAT_NCLASSES; i++) {
+		/* ls_site never changes once set */
+		if (lockstat_classes[i].ls_site == NULL) {
+			continue;
+		}
+		spl = splhigh();
+		lockstat_busy(&lockstat_classes[i].ls_busy);
+		copy = lockstat_classes[i];
+		lockstat_unbusy(&lockstat_classes[i].ls_busy);
+		splx(spl);
+
+		if (copy.ls_acquires == 0) {
+			continue;
+		}
+		for (j = ntop; j > 0; j--) {
+			if (top[j-1].ls_waittime >= copy.ls_waittime) {
+				break;
+			}
+			if (j < n) {
+				top[j] = top[j-1];
+			}
+		}
+		if (j < n) {
+			top[j] = copy;
+			if (ntop < n) {
+				ntop++;
+			}
+		}
+	}
+
+	kprintf("kind     name              acquires  contended "
+		"    wait us  maxhold us  site       blocker\n");
+	for (i = 0; i < ntop; i++) {
+		kprintf("%-8s %-15s %10llu %10llu %11llu %11llu  %p %p\n",
+			kinds[top[i].ls_kind],
+			top[i].ls_name[0] != 0 ? top[i].ls_name : "-",
+			(unsigned long long)top[i].ls_acquires,
+			(unsigned long long)top[i].ls_contended,
+			lockstat_usec(top[i].ls_waittime),
+			lockstat_usec(top[i].ls_maxhold),
+			top[i].ls_site, top[i].ls_blocker);
+	}
+
+	kfree(top);
+}
+
+#else /* OPT_LOCKSTATS */
+
+void
+lockstat_dump(unsigned n)
+{
+	(void)n;
+	kprintf("Enable options lockstats to use this functionality.\n");
+}
+
+#endif /* OPT_LOCKSTATS */
@@ -0,0 +1,535 @@
+/*
+ * Sampling profiler. See prof.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <platform/maxcpus.h>
+#include <cpu.h>
+#include <membar.h>
+#include <current.h>
+#include <proc.h>
+#include <thread.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <elf.h>
+#include <prof.h>
+
+/* Lines of the kernel histogram, and pcs shown for each process. */
+#define PROF_TOP	30
+#define PROF_USERTOP	8
+
+struct prof_sample {
+	vaddr_t ps_pc;
+	pid_t ps_pid;			/* -1 if there was no process */
+	bool ps_user;
+};
+
+struct prof_cpu {
+	struct prof_sample *pc_samples;	/* PROF_SAMPLES of them */
+	unsigned pc_count;		/* samples in pc_samples */
+	unsigned pc_dropped;		/* samples lost, pc_samples full */
+};
+
+static struct prof_cpu prof_cpus[MAXCPUS];
+static volatile bool prof_running;
+
+/* A line of a histogram. */
+struct prof_entry {
+	pid_t pe_pid;			/* for user samples; 0 for kernel */
+	vaddr_t pe_pc;			/* pc, or start of its function */
+	unsigned pe_count;
+};
+
+/* Functions of the kernel, sorted by address. */
+struct prof_sym {
+	vaddr_t sy_addr;
+	size_t sy_size;
+	const char *sy_name;
+};
+
+struct prof_syms {
+	struct prof_sym *ps_syms;
+	unsigned ps_num;
+	char *ps_strtab;
+};
+
+////////////////////////////////////////////////////////////
+// sampling
+
+int
+prof_start(void)
+{
+	struct prof_cpu *pcpu;
+	unsigned i, ncpus;
+
+	prof_stop();
+
+	ncpus = thread_numcpus();
+	for (i=0; i<ncpus; i++) {
+		pcpu = &prof_cpus[i];
+		if (pcpu->pc_samples == NULL) {
+			pcpu->pc_samples =
+				kmalloc(PROF_SAMPLES * sizeof(*pcpu->pc_samples));
+			if (pcpu->pc_samples == NULL) {
+				return ENOMEM;
+			}
+		}
+		pcpu->pc_count = 0;
+		pcpu->pc_dropped = 0;
+	}
+
+	membar_store_store();
+	prof_running = true;
+	return 0;
+}
+
+/*
+ * A cpu that was already in prof_sample can still store one sample
+ * after this, which doesn't matter.
+ */
+void
+prof_stop(void)
+{
+	prof_running = false;
+	membar_any_any();
+}
+
+void
+prof_sample(vaddr_t pc, bool user)
+{
+	struct prof_cpu *pcpu;
+	struct prof_sample *ps;
+
+	if (!prof_running) {
+		return;
+	}
+	pcpu = &prof_cpus[curcpu->c_number];
+	if (pcpu->pc_samples == NULL) {
+		return;
+	}
+	if (pcpu->pc_count >= PROF_SAMPLES) {
+		pcpu->pc_dropped++;
+		return;
+	}
+	ps = &pcpu->pc_samples[pcpu->pc_count];
+	ps->ps_pc = pc;
+	ps->ps_pid = curproc != NULL ? curproc->p_pid : -1;
+	ps->ps_user = user;
+	pcpu->pc_count++;
+}
+
+////////////////////////////////////////////////////////////
+// kernel symbols
+
+/* read exactly LEN bytes at POS of VN */
+static
+int
+prof_read(struct vnode *vn, off_t pos, void *buf, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, pos, UIO_READ);
+	result = VOP_READ(vn, &ku);
+	if (result) {
+		return result;
+	}
+	return ku.uio_resid != 0 ? ENOEXEC : 0;
+}
+
+/* sort by address, with a Shell sort; there are a few thousand */
+static
+void
+prof_sortsyms(struct prof_sym *syms, unsigned n)
+{
+	struct prof_sym tmp;
+	unsigned gap, i, j;
+
+	for (gap = n / 2; gap > 0; gap /= 2) {
+		for (i=gap; i<n; i++) {
+			tmp = syms[i];
+			for (j=i; j>=gap && syms[j-gap].sy_addr > tmp.sy_addr;
+			     j-=gap) {
+				syms[j] = syms[j-gap];
+			}
+			syms[j] = tmp;
+		}
+	}
+}
+
+static
+void
+prof_freesyms(struct prof_syms *ps)
+{
+	kfree(ps->ps_syms);
+	kfree(ps->ps_strtab);
+	ps->ps_syms = NULL;
+	ps->ps_strtab = NULL;
+	ps->ps_num = 0;
+}
+
+/*
+ * Load the functions from the symbol table of the ELF file at PATH,
+ * which had better be the kernel that's running.
+ */
+static
+int
+prof_loadsyms(const char *path, struct prof_syms *ps)
+{
+	Elf_Sym symbuf[32];
+	Elf_Ehdr eh;
+	Elf_Shdr *sh, *symsh, *strsh;
+	struct vnode *vn;
+	char *pathcopy;
+	unsigned i, j, nsyms, n;
+	int result;
+
+	ps->ps_syms = NULL;
+	ps->ps_strtab = NULL;
+	ps->ps_num = 0;
+
+	pathcopy = kstrdup(path);
+	if (pathcopy == NULL) {
+		return ENOMEM;
+	}
+	result = vfs_open(pathcopy, O_RDONLY, 0, &vn);
+	kfree(pathcopy);
+	if (result) {
+		return result;
+	}
+
+	sh = NULL;
+	result = prof_read(vn, 0, &eh, sizeof(eh));
+	if (result) {
+		goto out;
+	}
+	if (eh.e_ident[EI_MAG0] != ELFMAG0 ||
+	    eh.e_ident[EI_MAG1] != ELFMAG1 ||
+	    eh.e_ident[EI_MAG2] != ELFMAG2 ||
+	    eh.e_ident[EI_MAG3] != ELFMAG3 ||
+	    eh.e_ident[EI_CLASS] != ELFCLASS32 ||
+	    eh.e_shentsize != sizeof(Elf_Shdr) || eh.e_shnum == 0) {
+		result = ENOEXEC;
+		goto out;
+	}
+
+	/* find the symbol table and its strings */
+	sh = kmalloc(eh.e_shnum * sizeof(*sh));
+	if (sh == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+	result = prof_read(vn, eh.e_shoff, sh, eh.e_shnum * sizeof(*sh));
+	if (result) {
+		goto out;
+	}
+	symsh = NULL;
+	for (i=0; i<eh.e_shnum; i++) {
+		if (sh[i].sh_type == SHT_SYMTAB) {
+			symsh = &sh[i];
+			break;
+		}
+	}
+	if (symsh == NULL || symsh->sh_link >= eh.e_shnum ||
+	    sh[symsh->sh_link].sh_type != SHT_STRTAB) {
+		/* stripped */
+		result = ENOEXEC;
+		goto out;
+	}
+	strsh = &sh[symsh->sh_link];
+
+	ps->ps_strtab = kmalloc(strsh->sh_size + 1);
+	nsyms = symsh->sh_size / sizeof(Elf_Sym);
+	ps->ps_syms = kmalloc(nsyms * sizeof(*ps->ps_syms));
+	if (ps->ps_strtab == NULL || ps->ps_syms == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+	result = prof_read(vn, strsh->sh_offset, ps->ps_strtab,
+			   strsh->sh_size);
+	if (result) {
+		goto out;
+	}
+	ps->ps_strtab[strsh->sh_size] = '\0';
+
+	/* keep the functions */
+	for (i=0; i<nsyms; i+=n) {
+		n = nsyms - i;
+		if (n > sizeof(symbuf) / sizeof(symbuf[0])) {
+			n = sizeof(symbuf) / sizeof(symbuf[0]);
+		}
+		result = prof_read(vn, symsh->sh_offset + i * sizeof(Elf_Sym),
+				   symbuf, n * sizeof(Elf_Sym));
+		if (result) {
+			goto out;
+		}
+		for (j=0; j<n; j++) {
+			if (ELF32_ST_TYPE(symbuf[j].st_info) != STT_FUNC ||
+			    symbuf[j].st_value == 0 ||
+			    symbuf[j].st_name >= strsh->sh_size) {
+				continue;
+			}
+			ps->ps_syms[ps->ps_num].sy_addr = symbuf[j].st_value;
+			ps->ps_syms[ps->ps_num].sy_size = symbuf[j].st_size;
+			ps->ps_syms[ps->ps_num].sy_name =
+				ps->ps_strtab + symbuf[j].st_name;
+			ps->ps_num++;
+		}
+	}
+	prof_sortsyms(ps->ps_syms, ps->ps_num);
+
+ out:
+	if (result) {
+		prof_freesyms(ps);
+	}
+	kfree(sh);
+	vfs_close(vn);
+	return result;
+}
+
+/* the function PC is in, or NULL */
+static
+const struct prof_sym *
+prof_findsym(const struct prof_syms *ps, vaddr_t pc)
+{
+	const struct prof_sym *sym;
+	unsigned lo, hi, mid;
+
+	/* find the last one that starts at or before pc */
+	lo = 0;
+	hi = ps->ps_num;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ps->ps_syms[mid].sy_addr <= pc) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return NULL;
+	}
+	sym = &ps->ps_syms[lo - 1];
+	if (sym->sy_size != 0 && pc - sym->sy_addr >= sym->sy_size) {
+		return NULL;
+	}
+	return sym;
+}
+
+////////////////////////////////////////////////////////////
+// histograms
+
+static
+bool
+prof_before(const struct prof_entry *a, const struct prof_entry *b,
+	    bool bycount)
+{
+	if (bycount && a->pe_count != b->pe_count) {
+		return a->pe_count > b->pe_count;
+	}
+	if (a->pe_pid != b->pe_pid) {
+		return a->pe_pid < b->pe_pid;
+	}
+	return a->pe_pc < b->pe_pc;
+}
+
+/* sort by process and pc, or if BYCOUNT most samples first */
+static
+void
+prof_sort(struct prof_entry *e, unsigned n, bool bycount)
+{
+	struct prof_entry tmp;
+	unsigned gap, i, j;
+
+	for (gap = n / 2; gap > 0; gap /= 2) {
+		for (i=gap; i<n; i++) {
+			tmp = e[i];
+			for (j=i; j>=gap && prof_before(&tmp, &e[j-gap], bycount);
+			     j-=gap) {
+				e[j] = e[j-gap];
+			}
+			e[j] = tmp;
+		}
+	}
+}
+
+/*
+ * Count the user or kernel samples by process and pc, or by function
+ * if SYMS isn't NULL. Returns the histogram, sorted by process and
+ * pc, with its length in *NP and the number of samples in *TOTALP;
+ * NULL if there are none or there isn't enough memory.
+ */
+static
+struct prof_entry *
+prof_collect(bool user, const struct prof_syms *syms,
+	     unsigned *np, unsigned *totalp)
+{
+	struct prof_entry *e;
+	const struct prof_sample *ps;
+	const struct prof_sym *sym;
+	unsigned ncpus, total, n, i, j;
+
+	ncpus = thread_numcpus();
+	total = 0;
+	for (i=0; i<ncpus; i++) {
+		for (j=0; j<prof_cpus[i].pc_count; j++) {
+			if (prof_cpus[i].pc_samples[j].ps_user == user) {
+				total++;
+			}
+		}
+	}
+	*np = 0;
+	*totalp = total;
+	if (total == 0) {
+		return NULL;
+	}
+
+	e = kmalloc(total * sizeof(*e));
+	if (e == NULL) {
+		kprintf("prof: Out of memory\n");
+		return NULL;
+	}
+	n = 0;
+	for (i=0; i<ncpus; i++) {
+		for (j=0; j<prof_cpus[i].pc_count; j++) {
+			ps = &prof_cpus[i].pc_samples[j];
+			if (ps->ps_user != user) {
+				continue;
+			}
+			e[n].pe_pid = user ? ps->ps_pid : 0;
+			e[n].pe_pc = ps->ps_pc;
+			if (syms != NULL) {
+				sym = prof_findsym(syms, ps->ps_pc);
+				if (sym != NULL) {
+					e[n].pe_pc = sym->sy_addr;
+				}
+			}
+			e[n].pe_count = 1;
+			n++;
+		}
+	}
+
+	/* merge the duplicates */
+	prof_sort(e, n, false);
+	for (i=j=0; i<n; i++) {
+		if (j > 0 && e[j-1].pe_pid == e[i].pe_pid &&
+		    e[j-1].pe_pc == e[i].pe_pc) {
+			e[j-1].pe_count++;
+		}
+		else {
+			e[j++] = e[i];
+		}
+	}
+	*np = j;
+	return e;
+}
+
+/* COUNT as a percentage of TOTAL, in tenths */
+#define PROF_TENTHS(count, total) ((count) * 1000 / (total))
+
+static
+void
+prof_summary(void)
+{
+	unsigned ncpus, i;
+
+	ncpus = thread_numcpus();
+	for (i=0; i<ncpus; i++) {
+		kprintf("cpu%u: %u samples", i, prof_cpus[i].pc_count);
+		if (prof_cpus[i].pc_dropped > 0) {
+			kprintf(", %u dropped (buffer full)",
+				prof_cpus[i].pc_dropped);
+		}
+		kprintf("\n");
+	}
+}
+
+void
+prof_dump(const char *kernelpath)
+{
+	struct prof_syms syms;
+	struct prof_entry *e;
+	const struct prof_sym *sym;
+	unsigned n, total, tenths, i;
+	int result;
+
+	prof_stop();
+	prof_summary();
+
+	result = prof_loadsyms(kernelpath, &syms);
+	if (result) {
+		kprintf("prof: %s: %s; showing addresses\n", kernelpath,
+			strerror(result));
+	}
+	e = prof_collect(false, result ? NULL : &syms, &n, &total);
+	if (e == NULL) {
+		kprintf("No kernel samples\n");
+		prof_freesyms(&syms);
+		return;
+	}
+
+	kprintf("%u kernel samples\n", total);
+	kprintf(" samples      %%  function\n");
+	prof_sort(e, n, true);
+	for (i=0; i<n && i<PROF_TOP; i++) {
+		tenths = PROF_TENTHS(e[i].pe_count, total);
+		sym = result ? NULL : prof_findsym(&syms, e[i].pe_pc);
+		if (sym != NULL) {
+			kprintf("%8u  %3u.%u  %s\n", e[i].pe_count,
+				tenths / 10, tenths % 10, sym->sy_name);
+		}
+		else {
+			kprintf("%8u  %3u.%u  0x%08lx\n", e[i].pe_count,
+				tenths / 10, tenths % 10,
+				(unsigned long)e[i].pe_pc);
+		}
+	}
+	if (n > PROF_TOP) {
+		kprintf("(and %u more)\n", n - PROF_TOP);
+	}
+
+	kfree(e);
+	prof_freesyms(&syms);
+}
+
+void
+prof_dumpuser(void)
+{
+	struct prof_entry *e;
+	unsigned n, total, start, end, count, tenths, i;
+
+	prof_stop();
+	prof_summary();
+
+	e = prof_collect(true, NULL, &n, &total);
+	if (e == NULL) {
+		kprintf("No user samples\n");
+		return;
+	}
+	kprintf("%u user samples\n", total);
+
+	/* e is sorted by process; do a process at a time */
+	for (start=0; start<n; start=end) {
+		count = 0;
+		for (end=start; end<n && e[end].pe_pid == e[start].pe_pid;
+		     end++) {
+			count += e[end].pe_count;
+		}
+		tenths = PROF_TENTHS(count, total);
+		kprintf("pid %d: %u samples, %u.%u%%\n", (int)e[start].pe_pid,
+			count, tenths / 10, tenths % 10);
+
+		prof_sort(e + start, end - start, true);
+		for (i=start; i<end && i<start+PROF_USERTOP; i++) {
+			kprintf("   %8u  0x%08lx\n", e[i].pe_count,
+				(unsigned long)e[i].pe_pc);
+		}
+	}
+	kfree(e);
+}
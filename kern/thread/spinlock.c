@@ -30,6 +30,8 @@
 /* Make sure to build out-of-line versions of inline functions */
 #define SPINLOCK_INLINE   /* empty */
 #define MEMBAR_INLINE     /* empty */
+#define ATOMIC_INLINE     /* empty */
+#define SEQLOCK_INLINE    /* empty */
 
 #include <types.h>
 #include <lib.h>
@@ -37,7 +39,11 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <membar.h>
+#include <atomic.h>
+#include <seqlock.h>
 #include <current.h>	/* for curcpu */
+#include <mainbus.h>	/* for mainbus_cycles */
+#include "opt-uniprocessor.h"
 
 /*
  * Spinlocks.
@@ -52,6 +58,12 @@ spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
 	splk->splk_holder = NULL;
+#if OPT_LOCKSTATS
+	splk->splk_stat.lh_class = NULL;
+	splk->splk_stat.lh_kind = LS_SPINLOCK;
+	splk->splk_stat.lh_name = NULL;
+	splk->splk_stat.lh_site = __builtin_return_address(0);
+#endif
 }
 
 /*
@@ -64,6 +76,52 @@ spinlock_cleanup(struct spinlock *splk)
 	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
 }
 
+#if OPT_UNIPROCESSOR
+
+/*
+ * With only one cpu, disabling interrupts is all it takes: nobody
+ * else can be in the lock to begin with, so the lock word stays 0 and
+ * there's nothing to spin on or order. The holder is still kept, for
+ * spinlock_do_i_hold and the deadlock check.
+ */
+void
+spinlock_acquire(struct spinlock *splk)
+{
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		if (splk->splk_holder == curcpu->c_self) {
+			panic("Deadlock on spinlock %p\n", splk);
+		}
+		curcpu->c_spinlocks++;
+		splk->splk_holder = curcpu->c_self;
+#if OPT_LOCKSTATS
+		lockstat_acquired(&splk->splk_stat, false, 0, NULL,
+				  __builtin_return_address(0));
+#endif
+	}
+}
+
+void
+spinlock_release(struct spinlock *splk)
+{
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		KASSERT(splk->splk_holder == curcpu->c_self);
+		KASSERT(curcpu->c_spinlocks > 0);
+		curcpu->c_spinlocks--;
+#if OPT_LOCKSTATS
+		lockstat_released(&splk->splk_stat);
+#endif
+	}
+
+	splk->splk_holder = NULL;
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+#else /* !OPT_UNIPROCESSOR */
+
 /*
  * Get the lock.
  *
@@ -75,6 +133,11 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+#if OPT_LOCKSTATS
+	bool waited = false;
+	uint64_t waitstart = 0;
+	const void *blocker = NULL;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -102,6 +165,13 @@ spinlock_acquire(struct spinlock *splk)
 		 * we don't.
 		 */
 		if (spinlock_data_get(&splk->splk_lock) != 0) {
+#if OPT_LOCKSTATS
+			if (!waited && mycpu != NULL) {
+				waited = true;
+				waitstart = mainbus_cycles();
+				blocker = splk->splk_stat.lh_site;
+			}
+#endif
 			continue;
 		}
 		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
@@ -112,6 +182,12 @@ spinlock_acquire(struct spinlock *splk)
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+#if OPT_LOCKSTATS
+	if (mycpu != NULL) {
+		lockstat_acquired(&splk->splk_stat, waited, waitstart,
+				  blocker, __builtin_return_address(0));
+	}
+#endif
 }
 
 /*
@@ -125,6 +201,9 @@ spinlock_release(struct spinlock *splk)
 		KASSERT(splk->splk_holder == curcpu->c_self);
 		KASSERT(curcpu->c_spinlocks > 0);
 		curcpu->c_spinlocks--;
+#if OPT_LOCKSTATS
+		lockstat_released(&splk->splk_stat);
+#endif
 	}
 
 	splk->splk_holder = NULL;
@@ -133,6 +212,8 @@ spinlock_release(struct spinlock *splk)
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
+#endif /* OPT_UNIPROCESSOR */
+
 /*
  * Check if the current cpu holds the lock.
  */
@@ -146,3 +227,20 @@ spinlock_do_i_hold(struct spinlock *splk)
 	/* Assume we can read splk_holder atomically enough for this to work */
 	return (splk->splk_holder == curcpu->c_self);
 }
+
+/*
+ * Sequence locks. The rest is inline in seqlock.h.
+ */
+void
+seqlock_init(struct seqlock *sq)
+{
+	spinlock_init(&sq->sq_lock);
+	sq->sq_seq = 0;
+}
+
+void
+seqlock_cleanup(struct seqlock *sq)
+{
+	KASSERT((sq->sq_seq & 1) == 0);
+	spinlock_cleanup(&sq->sq_lock);
+}
@@ -36,6 +36,7 @@
 #include <spl.h>
 #include <thread.h>
 #include <current.h>
+#include <stats.h>
 
 /*
  * Machine-independent interrupt handling functions.
@@ -99,6 +100,9 @@ splraise(int oldspl, int newspl)
 
 	if (cur->t_iplhigh_count == 0) {
 		cpu_irqoff();
+#if OPT_IRQSTATS
+		stats_irqoff();
+#endif
 	}
 	cur->t_iplhigh_count++;
 }
@@ -119,6 +123,9 @@ spllower(int oldspl, int newspl)
 
 	cur->t_iplhigh_count--;
 	if (cur->t_iplhigh_count == 0) {
+#if OPT_IRQSTATS
+		stats_irqon();
+#endif
 		cpu_irqon();
 	}
 }
@@ -0,0 +1,219 @@
+/*
+ * System-wide event counters. See stats.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <mainbus.h>
+#include <vfs.h>
+#include <stats.h>
+
+static const char *const stats_groups[] = {
+	"vm",
+	"sched",
+	"bio",
+	"cache",
+	"syscall",
+	"disk",
+	"kmem",
+#if OPT_IRQSTATS
+	"intr",
+#endif
+};
+#define STATS_DISK 5	/* each disk's own, from its queue */
+#define STATS_KMEM 6	/* kmalloc by tag, with options kmtags */
+#define STATS_INTR 7	/* the histograms' group */
+#define STATS_NGROUPS (sizeof(stats_groups) / sizeof(stats_groups[0]))
+
+/* Which group each counter is in, and its name there. */
+static const struct {
+	unsigned group;
+	const char *name;
+} stats_counters[STAT_NCOUNTERS] = {
+	[STAT_VM_FAULTS] =		{ 0, "faults" },
+	[STAT_VM_ZEROFILLS] =		{ 0, "zerofills" },
+	[STAT_VM_COWCOPIES] =		{ 0, "cowcopies" },
+	[STAT_VM_PAGEINS] =		{ 0, "pageins" },
+	[STAT_VM_PAGEOUTS] =		{ 0, "pageouts" },
+	[STAT_SCHED_SWITCHES] =		{ 1, "switches" },
+	[STAT_SCHED_PREEMPTS] =		{ 1, "preempts" },
+	[STAT_SCHED_MIGRATIONS] =	{ 1, "migrations" },
+	[STAT_SCHED_STEALS] =		{ 1, "steals" },
+	[STAT_SCHED_IDLES] =		{ 1, "idles" },
+	[STAT_BIO_READS] =		{ 2, "reads" },
+	[STAT_BIO_READBLOCKS] =		{ 2, "readblocks" },
+	[STAT_BIO_WRITES] =		{ 2, "writes" },
+	[STAT_BIO_WRITEBLOCKS] =	{ 2, "writeblocks" },
+	[STAT_BIO_RETRIES] =		{ 2, "retries" },
+	[STAT_CACHE_BUFHITS] =		{ 3, "bufhits" },
+	[STAT_CACHE_BUFMISSES] =	{ 3, "bufmisses" },
+	[STAT_CACHE_NAMEHITS] =		{ 3, "namehits" },
+	[STAT_CACHE_NAMEMISSES] =	{ 3, "namemisses" },
+	[STAT_SYSCALLS] =		{ 4, "calls" },
+	[STAT_SYSCALL_ERRORS] =		{ 4, "errors" },
+};
+
+/*
+ * Add up every cpu's copy. A 64-bit load isn't atomic here, so a copy
+ * read just as its low word carries over can come out 2^32 off; that
+ * only skews the one sample, and a cpu has to count 4 billion events
+ * first.
+ */
+uint64_t
+stats_total(unsigned c)
+{
+	uint64_t total;
+	unsigned i, n;
+
+	KASSERT(c < STAT_NCOUNTERS);
+
+	total = 0;
+	n = thread_numcpus();
+	for (i = 0; i < n; i++) {
+		total += thread_getcpu(i)->c_stats[c];
+	}
+	return total;
+}
+
+const char *
+stats_group(unsigned g)
+{
+	if (g >= STATS_NGROUPS) {
+		return NULL;
+	}
+	return stats_groups[g];
+}
+
+#if OPT_IRQSTATS
+
+/*
+ * Print the histograms, after the counters of group STATS_INTR (of
+ * which there aren't any yet) at POS; as stats_format.
+ */
+static
+size_t
+stats_format_hists(char *buf, size_t len, size_t pos)
+{
+	uint64_t sums[STAT_NBUCKETS];
+	bool any;
+	unsigned h, b, i, ncpus;
+	int n;
+
+	ncpus = thread_numcpus();
+	for (h = 0; h < STAT_NHISTS; h++) {
+		any = false;
+		for (b = 0; b < STAT_NBUCKETS; b++) {
+			sums[b] = 0;
+			for (i = 0; i < ncpus; i++) {
+				sums[b] += thread_getcpu(i)->c_hists[h][b];
+			}
+			any = any || sums[b] > 0;
+		}
+		if (!any) {
+			continue;
+		}
+
+		if (h == STAT_HIST_IRQOFF) {
+			n = snprintf(buf + (pos < len ? pos : len),
+				     pos < len ? len - pos : 0, "irqoff");
+		}
+		else if (h == STAT_HIST_IPI) {
+			n = snprintf(buf + (pos < len ? pos : len),
+				     pos < len ? len - pos : 0, "ipi");
+		}
+		else {
+			n = snprintf(buf + (pos < len ? pos : len),
+				     pos < len ? len - pos : 0, "slot%u",
+				     h - STAT_HIST_SLOT(0));
+		}
+		pos += n;
+		for (b = 0; b < STAT_NBUCKETS; b++) {
+			if (sums[b] == 0) {
+				continue;
+			}
+			n = snprintf(buf + (pos < len ? pos : len),
+				     pos < len ? len - pos : 0, " %u:%llu",
+				     b, (unsigned long long)sums[b]);
+			pos += n;
+		}
+		n = snprintf(buf + (pos < len ? pos : len),
+			     pos < len ? len - pos : 0, "\n");
+		pos += n;
+	}
+	return pos;
+}
+
+void
+stats_hist(unsigned h, uint64_t time)
+{
+	unsigned b;
+
+	KASSERT(h < STAT_NHISTS);
+
+	for (b = 0; time > 1 && b < STAT_NBUCKETS - 1; b++) {
+		time >>= 1;
+	}
+	curcpu->c_hists[h][b]++;
+}
+
+/*
+ * These are called from splraise and spllower, so they mustn't touch
+ * the spl themselves.
+ */
+void
+stats_irqoff(void)
+{
+	curcpu->c_irqoff = mainbus_cycles_irqoff();
+}
+
+void
+stats_irqon(void)
+{
+	struct cpu *c = curcpu;
+
+	/* Nothing's open if this cpu's first stretch began before us. */
+	if (c->c_irqoff != 0) {
+		stats_hist(STAT_HIST_IRQOFF,
+			   mainbus_cycles_irqoff() - c->c_irqoff);
+		c->c_irqoff = 0;
+	}
+}
+
+#endif /* OPT_IRQSTATS */
+
+size_t
+stats_format(unsigned g, char *buf, size_t len)
+{
+	size_t pos;
+	unsigned c;
+	int n;
+
+	KASSERT(g < STATS_NGROUPS);
+
+	pos = 0;
+	for (c = 0; c < STAT_NCOUNTERS; c++) {
+		if (stats_counters[c].group != g) {
+			continue;
+		}
+		n = snprintf(buf + (pos < len ? pos : len),
+			     pos < len ? len - pos : 0, "%s %llu\n",
+			     stats_counters[c].name,
+			     (unsigned long long)stats_total(c));
+		pos += n;
+	}
+	if (g == STATS_DISK) {
+		pos = vfs_devstats(buf, len, pos);
+	}
+	if (g == STATS_KMEM) {
+		pos = kheap_formattags(buf, len, pos);
+	}
+#if OPT_IRQSTATS
+	if (g == STATS_INTR) {
+		pos = stats_format_hists(buf, len, pos);
+	}
+#endif
+	return pos;
+}
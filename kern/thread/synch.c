@@ -33,12 +33,19 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <membar.h>
+#include <kmem_cache.h>
 #include <wchan.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
 #include <synch.h>
+#include <timer.h>
+#include <mainbus.h>
+#include <trace.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -49,7 +56,7 @@ sem_create(const char *name, unsigned initial_count)
 {
         struct semaphore *sem;
 
-        sem = kmalloc(sizeof(struct semaphore));
+        sem = kmalloc_tagged(sizeof(struct semaphore), KM_THREAD);
         if (sem == NULL) {
                 return NULL;
         }
@@ -120,6 +127,35 @@ P(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+/*
+ * P that gives up after TICKS ticks. The deadline is fixed up front so
+ * losing races with other P's doesn't keep extending it.
+ */
+int
+sem_timedP(struct semaphore *sem, unsigned ticks)
+{
+        uint64_t deadline, now;
+
+        KASSERT(sem != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        deadline = timer_now() + ticks;
+
+	spinlock_acquire(&sem->sem_lock);
+        while (sem->sem_count == 0) {
+                now = timer_now();
+                if (now >= deadline) {
+                        spinlock_release(&sem->sem_lock);
+                        return ETIMEDOUT;
+                }
+                wchan_timedsleep(sem->sem_wchan, &sem->sem_lock, deadline - now);
+        }
+        KASSERT(sem->sem_count > 0);
+        sem->sem_count--;
+	spinlock_release(&sem->sem_lock);
+        return 0;
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -138,47 +174,176 @@ V(struct semaphore *sem)
 //
 // Lock.
 
-/*At most one thread may hold the lock at any given time. We can implement it using a semaphore initialized with count = 1.
- * P() on the emaphore acquires the lock (decrement, blcok if count == 0)
- * V() releases the lock (increment, wake a waiting thread if there are any)
+/*
+ * At most one thread may hold the lock at any given time. lk_held is the lock itself: a word we test-and-set, so taking
+ * a free lock is one atomic instruction and never touches the spinlock or the wait channel. If it's taken we spin on it
+ * for a while, but only as long as the owner is running on another cpu and so will probably let go soon. Otherwise (or
+ * once we've spun LOCK_SPIN_MAX times) we sleep on lk_wchan. lk_waiters counts the sleepers, so lock_release only goes
+ * near the spinlock when there is somebody to wake.
  */
+#define LOCK_SPIN_MAX 1000
 
+/*
+ * Priority inheritance. A thread about to sleep for a lock lends its scheduling level to the owner, and on down the
+ * chain if the owner is itself asleep for another lock (t_blockedon), so a holder can't be kept off the cpu by threads
+ * less important than the ones waiting for it. The lock records the best level lent through it (lk_prio) and goes on
+ * the owner's t_pilocks; when the owner lets go of it, the owner drops back to the best of the other locks it was lent
+ * through, and the waiters left behind lend to the next owner. All of this is under lock_pilock, which comes after
+ * lk_lock and before the run queue locks. Nothing is taken on the fast paths, and lock_release only takes lock_pilock
+ * if the thread has been lent something.
+ *
+ * lk_owner is read without lk_lock, as in lock_owner_running, so a lend can land on a thread that has just let go of
+ * the lock; it keeps it until its next lock_release, where locks it no longer holds come off its chain. (Thread structs
+ * stay in the thread cache, so the pointer is always to some thread.)
+ */
+static struct spinlock lock_pilock = SPINLOCK_INITIALIZER;
 
+/* Longest chain of owners followed, in case of a cycle (a deadlock) */
+#define LOCK_PI_DEPTH 8
 
-struct lock *
-lock_create(const char *name)
+/* Take LOCK off the t_pilocks chain it's on, if any. Call with lock_pilock held */
+static
+void
+lock_pi_unlink(struct lock *lock)
 {
+        struct lock **pp;
+
+        KASSERT(spinlock_do_i_hold(&lock_pilock));
+        if (lock->lk_pithread != NULL) {
+                for (pp = &lock->lk_pithread->t_pilocks; *pp != NULL; pp = &(*pp)->lk_pinext) {
+                        if (*pp == lock) {
+                                *pp = lock->lk_pinext;
+                                break;
+                        }
+                }
+        }
+        lock->lk_pithread = NULL;
+        lock->lk_pinext = NULL;
+        lock->lk_prio = THREAD_NOINHERIT;
+}
 
-       
+/* Lend LEVEL to LOCK's owner and on down the chain. Call with lock_pilock held */
+static
+void
+lock_pi_lend(struct lock *lock, unsigned level)
+{
+        struct thread *owner;
+        unsigned depth;
+
+        KASSERT(spinlock_do_i_hold(&lock_pilock));
+        for (depth = 0; lock != NULL && depth < LOCK_PI_DEPTH; depth++) {
+                owner = (struct thread *)lock->lk_owner;
+                if (owner == NULL || level >= THREAD_LEVEL(owner)) {
+                        /* it's already as well off as we could make it, and so is the rest of the chain */
+                        break;
+                }
+                if (lock->lk_pithread != owner) {
+                        lock_pi_unlink(lock);
+                        lock->lk_pithread = owner;
+                        lock->lk_pinext = owner->t_pilocks;
+                        owner->t_pilocks = lock;
+                }
+                if (level < lock->lk_prio) {
+                        lock->lk_prio = level;
+                }
+                thread_lend(owner, level);
+                lock = owner->t_blockedon;
+        }
+}
 
+/*
+ * The current thread has let go of LOCK; LEVEL is the best level among the waiters left, who lend it to the new owner
+ * (if any). Drop the locks we don't hold any more off our chain, and go back to the best level lent through the rest.
+ */
+static
+void
+lock_pi_released(struct lock *lock, unsigned level)
+{
+        struct lock *l, *next;
+        unsigned best;
 
-        struct lock *lock;
+        if (curthread->t_pilocks == NULL && level == THREAD_NOINHERIT) {
+                return;
+        }
 
-        lock = kmalloc(sizeof(struct lock));
-        if (lock == NULL) {
-                return NULL;
+        spinlock_acquire(&lock_pilock);
+        best = THREAD_NOINHERIT;
+        for (l = curthread->t_pilocks; l != NULL; l = next) {
+                next = l->lk_pinext;
+                if (l->lk_owner != curthread) {
+                        lock_pi_unlink(l);
+                }
+                else if (l->lk_prio < best) {
+                        best = l->lk_prio;
+                }
         }
+        /* (we're running, not on a run queue, so nothing needs moving) */
+        curthread->t_inherit = best;
 
-        lock->lk_name = kstrdup(name);
-        if (lock->lk_name == NULL) {
-                kfree(lock);
-                return NULL;
+        if (level != THREAD_NOINHERIT) {
+                lock_pi_lend(lock, level);
         }
+        spinlock_release(&lock_pilock);
+}
 
+/* Freed locks keep their spinlock and wait channel in the cache, only the name is per lock */
+static
+int
+lock_ctor(void *obj)
+{
+        struct lock *lock = obj;
 
-        /* initialize the semaphore to 1 (indicating that it's free held by noone at initialization)*/
-        lock->lk_sem = sem_create(name, 1);
-        if (lock->lk_sem == NULL){
-                kfree(lock->lk_name);
-                kfree(lock); 
-                return NULL;
+        lock->lk_wchan = wchan_create("lock");
+        if (lock->lk_wchan == NULL){
+                return ENOMEM;
         }
+        spinlock_init(&lock->lk_lock);
 
-        /* No owner at the initiation stage.*/
+        /* free, with no owner and nobody waiting */
+        spinlock_data_set(&lock->lk_held, 0);
         lock->lk_owner = NULL; 
+        lock->lk_waiters = 0;
+        lock->lk_prio = THREAD_NOINHERIT;
+        lock->lk_pithread = NULL;
+        lock->lk_pinext = NULL;
+        return 0;
+}
 
+static
+void
+lock_dtor(void *obj)
+{
+        struct lock *lock = obj;
 
+        spinlock_cleanup(&lock->lk_lock);
+        wchan_destroy(lock->lk_wchan);
+}
 
+static struct kmem_cache lock_cache = KMEM_CACHE_INITIALIZER("lock", struct lock, lock_ctor, lock_dtor, KM_THREAD);
+
+struct lock *
+lock_create(const char *name)
+{
+        struct lock *lock;
+
+        lock = kmem_cache_alloc(&lock_cache);
+        if (lock == NULL) {
+                return NULL;
+        }
+
+        lock->lk_name = kstrdup(name);
+        if (lock->lk_name == NULL) {
+                kmem_cache_free(&lock_cache, lock);
+                return NULL;
+        }
+
+#if OPT_LOCKSTATS
+        /* locks from the cache may have belonged to another class */
+        lock->lk_stat.lh_class = NULL;
+        lock->lk_stat.lh_kind = LS_LOCK;
+        lock->lk_stat.lh_name = lock->lk_name;
+        lock->lk_stat.lh_site = __builtin_return_address(0);
+#endif
 
         return lock;
 }
@@ -189,39 +354,173 @@ lock_destroy(struct lock *lock)
         KASSERT(lock != NULL);
 
 
-        /* Make sure the lock doesn't have an ownner */
+        /* Make sure the lock is free and unwaited for (so it goes back to the cache as the constructor made it) */
         KASSERT(lock->lk_owner == NULL);
+        KASSERT(spinlock_data_get(&lock->lk_held) == 0);
+        KASSERT(lock->lk_waiters == 0);
+
+        /* a late lend (see lock_pi_lend) may have left it on somebody's chain */
+        if (lock->lk_pithread != NULL) {
+                spinlock_acquire(&lock_pilock);
+                lock_pi_unlink(lock);
+                spinlock_release(&lock_pilock);
+        }
         
-        sem_destroy(lock->lk_sem);
         kfree(lock->lk_name);   
-        kfree(lock);
+        kmem_cache_free(&lock_cache, lock);
 }
 
+/* 
+ * True while it's worth spinning for the lock: the owner is running on some other cpu. The owner is read without any
+ * locking and may change (or exit) under us; thread structs stay in the thread cache, so the worst case is spinning a
+ * little longer or giving up a little early.
+ */
+static
+bool
+lock_owner_running(struct lock *lock)
+{
+        volatile struct thread *owner = lock->lk_owner;
+
+        return owner != NULL && owner->t_state == S_RUN && owner->t_cpu != curcpu->c_self;
+}
 
 /* 
- * lock_acquire will wait (P) on the semaphore to acquire the lock. This may block if another thread is holding it.
- * When woken up, the thread will be the owner of the lock.
+ * lock_acquire takes the lock if it's free, spins while the owner is busy on another cpu, and otherwise sleeps until
+ * lock_release wakes us up to try again. When it returns the current thread is the owner of the lock.
  */
 void
 lock_acquire(struct lock *lock)
 {
-        /* Decremenet semaphore (done in P()) will block if busy */
-        P(lock->lk_sem); 
-        lock->lk_owner = curthread; 
+        unsigned spins;
+#if OPT_LOCKSTATS
+        uint64_t waitstart;
+        const void *blocker;
+#endif
+
+        KASSERT(lock != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(!lock_do_i_hold(lock));
+
+        /* Fast path: the lock is free */
+        if (spinlock_data_testandset(&lock->lk_held) == 0) {
+                membar_any_any();
+                lock->lk_owner = curthread;
+#if OPT_LOCKSTATS
+                lockstat_acquired(&lock->lk_stat, false, 0, NULL, __builtin_return_address(0));
+#endif
+                return;
+        }
+
+        TRACE(TR_LOCKWAIT, (vaddr_t)lock, (vaddr_t)__builtin_return_address(0));
+#if OPT_LOCKSTATS
+        waitstart = mainbus_cycles();
+        blocker = lock->lk_stat.lh_site;
+#endif
+
+        /* Spin while the owner is running elsewhere. Only read lk_held while spinning, so we don't bounce the line */
+        for (spins = 0; spins < LOCK_SPIN_MAX && lock_owner_running(lock); spins++) {
+                if (spinlock_data_get(&lock->lk_held) == 0 &&
+                    spinlock_data_testandset(&lock->lk_held) == 0) {
+                        membar_any_any();
+                        lock->lk_owner = curthread;
+                        TRACE(TR_LOCKGOT, (vaddr_t)lock, 0);
+#if OPT_LOCKSTATS
+                        lockstat_acquired(&lock->lk_stat, true, waitstart, blocker, __builtin_return_address(0));
+#endif
+                        return;
+                }
+        }
+
+        /* 
+         * Sleep. We count ourselves as a waiter before trying again, and lock_release clears lk_held before looking at
+         * the count, so either our test sees the lock free or the releaser sees us and wakes us (it needs lk_lock to do
+         * that, which we hold until we're on the wait channel). Whoever wakes us takes us off the count. Usually that's
+         * lock_release handing us the lock, in which case we're already the owner when we wake; otherwise we try again.
+         */
+        spinlock_acquire(&lock->lk_lock);
+        for (;;) {
+                lock->lk_waiters++;
+                membar_any_any();
+                if (spinlock_data_testandset(&lock->lk_held) == 0) {
+                        lock->lk_waiters--;
+                        membar_any_any();
+                        lock->lk_owner = curthread;
+                        break;
+                }
+
+                /* lend the owner our level while we wait */
+                spinlock_acquire(&lock_pilock);
+                curthread->t_blockedon = lock;
+                lock_pi_lend(lock, THREAD_LEVEL(curthread));
+                spinlock_release(&lock_pilock);
+
+                wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+                if (lock->lk_owner == curthread) {
+                        break;
+                }
+        }
+        spinlock_release(&lock->lk_lock);
+        if (curthread->t_blockedon != NULL) {
+                spinlock_acquire(&lock_pilock);
+                curthread->t_blockedon = NULL;
+                spinlock_release(&lock_pilock);
+        }
+        TRACE(TR_LOCKGOT, (vaddr_t)lock, 1);
+
+#if OPT_LOCKSTATS
+        lockstat_acquired(&lock->lk_stat, true, waitstart, blocker, __builtin_return_address(0));
+#endif
 }
 
-/*lock_release releases the lock and calls V() on the semaphore to wake up a waiting thread
+/*
+ * lock_release hands the lock straight to the oldest sleeper if there is one: lk_held stays set and the sleeper wakes
+ * up as the owner, so nobody can slip in between and the sleeper never has to go back to sleep. Otherwise it frees
+ * the lock for whoever comes along next.
  */
 void
 lock_release(struct lock *lock)
 {
-        
+        struct thread *next;
+        unsigned level;
+
         if (lock->lk_owner == curthread){
-                /* Reset lock owner to NULL */
+#if OPT_LOCKSTATS
+                lockstat_released(&lock->lk_stat);
+#endif
+                if (lock->lk_waiters > 0) {
+                        spinlock_acquire(&lock->lk_lock);
+                        next = wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
+                        if (next != NULL) {
+                                /* it can't look at lk_owner until it gets lk_lock back */
+                                lock->lk_waiters--;
+                                membar_any_any();
+                                lock->lk_owner = next;
+                                level = wchan_toplevel(lock->lk_wchan, &lock->lk_lock);
+                                spinlock_release(&lock->lk_lock);
+                                lock_pi_released(lock, level);
+                                return;
+                        }
+                        spinlock_release(&lock->lk_lock);
+                }
+
+                /* Reset lock owner to NULL, then let go */
                 lock->lk_owner = NULL;
-                
-                /* Increment semaphore */
-                V(lock->lk_sem);
+                membar_any_any();
+                spinlock_data_set(&lock->lk_held, 0);
+                membar_any_any();
+
+                /* 
+                 * Someone may have counted themselves in after we looked. They'll see the lock free when they try,
+                 * unless they're already asleep; then wake them up to try again.
+                 */
+                if (lock->lk_waiters > 0) {
+                        spinlock_acquire(&lock->lk_lock);
+                        if (wchan_wakeone(lock->lk_wchan, &lock->lk_lock) != NULL) {
+                                lock->lk_waiters--;
+                        }
+                        spinlock_release(&lock->lk_lock);
+                }
+                lock_pi_released(lock, THREAD_NOINHERIT);
         }
 }
 
@@ -241,39 +540,66 @@ lock_do_i_hold(struct lock *lock)
 /* Allow threads to wait for some condition to become true. Each cv has its own wait channel 
 * and spinlock. Threads must hold an external lock when calling cv_wait, cv_signal, or cv_broadcast which ensures proper
 * synchronization and complies with mesa semantics. 
+*
+* Signalling doesn't wake anybody up. The first thing a woken waiter would do is try for the lock, which the signaller
+* still holds, so cv_signal and cv_broadcast move waiters from the cv's wait channel straight onto the lock's (wait
+* morphing), and lock_release then hands the lock to them one at a time. That's why waiters and signallers must use
+* the same lock. Lock order: cv_lock before the lock's lk_lock.
 */
 
 
 
 
+/* Same as locks: the wait channel and spinlock stay with the cv in the cache */
+static
+int
+cv_ctor(void *obj)
+{
+        struct cv *cv = obj;
+
+        cv->cv_wchan = wchan_create("cv");
+        if(cv->cv_wchan == NULL){
+                return ENOMEM;
+        }
+
+        spinlock_init(&cv->cv_lock);                      
+        return 0;
+}
+
+static
+void
+cv_dtor(void *obj)
+{
+        struct cv *cv = obj;
+
+        spinlock_cleanup(&cv->cv_lock);
+        wchan_destroy(cv->cv_wchan);
+}
+
+static struct kmem_cache cv_cache = KMEM_CACHE_INITIALIZER("cv", struct cv, cv_ctor, cv_dtor, KM_THREAD);
+
 struct cv *
 cv_create(const char *name)
 {
         struct cv *cv;
 
-        cv = kmalloc(sizeof(struct cv));
+        cv = kmem_cache_alloc(&cv_cache);
         if (cv == NULL) {
                 return NULL;
         }
 
         cv->cv_name = kstrdup(name);
         if (cv->cv_name==NULL) {
-                kfree(cv);
+                kmem_cache_free(&cv_cache, cv);
                 return NULL;
         }
 
-
-        cv->cv_wchan = wchan_create(cv->cv_name);
-        if(cv->cv_wchan == NULL){
-                kfree(cv->cv_name);
-                kfree(cv);
-                return NULL;
-        }
-
-        spinlock_init(&cv->cv_lock);                      
-
-
-
+#if OPT_LOCKSTATS
+        cv->cv_stat.lh_class = NULL;
+        cv->cv_stat.lh_kind = LS_CV;
+        cv->cv_stat.lh_name = cv->cv_name;
+        cv->cv_stat.lh_site = __builtin_return_address(0);
+#endif
 
         return cv;
 }
@@ -283,20 +609,39 @@ cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
 
-        
-        spinlock_cleanup(&cv->cv_lock);
-        wchan_destroy(cv->cv_wchan);
-        
-
+        /* nobody may still be waiting on it */
+        spinlock_acquire(&cv->cv_lock);
+        KASSERT(wchan_isempty(cv->cv_wchan, &cv->cv_lock));
+        spinlock_release(&cv->cv_lock);
 
+        kfree(cv->cv_name);
+        kmem_cache_free(&cv_cache, cv);
+}
 
 
 
-        kfree(cv->cv_name);
-        kfree(cv);
-}
+/*
+ * Get the lock back after a cv wait. If we were moved onto the lock's wait channel, lock_release handed the lock to us
+ * before waking us; it set lk_owner under lk_lock, so look under lk_lock too.
+ */
+static
+void
+cv_relock(struct lock *lock)
+{
+        bool handed;
 
+        spinlock_acquire(&lock->lk_lock);
+        handed = lock->lk_owner == curthread;
+        spinlock_release(&lock->lk_lock);
 
+        if (!handed) {
+                lock_acquire(lock);
+                return;
+        }
+#if OPT_LOCKSTATS
+        lockstat_acquired(&lock->lk_stat, false, 0, NULL, __builtin_return_address(0));
+#endif
+}
 
 /*
  * cv_wait blocks the calling thread until the specified condition is signalled. 
@@ -306,6 +651,10 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
+#if OPT_LOCKSTATS
+        uint64_t start = mainbus_cycles();
+#endif
+
         KASSERT(cv != NULL);
         KASSERT(lock != NULL);
        
@@ -320,12 +669,43 @@ cv_wait(struct cv *cv, struct lock *lock)
 
         /* Atomically put thread to sleep while holding cv_lock ensuring no wakeups are missed */
         wchan_sleep(cv->cv_wchan, &cv->cv_lock); 
+#if OPT_LOCKSTATS
+        lockstat_slept(&cv->cv_stat, start);
+#endif
 
         /* After waking we drop the cv spinlock */
         spinlock_release(&cv->cv_lock);
         
-        /* Reacquire aller's lock so condition can be safely re-checked */
-        lock_acquire(lock);
+        /* Reacquire caller's lock so condition can be safely re-checked (we may have been handed it already) */
+        cv_relock(lock);
+}
+
+/*
+ * cv_timedwait is cv_wait with a limit of TICKS ticks on the sleep. It returns ETIMEDOUT if nobody signalled us by
+ * then, 0 otherwise. Either way the lock is held again on return and the caller re-checks its condition.
+ */
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks)
+{
+        bool timedout;
+#if OPT_LOCKSTATS
+        uint64_t start = mainbus_cycles();
+#endif
+
+        KASSERT(cv != NULL);
+        KASSERT(lock != NULL);
+        KASSERT(lock_do_i_hold(lock));
+
+        spinlock_acquire(&cv->cv_lock);
+        lock_release(lock);
+        timedout = wchan_timedsleep(cv->cv_wchan, &cv->cv_lock, ticks);
+#if OPT_LOCKSTATS
+        lockstat_slept(&cv->cv_stat, start);
+#endif
+        spinlock_release(&cv->cv_lock);
+        cv_relock(lock);
+
+        return timedout ? ETIMEDOUT : 0;
 }
 
 /*
@@ -339,8 +719,11 @@ cv_signal(struct cv *cv, struct lock *lock)
         KASSERT(lock != NULL); 
         KASSERT(lock_do_i_hold(lock));
 
+        /* Move one waiter onto the lock; it runs once we let the lock go */
         spinlock_acquire(&cv->cv_lock);
-        wchan_wakeone(cv->cv_wchan, &cv->cv_lock);
+        spinlock_acquire(&lock->lk_lock);
+        lock->lk_waiters += wchan_move(cv->cv_wchan, &cv->cv_lock, lock->lk_wchan, &lock->lk_lock, 1);
+        spinlock_release(&lock->lk_lock);
         spinlock_release(&cv->cv_lock);
 
 }
@@ -355,9 +738,157 @@ cv_broadcast(struct cv *cv, struct lock *lock)
         KASSERT(lock != NULL); 
         KASSERT(lock_do_i_hold(lock));
 
+        /* Move them all onto the lock instead of waking them to fight over it */
         spinlock_acquire(&cv->cv_lock);        
-        wchan_wakeall(cv->cv_wchan, &cv->cv_lock);
+        spinlock_acquire(&lock->lk_lock);
+        lock->lk_waiters += wchan_move(cv->cv_wchan, &cv->cv_lock, lock->lk_wchan, &lock->lk_lock, (unsigned)-1);
+        spinlock_release(&lock->lk_lock);
         spinlock_release(&cv->cv_lock);
 
 
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+/*
+ * Readers wait while a writer holds the lock or is waiting for it (writer preference), unless rw_passes lets them
+ * through. rw_passes is handed out by rwlock_release_write: when it has let RWLOCK_WRITER_STREAK writers go in a row
+ * while readers were waiting, it lets as many readers as were waiting go ahead of the next writer, and writers wait until
+ * those passes are used up. Every reader that gets in while passes are left uses one, so they always run out.
+ */
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc_tagged(sizeof(*rw), KM_THREAD);
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rw_name = kstrdup(name);
+        if (rw->rw_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_readwchan = wchan_create(rw->rw_name);
+        if (rw->rw_readwchan == NULL) {
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_writewchan = wchan_create(rw->rw_name);
+        if (rw->rw_writewchan == NULL) {
+                wchan_destroy(rw->rw_readwchan);
+                kfree(rw->rw_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        spinlock_init(&rw->rw_lock);
+        rw->rw_readers = 0;
+        rw->rw_writer = NULL;
+        rw->rw_waitreaders = 0;
+        rw->rw_waitwriters = 0;
+        rw->rw_streak = 0;
+        rw->rw_passes = 0;
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_writer == NULL);
+        KASSERT(rw->rw_waitreaders == 0 && rw->rw_waitwriters == 0);
+
+        spinlock_cleanup(&rw->rw_lock);
+        wchan_destroy(rw->rw_writewchan);
+        wchan_destroy(rw->rw_readwchan);
+        kfree(rw->rw_name);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(rw->rw_writer != curthread);
+
+        spinlock_acquire(&rw->rw_lock);
+        while (rw->rw_writer != NULL || (rw->rw_waitwriters > 0 && rw->rw_passes == 0)) {
+                rw->rw_waitreaders++;
+                wchan_sleep(rw->rw_readwchan, &rw->rw_lock);
+                rw->rw_waitreaders--;
+        }
+        if (rw->rw_passes > 0) {
+                rw->rw_passes--;
+        }
+        rw->rw_readers++;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_readers > 0);
+        rw->rw_readers--;
+        if (rw->rw_readers == 0 && rw->rw_waitwriters > 0) {
+                wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+        }
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(rw->rw_writer != curthread);
+
+        spinlock_acquire(&rw->rw_lock);
+        while (rw->rw_writer != NULL || rw->rw_readers > 0 || rw->rw_passes > 0) {
+                rw->rw_waitwriters++;
+                wchan_sleep(rw->rw_writewchan, &rw->rw_lock);
+                rw->rw_waitwriters--;
+        }
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rwlock_do_i_hold_write(rw));
+
+        spinlock_acquire(&rw->rw_lock);
+        rw->rw_writer = NULL;
+
+        if (rw->rw_waitreaders > 0 && (rw->rw_waitwriters == 0 || ++rw->rw_streak >= RWLOCK_WRITER_STREAK)) {
+                /* readers' turn; if writers are waiting, only the readers waiting now may go first */
+                rw->rw_streak = 0;
+                rw->rw_passes = rw->rw_waitwriters > 0 ? rw->rw_waitreaders : 0;
+                wchan_wakeall(rw->rw_readwchan, &rw->rw_lock);
+        }
+        else if (rw->rw_waitwriters > 0) {
+                wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+        }
+        spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+        return rw->rw_writer == curthread;
+}
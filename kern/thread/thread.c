@@ -37,6 +37,7 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <array.h>
+#include <atomic.h>
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
@@ -44,16 +45,27 @@
 #include <thread.h>
 #include <threadlist.h>
 #include <threadprivate.h>
+#include <timer.h>
+#include <workqueue.h>
+#include <epoch.h>
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
+#include <clock.h>
+#include <membar.h>
+#include <schedtrace.h>
+#include <stats.h>
+#include <trace.h>
 #include <vnode.h>
+#include <kmem_cache.h>
 
 
 
 #include "opt-synchprobs.h"
+#include "opt-wchandebug.h"
+#include "opt-uniprocessor.h"
 
 
 
@@ -64,23 +76,54 @@
 struct wchan {
 	const char *wc_name;		/* name for this channel */
 	struct threadlist wc_threads;	/* list of waiting threads */
+#if OPT_WCHANDEBUG
 	unsigned wc_index;		/* index into allwchans[] */
+#endif
 };
 
+/* Wakeup latency is being recorded (see schedtrace.h). */
+static volatile bool schedlat_on;
+static void schedlat_stamp(struct thread *t, struct cpu *c);
+static void schedlat_count(struct thread *t);
+
 /* Master array of CPUs. */
 DECLARRAY(cpu, static __UNUSED inline);
 DEFARRAY(cpu, static __UNUSED inline);
 static struct cpuarray allcpus;
 
-/* Array of all wchans (for debugging purposes) */
+#if OPT_WCHANDEBUG
+/*
+ * Array of all wchans, for the gdb scripts in kern/gdbscripts/wchan.
+ * Every wchan_create and wchan_destroy goes through the one lock, so
+ * it's only kept with the wchandebug option.
+ */
 DECLARRAY(wchan, static __UNUSED inline);
 DEFARRAY(wchan, static __UNUSED inline);
 static struct spinlock allwchans_lock;
 static struct wchanarray allwchans;
+#endif
 
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/*
+ * Run queue levels (see cpu.h): SCHED_DEADLINE threads are at 0, each
+ * SCHED_FIFO priority has a level, and the time-sharing levels start
+ * at SCHED_TSLEVEL.
+ */
+#define SCHED_TSLEVEL CPU_RUNQUEUE_RTLEVELS
+#define SCHED_FIFOLEVEL(prio) (1 + SCHED_FIFO_MAXPRIO - (prio))
+
+/* c_release when there's nothing throttled on the cpu */
+#define SCHED_NORELEASE ((uint64_t)-1)
+
+/*
+ * Admission control for SCHED_DEADLINE: the thousandths of a cpu
+ * promised to deadline threads, all of them on all cpus.
+ */
+static struct spinlock sched_rtlock = SPINLOCK_INITIALIZER;
+static unsigned sched_dlutil;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -120,9 +163,96 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Spare stacks. Each cpu keeps up to CPU_STACKCACHE_SIZE stacks that
+ * already have the magic numbers of thread_checkstack_init in them,
+ * so thread_fork doesn't have to go to kmalloc (and the page
+ * allocator) for one. Stacks are checked when they come back, so the
+ * magic is still good when they go out again.
+ */
+static
+void *
+thread_stack_get(void)
+{
+	void *stack;
+	int spl;
+
+	/* interrupts off so curcpu can't change while we use its list */
+	spl = splhigh();
+	if (curcpu->c_nstacks > 0) {
+		stack = curcpu->c_stacks[--curcpu->c_nstacks];
+		splx(spl);
+		return stack;
+	}
+	splx(spl);
+
+	stack = kmalloc_tagged(STACK_SIZE, KM_THREAD);
+	if (stack != NULL) {
+		((uint32_t *)stack)[0] = THREAD_STACK_MAGIC;
+		((uint32_t *)stack)[1] = THREAD_STACK_MAGIC;
+		((uint32_t *)stack)[2] = THREAD_STACK_MAGIC;
+		((uint32_t *)stack)[3] = THREAD_STACK_MAGIC;
+	}
+	return stack;
+}
+
+static
+void
+thread_stack_put(void *stack)
+{
+	int spl;
+
+	KASSERT(((uint32_t *)stack)[0] == THREAD_STACK_MAGIC);
+	KASSERT(((uint32_t *)stack)[1] == THREAD_STACK_MAGIC);
+	KASSERT(((uint32_t *)stack)[2] == THREAD_STACK_MAGIC);
+	KASSERT(((uint32_t *)stack)[3] == THREAD_STACK_MAGIC);
+
+	spl = splhigh();
+	if (curcpu->c_nstacks < CPU_STACKCACHE_SIZE) {
+		curcpu->c_stacks[curcpu->c_nstacks++] = stack;
+		splx(spl);
+		return;
+	}
+	splx(spl);
+
+	kfree(stack);
+}
+
+/*
+ * Thread structures are cached, and a thread that had a stack keeps
+ * it while in the cache, so most forks don't allocate one either.
+ * Threads leaving the cache give their stack to the spare stacks.
+ */
+static
+int
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	thread->t_stack = NULL;
+	return 0;
+}
+
+static
+void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	if (thread->t_stack != NULL) {
+		thread_stack_put(thread->t_stack);
+	}
+}
+
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", struct thread, thread_ctor, thread_dtor,
+			       KM_THREAD);
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
+ *
+ * t_stack may already point to a stack from the cache.
  */
 static
 struct thread *
@@ -132,14 +262,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(&thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(&thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -148,10 +278,31 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_loadas = NULL;
+	thread->t_policy = SCHED_OTHER;
+	thread->t_priority = SCHED_TSLEVEL;
+	thread->t_inherit = THREAD_NOINHERIT;
+	thread->t_blockedon = NULL;
+	thread->t_pilocks = NULL;
+	thread->t_ticks = 0;
+	thread->t_budget = 0;
+	thread->t_period = 0;
+	thread->t_used = 0;
+	thread->t_deadline = 0;
+	thread->t_throttled = false;
+	thread->t_lastcpu = NULL;
+	thread->t_lastran = 0;
+	thread->t_cpumask = THREAD_ALLCPUS;
+	thread->t_wakenext = NULL;
+	bzero(&thread->t_times, sizeof(thread->t_times));
+	thread->t_timestamp = 0;
+	thread->t_wakeat = 0;
+	thread->t_wakekind = SL_LOCAL;
+	thread->t_epochnest = 0;
+	thread->t_resched = false;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -177,8 +328,9 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
-	c = kmalloc(sizeof(*c));
+	c = kmalloc_tagged(sizeof(*c), KM_THREAD);
 	if (c == NULL) {
 		panic("cpu_create: Out of memory\n");
 	}
@@ -190,13 +342,49 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_npagecache = 0;
+	for (i=0; i<CPU_KMCACHE_NSIZES; i++) {
+		c->c_nkmcache[i] = 0;
+	}
+	c->c_nstacks = 0;
+	c->c_asid = 0;
+	c->c_asid_generation = 0;
+	c->c_tlb_victim = 0;
+	c->c_cyclebase = 0;
+	c->c_tickspan = 1;
+	c->c_tickdone = 0;
+	c->c_tracecount = 0;
+	bzero(c->c_wakelat, sizeof(c->c_wakelat));
+	c->c_epochseen = epoch_gen;
+	bzero(c->c_stats, sizeof(c->c_stats));
+	c->c_idlecycles = 0;
+	c->c_idlestart = 0;
+#if OPT_IRQSTATS
+	bzero(c->c_hists, sizeof(c->c_hists));
+	c->c_irqoff = 0;
+#endif
+	c->c_loghead = 0;
+	c->c_logtail = 0;
+	c->c_logdropped = 0;
+	c->c_logreported = 0;
 
+	c->c_wakeups = NULL;
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<CPU_RUNQUEUE_LEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
+	c->c_release = SCHED_NORELEASE;
 	spinlock_init(&c->c_runqueue_lock);
 
+	c->c_workhead = NULL;
+	c->c_worktail = &c->c_workhead;
+	c->c_workwchan = NULL;
+	spinlock_init(&c->c_work_lock);
+
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -220,13 +408,19 @@ cpu_create(unsigned hardware_number)
 		 * cpu. This means we're using the boot stack, which
 		 * can't be freed. (Exercise: what would it take to
 		 * make it possible to free the boot stack?)
+		 *
+		 * Nothing has been freed to the thread cache this
+		 * early, so the thread doesn't have a stack yet.
 		 */
-		/*c->c_curthread->t_stack = ... */
+		KASSERT(c->c_curthread->t_stack == NULL);
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
 		if (c->c_curthread->t_stack == NULL) {
-			panic("cpu_create: couldn't allocate stack");
+			c->c_curthread->t_stack = kmalloc_tagged(STACK_SIZE,
+								 KM_THREAD);
+			if (c->c_curthread->t_stack == NULL) {
+				panic("cpu_create: couldn't allocate stack");
+			}
 		}
 		thread_checkstack_init(c->c_curthread);
 	}
@@ -257,11 +451,12 @@ thread_destroy(struct thread *thread)
 	 * either here or in thread_exit(). (And not both...)
 	 */
 
-	/* Thread subsystem fields */
+	/*
+	 * Thread subsystem fields (the stack stays with the thread in
+	 * the cache; check it now so it goes back out with its magic)
+	 */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
+	thread_checkstack(thread);
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
@@ -269,7 +464,7 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(&thread_cache, thread);
 }
 
 /*
@@ -299,6 +494,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -313,9 +510,14 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<CPU_RUNQUEUE_LEVELS; i++) {
+		struct threadlist *rq = &curcpu->c_runqueue[i];
+
+		rq->tl_count = 0;
+		rq->tl_head.tln_next = &rq->tl_tail;
+		rq->tl_tail.tln_prev = &rq->tl_head;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -390,9 +592,11 @@ thread_bootstrap(void)
 	/* cpu_create() should have set t_proc. */
 	KASSERT(curthread->t_proc != NULL);
 
+#if OPT_WCHANDEBUG
 	/* Initialize allwchans */
 	spinlock_init(&allwchans_lock);
 	wchanarray_init(&allwchans);
+#endif
 
 	/* Done */
 }
@@ -419,25 +623,45 @@ cpu_hatch(unsigned software_number)
 
 	kprintf("cpu%u: %s\n", software_number, buf);
 
+	workqueue_startcpu();
 	V(cpu_startup_sem);
 	thread_exit();
 }
 
 /*
- * Start up secondary cpus. Called from boot().
+ * Start up secondary cpus. Called from boot(), which doesn't wait for
+ * them to hatch until thread_wait_cpus at the end.
  */
 void
 thread_start_cpus(void)
 {
 	char buf[64];
-	unsigned i;
 
 	cpu_identify(buf, sizeof(buf));
 	kprintf("cpu0: %s\n", buf);
+	workqueue_startcpu();
 
 	cpu_startup_sem = sem_create("cpu_hatch", 0);
+	if (cpu_startup_sem == NULL) {
+		panic("thread_start_cpus: Out of memory\n");
+	}
+#if OPT_UNIPROCESSOR
+	/* (so thread_wait_cpus has nobody to wait for) */
+	kprintf("Uniprocessor kernel: other cpus are left stopped\n");
+#else
 	mainbus_start_cpus();
+#endif
+}
+
+/*
+ * Wait for the cpus thread_start_cpus started to come up.
+ */
+void
+thread_wait_cpus(void)
+{
+	unsigned i;
 
+	KASSERT(cpu_startup_sem != NULL);
 	for (i=0; i<cpuarray_num(&allcpus) - 1; i++) {
 		P(cpu_startup_sem);
 	}
@@ -446,158 +670,821 @@ thread_start_cpus(void)
 }
 
 /*
- * Make a thread runnable.
- *
- * targetcpu might be curcpu; it might not be, too.
+ * Deadline bookkeeping. A SCHED_DEADLINE thread's period ends at
+ * t_deadline; once it has run t_budget ticks of it, it's throttled:
+ * dropped to the bottom time-sharing level, where it only runs when
+ * nothing else wants to, until the period is over. Then it gets a new
+ * period starting there and then, and level 0 back. Call these with
+ * the runqueue lock of T's cpu.
  */
+
+/* Start T's next period, if its last one is over by NOW. */
 static
 void
-thread_make_runnable(struct thread *target, bool already_have_lock)
+sched_replenish(struct thread *t, uint64_t now)
 {
-	struct cpu *targetcpu;
-
-	/* Lock the run queue of the target thread's cpu. */
-	targetcpu = target->t_cpu;
+	KASSERT(t->t_policy == SCHED_DEADLINE);
 
-	if (already_have_lock) {
-		/* The target thread's cpu should be already locked. */
-		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+	if (now < t->t_deadline) {
+		return;
 	}
-	else {
-		spinlock_acquire(&targetcpu->c_runqueue_lock);
+	t->t_deadline = now + t->t_period;
+	t->t_used = 0;
+	if (t->t_throttled) {
+		t->t_throttled = false;
+		t->t_priority = 0;
+		t->t_ticks = 0;
 	}
+}
 
-	/* Target thread is now ready to run; put it on the run queue. */
-	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+/* T has used up its budget. */
+static
+void
+sched_throttle(struct thread *t)
+{
+	KASSERT(t->t_policy == SCHED_DEADLINE);
 
-	if (targetcpu->c_isidle) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
-	}
+	t->t_throttled = true;
+	t->t_priority = CPU_RUNQUEUE_LEVELS - 1;
+	t->t_ticks = 0;
+}
 
-	if (!already_have_lock) {
-		spinlock_release(&targetcpu->c_runqueue_lock);
+/* The thousandths of a cpu T has been promised. Needs sched_rtlock. */
+static
+unsigned
+sched_util(struct thread *t)
+{
+	if (t->t_policy != SCHED_DEADLINE) {
+		return 0;
 	}
+	return DIVROUNDUP((uint64_t)t->t_budget * 1000, t->t_period);
 }
 
 /*
- * Create a new thread based on an existing one.
- *
- * The new thread has name NAME, and starts executing in function
- * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
- *
- * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * Run queue access. Each cpu has one run queue per priority level;
+ * threads are taken from the highest nonempty level first. The
+ * caller holds the cpu's runqueue lock.
  */
-int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+
+/*
+ * Put T at the tail of its level (with any level it's lent) on C, or
+ * for level 0, ahead of the threads with later deadlines. (A thread
+ * only lent level 0 has no deadline and goes ahead of all of them.)
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
 {
-	struct thread *newthread;
-	int result;
+	struct thread *t2;
+	unsigned level;
 
-	newthread = thread_create(name);
-	if (newthread == NULL) {
-		return ENOMEM;
-	}
+	KASSERT(t->t_priority < CPU_RUNQUEUE_LEVELS);
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+	if (t->t_policy == SCHED_DEADLINE) {
+		sched_replenish(t, timer_now());
+		if (t->t_throttled && t->t_deadline < c->c_release) {
+			c->c_release = t->t_deadline;
+		}
 	}
-	thread_checkstack_init(newthread);
-
-	/*
-	 * Now we clone various fields from the parent thread.
-	 */
 
-	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
-
-	/* Attach the new thread to its process */
-	if (proc == NULL) {
-		proc = curthread->t_proc;
+	level = THREAD_LEVEL(t);
+	if (level == 0) {
+		THREADLIST_FORALL(t2, c->c_runqueue[0]) {
+			if (t->t_deadline < t2->t_deadline) {
+				break;
+			}
+		}
+		if (t2 != NULL) {
+			threadlist_insertbefore(&c->c_runqueue[0], t, t2);
+		}
+		else {
+			threadlist_addtail(&c->c_runqueue[0], t);
+		}
 	}
-	result = proc_addthread(proc, newthread);
-	if (result) {
-		/* thread_destroy will clean up the stack */
-		thread_destroy(newthread);
-		return result;
+	else {
+		threadlist_addtail(&c->c_runqueue[level], t);
 	}
+	c->c_runcount++;
+}
 
-	/*
-	 * Because new threads come out holding the cpu runqueue lock
-	 * (see notes at bottom of thread_switch), we need to account
-	 * for the spllower() that will be done releasing it.
-	 */
-	newthread->t_iplhigh_count++;
+/* Take the next thread to run off C, or return NULL if there isn't one. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
 
-	/* Set up the switchframe so entrypoint() gets called */
-	switchframe_init(newthread, entrypoint, data1, data2);
+	for (i=0; i<CPU_RUNQUEUE_LEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
-	thread_make_runnable(newthread, false);
+#if !OPT_UNIPROCESSOR	/* only migration uses these */
 
-	return 0;
+/* Take the thread that would run last off C, or return NULL. */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=CPU_RUNQUEUE_LEVELS; i-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
 }
 
 /*
- * High level, machine-independent context switch code.
- *
- * The current thread is queued appropriately and its state is changed
- * to NEWSTATE; another thread to run is selected and switched to.
- *
- * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
- * WC, protected by the spinlock LK. Otherwise WC and Lk should be
- * NULL.
+ * Take a thread that may not run on C off C, or return NULL. Skips
+ * C's curthread (see thread_consider_migration).
  */
 static
-void
-thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
+struct thread *
+runqueue_remdisallowed(struct cpu *c)
 {
-	struct thread *cur, *next;
-	int spl;
+	struct thread *t;
+	unsigned i;
 
-	DEBUGASSERT(curcpu->c_curthread == curthread);
-	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
+	for (i=0; i<CPU_RUNQUEUE_LEVELS; i++) {
+		THREADLIST_FORALL(t, c->c_runqueue[i]) {
+			if (!THREAD_CPU_OK(t, c) && t != c->c_curthread) {
+				threadlist_remove(&c->c_runqueue[i], t);
+				c->c_runcount--;
+				return t;
+			}
+		}
+	}
+	return NULL;
+}
 
-	/* Explicitly disable interrupts on this processor */
-	spl = splhigh();
+#endif /* !OPT_UNIPROCESSOR */
 
-	cur = curthread;
+/* Highest level with a thread waiting on C (CPU_RUNQUEUE_LEVELS if none). */
+static
+unsigned
+runqueue_toplevel(struct cpu *c)
+{
+	unsigned i;
 
-	/*
-	 * If we're idle, return without doing anything. This happens
-	 * when the timer interrupt interrupts the idle loop.
-	 */
-	if (curcpu->c_isidle) {
-		splx(spl);
-		return;
+	for (i=0; i<CPU_RUNQUEUE_LEVELS; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			break;
+		}
 	}
+	return i;
+}
 
-	/* Check the stack guard band. */
-	thread_checkstack(cur);
+/*
+ * Remote wakeups. Waking a thread onto another cpu doesn't take that
+ * cpu's runqueue lock, which would then bounce between every cpu
+ * that wakes threads there: the thread goes on the other cpu's
+ * c_wakeups, a list pushed onto with atomic_cas_ptr, and the owner
+ * moves them all into its run queue the next time it looks at it
+ * (thread_switch, including the idle loop, and thread_tick). So only
+ * an idle cpu needs an IPI; a busy one finds the thread at its next
+ * switch or hardclock, which is as soon as it would have preempted
+ * for it anyway.
+ */
 
-	/* Lock the run queue. */
-	spinlock_acquire(&curcpu->c_runqueue_lock);
+/* Push T onto C's wakeups. */
+static
+void
+wakeups_push(struct cpu *c, struct thread *t)
+{
+	struct thread *head;
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
-		spinlock_release(&curcpu->c_runqueue_lock);
-		splx(spl);
+	do {
+		head = c->c_wakeups;
+		t->t_wakenext = head;
+	} while (!atomic_cas_ptr((void *volatile *)&c->c_wakeups, head, t));
+}
+
+/*
+ * Move this cpu's wakeups into its run queue, in the order they came
+ * (the list is a stack). Call with our runqueue lock held.
+ */
+static
+void
+wakeups_drain(void)
+{
+	struct cpu *c = curcpu->c_self;
+	struct thread *list, *t, *prev;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (c->c_wakeups == NULL) {
 		return;
 	}
-
-	/* Put the thread in the right place. */
+	do {
+		list = c->c_wakeups;
+	} while (!atomic_cas_ptr((void *volatile *)&c->c_wakeups, list, NULL));
+
+	prev = NULL;
+	while (list != NULL) {
+		t = list;
+		list = t->t_wakenext;
+		t->t_wakenext = prev;
+		prev = t;
+	}
+	while (prev != NULL) {
+		t = prev;
+		prev = t->t_wakenext;
+		t->t_wakenext = NULL;
+		runqueue_add(c, t);
+	}
+}
+
+/*
+ * The least busy cpu T may run on. The run queue lengths are only a
+ * hint, so no locks.
+ */
+static
+struct cpu *
+thread_pickcpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus;
+
+	best = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (THREAD_CPU_OK(t, c) &&
+		    (best == NULL || c->c_runcount < best->c_runcount)) {
+			best = c;
+		}
+	}
+	/* thread_setaffinity doesn't allow masks without a real cpu */
+	KASSERT(best != NULL);
+	return best;
+}
+
+unsigned
+thread_numcpus(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+thread_getcpu(unsigned num)
+{
+	return cpuarray_get(&allcpus, num);
+}
+
+int
+thread_setaffinity(struct thread *t, uint32_t mask)
+{
+	uint32_t present;
+	unsigned i, numcpus;
+
+	present = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		present |= 1U << cpuarray_get(&allcpus, i)->c_number;
+	}
+	if ((mask & present) == 0) {
+		return EINVAL;
+	}
+
+	/*
+	 * One word, so no lock; the scheduler may see the old mask
+	 * for a little while, which only delays the move.
+	 */
+	t->t_cpumask = mask & present;
+	return 0;
+}
+
+/*
+ * Scheduling classes. A class asked for is checked and turned into
+ * its run queue level and, for SCHED_DEADLINE, ticks (rounding up, so
+ * a thread never gets less than it asked for). Admission control only
+ * looks at SCHED_DEADLINE: FIFO threads promise nothing to anyone.
+ */
+
+struct sched_class {
+	int policy;
+	unsigned level;
+	unsigned budget;
+	unsigned period;
+};
+
+static
+unsigned
+sched_mstoticks(unsigned ms)
+{
+	return DIVROUNDUP((uint64_t)ms * HZ, 1000);
+}
+
+static
+int
+sched_check(const struct sched_attr *sa, struct sched_class *sc)
+{
+	sc->policy = sa->sa_policy;
+	sc->level = SCHED_TSLEVEL;
+	sc->budget = 0;
+	sc->period = 0;
+
+	switch (sa->sa_policy) {
+	    case SCHED_OTHER:
+		break;
+	    case SCHED_FIFO:
+		if (sa->sa_priority < 1 ||
+		    sa->sa_priority > SCHED_FIFO_MAXPRIO) {
+			return EINVAL;
+		}
+		sc->level = SCHED_FIFOLEVEL(sa->sa_priority);
+		break;
+	    case SCHED_DEADLINE:
+		if (sa->sa_budget == 0 || sa->sa_budget > sa->sa_period) {
+			return EINVAL;
+		}
+		sc->level = 0;
+		sc->budget = sched_mstoticks(sa->sa_budget);
+		sc->period = sched_mstoticks(sa->sa_period);
+		break;
+	    default:
+		return EINVAL;
+	}
+	return 0;
+}
+
+/* The thousandths of a cpu SC promises. */
+static
+unsigned
+sched_classutil(const struct sched_class *sc)
+{
+	if (sc->policy != SCHED_DEADLINE) {
+		return 0;
+	}
+	return DIVROUNDUP((uint64_t)sc->budget * 1000, sc->period);
+}
+
+/*
+ * Trade OLD thousandths of a cpu for NEW ones, if there are enough.
+ * Needs sched_rtlock.
+ */
+static
+bool
+sched_admit(unsigned old, unsigned new)
+{
+	KASSERT(spinlock_do_i_hold(&sched_rtlock));
+	KASSERT(old <= sched_dlutil);
+
+	if (sched_dlutil - old + new >
+	    SCHED_DEADLINE_MAXUTIL * cpuarray_num(&allcpus)) {
+		return false;
+	}
+	sched_dlutil = sched_dlutil - old + new;
+	return true;
+}
+
+/*
+ * Put T in class SC, requeueing it if it's waiting to run. As with
+ * thread_lend, it might be between cpus, and then it's queued with
+ * the new class when it lands; if it's running, it's charged by the
+ * new class from its next hardclock.
+ */
+static
+void
+sched_set(struct thread *t, const struct sched_class *sc)
+{
+	struct cpu *c;
+	struct thread *t2;
+	bool queued;
+
+	for (;;) {
+		c = t->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (t->t_cpu == c) {
+			break;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+
+	queued = false;
+	if (t->t_state == S_READY) {
+		THREADLIST_FORALL(t2, c->c_runqueue[THREAD_LEVEL(t)]) {
+			if (t2 == t) {
+				threadlist_remove(
+					&c->c_runqueue[THREAD_LEVEL(t)], t);
+				c->c_runcount--;
+				queued = true;
+				break;
+			}
+		}
+	}
+
+	t->t_policy = sc->policy;
+	t->t_priority = sc->level;
+	t->t_ticks = 0;
+	t->t_budget = sc->budget;
+	t->t_period = sc->period;
+	t->t_used = 0;
+	t->t_throttled = false;
+	t->t_deadline = 0;
+	if (sc->policy == SCHED_DEADLINE) {
+		t->t_deadline = timer_now() + sc->period;
+	}
+
+	if (queued) {
+		runqueue_add(c, t);
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+int
+thread_setsched(struct thread *t, const struct sched_attr *sa)
+{
+	struct sched_class sc;
+	int result;
+
+	result = sched_check(sa, &sc);
+	if (result) {
+		return result;
+	}
+
+	spinlock_acquire(&sched_rtlock);
+	if (!sched_admit(sched_util(t), sched_classutil(&sc))) {
+		spinlock_release(&sched_rtlock);
+		return EBUSY;
+	}
+	sched_set(t, &sc);
+	spinlock_release(&sched_rtlock);
+	return 0;
+}
+
+int
+thread_setsched_proc(struct proc *p, const struct sched_attr *sa)
+{
+	struct sched_class sc;
+	unsigned i, num, old;
+	int result;
+
+	result = sched_check(sa, &sc);
+	if (result) {
+		return result;
+	}
+
+	/* all the threads or none */
+	spinlock_acquire(&p->p_lock);
+	spinlock_acquire(&sched_rtlock);
+	num = threadarray_num(&p->p_threads);
+	old = 0;
+	for (i=0; i<num; i++) {
+		old += sched_util(threadarray_get(&p->p_threads, i));
+	}
+	if (!sched_admit(old, num * sched_classutil(&sc))) {
+		result = EBUSY;
+	}
+	else {
+		for (i=0; i<num; i++) {
+			sched_set(threadarray_get(&p->p_threads, i), &sc);
+		}
+	}
+	spinlock_release(&sched_rtlock);
+	spinlock_release(&p->p_lock);
+	return result;
+}
+
+void
+thread_getsched(struct thread *t, struct sched_attr *sa)
+{
+	/* one word each; read the lot under the lock so they match */
+	spinlock_acquire(&sched_rtlock);
+	sa->sa_policy = t->t_policy;
+	sa->sa_priority = 0;
+	sa->sa_budget = 0;
+	sa->sa_period = 0;
+	if (t->t_policy == SCHED_FIFO) {
+		sa->sa_priority = 1 + SCHED_FIFO_MAXPRIO - t->t_priority;
+	}
+	else if (t->t_policy == SCHED_DEADLINE) {
+		sa->sa_budget = t->t_budget * 1000 / HZ;
+		sa->sa_period = t->t_period * 1000 / HZ;
+	}
+	spinlock_release(&sched_rtlock);
+}
+
+/*
+ * Make a thread runnable.
+ *
+ * targetcpu might be curcpu; it might not be, too.
+ */
+static
+void
+thread_make_runnable(struct thread *target, bool already_have_lock)
+{
+	struct cpu *targetcpu;
+	bool oncpu;
+
+	targetcpu = target->t_cpu;
+
+	/*
+	 * If the thread may no longer run on its cpu, send it to one
+	 * it may run on, unless that cpu is still on its stack (it
+	 * went idle after the thread went to sleep; see the curthread
+	 * notes in thread_consider_migration). Not when called from
+	 * thread_switch, which is still on the thread's stack itself.
+	 */
+	if (!already_have_lock && !THREAD_CPU_OK(target, targetcpu)) {
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		oncpu = targetcpu->c_curthread == target;
+		spinlock_release(&targetcpu->c_runqueue_lock);
+		if (!oncpu) {
+			targetcpu = thread_pickcpu(target);
+			target->t_cpu = targetcpu;
+		}
+	}
+
+	/*
+	 * Another cpu's: hand it over (see wakeups_push). The push is
+	 * a full barrier, and the idle loop sets c_isidle before its
+	 * last look at c_wakeups, so either it sees the thread or we
+	 * see that it's idle.
+	 */
+	if (!already_have_lock && targetcpu != curcpu->c_self) {
+		target->t_state = S_READY;
+		schedtrace_record(ST_WAKEUP, target, targetcpu->c_number);
+		if (schedlat_on) {
+			schedlat_stamp(target, targetcpu);
+		}
+		wakeups_push(targetcpu, target);
+		if (targetcpu->c_isidle) {
+			ipi_send(targetcpu, IPI_UNIDLE);
+		}
+		return;
+	}
+
+	/* Lock the run queue of the target thread's cpu. */
+
+	if (already_have_lock) {
+		/* The target thread's cpu should be already locked. */
+		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+	}
+	else {
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+	}
+
+	/* Target thread is now ready to run; put it on the run queue. */
+	target->t_state = S_READY;
+	runqueue_add(targetcpu, target);
+	if (!already_have_lock) {
+		/* (otherwise it's thread_switch requeueing curthread) */
+		schedtrace_record(ST_WAKEUP, target, targetcpu->c_number);
+		if (schedlat_on) {
+			schedlat_stamp(target, targetcpu);
+		}
+	}
+
+	if (targetcpu->c_isidle) {
+		/*
+		 * Other processor is idle; send interrupt to make
+		 * sure it unidles.
+		 */
+		ipi_send(targetcpu, IPI_UNIDLE);
+	}
+
+	if (!already_have_lock) {
+		spinlock_release(&targetcpu->c_runqueue_lock);
+	}
+}
+
+/*
+ * Work stealing.
+ *
+ * A cpu about to go idle takes a thread from the peer with the most
+ * threads waiting, rather than waiting for that peer's next
+ * thread_consider_migration. A thread that ran on the peer in the
+ * last THREAD_HOT_HARDCLOCKS probably still has its working set in
+ * that peer's cache, so it is left alone; we look from the tail of
+ * the lowest level, where the threads that have waited longest and
+ * run least interactively are. If every waiting thread is hot we
+ * idle and try again after the next interrupt.
+ *
+ * Called from thread_switch at splhigh, without our runqueue lock.
+ * Returns true if it put a thread on our run queue.
+ */
+
+#define THREAD_HOT_HARDCLOCKS 2
+
+#if OPT_UNIPROCESSOR
+
+/* There's no peer to steal from. */
+static
+bool
+thread_steal(void)
+{
+	return false;
+}
+
+#else /* !OPT_UNIPROCESSOR */
+
+static
+bool
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, most;
+
+	/* Find the busiest other cpu; the counts are only a hint, so no locks. */
+	victim = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || c->c_isidle) {
+			continue;
+		}
+		if (c->c_runcount > most) {
+			most = c->c_runcount;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	for (i=CPU_RUNQUEUE_LEVELS; i-- > 0; ) {
+		THREADLIST_FORALL_REV(t, victim->c_runqueue[i]) {
+			/* see thread_consider_migration about curthread */
+			if (t == victim->c_curthread ||
+			    !THREAD_CPU_OK(t, curcpu)) {
+				continue;
+			}
+			/* hot threads stay, unless they may not stay */
+			if (!THREAD_CPU_OK(t, victim) ||
+			    t->t_lastcpu != victim ||
+			    victim->c_hardclocks - t->t_lastran >=
+			    THREAD_HOT_HARDCLOCKS) {
+				break;
+			}
+		}
+		if (t != NULL) {
+			threadlist_remove(&victim->c_runqueue[i], t);
+			victim->c_runcount--;
+			break;
+		}
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t == NULL) {
+		return false;
+	}
+
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+
+	t->t_cpu = curcpu->c_self;
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	runqueue_add(curcpu->c_self, t);
+	spinlock_release(&curcpu->c_runqueue_lock);
+	schedtrace_record(ST_MIGRATE, t, curcpu->c_number);
+	STAT_INC(STAT_SCHED_STEALS);
+	return true;
+}
+
+#endif /* OPT_UNIPROCESSOR */
+
+/*
+ * Create a new thread based on an existing one.
+ *
+ * The new thread has name NAME, and starts executing in function
+ * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
+ *
+ * The new thread is created in the process P. If P is null, the
+ * process is inherited from the caller. It will start on the same CPU
+ * as the caller, unless the scheduler intervenes first.
+ */
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	struct thread *newthread;
+	int result;
+
+	newthread = thread_create(name);
+	if (newthread == NULL) {
+		return ENOMEM;
+	}
+
+	/*
+	 * Get a stack, unless the thread came with one from the cache.
+	 * Either way the stack magic is already there.
+	 */
+	if (newthread->t_stack == NULL) {
+		newthread->t_stack = thread_stack_get();
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+	}
+
+	/*
+	 * Now we clone various fields from the parent thread.
+	 */
+
+	/* Thread subsystem fields */
+	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_cpumask = curthread->t_cpumask;
+
+	/* Attach the new thread to its process */
+	if (proc == NULL) {
+		proc = curthread->t_proc;
+	}
+	result = proc_addthread(proc, newthread);
+	if (result) {
+		/* thread_destroy will clean up the stack */
+		thread_destroy(newthread);
+		return result;
+	}
+
+	/*
+	 * Because new threads come out holding the cpu runqueue lock
+	 * (see notes at bottom of thread_switch), we need to account
+	 * for the spllower() that will be done releasing it.
+	 */
+	newthread->t_iplhigh_count++;
+
+	/* Set up the switchframe so entrypoint() gets called */
+	switchframe_init(newthread, entrypoint, data1, data2);
+
+	/* Lock the current cpu's run queue and make the new thread runnable */
+	thread_make_runnable(newthread, false);
+
+	return 0;
+}
+
+/*
+ * High level, machine-independent context switch code.
+ *
+ * The current thread is queued appropriately and its state is changed
+ * to NEWSTATE; another thread to run is selected and switched to.
+ *
+ * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
+ * WC, protected by the spinlock LK. Otherwise WC and Lk should be
+ * NULL.
+ */
+static
+void
+thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
+{
+	struct thread *cur, *next;
+	bool idled;
+	int spl;
+
+	DEBUGASSERT(curcpu->c_curthread == curthread);
+	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
+
+	/* Explicitly disable interrupts on this processor */
+	spl = splhigh();
+
+	cur = curthread;
+
+	/*
+	 * If we're idle, return without doing anything. This happens
+	 * when the timer interrupt interrupts the idle loop.
+	 */
+	if (curcpu->c_isidle) {
+		splx(spl);
+		return;
+	}
+
+	/* Check the stack guard band. */
+	thread_checkstack(cur);
+
+	/* Read sections can't sleep or yield (see epoch.h). */
+	KASSERT(cur->t_epochnest == 0);
+
+	/* Lock the run queue, and take in what other cpus woke. */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	wakeups_drain();
+
+	/* Whatever preemption was pending, this is it */
+	cur->t_resched = false;
+
+	/* Micro-optimization: if nothing to do, just return */
+	if (newstate == S_READY && curcpu->c_runcount == 0) {
+		spinlock_release(&curcpu->c_runqueue_lock);
+		splx(spl);
+		return;
+	}
+
+	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
@@ -623,6 +1510,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		break;
 	}
 	cur->t_state = newstate;
+	schedtrace_record(ST_SWITCHOUT, cur, newstate);
+	thread_charge(cur->t_in_interrupt ? CT_INTR : CT_SYS);
+
+	/* For thread_steal's cache affinity check. */
+	cur->t_lastcpu = curcpu->c_self;
+	cur->t_lastran = curcpu->c_hardclocks;
 
 	/*
 	 * Get the next thread. While there isn't one, call md_idle().
@@ -643,12 +1536,49 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
+	idled = false;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/* Look for work on other cpus before idling. */
+			if (!thread_steal()) {
+				if (!idled) {
+					schedtrace_record(ST_IDLE, NULL, 0);
+					STAT_INC(STAT_SCHED_IDLES);
+					idled = true;
+				}
+				/* nothing's running, so we're quiescent */
+				epoch_quiescent();
+				/*
+				 * Stop the clock while we wait. Catching
+				 * up on ticks can run timers that wake
+				 * threads onto this cpu (with no IPI, as
+				 * it's us), so look again before idling.
+				 */
+				hardclock_stop();
+				membar_any_any();
+				if (curcpu->c_runcount == 0 &&
+				    curcpu->c_wakeups == NULL) {
+					curcpu->c_idlestart =
+						mainbus_cycles_irqoff();
+#if OPT_IRQSTATS
+					/* waiting isn't holding them off */
+					stats_irqon();
+					cpu_idle();
+					stats_irqoff();
+#else
+					cpu_idle();
+#endif
+					curcpu->c_idlecycles +=
+						mainbus_cycles_irqoff() -
+						curcpu->c_idlestart;
+					curcpu->c_idlestart = 0;
+				}
+				hardclock_start();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
+			wakeups_drain();
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
@@ -662,6 +1592,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 */
 	curcpu->c_curthread = next;
 	curthread = next;
+	schedtrace_record(ST_SWITCHIN, next, next->t_priority);
+	STAT_INC(STAT_SCHED_SWITCHES);
+	if (next->t_wakeat != 0) {
+		schedlat_count(next);
+	}
+	TRACE(TR_SWITCH, (vaddr_t)cur, (vaddr_t)next);
 
 	/* do the switch (in assembler in switch.S) */
 	switchframe_switch(&cur->t_context, &next->t_context);
@@ -717,6 +1653,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* Start our clock again (see thread_charge). */
+	cur->t_timestamp = mainbus_cycles();
+
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
@@ -726,6 +1665,13 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/*
+	 * Nobody on this cpu is in a read section now: the thread that
+	 * switched out couldn't be, and neither could this one when it
+	 * switched out before.
+	 */
+	epoch_quiescent();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -750,6 +1696,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
 
+	/* Start our clock (see thread_charge). */
+	cur->t_timestamp = mainbus_cycles();
+
 	/* Release the runqueue lock acquired in thread_switch. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
@@ -759,6 +1708,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* As in thread_switch. */
+	epoch_quiescent();
+
 	/* Enable interrupts. */
 	spl0();
 
@@ -808,6 +1760,13 @@ thread_exit(void)
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
 
+	/* Give back what admission control promised us. */
+	if (cur->t_policy == SCHED_DEADLINE) {
+		spinlock_acquire(&sched_rtlock);
+		sched_dlutil -= sched_util(cur);
+		spinlock_release(&sched_rtlock);
+	}
+
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
@@ -831,17 +1790,287 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * SCHED_OTHER threads, which is all of them unless they ask for
+ * something else, are in a multi-level feedback queue. Threads start
+ * at its top level, SCHED_TSLEVEL, and a thread L levels below that
+ * gets a quantum of SCHED_QUANTUM(L) hardclocks.
+ * A thread that runs through its whole quantum (counted across
+ * sleeps, so sleeping just before it runs out doesn't help) drops a
+ * level; one that sleeps first keeps its level. So interactive and
+ * I/O-bound threads stay near the top and preempt the CPU-bound ones
+ * as soon as they wake up, while those run longer quanta further
+ * down.
+ *
+ * schedule() is called once every SCHEDULE_HARDCLOCKS from
+ * hardclock() and moves everything on this cpu back to the top level,
+ * so threads at the bottom can't starve and threads whose behavior
+ * changed get another chance. Threads sleeping at that moment keep
+ * their level.
+ *
+ * The real-time classes (kern/sched.h) are the levels above that and
+ * are left alone: a SCHED_FIFO thread stays at the level of its
+ * priority and has no quantum, and a SCHED_DEADLINE thread is at
+ * level 0 until it has used up its budget and the MLFQ has it (see
+ * sched_throttle).
+ */
+
+#define SCHED_QUANTUM(level) (1U << ((level) - SCHED_TSLEVEL))
+
+void
+schedule(void)
+{
+	struct thread *t;
+	unsigned i;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=SCHED_TSLEVEL+1; i<CPU_RUNQUEUE_LEVELS; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i])) != NULL) {
+			t->t_priority = SCHED_TSLEVEL;
+			t->t_ticks = 0;
+			threadlist_addtail(&curcpu->c_runqueue[SCHED_TSLEVEL], t);
+		}
+	}
+	if (!curcpu->c_isidle && curthread->t_priority >= SCHED_TSLEVEL) {
+		curthread->t_priority = SCHED_TSLEVEL;
+		curthread->t_ticks = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+/*
+ * Give the throttled threads on C whose periods are over by NOW their
+ * budgets back, moving them up to level 0.
+ */
+static
+void
+sched_release(struct cpu *c, uint64_t now)
+{
+	struct thread *t, *next;
+	unsigned i;
+
+	c->c_release = SCHED_NORELEASE;
+	for (i=SCHED_TSLEVEL; i<CPU_RUNQUEUE_LEVELS; i++) {
+		for (t = c->c_runqueue[i].tl_head.tln_next->tln_self;
+		     t != NULL; t = next) {
+			next = t->t_listnode.tln_next->tln_self;
+			if (t->t_policy != SCHED_DEADLINE || !t->t_throttled) {
+				continue;
+			}
+			if (now >= t->t_deadline) {
+				threadlist_remove(&c->c_runqueue[i], t);
+				c->c_runcount--;
+				/* replenishes it */
+				runqueue_add(c, t);
+			}
+			else if (t->t_deadline < c->c_release) {
+				c->c_release = t->t_deadline;
+			}
+		}
+	}
+}
+
+/*
+ * Priority inheritance (see synch.c). The lent level only changes
+ * where T is queued, not its own level or quantum, so it goes back to
+ * exactly where it was once the lock's let go. T can't be in the run
+ * queue at any other level than THREAD_LEVEL, but it may be between
+ * cpus (being stolen, or on c_wakeups), in which case it's queued with
+ * the new level when it lands.
+ */
+void
+thread_lend(struct thread *t, unsigned level)
+{
+	struct cpu *c;
+	struct thread *t2;
+	unsigned old;
+
+	/*
+	 * Lock the run queue of the cpu it's on, rechecking after. (No
+	 * cpu means the lender caught a thread that exited and has been
+	 * recycled since; see synch.c. There's nothing to do.)
+	 */
+	for (;;) {
+		c = t->t_cpu;
+		if (c == NULL) {
+			return;
+		}
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (t->t_cpu == c) {
+			break;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+
+	old = THREAD_LEVEL(t);
+	if (level < t->t_inherit) {
+		t->t_inherit = level;
+	}
+	if (t->t_state == S_READY && THREAD_LEVEL(t) < old) {
+		THREADLIST_FORALL(t2, c->c_runqueue[old]) {
+			if (t2 == t) {
+				threadlist_remove(&c->c_runqueue[old], t);
+				c->c_runcount--;
+				runqueue_add(c, t);
+				break;
+			}
+		}
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Charge the current thread for a hardclock. It should yield when its
+ * quantum is used up (and then drops a level), when it's a deadline
+ * thread that has used up its budget, or when a thread at a higher
+ * level is waiting to run.
  */
+bool
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	uint64_t now;
+	bool preempt;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	/* the idle loop isn't charged to whoever went to sleep last */
+	if (curcpu->c_isidle) {
+		spinlock_release(&curcpu->c_runqueue_lock);
+		return false;
+	}
+
+	/* a better thread woken from afar should preempt us now */
+	wakeups_drain();
+
+	/* so should a deadline thread getting its budget back */
+	now = 0;
+	if (curcpu->c_release != SCHED_NORELEASE ||
+	    cur->t_policy == SCHED_DEADLINE) {
+		now = timer_now();
+	}
+	if (now >= curcpu->c_release) {
+		sched_release(curcpu->c_self, now);
+	}
+	if (cur->t_policy == SCHED_DEADLINE) {
+		sched_replenish(cur, now);
+	}
+
+	if (cur->t_policy == SCHED_FIFO) {
+		/* no quantum; it runs until something better shows up */
+		preempt = runqueue_toplevel(curcpu) < THREAD_LEVEL(cur);
+	}
+	else if (cur->t_policy == SCHED_DEADLINE && !cur->t_throttled) {
+		if (++cur->t_used >= cur->t_budget) {
+			sched_throttle(cur);
+			preempt = true;
+		}
+		else {
+			preempt = runqueue_toplevel(curcpu) < THREAD_LEVEL(cur);
+		}
+	}
+	else {
+		cur->t_ticks++;
+		if (cur->t_ticks >= SCHED_QUANTUM(cur->t_priority)) {
+			if (cur->t_priority < CPU_RUNQUEUE_LEVELS - 1) {
+				cur->t_priority++;
+			}
+			cur->t_ticks = 0;
+			preempt = true;
+		}
+		else {
+			preempt = runqueue_toplevel(curcpu) <
+				THREAD_LEVEL(cur);
+		}
+	}
+
+	/* get off a cpu we may no longer use (migration moves us on) */
+	if (!THREAD_CPU_OK(cur, curcpu)) {
+		preempt = true;
+	}
+
+	spinlock_release(&curcpu->c_runqueue_lock);
+	return preempt;
+}
+
+/*
+ * Voluntary preemption. hardclock preempts the kernel too, but not
+ * inside a read section, where it sets t_resched instead; and a
+ * thread another cpu wakes onto this one while it's busy gets no IPI,
+ * so it waits for our next hardclock even if it's at a better level.
+ * Long loops call this between steps to catch both sooner. The
+ * unlocked look at c_runcount and c_wakeups keeps the common case to
+ * a few loads;
+ * a thread that shows up just after is picked up next time.
+ */
+void
+cond_resched(void)
+{
+	struct thread *cur = curthread;
+	bool yield;
+
+	if (cur->t_in_interrupt || curcpu->c_spinlocks > 0 ||
+	    cur->t_epochnest > 0 || cur->t_curspl > 0) {
+		return;
+	}
+	if (!cur->t_resched && curcpu->c_runcount == 0 &&
+	    curcpu->c_wakeups == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	wakeups_drain();
+	yield = cur->t_resched ||
+		runqueue_toplevel(curcpu) < THREAD_LEVEL(cur);
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (yield) {
+		schedtrace_record(ST_RESCHED, cur, 0);
+		thread_yield();
+	}
+}
+
+/*
+ * CPU time accounting. The trap code calls this whenever the cpu
+ * switches between user mode, the kernel and interrupt handlers, and
+ * thread_switch calls it before switching away, so the time since the
+ * last call was all spent in one of them. A thread's clock starts
+ * again when it is switched back in. Time the cpu spends idle,
+ * interrupts included, isn't anybody's.
+ */
+void
+thread_charge(unsigned what)
+{
+	struct thread *cur = curthread;
+	uint64_t now, delta;
+
+	now = mainbus_cycles();
+	delta = now - cur->t_timestamp;
+	cur->t_timestamp = now;
+
+	if (curcpu->c_isidle) {
+		return;
+	}
+	switch (what) {
+	    case CT_USER:
+		cur->t_times.ct_utime += delta;
+		break;
+	    case CT_SYS:
+		cur->t_times.ct_stime += delta;
+		break;
+	    case CT_INTR:
+		cur->t_times.ct_itime += delta;
+		break;
+	    default:
+		panic("thread_charge: bad time %u\n", what);
+	}
+}
 
 void
-schedule(void)
+cputimes_add(struct cputimes *dst, const struct cputimes *src)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	dst->ct_utime += src->ct_utime;
+	dst->ct_stime += src->ct_stime;
+	dst->ct_itime += src->ct_itime;
 }
 
 /*
@@ -860,7 +2089,18 @@ schedule(void)
  * For here and now, because we know we're running on System/161 and
  * System/161 does not (yet) model such cache effects, we'll be very
  * aggressive.
+ *
+ * A uniprocessor kernel has nowhere to move anything.
  */
+#if OPT_UNIPROCESSOR
+
+void
+thread_consider_migration(void)
+{
+}
+
+#else /* !OPT_UNIPROCESSOR */
+
 void
 thread_consider_migration(void)
 {
@@ -870,14 +2110,37 @@ thread_consider_migration(void)
 	struct threadlist victims;
 	struct thread *t;
 
+	/*
+	 * First send threads that may not run here to a cpu they may
+	 * run on (see thread_setaffinity).
+	 */
+	for (;;) {
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		t = runqueue_remdisallowed(curcpu->c_self);
+		spinlock_release(&curcpu->c_runqueue_lock);
+		if (t == NULL) {
+			break;
+		}
+		c = thread_pickcpu(t);
+		t->t_cpu = c;
+		spinlock_acquire(&c->c_runqueue_lock);
+		runqueue_add(c, t);
+		schedtrace_record(ST_MIGRATE, t, c->c_number);
+		STAT_INC(STAT_SCHED_MIGRATIONS);
+		if (c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+
 	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += c->c_runcount;
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = c->c_runcount;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
@@ -891,7 +2154,10 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		t = runqueue_remtail(curcpu);
+		if (t == NULL) {
+			break;
+		}
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -902,7 +2168,7 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (c->c_runcount < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -932,8 +2198,17 @@ thread_consider_migration(void)
 				continue;
 			}
 
+			/* Same if it may not run on c. */
+			if (!THREAD_CPU_OK(t, c)) {
+				threadlist_addtail(&victims, t);
+				to_send--;
+				continue;
+			}
+
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
+			schedtrace_record(ST_MIGRATE, t, c->c_number);
+			STAT_INC(STAT_SCHED_MIGRATIONS);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -957,7 +2232,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -966,6 +2241,252 @@ thread_consider_migration(void)
 	threadlist_cleanup(&victims);
 }
 
+#endif /* OPT_UNIPROCESSOR */
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Scheduler event trace (see schedtrace.h).
+ */
+
+/*
+ * Note an event on the current cpu. Nobody else writes our ring; the
+ * membar makes sure a reader that sees the new count sees the event.
+ */
+void
+schedtrace_record(unsigned type, const struct thread *t, unsigned arg)
+{
+	struct cpu *c;
+	struct schedtrace_event *se;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	se = &c->c_trace[c->c_tracecount & (SCHEDTRACE_SIZE - 1)];
+	se->se_time = mainbus_cycles();
+	se->se_thread = t;
+	se->se_pid = (t != NULL && t->t_proc != NULL) ? t->t_proc->p_pid : -1;
+	se->se_type = type;
+	se->se_arg = arg;
+	membar_store_store();
+	c->c_tracecount++;
+	splx(spl);
+}
+
+static const char *const schedtrace_types[] = {
+	[ST_SWITCHOUT] = "out",
+	[ST_SWITCHIN] = "in",
+	[ST_WAKEUP] = "wakeup",
+	[ST_MIGRATE] = "migrate",
+	[ST_IDLE] = "idle",
+	[ST_RESCHED] = "resched",
+};
+
+static const char *const schedtrace_states[] = {
+	[S_RUN] = "run",
+	[S_READY] = "ready",
+	[S_SLEEP] = "sleep",
+	[S_ZOMBIE] = "zombie",
+};
+
+/*
+ * Print C's ring, copying it into BUF first. The cpu keeps recording
+ * while we copy, so anything old enough that it may have been written
+ * over in the meantime (including the slot being written right now)
+ * is left out.
+ */
+static
+void
+schedtrace_dumpcpu(struct cpu *c, struct schedtrace_event *buf)
+{
+	struct schedtrace_event *se;
+	unsigned start, end, count, span, i;
+
+	start = c->c_tracecount;
+	membar_load_load();
+	memcpy(buf, c->c_trace, sizeof(c->c_trace));
+	membar_load_load();
+	end = c->c_tracecount;
+
+	count = start < SCHEDTRACE_SIZE ? start : SCHEDTRACE_SIZE;
+	span = end + 1 - (start - count);
+	if (span > SCHEDTRACE_SIZE) {
+		i = span - SCHEDTRACE_SIZE;
+		count = i < count ? count - i : 0;
+	}
+
+	kprintf("cpu%u: %u events, last %u:\n", c->c_number, end, count);
+	for (i = start - count; i != start; i++) {
+		se = &buf[i & (SCHEDTRACE_SIZE - 1)];
+		kprintf("  %12llu %-7s %p pid %-4d ",
+			(unsigned long long)se->se_time,
+			schedtrace_types[se->se_type],
+			se->se_thread, (int)se->se_pid);
+		switch (se->se_type) {
+		    case ST_SWITCHOUT:
+			kprintf("%s\n", schedtrace_states[se->se_arg]);
+			break;
+		    case ST_SWITCHIN:
+			kprintf("level %u\n", (unsigned)se->se_arg);
+			break;
+		    case ST_WAKEUP:
+		    case ST_MIGRATE:
+			kprintf("-> cpu%u\n", (unsigned)se->se_arg);
+			break;
+		    default:
+			kprintf("\n");
+			break;
+		}
+	}
+}
+
+/*
+ * Print the trace of every cpu, or only of cpu CPUNUM.
+ */
+void
+schedtrace_dump(unsigned cpunum)
+{
+	struct schedtrace_event *buf;
+	unsigned i;
+
+	buf = kmalloc_tagged(SCHEDTRACE_SIZE * sizeof(*buf), KM_THREAD);
+	if (buf == NULL) {
+		kprintf("schedtrace: Out of memory\n");
+		return;
+	}
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		if (cpunum == SCHEDTRACE_ALLCPUS || cpunum == i) {
+			schedtrace_dumpcpu(cpuarray_get(&allcpus, i), buf);
+		}
+	}
+	kfree(buf);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Wakeup latency (see schedtrace.h).
+ */
+
+/* Nanoseconds on the clock device. */
+static
+uint64_t
+schedlat_now(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Stamp T, about to go on C's run queue or wakeups, with the time and
+ * the kind of wakeup. Called from thread_make_runnable.
+ */
+static
+void
+schedlat_stamp(struct thread *t, struct cpu *c)
+{
+	if (c == curcpu->c_self) {
+		t->t_wakekind = SL_LOCAL;
+	}
+	else if (c->c_isidle) {
+		t->t_wakekind = SL_IPI;
+	}
+	else {
+		t->t_wakekind = SL_REMOTE;
+	}
+	t->t_wakeat = schedlat_now();
+}
+
+/*
+ * T, stamped by schedlat_stamp, is about to run on this cpu; count
+ * how long that took. Called from thread_switch with our run queue
+ * lock held.
+ */
+static
+void
+schedlat_count(struct thread *t)
+{
+	uint64_t now, usecs;
+	unsigned b;
+
+	now = schedlat_now();
+	usecs = now > t->t_wakeat ? (now - t->t_wakeat) / 1000 : 0;
+	t->t_wakeat = 0;
+
+	b = 0;
+	while (usecs != 0 && b < SCHEDLAT_NBUCKETS - 1) {
+		usecs >>= 1;
+		b++;
+	}
+	curcpu->c_wakelat[t->t_wakekind][b]++;
+}
+
+/*
+ * Turn recording on or off. Turning it on clears the histograms; a
+ * cpu that is counting right now may still get one more in.
+ */
+void
+schedlat_enable(bool on)
+{
+	struct cpu *c;
+	unsigned i;
+
+	if (on) {
+		for (i=0; i<cpuarray_num(&allcpus); i++) {
+			c = cpuarray_get(&allcpus, i);
+			spinlock_acquire(&c->c_runqueue_lock);
+			bzero(c->c_wakelat, sizeof(c->c_wakelat));
+			spinlock_release(&c->c_runqueue_lock);
+		}
+	}
+	schedlat_on = on;
+}
+
+static const char *const schedlat_kinds[SL_NKINDS] = {
+	[SL_LOCAL] = "local",
+	[SL_IPI] = "ipi",
+	[SL_REMOTE] = "remote",
+};
+
+/*
+ * Print the histograms, one line per cpu and kind of wakeup, skipping
+ * empty ones. Column N is bucket N.
+ */
+void
+schedlat_dump(void)
+{
+	unsigned counts[SCHEDLAT_NBUCKETS];
+	struct cpu *c;
+	unsigned i, k, b, total;
+
+	kprintf("wakeup latency (%s); column N: under 2^N us\n",
+		schedlat_on ? "on" : "off");
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		for (k=0; k<SL_NKINDS; k++) {
+			spinlock_acquire(&c->c_runqueue_lock);
+			memcpy(counts, c->c_wakelat[k], sizeof(counts));
+			spinlock_release(&c->c_runqueue_lock);
+
+			total = 0;
+			for (b=0; b<SCHEDLAT_NBUCKETS; b++) {
+				total += counts[b];
+			}
+			if (total == 0) {
+				continue;
+			}
+			kprintf("cpu%u %-6s %7u:", c->c_number,
+				schedlat_kinds[k], total);
+			for (b=0; b<SCHEDLAT_NBUCKETS; b++) {
+				kprintf(" %u", counts[b]);
+			}
+			kprintf("\n");
+		}
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -984,15 +2505,18 @@ struct wchan *
 wchan_create(const char *name)
 {
 	struct wchan *wc;
+#if OPT_WCHANDEBUG
 	int result;
+#endif
 
-	wc = kmalloc(sizeof(*wc));
+	wc = kmalloc_tagged(sizeof(*wc), KM_THREAD);
 	if (wc == NULL) {
 		return NULL;
 	}
 	threadlist_init(&wc->wc_threads);
 	wc->wc_name = name;
 
+#if OPT_WCHANDEBUG
 	/* add to allwchans[] */
 	spinlock_acquire(&allwchans_lock);
 	result = wchanarray_add(&allwchans, wc, &wc->wc_index);
@@ -1003,6 +2527,7 @@ wchan_create(const char *name)
 		kfree(wc);
 		return NULL;
 	}
+#endif
 
 	return wc;
 }
@@ -1014,6 +2539,7 @@ wchan_create(const char *name)
 void
 wchan_destroy(struct wchan *wc)
 {
+#if OPT_WCHANDEBUG
 	unsigned num;
 	struct wchan *wc2;
 
@@ -1029,6 +2555,7 @@ wchan_destroy(struct wchan *wc)
 	}
 	wchanarray_setsize(&allwchans, num - 1);
 	spinlock_release(&allwchans_lock);
+#endif
 
 	threadlist_cleanup(&wc->wc_threads);
 	kfree(wc);
@@ -1058,9 +2585,84 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 }
 
 /*
- * Wake up one thread sleeping on a wait channel.
+ * Timed sleeps. If the timer goes off while the thread is still on
+ * the channel, its function takes the thread off and wakes it up.
  */
+struct wchan_timeout {
+	struct timer wt_timer;
+	struct thread *wt_thread;
+	struct wchan *wt_wchan;
+	struct spinlock *wt_lock;
+	bool wt_timedout;	/* the timer woke the thread */
+	bool wt_done;		/* the timer function is finished with us */
+};
+
+static
 void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *t;
+
+	spinlock_acquire(wt->wt_lock);
+	THREADLIST_FORALL(t, wt->wt_wchan->wc_threads) {
+		if (t == wt->wt_thread) {
+			break;
+		}
+	}
+	if (t != NULL) {
+		threadlist_remove(&wt->wt_wchan->wc_threads, t);
+		thread_make_runnable(t, false);
+		wt->wt_timedout = true;
+	}
+	wt->wt_done = true;
+	spinlock_release(wt->wt_lock);
+}
+
+/*
+ * Like wchan_sleep, but give up after TICKS hardclock ticks. Returns
+ * true if we timed out rather than being woken.
+ */
+bool
+wchan_timedsleep(struct wchan *wc, struct spinlock *lk, unsigned ticks)
+{
+	struct wchan_timeout wt;
+
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(lk));
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	wt.wt_thread = curthread;
+	wt.wt_wchan = wc;
+	wt.wt_lock = lk;
+	wt.wt_timedout = false;
+	wt.wt_done = false;
+	timer_init(&wt.wt_timer, wchan_timeout, &wt);
+
+	/* The timer function needs LK, so it can't get in before we sleep. */
+	timer_add(&wt.wt_timer, ticks);
+	thread_switch(S_SLEEP, wc, lk);
+	spinlock_acquire(lk);
+
+	if (!timer_cancel(&wt.wt_timer)) {
+		/*
+		 * It fired. If we were woken normally first, its function
+		 * may still be waiting for LK; let it finish before WT
+		 * goes away.
+		 */
+		while (!wt.wt_done) {
+			spinlock_release(lk);
+			spinlock_acquire(lk);
+		}
+	}
+	return wt.wt_timedout;
+}
+
+/*
+ * Wake up one thread sleeping on a wait channel. Returns the thread,
+ * or NULL if nobody was sleeping.
+ */
+struct thread *
 wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *target;
@@ -1072,7 +2674,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return NULL;
 	}
 
 	/*
@@ -1084,6 +2686,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 */
 
 	thread_make_runnable(target, false);
+	return target;
 }
 
 /*
@@ -1119,6 +2722,32 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move up to MAX threads, oldest first, from sleeping on FROM to
+ * sleeping on TO, without waking them. They will still reacquire
+ * FROM's spinlock when they do wake up. Returns how many moved.
+ */
+unsigned
+wchan_move(struct wchan *from, struct spinlock *fromlk,
+	   struct wchan *to, struct spinlock *tolk, unsigned max)
+{
+	struct thread *target;
+	unsigned n;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	for (n = 0; n < max; n++) {
+		target = threadlist_remhead(&from->wc_threads);
+		if (target == NULL) {
+			break;
+		}
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+	}
+	return n;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1134,12 +2763,71 @@ wchan_isempty(struct wchan *wc, struct spinlock *lk)
 	return ret;
 }
 
+/*
+ * Best level of the sleepers, for handing a lock's waiters' priority
+ * on to its next owner.
+ */
+unsigned
+wchan_toplevel(struct wchan *wc, struct spinlock *lk)
+{
+	struct thread *t;
+	unsigned level = THREAD_NOINHERIT;
+
+	KASSERT(spinlock_do_i_hold(lk));
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		if (THREAD_LEVEL(t) < level) {
+			level = THREAD_LEVEL(t);
+		}
+	}
+	return level;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
  * Machine-independent IPI handling
  */
 
+#if OPT_UNIPROCESSOR
+
+/*
+ * One cpu: nobody to interrupt. An IPI to ourselves would only make
+ * us take an interrupt we're already awake for, so these have nothing
+ * to do.
+ */
+void
+ipi_send(struct cpu *target, int code)
+{
+	KASSERT(code >= 0 && code < 32);
+	(void)target;
+	(void)code;
+}
+
+void
+ipi_broadcast(int code)
+{
+	(void)code;
+}
+
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	(void)target;
+	(void)mapping;
+}
+
+void
+ipi_tlbshootdown_cpus(uint32_t cpus,
+		      const struct tlbshootdown *mappings, unsigned num)
+{
+	KASSERT(curthread->t_curspl == 0);
+	(void)cpus;
+	(void)mappings;
+	(void)num;
+}
+
+#else /* !OPT_UNIPROCESSOR */
+
 /*
  * Send an IPI (inter-processor interrupt) to the specified CPU.
  */
@@ -1190,6 +2878,86 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Queue NUM mappings on every cpu in the CPUS bitmask (by cpu number,
+ * skipping ourselves) with one IPI each, then wait for all of them.
+ * A batch larger than TLBSHOOTDOWN_MAX flushes the whole TLB of each
+ * target; MAPPINGS isn't looked at then and may be NULL.
+ */
+void
+ipi_tlbshootdown_cpus(uint32_t cpus,
+		      const struct tlbshootdown *mappings, unsigned num)
+{
+	unsigned tickets[32];
+	unsigned i, j, numcpus;
+	struct cpu *c;
+	int n;
+
+	KASSERT(curthread->t_curspl == 0);
+
+	cpus &= ~((uint32_t)1 << curcpu->c_number);
+	if (cpus == 0 || num == 0) {
+		return;
+	}
+
+	numcpus = cpuarray_num(&allcpus);
+	KASSERT(numcpus <= 32);
+
+	for (i=0; i<numcpus; i++) {
+		if ((cpus & ((uint32_t)1 << i)) == 0) {
+			continue;
+		}
+		c = cpuarray_get(&allcpus, i);
+
+		spinlock_acquire(&c->c_ipi_lock);
+
+		/*
+		 * Queue the whole batch; if it doesn't fit, fall back
+		 * to flushing the target's entire TLB.
+		 */
+		n = c->c_numshootdown;
+		if (n != TLBSHOOTDOWN_ALL && (unsigned)n + num > TLBSHOOTDOWN_MAX) {
+			n = TLBSHOOTDOWN_ALL;
+		}
+		if (n != TLBSHOOTDOWN_ALL) {
+			for (j=0; j<num; j++) {
+				c->c_shootdown[n++] = mappings[j];
+			}
+		}
+		c->c_numshootdown = n;
+
+		/*
+		 * Whatever is queued now is handled by the target's
+		 * next pass through interprocessor_interrupt, which
+		 * bumps the counter. Only one IPI per pending batch.
+		 */
+		tickets[i] = c->c_shootdown_done + 1;
+		if ((c->c_ipi_pending & (1U << IPI_TLBSHOOTDOWN)) == 0) {
+			c->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
+			mainbus_send_ipi(c);
+		}
+
+		spinlock_release(&c->c_ipi_lock);
+	}
+
+	/* Now wait (interrupts are on, so we still serve our own IPIs) */
+	for (i=0; i<numcpus; i++) {
+		if ((cpus & ((uint32_t)1 << i)) == 0) {
+			continue;
+		}
+		c = cpuarray_get(&allcpus, i);
+
+		spinlock_acquire(&c->c_ipi_lock);
+		while ((int)(c->c_shootdown_done - tickets[i]) < 0) {
+			spinlock_release(&c->c_ipi_lock);
+			spinlock_acquire(&c->c_ipi_lock);
+		}
+		spinlock_release(&c->c_ipi_lock);
+	}
+}
+
+#endif /* OPT_UNIPROCESSOR */
+
 void
 interprocessor_interrupt(void)
 {
@@ -1232,6 +3000,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done++;
 	}
 
 	curcpu->c_ipi_pending = 0;
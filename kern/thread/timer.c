@@ -0,0 +1,258 @@
+/*
+ * Hierarchical timer wheel.
+ *
+ * Pending timers live in TW_LEVELS wheels of TW_SLOTS slots each. A
+ * timer due within TW_SLOTS ticks goes in level 0, in the slot for
+ * its exact tick; one due later goes in the first level whose slots
+ * are wide enough, in the slot for its expiry time at that
+ * granularity. Every TW_SLOTS ticks, the next level's slot for the
+ * coming block of ticks is emptied and its timers are placed again,
+ * which moves them down a level (this cascades upward when a level
+ * wraps). So adding and cancelling are O(1), and each tick only looks
+ * at the timers that are due, plus the occasional cascade.
+ *
+ * Timers further out than the wheel reaches (2^24 ticks, about two
+ * days at HZ=100) are parked in the last slot they can reach and
+ * placed again from there.
+ *
+ * The wheel is driven by hardclock on cpu 0. The on-chip timer gives
+ * every cpu its own hardclock, so that is our clock; the ltimer
+ * countdown only interrupts once a second (see ltimer.c). When cpu 0
+ * is idle it may stop its clock (clock.c), after asking timer_idle
+ * how long it can; ticks go by uncounted until it wakes and makes them
+ * up all at once. A timer added meanwhile that would be due before
+ * then kicks it awake.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <timer.h>
+
+#define TW_BITS		6
+#define TW_SLOTS	(1 << TW_BITS)
+#define TW_MASK		(TW_SLOTS - 1)
+#define TW_LEVELS	4
+#define TW_MAXDELTA	(((uint64_t)1 << (TW_BITS * TW_LEVELS)) - 1)
+
+static struct timer *timer_wheel[TW_LEVELS][TW_SLOTS];
+static uint64_t timer_clock;		/* the next tick to process */
+static bool timer_stopped;		/* cpu 0's clock is stopped, */
+static uint64_t timer_idleuntil;	/* ... and runs this tick next */
+static struct spinlock timer_lock = SPINLOCK_INITIALIZER;
+
+/* Put T at the head of the list SLOT. */
+static
+void
+timer_link(struct timer **slot, struct timer *t)
+{
+	t->tm_next = *slot;
+	if (*slot != NULL) {
+		(*slot)->tm_prevp = &t->tm_next;
+	}
+	*slot = t;
+	t->tm_prevp = slot;
+}
+
+/* Take T off its list. */
+static
+void
+timer_unlink(struct timer *t)
+{
+	*t->tm_prevp = t->tm_next;
+	if (t->tm_next != NULL) {
+		t->tm_next->tm_prevp = t->tm_prevp;
+	}
+	t->tm_next = NULL;
+	t->tm_prevp = NULL;
+}
+
+/* Put T in the right slot for its expiry time. Call with timer_lock. */
+static
+void
+timer_place(struct timer *t)
+{
+	uint64_t expires, delta;
+	unsigned level;
+
+	expires = t->tm_expires;
+	if (expires < timer_clock) {
+		expires = timer_clock;
+	}
+	delta = expires - timer_clock;
+	if (delta > TW_MAXDELTA) {
+		delta = TW_MAXDELTA;
+		expires = timer_clock + delta;
+	}
+
+	for (level = 0; level < TW_LEVELS - 1; level++) {
+		if (delta < ((uint64_t)1 << (TW_BITS * (level + 1)))) {
+			break;
+		}
+	}
+	timer_link(&timer_wheel[level][(expires >> (TW_BITS * level)) & TW_MASK],
+		   t);
+}
+
+void
+timer_init(struct timer *t, void (*func)(void *), void *arg)
+{
+	t->tm_next = NULL;
+	t->tm_prevp = NULL;
+	t->tm_expires = 0;
+	t->tm_func = func;
+	t->tm_arg = arg;
+}
+
+void
+timer_add(struct timer *t, unsigned ticks)
+{
+	bool kick;
+
+	spinlock_acquire(&timer_lock);
+	KASSERT(t->tm_prevp == NULL);
+	t->tm_expires = timer_clock + ticks;
+	timer_place(t);
+	kick = timer_stopped && t->tm_expires < timer_idleuntil;
+	if (kick) {
+		/* once is enough */
+		timer_stopped = false;
+	}
+	spinlock_release(&timer_lock);
+
+	if (kick) {
+		hardclock_kick();
+	}
+}
+
+bool
+timer_cancel(struct timer *t)
+{
+	bool pending;
+
+	spinlock_acquire(&timer_lock);
+	pending = t->tm_prevp != NULL;
+	if (pending) {
+		timer_unlink(t);
+	}
+	spinlock_release(&timer_lock);
+	return pending;
+}
+
+uint64_t
+timer_now(void)
+{
+	uint64_t now;
+
+	/* 64 bits aren't read atomically */
+	spinlock_acquire(&timer_lock);
+	now = timer_clock;
+	spinlock_release(&timer_lock);
+	return now;
+}
+
+unsigned
+timer_ticks(const struct timespec *ts)
+{
+	uint64_t ticks;
+
+	ticks = (uint64_t)ts->tv_sec * HZ +
+		DIVROUNDUP((uint64_t)ts->tv_nsec, 1000000000 / HZ);
+
+	/* plus one, since part of the current tick is already gone */
+	ticks++;
+	if (ticks > 0xffffffff) {
+		ticks = 0xffffffff;
+	}
+	return ticks;
+}
+
+void
+timer_tick(void)
+{
+	struct timer *list, *t;
+	unsigned index, level;
+
+	spinlock_acquire(&timer_lock);
+
+	/*
+	 * At the start of each block of TW_SLOTS ticks, spread out the
+	 * level 1 slot for the block, and so on up while levels wrap.
+	 */
+	index = timer_clock & TW_MASK;
+	for (level = 1; level < TW_LEVELS && index == 0; level++) {
+		index = (timer_clock >> (TW_BITS * level)) & TW_MASK;
+		list = timer_wheel[level][index];
+		timer_wheel[level][index] = NULL;
+		while (list != NULL) {
+			t = list;
+			list = t->tm_next;
+			timer_place(t);
+		}
+	}
+
+	/* Everything in our level 0 slot is due now. */
+	index = timer_clock & TW_MASK;
+	list = timer_wheel[0][index];
+	timer_wheel[0][index] = NULL;
+	for (t = list; t != NULL; t = t->tm_next) {
+		KASSERT(t->tm_expires <= timer_clock);
+		t->tm_prevp = NULL;
+	}
+	timer_clock++;
+
+	spinlock_release(&timer_lock);
+
+	/*
+	 * Call them without the lock. Don't touch a timer after its
+	 * function runs; it may be gone or added again already.
+	 */
+	while (list != NULL) {
+		t = list;
+		list = t->tm_next;
+		t->tm_func(t->tm_arg);
+	}
+}
+
+unsigned
+timer_idle(unsigned max)
+{
+	unsigned i, index;
+
+	KASSERT(max >= 1);
+
+	/*
+	 * Find the first tick from now that has work: a nonempty slot
+	 * in level 0, or the start of a block whose level 1 slot has
+	 * timers to spread out (or that starts a level 1 block too,
+	 * which might cascade further). Waking for that one means
+	 * taking i + 1 ticks.
+	 */
+	spinlock_acquire(&timer_lock);
+	for (i = 0; i + 1 < max; i++) {
+		index = (timer_clock + i) & TW_MASK;
+		if (timer_wheel[0][index] != NULL) {
+			break;
+		}
+		if (index == 0) {
+			index = ((timer_clock + i) >> TW_BITS) & TW_MASK;
+			if (index == 0 || timer_wheel[1][index] != NULL) {
+				break;
+			}
+		}
+	}
+	timer_stopped = true;
+	timer_idleuntil = timer_clock + i;
+	spinlock_release(&timer_lock);
+
+	return i + 1;
+}
+
+void
+timer_busy(void)
+{
+	spinlock_acquire(&timer_lock);
+	timer_stopped = false;
+	spinlock_release(&timer_lock);
+}
@@ -0,0 +1,176 @@
+/*
+ * Kernel tracepoints. See trace.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <platform/maxcpus.h>
+#include <spl.h>
+#include <cpu.h>
+#include <membar.h>
+#include <mainbus.h>
+#include <current.h>
+#include <proc.h>
+#include <thread.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <trace.h>
+
+struct trace_cpu {
+	struct trace_rec *tc_recs;	/* TRACE_SIZE of them */
+	unsigned tc_count;		/* records ever written */
+};
+
+static struct trace_cpu trace_cpus[MAXCPUS];
+volatile uint32_t trace_mask;
+static bool trace_mirroring;
+static void (*trace_mirror)(uint32_t code);
+
+void
+trace_setmirror(void (*fn)(uint32_t code))
+{
+	trace_mirror = fn;
+}
+
+int
+trace_start(uint32_t mask, bool mirror)
+{
+	struct trace_cpu *tc;
+	unsigned i, ncpus;
+
+	trace_stop();
+
+	ncpus = thread_numcpus();
+	for (i=0; i<ncpus; i++) {
+		tc = &trace_cpus[i];
+		if (tc->tc_recs == NULL) {
+			tc->tc_recs = kmalloc(TRACE_SIZE * sizeof(*tc->tc_recs));
+			if (tc->tc_recs == NULL) {
+				return ENOMEM;
+			}
+		}
+		tc->tc_count = 0;
+	}
+
+	trace_mirroring = mirror;
+	membar_store_store();
+	trace_mask = mask;
+	return 0;
+}
+
+/*
+ * A cpu that had already got past the mask test can still add one
+ * record after this, which doesn't matter.
+ */
+void
+trace_stop(void)
+{
+	trace_mask = 0;
+	membar_any_any();
+}
+
+void
+trace_record(unsigned type, uint32_t arg1, uint32_t arg2)
+{
+	struct trace_cpu *tc;
+	struct trace_rec *tr;
+	int spl;
+
+	spl = splhigh();
+	tc = &trace_cpus[curcpu->c_number];
+	if (tc->tc_recs != NULL) {
+		tr = &tc->tc_recs[tc->tc_count & (TRACE_SIZE - 1)];
+		tr->tr_time = mainbus_cycles();
+		tr->tr_type = type;
+		tr->tr_cpu = curcpu->c_number;
+		tr->tr_pid = curproc != NULL ? curproc->p_pid : -1;
+		tr->tr_arg1 = arg1;
+		tr->tr_arg2 = arg2;
+		tc->tc_count++;
+	}
+	if (trace_mirroring && trace_mirror != NULL) {
+		trace_mirror((type << 24) | (arg1 & 0xffffff));
+	}
+	splx(spl);
+}
+
+/* write LEN bytes at *POSP of VN and advance *POSP */
+static
+int
+trace_write(struct vnode *vn, off_t *posp, const void *buf, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, (void *)buf, len, *posp, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return ENOSPC;
+	}
+	*posp = ku.uio_offset;
+	return 0;
+}
+
+int
+trace_save(const char *path)
+{
+	struct tracefile_header th;
+	struct trace_cpu *tc;
+	struct vnode *vn;
+	char *pathcopy;
+	unsigned ncpus, i, n, first, at, chunk;
+	off_t pos;
+	int result;
+
+	trace_stop();
+
+	ncpus = thread_numcpus();
+	th.th_magic = TRACEFILE_MAGIC;
+	th.th_version = TRACEFILE_VERSION;
+	th.th_cyclerate = mainbus_cyclerate();
+	th.th_ncpus = ncpus;
+	th.th_nrecs = 0;
+	th.th_recsize = sizeof(struct trace_rec);
+	for (i=0; i<ncpus; i++) {
+		tc = &trace_cpus[i];
+		th.th_nrecs += tc->tc_count < TRACE_SIZE ?
+			tc->tc_count : TRACE_SIZE;
+	}
+
+	pathcopy = kstrdup(path);
+	if (pathcopy == NULL) {
+		return ENOMEM;
+	}
+	result = vfs_open(pathcopy, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	kfree(pathcopy);
+	if (result) {
+		return result;
+	}
+
+	pos = 0;
+	result = trace_write(vn, &pos, &th, sizeof(th));
+	for (i=0; i<ncpus && !result; i++) {
+		tc = &trace_cpus[i];
+		n = tc->tc_count < TRACE_SIZE ? tc->tc_count : TRACE_SIZE;
+		/* the ring from the oldest record, in up to two pieces */
+		first = tc->tc_count - n;
+		while (n > 0 && !result) {
+			at = first & (TRACE_SIZE - 1);
+			chunk = TRACE_SIZE - at < n ? TRACE_SIZE - at : n;
+			result = trace_write(vn, &pos, &tc->tc_recs[at],
+					     chunk * sizeof(struct trace_rec));
+			first += chunk;
+			n -= chunk;
+		}
+	}
+
+	vfs_close(vn);
+	return result;
+}
@@ -0,0 +1,146 @@
+/*
+ * Per-cpu work queues (see workqueue.h).
+ *
+ * Each cpu has a list of queued items and a worker thread, pinned to
+ * it, that sleeps until the list is nonempty and then runs the items
+ * one at a time. The list is under the cpu's c_work_lock; as items
+ * are almost always queued on the current cpu, the lock is hardly
+ * ever contended but between the worker and interrupt handlers on
+ * the same cpu.
+ *
+ * Whether an item is queued is kept in the item itself, and claimed
+ * with atomic_cas, because the second submit can come from another
+ * cpu than the first.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <atomic.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+
+void
+work_init(struct work *w, void (*func)(void *), void *arg)
+{
+	w->w_next = NULL;
+	w->w_queued = 0;
+	w->w_func = func;
+	w->w_arg = arg;
+}
+
+/*
+ * Queue W on cpu C, or with C NULL on this one.
+ */
+static
+bool
+workqueue_queue(struct cpu *c, struct work *w)
+{
+	int s;
+
+	if (!atomic_cas(&w->w_queued, 0, 1)) {
+		return false;
+	}
+
+	/* stay on this cpu until it's on the queue */
+	s = splhigh();
+	if (c == NULL) {
+		c = curcpu->c_self;
+	}
+	spinlock_acquire(&c->c_work_lock);
+	w->w_next = NULL;
+	*c->c_worktail = w;
+	c->c_worktail = &w->w_next;
+	if (c->c_workwchan != NULL) {
+		wchan_wakeone(c->c_workwchan, &c->c_work_lock);
+	}
+	spinlock_release(&c->c_work_lock);
+	splx(s);
+	return true;
+}
+
+bool
+workqueue_submit(struct work *w)
+{
+	return workqueue_queue(NULL, w);
+}
+
+bool
+workqueue_submit_cpu(struct cpu *c, struct work *w)
+{
+	KASSERT(c != NULL);
+	return workqueue_queue(c, w);
+}
+
+/*
+ * The worker for cpu number CPUNUM.
+ */
+static
+void
+workqueue_thread(void *unused, unsigned long cpunum)
+{
+	struct cpu *c;
+	struct work *w;
+	int result;
+
+	(void)unused;
+
+	/* get onto our cpu and stay there */
+	result = thread_setaffinity(curthread, 1U << cpunum);
+	KASSERT(result == 0);
+	while (curcpu->c_number != cpunum) {
+		thread_yield();
+	}
+	c = curcpu->c_self;
+
+	while (1) {
+		spinlock_acquire(&c->c_work_lock);
+		while (c->c_workhead == NULL) {
+			wchan_sleep(c->c_workwchan, &c->c_work_lock);
+		}
+		w = c->c_workhead;
+		c->c_workhead = w->w_next;
+		if (c->c_workhead == NULL) {
+			c->c_worktail = &c->c_workhead;
+		}
+		spinlock_release(&c->c_work_lock);
+
+		/* from here on it may be queued again */
+		w->w_next = NULL;
+		atomic_cas(&w->w_queued, 1, 0);
+		w->w_func(w->w_arg);
+	}
+}
+
+void
+workqueue_startcpu(void)
+{
+	char name[16];
+	char *wcname;
+	struct wchan *wc;
+	unsigned cpunum;
+	int result;
+
+	cpunum = curcpu->c_number;
+	snprintf(name, sizeof(name), "work%u", cpunum);
+
+	/* (the wchan keeps its name; it's never destroyed) */
+	wcname = kstrdup(name);
+	wc = wcname == NULL ? NULL : wchan_create(wcname);
+	if (wc == NULL) {
+		panic("workqueue_startcpu: out of memory\n");
+	}
+	spinlock_acquire(&curcpu->c_work_lock);
+	curcpu->c_workwchan = wc;
+	spinlock_release(&curcpu->c_work_lock);
+
+	result = thread_fork(name, NULL, workqueue_thread, NULL, cpunum);
+	if (result) {
+		panic("workqueue_startcpu: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
@@ -0,0 +1,545 @@
+/*
+ * Block device request queue (see blkq.h).
+ *
+ * The queue is one list, sorted by sector, under bq_lock; bq_head is
+ * the sector after the last one served, which is where the C-LOOK
+ * sweep carries on from. bq_ndone counts dispatches, and a request
+ * notes its value when it's queued, which is how old it is for the
+ * deadline. bq_nqueued counts the requests on the list in each
+ * class, and bq_budget the runs each has left in this round. The
+ * thread takes a run of requests off the list, does
+ * them without the lock (the driver sleeps), and calls their
+ * br_done functions, also without it.
+ *
+ * The counters that submitting and picking change are under bq_lock
+ * too. The ones only the thread changes, the times, aren't; reading
+ * them may catch a 64-bit one half updated, as with stats.h's. Times
+ * are mainbus_cycles, which the cpus count in step closely enough for
+ * a request queued on one and finished on another.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/ioprio.h>
+#include <kern/sched.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <mainbus.h>
+#include <blkq.h>
+#include <trace.h>
+
+/* Most bytes blkq_uio bounces through the kernel at a time. */
+#define BLKQ_BOUNCE	(16 * 512)
+
+struct blkq {
+	const char *bq_name;
+	blkq_iofn bq_iofn;
+	void *bq_data;
+	size_t bq_sectsize;
+
+	struct lock *bq_lock;
+	struct cv *bq_workcv;		/* for the thread: requests queued */
+	struct cv *bq_donecv;		/* for blkq_io: requests done */
+	struct blkreq *bq_list;		/* sorted by sector */
+	uint32_t bq_head;
+	unsigned bq_ndone;
+	unsigned bq_nqueued[IOPRIO_NCLASSES];
+	unsigned bq_budget[IOPRIO_NCLASSES];
+
+	/* counters (see blkq.h) */
+	uint64_t bq_reqs[2];		/* requests, reads then writes */
+	uint64_t bq_sects[2];		/* ... their sectors */
+	uint64_t bq_merged;
+	unsigned bq_inflight;
+	uint64_t bq_depthsum;
+	uint64_t bq_busy;		/* cycles in the driver */
+	uint64_t bq_svc[BLKQ_NBUCKETS];
+	uint64_t bq_lat[BLKQ_NBUCKETS];
+	uint64_t bq_clat[IOPRIO_NCLASSES][BLKQ_NBUCKETS];
+};
+
+static const unsigned blkq_budgets[IOPRIO_NCLASSES] = {
+	[IOPRIO_RT] = BLKQ_BUDGET_RT,
+	[IOPRIO_BE] = BLKQ_BUDGET_BE,
+	[IOPRIO_IDLE] = 0,
+};
+
+static const unsigned blkq_deadlines[IOPRIO_NCLASSES] = {
+	[IOPRIO_RT] = BLKQ_DEADLINE,
+	[IOPRIO_BE] = BLKQ_DEADLINE,
+	[IOPRIO_IDLE] = 4 * BLKQ_DEADLINE,
+};
+
+/* Count the time from START to END (cycles) in histogram HIST (in us). */
+static
+void
+blkq_hist(uint64_t *hist, uint64_t start, uint64_t end)
+{
+	uint64_t us;
+	unsigned b;
+
+	/* (the cpus' counts are close, not equal) */
+	us = end > start ? (end - start) * 1000000 / mainbus_cyclerate() : 0;
+	for (b = 0; us > 1 && b < BLKQ_NBUCKETS - 1; b++) {
+		us >>= 1;
+	}
+	hist[b]++;
+}
+
+/*
+ * The class to serve next: the best one with requests waiting and
+ * budget left, starting a new round if there isn't one. Call with
+ * bq_lock held, with the list not empty.
+ */
+static
+int
+blkq_class(struct blkq *bq)
+{
+	int c;
+
+	for (c = 0; c < IOPRIO_NCLASSES; c++) {
+		if (bq->bq_nqueued[c] > 0 && bq->bq_budget[c] > 0) {
+			return c;
+		}
+	}
+	for (c = 0; c < IOPRIO_NCLASSES; c++) {
+		bq->bq_budget[c] = blkq_budgets[c];
+	}
+	/* the best one waiting has budget now, unless it's IOPRIO_IDLE */
+	for (c = 0; c < IOPRIO_NCLASSES; c++) {
+		if (bq->bq_nqueued[c] > 0) {
+			return c;
+		}
+	}
+	panic("blkq %s: no requests in any class\n", bq->bq_name);
+}
+
+/*
+ * Take the next run of requests off the list, chained on br_next.
+ * Call with bq_lock held, with the list not empty.
+ */
+static
+struct blkreq *
+blkq_pick(struct blkq *bq)
+{
+	struct blkreq *br, **brp, **pick = NULL, **first = NULL;
+	struct blkreq **late = NULL;
+	struct blkreq *run, *last;
+	uint32_t end, nsect;
+	unsigned age, lateage = 0;
+	int c;
+
+	KASSERT(bq->bq_list != NULL);
+
+	/* the class's first and first at or past the head, and the latest */
+	c = blkq_class(bq);
+	for (brp = &bq->bq_list; *brp != NULL; brp = &(*brp)->br_next) {
+		br = *brp;
+		if (br->br_class == c) {
+			if (first == NULL) {
+				first = brp;
+			}
+			if (pick == NULL && br->br_sector >= bq->bq_head) {
+				pick = brp;
+			}
+		}
+		age = bq->bq_ndone - br->br_when;
+		if (age >= blkq_deadlines[br->br_class] &&
+		    (late == NULL || age > lateage)) {
+			late = brp;
+			lateage = age;
+		}
+	}
+	if (late != NULL) {
+		pick = late;
+	}
+	else if (pick == NULL) {
+		/* end of the sweep; back to the lowest */
+		KASSERT(first != NULL);
+		pick = first;
+	}
+
+	/* take it, and whatever of its class carries on from it */
+	run = last = *pick;
+	c = run->br_class;
+	*pick = run->br_next;
+	end = run->br_sector + run->br_nsect;
+	nsect = run->br_nsect;
+	bq->bq_nqueued[c]--;
+	while (*pick != NULL && (*pick)->br_sector == end &&
+	       (*pick)->br_write == run->br_write &&
+	       (*pick)->br_class == c &&
+	       nsect + (*pick)->br_nsect <= BLKQ_MAXRUN) {
+		last->br_next = *pick;
+		last = *pick;
+		*pick = last->br_next;
+		end += last->br_nsect;
+		nsect += last->br_nsect;
+		bq->bq_nqueued[c]--;
+		bq->bq_merged++;
+	}
+	last->br_next = NULL;
+
+	if (bq->bq_budget[c] > 0) {
+		bq->bq_budget[c]--;
+	}
+	bq->bq_head = end;
+	bq->bq_ndone++;
+	return run;
+}
+
+static
+void
+blkq_thread(void *vbq, unsigned long unused)
+{
+	struct blkq *bq = vbq;
+	struct blkreq *run, *br;
+	struct sched_attr sa;
+	uint64_t start, end;
+	unsigned n;
+
+	(void)unused;
+
+	/*
+	 * Everyone waiting on the disk waits on us, and we mostly sleep
+	 * in the driver, so go ahead of the threads that would keep us
+	 * from starting the next run.
+	 */
+	sa.sa_policy = SCHED_FIFO;
+	sa.sa_priority = SCHED_FIFO_MAXPRIO;
+	(void)thread_setsched(curthread, &sa);
+
+	lock_acquire(bq->bq_lock);
+	while (1) {
+		while (bq->bq_list == NULL) {
+			cv_wait(bq->bq_workcv, bq->bq_lock);
+		}
+		run = blkq_pick(bq);
+		lock_release(bq->bq_lock);
+
+		/* back to back, so the disk sees one run */
+		n = 0;
+		for (br = run; br != NULL; br = br->br_next) {
+			start = mainbus_cycles();
+			br->br_result = bq->bq_iofn(bq->bq_data,
+						    br->br_sector,
+						    br->br_nsect, br->br_data,
+						    br->br_write);
+			end = mainbus_cycles();
+			TRACE(TR_BIODONE, br->br_sector, br->br_result);
+			if (end > start) {
+				bq->bq_busy += end - start;
+			}
+			blkq_hist(bq->bq_svc, start, end);
+			blkq_hist(bq->bq_lat, br->br_start, end);
+			blkq_hist(bq->bq_clat[br->br_class], br->br_start,
+				  end);
+			n++;
+		}
+		/* (br_done may free the request) */
+		while (run != NULL) {
+			br = run;
+			run = br->br_next;
+			br->br_done(br, br->br_result);
+		}
+
+		lock_acquire(bq->bq_lock);
+		KASSERT(bq->bq_inflight >= n);
+		bq->bq_inflight -= n;
+	}
+}
+
+struct blkq *
+blkq_create(const char *name, blkq_iofn iofn, void *data, size_t sectsize)
+{
+	struct blkq *bq;
+	int c;
+
+	bq = kmalloc_tagged(sizeof(*bq), KM_VFS);
+	if (bq == NULL) {
+		return NULL;
+	}
+	bq->bq_name = name;
+	bq->bq_iofn = iofn;
+	bq->bq_data = data;
+	bq->bq_sectsize = sectsize;
+	bq->bq_list = NULL;
+	bq->bq_head = 0;
+	bq->bq_ndone = 0;
+	bzero(bq->bq_nqueued, sizeof(bq->bq_nqueued));
+	for (c = 0; c < IOPRIO_NCLASSES; c++) {
+		bq->bq_budget[c] = blkq_budgets[c];
+	}
+	bzero(bq->bq_reqs, sizeof(bq->bq_reqs));
+	bzero(bq->bq_sects, sizeof(bq->bq_sects));
+	bq->bq_merged = 0;
+	bq->bq_inflight = 0;
+	bq->bq_depthsum = 0;
+	bq->bq_busy = 0;
+	bzero(bq->bq_svc, sizeof(bq->bq_svc));
+	bzero(bq->bq_lat, sizeof(bq->bq_lat));
+	bzero(bq->bq_clat, sizeof(bq->bq_clat));
+	bq->bq_lock = lock_create(name);
+	bq->bq_workcv = cv_create(name);
+	bq->bq_donecv = cv_create(name);
+	if (bq->bq_lock == NULL || bq->bq_workcv == NULL ||
+	    bq->bq_donecv == NULL) {
+		goto fail;
+	}
+	if (thread_fork(name, NULL, blkq_thread, bq, 0)) {
+		goto fail;
+	}
+	return bq;
+
+ fail:
+	if (bq->bq_donecv != NULL) {
+		cv_destroy(bq->bq_donecv);
+	}
+	if (bq->bq_workcv != NULL) {
+		cv_destroy(bq->bq_workcv);
+	}
+	if (bq->bq_lock != NULL) {
+		lock_destroy(bq->bq_lock);
+	}
+	kfree(bq);
+	return NULL;
+}
+
+void
+blkq_submit(struct blkq *bq, struct blkreq *br)
+{
+	struct blkreq **brp;
+
+	KASSERT(br->br_nsect > 0);
+	KASSERT(br->br_done != NULL);
+
+	TRACE(TR_BIOSUBMIT, br->br_sector,
+	      br->br_nsect | (br->br_write ? 0x80000000 : 0));
+
+	br->br_start = mainbus_cycles();
+	br->br_class = curproc->p_ioprio;
+	KASSERT(br->br_class >= 0 && br->br_class < IOPRIO_NCLASSES);
+
+	lock_acquire(bq->bq_lock);
+	br->br_when = bq->bq_ndone;
+	bq->bq_nqueued[br->br_class]++;
+	bq->bq_reqs[br->br_write]++;
+	bq->bq_sects[br->br_write] += br->br_nsect;
+	bq->bq_inflight++;
+	bq->bq_depthsum += bq->bq_inflight;
+	/* after any at the same sector, so they go in the order they came */
+	for (brp = &bq->bq_list; *brp != NULL; brp = &(*brp)->br_next) {
+		if ((*brp)->br_sector > br->br_sector) {
+			break;
+		}
+	}
+	br->br_next = *brp;
+	*brp = br;
+	cv_signal(bq->bq_workcv, bq->bq_lock);
+	lock_release(bq->bq_lock);
+}
+
+////////////////////////////////////////////////////////////
+// waiting for requests
+
+struct blkq_waiter {
+	struct blkq *bw_bq;
+	bool bw_done;
+	int bw_result;
+};
+
+static
+void
+blkq_wakeup(struct blkreq *br, int result)
+{
+	struct blkq_waiter *bw = br->br_arg;
+	struct blkq *bq = bw->bw_bq;
+
+	lock_acquire(bq->bq_lock);
+	bw->bw_result = result;
+	bw->bw_done = true;
+	cv_broadcast(bq->bq_donecv, bq->bq_lock);
+	lock_release(bq->bq_lock);
+}
+
+int
+blkq_io(struct blkq *bq, uint32_t sector, uint32_t nsect, void *buf,
+	bool write)
+{
+	struct blkq_waiter bw;
+	struct blkreq br;
+
+	bw.bw_bq = bq;
+	bw.bw_done = false;
+	bw.bw_result = 0;
+
+	br.br_sector = sector;
+	br.br_nsect = nsect;
+	br.br_data = buf;
+	br.br_write = write;
+	br.br_done = blkq_wakeup;
+	br.br_arg = &bw;
+	blkq_submit(bq, &br);
+
+	lock_acquire(bq->bq_lock);
+	while (!bw.bw_done) {
+		cv_wait(bq->bq_donecv, bq->bq_lock);
+	}
+	lock_release(bq->bq_lock);
+	return bw.bw_result;
+}
+
+/*
+ * A kernel buffer in one piece (the buffer cache's case) goes to the
+ * disk as it is; anything else is moved through a bounce buffer.
+ */
+int
+blkq_uio(struct blkq *bq, struct uio *uio)
+{
+	struct iovec *iov = uio->uio_iov;
+	uint32_t sector, nsect;
+	size_t len;
+	char *bounce;
+	bool write = (uio->uio_rw == UIO_WRITE);
+	int result = 0;
+
+	KASSERT(uio->uio_offset % bq->bq_sectsize == 0);
+	KASSERT(uio->uio_resid % bq->bq_sectsize == 0);
+
+	sector = uio->uio_offset / bq->bq_sectsize;
+
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1) {
+		len = uio->uio_resid;
+		KASSERT(iov->iov_len >= len);
+		result = blkq_io(bq, sector, len / bq->bq_sectsize,
+				 iov->iov_kbase, write);
+		if (result) {
+			return result;
+		}
+		iov->iov_kbase = (char *)iov->iov_kbase + len;
+		iov->iov_len -= len;
+		uio->uio_resid -= len;
+		uio->uio_offset += len;
+		return 0;
+	}
+
+	bounce = kmalloc_tagged(BLKQ_BOUNCE, KM_VFS);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > BLKQ_BOUNCE) {
+			len = BLKQ_BOUNCE - BLKQ_BOUNCE % bq->bq_sectsize;
+		}
+		nsect = len / bq->bq_sectsize;
+		if (write) {
+			result = uiomove(bounce, len, uio);
+			if (result) {
+				break;
+			}
+		}
+		result = blkq_io(bq, sector, nsect, bounce, write);
+		if (result) {
+			break;
+		}
+		if (!write) {
+			result = uiomove(bounce, len, uio);
+			if (result) {
+				break;
+			}
+		}
+		sector += nsect;
+	}
+	kfree(bounce);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// counters
+
+/* Print histogram HIST as NAME.WHAT, if it has anything in it. */
+static
+size_t
+blkq_format_hist(const uint64_t *hist, const char *name, const char *what,
+		 char *buf, size_t len, size_t pos)
+{
+	unsigned b;
+	bool any;
+	int n;
+
+	any = false;
+	for (b = 0; b < BLKQ_NBUCKETS; b++) {
+		any = any || hist[b] > 0;
+	}
+	if (!any) {
+		return pos;
+	}
+
+	n = snprintf(buf + (pos < len ? pos : len),
+		     pos < len ? len - pos : 0, "%s.%s", name, what);
+	pos += n;
+	for (b = 0; b < BLKQ_NBUCKETS; b++) {
+		if (hist[b] == 0) {
+			continue;
+		}
+		n = snprintf(buf + (pos < len ? pos : len),
+			     pos < len ? len - pos : 0, " %u:%llu",
+			     b, (unsigned long long)hist[b]);
+		pos += n;
+	}
+	n = snprintf(buf + (pos < len ? pos : len),
+		     pos < len ? len - pos : 0, "\n");
+	pos += n;
+	return pos;
+}
+
+size_t
+blkq_format(struct blkq *bq, const char *name, char *buf, size_t len,
+	    size_t pos)
+{
+	uint64_t vals[8];
+	static const char *const names[8] = {
+		"reads", "readbytes", "writes", "writebytes",
+		"merged", "inflight", "depthsum", "busyus",
+	};
+	static const char *const classlat[IOPRIO_NCLASSES] = {
+		[IOPRIO_RT] = "rtlat",
+		[IOPRIO_BE] = "belat",
+		[IOPRIO_IDLE] = "idlelat",
+	};
+	unsigned i;
+	int n;
+
+	lock_acquire(bq->bq_lock);
+	vals[0] = bq->bq_reqs[0];
+	vals[1] = bq->bq_sects[0] * bq->bq_sectsize;
+	vals[2] = bq->bq_reqs[1];
+	vals[3] = bq->bq_sects[1] * bq->bq_sectsize;
+	vals[4] = bq->bq_merged;
+	vals[5] = bq->bq_inflight;
+	vals[6] = bq->bq_depthsum;
+	/* (in two parts, so it doesn't overflow after a few days) */
+	vals[7] = bq->bq_busy / mainbus_cyclerate() * 1000000 +
+		bq->bq_busy % mainbus_cyclerate() * 1000000 /
+		mainbus_cyclerate();
+	lock_release(bq->bq_lock);
+
+	for (i = 0; i < 8; i++) {
+		n = snprintf(buf + (pos < len ? pos : len),
+			     pos < len ? len - pos : 0, "%s.%s %llu\n",
+			     name, names[i], (unsigned long long)vals[i]);
+		pos += n;
+	}
+	pos = blkq_format_hist(bq->bq_svc, name, "svc", buf, len, pos);
+	pos = blkq_format_hist(bq->bq_lat, name, "lat", buf, len, pos);
+	for (i = 0; i < IOPRIO_NCLASSES; i++) {
+		pos = blkq_format_hist(bq->bq_clat[i], name, classlat[i],
+				       buf, len, pos);
+	}
+	return pos;
+}
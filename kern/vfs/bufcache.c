@@ -0,0 +1,1121 @@
+/*
+ * Buffer cache (see bufcache.h).
+ *
+ * Every buffer is on the hash, which finds it by (device, block),
+ * once it has been used at all. Buffers nobody holds are also on the
+ * LRU list, least recently released first; when the cache is full,
+ * the first of those is reused (after writing it out if it's dirty).
+ * One sleep lock covers the hash, the list and the buffer flags; a
+ * thread holding a buffer (b_busy) can use its data without it, so
+ * disk I/O is done without the cache lock held.
+ *
+ * A buffer that isn't b_valid may still hold part of its block, the
+ * bytes from b_vstart up to b_vend, written with buf_markrange and
+ * not read; b_vend is 0 if it holds none. It's always dirty then.
+ * buf_fill reads the rest under it, which has to happen before it's
+ * read or written back, as the disk only does whole blocks.
+ *
+ * The cache's size is fixed at boot, from how much memory is free
+ * then; buffer memory is allocated as buffers are first used.
+ *
+ * Readahead requests (buf_prefetch) go on a small queue, also under
+ * buf_lock, that a thread of our own works through with buf_readrun.
+ * When the queue is full, new requests are dropped; they're only
+ * hints.
+ *
+ * Another thread writes dirty buffers back in the background: every
+ * BUF_FLUSHSECS seconds it writes the ones that have been dirty for
+ * at least BUF_MAXAGE, in block order, so that runs of them go out
+ * together. And if a buffer has to be written out to make room, the
+ * cache is filling with dirty blocks, so it's woken up to write all
+ * of them on its next tick.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/sched.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <clock.h>
+#include <thread.h>
+#include <device.h>
+#include <coremap.h>
+#include <vm.h>
+#include <bufcache.h>
+#include <cpu.h>
+#include <current.h>
+#include <stats.h>
+
+/* The share of the free memory at boot that goes to the cache (1/N). */
+#define BUF_MEMSHARE	8
+
+/* Fewest buffers the cache has no matter how little memory there is. */
+#define BUF_MIN		64
+
+/* Hash table size (a power of two). */
+#define BUF_HASHSIZE	256
+
+/* Readahead requests that can be waiting. */
+#define BUF_RAQUEUE	16
+
+/* How often dirty buffers are written back, and at what age (seconds). */
+#define BUF_FLUSHSECS	5
+#define BUF_MAXAGE	5
+
+struct buf_ra {
+	struct device *ra_dev;
+	daddr_t ra_block;
+	unsigned ra_n;
+};
+
+struct buf {
+	struct device *b_dev;		/* NULL if the buffer holds nothing */
+	daddr_t b_block;
+	void *b_data;
+	bool b_valid;			/* b_data holds the block */
+	unsigned b_vstart, b_vend;	/* ... or just this much of it */
+	bool b_dirty;			/* ... and it's changed since it was read */
+	bool b_busy;			/* held by some thread */
+	unsigned b_pin;			/* transaction pinning it, or 0 */
+	time_t b_dirtied;		/* when it was first changed */
+	struct buf *b_hnext;		/* hash chain */
+	struct buf *b_lprev, *b_lnext;	/* LRU list, if not busy */
+};
+
+static struct lock *buf_lock;
+static struct cv *buf_cv;		/* broadcast when a buffer is released */
+static struct buf *buf_all;		/* all the buffers */
+static unsigned buf_num;
+static unsigned buf_used;		/* buffers with b_data */
+static struct buf *buf_hash[BUF_HASHSIZE];
+static struct buf *buf_lruhead, *buf_lrutail;
+static struct cv *buf_racv;		/* signalled when readahead is queued */
+static struct buf_ra buf_raq[BUF_RAQUEUE];	/* readahead queue */
+static unsigned buf_rahead, buf_racount;
+static struct device *buf_radev;	/* device being read ahead on */
+static struct buf **buf_flushlist;	/* for sorting dirty buffers */
+static bool buf_flushall;		/* write back everything, soon */
+
+static void buf_rathread(void *unused1, unsigned long unused2);
+static void buf_flushthread(void *unused1, unsigned long unused2);
+
+static
+unsigned
+buf_hashfn(struct device *dev, daddr_t block)
+{
+	return ((uintptr_t)dev / sizeof(struct device) + block) & (BUF_HASHSIZE - 1);
+}
+
+void
+buf_bootstrap(void)
+{
+	buf_num = coremap_freecount() * (PAGE_SIZE / BUF_BLOCKSIZE) / BUF_MEMSHARE;
+	if (buf_num < BUF_MIN) {
+		buf_num = BUF_MIN;
+	}
+
+	buf_lock = lock_create("bufcache");
+	buf_cv = cv_create("bufcache");
+	buf_racv = cv_create("bufra");
+	buf_all = kmalloc_tagged(buf_num * sizeof(struct buf), KM_BUFCACHE);
+	buf_flushlist = kmalloc_tagged(buf_num * sizeof(struct buf *),
+				       KM_BUFCACHE);
+	if (buf_lock == NULL || buf_cv == NULL || buf_racv == NULL ||
+	    buf_all == NULL || buf_flushlist == NULL) {
+		panic("buf_bootstrap: out of memory\n");
+	}
+	for (unsigned i = 0; i < buf_num; i++) {
+		buf_all[i].b_dev = NULL;
+		buf_all[i].b_block = 0;
+		buf_all[i].b_data = NULL;
+		buf_all[i].b_valid = false;
+		buf_all[i].b_vstart = buf_all[i].b_vend = 0;
+		buf_all[i].b_dirty = false;
+		buf_all[i].b_busy = false;
+		buf_all[i].b_pin = 0;
+		buf_all[i].b_dirtied = 0;
+		buf_all[i].b_hnext = NULL;
+		buf_all[i].b_lprev = buf_all[i].b_lnext = NULL;
+	}
+	buf_used = 0;
+	buf_rahead = buf_racount = 0;
+	buf_radev = NULL;
+	buf_flushall = false;
+	if (thread_fork("bufra", NULL, buf_rathread, NULL, 0)) {
+		panic("buf_bootstrap: could not start the readahead thread\n");
+	}
+	if (thread_fork("bufflush", NULL, buf_flushthread, NULL, 0)) {
+		panic("buf_bootstrap: could not start the flusher thread\n");
+	}
+	kprintf("bufcache: %u buffers (%u KB)\n", buf_num,
+		buf_num * BUF_BLOCKSIZE / 1024);
+}
+
+/*
+ * LRU and hash list handling. Call with buf_lock held.
+ */
+
+static
+void
+buf_lru_remove(struct buf *b)
+{
+	if (b->b_lprev != NULL) {
+		b->b_lprev->b_lnext = b->b_lnext;
+	}
+	else {
+		buf_lruhead = b->b_lnext;
+	}
+	if (b->b_lnext != NULL) {
+		b->b_lnext->b_lprev = b->b_lprev;
+	}
+	else {
+		buf_lrutail = b->b_lprev;
+	}
+	b->b_lprev = b->b_lnext = NULL;
+}
+
+/* at the tail (used last), or at the head if it holds nothing worth keeping */
+static
+void
+buf_lru_insert(struct buf *b, bool athead)
+{
+	if (athead) {
+		b->b_lprev = NULL;
+		b->b_lnext = buf_lruhead;
+		if (buf_lruhead != NULL) {
+			buf_lruhead->b_lprev = b;
+		}
+		else {
+			buf_lrutail = b;
+		}
+		buf_lruhead = b;
+	}
+	else {
+		b->b_lnext = NULL;
+		b->b_lprev = buf_lrutail;
+		if (buf_lrutail != NULL) {
+			buf_lrutail->b_lnext = b;
+		}
+		else {
+			buf_lruhead = b;
+		}
+		buf_lrutail = b;
+	}
+}
+
+static
+struct buf *
+buf_hash_find(struct device *dev, daddr_t block)
+{
+	struct buf *b;
+
+	for (b = buf_hash[buf_hashfn(dev, block)]; b != NULL; b = b->b_hnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buf_hash_insert(struct buf *b)
+{
+	unsigned h = buf_hashfn(b->b_dev, b->b_block);
+
+	b->b_hnext = buf_hash[h];
+	buf_hash[h] = b;
+}
+
+static
+void
+buf_hash_remove(struct buf *b)
+{
+	struct buf **bp = &buf_hash[buf_hashfn(b->b_dev, b->b_block)];
+
+	while (*bp != b) {
+		KASSERT(*bp != NULL);
+		bp = &(*bp)->b_hnext;
+	}
+	*bp = b->b_hnext;
+	b->b_hnext = NULL;
+}
+
+/* forget what a buffer holds. Call with buf_lock held */
+static
+void
+buf_forget(struct buf *b)
+{
+	if (b->b_dev != NULL) {
+		buf_hash_remove(b);
+		b->b_dev = NULL;
+	}
+	b->b_valid = false;
+	b->b_vstart = b->b_vend = 0;
+	b->b_dirty = false;
+}
+
+/*
+ * Read or write the N blocks from BLOCK on, to or from the buffers
+ * in IOV (a whole block each), with one device request, retrying I/O
+ * errors. Call with the buffers held and buf_lock not held.
+ */
+static
+int
+buf_devio(struct device *dev, daddr_t block, struct iovec *iov, unsigned n,
+	  enum uio_rw rw)
+{
+	struct uio ku;
+	unsigned i;
+	int result;
+	int tries = 0;
+
+	if (rw == UIO_READ) {
+		STAT_INC(STAT_BIO_READS);
+		STAT_ADD(STAT_BIO_READBLOCKS, n);
+	}
+	else {
+		STAT_INC(STAT_BIO_WRITES);
+		STAT_ADD(STAT_BIO_WRITEBLOCKS, n);
+	}
+
+	while (1) {
+		ku.uio_iov = iov;
+		ku.uio_iovcnt = n;
+		ku.uio_offset = ((off_t)block) * BUF_BLOCKSIZE;
+		ku.uio_resid = n * BUF_BLOCKSIZE;
+		ku.uio_segflg = UIO_SYSSPACE;
+		ku.uio_rw = rw;
+		ku.uio_space = NULL;
+		ku.uio_flags = 0;
+
+		result = DEVOP_IO(dev, &ku);
+		if (result == EINVAL) {
+			/*
+			 * The sector was out of range or the offset
+			 * wasn't sector-aligned: the file system's fault.
+			 */
+			panic("bufcache: DEVOP_IO returned EINVAL\n");
+		}
+		if (result != EIO) {
+			return result;
+		}
+		if (tries == 0) {
+			kprintf("bufcache: block %u I/O error, retrying\n",
+				block);
+		}
+		if (tries == 10) {
+			kprintf("bufcache: block %u I/O error, giving up "
+				"after %d retries\n", block, tries);
+			return result;
+		}
+		tries++;
+		STAT_INC(STAT_BIO_RETRIES);
+
+		/*
+		 * Put the iovecs back the way they were. uiomove moved
+		 * each one's base up by what it transferred and took
+		 * that off its length, and each started out one block.
+		 */
+		for (i = 0; i < n; i++) {
+			iov[i].iov_kbase = (char *)iov[i].iov_kbase -
+				(BUF_BLOCKSIZE - iov[i].iov_len);
+			iov[i].iov_len = BUF_BLOCKSIZE;
+		}
+	}
+}
+
+/* one buffer's block. Call with it held */
+static
+int
+buf_io(struct buf *b, enum uio_rw rw)
+{
+	struct iovec iov;
+
+	KASSERT(b->b_busy);
+
+	iov.iov_kbase = b->b_data;
+	iov.iov_len = BUF_BLOCKSIZE;
+	return buf_devio(b->b_dev, b->b_block, &iov, 1, rw);
+}
+
+/*
+ * Read in the rest of a buffer that holds part of its block, keeping
+ * the part it holds. Call with it held and buf_lock not held.
+ */
+static
+int
+buf_fill(struct buf *b)
+{
+	char *save;
+	unsigned len;
+	int result;
+
+	KASSERT(b->b_busy && !b->b_valid && b->b_vend > 0);
+
+	len = b->b_vend - b->b_vstart;
+	save = kmalloc_tagged(len, KM_BUFCACHE);
+	if (save == NULL) {
+		return ENOMEM;
+	}
+	memcpy(save, (char *)b->b_data + b->b_vstart, len);
+	result = buf_io(b, UIO_READ);
+	/* (whatever the read did, that part is still what was written) */
+	memcpy((char *)b->b_data + b->b_vstart, save, len);
+	kfree(save);
+	if (result) {
+		return result;
+	}
+	b->b_valid = true;
+	b->b_vstart = b->b_vend = 0;
+	return 0;
+}
+
+/*
+ * Write out dirty buffer B, and along with it, in the same device
+ * request, the dirty buffers for the blocks right after it that
+ * nobody holds or has pinned. Call with buf_lock held and B held (off the LRU
+ * list); the lock is let go during the I/O. B is still held after;
+ * the others are put back.
+ */
+static
+int
+buf_writerun(struct buf *b)
+{
+	struct iovec oneiov, *iov;
+	struct buf *onebuf, **run, *nb;
+	unsigned i, n, max;
+	int result;
+
+	KASSERT(b->b_busy && b->b_dirty && b->b_pin == 0);
+
+	if (!b->b_valid) {
+		lock_release(buf_lock);
+		result = buf_fill(b);
+		lock_acquire(buf_lock);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* if we're short of memory, just the one */
+	iov = kmalloc_tagged(BUF_MAXRUN * sizeof(*iov), KM_BUFCACHE);
+	run = kmalloc_tagged(BUF_MAXRUN * sizeof(*run), KM_BUFCACHE);
+	if (iov != NULL && run != NULL) {
+		max = BUF_MAXRUN;
+	}
+	else {
+		kfree(iov);
+		kfree(run);
+		iov = &oneiov;
+		run = &onebuf;
+		max = 1;
+	}
+
+	run[0] = b;
+	for (n = 1; n < max; n++) {
+		nb = buf_hash_find(b->b_dev, b->b_block + n);
+		if (nb == NULL || nb->b_busy || !nb->b_dirty ||
+		    nb->b_pin != 0 || !nb->b_valid) {
+			break;
+		}
+		buf_lru_remove(nb);
+		nb->b_busy = true;
+		run[n] = nb;
+	}
+	for (i = 0; i < n; i++) {
+		iov[i].iov_kbase = run[i]->b_data;
+		iov[i].iov_len = BUF_BLOCKSIZE;
+	}
+
+	lock_release(buf_lock);
+	result = buf_devio(b->b_dev, b->b_block, iov, n, UIO_WRITE);
+	lock_acquire(buf_lock);
+
+	for (i = 0; i < n; i++) {
+		if (result == 0) {
+			run[i]->b_dirty = false;
+		}
+		if (i > 0) {
+			run[i]->b_busy = false;
+			buf_lru_insert(run[i], false);
+		}
+	}
+	if (n > 1) {
+		cv_broadcast(buf_cv, buf_lock);
+	}
+
+	if (max > 1) {
+		kfree(iov);
+		kfree(run);
+	}
+	return result;
+}
+
+/*
+ * Get the buffer for (dev, block), held, whether or not it holds the
+ * block yet. With NOWAIT, fail with EAGAIN rather than wait for a
+ * buffer somebody else holds.
+ */
+static
+int
+buf_lookup(struct device *dev, daddr_t block, bool nowait, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	lock_acquire(buf_lock);
+	while (1) {
+		b = buf_hash_find(dev, block);
+		if (b != NULL) {
+			if (b->b_busy) {
+				if (nowait) {
+					lock_release(buf_lock);
+					return EAGAIN;
+				}
+				cv_wait(buf_cv, buf_lock);
+				continue;
+			}
+			buf_lru_remove(b);
+			break;
+		}
+
+		/* not cached: a buffer that hasn't been used yet, if any */
+		if (buf_used < buf_num) {
+			b = &buf_all[buf_used];
+			b->b_data = kmalloc_tagged(BUF_BLOCKSIZE, KM_BUFCACHE);
+			if (b->b_data == NULL) {
+				lock_release(buf_lock);
+				return ENOMEM;
+			}
+			buf_used++;
+			break;
+		}
+
+		/* otherwise the one least recently used that isn't pinned */
+		b = buf_lruhead;
+		while (b != NULL && b->b_pin != 0) {
+			b = b->b_lnext;
+		}
+		if (b == NULL) {
+			/* every buffer is held or pinned */
+			if (nowait) {
+				lock_release(buf_lock);
+				return EAGAIN;
+			}
+			cv_wait(buf_cv, buf_lock);
+			continue;
+		}
+		buf_lru_remove(b);
+		if (b->b_dirty) {
+			/*
+			 * Write it out first (with any dirty blocks
+			 * after it), then start over: somebody may want
+			 * what it holds, or our block, meanwhile.
+			 * Get the flusher going on the rest.
+			 */
+			buf_flushall = true;
+			b->b_busy = true;
+			result = buf_writerun(b);
+			b->b_busy = false;
+			buf_lru_insert(b, result == 0);
+			cv_broadcast(buf_cv, buf_lock);
+			if (result) {
+				lock_release(buf_lock);
+				return result;
+			}
+			continue;
+		}
+		buf_forget(b);
+		break;
+	}
+
+	if (b->b_dev == NULL) {
+		b->b_dev = dev;
+		b->b_block = block;
+		b->b_valid = false;
+		b->b_vstart = b->b_vend = 0;
+		b->b_dirty = false;
+		buf_hash_insert(b);
+	}
+	b->b_busy = true;
+	lock_release(buf_lock);
+
+	*ret = b;
+	return 0;
+}
+
+/* done with the buffer, and what it holds is no good */
+static
+void
+buf_discard(struct buf *b)
+{
+	lock_acquire(buf_lock);
+	KASSERT(b->b_busy);
+	b->b_busy = false;
+	buf_forget(b);
+	buf_lru_insert(b, true);
+	cv_broadcast(buf_cv, buf_lock);
+	lock_release(buf_lock);
+}
+
+int
+buf_read(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	result = buf_lookup(dev, block, false, &b);
+	if (result) {
+		return result;
+	}
+	if (b->b_valid) {
+		STAT_INC(STAT_CACHE_BUFHITS);
+	}
+	else if (b->b_vend > 0) {
+		/* (a miss for the part that has to be read) */
+		STAT_INC(STAT_CACHE_BUFMISSES);
+		result = buf_fill(b);
+		if (result) {
+			/* the part that was written is still good */
+			buf_release(b);
+			return result;
+		}
+	}
+	else {
+		STAT_INC(STAT_CACHE_BUFMISSES);
+		result = buf_io(b, UIO_READ);
+		if (result) {
+			buf_discard(b);
+			return result;
+		}
+		b->b_valid = true;
+	}
+	*ret = b;
+	return 0;
+}
+
+int
+buf_get(struct device *dev, daddr_t block, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	result = buf_lookup(dev, block, false, &b);
+	if (result) {
+		return result;
+	}
+	/* the caller fills it in */
+	b->b_valid = true;
+	b->b_vstart = b->b_vend = 0;
+	*ret = b;
+	return 0;
+}
+
+int
+buf_getrange(struct device *dev, daddr_t block, unsigned off,
+	     struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(off < BUF_BLOCKSIZE);
+
+	result = buf_lookup(dev, block, false, &b);
+	if (result) {
+		return result;
+	}
+	if (b->b_valid) {
+		STAT_INC(STAT_CACHE_BUFHITS);
+	}
+	else if (b->b_vend == 0 ||
+		 (off >= b->b_vstart && off <= b->b_vend)) {
+		/* it can start (or go on) holding part of the block */
+		STAT_INC(STAT_CACHE_BUFHITS);
+	}
+	else {
+		/* a write apart from what it holds: read the rest first */
+		STAT_INC(STAT_CACHE_BUFMISSES);
+		result = buf_fill(b);
+		if (result) {
+			buf_release(b);
+			return result;
+		}
+	}
+	*ret = b;
+	return 0;
+}
+
+void *
+buf_data(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_data;
+}
+
+void
+buf_markdirty(struct buf *b)
+{
+	struct timespec now;
+
+	KASSERT(b->b_busy);
+	if (!b->b_dirty) {
+		gettime(&now);
+		b->b_dirtied = now.tv_sec;
+		b->b_dirty = true;
+	}
+}
+
+/*
+ * After buf_getrange, which saw to it that OFF is inside the part the
+ * buffer holds or right after it, if it holds part; so the part it
+ * holds afterwards is still all in one piece.
+ */
+void
+buf_markrange(struct buf *b, unsigned off, unsigned len)
+{
+	KASSERT(b->b_busy);
+	KASSERT(off + len <= BUF_BLOCKSIZE);
+
+	if (len == 0) {
+		return;
+	}
+	if (!b->b_valid) {
+		if (b->b_vend == 0) {
+			b->b_vstart = off;
+			b->b_vend = off + len;
+		}
+		else {
+			KASSERT(off >= b->b_vstart && off <= b->b_vend);
+			if (off + len > b->b_vend) {
+				b->b_vend = off + len;
+			}
+		}
+		if (b->b_vstart == 0 && b->b_vend == BUF_BLOCKSIZE) {
+			/* all of it's been written */
+			b->b_valid = true;
+			b->b_vstart = b->b_vend = 0;
+		}
+	}
+	buf_markdirty(b);
+}
+
+void
+buf_release(struct buf *b)
+{
+	lock_acquire(buf_lock);
+	KASSERT(b->b_busy);
+	b->b_busy = false;
+	buf_lru_insert(b, false);
+	cv_broadcast(buf_cv, buf_lock);
+	lock_release(buf_lock);
+}
+
+int
+buf_flush(struct device *dev)
+{
+	struct buf *b, *pb;
+	int result, ret = 0;
+
+	lock_acquire(buf_lock);
+	for (unsigned i = 0; i < buf_used; i++) {
+		b = &buf_all[i];
+		while (b->b_dev == dev && b->b_dirty && b->b_busy) {
+			/* somebody's using it; write it once they're done */
+			cv_wait(buf_cv, buf_lock);
+		}
+		if (b->b_dev != dev || !b->b_dirty || b->b_pin != 0) {
+			continue;
+		}
+
+		/* start from the first of any run of dirty blocks it's in */
+		while (b->b_block > 0) {
+			pb = buf_hash_find(dev, b->b_block - 1);
+			if (pb == NULL || pb->b_busy || !pb->b_dirty ||
+			    pb->b_pin != 0) {
+				break;
+			}
+			b = pb;
+		}
+
+		buf_lru_remove(b);
+		b->b_busy = true;
+		result = buf_writerun(b);
+		if (result && ret == 0) {
+			ret = result;
+		}
+		b->b_busy = false;
+		buf_lru_insert(b, false);
+		cv_broadcast(buf_cv, buf_lock);
+
+		/* (if that was an earlier block, buf_all[i] was in the run) */
+		if (result == 0 && buf_all[i].b_dev == dev &&
+		    buf_all[i].b_dirty && buf_all[i].b_pin == 0) {
+			i--;
+		}
+	}
+	lock_release(buf_lock);
+	return ret;
+}
+
+/*
+ * Write out whichever of the N blocks in BLOCKS are cached and dirty
+ * (0s, for holes, are skipped). Each one goes in a run with the dirty
+ * blocks right after it, as in buf_flush, so a stretch of a file
+ * still takes one request.
+ */
+int
+buf_flushblocks(struct device *dev, const daddr_t *blocks, unsigned n)
+{
+	struct buf *b;
+	int result, ret = 0;
+
+	lock_acquire(buf_lock);
+	for (unsigned i = 0; i < n; i++) {
+		if (blocks[i] == 0) {
+			continue;
+		}
+		/* (look it up again after waiting; it may have been thrown out) */
+		while ((b = buf_hash_find(dev, blocks[i])) != NULL &&
+		       b->b_dirty && b->b_busy) {
+			cv_wait(buf_cv, buf_lock);
+		}
+		if (b == NULL || !b->b_dirty || b->b_pin != 0) {
+			continue;
+		}
+
+		buf_lru_remove(b);
+		b->b_busy = true;
+		result = buf_writerun(b);
+		if (result && ret == 0) {
+			ret = result;
+		}
+		b->b_busy = false;
+		buf_lru_insert(b, false);
+		cv_broadcast(buf_cv, buf_lock);
+	}
+	lock_release(buf_lock);
+	return ret;
+}
+
+/*
+ * Make sure the N blocks from BLOCK on are in the cache, reading the
+ * ones that aren't with as few device requests as it takes: one for
+ * each stretch of them between blocks that are cached already (or
+ * that somebody holds, which we skip rather than wait for).
+ */
+int
+buf_readrun(struct device *dev, daddr_t block, unsigned n)
+{
+	struct iovec *iov;
+	struct buf **run, *b;
+	unsigned i, j, got;
+	int result = 0;
+
+	/* don't hold so many that everybody else has to wait */
+	if (n > BUF_MAXRUN) {
+		n = BUF_MAXRUN;
+	}
+	if (n > buf_num / 4) {
+		n = buf_num / 4;
+	}
+
+	iov = kmalloc_tagged(n * sizeof(*iov), KM_BUFCACHE);
+	run = kmalloc_tagged(n * sizeof(*run), KM_BUFCACHE);
+	if (iov == NULL || run == NULL) {
+		kfree(iov);
+		kfree(run);
+		return ENOMEM;
+	}
+
+	i = 0;
+	while (i < n && result == 0) {
+		for (got = 0; i + got < n; got++) {
+			if (buf_lookup(dev, block + i + got, true, &b)) {
+				break;
+			}
+			if (b->b_valid || b->b_vend > 0) {
+				/* (part of it written is as good as there) */
+				buf_release(b);
+				break;
+			}
+			run[got] = b;
+			iov[got].iov_kbase = b->b_data;
+			iov[got].iov_len = BUF_BLOCKSIZE;
+		}
+		if (got == 0) {
+			/* that one's there already */
+			i++;
+			continue;
+		}
+
+		result = buf_devio(dev, block + i, iov, got, UIO_READ);
+		for (j = 0; j < got; j++) {
+			if (result == 0) {
+				run[j]->b_valid = true;
+				buf_release(run[j]);
+			}
+			else {
+				buf_discard(run[j]);
+			}
+		}
+		i += got;
+	}
+
+	kfree(iov);
+	kfree(run);
+	return result;
+}
+
+/*
+ * Ask for the N blocks from BLOCK on to be read into the cache in
+ * the background. Blocks at the front that are cached already are
+ * left off; if that's all of them, or the queue is full, nothing
+ * happens.
+ */
+void
+buf_prefetch(struct device *dev, daddr_t block, unsigned n)
+{
+	struct buf_ra *ra;
+
+	lock_acquire(buf_lock);
+	while (n > 0 && buf_hash_find(dev, block) != NULL) {
+		block++;
+		n--;
+	}
+	if (n > 0 && buf_racount < BUF_RAQUEUE) {
+		ra = &buf_raq[(buf_rahead + buf_racount) % BUF_RAQUEUE];
+		ra->ra_dev = dev;
+		ra->ra_block = block;
+		ra->ra_n = n;
+		buf_racount++;
+		cv_signal(buf_racv, buf_lock);
+	}
+	lock_release(buf_lock);
+}
+
+static
+void
+buf_rathread(void *unused1, unsigned long unused2)
+{
+	struct buf_ra ra;
+
+	(void)unused1;
+	(void)unused2;
+
+	lock_acquire(buf_lock);
+	while (1) {
+		while (buf_racount == 0) {
+			cv_wait(buf_racv, buf_lock);
+		}
+		ra = buf_raq[buf_rahead];
+		buf_rahead = (buf_rahead + 1) % BUF_RAQUEUE;
+		buf_racount--;
+
+		/* buf_invalidate waits for us to be done with the device */
+		buf_radev = ra.ra_dev;
+		lock_release(buf_lock);
+		/* (errors don't matter: whoever wants the blocks will see) */
+		(void)buf_readrun(ra.ra_dev, ra.ra_block, ra.ra_n);
+		lock_acquire(buf_lock);
+		buf_radev = NULL;
+		cv_broadcast(buf_cv, buf_lock);
+	}
+}
+
+/*
+ * Pinning. A journal pins each buffer it changes, for the transaction
+ * the change is part of, so the change can't reach its home on disk
+ * before the transaction is in the journal. The pin goes when the
+ * transaction is written, unless a later one has taken it over.
+ */
+void
+buf_pin(struct buf *b, unsigned id)
+{
+	KASSERT(id != 0);
+
+	lock_acquire(buf_lock);
+	KASSERT(b->b_busy);
+	b->b_pin = id;
+	lock_release(buf_lock);
+}
+
+unsigned
+buf_pinned(struct buf *b)
+{
+	unsigned id;
+
+	lock_acquire(buf_lock);
+	KASSERT(b->b_busy);
+	id = b->b_pin;
+	lock_release(buf_lock);
+	return id;
+}
+
+void
+buf_unpin(struct device *dev, daddr_t block, unsigned id)
+{
+	struct buf *b;
+
+	lock_acquire(buf_lock);
+	/* (a pinned buffer can't be thrown out, so it's still there) */
+	b = buf_hash_find(dev, block);
+	KASSERT(b != NULL);
+	if (b->b_pin == id) {
+		b->b_pin = 0;
+		/* somebody may be waiting for a buffer to throw out */
+		cv_broadcast(buf_cv, buf_lock);
+	}
+	lock_release(buf_lock);
+}
+
+/*
+ * Pinning too many would leave nothing to throw out to make room; a
+ * journal commits (or gives up pinning) at this many.
+ */
+unsigned
+buf_pinmax(void)
+{
+	return buf_num / 4;
+}
+
+/* B1 goes before B2 when writing back */
+static
+bool
+buf_before(struct buf *b1, struct buf *b2)
+{
+	if (b1->b_dev != b2->b_dev) {
+		return (uintptr_t)b1->b_dev < (uintptr_t)b2->b_dev;
+	}
+	return b1->b_block < b2->b_block;
+}
+
+/*
+ * Write back the dirty buffers nobody holds or has pinned that were
+ * changed before
+ * CUTOFF (or all of them, with ALL), lowest block first. Call with
+ * buf_lock held.
+ */
+static
+void
+buf_writeback(time_t cutoff, bool all)
+{
+	struct buf *b;
+	unsigned i, j, gap, n;
+
+	n = 0;
+	for (i = 0; i < buf_used; i++) {
+		b = &buf_all[i];
+		if (b->b_dirty && !b->b_busy && b->b_pin == 0 &&
+		    (all || b->b_dirtied < cutoff)) {
+			buf_flushlist[n++] = b;
+		}
+	}
+
+	/* shell sort */
+	for (gap = n / 2; gap > 0; gap /= 2) {
+		for (i = gap; i < n; i++) {
+			b = buf_flushlist[i];
+			for (j = i; j >= gap && buf_before(b, buf_flushlist[j - gap]);
+			     j -= gap) {
+				buf_flushlist[j] = buf_flushlist[j - gap];
+			}
+			buf_flushlist[j] = b;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		b = buf_flushlist[i];
+		/*
+		 * It may have been written (as part of an earlier run),
+		 * taken, or even reused since; if it's dirty and free
+		 * it needs writing whatever it holds now.
+		 */
+		if (!b->b_dirty || b->b_busy || b->b_pin != 0) {
+			continue;
+		}
+		buf_lru_remove(b);
+		b->b_busy = true;
+		(void)buf_writerun(b);
+		b->b_busy = false;
+		buf_lru_insert(b, false);
+		cv_broadcast(buf_cv, buf_lock);
+	}
+}
+
+static
+void
+buf_flushthread(void *unused1, unsigned long unused2)
+{
+	struct timespec now;
+	struct sched_attr sa;
+	unsigned secs = 0;
+	bool all;
+
+	(void)unused1;
+	(void)unused2;
+
+	/*
+	 * Get a share of the cpu however busy it is, so dirty buffers
+	 * don't pile up behind CPU-bound threads. If the deadline
+	 * threads have it all, we're time shared like before.
+	 */
+	sa.sa_policy = SCHED_DEADLINE;
+	sa.sa_budget = 20;
+	sa.sa_period = 200;
+	(void)thread_setsched(curthread, &sa);
+
+	while (1) {
+		clocksleep(1);
+		secs++;
+
+		lock_acquire(buf_lock);
+		all = buf_flushall;
+		if (all || secs >= BUF_FLUSHSECS) {
+			buf_flushall = false;
+			secs = 0;
+			gettime(&now);
+			buf_writeback(now.tv_sec - BUF_MAXAGE + 1, all);
+		}
+		lock_release(buf_lock);
+	}
+}
+
+void
+buf_invalidate(struct device *dev)
+{
+	struct buf *b;
+	unsigned i, j;
+
+	lock_acquire(buf_lock);
+
+	/* no more reading ahead on it */
+	for (i = j = 0; i < buf_racount; i++) {
+		if (buf_raq[(buf_rahead + i) % BUF_RAQUEUE].ra_dev != dev) {
+			buf_raq[(buf_rahead + j) % BUF_RAQUEUE] =
+				buf_raq[(buf_rahead + i) % BUF_RAQUEUE];
+			j++;
+		}
+	}
+	buf_racount = j;
+	while (buf_radev == dev) {
+		cv_wait(buf_cv, buf_lock);
+	}
+
+	for (i = 0; i < buf_used; i++) {
+		b = &buf_all[i];
+		if (b->b_dev == dev) {
+			KASSERT(!b->b_busy);
+			KASSERT(b->b_pin == 0);
+			if (b->b_dirty) {
+				kprintf("bufcache: block %u dropped "
+					"without being written\n", b->b_block);
+			}
+			buf_lru_remove(b);
+			buf_forget(b);
+			buf_lru_insert(b, true);
+		}
+	}
+	lock_release(buf_lock);
+}
@@ -150,6 +150,21 @@ dev_ioctl(struct vnode *v, int op, userptr_t data)
 	return DEVOP_IOCTL(d, op, data);
 }
 
+/*
+ * Called for poll.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct pollset *ps)
+{
+	struct device *d = v->vn_data;
+
+	if (d->d_ops->devop_poll == NULL) {
+		return vnode_poll_always(v, events, ps);
+	}
+	return d->d_ops->devop_poll(d, events, ps);
+}
+
 /*
  * Called for stat().
  * Set the type and the size (block devices only).
@@ -330,12 +345,17 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_read = dev_read,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_uio_notdir,
 	.vop_write = dev_write,
 	.vop_ioctl = dev_ioctl,
 	.vop_stat = dev_stat,
 	.vop_gettype = dev_gettype,
 	.vop_isseekable = dev_isseekable,
 	.vop_fsync = null_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = dev_poll,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_nosys,
 	.vop_mmap = dev_mmap,
 	.vop_truncate = dev_truncate,
 	.vop_namefile = dev_namefile,
@@ -359,7 +379,7 @@ dev_create_vnode(struct device *dev)
 	int result;
 	struct vnode *v;
 
-	v = kmalloc(sizeof(struct vnode));
+	v = kmalloc_tagged(sizeof(struct vnode), KM_VFS);
 	if (v==NULL) {
 		return NULL;
 	}
@@ -103,7 +103,7 @@ devnull_create(void)
 	int result;
 	struct device *dev;
 
-	dev = kmalloc(sizeof(*dev));
+	dev = kmalloc_tagged(sizeof(*dev), KM_VFS);
 	if (dev==NULL) {
 		panic("Could not add null device: out of memory\n");
 	}
@@ -114,6 +114,7 @@ devnull_create(void)
 	dev->d_blocksize = 1;
 
 	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+	dev->d_queue = NULL;
 
 	dev->d_data = NULL;
 
@@ -0,0 +1,332 @@
+/*
+ * Stripe set (RAID-0) device: several disks made into one, "stripeN",
+ * that can be mounted like any of them. The set's sectors are dealt
+ * out to the disks a stripe unit at a time: the first unit on the
+ * first disk, the next on the second, and so on round, so a long
+ * transfer keeps every disk busy at once.
+ *
+ * A transfer is cut into one piece per stripe unit it touches, and
+ * the pieces all go on their disks' request queues (blkq.h) before
+ * waiting for any of them; each disk's queue thread does its pieces,
+ * the ones that follow on from each other on that disk as one run,
+ * while the others do theirs. The disks are claimed from the VFS
+ * (vfs_claimdev), so nothing can be mounted on them separately.
+ *
+ * There's no redundancy: lose one disk and the set is gone.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vfs.h>
+#include <device.h>
+#include <blkq.h>
+
+/* Most disks in a set. */
+#define STRIPE_MAXDISKS	8
+
+/* Most bytes a transfer from user memory is bounced through at once. */
+#define STRIPE_BOUNCE	(32 * 1024)
+
+struct stripe {
+	struct device st_dev;
+	char st_name[16];
+	uint32_t st_unit;			/* sectors per stripe unit */
+	unsigned st_ndisks;
+	struct device *st_disks[STRIPE_MAXDISKS];
+
+	struct lock *st_lock;			/* for st_cv and the waits */
+	struct cv *st_cv;			/* pieces done */
+};
+
+/* One transfer's pieces, in flight. */
+struct stripe_wait {
+	struct stripe *sw_st;
+	unsigned sw_pending;
+	int sw_result;
+};
+
+static unsigned stripe_count;
+
+static
+void
+stripe_piecedone(struct blkreq *br, int result)
+{
+	struct stripe_wait *sw = br->br_arg;
+	struct stripe *st = sw->sw_st;
+
+	lock_acquire(st->st_lock);
+	if (result != 0 && sw->sw_result == 0) {
+		sw->sw_result = result;
+	}
+	KASSERT(sw->sw_pending > 0);
+	sw->sw_pending--;
+	if (sw->sw_pending == 0) {
+		cv_broadcast(st->st_cv, st->st_lock);
+	}
+	lock_release(st->st_lock);
+}
+
+/*
+ * Move NSECT sectors from SECTOR of the set to or from the kernel
+ * buffer BUF: queue all the pieces, then wait for them all.
+ */
+static
+int
+stripe_doio(struct stripe *st, uint32_t sector, uint32_t nsect, char *buf,
+	    bool write)
+{
+	struct stripe_wait sw;
+	struct blkreq *pieces, *br;
+	uint32_t unitno, off, n, npieces, i;
+	size_t sectsize = st->st_dev.d_blocksize;
+
+	/* one piece per unit touched */
+	npieces = (sector % st->st_unit + nsect + st->st_unit - 1) /
+		st->st_unit;
+	pieces = kmalloc_tagged(npieces * sizeof(*pieces), KM_VFS);
+	if (pieces == NULL) {
+		return ENOMEM;
+	}
+
+	/* (all of them count from the start, so none can finish it early) */
+	sw.sw_st = st;
+	sw.sw_pending = npieces;
+	sw.sw_result = 0;
+
+	for (i = 0; i < npieces; i++) {
+		unitno = sector / st->st_unit;
+		off = sector % st->st_unit;
+		n = st->st_unit - off;
+		if (n > nsect) {
+			n = nsect;
+		}
+
+		br = &pieces[i];
+		br->br_sector = (unitno / st->st_ndisks) * st->st_unit + off;
+		br->br_nsect = n;
+		br->br_data = buf;
+		br->br_write = write;
+		br->br_done = stripe_piecedone;
+		br->br_arg = &sw;
+		blkq_submit(st->st_disks[unitno % st->st_ndisks]->d_queue, br);
+
+		sector += n;
+		nsect -= n;
+		buf += n * sectsize;
+	}
+	KASSERT(nsect == 0);
+
+	lock_acquire(st->st_lock);
+	while (sw.sw_pending > 0) {
+		cv_wait(st->st_cv, st->st_lock);
+	}
+	lock_release(st->st_lock);
+
+	kfree(pieces);
+	return sw.sw_result;
+}
+
+////////////////////////////////////////////////////////////
+// device operations
+
+static
+int
+stripe_eachopen(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+	return 0;
+}
+
+/*
+ * A kernel buffer in one piece (the buffer cache's case) is used as it
+ * is; anything else is moved through a bounce buffer.
+ */
+static
+int
+stripe_io(struct device *d, struct uio *uio)
+{
+	struct stripe *st = d->d_data;
+	struct iovec *iov = uio->uio_iov;
+	size_t sectsize = d->d_blocksize;
+	bool write = (uio->uio_rw == UIO_WRITE);
+	uint32_t sector;
+	size_t len;
+	char *bounce;
+	int result = 0;
+
+	if (uio->uio_offset % sectsize != 0 || uio->uio_resid % sectsize != 0) {
+		return EINVAL;
+	}
+	sector = uio->uio_offset / sectsize;
+	if (uio->uio_offset < 0 ||
+	    sector + uio->uio_resid / sectsize > d->d_blocks) {
+		return EINVAL;
+	}
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1) {
+		len = uio->uio_resid;
+		KASSERT(iov->iov_len >= len);
+		result = stripe_doio(st, sector, len / sectsize,
+				     iov->iov_kbase, write);
+		if (result) {
+			return result;
+		}
+		iov->iov_kbase = (char *)iov->iov_kbase + len;
+		iov->iov_len -= len;
+		uio->uio_resid -= len;
+		uio->uio_offset += len;
+		return 0;
+	}
+
+	bounce = kmalloc_tagged(STRIPE_BOUNCE, KM_VFS);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > STRIPE_BOUNCE) {
+			len = STRIPE_BOUNCE - STRIPE_BOUNCE % sectsize;
+		}
+		if (write) {
+			result = uiomove(bounce, len, uio);
+			if (result) {
+				break;
+			}
+		}
+		result = stripe_doio(st, sector, len / sectsize, bounce,
+				     write);
+		if (result) {
+			break;
+		}
+		if (!write) {
+			result = uiomove(bounce, len, uio);
+			if (result) {
+				break;
+			}
+		}
+		sector += len / sectsize;
+	}
+	kfree(bounce);
+	return result;
+}
+
+static
+int
+stripe_ioctl(struct device *d, int op, userptr_t data)
+{
+	(void)d;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static const struct device_ops stripe_devops = {
+	.devop_eachopen = stripe_eachopen,
+	.devop_io = stripe_io,
+	.devop_ioctl = stripe_ioctl,
+};
+
+////////////////////////////////////////////////////////////
+// setup
+
+/*
+ * Make a stripe set, with a stripe unit of UNIT sectors, out of the
+ * NDISKS mountable disks named in DISKS, and add it as the next
+ * "stripeN". The disks have to have the same sector size and the
+ * request queues this works through; the set is as big as the
+ * smallest of them allows.
+ */
+int
+stripe_create(unsigned unit, unsigned ndisks, char **disks)
+{
+	struct stripe *st;
+	struct device *d;
+	blkcnt_t units;
+	unsigned i, nclaimed = 0;
+	int result;
+
+	if (unit == 0 || ndisks < 2 || ndisks > STRIPE_MAXDISKS) {
+		return EINVAL;
+	}
+
+	st = kmalloc_tagged(sizeof(*st), KM_VFS);
+	if (st == NULL) {
+		return ENOMEM;
+	}
+	st->st_unit = unit;
+	st->st_ndisks = ndisks;
+	st->st_lock = lock_create("stripe");
+	st->st_cv = cv_create("stripe");
+	if (st->st_lock == NULL || st->st_cv == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+
+	for (i = 0; i < ndisks; i++) {
+		result = vfs_claimdev(disks[i], &d);
+		if (result) {
+			kprintf("stripe: %s: %s\n", disks[i],
+				strerror(result));
+			goto fail;
+		}
+		nclaimed++;
+		if (d->d_queue == NULL ||
+		    (i > 0 && d->d_blocksize != st->st_disks[0]->d_blocksize)) {
+			kprintf("stripe: %s: Can't be striped with the others\n",
+				disks[i]);
+			result = EINVAL;
+			goto fail;
+		}
+		st->st_disks[i] = d;
+	}
+
+	/* whole units only, as many as the smallest disk has */
+	units = st->st_disks[0]->d_blocks / unit;
+	for (i = 1; i < ndisks; i++) {
+		if (st->st_disks[i]->d_blocks / unit < units) {
+			units = st->st_disks[i]->d_blocks / unit;
+		}
+	}
+	if (units == 0) {
+		result = EINVAL;
+		goto fail;
+	}
+
+	st->st_dev.d_ops = &stripe_devops;
+	st->st_dev.d_blocks = units * unit * ndisks;
+	st->st_dev.d_blocksize = st->st_disks[0]->d_blocksize;
+	st->st_dev.d_devnumber = 0; /* assigned by vfs_adddev */
+	st->st_dev.d_data = st;
+	st->st_dev.d_queue = NULL;
+
+	snprintf(st->st_name, sizeof(st->st_name), "stripe%u", stripe_count);
+	result = vfs_adddev(st->st_name, &st->st_dev, 1);
+	if (result) {
+		goto fail;
+	}
+	stripe_count++;
+
+	kprintf("%s: %u disks, %u-sector stripe unit, %u sectors\n",
+		st->st_name, ndisks, unit, (unsigned)st->st_dev.d_blocks);
+	return 0;
+
+ fail:
+	for (i = 0; i < nclaimed; i++) {
+		vfs_unclaimdev(disks[i]);
+	}
+	if (st->st_cv != NULL) {
+		cv_destroy(st->st_cv);
+	}
+	if (st->st_lock != NULL) {
+		lock_destroy(st->st_lock);
+	}
+	kfree(st);
+	return result;
+}
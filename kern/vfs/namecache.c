@@ -0,0 +1,349 @@
+/*
+ * Name cache (see namecache.h).
+ *
+ * Entries are on a hash, by (starting directory, path), and on an
+ * LRU list, most recently used first; when the cache is full, the
+ * last one on the list is dropped to make room. One sleep lock covers
+ * both. Entries hold references to their vnodes, which are dropped
+ * only after the lock is released, since that can reclaim the vnode.
+ *
+ * A lookup that misses goes to the file system without the lock, so
+ * a purge can happen while it's in progress; the result it got might
+ * then already be out of date. Every purge bumps ncache_gen, and a
+ * result is only entered if the generation is still the one the
+ * lookup started with.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <namecache.h>
+#include <cpu.h>
+#include <current.h>
+#include <stats.h>
+
+/* Hash table size (a power of two). */
+#define NCACHE_HASHSIZE	64
+
+/* Most entries. */
+#define NCACHE_MAX	256
+
+/* Longest path cached, with its terminating null. */
+#define NCACHE_PATHLEN	48
+
+struct ncentry {
+	struct vnode *nc_dir;		/* where the lookup started */
+	struct vnode *nc_vn;		/* what it found, or NULL if nothing */
+	unsigned nc_hash;
+	char nc_path[NCACHE_PATHLEN];
+	struct ncentry *nc_hnext;	/* hash chain */
+	struct ncentry *nc_lprev, *nc_lnext;	/* LRU list */
+};
+
+static struct lock *ncache_lock;
+static struct ncentry *ncache_hash[NCACHE_HASHSIZE];
+static struct ncentry *ncache_lruhead, *ncache_lrutail;
+static unsigned ncache_count;
+static unsigned ncache_gen;
+
+void
+ncache_bootstrap(void)
+{
+	ncache_lock = lock_create("namecache");
+	if (ncache_lock == NULL) {
+		panic("ncache_bootstrap: out of memory\n");
+	}
+	ncache_lruhead = ncache_lrutail = NULL;
+	ncache_count = 0;
+	ncache_gen = 0;
+}
+
+static
+unsigned
+ncache_hashfn(struct vnode *dir, const char *path)
+{
+	unsigned h = (uintptr_t)dir / sizeof(struct vnode);
+
+	while (*path) {
+		h = h * 33 + (unsigned char)*path++;
+	}
+	return h;
+}
+
+/*
+ * Whether a lookup of PATH from DIR can be cached: a file system's,
+ * short enough, and nothing but plain names.
+ */
+static
+bool
+ncache_cacheable(struct vnode *dir, const char *path)
+{
+	const char *s;
+
+	if (dir->vn_fs == NULL || strlen(path) >= NCACHE_PATHLEN) {
+		return false;
+	}
+	for (s = path; *s; ) {
+		if (s[0] == '.' && (s[1] == '/' || s[1] == 0 ||
+				    (s[1] == '.' && (s[2] == '/' || s[2] == 0)))) {
+			return false;
+		}
+		while (*s && *s != '/') {
+			s++;
+		}
+		while (*s == '/') {
+			s++;
+		}
+	}
+	return true;
+}
+
+/* Whether NAME is one of the components of PATH. */
+static
+bool
+ncache_hascomponent(const char *path, const char *name)
+{
+	const char *n;
+
+	while (*path) {
+		for (n = name; *n && *path == *n; n++) {
+			path++;
+		}
+		if (*n == 0 && (*path == '/' || *path == 0)) {
+			return true;
+		}
+		while (*path && *path != '/') {
+			path++;
+		}
+		while (*path == '/') {
+			path++;
+		}
+	}
+	return false;
+}
+
+/*
+ * List handling. Call with ncache_lock held.
+ */
+
+static
+void
+ncache_unlink(struct ncentry *nc)
+{
+	struct ncentry **np = &ncache_hash[nc->nc_hash & (NCACHE_HASHSIZE - 1)];
+
+	while (*np != nc) {
+		KASSERT(*np != NULL);
+		np = &(*np)->nc_hnext;
+	}
+	*np = nc->nc_hnext;
+	nc->nc_hnext = NULL;
+
+	if (nc->nc_lprev != NULL) {
+		nc->nc_lprev->nc_lnext = nc->nc_lnext;
+	}
+	else {
+		ncache_lruhead = nc->nc_lnext;
+	}
+	if (nc->nc_lnext != NULL) {
+		nc->nc_lnext->nc_lprev = nc->nc_lprev;
+	}
+	else {
+		ncache_lrutail = nc->nc_lprev;
+	}
+	nc->nc_lprev = nc->nc_lnext = NULL;
+
+	KASSERT(ncache_count > 0);
+	ncache_count--;
+}
+
+static
+void
+ncache_link(struct ncentry *nc)
+{
+	unsigned h = nc->nc_hash & (NCACHE_HASHSIZE - 1);
+
+	nc->nc_hnext = ncache_hash[h];
+	ncache_hash[h] = nc;
+
+	nc->nc_lprev = NULL;
+	nc->nc_lnext = ncache_lruhead;
+	if (ncache_lruhead != NULL) {
+		ncache_lruhead->nc_lprev = nc;
+	}
+	else {
+		ncache_lrutail = nc;
+	}
+	ncache_lruhead = nc;
+
+	ncache_count++;
+}
+
+static
+struct ncentry *
+ncache_find(struct vnode *dir, const char *path, unsigned hash)
+{
+	struct ncentry *nc;
+
+	for (nc = ncache_hash[hash & (NCACHE_HASHSIZE - 1)]; nc != NULL;
+	     nc = nc->nc_hnext) {
+		if (nc->nc_hash == hash && nc->nc_dir == dir &&
+		    !strcmp(nc->nc_path, path)) {
+			return nc;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Drop a list of unlinked entries (chained on nc_hnext). Call without
+ * ncache_lock.
+ */
+static
+void
+ncache_freelist(struct ncentry *list)
+{
+	struct ncentry *nc;
+
+	while (list != NULL) {
+		nc = list;
+		list = nc->nc_hnext;
+		if (nc->nc_vn != NULL) {
+			VOP_DECREF(nc->nc_vn);
+		}
+		VOP_DECREF(nc->nc_dir);
+		kfree(nc);
+	}
+}
+
+/*
+ * Remember that looking up PATH from DIR found VN (NULL for ENOENT),
+ * unless there's been a purge since generation GEN.
+ */
+static
+void
+ncache_enter(struct vnode *dir, const char *path, unsigned hash,
+	     struct vnode *vn, unsigned gen)
+{
+	struct ncentry *nc, *victim = NULL;
+
+	nc = kmalloc_tagged(sizeof(*nc), KM_VFS);
+	if (nc == NULL) {
+		/* it's only a cache */
+		return;
+	}
+	nc->nc_dir = dir;
+	nc->nc_vn = vn;
+	nc->nc_hash = hash;
+	strcpy(nc->nc_path, path);
+	nc->nc_hnext = NULL;
+	nc->nc_lprev = nc->nc_lnext = NULL;
+
+	lock_acquire(ncache_lock);
+	if (gen != ncache_gen || ncache_find(dir, path, hash) != NULL) {
+		lock_release(ncache_lock);
+		kfree(nc);
+		return;
+	}
+	if (ncache_count >= NCACHE_MAX) {
+		victim = ncache_lrutail;
+		ncache_unlink(victim);
+	}
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	ncache_link(nc);
+	lock_release(ncache_lock);
+
+	ncache_freelist(victim);
+}
+
+int
+ncache_lookup(struct vnode *dir, char *path, struct vnode **ret)
+{
+	char key[NCACHE_PATHLEN];
+	struct ncentry *nc;
+	unsigned hash, gen;
+	int result;
+
+	if (!ncache_cacheable(dir, path)) {
+		return VOP_LOOKUP(dir, path, ret);
+	}
+
+	/* the lookup may destroy the path */
+	strcpy(key, path);
+	hash = ncache_hashfn(dir, key);
+
+	lock_acquire(ncache_lock);
+	nc = ncache_find(dir, key, hash);
+	if (nc != NULL) {
+		STAT_INC(STAT_CACHE_NAMEHITS);
+		/* move it to the front */
+		ncache_unlink(nc);
+		ncache_link(nc);
+		if (nc->nc_vn == NULL) {
+			lock_release(ncache_lock);
+			return ENOENT;
+		}
+		VOP_INCREF(nc->nc_vn);
+		*ret = nc->nc_vn;
+		lock_release(ncache_lock);
+		return 0;
+	}
+	gen = ncache_gen;
+	lock_release(ncache_lock);
+	STAT_INC(STAT_CACHE_NAMEMISSES);
+
+	result = VOP_LOOKUP(dir, path, ret);
+	if (result == 0) {
+		ncache_enter(dir, key, hash, *ret, gen);
+	}
+	else if (result == ENOENT) {
+		ncache_enter(dir, key, hash, NULL, gen);
+	}
+	return result;
+}
+
+void
+ncache_purgename(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc, *next, *list = NULL;
+
+	lock_acquire(ncache_lock);
+	ncache_gen++;
+	for (nc = ncache_lruhead; nc != NULL; nc = next) {
+		next = nc->nc_lnext;
+		if (nc->nc_dir->vn_fs == dir->vn_fs &&
+		    ncache_hascomponent(nc->nc_path, name)) {
+			ncache_unlink(nc);
+			nc->nc_hnext = list;
+			list = nc;
+		}
+	}
+	lock_release(ncache_lock);
+
+	ncache_freelist(list);
+}
+
+void
+ncache_purgefs(struct fs *fs)
+{
+	struct ncentry *nc, *next, *list = NULL;
+
+	lock_acquire(ncache_lock);
+	ncache_gen++;
+	for (nc = ncache_lruhead; nc != NULL; nc = next) {
+		next = nc->nc_lnext;
+		if (nc->nc_dir->vn_fs == fs) {
+			ncache_unlink(nc);
+			nc->nc_hnext = list;
+			list = nc;
+		}
+	}
+	lock_release(ncache_lock);
+
+	ncache_freelist(list);
+}
@@ -0,0 +1,374 @@
+/*
+ * Pipes (see pipe.h).
+ *
+ * The ring is pp_buf, pp_len bytes of data starting at pp_head. It and
+ * everything else in the pipe are under pp_lock, a sleep lock, since
+ * the data is moved in and out with uiomove, which can fault. Readers
+ * wait on pp_readcv for data or for the writer to go; writers wait on
+ * pp_writecv for room or for the reader to go. Pollers of either end
+ * are on pp_pollq, woken along with both.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/poll.h>
+#include <stat.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <vm.h>
+#include <poll.h>
+#include <vnode.h>
+#include <pipe.h>
+
+#define PIPE_SIZE	PAGE_SIZE
+
+struct pipe {
+	struct vnode pp_reader;
+	struct vnode pp_writer;
+	struct lock *pp_lock;
+	struct cv *pp_readcv;		/* waiting for data */
+	struct cv *pp_writecv;		/* waiting for room */
+	struct pollq pp_pollq;		/* polling either end */
+	char *pp_buf;			/* PIPE_SIZE bytes */
+	unsigned pp_head;		/* offset of first byte of data */
+	unsigned pp_len;		/* bytes of data */
+	bool pp_readeropen;
+	bool pp_writeropen;
+};
+
+static const struct vnode_ops pipe_vnops;
+
+static
+void
+pipe_destroy(struct pipe *pp)
+{
+	kfree(pp->pp_buf);
+	pollq_cleanup(&pp->pp_pollq);
+	cv_destroy(pp->pp_writecv);
+	cv_destroy(pp->pp_readcv);
+	lock_destroy(pp->pp_lock);
+	kfree(pp);
+}
+
+////////////////////////////////////////////////////////////
+// vnode operations
+
+static
+int
+pipe_eachopen(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return 0;
+}
+
+/*
+ * Only the open file the end was made for has a reference, so this is
+ * always the last one. Whichever end goes second takes the pipe with
+ * it.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *pp = v->vn_data;
+	bool gone;
+
+	if (vnode_decref_unless_last(v)) {
+		return EBUSY;
+	}
+
+	lock_acquire(pp->pp_lock);
+	if (v == &pp->pp_reader) {
+		pp->pp_readeropen = false;
+		cv_broadcast(pp->pp_writecv, pp->pp_lock);
+	}
+	else {
+		pp->pp_writeropen = false;
+		cv_broadcast(pp->pp_readcv, pp->pp_lock);
+	}
+	pollq_wakeup(&pp->pp_pollq);
+	gone = !pp->pp_readeropen && !pp->pp_writeropen;
+	lock_release(pp->pp_lock);
+
+	vnode_cleanup(v);
+	if (gone) {
+		pipe_destroy(pp);
+	}
+	return 0;
+}
+
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	unsigned len;
+	int result = 0;
+
+	if (v != &pp->pp_reader) {
+		return EBADF;
+	}
+
+	lock_acquire(pp->pp_lock);
+	while (pp->pp_len == 0 && pp->pp_writeropen) {
+		cv_wait(pp->pp_readcv, pp->pp_lock);
+	}
+
+	/* at most two pieces: up to the end of the buffer, then from the start */
+	while (pp->pp_len > 0 && uio->uio_resid > 0) {
+		len = PIPE_SIZE - pp->pp_head;
+		if (len > pp->pp_len) {
+			len = pp->pp_len;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(pp->pp_buf + pp->pp_head, len, uio);
+		if (result) {
+			break;
+		}
+		pp->pp_head = (pp->pp_head + len) % PIPE_SIZE;
+		pp->pp_len -= len;
+	}
+	if (pp->pp_len == 0) {
+		/* keep the next write in one piece */
+		pp->pp_head = 0;
+	}
+
+	cv_broadcast(pp->pp_writecv, pp->pp_lock);
+	pollq_wakeup(&pp->pp_pollq);
+	lock_release(pp->pp_lock);
+	return result;
+}
+
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	unsigned tail, len;
+	int result = 0;
+
+	if (v != &pp->pp_writer) {
+		return EBADF;
+	}
+
+	lock_acquire(pp->pp_lock);
+	while (uio->uio_resid > 0) {
+		while (pp->pp_len == PIPE_SIZE && pp->pp_readeropen) {
+			cv_wait(pp->pp_writecv, pp->pp_lock);
+		}
+		if (!pp->pp_readeropen) {
+			result = EPIPE;
+			break;
+		}
+
+		tail = (pp->pp_head + pp->pp_len) % PIPE_SIZE;
+		len = (tail < pp->pp_head ? pp->pp_head : PIPE_SIZE) - tail;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(pp->pp_buf + tail, len, uio);
+		if (result) {
+			break;
+		}
+		pp->pp_len += len;
+		cv_broadcast(pp->pp_readcv, pp->pp_lock);
+		pollq_wakeup(&pp->pp_pollq);
+	}
+	lock_release(pp->pp_lock);
+	return result;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_stat(struct vnode *v, struct stat *st)
+{
+	struct pipe *pp = v->vn_data;
+
+	bzero(st, sizeof(*st));
+	st->st_mode = S_IFIFO | 0600;
+	st->st_nlink = 1;
+	lock_acquire(pp->pp_lock);
+	st->st_size = pp->pp_len;
+	lock_release(pp->pp_lock);
+	st->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+/*
+ * The reader is ready with data in the pipe, and also hung up once
+ * the writer is gone (reads then return 0 without waiting); the writer is ready with room,
+ * and gets POLLERR once the reader is gone (writes then fail).
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, struct pollset *ps)
+{
+	struct pipe *pp = v->vn_data;
+	int revents = 0;
+
+	poll_wait(ps, &pp->pp_pollq);
+
+	lock_acquire(pp->pp_lock);
+	if (v == &pp->pp_reader) {
+		if (pp->pp_len > 0 || !pp->pp_writeropen) {
+			revents |= events & POLLIN;
+		}
+		if (!pp->pp_writeropen) {
+			revents |= POLLHUP;
+		}
+	}
+	else {
+		if (!pp->pp_readeropen) {
+			revents |= POLLERR;
+		}
+		else if (pp->pp_len < PIPE_SIZE) {
+			revents |= events & POLLOUT;
+		}
+	}
+	lock_release(pp->pp_lock);
+	return revents;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static const struct vnode_ops pipe_vnops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = pipe_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentries = vopfail_uio_notdir,
+	.vop_write = pipe_write,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_fsync = pipe_fsync,
+	.vop_datasync = vnode_datasync_slow,
+	.vop_poll = pipe_poll,
+	.vop_seekhole = vnode_seekhole_none,
+	.vop_fallocate = vopfail_fallocate_nosys,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = vopfail_uio_inval,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+////////////////////////////////////////////////////////////
+// creation
+
+int
+pipe_create(struct vnode **reader, struct vnode **writer)
+{
+	struct pipe *pp;
+	int result = ENOMEM;
+
+	pp = kmalloc_tagged(sizeof(*pp), KM_VFS);
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+	pp->pp_buf = kmalloc_tagged(PIPE_SIZE, KM_VFS);
+	if (pp->pp_buf == NULL) {
+		kfree(pp);
+		return ENOMEM;
+	}
+	pp->pp_lock = lock_create("pipe");
+	if (pp->pp_lock == NULL) {
+		goto fail_buf;
+	}
+	pp->pp_readcv = cv_create("piperead");
+	if (pp->pp_readcv == NULL) {
+		goto fail_lock;
+	}
+	pp->pp_writecv = cv_create("pipewrite");
+	if (pp->pp_writecv == NULL) {
+		goto fail_readcv;
+	}
+	pollq_init(&pp->pp_pollq);
+	pp->pp_head = 0;
+	pp->pp_len = 0;
+	pp->pp_readeropen = true;
+	pp->pp_writeropen = true;
+
+	result = vnode_init(&pp->pp_reader, &pipe_vnops, NULL, pp);
+	if (result) {
+		goto fail_writecv;
+	}
+	result = vnode_init(&pp->pp_writer, &pipe_vnops, NULL, pp);
+	if (result) {
+		vnode_cleanup(&pp->pp_reader);
+		goto fail_writecv;
+	}
+
+	*reader = &pp->pp_reader;
+	*writer = &pp->pp_writer;
+	return 0;
+
+ fail_writecv:
+	pollq_cleanup(&pp->pp_pollq);
+	cv_destroy(pp->pp_writecv);
+ fail_readcv:
+	cv_destroy(pp->pp_readcv);
+ fail_lock:
+	lock_destroy(pp->pp_lock);
+ fail_buf:
+	kfree(pp->pp_buf);
+	kfree(pp);
+	return result;
+}
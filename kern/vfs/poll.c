@@ -0,0 +1,184 @@
+/*
+ * Wait queues for poll (see poll.h).
+ *
+ * Lock order: a queue's pq_lock, then a set's ps_lock. Sets that are
+ * asleep are also on poll_sleepers, under poll_lock (taken before
+ * ps_lock), so that poll_killproc can find a process's.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <proc.h>
+#include <current.h>
+#include <poll.h>
+
+static struct spinlock poll_lock = SPINLOCK_INITIALIZER;
+static struct pollset *poll_sleepers;
+
+////////////////////////////////////////////////////////////
+// queues
+
+void
+pollq_init(struct pollq *pq)
+{
+	spinlock_init(&pq->pq_lock);
+	pq->pq_first = NULL;
+}
+
+void
+pollq_cleanup(struct pollq *pq)
+{
+	KASSERT(pq->pq_first == NULL);
+	spinlock_cleanup(&pq->pq_lock);
+}
+
+void
+pollq_wakeup(struct pollq *pq)
+{
+	struct pollent *pe;
+	struct pollset *ps;
+
+	spinlock_acquire(&pq->pq_lock);
+	for (pe = pq->pq_first; pe != NULL; pe = pe->pe_next) {
+		ps = pe->pe_set;
+		spinlock_acquire(&ps->ps_lock);
+		ps->ps_woken = true;
+		wchan_wakeall(ps->ps_wchan, &ps->ps_lock);
+		spinlock_release(&ps->ps_lock);
+	}
+	spinlock_release(&pq->pq_lock);
+}
+
+////////////////////////////////////////////////////////////
+// sets
+
+int
+pollset_init(struct pollset *ps, unsigned max)
+{
+	ps->ps_wchan = wchan_create("poll");
+	if (ps->ps_wchan == NULL) {
+		return ENOMEM;
+	}
+	ps->ps_ents = NULL;
+	if (max > 0) {
+		ps->ps_ents = kmalloc_tagged(max * sizeof(ps->ps_ents[0]),
+					     KM_VFS);
+		if (ps->ps_ents == NULL) {
+			wchan_destroy(ps->ps_wchan);
+			return ENOMEM;
+		}
+	}
+	spinlock_init(&ps->ps_lock);
+	ps->ps_woken = false;
+	ps->ps_proc = curproc;
+	ps->ps_next = NULL;
+	ps->ps_nents = 0;
+	ps->ps_maxents = max;
+	return 0;
+}
+
+void
+pollset_cleanup(struct pollset *ps)
+{
+	struct pollent *pe;
+	struct pollq *pq;
+	unsigned i;
+
+	for (i = 0; i < ps->ps_nents; i++) {
+		pe = &ps->ps_ents[i];
+		pq = pe->pe_q;
+		spinlock_acquire(&pq->pq_lock);
+		*pe->pe_prevp = pe->pe_next;
+		if (pe->pe_next != NULL) {
+			pe->pe_next->pe_prevp = pe->pe_prevp;
+		}
+		spinlock_release(&pq->pq_lock);
+	}
+	kfree(ps->ps_ents);
+	spinlock_cleanup(&ps->ps_lock);
+	wchan_destroy(ps->ps_wchan);
+}
+
+void
+poll_wait(struct pollset *ps, struct pollq *pq)
+{
+	struct pollent *pe;
+
+	if (ps == NULL) {
+		return;
+	}
+	/* one entry per file, and no file has more than one queue */
+	KASSERT(ps->ps_nents < ps->ps_maxents);
+	pe = &ps->ps_ents[ps->ps_nents++];
+	pe->pe_set = ps;
+	pe->pe_q = pq;
+
+	spinlock_acquire(&pq->pq_lock);
+	pe->pe_next = pq->pq_first;
+	pe->pe_prevp = &pq->pq_first;
+	if (pe->pe_next != NULL) {
+		pe->pe_next->pe_prevp = &pe->pe_next;
+	}
+	pq->pq_first = pe;
+	spinlock_release(&pq->pq_lock);
+}
+
+/*
+ * Sleep, on the sleepers list so poll_killproc can find us.
+ */
+bool
+pollset_sleep(struct pollset *ps, unsigned ticks)
+{
+	struct pollset **psp;
+	bool timedout = false;
+
+	spinlock_acquire(&poll_lock);
+	ps->ps_next = poll_sleepers;
+	poll_sleepers = ps;
+	spinlock_release(&poll_lock);
+
+	spinlock_acquire(&ps->ps_lock);
+	if (!ps->ps_woken && !ps->ps_proc->p_thrkill) {
+		if (ticks == 0) {
+			wchan_sleep(ps->ps_wchan, &ps->ps_lock);
+		}
+		else {
+			timedout = wchan_timedsleep(ps->ps_wchan,
+						    &ps->ps_lock, ticks);
+		}
+	}
+	ps->ps_woken = false;
+	spinlock_release(&ps->ps_lock);
+
+	spinlock_acquire(&poll_lock);
+	for (psp = &poll_sleepers; *psp != ps; psp = &(*psp)->ps_next) {
+		KASSERT(*psp != NULL);
+	}
+	*psp = ps->ps_next;
+	spinlock_release(&poll_lock);
+
+	return timedout;
+}
+
+void
+poll_killproc(struct proc *p)
+{
+	struct pollset *ps;
+
+	KASSERT(p->p_thrkill);
+
+	spinlock_acquire(&poll_lock);
+	for (ps = poll_sleepers; ps != NULL; ps = ps->ps_next) {
+		if (ps->ps_proc != p) {
+			continue;
+		}
+		spinlock_acquire(&ps->ps_lock);
+		ps->ps_woken = true;
+		wchan_wakeall(ps->ps_wchan, &ps->ps_lock);
+		spinlock_release(&ps->ps_lock);
+	}
+	spinlock_release(&poll_lock);
+}
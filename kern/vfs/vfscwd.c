@@ -33,8 +33,10 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <limits.h>
 #include <stat.h>
 #include <lib.h>
+#include <atomic.h>
 #include <uio.h>
 #include <proc.h>
 #include <current.h>
@@ -42,6 +44,144 @@
 #include <fs.h>
 #include <vnode.h>
 
+/*
+ * The name of a process's current directory, as getcwd returns it,
+ * is kept on the process (p_cwdpath) so getcwd doesn't have to ask
+ * the file system every time. chdir sets it. A rename or rmdir could
+ * change it behind the process's back, and we don't know whose, so
+ * those bump vfs_cwdgen; a name from an older generation is computed
+ * again on the next getcwd. Only the process's own threads touch
+ * p_cwdpath, under p_lock.
+ */
+static volatile unsigned vfs_cwdgen;
+
+void
+vfs_forgetcwds(void)
+{
+	atomic_add(&vfs_cwdgen, 1);
+}
+
+/*
+ * Replace the current process's cached name with NAME (which may be
+ * NULL), from generation GEN, if the current directory is still DIR.
+ * Consumes NAME.
+ */
+static
+void
+cwd_setname(struct vnode *dir, char *name, unsigned gen)
+{
+	char *old;
+
+	spinlock_acquire(&curproc->p_lock);
+	if (curproc->p_cwd != dir) {
+		spinlock_release(&curproc->p_lock);
+		kfree(name);
+		return;
+	}
+	old = curproc->p_cwdpath;
+	curproc->p_cwdpath = name;
+	curproc->p_cwdgen = gen;
+	spinlock_release(&curproc->p_lock);
+
+	kfree(old);
+}
+
+/*
+ * Get a copy of the current process's cached name, if it has one
+ * that's still good. Can't allocate under p_lock, so find the length
+ * first and check nothing changed after.
+ */
+static
+char *
+cwd_getname(void)
+{
+	const char *name;
+	char *copy;
+	size_t len;
+	unsigned gen = vfs_cwdgen;
+
+	spinlock_acquire(&curproc->p_lock);
+	name = curproc->p_cwdpath;
+	if (name == NULL || curproc->p_cwdgen != gen) {
+		spinlock_release(&curproc->p_lock);
+		return NULL;
+	}
+	len = strlen(name);
+	spinlock_release(&curproc->p_lock);
+
+	copy = kmalloc_tagged(len + 1, KM_VFS);
+	if (copy == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&curproc->p_lock);
+	if (curproc->p_cwdpath != name || curproc->p_cwdgen != gen ||
+	    strlen(name) != len) {
+		spinlock_release(&curproc->p_lock);
+		kfree(copy);
+		return NULL;
+	}
+	strcpy(copy, name);
+	spinlock_release(&curproc->p_lock);
+
+	return copy;
+}
+
+/*
+ * Work out the name of directory DIR: the volume name, a colon, and
+ * VOP_NAMEFILE's path.
+ */
+static
+int
+cwd_makename(struct vnode *dir, char **ret)
+{
+	struct iovec iov;
+	struct uio ku;
+	const char *name;
+	char colon=':';
+	char *buf;
+	size_t len;
+	int result;
+
+	/* The current dir must be a directory, and thus it is not a device. */
+	KASSERT(dir->vn_fs != NULL);
+
+	name = FSOP_GETVOLNAME(dir->vn_fs);
+	if (name==NULL) {
+		name = vfs_getdevname(dir->vn_fs);
+	}
+	KASSERT(name != NULL);
+
+	buf = kmalloc_tagged(PATH_MAX+1, KM_VFS);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	uio_kinit(&iov, &ku, buf, PATH_MAX, 0, UIO_READ);
+
+	result = uiomove((char *)name, strlen(name), &ku);
+	if (result) {
+		goto fail;
+	}
+	result = uiomove(&colon, 1, &ku);
+	if (result) {
+		goto fail;
+	}
+	result = VOP_NAMEFILE(dir, &ku);
+	if (result) {
+		goto fail;
+	}
+
+	len = PATH_MAX - ku.uio_resid;
+	buf[len] = 0;
+	*ret = kstrdup(buf);
+	kfree(buf);
+	return *ret == NULL ? ENOMEM : 0;
+
+ fail:
+	kfree(buf);
+	return result;
+}
+
 /*
  * Get current directory as a vnode.
  */
@@ -71,6 +211,7 @@ int
 vfs_setcurdir(struct vnode *dir)
 {
 	struct vnode *old;
+	char *oldname;
 	mode_t vtype;
 	int result;
 
@@ -87,11 +228,14 @@ vfs_setcurdir(struct vnode *dir)
 	spinlock_acquire(&curproc->p_lock);
 	old = curproc->p_cwd;
 	curproc->p_cwd = dir;
+	oldname = curproc->p_cwdpath;
+	curproc->p_cwdpath = NULL;
 	spinlock_release(&curproc->p_lock);
 
 	if (old!=NULL) {
 		VOP_DECREF(old);
 	}
+	kfree(oldname);
 
 	return 0;
 }
@@ -103,27 +247,34 @@ int
 vfs_clearcurdir(void)
 {
 	struct vnode *old;
+	char *oldname;
 
 	spinlock_acquire(&curproc->p_lock);
 	old = curproc->p_cwd;
 	curproc->p_cwd = NULL;
+	oldname = curproc->p_cwdpath;
+	curproc->p_cwdpath = NULL;
 	spinlock_release(&curproc->p_lock);
 
 	if (old!=NULL) {
 		VOP_DECREF(old);
 	}
+	kfree(oldname);
 
 	return 0;
 }
 
 /*
  * Set current directory, as a pathname. Use vfs_lookup to translate
- * it to a vnode.
+ * it to a vnode. Work out its name for getcwd while we have it; if
+ * that fails, getcwd will try again (and report the error).
  */
 int
 vfs_chdir(char *path)
 {
 	struct vnode *vn;
+	char *name;
+	unsigned gen;
 	int result;
 
 	result = vfs_lookup(path, &vn);
@@ -131,53 +282,49 @@ vfs_chdir(char *path)
 		return result;
 	}
 	result = vfs_setcurdir(vn);
+	if (result == 0) {
+		gen = vfs_cwdgen;
+		if (cwd_makename(vn, &name) == 0) {
+			cwd_setname(vn, name, gen);
+		}
+	}
 	VOP_DECREF(vn);
 	return result;
 }
 
 /*
- * Get current directory, as a pathname.
- * Use VOP_NAMEFILE to get the pathname and FSOP_GETVOLNAME to get the
- * volume name.
+ * Get current directory, as a pathname: from the cached name if
+ * there's a good one, otherwise from VOP_NAMEFILE and
+ * FSOP_GETVOLNAME (and then cache that).
  */
 int
 vfs_getcwd(struct uio *uio)
 {
 	struct vnode *cwd;
+	char *name;
+	unsigned gen;
 	int result;
-	const char *name;
-	char colon=':';
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	result = vfs_getcurdir(&cwd);
-	if (result) {
+	name = cwd_getname();
+	if (name != NULL) {
+		result = uiomove(name, strlen(name), uio);
+		kfree(name);
 		return result;
 	}
 
-	/* The current dir must be a directory, and thus it is not a device. */
-	KASSERT(cwd->vn_fs != NULL);
-
-	name = FSOP_GETVOLNAME(cwd->vn_fs);
-	if (name==NULL) {
-		vfs_biglock_acquire();
-		name = vfs_getdevname(cwd->vn_fs);
-		vfs_biglock_release();
-	}
-	KASSERT(name != NULL);
-
-	result = uiomove((char *)name, strlen(name), uio);
-	if (result) {
-		goto out;
-	}
-	result = uiomove(&colon, 1, uio);
+	result = vfs_getcurdir(&cwd);
 	if (result) {
-		goto out;
+		return result;
 	}
 
-	result = VOP_NAMEFILE(cwd, uio);
-
- out:
+	gen = vfs_cwdgen;
+	result = cwd_makename(cwd, &name);
+	if (result == 0) {
+		result = uiomove(name, strlen(name), uio);
+		cwd_setname(cwd, name, gen);
+	}
 
 	VOP_DECREF(cwd);
 	return result;
@@ -0,0 +1,85 @@
+/*
+ * Helpers for vop_getdirentries (see vnode.h and <kern/dirent.h>).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/dirent.h>
+#include <limits.h>
+#include <lib.h>
+#include <uio.h>
+#include <vnode.h>
+
+/*
+ * Add one entry to the records going out through UIO. Returns ENOSPC,
+ * having moved nothing, if the whole record doesn't fit.
+ */
+int
+vnode_putdirent(struct uio *uio, uint32_t ino, mode_t type, const char *name)
+{
+	uint32_t rec[DIRENT_MAXRECLEN / sizeof(uint32_t)];
+	struct dirent *d = (struct dirent *)rec;
+	size_t namlen, reclen;
+
+	namlen = strlen(name);
+	if (namlen > NAME_MAX) {
+		return ENAMETOOLONG;
+	}
+	reclen = DIRENT_RECLEN(namlen);
+	if (reclen > uio->uio_resid) {
+		return ENOSPC;
+	}
+
+	/* (this also null-terminates the name and clears the padding) */
+	bzero(rec, reclen);
+	d->d_ino = ino;
+	d->d_reclen = reclen;
+	d->d_type = (type & _S_IFMT) >> 12;
+	d->d_namlen = namlen;
+	memcpy(d->d_name, name, namlen);
+
+	return uiomove(rec, reclen, uio);
+}
+
+/*
+ * vop_getdirentries for file systems that can only produce one name at
+ * a time: call VOP_GETDIRENTRY until the records stop fitting, with no
+ * inode numbers or types. The offset means what it does to
+ * VOP_GETDIRENTRY.
+ */
+int
+vnode_getdirentries_slow(struct vnode *dir, struct uio *uio)
+{
+	char name[NAME_MAX + 1];
+	struct iovec iov;
+	struct uio ku;
+	off_t pos;
+	int result;
+
+	pos = uio->uio_offset;
+	while (1) {
+		uio_kinit(&iov, &ku, name, sizeof(name) - 1, pos, UIO_READ);
+		result = VOP_GETDIRENTRY(dir, &ku);
+		if (result) {
+			return result;
+		}
+		if (ku.uio_resid == sizeof(name) - 1) {
+			/* EOF */
+			break;
+		}
+		name[sizeof(name) - 1 - ku.uio_resid] = 0;
+
+		result = vnode_putdirent(uio, 0, 0, name);
+		if (result == ENOSPC) {
+			/* leave it for next time */
+			break;
+		}
+		if (result) {
+			return result;
+		}
+		pos = ku.uio_offset;
+	}
+
+	uio->uio_offset = pos;
+	return 0;
+}
@@ -114,6 +114,29 @@ vopfail_truncate_isdir(struct vnode *vn, off_t pos)
 	return EISDIR;
 }
 
+////////////////////////////////////////////////////////////
+// fallocate
+
+int
+vopfail_fallocate_isdir(struct vnode *vn, int mode, off_t start, off_t len)
+{
+	(void)vn;
+	(void)mode;
+	(void)start;
+	(void)len;
+	return EISDIR;
+}
+
+int
+vopfail_fallocate_nosys(struct vnode *vn, int mode, off_t start, off_t len)
+{
+	(void)vn;
+	(void)mode;
+	(void)start;
+	(void)len;
+	return ENOSYS;
+}
+
 ////////////////////////////////////////////////////////////
 // creat
 
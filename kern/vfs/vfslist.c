@@ -43,6 +43,8 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <blkq.h>
+#include <namecache.h>
 
 /*
  * Structure for a single named device.
@@ -60,6 +62,10 @@
  * kd_fs      - Filesystem object mounted on, or associated with, this
  *              device. NULL if there is no filesystem.
  *
+ * kd_claimed - Set if the device has been given over to another
+ *              device that's built on it (vfs_claimdev), after which
+ *              it can't be mounted.
+ *
  * A filesystem can be associated with a device without having been
  * mounted if the device was created that way. In this case,
  * kd_rawname is NULL (prohibiting mount/unmount), and, as there is
@@ -80,6 +86,7 @@ struct knowndev {
 	struct device *kd_device;
 	struct vnode *kd_vnode;
 	struct fs *kd_fs;
+	bool kd_claimed;
 };
 
 DECLARRAY(knowndev, static __UNUSED inline);
@@ -87,7 +94,17 @@ DEFARRAY(knowndev, static __UNUSED inline);
 
 static struct knowndevarray *knowndevs;
 
-/* The big lock for all FS ops. Remove for filesystem assignment. */
+/*
+ * Lock for knowndevs and the knowndev structures. Looking up devices
+ * only reads it; adding devices and mounting/unmounting write it. It
+ * comes after vfs_biglock.
+ */
+static struct rwlock *knowndevs_lock;
+
+/*
+ * The big lock: for the VFS layer's own state (the boot filesystem,
+ * mounting) and for emufs. SFS does its own locking (see sfs.h).
+ */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
 
@@ -109,9 +126,15 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	knowndevs_lock = rwlock_create("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
 	
+	ncache_bootstrap();
 	devnull_create();
 	semfs_bootstrap();
+	statsfs_bootstrap();
 }
 
 /*
@@ -157,6 +180,7 @@ vfs_sync(void)
 	unsigned i, num;
 
 	vfs_biglock_acquire();
+	rwlock_acquire_read(knowndevs_lock);
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -166,11 +190,35 @@ vfs_sync(void)
 		}
 	}
 
+	rwlock_release_read(knowndevs_lock);
 	vfs_biglock_release();
 
 	return 0;
 }
 
+/*
+ * Print the I/O counters of each device that has a request queue,
+ * under its name, for stats:disk; as blkq_format.
+ */
+size_t
+vfs_devstats(char *buf, size_t len, size_t pos)
+{
+	struct knowndev *dev;
+	unsigned i, num;
+
+	rwlock_acquire_read(knowndevs_lock);
+	num = knowndevarray_num(knowndevs);
+	for (i=0; i<num; i++) {
+		dev = knowndevarray_get(knowndevs, i);
+		if (dev->kd_device != NULL && dev->kd_device->d_queue != NULL) {
+			pos = blkq_format(dev->kd_device->d_queue,
+					  dev->kd_name, buf, len, pos);
+		}
+	}
+	rwlock_release_read(knowndevs_lock);
+	return pos;
+}
+
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.
@@ -183,6 +231,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 
 	KASSERT(vfs_biglock_do_i_hold());
 
+	rwlock_acquire_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -203,12 +252,14 @@ vfs_getroot(const char *devname, struct vnode **result)
 			if (!strcmp(kd->kd_name, devname) ||
 			    (volname!=NULL && !strcmp(volname, devname))) {
 				*result = FSOP_GETROOT(kd->kd_fs);
+				rwlock_release_read(knowndevs_lock);
 				return 0;
 			}
 		}
 		else {
 			if (kd->kd_rawname!=NULL &&
 			    !strcmp(kd->kd_name, devname)) {
+				rwlock_release_read(knowndevs_lock);
 				return ENXIO;
 			}
 		}
@@ -224,6 +275,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
 			*result = kd->kd_vnode;
+			rwlock_release_read(knowndevs_lock);
 			return 0;
 		}
 
@@ -235,6 +287,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
 			*result = kd->kd_vnode;
+			rwlock_release_read(knowndevs_lock);
 			return 0;
 		}
 
@@ -249,6 +302,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 	 * If we got here, the device specified by devname doesn't exist.
 	 */
 
+	rwlock_release_read(knowndevs_lock);
 	return ENODEV;
 }
 
@@ -263,8 +317,7 @@ vfs_getdevname(struct fs *fs)
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
-
+	rwlock_acquire_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -276,10 +329,12 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
+			rwlock_release_read(knowndevs_lock);
 			return kd->kd_name;
 		}
 	}
 
+	rwlock_release_read(knowndevs_lock);
 	return NULL;
 }
 
@@ -290,7 +345,7 @@ static
 char *
 mkrawname(const char *name)
 {
-	char *s = kmalloc(strlen(name)+3+1);
+	char *s = kmalloc_tagged(strlen(name)+3+1, KM_VFS);
 	if (!s) {
 		return NULL;
 	}
@@ -340,7 +395,7 @@ badnames(const char *n1, const char *n2, const char *n3)
 	unsigned i, num;
 	struct knowndev *kd;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(rwlock_do_i_hold_write(knowndevs_lock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -398,7 +453,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		goto nomem;
 	}
 
-	kd = kmalloc(sizeof(struct knowndev));
+	kd = kmalloc_tagged(sizeof(struct knowndev), KM_VFS);
 	if (kd==NULL) {
 		goto nomem;
 	}
@@ -408,17 +463,21 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	kd->kd_device = dev;
 	kd->kd_vnode = vnode;
 	kd->kd_fs = fs;
+	kd->kd_claimed = false;
 
 	if (fs!=NULL) {
 		volname = FSOP_GETVOLNAME(fs);
 	}
 
+	rwlock_acquire_write(knowndevs_lock);
 	if (badnames(name, rawname, volname)) {
+		rwlock_release_write(knowndevs_lock);
 		vfs_biglock_release();
 		return EEXIST;
 	}
 
 	result = knowndevarray_add(knowndevs, kd, &index);
+	rwlock_release_write(knowndevs_lock);
 
 	if (result == 0 && dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
@@ -482,7 +541,7 @@ findmount(const char *devname, struct knowndev **result)
 	unsigned i, num;
 	bool found = false;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(rwlock_do_i_hold_write(knowndevs_lock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; !found && i<num; i++) {
@@ -517,14 +576,17 @@ vfs_mount(const char *devname, void *data,
 	int result;
 
 	vfs_biglock_acquire();
+	rwlock_acquire_write(knowndevs_lock);
 
 	result = findmount(devname, &kd);
 	if (result) {
+		rwlock_release_write(knowndevs_lock);
 		vfs_biglock_release();
 		return result;
 	}
 
-	if (kd->kd_fs != NULL) {
+	if (kd->kd_fs != NULL || kd->kd_claimed) {
+		rwlock_release_write(knowndevs_lock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
@@ -533,6 +595,7 @@ vfs_mount(const char *devname, void *data,
 
 	result = mountfunc(data, kd->kd_device, &fs);
 	if (result) {
+		rwlock_release_write(knowndevs_lock);
 		vfs_biglock_release();
 		return result;
 	}
@@ -545,10 +608,62 @@ vfs_mount(const char *devname, void *data,
 	kprintf("vfs: Mounted %s: on %s\n",
 		volname ? volname : kd->kd_name, kd->kd_name);
 
+	rwlock_release_write(knowndevs_lock);
 	vfs_biglock_release();
 	return 0;
 }
 
+/*
+ * Hand over the mountable device DEVNAME, which mustn't have anything
+ * mounted on it, to a device being built out of it; it can't be
+ * mounted after this.
+ */
+int
+vfs_claimdev(const char *devname, struct device **ret)
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+	rwlock_acquire_write(knowndevs_lock);
+
+	result = findmount(devname, &kd);
+	if (result == 0 && (kd->kd_fs != NULL || kd->kd_claimed)) {
+		result = EBUSY;
+	}
+	if (result == 0) {
+		KASSERT(kd->kd_device != NULL);
+		kd->kd_claimed = true;
+		*ret = kd->kd_device;
+	}
+
+	rwlock_release_write(knowndevs_lock);
+	vfs_biglock_release();
+	return result;
+}
+
+/*
+ * Give back a device claimed with vfs_claimdev, when what was being
+ * built on it didn't get made after all.
+ */
+void
+vfs_unclaimdev(const char *devname)
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+	rwlock_acquire_write(knowndevs_lock);
+
+	result = findmount(devname, &kd);
+	KASSERT(result == 0);
+	KASSERT(kd->kd_claimed);
+	kd->kd_claimed = false;
+
+	rwlock_release_write(knowndevs_lock);
+	vfs_biglock_release();
+}
+
 /*
  * Unmount a filesystem/device by name.
  * First calls FSOP_SYNC on the filesystem; then calls FSOP_UNMOUNT.
@@ -560,6 +675,7 @@ vfs_unmount(const char *devname)
 	int result;
 
 	vfs_biglock_acquire();
+	rwlock_acquire_write(knowndevs_lock);
 
 	result = findmount(devname, &kd);
 	if (result) {
@@ -573,7 +689,8 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
-	/* sync the fs */
+	/* drop the name cache's references, then sync the fs */
+	ncache_purgefs(kd->kd_fs);
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto fail;
@@ -592,6 +709,7 @@ vfs_unmount(const char *devname)
 	KASSERT(result==0);
 
  fail:
+	rwlock_release_write(knowndevs_lock);
 	vfs_biglock_release();
 	return result;
 }
@@ -607,6 +725,7 @@ vfs_unmountall(void)
 	int result;
 
 	vfs_biglock_acquire();
+	rwlock_acquire_write(knowndevs_lock);
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -622,6 +741,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		ncache_purgefs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -657,6 +778,7 @@ vfs_unmountall(void)
 		dev->kd_fs = NULL;
 	}
 
+	rwlock_release_write(knowndevs_lock);
 	vfs_biglock_release();
 
 	return 0;
@@ -39,6 +39,7 @@
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include <namecache.h>
 
 static struct vnode *bootfs_vnode = NULL;
 
@@ -122,12 +123,14 @@ vfs_clearbootfs(void)
 
 /*
  * Common code to pull the device name, if any, off the front of a
- * path and choose the vnode to begin the name lookup relative to.
+ * path and choose the vnode to begin the name lookup relative to:
+ * DIR for a relative path, or the current directory if DIR is NULL.
  */
 
 static
 int
-getdevice(char *path, char **subpath, struct vnode **startvn)
+getdevice(struct vnode *dir, char *path, char **subpath,
+	  struct vnode **startvn)
 {
 	int slash=-1, colon=-1, i;
 	struct vnode *vn;
@@ -159,6 +162,11 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 		 * use the whole thing as the subpath.
 		 */
 		*subpath = path;
+		if (dir != NULL) {
+			VOP_INCREF(dir);
+			*startvn = dir;
+			return 0;
+		}
 		return vfs_getcurdir(startvn);
 	}
 
@@ -226,20 +234,29 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
+ *
+ * Lookups go through the name cache (namecache.c). So that the
+ * directory part of a lookparent can be found there too, a path with
+ * a directory part is split here: the directory is looked up, and
+ * the file system's lookparent only sees the last name.
  */
 
 int
-vfs_lookparent(char *path, struct vnode **retval,
-	       char *buf, size_t buflen)
+vfs_lookparentat(struct vnode *dir, char *path, struct vnode **retval,
+		 char *buf, size_t buflen)
 {
-	struct vnode *startvn;
+	struct vnode *startvn, *subdir;
+	char *s;
 	int result;
 
+	/*
+	 * The big lock covers bootfs_vnode, which getdevice may start
+	 * from; the file system does its own locking for the lookup.
+	 */
 	vfs_biglock_acquire();
-
-	result = getdevice(path, &path, &startvn);
+	result = getdevice(dir, path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -251,39 +268,59 @@ vfs_lookparent(char *path, struct vnode **retval,
 		 */
 		result = EINVAL;
 	}
-	else {
+	else if ((s = strrchr(path, '/')) == NULL || s[1] == 0) {
+		/* no directory part (or a trailing slash); leave it be */
 		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
 	}
+	else {
+		*s = 0;
+		result = ncache_lookup(startvn, path, &subdir);
+		if (result == 0) {
+			result = VOP_LOOKPARENT(subdir, s+1, retval,
+						buf, buflen);
+			VOP_DECREF(subdir);
+		}
+	}
 
 	VOP_DECREF(startvn);
 
-	vfs_biglock_release();
 	return result;
 }
 
 int
-vfs_lookup(char *path, struct vnode **retval)
+vfs_lookupat(struct vnode *dir, char *path, struct vnode **retval)
 {
 	struct vnode *startvn;
 	int result;
 
+	/* (see vfs_lookparentat) */
 	vfs_biglock_acquire();
-
-	result = getdevice(path, &path, &startvn);
+	result = getdevice(dir, path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (strlen(path)==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
+	result = ncache_lookup(startvn, path, retval);
 
 	VOP_DECREF(startvn);
-	vfs_biglock_release();
 	return result;
 }
+
+int
+vfs_lookparent(char *path, struct vnode **retval,
+	       char *buf, size_t buflen)
+{
+	return vfs_lookparentat(NULL, path, retval, buf, buflen);
+}
+
+int
+vfs_lookup(char *path, struct vnode **retval)
+{
+	return vfs_lookupat(NULL, path, retval);
+}
@@ -38,11 +38,13 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <namecache.h>
 
 
-/* Does most of the work for open(). */
+/* Does most of the work for open() and openat(). */
 int
-vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
+vfs_openat(struct vnode *startdir, char *path, int openflags, mode_t mode,
+	   struct vnode **ret)
 {
 	int how;
 	int result;
@@ -68,17 +70,19 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		struct vnode *dir;
 		int excl = (openflags & O_EXCL)!=0;
 
-		result = vfs_lookparent(path, &dir, name, sizeof(name));
+		result = vfs_lookparentat(startdir, path, &dir,
+					  name, sizeof(name));
 		if (result) {
 			return result;
 		}
 
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		ncache_purgename(dir, name);
 
 		VOP_DECREF(dir);
 	}
 	else {
-		result = vfs_lookup(path, &vn);
+		result = vfs_lookupat(startdir, path, &vn);
 	}
 
 	if (result) {
@@ -111,6 +115,12 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 	return 0;
 }
 
+int
+vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
+{
+	return vfs_openat(NULL, path, openflags, mode, ret);
+}
+
 /* Does most of the work for close(). */
 void
 vfs_close(struct vnode *vn)
@@ -132,25 +142,32 @@ vfs_close(struct vnode *vn)
 	VOP_DECREF(vn);
 }
 
-/* Does most of the work for remove(). */
+/* Does most of the work for remove() and unlinkat(). */
 int
-vfs_remove(char *path)
+vfs_removeat(struct vnode *startdir, char *path)
 {
 	struct vnode *dir;
 	char name[NAME_MAX+1];
 	int result;
 
-	result = vfs_lookparent(path, &dir, name, sizeof(name));
+	result = vfs_lookparentat(startdir, path, &dir, name, sizeof(name));
 	if (result) {
 		return result;
 	}
 
 	result = VOP_REMOVE(dir, name);
+	ncache_purgename(dir, name);
 	VOP_DECREF(dir);
 
 	return result;
 }
 
+int
+vfs_remove(char *path)
+{
+	return vfs_removeat(NULL, path);
+}
+
 /* Does most of the work for rename(). */
 int
 vfs_rename(char *oldpath, char *newpath)
@@ -179,6 +196,9 @@ vfs_rename(char *oldpath, char *newpath)
 	}
 
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	/* a directory may have moved; forget the whole file system */
+	ncache_purgefs(olddir->vn_fs);
+	vfs_forgetcwds();
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -213,6 +233,7 @@ vfs_link(char *oldpath, char *newpath)
 	}
 
 	result = VOP_LINK(newdir, newname, oldfile);
+	ncache_purgename(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -240,6 +261,7 @@ vfs_symlink(const char *contents, char *path)
 	}
 
 	result = VOP_SYMLINK(newdir, newname, contents);
+	ncache_purgename(newdir, newname);
 	VOP_DECREF(newdir);
 
 	return result;
@@ -271,46 +293,66 @@ vfs_readlink(char *path, struct uio *uio)
 }
 
 /*
- * Does most of the work for mkdir.
+ * Does most of the work for mkdir and mkdirat.
  */
 int
-vfs_mkdir(char *path, mode_t mode)
+vfs_mkdirat(struct vnode *startdir, char *path, mode_t mode)
 {
 	struct vnode *parent;
 	char name[NAME_MAX+1];
 	int result;
 
-	result = vfs_lookparent(path, &parent, name, sizeof(name));
+	result = vfs_lookparentat(startdir, path, &parent,
+				  name, sizeof(name));
 	if (result) {
 		return result;
 	}
 
 	result = VOP_MKDIR(parent, name, mode);
+	ncache_purgename(parent, name);
 
 	VOP_DECREF(parent);
 
 	return result;
 }
 
+int
+vfs_mkdir(char *path, mode_t mode)
+{
+	return vfs_mkdirat(NULL, path, mode);
+}
+
 /*
- * Does most of the work for rmdir.
+ * Does most of the work for rmdir and unlinkat(AT_REMOVEDIR).
  */
 int
-vfs_rmdir(char *path)
+vfs_rmdirat(struct vnode *startdir, char *path)
 {
 	struct vnode *parent;
 	char name[NAME_MAX+1];
 	int result;
 
-	result = vfs_lookparent(path, &parent, name, sizeof(name));
+	result = vfs_lookparentat(startdir, path, &parent,
+				  name, sizeof(name));
 	if (result) {
 		return result;
 	}
 
 	result = VOP_RMDIR(parent, name);
+	/* entries may start from the directory itself */
+	if (parent->vn_fs != NULL) {
+		ncache_purgefs(parent->vn_fs);
+	}
+	vfs_forgetcwds();
 
 	VOP_DECREF(parent);
 
 	return result;
 }
 
+int
+vfs_rmdir(char *path)
+{
+	return vfs_rmdirat(NULL, path);
+}
+
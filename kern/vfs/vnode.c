@@ -32,7 +32,10 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/poll.h>
+#include <stat.h>
 #include <lib.h>
+#include <atomic.h>
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
@@ -49,9 +52,11 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 
 	vn->vn_ops = ops;
 	vn->vn_refcount = 1;
-	spinlock_init(&vn->vn_countlock);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
+	vn->vn_text = NULL;
+	vn->vn_textgen = 0;
+	vn->vn_elf = NULL;
 	return 0;
 }
 
@@ -63,7 +68,8 @@ vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
 
-	spinlock_cleanup(&vn->vn_countlock);
+	textcache_purge(vn);
+	loadelf_purge(vn);
 
 	vn->vn_ops = NULL;
 	vn->vn_refcount = 0;
@@ -81,9 +87,27 @@ vnode_incref(struct vnode *vn)
 {
 	KASSERT(vn != NULL);
 
-	spinlock_acquire(&vn->vn_countlock);
-	vn->vn_refcount++;
-	spinlock_release(&vn->vn_countlock);
+	atomic_add(&vn->vn_refcount, 1);
+}
+
+/*
+ * Decrement refcount, unless this is the last reference.
+ */
+bool
+vnode_decref_unless_last(struct vnode *vn)
+{
+	unsigned count;
+
+	KASSERT(vn != NULL);
+
+	do {
+		count = vn->vn_refcount;
+		KASSERT(count > 0);
+		if (count == 1) {
+			return false;
+		}
+	} while (!atomic_cas(&vn->vn_refcount, count, count - 1));
+	return true;
 }
 
 /*
@@ -94,25 +118,10 @@ vnode_incref(struct vnode *vn)
 void
 vnode_decref(struct vnode *vn)
 {
-	bool destroy;
 	int result;
 
-	KASSERT(vn != NULL);
-
-	spinlock_acquire(&vn->vn_countlock);
-
-	KASSERT(vn->vn_refcount > 0);
-	if (vn->vn_refcount > 1) {
-		vn->vn_refcount--;
-		destroy = false;
-	}
-	else {
-		/* Don't decrement; pass the reference to VOP_RECLAIM. */
-		destroy = true;
-	}
-	spinlock_release(&vn->vn_countlock);
-
-	if (destroy) {
+	/* If it's the last one, don't decrement; pass it to VOP_RECLAIM. */
+	if (!vnode_decref_unless_last(vn)) {
 		result = VOP_RECLAIM(vn);
 		if (result != 0 && result != EBUSY) {
 			// XXX: lame.
@@ -122,6 +131,48 @@ vnode_decref(struct vnode *vn)
 	}
 }
 
+/*
+ * Generic vop_datasync: sync the whole file, inode and all.
+ */
+int
+vnode_datasync_slow(struct vnode *file, off_t start, off_t len)
+{
+	(void)start;
+	(void)len;
+	return VOP_FSYNC(file);
+}
+
+/*
+ * Generic vop_poll: never any waiting.
+ */
+int
+vnode_poll_always(struct vnode *object, int events, struct pollset *ps)
+{
+	(void)object;
+	(void)ps;
+	return events & (POLLIN | POLLOUT);
+}
+
+/*
+ * Generic vop_seekhole: data up to the size, and the hole after.
+ */
+int
+vnode_seekhole_none(struct vnode *file, off_t pos, bool hole, off_t *ret)
+{
+	struct stat st;
+	int result;
+
+	result = VOP_STAT(file, &st);
+	if (result) {
+		return result;
+	}
+	if (pos < 0 || pos >= st.st_size) {
+		return ENXIO;
+	}
+	*ret = hole ? st.st_size : pos;
+	return 0;
+}
+
 /*
  * Check for various things being valid.
  * Called before all VOP_* calls.
@@ -129,7 +180,7 @@ vnode_decref(struct vnode *vn)
 void
 vnode_check(struct vnode *v, const char *opstr)
 {
-	vfs_biglock_acquire();
+	unsigned count;
 
 	if (v == NULL) {
 		panic("vnode_check: vop_%s: null vnode\n", opstr);
@@ -158,20 +209,17 @@ vnode_check(struct vnode *v, const char *opstr)
 		panic("vnode_check: vop_%s: deadbeef fs pointer\n", opstr);
 	}
 
-	spinlock_acquire(&v->vn_countlock);
-
-	if (v->vn_refcount < 0) {
+	/* read it once; it's unsigned, so a negative count shows up huge */
+	count = v->vn_refcount;
+	if ((int)count < 0) {
 		panic("vnode_check: vop_%s: negative refcount %d\n", opstr,
-		      v->vn_refcount);
+		      (int)count);
 	}
-	else if (v->vn_refcount == 0) {
+	else if (count == 0) {
 		panic("vnode_check: vop_%s: zero refcount\n", opstr);
 	}
-	else if (v->vn_refcount > 0x100000) {
-		kprintf("vnode_check: vop_%s: warning: large refcount %d\n",
-			opstr, v->vn_refcount);
+	else if (count > 0x100000) {
+		kprintf("vnode_check: vop_%s: warning: large refcount %u\n",
+			opstr, count);
 	}
-
-	spinlock_release(&v->vn_countlock);
-	vfs_biglock_release();
 }
@@ -36,8 +36,24 @@
 #include <current.h>
 #include <current.h>
 #include <coremap.h>  
+#include <swap.h>
+#include <shm.h>
 #include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <workqueue.h>
+#include <cpu.h>
 #include <mips/tlb.h>
+#include <vnode.h>
+#include <uio.h>
+#include <copyinout.h>
+#include <kern/mman.h>
+#include <kmem_cache.h>
+#include <synch.h>
+#include <atomic.h>
+#include <epoch.h>
+#include <stats.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -46,34 +62,217 @@
  */
 
  /* We use:
- *   - A linked list of regions to describe the layout and permissions
- *     of the process's virtual memory (code, data, heap, etc.).
+ *   - A sorted array of regions to describe the layout and permissions
+ *     of the process's virtual memory (code, data, etc.).
  *   - A 2-level page table to map virtual pages to physical frames:
  *       L1 index = bits [31:22]
  *       L2 index = bits [21:12]
  *
  * The TLB is used as a cache of these mappings; on a TLB miss,
  * vm_fault() looks up the mapping in this 2-level page table.
+ *
+ * TLB entries are tagged with the as's ASID so they survive context
+ * switches. ASIDs are handed out in order from a global counter; when
+ * they run out we start a new generation, which makes every as get a
+ * new ASID on its next as_activate, and each cpu flushes its TLB once
+ * the first time it activates something in the new generation. ASID 0
+ * is never handed out (the invalid entries written by flushes use it).
+ */
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static uint32_t asid_generation = 1;
+static uint32_t asid_next = 1;
+
+static int region_writeback(struct addrspace *as, struct region *r, bool unlock);
+
+/*
+ * Page table pages. A level 1 table (PT_L1_SIZE pointers) and a level 2 table (PT_L2_SIZE entries) are each
+ * exactly one page, so they come zero filled straight from the coremap rather than through kmalloc.
+ */
+static
+void *
+pt_alloc(void)
+{
+	COMPILE_ASSERT(PT_L1_SIZE * sizeof(paddr_t *) == PAGE_SIZE);
+	COMPILE_ASSERT(PT_L2_SIZE * sizeof(paddr_t) == PAGE_SIZE);
+
+	paddr_t pa = alloc_user_page(true);
+	return pa == 0 ? NULL : (void *)PADDR_TO_KVADDR(pa);
+}
+
+static
+void
+pt_free(void *table)
+{
+	free_page((vaddr_t)table - MIPS_KSEG0);
+}
+
+/*
+ * Give back a table that was part of a page table, once it is unlinked. The UTLB refill handler (exception-mips1.S)
+ * walks the tables of whatever address space each cpu runs without taking any lock, so another cpu may be reading
+ * this one right now, and it mustn't be reused under it. The handler runs with interrupts off, so a cpu can't pass
+ * a quiescent state in the middle of a walk: after an epoch grace period (see epoch.h) every walk that could have
+ * found the table is over. The wait is done by the epoch work item, not by us.
+ */
+struct pt_deferred {
+	struct epoch_item pd_item;
+	void *pd_table;
+};
+
+static
+void
+pt_dofree(void *arg)
+{
+	struct pt_deferred *pd = arg;
+
+	pt_free(pd->pd_table);
+	kfree(pd);
+}
+
+static
+void
+pt_free_later(void *table)
+{
+	struct pt_deferred *pd = kmalloc_tagged(sizeof(*pd), KM_VM);
+	if (pd == NULL){
+		/* do it the slow way */
+		epoch_synchronize();
+		pt_free(table);
+		return;
+	}
+	pd->pd_table = table;
+	epoch_defer(&pd->pd_item, pt_dofree, pd);
+}
+
+/*
+ * Level 2 tables are shared between parent and child after fork (see as_copy): the table's frame has a reference
+ * for each address space using it, and while it has more than one nobody may change an entry in it. Anything about
+ * to do so gets the table through as_l2table with create, which first gives this address space a copy of its own
+ * (pt_unshare). Entries of the copy share their frames copy-on-write, the same as fork used to do for every entry.
+ * pt_drop lets go of a table, shared or not; the caller must have unlinked it from as->pt_l1 already.
+ */
+/*
+ * Get rid of every TLB entry of as. Rather than shooting them all down, give it a fresh ASID: the old entries can
+ * never match again (the ASID isn't reused before the next generation, which flushes). Other threads of as may be
+ * running on other cpus under the old ASID right now, so that isn't enough there: flush their TLBs.
+ */
+static
+void
+as_tlbflush(struct addrspace *as)
+{
+	spinlock_acquire(&asid_lock);
+	as->as_asid_gen = 0;
+	spinlock_release(&asid_lock);
+	if (as == proc_getas()){
+		as_activate();
+	}
+	ipi_tlbshootdown_cpus(as->as_cpus, NULL, TLBSHOOTDOWN_MAX + 1);
+}
+
+static
+void
+pt_drop(struct addrspace *as, paddr_t *l2)
+{
+	if (pte_table_release(l2, as)) {
+		/* the whole table at once, with one coremap lock hold (it waits out the pager if it is writing a page) */
+		pte_free_vec(l2, PT_L2_SIZE);
+		pt_free_later(l2);
+	}
+}
+
+static
+paddr_t *
+pt_unshare(struct addrspace *as, unsigned l1)
+{
+	paddr_t *old_l2 = as->pt_l1[l1];
+	paddr_t *new_l2 = pt_alloc();
+	if (new_l2 == NULL) {
+		return NULL;
+	}
+
+	for (unsigned j = 0; j < PT_L2_SIZE; j++) {
+		paddr_t old_paddr = pte_share(&old_l2[j]);
+		if (!PTE_IS_SWAPPED(old_paddr)) {
+			new_l2[j] = old_paddr;
+			continue;
+		}
+
+		/* swap slots can't be shared, so this one stays with the table and we get our own copy in memory */
+		paddr_t pa = alloc_user_page(false);
+		int result = pa == 0 ? ENOMEM : swap_in(PTE_SWAPSLOT(old_paddr), pa);
+		if (result) {
+			if (pa != 0) {
+				free_page(pa);
+			}
+			/* the shared table stays ours, the copy goes with the references it took so far */
+			pte_free_vec(new_l2, j);
+			pt_free(new_l2);
+			return NULL;
+		}
+		new_l2[j] = pa;
+		as->as_stats.vs_resident++;
+		as->as_stats.vs_pageins++;
+		STAT_INC(STAT_VM_PAGEINS);
+		page_setowner(pa, as, ((vaddr_t)l1 << PT_L1_SHIFT) | ((vaddr_t)j << PT_L2_SHIFT));
+	}
+
+	as->pt_l1[l1] = new_l2;
+	pt_drop(as, old_l2);
+	return new_l2;
+}
+
+/* addrspace structs come from a cache, fork and exec make and drop one per process. They are cached with their lock */
+static
+int
+as_ctor(void *obj)
+{
+	struct addrspace *as = obj;
+
+	as->as_lock = lock_create("as_lock");
+	if (as->as_lock == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+as_dtor(void *obj)
+{
+	struct addrspace *as = obj;
+
+	lock_destroy(as->as_lock);
+}
+
+static struct kmem_cache as_cache = KMEM_CACHE_INITIALIZER("addrspace", struct addrspace, as_ctor, as_dtor, KM_VM);
+
+/*
+ * Address spaces of exited processes are torn down later, by a work item, so _exit doesn't have to wait for
+ * thousands of pages to be freed. Pending ones are chained through as_reapnext.
  */
+static struct spinlock reaper_lock = SPINLOCK_INITIALIZER;
+static struct work reaper_work;
+static struct addrspace *reaper_list = NULL;
+
 struct addrspace *
 as_create(void)
 {
 	struct addrspace *as;
 
-	as = kmalloc(sizeof(struct addrspace));
+	as = kmem_cache_alloc(&as_cache);
 	if (as == NULL) {
 		return NULL;
 	}
 
 	/* no regions yet */
 	as->regions = NULL; 
+	as->nregions = 0;
+	as->maxregions = 0;
+	as->last_region = 0;
 
 	/*
-	 * Initialize page table
+	 * Initialize page table (allocated by the first fault)
 	 */
-	for (int i = 0; i < PT_L1_SIZE; i++){
-		as->pt_l1[i] = NULL; 
-	}
+	as->pt_l1 = NULL;
 
 	/* Initialize heap bounds (initially empty) */
 	as->heap_base = 0; 
@@ -85,6 +284,15 @@ as_create(void)
 
 	/* not currently loading from an elf */
 	as->loading = false; 
+	as->mmap_low = MMAP_TOP; 
+
+	/* hasn't run anywhere yet, gets an ASID on first activation */
+	as->as_cpus = 0;
+	as->as_asid = 0;
+	as->as_asid_gen = 0;
+	as->as_reapnext = NULL;
+	as->as_cownext = 0;
+	bzero(&as->as_stats, sizeof(as->as_stats));
 	return as;
 }
 
@@ -94,11 +302,14 @@ as_create(void)
 /*
  * as_copy:
  * Copy an address space.
- *  - Deep-copy regions (linked list)
- *  - Deep-copy page table: allocate new frames and copy contents
+ *  - Copy regions (one sorted array)
+ *  - Share the level 2 page tables: the child uses the parent's, read only (see pt_unshare), so fork costs one
+ *    reference per table rather than one per page. The first change to an entry on either side copies that
+ *    table, and the frames in it are shared copy-on-write from then on until vm_fault gives the writer its own.
  */
+static
 int
-as_copy(struct addrspace *old, struct addrspace **ret)
+as_copy_locked(struct addrspace *old, struct addrspace **ret)
 {
     struct addrspace *newas;
 
@@ -108,37 +319,26 @@ as_copy(struct addrspace *old, struct addrspace **ret)
         return ENOMEM;
     }
 
-    /* 2. Deep-copy the region list from old->regions to newas->regions */
-    newas->regions = NULL;
-    struct region *oldr = old->regions;
-    struct region *prev_new = NULL;
-
-
-    while (oldr != NULL) {
-
-        /* Allocate a new region node */
-        struct region *newr = kmalloc(sizeof(struct region));
-        if (newr == NULL) {
+    /* 2. Copy the region array */
+    if (old->nregions > 0) {
+        newas->regions = kmalloc_tagged(old->nregions * sizeof(struct region), KM_VM);
+        if (newas->regions == NULL) {
             as_destroy(newas);
             return ENOMEM;
         }
+        memcpy(newas->regions, old->regions, old->nregions * sizeof(struct region));
+        newas->nregions = old->nregions;
+        newas->maxregions = old->nregions;
 
-        /* Copy region fields */
-        newr->vbase      = oldr->vbase;
-        newr->npages     = oldr->npages;
-        newr->readable   = oldr->readable;
-        newr->writeable  = oldr->writeable;
-        newr->executable = oldr->executable;
-        newr->next       = NULL;
-
-        /* Append to new list */
-        if (prev_new == NULL) {
-            newas->regions = newr;      /* first region in list */
-        } else {
-            prev_new->next = newr;
+        /* the child's regions hold their own vnode and shared memory segment references */
+        for (unsigned k = 0; k < newas->nregions; k++) {
+            if (newas->regions[k].vn != NULL) {
+                VOP_INCREF(newas->regions[k].vn);
+            }
+            if (newas->regions[k].shm != NULL) {
+                shm_incref(newas->regions[k].shm);
+            }
         }
-        prev_new = newr;
-        oldr = oldr->next;
     }
 
     /* 3. Copy heap + stack metadata */
@@ -147,49 +347,33 @@ as_copy(struct addrspace *old, struct addrspace **ret)
     newas->stack_base = old->stack_base;
     newas->stack_end  = old->stack_end;
 	newas->loading = old->loading; 
+	newas->mmap_low = old->mmap_low; 
 
-    /* 4. Deep-copy the 2-level page table */
-    for (int i = 0; i < PT_L1_SIZE; i++) {
-        if (old->pt_l1[i] == NULL) {
-                        continue;
-                }
-
-                paddr_t *old_l2 = old->pt_l1[i];
-
-                /* Allocate new level-2 table */
-                paddr_t *new_l2 = kmalloc(PT_L2_SIZE * sizeof(paddr_t));
-                if (new_l2 == NULL) {
+    /* 4. Share the level 2 page tables */
+    if (old->pt_l1 != NULL) {
+                newas->pt_l1 = pt_alloc();
+                if (newas->pt_l1 == NULL) {
                         as_destroy(newas);
                         return ENOMEM;
                 }
-
-                for (int j = 0; j < PT_L2_SIZE; j++) {
-                        paddr_t old_paddr = old_l2[j];
-
-                        if (old_paddr == 0) {
-                                new_l2[j] = 0;
-                                continue;
+                for (int i = 0; i < PT_L1_SIZE; i++) {
+                        if (old->pt_l1[i] != NULL) {
+                                page_incref(KVADDR_TO_PADDR((vaddr_t)old->pt_l1[i]));
+                                newas->pt_l1[i] = old->pt_l1[i];
                         }
-
-                        /* Allocate new physical frame for this page */
-                        paddr_t new_paddr = alloc_page();
-                        if (new_paddr == 0) {
-                                kfree(new_l2);
-                                as_destroy(newas);
-                                return ENOMEM;
-                        }
-
-                        /* Copy page contents */
-                        void *old_kva = (void *)PADDR_TO_KVADDR(old_paddr);
-                        void *new_kva = (void *)PADDR_TO_KVADDR(new_paddr);
-                        memmove(new_kva, old_kva, PAGE_SIZE);
-
-                        new_l2[j] = new_paddr;
+                        /* let anyone waiting for this cpu in now and then (we only hold the sleep lock) */
+                        cond_resched();
                 }
-
-                newas->pt_l1[i] = new_l2;
         }
+        newas->as_stats.vs_resident = old->as_stats.vs_resident;
+
+        /*
+         * TLBs may still hold dirty (writable) entries of the parent for pages that are now shared, on any cpu that
+         * ran it. The next write then faults and vm_fault breaks the sharing.
+         */
+        as_tlbflush(old);
 
+        newas->as_stats.vs_maxresident = newas->as_stats.vs_resident;
         *ret = newas;
         return 0;
 }
@@ -197,40 +381,105 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 
 
 
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	int result;
+
+	/* the other threads of the parent mustn't change it under us */
+	lock_acquire(old->as_lock);
+	result = as_copy_locked(old, ret);
+	lock_release(old->as_lock);
+	return result;
+}
+
 /* Destroy as. Need to free all physical pages that are mapped in the pt then free the whole as */
 void
 as_destroy(struct addrspace *as)
 {
-        /* Free all user pages and level-2 tables */
-        for (int i = 0; i < PT_L1_SIZE; i++) {
+        /* Shared file mappings keep their contents: write them back before the frames go away */
+        for (unsigned i = 0; i < as->nregions; i++) {
+                if (as->regions[i].shared && as->regions[i].writeable && as->regions[i].vn != NULL) {
+                        region_writeback(as, &as->regions[i], false);
+                }
+        }
+
+        /* Free all user pages and level-2 tables (or just our references to the ones shared after fork) */
+        for (int i = 0; as->pt_l1 != NULL && i < PT_L1_SIZE; i++) {
                 if (as->pt_l1[i] != NULL) {
                         paddr_t *l2 = as->pt_l1[i];
-
-                        for (int j = 0; j < PT_L2_SIZE; j++) {
-                                if (l2[j] != 0) {
-                                        free_page(l2[j]);
-                                }
-                        }
-
-                        kfree(l2);
                         as->pt_l1[i] = NULL;
+                        pt_drop(as, l2);
+                        /* a level 2 table is a thousand pages; a good place to let others run */
+                        cond_resched();
+                }
+        }
+        if (as->pt_l1 != NULL) {
+                paddr_t **l1 = as->pt_l1;
+                as->pt_l1 = NULL;
+                pt_free_later(l1);
+        }
+
+        /* Free the regions (and drop their file and segment references) */
+        for (unsigned i = 0; i < as->nregions; i++) {
+                if (as->regions[i].vn != NULL) {
+                        VOP_DECREF(as->regions[i].vn);
+                }
+                if (as->regions[i].shm != NULL) {
+                        shm_decref(as->regions[i].shm);
                 }
         }
+        if (as->regions != NULL) {
+                kfree(as->regions);
+        }
+
+        kmem_cache_free(&as_cache, as);
+}
+
+
+
+/* hand as to the reaper */
+void
+as_destroy_later(struct addrspace *as)
+{
+        spinlock_acquire(&reaper_lock);
+        as->as_reapnext = reaper_list;
+        reaper_list = as;
+        spinlock_release(&reaper_lock);
+
+        /* if it's already queued, that run will find this one too */
+        workqueue_submit(&reaper_work);
+}
 
-        /* Free the regions list */
-        struct region *r = as->regions;
-        while (r != NULL) {
-                struct region *next = r->next;
-                kfree(r);
-                r = next;
+/* the work item: destroy everything on the list */
+static
+void
+reaper_work_fn(void *unused)
+{
+        (void)unused;
+
+        spinlock_acquire(&reaper_lock);
+        struct addrspace *list = reaper_list;
+        reaper_list = NULL;
+        spinlock_release(&reaper_lock);
+
+        while (list != NULL) {
+                struct addrspace *as = list;
+                list = as->as_reapnext;
+                as_destroy(as);
         }
+}
 
-        kfree(as);
+/* set up the reaper, called once during boot */
+void
+as_bootstrap(void)
+{
+        work_init(&reaper_work, reaper_work_fn, NULL);
 }
 
 
 
-/* Switch to a new as. We flush the TLB so the new process won't read stale entries */
+/* Switch to a new as. Entries are tagged with ASIDs so this normally just loads the as's ASID into the MMU */
 void
 as_activate(void)
 {
@@ -240,31 +489,212 @@ as_activate(void)
 	if (as == NULL) {
 		/*
 		 * Kernel thread without an address space; leave the
-		 * prior address space in place.
+		 * prior address space in place, but don't let the UTLB
+		 * refill handler walk its page table anymore.
 		 */
+		cpu_ptroot[curcpu->c_number] = 0;
 		return;
 	}
 
 	/* Need to disable interrupts to avoid races while modifying TLB */
 	int spl = splhigh(); 
 
-	/* Flush the tlb to prevent another process's mappings from remaining (the CPU will refill via vm_fault if needed) */
-	for (int i = 0; i < NUM_TLB; i++){
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i); 
+	/* remember that this cpu may now hold entries for the as (threads on other cpus may be doing the same) */
+	KASSERT(curcpu->c_number < 32);
+	unsigned bit = 1U << curcpu->c_number;
+	unsigned cpus;
+	do {
+		cpus = as->as_cpus;
+	} while ((cpus & bit) == 0 && !atomic_cas(&as->as_cpus, cpus, cpus | bit));
+
+	/* make sure the as has an ASID from the current generation */
+	spinlock_acquire(&asid_lock);
+	if (as->as_asid_gen != asid_generation){
+		if (asid_next == NUM_ASID){
+			/* ran out, start over (this retires every ASID handed out so far) */
+			asid_generation++;
+			asid_next = 1;
+		}
+		as->as_asid = asid_next++;
+		as->as_asid_gen = asid_generation;
+	}
+	uint32_t generation = asid_generation;
+	spinlock_release(&asid_lock);
+
+	/* Entries from an older generation may carry an ASID that now belongs to someone else, so flush them */
+	if (curcpu->c_asid_generation != generation){
+		for (int i = 0; i < NUM_TLB; i++){
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i); 
+		}
+		curcpu->c_asid_generation = generation;
 	}
 
+	/* Otherwise switching is just loading the ASID, the entries of other processes stay in the TLB */
+	curcpu->c_asid = as->as_asid;
+	tlb_setasid(as->as_asid);
+
+	/* and this is the page table the UTLB refill handler walks on this cpu */
+	cpu_ptroot[curcpu->c_number] = (vaddr_t)&as->pt_l1;
+
 	/* restore interrupts */
 	splx(spl);
 }
 
+/*
+ * Invalidate the given pages of an as in every TLB that might hold them. Only cpus that have run the as
+ * get an IPI, and each of them gets the whole batch in one IPI (more than TLBSHOOTDOWN_MAX pages turn
+ * into a full flush on that cpu). Returns after every target cpu has done the invalidation, so the
+ * caller can then safely reuse the frames.
+ */
+void
+as_tlbshootdown(struct addrspace *as, const vaddr_t *vaddrs, unsigned num)
+{
+	struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+	unsigned i;
+
+	KASSERT(as != NULL);
+
+	/* take care of our own TLB */
+	for (i = 0; i < num; i++){
+		struct tlbshootdown mine = { .ts_vaddr = vaddrs[i], .ts_asid = as->as_asid };
+		vm_tlbshootdown(&mine);
+	}
+
+	/* the common case: single threaded process that never ran on another cpu */
+	if ((as->as_cpus & ~((uint32_t)1 << curcpu->c_number)) == 0){
+		return;
+	}
+
+	if (num > TLBSHOOTDOWN_MAX){
+		/* too many to list, the targets just flush their whole TLB */
+		ipi_tlbshootdown_cpus(as->as_cpus, NULL, num);
+		return;
+	}
+
+	for (i = 0; i < num; i++){
+		ts[i].ts_vaddr = vaddrs[i];
+		ts[i].ts_asid = as->as_asid;
+	}
+	ipi_tlbshootdown_cpus(as->as_cpus, ts, num);
+}
+
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * The TLB entries can stay (they are tagged with the ASID and
+	 * as_destroy shoots them down), but the UTLB refill handler
+	 * must stop using the page table before the as goes away.
 	 */
+	cpu_ptroot[curcpu->c_number] = 0;
+}
+
+/*
+ * Add a region of npages pages at page aligned vaddr to the sorted array (growing it if it is full). Regions may not
+ * overlap: each has at most one file behind it, so two ELF segments sharing a page would lose one's data to the other
+ * (as_define_region gives such a page a region of its own first, see region_boundary).
+ */
+static
+int
+region_insert(struct addrspace *as, vaddr_t vaddr, size_t npages,
+	      int readable, int writeable, int executable, struct region **ret)
+{
+	/* find the slot that keeps the array sorted by vbase, and refuse to overlap the regions either side of it */
+	unsigned pos = as->nregions;
+	while (pos > 0 && as->regions[pos - 1].vbase > vaddr){
+		pos--;
+	}
+	if (pos > 0 && as->regions[pos - 1].vbase + as->regions[pos - 1].npages * PAGE_SIZE > vaddr){
+		return EINVAL;
+	}
+	if (pos < as->nregions && as->regions[pos].vbase < vaddr + npages * PAGE_SIZE){
+		return EINVAL;
+	}
+
+	/* grow the array if it is full */
+	if (as->nregions == as->maxregions){
+		unsigned newmax = as->maxregions == 0 ? MAX_REGIONS : as->maxregions * 2;
+		struct region *newregions = kmalloc_tagged(newmax * sizeof(struct region), KM_VM);
+		if (newregions == NULL){
+			return ENOMEM; 
+		}
+		if (as->regions != NULL){
+			memcpy(newregions, as->regions, as->nregions * sizeof(struct region));
+			kfree(as->regions);
+		}
+		as->regions = newregions;
+		as->maxregions = newmax;
+	}
+
+	/* shift the later regions up */
+	for (unsigned i = as->nregions; i > pos; i--){
+		as->regions[i] = as->regions[i - 1];
+	}
+	as->nregions++;
+	as->last_region = pos;
+
+	/* set the corresponding flags */
+	struct region *r = &as->regions[pos];
+	r->vbase = vaddr; 
+	r->npages = npages;
+	r->readable = readable; 
+	r->writeable = writeable; 
+	r->executable = executable; 
+	r->vn = NULL; 
+	r->seg_vaddr = vaddr; 
+	r->file_offset = 0; 
+	r->filesz = 0; 
+	r->mmapped = false; 
+	r->shared = false; 
+	r->shm = NULL;
+	r->boundary = false;
+
+	*ret = r;
+	return 0;
+}
+
+/*
+ * Make page, the first or last page of the region at index idx, a boundary region: a page two ELF segments share.
+ * A region has one file behind it, so the page gets a region of its own, with the permissions of both segments,
+ * and as_define_file reads both segments' bytes into it right away instead of leaving it to vm_fault. Only regions
+ * load_elf is still setting up (no file or mapping behind them yet) can be split.
+ */
+static
+int
+region_boundary(struct addrspace *as, unsigned idx, vaddr_t page, int readable, int writeable, int executable)
+{
+	struct region *r = &as->regions[idx];
+	if (r->vn != NULL || r->mmapped || r->shm != NULL){
+		return EINVAL;
+	}
+	KASSERT(page == r->vbase || page == r->vbase + (r->npages - 1) * PAGE_SIZE);
+
+	if (r->npages > 1){
+		/* split the page off; if there's no room for its region, put it back */
+		bool first = page == r->vbase;
+		if (first){
+			r->vbase += PAGE_SIZE;
+			r->seg_vaddr = r->vbase;
+		}
+		r->npages--;
+		struct region *b;
+		int result = region_insert(as, page, 1, r->readable, r->writeable, r->executable, &b);
+		if (result){
+			if (first){
+				r->vbase -= PAGE_SIZE;
+				r->seg_vaddr = r->vbase;
+			}
+			r->npages++;
+			return result;
+		}
+		r = b;
+	}
+
+	r->readable = r->readable || readable;
+	r->writeable = r->writeable || writeable;
+	r->executable = r->executable || executable;
+	r->boundary = true;
+	return 0;
 }
 
 /*
@@ -276,6 +706,11 @@ as_deactivate(void)
  * write, or execute permission should be set on the segment. At the
  * moment, these are ignored. When you write the VM system, you may
  * want to implement them.
+ *
+ * A page the segment shares with one that is already defined (the
+ * last page of the one below, or the first of the one above) gets a
+ * region of its own with the permissions of both; any other overlap
+ * fails with EINVAL.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
@@ -289,24 +724,51 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	/* calculate the number of pages by using the aligned size */
 	size_t npages = sz / PAGE_SIZE; 
+	vaddr_t reg_end = vaddr + npages * PAGE_SIZE;
 
-	/* allocate the region */
-	struct region *r = kmalloc(sizeof(struct region)); 
-	if (r == NULL){
-		return ENOMEM; 
+	/*
+	 * The segment may share its first page with the end of the one below, or its last page with the start of the
+	 * one above (linkers commonly put the end of .text and the start of .data in one page). That page becomes a
+	 * boundary region and this one starts or ends next to it; any other overlap is an error.
+	 */
+	vaddr_t end = reg_end;
+	unsigned i = 0;
+	while (i < as->nregions && vaddr < end){
+		struct region *o = &as->regions[i];
+		vaddr_t oend = o->vbase + o->npages * PAGE_SIZE;
+		vaddr_t page;
+		if (oend <= vaddr || o->vbase >= end){
+			i++;
+			continue;
+		}
+		if (oend == vaddr + PAGE_SIZE){
+			page = vaddr;
+			vaddr += PAGE_SIZE;
+		}
+		else if (o->vbase == end - PAGE_SIZE){
+			page = end - PAGE_SIZE;
+			end -= PAGE_SIZE;
+		}
+		else {
+			return EINVAL;
+		}
+		int result = region_boundary(as, i, page, readable, writeable, executable);
+		if (result){
+			return result;
+		}
+		/* that may have added a region and moved the others, start over */
+		i = 0;
 	}
 
-	/* set the corresponding flags */
-	r->vbase = vaddr; 
-	r->npages = npages;
-	r->readable = readable; 
-	r->writeable = writeable; 
-	r->executable = executable; 
-	r->next = as->regions;
-	as->regions = r; 
+	if (vaddr < end){
+		struct region *r;
+		int result = region_insert(as, vaddr, (end - vaddr) / PAGE_SIZE, readable, writeable, executable, &r);
+		if (result){
+			return result; 
+		}
+	}
 
 	/* The heap begins right after the last data/BSS region so we compute this regions end and check if its the region at the end */
-	vaddr_t reg_end = r->vbase + r->npages * PAGE_SIZE; 
 	if (as->heap_base == 0 || reg_end > as->heap_base){
 		as->heap_base = reg_end; 
 		as->heap_end = reg_end; 
@@ -317,6 +779,452 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 }
 
+/*
+ * Find the region containing vaddr. Faults tend to come in runs within one region, so we first try the one that
+ * matched last time, and otherwise binary search the sorted array for the last region starting at or below vaddr.
+ */
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *r;
+
+	if (as->nregions == 0){
+		return NULL;
+	}
+
+	/* last-hit cache */
+	KASSERT(as->last_region < as->nregions);
+	r = &as->regions[as->last_region];
+	if (vaddr >= r->vbase && vaddr < r->vbase + r->npages * PAGE_SIZE){
+		return r;
+	}
+
+	unsigned lo = 0, hi = as->nregions;
+	while (hi - lo > 1){
+		unsigned mid = lo + (hi - lo) / 2;
+		if (as->regions[mid].vbase <= vaddr){
+			lo = mid;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	r = &as->regions[lo];
+	if (vaddr >= r->vbase && vaddr < r->vbase + r->npages * PAGE_SIZE){
+		as->last_region = lo;
+		return r;
+	}
+	return NULL;
+}
+
+/*
+ * Read len bytes of vn at offset into the current process's memory at vaddr, for a boundary region. It's part of
+ * the address space being loaded (as->loading), so the stores are allowed whatever the region's permissions.
+ */
+static
+int
+region_readin(struct vnode *vn, off_t offset, vaddr_t vaddr, size_t len)
+{
+	struct iovec iov;
+	struct uio u;
+
+	KASSERT(len <= PAGE_SIZE);
+	char *buf = kmalloc_tagged(len, KM_VM);
+	if (buf == NULL){
+		return ENOMEM;
+	}
+	uio_kinit(&iov, &u, buf, len, offset, UIO_READ);
+	int result = VOP_READ(vn, &u);
+	if (result == 0 && u.uio_resid != 0){
+		/* the file is shorter than its headers say */
+		result = ENOEXEC;
+	}
+	if (result == 0){
+		result = copyout(buf, (userptr_t)vaddr, len);
+	}
+	kfree(buf);
+	return result;
+}
+
+/*
+ * Back the regions from vaddr on with filesz bytes of file data so vm_fault can page them in instead of load_elf
+ * copying it all up front. The data usually lies in one region, but a segment that shares a page with another
+ * (see region_boundary) runs into or out of a boundary region: the bytes there are read in now, and the rest backs
+ * the region after it.
+ */
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, struct vnode *vn, off_t offset, size_t filesz)
+{
+	bool first = true;
+
+	while (filesz > 0){
+		struct region *r = as_find_region(as, vaddr);
+		if (r == NULL){
+			/* the file data has to lie inside the segment's regions */
+			return first ? EFAULT : EINVAL;
+		}
+		size_t len = r->vbase + r->npages * PAGE_SIZE - vaddr;
+		if (len > filesz){
+			len = filesz;
+		}
+
+		if (r->boundary){
+			int result = region_readin(vn, offset, vaddr, len);
+			if (result){
+				return result;
+			}
+		}
+		else {
+			/* only one file per region (region_insert keeps segments from sharing one) */
+			if (r->vn != NULL){
+				return EINVAL;
+			}
+			VOP_INCREF(vn);
+			r->vn = vn; 
+			r->seg_vaddr = vaddr; 
+			r->file_offset = offset; 
+			r->filesz = len; 
+		}
+
+		vaddr += len;
+		offset += len;
+		filesz -= len;
+		first = false;
+	}
+	return 0;
+}
+
+/* How many pages region_writeback gathers up before writing them */
+#define WRITEBACK_BATCH 16
+
+/* 
+ * Write the pages of a shared file mapping that are in memory back to the file (only the bytes the file covers,
+ * mappings never extend the file). We don't track dirty bits, so every present page (or swapped out page) is written.
+ *
+ * The pages are gathered a batch at a time, each with a reference of our own so it can't be freed or reused, and then
+ * written. With UNLOCK set (munmap) the caller holds as_lock, and we let it go around the writes, since nothing may do
+ * file I/O holding it (see addrspace.h); if the region is gone when we get it back, another thread unmapped it and
+ * wrote it back itself. as_destroy has the address space to itself and doesn't hold the lock.
+ */
+static
+int
+region_writeback(struct addrspace *as, struct region *r, bool unlock)
+{
+	struct region copy = *r;
+	struct {
+		paddr_t pa;
+		vaddr_t va, start, end;
+	} pages[WRITEBACK_BATCH];
+	vaddr_t seg_end = copy.seg_vaddr + copy.filesz;
+	size_t p = 0;
+	int result = 0;
+
+	KASSERT(r->shared && r->vn != NULL);
+
+	/* the region's reference may go while we don't hold the lock */
+	VOP_INCREF(copy.vn);
+
+	while (p < copy.npages && result == 0){
+		unsigned n = 0;
+
+		for (; p < copy.npages && n < WRITEBACK_BATCH; p++){
+			vaddr_t va = copy.vbase + p * PAGE_SIZE;
+
+			/* the part of this page that is backed by the file */
+			vaddr_t start = va > copy.seg_vaddr ? va : copy.seg_vaddr;
+			vaddr_t end = va + PAGE_SIZE < seg_end ? va + PAGE_SIZE : seg_end;
+			if (start >= end){
+				continue;
+			}
+
+			paddr_t *l2 = as_l2table(as, va, false);
+			if (l2 == NULL){
+				continue;
+			}
+			paddr_t pa = pte_share(&l2[(va >> PT_L2_SHIFT) & PT_INDEX_MASK]);
+			if (pa == 0){
+				continue;
+			}
+			if (PTE_IS_SWAPPED(pa)){
+				/* the pager wrote it to swap: write a copy read back from there (the slot stays put) */
+				paddr_t frame = alloc_page();
+				if (frame == 0){
+					result = ENOMEM;
+					break;
+				}
+				result = swap_in(PTE_SWAPSLOT(pa), frame);
+				if (result){
+					free_page(frame);
+					break;
+				}
+				pa = frame;
+			}
+			pages[n].pa = pa;
+			pages[n].va = va;
+			pages[n].start = start;
+			pages[n].end = end;
+			n++;
+		}
+
+		if (unlock){
+			lock_release(as->as_lock);
+		}
+		for (unsigned i = 0; i < n; i++){
+			if (result == 0){
+				struct iovec iov;
+				struct uio u;
+				uio_kinit(&iov, &u, (char *)PADDR_TO_KVADDR(pages[i].pa) + (pages[i].start - pages[i].va),
+					  pages[i].end - pages[i].start,
+					  copy.file_offset + (pages[i].start - copy.seg_vaddr), UIO_WRITE);
+				result = VOP_WRITE(copy.vn, &u);
+			}
+			free_page(pages[i].pa);
+		}
+		if (unlock){
+			lock_acquire(as->as_lock);
+			r = as_find_region(as, copy.vbase);
+			if (r == NULL || r->vbase != copy.vbase || r->npages != copy.npages || r->vn != copy.vn){
+				break;
+			}
+		}
+	}
+
+	VOP_DECREF(copy.vn);
+	return result;
+}
+
+/*
+ * Unmap the pages in [start, end) (page aligned): free their frames and swap slots, shooting down each batch of
+ * TLB entries before the frames can be reused, and give back level 2 tables that end up empty. The next touch of
+ * any of these pages faults it in fresh (zero filled, or from the file for file backed regions).
+ *
+ * Level 2 tables still shared with a parent or child are copied first, or just dropped if the range covers all of
+ * one. That is the only thing that can fail (ENOMEM), and then nothing has been unmapped.
+ */
+int
+as_release(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	KASSERT((start & ~(vaddr_t)PAGE_FRAME) == 0 && (end & ~(vaddr_t)PAGE_FRAME) == 0);
+
+	vaddr_t batch[TLBSHOOTDOWN_MAX];
+	paddr_t frames[TLBSHOOTDOWN_MAX];
+	unsigned n = 0;
+	if (as->pt_l1 == NULL){
+		return 0;
+	}
+	for (unsigned l1 = start >> PT_L1_SHIFT; l1 <= ((end - 1) >> PT_L1_SHIFT) && start < end; l1++){
+		paddr_t *l2 = as->pt_l1[l1];
+		if (l2 == NULL || !page_is_shared(KVADDR_TO_PADDR((vaddr_t)l2))){
+			continue;
+		}
+
+		vaddr_t base = (vaddr_t)l1 << PT_L1_SHIFT;
+		if (start <= base && end - base >= (vaddr_t)1 << PT_L1_SHIFT){
+			/* the other side keeps the pages, we only mustn't see them through the TLB any more */
+			as->pt_l1[l1] = NULL;
+			as_tlbflush(as);
+			pt_drop(as, l2);
+		}
+		else if (pt_unshare(as, l1) == NULL){
+			return ENOMEM;
+		}
+	}
+	for (vaddr_t va = start; va < end; va += PAGE_SIZE){
+		paddr_t *l2 = as->pt_l1[(va >> PT_L1_SHIFT) & PT_INDEX_MASK];
+		if (l2 == NULL){
+			continue;
+		}
+
+		/* pte_take waits out the pager if it is writing this page */
+		paddr_t pte = pte_take(&l2[(va >> PT_L2_SHIFT) & PT_INDEX_MASK]);
+		if (PTE_IS_SWAPPED(pte)){
+			/* the pager wrote it out, there is no TLB entry to worry about */
+			swap_free(PTE_SWAPSLOT(pte));
+			continue;
+		}
+		if (pte == 0){
+			continue;
+		}
+		as->as_stats.vs_resident--;
+
+		batch[n] = va;
+		frames[n] = pte;
+		n++;
+
+		if (n == TLBSHOOTDOWN_MAX){
+			as_tlbshootdown(as, batch, n);
+			free_page_vec(frames, n);
+			n = 0;
+		}
+	}
+	if (n > 0){
+		as_tlbshootdown(as, batch, n);
+		free_page_vec(frames, n);
+	}
+
+	/* free the level 2 tables the range emptied (an all zero table has no frames the pager could be working on) */
+	bool freed = false;
+	for (unsigned l1 = start >> PT_L1_SHIFT; l1 <= ((end - 1) >> PT_L1_SHIFT) && start < end; l1++){
+		paddr_t *l2 = as->pt_l1[l1];
+		if (l2 == NULL){
+			continue;
+		}
+
+		unsigned j = 0;
+		while (j < PT_L2_SIZE && l2[j] == 0){
+			j++;
+		}
+		if (j == PT_L2_SIZE){
+			as->pt_l1[l1] = NULL;
+			pt_free_later(l2);
+			freed = true;
+		}
+	}
+
+	/* and the level 1 table if that was the last one */
+	if (freed){
+		unsigned i = 0;
+		while (i < PT_L1_SIZE && as->pt_l1[i] == NULL){
+			i++;
+		}
+		if (i == PT_L1_SIZE){
+			paddr_t **l1table = as->pt_l1;
+			as->pt_l1 = NULL;
+			pt_free_later(l1table);
+		}
+	}
+	return 0;
+}
+
+/* find the level 2 table for vaddr; with create, allocate it or make it this address space's own (see pt_unshare) */
+paddr_t *
+as_l2table(struct addrspace *as, vaddr_t vaddr, bool create)
+{
+	if (as->pt_l1 == NULL){
+		if (!create){
+			return NULL;
+		}
+		as->pt_l1 = pt_alloc();
+		if (as->pt_l1 == NULL){
+			return NULL;
+		}
+	}
+
+	unsigned l1 = (vaddr >> PT_L1_SHIFT) & PT_INDEX_MASK;
+	if (as->pt_l1[l1] == NULL && create){
+		as->pt_l1[l1] = pt_alloc();
+	}
+	else if (create && page_is_shared(KVADDR_TO_PADDR((vaddr_t)as->pt_l1[l1]))){
+		return pt_unshare(as, l1);
+	}
+	return as->pt_l1[l1];
+}
+
+/* Create an mmap region: pick the next free range below the previous mappings and demand page it from vn */
+int
+as_mmap(struct addrspace *as, size_t len, int prot, bool shared,
+	struct vnode *vn, off_t offset, size_t filesz, vaddr_t *ret)
+{
+	KASSERT(len > 0);
+	size_t npages = (len + PAGE_SIZE - 1) / PAGE_SIZE; 
+
+	/* make sure it fits between the heap and the existing mappings */
+	if (npages > (as->mmap_low - as->heap_end) / PAGE_SIZE){
+		return ENOMEM; 
+	}
+	vaddr_t vaddr = as->mmap_low - npages * PAGE_SIZE; 
+
+	struct region *r;
+	int result = region_insert(as, vaddr, npages, prot & PROT_READ, prot & PROT_WRITE, prot & PROT_EXEC, &r);
+	if (result){
+		return result; 
+	}
+	r->mmapped = true; 
+	r->shared = shared; 
+
+	if (vn != NULL){
+		VOP_INCREF(vn);
+		r->vn = vn; 
+		r->file_offset = offset; 
+		r->filesz = filesz; 
+	}
+
+	as->mmap_low = vaddr; 
+	*ret = vaddr;
+	return 0;
+}
+
+/* Map a whole shared memory segment: an anonymous shared mmap region whose pages vm_fault gets from the segment */
+int
+as_mmap_shm(struct addrspace *as, struct shmseg *seg, int prot, vaddr_t *ret)
+{
+	int result = as_mmap(as, shm_npages(seg) * PAGE_SIZE, prot, true, NULL, 0, 0, ret);
+	if (result){
+		return result;
+	}
+
+	struct region *r = as_find_region(as, *ret);
+	KASSERT(r != NULL && r->vbase == *ret);
+	shm_incref(seg);
+	r->shm = seg;
+	return 0;
+}
+
+/* Remove an mmap region (which must be unmapped as a whole), freeing its frames and dropping them from the TLBs */
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *r = as_find_region(as, vaddr);
+	if (r == NULL || !r->mmapped || r->vbase != vaddr ||
+	    (len + PAGE_SIZE - 1) / PAGE_SIZE != r->npages){
+		return EINVAL; 
+	}
+
+	int result = 0;
+	if (r->shared && r->writeable && r->vn != NULL){
+		/* keep going even if this fails, the mapping goes away regardless */
+		result = region_writeback(as, r, true);
+
+		/* that let go of as_lock: the region may have moved in the array, or been unmapped by another thread */
+		r = as_find_region(as, vaddr);
+		if (r == NULL || !r->mmapped || r->vbase != vaddr){
+			return EINVAL;
+		}
+	}
+
+	/* this shoots the pages down in every TLB that may hold them, so the frames can't be reached through us after */
+	int err = as_release(as, r->vbase, r->vbase + r->npages * PAGE_SIZE);
+	if (err){
+		return err;
+	}
+
+	if (r->vn != NULL){
+		VOP_DECREF(r->vn);
+	}
+	if (r->shm != NULL){
+		shm_decref(r->shm);
+	}
+
+	/* take it out of the array */
+	unsigned pos = r - as->regions;
+	for (unsigned k = pos; k + 1 < as->nregions; k++){
+		as->regions[k] = as->regions[k + 1];
+	}
+	as->nregions--;
+	as->last_region = 0;
+
+	/* the mmap area now ends at the lowest remaining mapping (so unmapping the last ones gives the space back to the heap) */
+	as->mmap_low = MMAP_TOP;
+	for (unsigned k = 0; k < as->nregions; k++){
+		if (as->regions[k].mmapped && as->regions[k].vbase < as->mmap_low){
+			as->mmap_low = as->regions[k].vbase;
+		}
+	}
+
+	return result;
+}
+
 /* called before loading an elf binary into this address space. */
 int
 as_prepare_load(struct addrspace *as)
@@ -354,3 +1262,49 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Define the user stack region with frames already in it at the top
+ * (the exec argument strings) and at least a page, plus extra bytes,
+ * of ordinary stack below them.
+ */
+int
+as_define_stack_args(struct addrspace *as, const paddr_t *frames,
+		     unsigned nframes, size_t extra, vaddr_t *argbase)
+{
+	vaddr_t stackptr, base;
+	paddr_t *l2_table = NULL;
+	unsigned i;
+	int result;
+
+	result = as_define_stack(as, &stackptr);
+	if (result) {
+		return result;
+	}
+
+	base = USERSTACK - nframes * PAGE_SIZE;
+	as->stack_end = base - PAGE_SIZE - ROUNDUP(extra, PAGE_SIZE);
+
+	if (nframes > 0) {
+		/* they all fall in the last level 2 table, so get it before installing any */
+		KASSERT((base >> PT_L1_SHIFT) == ((USERSTACK - 1) >> PT_L1_SHIFT));
+		l2_table = as_l2table(as, base, true);
+		if (l2_table == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	for (i = 0; i < nframes; i++) {
+		vaddr_t va = base + i * PAGE_SIZE;
+
+		l2_table[(va >> PT_L2_SHIFT) & PT_INDEX_MASK] = frames[i];
+		as->as_stats.vs_resident++;
+		page_setowner(frames[i], as, va);
+	}
+	if (VMSTATS_RESIDENT(&as->as_stats) > as->as_stats.vs_maxresident) {
+		as->as_stats.vs_maxresident = VMSTATS_RESIDENT(&as->as_stats);
+	}
+
+	*argbase = base;
+	return 0;
+}
+
@@ -84,6 +84,10 @@
  * To make use of this code, in addition to tm_badfaultfunc the
  * thread_machdep structure should contain a jmp_buf called
  * "tm_copyjmp".
+ *
+ * user_access_begin (see copyinout.h) is the same thing taken apart,
+ * so that the setjmp happens in the caller and the recovery can stay
+ * on across many accesses.
  */
 
 /*
@@ -319,3 +323,48 @@ copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *actual)
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return result;
 }
+
+/*
+ * user_access_begin/user_access_end. See copyinout.h.
+ */
+int
+useraccess_arm(const_userptr_t userptr, size_t len)
+{
+	int result;
+	size_t stoplen;
+
+	/* no nesting, and no copyin and friends inside */
+	KASSERT(curthread->t_machdep.tm_badfaultfunc == NULL);
+
+	result = copycheck(userptr, len, &stoplen);
+	if (result) {
+		return result;
+	}
+	if (stoplen != len) {
+		/* Single block, can't legally truncate it. */
+		return EFAULT;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+	return 0;
+}
+
+jmp_buf *
+useraccess_jmpbuf(void)
+{
+	return &curthread->t_machdep.tm_copyjmp;
+}
+
+int
+useraccess_fault(void)
+{
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return EFAULT;
+}
+
+void
+user_access_end(void)
+{
+	KASSERT(curthread->t_machdep.tm_badfaultfunc == copyfail);
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+}
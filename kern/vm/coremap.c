@@ -3,11 +3,19 @@
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <wchan.h>
+#include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <futex.h>
+#include <workqueue.h>
+#include <stats.h>
 
 /* This will serve as the physical memory allocator. Allows the OS to keep track of every physical page, */
 /* and allocates and free pages dynamically */
@@ -15,12 +23,61 @@
 /* At boot, we call ram_getsize() and ram_getfirstfree() to retrieve the usable physical memeory range [lo, hi). 
  * then we construct an array of coremap entries (one per physical page). And this struct basically tracks
  * whether the page is free or allocated. 
+ *
+ * Free memory is managed as a binary buddy system over the coremap indices. Every free block is 2^order frames long,
+ * starts at an index that is a multiple of 2^order, and its head entry sits on free_heads[order]. A block's buddy is
+ * found by flipping bit "order" of its index, so splitting on alloc and coalescing on free are both O(CM_MAX_ORDER).
+ * Single pages (alloc_page/free_page) are just order 0 blocks.
+ *
+ * The entries are set up lazily, CM_INIT_CHUNK frames at a time from the bottom (see coremap_init_chunk), so boot
+ * doesn't pay for all of RAM: vm_bootstrap does the first chunk, a work item does the rest in the background, and
+ * buddy_alloc does the next one itself if it runs out first. Only the frames below init_pages have real entries
+ * (everything from there on is garbage nobody may look at) and only those are ever on the free lists.
  */
 struct coremap_entry {
     bool free; /* set to true if this phys page is free (not allocated) */
     unsigned block_size; /* size of the contigous block allocated (set at block head) */
+
+    /* order of the free block this entry heads, or CM_NOORDER if it is not the head of a free block */
+    unsigned order;
+
+    /* free block heads are threaded onto a doubly linked list (one list per order) by coremap index so that */
+    /* allocation never has to scan the coremap. These fields are only meaningful on a free block head */
+    unsigned next_free;
+    unsigned prev_free;
+
+    /* set while the frame sits in the pre-zeroed pool (its contents are known to be all zeros) */
+    bool zeroed;
+
+    /* number of page table entries mapping this frame. Fork shares frames copy-on-write instead of copying them, */
+    /* so a user frame can be mapped by several address spaces at once. Allocated frames start at 1 */
+    unsigned refcount;
+
+    /* reverse map for the pager: the address space and page that map this frame. NULL for kernel frames, frames */
+    /* shared by several address spaces and MAP_SHARED pages, none of which are ever paged out */
+    struct addrspace *owner;
+    vaddr_t vaddr;
+
+    /* software reference bit: set whenever vm_fault maps the frame, cleared by the pager's clock hand */
+    bool referenced;
+
+    /* set while the pager is working on the frame; anyone wanting its page table entry waits on busy_wchan */
+    bool busy;
+
+    /* pte_wire holds on the frame: while non zero the pager and the merge scanner leave it alone. Only a hint, a */
+    /* frame freed while wired is reset here and the late page_unwire finds nothing to drop */
+    unsigned wired;
 };
 
+/* index used to terminate the free lists (no frame has this index) */
+#define CM_NONE ((unsigned)-1)
+
+/* order value for entries that don't head a free block */
+#define CM_NOORDER ((unsigned)-1)
+
+/* largest block we track: 2^12 pages = 16MB which covers all of RAM on our sys161 configs */
+#define CM_MAX_ORDER 12
+
 
 /* global variables */
 static struct coremap_entry *coremap = NULL; /* pointer to the beginning of our coremap array */
@@ -34,6 +91,286 @@ static struct spinlock coremap_lock = SPINLOCK_INITIALIZER; /* spinlock used to
 
 static bool coremap_ready = false; /* flag to indicate core map has been initialized */
 
+static unsigned free_heads[CM_MAX_ORDER + 1]; /* index of the first free block of each order */
+static unsigned free_count = 0; /* number of frames currently free (summed over all orders) */
+
+/* frames set up per step of the lazy initialization (1MB) */
+#define CM_INIT_CHUNK 256
+
+static unsigned init_pages = 0; /* frames [0, init_pages) have been set up, protected by coremap_lock */
+static struct work init_work; /* sets up the rest in the background */
+
+/* free frames, counting the ones not set up yet (which are all free) */
+#define CM_FREECOUNT() (free_count + (total_pages - init_pages))
+
+static struct wchan *busy_wchan = NULL; /* threads waiting for the pager to finish with a frame sleep here */
+static unsigned clock_hand = 0; /* next frame the pager's clock looks at */
+static unsigned trim_hand = 0; /* same, for trimming one address space down to its RSS limit */
+static unsigned merge_hand = 0; /* and the next one the merge scanner looks at */
+
+/* 
+ * The shared zero page: one permanently zero frame that vm_fault maps read only for read faults on untouched
+ * anonymous memory. It keeps the reference it gets at boot forever, so it always looks shared and the first write
+ * to it goes through copy-on-write like any other shared frame.
+ */
+static paddr_t zero_paddr = 0;
+
+/* 
+ * Pool of frames that the pagezero thread has already zeroed. Frames in the pool are allocated as far as the buddy
+ * lists are concerned and are chained through next_free. Protected by zeropool_lock.
+ */
+#define ZEROPOOL_TARGET 64 /* pagezero stops filling once the pool holds this many frames */
+#define ZEROPOOL_LOW 16 /* and gets woken up again when the pool drops below this */
+
+static struct spinlock zeropool_lock = SPINLOCK_INITIALIZER;
+static struct wchan *zeropool_wchan = NULL; /* pagezero sleeps here while the pool is full */
+static unsigned zeropool_head = CM_NONE;
+static unsigned zeropool_count = 0;
+
+
+/* 
+ * push the block of 2^order frames starting at idx onto its free list. The frames in the block must already be
+ * marked free; only the head records the order. Caller holds coremap_lock 
+ */
+static void freelist_push(unsigned idx, unsigned order){
+    KASSERT(coremap[idx].free);
+    coremap[idx].order = order;
+
+    coremap[idx].prev_free = CM_NONE;
+    coremap[idx].next_free = free_heads[order];
+    if (free_heads[order] != CM_NONE){
+        coremap[free_heads[order]].prev_free = idx;
+    }
+    free_heads[order] = idx;
+    free_count += 1U << order;
+}
+
+/* unlink the free block headed by idx from its free list. Frames stay marked free. Caller holds coremap_lock */
+static void freelist_remove(unsigned idx){
+    unsigned order = coremap[idx].order;
+
+    KASSERT(coremap[idx].free);
+    KASSERT(order <= CM_MAX_ORDER);
+
+    unsigned prev = coremap[idx].prev_free;
+    unsigned next = coremap[idx].next_free;
+
+    if (prev != CM_NONE){
+        coremap[prev].next_free = next;
+    } else {
+        free_heads[order] = next;
+    }
+    if (next != CM_NONE){
+        coremap[next].prev_free = prev;
+    }
+
+    coremap[idx].order = CM_NOORDER;
+    coremap[idx].next_free = CM_NONE;
+    coremap[idx].prev_free = CM_NONE;
+    free_count -= 1U << order;
+}
+
+/* smallest order whose block holds npages frames */
+static unsigned order_for(unsigned npages){
+    unsigned order = 0;
+    while ((1U << order) < npages){
+        order++;
+    }
+    return order;
+}
+
+static bool coremap_init_chunk(void);
+
+/* 
+ * Take a free block of exactly 2^order frames, splitting a larger block if there isn't one.
+ * Returns the index of the block head, or CM_NONE if nothing big enough is free. Caller holds coremap_lock.
+ */
+static unsigned buddy_alloc(unsigned order){
+    unsigned o;
+
+    for (;;){
+        /* find the smallest non-empty list that can satisfy the request */
+        o = order;
+        while (o <= CM_MAX_ORDER && free_heads[o] == CM_NONE){
+            o++;
+        }
+        if (o <= CM_MAX_ORDER){
+            break;
+        }
+        /* nothing big enough among the frames set up so far: set up some more, if there are any */
+        if (!coremap_init_chunk()){
+            return CM_NONE;
+        }
+    }
+
+    unsigned idx = free_heads[o];
+    freelist_remove(idx);
+
+    /* split the block in half until it's the right size. The upper halves go back on the smaller lists */
+    while (o > order){
+        o--;
+        freelist_push(idx + (1U << o), o);
+    }
+
+    /* the frames we hand out are no longer free */
+    for (unsigned i = 0; i < (1U << order); i++){
+        coremap[idx + i].free = false;
+        coremap[idx + i].block_size = 0;
+        coremap[idx + i].refcount = 1;
+        coremap[idx + i].owner = NULL;
+        coremap[idx + i].referenced = false;
+        coremap[idx + i].busy = false;
+        coremap[idx + i].wired = 0;
+    }
+    return idx;
+}
+
+/* 
+ * Return the aligned block of 2^order frames at idx to the allocator, merging it with its buddy for as long as
+ * the buddy is itself a whole free block of the same order. Caller holds coremap_lock.
+ */
+static void buddy_free(unsigned idx, unsigned order){
+    for (unsigned i = 0; i < (1U << order); i++){
+        KASSERT(!coremap[idx + i].free);
+        KASSERT(!coremap[idx + i].zeroed);
+        coremap[idx + i].free = true;
+        coremap[idx + i].block_size = 0;
+        coremap[idx + i].order = CM_NOORDER;
+        coremap[idx + i].refcount = 0;
+        coremap[idx + i].wired = 0;
+    }
+
+    while (order < CM_MAX_ORDER){
+        unsigned buddy = idx ^ (1U << order);
+
+        /* the buddy must exist (and be set up), be free and head a block of the same size for us to merge with it */
+        if (buddy >= init_pages || !coremap[buddy].free || coremap[buddy].order != order){
+            break;
+        }
+        freelist_remove(buddy);
+
+        /* the merged block starts at whichever of the two comes first */
+        if (buddy < idx){
+            idx = buddy;
+        }
+        order++;
+    }
+    freelist_push(idx, order);
+}
+
+/* 
+ * Free the run of frames [idx, idx + npages) by carving it into the largest aligned power of two blocks that fit
+ * and handing each one to buddy_free(). Used for the unused tail of rounded up allocations and for free_kpages().
+ * Caller holds coremap_lock.
+ */
+static void buddy_free_range(unsigned idx, unsigned npages){
+    unsigned end = idx + npages;
+
+    while (idx < end){
+        unsigned order = 0;
+        while (order < CM_MAX_ORDER && (idx & ((1U << (order + 1)) - 1)) == 0 && idx + (1U << (order + 1)) <= end){
+            order++;
+        }
+        buddy_free(idx, order);
+        idx += 1U << order;
+    }
+}
+
+/* pop a frame from the pre-zeroed pool, returning 0 if it's empty. Caller holds zeropool_lock */
+static paddr_t zeropool_pop(void){
+    if (zeropool_head == CM_NONE){
+        return 0;
+    }
+    unsigned i = zeropool_head;
+    KASSERT(coremap[i].zeroed);
+    zeropool_head = coremap[i].next_free;
+    coremap[i].next_free = CM_NONE;
+    coremap[i].zeroed = false;
+    zeropool_count--;
+    return first_paddr + i * PAGE_SIZE;
+}
+
+/* 
+ * Body of the pagezero kernel thread. It takes frames off the free lists, zeroes them and parks them in the pool,
+ * yielding after every page so it only really gets to run when nothing else wants the cpu. It stays away from the
+ * last few free frames so it never competes with real allocations when memory is tight.
+ */
+static void pagezero_thread(void *unused1, unsigned long unused2){
+    (void)unused1;
+    (void)unused2;
+
+    while (1){
+        spinlock_acquire(&zeropool_lock);
+        while (zeropool_count >= ZEROPOOL_TARGET || CM_FREECOUNT() < 2 * ZEROPOOL_TARGET){
+            wchan_sleep(zeropool_wchan, &zeropool_lock);
+        }
+        spinlock_release(&zeropool_lock);
+
+        paddr_t pa = alloc_page();
+        if (pa != 0){
+            pagezero((void *)PADDR_TO_KVADDR(pa));
+
+            unsigned i = (pa - first_paddr) / PAGE_SIZE;
+            spinlock_acquire(&zeropool_lock);
+            coremap[i].zeroed = true;
+            coremap[i].next_free = zeropool_head;
+            zeropool_head = i;
+            zeropool_count++;
+            spinlock_release(&zeropool_lock);
+        }
+
+        thread_yield();
+    }
+}
+
+/* 
+ * Set up the entries of the next CM_INIT_CHUNK frames: every frame starts out allocated and we then free the whole
+ * chunk, which carves it into the largest aligned buddy blocks that fit and merges them with free blocks below it.
+ * Returns false if everything was set up already. Caller holds coremap_lock.
+ */
+static bool coremap_init_chunk(void){
+    unsigned start = init_pages;
+    unsigned end = start + CM_INIT_CHUNK;
+    if (start == total_pages){
+        return false;
+    }
+    if (end > total_pages){
+        end = total_pages;
+    }
+
+    for (unsigned i = start; i < end; i++){
+        coremap[i].free = false;
+        coremap[i].block_size = 0;
+        coremap[i].order = CM_NOORDER;
+        coremap[i].next_free = CM_NONE;
+        coremap[i].prev_free = CM_NONE;
+        coremap[i].zeroed = false;
+        coremap[i].refcount = 1;
+        coremap[i].owner = NULL;
+        coremap[i].vaddr = 0;
+        coremap[i].referenced = false;
+        coremap[i].busy = false;
+        coremap[i].wired = 0;
+    }
+    init_pages = end;
+    buddy_free_range(start, end - start);
+    return true;
+}
+
+/* Work item that sets up the rest of the coremap, a chunk per run so the worker can do other things in between */
+static void coremap_init_work(void *unused){
+    (void)unused;
+
+    spinlock_acquire(&coremap_lock);
+    coremap_init_chunk();
+    bool more = init_pages < total_pages;
+    spinlock_release(&coremap_lock);
+
+    if (more){
+        workqueue_submit(&init_work);
+    }
+}
+
 /* 
  * this function is called once during system initialization to initialize the virtual memory system. 
  * we build the core map. Now remember we can't use kmalloc() as the heap allocator is not ready so we manually reserve space at beginnign of RAM
@@ -71,13 +408,71 @@ static bool coremap_ready = false; /* flag to indicate core map has been initial
     /* now we compute the total number of pages available after the core map */
     total_pages = (hi - first_paddr) / PAGE_SIZE;
     
-    /* initialize the coremap */
-    for (unsigned i = 0; i < total_pages; i++){
-        coremap[i].free = true; 
-        coremap[i].block_size = 0; 
+    /* set up the first chunk of the coremap now and leave the rest to init_work (see coremap_init_chunk) */
+    for (unsigned o = 0; o <= CM_MAX_ORDER; o++){
+        free_heads[o] = CM_NONE;
+    }
+    free_count = 0;
+    init_pages = 0;
+    spinlock_acquire(&coremap_lock);
+    coremap_init_chunk();
+    spinlock_release(&coremap_lock);
+    if (init_pages < total_pages){
+        work_init(&init_work, coremap_init_work, NULL);
+        workqueue_submit(&init_work);
     }
 
     coremap_ready = true;
+
+    zero_paddr = alloc_page();
+    if (zero_paddr == 0){
+        panic("vm_bootstrap: no memory for the zero page\n");
+    }
+    pagezero((void *)PADDR_TO_KVADDR(zero_paddr));
+
+    busy_wchan = wchan_create("cm_busy");
+    if (busy_wchan == NULL){
+        panic("vm_bootstrap: could not create the coremap wait channel\n");
+    }
+
+    /* start the thread that keeps the pre-zeroed pool topped up. If this fails alloc_zeroed_page() just zeroes inline */
+    zeropool_wchan = wchan_create("zeropool");
+    if (zeropool_wchan == NULL || thread_fork("pagezero", NULL, pagezero_thread, NULL, 0)){
+        kprintf("vm: could not start pagezero thread, zeroing pages on demand\n");
+    }
+}
+
+
+ /* 
+  * Per-CPU page magazines. Each struct cpu keeps up to CPU_PAGECACHE_SIZE single frames that are already marked as
+  * allocated in the coremap. alloc_page() and free_page() work out of the local magazine with interrupts off (so we
+  * can't be switched to another cpu halfway through) and only take coremap_lock to move CM_MAGAZINE_BATCH frames
+  * at a time between the magazine and the buddy lists.
+  */
+#define CM_MAGAZINE_BATCH (CPU_PAGECACHE_SIZE / 2)
+
+/* move up to CM_MAGAZINE_BATCH frames from the buddy lists into this cpu's magazine. Called at splhigh */
+static void magazine_refill(struct cpu *c){
+    spinlock_acquire(&coremap_lock);
+    while (c->c_npagecache < CM_MAGAZINE_BATCH){
+        unsigned i = buddy_alloc(0);
+        if (i == CM_NONE){
+            break;
+        }
+        coremap[i].block_size = 1;
+        c->c_pagecache[c->c_npagecache++] = first_paddr + i * PAGE_SIZE;
+    }
+    spinlock_release(&coremap_lock);
+}
+
+/* hand frames from this cpu's magazine back to the buddy lists until only keep are left. Called at splhigh */
+static void magazine_drain(struct cpu *c, unsigned keep){
+    spinlock_acquire(&coremap_lock);
+    while (c->c_npagecache > keep){
+        paddr_t pa = c->c_pagecache[--c->c_npagecache];
+        buddy_free((pa - first_paddr) / PAGE_SIZE, 0);
+    }
+    spinlock_release(&coremap_lock);
 }
 
 
@@ -93,30 +488,68 @@ static bool coremap_ready = false; /* flag to indicate core map has been initial
         return pa;
     }
     
-    /* acquire spinlock for core map first */
-    spinlock_acquire(&coremap_lock); 
+    /* interrupts off so curcpu can't change under us while we use its magazine */
+    int spl = splhigh();
+    struct cpu *c = curcpu->c_self;
 
-    /* find first available page */
-    for (unsigned i = 0; i < total_pages; i++){
-        if (coremap[i].free){
-            /* mark the page as used */
-            coremap[i].free = false;
-            coremap[i].block_size = 1; 
+    /* magazine is empty so grab a batch from the coremap */
+    bool low = false;
+    if (c->c_npagecache == 0){
+        magazine_refill(c);
+        low = CM_FREECOUNT() < PAGER_LOW_WATER;
+    }
 
-            /* compute the pa of the page by using our base address */
-            paddr_t pa = first_paddr + i * PAGE_SIZE; 
+    if (c->c_npagecache == 0){
+        splx(spl);
 
-            spinlock_release(&coremap_lock); 
-            return pa; 
-        }
+        /* last resort: the frames parked in the zero pool are still free memory */
+        spinlock_acquire(&zeropool_lock);
+        paddr_t pa = zeropool_pop();
+        spinlock_release(&zeropool_lock);
+
+        /* returns 0 if there really is no memory left */
+        return pa; 
     }
 
-    /* no memory left */
-    spinlock_release(&coremap_lock); 
-    return 0; 
+    /* the frame is already marked allocated (block_size 1) in the coremap */
+    paddr_t pa = c->c_pagecache[--c->c_npagecache];
+    splx(spl);
+
+    /* memory is getting tight, let the pager start evicting in the background */
+    if (low){
+        swap_kick();
+    }
+    return pa; 
  }
 
  
+ /* 
+  * Allocate a physical page whose contents are all zeros. Normally this pops a frame that pagezero already cleared,
+  * so the fault path doesn't pay for the memset. If the pool is empty we fall back to alloc_page() and zero inline.
+  */
+ paddr_t alloc_zeroed_page(void){
+    paddr_t pa = 0;
+
+    if (coremap_ready && zeropool_wchan != NULL){
+        spinlock_acquire(&zeropool_lock);
+        pa = zeropool_pop();
+        if (zeropool_count < ZEROPOOL_LOW){
+            wchan_wakeone(zeropool_wchan, &zeropool_lock);
+        }
+        spinlock_release(&zeropool_lock);
+        if (pa != 0){
+            return pa;
+        }
+    }
+
+    pa = alloc_page();
+    if (pa == 0){
+        return 0;
+    }
+    pagezero((void *)PADDR_TO_KVADDR(pa));
+    return pa;
+ }
+
  /* Function used to free a page */
  void free_page(paddr_t pa){
 
@@ -125,11 +558,8 @@ static bool coremap_ready = false; /* flag to indicate core map has been initial
         return;
     }
     
-    spinlock_acquire(&coremap_lock); 
-    
     /* safety check */
     if (pa < first_paddr){
-        spinlock_release(&coremap_lock);
         return; 
     }
 
@@ -138,75 +568,632 @@ static bool coremap_ready = false; /* flag to indicate core map has been initial
     unsigned cm_idx = (pa - first_paddr) / PAGE_SIZE;
     KASSERT(cm_idx < total_pages); 
 
+    KASSERT(!coremap[cm_idx].free);
     KASSERT(coremap[cm_idx].block_size == 1); 
+    KASSERT(coremap[cm_idx].refcount > 0);
+
+    /* 
+     * If the frame is shared copy-on-write this just drops one reference. A count of 1 means we are the only owner,
+     * and since only an owner can add references (by forking) nobody can race with us, so the lock is only needed
+     * when the frame is actually shared.
+     */
+    if (coremap[cm_idx].refcount > 1){
+        spinlock_acquire(&coremap_lock);
+        if (coremap[cm_idx].refcount > 1){
+            coremap[cm_idx].refcount--;
+
+            /* the remaining mapping may not be the recorded owner, vm_fault sets the right one on its next fault */
+            coremap[cm_idx].owner = NULL;
+            spinlock_release(&coremap_lock);
+            return;
+        }
+        spinlock_release(&coremap_lock);
+    }
 
-    /* free the page */    
-    coremap[cm_idx].free = true;
-    coremap[cm_idx].block_size = 0; 
+    /* page table entries are dropped through pte_take, which already waited for the pager and cleared the owner */
+    KASSERT(!coremap[cm_idx].busy);
+    KASSERT(coremap[cm_idx].owner == NULL);
+    coremap[cm_idx].wired = 0;
+
+    /* free the page into this cpu's magazine, spilling half of it back to the buddy allocator if it's full */    
+    int spl = splhigh();
+    struct cpu *c = curcpu->c_self;
+    if (c->c_npagecache == CPU_PAGECACHE_SIZE){
+        magazine_drain(c, CPU_PAGECACHE_SIZE - CM_MAGAZINE_BATCH);
+    }
+    c->c_pagecache[c->c_npagecache++] = pa;
+    splx(spl);
+ }
+
+ 
+ /* Add a reference to a user frame that is about to be mapped copy-on-write by another address space */
+ void page_incref(paddr_t pa){
+    KASSERT(coremap_ready);
+    KASSERT(pa >= first_paddr);
+
+    unsigned cm_idx = (pa - first_paddr) / PAGE_SIZE;
+    KASSERT(cm_idx < total_pages);
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(!coremap[cm_idx].free);
+    KASSERT(coremap[cm_idx].block_size == 1);
+    coremap[cm_idx].refcount++;
     spinlock_release(&coremap_lock);
  }
 
+ /* 
+  * Returns true if more than one page table maps this frame, i.e., it must stay read only and be copied before the
+  * first write. The unlocked read is fine: other owners can only lower the count, and going from shared to not
+  * shared under us at worst costs one unnecessary copy.
+  */
+ bool page_is_shared(paddr_t pa){
+    if (!coremap_ready || pa < first_paddr){
+        return false;
+    }
+
+    unsigned cm_idx = (pa - first_paddr) / PAGE_SIZE;
+    KASSERT(cm_idx < total_pages);
+    return coremap[cm_idx].refcount > 1;
+ }
+
+ /* the zero page with a reference added for a new mapping of it (dropped with free_page like any other frame) */
+ paddr_t page_zero_ref(void){
+    page_incref(zero_paddr);
+    return zero_paddr;
+ }
+
+ bool page_is_zero(paddr_t pa){
+    return pa == zero_paddr;
+ }
+
  
+ /* 
+  * Bulk release. Tearing down a big address space one free_page() at a time costs a coremap_lock round trip per
+  * page (and pte_take another one), so these two take the lock once for a whole vector. Frames whose last
+  * reference goes away go straight back on the buddy lists rather than through the magazine.
+  */
 
- /* Function used to allocate contiguous physical pages (kernel might need multiple pages) */
- /* we need to search the coremap for npages consecutive free frames and if we find them mark as used and return kva*/
-vaddr_t alloc_kpages(unsigned npages)
-{
+ /* drop one reference to the frame at cm_idx. Caller holds coremap_lock */
+ static void page_drop_locked(unsigned cm_idx){
+    KASSERT(cm_idx < total_pages);
+    KASSERT(!coremap[cm_idx].free);
+    KASSERT(coremap[cm_idx].block_size == 1);
+    KASSERT(coremap[cm_idx].refcount > 0);
+    KASSERT(!coremap[cm_idx].busy);
 
-    /* Early boot core map not ready yet we use ram steal mem */
-    if (!coremap_ready){
-        paddr_t pa = ram_stealmem(npages);
-        if(pa == 0){
-            return 0;
-        }
-        return PADDR_TO_KVADDR(pa);
+    coremap[cm_idx].owner = NULL;
+    if (coremap[cm_idx].refcount > 1){
+        coremap[cm_idx].refcount--;
+        return;
     }
-    /* first acquire core map lock to prev concurrent access */
+    buddy_free(cm_idx, 0);
+ }
+
+ /* free_page() for each of the n frames in frames */
+ void free_page_vec(const paddr_t *frames, unsigned n){
+    KASSERT(coremap_ready);
+
+    spinlock_acquire(&coremap_lock);
+    for (unsigned i = 0; i < n; i++){
+        KASSERT(frames[i] >= first_paddr);
+        page_drop_locked((frames[i] - first_paddr) / PAGE_SIZE);
+    }
+    spinlock_release(&coremap_lock);
+ }
+
+ /* 
+  * pte_take() on each of the n page table entries in ptes, dropping the frames and swap slots they held. Used by
+  * as_destroy on whole level 2 tables, so the caller must make sure nothing can still be using the pages (no TLB
+  * entries, nobody faulting). If the pager is busy with one of the frames we still have to wait for it.
+  */
+ void pte_free_vec(paddr_t *ptes, unsigned n){
     spinlock_acquire(&coremap_lock);
+    for (unsigned i = 0; i < n; i++){
+        paddr_t v = ptes[i];
+        if (v == 0){
+            continue;
+        }
+        if (PTE_IS_SWAPPED(v)){
+            ptes[i] = 0;
+            swap_free(PTE_SWAPSLOT(v));
+            continue;
+        }
+
+        unsigned cm_idx = ((v & PAGE_FRAME) - first_paddr) / PAGE_SIZE;
+        KASSERT(cm_idx < total_pages);
+        if (coremap[cm_idx].busy){
+            /* look at this entry again once the pager is done, it may point at swap now */
+            wchan_sleep(busy_wchan, &coremap_lock);
+            i--;
+            continue;
+        }
+        ptes[i] = 0;
+        page_drop_locked(cm_idx);
+    }
+    spinlock_release(&coremap_lock);
+ }
 
-    /* Search for a contiguous free run of npages frames */
-    for (unsigned i = 0; i < total_pages; i++) {
+ /* 
+  * as stops using the level 2 table l2 (PT_L2_SIZE entries). If other address spaces share it (see as_copy) this
+  * drops as's reference to the table and returns false, after waiting out the pager and taking as off as the owner
+  * of the frames in it, since as may be about to go away. Returns true if as was its only user, and the entries and
+  * the table are then the caller's to free.
+  */
+ bool pte_table_release(paddr_t *l2, struct addrspace *as){
+    unsigned table_idx = (KVADDR_TO_PADDR((vaddr_t)l2) - first_paddr) / PAGE_SIZE;
+    KASSERT(table_idx < total_pages);
 
-        /* If this frame is not free, skip */
-        if (!coremap[i].free){
+    spinlock_acquire(&coremap_lock);
+    for (unsigned i = 0; i < PT_L2_SIZE && coremap[table_idx].refcount > 1; i++){
+        paddr_t v = l2[i];
+        if (v == 0 || PTE_IS_SWAPPED(v)){
+            continue;
+        }
+
+        unsigned cm_idx = ((v & PAGE_FRAME) - first_paddr) / PAGE_SIZE;
+        KASSERT(cm_idx < total_pages);
+        if (coremap[cm_idx].busy){
+            wchan_sleep(busy_wchan, &coremap_lock);
+            i--;
             continue;
         }
+        if (coremap[cm_idx].owner == as){
+            coremap[cm_idx].owner = NULL;
+        }
+    }
+
+    bool last = coremap[table_idx].refcount == 1;
+    if (!last){
+        coremap[table_idx].refcount--;
+    }
+    spinlock_release(&coremap_lock);
+    return last;
+ }
+
+ /* 
+  * Page table entry access that is safe against the pager. Everything below works on a user page table entry
+  * (present frame, swapped slot or 0, see addrspace.h) and, while the frame it maps is busy (the pager is writing it
+  * out or shooting down its TLB entries), sleeps until the pager is done and then looks again, since the entry may
+  * now point at swap. The pager changes entries only under coremap_lock, so holding it here keeps them stable.
+  * Present frames are returned without the PTE_UNREF flag.
+  */
+
+ /* wait for the pager if needed and return the entry, marking a present frame as just referenced */
+ paddr_t pte_get(paddr_t *pte){
+    spinlock_acquire(&coremap_lock);
+    for (;;){
+        paddr_t v = *pte;
+        if (v == 0 || PTE_IS_SWAPPED(v)){
+            spinlock_release(&coremap_lock);
+            return v;
+        }
+
+        unsigned cm_idx = ((v & PAGE_FRAME) - first_paddr) / PAGE_SIZE;
+        KASSERT(cm_idx < total_pages);
+        if (!coremap[cm_idx].busy){
+            coremap[cm_idx].referenced = true;
+            *pte = v & PAGE_FRAME;
+            spinlock_release(&coremap_lock);
+            return v & PAGE_FRAME;
+        }
+        wchan_sleep(busy_wchan, &coremap_lock);
+    }
+ }
 
-        /* Check if frames [i, i + npages) are all free */
-        bool run_ok = true;
-        for (unsigned j = 0; j < npages; j++) {
+ /* like pte_get, but also adds a reference to a present frame (for fork mapping it copy-on-write) */
+ paddr_t pte_share(paddr_t *pte){
+    spinlock_acquire(&coremap_lock);
+    for (;;){
+        paddr_t v = *pte;
+        if (v == 0 || PTE_IS_SWAPPED(v)){
+            spinlock_release(&coremap_lock);
+            return v;
+        }
 
-            /* if we run out of bounds or find a used fram break */
-            if (i + j >= total_pages || !coremap[i + j].free) {
-                run_ok = false;
-                break;
+        unsigned cm_idx = ((v & PAGE_FRAME) - first_paddr) / PAGE_SIZE;
+        KASSERT(cm_idx < total_pages);
+        if (!coremap[cm_idx].busy){
+            KASSERT(coremap[cm_idx].block_size == 1);
+            coremap[cm_idx].refcount++;
+            spinlock_release(&coremap_lock);
+            return v & PAGE_FRAME;
+        }
+        wchan_sleep(busy_wchan, &coremap_lock);
+    }
+ }
+
+ /*
+  * like pte_share, for uiomove's page path (vm_pagemove): the extra reference keeps the pager off the frame while it is
+  * copied, and page_unpin drops it again. With WRITE the frame must be this entry's alone (not copy-on-write or the
+  * zero page); 0 means there's nothing to pin and the caller goes through a fault instead
+  */
+ paddr_t pte_pin(paddr_t *pte, bool write){
+    spinlock_acquire(&coremap_lock);
+    for (;;){
+        paddr_t v = *pte;
+        if (v == 0 || PTE_IS_SWAPPED(v)){
+            spinlock_release(&coremap_lock);
+            return 0;
+        }
+
+        unsigned cm_idx = ((v & PAGE_FRAME) - first_paddr) / PAGE_SIZE;
+        KASSERT(cm_idx < total_pages);
+        if (!coremap[cm_idx].busy){
+            if (write && (coremap[cm_idx].refcount != 1 || (v & PAGE_FRAME) == zero_paddr)){
+                spinlock_release(&coremap_lock);
+                return 0;
             }
+            coremap[cm_idx].refcount++;
+            coremap[cm_idx].referenced = true;
+            *pte = v & PAGE_FRAME;
+            spinlock_release(&coremap_lock);
+            return v & PAGE_FRAME;
         }
+        wchan_sleep(busy_wchan, &coremap_lock);
+    }
+ }
+
+ /* drop pte_pin's reference. Unlike free_page this leaves the owner alone, so the frame stays pageable */
+ void page_unpin(paddr_t pa){
+    unsigned cm_idx = (pa - first_paddr) / PAGE_SIZE;
+    KASSERT(cm_idx < total_pages);
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(coremap[cm_idx].refcount > 1);
+    coremap[cm_idx].refcount--;
+    spinlock_release(&coremap_lock);
+ }
 
-        /* Found a suitable run */
-        if (run_ok) {
-            /* Mark them all allocated */
-            coremap[i].free = false; 
-            coremap[i].block_size = npages; 
+ /* 
+  * Keep the pager off the frame the entry maps for the length of a whole transfer (vm_prefault). Unlike pte_pin this
+  * leaves the refcount alone, so the page can still be written through its mapping and copy-on-write still works.
+  * With WRITE the frame must be this entry's alone, as in pte_pin; 0 means there's nothing resident to wire
+  */
+ paddr_t pte_wire(paddr_t *pte, bool write){
+    spinlock_acquire(&coremap_lock);
+    for (;;){
+        paddr_t v = *pte;
+        if (v == 0 || PTE_IS_SWAPPED(v)){
+            spinlock_release(&coremap_lock);
+            return 0;
+        }
 
-            for (unsigned j = 1; j < npages; j++) {
-                coremap[i + j].free = false;
-                coremap[i + j].block_size = 0; 
+        unsigned cm_idx = ((v & PAGE_FRAME) - first_paddr) / PAGE_SIZE;
+        KASSERT(cm_idx < total_pages);
+        if (!coremap[cm_idx].busy){
+            if (write && (coremap[cm_idx].refcount != 1 || (v & PAGE_FRAME) == zero_paddr)){
+                spinlock_release(&coremap_lock);
+                return 0;
             }
+            coremap[cm_idx].wired++;
+            coremap[cm_idx].referenced = true;
+            *pte = v & PAGE_FRAME;
+            spinlock_release(&coremap_lock);
+            return v & PAGE_FRAME;
+        }
+        wchan_sleep(busy_wchan, &coremap_lock);
+    }
+ }
 
-            /* Compute physical address of frame i */
-            paddr_t pa = first_paddr + i * PAGE_SIZE;
+ /* undo pte_wire. The frame may have been freed (and reset) since, then there's nothing to undo */
+ void page_unwire(paddr_t pa){
+    unsigned cm_idx = (pa - first_paddr) / PAGE_SIZE;
+    KASSERT(cm_idx < total_pages);
 
+    spinlock_acquire(&coremap_lock);
+    if (coremap[cm_idx].wired > 0){
+        coremap[cm_idx].wired--;
+    }
+    spinlock_release(&coremap_lock);
+ }
+
+ /* wait for the pager if needed, clear the entry and return what it held. The caller frees the frame or swap slot */
+ paddr_t pte_take(paddr_t *pte){
+    spinlock_acquire(&coremap_lock);
+    for (;;){
+        paddr_t v = *pte;
+        if (v == 0 || PTE_IS_SWAPPED(v)){
+            *pte = 0;
             spinlock_release(&coremap_lock);
+            return v;
+        }
 
-            /* Convert paddr → kseg0 virtual address */
-            return PADDR_TO_KVADDR(pa);
+        unsigned cm_idx = ((v & PAGE_FRAME) - first_paddr) / PAGE_SIZE;
+        KASSERT(cm_idx < total_pages);
+        if (!coremap[cm_idx].busy){
+            *pte = 0;
+            if (coremap[cm_idx].refcount == 1){
+                coremap[cm_idx].owner = NULL;
+            }
+            spinlock_release(&coremap_lock);
+            return v & PAGE_FRAME;
         }
+        wchan_sleep(busy_wchan, &coremap_lock);
     }
+ }
+
+ /* 
+  * vm_fault calls this at splhigh right before loading a frame into the TLB. If the pager has started on the frame
+  * since pte_get, the fault is retried; otherwise the pager's shootdown IPI can only arrive after the TLB write
+  * and will remove the entry again, so we never leave a TLB entry to a frame that is being paged out.
+  */
+ bool page_is_busy(paddr_t pa){
+    unsigned cm_idx = (pa - first_paddr) / PAGE_SIZE;
+    KASSERT(cm_idx < total_pages);
+    return coremap[cm_idx].busy;
+ }
+
+ /* record which address space and page map a private user frame, which makes it a candidate for paging out */
+ void page_setowner(paddr_t pa, struct addrspace *as, vaddr_t va){
+    unsigned cm_idx = (pa - first_paddr) / PAGE_SIZE;
+    KASSERT(cm_idx < total_pages);
 
-    /* No contiguous run available */
+    spinlock_acquire(&coremap_lock);
+    KASSERT(!coremap[cm_idx].free);
+    if (coremap[cm_idx].refcount == 1){
+        coremap[cm_idx].owner = as;
+        coremap[cm_idx].vaddr = va;
+    }
+    coremap[cm_idx].referenced = true;
     spinlock_release(&coremap_lock);
-    return 0;
+ }
+
+ /* number of frames on the buddy free lists or not set up yet (not counting magazines and the zero pool) */
+ unsigned coremap_freecount(void){
+    return CM_FREECOUNT();
+ }
+
+ /* number of frames in the pre-zeroed pool, for the menu's perf snapshot */
+ unsigned coremap_zeroedcount(void){
+    return zeropool_count;
+ }
+
+ /* 
+  * whether the level 2 table pte is in is shared by several address spaces since a fork (see as_copy), in which case
+  * the frames it maps aren't private even with a single reference. Caller holds coremap_lock
+  */
+ static bool pte_shared_locked(const paddr_t *pte){
+    unsigned cm_idx = (KVADDR_TO_PADDR((vaddr_t)pte & PAGE_FRAME) - first_paddr) / PAGE_SIZE;
+    KASSERT(cm_idx < total_pages);
+    return coremap[cm_idx].refcount > 1;
+ }
+
+ /* mark the frame at i busy for the pager (or the merge scanner) if it is a private user frame. Caller holds coremap_lock */
+ static bool pageout_grab_locked(unsigned i, struct pageout *po){
+    struct coremap_entry *e = &coremap[i];
+    if (e->free || e->owner == NULL || e->refcount != 1 || e->busy || e->block_size != 1 || e->zeroed || e->wired > 0){
+        return false;
+    }
+
+    paddr_t *l2_table = as_l2table(e->owner, e->vaddr, false);
+    KASSERT(l2_table != NULL);
+    paddr_t *pte = &l2_table[(e->vaddr >> PT_L2_SHIFT) & PT_INDEX_MASK];
+    if (pte_shared_locked(pte)){
+        return false;
+    }
+    KASSERT(*pte == (first_paddr + i * PAGE_SIZE) || *pte == ((first_paddr + i * PAGE_SIZE) | PTE_UNREF));
+    *pte |= PTE_UNREF;
+
+    e->busy = true;
+    po->pa = first_paddr + i * PAGE_SIZE;
+    po->as = e->owner;
+    po->va = e->vaddr;
+    po->evict = false;
+    return true;
+ }
+
+ /* 
+  * The pager's clock. Sweeps the hand over the coremap looking at private user frames: a frame that was referenced
+  * since the last pass gets its bit cleared (second chance), one that wasn't is chosen for eviction. Both kinds are
+  * marked busy and returned in list, because the pager must shoot down their TLB entries in either case (for the
+  * referenced ones so the next access faults and sets the bit again). Returns the number of frames in list.
+  * The owner's entry gets PTE_UNREF as well, otherwise the UTLB refill handler could load it again behind our back:
+  * while it is set, every access to the page goes through vm_fault and waits for the pager.
+  * With as set only that address space's frames are looked at, by a hand of their own so trimming one process
+  * doesn't push the global clock past everybody else's pages.
+  */
+ unsigned coremap_pageout_select(struct pageout *list, unsigned max, struct addrspace *as){
+    unsigned *hand = as == NULL ? &clock_hand : &trim_hand;
+    unsigned n = 0;
+
+    spinlock_acquire(&coremap_lock);
+    for (unsigned steps = 0; steps < init_pages && n < max; steps++){
+        unsigned i = *hand;
+        *hand = (i + 1) % init_pages;
+
+        if (as != NULL && coremap[i].owner != as){
+            continue;
+        }
+        if (!pageout_grab_locked(i, &list[n])){
+            continue;
+        }
+        list[n].evict = !coremap[i].referenced;
+        coremap[i].referenced = false;
+        n++;
+    }
+    spinlock_release(&coremap_lock);
+    return n;
+ }
+
+ /* the pager is done with a frame it didn't evict (second chance, or the write failed) */
+ void coremap_pageout_cancel(const struct pageout *po){
+    unsigned cm_idx = (po->pa - first_paddr) / PAGE_SIZE;
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(coremap[cm_idx].busy);
+    coremap[cm_idx].busy = false;
+    wchan_wakeall(busy_wchan, &coremap_lock);
+    spinlock_release(&coremap_lock);
+ }
+
+ /* 
+  * the frame's contents are safely in swap: point the owner's entry at the slot and free the frame. If a fork has
+  * shared the owner's page table meanwhile the frame stays (the entry is the child's too); this returns false and
+  * the caller gives the slot back
+  */
+ bool coremap_pageout_done(const struct pageout *po, paddr_t *pte, paddr_t newpte){
+    unsigned cm_idx = (po->pa - first_paddr) / PAGE_SIZE;
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(coremap[cm_idx].busy);
+    KASSERT((*pte & PAGE_FRAME) == po->pa);
+    if (pte_shared_locked(pte)){
+        coremap[cm_idx].busy = false;
+        wchan_wakeall(busy_wchan, &coremap_lock);
+        spinlock_release(&coremap_lock);
+        return false;
+    }
+    *pte = newpte;
+    po->as->as_stats.vs_evictions++;
+    STAT_INC(STAT_VM_PAGEOUTS);
+    coremap[cm_idx].owner = NULL;
+    coremap[cm_idx].referenced = false;
+    coremap[cm_idx].busy = false;
+    wchan_wakeall(busy_wchan, &coremap_lock);
+    spinlock_release(&coremap_lock);
+
+    /* futex waiters on the frame would never hear from a waker again, the page comes back somewhere else */
+    futex_pageout(po->pa);
+    free_page(po->pa);
+    return true;
+ }
+
+ /*
+  * Same-page merging (see pagemerge.c) uses the pager's protocol: frames it looks at are grabbed busy like the
+  * clock's, with their own hand so the two don't disturb each other's sweep, and given back with
+  * coremap_pageout_cancel. coremap_merge_grab grabs one particular frame, if it is still private.
+  */
+ unsigned coremap_merge_select(struct pageout *list, unsigned max){
+    unsigned n = 0;
+
+    spinlock_acquire(&coremap_lock);
+    for (unsigned steps = 0; steps < init_pages && n < max; steps++){
+        unsigned i = merge_hand;
+        merge_hand = (merge_hand + 1) % init_pages;
+        if (pageout_grab_locked(i, &list[n])){
+            n++;
+        }
+    }
+    spinlock_release(&coremap_lock);
+    return n;
+ }
+
+ bool coremap_merge_grab(paddr_t pa, struct pageout *po){
+    unsigned cm_idx = (pa - first_paddr) / PAGE_SIZE;
+    KASSERT(cm_idx < total_pages);
+
+    spinlock_acquire(&coremap_lock);
+    bool grabbed = cm_idx < init_pages && pageout_grab_locked(cm_idx, po);
+    spinlock_release(&coremap_lock);
+    return grabbed;
+ }
+
+ /* the scanner keeps the frame as a merged one: it takes a reference of its own and the frame stops being private */
+ void coremap_merge_keep(const struct pageout *po){
+    unsigned cm_idx = (po->pa - first_paddr) / PAGE_SIZE;
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(coremap[cm_idx].busy && coremap[cm_idx].refcount == 1);
+    coremap[cm_idx].refcount++;
+    coremap[cm_idx].owner = NULL;
+    coremap[cm_idx].busy = false;
+    wchan_wakeall(busy_wchan, &coremap_lock);
+    spinlock_release(&coremap_lock);
+ }
+
+ /* 
+  * the frame holds the same bytes as target (a merged frame or the zero page): map that instead and free the frame.
+  * The caller has already added the reference for the entry to target, and drops it again if this returns false
+  * (the page table was shared by a fork meanwhile, as in coremap_pageout_done; the frame stays)
+  */
+ bool coremap_merge_done(const struct pageout *po, paddr_t *pte, paddr_t target){
+    unsigned cm_idx = (po->pa - first_paddr) / PAGE_SIZE;
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(coremap[cm_idx].busy);
+    KASSERT((*pte & PAGE_FRAME) == po->pa);
+    if (pte_shared_locked(pte)){
+        coremap[cm_idx].busy = false;
+        wchan_wakeall(busy_wchan, &coremap_lock);
+        spinlock_release(&coremap_lock);
+        return false;
+    }
+    *pte = target;
+    coremap[cm_idx].owner = NULL;
+    coremap[cm_idx].referenced = false;
+    coremap[cm_idx].busy = false;
+    wchan_wakeall(busy_wchan, &coremap_lock);
+    spinlock_release(&coremap_lock);
+
+    futex_pageout(po->pa);
+    free_page(po->pa);
+    return true;
+ }
+
+ 
+ /* Function used to allocate contiguous physical pages (kernel might need multiple pages) */
+ /* we round npages up to a power of two, take a buddy block of that order and give back the unused tail */
+vaddr_t alloc_kpages(unsigned npages)
+{
+
+    /* Early boot core map not ready yet we use ram steal mem */
+    if (!coremap_ready){
+        paddr_t pa = ram_stealmem(npages);
+        if(pa == 0){
+            return 0;
+        }
+        return PADDR_TO_KVADDR(pa);
+    }
+
+    if (npages == 0 || npages > (1U << CM_MAX_ORDER)) {
+        return 0;
+    }
+
+    /* single pages come out of the per-cpu magazine like user pages do */
+    if (npages == 1) {
+        paddr_t pa = alloc_page();
+        return pa == 0 ? 0 : PADDR_TO_KVADDR(pa);
+    }
+    unsigned order = order_for(npages);
+
+    /* first acquire core map lock to prev concurrent access */
+    spinlock_acquire(&coremap_lock);
+
+    /* not enough free frames in total, no point in looking */
+    if (CM_FREECOUNT() < npages) {
+        spinlock_release(&coremap_lock);
+        return 0;
+    }
+
+    unsigned i = buddy_alloc(order);
+    if (i == CM_NONE) {
+        /* frames sitting in our magazine may be what's breaking up the block we need, so flush it and try again */
+        spinlock_release(&coremap_lock);
+        int spl = splhigh();
+        magazine_drain(curcpu->c_self, 0);
+        splx(spl);
+        spinlock_acquire(&coremap_lock);
+        i = buddy_alloc(order);
+    }
+    if (i == CM_NONE) {
+        /* No contiguous block available */
+        spinlock_release(&coremap_lock);
+        return 0;
+    }
+
+    /* if npages wasn't a power of two hand the frames past the end of the request straight back */
+    if (npages < (1U << order)) {
+        buddy_free_range(i + npages, (1U << order) - npages);
+    }
+    coremap[i].block_size = npages; 
+
+    /* Compute physical address of frame i */
+    paddr_t pa = first_paddr + i * PAGE_SIZE;
+
+    spinlock_release(&coremap_lock);
+
+    /* Convert paddr → kseg0 virtual address */
+    return PADDR_TO_KVADDR(pa);
 }
 
 
@@ -240,14 +1227,15 @@ void free_kpages(vaddr_t kvaddr)
     unsigned block_ln = coremap[index].block_size;
     KASSERT(block_ln > 0);
 
-    /* Free current frame, then continue freeing frames until we hit one that is already free.
-     * This makes free_kpages work even without block-size metadata.
-     */
-
-    for(unsigned i = 0; i < block_ln; i++) {
-       coremap[index + i].free = true; 
-       coremap[index + i].block_size = 0; 
+    /* single pages go back through the per-cpu magazine */
+    if (block_ln == 1) {
+        spinlock_release(&coremap_lock);
+        free_page(pa);
+        return;
     }
 
+    /* give the run back to the buddy allocator, which coalesces it with any free neighbours */
+    buddy_free_range(index, block_ln);
+
     spinlock_release(&coremap_lock);
 }
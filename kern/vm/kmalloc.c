@@ -30,7 +30,14 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <platform/maxcpus.h>
+#include <cpu.h>
+#include <current.h>
+#include <spl.h>
 #include <vm.h>
+#include <kern/kheapstats.h>
+#include "opt-kheapstats.h"
+#include "opt-kmtags.h"
 
 /*
  * Kernel malloc.
@@ -160,10 +167,10 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the pages and their freelists. In front of it
+ * each cpu keeps a magazine of free blocks per size class (see
+ * "Per-cpu magazines" below), so most kmalloc and kfree calls don't
+ * need it.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -212,6 +219,23 @@ struct kheap_root {
 
 static struct kheap_root kheaproots[NUM_PAGEREFPAGES];
 
+/*
+ * The block type (plus one, 0 means none) of each subpage page, by
+ * physical page number, so kfree can tell a block's size without
+ * searching the page lists. The same 16M limit applies; anything
+ * beyond it has no entry and goes the slow way.
+ *
+ * Entries change under kmalloc_spinlock when a page is added or
+ * removed. A block being freed keeps its page in use, so looking up
+ * the entry for it doesn't need the lock.
+ */
+
+#define KHEAP_MAXPAGES TOTAL_PAGEREFS
+
+static uint8_t kheap_pagetypes[KHEAP_MAXPAGES];
+
+#define KHEAP_PAGENUM(va) (KVADDR_TO_PADDR(va) / PAGE_SIZE)
+
 /*
  * Allocate a page to hold pagerefs.
  */
@@ -450,6 +474,19 @@ checkguardband(vaddr_t blockaddr, size_t smallerblocksize, size_t blocksize)
 #endif
 #endif
 
+/*
+ * The per-cpu magazines hide free blocks from the page freelists, so
+ * they are left out when SLOW (double free and guard band checks) or
+ * LABELS (leak dumps) want to see every block where it belongs.
+ */
+#if !defined(SLOW) && !defined(LABELS)
+#define MAGAZINES
+#endif
+
+#if CPU_KMCACHE_NSIZES != NSIZES
+#error "CPU_KMCACHE_NSIZES in cpu.h doesn't match NSIZES"
+#endif
+
 #ifdef CHECKBEEF
 /*
  * Check that a (free) block contains deadbeef as it should.
@@ -697,6 +734,153 @@ dump_subpages(unsigned generation)
 
 #endif /* LABELS */
 
+////////////////////////////////////////
+
+/*
+ * Subsystem tags (options kmtags).
+ *
+ * A subpage block carries its tag in a header of its own, inside the
+ * label and guard band if those are on, 8 bytes so the client pointer
+ * stays as aligned as it was. A whole-page allocation keeps its tag
+ * in kheap_bigtags, by first page, with the number of pages, since
+ * free_kpages doesn't say; pages beyond the table aren't counted.
+ * Entries there belong to the allocation and need no lock.
+ *
+ * The counters are per cpu and only touched at splhigh on their own
+ * cpu, like those of kheapstats. Bytes are whole blocks or pages,
+ * header included, which is what a subsystem really costs; a cpu's
+ * live bytes go negative when it frees what another allocated, but
+ * the sum over cpus (mod 2^32) is right.
+ *
+ * Without the option all of this compiles away.
+ */
+
+#if OPT_KMTAGS
+
+#define TAG_PTROFFSET 8
+#define TAG_OVERHEAD TAG_PTROFFSET
+
+static const char *const kmtag_names[KM_NTAGS] = {
+	[KM_OTHER] =	"other",
+	[KM_THREAD] =	"thread",
+	[KM_PROC] =	"proc",
+	[KM_VM] =	"vm",
+	[KM_VFS] =	"vfs",
+	[KM_BUFCACHE] =	"bufcache",
+	[KM_FS] =	"fs",
+	[KM_DEV] =	"dev",
+	[KM_NET] =	"net",
+};
+
+struct kmtag_cpucounts {
+	unsigned kt_allocs[KM_NTAGS];
+	unsigned kt_frees[KM_NTAGS];
+	unsigned kt_bytes[KM_NTAGS];	/* allocated less freed */
+};
+
+static struct kmtag_cpucounts kmtag_cpucounts[MAXCPUS];
+
+static struct {
+	uint8_t tag;
+	uint16_t npages;	/* 0 if not the start of a big allocation */
+} kheap_bigtags[KHEAP_MAXPAGES];
+
+/* Count BYTES allocated (or freed) under TAG. */
+static
+void
+kmtag_count(unsigned tag, size_t bytes, bool alloc)
+{
+	struct kmtag_cpucounts *kt;
+	int spl;
+
+	spl = splhigh();
+	kt = &kmtag_cpucounts[CURCPU_EXISTS() ? curcpu->c_number : 0];
+	if (alloc) {
+		kt->kt_allocs[tag]++;
+		kt->kt_bytes[tag] += bytes;
+	}
+	else {
+		kt->kt_frees[tag]++;
+		kt->kt_bytes[tag] -= bytes;
+	}
+	splx(spl);
+}
+
+/*
+ * Put TAG in the header of a block and return the client pointer.
+ */
+static
+void *
+establishtag(void *block, unsigned tag)
+{
+	*(uint32_t *)block = tag;
+	return (char *)block + TAG_PTROFFSET;
+}
+
+#else
+
+#define TAG_OVERHEAD 0
+#define kmtag_count(tag, bytes, alloc) ((void)(tag))
+
+#endif /* OPT_KMTAGS */
+
+/*
+ * Print each tag's live bytes and allocs and frees, at POS of BUF, as
+ * "vfs.bytes N" and so on; see stats_format.
+ */
+size_t
+kheap_formattags(char *buf, size_t len, size_t pos)
+{
+#if OPT_KMTAGS
+	unsigned tag, i, allocs, frees, bytes;
+	int n;
+
+	for (tag=0; tag<KM_NTAGS; tag++) {
+		allocs = frees = bytes = 0;
+		for (i=0; i<MAXCPUS; i++) {
+			allocs += kmtag_cpucounts[i].kt_allocs[tag];
+			frees += kmtag_cpucounts[i].kt_frees[tag];
+			bytes += kmtag_cpucounts[i].kt_bytes[tag];
+		}
+		n = snprintf(buf + (pos < len ? pos : len),
+			     pos < len ? len - pos : 0,
+			     "%s.bytes %u\n%s.allocs %u\n%s.frees %u\n",
+			     kmtag_names[tag], bytes,
+			     kmtag_names[tag], allocs,
+			     kmtag_names[tag], frees);
+		pos += n;
+	}
+#else
+	(void)buf;
+	(void)len;
+#endif
+	return pos;
+}
+
+/*
+ * Print each tag's live bytes on one line, for the menu's perf
+ * snapshot.
+ */
+void
+kheap_printtags(void)
+{
+#if OPT_KMTAGS
+	unsigned tag, i, bytes;
+
+	kprintf("kmalloc:");
+	for (tag=0; tag<KM_NTAGS; tag++) {
+		bytes = 0;
+		for (i=0; i<MAXCPUS; i++) {
+			bytes += kmtag_cpucounts[i].kt_bytes[tag];
+		}
+		kprintf(" %s %uk", kmtag_names[tag], (bytes + 1023) / 1024);
+	}
+	kprintf("\n");
+#else
+	kprintf("kmalloc: enable options kmtags for usage by tag\n");
+#endif
+}
+
 void
 kheap_nextgeneration(void)
 {
@@ -814,6 +998,206 @@ kheap_printstats(void)
 	spinlock_release(&kmalloc_spinlock);
 }
 
+/*
+ * Print, for each size class, how many pages it has and how much of
+ * them is free. Free space in pages that are partly in use can only
+ * be used for blocks of that size, so it's what the heap loses to
+ * fragmentation. Blocks in the per-cpu magazines count as in use.
+ */
+void
+kheap_printfrag(void)
+{
+	struct pageref *pr;
+	unsigned pages[NSIZES], partial[NSIZES], nfree[NSIZES];
+	unsigned i, blktype, totpages, totpartial;
+	size_t freebytes, totfree;
+
+	for (i=0; i<NSIZES; i++) {
+		pages[i] = partial[i] = nfree[i] = 0;
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		blktype = PR_BLOCKTYPE(pr);
+		KASSERT(blktype < NSIZES);
+		pages[blktype]++;
+		if (pr->nfree > 0) {
+			partial[blktype]++;
+			nfree[blktype] += pr->nfree;
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	totpages = totpartial = 0;
+	totfree = 0;
+	kprintf("size   pages  partial  blocks free  free KB\n");
+	for (i=0; i<NSIZES; i++) {
+		freebytes = nfree[i] * sizes[i];
+		kprintf("%-5lu %6u  %7u  %11u  %7lu\n",
+			(unsigned long)sizes[i], pages[i], partial[i],
+			nfree[i], (unsigned long)freebytes / 1024);
+		totpages += pages[i];
+		totpartial += partial[i];
+		totfree += freebytes;
+	}
+	kprintf("total %6u  %7u               %7lu (of %lu KB)\n",
+		totpages, totpartial, (unsigned long)totfree / 1024,
+		(unsigned long)totpages * PAGE_SIZE / 1024);
+}
+
+////////////////////////////////////////
+
+/*
+ * Per-size-class counters (options kheapstats).
+ *
+ * Class NSIZES counts whole-page allocations. The counters are kept
+ * per cpu and only touched at splhigh on their own cpu, so the
+ * magazine fast paths don't need a lock for them; before curcpu
+ * exists there is only the boot cpu, which uses slot 0. The peak is
+ * sampled under kmalloc_spinlock whenever a class goes to the page
+ * freelists or alloc_kpages, so it can miss by up to a magazine's
+ * worth of blocks per cpu.
+ *
+ * Without the option all of this compiles away.
+ */
+
+#define KHEAP_NCLASSES (NSIZES + 1)
+#define KHEAP_PAGECLASS NSIZES
+
+#if OPT_KHEAPSTATS
+
+struct kheap_cpucounts {
+	unsigned kc_allocs[KHEAP_NCLASSES];
+	unsigned kc_frees[KHEAP_NCLASSES];
+	unsigned kc_failures[KHEAP_NCLASSES];
+};
+
+static struct kheap_cpucounts kheap_cpucounts[MAXCPUS];
+static unsigned kheap_peak[KHEAP_NCLASSES];	/* protected by kmalloc_spinlock */
+
+/* Counters of the current cpu. Called at splhigh. */
+#define KHEAP_MYCOUNTS() \
+	(&kheap_cpucounts[CURCPU_EXISTS() ? curcpu->c_number : 0])
+
+/* Bump counter FIELD of class CL, at splhigh already or not. */
+#define KHEAP_COUNT_SPLHIGH(field, cl) (KHEAP_MYCOUNTS()->field[cl]++)
+#define KHEAP_COUNT(field, cl) do {		\
+		int kc_spl = splhigh();		\
+		KHEAP_COUNT_SPLHIGH(field, cl);	\
+		splx(kc_spl);			\
+	} while (0)
+
+/*
+ * Blocks of class CL allocated right now, summed over all cpus. The
+ * per-cpu differences can be negative (blocks freed on another cpu
+ * than they were allocated on) but the sum can't.
+ */
+static
+unsigned
+kheap_live(unsigned cl)
+{
+	unsigned i, live = 0;
+
+	for (i=0; i<MAXCPUS; i++) {
+		live += kheap_cpucounts[i].kc_allocs[cl] -
+			kheap_cpucounts[i].kc_frees[cl];
+	}
+	return live;
+}
+
+/* Update the peak of class CL. Called with kmalloc_spinlock held. */
+static
+void
+kheap_notepeak(unsigned cl)
+{
+	unsigned live;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	live = kheap_live(cl);
+	if (live > kheap_peak[cl]) {
+		kheap_peak[cl] = live;
+	}
+}
+
+#else
+
+#define KHEAP_COUNT_SPLHIGH(field, cl) ((void)(cl))
+#define KHEAP_COUNT(field, cl) ((void)(cl))
+#define kheap_notepeak(cl) ((void)(cl))
+
+#endif /* OPT_KHEAPSTATS */
+
+/*
+ * Copy the counters of up to MAX classes into KS. Returns the number
+ * of classes there are (0 without options kheapstats).
+ */
+unsigned
+kheap_getstats(struct kheapstats *ks, unsigned max)
+{
+#if OPT_KHEAPSTATS
+	unsigned cl, i;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (cl=0; cl<KHEAP_NCLASSES && cl<max; cl++) {
+		kheap_notepeak(cl);
+		ks[cl].ks_size = cl == KHEAP_PAGECLASS ? 0 : sizes[cl];
+		ks[cl].ks_allocs = 0;
+		ks[cl].ks_frees = 0;
+		ks[cl].ks_failures = 0;
+		for (i=0; i<MAXCPUS; i++) {
+			ks[cl].ks_allocs += kheap_cpucounts[i].kc_allocs[cl];
+			ks[cl].ks_frees += kheap_cpucounts[i].kc_frees[cl];
+			ks[cl].ks_failures +=
+				kheap_cpucounts[i].kc_failures[cl];
+		}
+		ks[cl].ks_live = ks[cl].ks_allocs - ks[cl].ks_frees;
+		ks[cl].ks_peak = kheap_peak[cl];
+	}
+	spinlock_release(&kmalloc_spinlock);
+	return KHEAP_NCLASSES;
+#else
+	(void)ks;
+	(void)max;
+	return 0;
+#endif
+}
+
+/*
+ * Print the counters. Unlike kheap_printstats this doesn't look at
+ * the heap pages at all.
+ */
+void
+kheap_printcounts(void)
+{
+	struct kheapstats ks[KHEAP_NCLASSES];
+	unsigned n, i;
+
+	n = kheap_getstats(ks, KHEAP_NCLASSES);
+	if (n == 0) {
+		kprintf("Enable options kheapstats to use this functionality.\n");
+		return;
+	}
+
+	kprintf("size     allocs      frees   live KB   peak KB  failed\n");
+	for (i=0; i<n; i++) {
+		if (ks[i].ks_size == 0) {
+			/* whole pages: live and peak are allocations */
+			kprintf("pages %9u  %9u  %8u* %8u* %7u\n",
+				ks[i].ks_allocs, ks[i].ks_frees,
+				ks[i].ks_live, ks[i].ks_peak,
+				ks[i].ks_failures);
+			continue;
+		}
+		kprintf("%-5lu %9u  %9u  %8lu  %8lu  %7u\n",
+			(unsigned long)ks[i].ks_size,
+			ks[i].ks_allocs, ks[i].ks_frees,
+			(unsigned long)(ks[i].ks_live * ks[i].ks_size) / 1024,
+			(unsigned long)(ks[i].ks_peak * ks[i].ks_size) / 1024,
+			ks[i].ks_failures);
+	}
+	kprintf("(* = allocations, not KB)\n");
+}
+
 ////////////////////////////////////////
 
 /*
@@ -866,13 +1250,255 @@ int blocktype(size_t clientsz)
 	return 0;
 }
 
+/*
+ * Look up the block type of the subpage page the block at PTRADDR is
+ * on in kheap_pagetypes. Returns -1 if it isn't a subpage page, or
+ * KHEAP_UNKNOWN if the page is beyond what the table covers.
+ */
+#define KHEAP_UNKNOWN NSIZES
+
+static
+int
+kheap_blocktype(vaddr_t ptraddr)
+{
+	vaddr_t pagenum = KHEAP_PAGENUM(ptraddr);
+
+	if (pagenum >= KHEAP_MAXPAGES) {
+		return KHEAP_UNKNOWN;
+	}
+	return (int)kheap_pagetypes[pagenum] - 1;
+}
+
+/*
+ * Record the block type of a subpage page (-1 when it stops being
+ * one). Called with kmalloc_spinlock held.
+ */
+static
+void
+kheap_setblocktype(vaddr_t prpage, int blktype)
+{
+	vaddr_t pagenum = KHEAP_PAGENUM(prpage);
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	if (pagenum < KHEAP_MAXPAGES) {
+		kheap_pagetypes[pagenum] = blktype + 1;
+	}
+}
+
+/*
+ * Find the pageref of the subpage page the block at PTRADDR is on,
+ * or NULL if it isn't on any of our pages.
+ */
+static
+struct pageref *
+subpage_findpage(vaddr_t ptraddr)
+{
+	struct pageref *pr;	// pageref we're looking at
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	int blktype;		// PR_BLOCKTYPE(pr)
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	for (pr = allbase; pr; pr = pr->next_all) {
+		prpage = PR_PAGEADDR(pr);
+		blktype = PR_BLOCKTYPE(pr);
+
+		/* check for corruption */
+		KASSERT(blktype>=0 && blktype<NSIZES);
+		checksubpage(pr);
+
+		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
+			return pr;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Put the (already checked and deadbeefed) block at PTRADDR back on
+ * the freelist of its page PR. If that frees the whole page, the page
+ * is taken off the lists and its address returned; the caller must
+ * then free_kpages it after releasing kmalloc_spinlock. Otherwise
+ * returns 0.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, vaddr_t ptraddr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = ptraddr - prpage;
+	KASSERT(offset < PAGE_SIZE && offset % sizes[blktype] == 0);
+
+	/*
+	 * We probably ought to check for free twice by seeing if the block
+	 * is already on the free list. But that's expensive, so we don't.
+	 */
+
+	fl = (struct freelist *)ptraddr;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = NULL;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+
+		/* this block should not already be on the free list! */
+#ifdef SLOW
+		{
+			struct freelist *fl2;
+
+			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+				KASSERT(fl2 != fl);
+			}
+		}
+#else
+		/* check just the head */
+		KASSERT(fl != fl->next);
+#endif
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+
+	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+		/* Whole page is free. */
+		remove_lists(pr, blktype);
+		freepageref(pr);
+		kheap_setblocktype(prpage, -1);
+		return prpage;
+	}
+	return 0;
+}
+
+#ifdef MAGAZINES
+
+/*
+ * Per-cpu magazines.
+ *
+ * Each cpu keeps up to CPU_KMCACHE_SIZE free blocks of each size in
+ * c_kmcache[]. kmalloc and kfree work out of the local magazine with
+ * interrupts off (so we can't be switched to another cpu halfway
+ * through) and only take kmalloc_spinlock to move KMCACHE_BATCH
+ * blocks at a time between a magazine and the page freelists. As far
+ * as their pages are concerned, blocks in a magazine are allocated;
+ * they have already been checked and deadbeefed by kfree.
+ */
+
+#define KMCACHE_BATCH (CPU_KMCACHE_SIZE / 2)
+
+/*
+ * Take up to KMCACHE_BATCH free blocks of type BLKTYPE off the page
+ * freelists into C's magazine. Called at splhigh.
+ */
+static
+void
+kmcache_refill(struct cpu *c, unsigned blktype)
+{
+	struct pageref *pr;	// pageref for page we're taking blocks from
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	struct freelist *fl;	// free list entry
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
+
+	for (pr = sizebases[blktype];
+	     pr != NULL && c->c_nkmcache[blktype] < KMCACHE_BATCH;
+	     pr = pr->next_samesize) {
+
+		/* check for corruption */
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		checksubpage(pr);
+
+		prpage = PR_PAGEADDR(pr);
+		while (pr->nfree > 0 && c->c_nkmcache[blktype] < KMCACHE_BATCH) {
+			KASSERT(pr->freelist_offset < PAGE_SIZE);
+			fl = (struct freelist *)(prpage + pr->freelist_offset);
+			pr->nfree--;
+
+			if (fl->next != NULL) {
+				KASSERT(pr->nfree > 0);
+				KASSERT((vaddr_t)fl->next - prpage < PAGE_SIZE);
+				pr->freelist_offset = (vaddr_t)fl->next - prpage;
+			}
+			else {
+				KASSERT(pr->nfree == 0);
+				pr->freelist_offset = INVALID_OFFSET;
+			}
+			c->c_kmcache[blktype][c->c_nkmcache[blktype]++] = fl;
+		}
+	}
+
+	checksubpages();
+
+	kheap_notepeak(blktype);
+	spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Put the oldest blocks of type BLKTYPE in C's magazine back on their
+ * pages until only KEEP are left, releasing pages that become free.
+ * Called at splhigh.
+ */
+static
+void
+kmcache_drain(struct cpu *c, unsigned blktype, unsigned keep)
+{
+	vaddr_t freepages[CPU_KMCACHE_SIZE];
+	unsigned nfreepages = 0;
+	unsigned ndrain, i;
+	struct pageref *pr;
+	vaddr_t block, page;
+
+	KASSERT(c->c_nkmcache[blktype] > keep);
+	ndrain = c->c_nkmcache[blktype] - keep;
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
+
+	for (i=0; i<ndrain; i++) {
+		block = (vaddr_t)c->c_kmcache[blktype][i];
+		pr = subpage_findpage(block);
+		KASSERT(pr != NULL);
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		page = subpage_putblock(pr, block);
+		if (page != 0) {
+			freepages[nfreepages++] = page;
+		}
+	}
+
+	checksubpages();
+
+	spinlock_release(&kmalloc_spinlock);
+
+	/* the newest blocks stay, they are the most likely to be in the cache */
+	for (i=0; i<keep; i++) {
+		c->c_kmcache[blktype][i] = c->c_kmcache[blktype][ndrain + i];
+	}
+	c->c_nkmcache[blktype] = keep;
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+}
+
+#endif /* MAGAZINES */
+
 /*
  * Allocate a block of size SZ, where SZ is not large enough to
  * warrant a whole-page allocation.
  */
 static
 void *
-subpage_kmalloc(size_t sz
+subpage_kmalloc(size_t sz, unsigned tag
 #ifdef LABELS
 		, vaddr_t label
 #endif
@@ -901,10 +1527,46 @@ subpage_kmalloc(size_t sz
 	clientsz += LABEL_PTROFFSET;
 #endif
 	sz += LABEL_PTROFFSET;
+#endif
+#if OPT_KMTAGS
+#ifdef GUARDS
+	clientsz += TAG_PTROFFSET;
+#endif
+	sz += TAG_PTROFFSET;
 #endif
 	blktype = blocktype(sz);
 	sz = sizes[blktype];
 
+#ifdef MAGAZINES
+	if (CURCPU_EXISTS()) {
+		struct cpu *c;
+		int spl;
+
+		/* interrupts off so curcpu can't change while we use its magazine */
+		spl = splhigh();
+		c = curcpu->c_self;
+		if (c->c_nkmcache[blktype] == 0) {
+			kmcache_refill(c, blktype);
+		}
+		if (c->c_nkmcache[blktype] > 0) {
+			retptr = c->c_kmcache[blktype][--c->c_nkmcache[blktype]];
+			KHEAP_COUNT_SPLHIGH(kc_allocs, blktype);
+			splx(spl);
+			kmtag_count(tag, sz, true);
+#ifdef GUARDS
+			retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#if OPT_KMTAGS
+			retptr = establishtag(retptr, tag);
+#endif
+			return retptr;
+		}
+		splx(spl);
+
+		/* No free block of this size on any page; make a new page. */
+	}
+#endif
+
 	spinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
@@ -944,10 +1606,16 @@ subpage_kmalloc(size_t sz
 #ifdef LABELS
 			retptr = establishlabel(retptr, label);
 #endif
+#if OPT_KMTAGS
+			retptr = establishtag(retptr, tag);
+#endif
 
 			checksubpages();
 
+			KHEAP_COUNT(kc_allocs, blktype);
+			kheap_notepeak(blktype);
 			spinlock_release(&kmalloc_spinlock);
+			kmtag_count(tag, sz, true);
 			return retptr;
 		}
 	}
@@ -966,6 +1634,7 @@ subpage_kmalloc(size_t sz
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
+		KHEAP_COUNT(kc_failures, blktype);
 		return NULL;
 	}
 	KASSERT(prpage % PAGE_SIZE == 0);
@@ -981,11 +1650,13 @@ subpage_kmalloc(size_t sz
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
+		KHEAP_COUNT(kc_failures, blktype);
 		return NULL;
 	}
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
 	pr->nfree = PAGE_SIZE / sizes[blktype];
+	kheap_setblocktype(prpage, blktype);
 
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
@@ -1027,14 +1698,23 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
+	unsigned tag;		// whom to charge it to
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
 #endif
 
 	ptraddr = (vaddr_t)ptr;
+#if OPT_KMTAGS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/* as for GUARDS below */
+		return -1;
+	}
+	ptraddr -= TAG_PTROFFSET;
+	tag = *(uint32_t *)ptraddr;
+#else
+	tag = KM_OTHER;
+#endif
 #ifdef GUARDS
 	if (ptraddr % PAGE_SIZE == 0) {
 		/*
@@ -1059,29 +1739,57 @@ subpage_kfree(void *ptr)
 	ptraddr -= LABEL_PTROFFSET;
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
+	blktype = kheap_blocktype(ptraddr);
+	if (blktype < 0) {
+		/* Not on any of our pages - not a subpage allocation */
+		return -1;
+	}
 
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
+#ifdef MAGAZINES
+	if (blktype != KHEAP_UNKNOWN && CURCPU_EXISTS()) {
+		struct cpu *c;
+		int spl;
 
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
+		/* Check for proper positioning and alignment */
+		offset = ptraddr % PAGE_SIZE;
+		if (offset % sizes[blktype] != 0) {
+			panic("kfree: subpage free of invalid addr %p\n", ptr);
 		}
+		KASSERT(tag < KM_NTAGS);
+#ifdef GUARDS
+		blocksize = sizes[blktype];
+		smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
+		checkguardband(ptraddr, smallerblocksize, blocksize);
+#endif
+		fill_deadbeef((void *)ptraddr, sizes[blktype]);
+
+		/* into this cpu's magazine, giving half of it back first if it's full */
+		spl = splhigh();
+		c = curcpu->c_self;
+		if (c->c_nkmcache[blktype] == CPU_KMCACHE_SIZE) {
+			kmcache_drain(c, blktype,
+				      CPU_KMCACHE_SIZE - KMCACHE_BATCH);
+		}
+		c->c_kmcache[blktype][c->c_nkmcache[blktype]++] = (void *)ptraddr;
+		KHEAP_COUNT_SPLHIGH(kc_frees, blktype);
+		splx(spl);
+		kmtag_count(tag, sizes[blktype], false);
+		return 0;
 	}
+#endif
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
 
+	pr = subpage_findpage(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
 
 	offset = ptraddr - prpage;
 
@@ -1089,6 +1797,7 @@ subpage_kfree(void *ptr)
 	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
+	KASSERT(tag < KM_NTAGS);
 
 #ifdef GUARDS
 	blocksize = sizes[blktype];
@@ -1102,47 +1811,14 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef((void *)ptraddr, sizes[blktype]);
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
-
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
-
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
-
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
-		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
-	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
-
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
+	prpage = subpage_putblock(pr, ptraddr);
+	KHEAP_COUNT(kc_frees, blktype);
+	spinlock_release(&kmalloc_spinlock);
+	kmtag_count(tag, sizes[blktype], false);
+	if (prpage != 0) {
 		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
-	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -1156,27 +1832,31 @@ subpage_kfree(void *ptr)
 //
 ////////////////////////////////////////////////////////////
 
-/*
- * Allocate a block of size SZ. Redirect either to subpage_kmalloc or
- * alloc_kpages depending on how big SZ is.
- */
-void *
-kmalloc(size_t sz)
-{
-	size_t checksz;
-#ifdef LABELS
-	vaddr_t label;
-#endif
-
 #ifdef LABELS
 #ifdef __GNUC__
-	label = (vaddr_t)__builtin_return_address(0);
+#define KMALLOC_CALLER() ((vaddr_t)__builtin_return_address(0))
 #else
 #error "Don't know how to get return address with this compiler"
 #endif /* __GNUC__ */
 #endif /* LABELS */
 
-	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
+/*
+ * Allocate a block of size SZ for TAG. Redirect either to
+ * subpage_kmalloc or alloc_kpages depending on how big SZ is.
+ */
+static
+void *
+kmalloc_common(size_t sz, unsigned tag
+#ifdef LABELS
+	       , vaddr_t label
+#endif
+	)
+{
+	size_t checksz;
+
+	KASSERT(tag < KM_NTAGS);
+
+	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD + TAG_OVERHEAD;
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
@@ -1185,17 +1865,53 @@ kmalloc(size_t sz)
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
 		address = alloc_kpages(npages);
 		if (address==0) {
+			KHEAP_COUNT(kc_failures, KHEAP_PAGECLASS);
 			return NULL;
 		}
 		KASSERT(address % PAGE_SIZE == 0);
+		KHEAP_COUNT(kc_allocs, KHEAP_PAGECLASS);
+#if OPT_KHEAPSTATS
+		spinlock_acquire(&kmalloc_spinlock);
+		kheap_notepeak(KHEAP_PAGECLASS);
+		spinlock_release(&kmalloc_spinlock);
+#endif
+#if OPT_KMTAGS
+		if (KHEAP_PAGENUM(address) < KHEAP_MAXPAGES) {
+			kheap_bigtags[KHEAP_PAGENUM(address)].tag = tag;
+			kheap_bigtags[KHEAP_PAGENUM(address)].npages = npages;
+			kmtag_count(tag, npages * PAGE_SIZE, true);
+		}
+#else
+		(void)tag;
+#endif
 
 		return (void *)address;
 	}
 
 #ifdef LABELS
-	return subpage_kmalloc(sz, label);
+	return subpage_kmalloc(sz, tag, label);
 #else
-	return subpage_kmalloc(sz);
+	return subpage_kmalloc(sz, tag);
+#endif
+}
+
+void *
+kmalloc(size_t sz)
+{
+#ifdef LABELS
+	return kmalloc_common(sz, KM_OTHER, KMALLOC_CALLER());
+#else
+	return kmalloc_common(sz, KM_OTHER);
+#endif
+}
+
+void *
+kmalloc_tagged(size_t sz, unsigned tag)
+{
+#ifdef LABELS
+	return kmalloc_common(sz, tag, KMALLOC_CALLER());
+#else
+	return kmalloc_common(sz, tag);
 #endif
 }
 
@@ -1205,6 +1921,10 @@ kmalloc(size_t sz)
 void
 kfree(void *ptr)
 {
+#if OPT_KMTAGS
+	vaddr_t pagenum;
+#endif
+
 	/*
 	 * Try subpage first; if that fails, assume it's a big allocation.
 	 */
@@ -1212,6 +1932,17 @@ kfree(void *ptr)
 		return;
 	} else if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+		KHEAP_COUNT(kc_frees, KHEAP_PAGECLASS);
+#if OPT_KMTAGS
+		pagenum = KHEAP_PAGENUM((vaddr_t)ptr);
+		if (pagenum < KHEAP_MAXPAGES &&
+		    kheap_bigtags[pagenum].npages > 0) {
+			kmtag_count(kheap_bigtags[pagenum].tag,
+				    kheap_bigtags[pagenum].npages * PAGE_SIZE,
+				    false);
+			kheap_bigtags[pagenum].npages = 0;
+		}
+#endif
 		free_kpages((vaddr_t)ptr);
 	}
 }
@@ -0,0 +1,126 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <kmem_cache.h>
+
+/* 
+ * Typed object caches on top of kmalloc. Each object gets a small header in front of it, which links it on its
+ * cache's free list while it is free. That way the object itself is not touched between kmem_cache_free and the
+ * next kmem_cache_alloc: the locks, wait channels and buffers its constructor made are still there.
+ *
+ * Objects come from kmalloc (and so from this cpu's kmalloc magazine most of the time); only the free list needs
+ * the cache lock. Constructors and destructors run without it, so they can use other caches.
+ */
+struct kmem_obj {
+    struct kmem_obj *ko_next; /* next free object */
+    struct kmem_cache *ko_cache; /* the cache the object belongs to (sanity check on free) */
+};
+
+/* objects are handed out right after the header, which keeps kmalloc's 8 byte alignment */
+#define KO_OBJ(ko) ((void *)((ko) + 1))
+#define KO_HDR(obj) ((struct kmem_obj *)(obj) - 1)
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, int (*ctor)(void *), void (*dtor)(void *),
+                                     unsigned tag){
+    struct kmem_cache *kc = kmalloc(sizeof(*kc));
+    if (kc == NULL){
+        return NULL;
+    }
+
+    kc->kc_name = name;
+    kc->kc_size = size;
+    kc->kc_ctor = ctor;
+    kc->kc_dtor = dtor;
+    kc->kc_tag = tag;
+    spinlock_init(&kc->kc_lock);
+    kc->kc_free = NULL;
+    kc->kc_nfree = 0;
+    kc->kc_nlive = 0;
+    kc->kc_typesafe = false;
+    return kc;
+}
+
+/* destroy a cache from kmem_cache_create, all its objects must have been freed */
+void kmem_cache_destroy(struct kmem_cache *kc){
+    KASSERT(kc->kc_nlive == 0);
+    kmem_cache_reap(kc);
+    spinlock_cleanup(&kc->kc_lock);
+    kfree(kc);
+}
+
+/* the object really goes away: destruct it and give the memory back */
+static void kmem_obj_release(struct kmem_cache *kc, struct kmem_obj *ko){
+    if (kc->kc_dtor != NULL){
+        kc->kc_dtor(KO_OBJ(ko));
+    }
+    kfree(ko);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *kc){
+    spinlock_acquire(&kc->kc_lock);
+    struct kmem_obj *ko = kc->kc_free;
+    if (ko != NULL){
+        kc->kc_free = ko->ko_next;
+        kc->kc_nfree--;
+        kc->kc_nlive++;
+        spinlock_release(&kc->kc_lock);
+        return KO_OBJ(ko);
+    }
+    spinlock_release(&kc->kc_lock);
+
+    /* nothing cached, make a new one */
+    ko = kmalloc_tagged(sizeof(*ko) + kc->kc_size, kc->kc_tag);
+    if (ko == NULL){
+        return NULL;
+    }
+    ko->ko_next = NULL;
+    ko->ko_cache = kc;
+    if (kc->kc_ctor != NULL && kc->kc_ctor(KO_OBJ(ko))){
+        kfree(ko);
+        return NULL;
+    }
+
+    spinlock_acquire(&kc->kc_lock);
+    kc->kc_nlive++;
+    spinlock_release(&kc->kc_lock);
+    return KO_OBJ(ko);
+}
+
+void kmem_cache_free(struct kmem_cache *kc, void *obj){
+    KASSERT(obj != NULL);
+    struct kmem_obj *ko = KO_HDR(obj);
+    KASSERT(ko->ko_cache == kc);
+
+    spinlock_acquire(&kc->kc_lock);
+    KASSERT(kc->kc_nlive > 0);
+    kc->kc_nlive--;
+    if (kc->kc_nfree < KMEM_CACHE_MAXFREE || kc->kc_typesafe){
+        ko->ko_next = kc->kc_free;
+        kc->kc_free = ko;
+        kc->kc_nfree++;
+        spinlock_release(&kc->kc_lock);
+        return;
+    }
+    spinlock_release(&kc->kc_lock);
+
+    /* the cache is full */
+    kmem_obj_release(kc, ko);
+}
+
+void kmem_cache_reap(struct kmem_cache *kc){
+    if (kc->kc_typesafe){
+        return;
+    }
+
+    spinlock_acquire(&kc->kc_lock);
+    struct kmem_obj *list = kc->kc_free;
+    kc->kc_free = NULL;
+    kc->kc_nfree = 0;
+    spinlock_release(&kc->kc_lock);
+
+    while (list != NULL){
+        struct kmem_obj *ko = list;
+        list = ko->ko_next;
+        kmem_obj_release(kc, ko);
+    }
+}
@@ -0,0 +1,288 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <clock.h>
+#include <hashtab.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagemerge.h>
+
+/*
+ * Same-page merging.
+ *
+ * Forked workers tend to end up with many private pages holding the same bytes (tables they all built the same way,
+ * buffers they zeroed) which copy-on-write can't share because they were written after the fork. When it is turned
+ * on, the merge scanner thread sweeps the coremap looking for such pages and maps them all to one frame, read only,
+ * so the first write to any of them goes through the copy-on-write path in vm_fault and gets its own copy back.
+ *
+ * The scanner uses the pager's protocol (see coremap.c): it grabs a batch of private frames busy, shoots them out of
+ * the TLBs so nobody can write them while it looks, and then, for each one,
+ *   - maps the zero page instead if it is all zeroes;
+ *   - maps the merged frame with the same contents instead, if there is one;
+ *   - or otherwise remembers the frame by a hash of its contents. If a later frame has the same hash and still the
+ *     same contents, the first one becomes a merged frame and the later is mapped to it.
+ * Merged frames are in merge_stable, by hash, and that table holds a reference to each: a merged frame always looks
+ * shared, so nobody ever writes it in place and its contents can't change. Once everyone else has written their copy
+ * (or gone away) the table's reference is the only one left and the scanner frees the frame. The frames remembered
+ * in merge_unstable are only hints, since they are still private and may change or be freed at any time.
+ *
+ * Like frames shared after fork, merged frames have no owner and aren't paged out.
+ */
+
+#define MERGE_BATCH      16     /* frames grabbed at a time */
+#define MERGE_BURST      8      /* batches per burst, then the scanner sleeps */
+#define MERGE_PASS       64     /* bursts after which the unstable table is thrown away and the stable one pruned */
+#define MERGE_HASHBITS   10     /* size of the unstable table */
+
+struct mergedpage {
+    uint32_t mp_hash;
+    paddr_t mp_pa;
+};
+
+DECLHASH(mergedpage, static __UNUSED inline);
+DEFHASH(mergedpage, static __UNUSED inline);
+
+/* the scanner's: merged frames, and private frames seen once */
+static struct mergedpagehash merge_stable;
+static struct mergedpage merge_unstable[1 << MERGE_HASHBITS];
+
+/* protects merge_on and the counters */
+static struct spinlock merge_lock = SPINLOCK_INITIALIZER;
+static struct wchan *merge_wchan;   /* the scanner waits here while merging is off */
+static bool merge_on = false;
+static unsigned merge_nstable = 0;  /* merged frames in use */
+static unsigned merge_nmerged = 0;  /* frames freed by merging, ever */
+static unsigned merge_nzero = 0;    /* of which were mapped to the zero page */
+
+static bool page_iszero(paddr_t pa){
+    const uint32_t *p = (const uint32_t *)PADDR_TO_KVADDR(pa);
+    for (unsigned i = 0; i < PAGE_SIZE / sizeof(*p); i++){
+        if (p[i] != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool page_same(paddr_t a, paddr_t b){
+    const uint32_t *p = (const uint32_t *)PADDR_TO_KVADDR(a);
+    const uint32_t *q = (const uint32_t *)PADDR_TO_KVADDR(b);
+    for (unsigned i = 0; i < PAGE_SIZE / sizeof(*p); i++){
+        if (p[i] != q[i]){
+            return false;
+        }
+    }
+    return true;
+}
+
+/* the owner's page table entry for a grabbed frame (stable while the frame is busy) */
+static paddr_t *merge_pte(const struct pageout *po){
+    paddr_t *l2 = as_l2table(po->as, po->va, false);
+    KASSERT(l2 != NULL);
+    return &l2[(po->va >> PT_L2_SHIFT) & PT_INDEX_MASK];
+}
+
+static void merge_count(unsigned *counter, int n){
+    spinlock_acquire(&merge_lock);
+    *counter += n;
+    spinlock_release(&merge_lock);
+}
+
+/* map the grabbed frame po to target, which we already hold a reference to for it (or give po back as it is) */
+static bool merge_into(const struct pageout *po, paddr_t target){
+    if (!coremap_merge_done(po, merge_pte(po), target)){
+        free_page(target);
+        return false;
+    }
+    merge_count(&merge_nmerged, 1);
+    return true;
+}
+
+/* make the grabbed frame po a merged frame, by hash. False (and po still grabbed) if we're out of memory */
+static bool merge_keep(const struct pageout *po, uint32_t hash){
+    struct mergedpage *mp = kmalloc_tagged(sizeof(*mp), KM_VM);
+    if (mp == NULL){
+        return false;
+    }
+    mp->mp_hash = hash;
+    mp->mp_pa = po->pa;
+    if (mergedpagehash_add(&merge_stable, &hash, sizeof(hash), mp)){
+        kfree(mp);
+        return false;
+    }
+    coremap_merge_keep(po);
+    merge_count(&merge_nstable, 1);
+    return true;
+}
+
+/*
+ * The frame at po (grabbed, out of the TLBs) has the same hash as the private frame other we saw earlier: grab that
+ * as well and, if the two really are the same, merge them. other may be in our own batch (held says which of those
+ * we still hold), otherwise it may have changed or been freed since.
+ */
+static bool merge_pair(struct pageout *po, paddr_t other, uint32_t hash, struct pageout *batch, bool *held, unsigned n){
+    struct pageout o;
+    bool mine = false;
+    unsigned j;
+
+    for (j = 0; j < n; j++){
+        if (held[j] && batch[j].pa == other){
+            mine = true;
+            break;
+        }
+    }
+    if (!mine){
+        if (!coremap_merge_grab(other, &o)){
+            return false;
+        }
+        as_tlbshootdown(o.as, &o.va, 1);
+    }
+
+    const struct pageout *keep = mine ? &batch[j] : &o;
+    bool merged = page_same(keep->pa, po->pa) && merge_keep(keep, hash);
+    if (merged){
+        if (mine){
+            held[j] = false;
+        }
+        page_incref(other);
+        merge_into(po, other);
+    }
+    else if (!mine){
+        coremap_pageout_cancel(&o);
+    }
+    return merged;
+}
+
+/* one batch: returns whether there was anything to look at */
+static bool merge_batch(void){
+    struct pageout po[MERGE_BATCH];
+    bool held[MERGE_BATCH];
+    vaddr_t vaddrs[MERGE_BATCH];
+
+    unsigned n = coremap_merge_select(po, MERGE_BATCH);
+    for (unsigned i = 0; i < n; ){
+        struct addrspace *as = po[i].as;
+        unsigned k = 0;
+        while (i < n && po[i].as == as){
+            vaddrs[k++] = po[i++].va;
+        }
+        as_tlbshootdown(as, vaddrs, k);
+    }
+
+    for (unsigned i = 0; i < n; i++){
+        held[i] = true;
+
+        if (page_iszero(po[i].pa)){
+            held[i] = false;
+            if (merge_into(&po[i], page_zero_ref())){
+                merge_count(&merge_nzero, 1);
+            }
+            continue;
+        }
+
+        uint32_t hash = hashtab_hash((const void *)PADDR_TO_KVADDR(po[i].pa), PAGE_SIZE);
+        struct mergedpage *mp = mergedpagehash_get(&merge_stable, &hash, sizeof(hash));
+        if (mp != NULL){
+            /* if the contents differ this is a hash collision, and the frame just stays private */
+            if (page_same(mp->mp_pa, po[i].pa)){
+                held[i] = false;
+                page_incref(mp->mp_pa);
+                merge_into(&po[i], mp->mp_pa);
+            }
+            continue;
+        }
+
+        struct mergedpage *u = &merge_unstable[hash & ((1 << MERGE_HASHBITS) - 1)];
+        if (u->mp_pa != 0 && u->mp_hash == hash && u->mp_pa != po[i].pa){
+            if (merge_pair(&po[i], u->mp_pa, hash, po, held, i)){
+                held[i] = false;
+                u->mp_pa = 0;
+                continue;
+            }
+        }
+        u->mp_hash = hash;
+        u->mp_pa = po[i].pa;
+    }
+
+    for (unsigned i = 0; i < n; i++){
+        if (held[i]){
+            coremap_pageout_cancel(&po[i]);
+        }
+    }
+    return n > 0;
+}
+
+/* free the merged frames nobody maps any more (the table's reference is the only one left) */
+static void merge_prune(void){
+    struct hashtab_iter it;
+    struct mergedpage *mp;
+
+    mergedpagehash_iter_init(&it, &merge_stable);
+    while ((mp = mergedpagehash_iter_next(&it)) != NULL){
+        if (!page_is_shared(mp->mp_pa)){
+            mergedpagehash_remove(&merge_stable, &mp->mp_hash, sizeof(mp->mp_hash));
+            free_page(mp->mp_pa);
+            kfree(mp);
+            merge_count(&merge_nstable, -1);
+        }
+    }
+}
+
+static void merge_thread(void *unused1, unsigned long unused2){
+    (void)unused1;
+    (void)unused2;
+
+    for (unsigned burst = 0; ; burst++){
+        spinlock_acquire(&merge_lock);
+        while (!merge_on){
+            wchan_sleep(merge_wchan, &merge_lock);
+        }
+        spinlock_release(&merge_lock);
+
+        for (unsigned b = 0; b < MERGE_BURST; b++){
+            if (!merge_batch()){
+                break;
+            }
+        }
+
+        if (burst % MERGE_PASS == MERGE_PASS - 1){
+            bzero(merge_unstable, sizeof(merge_unstable));
+            merge_prune();
+        }
+        clocksleep(1);
+    }
+}
+
+void pagemerge_enable(bool on){
+    spinlock_acquire(&merge_lock);
+    merge_on = on;
+    wchan_wakeall(merge_wchan, &merge_lock);
+    spinlock_release(&merge_lock);
+}
+
+void pagemerge_dump(void){
+    spinlock_acquire(&merge_lock);
+    bool on = merge_on;
+    unsigned nstable = merge_nstable, nmerged = merge_nmerged, nzero = merge_nzero;
+    spinlock_release(&merge_lock);
+
+    kprintf("Page merging %s: %u merged frames, %u pages merged (%u into the zero page)\n",
+            on ? "on" : "off", nstable, nmerged, nzero);
+}
+
+void pagemerge_bootstrap(void){
+    mergedpagehash_init(&merge_stable);
+    merge_wchan = wchan_create("pagemerge");
+    if (merge_wchan == NULL){
+        panic("pagemerge_bootstrap: out of memory\n");
+    }
+
+    int result = thread_fork("pagemerge", NULL, merge_thread, NULL, 0);
+    if (result){
+        panic("pagemerge_bootstrap: could not start the scanner: %s\n", strerror(result));
+    }
+}
@@ -0,0 +1,216 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/shm.h>
+#include <lib.h>
+#include <atomic.h>
+#include <synch.h>
+#include <hashtab.h>
+#include <radix.h>
+#include <coremap.h>
+#include <swap.h>
+#include <vm.h>
+#include <shm.h>
+
+struct shmseg {
+    volatile unsigned refcount;
+    int id;             /* 0 for anonymous segments and once removed */
+    int key;            /* IPC_PRIVATE if it has none */
+    size_t npages;
+    struct lock *lock;  /* frames: two first touches of a page must get the same one */
+    paddr_t *frames;    /* 0 for pages nobody has touched yet */
+};
+
+DECLHASH(shmseg, static __UNUSED inline);
+DEFHASH(shmseg, static __UNUSED inline);
+DECLRADIX(shmseg, static __UNUSED inline);
+DEFRADIX(shmseg, static __UNUSED inline);
+
+/* the segments shmget made, by key and by id (both hold the id's one reference), and the next id to give out */
+static struct lock *shm_tablelock;
+static struct shmseghash shm_bykey;
+static struct shmsegradix shm_byid;
+static int shm_nextid = 1;
+
+void shm_bootstrap(void){
+    shm_tablelock = lock_create("shm");
+    if (shm_tablelock == NULL){
+        panic("shm_bootstrap: Out of memory\n");
+    }
+    shmseghash_init(&shm_bykey);
+    shmsegradix_init(&shm_byid);
+}
+
+int shm_create(size_t npages, struct shmseg **ret){
+    KASSERT(npages > 0);
+
+    struct shmseg *seg = kmalloc_tagged(sizeof(*seg), KM_VM);
+    if (seg == NULL){
+        return ENOMEM;
+    }
+    seg->frames = kmalloc_tagged(npages * sizeof(paddr_t), KM_VM);
+    if (seg->frames == NULL){
+        kfree(seg);
+        return ENOMEM;
+    }
+    seg->lock = lock_create("shmseg");
+    if (seg->lock == NULL){
+        kfree(seg->frames);
+        kfree(seg);
+        return ENOMEM;
+    }
+    for (size_t i = 0; i < npages; i++){
+        seg->frames[i] = 0;
+    }
+    seg->refcount = 1;
+    seg->id = 0;
+    seg->key = IPC_PRIVATE;
+    seg->npages = npages;
+
+    *ret = seg;
+    return 0;
+}
+
+void shm_incref(struct shmseg *seg){
+    atomic_add(&seg->refcount, 1);
+}
+
+/* the last reference: nothing maps the frames any more, so ours are the last ones too */
+void shm_decref(struct shmseg *seg){
+    if (!atomic_dec_and_test(&seg->refcount)){
+        return;
+    }
+    KASSERT(seg->id == 0);
+    for (size_t i = 0; i < seg->npages; i++){
+        if (seg->frames[i] != 0){
+            free_page(seg->frames[i]);
+        }
+    }
+    lock_destroy(seg->lock);
+    kfree(seg->frames);
+    kfree(seg);
+}
+
+size_t shm_npages(const struct shmseg *seg){
+    return seg->npages;
+}
+
+int shm_getpage(struct shmseg *seg, size_t index, paddr_t *ret){
+    KASSERT(index < seg->npages);
+
+    lock_acquire(seg->lock);
+    paddr_t pa = seg->frames[index];
+    if (pa == 0){
+        pa = alloc_user_page(true);
+        if (pa == 0){
+            lock_release(seg->lock);
+            return ENOMEM;
+        }
+        seg->frames[index] = pa;
+    }
+    page_incref(pa);
+    lock_release(seg->lock);
+
+    *ret = pa;
+    return 0;
+}
+
+int shm_get(int key, size_t size, int flags, int *id){
+    struct shmseg *seg;
+    int result;
+
+    lock_acquire(shm_tablelock);
+
+    seg = (key == IPC_PRIVATE) ? NULL : shmseghash_get(&shm_bykey, &key, sizeof(key));
+    if (seg != NULL){
+        if ((flags & IPC_CREAT) && (flags & IPC_EXCL)){
+            result = EEXIST;
+        }
+        else if (size > seg->npages * PAGE_SIZE){
+            result = EINVAL;
+        }
+        else {
+            *id = seg->id;
+            result = 0;
+        }
+        lock_release(shm_tablelock);
+        return result;
+    }
+
+    if (key != IPC_PRIVATE && !(flags & IPC_CREAT)){
+        lock_release(shm_tablelock);
+        return ENOENT;
+    }
+    if (size == 0){
+        lock_release(shm_tablelock);
+        return EINVAL;
+    }
+
+    result = shm_create((size + PAGE_SIZE - 1) / PAGE_SIZE, &seg);
+    if (result){
+        lock_release(shm_tablelock);
+        return result;
+    }
+    seg->id = shm_nextid;
+    seg->key = key;
+
+    /* the creation reference becomes the id's */
+    result = shmsegradix_set(&shm_byid, seg->id, seg);
+    if (result == 0 && key != IPC_PRIVATE){
+        result = shmseghash_add(&shm_bykey, &seg->key, sizeof(seg->key), seg);
+        if (result){
+            shmsegradix_remove(&shm_byid, seg->id);
+        }
+    }
+    if (result){
+        lock_release(shm_tablelock);
+        seg->id = 0;
+        shm_decref(seg);
+        return result;
+    }
+    shm_nextid++;
+
+    *id = seg->id;
+    lock_release(shm_tablelock);
+    return 0;
+}
+
+int shm_lookup(int id, struct shmseg **ret){
+    if (id <= 0){
+        return EINVAL;
+    }
+
+    lock_acquire(shm_tablelock);
+    struct shmseg *seg = shmsegradix_get(&shm_byid, id);
+    if (seg != NULL){
+        shm_incref(seg);
+    }
+    lock_release(shm_tablelock);
+
+    if (seg == NULL){
+        return EINVAL;
+    }
+    *ret = seg;
+    return 0;
+}
+
+int shm_remove(int id){
+    if (id <= 0){
+        return EINVAL;
+    }
+
+    lock_acquire(shm_tablelock);
+    struct shmseg *seg = shmsegradix_remove(&shm_byid, id);
+    if (seg != NULL){
+        if (seg->key != IPC_PRIVATE){
+            shmseghash_remove(&shm_bykey, &seg->key, sizeof(seg->key));
+        }
+        seg->id = 0;
+    }
+    lock_release(shm_tablelock);
+
+    if (seg == NULL){
+        return EINVAL;
+    }
+    shm_decref(seg);
+    return 0;
+}
@@ -0,0 +1,375 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <kern/mempressure.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+
+/* 
+ * Swap space and the pager.
+ *
+ * The swap area is the whole of the raw disk SWAP_DEVICE, cut into page sized slots tracked by a bitmap. A private
+ * user page that gets evicted has its page table entry replaced by its slot number (see PTE_MKSWAP in addrspace.h)
+ * and vm_fault reads it back on the next touch.
+ *
+ * Eviction is done by a kernel thread, the pager, rather than by whoever runs out of memory. It wakes up when a
+ * coremap refill sees free memory under PAGER_LOW_WATER (or when an allocation actually failed) and runs the clock
+ * in coremap.c until PAGER_HIGH_WATER frames are free. The clock gives every recently referenced frame a second
+ * chance; the MIPS TLB has no reference bits, so "referenced" means vm_fault mapped it since the hand last went by,
+ * and clearing the bit also shoots the page out of the TLBs so the next access faults and sets it again.
+ * Each round picks up to PAGER_BATCH frames, shoots down their TLB entries per address space, and writes the
+ * victims that got consecutive slots with a single multi-iovec VOP_WRITE.
+ *
+ * Victims go to the compressed pool in zswap.c first, if they compress well and it has room, so most pageouts
+ * and the faults that bring them back don't touch the disk.
+ *
+ * Below the pager's watermarks there are two more things. Under PAGER_MIN_WATER, user allocations wait for a pager
+ * run before taking a frame, so the last frames are left for the kernel. And a process over its RLIMIT_RSS pages out
+ * its own frames from vm_fault (swap_trim) before it brings in more. Crossing a watermark also changes the pressure
+ * level that mempressure() reports.
+ *
+ * There are no dirty bits either, so every evicted page is written, and slots are given back as soon as the page
+ * is read in. Only frames with exactly one private mapping are candidates: copy-on-write shared frames, MAP_SHARED
+ * pages and kernel memory stay resident.
+ */
+
+#define PAGER_BATCH 16   /* frames the clock hands us per round, and so the most we write with one request */
+#define PAGER_ROUNDS 8   /* rounds per wakeup before we give the waiters whatever we managed to free */
+
+static struct vnode *swap_vn = NULL; /* NULL when there is no swap device and paging is off */
+static struct bitmap *swap_map = NULL; /* one bit per slot, set while the slot holds a page */
+static unsigned swap_nslots = 0;
+
+/* protects the bitmap and the pager's wakeup state below */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+static struct wchan *pager_wchan = NULL; /* the pager sleeps here between rounds */
+static struct wchan *memwait_wchan = NULL; /* threads whose allocation failed wait here for the pager */
+static bool pager_wanted = false; /* an allocation failed, run even if the last rounds freed nothing */
+static bool pager_stuck = false; /* the last wakeup freed nothing, so low water kicks alone won't wake us again */
+static unsigned pageout_gen = 0; /* bumped after every wakeup so waiters know the pager has been around */
+static bool pageout_progress = false; /* whether there was free memory after the last wakeup */
+static struct wchan *pressure_wchan = NULL; /* mempressure() waiters, also made without a swap device */
+static int pressure_level = MEMPRESSURE_NONE; /* the level they were last told about */
+
+/* transfer niov whole pages at slot and the slots following it */
+static int swap_rw(unsigned slot, struct iovec *iov, unsigned niov, enum uio_rw rw){
+    struct uio u;
+
+    KASSERT(slot + niov <= swap_nslots);
+
+    u.uio_iov = iov;
+    u.uio_iovcnt = niov;
+    u.uio_offset = (off_t)slot * PAGE_SIZE;
+    u.uio_resid = niov * PAGE_SIZE;
+    u.uio_segflg = UIO_SYSSPACE;
+    u.uio_rw = rw;
+    u.uio_space = NULL;
+    u.uio_flags = 0;
+
+    int result = rw == UIO_READ ? VOP_READ(swap_vn, &u) : VOP_WRITE(swap_vn, &u);
+    if (result){
+        return result;
+    }
+    if (u.uio_resid != 0){
+        return EIO;
+    }
+    return 0;
+}
+
+int swap_in(unsigned slot, paddr_t pa){
+    struct iovec iov;
+
+    KASSERT(swap_vn != NULL);
+    if (zswap_owns(slot)){
+        zswap_load(slot, pa);
+        return 0;
+    }
+    iov.iov_kbase = (void *)PADDR_TO_KVADDR(pa);
+    iov.iov_len = PAGE_SIZE;
+    return swap_rw(slot, &iov, 1, UIO_READ);
+}
+
+/* also called by pte_free_vec with coremap_lock held, so don't call into the coremap with swap_lock held */
+void swap_free(unsigned slot){
+    if (zswap_owns(slot)){
+        zswap_free(slot);
+        return;
+    }
+    spinlock_acquire(&swap_lock);
+    KASSERT(bitmap_isset(swap_map, slot));
+    bitmap_unmark(swap_map, slot);
+    spinlock_release(&swap_lock);
+}
+
+/* the owner's page table entry for a frame the clock picked (stable while the frame is busy) */
+static paddr_t *pageout_pte(const struct pageout *po){
+    paddr_t *l2 = as_l2table(po->as, po->va, false);
+    KASSERT(l2 != NULL);
+    return &l2[(po->va >> PT_L2_SHIFT) & PT_INDEX_MASK];
+}
+
+/* one turn of the clock (over as's frames only, unless it is NULL): returns the number of frames paged out */
+static unsigned pageout_batch(struct addrspace *as){
+    struct pageout po[PAGER_BATCH];
+    unsigned slots[PAGER_BATCH];
+    vaddr_t vaddrs[PAGER_BATCH];
+    struct iovec iov[PAGER_BATCH];
+
+    unsigned n = coremap_pageout_select(po, PAGER_BATCH, as);
+
+    /* 
+     * Get every picked page out of the TLBs: victims must not be written to while we copy them out, and the
+     * others have to fault on their next access to be marked referenced again. Neighbouring frames often belong
+     * to the same address space, so shoot those down together.
+     */
+    for (unsigned i = 0; i < n; ){
+        struct addrspace *owner = po[i].as;
+        unsigned k = 0;
+        while (i < n && po[i].as == owner){
+            vaddrs[k++] = po[i++].va;
+        }
+        as_tlbshootdown(owner, vaddrs, k);
+    }
+
+    /* second chance frames are done now, victims that fit in the compressed pool too; compact the rest to the front */
+    unsigned nevict = 0;
+    unsigned freed = 0;
+    for (unsigned i = 0; i < n; i++){
+        unsigned zslot;
+        if (!po[i].evict){
+            coremap_pageout_cancel(&po[i]);
+        }
+        else if (zswap_store(po[i].pa, &zslot) == 0){
+            if (coremap_pageout_done(&po[i], pageout_pte(&po[i]), PTE_MKSWAP(zslot))){
+                freed++;
+            }
+            else {
+                zswap_free(zslot);
+            }
+        }
+        else {
+            po[nevict++] = po[i];
+        }
+    }
+
+    /* get slots for them, handing back whatever doesn't fit if swap is full */
+    unsigned nslots = 0;
+    spinlock_acquire(&swap_lock);
+    while (nslots < nevict && bitmap_alloc(swap_map, &slots[nslots]) == 0){
+        nslots++;
+    }
+    spinlock_release(&swap_lock);
+    for (unsigned i = nslots; i < nevict; i++){
+        coremap_pageout_cancel(&po[i]);
+    }
+
+    /* bitmap_alloc hands out the lowest free slots, so these mostly come in runs we can write in one go */
+    unsigned start = 0;
+    while (start < nslots){
+        unsigned end = start + 1;
+        while (end < nslots && slots[end] == slots[end - 1] + 1){
+            end++;
+        }
+
+        for (unsigned k = start; k < end; k++){
+            iov[k - start].iov_kbase = (void *)PADDR_TO_KVADDR(po[k].pa);
+            iov[k - start].iov_len = PAGE_SIZE;
+        }
+        int result = swap_rw(slots[start], iov, end - start, UIO_WRITE);
+
+        for (unsigned k = start; k < end; k++){
+            if (result){
+                coremap_pageout_cancel(&po[k]);
+                swap_free(slots[k]);
+            }
+            else if (coremap_pageout_done(&po[k], pageout_pte(&po[k]), PTE_MKSWAP(slots[k]))){
+                freed++;
+            }
+            else {
+                /* a fork shared the page table while we wrote the page, it stays resident */
+                swap_free(slots[k]);
+            }
+        }
+        if (result){
+            kprintf("swap: error %d writing slots %u-%u\n", result, slots[start], slots[end - 1]);
+        }
+        start = end;
+    }
+    return freed;
+}
+
+/* 
+ * The pressure level for the free memory there is now. It goes up as soon as a watermark is crossed but only drops
+ * back once the pager's target is met, so a pager run doesn't make it flap. Caller holds swap_lock
+ */
+static void pressure_update_locked(void){
+    unsigned nfree = coremap_freecount();
+    int level;
+
+    if (nfree < PAGER_MIN_WATER){
+        level = MEMPRESSURE_CRITICAL;
+    }
+    else if (nfree < PAGER_LOW_WATER || (nfree < PAGER_HIGH_WATER && pressure_level != MEMPRESSURE_NONE)){
+        level = MEMPRESSURE_LOW;
+    }
+    else {
+        level = MEMPRESSURE_NONE;
+    }
+
+    if (level != pressure_level){
+        pressure_level = level;
+        wchan_wakeall(pressure_wchan, &swap_lock);
+    }
+}
+
+/* Body of the pager thread */
+static void pager_thread(void *unused1, unsigned long unused2){
+    (void)unused1;
+    (void)unused2;
+
+    while (1){
+        spinlock_acquire(&swap_lock);
+        while (!pager_wanted && (pager_stuck || coremap_freecount() >= PAGER_LOW_WATER)){
+            wchan_sleep(pager_wchan, &swap_lock);
+        }
+        pager_wanted = false;
+        spinlock_release(&swap_lock);
+
+        unsigned freed = 0;
+        for (unsigned round = 0; round < PAGER_ROUNDS && coremap_freecount() < PAGER_HIGH_WATER; round++){
+            freed += pageout_batch(NULL);
+        }
+
+        spinlock_acquire(&swap_lock);
+        pressure_update_locked();
+        pageout_gen++;
+        pageout_progress = freed > 0 || coremap_freecount() > 0;
+        pager_stuck = freed == 0;
+        wchan_wakeall(memwait_wchan, &swap_lock);
+        spinlock_release(&swap_lock);
+    }
+}
+
+void swap_kick(void){
+    if (pressure_wchan == NULL){
+        return;
+    }
+    spinlock_acquire(&swap_lock);
+    pressure_update_locked();
+    if (swap_vn != NULL){
+        wchan_wakeone(pager_wchan, &swap_lock);
+    }
+    spinlock_release(&swap_lock);
+}
+
+/* an allocation failed: wait for the pager to have another go. Returns false if it couldn't free anything */
+static bool swap_wait(void){
+    if (swap_vn == NULL){
+        return false;
+    }
+
+    spinlock_acquire(&swap_lock);
+    pressure_update_locked();
+    unsigned gen = pageout_gen;
+    pager_wanted = true;
+    wchan_wakeone(pager_wchan, &swap_lock);
+    while (pageout_gen == gen){
+        wchan_sleep(memwait_wchan, &swap_lock);
+    }
+    bool progress = pageout_progress;
+    spinlock_release(&swap_lock);
+    return progress;
+}
+
+paddr_t alloc_user_page(bool zeroed){
+    /* nearly out: let the pager have a go first, whether or not this allocation would still succeed */
+    if (coremap_freecount() < PAGER_MIN_WATER){
+        swap_wait();
+    }
+    while (1){
+        paddr_t pa = zeroed ? alloc_zeroed_page() : alloc_page();
+        if (pa != 0 || !swap_wait()){
+            return pa;
+        }
+    }
+}
+
+unsigned swap_trim(struct addrspace *as, unsigned max){
+    if (swap_vn == NULL){
+        return 0;
+    }
+
+    /* the first go round may only take away second chances, like the pager's */
+    unsigned freed = 0;
+    for (unsigned round = 0; round < PAGER_ROUNDS && freed < max; round++){
+        freed += pageout_batch(as);
+    }
+    return freed;
+}
+
+int swap_pressure(int seen, unsigned ticks){
+    spinlock_acquire(&swap_lock);
+    pressure_update_locked();
+    if (pressure_level == seen){
+        wchan_timedsleep(pressure_wchan, &swap_lock, ticks);
+        pressure_update_locked();
+    }
+    int level = pressure_level;
+    spinlock_release(&swap_lock);
+    return level;
+}
+
+void swap_bootstrap(void){
+    char path[] = SWAP_DEVICE; /* vfs_open scribbles on its argument */
+    struct vnode *vn;
+    struct stat st;
+
+    /* the pressure level is reported with or without swap */
+    pressure_wchan = wchan_create("mempressure");
+    if (pressure_wchan == NULL){
+        panic("swap_bootstrap: out of memory\n");
+    }
+
+    int result = vfs_open(path, O_RDWR, 0, &vn);
+    if (result){
+        kprintf("swap: no %s (error %d), paging disabled\n", SWAP_DEVICE, result);
+        return;
+    }
+
+    result = VOP_STAT(vn, &st);
+    if (result || st.st_size < PAGE_SIZE){
+        kprintf("swap: %s is unusable, paging disabled\n", SWAP_DEVICE);
+        vfs_close(vn);
+        return;
+    }
+    swap_nslots = st.st_size / PAGE_SIZE;
+
+    swap_map = bitmap_create(swap_nslots);
+    pager_wchan = wchan_create("pager");
+    memwait_wchan = wchan_create("memwait");
+    if (swap_map == NULL || pager_wchan == NULL || memwait_wchan == NULL){
+        panic("swap_bootstrap: out of memory\n");
+    }
+
+    zswap_bootstrap(swap_nslots);
+
+    /* paging is on from here (the pager and swap_kick test swap_vn) */
+    swap_vn = vn;
+    result = thread_fork("pager", NULL, pager_thread, NULL, 0);
+    if (result){
+        panic("swap_bootstrap: could not start the pager: %s\n", strerror(result));
+    }
+
+    kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
@@ -0,0 +1,175 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+
+/* 
+ * Shared text pages. Every exec of the same binary demand pages the same read only text from the same vnode, so
+ * rather than reading a private copy each time, vm_fault keeps the frames it reads for read only regions in a
+ * cache hung off the vnode, indexed by file page. The cache holds one coremap reference to each frame and every
+ * address space that maps it holds another, so the frames are copy-on-write shared like after a fork and the
+ * pager leaves them alone. A second exec only has to set up page tables.
+ *
+ * The same goes for private file mappings that aren't read only (a program's data segment, MAP_PRIVATE mmaps): a
+ * page that is read first is mapped from the cache too, and only copied when it is written, the same way. And
+ * read() on an SFS file takes what it can from the cache before going to the buffer cache (textcache_read), so
+ * pages somebody has mapped are copied from the frame that is already there.
+ *
+ * Only whole pages of file data at page aligned offsets are cached (the first and last page of a segment may be
+ * part zero fill and depend on the segment layout). The cache is dropped when the vnode is reclaimed, that is when
+ * the last process running the binary is gone, and on any write or truncate so later execs see the new file.
+ *
+ * vm_fault reads a page without any lock on the file, so the read can overlap a write, and a page read before the
+ * write (or half way through it) mustn't be cached once the write is done. Each purge bumps vn_textgen; vm_fault
+ * notes it before the read and textcache_insert doesn't cache the page if it has moved. As writes purge both before
+ * and after they change the file, a read that overlaps one always sees the second purge, or is cached in time to be
+ * dropped by it.
+ */
+struct textcache {
+    paddr_t *pages; /* frame for each page of the file, 0 if not cached */
+    unsigned npages; /* size of pages */
+};
+
+/* one lock for all the caches, it is only held for short lookups */
+static struct spinlock textcache_lock = SPINLOCK_INITIALIZER;
+
+/* return the cached frame for the page at offset with a reference added for the caller, or 0 */
+paddr_t textcache_lookup(struct vnode *vn, off_t offset){
+    KASSERT((offset & ~(off_t)PAGE_FRAME) == 0);
+    unsigned idx = offset / PAGE_SIZE;
+    paddr_t pa = 0;
+
+    spinlock_acquire(&textcache_lock);
+    struct textcache *tc = vn->vn_text;
+    if (tc != NULL && idx < tc->npages && tc->pages[idx] != 0){
+        pa = tc->pages[idx];
+        page_incref(pa);
+    }
+    spinlock_release(&textcache_lock);
+    return pa;
+}
+
+/* the purge generation, to pass to textcache_insert for a page read from now on */
+unsigned textcache_gen(struct vnode *vn){
+    spinlock_acquire(&textcache_lock);
+    unsigned gen = vn->vn_textgen;
+    spinlock_release(&textcache_lock);
+    return gen;
+}
+
+/* 
+ * vm_fault just read the page at offset into pa: keep it for the next exec. The cache takes a reference of its own.
+ * Caching is best effort, if we can't get memory for the index or someone else cached the page first, we don't;
+ * nor if the cache was purged since textcache_gen returned gen, before the read began.
+ */
+void textcache_insert(struct vnode *vn, off_t offset, paddr_t pa, unsigned gen){
+    KASSERT((offset & ~(off_t)PAGE_FRAME) == 0);
+    unsigned idx = offset / PAGE_SIZE;
+
+    spinlock_acquire(&textcache_lock);
+    while (vn->vn_textgen == gen && (vn->vn_text == NULL || idx >= vn->vn_text->npages)){
+        /* grow the index (can't kmalloc with the spinlock held, so drop it and check again afterwards) */
+        struct textcache *old = vn->vn_text;
+        unsigned oldn = old == NULL ? 0 : old->npages;
+        unsigned newn = idx + 1 > 2 * oldn ? idx + 1 : 2 * oldn;
+        spinlock_release(&textcache_lock);
+
+        struct textcache *tc = kmalloc_tagged(sizeof(struct textcache), KM_VM);
+        paddr_t *pages = kmalloc_tagged(newn * sizeof(paddr_t), KM_VM);
+        if (tc == NULL || pages == NULL){
+            kfree(tc);
+            kfree(pages);
+            return;
+        }
+        bzero(pages, newn * sizeof(paddr_t));
+        tc->pages = pages;
+        tc->npages = newn;
+
+        spinlock_acquire(&textcache_lock);
+        if (vn->vn_text != old){
+            /* somebody else resized it meanwhile, use theirs */
+            spinlock_release(&textcache_lock);
+            kfree(pages);
+            kfree(tc);
+            spinlock_acquire(&textcache_lock);
+            continue;
+        }
+        if (old != NULL){
+            memcpy(pages, old->pages, old->npages * sizeof(paddr_t));
+        }
+        vn->vn_text = tc;
+        spinlock_release(&textcache_lock);
+        if (old != NULL){
+            kfree(old->pages);
+            kfree(old);
+        }
+        spinlock_acquire(&textcache_lock);
+    }
+
+    if (vn->vn_textgen == gen && vn->vn_text->pages[idx] == 0){
+        page_incref(pa);
+        vn->vn_text->pages[idx] = pa;
+    }
+    spinlock_release(&textcache_lock);
+}
+
+/* 
+ * Move file data for uio (a read) out of the cached frames, from its offset on, until it is done or gets to a page
+ * that isn't cached; the caller reads the rest from the file. A cached page is all file data (see above), so this
+ * never reads past the end of the file.
+ */
+int textcache_read(struct vnode *vn, struct uio *uio){
+    KASSERT(uio->uio_rw == UIO_READ);
+
+    while (uio->uio_resid > 0 && vn->vn_text != NULL){
+        off_t offset = uio->uio_offset;
+        off_t pageoff = offset & (off_t)PAGE_FRAME;
+        paddr_t pa = textcache_lookup(vn, pageoff);
+        if (pa == 0){
+            break;
+        }
+
+        /* we hold a reference to the frame, so it stays even if the cache is dropped meanwhile */
+        size_t skip = offset - pageoff;
+        size_t len = PAGE_SIZE - skip;
+        if (len > uio->uio_resid){
+            len = uio->uio_resid;
+        }
+        int result = uiomove((char *)PADDR_TO_KVADDR(pa) + skip, len, uio);
+        free_page(pa);
+        if (result){
+            return result;
+        }
+    }
+    return 0;
+}
+
+void textcache_purge(struct vnode *vn){
+    /* the generation has to move even when there is nothing cached, a fault may be about to cache something */
+    spinlock_acquire(&textcache_lock);
+    struct textcache *tc = vn->vn_text;
+    vn->vn_text = NULL;
+    vn->vn_textgen++;
+    spinlock_release(&textcache_lock);
+
+    if (tc == NULL){
+        return;
+    }
+
+    /* drop the cache's references, frames still mapped by running processes stay until they are done with them */
+    for (unsigned i = 0; i < tc->npages; i++){
+        if (tc->pages[i] != 0){
+            free_page(tc->pages[i]);
+        }
+    }
+    kfree(tc->pages);
+    kfree(tc);
+}
+
+/* purge once more after a write, truncate or fallocate is done (see VOP_WRITE) and pass its result on */
+int textcache_repurge(struct vnode *vn, int result){
+    textcache_purge(vn);
+    return result;
+}
@@ -4,10 +4,22 @@
 #include <lib.h>
 #include <spl.h>
 #include <current.h>
+#include <cpu.h>
 #include <proc.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <shm.h>
 #include <mips/tlb.h>
+#include <uio.h>
+#include <vnode.h>
+#include <synch.h>
+#include <clock.h>
+#include <trace.h>
+#include <stats.h>
+#include <thread.h>
+#include <workqueue.h>
 
 
 /*
@@ -22,9 +34,291 @@
  *  L1 index selects pt_l1[l1], which points to a level-2 array of paddr_t.
  *  L2 index selects the specific page entry inside that level-2 array.
  */
-#define PT_L1_SHIFT   22
-#define PT_L2_SHIFT   12
-#define PT_INDEX_MASK 0x3ff  /* 10 bits set */
+/* (PT_L1_SHIFT, PT_L2_SHIFT and PT_INDEX_MASK are in addrspace.h) */
+
+/*
+ * TLB replacement policy: each cpu walks its TLB round-robin. The MIPS TLB keeps no reference bits, so we
+ * can't do better than FIFO without taking extra faults, and this avoids both scanning the TLB for an
+ * invalid slot (64 tlb_reads) and calling into the random device on every miss. After a flush the cursor
+ * naturally fills the empty slots first. Must be called at splhigh.
+ */
+static
+unsigned
+tlb_victim(void)
+{
+    unsigned slot = curcpu->c_tlb_victim;
+    curcpu->c_tlb_victim = (slot + 1) % NUM_TLB;
+    return slot;
+}
+
+/*
+ * Fault-around: when a real miss is resolved, vm_fault also loads up to vm_faultaround neighbouring pages that are
+ * already in the page table (and in the same region, so the permissions are the same), alternating forward and
+ * backward from the faulting page. Sequential scans then take one trap per few pages instead of one per page.
+ * Preloading only uses free TLB slots: we stop as soon as the slot the replacement policy would hand us next still
+ * holds a valid entry, so fault-around never pushes out mappings that are actually in use. 0 turns it off.
+ */
+unsigned vm_faultaround = 4;
+
+/* Called at splhigh, right after the TLB write for faultaddress. [lo, hi) are the bounds of its region */
+static
+void
+fault_around(struct addrspace *as, paddr_t *l2_table, vaddr_t faultaddress, vaddr_t lo, vaddr_t hi,
+             bool writeable, bool shared)
+{
+    unsigned loaded = 0;
+    unsigned limit = vm_faultaround < VM_FAULTAROUND_MAX ? vm_faultaround : VM_FAULTAROUND_MAX;
+    bool full = false;
+
+    for (unsigned d = 1; !full && loaded < limit && d <= limit; d++){
+        for (int dir = 0; !full && dir < 2 && loaded < limit; dir++){
+            vaddr_t va = dir == 0 ? faultaddress + d * PAGE_SIZE : faultaddress - d * PAGE_SIZE;
+
+            /* same region and the same level 2 table only (watch out for wrapping around) */
+            if (va < lo || va >= hi || (va >> PT_L1_SHIFT) != (faultaddress >> PT_L1_SHIFT)){
+                continue;
+            }
+
+            /* only pages that are really there (not swapped out, never touched, or being paged out) and that the
+             * clock doesn't want to see a reference for (PTE_UNREF) */
+            paddr_t pa = l2_table[(va >> PT_L2_SHIFT) & PT_INDEX_MASK];
+            if (pa == 0 || (pa & PTE_FLAGS) != 0 || page_is_busy(pa)){
+                continue;
+            }
+
+            /* never load a second entry for a page (a duplicate match is fatal on MIPS) */
+            uint32_t ehi = va | (as->as_asid << TLBHI_PIDSHIFT);
+            if (tlb_probe(ehi, 0) >= 0){
+                continue;
+            }
+
+            /* is the next slot free? */
+            uint32_t oldhi, oldlo;
+            unsigned slot = curcpu->c_tlb_victim;
+            tlb_read(&oldhi, &oldlo, slot);
+            if (oldlo & TLBLO_VALID){
+                full = true;
+                continue;
+            }
+            tlb_victim();
+
+            bool cow = page_is_shared(pa) && !shared;
+            uint32_t elo = pa | TLBLO_VALID | ((writeable && !cow) ? TLBLO_DIRTY : 0);
+            tlb_write(ehi, elo, slot);
+            loaded++;
+        }
+    }
+
+    /* tlb_probe and tlb_read load entryhi, put our ASID back */
+    tlb_setasid(curcpu->c_asid);
+}
+
+/*
+ * Batched copy-on-write. A child that writes its whole inherited heap after fork takes a fault per page, each a
+ * trap, a lock round trip and one page copy. So a copy-on-write break on the page right after the previous one
+ * (as_cownext) is taken as a sequential pass and vm_fault copies the next vm_cowbatch pages of the region as well,
+ * as long as they're still shared; the following fault, on the page past the batch, continues the pass. A batch of
+ * VM_COWFARM_MIN pages or more has its second half copied by the worker (workqueue.h) of an idle cpu while the
+ * faulting thread does the first half. 0 turns batching off.
+ */
+unsigned vm_cowbatch = 8;
+
+/* second half of a batch, for the helper cpu */
+struct cowfarm {
+    struct work cf_work;
+    struct semaphore *cf_done;
+    const paddr_t *cf_src;
+    const paddr_t *cf_dst;
+    unsigned cf_n;
+};
+
+static
+void
+cow_farmwork(void *arg)
+{
+    struct cowfarm *cf = arg;
+
+    for (unsigned i = 0; i < cf->cf_n; i++){
+        pagecopy((void *)PADDR_TO_KVADDR(cf->cf_dst[i]), (void *)PADDR_TO_KVADDR(cf->cf_src[i]));
+    }
+    V(cf->cf_done);
+}
+
+/* some cpu other than ours with nothing to run, or NULL (unlocked: it's only a hint) */
+static
+struct cpu *
+cow_idlecpu(void)
+{
+    struct cpu *self = curcpu->c_self;
+    unsigned n = thread_numcpus();
+
+    for (unsigned i = 0; i < n; i++){
+        struct cpu *c = thread_getcpu(i);
+        if (c != self && c->c_isidle && c->c_runcount == 0){
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Copy up to vm_cowbatch shared pages following faultaddress, whose copy-on-write vm_fault just broke, below hi
+ * (the end of its region) and in the same level 2 table, stopping at the first one that isn't shared or present.
+ * Called with as_lock held and interrupts on. Returns the address after the last page copied, for as_cownext.
+ */
+static
+vaddr_t
+cow_batch(struct addrspace *as, paddr_t *l2_table, vaddr_t faultaddress, vaddr_t hi)
+{
+    paddr_t src[VM_COWBATCH_MAX], dst[VM_COWBATCH_MAX];
+    vaddr_t vaddrs[VM_COWBATCH_MAX];
+    unsigned limit = vm_cowbatch < VM_COWBATCH_MAX ? vm_cowbatch : VM_COWBATCH_MAX;
+    unsigned n, i, half;
+    struct cowfarm cf;
+    struct cpu *helper;
+
+    for (n = 0; n < limit; n++){
+        vaddr_t va = faultaddress + (n + 1) * PAGE_SIZE;
+        if (va >= hi || va < faultaddress || (va >> PT_L1_SHIFT) != (faultaddress >> PT_L1_SHIFT)){
+            break;
+        }
+
+        /* only frames that are there and still shared with someone (not the zero page, a write zero fills that) */
+        paddr_t *pte = &l2_table[(va >> PT_L2_SHIFT) & PT_INDEX_MASK];
+        paddr_t pa = pte_get(pte);
+        if (pa == 0 || PTE_IS_SWAPPED(pa) || page_is_zero(pa) || !page_is_shared(pa)){
+            break;
+        }
+
+        /* our own reference for the copy, in case the other owner lets go first */
+        src[n] = pte_share(pte);
+        if (src[n] != pa){
+            if (src[n] != 0 && !PTE_IS_SWAPPED(src[n])){
+                free_page(src[n]);
+            }
+            break;
+        }
+        dst[n] = alloc_user_page(false);
+        if (dst[n] == 0){
+            free_page(src[n]);
+            break;
+        }
+        vaddrs[n] = va;
+    }
+    if (n == 0){
+        return faultaddress + PAGE_SIZE;
+    }
+
+    /* the frames stay mapped read only meanwhile, so the copies need no lock */
+    half = 0;
+    helper = n >= VM_COWFARM_MIN ? cow_idlecpu() : NULL;
+    if (helper != NULL){
+        cf.cf_done = sem_create("cowfarm", 0);
+        if (cf.cf_done != NULL){
+            half = n / 2;
+            cf.cf_src = src + n - half;
+            cf.cf_dst = dst + n - half;
+            cf.cf_n = half;
+            work_init(&cf.cf_work, cow_farmwork, &cf);
+            workqueue_submit_cpu(helper, &cf.cf_work);
+        }
+    }
+    for (i = 0; i < n - half; i++){
+        pagecopy((void *)PADDR_TO_KVADDR(dst[i]), (void *)PADDR_TO_KVADDR(src[i]));
+    }
+    if (half > 0){
+        P(cf.cf_done);
+        sem_destroy(cf.cf_done);
+    }
+
+    /* install the copies, unless something changed the entry meanwhile (then the copy wasn't wanted after all) */
+    for (i = 0; i < n; i++){
+        paddr_t *pte = &l2_table[(vaddrs[i] >> PT_L2_SHIFT) & PT_INDEX_MASK];
+        if (pte_get(pte) == src[i]){
+            *pte = dst[i];
+            page_setowner(dst[i], as, vaddrs[i]);
+            as->as_stats.vs_cowcopies++;
+            STAT_INC(STAT_VM_COWCOPIES);
+        }
+        else {
+            free_page(dst[i]);
+            dst[i] = 0;
+        }
+    }
+
+    /* the old frames may still be in a TLB (read only), so get rid of those entries before dropping them */
+    as_tlbshootdown(as, vaddrs, n);
+    for (i = 0; i < n; i++){
+        if (dst[i] != 0){
+            free_page(src[i]);
+        }
+        free_page(src[i]);
+    }
+    return faultaddress + (n + 1) * PAGE_SIZE;
+}
+
+/*
+ * Fill a newly touched page of a file backed region. The part of the page covered by the segment's file data is
+ * read from the vnode, the rest (bss, or the bytes before an unaligned segment start) is zeroed. The caller makes
+ * sure the page overlaps the file data.
+ */
+static
+int
+region_fill_page(struct region *r, vaddr_t va, paddr_t pa)
+{
+    vaddr_t seg_end = r->seg_vaddr + r->filesz;
+    vaddr_t start = va > r->seg_vaddr ? va : r->seg_vaddr;
+    vaddr_t end = va + PAGE_SIZE < seg_end ? va + PAGE_SIZE : seg_end;
+    char *kva = (char *)PADDR_TO_KVADDR(pa);
+    struct iovec iov;
+    struct uio u;
+
+    KASSERT(start < end);
+
+    /* zero whatever the file doesn't cover */
+    bzero(kva, start - va);
+    bzero(kva + (end - va), va + PAGE_SIZE - end);
+
+    uio_kinit(&iov, &u, kva + (start - va), end - start, r->file_offset + (start - r->seg_vaddr), UIO_READ);
+    int result = VOP_READ(r->vn, &u);
+    if (result){
+        return result;
+    }
+    if (u.uio_resid != 0){
+        /* short read, the executable must have been truncated under us */
+        kprintf("vm: short read paging in 0x%x - file truncated?\n", va);
+        return EIO;
+    }
+    return 0;
+}
+
+/* how far below USERSTACK the current process's stack may grow */
+static vaddr_t vm_stacklimit(void){
+    spinlock_acquire(&curproc->p_lock);
+    rlim_t limit = curproc->p_rlimit[RLIMIT_STACK].rlim_cur;
+    spinlock_release(&curproc->p_lock);
+    return limit < STACK_LIMIT_MAX ? (vaddr_t)limit : STACK_LIMIT_MAX;
+}
+
+/* 
+ * Hold the current process to its RLIMIT_RSS: once it has that many pages resident, page out some of its own before
+ * it gets another. The counters are read without as_lock, which is close enough for a limit. Without swap (or with
+ * nothing we may evict) the limit can't be kept and the fault goes ahead anyway.
+ */
+static void vm_rsstrim(struct addrspace *as){
+    spinlock_acquire(&curproc->p_lock);
+    rlim_t limit = curproc->p_rlimit[RLIMIT_RSS].rlim_cur;
+    spinlock_release(&curproc->p_lock);
+    if (limit == RLIM_INFINITY){
+        return;
+    }
+
+    unsigned maxpages = limit / PAGE_SIZE > 0 ? limit / PAGE_SIZE : 1;
+    unsigned resident = VMSTATS_RESIDENT(&as->as_stats);
+    if (resident >= maxpages){
+        swap_trim(as, resident - maxpages + 1);
+    }
+}
 
 /* Function that is called to handle page faults (CPU tried to access a va that is not currently in the TLB) */
 /* 
@@ -33,26 +327,39 @@
  *   2. Check whether the address is inside a valid region / heap / stack.
  *   3. Enforce permissions (e.g., VM_FAULT_READONLY).
  *   4. Look up or create the 2-level page table entry.
- *   5. Allocate a physical page on first access and zero it.
- *   6. Load the mapping into the TLB.
+ *   5. On first access read the page from the executable (file backed regions), map the shared zero page on a
+ *      read or allocate a zero filled one on a write, read it back in if the pager swapped it out, or copy a
+ *      shared (copy-on-write) page on a write.
+ *   6. Load the mapping into the TLB (read only while the page is still shared).
  */
-int vm_fault(int faulttype, vaddr_t faultaddress){
-    struct addrspace *as; 
+static int vm_fault_locked(struct addrspace *as, int faulttype, vaddr_t faultaddress){
     paddr_t paddr; 
 
 
     /* align the fault address */
     faultaddress &= PAGE_FRAME; 
 
-    /* retrieve curprocs as */
-    as = proc_getas(); 
-    if(as == NULL){
-        return EFAULT; 
+    /* count real misses (not write faults on present pages) so we can tell how well the TLB is working */
+    STAT_INC(STAT_VM_FAULTS);
+    if (faulttype != VM_FAULT_READONLY){
+        as->as_stats.vs_tlbmisses++;
+    }
+
+    /* the time page (see kern/time.h) isn't in any region or the page table: it's the kernel's, and only ever read */
+    if (faultaddress == TIMEPAGE){
+        paddr = time_pagepaddr();
+        if (paddr == 0 || faulttype != VM_FAULT_READ){
+            return EFAULT;
+        }
+        int spl = splhigh();
+        tlb_write(faultaddress | (as->as_asid << TLBHI_PIDSHIFT), paddr | TLBLO_VALID, tlb_victim());
+        splx(spl);
+        return 0;
     }
 
    
-    /* Now we will loop over each region (text, data, heap, stack) and for each region we will compute its bounds */
-    /* and check if falutaddress belongs to that region or not (if it belongs to non or its a permission fault we return segfault)*/
+    /* Now we will find the region (text, data, heap, stack) that falutaddress belongs to, as_find_region keeps this O(1) for repeated faults */
+    /* in the same segment (if it belongs to non or its a permission fault we return segfault)*/
     /* this prevents processes from reading or writing random memory */
     
     /* introduce boolean that we will set to true if the address is valid that is its inside a region */
@@ -61,22 +368,24 @@ int vm_fault(int faulttype, vaddr_t faultaddress){
     /* and a boolean that will be true if the region is writeable */
     bool writeable = false; 
 
-    struct region *r = as->regions;
-    while (r != NULL){
-         /* compute the start and end addresses of this region */
-        vaddr_t start = r->vbase;
-        vaddr_t end = r->vbase + r->npages * PAGE_SIZE; 
-
-        /* check if the fault address is within these boundaries */
-        if (faultaddress >= start && faultaddress < end){
-            in_region = true; 
-            /* While loading (load_elf), we temporarily allow writes even to text, so we OR with as->loading.*/
-            writeable = r->writeable || as->loading; 
-            break;
-        }
-        
-        r = r->next; 
+    /* bounds of whatever we found, for fault-around */
+    vaddr_t lo = 0, hi = 0;
 
+    struct region *r = as_find_region(as, faultaddress);
+    if (r != NULL){
+        /*
+         * A TLB entry can't allow writes without reads, so a region that can't be read (mmap'd PROT_NONE or
+         * PROT_WRITE alone) can't be touched at all. Executable ones count as readable, since instruction fetches
+         * fault as reads.
+         */
+        if (!r->readable && !r->executable && !as->loading){
+            return EFAULT;
+        }
+        in_region = true; 
+        /* While loading (load_elf), we temporarily allow writes even to text, so we OR with as->loading.*/
+        writeable = r->writeable || as->loading; 
+        lo = r->vbase;
+        hi = r->vbase + r->npages * PAGE_SIZE;
     }
     
     /* If not in any region, check heap and stack ranges. */
@@ -84,12 +393,20 @@ int vm_fault(int faulttype, vaddr_t faultaddress){
         if (faultaddress >= as->heap_base && faultaddress < as->heap_end) {
             in_region = true;
             writeable = true;
+            lo = as->heap_base;
+            hi = as->heap_end;
         }
 
-        /* Stack grows downward from stack_base to stack_end */
-        else if (faultaddress >= as->stack_end && faultaddress < as->stack_base){
+        /* Stack grows downward from stack_base to stack_end, and a touch below that grows it (see addrspace.h) */
+        else if (as->stack_base != 0 && faultaddress < as->stack_base &&
+                 (faultaddress >= as->stack_end || as->stack_base - faultaddress <= vm_stacklimit())){
+            if (faultaddress < as->stack_end){
+                as->stack_end = faultaddress;
+            }
             in_region = true;
             writeable = true; 
+            lo = as->stack_end;
+            hi = as->stack_base;
         }
     }
 
@@ -106,80 +423,383 @@ int vm_fault(int faulttype, vaddr_t faultaddress){
 
     /* At this point we know the address is valid and we have the right permission flags */
     /* so we use 2 level pt to find or create the mapping */
-    /* Compute the level 1 and level 2 indicies for page table look up */
-    unsigned l1 = (faultaddress >> PT_L1_SHIFT) & PT_INDEX_MASK;
+    /* Compute the level 2 index for page table look up (as_l2table does the level 1 part) */
     unsigned l2 = (faultaddress >> PT_L2_SHIFT) & PT_INDEX_MASK;
 
-    /* get or allocate the level 2 table */
-    paddr_t *l2_table = as->pt_l1[l1];
-     if (l2_table == NULL) {
-        l2_table = kmalloc(PT_L2_SIZE * sizeof(paddr_t));
-        if (l2_table == NULL) {
+    /* get or allocate the level 2 table (our own: if it is still shared since a fork, this copies it) */
+    paddr_t *l2_table = as_l2table(as, faultaddress, true);
+    if (l2_table == NULL) {
+        return ENOMEM;
+    }
+
+    /* Get physical address for this page (waiting if the pager is in the middle of writing it out) */
+    paddr = pte_get(&l2_table[l2]);
+
+    if (PTE_IS_SWAPPED(paddr)) {
+        /* The pager wrote this page to swap: read it back into a fresh frame and give up the slot */
+        unsigned slot = PTE_SWAPSLOT(paddr);
+        paddr = alloc_user_page(false);
+        if (paddr == 0) {
             return ENOMEM;
         }
-        for (unsigned i = 0; i < PT_L2_SIZE; i++) {
-            l2_table[i] = 0;
+
+        int result = swap_in(slot, paddr);
+        if (result) {
+            free_page(paddr);
+            return result;
         }
-        as->pt_l1[l1] = l2_table;
+        l2_table[l2] = paddr;
+        swap_free(slot);
+        as->as_stats.vs_pageins++;
+        STAT_INC(STAT_VM_PAGEINS);
+        as->as_stats.vs_resident++;
     }
+    else if (paddr == 0 && r != NULL && r->vn != NULL &&
+        faultaddress < r->seg_vaddr + r->filesz && faultaddress + PAGE_SIZE > r->seg_vaddr) {
+        /* First access to a page with file data behind it (demand paged executable, private mmap): read it in. */
+        /* Whole pages are shared with every other process mapping the same file through the text cache, copy on */
+        /* write if the region is writeable. The first write to a page that isn't cached yet reads a private copy */
+        /* straight away rather than caching it and copying it at once. MAP_SHARED pages are never cached */
+        off_t offset = r->file_offset + (off_t)(faultaddress - r->seg_vaddr);
+        bool cacheable = !r->shared && faultaddress >= r->seg_vaddr &&
+            faultaddress + PAGE_SIZE <= r->seg_vaddr + r->filesz && (offset & ~(off_t)PAGE_FRAME) == 0;
+        bool insert = cacheable && (!r->writeable || faulttype == VM_FAULT_READ);
+
+        paddr = cacheable ? textcache_lookup(r->vn, offset) : 0;
+        if (paddr == 0) {
+            paddr = alloc_user_page(false); 
+            if (paddr == 0) {
+                return ENOMEM; 
+            }
 
-    /* Get physical address for this page */
-    paddr = l2_table[l2];
+            /* 
+             * Don't read the file holding as_lock (see addrspace.h): let it go around the read, keeping the vnode
+             * alive ourselves, and then check the page is still wanted, the same file data in the same place and
+             * nothing mapped yet. If another thread got there first or unmapped it, the access just faults again.
+             */
+            struct region copy = *r;
+            VOP_INCREF(copy.vn);
+            lock_release(as->as_lock);
+            unsigned gen = insert ? textcache_gen(copy.vn) : 0;
+            int result = region_fill_page(&copy, faultaddress, paddr);
+            VOP_DECREF(copy.vn);
+            lock_acquire(as->as_lock);
+            if (result) {
+                free_page(paddr);
+                return result;
+            }
+
+            r = as_find_region(as, faultaddress);
+            l2_table = as_l2table(as, faultaddress, false);
+            if (r == NULL || r->vn != copy.vn || r->file_offset != copy.file_offset ||
+                r->seg_vaddr != copy.seg_vaddr || l2_table == NULL || l2_table[l2] != 0) {
+                free_page(paddr);
+                return 0;
+            }
+
+            /* a fork meanwhile may have shared the table again */
+            l2_table = as_l2table(as, faultaddress, true);
+            if (l2_table == NULL) {
+                free_page(paddr);
+                return ENOMEM;
+            }
+            writeable = r->writeable || as->loading;
+            lo = r->vbase;
+            hi = r->vbase + r->npages * PAGE_SIZE;
+            if (insert) {
+                textcache_insert(r->vn, offset, paddr, gen);
+            }
+            as->as_stats.vs_pageins++;
+            STAT_INC(STAT_VM_PAGEINS);
+        }
 
-    if (paddr == 0) {
-        /* First access: allocate a physical frame */
-        paddr = alloc_page(); 
+        /* Install this mapping in the pt */
+        l2_table[l2] = paddr; 
+        as->as_stats.vs_resident++;
+    }
+    else if (paddr == 0 && r != NULL && r->shm != NULL) {
+        /* First touch of a page of a shared memory segment: map the segment's frame, which every other address */
+        /* space mapping the segment gets too (allocated now if this is the first touch anywhere) */
+        int result = shm_getpage(r->shm, (faultaddress - r->vbase) / PAGE_SIZE, &paddr);
+        if (result) {
+            return result;
+        }
+        l2_table[l2] = paddr;
+        as->as_stats.vs_resident++;
+    }
+    else if (paddr == 0 && faulttype == VM_FAULT_READ && !(r != NULL && r->shared)) {
+        /* First access is a read: map the shared zero page, a real frame is only allocated if the page is written */
+        paddr = page_zero_ref();
+        l2_table[l2] = paddr;
+        as->as_stats.vs_resident++;
+    }
+    else if (paddr == 0) {
+        /* First access: allocate a zero filled physical frame (normally already zeroed by the pagezero thread) */
+        paddr = alloc_user_page(true); 
         if (paddr == 0) {
             return ENOMEM; 
         }
 
-        /* Zero the new page */
-        bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE); 
-
         /* Install this mapping in the pt */
         l2_table[l2] = paddr; 
+        as->as_stats.vs_zerofills++;
+        STAT_INC(STAT_VM_ZEROFILLS);
+        as->as_stats.vs_resident++;
+    }
+    else if (writeable && faulttype != VM_FAULT_READ && page_is_shared(paddr) && !(r != NULL && r->shared)){
+        /* Write to a page shared copy-on-write after fork (or the zero page): give this address space its own copy */
+        bool zero = page_is_zero(paddr);
+        paddr_t copy = alloc_user_page(zero);
+        if (copy == 0){
+            return ENOMEM;
+        }
+        if (!zero){
+            pagecopy((void *)PADDR_TO_KVADDR(copy), (void *)PADDR_TO_KVADDR(paddr));
+            as->as_stats.vs_cowcopies++;
+            STAT_INC(STAT_VM_COWCOPIES);
+        }
+        else {
+            as->as_stats.vs_zerofills++;
+            STAT_INC(STAT_VM_ZEROFILLS);
+        }
+        l2_table[l2] = copy;
+
+        /* drop our reference to the shared frame (frees it if the other owner went away meanwhile) */
+        free_page(paddr);
+        paddr = copy;
+
+        /* the page after the last one copied: a sequential pass, so copy ahead (see cow_batch) */
+        if (!zero && vm_cowbatch > 0 && faultaddress == as->as_cownext){
+            as->as_cownext = cow_batch(as, l2_table, faultaddress, hi);
+        }
+        else {
+            as->as_cownext = faultaddress + PAGE_SIZE;
+        }
+    }
+
+    if (VMSTATS_RESIDENT(&as->as_stats) > as->as_stats.vs_maxresident){
+        as->as_stats.vs_maxresident = VMSTATS_RESIDENT(&as->as_stats);
+    }
+
+    /* private pages can be paged out, so tell the coremap who maps the frame (MAP_SHARED pages stay resident) */
+    if (r == NULL || !r->shared){
+        page_setowner(paddr, as, faultaddress);
     }
 
 
     /* Now we must build the TLB entry for this new mapping. Using dumbvm naming convention ehi = vpn bits, elo = physical frame address + valid bit + dirty bit if writable */
-    uint32_t ehi = faultaddress; 
-    uint32_t elo = paddr | TLBLO_VALID | (writeable ? TLBLO_DIRTY : 0); 
+    /* ehi also carries our ASID, so tlb_probe only matches our own entries and tlb_write leaves the MMU on our ASID */
+    uint32_t ehi = faultaddress | (as->as_asid << TLBHI_PIDSHIFT); 
+    /* a page that is still shared is mapped read only so the first write comes back here to copy it (unless it is */
+    /* in a MAP_SHARED mapping, where the sharing is the point) */
+    bool cow = page_is_shared(paddr) && !(r != NULL && r->shared);
+    uint32_t elo = paddr | TLBLO_VALID | ((writeable && !cow) ? TLBLO_DIRTY : 0); 
     
 
     /* Insert this new mapping into TLB */
     int spl = splhigh(); 
 
-    for(int i = 0; i < NUM_TLB; i++){
-        uint32_t old_ehi;
-        uint32_t old_elo; 
-        tlb_read(&old_ehi, &old_elo, i); 
+    /* if the pager picked this frame since we looked it up, back off and let the access fault again */
+    if (l2_table[l2] != paddr || page_is_busy(paddr)){
+        splx(spl);
+        return 0;
+    }
 
-        if (!(old_elo & TLBLO_VALID)){
-            /* valid bit is not set so we found empty slot */
-            tlb_write(ehi, elo, i); 
-            splx(spl); 
-            return 0; 
-        }   
+    /* On a readonly fault the old (clean) entry for this page is still in the TLB, overwrite it rather than adding a duplicate */
+    if (faulttype == VM_FAULT_READONLY){
+        int existing = tlb_probe(ehi, 0);
+        if (existing >= 0){
+            tlb_write(ehi, elo, existing);
+            splx(spl);
+            return 0;
+        }
     }
 
-    /* No empty TLB entry so we need to evict an entry we will just choose a random slot */
-    int candidate = random() % NUM_TLB; 
-    tlb_write(ehi, elo, candidate); 
+    /* A real miss means there is no entry for the page, so just take the next slot the replacement policy gives us */
+    tlb_write(ehi, elo, tlb_victim()); 
+
+    /* and while we're here, the neighbours */
+    if (vm_faultaround > 0){
+        fault_around(as, l2_table, faultaddress, lo, hi, writeable, r != NULL && r->shared);
+    }
 
     splx(spl); 
     return 0; 
 
 }
 
+int vm_fault(int faulttype, vaddr_t faultaddress){
+    struct addrspace *as = proc_getas(); 
+    if (as == NULL){
+        return EFAULT; 
+    }
+
+    TRACE(TR_FAULT, faultaddress, faulttype);
+
+    /* the pager doesn't take as_lock, so neither may we while trimming */
+    vm_rsstrim(as);
+
+    /* the threads of a process fault one at a time */
+    lock_acquire(as->as_lock);
+    int result = vm_fault_locked(as, faulttype, faultaddress);
+    lock_release(as->as_lock);
+
+    TRACE(TR_FAULTDONE, faultaddress, result);
+    return result;
+}
+
+/* whether the page at va may be written by the user, by the same rules as vm_fault */
+static bool vm_writeable(struct addrspace *as, vaddr_t va){
+    struct region *r = as_find_region(as, va);
+    if (r != NULL){
+        return r->writeable || as->loading;
+    }
+    return (va >= as->heap_base && va < as->heap_end) || (va >= as->stack_end && va < as->stack_base);
+}
+
+/*
+ * uiomove's page path (see uio.h): move up to npages whole pages between the page aligned kernel buffer kbuf and the
+ * user pages from uva on, copying straight to or from the frames the page table maps instead of through copyin or
+ * copyout, which would take a TLB miss (and the fault handler) on every page and copy through the user mapping.
+ * Stops at the first page that isn't simply there to copy: not resident, swapped out, or for a write to the user
+ * (touser) a copy-on-write, zero or read only page. Those need vm_fault, so the caller falls back to copyin/copyout
+ * for them. Returns the number of pages moved.
+ */
+unsigned vm_pagemove(struct addrspace *as, vaddr_t uva, void *kbuf, unsigned npages, bool touser){
+    KASSERT(uva % PAGE_SIZE == 0 && (vaddr_t)kbuf % PAGE_SIZE == 0);
+
+    if (uva >= USERSPACETOP || npages > (USERSPACETOP - uva) / PAGE_SIZE){
+        return 0;
+    }
+    /* a thread already holding as_lock (vm_fault filling a page) gets the ordinary path */
+    if (lock_do_i_hold(as->as_lock)){
+        return 0;
+    }
+
+    /* as_lock keeps the page table and the layout still, pte_pin keeps the pager off each frame while we copy */
+    lock_acquire(as->as_lock);
+    unsigned i;
+    for (i = 0; i < npages; i++){
+        vaddr_t va = uva + i * PAGE_SIZE;
+        /* writing needs a table of our own, as in vm_fault */
+        paddr_t *l2_table = as_l2table(as, va, touser);
+        if (l2_table == NULL || (touser && !vm_writeable(as, va))){
+            break;
+        }
+        paddr_t pa = pte_pin(&l2_table[(va >> PT_L2_SHIFT) & PT_INDEX_MASK], touser);
+        if (pa == 0){
+            break;
+        }
+
+        char *kpage = (char *)kbuf + i * PAGE_SIZE;
+        if (touser){
+            pagecopy((void *)PADDR_TO_KVADDR(pa), kpage);
+        }
+        else {
+            pagecopy(kpage, (void *)PADDR_TO_KVADDR(pa));
+        }
+        page_unpin(pa);
+    }
+    lock_release(as->as_lock);
+    return i;
+}
+
+/*
+ * Fault in the pages of a user buffer before a read or write takes its filesystem locks, and wire them so the pager
+ * leaves them there until the copy is done; otherwise every page of a large buffer nobody touched yet takes its
+ * fault (zero fill, copy-on-write or swap in) in the middle of uiomove, with file->lock and maybe vfs_biglock held.
+ * Stops at the first page vm_fault wouldn't give us: the copy then finds out the usual way, error and all.
+ */
+unsigned vm_prefault(struct addrspace *as, vaddr_t uva, size_t len, bool touser, paddr_t *wired, unsigned max){
+    if (as == NULL || len == 0 || uva >= USERSPACETOP || len > USERSPACETOP - uva){
+        return 0;
+    }
+    if (lock_do_i_hold(as->as_lock)){
+        return 0;
+    }
+
+    vm_rsstrim(as);
+    lock_acquire(as->as_lock);
+    unsigned n = 0;
+    for (vaddr_t va = uva & PAGE_FRAME; va < uva + len && n < max; va += PAGE_SIZE){
+        /* what is already there only needs wiring, anything else gets the fault the copy would have taken */
+        paddr_t *l2_table = as_l2table(as, va, touser);
+        paddr_t pa = 0;
+        if (l2_table != NULL && (!touser || vm_writeable(as, va))){
+            pa = pte_wire(&l2_table[(va >> PT_L2_SHIFT) & PT_INDEX_MASK], touser);
+        }
+        if (pa == 0){
+            if (vm_fault_locked(as, touser ? VM_FAULT_WRITE : VM_FAULT_READ, va)){
+                break;
+            }
+            l2_table = as_l2table(as, va, false);
+            KASSERT(l2_table != NULL);
+            pa = pte_wire(&l2_table[(va >> PT_L2_SHIFT) & PT_INDEX_MASK], touser);
+            if (pa == 0){
+                break;
+            }
+        }
+        wired[n++] = pa;
+    }
+    lock_release(as->as_lock);
+    return n;
+}
+
+void vm_unwire(const paddr_t *wired, unsigned n){
+    for (unsigned i = 0; i < n; i++){
+        page_unwire(wired[i]);
+    }
+}
+
 void
 vm_tlbshootdown_all(void)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+    int spl = splhigh();
+    for (int i = 0; i < NUM_TLB; i++){
+        tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+    }
+    tlb_setasid(curcpu->c_asid);
+    splx(spl);
 }
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+    int spl = splhigh();
+
+    /* if the page is in our TLB replace it with an invalid entry, otherwise there is nothing to do */
+    int i = tlb_probe((ts->ts_vaddr & PAGE_FRAME) | (ts->ts_asid << TLBHI_PIDSHIFT), 0);
+    if (i >= 0){
+        tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+    }
+
+    /* the probe and write clobbered the ASID the MMU matches against */
+    tlb_setasid(curcpu->c_asid);
+    splx(spl);
+}
+
+/*
+ * Add a reaped child's counters to its parent's totals. The child has no resident pages anymore, so vs_resident goes up
+ * along with vs_evictions to leave VMSTATS_RESIDENT alone, and the maximum is the larger one rather than a sum.
+ */
+void
+vmstats_add(struct vmstats *to, const struct vmstats *from)
+{
+    to->vs_tlbmisses += from->vs_tlbmisses;
+    to->vs_zerofills += from->vs_zerofills;
+    to->vs_cowcopies += from->vs_cowcopies;
+    to->vs_pageins += from->vs_pageins;
+    to->vs_evictions += from->vs_evictions;
+    to->vs_resident += from->vs_evictions;
+    if (from->vs_maxresident > to->vs_maxresident){
+        to->vs_maxresident = from->vs_maxresident;
+    }
+}
+
+void
+vmstats_print(const char *name, const struct vmstats *vs)
+{
+    kprintf("%s: %u TLB misses, %u zero fills, %u COW copies, %u pageins, %u evictions\n",
+            name, vs->vs_tlbmisses, vs->vs_zerofills, vs->vs_cowcopies, vs->vs_pageins, vs->vs_evictions);
+    kprintf("%s: %u pages resident, %u at most\n", name, VMSTATS_RESIDENT(vs), vs->vs_maxresident);
 }
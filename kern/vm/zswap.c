@@ -0,0 +1,275 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+
+/*
+ * The compressed swap pool (see swap.c).
+ *
+ * Before the pager writes a victim to disk it tries to compress it into this pool, which is a fixed set of kernel
+ * pages taken at boot, each cut into ZSWAP_NCHUNKS chunks. A compressed page takes a run of chunks within one pool
+ * page, found through that page's mask of free chunks. Pages that are all zero take no chunks at all, and pages that
+ * don't shrink to ZSWAP_MAXCHUNKS chunks, or don't fit, go to disk as before. Reading a page back in decompresses it.
+ *
+ * Pool entries are swap slots numbered after the disk's (zswap_first on), so page table entries, swap_in and
+ * swap_free don't care where a page went. swap_free is called with coremap_lock held, so nothing here calls into
+ * the coremap after boot.
+ *
+ * The compressor is a small LZ77: a control byte under 0x80 is followed by that many plus one literal bytes, and
+ * one from 0x80 up is a copy of (c & 0x7f) + ZS_MINMATCH bytes from a two byte distance back. Matches are found by
+ * hashing each position's next four bytes into a table of the last position they were seen at.
+ */
+
+#define ZSWAP_CHUNK      128                        /* bytes */
+#define ZSWAP_NCHUNKS    (PAGE_SIZE / ZSWAP_CHUNK)  /* chunks per pool page, one mask bit each */
+#define ZSWAP_MAXCHUNKS  (ZSWAP_NCHUNKS / 2)        /* pages that don't compress at least 2:1 go to disk */
+#define ZSWAP_FRACTION   16                         /* the pool gets this fraction of the free memory at boot */
+#define ZSWAP_EPC        2                          /* entries per chunk, for zero and tiny pages */
+
+#define ZS_MINMATCH  4
+#define ZS_MAXMATCH  (0x7f + ZS_MINMATCH)
+#define ZS_MAXLIT    0x80
+#define ZS_HASHBITS  10
+
+#if ZSWAP_NCHUNKS != 32
+#error "the chunk masks are 32 bits"
+#endif
+
+struct zswap_entry {
+    uint16_t ze_page;       /* pool page */
+    uint8_t ze_first;       /* first chunk in it */
+    uint8_t ze_nchunks;     /* 0 for a page of zeroes */
+    uint16_t ze_len;        /* compressed bytes */
+};
+
+/* protects everything below */
+static struct spinlock zswap_lock = SPINLOCK_INITIALIZER;
+
+static char **zswap_pages;             /* kernel addresses of the pool pages */
+static uint32_t *zswap_chunkfree;      /* per pool page, a bit for each free chunk */
+static unsigned zswap_npages;
+static struct zswap_entry *zswap_entries;
+static struct bitmap *zswap_map;       /* entries in use */
+static unsigned zswap_nentries;
+static unsigned zswap_first;           /* slot number of entry 0 */
+
+/* the pager's scratch space (only it compresses) */
+static uint16_t zs_hash[1 << ZS_HASHBITS];
+static uint8_t zs_buf[ZSWAP_MAXCHUNKS * ZSWAP_CHUNK];
+
+static unsigned zs_hashof(const uint8_t *p){
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (v * 2654435761U) >> (32 - ZS_HASHBITS);
+}
+
+/* emit the literals src[from, to) at dst + *outp, returns false if they don't fit in max */
+static bool zs_literals(const uint8_t *src, unsigned from, unsigned to, uint8_t *dst, unsigned *outp, unsigned max){
+    unsigned out = *outp;
+    while (from < to){
+        unsigned n = to - from < ZS_MAXLIT ? to - from : ZS_MAXLIT;
+        if (out + 1 + n > max){
+            return false;
+        }
+        dst[out++] = n - 1;
+        memcpy(dst + out, src + from, n);
+        out += n;
+        from += n;
+    }
+    *outp = out;
+    return true;
+}
+
+/* compress a page into dst, returns the length or 0 if it needs more than max bytes */
+static unsigned zs_compress(const uint8_t *src, uint8_t *dst, unsigned max){
+    unsigned ip = 0, lit = 0, out = 0;
+
+    bzero(zs_hash, sizeof(zs_hash));
+    while (ip + ZS_MINMATCH <= PAGE_SIZE){
+        unsigned h = zs_hashof(src + ip);
+        unsigned cand = zs_hash[h];
+        zs_hash[h] = ip + 1;    /* 0 means nothing seen */
+
+        if (cand-- == 0 || src[cand] != src[ip] || src[cand + 1] != src[ip + 1] ||
+            src[cand + 2] != src[ip + 2] || src[cand + 3] != src[ip + 3]){
+            ip++;
+            continue;
+        }
+
+        unsigned len = ZS_MINMATCH;
+        while (ip + len < PAGE_SIZE && len < ZS_MAXMATCH && src[cand + len] == src[ip + len]){
+            len++;
+        }
+        if (!zs_literals(src, lit, ip, dst, &out, max) || out + 3 > max){
+            return 0;
+        }
+        unsigned dist = ip - cand;
+        dst[out++] = 0x80 | (len - ZS_MINMATCH);
+        dst[out++] = dist & 0xff;
+        dst[out++] = dist >> 8;
+        ip += len;
+        lit = ip;
+    }
+    if (!zs_literals(src, lit, PAGE_SIZE, dst, &out, max)){
+        return 0;
+    }
+    return out;
+}
+
+static void zs_decompress(const uint8_t *src, unsigned len, uint8_t *dst){
+    unsigned ip = 0, op = 0;
+
+    while (ip < len){
+        unsigned c = src[ip++];
+        if (c & 0x80){
+            unsigned n = (c & 0x7f) + ZS_MINMATCH;
+            unsigned dist = src[ip] | (src[ip + 1] << 8);
+            ip += 2;
+            KASSERT(dist > 0 && dist <= op && op + n <= PAGE_SIZE);
+            /* byte at a time, the copy may overlap itself */
+            for (unsigned i = 0; i < n; i++, op++){
+                dst[op] = dst[op - dist];
+            }
+        }
+        else {
+            unsigned n = c + 1;
+            KASSERT(op + n <= PAGE_SIZE);
+            memcpy(dst + op, src + ip, n);
+            ip += n;
+            op += n;
+        }
+    }
+    KASSERT(op == PAGE_SIZE);
+}
+
+static bool zs_iszero(const uint32_t *p){
+    for (unsigned i = 0; i < PAGE_SIZE / sizeof(*p); i++){
+        if (p[i] != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+/* find n free chunks in a row in some pool page and take them; false if there's no room */
+static bool zswap_alloc_chunks(unsigned n, unsigned *pagep, unsigned *firstp){
+    uint32_t want = (n == 32) ? 0xffffffff : ((1U << n) - 1);
+
+    for (unsigned p = 0; p < zswap_npages; p++){
+        uint32_t fr = zswap_chunkfree[p];
+        for (unsigned first = 0; first + n <= ZSWAP_NCHUNKS && fr != 0; first++){
+            if (((fr >> first) & want) == want){
+                zswap_chunkfree[p] &= ~(want << first);
+                *pagep = p;
+                *firstp = first;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool zswap_owns(unsigned slot){
+    return zswap_npages > 0 && slot >= zswap_first && slot < zswap_first + zswap_nentries;
+}
+
+int zswap_store(paddr_t pa, unsigned *slotp){
+    const uint8_t *src = (const uint8_t *)PADDR_TO_KVADDR(pa);
+    unsigned len = 0, nchunks = 0;
+
+    if (zswap_npages == 0){
+        return ENOSPC;
+    }
+    if (!zs_iszero((const uint32_t *)src)){
+        len = zs_compress(src, zs_buf, sizeof(zs_buf));
+        if (len == 0){
+            return EFBIG;
+        }
+        nchunks = (len + ZSWAP_CHUNK - 1) / ZSWAP_CHUNK;
+    }
+
+    unsigned idx, page = 0, first = 0;
+    spinlock_acquire(&zswap_lock);
+    if (bitmap_alloc(zswap_map, &idx)){
+        spinlock_release(&zswap_lock);
+        return ENOSPC;
+    }
+    if (nchunks > 0 && !zswap_alloc_chunks(nchunks, &page, &first)){
+        bitmap_unmark(zswap_map, idx);
+        spinlock_release(&zswap_lock);
+        return ENOSPC;
+    }
+    if (nchunks > 0){
+        memcpy(zswap_pages[page] + first * ZSWAP_CHUNK, zs_buf, len);
+    }
+    zswap_entries[idx].ze_page = page;
+    zswap_entries[idx].ze_first = first;
+    zswap_entries[idx].ze_nchunks = nchunks;
+    zswap_entries[idx].ze_len = len;
+    spinlock_release(&zswap_lock);
+
+    *slotp = zswap_first + idx;
+    return 0;
+}
+
+/* the entry can't go away under us: whoever reads a page in holds the only reference to its slot */
+void zswap_load(unsigned slot, paddr_t pa){
+    KASSERT(zswap_owns(slot));
+    const struct zswap_entry *ze = &zswap_entries[slot - zswap_first];
+    uint8_t *dst = (uint8_t *)PADDR_TO_KVADDR(pa);
+
+    if (ze->ze_nchunks == 0){
+        bzero(dst, PAGE_SIZE);
+        return;
+    }
+    zs_decompress((const uint8_t *)zswap_pages[ze->ze_page] + ze->ze_first * ZSWAP_CHUNK, ze->ze_len, dst);
+}
+
+void zswap_free(unsigned slot){
+    KASSERT(zswap_owns(slot));
+    unsigned idx = slot - zswap_first;
+    struct zswap_entry *ze = &zswap_entries[idx];
+
+    spinlock_acquire(&zswap_lock);
+    KASSERT(bitmap_isset(zswap_map, idx));
+    if (ze->ze_nchunks > 0){
+        uint32_t mask = (ze->ze_nchunks == 32) ? 0xffffffff : ((1U << ze->ze_nchunks) - 1);
+        KASSERT((zswap_chunkfree[ze->ze_page] & (mask << ze->ze_first)) == 0);
+        zswap_chunkfree[ze->ze_page] |= mask << ze->ze_first;
+    }
+    bitmap_unmark(zswap_map, idx);
+    spinlock_release(&zswap_lock);
+}
+
+void zswap_bootstrap(unsigned first){
+    unsigned npages = coremap_freecount() / ZSWAP_FRACTION;
+    if (npages == 0){
+        return;
+    }
+
+    zswap_pages = kmalloc_tagged(npages * sizeof(*zswap_pages), KM_VM);
+    zswap_chunkfree = kmalloc_tagged(npages * sizeof(*zswap_chunkfree), KM_VM);
+    zswap_nentries = npages * ZSWAP_NCHUNKS * ZSWAP_EPC;
+    zswap_entries = kmalloc_tagged(zswap_nentries * sizeof(*zswap_entries), KM_VM);
+    zswap_map = bitmap_create(zswap_nentries);
+    if (zswap_pages == NULL || zswap_chunkfree == NULL || zswap_entries == NULL || zswap_map == NULL){
+        panic("zswap_bootstrap: out of memory\n");
+    }
+
+    unsigned n;
+    for (n = 0; n < npages; n++){
+        vaddr_t va = alloc_kpages(1);
+        if (va == 0){
+            break;
+        }
+        zswap_pages[n] = (char *)va;
+        zswap_chunkfree[n] = 0xffffffff;
+    }
+
+    zswap_first = first;
+    zswap_npages = n;
+    kprintf("swap: %u page compressed pool\n", n);
+}
@@ -29,6 +29,7 @@
 
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <err.h>
 
 /*
@@ -38,33 +39,61 @@
 
 
 
+/*
+ * How much to ask the kernel to copy at once, to begin with and at
+ * most. Each time a whole chunk comes back the next request is twice
+ * as big; a short one (a line from the console, say) starts it over.
+ */
+#define CATCHUNK	(64*1024)
+#define CATCHUNK_MAX	(1024*1024)
+
+/* For copying by hand, if copy_file_range isn't there. */
+static char buf[CATCHUNK];
+
+/* Print the rest of FD with read and write. */
+static
+int
+catbyhand(int fd)
+{
+	int len, wlen, done;
+
+	while ((len = read(fd, buf, sizeof(buf)))>0) {
+		for (done = 0; done < len; done += wlen) {
+			wlen = write(STDOUT_FILENO, buf + done, len - done);
+			if (wlen<0) {
+				return -1;
+			}
+		}
+	}
+	return len;
+}
+
 /* Print a file that's already been opened. */
 static
 void
 docat(const char *name, int fd)
 {
-	char buf[1024];
-	int len, wr, wrtot;
+	int len;
+	size_t chunk;
 
 	/*
+	 * The kernel copies straight from the file to stdout for us.
 	 * As long as we get more than zero bytes, we haven't hit EOF.
 	 * Zero means EOF. Less than zero means an error occurred.
-	 * We may read less than we asked for, though, in various cases
-	 * for various reasons.
+	 * We may get less than we asked for, though, in various cases
+	 * for various reasons (a line at a time from the console, say).
 	 */
-	while ((len = read(fd, buf, sizeof(buf)))>0) {
-		/*
-		 * Likewise, we may actually write less than we attempted
-		 * to. So loop until we're done.
-		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(STDOUT_FILENO, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "stdout");
-			}
-			wrtot += wr;
+	chunk = CATCHUNK;
+	while ((len = copy_file_range(fd, STDOUT_FILENO, chunk))>0) {
+		if ((size_t)len < chunk) {
+			chunk = CATCHUNK;
 		}
+		else if (chunk < CATCHUNK_MAX) {
+			chunk *= 2;
+		}
+	}
+	if (len<0 && errno == ENOSYS) {
+		len = catbyhand(fd);
 	}
 	/*
 	 * If we got a read error, print it and exit.
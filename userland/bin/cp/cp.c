@@ -28,6 +28,7 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
 #include <err.h>
 
 /*
@@ -36,6 +37,35 @@
  */
 
 
+/*
+ * How much to ask the kernel to copy at once, to begin with and at
+ * most. Each time a whole chunk comes back the next request is twice
+ * as big, so a big file goes in a few calls.
+ */
+#define COPYCHUNK	(64*1024)
+#define COPYCHUNK_MAX	(1024*1024)
+
+/* For copying by hand, if copy_file_range isn't there. */
+static char buf[COPYCHUNK];
+
+/* Copy the rest of FROMFD to TOFD with read and write. */
+static
+int
+copybyhand(int fromfd, int tofd)
+{
+	int len, wlen, done;
+
+	while ((len = read(fromfd, buf, sizeof(buf)))>0) {
+		for (done = 0; done < len; done += wlen) {
+			wlen = write(tofd, buf + done, len - done);
+			if (wlen<0) {
+				return -1;
+			}
+		}
+	}
+	return len;
+}
+
 /* Copy one file to another. */
 static
 void
@@ -43,8 +73,8 @@ copy(const char *from, const char *to)
 {
 	int fromfd;
 	int tofd;
-	char buf[1024];
-	int len, wr, wrtot;
+	int len;
+	size_t chunk;
 
 	/*
 	 * Open the files, and give up if they won't open
@@ -59,30 +89,26 @@ copy(const char *from, const char *to)
 	}
 
 	/*
+	 * Let the kernel move the data from one file to the other,
+	 * a big chunk at a time, without bringing it out here.
 	 * As long as we get more than zero bytes, we haven't hit EOF.
 	 * Zero means EOF. Less than zero means an error occurred.
-	 * We may read less than we asked for, though, in various cases
-	 * for various reasons.
+	 * (The error may have been on either file.)
 	 */
-	while ((len = read(fromfd, buf, sizeof(buf)))>0) {
-		/*
-		 * Likewise, we may actually write less than we attempted
-		 * to. So loop until we're done.
-		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(tofd, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "%s", to);
-			}
-			wrtot += wr;
+	chunk = COPYCHUNK;
+	while ((len = copy_file_range(fromfd, tofd, chunk))>0) {
+		if ((size_t)len == chunk && chunk < COPYCHUNK_MAX) {
+			chunk *= 2;
 		}
 	}
+	if (len<0 && errno == ENOSYS) {
+		len = copybyhand(fromfd, tofd);
+	}
 	/*
 	 * If we got a read error, print it and exit.
 	 */
 	if (len<0) {
-		err(1, "%s", from);
+		err(1, "%s to %s", from, to);
 	}
 
 	if (close(fromfd) < 0) {
@@ -0,0 +1,323 @@
+/*
+ * iostat - show disk activity
+ * usage: iostat [-h] [interval [count]]
+ *
+ * Reads each disk's counters from stats:disk (see blkq.h in the
+ * kernel). The first report covers the time since boot; with an
+ * INTERVAL (seconds), more follow, each covering the time since the
+ * one before, COUNT of them in all or until interrupted. Per disk:
+ *
+ *    r/s w/s     requests per second
+ *    rkB/s wkB/s kilobytes per second
+ *    mrg/s       requests that went to the disk as part of a run
+ *    aqu         average number of requests queued or in service
+ *                when one was queued (itself counted)
+ *    svc         average time the disk took per request (ms)
+ *    util        how much of the time the disk was busy (%)
+ *
+ * -h also prints the service and latency (queueing included)
+ * histograms of the time since boot, a line per bucket that has
+ * anything in it.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <err.h>
+
+#define MAXDISKS	16
+#define NAMELEN		16
+#define NBUCKETS	24	/* BLKQ_NBUCKETS */
+
+/* The counters, in the order the kernel prints them. */
+static const char *const fields[] = {
+	"reads", "readbytes", "writes", "writebytes",
+	"merged", "inflight", "depthsum", "busyus",
+};
+#define NFIELDS (sizeof(fields) / sizeof(fields[0]))
+enum { F_READS, F_RBYTES, F_WRITES, F_WBYTES, F_MERGED, F_INFLIGHT,
+       F_DEPTHSUM, F_BUSYUS };
+
+struct disk {
+	char name[NAMELEN];
+	unsigned long long v[NFIELDS];
+	unsigned long long svc[NBUCKETS];
+	unsigned long long lat[NBUCKETS];
+};
+
+struct sample {
+	struct disk disks[MAXDISKS];
+	unsigned ndisks;
+	unsigned long long us;		/* when (since boot) */
+};
+
+static char buf[16384];
+
+static
+unsigned long long
+number(const char **sp)
+{
+	unsigned long long v = 0;
+	const char *s = *sp;
+
+	while (*s >= '0' && *s <= '9') {
+		v = v * 10 + (*s - '0');
+		s++;
+	}
+	*sp = s;
+	return v;
+}
+
+static
+struct disk *
+getdisk(struct sample *sm, const char *name, size_t len)
+{
+	unsigned i;
+
+	if (len >= NAMELEN) {
+		len = NAMELEN - 1;
+	}
+	for (i = 0; i < sm->ndisks; i++) {
+		if (strlen(sm->disks[i].name) == len &&
+		    !memcmp(sm->disks[i].name, name, len)) {
+			return &sm->disks[i];
+		}
+	}
+	if (sm->ndisks == MAXDISKS) {
+		return NULL;
+	}
+	i = sm->ndisks++;
+	memset(&sm->disks[i], 0, sizeof(sm->disks[i]));
+	memcpy(sm->disks[i].name, name, len);
+	sm->disks[i].name[len] = 0;
+	return &sm->disks[i];
+}
+
+/* Take one line, "disk.what value" or "disk.what k:n k:n ...". */
+static
+void
+parseline(struct sample *sm, const char *s, const char *end)
+{
+	const char *dot, *sp;
+	unsigned long long *hist;
+	struct disk *d;
+	size_t wlen;
+	unsigned i, k;
+
+	for (sp = s; sp < end && *sp != ' '; sp++) {
+		/* nothing */
+	}
+	if (sp == end) {
+		return;
+	}
+	/* the last dot before the space: disk names could have dots */
+	dot = NULL;
+	for (i = 0; s + i < sp; i++) {
+		if (s[i] == '.') {
+			dot = s + i;
+		}
+	}
+	if (dot == NULL) {
+		return;
+	}
+	d = getdisk(sm, s, dot - s);
+	if (d == NULL) {
+		return;
+	}
+	dot++;
+	wlen = sp - dot;
+	sp++;
+
+	if (wlen == 3 && (!memcmp(dot, "svc", 3) || !memcmp(dot, "lat", 3))) {
+		hist = dot[0] == 's' ? d->svc : d->lat;
+		while (sp < end) {
+			k = number(&sp);
+			if (*sp != ':') {
+				break;
+			}
+			sp++;
+			if (k < NBUCKETS) {
+				hist[k] = number(&sp);
+			}
+			while (*sp == ' ') {
+				sp++;
+			}
+		}
+		return;
+	}
+	for (i = 0; i < NFIELDS; i++) {
+		if (strlen(fields[i]) == wlen && !memcmp(dot, fields[i], wlen)) {
+			d->v[i] = number(&sp);
+			return;
+		}
+	}
+}
+
+static
+void
+readsample(struct sample *sm)
+{
+	struct timespec ts;
+	const char *s, *end;
+	ssize_t len, r;
+	int fd;
+
+	fd = open("stats:disk", O_RDONLY);
+	if (fd < 0) {
+		err(1, "stats:disk");
+	}
+	len = 0;
+	do {
+		r = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (r < 0) {
+			err(1, "stats:disk: read");
+		}
+		len += r;
+	} while (r > 0 && len < (ssize_t)sizeof(buf) - 1);
+	close(fd);
+	buf[len] = 0;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		err(1, "clock_gettime");
+	}
+	sm->us = (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+	sm->ndisks = 0;
+	for (s = buf; *s; s = end + 1) {
+		end = strchr(s, '\n');
+		if (end == NULL) {
+			break;
+		}
+		parseline(sm, s, end);
+	}
+}
+
+/* Print N/D to one decimal place, in a field WIDTH wide. */
+static
+void
+ratio(unsigned long long n, unsigned long long d, int width)
+{
+	char tmp[32];
+	unsigned long long x;
+
+	x = d == 0 ? 0 : (n * 10 + d / 2) / d;
+	snprintf(tmp, sizeof(tmp), "%llu.%llu", x / 10, x % 10);
+	printf(" %*s", width, tmp);
+}
+
+static
+void
+report(const struct sample *old, const struct sample *now)
+{
+	static const struct disk zero;
+	const struct disk *a, *b;
+	unsigned long long us, dv[NFIELDS], nreq;
+	unsigned i, j, f;
+
+	us = now->us - (old != NULL ? old->us : 0);
+	if (us == 0) {
+		us = 1;
+	}
+
+	printf("%-8s %7s %7s %8s %8s %6s %5s %6s %5s\n", "device",
+	       "r/s", "w/s", "rkB/s", "wkB/s", "mrg/s", "aqu", "svc", "util");
+	for (i = 0; i < now->ndisks; i++) {
+		b = &now->disks[i];
+		a = &zero;
+		for (j = 0; old != NULL && j < old->ndisks; j++) {
+			if (!strcmp(old->disks[j].name, b->name)) {
+				a = &old->disks[j];
+			}
+		}
+		for (f = 0; f < NFIELDS; f++) {
+			dv[f] = b->v[f] - a->v[f];
+		}
+		nreq = dv[F_READS] + dv[F_WRITES];
+
+		printf("%-8s", b->name);
+		ratio(dv[F_READS] * 1000000, us, 7);
+		ratio(dv[F_WRITES] * 1000000, us, 7);
+		ratio(dv[F_RBYTES] * 1000000 / 1024, us, 8);
+		ratio(dv[F_WBYTES] * 1000000 / 1024, us, 8);
+		ratio(dv[F_MERGED] * 1000000, us, 6);
+		ratio(dv[F_DEPTHSUM], nreq, 5);
+		ratio(dv[F_BUSYUS], nreq * 1000, 6);
+		ratio(dv[F_BUSYUS] * 100, us, 5);
+		printf("\n");
+	}
+}
+
+static
+void
+printhist(const char *what, const unsigned long long *hist)
+{
+	char range[24];
+	unsigned k;
+
+	for (k = 0; k < NBUCKETS; k++) {
+		if (hist[k] == 0) {
+			continue;
+		}
+		/* (bucket 0 has 0 and 1 as well) */
+		snprintf(range, sizeof(range), "%u-%uus",
+			 k == 0 ? 0 : 1U << k, 1U << (k + 1));
+		printf("  %s %12s %llu\n", what, range, hist[k]);
+	}
+}
+
+static struct sample samples[2];
+
+int
+main(int argc, char *argv[])
+{
+	struct timespec ts;
+	unsigned interval, count, n, i;
+	int hopt, cur;
+
+	hopt = 0;
+	interval = count = 0;
+	n = 0;
+	for (i = 1; i < (unsigned)argc; i++) {
+		if (!strcmp(argv[i], "-h")) {
+			hopt = 1;
+		}
+		else if (argv[i][0] == '-' || n == 2) {
+			errx(1, "Usage: iostat [-h] [interval [count]]");
+		}
+		else if (n++ == 0) {
+			interval = atoi(argv[i]);
+		}
+		else {
+			count = atoi(argv[i]);
+		}
+	}
+
+	cur = 0;
+	readsample(&samples[cur]);
+	report(NULL, &samples[cur]);
+	if (hopt) {
+		for (i = 0; i < samples[cur].ndisks; i++) {
+			printf("%s:\n", samples[cur].disks[i].name);
+			printhist("svc", samples[cur].disks[i].svc);
+			printhist("lat", samples[cur].disks[i].lat);
+		}
+	}
+	if (interval == 0) {
+		return 0;
+	}
+
+	for (n = 1; count == 0 || n < count; n++) {
+		ts.tv_sec = interval;
+		ts.tv_nsec = 0;
+		(void)nanosleep(&ts, NULL);
+		readsample(&samples[!cur]);
+		printf("\n");
+		report(&samples[cur], &samples[!cur]);
+		cur = !cur;
+	}
+	return 0;
+}
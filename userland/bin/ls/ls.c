@@ -31,6 +31,7 @@
 #include <sys/stat.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <dirent.h>
 #include <string.h>
 #include <errno.h>
 #include <err.h>
@@ -193,9 +194,10 @@ void
 listdir(const char *path, int showheader)
 {
 	int fd;
-	char buf[1024];
+	unsigned buf[1024 / sizeof(unsigned)];	/* (aligned for struct dirent) */
 	char newpath[1024];
-	ssize_t len;
+	struct dirent *d;
+	ssize_t len, pos;
 
 	if (showheader) {
 		printheader(path);
@@ -212,19 +214,22 @@ listdir(const char *path, int showheader)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	while ((len = getdirentries(fd, (char *)buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < len; pos += d->d_reclen) {
+			d = (struct dirent *)((char *)buf + pos);
 
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+			/* Assemble the full name of the new item */
+			snprintf(newpath, sizeof(newpath), "%s/%s",
+				 path, d->d_name);
 
-		if (aopt || buf[0]!='.') {
-			/* Print it */
-			print(newpath);
+			if (aopt || d->d_name[0]!='.') {
+				/* Print it */
+				print(newpath);
+			}
 		}
 	}
 	if (len<0) {
-		err(1, "%s: getdirentry", path);
+		err(1, "%s: getdirentries", path);
 	}
 
 	/* Done */
@@ -236,9 +241,10 @@ void
 recursedir(const char *path)
 {
 	int fd;
-	char buf[1024];
+	unsigned buf[1024 / sizeof(unsigned)];
 	char newpath[1024];
-	int len;
+	struct dirent *d;
+	ssize_t len, pos;
 
 	/*
 	 * Open it.
@@ -251,29 +257,35 @@ recursedir(const char *path)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	while ((len = getdirentries(fd, (char *)buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < len; pos += d->d_reclen) {
+			d = (struct dirent *)((char *)buf + pos);
 
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+			/* Assemble the full name of the new item */
+			snprintf(newpath, sizeof(newpath), "%s/%s",
+				 path, d->d_name);
 
-		if (!aopt && buf[0]=='.') {
-			/* skip this one */
-			continue;
-		}
+			if (!aopt && d->d_name[0]=='.') {
+				/* skip this one */
+				continue;
+			}
 
-		if (!strcmp(buf, ".") || !strcmp(buf, "..")) {
-			/* always skip these */
-			continue;
-		}
+			if (!strcmp(d->d_name, ".") ||
+			    !strcmp(d->d_name, "..")) {
+				/* always skip these */
+				continue;
+			}
 
-		if (!isdir(newpath)) {
-			continue;
-		}
+			/* (the type is there if it was cheap to get) */
+			if (d->d_type != DT_DIR &&
+			    (d->d_type != DT_UNKNOWN || !isdir(newpath))) {
+				continue;
+			}
 
-		listdir(newpath, 1 /*showheader*/);
-		if (Ropt) {
-			recursedir(newpath);
+			listdir(newpath, 1 /*showheader*/);
+			if (Ropt) {
+				recursedir(newpath);
+			}
 		}
 	}
 	if (len<0) {
@@ -39,6 +39,7 @@
 #include <sys/wait.h>
 #include <assert.h>
 #include <unistd.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -75,21 +76,21 @@ static pid_t bgpids[MAXBG];
 
 /*
  * can_bg
- * just checks for an open slot.
+ * just checks for N open slots.
  */
 static
 int
-can_bg(void)
+can_bg(int n)
 {
 	int i;
 
-	for (i = 0; i < MAXBG; i++) {
+	for (i = 0; i < MAXBG && n > 0; i++) {
 		if (bgpids[i] == 0) {
-			return 1;
+			n--;
 		}
 	}
 
-	return 0;
+	return n == 0;
 }
 
 /*
@@ -340,6 +341,54 @@ cmd_exit(int ac, char *av[], struct exitinfo *ei)
 	exit(code);
 }
 
+/*
+ * pwd
+ * print the current directory.
+ */
+static
+void
+cmd_pwd(int ac, char *av[], struct exitinfo *ei)
+{
+	char buf[PATH_MAX];
+
+	(void)av;
+	if (ac != 1) {
+		printf("Usage: pwd\n");
+		exitinfo_exit(ei, 1);
+		return;
+	}
+	if (getcwd(buf, sizeof(buf)) == NULL) {
+		warn("pwd");
+		exitinfo_exit(ei, 1);
+		return;
+	}
+	printf("%s\n", buf);
+	exitinfo_exit(ei, 0);
+}
+
+/*
+ * true, false
+ * by hand, because starting a process just to get an exit code of 0
+ * or 1 is silly.
+ */
+static
+void
+cmd_true(int ac, char *av[], struct exitinfo *ei)
+{
+	(void)ac;
+	(void)av;
+	exitinfo_exit(ei, 0);
+}
+
+static
+void
+cmd_false(int ac, char *av[], struct exitinfo *ei)
+{
+	(void)ac;
+	(void)av;
+	exitinfo_exit(ei, 1);
+}
+
 /*
  * a struct of the builtins associates the builtin name with the function that
  * executes it.  they must all take an argc and argv.
@@ -351,25 +400,110 @@ static struct {
 	{ "cd",    cmd_chdir },
 	{ "chdir", cmd_chdir },
 	{ "exit",  cmd_exit },
+	{ "false", cmd_false },
+	{ "pwd",   cmd_pwd },
+	{ "true",  cmd_true },
 	{ "wait",  cmd_wait },
 	{ NULL, NULL }
 };
 
+/*
+ * runpipeline
+ * starts the NSTAGES commands in STAGES with a pipe from each one's
+ * stdout to the next one's stdin, and puts their pids in PIDS. each is
+ * started with spawn rather than fork and execvp: it doesn't copy the
+ * shell only to throw the copy away, and if the program can't be run
+ * we hear about it here instead of from a child that exits 1. returns
+ * how many got started; if that's not all of them, the pipes are
+ * closed anyway, so the ones that did will finish.
+ */
+static
+int
+runpipeline(char **stages[], int nstages, pid_t pids[])
+{
+	struct spawn_action acts[5];
+	int nacts, i;
+	int prevread = -1, fds[2];
+	pid_t pid;
+
+	for (i=0; i<nstages; i++) {
+		nacts = 0;
+		fds[0] = fds[1] = -1;
+		if (i < nstages - 1 && pipe(fds) < 0) {
+			warn("pipe");
+			break;
+		}
+
+		/* hook up stdin and stdout, then close the pipes' fds */
+		if (prevread >= 0) {
+			acts[nacts].sa_op = SPAWN_DUP2;
+			acts[nacts].sa_fd = prevread;
+			acts[nacts].sa_newfd = STDIN_FILENO;
+			nacts++;
+		}
+		if (fds[1] >= 0) {
+			acts[nacts].sa_op = SPAWN_DUP2;
+			acts[nacts].sa_fd = fds[1];
+			acts[nacts].sa_newfd = STDOUT_FILENO;
+			nacts++;
+		}
+		if (prevread >= 0) {
+			acts[nacts].sa_op = SPAWN_CLOSE;
+			acts[nacts].sa_fd = prevread;
+			nacts++;
+		}
+		if (fds[0] >= 0) {
+			acts[nacts].sa_op = SPAWN_CLOSE;
+			acts[nacts].sa_fd = fds[0];
+			nacts++;
+			acts[nacts].sa_op = SPAWN_CLOSE;
+			acts[nacts].sa_fd = fds[1];
+			nacts++;
+		}
+
+		pid = spawnvp(stages[i][0], stages[i], acts, nacts);
+		if (pid < 0) {
+			warn("%s", stages[i][0]);
+		}
+
+		/* the shell keeps only the read end for the next stage */
+		if (prevread >= 0) {
+			close(prevread);
+		}
+		if (fds[1] >= 0) {
+			close(fds[1]);
+		}
+		prevread = fds[0];
+
+		if (pid < 0) {
+			break;
+		}
+		pids[i] = pid;
+	}
+
+	if (i < nstages && prevread >= 0) {
+		close(prevread);
+	}
+	return i;
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
- * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * otherwise, it's a standard command, or a pipeline of them split by '|'.
+ * check for the '&', try to background the job if possible, otherwise just
+ * run it and wait on it.
  */
 static
 void
 docommand(char *buf, struct exitinfo *ei)
 {
 	char *args[NARG_MAX + 1];
-	int nargs, i;
+	char **stages[NARG_MAX + 1];
+	pid_t pids[NARG_MAX + 1];
+	int nargs, nstages, npids, i;
 	char *s;
-	pid_t pid;
 	int status;
 	int bg=0;
 	time_t startsecs, endsecs;
@@ -405,60 +539,73 @@ docommand(char *buf, struct exitinfo *ei)
 
 	if (nargs > 0 && !strcmp(args[nargs-1], "&")) {
 		/* background */
-		if (!can_bg()) {
-			printf("%s: Too many background jobs; wait for "
-			       "some to finish before starting more\n",
-			       args[0]);
-			exitinfo_exit(ei, 1);
-			return;
-		}
 		nargs--;
 		args[nargs] = NULL;
 		bg = 1;
 	}
 
+	/*
+	 * Split it into the stages of a pipeline, at each "|", by
+	 * replacing the "|" with the NULL that ends that stage's argv.
+	 */
+	stages[0] = args;
+	nstages = 1;
+	for (i=0; i<nargs; i++) {
+		if (!strcmp(args[i], "|")) {
+			args[i] = NULL;
+			stages[nstages++] = &args[i+1];
+		}
+	}
+	for (i=0; i<nstages; i++) {
+		if (stages[i][0] == NULL) {
+			printf("sh: Missing command in pipeline\n");
+			exitinfo_exit(ei, 1);
+			return;
+		}
+	}
+
+	if (bg && !can_bg(nstages)) {
+		printf("%s: Too many background jobs; wait for "
+		       "some to finish before starting more\n",
+		       args[0]);
+		exitinfo_exit(ei, 1);
+		return;
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			exitinfo_exit(ei, 255);
-			return;
-		case 0:
-			/* child */
-			execvp(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
+	npids = runpipeline(stages, nstages, pids);
+	if (npids < nstages) {
+		/* the rest get end of file or EPIPE; collect them */
+		for (i=0; i<npids; i++) {
+			waitpid(pids[i], &status, 0);
+		}
+		exitinfo_exit(ei, 1);
+		return;
 	}
 
 	/* parent */
 	if (bg) {
 		/* background this command */
-		remember_bg(pid);
-		printf("[%d] %s ... &\n", pid, args[0]);
+		for (i=0; i<npids; i++) {
+			remember_bg(pids[i]);
+		}
+		printf("[%d] %s ... &\n", pids[npids-1], args[0]);
 		exitinfo_exit(ei, 0);
 		return;
 	}
 
-	if (waitpid(pid, &status, 0) < 0) {
-		warn("waitpid");
-		exitinfo_exit(ei, 255);
-	}
-	else {
-		readstatus(status, ei);
+	/* the pipeline's exit status is the last stage's */
+	for (i=0; i<npids; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			exitinfo_exit(ei, 255);
+		}
+		else if (i == npids-1) {
+			readstatus(status, ei);
+		}
 	}
 
 	if (timing) {
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * strace - run a program and show the system calls it makes
+ * usage: strace [-c] [-o file] program [args...]
+ *
+ * Each call is printed as it's read back from the kernel (see
+ * <sys/systrace.h>), with its arguments in hex, what it returned,
+ * and how long it took. At the end there's a table of the calls made
+ * and a histogram of how long each kind took. With -c only the table
+ * and histograms are printed. The output goes to standard error, or
+ * to the file given with -o.
+ *
+ * The kernel doesn't know what the arguments mean, so pointers are
+ * printed as numbers; and the records of a busy program can be lost
+ * if they come faster than we read them, which is printed too. The
+ * times in the table are always all of them.
+ *
+ * This program uses these system calls:
+ *    fork execv systrace systrace_read systrace_stats waitpid
+ *    nanosleep open write _exit
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/systrace.h>
+#include <kern/syscall.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+
+/* Names and argument counts of the calls the kernel has */
+static const struct {
+	const char *name;
+	unsigned nargs;
+} calls[] = {
+	[SYS_fork] = { "fork", 0 },
+	[SYS_execv] = { "execv", 2 },
+	[SYS__exit] = { "_exit", 1 },
+	[SYS_waitpid] = { "waitpid", 3 },
+	[SYS_getpid] = { "getpid", 0 },
+	[SYS_sbrk] = { "sbrk", 1 },
+	[SYS_mmap] = { "mmap", 4 },
+	[SYS_munmap] = { "munmap", 2 },
+	[SYS_madvise] = { "madvise", 3 },
+	[SYS_getrusage] = { "getrusage", 2 },
+	[SYS_getrlimit] = { "getrlimit", 2 },
+	[SYS_setrlimit] = { "setrlimit", 2 },
+	[SYS_open] = { "open", 3 },
+	[SYS_pipe] = { "pipe", 1 },
+	[SYS_dup2] = { "dup2", 2 },
+	[SYS_close] = { "close", 1 },
+	[SYS_fsync] = { "fsync", 1 },
+	[SYS_fdatasync] = { "fdatasync", 1 },
+	[SYS_sync_file_range] = { "sync_file_range", 4 },
+	[SYS_fallocate] = { "fallocate", 4 },
+	[SYS_poll] = { "poll", 3 },
+	[SYS_ioctl] = { "ioctl", 3 },
+	[SYS_read] = { "read", 3 },
+	[SYS_pread] = { "pread", 4 },
+	[SYS_readv] = { "readv", 3 },
+	[SYS_getdirentry] = { "getdirentry", 3 },
+	[SYS_write] = { "write", 3 },
+	[SYS_pwrite] = { "pwrite", 4 },
+	[SYS_writev] = { "writev", 3 },
+	[SYS_lseek] = { "lseek", 4 },
+	[SYS_chdir] = { "chdir", 1 },
+	[SYS___getcwd] = { "__getcwd", 2 },
+	[SYS_stat] = { "stat", 2 },
+	[SYS_fstat] = { "fstat", 2 },
+	[SYS_lstat] = { "lstat", 2 },
+	[SYS_fstatat] = { "fstatat", 4 },
+	[SYS_openat] = { "openat", 4 },
+	[SYS_mkdir] = { "mkdir", 2 },
+	[SYS_mkdirat] = { "mkdirat", 3 },
+	[SYS_remove] = { "remove", 1 },
+	[SYS_rmdir] = { "rmdir", 1 },
+	[SYS_unlinkat] = { "unlinkat", 3 },
+	[SYS_socket] = { "socket", 3 },
+	[SYS_bind] = { "bind", 3 },
+	[SYS_connect] = { "connect", 3 },
+	[SYS_getsockname] = { "getsockname", 3 },
+	[SYS_recvfrom] = { "recvfrom", 4 },
+	[SYS_sendto] = { "sendto", 4 },
+	[SYS___time] = { "__time", 2 },
+	[SYS_nanosleep] = { "nanosleep", 2 },
+	[SYS_reboot] = { "reboot", 1 },
+	[SYS_kheapstats] = { "kheapstats", 2 },
+	[SYS_sched_setaffinity] = { "sched_setaffinity", 2 },
+	[SYS_sched_getaffinity] = { "sched_getaffinity", 2 },
+	[SYS_sched_setattr] = { "sched_setattr", 2 },
+	[SYS_sched_getattr] = { "sched_getattr", 2 },
+	[SYS_ioprio_set] = { "ioprio_set", 2 },
+	[SYS_ioprio_get] = { "ioprio_get", 1 },
+	[SYS_futex_wait] = { "futex_wait", 2 },
+	[SYS_futex_wake] = { "futex_wake", 2 },
+	[SYS_spawn] = { "spawn", 4 },
+	[SYS___thr_create] = { "__thr_create", 3 },
+	[SYS_thr_exit] = { "thr_exit", 1 },
+	[SYS_thr_join] = { "thr_join", 2 },
+	[SYS_copy_file_range] = { "copy_file_range", 3 },
+	[SYS_ioring_enter] = { "ioring_enter", 1 },
+	[SYS_aio_read] = { "aio_read", 1 },
+	[SYS_aio_write] = { "aio_write", 1 },
+	[SYS_aio_wait] = { "aio_wait", 3 },
+	[SYS_getdirentries] = { "getdirentries", 3 },
+	[SYS_systrace] = { "systrace", 2 },
+	[SYS_systrace_read] = { "systrace_read", 3 },
+	[SYS_systrace_stats] = { "systrace_stats", 3 },
+	[SYS_dmesg] = { "dmesg", 2 },
+	[SYS_sem_op] = { "sem_op", 2 },
+	[SYS_shmget] = { "shmget", 3 },
+	[SYS_shmat] = { "shmat", 3 },
+	[SYS_shmdt] = { "shmdt", 1 },
+	[SYS_shmctl] = { "shmctl", 2 },
+	[SYS_mempressure] = { "mempressure", 2 },
+};
+
+#define NCALLS (sizeof(calls) / sizeof(calls[0]))
+#define MAXSTATS 64
+
+static int outfd = STDERR_FILENO;
+
+/*
+ * printf to outfd.
+ */
+static
+void
+out(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len > (int)sizeof(buf) - 1) {
+		len = sizeof(buf) - 1;
+	}
+	write(outfd, buf, len);
+}
+
+static
+const char *
+callname(unsigned callno)
+{
+	static char buf[32];
+
+	if (callno < NCALLS && calls[callno].name != NULL) {
+		return calls[callno].name;
+	}
+	snprintf(buf, sizeof(buf), "syscall_%u", callno);
+	return buf;
+}
+
+/*
+ * Print one record.
+ */
+static
+void
+showrec(const struct systrace_rec *sr)
+{
+	unsigned i, nargs;
+
+	if (sr->sr_callno == SYSTRACE_DROPPED) {
+		out("... %d calls not shown ...\n", (int)sr->sr_retval);
+		return;
+	}
+
+	nargs = sr->sr_callno < NCALLS ? calls[sr->sr_callno].nargs : 4;
+	out("%s(", callname(sr->sr_callno));
+	for (i=0; i<nargs; i++) {
+		out(i == 0 ? "0x%x" : ", 0x%x", sr->sr_args[i]);
+	}
+	if (sr->sr_err) {
+		out(") = -1 %s", strerror(sr->sr_err));
+	}
+	else {
+		out(") = %d", (int)sr->sr_retval);
+	}
+	out(" <%u.%06u>\n", sr->sr_nsecs / 1000000000,
+	    sr->sr_nsecs % 1000000000 / 1000);
+}
+
+/*
+ * Print the table and the histograms.
+ */
+static
+void
+showstats(pid_t pid)
+{
+	struct systrace_stat ss[MAXSTATS];
+	char bar[41];
+	unsigned i, b, n, top, lo, len;
+	int r;
+
+	r = systrace_stats(pid, ss, MAXSTATS);
+	if (r < 0) {
+		warn("systrace_stats");
+		return;
+	}
+	n = r < MAXSTATS ? (unsigned)r : MAXSTATS;
+
+	out("\n%8s %8s %12s %10s %10s  %s\n",
+	    "calls", "errors", "total us", "avg us", "max us", "syscall");
+	for (i=0; i<n; i++) {
+		out("%8u %8u %12llu %10llu %10u  %s\n",
+		    ss[i].ss_count, ss[i].ss_errors,
+		    (unsigned long long)(ss[i].ss_totalns / 1000),
+		    (unsigned long long)(ss[i].ss_totalns / 1000 /
+					 ss[i].ss_count),
+		    ss[i].ss_maxns / 1000, callname(ss[i].ss_callno));
+	}
+
+	for (i=0; i<n; i++) {
+		top = 0;
+		for (b=0; b<SYSTRACE_NBUCKETS; b++) {
+			if (ss[i].ss_hist[b] > top) {
+				top = ss[i].ss_hist[b];
+			}
+		}
+		out("\n%s, us:\n", callname(ss[i].ss_callno));
+		for (b=0; b<SYSTRACE_NBUCKETS; b++) {
+			if (ss[i].ss_hist[b] == 0) {
+				continue;
+			}
+			lo = b == 0 ? 0 : 1U << (b - 1);
+			if (b == SYSTRACE_NBUCKETS - 1) {
+				out("%12u+ ", lo);
+			}
+			else {
+				out("%6u-%-6u ", lo, 1U << b);
+			}
+			len = (ss[i].ss_hist[b] * 40 + top - 1) / top;
+			memset(bar, '*', len);
+			bar[len] = 0;
+			out("%8u |%s\n", ss[i].ss_hist[b], bar);
+		}
+	}
+}
+
+/*
+ * Wait for the child to have tracing on. It turns it on itself before
+ * it execs, so until then reading gets EINVAL; if it couldn't, it
+ * exits.
+ */
+static
+int
+waitfortrace(pid_t pid)
+{
+	struct systrace_stat ss;
+	struct timespec ts;
+	int status;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = 1000000;
+	while (systrace_stats(pid, &ss, 0) < 0) {
+		if (errno != EINVAL) {
+			err(1, "systrace_stats");
+		}
+		if (waitpid(pid, &status, WNOHANG) == pid) {
+			return -1;
+		}
+		nanosleep(&ts, NULL);
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct systrace_rec recs[16];
+	int i, n, j, status, flags;
+	int summary = 0, started = 0;
+	const char *outfile = NULL;
+	pid_t pid;
+
+	for (i=1; i<argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-c")) {
+			summary = 1;
+		}
+		else if (!strcmp(argv[i], "-o") && i+1 < argc) {
+			outfile = argv[++i];
+		}
+		else {
+			errx(1, "Usage: strace [-c] [-o file] program [args...]");
+		}
+	}
+	if (i == argc) {
+		errx(1, "Usage: strace [-c] [-o file] program [args...]");
+	}
+
+	if (outfile != NULL) {
+		outfd = open(outfile, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		if (outfd < 0) {
+			err(1, "%s", outfile);
+		}
+	}
+
+	flags = summary ? SYSTRACE_STATS : SYSTRACE_RECORDS|SYSTRACE_STATS;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (outfd != STDERR_FILENO) {
+			close(outfd);
+		}
+		if (systrace(0, flags) < 0) {
+			err(1, "systrace");
+		}
+		execvp(argv[i], argv + i);
+		err(1, "%s", argv[i]);
+	}
+
+	if (waitfortrace(pid) < 0) {
+		/* it has already said why */
+		return 1;
+	}
+
+	if (!summary) {
+		while ((n = systrace_read(pid, recs, 16)) > 0) {
+			for (j=0; j<n; j++) {
+				/* skip the child's own call that started it */
+				if (!started) {
+					started = 1;
+					if (recs[j].sr_callno == SYS_systrace) {
+						continue;
+					}
+				}
+				showrec(&recs[j]);
+			}
+		}
+		if (n < 0) {
+			warn("systrace_read");
+		}
+	}
+	else {
+		/* systrace_read is how we find out it has finished */
+		while (systrace_read(pid, recs, 16) > 0) {
+			/* nothing */
+		}
+	}
+
+	showstats(pid);
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (WIFEXITED(status)) {
+		out("+++ exited with %d +++\n", WEXITSTATUS(status));
+	}
+	else if (WIFSIGNALED(status)) {
+		out("+++ killed by signal %d +++\n", WTERMSIG(status));
+	}
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
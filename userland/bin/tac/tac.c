@@ -61,7 +61,20 @@ struct indexentry {
 static int datafd = -1, indexfd = -1;
 static char dataname[64], indexname[64];
 
-static char buf[4096];
+/*
+ * Everything goes through big buffers, so the scratch files are read
+ * and written in whole blocks rather than a line (or an index entry)
+ * at a time: BUFSIZE of data, and IXBATCH index entries, per call.
+ */
+#define BUFSIZE		(64*1024)
+#define BLOCKSIZE	512
+#define IXBATCH		(BUFSIZE / sizeof(struct indexentry))
+
+static char buf[BUFSIZE];
+static char outbuf[BUFSIZE];
+static size_t outlen;
+static struct indexentry ixbuf[IXBATCH];
+static unsigned ixcount;
 
 ////////////////////////////////////////////////////////////
 // string ops
@@ -128,6 +141,58 @@ dolseek(int fd, const char *name, off_t pos, int whence)
 	return ret;
 }
 
+////////////////////////////////////////////////////////////
+// buffering
+
+/* Add an entry to the index file. */
+static
+void
+addindex(const struct indexentry *x)
+{
+	if (ixcount == IXBATCH) {
+		dowrite(indexfd, indexname, ixbuf, sizeof(ixbuf));
+		ixcount = 0;
+	}
+	ixbuf[ixcount++] = *x;
+}
+
+static
+void
+flushindex(void)
+{
+	if (ixcount > 0) {
+		dowrite(indexfd, indexname, ixbuf, ixcount * sizeof(ixbuf[0]));
+		ixcount = 0;
+	}
+}
+
+/* Send LEN bytes at P to stdout. */
+static
+void
+output(const char *p, size_t len)
+{
+	if (outlen + len > sizeof(outbuf)) {
+		dowrite(STDOUT_FILENO, "stdout", outbuf, outlen);
+		outlen = 0;
+	}
+	if (len >= sizeof(outbuf)) {
+		dowrite(STDOUT_FILENO, "stdout", p, len);
+		return;
+	}
+	memcpy(outbuf + outlen, p, len);
+	outlen += len;
+}
+
+static
+void
+flushoutput(void)
+{
+	if (outlen > 0) {
+		dowrite(STDOUT_FILENO, "stdout", outbuf, outlen);
+		outlen = 0;
+	}
+}
+
 ////////////////////////////////////////////////////////////
 // file I/O
 
@@ -168,7 +233,7 @@ readfile(const char *name)
 				here = (t - s);
 				x.len += here;
 				remaining -= here;
-				dowrite(indexfd, indexname, &x, sizeof(x));
+				addindex(&x);
 				x.pos += x.len;
 				x.len = 0;
 			}
@@ -179,7 +244,7 @@ readfile(const char *name)
 		dowrite(datafd, dataname, buf, len);
 	}
 	if (x.len > 0) {
-		dowrite(indexfd, indexname, &x, sizeof(x));
+		addindex(&x);
 	}
 
 	if (closefd != -1) {
@@ -187,43 +252,85 @@ readfile(const char *name)
 	}
 }
 
+/*
+ * Print the data file backwards, a line at a time, reading the index
+ * file backwards IXBATCH entries at a time. The data is read into BUF
+ * as a window that ends at the end of the line being printed and
+ * starts on a block boundary as far back as will fit, so the lines
+ * before it usually come out of the same read. A line too long for
+ * that gets copied through BUF by itself.
+ */
 static
 void
 dumpdata(void)
 {
 	struct indexentry x;
-	off_t indexsize, pos, done;
+	off_t ixpos, wstart, wend, done;
 	size_t amount, len;
+	unsigned n;
 
-	indexsize = dolseek(indexfd, indexname, 0, SEEK_CUR);
-	pos = indexsize;
-	while (1) {
-		pos -= sizeof(x);
-		if (pos == 0) {
-			break;
-		}
-		assert(pos >= 0);
-		dolseek(indexfd, indexname, pos, SEEK_SET);
+	flushindex();
 
-		len = doread(indexfd, indexname, &x, sizeof(x));
-		if (len != sizeof(x)) {
+	wstart = wend = 0;
+	ixpos = dolseek(indexfd, indexname, 0, SEEK_CUR);
+	assert(ixpos % sizeof(x) == 0);
+	while (ixpos > 0) {
+		n = ixpos / sizeof(x);
+		if (n > IXBATCH) {
+			n = IXBATCH;
+		}
+		ixpos -= n * sizeof(x);
+		dolseek(indexfd, indexname, ixpos, SEEK_SET);
+		len = doread(indexfd, indexname, ixbuf, n * sizeof(x));
+		if (len != n * sizeof(x)) {
 			errx(1, "%s: read: Unexpected EOF", indexname);
 		}
-		dolseek(datafd, dataname, x.pos, SEEK_SET);
 
-		for (done = 0; done < x.len; done += amount) {
-			amount = sizeof(buf);
-			if ((off_t)amount > x.len - done) {
-				amount = x.len - done;
+		while (n > 0) {
+			x = ixbuf[--n];
+
+			if (x.pos >= wstart && x.pos + x.len <= wend) {
+				output(buf + (x.pos - wstart), x.len);
+				continue;
 			}
-			len = doread(datafd, dataname, buf, amount);
-			if (len != amount) {
-				errx(1, "%s: read: Unexpected short count"
-				     " %zu of %zu", dataname, len, amount);
+
+			if (x.len <= BUFSIZE - BLOCKSIZE) {
+				wend = x.pos + x.len;
+				wstart = wend > BUFSIZE ? wend - BUFSIZE : 0;
+				wstart = (wstart + BLOCKSIZE - 1) &
+					~(off_t)(BLOCKSIZE - 1);
+				dolseek(datafd, dataname, wstart, SEEK_SET);
+				amount = wend - wstart;
+				len = doread(datafd, dataname, buf, amount);
+				if (len != amount) {
+					errx(1, "%s: read: Unexpected short "
+					     "count %zu of %zu", dataname,
+					     len, amount);
+				}
+				output(buf + (x.pos - wstart), x.len);
+				continue;
+			}
+
+			/* too long for the window */
+			wstart = wend = 0;
+			dolseek(datafd, dataname, x.pos, SEEK_SET);
+			for (done = 0; done < x.len; done += amount) {
+				amount = sizeof(buf);
+				if ((off_t)amount > x.len - done) {
+					amount = x.len - done;
+				}
+				len = doread(datafd, dataname, buf, amount);
+				if (len != amount) {
+					errx(1, "%s: read: Unexpected short "
+					     "count %zu of %zu", dataname,
+					     len, amount);
+				}
+				output(buf, len);
 			}
-			dowrite(STDOUT_FILENO, "stdout", buf, len);
 		}
 	}
+
+	flushoutput();
 }
 
 ////////////////////////////////////////////////////////////
@@ -0,0 +1,20 @@
+#ifndef _AIO_H_
+#define _AIO_H_
+
+/*
+ * Asynchronous I/O (see <kern/aio.h>). aio_read and aio_write queue
+ * the request CB describes and return 0 without waiting for it;
+ * aio_wait stores up to MAX finished requests at EVENTS and returns
+ * how many, waiting for one to finish first unless FLAGS has
+ * AIO_NOWAIT. It returns 0 if there was nothing to wait for.
+ */
+
+#include <sys/types.h>
+#include <kern/aio.h>
+
+/* System call stubs */
+int aio_read(const struct aiocb *cb);
+int aio_write(const struct aiocb *cb);
+int aio_wait(struct aio_event *events, int max, int flags);
+
+#endif /* _AIO_H_ */
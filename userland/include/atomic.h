@@ -0,0 +1,119 @@
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on a word in memory with LL/SC, for the locks and
+ * lock-free lists in libc (stdio, malloc) and libtask, and for the
+ * tests of the futex and thread calls. Not a standard interface.
+ *
+ * atomic_cas stores NEW if the word holds OLD, and returns the value
+ * it held (so it succeeded if that's OLD). atomic_cas_ptr is the same
+ * on a pointer, which is a word here.
+ *
+ * atomic_xchg stores NEW and returns the value it replaced.
+ *
+ * atomic_add adds DELTA (which may be negative) and returns the new
+ * value.
+ *
+ * Each is a load-linked of the word and a store-conditional of the
+ * new value, retried until the store goes through (SC fails if anybody
+ * else stored to the word in between). The LL and SC have to be in the
+ * same asm statement so the compiler can't put a load or store of its
+ * own between them. All of them are full memory barriers, as is
+ * membar_any_any: nothing before them is ordered after them or the
+ * other way around.
+ */
+
+static
+inline
+void
+membar_any_any(void)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		"sync;"			/* do it */
+		".set pop"		/* restore assembler mode */
+		: : : "memory");
+}
+
+static
+inline
+int
+atomic_cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	membar_any_any();
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"bne %0, %3, 2f;"	/*   give up if x != old */
+		"move %1, %4;"		/*   y = new */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   try again if it failed */
+		"2:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	membar_any_any();
+	return x;
+}
+
+static
+inline
+void *
+atomic_cas_ptr(void *volatile *p, void *old, void *new)
+{
+	return (void *)atomic_cas((volatile int *)p, (int)old, (int)new);
+}
+
+static
+inline
+int
+atomic_xchg(volatile int *p, int new)
+{
+	int x, y;
+
+	membar_any_any();
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"move %1, %3;"		/*   y = new */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   try again if it failed */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (p), "r" (new) : "memory");
+	membar_any_any();
+	return x;
+}
+
+static
+inline
+int
+atomic_add(volatile int *p, int delta)
+{
+	int x, y;
+
+	membar_any_any();
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"addu %0, %0, %3;"	/*   x += delta */
+		"move %1, %0;"		/*   y = x */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   try again if it failed */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (p), "r" (delta) : "memory");
+	membar_any_any();
+	return x;
+}
+
+#endif /* _ATOMIC_H_ */
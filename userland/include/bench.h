@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * bench.h
+ *
+ * Benchmark support (libbench, link with -lbench), shared by the
+ * benchmark programs (sysbench, procbench, vmbench, fsbench,
+ * scalebench, and frack's bench mode) so their numbers are taken and printed the same way
+ * and can be compared from one kernel to the next.
+ *
+ * A benchmark takes a number of samples, each the time in nanoseconds
+ * that some number of operations took, and bench_report prints two
+ * lines for it:
+ *
+ *    BENCH <name> ops=<n> ns/op=<mean> p50=<ns> p90=<ns> p99=<ns> max=<ns> [extra]
+ *    BENCHHIST <name> le<ns>=<samples> ...
+ *
+ * where the percentiles are over the samples, per operation, and the
+ * histogram counts the samples whose time per operation was at most
+ * each power of two nanoseconds (only those with any). That's easy to
+ * pick out of console output with grep and split on spaces and '=',
+ * so runs can be compared by a script.
+ *
+ * Clocks: bench_ns is the kernel's clock, to the nanosecond, and
+ * costs a system call. bench_coarse_ns reads the time page (see
+ * clock_gettime) and costs next to nothing, but only moves once a
+ * clock tick (10ms on System/161), so it's for whole runs of seconds,
+ * or for seeing whether a time limit has passed in a loop that
+ * shouldn't go into the kernel. There's no cycle counter user code
+ * can read on System/161.
+ *
+ * bench_run does the whole thing for a function FN(ARG, N) that does
+ * N operations: once to warm up, then it finds the N that takes at
+ * least BENCH_SAMPLENS (bench_calibrate, doubling N from 1), takes
+ * NSAMPLES samples of that many and reports them. So a cheap call is
+ * timed in batches big enough that the clock's own cost is lost in
+ * them, and an expensive one one at a time, without each benchmark
+ * picking its own batch size.
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+
+/* Time bench_calibrate aims for, per sample. */
+#define BENCH_SAMPLENS	1000000		/* 1ms */
+
+/* Most operations per sample bench_calibrate will go to. */
+#define BENCH_MAXBATCH	(1U << 20)
+
+/* Nanoseconds since some fixed time (from __time()). */
+uint64_t bench_ns(void);
+
+/* Nanoseconds since boot, from the time page: good to a clock tick. */
+uint64_t bench_coarse_ns(void);
+
+/* How many operations of FN make a sample of at least TARGET ns. */
+unsigned bench_calibrate(void (*fn)(void *arg, unsigned n), void *arg,
+			 uint64_t target);
+
+/*
+ * Warm up, calibrate and take NSAMPLES samples of FN, and report them
+ * as NAME (with EXTRA) as bench_report does.
+ */
+void bench_run(const char *name, void (*fn)(void *arg, unsigned n),
+	       void *arg, unsigned nsamples, const char *extra);
+
+/*
+ * Print the results for NAME. SAMPLES (which gets sorted) has NSAMPLES
+ * times, each for OPSPER operations. EXTRA, if not NULL, is put on the
+ * end of the first line.
+ */
+void bench_report(const char *name, uint64_t *samples, unsigned nsamples,
+		  unsigned opsper, const char *extra);
+
+#endif /* _BENCH_H_ */
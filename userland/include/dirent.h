@@ -0,0 +1,19 @@
+#ifndef _DIRENT_H_
+#define _DIRENT_H_
+
+/*
+ * Reading directories (see <kern/dirent.h>). getdirentries fills BUF
+ * with as many struct dirent records from the open directory FD as
+ * fit, carrying on from where the last call left off, and returns
+ * how many bytes of them there are: 0 at the end of the directory.
+ * BUFLEN must be at least DIRENT_MAXRECLEN. Step from one record to
+ * the next by its d_reclen.
+ */
+
+#include <sys/types.h>
+#include <kern/dirent.h>
+
+/* System call stub */
+ssize_t getdirentries(int fd, char *buf, size_t buflen);
+
+#endif /* _DIRENT_H_ */
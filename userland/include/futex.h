@@ -0,0 +1,21 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+/*
+ * Futexes: sleep and wake on a word of memory. Words are identified
+ * by the memory behind them, so processes that share a MAP_SHARED
+ * mapping (directly or through fork) can use them to wait for each
+ * other. ADDR must be 4-byte aligned.
+ *
+ * futex_wait sleeps only if *ADDR is still VAL when the kernel looks,
+ * otherwise it fails with EAGAIN. It can also return 0 without anyone
+ * calling futex_wake, so callers should check their word again.
+ * futex_wake wakes up to N waiters on ADDR and returns how many it
+ * woke.
+ */
+
+/* System call stubs */
+int futex_wait(volatile int *addr, int val);
+int futex_wake(volatile int *addr, int n);
+
+#endif /* _FUTEX_H_ */
@@ -0,0 +1,17 @@
+#ifndef _IORING_H_
+#define _IORING_H_
+
+/*
+ * ioring_enter: do the file operations queued in RING's submission
+ * ring and post their results in its completion ring (see
+ * <kern/ioring.h>). Returns how many were done, which is fewer than
+ * were queued if the completion ring filled up.
+ */
+
+#include <sys/types.h>
+#include <kern/ioring.h>
+
+/* System call stub */
+int ioring_enter(struct ioring *ring);
+
+#endif /* _IORING_H_ */
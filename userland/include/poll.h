@@ -0,0 +1,16 @@
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * poll (see <kern/poll.h>): wait until one of the NFDS files in FDS
+ * is ready for its events, or TIMEOUT milliseconds go by (-1 is
+ * forever, 0 is not at all). Returns how many have revents set.
+ */
+
+#include <sys/types.h>
+#include <kern/poll.h>
+
+/* System call stub */
+int poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+#endif /* _POLL_H_ */
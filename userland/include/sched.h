@@ -0,0 +1,32 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <kern/sched.h>
+#include <kern/ioprio.h>
+
+/*
+ * CPU affinity. A mask has bit N set for cpu number N; pid 0 is the
+ * calling process, otherwise it must be a child of the caller.
+ *
+ * Scheduling classes (SCHED_OTHER, SCHED_FIFO and SCHED_DEADLINE; see
+ * <kern/sched.h>): sched_setattr applies to every thread of the
+ * process, and sched_getattr reports that of its first thread. The
+ * pid is as for affinity.
+ *
+ * I/O priority classes (IOPRIO_RT, IOPRIO_BE and IOPRIO_IDLE; see
+ * <kern/ioprio.h>): ioprio_set puts the process in one, for the
+ * requests it makes of the disks from then on, and ioprio_get returns
+ * it. The pid is as for affinity; children get the parent's class.
+ */
+
+/* System call stubs */
+int sched_setaffinity(pid_t pid, uint32_t mask);
+int sched_getaffinity(pid_t pid, uint32_t *mask);
+int sched_setattr(pid_t pid, const struct sched_attr *attr);
+int sched_getattr(pid_t pid, struct sched_attr *attr);
+int ioprio_set(pid_t pid, int ioprio);
+int ioprio_get(pid_t pid);
+
+#endif /* _SCHED_H_ */
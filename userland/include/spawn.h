@@ -0,0 +1,32 @@
+#ifndef _SPAWN_H_
+#define _SPAWN_H_
+
+/*
+ * spawn: start a new process running PATH with arguments ARGV, like
+ * fork followed by execv in the child but without copying the caller
+ * first. The child's file descriptors are the caller's, changed by
+ * the NACTIONS file actions in ACTIONS (see <kern/spawn.h>). Returns
+ * the child's pid, to be collected with waitpid; if the program can't
+ * be run, or a file action fails, no child is made and spawn fails
+ * with the error.
+ *
+ * spawnvp is the same, but looks for PROG on the search path like
+ * execvp.
+ */
+
+#include <sys/types.h>
+#include <kern/spawn.h>
+
+/* libc wrapper; flushes stdout and calls __spawn */
+pid_t spawn(const char *path, char *const *argv,
+	    const struct spawn_action *actions, int nactions);
+
+/* System call stub */
+pid_t __spawn(const char *path, char *const *argv,
+	      const struct spawn_action *actions, int nactions);
+
+/* libc wrapper; calls spawn */
+pid_t spawnvp(const char *prog, char *const *argv,
+	      const struct spawn_action *actions, int nactions);
+
+#endif /* _SPAWN_H_ */
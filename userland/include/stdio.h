@@ -41,6 +41,25 @@
 /* Constant returned by a bunch of stdio functions on error */
 #define EOF (-1)
 
+/*
+ * Standard output is buffered: it's written out a line at a time if
+ * it's the console and a buffer-full at a time otherwise, and when
+ * fflush is called or the program exits. fflush(NULL) flushes every
+ * buffer (which is only stdout's).
+ */
+#define BUFSIZ 1024
+
+typedef struct __file FILE;
+extern FILE *stdout;
+
+int fflush(FILE *);
+
+/*
+ * Add data to a buffer
+ * (for libc internal use only)
+ */
+int __stdio_write(FILE *f, const char *data, size_t len);
+
 /*
  * The actual guts of printf
  * (for libc internal use only)
@@ -76,6 +76,13 @@ char *setstate(char *);
 void *malloc(size_t size);
 void free(void *ptr);
 
+/*
+ * Threads starting and ending, for malloc's per-thread caches
+ * (for libc internal use only; see thr_create.c)
+ */
+void __malloc_thrstart(void *stackptr);
+void __malloc_thrend(void);
+
 /*
  * Sort.
  */
@@ -0,0 +1,14 @@
+#ifndef _SYS_KHEAPSTATS_H_
+#define _SYS_KHEAPSTATS_H_
+
+#include <sys/types.h>
+
+/*
+ * Get struct kheapstats from the kernel.
+ */
+#include <kern/kheapstats.h>
+
+/* System call stubs */
+int kheapstats(struct kheapstats *buf, unsigned nclasses);
+
+#endif /* _SYS_KHEAPSTATS_H_ */
@@ -0,0 +1,14 @@
+#ifndef _SYS_MEMPRESSURE_H_
+#define _SYS_MEMPRESSURE_H_
+
+#include <sys/types.h>
+
+/*
+ * Get struct mempressure and the MEMPRESSURE_* levels from the kernel.
+ */
+#include <kern/mempressure.h>
+
+/* System call stubs */
+int mempressure(int seen, struct mempressure *mp);
+
+#endif /* _SYS_MEMPRESSURE_H_ */
@@ -0,0 +1,19 @@
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+#include <sys/types.h>
+
+/*
+ * Get the PROT_* and MAP_* flags from the kernel.
+ */
+#include <kern/mman.h>
+
+/* Returned by mmap on error */
+#define MAP_FAILED ((void *)-1)
+
+/* System call stubs */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+int madvise(void *addr, size_t len, int advice);
+
+#endif /* _SYS_MMAN_H_ */
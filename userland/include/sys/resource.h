@@ -0,0 +1,18 @@
+#ifndef _SYS_RESOURCE_H_
+#define _SYS_RESOURCE_H_
+
+#include <sys/types.h>
+
+/*
+ * Get struct rusage, struct rlimit and the RUSAGE_* and RLIMIT_* codes
+ * from the kernel.
+ */
+#include <kern/time.h>
+#include <kern/resource.h>
+
+/* System call stubs */
+int getrusage(int who, struct rusage *usage);
+int getrlimit(int resource, struct rlimit *rlp);
+int setrlimit(int resource, const struct rlimit *rlp);
+
+#endif /* _SYS_RESOURCE_H_ */
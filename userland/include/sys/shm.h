@@ -0,0 +1,24 @@
+#ifndef _SYS_SHM_H_
+#define _SYS_SHM_H_
+
+/*
+ * System V style shared memory. shmget finds or makes the segment for
+ * a key (IPC_PRIVATE for a new one only its id can reach), shmat maps
+ * all of it and returns where, and shmdt unmaps it. shmctl(IPC_RMID)
+ * removes the id; the memory itself lasts until the last process has
+ * detached it (or exited). Segments are zero filled to begin with.
+ */
+
+#include <sys/types.h>
+#include <kern/shm.h>
+
+/* Returned by shmat on error */
+#define SHM_FAILED ((void *)-1)
+
+/* System call stubs */
+int shmget(int key, size_t size, int flags);
+void *shmat(int id, const void *addr, int flags);
+int shmdt(const void *addr);
+int shmctl(int id, int cmd);
+
+#endif /* _SYS_SHM_H_ */
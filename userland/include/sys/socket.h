@@ -0,0 +1,25 @@
+#ifndef _SYS_SOCKET_H_
+#define _SYS_SOCKET_H_
+
+/*
+ * Sockets. The only kind there is is AF_LNET, SOCK_DGRAM: datagrams
+ * addressed by lnet node and port (struct sockaddr_ln, from
+ * <kern/socket.h>). Sending to LNADDR_LOCAL reaches sockets on this
+ * machine. read and write on a socket are recvfrom and sendto with no
+ * address; connect sets the address those use.
+ */
+
+#include <sys/types.h>
+#include <kern/socket.h>
+
+/* System call stubs */
+int socket(int domain, int type, int protocol);
+int bind(int fd, const struct sockaddr *addr, socklen_t len);
+int connect(int fd, const struct sockaddr *addr, socklen_t len);
+ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+	       const struct sockaddr *to, socklen_t tolen);
+ssize_t recvfrom(int fd, void *buf, size_t len, int flags,
+		 struct sockaddr *from, socklen_t *fromlen);
+int getsockname(int fd, struct sockaddr *addr, socklen_t *len);
+
+#endif /* _SYS_SOCKET_H_ */
@@ -72,12 +72,20 @@ int fstat(int filehandle, struct stat *buf);
 int stat(const char *path, struct stat *buf);
 int lstat(const char *path, struct stat *buf);
 
+/*
+ * fstatat is stat with a relative path taken from the directory open
+ * on DIRFD (or the current directory, for AT_FDCWD). FLAGS may be
+ * AT_SYMLINK_NOFOLLOW, which it always is here anyway.
+ */
+int fstatat(int dirfd, const char *path, struct stat *buf, int flags);
+
 /*
  * The second argument to mkdir is the mode for the new directory.
  * Unless you're implementing security and permissions, you can
  * (and should) ignore it. See notes in unistd.h.
  */
 int mkdir(const char *dirname, int ignore);
+int mkdirat(int dirfd, const char *dirname, int ignore);
 
 
 #endif /* _SYS_STAT_H_ */
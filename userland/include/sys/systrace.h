@@ -0,0 +1,16 @@
+#ifndef _SYS_SYSTRACE_H_
+#define _SYS_SYSTRACE_H_
+
+#include <sys/types.h>
+
+/*
+ * Get the record and histogram structures and the flags.
+ */
+#include <kern/systrace.h>
+
+/* System call stubs */
+int systrace(pid_t pid, int flags);
+int systrace_read(pid_t pid, struct systrace_rec *buf, unsigned nrecs);
+int systrace_stats(pid_t pid, struct systrace_stat *buf, unsigned max);
+
+#endif /* _SYS_SYSTRACE_H_ */
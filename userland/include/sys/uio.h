@@ -0,0 +1,15 @@
+#ifndef _SYS_UIO_H_
+#define _SYS_UIO_H_
+
+#include <sys/types.h>
+
+/*
+ * Get struct iovec from the kernel.
+ */
+#include <kern/iovec.h>
+
+/* System call stubs */
+ssize_t readv(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t writev(int filehandle, const struct iovec *iov, int iovcnt);
+
+#endif /* _SYS_UIO_H_ */
@@ -0,0 +1,51 @@
+#ifndef _TASK_H_
+#define _TASK_H_
+
+/*
+ * Task parallelism (libtask, link with -ltask): fork-join on a pool
+ * of worker threads, one per cpu, that balance the load by stealing.
+ *
+ * task_init starts the pool: NWORKERS workers in all, the calling
+ * thread being one of them, or with NWORKERS 0 one for each cpu the
+ * process may run on (see sched_setaffinity). Call it once, from the
+ * first thread, before anything else here. Returns 0, or -1 with
+ * errno set if a thread couldn't be started, in which case the pool
+ * is whatever did start. Without task_init everything still works,
+ * on the one thread.
+ *
+ * task_spawn makes T a task that runs FUNC(ARG), maybe on another
+ * worker, and task_sync waits for it to finish (running it right
+ * there if nobody has taken it yet). T is the caller's, usually a
+ * local variable; it has to stay put until task_sync, and tasks have
+ * to be synced in the reverse of the order they were spawned in.
+ *
+ * parallel_for calls BODY(I, ARG) for each I from FROM up to (not
+ * including) TO, spread over the workers in chunks of about GRAIN,
+ * and returns when they're all done. GRAIN 0 picks a size that gives
+ * each worker a few chunks.
+ *
+ * Tasks can spawn tasks and call parallel_for themselves, to any
+ * depth; but all of this has to be called from the first thread or
+ * from inside a task, as that's how a worker finds its own queue.
+ * Workers waiting in task_sync run other tasks in the meantime, on
+ * top of their stacks, and a thread's stack is only THR_STACKSIZE
+ * (64K), so keep tasks' frames small and their nesting shallow.
+ * Workers with nothing to do sleep on a futex until there's more.
+ */
+
+struct task {
+	void (*t_func)(void *);
+	void *t_arg;
+	volatile int t_done;
+};
+
+int task_init(unsigned nworkers);
+unsigned task_nworkers(void);
+
+void task_spawn(struct task *t, void (*func)(void *), void *arg);
+void task_sync(struct task *t);
+
+void parallel_for(unsigned from, unsigned to, unsigned grain,
+		  void (*body)(unsigned i, void *arg), void *arg);
+
+#endif /* _TASK_H_ */
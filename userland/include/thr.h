@@ -0,0 +1,31 @@
+#ifndef _THR_H_
+#define _THR_H_
+
+/*
+ * Threads within a process. thr_create starts a thread running
+ * FUNC(ARG) on a stack of its own, sharing everything else with the
+ * caller, and returns its id. The thread ends when FUNC returns or
+ * calls thr_exit, and thr_join waits for the thread with id TID to
+ * end and stores its value (FUNC's return value, or what it passed to
+ * thr_exit) at VALUEP unless that is NULL. Each thread can be joined
+ * once; the first thread of a process can't be joined at all.
+ *
+ * The process exits with status 0 when its last thread ends, and all
+ * of its threads go when any of them calls _exit or execv.
+ */
+
+#include <sys/cdefs.h>
+
+/* Get THR_STACKSIZE from the kernel. */
+#include <kern/thr.h>
+
+/* libc wrapper; calls __thr_create */
+int thr_create(void *(*func)(void *), void *arg);
+
+/* System call stubs */
+int __thr_create(void (*entry)(void *(*)(void *), void *),
+		 void *(*func)(void *), void *arg);
+__DEAD void thr_exit(void *value);
+int thr_join(int tid, void **valuep);
+
+#endif /* _THR_H_ */
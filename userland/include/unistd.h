@@ -145,11 +145,29 @@ ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+ssize_t copy_file_range(int infile, int outfile, size_t size);
+int fdatasync(int filehandle);
+int sync_file_range(int filehandle, off_t pos, off_t len);
+int fallocate(int filehandle, int mode, off_t pos, off_t len);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
+ssize_t dmesg(char *buf, size_t buflen);
+int sem_op(int filehandle, int delta);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
+/* fstatat, mkdirat - see sys/stat.h */
+
+/*
+ * openat and unlinkat are open and remove (or rmdir, with flags
+ * AT_REMOVEDIR), except that a relative name starts from the
+ * directory open on DIRFD. With DIRFD AT_FDCWD they're the same.
+ */
+int openat(int dirfd, const char *filename, int flags, ...);
+int unlinkat(int dirfd, const char *filename, int flags);
 
 /*
  * These are not themselves system calls, but wrapper routines in libc.
@@ -157,6 +175,14 @@ ssize_t __getcwd(char *buf, size_t buflen);
 
 int execvp(const char *prog, char *const *args); /* calls execv */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
-time_t time(time_t *seconds);			/* calls __time */
+time_t time(time_t *seconds);			/* reads the time page */
+int clock_gettime(int clock, struct timespec *ts);	/* ditto */
+
+/*
+ * fork and execv are wrappers too: they flush stdout (see stdio.h)
+ * and then make these system calls.
+ */
+pid_t __fork(void);
+int __execv(const char *prog, char *const *args);
 
 #endif /* _UNISTD_H_ */
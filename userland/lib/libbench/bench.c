@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * bench.c
+ *
+ * 	Timing, calibration and reporting for the benchmarks; see
+ *	bench.h.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+#include <bench.h>
+
+/* Histogram buckets: up to 2^(BENCH_NBUCKETS-1) ns per operation. */
+#define BENCH_NBUCKETS	40
+
+uint64_t
+bench_ns(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	if (__time(&secs, &nsecs) < 0) {
+		err(1, "__time");
+	}
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+uint64_t
+bench_coarse_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		err(1, "clock_gettime");
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+unsigned
+bench_calibrate(void (*fn)(void *arg, unsigned n), void *arg,
+		uint64_t target)
+{
+	uint64_t start;
+	unsigned n;
+
+	for (n = 1; n < BENCH_MAXBATCH; n *= 2) {
+		start = bench_ns();
+		fn(arg, n);
+		if (bench_ns() - start >= target) {
+			break;
+		}
+	}
+	return n;
+}
+
+void
+bench_run(const char *name, void (*fn)(void *arg, unsigned n), void *arg,
+	  unsigned nsamples, const char *extra)
+{
+	uint64_t *samples, start;
+	unsigned i, n;
+
+	samples = malloc(nsamples * sizeof(samples[0]));
+	if (samples == NULL) {
+		err(1, "%s: malloc", name);
+	}
+
+	/* (faults in the program's memory, gets files into the cache) */
+	fn(arg, 1);
+	n = bench_calibrate(fn, arg, BENCH_SAMPLENS);
+
+	for (i=0; i<nsamples; i++) {
+		start = bench_ns();
+		fn(arg, n);
+		samples[i] = bench_ns() - start;
+	}
+	bench_report(name, samples, nsamples, n, extra);
+	free(samples);
+}
+
+static
+int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* The Pth percentile of the NSAMPLES sorted samples, per operation. */
+static
+unsigned long
+percentile(const uint64_t *samples, unsigned nsamples, unsigned p,
+	   unsigned opsper)
+{
+	unsigned i;
+
+	i = (nsamples * p) / 100;
+	if (i >= nsamples) {
+		i = nsamples - 1;
+	}
+	return samples[i] / opsper;
+}
+
+/* The BENCHHIST line for the NSAMPLES samples, per operation. */
+static
+void
+histogram(const char *name, const uint64_t *samples, unsigned nsamples,
+	  unsigned opsper)
+{
+	unsigned counts[BENCH_NBUCKETS];
+	uint64_t per;
+	unsigned i, b;
+
+	for (b=0; b<BENCH_NBUCKETS; b++) {
+		counts[b] = 0;
+	}
+	for (i=0; i<nsamples; i++) {
+		per = samples[i] / opsper;
+		for (b=0; b < BENCH_NBUCKETS - 1 && per > ((uint64_t)1 << b);
+		     b++) {
+			/* nothing */
+		}
+		counts[b]++;
+	}
+
+	printf("BENCHHIST %s", name);
+	for (b=0; b<BENCH_NBUCKETS; b++) {
+		if (counts[b] > 0) {
+			printf(" le%llu=%u",
+			       (unsigned long long)1 << b, counts[b]);
+		}
+	}
+	printf("\n");
+}
+
+void
+bench_report(const char *name, uint64_t *samples, unsigned nsamples,
+	     unsigned opsper, const char *extra)
+{
+	uint64_t total;
+	unsigned i;
+
+	if (nsamples == 0 || opsper == 0) {
+		errx(1, "%s: no samples", name);
+	}
+
+	total = 0;
+	for (i=0; i<nsamples; i++) {
+		total += samples[i];
+	}
+	qsort(samples, nsamples, sizeof(samples[0]), cmp_u64);
+
+	printf("BENCH %s ops=%lu ns/op=%lu p50=%lu p90=%lu p99=%lu max=%lu",
+	       name, (unsigned long)nsamples * opsper,
+	       (unsigned long)(total / ((uint64_t)nsamples * opsper)),
+	       percentile(samples, nsamples, 50, opsper),
+	       percentile(samples, nsamples, 90, opsper),
+	       percentile(samples, nsamples, 99, opsper),
+	       (unsigned long)(samples[nsamples - 1] / opsper));
+	if (extra != NULL) {
+		printf(" %s", extra);
+	}
+	printf("\n");
+	histogram(name, samples, nsamples, opsper);
+}
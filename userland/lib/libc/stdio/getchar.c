@@ -41,6 +41,9 @@ getchar(void)
 	char ch;
 	int len;
 
+	/* show any prompt before waiting for the answer */
+	fflush(stdout);
+
 	len = read(STDIN_FILENO, &ch, 1);
 	if (len<=0) {
 		/* end of file or error */
@@ -28,23 +28,19 @@
  */
 
 #include <stdio.h>
-#include <unistd.h>
 
 /*
- * C standard function - print a single character.
- *
- * Properly, stdio is supposed to be buffered, but for present purposes
- * writing that code is not really worthwhile.
+ * C standard function - print a single character (to the stdout
+ * buffer; see stdout.c).
  */
 
 int
 putchar(int ch)
 {
 	char c = ch;
-	int len;
-	len = write(STDOUT_FILENO, &c, 1);
-	if (len<=0) {
+
+	if (__stdio_write(stdout, &c, 1)) {
 		return EOF;
 	}
-	return ch;
+	return (int)(unsigned char)c;
 }
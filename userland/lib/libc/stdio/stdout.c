@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <futex.h>
+#include <atomic.h>
+
+/*
+ * Buffered standard output.
+ *
+ * Everything written to stdout (putchar, puts, printf) goes through
+ * __stdio_write into one buffer, which is written out in one system
+ * call when it fills, or, if stdout is the console (a character
+ * device), at the end of every line. fflush writes it out on demand,
+ * and exit, getchar, the err/warn functions, assert, fork, execv and
+ * spawn all flush it first, so output still comes out in the order
+ * it was written and isn't lost or doubled.
+ *
+ * The buffer is shared by all the threads of a process, so it has a
+ * lock: a futex word that's 0 when free, 1 when held, and 2 when held
+ * with someone waiting.
+ */
+
+struct __file {
+	int f_fd;
+	int f_mode;			/* FILE_MODE_*, or -1 until known */
+	volatile int f_lock;
+	size_t f_len;			/* bytes in f_buf */
+	char f_buf[BUFSIZ];
+};
+
+#define FILE_MODE_LINE	0	/* write out at each newline */
+#define FILE_MODE_FULL	1	/* write out when full */
+
+static FILE stdout_file = { STDOUT_FILENO, -1, 0, 0, { 0 } };
+FILE *stdout = &stdout_file;
+
+static
+void
+file_lock(FILE *f)
+{
+	int c;
+
+	c = atomic_cas(&f->f_lock, 0, 1);
+	while (c != 0) {
+		if (c == 2 || atomic_cas(&f->f_lock, 1, 2) != 0) {
+			futex_wait(&f->f_lock, 2);
+		}
+		c = atomic_cas(&f->f_lock, 0, 2);
+	}
+}
+
+static
+void
+file_unlock(FILE *f)
+{
+	if (atomic_cas(&f->f_lock, 1, 0) != 1) {
+		/* it was 2: someone's waiting */
+		f->f_lock = 0;
+		futex_wake(&f->f_lock, 1);
+	}
+}
+
+/*
+ * Write out what's in the buffer. Call with the lock held.
+ */
+static
+int
+file_flush(FILE *f)
+{
+	size_t done;
+	ssize_t r;
+	int ret = 0;
+
+	for (done = 0; done < f->f_len; done += r) {
+		r = write(f->f_fd, f->f_buf + done, f->f_len - done);
+		if (r <= 0) {
+			/* drop the rest rather than trying it forever */
+			ret = EOF;
+			break;
+		}
+	}
+	f->f_len = 0;
+	return ret;
+}
+
+/*
+ * Add LEN bytes at DATA to F's buffer, writing it out as needed.
+ * Returns 0, or EOF if a write failed.
+ */
+int
+__stdio_write(FILE *f, const char *data, size_t len)
+{
+	struct stat st;
+	size_t n, i;
+	int ret = 0, olderrno, newline = 0;
+
+	file_lock(f);
+
+	if (f->f_mode < 0) {
+		olderrno = errno;
+		if (fstat(f->f_fd, &st) == 0 && !S_ISCHR(st.st_mode)) {
+			f->f_mode = FILE_MODE_FULL;
+		}
+		else {
+			f->f_mode = FILE_MODE_LINE;
+		}
+		errno = olderrno;
+	}
+
+	while (len > 0) {
+		n = BUFSIZ - f->f_len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(f->f_buf + f->f_len, data, n);
+		for (i=0; i<n && f->f_mode == FILE_MODE_LINE && !newline; i++) {
+			if (data[i] == '\n') {
+				newline = 1;
+			}
+		}
+		f->f_len += n;
+		data += n;
+		len -= n;
+		if (f->f_len == BUFSIZ && file_flush(f)) {
+			ret = EOF;
+		}
+	}
+	if (newline && f->f_len > 0 && file_flush(f)) {
+		ret = EOF;
+	}
+
+	file_unlock(f);
+	return ret;
+}
+
+/*
+ * C standard I/O function - write out F's buffer, or every buffer if
+ * F is NULL. (There's only stdout.)
+ */
+int
+fflush(FILE *f)
+{
+	int ret = 0;
+
+	if (f == NULL) {
+		f = stdout;
+	}
+	if (f->f_len > 0) {
+		file_lock(f);
+		ret = file_flush(f);
+		file_unlock(f);
+	}
+	return ret;
+}
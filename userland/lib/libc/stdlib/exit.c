@@ -28,6 +28,7 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <unistd.h>
 
 /*
@@ -41,6 +42,7 @@ exit(int code)
 	 * In a more complicated libc, this would call functions registered
 	 * with atexit() before calling the syscall to actually exit.
 	 */
+	fflush(NULL);
 
 #ifdef __mips__
 	/*
@@ -30,15 +30,27 @@
 /*
  * User-level malloc and free implementation.
  *
- * This is a basic first-fit allocator. It's intended to be simple and
- * easy to follow. It performs abysmally if the heap becomes larger than
- * physical memory. To get (much) better out-of-core performance, port
- * the kernel's malloc. :-)
+ * The heap is a sequence of blocks, each with a header giving the
+ * sizes of it and the block before, so free can merge a block with
+ * its neighbours straight away. Free blocks are kept on segregated
+ * free lists by size (see below), so malloc goes straight to blocks
+ * that fit instead of walking the heap, and neither gets slower as
+ * the heap grows. It still doesn't do anything clever about heaps
+ * larger than physical memory.
+ *
+ * All threads share the heap, so it has a lock; to keep them from
+ * queueing up on it, small requests (up to MCACHE_MAXSIZE bytes) are
+ * mostly served without it, by a cache of the calling thread's own
+ * (see "Thread caches" below).
  */
 
 #include <stdlib.h>
 #include <stdint.h>  // for uintptr_t on non-OS/161 platforms
 #include <unistd.h>
+#include <sys/mman.h>
+#include <futex.h>
+#include <thr.h>
+#include <atomic.h>
 #include <err.h>
 #include <assert.h>
 
@@ -223,6 +235,139 @@ __malloc_init(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Free lists.
+ *
+ * Every free block is on exactly one of NBINS doubly-linked lists,
+ * chosen by its size; the links live in the block's data area, which
+ * is always at least MBLOCKSIZE bytes, room for two pointers. Sizes
+ * up to NSMALLBINS blocks each have a bin of their own, so any block
+ * in the right small bin fits exactly. Bigger sizes share a bin per
+ * power of two. __malloc_binmap has a bit set for each bin that isn't
+ * empty, so finding the next bin up with anything in it doesn't mean
+ * looking at the empty ones.
+ *
+ * Since each header also says where the previous one is (a boundary
+ * tag, in effect), free can find both neighbours of a block, take
+ * them off their lists and merge with them without searching; and
+ * malloc only ever looks at more than one block when the request is
+ * bigger than NSMALLBINS blocks, and then only within one bin.
+ */
+
+struct mfree {
+	struct mfree *mf_next;
+	struct mfree *mf_prev;
+};
+
+#define M_FREE(mh)	((struct mfree *)M_DATA(mh))
+#define M_FROMFREE(mf)	(((struct mheader *)(mf))-1)
+
+#define NSMALLBINS	64
+#define NBINS		(NSMALLBINS + 32)
+#define BINMAPBITS	32
+
+static struct mfree *__malloc_bins[NBINS];
+static uint32_t __malloc_binmap[NBINS / BINMAPBITS];
+
+/* The highest block in the heap, or NULL if the heap is empty. */
+static struct mheader *__heaplast;
+
+/*
+ * Which bin a block of SIZE data bytes (a nonzero multiple of
+ * MBLOCKSIZE) goes in.
+ */
+static
+unsigned
+__malloc_bin(size_t size)
+{
+	size_t nblocks = size >> MBLOCKSHIFT;
+	unsigned bin;
+
+	if (nblocks <= NSMALLBINS) {
+		return nblocks - 1;
+	}
+	/* NSMALLBINS is 2^6, so 65-127 blocks are bin NSMALLBINS */
+	bin = NSMALLBINS;
+	for (nblocks >>= 7; nblocks > 0; nblocks >>= 1) {
+		bin++;
+	}
+	return bin < NBINS ? bin : NBINS - 1;
+}
+
+static
+void
+__malloc_binadd(struct mheader *mh)
+{
+	unsigned bin = __malloc_bin(M_SIZE(mh));
+	struct mfree *mf = M_FREE(mh);
+
+	mf->mf_prev = NULL;
+	mf->mf_next = __malloc_bins[bin];
+	if (mf->mf_next != NULL) {
+		mf->mf_next->mf_prev = mf;
+	}
+	__malloc_bins[bin] = mf;
+	__malloc_binmap[bin / BINMAPBITS] |= (uint32_t)1 << (bin % BINMAPBITS);
+}
+
+static
+void
+__malloc_binremove(struct mheader *mh)
+{
+	unsigned bin = __malloc_bin(M_SIZE(mh));
+	struct mfree *mf = M_FREE(mh);
+
+	if (mf->mf_prev != NULL) {
+		mf->mf_prev->mf_next = mf->mf_next;
+	}
+	else {
+		if (__malloc_bins[bin] != mf) {
+			errx(1, "malloc: Heap corrupt; free block %p not"
+			     " on its list", mh);
+		}
+		__malloc_bins[bin] = mf->mf_next;
+		if (mf->mf_next == NULL) {
+			__malloc_binmap[bin / BINMAPBITS] &=
+				~((uint32_t)1 << (bin % BINMAPBITS));
+		}
+	}
+	if (mf->mf_next != NULL) {
+		mf->mf_next->mf_prev = mf->mf_prev;
+	}
+}
+
+/*
+ * The first bin after BIN that isn't empty, or NBINS if there isn't
+ * one.
+ */
+static
+unsigned
+__malloc_nextbin(unsigned bin)
+{
+	uint32_t bits;
+	unsigned word;
+
+	bin++;
+	word = bin / BINMAPBITS;
+	if (word >= NBINS / BINMAPBITS) {
+		return NBINS;
+	}
+	bits = __malloc_binmap[word] & ~(((uint32_t)1 << (bin % BINMAPBITS)) - 1);
+	while (bits == 0) {
+		word++;
+		if (word >= NBINS / BINMAPBITS) {
+			return NBINS;
+		}
+		bits = __malloc_binmap[word];
+	}
+	for (bin = word * BINMAPBITS; (bits & 1) == 0; bits >>= 1) {
+		bin++;
+	}
+	return bin;
+}
+
+////////////////////////////////////////////////////////////
+
 #ifdef MALLOCDEBUG
 
 /*
@@ -301,7 +446,8 @@ __malloc_sbrk(size_t size)
 /*
  * Make a new (free) block from the block passed in, leaving size
  * bytes for data in the current block. size must be a multiple of
- * MBLOCKSIZE.
+ * MBLOCKSIZE. The new block goes on its free list; mh must not be
+ * on one.
  *
  * Only split if the excess space is at least twice the blocksize -
  * one blocksize to hold a header and one for data.
@@ -343,17 +489,65 @@ __malloc_split(struct mheader *mh, size_t size)
 	if (mhnext != (struct mheader *) __heaptop) {
 		mhnext->mh_prevblock = mhnew->mh_nextblock;
 	}
+	else {
+		__heaplast = mhnew;
+	}
+
+	/*
+	 * The block after mhnew was after mh, which was either in use
+	 * or just taken off a free list for us, in which case its
+	 * neighbours aren't free; so mhnew doesn't need merging.
+	 */
+	__malloc_binadd(mhnew);
 }
 
 /*
- * malloc itself.
+ * Find a free block with at least SIZE bytes of data, and take it
+ * off its list. Returns NULL if there isn't one.
  */
+static
+struct mheader *
+__malloc_find(size_t size)
+{
+	struct mheader *mh;
+	struct mfree *mf;
+	unsigned bin;
+
+	bin = __malloc_bin(size);
+
+	/* In a small bin everything fits; in a big one, look for one. */
+	for (mf = __malloc_bins[bin]; mf != NULL; mf = mf->mf_next) {
+		mh = M_FROMFREE(mf);
+		if (!M_OK(mh) || mh->mh_inuse) {
+			errx(1, "malloc: Heap corrupt; bad free block %p", mh);
+		}
+		if (M_SIZE(mh) >= size) {
+			__malloc_binremove(mh);
+			return mh;
+		}
+	}
+
+	/* Everything in a later bin fits. */
+	bin = __malloc_nextbin(bin);
+	if (bin == NBINS) {
+		return NULL;
+	}
+	mh = M_FROMFREE(__malloc_bins[bin]);
+	if (!M_OK(mh) || mh->mh_inuse) {
+		errx(1, "malloc: Heap corrupt; bad free block %p", mh);
+	}
+	__malloc_binremove(mh);
+	return mh;
+}
+
+/*
+ * Allocate SIZE bytes from the heap. Call with the heap locked.
+ */
+static
 void *
-malloc(size_t size)
+__malloc_heapalloc(size_t size)
 {
 	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
 	size_t morespace;
 	void *p;
 
@@ -372,42 +566,17 @@ malloc(size_t size)
 	__malloc_dump();
 #endif
 
-	/* Round size up to an integral number of blocks. */
-	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
-
 	/*
-	 * First-fit search algorithm for available blocks.
-	 * Check to make sure the next/previous sizes all agree.
+	 * Round size up to an integral number of blocks, and at least
+	 * one (the free list links need the room).
 	 */
-	rightprevblock = 0;
-	mh = NULL;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
-		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i,
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
-		}
-		rightprevblock = mh->mh_nextblock;
-
-		/* Can't allocate a block that's in use. */
-		if (mh->mh_inuse) {
-			continue;
-		}
-
-		/* Can't allocate a block that isn't big enough. */
-		if (M_SIZE(mh) < size) {
-			continue;
-		}
+	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
+	if (size == 0) {
+		size = MBLOCKSIZE;
+	}
 
+	mh = __malloc_find(size);
+	if (mh != NULL) {
 		/* Try splitting block. */
 		__malloc_split(mh, size);
 
@@ -422,17 +591,14 @@ malloc(size_t size)
 #endif
 		return M_DATA(mh);
 	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
-	}
 
 	/*
 	 * Didn't find anything. Expand the heap.
 	 *
-	 * If the heap is nonempty and the top block (the one mh is
-	 * left pointing to after the above loop) is free, we can
-	 * expand it. Otherwise we need a new block.
+	 * If the top block is free, we can expand it. Otherwise we
+	 * need a new block.
 	 */
+	mh = __heaplast;
 	if (mh != NULL && !mh->mh_inuse) {
 		assert(size > M_SIZE(mh));
 		morespace = size - M_SIZE(mh);
@@ -451,18 +617,21 @@ malloc(size_t size)
 
 	if (mh != NULL && !mh->mh_inuse) {
 		/* update old header */
+		__malloc_binremove(mh);
 		mh->mh_nextblock = M_MKFIELD(M_NEXTOFF(mh) + morespace);
 		mh->mh_inuse = 1;
 	}
 	else {
 		/* fill out new header */
 		mh = p;
-		mh->mh_prevblock = rightprevblock;
+		mh->mh_prevblock = __heaplast == NULL ? 0 :
+			__heaplast->mh_nextblock;
 		mh->mh_magic1 = MMAGIC;
 		mh->mh_magic2 = MMAGIC;
 		mh->mh_pad = 0;
 		mh->mh_inuse = 1;
 		mh->mh_nextblock = M_MKFIELD(morespace);
+		__heaplast = mh;
 	}
 
 	/*
@@ -481,6 +650,7 @@ malloc(size_t size)
 
 ////////////////////////////////////////////////////////////
 
+#ifdef MALLOCDEBUG
 /*
  * Clear a range of memory with 0xdeadbeef.
  * ptr must be suitably aligned.
@@ -495,13 +665,15 @@ __malloc_deadbeef(void *ptr, size_t size)
 		x[i] = 0xdeadbeef;
 	}
 }
+#endif
 
 /*
- * Attempt to merge two adjacent blocks (mh below mhnext).
+ * Merge two adjacent free blocks (mh below mhnext), neither of
+ * which is on a free list.
  */
 static
 void
-__malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
+__malloc_merge(struct mheader *mh, struct mheader *mhnext)
 {
 	struct mheader *mhnextnext;
 
@@ -509,10 +681,6 @@ __malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
 		errx(1, "free: Heap corrupt (%p and %p inconsistent)",
 		     mh, mhnext);
 	}
-	if (mh->mh_inuse || mhnext->mh_inuse) {
-		/* can't merge */
-		return;
-	}
 
 	mhnextnext = M_NEXT(mhnext);
 
@@ -522,23 +690,74 @@ __malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
 	if (mhnextnext != (struct mheader *)__heaptop) {
 		mhnextnext->mh_prevblock = mh->mh_nextblock;
 	}
+	else {
+		__heaplast = mh;
+	}
 
+#ifdef MALLOCDEBUG
 	/* Deadbeef out the memory used by the now-obsolete header */
 	__malloc_deadbeef(mhnext, sizeof(struct mheader));
+#endif
 }
 
 /*
- * The actual free() implementation.
+ * Hand the whole pages inside a free block back to the kernel. They
+ * stay part of the heap, and come back zero-filled if the block is
+ * reused. Only worth a system call for fairly large blocks.
  */
+#define MRELEASE_MIN (4*PAGE_SIZE)
+
+static
 void
-free(void *x)
+__malloc_release(struct mheader *mh)
 {
-	struct mheader *mh, *mhnext, *mhprev;
+	uintptr_t start, end;
+
+	/* keep the first page: the free list links are in it */
+	start = ((uintptr_t)(M_FREE(mh) + 1) + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE-1);
+	end = (uintptr_t)M_NEXT(mh) & ~(uintptr_t)(PAGE_SIZE-1);
+	if (end >= start + MRELEASE_MIN) {
+		/* purely an optimization, so ignore failure */
+		(void)madvise((void *)start, end - start, MADV_DONTNEED);
+	}
+}
 
-	if (x==NULL) {
-		/* safest practice */
+/*
+ * If the free block at the top of the heap has a lot of whole pages
+ * in it, give them back to the kernel by shrinking the heap, so a
+ * process that frees most of its memory doesn't keep its peak size.
+ * The block must not be on a free list (its size changes).
+ */
+#define MTRIM_MIN (16*PAGE_SIZE)
+
+static
+void
+__malloc_trim(struct mheader *mh)
+{
+	uintptr_t newtop;
+
+	/* leave the header and one unit of data, and a whole page */
+	newtop = ((uintptr_t)M_DATA(mh) + MBLOCKSIZE + PAGE_SIZE - 1) &
+		~(uintptr_t)(PAGE_SIZE-1);
+	if (newtop + MTRIM_MIN > __heaptop) {
 		return;
 	}
+	if (sbrk(-(intptr_t)(__heaptop - newtop)) == (void *)-1) {
+		/* purely an optimization, so ignore failure */
+		return;
+	}
+	__heaptop = newtop;
+	mh->mh_nextblock = M_MKFIELD(newtop - (uintptr_t)mh);
+}
+
+/*
+ * Give block X back to the heap. Call with the heap locked.
+ */
+static
+void
+__malloc_heapfree(void *x)
+{
+	struct mheader *mh, *mhnext, *mhprev;
 
 	/* Consistency check. */
 	if (__heapbase==0 || __heaptop==0 || __heapbase > __heaptop) {
@@ -569,23 +788,400 @@ free(void *x)
 	/* mark it free */
 	mh->mh_inuse = 0;
 
+#ifdef MALLOCDEBUG
 	/* wipe it */
 	__malloc_deadbeef(M_DATA(mh), M_SIZE(mh));
+#endif
 
-	/* Try merging with the block above (but not if we're at the top) */
+	/* Merge with the block above if it's free (and there is one) */
 	mhnext = M_NEXT(mh);
-	if (mhnext != (struct mheader *)__heaptop) {
-		__malloc_trymerge(mh, mhnext);
+	if (mhnext != (struct mheader *)__heaptop && !mhnext->mh_inuse) {
+		__malloc_binremove(mhnext);
+		__malloc_merge(mh, mhnext);
 	}
 
-	/* Try merging with the block below (but not if we're at the bottom) */
+	/* Merge with the block below if it's free (and there is one) */
 	if (mh != (struct mheader *)__heapbase) {
 		mhprev = M_PREV(mh);
-		__malloc_trymerge(mhprev, mh);
+		if (!M_OK(mhprev)) {
+			errx(1, "free: Heap corrupt (bad header below %p)", x);
+		}
+		if (!mhprev->mh_inuse) {
+			__malloc_binremove(mhprev);
+			__malloc_merge(mhprev, mh);
+			mh = mhprev;
+		}
 	}
 
+	/* Shrink the heap if this is a big block at the top */
+	if (mh == __heaplast) {
+		__malloc_trim(mh);
+	}
+
+	__malloc_binadd(mh);
+
+	/* Give the pages of a big free block in the middle back */
+	__malloc_release(mh);
+
 #ifdef MALLOCDEBUG
 	warnx("free: freed %p", x);
 	__malloc_dump();
 #endif
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Thread caches.
+ *
+ * Requests of up to MCACHE_MAXSIZE bytes are rounded up to one of
+ * MNCLASSES size classes and come from runs: MRUN_SIZE-byte pages,
+ * mmap'd MRUN_BATCH at a time and handed out from a central pool
+ * under the heap lock, each cut into blocks of one class with a
+ * struct mrun at the front saying which class and whose they are.
+ * Blocks in runs have no header of their own; free tells them from
+ * heap blocks by the page they're on, which __malloc_runmap has a bit
+ * for if it's a run.
+ *
+ * Each of the first MCACHE_NSLOTS threads has a cache: a free list
+ * per class that only that thread touches, so it allocates and frees
+ * its own blocks without any lock or atomic operation, and goes to
+ * the central pool only for a whole run at a time. A block freed by
+ * some other thread is pushed (with compare-and-swap, as many may do
+ * this at once) onto the owning cache's mc_remote list, which the
+ * owner takes over in one go next time one of its lists runs dry.
+ * Runs aren't given back: the blocks stay with their cache, and a
+ * cache whose thread ends goes, as is, to the next thread that starts.
+ *
+ * There's no thread-local storage, so malloc finds the caller's cache
+ * from its stack pointer (as libtask does): the first thread's stack
+ * is above TIMEPAGE and every other thread's is THR_STACKSIZE bytes
+ * below the top thr_create's start routine records in
+ * __malloc_thrstart. Threads beyond MCACHE_NSLOTS, and the ones
+ * started some other way, find none and use the heap, locked.
+ */
+
+#define MCACHE_MAXSIZE	64
+#define MNCLASSES	4
+#define MCACHE_NSLOTS	32
+#define MRUN_SIZE	4096
+#define MRUN_BATCH	16
+#define MRUN_MAGIC	0x6d72756e
+
+static const size_t __malloc_classsize[MNCLASSES] = { 16, 32, 48, 64 };
+
+struct mblock {
+	struct mblock *mb_next;
+};
+
+struct mrun {
+	uint32_t mr_magic;		/* MRUN_MAGIC */
+	uint32_t mr_class;		/* size class of its blocks */
+	uint32_t mr_slot;		/* the cache they belong to */
+	uint32_t mr_pad;
+};
+
+#define MRUN_OF(p)	((struct mrun *)((uintptr_t)(p) & ~(uintptr_t)(MRUN_SIZE-1)))
+
+struct mcache {
+	void *volatile mc_stacktop;	/* owner's, NULL if it has none */
+	struct mblock *mc_free[MNCLASSES];
+	void *volatile mc_remote;	/* blocks freed by other threads */
+};
+
+static struct mcache __malloc_caches[MCACHE_NSLOTS];
+
+/* Free runs. */
+static struct mblock *__malloc_runpool;
+
+/*
+ * A bit for each page below TIMEPAGE (which is as high as mmap goes)
+ * saying whether it's a run. Bits are set, under the heap lock, when
+ * the batch is mmap'd and never cleared, as runs aren't given back, so
+ * free can look without the lock: a page's bit is set before any block
+ * on it is handed out, and never changes otherwise. Only the words
+ * for pages that are really in use are ever touched.
+ */
+#define MRUN_NPAGES	(TIMEPAGE / MRUN_SIZE)
+#define MRUN_MAPBIT(page) ((uint32_t)1 << ((page) % 32))
+static uint32_t __malloc_runmap[MRUN_NPAGES / 32];
+
+/* The heap lock: 0 free, 1 held, 2 held with someone waiting. */
+static volatile int __malloc_lockword;
+
+static
+void
+__malloc_lock(void)
+{
+	int c;
+
+	c = atomic_cas(&__malloc_lockword, 0, 1);
+	while (c != 0) {
+		if (c == 2 || atomic_cas(&__malloc_lockword, 1, 2) != 0) {
+			futex_wait(&__malloc_lockword, 2);
+		}
+		c = atomic_cas(&__malloc_lockword, 0, 2);
+	}
+}
+
+static
+void
+__malloc_unlock(void)
+{
+	if (atomic_cas(&__malloc_lockword, 1, 0) != 1) {
+		/* it was 2: someone's waiting */
+		__malloc_lockword = 0;
+		futex_wake(&__malloc_lockword, 1);
+	}
+}
+
+/*
+ * The calling thread's cache, or NULL if it hasn't got one.
+ */
+static
+struct mcache *
+__malloc_self(void)
+{
+	char here;
+	uintptr_t sp = (uintptr_t)&here, top;
+	unsigned i;
+
+	if (sp >= TIMEPAGE) {
+		return &__malloc_caches[0];
+	}
+	for (i=1; i<MCACHE_NSLOTS; i++) {
+		top = (uintptr_t)__malloc_caches[i].mc_stacktop;
+		if (sp < top && sp >= top - THR_STACKSIZE) {
+			return &__malloc_caches[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * A thread is starting with its stack at SP, or ending. Called by
+ * thr_create's start routine, on the thread itself.
+ */
+void
+__malloc_thrstart(void *sp)
+{
+	uintptr_t top;
+	unsigned i;
+
+	/* stacks are whole pages; take the top of ours */
+	top = ((uintptr_t)sp + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE-1);
+
+	/* a thread that left without __malloc_thrend had ours */
+	for (i=1; i<MCACHE_NSLOTS; i++) {
+		if ((uintptr_t)__malloc_caches[i].mc_stacktop == top) {
+			return;
+		}
+	}
+	for (i=1; i<MCACHE_NSLOTS; i++) {
+		if (__malloc_caches[i].mc_stacktop == NULL &&
+		    atomic_cas_ptr(&__malloc_caches[i].mc_stacktop,
+				   NULL, (void *)top) == NULL) {
+			return;
+		}
+	}
+	/* none left; use the heap */
+}
+
+void
+__malloc_thrend(void)
+{
+	struct mcache *mc;
+
+	mc = __malloc_self();
+	if (mc != NULL && mc != &__malloc_caches[0]) {
+		mc->mc_stacktop = NULL;
+	}
+}
+
+/*
+ * Take a free run from the central pool, mmapping some more if it's
+ * empty. Call with the heap locked.
+ */
+static
+struct mrun *
+__malloc_getrun(void)
+{
+	struct mblock *mb;
+	uintptr_t page;
+	char *p;
+	unsigned i;
+
+	if (__malloc_runpool == NULL) {
+		p = mmap(NULL, MRUN_BATCH * MRUN_SIZE, PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANON, -1, 0);
+		if (p == MAP_FAILED) {
+			return NULL;
+		}
+		for (i=0; i<MRUN_BATCH; i++) {
+			mb = (struct mblock *)(p + i * MRUN_SIZE);
+			mb->mb_next = __malloc_runpool;
+			__malloc_runpool = mb;
+			page = (uintptr_t)mb / MRUN_SIZE;
+			__malloc_runmap[page / 32] |= MRUN_MAPBIT(page);
+		}
+	}
+	mb = __malloc_runpool;
+	__malloc_runpool = mb->mb_next;
+	return (struct mrun *)mb;
+}
+
+/*
+ * Put blocks on MC's list for class C, first the ones other threads
+ * have freed and then, if none were of that class, a new run's worth.
+ * Returns 0 if there's no memory for a run.
+ */
+static
+int
+__malloc_refill(struct mcache *mc, unsigned c)
+{
+	struct mblock *mb, *next;
+	struct mrun *run;
+	void *old;
+	size_t size;
+	unsigned i, n;
+
+	do {
+		old = mc->mc_remote;
+	} while (old != NULL &&
+		 atomic_cas_ptr(&mc->mc_remote, old, NULL) != old);
+	for (mb = old; mb != NULL; mb = next) {
+		next = mb->mb_next;
+		run = MRUN_OF(mb);
+		mb->mb_next = mc->mc_free[run->mr_class];
+		mc->mc_free[run->mr_class] = mb;
+	}
+	if (mc->mc_free[c] != NULL) {
+		return 1;
+	}
+
+	__malloc_lock();
+	run = __malloc_getrun();
+	__malloc_unlock();
+	if (run == NULL) {
+		return 0;
+	}
+	run->mr_magic = MRUN_MAGIC;
+	run->mr_class = c;
+	run->mr_slot = mc - __malloc_caches;
+	run->mr_pad = 0;
+
+	/* put them on in address order */
+	size = __malloc_classsize[c];
+	n = (MRUN_SIZE - sizeof(struct mrun)) / size;
+	for (i=n; i-- > 0; ) {
+		mb = (struct mblock *)((char *)(run + 1) + i * size);
+		mb->mb_next = mc->mc_free[c];
+		mc->mc_free[c] = mb;
+	}
+	return 1;
+}
+
+/*
+ * Is X on a run?
+ */
+static
+int
+__malloc_isrun(void *x)
+{
+	uintptr_t page;
+
+	if ((uintptr_t)x >= TIMEPAGE) {
+		return 0;
+	}
+	page = (uintptr_t)x / MRUN_SIZE;
+	return (__malloc_runmap[page / 32] & MRUN_MAPBIT(page)) != 0;
+}
+
+/*
+ * Free block X of a run.
+ */
+static
+void
+__malloc_runfree(void *x)
+{
+	struct mcache *mc;
+	struct mblock *mb = x;
+	struct mrun *run;
+	void *old;
+
+	run = MRUN_OF(x);
+	if (run->mr_magic != MRUN_MAGIC || run->mr_class >= MNCLASSES
+	    || run->mr_slot >= MCACHE_NSLOTS
+	    || (uintptr_t)x < (uintptr_t)(run + 1)
+	    || ((uintptr_t)x - (uintptr_t)(run + 1)) %
+	       __malloc_classsize[run->mr_class] != 0) {
+		errx(1, "free: Invalid pointer %p freed", x);
+	}
+
+	mc = &__malloc_caches[run->mr_slot];
+	if (mc == __malloc_self()) {
+		mb->mb_next = mc->mc_free[run->mr_class];
+		mc->mc_free[run->mr_class] = mb;
+		return;
+	}
+
+	/* someone else's: give it back to them */
+	do {
+		old = mc->mc_remote;
+		mb->mb_next = old;
+	} while (atomic_cas_ptr(&mc->mc_remote, old, mb) != old);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * malloc itself.
+ */
+void *
+malloc(size_t size)
+{
+	struct mcache *mc;
+	struct mblock *mb;
+	unsigned c;
+	void *p;
+
+	if (size <= MCACHE_MAXSIZE) {
+		mc = __malloc_self();
+		for (c=0; mc != NULL && __malloc_classsize[c] < size; c++) {
+			/* find the class */
+		}
+		if (mc != NULL &&
+		    (mc->mc_free[c] != NULL || __malloc_refill(mc, c))) {
+			mb = mc->mc_free[c];
+			mc->mc_free[c] = mb->mb_next;
+			return mb;
+		}
+		/* if there's no memory for a run, the heap may have some */
+	}
+
+	__malloc_lock();
+	p = __malloc_heapalloc(size);
+	__malloc_unlock();
+	return p;
+}
+
+/*
+ * The actual free() implementation.
+ */
+void
+free(void *x)
+{
+	if (x==NULL) {
+		/* safest practice */
+		return;
+	}
+
+	if (__malloc_isrun(x)) {
+		__malloc_runfree(x);
+	}
+	else {
+		__malloc_lock();
+		__malloc_heapfree(x);
+		__malloc_unlock();
+	}
+}
@@ -27,119 +27,217 @@
  * SUCH DAMAGE.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
-#include <string.h>
-#include <assert.h>
 
 /*
  * qsort() for OS/161, where it isn't in libc.
+ *
+ * This is an introsort: quicksort with a median-of-three pivot, down
+ * to partitions of ISORT_MAX elements or fewer, which are finished
+ * with insertion sort. If the quicksort recurses more than about
+ * 2 log2(num) levels deep, the input is one that defeats the pivot
+ * choice, and that partition is heapsorted instead, so the worst case
+ * is O(n log n) and not O(n^2). Only the smaller side of a partition
+ * is recursed on, so the stack stays O(log n) too.
  */
+
+#define ISORT_MAX 16
+
+struct sortctx {
+	size_t size;
+	int (*f)(const void *, const void *);
+	int swaptype;		/* SWAP_* below */
+};
+
+#define SWAP_WORD 0		/* one aligned long */
+#define SWAP_WORDS 1		/* several aligned longs */
+#define SWAP_BYTES 2
+
+static
 void
-qsort(void *vdata, unsigned num, size_t size,
-      int (*f)(const void *, const void *))
+swap(const struct sortctx *sc, char *a, char *b)
 {
-	unsigned pivot, head, tail;
-	char *data = vdata;
-	char tmp[size];
+	if (sc->swaptype == SWAP_WORD) {
+		long t = *(long *)a;
+		*(long *)a = *(long *)b;
+		*(long *)b = t;
+	}
+	else if (sc->swaptype == SWAP_WORDS) {
+		long *la = (long *)a, *lb = (long *)b, t;
+		size_t i;
 
-#define COMPARE(aa, bb) \
-		((aa) == (bb) ? 0 : f(data + (aa) * size, data + (bb) * size))
-#define EXCHANGE(aa, bb) \
-		memcpy(tmp, data + (aa) * size, size);			\
-		memcpy(data + (aa) * size, data + (bb) * size, size);	\
-		memcpy(data + (bb) * size, tmp, size)
+		for (i=0; i<sc->size / sizeof(long); i++) {
+			t = la[i];
+			la[i] = lb[i];
+			lb[i] = t;
+		}
+	}
+	else {
+		char t;
+		size_t i;
 
+		for (i=0; i<sc->size; i++) {
+			t = a[i];
+			a[i] = b[i];
+			b[i] = t;
+		}
+	}
+}
 
-	if (num <= 1) {
-		return;
+#define CMP(sc, a, b) ((sc)->f((a), (b)))
+
+static
+void
+insertionsort(const struct sortctx *sc, char *data, unsigned num)
+{
+	char *end = data + num * sc->size;
+	char *p, *q;
+
+	for (p = data + sc->size; p < end; p += sc->size) {
+		for (q = p; q > data && CMP(sc, q - sc->size, q) > 0;
+		     q -= sc->size) {
+			swap(sc, q - sc->size, q);
+		}
 	}
-	if (num == 2) {
-		if (COMPARE(0, 1) > 0) {
-			EXCHANGE(0, 1);
+}
+
+/* Move element I down the heap of NUM elements at DATA. */
+static
+void
+siftdown(const struct sortctx *sc, char *data, unsigned i, unsigned num)
+{
+	unsigned child;
+
+	while ((child = 2 * i + 1) < num) {
+		if (child + 1 < num &&
+		    CMP(sc, data + child * sc->size,
+			data + (child + 1) * sc->size) < 0) {
+			child++;
+		}
+		if (CMP(sc, data + i * sc->size, data + child * sc->size) >= 0) {
 			return;
 		}
+		swap(sc, data + i * sc->size, data + child * sc->size);
+		i = child;
+	}
+}
+
+static
+void
+heapsort(const struct sortctx *sc, char *data, unsigned num)
+{
+	unsigned i;
+
+	for (i = num / 2; i > 0; i--) {
+		siftdown(sc, data, i - 1, num);
+	}
+	for (i = num - 1; i > 0; i--) {
+		swap(sc, data, data + i * sc->size);
+		siftdown(sc, data, 0, i);
 	}
+}
+
+static
+void
+introsort(const struct sortctx *sc, char *data, unsigned num, unsigned depth)
+{
+	size_t size = sc->size;
+	char *lo, *mid, *hi, *i, *j;
+	unsigned nleft, nright;
 
-	/*
-	 * 1. Pick a pivot value. For simplicity, always use the
-	 * middle of the array.
-	 */
-	pivot = num / 2;
-
-	/*
-	 * 2. Shift all values less than or equal to the pivot value
-	 * to the front of the array.
-	 */
-	head = 0;
-	tail = num - 1;
-
-	while (head < tail) {
-		if (COMPARE(head, pivot) <= 0) {
-			head++;
+	while (num > ISORT_MAX) {
+		if (depth == 0) {
+			heapsort(sc, data, num);
+			return;
 		}
-		else if (COMPARE(tail, pivot) > 0) {
-			tail--;
+		depth--;
+
+		/*
+		 * Sort the first, middle, and last elements, and use
+		 * the middle one as the pivot. Then the first and last
+		 * stop the scans below without bounds checks.
+		 */
+		lo = data;
+		mid = data + (num / 2) * size;
+		hi = data + (num - 1) * size;
+		if (CMP(sc, mid, lo) < 0) {
+			swap(sc, mid, lo);
 		}
-		else {
-			EXCHANGE(head, tail);
-			if (pivot == head) {
-				pivot = tail;
-			}
-			else if (pivot == tail) {
-				pivot = head;
+		if (CMP(sc, hi, mid) < 0) {
+			swap(sc, hi, mid);
+			if (CMP(sc, mid, lo) < 0) {
+				swap(sc, mid, lo);
 			}
-			head++;
-			tail--;
 		}
-	}
 
-	/*
-	 * 3. If there's an even number of elements and we swapped the
-	 * last two, the head and tail indexes will cross. In this
-	 * case the first entry on the tail side is tail+1. If there's
-	 * an odd number of elements, we stop with head == tail, and
-	 * the first entry on the tail side is this value (hence,
-	 * tail) if it's is greater than the pivot value, and the next
-	 * element (hence, tail+1) if it's less than or equal to the
-	 * pivot value.
-	 *
-	 * Henceforth use "tail" to hold the index of the first entry
-	 * of the back portion of the array.
-	 */
-	if (head > tail || COMPARE(head, pivot) <= 0) {
-		tail++;
-	}
-
-	/*
-	 * 4. If we got a bad pivot that gave us only one partition,
-	 * because of the order of the advances in the loop above it
-	 * will always put everything in the front portion of the
-	 * array (so tail == num). This happens if we picked the
-	 * largest value. Move the pivot to the end, if necessary, lop
-	 * off all values equal to it, and recurse on the rest.  (If
-	 * there is no rest, the array is already sorted and we're
-	 * done.)
-	 */
-	if (tail == num) {
-		if (pivot < num - 1) {
-			if (COMPARE(pivot, num - 1) > 0) {
-				EXCHANGE(pivot, num - 1);
+		/*
+		 * Park the pivot next to the first element and
+		 * partition the rest. Both scans stop at elements
+		 * equal to the pivot, so runs of equal keys split
+		 * evenly instead of all going one way.
+		 */
+		swap(sc, mid, lo + size);
+		i = lo + size;
+		j = hi;
+		for (;;) {
+			do {
+				i += size;
+			} while (CMP(sc, i, lo + size) < 0);
+			do {
+				j -= size;
+			} while (CMP(sc, j, lo + size) > 0);
+			if (i >= j) {
+				break;
 			}
+			swap(sc, i, j);
 		}
-		tail = num - 1;
-		while (tail > 0 && COMPARE(tail - 1, tail) == 0) {
-			tail--;
+		swap(sc, lo + size, j);
+
+		/* J is in place; recurse on the smaller side */
+		nleft = (j - data) / size;
+		nright = num - nleft - 1;
+		if (nleft < nright) {
+			introsort(sc, data, nleft, depth);
+			data = j + size;
+			num = nright;
 		}
-		if (tail > 0) {
-			qsort(vdata, tail, size, f);
+		else {
+			introsort(sc, j + size, nright, depth);
+			num = nleft;
 		}
+	}
+
+	insertionsort(sc, data, num);
+}
+
+void
+qsort(void *vdata, unsigned num, size_t size,
+      int (*f)(const void *, const void *))
+{
+	struct sortctx sc;
+	unsigned depth, n;
+
+	if (num <= 1 || size == 0) {
 		return;
 	}
-	assert(tail > 0 && tail < num);
 
-	/*
-	 * 5. Recurse on each subpart of the array.
-	 */
-	qsort(vdata, tail, size, f);
-	qsort((char *)vdata + tail * size, num - tail, size, f);
+	sc.size = size;
+	sc.f = f;
+	if ((uintptr_t)vdata % sizeof(long) != 0 || size % sizeof(long) != 0) {
+		sc.swaptype = SWAP_BYTES;
+	}
+	else if (size == sizeof(long)) {
+		sc.swaptype = SWAP_WORD;
+	}
+	else {
+		sc.swaptype = SWAP_WORDS;
+	}
+
+	depth = 0;
+	for (n = num; n > 1; n >>= 1) {
+		depth += 2;
+	}
+
+	introsort(&sc, vdata, num, depth);
 }
@@ -19,7 +19,16 @@ awk '
 	# print the name of the call and the number.
 	print $2, $3;
     }
-' | awk '{
+' | awk '
+    # These have wrappers in libc that flush stdout first, so their
+    # stubs are called __fork and so on.
+    BEGIN { wrapped["fork"]; wrapped["execv"]; wrapped["spawn"]; }
+    {
 	# output something simple that will work in syscalls.S.
-	printf "SYSCALL(%s, %s)\n", $1, $2;
+	if ($1 in wrapped) {
+		printf "WRAPPEDSYSCALL(%s, %s)\n", $1, $2;
+	}
+	else {
+		printf "SYSCALL(%s, %s)\n", $1, $2;
+	}
 }'
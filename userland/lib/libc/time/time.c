@@ -31,12 +31,19 @@
 
 /*
  * POSIX C function: retrieve time in seconds since the epoch.
- * Uses the OS/161 system call __time, which does the same thing
- * but also returns nanoseconds.
+ * Reads the time page with clock_gettime rather than making the
+ * __time system call, which does the same thing but also returns
+ * nanoseconds.
  */
 
 time_t
 time(time_t *t)
 {
-	return __time(t, NULL);
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (t != NULL) {
+		*t = ts.tv_sec;
+	}
+	return ts.tv_sec;
 }
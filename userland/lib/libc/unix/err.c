@@ -84,6 +84,9 @@ __printerr(int use_errno, const char *fmt, va_list ap)
 	 */
 	errmsg = strerror(errno);
 
+	/* get what's already been printed to stdout out ahead of us */
+	fflush(stdout);
+
 	/*
 	 * Look up the program name.
 	 * Strictly speaking we should pull off the rightmost
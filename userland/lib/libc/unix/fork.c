@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <spawn.h>
+
+/*
+ * Wrappers for the system calls that start programs or processes.
+ * Each flushes stdout first: otherwise fork would leave a copy of
+ * anything buffered in the child to be printed twice, execv would
+ * throw it away, and spawn's child could print before it.
+ */
+
+pid_t
+fork(void)
+{
+	fflush(NULL);
+	return __fork();
+}
+
+int
+execv(const char *prog, char *const *args)
+{
+	fflush(NULL);
+	return __execv(prog, args);
+}
+
+pid_t
+spawn(const char *path, char *const *argv,
+      const struct spawn_action *actions, int nactions)
+{
+	fflush(NULL);
+	return __spawn(path, argv, actions, nactions);
+}
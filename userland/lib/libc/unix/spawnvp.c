@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <errno.h>
+#include <limits.h>
+
+/*
+ * Spawn a program on the search path. Tries spawn() on each choice in
+ * turn, the same way execvp tries execv.
+ */
+pid_t
+spawnvp(const char *prog, char *const *args,
+	const struct spawn_action *actions, int nactions)
+{
+	const char *searchpath, *s, *t;
+	char progpath[PATH_MAX];
+	size_t len;
+	pid_t pid;
+
+	if (strchr(prog, '/') != NULL) {
+		return spawn(prog, args, actions, nactions);
+	}
+
+	searchpath = getenv("PATH");
+	if (searchpath == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	for (s = searchpath; s != NULL; s = t) {
+		t = strchr(s, ':');
+		if (t != NULL) {
+			len = t - s;
+			/* advance past the colon */
+			t++;
+		}
+		else {
+			len = strlen(s);
+		}
+		if (len == 0) {
+			continue;
+		}
+		if (len >= sizeof(progpath)) {
+			continue;
+		}
+		memcpy(progpath, s, len);
+		snprintf(progpath + len, sizeof(progpath) - len, "/%s", prog);
+		pid = spawn(progpath, args, actions, nactions);
+		if (pid >= 0) {
+			return pid;
+		}
+		switch (errno) {
+		    case ENOENT:
+		    case ENOTDIR:
+		    case ENOEXEC:
+			/* routine errors, try next dir */
+			break;
+		    default:
+			/* oops, let's fail */
+			return -1;
+		}
+	}
+	errno = ENOENT;
+	return -1;
+}
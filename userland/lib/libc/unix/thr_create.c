@@ -0,0 +1,26 @@
+#include <stdlib.h>
+#include <thr.h>
+
+/*
+ * Where every new thread starts: the kernel hands it FUNC and ARG,
+ * and there is nothing to return to, so the value goes to thr_exit.
+ * malloc gets to give it a cache of its own first (see malloc.c).
+ */
+static
+void
+thr_start(void *(*func)(void *), void *arg)
+{
+	char top;
+	void *value;
+
+	__malloc_thrstart(&top);
+	value = func(arg);
+	__malloc_thrend();
+	thr_exit(value);
+}
+
+int
+thr_create(void *(*func)(void *), void *arg)
+{
+	return __thr_create(thr_start, func, arg);
+}
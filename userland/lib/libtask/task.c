@@ -0,0 +1,376 @@
+/*
+ * Work-stealing task pool; see task.h.
+ *
+ * Each worker has a queue of tasks spawned on it and not started yet.
+ * The worker pushes and pops at the tail, so it runs its own work in
+ * the order a plain recursive program would; a worker with nothing to
+ * do steals from the head of someone else's, which is where the
+ * oldest and so usually the biggest pieces of work are. A queue has a
+ * spinlock, but as only the thieves ever contend on it with its owner
+ * and they only come by when they've run dry, it stays in one cpu's
+ * cache almost all the time.
+ *
+ * Threads have no thread-local storage, so task_self finds the
+ * caller's worker from its stack pointer: each worker thread notes
+ * the top of its stack when it starts, and the stacks don't overlap,
+ * so the caller is the worker with the lowest top that's above it.
+ * The first thread's stack is above all of them (see addrspace.h in
+ * the kernel) and it's worker 0.
+ *
+ * Idle workers look around TASK_SPINS times and then sleep on
+ * task_parkseq, after saying so in task_sleepers and looking one last
+ * time; task_spawn bumps it and wakes one when anyone's asleep. Either
+ * the sleeper's last look sees the new task, or the spawner sees the
+ * sleeper.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sched.h>
+#include <thr.h>
+#include <futex.h>
+#include <atomic.h>
+#include <task.h>
+
+#define TASK_MAXWORKERS	32
+#define TASK_QUEUESIZE	256	/* per worker; a power of two */
+#define TASK_SPINS	64
+
+struct worker {
+	volatile int w_lock;
+	unsigned w_head;		/* oldest, where thieves take */
+	unsigned w_tail;		/* where the owner pushes and pops */
+	struct task *w_queue[TASK_QUEUESIZE];
+	char *volatile w_stacktop;	/* for task_self; not for worker 0 */
+};
+
+static struct worker workers[TASK_MAXWORKERS];
+static volatile unsigned nworkers;
+static volatile int task_parkseq;
+static volatile int task_sleepers;
+
+////////////////////////////////////////////////////////////
+// queue locks
+
+static
+void
+queue_lock(struct worker *w)
+{
+	while (w->w_lock != 0 || atomic_cas(&w->w_lock, 0, 1) != 0) {
+		/* spin */
+	}
+}
+
+static
+void
+queue_unlock(struct worker *w)
+{
+	membar_any_any();
+	w->w_lock = 0;
+}
+
+////////////////////////////////////////////////////////////
+// queues
+
+static
+struct worker *
+task_self(void)
+{
+	char here;
+	struct worker *self;
+	char *top, *best;
+	unsigned i, n;
+
+	self = &workers[0];
+	best = NULL;
+	n = nworkers;
+	for (i=1; i<n; i++) {
+		top = workers[i].w_stacktop;
+		if (top != NULL && top >= &here &&
+		    (best == NULL || top < best)) {
+			best = top;
+			self = &workers[i];
+		}
+	}
+	return self;
+}
+
+/* Take the newest task off W's own queue, if it's WANT. */
+static
+bool
+task_pop(struct worker *w, struct task *want)
+{
+	bool found;
+
+	found = false;
+	queue_lock(w);
+	if (w->w_tail != w->w_head &&
+	    w->w_queue[(w->w_tail - 1) % TASK_QUEUESIZE] == want) {
+		w->w_tail--;
+		found = true;
+	}
+	queue_unlock(w);
+	return found;
+}
+
+/* Take the oldest task off VICTIM's queue, or return NULL. */
+static
+struct task *
+task_steal(struct worker *victim)
+{
+	struct task *t;
+
+	if (victim->w_head == victim->w_tail) {
+		/* an unlocked look, to keep off the lock of an empty queue */
+		return NULL;
+	}
+	t = NULL;
+	queue_lock(victim);
+	if (victim->w_head != victim->w_tail) {
+		t = victim->w_queue[victim->w_head % TASK_QUEUESIZE];
+		victim->w_head++;
+	}
+	queue_unlock(victim);
+	return t;
+}
+
+/* Find something for W to do: its own newest task, or someone else's. */
+static
+struct task *
+task_find(struct worker *w)
+{
+	struct task *t;
+	unsigned me, i, n;
+
+	t = NULL;
+	queue_lock(w);
+	if (w->w_tail != w->w_head) {
+		w->w_tail--;
+		t = w->w_queue[w->w_tail % TASK_QUEUESIZE];
+	}
+	queue_unlock(w);
+	if (t != NULL) {
+		return t;
+	}
+
+	me = w - workers;
+	n = nworkers;
+	for (i=1; i<n; i++) {
+		t = task_steal(&workers[(me + i) % n]);
+		if (t != NULL) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+task_run(struct task *t)
+{
+	t->t_func(t->t_arg);
+	membar_any_any();
+	t->t_done = 1;
+}
+
+////////////////////////////////////////////////////////////
+// workers
+
+static
+void *
+task_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct task *t;
+	unsigned spins;
+	int seq;
+	char top;
+
+	w->w_stacktop = &top;
+
+	spins = 0;
+	while (1) {
+		t = task_find(w);
+		if (t != NULL) {
+			task_run(t);
+			spins = 0;
+			continue;
+		}
+		if (++spins < TASK_SPINS) {
+			continue;
+		}
+		spins = 0;
+
+		seq = task_parkseq;
+		atomic_add(&task_sleepers, 1);
+		t = task_find(w);
+		if (t == NULL) {
+			/* EAGAIN just means there's news already */
+			futex_wait(&task_parkseq, seq);
+		}
+		atomic_add(&task_sleepers, -1);
+		if (t != NULL) {
+			task_run(t);
+		}
+	}
+	return NULL;
+}
+
+int
+task_init(unsigned n)
+{
+	uint32_t mask;
+	unsigned i;
+
+	if (n == 0) {
+		if (sched_getaffinity(0, &mask) == 0) {
+			for (; mask != 0; mask >>= 1) {
+				n += mask & 1;
+			}
+		}
+		if (n == 0) {
+			n = 1;
+		}
+	}
+	if (n > TASK_MAXWORKERS) {
+		n = TASK_MAXWORKERS;
+	}
+
+	nworkers = 1;
+	for (i=1; i<n; i++) {
+		if (thr_create(task_worker, &workers[i]) < 0) {
+			return -1;
+		}
+		nworkers = i + 1;
+	}
+	return 0;
+}
+
+unsigned
+task_nworkers(void)
+{
+	return nworkers > 0 ? nworkers : 1;
+}
+
+////////////////////////////////////////////////////////////
+// fork-join
+
+void
+task_spawn(struct task *t, void (*func)(void *), void *arg)
+{
+	struct worker *w;
+	bool queued;
+
+	t->t_func = func;
+	t->t_arg = arg;
+	t->t_done = 0;
+
+	if (nworkers < 2) {
+		/* nobody to hand it to */
+		task_run(t);
+		return;
+	}
+
+	w = task_self();
+	queued = false;
+	queue_lock(w);
+	if (w->w_tail - w->w_head < TASK_QUEUESIZE) {
+		w->w_queue[w->w_tail % TASK_QUEUESIZE] = t;
+		w->w_tail++;
+		queued = true;
+	}
+	queue_unlock(w);
+	if (!queued) {
+		/* there's plenty queued already */
+		task_run(t);
+		return;
+	}
+
+	if (task_sleepers > 0) {
+		atomic_add(&task_parkseq, 1);
+		futex_wake(&task_parkseq, 1);
+	}
+}
+
+void
+task_sync(struct task *t)
+{
+	struct worker *w;
+	struct task *t2;
+
+	if (t->t_done) {
+		membar_any_any();
+		return;
+	}
+
+	w = task_self();
+	if (task_pop(w, t)) {
+		task_run(t);
+		return;
+	}
+
+	/* it was stolen; help out with something else until it's done */
+	while (!t->t_done) {
+		t2 = task_find(w);
+		if (t2 != NULL) {
+			task_run(t2);
+		}
+	}
+	membar_any_any();
+}
+
+struct pfor {
+	unsigned from, to, grain;
+	void (*body)(unsigned i, void *arg);
+	void *arg;
+};
+
+/* Split off the top half until what's left is one chunk. */
+static
+void
+pfor_run(void *vp)
+{
+	struct pfor *p = vp;
+	struct pfor left, right;
+	struct task t;
+	unsigned i;
+
+	if (p->to - p->from > p->grain) {
+		left = *p;
+		right = *p;
+		left.to = right.from = p->from + (p->to - p->from) / 2;
+		task_spawn(&t, pfor_run, &right);
+		pfor_run(&left);
+		task_sync(&t);
+		return;
+	}
+	for (i = p->from; i < p->to; i++) {
+		p->body(i, p->arg);
+	}
+}
+
+void
+parallel_for(unsigned from, unsigned to, unsigned grain,
+	     void (*body)(unsigned i, void *arg), void *arg)
+{
+	struct pfor p;
+
+	if (from >= to) {
+		return;
+	}
+	if (grain == 0) {
+		grain = (to - from) / (8 * task_nworkers());
+		if (grain == 0) {
+			grain = 1;
+		}
+	}
+
+	p.from = from;
+	p.to = to;
+	p.grain = grain;
+	p.body = body;
+	p.arg = arg;
+	pfor_run(&p);
+}
@@ -0,0 +1,205 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <errno.h>
+#include <err.h>
+
+/*
+ * defrag - move the blocks of files on a mounted SFS volume together.
+ * Usage: defrag [-nv] [-s ms] [files or directories]
+ *    -n   Don't move anything; just say how fragmented things are.
+ *    -v   Say something about each file.
+ *    -s   Sleep this many ms after each file moved (default 20).
+ *
+ * Directories are done recursively; with no names, the current
+ * directory. The kernel moves one file at a time (SFS_IOC_DEFRAG),
+ * a file being locked while it's moved; there's no nice, so defrag
+ * keeps out of the way of real work by pausing between files. Files
+ * not on SFS are skipped quietly.
+ */
+
+static int nopt = 0;
+static int vopt = 0;
+static unsigned sleepms = 20;
+
+/* Totals */
+static unsigned files, fragmented, moved, nospace;
+static unsigned long long runsbefore, runsafter, blocksmoved;
+
+static
+void
+rest(void)
+{
+	struct timespec ts;
+
+	if (sleepms == 0) {
+		return;
+	}
+	ts.tv_sec = sleepms / 1000;
+	ts.tv_nsec = (sleepms % 1000) * 1000000;
+	(void)nanosleep(&ts, NULL);
+}
+
+static
+void
+dofile(const char *path, int fd)
+{
+	struct sfs_fragstat st;
+	unsigned before;
+
+	if (ioctl(fd, SFS_IOC_FRAGS, &st) < 0) {
+		if (errno != EINVAL) {
+			warn("%s", path);
+		}
+		return;
+	}
+	files++;
+	runsbefore += st.sfs_runs;
+	before = st.sfs_runs;
+	if (st.sfs_runs <= 1) {
+		runsafter += st.sfs_runs;
+		return;
+	}
+	fragmented++;
+
+	if (!nopt) {
+		if (ioctl(fd, SFS_IOC_DEFRAG, &st) < 0) {
+			if (errno == ENOSPC) {
+				nospace++;
+			}
+			else {
+				warn("%s", path);
+			}
+		}
+		else {
+			moved++;
+			blocksmoved += st.sfs_moved;
+			rest();
+		}
+	}
+	runsafter += st.sfs_runs;
+
+	if (vopt) {
+		printf("%s: %u blocks, %u runs", path, st.sfs_blocks, before);
+		if (!nopt) {
+			printf(" -> %u", st.sfs_runs);
+		}
+		printf("\n");
+	}
+}
+
+static void doitem(const char *path);
+
+static
+void
+dodir(const char *path, int fd)
+{
+	unsigned buf[1024 / sizeof(unsigned)];	/* (aligned for struct dirent) */
+	char newpath[1024];
+	struct dirent *d;
+	ssize_t len, pos;
+
+	while ((len = getdirentries(fd, (char *)buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < len; pos += d->d_reclen) {
+			d = (struct dirent *)((char *)buf + pos);
+			if (!strcmp(d->d_name, ".") ||
+			    !strcmp(d->d_name, "..")) {
+				continue;
+			}
+			snprintf(newpath, sizeof(newpath), "%s/%s",
+				 path, d->d_name);
+			doitem(newpath);
+		}
+	}
+	if (len < 0) {
+		warn("%s: getdirentries", path);
+	}
+}
+
+static
+void
+doitem(const char *path)
+{
+	struct stat sb;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		warn("%s", path);
+		return;
+	}
+	if (fstat(fd, &sb) < 0) {
+		warn("%s: fstat", path);
+	}
+	else if (S_ISDIR(sb.st_mode)) {
+		dodir(path, fd);
+	}
+	else if (S_ISREG(sb.st_mode)) {
+		dofile(path, fd);
+	}
+	close(fd);
+}
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: defrag [-nv] [-s ms] [files or directories]");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, items;
+
+	items = 0;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n")) {
+			nopt = 1;
+		}
+		else if (!strcmp(argv[i], "-v")) {
+			vopt = 1;
+		}
+		else if (!strcmp(argv[i], "-nv") || !strcmp(argv[i], "-vn")) {
+			nopt = vopt = 1;
+		}
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			sleepms = atoi(argv[++i]);
+		}
+		else if (argv[i][0] == '-') {
+			usage();
+		}
+	}
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-s")) {
+			i++;
+		}
+		else if (argv[i][0] != '-') {
+			doitem(argv[i]);
+			items++;
+		}
+	}
+	if (items == 0) {
+		doitem(".");
+	}
+
+	printf("%u files, %u fragmented", files, fragmented);
+	if (!nopt) {
+		printf(", %u moved (%llu blocks)", moved, blocksmoved);
+		if (nospace > 0) {
+			printf(", %u without room", nospace);
+		}
+	}
+	printf("\n");
+	printf("runs: %llu", runsbefore);
+	if (!nopt) {
+		printf(" -> %llu", runsafter);
+	}
+	printf("\n");
+	return 0;
+}
@@ -73,6 +73,9 @@ static bool dofiles, dodirs;
 static bool doindirect;
 static bool recurse;
 
+/* set by readsb: the volume's inodes hold extents, not block pointers */
+static bool extents;
+
 ////////////////////////////////////////////////////////////
 // printouts
 
@@ -142,6 +145,7 @@ readsb(void)
 	if (SWAP32(sb.sb_magic) != SFS_MAGIC) {
 		errx(1, "Not an sfs filesystem");
 	}
+	extents = (SWAP32(sb.sb_features) & SFS_FEATURE_EXTENTS) != 0;
 	return SWAP32(sb.sb_nblocks);
 }
 
@@ -150,6 +154,7 @@ void
 dumpsb(void)
 {
 	struct sfs_superblock sb;
+	struct sfs_jheader jh;
 	unsigned i;
 
 	diskread(&sb, SFS_SUPER_BLOCK);
@@ -162,8 +167,30 @@ dumpsb(void)
 	dumpvalf("Freemap size", "%u blocks",
 		 SFS_FREEMAPBLOCKS(SWAP32(sb.sb_nblocks)));
 	dumpvalf("Block size", "%u bytes", SFS_BLOCKSIZE);
+	dumpvalf("Features", "0x%x%s%s%s", SWAP32(sb.sb_features),
+		 (SWAP32(sb.sb_features) & SFS_FEATURE_EXTENTS) ?
+		 " extents" : "",
+		 (SWAP32(sb.sb_features) & SFS_FEATURE_INLINE) ?
+		 " inline" : "",
+		 (SWAP32(sb.sb_features) & SFS_FEATURE_JOURNAL) ?
+		 " journal" : "");
 	dumplval("Volume name", sb.sb_volname);
 
+	if (SWAP32(sb.sb_features) & SFS_FEATURE_JOURNAL) {
+		dumpvalf("Journal start", "block %u",
+			 SWAP32(sb.sb_journalstart));
+		dumpvalf("Journal size", "%u blocks",
+			 SWAP32(sb.sb_journalblocks));
+		diskread(&jh, SWAP32(sb.sb_journalstart));
+		dumpvalf("Journal magic", "0x%8x", SWAP32(jh.jh_magic));
+		dumpvalf("Journal tail", "%u", SWAP32(jh.jh_tail));
+		dumpvalf("Journal sequence", "%u", SWAP32(jh.jh_seq));
+		if (dumppos % 2 == 1) {
+			printf("\n");
+			dumppos++;
+		}
+	}
+
 	for (i=0; i<ARRAYCOUNT(sb.reserved); i++) {
 		if (sb.reserved[i] != 0) {
 			printf("    Word %u in reserved area: 0x%x\n",
@@ -286,6 +313,27 @@ traverse(const struct sfs_dinode *sfi, void (*doblock)(uint32_t, uint32_t))
 	numblocks = DIVROUNDUP(SWAP32(sfi->sfi_size), SFS_BLOCKSIZE);
 
 	fileblock = 0;
+	if (SWAP32(sfi->sfi_flags) & SFS_INODE_INLINE) {
+		/* (no blocks at all) */
+		return;
+	}
+	if (extents) {
+		/* each extent is a run of blocks; start 0 is a hole */
+		uint32_t start, len, j;
+
+		for (i=0; i<SWAP32(sfi->sfi_nextents) && i<SFS_NEXTENTS &&
+			     fileblock < numblocks; i++) {
+			start = SWAP32(sfi->sfi_extents[i].sfe_start);
+			len = SWAP32(sfi->sfi_extents[i].sfe_len);
+			for (j=0; j<len && fileblock < numblocks; j++) {
+				doblock(fileblock++, start == 0 ? 0 : start+j);
+			}
+		}
+		while (fileblock < numblocks) {
+			doblock(fileblock++, 0);
+		}
+		return;
+	}
 	for (i=0; i<SFS_NDIRECT && fileblock < numblocks; i++) {
 		doblock(fileblock++, SWAP32(sfi->sfi_direct[i]));
 	}
@@ -374,23 +422,17 @@ recursedir(uint32_t ino, const struct sfs_dinode *sfi)
 	printf("Done with directory %u\n", ino);
 }
 
+/* Hex dump of LEN bytes of file contents starting at file offset POS */
 static
-void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
+void
+dumpbytes(uint32_t pos, const uint8_t *data, unsigned len)
 {
-	uint8_t data[SFS_BLOCKSIZE];
-	unsigned i, j;
+	unsigned i, j, k;
 	char tmp[128];
 
-	if (diskblock == 0) {
-		printf("    0x%6x  [sparse]\n", fileblock * SFS_BLOCKSIZE);
-		return;
-	}
-
-	diskread(data, diskblock);
-	for (i=0; i<SFS_BLOCKSIZE; i++) {
+	for (i=0; i<len; i++) {
 		if (i % 16 == 0) {
-			snprintf(tmp, sizeof(tmp), "0x%x",
-				 fileblock * SFS_BLOCKSIZE + i);
+			snprintf(tmp, sizeof(tmp), "0x%x", pos + i);
 			printf("%8s", tmp);
 		}
 		if (i % 8 == 0) {
@@ -400,9 +442,13 @@ void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
 			printf(" ");
 		}
 		printf("%02x", data[i]);
-		if (i % 16 == 15) {
+		if (i % 16 == 15 || i == len-1) {
+			/* line up the text part of a short last line */
+			for (k = i % 16 + 1; k < 16; k++) {
+				printf(k % 8 == 0 ? "    " : "   ");
+			}
 			printf("  ");
-			for (j = i-15; j<=i; j++) {
+			for (j = i - i % 16; j<=i; j++) {
 				if (data[j] < 32 || data[j] > 126) {
 					putchar('.');
 				}
@@ -415,44 +461,44 @@ void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
 	}
 }
 
+static
+void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
+{
+	uint8_t data[SFS_BLOCKSIZE];
+
+	if (diskblock == 0) {
+		printf("    0x%6x  [sparse]\n", fileblock * SFS_BLOCKSIZE);
+		return;
+	}
+
+	diskread(data, diskblock);
+	dumpbytes(fileblock * SFS_BLOCKSIZE, data, SFS_BLOCKSIZE);
+}
+
 static
 void
 dumpfile(uint32_t ino, const struct sfs_dinode *sfi)
 {
 	printf("File contents for inode %u:\n", ino);
+	if (SWAP32(sfi->sfi_flags) & SFS_INODE_INLINE) {
+		uint32_t size = SWAP32(sfi->sfi_size);
+
+		dumpbytes(0, (const uint8_t *)sfi->sfi_data,
+			  size < SFS_INLINESIZE ? size : SFS_INLINESIZE);
+		return;
+	}
 	traverse(sfi, dumpfileblock);
 }
 
 static
 void
-dumpinode(uint32_t ino, const char *name)
+dumpblockptrs(const struct sfs_dinode *sfi)
 {
-	struct sfs_dinode sfi;
-	const char *typename;
 	char tmp[128];
 	unsigned i;
 
-	diskread(&sfi, ino);
-
-	printf("Inode %u", ino);
-	if (name != NULL) {
-		printf(" (%s)", name);
-	}
-	printf("\n");
-	printf("--------------\n");
-
-	switch (SWAP16(sfi.sfi_type)) {
-	    case SFS_TYPE_FILE: typename = "regular file"; break;
-	    case SFS_TYPE_DIR: typename = "directory"; break;
-	    default: typename = "invalid"; break;
-	}
-	dumpvalf("Type", "%u (%s)", SWAP16(sfi.sfi_type), typename);
-	dumpvalf("Size", "%u", SWAP32(sfi.sfi_size));
-	dumpvalf("Link count", "%u", SWAP16(sfi.sfi_linkcount));
-	printf("\n");
-
-        printf("    Direct blocks:\n");
-        for (i=0; i<SFS_NDIRECT; i++) {
+	printf("    Direct blocks:\n");
+	for (i=0; i<SFS_NDIRECT; i++) {
 		if (i % 4 == 0) {
 			printf("@%-2u    ", i);
 		}
@@ -465,7 +511,7 @@ dumpinode(uint32_t ino, const char *name)
 		 * number print then needs up to 16 digits.
 		 */
 		snprintf(tmp, sizeof(tmp), "%u (0x%x)",
-			 SWAP32(sfi.sfi_direct[i]), SWAP32(sfi.sfi_direct[i]));
+			 SWAP32(sfi->sfi_direct[i]), SWAP32(sfi->sfi_direct[i]));
 		printf("  %-16s", tmp);
 		if (i % 4 == 3) {
 			printf("\n");
@@ -475,16 +521,92 @@ dumpinode(uint32_t ino, const char *name)
 		printf("\n");
 	}
 	printf("    Indirect block: %u (0x%x)\n",
-	       SWAP32(sfi.sfi_indirect), SWAP32(sfi.sfi_indirect));
-	for (i=0; i<ARRAYCOUNT(sfi.sfi_waste); i++) {
-		if (sfi.sfi_waste[i] != 0) {
+	       SWAP32(sfi->sfi_indirect), SWAP32(sfi->sfi_indirect));
+	for (i=0; i<ARRAYCOUNT(sfi->sfi_waste); i++) {
+		if (sfi->sfi_waste[i] != 0) {
 			printf("    Word %u in waste area: 0x%x\n",
-			       i, SWAP32(sfi.sfi_waste[i]));
+			       i, SWAP32(sfi->sfi_waste[i]));
 		}
 	}
 
 	if (doindirect) {
-		dumpindirect(SWAP32(sfi.sfi_indirect));
+		dumpindirect(SWAP32(sfi->sfi_indirect));
+	}
+}
+
+static
+void
+dumpextents(const struct sfs_dinode *sfi)
+{
+	char tmp[128];
+	unsigned i, n;
+
+	n = SWAP32(sfi->sfi_nextents);
+	printf("    Extents: %u\n", n);
+	if (n > SFS_NEXTENTS) {
+		printf("    [extent count is past the maximum of %u]\n",
+		       SFS_NEXTENTS);
+		n = SFS_NEXTENTS;
+	}
+	for (i=0; i<n; i++) {
+		if (i % 3 == 0) {
+			printf("@%-2u    ", i);
+		}
+		if (sfi->sfi_extents[i].sfe_start == 0) {
+			snprintf(tmp, sizeof(tmp), "hole x%u",
+				 SWAP32(sfi->sfi_extents[i].sfe_len));
+		}
+		else {
+			snprintf(tmp, sizeof(tmp), "%u x%u",
+				 SWAP32(sfi->sfi_extents[i].sfe_start),
+				 SWAP32(sfi->sfi_extents[i].sfe_len));
+		}
+		printf("  %-20s", tmp);
+		if (i % 3 == 2) {
+			printf("\n");
+		}
+	}
+	if (i % 3 != 0) {
+		printf("\n");
+	}
+}
+
+static
+void
+dumpinode(uint32_t ino, const char *name)
+{
+	struct sfs_dinode sfi;
+	const char *typename;
+
+	diskread(&sfi, ino);
+
+	printf("Inode %u", ino);
+	if (name != NULL) {
+		printf(" (%s)", name);
+	}
+	printf("\n");
+	printf("--------------\n");
+
+	switch (SWAP16(sfi.sfi_type)) {
+	    case SFS_TYPE_FILE: typename = "regular file"; break;
+	    case SFS_TYPE_DIR: typename = "directory"; break;
+	    default: typename = "invalid"; break;
+	}
+	dumpvalf("Type", "%u (%s)", SWAP16(sfi.sfi_type), typename);
+	dumpvalf("Size", "%u", SWAP32(sfi.sfi_size));
+	dumpvalf("Link count", "%u", SWAP16(sfi.sfi_linkcount));
+	dumpvalf("Flags", "0x%x%s", SWAP32(sfi.sfi_flags),
+		 (SWAP32(sfi.sfi_flags) & SFS_INODE_INLINE) ? " (inline)" : "");
+	printf("\n");
+
+	if (SWAP32(sfi.sfi_flags) & SFS_INODE_INLINE) {
+		/* nothing to show but the contents */
+	}
+	else if (extents) {
+		dumpextents(&sfi);
+	}
+	else {
+		dumpblockptrs(&sfi);
 	}
 
 	if (SWAP16(sfi.sfi_type) == SFS_TYPE_DIR && dodirs) {
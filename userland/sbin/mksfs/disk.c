@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -50,6 +51,18 @@
 static int fd=-1;
 static uint32_t nblocks;
 
+/*
+ * Read cache, if diskcache() has been called: CACHELINES runs of
+ * cacherun blocks, each a run-aligned piece of the disk, so a read of
+ * a block that isn't in it brings in the blocks around it in the same
+ * read. Writes go straight to disk, and to the cache too if the block
+ * is in it.
+ */
+#define CACHELINES 16
+static uint32_t cacherun;		/* blocks per line; 0 if no cache */
+static char *cachedata;			/* CACHELINES * cacherun blocks */
+static uint32_t cachetag[CACHELINES];	/* run number + 1, 0 if empty */
+
 /*
  * Open a disk. If we're built for the host OS, check that it's a
  * System/161 disk image, and then ignore the header block.
@@ -114,6 +127,42 @@ diskblocks(void)
 	return nblocks;
 }
 
+/*
+ * Turn on the read cache, reading RUN blocks at a time.
+ */
+void
+diskcache(uint32_t run)
+{
+	assert(fd>=0);
+	assert(cacherun == 0 && run > 0);
+	cachedata = malloc(CACHELINES * run * BLOCKSIZE);
+	if (cachedata == NULL) {
+		/* no cache, then; everything still works */
+		return;
+	}
+	cacherun = run;
+}
+
+/*
+ * The cache line and its data for BLOCK, or NULL.
+ */
+static
+char *
+cachefind(uint32_t block)
+{
+	uint32_t run, line;
+
+	if (cacherun == 0) {
+		return NULL;
+	}
+	run = block / cacherun;
+	line = run % CACHELINES;
+	if (cachetag[line] != run + 1) {
+		return NULL;
+	}
+	return cachedata + ((line * cacherun) + block % cacherun) * BLOCKSIZE;
+}
+
 /*
  * Write a block.
  */
@@ -121,11 +170,17 @@ void
 diskwrite(const void *data, uint32_t block)
 {
 	const char *cdata = data;
+	char *cached;
 	uint32_t tot=0;
 	int len;
 
 	assert(fd>=0);
 
+	cached = cachefind(block);
+	if (cached != NULL) {
+		memcpy(cached, data, BLOCKSIZE);
+	}
+
 #ifdef HOST
 	// skip over disk file header
 	block++;
@@ -151,17 +206,16 @@ diskwrite(const void *data, uint32_t block)
 }
 
 /*
- * Read a block.
+ * Read COUNT blocks starting at BLOCK.
  */
+static
 void
-diskread(void *data, uint32_t block)
+rawread(void *data, uint32_t block, uint32_t count)
 {
 	char *cdata = data;
 	uint32_t tot=0;
 	int len;
 
-	assert(fd>=0);
-
 #ifdef HOST
 	// skip over disk file header
 	block++;
@@ -171,8 +225,8 @@ diskread(void *data, uint32_t block)
 		err(1, "lseek");
 	}
 
-	while (tot < BLOCKSIZE) {
-		len = read(fd, cdata + tot, BLOCKSIZE - tot);
+	while (tot < count*BLOCKSIZE) {
+		len = read(fd, cdata + tot, count*BLOCKSIZE - tot);
 		if (len < 0) {
 			if (errno==EINTR || errno==EAGAIN) {
 				continue;
@@ -186,6 +240,38 @@ diskread(void *data, uint32_t block)
 	}
 }
 
+/*
+ * Read a block.
+ */
+void
+diskread(void *data, uint32_t block)
+{
+	uint32_t run, line, first, count;
+	char *cached;
+
+	assert(fd>=0);
+
+	if (cacherun == 0 || block >= nblocks) {
+		rawread(data, block, 1);
+		return;
+	}
+
+	cached = cachefind(block);
+	if (cached == NULL) {
+		run = block / cacherun;
+		line = run % CACHELINES;
+		first = run * cacherun;
+		count = cacherun;
+		if (first + count > nblocks) {
+			count = nblocks - first;
+		}
+		rawread(cachedata + line * cacherun * BLOCKSIZE, first, count);
+		cachetag[line] = run + 1;
+		cached = cachefind(block);
+	}
+	memcpy(data, cached, BLOCKSIZE);
+}
+
 /*
  * Close the disk.
  */
@@ -197,4 +283,9 @@ closedisk(void)
 		err(1, "close");
 	}
 	fd = -1;
+
+	free(cachedata);
+	cachedata = NULL;
+	cacherun = 0;
+	memset(cachetag, 0, sizeof(cachetag));
 }
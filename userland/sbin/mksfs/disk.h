@@ -35,4 +35,6 @@ uint32_t diskblocks(void);
 void diskwrite(const void *data, uint32_t block);
 void diskread(void *data, uint32_t block);
 
+void diskcache(uint32_t run);
+
 void closedisk(void);
@@ -60,9 +60,16 @@
 /* Maximum size of freemap we support */
 #define MAXFREEMAPBLOCKS 32
 
+/* Smallest and largest journal we make */
+#define MINJOURNALBLOCKS SFS_JMINBLOCKS
+#define MAXJOURNALBLOCKS 256
+
 /* Free block bitmap */
 static char freemapbuf[MAXFREEMAPBLOCKS * SFS_BLOCKSIZE];
 
+/* Where the journal goes, if there is one */
+static uint32_t journalstart, journalblocks;
+
 /*
  * Assert that the on-disk data structures are correctly sized.
  */
@@ -114,6 +121,11 @@ initfreemap(uint32_t fsblocks)
 		allocblock(SFS_FREEMAP_START + i);
 	}
 
+	/* and so must the journal's */
+	for (i=0; i<journalblocks; i++) {
+		allocblock(journalstart + i);
+	}
+
 	/* all blocks in the freemap but past the volume end are "in use" */
 	for (i=fsblocks; i<freemapbits; i++) {
 		allocblock(i);
@@ -125,7 +137,7 @@ initfreemap(uint32_t fsblocks)
  */
 static
 void
-writesuper(const char *volname, uint32_t nblocks)
+writesuper(const char *volname, uint32_t nblocks, uint32_t features)
 {
 	struct sfs_superblock sb;
 
@@ -140,6 +152,9 @@ writesuper(const char *volname, uint32_t nblocks)
 	sb.sb_magic = SWAP32(SFS_MAGIC);
 	sb.sb_nblocks = SWAP32(nblocks);
 	strcpy(sb.sb_volname, volname);
+	sb.sb_features = SWAP32(features);
+	sb.sb_journalstart = SWAP32(journalstart);
+	sb.sb_journalblocks = SWAP32(journalblocks);
 
 	/* and write it out. */
 	diskwrite(&sb, SFS_SUPER_BLOCK);
@@ -164,6 +179,52 @@ writefreemap(uint32_t fsblocks)
 	}
 }
 
+/*
+ * Choose where the journal goes: right after the freemap, one block
+ * in 16 of the volume, within limits.
+ */
+static
+void
+placejournal(uint32_t fsblocks)
+{
+	journalstart = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks);
+	journalblocks = fsblocks / 16;
+	if (journalblocks < MINJOURNALBLOCKS) {
+		journalblocks = MINJOURNALBLOCKS;
+	}
+	if (journalblocks > MAXJOURNALBLOCKS) {
+		journalblocks = MAXJOURNALBLOCKS;
+	}
+	if (journalstart + journalblocks >= fsblocks) {
+		errx(1, "Device too small for a journal");
+	}
+}
+
+/*
+ * Write out an empty journal: a header pointing at the start of the
+ * log, and a zeroed log.
+ */
+static
+void
+writejournal(void)
+{
+	union {
+		struct sfs_jheader jh;
+		char block[SFS_BLOCKSIZE];
+	} u;
+	uint32_t i;
+
+	bzero((void *)&u, sizeof(u));
+	for (i=1; i<journalblocks; i++) {
+		diskwrite(u.block, journalstart + i);
+	}
+
+	u.jh.jh_magic = SWAP32(SFS_JMAGIC_HEADER);
+	u.jh.jh_tail = SWAP32(0);
+	u.jh.jh_seq = SWAP32(1);
+	diskwrite(u.block, journalstart);
+}
+
 /*
  * Write out the root directory inode.
  */
@@ -173,7 +234,10 @@ writerootdir(void)
 {
 	struct sfs_dinode sfi;
 
-	/* Initialize the dinode */
+	/*
+	 * Initialize the dinode. (All zeros is an empty block list, or
+	 * no extents, so this does for both inode formats.)
+	 */
 	bzero((void *)&sfi, sizeof(sfi));
 	sfi.sfi_size = SWAP32(0);
 	sfi.sfi_type = SWAP16(SFS_TYPE_DIR);
@@ -190,14 +254,35 @@ int
 main(int argc, char **argv)
 {
 	uint32_t size, blocksize;
+	uint32_t features = 0;
 	char *volname, *s;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	/*
+	 * -e: inodes hold extents; -i: small files live in their inode;
+	 * -j: metadata changes go through a journal
+	 */
+	while (argc > 1 && argv[1][0] == '-') {
+		if (!strcmp(argv[1], "-e")) {
+			features |= SFS_FEATURE_EXTENTS;
+		}
+		else if (!strcmp(argv[1], "-i")) {
+			features |= SFS_FEATURE_INLINE;
+		}
+		else if (!strcmp(argv[1], "-j")) {
+			features |= SFS_FEATURE_JOURNAL;
+		}
+		else {
+			break;
+		}
+		argc--;
+		argv++;
+	}
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, "Usage: mksfs [-e] [-i] [-j] device/diskfile volume-name");
 	}
 
 	check();
@@ -228,10 +313,17 @@ main(int argc, char **argv)
 	}
 	size = diskblocks();
 
+	if (features & SFS_FEATURE_JOURNAL) {
+		placejournal(size);
+	}
+
 	/* Write out the on-disk structures */
 	initfreemap(size);
-	writesuper(volname, size);
+	writesuper(volname, size, features);
 	writefreemap(size);
+	if (features & SFS_FEATURE_JOURNAL) {
+		writejournal();
+	}
 	writerootdir();
 
 	closedisk();
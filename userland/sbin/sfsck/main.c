@@ -44,6 +44,14 @@
 
 static int badness=0;
 
+/*
+ * How many blocks to read from the disk at once (see diskcache). SFS
+ * allocates the blocks of a file, and files made together, mostly in
+ * order, so reading 32K around each block a check needs means most of
+ * the next ones are already in memory.
+ */
+#define DISKRUN 64
+
 /*
  * Update the badness state. (codes are in main.h)
  *
@@ -74,6 +82,7 @@ main(int argc, char **argv)
 	}
 
 	opendisk(argv[1]);
+	diskcache(DISKRUN);
 
 	sfs_setup();
 	sb_load();
@@ -49,6 +49,10 @@
 
 static unsigned long count_dirs=0, count_files=0;
 
+/* Progress: say how far we've got every PROGRESS_INODES inodes. */
+#define PROGRESS_INODES 1000
+static unsigned long count_inodes=0;
+
 /*
  * State for checking indirect blocks.
  */
@@ -172,6 +176,126 @@ check_indirect_block(struct ibstate *ibs, uint32_t *ientry, int *iechangedp,
 	}
 }
 
+/*
+ * Remove extent I from SFI.
+ */
+static
+void
+remove_extent(struct sfs_dinode *sfi, uint32_t i)
+{
+	for (; i+1 < sfi->sfi_nextents; i++) {
+		sfi->sfi_extents[i] = sfi->sfi_extents[i+1];
+	}
+	sfi->sfi_nextents--;
+	sfi->sfi_extents[sfi->sfi_nextents].sfe_start = 0;
+	sfi->sfi_extents[sfi->sfi_nextents].sfe_len = 0;
+}
+
+/*
+ * check_inode_blocks for an extent inode: record the blocks in use,
+ * drop empty extents, make extents that run outside the volume into
+ * holes, and cut off anything past EOF.
+ */
+static
+int
+check_inode_extents(uint32_t ino, struct sfs_dinode *sfi, int isdir)
+{
+	struct sfs_extent *e;
+	uint32_t fileblocks, volblocks, base, i, j;
+	unsigned pasteofcount = 0;
+	blockusage_t usagetype = isdir ? B_DIRDATA : B_DATA;
+	int changed = 0;
+
+	fileblocks = SFS_ROUNDUP(sfi->sfi_size, SFS_BLOCKSIZE)/SFS_BLOCKSIZE;
+	volblocks = sb_totalblocks();
+
+	if (sfi->sfi_nextents > SFS_NEXTENTS) {
+		setbadness(EXIT_RECOV);
+		warnx("Inode %lu: %lu extents, more than %u (truncated)",
+		      (unsigned long)ino, (unsigned long)sfi->sfi_nextents,
+		      SFS_NEXTENTS);
+		sfi->sfi_nextents = SFS_NEXTENTS;
+		changed = 1;
+	}
+	for (i=sfi->sfi_nextents; i<SFS_NEXTENTS; i++) {
+		e = &sfi->sfi_extents[i];
+		if (e->sfe_start != 0 || e->sfe_len != 0) {
+			setbadness(EXIT_RECOV);
+			warnx("Inode %lu: unused extent %lu not zeroed "
+			      "(fixed)", (unsigned long)ino,
+			      (unsigned long)i);
+			e->sfe_start = e->sfe_len = 0;
+			changed = 1;
+		}
+	}
+
+	base = 0;
+	i = 0;
+	while (i < sfi->sfi_nextents) {
+		e = &sfi->sfi_extents[i];
+		if (e->sfe_len == 0) {
+			setbadness(EXIT_RECOV);
+			warnx("Inode %lu: extent %lu is empty (removed)",
+			      (unsigned long)ino, (unsigned long)i);
+			remove_extent(sfi, i);
+			changed = 1;
+			continue;
+		}
+		if (e->sfe_start != 0 &&
+		    (e->sfe_start >= volblocks ||
+		     e->sfe_len > volblocks - e->sfe_start)) {
+			setbadness(EXIT_RECOV);
+			warnx("Inode %lu: extent for blocks %lu-%lu outside "
+			      "of volume: %lu+%lu (cleared)",
+			      (unsigned long)ino, (unsigned long)base,
+			      (unsigned long)(base + e->sfe_len - 1),
+			      (unsigned long)e->sfe_start,
+			      (unsigned long)e->sfe_len);
+			e->sfe_start = 0;
+			changed = 1;
+		}
+		if (base >= fileblocks) {
+			/* all past EOF */
+			if (e->sfe_start != 0) {
+				for (j=0; j<e->sfe_len; j++) {
+					freemap_blockfree(e->sfe_start + j);
+				}
+				pasteofcount += e->sfe_len;
+			}
+			remove_extent(sfi, i);
+			changed = 1;
+			continue;
+		}
+		if (e->sfe_len > fileblocks - base) {
+			/* partly past EOF */
+			if (e->sfe_start != 0) {
+				for (j=fileblocks - base; j<e->sfe_len; j++) {
+					freemap_blockfree(e->sfe_start + j);
+				}
+				pasteofcount += e->sfe_len - (fileblocks - base);
+			}
+			e->sfe_len = fileblocks - base;
+			changed = 1;
+		}
+		if (e->sfe_start != 0) {
+			for (j=0; j<e->sfe_len; j++) {
+				freemap_blockinuse(e->sfe_start + j, usagetype,
+						   ino);
+			}
+		}
+		base += e->sfe_len;
+		i++;
+	}
+
+	if (pasteofcount > 0) {
+		warnx("Inode %lu: %u blocks after EOF (freed)",
+		     (unsigned long) ino, pasteofcount);
+		setbadness(EXIT_RECOV);
+	}
+
+	return changed;
+}
+
 /*
  * Check the blocks belonging to inode INO, whose inode has already
  * been loaded into SFI. ISDIR is a shortcut telling us if the inode
@@ -189,6 +313,10 @@ check_inode_blocks(uint32_t ino, struct sfs_dinode *sfi, int isdir)
 	int changed;
 	int i;
 
+	if (sb_extents()) {
+		return check_inode_extents(ino, sfi, isdir);
+	}
+
 	size = SFS_ROUNDUP(sfi->sfi_size, SFS_BLOCKSIZE);
 
 	ibs.ino = ino;
@@ -247,6 +375,54 @@ check_inode_blocks(uint32_t ino, struct sfs_dinode *sfi, int isdir)
 	return changed;
 }
 
+/*
+ * Check an inline inode: only regular files on a volume that allows
+ * them can be inline, the contents have to fit, and the bytes past
+ * EOF have to be 0. An inode that shouldn't be inline at all loses
+ * its contents; there's no way to tell what they were meant to be.
+ *
+ * Returns nonzero if SFI has been modified and needs to be written
+ * back.
+ */
+static
+int
+check_inode_inline(uint32_t ino, struct sfs_dinode *sfi, int isdir)
+{
+	uint32_t i;
+
+	if (!sb_inline() || isdir) {
+		warnx("Inode %lu: %s marked inline (emptied)",
+		      (unsigned long) ino,
+		      isdir ? "directory" : "file on a volume without "
+		      "inline files");
+		setbadness(EXIT_RECOV);
+		memset(sfi->sfi_data, 0, sizeof(sfi->sfi_data));
+		sfi->sfi_flags = 0;
+		sfi->sfi_size = 0;
+		return 1;
+	}
+
+	if (sfi->sfi_size > SFS_INLINESIZE) {
+		warnx("Inode %lu: inline file size %lu too large (truncated)",
+		      (unsigned long) ino, (unsigned long) sfi->sfi_size);
+		setbadness(EXIT_RECOV);
+		sfi->sfi_size = SFS_INLINESIZE;
+		return 1;
+	}
+
+	for (i=sfi->sfi_size; i<SFS_INLINESIZE; i++) {
+		if (sfi->sfi_data[i] != 0) {
+			warnx("Inode %lu: inline data past EOF (cleared)",
+			      (unsigned long) ino);
+			setbadness(EXIT_RECOV);
+			memset(sfi->sfi_data + sfi->sfi_size, 0,
+			       SFS_INLINESIZE - sfi->sfi_size);
+			return 1;
+		}
+	}
+	return 0;
+}
+
 /*
  * Do the pass1 inode-level checks on inode INO, which has already
  * been loaded into SFI. Note that sfi_type has already been
@@ -270,15 +446,37 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 
 	freemap_blockinuse(ino, B_INODE, ino);
 
-	if (checkzeroed(sfi->sfi_waste, sizeof(sfi->sfi_waste))) {
-		warnx("Inode %lu: sfi_waste section not zeroed (fixed)",
-		      (unsigned long) ino);
+	count_inodes++;
+	if (count_inodes % PROGRESS_INODES == 0) {
+		printf("\t%lu inodes checked\n", count_inodes);
+	}
+
+	if (sfi->sfi_flags & ~SFS_INODE_INLINE) {
+		warnx("Inode %lu: unknown flags 0x%lx (cleared)",
+		      (unsigned long) ino,
+		      (unsigned long) (sfi->sfi_flags & ~SFS_INODE_INLINE));
 		setbadness(EXIT_RECOV);
+		sfi->sfi_flags &= SFS_INODE_INLINE;
 		changed = 1;
 	}
 
-	if (check_inode_blocks(ino, sfi, isdir)) {
-		changed = 1;
+	if (sfi->sfi_flags & SFS_INODE_INLINE) {
+		if (check_inode_inline(ino, sfi, isdir)) {
+			changed = 1;
+		}
+	}
+	else {
+		if (!sb_extents() &&
+		    checkzeroed(sfi->sfi_waste, sizeof(sfi->sfi_waste))) {
+			warnx("Inode %lu: sfi_waste section not zeroed "
+			      "(fixed)", (unsigned long) ino);
+			setbadness(EXIT_RECOV);
+			changed = 1;
+		}
+
+		if (check_inode_blocks(ino, sfi, isdir)) {
+			changed = 1;
+		}
 	}
 
 	if (changed) {
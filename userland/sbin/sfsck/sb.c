@@ -44,6 +44,39 @@
 
 static struct sfs_superblock sb;
 
+/*
+ * Check the journal's location, and refuse to go on if it has
+ * anything in it: the volume isn't consistent until the kernel has
+ * replayed it, which it does at mount. (A transaction that was never
+ * committed counts too; we can't tell, but the mount can.)
+ */
+static
+void
+sb_loadjournal(void)
+{
+	struct sfs_jheader jh;
+	struct sfs_jdesc jd;
+	uint32_t start, nblocks;
+
+	start = sb.sb_journalstart;
+	nblocks = sb.sb_journalblocks;
+	if (start < SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(sb.sb_nblocks) ||
+	    nblocks < SFS_JMINBLOCKS || nblocks > sb.sb_nblocks - start) {
+		errx(EXIT_FATAL, "Invalid journal location (%lu blocks at %lu)",
+		     (unsigned long)nblocks, (unsigned long)start);
+	}
+
+	sfs_readjheader(start, &jh);
+	if (jh.jh_magic != SFS_JMAGIC_HEADER || jh.jh_tail >= nblocks - 1) {
+		errx(EXIT_FATAL, "Invalid journal header");
+	}
+	sfs_readjdesc(start + 1 + jh.jh_tail, &jd);
+	if (jd.jd_magic == SFS_JMAGIC_DESC && jd.jd_seq == jh.jh_seq) {
+		errx(EXIT_FATAL, "Journal has transactions to replay; "
+		     "mount the volume first");
+	}
+}
+
 /*
  * Load the superblock.
  */
@@ -57,6 +90,21 @@ sb_load(void)
 
 	assert(sb.sb_nblocks > 0);
 	assert(SFS_FREEMAPBLOCKS(sb.sb_nblocks) > 0);
+
+	/* We can't check what we don't understand */
+	if (sb.sb_features & ~SFS_FEATURES_KNOWN) {
+		errx(EXIT_FATAL, "Unsupported filesystem features 0x%lx",
+		     (unsigned long)(sb.sb_features & ~SFS_FEATURES_KNOWN));
+	}
+
+	if (sb.sb_features & SFS_FEATURE_JOURNAL) {
+		sb_loadjournal();
+	}
+	else {
+		/* (nothing else uses them) */
+		sb.sb_journalstart = 0;
+		sb.sb_journalblocks = 0;
+	}
 }
 
 /*
@@ -114,6 +162,39 @@ sb_freemapblocks(void)
 	return SFS_FREEMAPBLOCKS(sb.sb_nblocks);
 }
 
+/*
+ * Return whether the inodes hold extents.
+ */
+int
+sb_extents(void)
+{
+	return (sb.sb_features & SFS_FEATURE_EXTENTS) != 0;
+}
+
+/*
+ * Return whether files may be inline.
+ */
+int
+sb_inline(void)
+{
+	return (sb.sb_features & SFS_FEATURE_INLINE) != 0;
+}
+
+/*
+ * Return where the journal is, and how big.
+ */
+uint32_t
+sb_journalstart(void)
+{
+	return sb.sb_journalstart;
+}
+
+uint32_t
+sb_journalblocks(void)
+{
+	return sb.sb_journalblocks;
+}
+
 /*
  * Return the volume name.
  */
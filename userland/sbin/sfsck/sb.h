@@ -49,6 +49,18 @@ uint32_t sb_freemapblocks(void);
 /* After the superblock is loaded: return volume name. */
 const char *sb_volname(void);
 
+/* After the superblock is loaded: true if inodes hold extents. */
+int sb_extents(void);
+
+/* After the superblock is loaded: true if files may be inline. */
+int sb_inline(void);
+
+/* After the superblock is loaded: first journal block, or 0. */
+uint32_t sb_journalstart(void);
+
+/* After the superblock is loaded: journal size, or 0. */
+uint32_t sb_journalblocks(void);
+
 /* Check the superblock. Must load it first. */
 void sb_check(void);
 
@@ -40,6 +40,7 @@
 #include "utils.h"
 #include "ibmacros.h"
 #include "sfs.h"
+#include "sb.h"
 #include "main.h"
 
 ////////////////////////////////////////////////////////////
@@ -62,6 +63,32 @@ swapsb(struct sfs_superblock *sb)
 {
 	sb->sb_magic = SWAP32(sb->sb_magic);
 	sb->sb_nblocks = SWAP32(sb->sb_nblocks);
+	sb->sb_features = SWAP32(sb->sb_features);
+	sb->sb_journalstart = SWAP32(sb->sb_journalstart);
+	sb->sb_journalblocks = SWAP32(sb->sb_journalblocks);
+}
+
+static
+void
+swapjheader(struct sfs_jheader *jh)
+{
+	jh->jh_magic = SWAP32(jh->jh_magic);
+	jh->jh_tail = SWAP32(jh->jh_tail);
+	jh->jh_seq = SWAP32(jh->jh_seq);
+}
+
+static
+void
+swapjdesc(struct sfs_jdesc *jd)
+{
+	unsigned i;
+
+	jd->jd_magic = SWAP32(jd->jd_magic);
+	jd->jd_seq = SWAP32(jd->jd_seq);
+	jd->jd_ntags = SWAP32(jd->jd_ntags);
+	for (i=0; i<SFS_JTAGS; i++) {
+		jd->jd_tags[i] = SWAP32(jd->jd_tags[i]);
+	}
 }
 
 static
@@ -72,6 +99,11 @@ swapbits(uint8_t *bits)
 	(void)bits;
 }
 
+/*
+ * Swap everything but sfi_flags, which must be in host order already
+ * (an inline inode's contents are bytes and stay as they are); the
+ * callers swap that themselves.
+ */
 static
 void
 swapinode(struct sfs_dinode *sfi)
@@ -82,6 +114,21 @@ swapinode(struct sfs_dinode *sfi)
 	sfi->sfi_type = SWAP16(sfi->sfi_type);
 	sfi->sfi_linkcount = SWAP16(sfi->sfi_linkcount);
 
+	if (sfi->sfi_flags & SFS_INODE_INLINE) {
+		return;
+	}
+
+	if (sb_extents()) {
+		sfi->sfi_nextents = SWAP32(sfi->sfi_nextents);
+		for (i=0; i<SFS_NEXTENTS; i++) {
+			sfi->sfi_extents[i].sfe_start =
+				SWAP32(sfi->sfi_extents[i].sfe_start);
+			sfi->sfi_extents[i].sfe_len =
+				SWAP32(sfi->sfi_extents[i].sfe_len);
+		}
+		return;
+	}
+
 	for (i=0; i<NUM_D; i++) {
 		SET_D(sfi, i) = SWAP32(GET_D(sfi, i));
 	}
@@ -163,6 +210,26 @@ bmap(const struct sfs_dinode *sfi, uint32_t fileblock)
 {
 	uint32_t iblock, offset;
 
+	if (sfi->sfi_flags & SFS_INODE_INLINE) {
+		return 0;
+	}
+
+	if (sb_extents()) {
+		const struct sfs_extent *e;
+		uint32_t base = 0;
+		unsigned i;
+
+		for (i=0; i<sfi->sfi_nextents && i<SFS_NEXTENTS; i++) {
+			e = &sfi->sfi_extents[i];
+			if (fileblock - base < e->sfe_len) {
+				return e->sfe_start == 0 ? 0 :
+					e->sfe_start + (fileblock - base);
+			}
+			base += e->sfe_len;
+		}
+		return 0;
+	}
+
 	if (fileblock < INOMAX_D) {
 		return GET_D(sfi, fileblock);
 	}
@@ -206,6 +273,26 @@ sfs_writesb(uint32_t blocknum, struct sfs_superblock *sb)
 	swapsb(sb);
 }
 
+/*
+ * journal header and descriptor blocks - blocknum is a disk block
+ * number. (Only read: all sfsck does is see if there's anything in
+ * the journal.)
+ */
+
+void
+sfs_readjheader(uint32_t blocknum, struct sfs_jheader *jh)
+{
+	diskread(jh, blocknum);
+	swapjheader(jh);
+}
+
+void
+sfs_readjdesc(uint32_t blocknum, struct sfs_jdesc *jd)
+{
+	diskread(jd, blocknum);
+	swapjdesc(jd);
+}
+
 /*
  * freemap blocks - whichblock is a block number within the free block
  * bitmap.
@@ -234,6 +321,7 @@ void
 sfs_readinode(uint32_t ino, struct sfs_dinode *sfi)
 {
 	diskread(sfi, ino);
+	sfi->sfi_flags = SWAP32(sfi->sfi_flags);
 	swapinode(sfi);
 }
 
@@ -241,7 +329,9 @@ void
 sfs_writeinode(uint32_t ino, struct sfs_dinode *sfi)
 {
 	swapinode(sfi);
+	sfi->sfi_flags = SWAP32(sfi->sfi_flags);
 	diskwrite(sfi, ino);
+	sfi->sfi_flags = SWAP32(sfi->sfi_flags);
 	swapinode(sfi);
 }
 
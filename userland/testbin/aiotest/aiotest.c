@@ -0,0 +1,142 @@
+/*
+ * aiotest - exercise aio_read()/aio_write()/aio_wait().
+ *
+ * Queues NREQS writes of different blocks of a file at once (reusing
+ * the buffer as soon as each is queued), collects all their events,
+ * then queues reads of every block into separate buffers, counts to a
+ * big number while they run, and checks the data as the events come
+ * back. Also checks that a process can't have more than AIO_MAX
+ * requests outstanding, and that with nothing outstanding aio_wait
+ * returns 0.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <aio.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define FILENAME	"aiotest.dat"
+#define NREQS		16
+#define BLOCKSIZE	1024
+
+static char wbuf[BLOCKSIZE];
+static char rbuf[NREQS][BLOCKSIZE];
+
+static
+void
+queue(int fd, int block, void *buf, int write)
+{
+	struct aiocb cb;
+
+	cb.aio_fildes = fd;
+	cb.aio_offset = (off_t)block * BLOCKSIZE;
+	cb.aio_buf = buf;
+	cb.aio_nbytes = BLOCKSIZE;
+	cb.aio_data = block;
+	if ((write ? aio_write(&cb) : aio_read(&cb)) < 0) {
+		err(1, write ? "aio_write" : "aio_read");
+	}
+}
+
+/* collects events for all NREQS blocks and checks each one moved a whole block */
+static
+void
+collect(const char *what, int checkdata)
+{
+	struct aio_event ev[4];
+	int seen[NREQS];
+	int i, j, n, total = 0;
+
+	memset(seen, 0, sizeof(seen));
+	while (total < NREQS) {
+		n = aio_wait(ev, 4, 0);
+		if (n < 0) {
+			err(1, "aio_wait");
+		}
+		if (n == 0) {
+			errx(1, "FAILED: %s: only %d of %d events", what,
+			     total, NREQS);
+		}
+		for (i = 0; i < n; i++) {
+			if (ev[i].ae_data >= NREQS || seen[ev[i].ae_data]) {
+				errx(1, "FAILED: %s: bad event %u", what,
+				     ev[i].ae_data);
+			}
+			seen[ev[i].ae_data] = 1;
+			if (ev[i].ae_res != BLOCKSIZE) {
+				errx(1, "FAILED: %s of block %u returned %d",
+				     what, ev[i].ae_data, ev[i].ae_res);
+			}
+			for (j = 0; checkdata && j < BLOCKSIZE; j++) {
+				if (rbuf[ev[i].ae_data][j] !=
+				    (char)('A' + ev[i].ae_data)) {
+					errx(1, "FAILED: block %u has the "
+					     "wrong data", ev[i].ae_data);
+				}
+			}
+		}
+		total += n;
+	}
+	printf("aiotest: %d %ss done\n", NREQS, what);
+}
+
+int
+main(void)
+{
+	struct aio_event ev;
+	volatile unsigned count;
+	int fd, i;
+
+	fd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	if (aio_wait(&ev, 1, 0) != 0) {
+		errx(1, "FAILED: aio_wait with nothing queued didn't return 0");
+	}
+
+	for (i = 0; i < NREQS; i++) {
+		/* the kernel has its own copy once it's queued */
+		memset(wbuf, 'A' + i, BLOCKSIZE);
+		queue(fd, i, wbuf, 1);
+	}
+	collect("write", 0);
+
+	for (i = 0; i < NREQS; i++) {
+		queue(fd, i, rbuf[i], 0);
+	}
+	for (count = 0; count < 100000; count++) {
+		/* keep busy while the reads go on */
+	}
+	collect("read", 1);
+
+	for (i = 0; i < AIO_MAX; i++) {
+		queue(fd, i % NREQS, rbuf[i % NREQS], 0);
+	}
+	{
+		struct aiocb cb = { 0, fd, rbuf[0], BLOCKSIZE, 0 };
+		if (aio_read(&cb) != -1 || errno != EAGAIN) {
+			errx(1, "FAILED: request %d didn't fail with EAGAIN",
+			     AIO_MAX + 1);
+		}
+	}
+	for (i = 0; i < AIO_MAX; i++) {
+		if (aio_wait(&ev, 1, 0) != 1) {
+			errx(1, "FAILED: lost request %d", i);
+		}
+	}
+	if (aio_wait(&ev, 1, AIO_NOWAIT) != 0) {
+		errx(1, "FAILED: an extra event turned up");
+	}
+	printf("aiotest: at most %d requests outstanding\n", AIO_MAX);
+
+	close(fd);
+	remove(FILENAME);
+	printf("aiotest: SUCCESS\n");
+	return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * attest - exercise openat(), mkdirat(), fstatat() and unlinkat().
+ *
+ * Makes a directory, opens it, and builds and takes apart a small
+ * tree under it using only names relative to that descriptor, from
+ * another current directory, checking each step against the plain
+ * path calls. Also checks that a descriptor that isn't open or isn't
+ * a directory fails, and that unlinkat keeps files and directories
+ * apart. Then times NSTATS stats of a file DEPTH directories down by
+ * its whole path and by fstatat from its directory.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+
+#define TOPDIR	"attest.d"
+#define DEPTH	8
+#define NSTATS	500
+
+static
+void
+expect_fail(int result, int wanted, const char *what)
+{
+	if (result >= 0) {
+		errx(1, "%s: succeeded", what);
+	}
+	if (errno != wanted) {
+		err(1, "%s: wrong error", what);
+	}
+}
+
+static
+unsigned long
+usecs(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		err(1, "clock_gettime");
+	}
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static
+void
+basics(int dfd)
+{
+	struct stat st, st2;
+	int fd, ffd;
+
+	if (mkdirat(dfd, "sub", 0775) < 0) {
+		err(1, "mkdirat sub");
+	}
+	fd = openat(dfd, "sub/f", O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "openat sub/f");
+	}
+	if (write(fd, "hello", 5) != 5) {
+		err(1, "write sub/f");
+	}
+	close(fd);
+
+	/* the names are TOPDIR's, wherever we are */
+	if (chdir(TOPDIR "/sub") < 0) {
+		err(1, "chdir");
+	}
+	if (fstatat(dfd, "sub/f", &st, 0) < 0) {
+		err(1, "fstatat sub/f");
+	}
+	if (st.st_size != 5) {
+		errx(1, "fstatat sub/f: size %lld, not 5",
+		     (long long)st.st_size);
+	}
+	if (stat("f", &st2) < 0) {
+		err(1, "stat f");
+	}
+	if (st.st_ino != st2.st_ino) {
+		errx(1, "fstatat and stat see different files");
+	}
+	fd = openat(dfd, "sub/f", O_RDONLY);
+	if (fd < 0) {
+		err(1, "openat sub/f");
+	}
+	ffd = fd;
+
+	/* AT_FDCWD is the current directory */
+	if (fstatat(AT_FDCWD, "f", &st2, AT_SYMLINK_NOFOLLOW) < 0) {
+		err(1, "fstatat AT_FDCWD f");
+	}
+	if (st.st_ino != st2.st_ino) {
+		errx(1, "fstatat AT_FDCWD sees a different file");
+	}
+	if (chdir("../..") < 0) {
+		err(1, "chdir ../..");
+	}
+
+	/* bad descriptors */
+	expect_fail(openat(ffd, "x", O_RDONLY), ENOTDIR, "openat on a file");
+	expect_fail(fstatat(ffd, "x", &st, 0), ENOTDIR, "fstatat on a file");
+	expect_fail(mkdirat(ffd, "x", 0775), ENOTDIR, "mkdirat on a file");
+	expect_fail(openat(99, "x", O_RDONLY), EBADF, "openat on fd 99");
+	expect_fail(unlinkat(99, "x", 0), EBADF, "unlinkat on fd 99");
+	expect_fail(fstatat(dfd, "sub/f", &st, 0x40), EINVAL,
+		    "fstatat with a bad flag");
+	expect_fail(unlinkat(dfd, "sub/f", 0x40), EINVAL,
+		    "unlinkat with a bad flag");
+	close(ffd);
+
+	/* files and directories each their own way */
+	if (unlinkat(dfd, "sub", 0) >= 0) {
+		errx(1, "unlinkat without AT_REMOVEDIR removed sub");
+	}
+	if (unlinkat(dfd, "sub/f", AT_REMOVEDIR) >= 0) {
+		errx(1, "unlinkat AT_REMOVEDIR removed file sub/f");
+	}
+	if (unlinkat(dfd, "sub/f", 0) < 0) {
+		err(1, "unlinkat sub/f");
+	}
+	expect_fail(fstatat(dfd, "sub/f", &st, 0), ENOENT,
+		    "fstatat of removed sub/f");
+	if (unlinkat(dfd, "sub", AT_REMOVEDIR) < 0) {
+		err(1, "unlinkat sub");
+	}
+	expect_fail(stat(TOPDIR "/sub", &st), ENOENT, "stat of removed sub");
+}
+
+static
+void
+timing(int dfd)
+{
+	char path[DEPTH * 2 + sizeof(TOPDIR) + 8];
+	struct stat st;
+	unsigned long start, full, rel;
+	int i, fd, leaf;
+
+	/* TOPDIR/a/a/.../f */
+	strcpy(path, TOPDIR);
+	for (i = 0; i < DEPTH; i++) {
+		strcat(path, "/a");
+		if (mkdir(path, 0775) < 0) {
+			err(1, "mkdir %s", path);
+		}
+	}
+	leaf = open(path, O_RDONLY);
+	if (leaf < 0) {
+		err(1, "%s", path);
+	}
+	fd = openat(leaf, "f", O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "openat f");
+	}
+	close(fd);
+	strcat(path, "/f");
+
+	start = usecs();
+	for (i = 0; i < NSTATS; i++) {
+		if (stat(path, &st) < 0) {
+			err(1, "stat %s", path);
+		}
+	}
+	full = usecs() - start;
+
+	start = usecs();
+	for (i = 0; i < NSTATS; i++) {
+		if (fstatat(leaf, "f", &st, 0) < 0) {
+			err(1, "fstatat f");
+		}
+	}
+	rel = usecs() - start;
+
+	printf("attest: %d stats %d deep: by path %lu us, fstatat %lu us\n",
+	       NSTATS, DEPTH, full, rel);
+
+	/* and clean up from the bottom, relative to the top */
+	if (unlinkat(leaf, "f", 0) < 0) {
+		err(1, "unlinkat f");
+	}
+	close(leaf);
+	for (i = DEPTH; i > 0; i--) {
+		path[sizeof(TOPDIR) - 1 + 2 * i] = 0;
+		if (unlinkat(dfd, path + sizeof(TOPDIR), AT_REMOVEDIR) < 0) {
+			err(1, "unlinkat %s", path + sizeof(TOPDIR));
+		}
+	}
+}
+
+int
+main(void)
+{
+	int dfd;
+
+	if (mkdir(TOPDIR, 0775) < 0) {
+		err(1, "mkdir %s", TOPDIR);
+	}
+	dfd = open(TOPDIR, O_RDONLY);
+	if (dfd < 0) {
+		err(1, "%s", TOPDIR);
+	}
+
+	basics(dfd);
+	timing(dfd);
+
+	close(dfd);
+	if (rmdir(TOPDIR) < 0) {
+		err(1, "rmdir %s", TOPDIR);
+	}
+	printf("attest: passed\n");
+	return 0;
+}
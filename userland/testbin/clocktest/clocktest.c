@@ -0,0 +1,95 @@
+/*
+ * clocktest - exercise clock_gettime() and the time page.
+ *
+ * Checks that clock_gettime agrees with the __time system call to
+ * within a second, that CLOCK_MONOTONIC never goes backwards over
+ * NREADS reads and moves forward across a short sleep, rejects an
+ * unknown clock, and that a process writing the time page gets
+ * killed. Prints how many reads it managed in the time the loop took.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NREADS	100000
+
+static
+int
+before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+int
+main(void)
+{
+	struct timespec ts, last, start, req;
+	time_t secs;
+	unsigned long nsecs;
+	pid_t pid;
+	int i, status;
+
+	if (__time(&secs, &nsecs) < 0) {
+		err(1, "__time");
+	}
+	if (clock_gettime(CLOCK_REALTIME, &ts) < 0) {
+		err(1, "clock_gettime");
+	}
+	if (ts.tv_sec < secs || ts.tv_sec > secs + 1) {
+		errx(1, "clock_gettime says %ld, __time says %ld",
+		     (long)ts.tv_sec, (long)secs);
+	}
+	if (time(NULL) < secs) {
+		errx(1, "time went backwards");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	last = start;
+	for (i=0; i<NREADS; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if (before(&ts, &last)) {
+			errx(1, "CLOCK_MONOTONIC went backwards");
+		}
+		last = ts;
+	}
+	printf("clocktest: %d reads in %ld.%09ld seconds\n", NREADS,
+	       (long)(last.tv_sec - start.tv_sec - (last.tv_nsec < start.tv_nsec)),
+	       (long)((last.tv_nsec - start.tv_nsec + 1000000000) % 1000000000));
+
+	req.tv_sec = 0;
+	req.tv_nsec = 100000000;
+	if (nanosleep(&req, NULL) < 0) {
+		err(1, "nanosleep");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (!before(&last, &ts)) {
+		errx(1, "CLOCK_MONOTONIC didn't move across a sleep");
+	}
+
+	if (clock_gettime(12345, &ts) == 0 || errno != EINVAL) {
+		errx(1, "clock_gettime with a bad clock didn't fail with EINVAL");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		*(volatile int *)TIMEPAGE = 0;
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFSIGNALED(status)) {
+		errx(1, "writing the time page didn't kill the process");
+	}
+
+	printf("clocktest: passed\n");
+	return 0;
+}
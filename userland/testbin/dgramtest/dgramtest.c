@@ -0,0 +1,176 @@
+/*
+ * dgramtest - exercise datagram sockets.
+ *
+ * Binds two sockets on this machine, one to a fixed port and one to
+ * whatever port bind gives it, sends NMSGS datagrams of different
+ * sizes from one to the other through LNADDR_LOCAL and checks each
+ * arrives whole, in order, and says where it came from. Then connects
+ * them and does the same with read and write, checks a datagram bigger
+ * than the buffer is cut short, and checks that bind refuses a port
+ * that's taken and that socket calls on a non-socket fail.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define PORT		7
+#define NMSGS		8
+#define MAXMSG		1024
+
+static char sbuf[MAXMSG];
+static char rbuf[MAXMSG];
+
+static
+void
+mkaddr(struct sockaddr_ln *sa, unsigned addr, unsigned port)
+{
+	memset(sa, 0, sizeof(*sa));
+	sa->sln_len = sizeof(*sa);
+	sa->sln_family = AF_LNET;
+	sa->sln_addr = addr;
+	sa->sln_port = port;
+}
+
+static
+void
+fill(int msg, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		sbuf[i] = (char)(msg * 37 + i);
+	}
+}
+
+static
+void
+check(int msg, size_t len, ssize_t got)
+{
+	if (got < 0) {
+		err(1, "message %d: recvfrom", msg);
+	}
+	if ((size_t)got != len) {
+		errx(1, "message %d: got %ld bytes, expected %lu", msg,
+		     (long)got, (unsigned long)len);
+	}
+	fill(msg, len);
+	if (memcmp(sbuf, rbuf, len) != 0) {
+		errx(1, "message %d: wrong data", msg);
+	}
+}
+
+static
+int
+mksocket(unsigned port)
+{
+	struct sockaddr_ln sa;
+	int fd;
+
+	fd = socket(AF_LNET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		err(1, "socket");
+	}
+	mkaddr(&sa, LNADDR_LOCAL, port);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		err(1, "bind to port %u", port);
+	}
+	return fd;
+}
+
+int
+main(void)
+{
+	struct sockaddr_ln here, there, from;
+	socklen_t len;
+	ssize_t r;
+	size_t size;
+	int a, b, i;
+
+	a = mksocket(PORT);
+	b = mksocket(0);
+
+	len = sizeof(there);
+	if (getsockname(b, (struct sockaddr *)&there, &len) < 0) {
+		err(1, "getsockname");
+	}
+	if (there.sln_family != AF_LNET || there.sln_port == 0) {
+		errx(1, "getsockname: bad address");
+	}
+	printf("dgramtest: node %u, ports %u and %u\n",
+	       (unsigned)there.sln_addr, PORT, (unsigned)there.sln_port);
+
+	/* a to b with sendto/recvfrom */
+	mkaddr(&there, LNADDR_LOCAL, there.sln_port);
+	for (i=0; i<NMSGS; i++) {
+		size = (MAXMSG / NMSGS) * i + 1;
+		fill(i, size);
+		r = sendto(a, sbuf, size, 0, (struct sockaddr *)&there,
+			   sizeof(there));
+		if (r < 0) {
+			err(1, "message %d: sendto", i);
+		}
+	}
+	for (i=0; i<NMSGS; i++) {
+		size = (MAXMSG / NMSGS) * i + 1;
+		len = sizeof(from);
+		r = recvfrom(b, rbuf, sizeof(rbuf), 0,
+			     (struct sockaddr *)&from, &len);
+		check(i, size, r);
+		if (from.sln_port != PORT) {
+			errx(1, "message %d: came from port %u", i,
+			     (unsigned)from.sln_port);
+		}
+	}
+
+	/* b to a, connected, with write/read */
+	mkaddr(&here, LNADDR_LOCAL, PORT);
+	if (connect(b, (struct sockaddr *)&here, sizeof(here)) < 0) {
+		err(1, "connect");
+	}
+	for (i=0; i<NMSGS; i++) {
+		size = MAXMSG - i;
+		fill(i, size);
+		if (write(b, sbuf, size) < 0) {
+			err(1, "message %d: write", i);
+		}
+		r = read(a, rbuf, sizeof(rbuf));
+		check(i, size, r);
+	}
+
+	/* too big for the buffer: the rest is lost */
+	fill(0, MAXMSG);
+	if (write(b, sbuf, MAXMSG) < 0) {
+		err(1, "write");
+	}
+	r = read(a, rbuf, 10);
+	check(0, 10, r);
+
+	/* port 7 is taken */
+	i = socket(AF_LNET, SOCK_DGRAM, 0);
+	if (i < 0) {
+		err(1, "socket");
+	}
+	if (bind(i, (struct sockaddr *)&here, sizeof(here)) == 0) {
+		errx(1, "bind to a port in use succeeded");
+	}
+	else if (errno != EADDRINUSE) {
+		err(1, "bind to a port in use");
+	}
+	close(i);
+
+	/* not a socket */
+	if (bind(STDOUT_FILENO, (struct sockaddr *)&here,
+		 sizeof(here)) == 0 || errno != ENOTSOCK) {
+		errx(1, "bind on a non-socket didn't fail with ENOTSOCK");
+	}
+
+	close(a);
+	close(b);
+	printf("dgramtest: passed\n");
+	return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * direntest - exercise getdirentries().
+ *
+ * Makes NFILES files in the current directory, then lists it with
+ * getdirentries, once with a buffer big enough for everything and
+ * once with the smallest buffer allowed, checking that every record
+ * is well-formed and that each file turns up exactly once either way,
+ * and that what comes back matches getdirentry name for name. Also
+ * checks that too small a buffer, a closed descriptor and a file
+ * that isn't a directory fail.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define NFILES		40
+#define PREFIX		"dirent-"
+#define NAMEFMT		PREFIX "%02d"
+#define NOTDIR		"direntest.tmp"
+#define BIGBUF		8192
+#define MAXNAMES	256		/* entries the directory may have in all */
+
+static unsigned buf[BIGBUF / sizeof(unsigned)];	/* (aligned) */
+static char names[MAXNAMES][NAME_MAX + 1];
+
+static
+void
+makefiles(void)
+{
+	char name[32];
+	int i, fd;
+
+	for (i = 0; i < NFILES; i++) {
+		snprintf(name, sizeof(name), NAMEFMT, i);
+		fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+		if (fd < 0) {
+			err(1, "%s", name);
+		}
+		close(fd);
+	}
+}
+
+static
+void
+removefiles(void)
+{
+	char name[32];
+	int i;
+
+	for (i = 0; i < NFILES; i++) {
+		snprintf(name, sizeof(name), NAMEFMT, i);
+		if (remove(name) < 0) {
+			err(1, "remove %s", name);
+		}
+	}
+}
+
+/*
+ * Read the whole directory with getdirentries and a BUFLEN buffer;
+ * check the records and that each of our files is there once.
+ * Returns how many entries there were.
+ */
+static
+int
+listall(size_t buflen)
+{
+	int seen[NFILES];
+	struct dirent *d;
+	ssize_t len, pos;
+	int fd, n = 0, num, calls = 0, i;
+
+	memset(seen, 0, sizeof(seen));
+	fd = open(".", O_RDONLY);
+	if (fd < 0) {
+		err(1, ".");
+	}
+	while ((len = getdirentries(fd, (char *)buf, buflen)) > 0) {
+		calls++;
+		for (pos = 0; pos < len; pos += d->d_reclen) {
+			d = (struct dirent *)((char *)buf + pos);
+			if (d->d_reclen < DIRENT_RECLEN(d->d_namlen) ||
+			    d->d_reclen % 4 != 0 || pos + d->d_reclen > len) {
+				errx(1, "bad record length %u at %ld",
+				     d->d_reclen, (long)pos);
+			}
+			if (strlen(d->d_name) != d->d_namlen) {
+				errx(1, "%s: bad name length %u",
+				     d->d_name, d->d_namlen);
+			}
+			if (n >= MAXNAMES) {
+				errx(1, "too many entries");
+			}
+			strcpy(names[n++], d->d_name);
+			if (d->d_namlen > strlen(PREFIX) &&
+			    !memcmp(d->d_name, PREFIX, strlen(PREFIX)) &&
+			    (num = atoi(d->d_name + strlen(PREFIX))) >= 0 &&
+			    num < NFILES) {
+				if (seen[num]++) {
+					errx(1, "%s: seen twice", d->d_name);
+				}
+				if (d->d_type != DT_UNKNOWN &&
+				    d->d_type != DT_REG) {
+					errx(1, "%s: type %u", d->d_name,
+					     d->d_type);
+				}
+			}
+		}
+	}
+	if (len < 0) {
+		err(1, "getdirentries");
+	}
+	close(fd);
+
+	for (i = 0; i < NFILES; i++) {
+		if (!seen[i]) {
+			errx(1, NAMEFMT ": missing", i);
+		}
+	}
+	printf("%d entries in %d calls with a %u-byte buffer\n",
+	       n, calls, (unsigned)buflen);
+	return n;
+}
+
+/* Compare with getdirentry, one name at a time. */
+static
+void
+compare(int n)
+{
+	char name[NAME_MAX + 1];
+	ssize_t len;
+	int fd, i = 0;
+
+	fd = open(".", O_RDONLY);
+	if (fd < 0) {
+		err(1, ".");
+	}
+	while ((len = getdirentry(fd, name, sizeof(name) - 1)) > 0) {
+		name[len] = 0;
+		if (i >= n || strcmp(name, names[i])) {
+			errx(1, "getdirentry: %s is not %s", name,
+			     i < n ? names[i] : "(the end)");
+		}
+		i++;
+	}
+	if (len < 0) {
+		err(1, "getdirentry");
+	}
+	if (i != n) {
+		errx(1, "getdirentry: %d names, not %d", i, n);
+	}
+	close(fd);
+}
+
+static
+void
+failures(void)
+{
+	int fd;
+
+	fd = open(".", O_RDONLY);
+	if (fd < 0) {
+		err(1, ".");
+	}
+	if (getdirentries(fd, (char *)buf, DIRENT_MAXRECLEN - 1) >= 0 ||
+	    errno != EINVAL) {
+		errx(1, "small buffer: expected EINVAL");
+	}
+	close(fd);
+	if (getdirentries(fd, (char *)buf, BIGBUF) >= 0 || errno != EBADF) {
+		errx(1, "closed fd: expected EBADF");
+	}
+
+	fd = open(NOTDIR, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", NOTDIR);
+	}
+	if (getdirentries(fd, (char *)buf, BIGBUF) >= 0 || errno != ENOTDIR) {
+		errx(1, "regular file: expected ENOTDIR");
+	}
+	close(fd);
+	remove(NOTDIR);
+}
+
+int
+main(void)
+{
+	int n;
+
+	makefiles();
+
+	n = listall(BIGBUF);
+	if (listall(DIRENT_MAXRECLEN) != n) {
+		errx(1, "got different entries with a small buffer");
+	}
+	compare(n);
+	failures();
+
+	removefiles();
+	printf("direntest: passed\n");
+	return 0;
+}
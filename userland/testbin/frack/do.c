@@ -30,6 +30,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -39,6 +40,32 @@
 #include "name.h"
 #include "do.h"
 
+static int quiet;
+
+/*
+ * Normally each operation is printed as it's done; bench mode turns
+ * that off, so the console isn't what's being timed.
+ */
+void
+do_setquiet(int q)
+{
+	quiet = q;
+}
+
+static
+void
+say(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (quiet) {
+		return;
+	}
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+}
+
 int
 do_opendir(unsigned name)
 {
@@ -72,7 +99,7 @@ do_createfile(unsigned name)
 	if (fd < 0) {
 		err(1, "%s: create", namestr);
 	}
-	printf("create %s\n", namestr);
+	say("create %s\n", namestr);
 	return fd;
 }
 
@@ -122,7 +149,7 @@ do_write(int fd, unsigned name, unsigned code, unsigned seq,
 		done += ret;
 	}
 
-	printf("write %s: %lld at %lld\n", namestr, len, pos);
+	say("write %s: %lld at %lld\n", namestr, len, pos);
 }
 
 void
@@ -134,7 +161,7 @@ do_truncate(int fd, unsigned name, off_t len)
 	if (ftruncate(fd, len) == -1) {
 		err(1, "%s: truncate to %lld", namestr, len);
 	}
-	printf("truncate %s: to %lld\n", namestr, len);
+	say("truncate %s: to %lld\n", namestr, len);
 }
 
 void
@@ -146,7 +173,7 @@ do_mkdir(unsigned name)
 	if (mkdir(namestr, 0775) == -1) {
 		err(1, "%s: mkdir", namestr);
 	}
-	printf("mkdir %s\n", namestr);
+	say("mkdir %s\n", namestr);
 }
 
 void
@@ -158,7 +185,7 @@ do_rmdir(unsigned name)
 	if (rmdir(namestr) == -1) {
 		err(1, "%s: rmdir", namestr);
 	}
-	printf("rmdir %s\n", namestr);
+	say("rmdir %s\n", namestr);
 }
 
 void
@@ -170,7 +197,7 @@ do_unlink(unsigned name)
 	if (remove(namestr) == -1) {
 		err(1, "%s: remove", namestr);
 	}
-	printf("remove %s\n", namestr);
+	say("remove %s\n", namestr);
 }
 
 void
@@ -183,7 +210,7 @@ do_link(unsigned from, unsigned to)
 	if (link(fromstr, tostr) == -1) {
 		err(1, "link %s to %s", fromstr, tostr);
 	}
-	printf("link %s %s\n", fromstr, tostr);
+	say("link %s %s\n", fromstr, tostr);
 }
 
 void
@@ -196,7 +223,7 @@ do_rename(unsigned from, unsigned to)
 	if (rename(fromstr, tostr) == -1) {
 		err(1, "rename %s to %s", fromstr, tostr);
 	}
-	printf("rename %s %s\n", fromstr, tostr);
+	say("rename %s %s\n", fromstr, tostr);
 }
 
 void
@@ -216,7 +243,7 @@ do_renamexd(unsigned fromdir, unsigned from, unsigned todir, unsigned to)
 	if (rename(frombuf, tobuf) == -1) {
 		err(1, "rename %s to %s", frombuf, tobuf);
 	}
-	printf("rename %s %s\n", frombuf, tobuf);
+	say("rename %s %s\n", frombuf, tobuf);
 }
 
 void
@@ -228,7 +255,7 @@ do_chdir(unsigned name)
 	if (chdir(namestr) == -1) {
 		err(1, "chdir: %s", namestr);
 	}
-	printf("chdir %s\n", namestr);
+	say("chdir %s\n", namestr);
 }
 
 void
@@ -237,7 +264,7 @@ do_chdirup(void)
 	if (chdir("..") == -1) {
 		err(1, "chdir: ..");
 	}
-	printf("chdir ..\n");
+	say("chdir ..\n");
 }
 
 void
@@ -246,6 +273,6 @@ do_sync(void)
 	if (sync()) {
 		warn("sync");
 	}
-	printf("sync\n");
-	printf("----------------------------------------\n");
+	say("sync\n");
+	say("----------------------------------------\n");
 }
@@ -46,3 +46,4 @@ void do_renamexd(unsigned fromdir, unsigned from, unsigned todir, unsigned to);
 void do_chdir(unsigned name);
 void do_chdirup(void);
 void do_sync(void);
+void do_setquiet(int quiet);
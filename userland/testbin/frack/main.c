@@ -28,13 +28,22 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <err.h>
+#include <bench.h>
 
 #include "workloads.h"
 #include "main.h"
+#include "do.h"
+#include "timing.h"
 
 struct workload {
 	const char *name;
@@ -142,6 +151,232 @@ printworkloads(void)
 	}
 }
 
+/*
+ * Run WORKLOAD, with ARG if it takes one (ARG is NULL if none was
+ * given).
+ */
+static
+void
+runworkload(const struct workload *workload, const char *arg)
+{
+	if (workload->argname) {
+		if (arg == NULL) {
+			errx(1, "%s requires argument %s\n",
+			     workload->name, workload->argname);
+		}
+		workload->run.witharg(arg);
+	}
+	else {
+		if (arg != NULL) {
+			errx(1, "Stray argument for workload %s",
+			     workload->name);
+		}
+		workload->run.noarg();
+	}
+}
+
+////////////////////////////////////////////////////////////
+// bench mode
+
+/*
+ * frack bench [-n runs] workload[=arg] ...
+ *
+ * Runs each workload RUNS times (default 5) without the checker and
+ * without printing every operation, and reports how long each kind of
+ * operation took and how many operations a second the runs managed,
+ * as BENCH lines (see <bench.h>). With more than one workload they
+ * all run at once, each in a process of its own, so mixes of them
+ * can be timed against each other; the same one can be listed more
+ * than once. Each gets a directory of its own (frackbench.N, in the
+ * current directory), which is emptied after every run, outside the
+ * timing, and removed at the end.
+ */
+
+#define BENCH_DEFRUNS		5
+#define BENCH_MAXRUNS		100
+#define BENCH_MAXWORKLOADS	16
+
+/* The first entry in the current directory but . and .., if any. */
+static
+int
+firstentry(char *buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(".", O_RDONLY);
+	if (fd < 0) {
+		err(1, ".: open");
+	}
+	while ((n = getdirentry(fd, buf, len - 1)) > 0) {
+		buf[n] = 0;
+		if (strcmp(buf, ".") && strcmp(buf, "..")) {
+			close(fd);
+			return 1;
+		}
+	}
+	if (n < 0) {
+		err(1, ".: getdirentry");
+	}
+	close(fd);
+	return 0;
+}
+
+/* Remove everything in the current directory. */
+static
+void
+cleandir(void)
+{
+	char name[256];
+	struct stat st;
+
+	while (firstentry(name, sizeof(name))) {
+		if (lstat(name, &st) < 0) {
+			err(1, "%s: lstat", name);
+		}
+		if (S_ISDIR(st.st_mode)) {
+			if (chdir(name) < 0) {
+				err(1, "%s: chdir", name);
+			}
+			cleandir();
+			if (chdir("..") < 0) {
+				err(1, "..: chdir");
+			}
+			if (rmdir(name) < 0) {
+				err(1, "%s: rmdir", name);
+			}
+		}
+		else if (remove(name) < 0) {
+			err(1, "%s: remove", name);
+		}
+	}
+}
+
+/* In a child of bench: do the runs of WORKLOAD in directory NUM. */
+static
+void
+benchone(const struct workload *workload, const char *arg, unsigned nruns,
+	 unsigned num)
+{
+	uint64_t runtimes[BENCH_MAXRUNS], start;
+	char dir[32], path[256];
+	unsigned i;
+
+	snprintf(dir, sizeof(dir), "frackbench.%u", num);
+	if (mkdir(dir, 0775) < 0) {
+		err(1, "%s: mkdir", dir);
+	}
+	if (chdir(dir) < 0) {
+		err(1, "%s: chdir", dir);
+	}
+	if (getcwd(path, sizeof(path)) == NULL) {
+		err(1, "getcwd");
+	}
+
+	for (i=0; i<nruns; i++) {
+		start = bench_ns();
+		runworkload(workload, arg);
+		runtimes[i] = bench_ns() - start;
+
+		/* (in case it left us somewhere else) */
+		if (chdir(path) < 0) {
+			err(1, "%s: chdir", path);
+		}
+		cleandir();
+	}
+
+	if (chdir("..") < 0) {
+		err(1, "..: chdir");
+	}
+	if (rmdir(dir) < 0) {
+		warn("%s: rmdir", dir);
+	}
+	timing_report(workload->name, runtimes, nruns);
+}
+
+static
+void
+bench(int argc, char *argv[])
+{
+	const struct workload *workloads[BENCH_MAXWORKLOADS];
+	const char *args[BENCH_MAXWORKLOADS];
+	pid_t pids[BENCH_MAXWORKLOADS];
+	uint64_t start;
+	unsigned nruns, num, i;
+	char *eq;
+	int status, failed;
+
+	nruns = BENCH_DEFRUNS;
+	if (argc >= 2 && !strcmp(argv[0], "-n")) {
+		nruns = atoi(argv[1]);
+		if (nruns < 1 || nruns > BENCH_MAXRUNS) {
+			errx(1, "runs must be from 1 to %d", BENCH_MAXRUNS);
+		}
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 1) {
+		errx(1, "Usage: frack bench [-n runs] workload[=arg] ...");
+	}
+	if (argc > BENCH_MAXWORKLOADS) {
+		errx(1, "At most %d workloads at once", BENCH_MAXWORKLOADS);
+	}
+
+	num = argc;
+	for (i=0; i<num; i++) {
+		eq = strchr(argv[i], '=');
+		if (eq != NULL) {
+			*eq = 0;
+		}
+		args[i] = eq != NULL ? eq + 1 : NULL;
+		workloads[i] = findworkload(argv[i]);
+		if (workloads[i] == NULL) {
+			errx(1, "Unknown workload %s", argv[i]);
+		}
+		if ((workloads[i]->argname != NULL) != (args[i] != NULL)) {
+			errx(1, "%s: %s", argv[i], workloads[i]->argname ?
+			     "needs =argument" : "takes no argument");
+		}
+	}
+
+	setcheckmode(0);
+	do_setquiet(1);
+	timing_on();
+
+	printf("frack: bench, %u runs of %u workload%s at once\n",
+	       nruns, num, num == 1 ? "" : "s");
+	start = bench_ns();
+	for (i=0; i<num; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			benchone(workloads[i], args[i], nruns, i);
+			exit(0);
+		}
+	}
+
+	failed = 0;
+	for (i=0; i<num; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			warnx("%s failed", workloads[i]->name);
+			failed = 1;
+		}
+	}
+	printf("frack: bench done in %lu ms\n",
+	       (unsigned long)((bench_ns() - start) / 1000000));
+	if (failed) {
+		exit(1);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// main
+
 int
 main(int argc, char *argv[])
 {
@@ -154,8 +389,14 @@ main(int argc, char *argv[])
 		exit(0);
 	}
 
+	if (argc >= 2 && !strcmp(argv[1], "bench")) {
+		bench(argc - 2, argv + 2);
+		exit(0);
+	}
+
 	if (argc < 3) {
 		warnx("Usage: %s do|check workload [arg]", argv[0]);
+		warnx("       %s bench [-n runs] workload[=arg] ...", argv[0]);
 		warnx("Use \"list\" for a list of workloads");
 		exit(1);
 	}
@@ -177,20 +418,11 @@ main(int argc, char *argv[])
 		printworkloads();
 		exit(1);
 	}
-	setcheckmode(checkmode);
-	if (workload->argname) {
-		if (argc != 4) {
-			errx(1, "%s requires argument %s\n",
-			     workloadname, workload->argname);
-		}
-		workload->run.witharg(argv[3]);
-	}
-	else {
-		if (argc != 3) {
-			errx(1, "Stray argument for workload %s",workloadname);
-		}
-		workload->run.noarg();
+	if (argc > 4) {
+		errx(1, "Stray argument for workload %s", workloadname);
 	}
+	setcheckmode(checkmode);
+	runworkload(workload, argc == 4 ? argv[3] : NULL);
 	complete();
 	return 0;
 }
@@ -39,6 +39,7 @@
 #include "check.h"
 #include "ops.h"
 #include "main.h"
+#include "timing.h"
 
 struct file {
 	unsigned name;
@@ -73,6 +74,7 @@ struct dir *
 op_opendir(unsigned name)
 {
 	struct dir *ret;
+	uint64_t t;
 
 	ret = POOLALLOC(dir);
 	ret->name = name;
@@ -80,7 +82,9 @@ op_opendir(unsigned name)
 		ret->handle = -1;
 	}
 	else {
+		t = timing_start();
 		ret->handle = do_opendir(name);
+		timing_end(TIMED_OPENDIR, t);
 	}
 	return ret;
 }
@@ -88,12 +92,16 @@ op_opendir(unsigned name)
 void
 op_closedir(struct dir *d)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		/* nothing */
 		(void)d;
 	}
 	else {
+		t = timing_start();
 		do_closedir(d->handle, d->name);
+		timing_end(TIMED_CLOSEDIR, t);
 	}
 	POOLFREE(dir, d);
 }
@@ -109,6 +117,7 @@ op_open(unsigned testcode, unsigned name, unsigned openflags)
 {
 	struct file *ret;
 	int dotrunc;
+	uint64_t t;
 
 	if (openflags == O_TRUNC) {
 		openflags = 0;
@@ -135,7 +144,9 @@ op_open(unsigned testcode, unsigned name, unsigned openflags)
 	else {
 		if (openflags) {
 			assert(dotrunc == 0);
+			t = timing_start();
 			ret->handle = do_createfile(name);
+			timing_end(TIMED_CREATE, t);
 		}
 		else {
 			/*
@@ -143,7 +154,9 @@ op_open(unsigned testcode, unsigned name, unsigned openflags)
 			 * truncate call - neither truncate() nor
 			 * ftruncate()! You can only O_TRUNC. Oops...
 			 */
+			t = timing_start();
 			ret->handle = do_openfile(name, dotrunc);
+			timing_end(TIMED_OPEN, t);
 			dotrunc = 0;
 		}
 	}
@@ -156,11 +169,15 @@ op_open(unsigned testcode, unsigned name, unsigned openflags)
 void
 op_close(struct file *f)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		check_closefile(f->handle, f->name);
 	}
 	else {
+		t = timing_start();
 		do_closefile(f->handle, f->name);
+		timing_end(TIMED_CLOSE, t);
 	}
 	POOLFREE(file, f);
 }
@@ -169,6 +186,7 @@ void
 op_write(struct file *f, off_t pos, off_t len)
 {
 	off_t amount;
+	uint64_t t;
 
 	while (len > 0) {
 		amount = len;
@@ -181,8 +199,10 @@ op_write(struct file *f, off_t pos, off_t len)
 				    pos, amount);
 		}
 		else {
+			t = timing_start();
 			do_write(f->handle, f->name, f->testcode, f->seq,
 				 pos, amount);
+			timing_end(TIMED_WRITE, t);
 		}
 		f->seq++;
 		pos += amount;
@@ -193,11 +213,15 @@ op_write(struct file *f, off_t pos, off_t len)
 void
 op_truncate(struct file *f, off_t len)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		check_truncate(f->handle, f->name, len);
 	}
 	else {
+		t = timing_start();
 		do_truncate(f->handle, f->name, len);
+		timing_end(TIMED_TRUNCATE, t);
 	}
 }
 
@@ -207,88 +231,120 @@ op_truncate(struct file *f, off_t len)
 void
 op_mkdir(unsigned name)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		check_mkdir(name);
 	}
 	else {
+		t = timing_start();
 		do_mkdir(name);
+		timing_end(TIMED_MKDIR, t);
 	}
 }
 
 void
 op_rmdir(unsigned name)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		check_rmdir(name);
 	}
 	else {
+		t = timing_start();
 		do_rmdir(name);
+		timing_end(TIMED_RMDIR, t);
 	}
 }
 
 void
 op_unlink(unsigned name)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		check_unlink(name);
 	}
 	else {
+		t = timing_start();
 		do_unlink(name);
+		timing_end(TIMED_UNLINK, t);
 	}
 }
 
 void
 op_link(unsigned from, unsigned to)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		check_link(from, to);
 	}
 	else {
+		t = timing_start();
 		do_link(from, to);
+		timing_end(TIMED_LINK, t);
 	}
 }
 
 void
 op_rename(unsigned from, unsigned to)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		check_rename(from, to);
 	}
 	else {
+		t = timing_start();
 		do_rename(from, to);
+		timing_end(TIMED_RENAME, t);
 	}
 }
 
 void
 op_renamexd(unsigned fromdir, unsigned from, unsigned todir, unsigned to)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		check_renamexd(fromdir, from, todir, to);
 	}
 	else {
+		t = timing_start();
 		do_renamexd(fromdir, from, todir, to);
+		timing_end(TIMED_RENAME, t);
 	}
 }
 
 void
 op_chdir(unsigned name)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		check_chdir(name);
 	}
 	else {
+		t = timing_start();
 		do_chdir(name);
+		timing_end(TIMED_CHDIR, t);
 	}
 }
 
 void
 op_chdirup(void)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		check_chdirup();
 	}
 	else {
+		t = timing_start();
 		do_chdirup();
+		timing_end(TIMED_CHDIR, t);
 	}
 }
 
@@ -298,11 +354,15 @@ op_chdirup(void)
 void
 op_sync(void)
 {
+	uint64_t t;
+
 	if (checkmode) {
 		check_sync();
 	}
 	else {
+		t = timing_start();
 		do_sync();
+		timing_end(TIMED_SYNC, t);
 	}
 }
 
@@ -0,0 +1,102 @@
+/*
+ * Timing for bench mode; see timing.h.
+ *
+ * Every operation is counted, with its time, but only the first
+ * TIMING_MAXSAMPLES of each kind are kept for the percentiles; the
+ * BENCH line for a kind says how many there were in all (calls) and
+ * the total time they took (ms), which is what ops/sec comes from.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <bench.h>
+
+#include "timing.h"
+
+#define TIMING_MAXSAMPLES 1024
+
+static const char *const opnames[TIMED_NUM] = {
+	[TIMED_OPENDIR] = "opendir",
+	[TIMED_CLOSEDIR] = "closedir",
+	[TIMED_CREATE] = "create",
+	[TIMED_OPEN] = "open",
+	[TIMED_CLOSE] = "close",
+	[TIMED_WRITE] = "write",
+	[TIMED_TRUNCATE] = "truncate",
+	[TIMED_MKDIR] = "mkdir",
+	[TIMED_RMDIR] = "rmdir",
+	[TIMED_UNLINK] = "unlink",
+	[TIMED_LINK] = "link",
+	[TIMED_RENAME] = "rename",
+	[TIMED_CHDIR] = "chdir",
+	[TIMED_SYNC] = "sync",
+};
+
+static int timing;
+static uint64_t samples[TIMED_NUM][TIMING_MAXSAMPLES];
+static unsigned counts[TIMED_NUM];
+static uint64_t totals[TIMED_NUM];
+
+void
+timing_on(void)
+{
+	timing = 1;
+}
+
+uint64_t
+timing_start(void)
+{
+	return timing ? bench_ns() : 0;
+}
+
+void
+timing_end(enum timedop op, uint64_t start)
+{
+	uint64_t t;
+
+	if (!timing) {
+		return;
+	}
+	t = bench_ns() - start;
+	if (counts[op] < TIMING_MAXSAMPLES) {
+		samples[op][counts[op]] = t;
+	}
+	counts[op]++;
+	totals[op] += t;
+}
+
+void
+timing_report(const char *workload, uint64_t *runtimes, unsigned nruns)
+{
+	char name[64], extra[64];
+	uint64_t runtotal;
+	unsigned op, i, nops, nkept;
+
+	nops = 0;
+	for (op=0; op<TIMED_NUM; op++) {
+		if (counts[op] == 0) {
+			continue;
+		}
+		nops += counts[op];
+		nkept = counts[op] < TIMING_MAXSAMPLES ?
+			counts[op] : TIMING_MAXSAMPLES;
+		snprintf(name, sizeof(name), "frack.%s.%s", workload,
+			 opnames[op]);
+		snprintf(extra, sizeof(extra), "calls=%u ms=%lu", counts[op],
+			 (unsigned long)(totals[op] / 1000000));
+		bench_report(name, samples[op], nkept, 1, extra);
+	}
+
+	runtotal = 0;
+	for (i=0; i<nruns; i++) {
+		runtotal += runtimes[i];
+	}
+	if (nops < nruns || runtotal == 0) {
+		printf("frack: %s: nothing to time\n", workload);
+		return;
+	}
+	snprintf(name, sizeof(name), "frack.%s", workload);
+	snprintf(extra, sizeof(extra), "runs=%u ops/s=%lu", nruns,
+		 (unsigned long)((uint64_t)nops * 1000000000 / runtotal));
+	bench_report(name, runtimes, nruns, nops / nruns, extra);
+}
@@ -0,0 +1,29 @@
+/*
+ * Timing for bench mode (frack bench, see main.c): each operation the
+ * workloads do is timed, by kind, and timing_report prints a BENCH
+ * line (see <bench.h>) for each kind and one for the runs as a whole.
+ * When timing isn't on, timing_start and timing_end do nothing.
+ */
+
+enum timedop {
+	TIMED_OPENDIR,
+	TIMED_CLOSEDIR,
+	TIMED_CREATE,
+	TIMED_OPEN,
+	TIMED_CLOSE,
+	TIMED_WRITE,
+	TIMED_TRUNCATE,
+	TIMED_MKDIR,
+	TIMED_RMDIR,
+	TIMED_UNLINK,
+	TIMED_LINK,
+	TIMED_RENAME,
+	TIMED_CHDIR,
+	TIMED_SYNC,
+	TIMED_NUM
+};
+
+void timing_on(void);
+uint64_t timing_start(void);
+void timing_end(enum timedop op, uint64_t start);
+void timing_report(const char *workload, uint64_t *runtimes, unsigned nruns);
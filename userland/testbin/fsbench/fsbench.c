@@ -0,0 +1,313 @@
+/*
+ * fsbench - file system throughput.
+ *
+ * Usage: fsbench [directory]
+ *
+ * Works in DIRECTORY (default the current one), so the same run can be
+ * pointed at SFS, emufs or tmpfs and the numbers compared:
+ *    seqwrite.<bs>, seqread.<bs>
+ *                      write, then read back, a FILESIZE file in
+ *                      blocks of bs bytes; MB/s
+ *    randwrite.4k, randread.4k
+ *                      NRAND 4K pwrites and preads at random aligned
+ *                      offsets in that file; ops/s (IOPS)
+ *    create.<n>, stat.<n>, remove.<n>
+ *                      make n empty files in a new directory, stat
+ *                      each by name, and remove them; ops/s
+ * The write phases end with an fsync, which is counted as part of the
+ * last operation, so they measure getting the data to the disk and not
+ * just to the buffer cache. Results are BENCH lines (see bench.h);
+ * each sample is a batch of operations.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <bench.h>
+
+#define FILENAME	"fsbench.tmp"
+#define DIRNAME		"fsbench.d"
+#define FILESIZE	(1024*1024)
+#define MAXBLOCK	(64*1024)
+#define NRAND		256
+#define RANDBLOCK	4096
+#define MAXSAMPLES	256
+
+static const unsigned blocksizes[] = { 512, 4096, 65536 };
+static const unsigned dirsizes[] = { 16, 64, 256 };
+
+static uint64_t samples[MAXSAMPLES];
+static char buf[MAXBLOCK];
+static int fd = -1;
+static unsigned blocksize;
+static unsigned nops;
+static unsigned randseed;
+
+/* Is operation I the last one of its phase? */
+#define ISLAST(i) ((i) == nops - 1)
+
+////////////////////////////////////////////////////////////
+// operations
+
+static
+void
+op_seqwrite(unsigned i)
+{
+	if (write(fd, buf, blocksize) != (ssize_t)blocksize) {
+		err(1, "%s: write", FILENAME);
+	}
+	if (ISLAST(i) && fsync(fd) < 0) {
+		err(1, "%s: fsync", FILENAME);
+	}
+}
+
+static
+void
+op_seqread(unsigned i)
+{
+	(void)i;
+	if (read(fd, buf, blocksize) != (ssize_t)blocksize) {
+		err(1, "%s: read", FILENAME);
+	}
+}
+
+static
+off_t
+randoffset(void)
+{
+	randseed = randseed * 1103515245 + 12345;
+	return (off_t)((randseed >> 8) % (FILESIZE / RANDBLOCK)) * RANDBLOCK;
+}
+
+static
+void
+op_randwrite(unsigned i)
+{
+	if (pwrite(fd, buf, RANDBLOCK, randoffset()) != RANDBLOCK) {
+		err(1, "%s: pwrite", FILENAME);
+	}
+	if (ISLAST(i) && fsync(fd) < 0) {
+		err(1, "%s: fsync", FILENAME);
+	}
+}
+
+static
+void
+op_randread(unsigned i)
+{
+	(void)i;
+	if (pread(fd, buf, RANDBLOCK, randoffset()) != RANDBLOCK) {
+		err(1, "%s: pread", FILENAME);
+	}
+}
+
+static
+void
+filename(char *name, size_t len, unsigned i)
+{
+	snprintf(name, len, "%s/f%u", DIRNAME, i);
+}
+
+static
+void
+op_create(unsigned i)
+{
+	char name[32];
+	int f;
+
+	filename(name, sizeof(name), i);
+	f = open(name, O_WRONLY|O_CREAT|O_EXCL, 0664);
+	if (f < 0) {
+		err(1, "%s", name);
+	}
+	close(f);
+}
+
+static
+void
+op_stat(unsigned i)
+{
+	char name[32];
+	struct stat st;
+
+	filename(name, sizeof(name), i);
+	if (stat(name, &st) < 0) {
+		err(1, "%s: stat", name);
+	}
+}
+
+static
+void
+op_remove(unsigned i)
+{
+	char name[32];
+
+	filename(name, sizeof(name), i);
+	if (remove(name) < 0) {
+		err(1, "%s: remove", name);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// timing
+
+/*
+ * Do OP for 0..N-1, N a power of two, timed in batches so there are at
+ * most MAXSAMPLES samples, and report it. If BYTES isn't 0 it's how
+ * much each operation moves, and the rate is given in MB/s; otherwise
+ * in operations per second.
+ */
+static
+void
+timeops(const char *name, unsigned n, void (*op)(unsigned), unsigned bytes)
+{
+	char extra[32];
+	unsigned batch, nsamples, s, j;
+	uint64_t start, ns;
+	unsigned long rate;
+
+	nops = n;
+	batch = n > MAXSAMPLES ? n / MAXSAMPLES : 1;
+	nsamples = n / batch;
+
+	ns = 0;
+	for (s=0; s<nsamples; s++) {
+		start = bench_ns();
+		for (j=0; j<batch; j++) {
+			op(s * batch + j);
+		}
+		samples[s] = bench_ns() - start;
+		ns += samples[s];
+	}
+	if (ns == 0) {
+		ns = 1;
+	}
+
+	if (bytes > 0) {
+		/* in hundredths of a MB/s */
+		rate = (unsigned long)((uint64_t)n * bytes * 100 *
+				       1000000000 / (1024 * 1024) / ns);
+		snprintf(extra, sizeof(extra), "MB/s=%lu.%02lu",
+			 rate / 100, rate % 100);
+	}
+	else {
+		rate = (unsigned long)((uint64_t)n * 1000000000 / ns);
+		snprintf(extra, sizeof(extra), "ops/s=%lu", rate);
+	}
+	bench_report(name, samples, nsamples, batch, extra);
+}
+
+////////////////////////////////////////////////////////////
+// phases
+
+static
+void
+openfile(int flags)
+{
+	fd = open(FILENAME, flags, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+}
+
+static
+void
+closefile(void)
+{
+	if (close(fd) < 0) {
+		err(1, "%s: close", FILENAME);
+	}
+	fd = -1;
+}
+
+static
+void
+sequential(void)
+{
+	char name[32];
+	unsigned i;
+
+	for (i=0; i<sizeof(blocksizes)/sizeof(blocksizes[0]); i++) {
+		blocksize = blocksizes[i];
+
+		openfile(O_WRONLY|O_CREAT|O_TRUNC);
+		snprintf(name, sizeof(name), "seqwrite.%u", blocksize);
+		timeops(name, FILESIZE / blocksize, op_seqwrite, blocksize);
+		closefile();
+
+		openfile(O_RDONLY);
+		snprintf(name, sizeof(name), "seqread.%u", blocksize);
+		timeops(name, FILESIZE / blocksize, op_seqread, blocksize);
+		closefile();
+	}
+}
+
+/* uses the file sequential() left behind */
+static
+void
+randomio(void)
+{
+	openfile(O_RDWR);
+	randseed = 1;
+	timeops("randwrite.4k", NRAND, op_randwrite, 0);
+	randseed = 2;
+	timeops("randread.4k", NRAND, op_randread, 0);
+	closefile();
+}
+
+static
+void
+metadata(void)
+{
+	char name[32];
+	unsigned i, n;
+
+	for (i=0; i<sizeof(dirsizes)/sizeof(dirsizes[0]); i++) {
+		n = dirsizes[i];
+		if (mkdir(DIRNAME, 0775) < 0) {
+			err(1, "%s", DIRNAME);
+		}
+		snprintf(name, sizeof(name), "create.%u", n);
+		timeops(name, n, op_create, 0);
+		snprintf(name, sizeof(name), "stat.%u", n);
+		timeops(name, n, op_stat, 0);
+		snprintf(name, sizeof(name), "remove.%u", n);
+		timeops(name, n, op_remove, 0);
+		if (rmdir(DIRNAME) < 0) {
+			err(1, "%s: rmdir", DIRNAME);
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *dir = ".";
+
+	if (argc == 2) {
+		dir = argv[1];
+	}
+	else if (argc != 1) {
+		errx(1, "Usage: fsbench [directory]");
+	}
+	if (chdir(dir) < 0) {
+		err(1, "%s", dir);
+	}
+	memset(buf, 'f', sizeof(buf));
+
+	printf("fsbench: in %s\n", dir);
+	sequential();
+	randomio();
+	metadata();
+
+	if (remove(FILENAME) < 0) {
+		warn("%s: remove", FILENAME);
+	}
+	return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * fsynctest - check fsync, fdatasync and sync_file_range.
+ *
+ * Writes a file, syncs it each way (including rewriting part of it in
+ * place, which is the case fdatasync and sync_file_range can do
+ * without the inode), and checks the contents read back. Also checks
+ * the errors for bad file handles, bad ranges and pipes. Whether the
+ * data really reached the disk needs a crash to tell; this only shows
+ * the calls work and don't lose anything.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define FILENAME  "fsynctest.dat"
+#define BLOCK     512
+#define NBLOCKS   96		/* past the direct blocks, into the indirect */
+
+static char buf[BLOCK];
+
+static
+void
+fill(int block, int pass)
+{
+	memset(buf, 'a' + (block + pass) % 26, sizeof(buf));
+}
+
+static
+void
+writeblocks(int fd, int from, int to, int pass)
+{
+	int i;
+	ssize_t r;
+
+	for (i = from; i < to; i++) {
+		fill(i, pass);
+		r = pwrite(fd, buf, BLOCK, (off_t)i * BLOCK);
+		if (r != BLOCK) {
+			err(1, "pwrite of block %d", i);
+		}
+	}
+}
+
+static
+void
+checkblocks(int fd, int from, int to, int pass)
+{
+	char rbuf[BLOCK];
+	int i;
+	ssize_t r;
+
+	for (i = from; i < to; i++) {
+		r = pread(fd, rbuf, BLOCK, (off_t)i * BLOCK);
+		if (r != BLOCK) {
+			err(1, "pread of block %d", i);
+		}
+		fill(i, pass);
+		if (memcmp(rbuf, buf, BLOCK) != 0) {
+			errx(1, "block %d has the wrong contents", i);
+		}
+	}
+}
+
+static
+void
+expect(int result, int code, const char *what)
+{
+	if (result != -1) {
+		errx(1, "%s: succeeded", what);
+	}
+	if (errno != code) {
+		errx(1, "%s: got %s, expected %s", what, strerror(errno),
+		     strerror(code));
+	}
+}
+
+int
+main(void)
+{
+	int fd, fds[2];
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	/* a new file: everything changed, so all three sync it all */
+	writeblocks(fd, 0, NBLOCKS, 0);
+	if (fsync(fd)) {
+		err(1, "fsync");
+	}
+	checkblocks(fd, 0, NBLOCKS, 0);
+
+	/* rewrite in place: only data changed */
+	writeblocks(fd, 0, NBLOCKS, 1);
+	if (fdatasync(fd)) {
+		err(1, "fdatasync");
+	}
+	checkblocks(fd, 0, NBLOCKS, 1);
+
+	/* a range in the middle, and one running past the end */
+	writeblocks(fd, 10, 20, 2);
+	if (sync_file_range(fd, 10 * BLOCK, 10 * BLOCK)) {
+		err(1, "sync_file_range");
+	}
+	writeblocks(fd, 80, NBLOCKS, 2);
+	if (sync_file_range(fd, 80 * BLOCK, 1000 * BLOCK)) {
+		err(1, "sync_file_range past EOF");
+	}
+	if (sync_file_range(fd, 0, 0)) {
+		err(1, "sync_file_range of the whole file");
+	}
+	checkblocks(fd, 10, 20, 2);
+	checkblocks(fd, 80, NBLOCKS, 2);
+	checkblocks(fd, 20, 80, 1);
+
+	/* growing the file changes the size: fdatasync has to write it */
+	writeblocks(fd, NBLOCKS, NBLOCKS + 8, 3);
+	if (fdatasync(fd)) {
+		err(1, "fdatasync after growing");
+	}
+	if (lseek(fd, 0, SEEK_END) != (off_t)(NBLOCKS + 8) * BLOCK) {
+		errx(1, "wrong size after growing");
+	}
+	checkblocks(fd, NBLOCKS, NBLOCKS + 8, 3);
+
+	expect(sync_file_range(fd, -1, 0), EINVAL, "negative offset");
+	expect(sync_file_range(fd, 0, -1), EINVAL, "negative length");
+	close(fd);
+	expect(fsync(fd), EBADF, "fsync of a closed file");
+	expect(fdatasync(fd), EBADF, "fdatasync of a closed file");
+	expect(sync_file_range(fd, 0, 0), EBADF,
+	       "sync_file_range of a closed file");
+
+	if (pipe(fds)) {
+		err(1, "pipe");
+	}
+	expect(sync_file_range(fds[0], 0, 0), ESPIPE,
+	       "sync_file_range of a pipe");
+	close(fds[0]);
+	close(fds[1]);
+
+	if (remove(FILENAME)) {
+		err(1, "remove");
+	}
+	printf("fsynctest passed\n");
+	return 0;
+}
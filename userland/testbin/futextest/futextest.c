@@ -0,0 +1,140 @@
+/*
+ * futextest - exercise futex_wait()/futex_wake().
+ *
+ * Checks the simple cases first (a wait on a word that doesn't hold the
+ * expected value fails with EAGAIN, a wake with nobody waiting wakes
+ * nobody), then forks NPROCS children that each add to a counter in a
+ * shared mapping LOOPS times, under a lock built on a futex. The lock
+ * only calls into the kernel when it's contended. At the end the
+ * counter must be exact.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <futex.h>
+#include <atomic.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NPROCS	4
+#define LOOPS	2000
+
+struct shared {
+	volatile int lock;	/* 0 free, 1 held, 2 held with waiters */
+	volatile int counter;
+};
+
+/* The mutex from Drepper's "Futexes Are Tricky". */
+static
+void
+futexlock(volatile int *m)
+{
+	int c;
+
+	c = atomic_cas(m, 0, 1);
+	if (c == 0) {
+		return;
+	}
+	if (c != 2) {
+		c = atomic_xchg(m, 2);
+	}
+	while (c != 0) {
+		if (futex_wait(m, 2) < 0 && errno != EAGAIN) {
+			err(1, "futex_wait");
+		}
+		c = atomic_xchg(m, 2);
+	}
+}
+
+static
+void
+futexunlock(volatile int *m)
+{
+	if (atomic_xchg(m, 0) == 2) {
+		if (futex_wake(m, 1) < 0) {
+			err(1, "futex_wake");
+		}
+	}
+}
+
+static
+void
+simpletest(struct shared *s)
+{
+	s->lock = 5;
+	if (futex_wait(&s->lock, 6) != -1 || errno != EAGAIN) {
+		errx(1, "futex_wait on a changed word didn't fail with EAGAIN");
+	}
+	if (futex_wake(&s->lock, 1) != 0) {
+		errx(1, "futex_wake with no waiters woke somebody");
+	}
+	if (futex_wait((volatile int *)((char *)&s->lock + 1), 0) != -1 ||
+	    errno != EINVAL) {
+		errx(1, "futex_wait on an unaligned word didn't fail with EINVAL");
+	}
+	s->lock = 0;
+	printf("futextest: simple cases passed\n");
+}
+
+static
+void
+locktest(struct shared *s)
+{
+	pid_t pids[NPROCS];
+	int i, j, status, failed = 0;
+
+	for (i = 0; i < NPROCS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			for (j = 0; j < LOOPS; j++) {
+				futexlock(&s->lock);
+				s->counter = s->counter + 1;
+				futexunlock(&s->lock);
+			}
+			_exit(0);
+		}
+	}
+
+	for (i = 0; i < NPROCS; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			warnx("child %d failed", i);
+			failed = 1;
+		}
+	}
+	if (failed) {
+		errx(1, "FAILED");
+	}
+	if (s->counter != NPROCS * LOOPS) {
+		errx(1, "FAILED: counter is %d, expected %d",
+		     s->counter, NPROCS * LOOPS);
+	}
+	printf("futextest: %d processes counted to %d\n",
+	       NPROCS, s->counter);
+}
+
+int
+main(void)
+{
+	struct shared *s;
+
+	s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANON, -1, 0);
+	if (s == MAP_FAILED) {
+		err(1, "mmap");
+	}
+
+	simpletest(s);
+	locktest(s);
+
+	printf("futextest: SUCCESS\n");
+	return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * holetest - exercise SEEK_DATA, SEEK_HOLE and fallocate().
+ *
+ * Writes a file with data at the start and CHUNK bytes at GAP, and
+ * nothing between, then checks that lseek finds the data and the
+ * holes where they are; punches a hole in the first part and part of
+ * one in the second and checks what reads back, and where the data
+ * is then; and preallocates past the end, with and without changing
+ * the size. Run it on SFS (the default file is in the current
+ * directory). A file system without holes says the file is all
+ * data, which passes, with a note; one that can't fallocate skips
+ * those parts.
+ *
+ * Offsets are multiples of CHUNK, which is a whole number of blocks
+ * on any file system we have, and the file stays small enough for an
+ * SFS volume without extents.
+ */
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define CHUNK	4096
+#define GAP	(4 * CHUNK)
+
+static char buf[CHUNK];
+static bool holes = true;
+
+static
+off_t
+seek(int fd, off_t pos, int whence, const char *what)
+{
+	off_t ret;
+
+	ret = lseek(fd, pos, whence);
+	if (ret < 0) {
+		err(1, "lseek %s %lld", what, (long long)pos);
+	}
+	return ret;
+}
+
+static
+void
+expect_nxio(int fd, off_t pos, int whence, const char *what)
+{
+	if (lseek(fd, pos, whence) >= 0) {
+		errx(1, "lseek %s %lld: succeeded", what, (long long)pos);
+	}
+	if (errno != ENXIO) {
+		err(1, "lseek %s %lld: wrong error", what, (long long)pos);
+	}
+}
+
+static
+off_t
+filesize(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0) {
+		err(1, "fstat");
+	}
+	return st.st_size;
+}
+
+static
+void
+fill(int fd, off_t pos, char c)
+{
+	memset(buf, c, CHUNK);
+	if (pwrite(fd, buf, CHUNK, pos) != CHUNK) {
+		err(1, "pwrite at %lld", (long long)pos);
+	}
+}
+
+/* Check that LEN bytes from POS are all C */
+static
+void
+check(int fd, off_t pos, size_t len, char c)
+{
+	size_t i;
+
+	if (pread(fd, buf, len, pos) != (ssize_t)len) {
+		err(1, "pread at %lld", (long long)pos);
+	}
+	for (i = 0; i < len; i++) {
+		if (buf[i] != c) {
+			errx(1, "byte %lld is %d, not %d",
+			     (long long)(pos + i), buf[i], c);
+		}
+	}
+}
+
+static
+void
+seeks(int fd)
+{
+	off_t size = GAP + CHUNK;
+	off_t h;
+
+	if (seek(fd, 0, SEEK_DATA, "data") != 0) {
+		errx(1, "first data isn't at 0");
+	}
+	h = seek(fd, 0, SEEK_HOLE, "hole");
+	if (h == size) {
+		printf("holetest: no holes here; the file is all data\n");
+		holes = false;
+	}
+	else if (h != CHUNK) {
+		errx(1, "first hole at %lld, not %d", (long long)h, CHUNK);
+	}
+
+	if (seek(fd, CHUNK + 100, SEEK_DATA, "data") !=
+	    (holes ? GAP : CHUNK + 100)) {
+		errx(1, "data after the first hole in the wrong place");
+	}
+	if (seek(fd, GAP + 100, SEEK_HOLE, "hole") != size) {
+		errx(1, "no hole at the end");
+	}
+	if (seek(fd, GAP + 100, SEEK_DATA, "data") != GAP + 100) {
+		errx(1, "data isn't where it was asked for");
+	}
+	expect_nxio(fd, size, SEEK_DATA, "data");
+	expect_nxio(fd, size, SEEK_HOLE, "hole");
+	expect_nxio(fd, size + CHUNK, SEEK_DATA, "data");
+
+	/* and it doesn't move the offset it was given */
+	if (seek(fd, 0, SEEK_CUR, "cur") != GAP + 100) {
+		errx(1, "offset not left at the last seek");
+	}
+}
+
+static
+int
+punch(int fd)
+{
+	off_t size = GAP + CHUNK;
+
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      0, CHUNK) < 0) {
+		if (errno == ENOSYS) {
+			printf("holetest: no fallocate here; skipping\n");
+			return -1;
+		}
+		err(1, "punch 0");
+	}
+	if (filesize(fd) != size) {
+		errx(1, "punching changed the size");
+	}
+	check(fd, 0, CHUNK, 0);
+	if (holes && seek(fd, 0, SEEK_DATA, "data") != GAP) {
+		errx(1, "punched hole still has data");
+	}
+
+	/* part of a block: only those bytes go */
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      GAP + 100, 200) < 0) {
+		err(1, "punch part");
+	}
+	check(fd, GAP, 100, 'b');
+	check(fd, GAP + 100, 200, 0);
+	check(fd, GAP + 300, CHUNK - 300, 'b');
+	if (seek(fd, GAP, SEEK_DATA, "data") != GAP) {
+		errx(1, "partly punched block lost its data");
+	}
+
+	/* the modes that don't make sense */
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE, 0, CHUNK) >= 0 ||
+	    errno != EINVAL) {
+		errx(1, "punch without KEEP_SIZE didn't fail with EINVAL");
+	}
+	if (fallocate(fd, 0, 0, 0) >= 0 || errno != EINVAL) {
+		errx(1, "fallocate of nothing didn't fail with EINVAL");
+	}
+	return 0;
+}
+
+static
+void
+prealloc(int fd)
+{
+	off_t size = GAP + CHUNK;
+
+	/* past the end, leaving the size */
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, size, CHUNK) < 0) {
+		err(1, "fallocate KEEP_SIZE");
+	}
+	if (filesize(fd) != size) {
+		errx(1, "KEEP_SIZE changed the size");
+	}
+
+	/* and making it longer */
+	if (fallocate(fd, 0, size, 2 * CHUNK) < 0) {
+		err(1, "fallocate");
+	}
+	if (filesize(fd) != size + 2 * CHUNK) {
+		errx(1, "fallocate didn't make the file longer");
+	}
+	check(fd, size, CHUNK, 0);
+	check(fd, size + CHUNK, CHUNK, 0);
+	if (seek(fd, size, SEEK_HOLE, "hole") != size + 2 * CHUNK) {
+		errx(1, "preallocated blocks are a hole");
+	}
+
+	/* filling the first hole again */
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, GAP) < 0) {
+		err(1, "fallocate the hole");
+	}
+	check(fd, 0, CHUNK, 0);
+	if (seek(fd, 0, SEEK_HOLE, "hole") != size + 2 * CHUNK) {
+		errx(1, "filled hole is still a hole");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *file;
+	int fd;
+
+	file = argc > 1 ? argv[1] : "holetest.tmp";
+	if (argc > 2) {
+		errx(1, "Usage: holetest [file]");
+	}
+
+	fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+	fill(fd, 0, 'a');
+	fill(fd, GAP, 'b');
+	/* (so it's in the map, not waiting for allocation) */
+	if (fsync(fd) < 0) {
+		err(1, "fsync");
+	}
+
+	seeks(fd);
+	if (punch(fd) == 0) {
+		prealloc(fd);
+	}
+	close(fd);
+
+	/* it needs a file open for writing */
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+	if (fallocate(fd, 0, 0, CHUNK) >= 0 || errno != EBADF) {
+		errx(1, "fallocate on a read-only file didn't fail with EBADF");
+	}
+	close(fd);
+	remove(file);
+
+	printf("holetest: passed\n");
+	return 0;
+}
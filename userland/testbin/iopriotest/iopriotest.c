@@ -0,0 +1,207 @@
+/*
+ * iopriotest - check ioprio_set and ioprio_get.
+ *
+ * Puts itself in each I/O priority class and reads it back, checks
+ * the errors, sees that a child forked in a class starts in it and
+ * that the parent can move the child, and then has a child in
+ * IOPRIO_IDLE write a big file while the parent reads a small one,
+ * to see that the reads still get done. Whether they get done as
+ * fast as they should under the load needs a stopwatch (and the
+ * stats:disk latency histograms per class); this only shows it works.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <sched.h>
+#include <errno.h>
+#include <err.h>
+
+#define BIGFILE		"iopriotest.big"
+#define SMALLFILE	"iopriotest.small"
+#define CHUNK		4096
+#define BIGCHUNKS	128
+#define READS		32
+
+static char buf[CHUNK];
+
+static
+void
+check(pid_t pid, int ioprio)
+{
+	int got;
+
+	got = ioprio_get(pid);
+	if (got < 0) {
+		err(1, "ioprio_get");
+	}
+	if (got != ioprio) {
+		errx(1, "pid %d: got class %d, expected %d", pid, got,
+		     ioprio);
+	}
+}
+
+static
+void
+set(pid_t pid, int ioprio)
+{
+	if (ioprio_set(pid, ioprio) < 0) {
+		err(1, "ioprio_set %d", ioprio);
+	}
+	check(pid, ioprio);
+}
+
+static
+void
+expect(int ioprio, int code, const char *what)
+{
+	if (ioprio_set(0, ioprio) != -1) {
+		errx(1, "%s: succeeded", what);
+	}
+	if (errno != code) {
+		errx(1, "%s: got %s, expected %s", what, strerror(errno),
+		     strerror(code));
+	}
+}
+
+/* The child starts in our class, and we can change its. */
+static
+void
+inherit(void)
+{
+	int hold[2], status;
+	pid_t pid;
+	char c;
+
+	set(0, IOPRIO_IDLE);
+	if (pipe(hold)) {
+		err(1, "pipe");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(hold[1]);
+		if (ioprio_get(0) != IOPRIO_IDLE) {
+			_exit(1);
+		}
+		/* until the parent has moved us */
+		read(hold[0], &c, 1);
+		_exit(ioprio_get(0) == IOPRIO_RT ? 0 : 2);
+	}
+	close(hold[0]);
+
+	check(pid, IOPRIO_IDLE);
+	set(pid, IOPRIO_RT);
+	close(hold[1]);
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) == 1) {
+		errx(1, "child didn't start in the parent's class");
+	}
+	if (WEXITSTATUS(status) != 0) {
+		errx(1, "child wasn't moved to IOPRIO_RT");
+	}
+	set(0, IOPRIO_BE);
+}
+
+static
+void
+writefile(const char *name, int nchunks)
+{
+	int fd, i;
+
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	for (i = 0; i < nchunks; i++) {
+		memset(buf, 'a' + i % 26, sizeof(buf));
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			err(1, "%s: write", name);
+		}
+	}
+	if (fsync(fd)) {
+		err(1, "%s: fsync", name);
+	}
+	close(fd);
+}
+
+/* A bulk writer in IOPRIO_IDLE, and reads of our own going on. */
+static
+void
+load(void)
+{
+	int fd, i, status;
+	pid_t pid;
+
+	writefile(SMALLFILE, 1);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (ioprio_set(0, IOPRIO_IDLE) < 0) {
+			_exit(1);
+		}
+		writefile(BIGFILE, BIGCHUNKS);
+		_exit(0);
+	}
+
+	for (i = 0; i < READS; i++) {
+		fd = open(SMALLFILE, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s", SMALLFILE);
+		}
+		if (read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			err(1, "%s: read", SMALLFILE);
+		}
+		if (buf[0] != 'a' || buf[CHUNK - 1] != 'a') {
+			errx(1, "%s: wrong contents", SMALLFILE);
+		}
+		close(fd);
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "bulk writer failed");
+	}
+	remove(BIGFILE);
+	remove(SMALLFILE);
+}
+
+int
+main(void)
+{
+	check(0, IOPRIO_BE);
+
+	set(0, IOPRIO_RT);
+	set(0, IOPRIO_IDLE);
+	set(0, IOPRIO_BE);
+	set(getpid(), IOPRIO_BE);
+
+	expect(-1, EINVAL, "class -1");
+	expect(IOPRIO_NCLASSES, EINVAL, "class past the last");
+	check(0, IOPRIO_BE);
+
+	if (ioprio_get(getpid() + 1000) != -1 || errno != ESRCH) {
+		errx(1, "ioprio_get of a stranger didn't fail with ESRCH");
+	}
+	if (ioprio_set(getpid() + 1000, IOPRIO_BE) != -1 || errno != ESRCH) {
+		errx(1, "ioprio_set of a stranger didn't fail with ESRCH");
+	}
+
+	inherit();
+	load();
+
+	printf("iopriotest passed\n");
+	return 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * ioringtest - exercise ioring_enter().
+ *
+ * Opens a file through the ring, then queues NWRITES writes and a
+ * pread of each and hands them over with one ioring_enter, and checks
+ * every completion. Then queues more operations than the completion
+ * ring has room for and checks the kernel stops when it's full and
+ * picks up where it left off once the completions are taken, and that
+ * a bad operation completes with -EINVAL instead of failing the call.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ioring.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define FILENAME	"ioringtest.dat"
+#define ENTRIES		16
+#define NWRITES		6
+#define CHUNK		64
+
+static struct ioring_sqe sq[ENTRIES];
+static struct ioring_cqe cq[ENTRIES];
+static struct ioring ring = { 0, 0, 0, 0, ENTRIES, sq, cq };
+
+static char wbuf[NWRITES][CHUNK];
+static char rbuf[NWRITES][CHUNK];
+
+static
+struct ioring_sqe *
+getsqe(int op, int fd, unsigned data)
+{
+	struct ioring_sqe *sqe;
+
+	if (ring.ir_sqtail - ring.ir_sqhead == ENTRIES) {
+		errx(1, "submission ring full");
+	}
+	sqe = &sq[ring.ir_sqtail % ENTRIES];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->sqe_op = op;
+	sqe->sqe_fd = fd;
+	sqe->sqe_data = data;
+	ring.ir_sqtail++;
+	return sqe;
+}
+
+static
+int
+enter(void)
+{
+	int n;
+
+	n = ioring_enter(&ring);
+	if (n < 0) {
+		err(1, "ioring_enter");
+	}
+	return n;
+}
+
+/* takes the next completion, which must be for DATA, and returns its result */
+static
+int
+getcqe(unsigned data)
+{
+	struct ioring_cqe *cqe;
+
+	if (ring.ir_cqhead == ring.ir_cqtail) {
+		errx(1, "FAILED: no completion for %u", data);
+	}
+	cqe = &cq[ring.ir_cqhead % ENTRIES];
+	if (cqe->cqe_data != data) {
+		errx(1, "FAILED: completion for %u, expected %u",
+		     cqe->cqe_data, data);
+	}
+	ring.ir_cqhead++;
+	return cqe->cqe_res;
+}
+
+static
+int
+opentest(void)
+{
+	struct ioring_sqe *sqe;
+	int fd;
+
+	sqe = getsqe(IORING_OP_OPEN, -1, 1);
+	sqe->sqe_buf = (void *)FILENAME;
+	sqe->sqe_flags = O_RDWR | O_CREAT | O_TRUNC;
+	sqe->sqe_mode = 0664;
+	if (enter() != 1) {
+		errx(1, "FAILED: open wasn't done");
+	}
+	fd = getcqe(1);
+	if (fd < 0) {
+		errno = -fd;
+		err(1, "%s", FILENAME);
+	}
+	return fd;
+}
+
+static
+void
+batchtest(int fd)
+{
+	struct ioring_sqe *sqe;
+	int i, res;
+
+	for (i = 0; i < NWRITES; i++) {
+		memset(wbuf[i], 'a' + i, CHUNK);
+		sqe = getsqe(IORING_OP_WRITE, fd, 100 + i);
+		sqe->sqe_buf = wbuf[i];
+		sqe->sqe_len = CHUNK;
+	}
+	for (i = 0; i < NWRITES; i++) {
+		sqe = getsqe(IORING_OP_PREAD, fd, 200 + i);
+		sqe->sqe_buf = rbuf[i];
+		sqe->sqe_len = CHUNK;
+		sqe->sqe_offset = (NWRITES - 1 - i) * CHUNK;
+	}
+	if (enter() != 2 * NWRITES) {
+		errx(1, "FAILED: not all of the batch was done");
+	}
+
+	for (i = 0; i < NWRITES; i++) {
+		res = getcqe(100 + i);
+		if (res != CHUNK) {
+			errx(1, "FAILED: write %d returned %d", i, res);
+		}
+	}
+	for (i = 0; i < NWRITES; i++) {
+		res = getcqe(200 + i);
+		if (res != CHUNK) {
+			errx(1, "FAILED: pread %d returned %d", i, res);
+		}
+		if (memcmp(rbuf[i], wbuf[NWRITES - 1 - i], CHUNK) != 0) {
+			errx(1, "FAILED: pread %d got the wrong data", i);
+		}
+	}
+	printf("ioringtest: %d operations with one ioring_enter\n",
+	       2 * NWRITES);
+}
+
+static
+void
+fulltest(int fd)
+{
+	int i, res;
+
+	/* leave completions for half the ring sitting there */
+	for (i = 0; i < ENTRIES / 2; i++) {
+		getsqe(IORING_OP_NOP, -1, 300 + i);
+	}
+	if (enter() != ENTRIES / 2) {
+		errx(1, "FAILED: nops weren't done");
+	}
+
+	/* now queue a whole ring's worth: only half fit */
+	for (i = 0; i < ENTRIES; i++) {
+		getsqe(i == 0 ? 99 : IORING_OP_NOP, -1, 400 + i);
+	}
+	if (enter() != ENTRIES / 2) {
+		errx(1, "FAILED: the kernel overran the completion ring");
+	}
+	if (enter() != 0) {
+		errx(1, "FAILED: the kernel overran the full completion ring");
+	}
+
+	for (i = 0; i < ENTRIES / 2; i++) {
+		getcqe(300 + i);
+	}
+	if (getcqe(400) != -EINVAL) {
+		errx(1, "FAILED: a bad op didn't complete with -EINVAL");
+	}
+	for (i = 1; i < ENTRIES / 2; i++) {
+		getcqe(400 + i);
+	}
+	/* room again: the rest go */
+	if (enter() != ENTRIES / 2) {
+		errx(1, "FAILED: the rest weren't done");
+	}
+	for (i = ENTRIES / 2; i < ENTRIES; i++) {
+		getcqe(400 + i);
+	}
+
+	getsqe(IORING_OP_CLOSE, fd, 500);
+	enter();
+	res = getcqe(500);
+	if (res != 0) {
+		errx(1, "FAILED: close returned %d", res);
+	}
+	printf("ioringtest: a full completion ring holds submissions back\n");
+}
+
+int
+main(void)
+{
+	int fd;
+
+	fd = opentest();
+	batchtest(fd);
+	fulltest(fd);
+
+	remove(FILENAME);
+	printf("ioringtest: SUCCESS\n");
+	return 0;
+}
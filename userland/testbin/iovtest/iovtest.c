@@ -0,0 +1,96 @@
+/*
+ * iovtest - exercise readv()/writev().
+ *
+ * Writes a header and a payload to a file with one writev, then reads
+ * them back with one readv into buffers of different sizes from the
+ * ones written, and checks it all lined up: the byte counts, the data
+ * and where the seek position ended up. Then checks that a bad iovec
+ * count fails with EINVAL.
+ */
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define FILENAME	"iovtest.dat"
+#define PAYLOAD		1000
+
+static char header[16] = "iovtest header:";
+static char payload[PAYLOAD];
+static char in1[7], in2[500], in3[PAYLOAD];
+
+int
+main(void)
+{
+	struct iovec iov[3];
+	ssize_t r;
+	size_t total = sizeof(header) + sizeof(payload);
+	int fd, i;
+
+	for (i = 0; i < PAYLOAD; i++) {
+		payload[i] = 'a' + i % 26;
+	}
+
+	fd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = NULL;
+	iov[1].iov_len = 0;
+	iov[2].iov_base = payload;
+	iov[2].iov_len = sizeof(payload);
+	r = writev(fd, iov, 3);
+	if (r < 0) {
+		err(1, "writev");
+	}
+	if ((size_t)r != total) {
+		errx(1, "FAILED: writev wrote %ld of %lu", (long)r,
+		     (unsigned long)total);
+	}
+	if (lseek(fd, 0, SEEK_CUR) != (off_t)total) {
+		errx(1, "FAILED: writev left the seek position wrong");
+	}
+
+	/* read it back into buffers that split it differently (the last one has room to spare) */
+	lseek(fd, 0, SEEK_SET);
+	iov[0].iov_base = in1;
+	iov[0].iov_len = sizeof(in1);
+	iov[1].iov_base = in2;
+	iov[1].iov_len = sizeof(in2);
+	iov[2].iov_base = in3;
+	iov[2].iov_len = sizeof(in3);
+	r = readv(fd, iov, 3);
+	if (r < 0) {
+		err(1, "readv");
+	}
+	if ((size_t)r != total) {
+		errx(1, "FAILED: readv read %ld of %lu", (long)r,
+		     (unsigned long)total);
+	}
+	if (memcmp(in1, header, sizeof(in1)) != 0 ||
+	    memcmp(in2, header + sizeof(in1), sizeof(header) - sizeof(in1)) != 0 ||
+	    memcmp(in2 + sizeof(header) - sizeof(in1), payload,
+		   sizeof(in2) - (sizeof(header) - sizeof(in1))) != 0 ||
+	    memcmp(in3, payload + sizeof(in2) - (sizeof(header) - sizeof(in1)),
+		   total - sizeof(in1) - sizeof(in2)) != 0) {
+		errx(1, "FAILED: readv got the wrong data");
+	}
+	printf("iovtest: one writev and one readv moved %lu bytes\n",
+	       (unsigned long)total);
+
+	if (readv(fd, iov, 0) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: readv of 0 iovecs didn't fail with EINVAL");
+	}
+
+	close(fd);
+	remove(FILENAME);
+	printf("iovtest: SUCCESS\n");
+	return 0;
+}
@@ -48,6 +48,7 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <err.h>
+#include <thr.h>
 
 
 #define _PATH_RANDOM   "random:"
@@ -627,6 +628,168 @@ test7(void)
 	test567(7, seed);
 }
 
+/*
+ * Test 8
+ *
+ * Allocate a lot of memory in medium-sized blocks, free it all, and
+ * check that the heap (as seen by sbrk) shrinks back to about where
+ * it started; then do it again freeing in a different order.
+ */
+
+#define T8BLOCKS 256
+
+static
+void
+test8(void)
+{
+	void *blocks[T8BLOCKS];
+	char *start, *peak, *end;
+	int i, pass;
+
+	printf("Beginning malloc test 8\n");
+
+	/* make sure the heap is set up before we measure it */
+	free(malloc(SMALLSIZE));
+
+	for (pass=0; pass<2; pass++) {
+		start = sbrk(0);
+		for (i=0; i<T8BLOCKS; i++) {
+			blocks[i] = malloc(BIGSIZE);
+			if (blocks[i] == NULL) {
+				printf("FAILED: malloc failed\n");
+				return;
+			}
+		}
+		peak = sbrk(0);
+		for (i=0; i<T8BLOCKS; i++) {
+			/* pass 0 frees top down, pass 1 bottom up */
+			free(blocks[pass == 0 ? T8BLOCKS - 1 - i : i]);
+		}
+		end = sbrk(0);
+		printf("Pass %d: heap grew by %ld, and is %ld bigger after"
+		       " freeing\n", pass, (long)(peak - start),
+		       (long)(end - start));
+		if (end - start > 32 * 4096) {
+			printf("FAILED: heap didn't shrink\n");
+			return;
+		}
+	}
+	printf("Passed malloc test 8.\n");
+}
+
+/*
+ * Test 9
+ *
+ * Several threads at once: each allocates a set of blocks, small and
+ * not, and then frees the set another thread allocated, so most frees
+ * come from a thread other than the one that did the malloc.
+ */
+
+#define T9THREADS 4
+#define T9BLOCKS 256
+#define T9ROUNDS 20
+
+static void *t9blocks[T9THREADS][T9BLOCKS];
+static unsigned t9round;
+static volatile int t9failed;
+
+static
+size_t
+t9size(unsigned thread, unsigned i, unsigned round)
+{
+	static const size_t sizes[8] = { 4, 12, 16, 24, 40, 64, 72, 600 };
+
+	return sizes[(thread + i + round) % 8];
+}
+
+/* Allocate and mark this thread's set, after some churn of its own. */
+static
+void *
+t9alloc(void *arg)
+{
+	unsigned me = (unsigned)(uintptr_t)arg;
+	unsigned i, round = t9round;
+
+	for (i=0; i<T9BLOCKS; i++) {
+		free(malloc(t9size(me, i, round + 1)));
+	}
+	for (i=0; i<T9BLOCKS; i++) {
+		t9blocks[me][i] = malloc(t9size(me, i, round));
+		if (t9blocks[me][i] == NULL) {
+			printf("FAILED: malloc failed\n");
+			t9failed = 1;
+			return NULL;
+		}
+		markblock(t9blocks[me][i], t9size(me, i, round),
+			  me * T9BLOCKS + i, 0);
+	}
+	return NULL;
+}
+
+/* Check and free the next thread's set. */
+static
+void *
+t9free(void *arg)
+{
+	unsigned me = (unsigned)(uintptr_t)arg;
+	unsigned other = (me + 1) % T9THREADS;
+	unsigned i, round = t9round;
+
+	for (i=0; i<T9BLOCKS; i++) {
+		if (checkblock(t9blocks[other][i], t9size(other, i, round),
+			       other * T9BLOCKS + i, 0)) {
+			t9failed = 1;
+			return NULL;
+		}
+		free(t9blocks[other][i]);
+	}
+	return NULL;
+}
+
+/* Run FUNC on each of the threads at once and wait for them. */
+static
+void
+t9phase(void *(*func)(void *))
+{
+	int tids[T9THREADS];
+	unsigned i;
+
+	for (i=0; i<T9THREADS; i++) {
+		tids[i] = thr_create(func, (void *)(uintptr_t)i);
+		if (tids[i] < 0) {
+			err(1, "thr_create");
+		}
+	}
+	for (i=0; i<T9THREADS; i++) {
+		if (thr_join(tids[i], NULL) < 0) {
+			err(1, "thr_join");
+		}
+	}
+}
+
+static
+void
+test9(void)
+{
+	printf("Beginning malloc test 9\n");
+
+	t9failed = 0;
+	for (t9round=0; t9round<T9ROUNDS && !t9failed; t9round++) {
+		t9phase(t9alloc);
+		if (!t9failed) {
+			t9phase(t9free);
+		}
+		printf(".");
+	}
+	printf("\n");
+
+	if (t9failed) {
+		printf("FAILED malloc test 9\n");
+		return;
+	}
+	printf("Passed malloc test 9.\n");
+}
+
 ////////////////////////////////////////////////////////////
 
 static struct {
@@ -641,6 +804,8 @@ static struct {
 	{ 5, "Stress test", test5 },
 	{ 6, "Randomized stress test", test6 },
 	{ 7, "Stress test with particular seed", test7 },
+	{ 8, "Heap shrinks after freeing", test8 },
+	{ 9, "Frees from other threads", test9 },
 	{ -1, NULL, NULL }
 };
 
@@ -37,10 +37,18 @@
  *
  *    Once the VM system assignment is complete your system should be
  *    able to survive this.
+ *
+ *    With -t N the rows are spread over N worker threads (libtask;
+ *    0 means one per cpu), which makes it a scaling benchmark too.
+ *    The default is the original single thread.
  */
 
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
+#include <err.h>
+#include <task.h>
 
 #define Dim 	72	/* sum total of the arrays doesn't fit in
 			 * physical memory
@@ -53,10 +61,37 @@ int B[Dim][Dim];
 int C[Dim][Dim];
 int T[Dim][Dim][Dim];
 
+/* row I of the product: each row only touches its own T and C */
+static
+void
+multrow(unsigned i, void *unused)
+{
+    int j, k;
+
+    (void)unused;
+
+    for (j = 0; j < Dim; j++)
+        for (k = 0; k < Dim; k++)
+	    T[i][j][k] = A[i][k] * B[k][j];
+
+    for (j = 0; j < Dim; j++)
+        for (k = 0; k < Dim; k++)
+	    C[i][j] += T[i][j][k];
+}
+
 int
-main(void)
+main(int argc, char *argv[])
 {
-    int i, j, k, r;
+    int i, j, r;
+
+    if (argc == 3 && !strcmp(argv[1], "-t")) {
+	    if (task_init(atoi(argv[2])) < 0) {
+		    err(1, "task_init");
+	    }
+    }
+    else if (argc != 1 && argc != 0) {
+	    errx(1, "Usage: matmult [-t workers]");
+    }
 
     for (i = 0; i < Dim; i++)		/* first initialize the matrices */
 	for (j = 0; j < Dim; j++) {
@@ -65,15 +100,8 @@ main(void)
 	     C[i][j] = 0;
 	}
 
-    for (i = 0; i < Dim; i++)		/* then multiply them together */
-	for (j = 0; j < Dim; j++)
-            for (k = 0; k < Dim; k++)
-		T[i][j][k] = A[i][k] * B[k][j];
-
-    for (i = 0; i < Dim; i++)
-	for (j = 0; j < Dim; j++)
-            for (k = 0; k < Dim; k++)
-		C[i][j] += T[i][j][k];
+    /* then multiply them together, a row at a time */
+    parallel_for(0, Dim, 1, multrow, NULL);
 
     r = 0;
     for (i = 0; i < Dim; i++)
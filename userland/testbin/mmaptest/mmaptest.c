@@ -0,0 +1,226 @@
+/*
+ * mmaptest - exercise mmap()/munmap().
+ *
+ * Writes a test file, maps it privately and checks the contents, then
+ * maps it shared, modifies it, unmaps it and checks with read() that
+ * the change reached the file. Also checks an anonymous mapping is
+ * zero filled, that a forked child sees a shared mapping's pages, and
+ * that mappings without PROT_READ can't be touched at all.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define TESTFILE "mmaptest.dat"
+#define FILESIZE (3 * 4096 + 100)	/* ends partway through a page */
+
+static char buf[FILESIZE];
+
+static
+void
+makefile(void)
+{
+	int fd, i;
+
+	for (i = 0; i < FILESIZE; i++) {
+		buf[i] = 'a' + i % 26;
+	}
+
+	fd = open(TESTFILE, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open for write", TESTFILE);
+	}
+	if (write(fd, buf, FILESIZE) != FILESIZE) {
+		err(1, "%s: write", TESTFILE);
+	}
+	close(fd);
+}
+
+static
+void
+privatetest(void)
+{
+	char *p;
+	int fd, i;
+
+	fd = open(TESTFILE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", TESTFILE);
+	}
+	p = mmap(NULL, FILESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap private");
+	}
+	/* the mapping keeps the file, so we can close it right away */
+	close(fd);
+
+	if (memcmp(p, buf, FILESIZE) != 0) {
+		errx(1, "private mapping doesn't match the file");
+	}
+	/* the tail of the last page is past the end of the file */
+	for (i = FILESIZE; i < 4 * 4096; i++) {
+		if (p[i] != 0) {
+			errx(1, "byte %d past end of file is not zero", i);
+		}
+	}
+
+	/* private writes are allowed but don't reach the file */
+	p[0] = 'X';
+	if (munmap(p, FILESIZE)) {
+		err(1, "munmap private");
+	}
+	printf("private mapping ok\n");
+}
+
+static
+void
+sharedtest(void)
+{
+	char check[16];
+	char *p;
+	int fd, status;
+	pid_t pid;
+
+	fd = open(TESTFILE, O_RDWR);
+	if (fd < 0) {
+		err(1, "%s: open", TESTFILE);
+	}
+	p = mmap(NULL, FILESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap shared");
+	}
+
+	/* a child writing into a shared mapping is seen by the parent */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		memcpy(p + 4096, "from the child", 14);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (memcmp(p + 4096, "from the child", 14) != 0) {
+		errx(1, "parent doesn't see the child's write");
+	}
+
+	memcpy(p, "hello", 5);
+	if (munmap(p, FILESIZE)) {
+		err(1, "munmap shared");
+	}
+
+	/* both writes must have made it to the file */
+	lseek(fd, 0, SEEK_SET);
+	if (read(fd, check, 5) != 5 || memcmp(check, "hello", 5) != 0) {
+		errx(1, "shared write didn't reach the file");
+	}
+	lseek(fd, 4096, SEEK_SET);
+	if (read(fd, check, 14) != 14 ||
+	    memcmp(check, "from the child", 14) != 0) {
+		errx(1, "child's shared write didn't reach the file");
+	}
+	close(fd);
+	printf("shared mapping ok\n");
+}
+
+static
+void
+anontest(void)
+{
+	char *p;
+	int i;
+
+	p = mmap(NULL, 8 * 4096, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap anon");
+	}
+	for (i = 0; i < 8 * 4096; i++) {
+		if (p[i] != 0) {
+			errx(1, "anonymous byte %d is not zero", i);
+		}
+	}
+	for (i = 0; i < 8 * 4096; i += 4096) {
+		p[i] = 1;
+	}
+	if (munmap(p, 8 * 4096)) {
+		err(1, "munmap anon");
+	}
+	printf("anonymous mapping ok\n");
+}
+
+/*
+ * Pages can't be writeable without being readable, so PROT_NONE and
+ * PROT_WRITE alone both mean no access.
+ */
+static
+void
+noaccesstest(void)
+{
+	static const int prots[2] = { PROT_NONE, PROT_WRITE };
+	char *p;
+	int fd, i, status;
+	pid_t pid;
+
+	for (i = 0; i < 2; i++) {
+		p = mmap(NULL, 4096, prots[i], MAP_PRIVATE | MAP_ANON, -1, 0);
+		if (p == MAP_FAILED) {
+			err(1, "mmap prot %d", prots[i]);
+		}
+
+		/* the kernel can't store into it either */
+		fd = open(TESTFILE, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s: open", TESTFILE);
+		}
+		if (read(fd, p, 16) != -1 || errno != EFAULT) {
+			errx(1, "read into a prot %d mapping didn't fail "
+			     "with EFAULT", prots[i]);
+		}
+		close(fd);
+
+		/* and a store from user mode is a fatal fault */
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			p[0] = 1;
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFSIGNALED(status)) {
+			errx(1, "store into a prot %d mapping didn't fault",
+			     prots[i]);
+		}
+
+		if (munmap(p, 4096)) {
+			err(1, "munmap prot %d", prots[i]);
+		}
+	}
+	printf("no-access mappings ok\n");
+}
+
+int
+main(void)
+{
+	makefile();
+	privatetest();
+	sharedtest();
+	anontest();
+	noaccesstest();
+	remove(TESTFILE);
+	printf("mmaptest: passed\n");
+	return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * pipetest - exercise pipes.
+ *
+ * Writes and reads a little through a pipe in one process, then forks
+ * and streams NBYTES (many times the pipe's buffer) from the child to
+ * the parent in odd-sized writes, checking every byte arrives in
+ * order. Then checks that a read sees end of file once the write end
+ * is closed, and that a write fails with EPIPE once the read end is.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define NBYTES		(256 * 1024)
+#define CHUNK		1777
+
+static char buf[CHUNK];
+
+static
+char
+byteat(unsigned pos)
+{
+	return (char)(pos * 7 + pos / 251);
+}
+
+static
+void
+small(void)
+{
+	int fds[2];
+	char rbuf[16];
+	ssize_t r;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	r = write(fds[1], "hello", 5);
+	if (r != 5) {
+		err(1, "write");
+	}
+	r = read(fds[0], rbuf, sizeof(rbuf));
+	if (r != 5 || memcmp(rbuf, "hello", 5) != 0) {
+		errx(1, "small: read back %ld bytes, expected 5", (long)r);
+	}
+	close(fds[0]);
+	close(fds[1]);
+	printf("pipetest: small write and read ok\n");
+}
+
+static
+void
+stream(void)
+{
+	int fds[2], status;
+	unsigned pos, i;
+	size_t len;
+	ssize_t r;
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		for (pos = 0; pos < NBYTES; pos += len) {
+			len = NBYTES - pos < CHUNK ? NBYTES - pos : CHUNK;
+			for (i=0; i<len; i++) {
+				buf[i] = byteat(pos + i);
+			}
+			r = write(fds[1], buf, len);
+			if (r < 0 || (size_t)r != len) {
+				err(1, "child: write");
+			}
+		}
+		_exit(0);
+	}
+
+	close(fds[1]);
+	pos = 0;
+	while ((r = read(fds[0], buf, sizeof(buf))) > 0) {
+		for (i=0; i<(unsigned)r; i++) {
+			if (buf[i] != byteat(pos + i)) {
+				errx(1, "stream: wrong byte at %u", pos + i);
+			}
+		}
+		pos += r;
+	}
+	if (r < 0) {
+		err(1, "read");
+	}
+	if (pos != NBYTES) {
+		errx(1, "stream: got %u bytes, expected %u", pos, NBYTES);
+	}
+	close(fds[0]);
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "stream: child failed");
+	}
+	printf("pipetest: streamed %u bytes ok\n", pos);
+}
+
+static
+void
+ends(void)
+{
+	int fds[2];
+	ssize_t r;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	close(fds[1]);
+	r = read(fds[0], buf, sizeof(buf));
+	if (r != 0) {
+		errx(1, "read with no writer returned %ld, expected 0",
+		     (long)r);
+	}
+	close(fds[0]);
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	close(fds[0]);
+	r = write(fds[1], "x", 1);
+	if (r >= 0 || errno != EPIPE) {
+		errx(1, "write with no reader returned %ld, expected EPIPE",
+		     (long)r);
+	}
+	close(fds[1]);
+	printf("pipetest: end of file and EPIPE ok\n");
+}
+
+int
+main(void)
+{
+	small();
+	stream();
+	ends();
+	printf("pipetest: passed\n");
+	return 0;
+}
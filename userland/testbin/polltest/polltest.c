@@ -0,0 +1,146 @@
+/*
+ * polltest - check poll.
+ *
+ * Polls the two ends of a pipe: empty, with data, with the writer
+ * gone, and full; waits with a timeout that runs out and forever on
+ * a child process that writes after a while, which only returns if
+ * the write wakes the poll. Also checks closed and skipped fds.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <err.h>
+
+static
+int
+poll1(int fd, short events, int timeout, short *revents)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = -1;
+	r = poll(&pfd, 1, timeout);
+	if (r < 0) {
+		err(1, "poll");
+	}
+	*revents = pfd.revents;
+	return r;
+}
+
+static
+void
+expect(int fd, short events, int timeout, short want, const char *what)
+{
+	short revents;
+	int r;
+
+	r = poll1(fd, events, timeout, &revents);
+	if (r != (want != 0) || revents != want) {
+		errx(1, "%s: poll returned %d with revents 0x%x, expected 0x%x",
+		     what, r, revents, want);
+	}
+}
+
+int
+main(void)
+{
+	struct timespec ts;
+	struct pollfd pfds[3];
+	char buf[512];
+	int fds[2], status, r;
+	short revents;
+	pid_t pid;
+
+	if (pipe(fds)) {
+		err(1, "pipe");
+	}
+
+	/* empty: nothing to read, room to write */
+	expect(fds[0], POLLIN, 0, 0, "empty pipe");
+	expect(fds[1], POLLOUT, 0, POLLOUT, "writer of an empty pipe");
+	expect(fds[0], POLLIN, 100, 0, "empty pipe with a timeout");
+
+	/* both together; only the writer is ready */
+	pfds[0].fd = fds[0];
+	pfds[0].events = POLLIN;
+	pfds[1].fd = fds[1];
+	pfds[1].events = POLLOUT;
+	pfds[2].fd = -1;
+	pfds[2].events = POLLIN;
+	pfds[2].revents = -1;
+	r = poll(pfds, 3, 0);
+	if (r != 1 || pfds[0].revents != 0 || pfds[1].revents != POLLOUT ||
+	    pfds[2].revents != 0) {
+		errx(1, "both ends: got %d (0x%x 0x%x 0x%x)", r,
+		     pfds[0].revents, pfds[1].revents, pfds[2].revents);
+	}
+
+	/* data */
+	if (write(fds[1], "x", 1) != 1) {
+		err(1, "write");
+	}
+	expect(fds[0], POLLIN, 0, POLLIN, "pipe with data");
+	if (read(fds[0], buf, 1) != 1) {
+		err(1, "read");
+	}
+
+	/* full: no room */
+	memset(buf, 'y', sizeof(buf));
+	do {
+		if (write(fds[1], buf, sizeof(buf)) != sizeof(buf)) {
+			err(1, "write");
+		}
+	} while (poll1(fds[1], POLLOUT, 0, &revents) == 1);
+	expect(fds[1], POLLOUT, 0, 0, "full pipe");
+	while (poll1(fds[0], POLLIN, 0, &revents) == 1) {
+		if (read(fds[0], buf, sizeof(buf)) <= 0) {
+			err(1, "read");
+		}
+	}
+
+	/* wait forever for a child's write */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		ts.tv_sec = 0;
+		ts.tv_nsec = 200000000;
+		nanosleep(&ts, NULL);
+		if (write(fds[1], "z", 1) != 1) {
+			err(1, "write in the child");
+		}
+		_exit(0);
+	}
+	expect(fds[0], POLLIN, -1, POLLIN, "waiting for the child");
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (read(fds[0], buf, 1) != 1 || buf[0] != 'z') {
+		errx(1, "wrong data from the child");
+	}
+
+	/* the writer gone: readable (read returns 0) and hung up */
+	close(fds[1]);
+	expect(fds[0], POLLIN, 0, POLLIN | POLLHUP, "pipe with no writer");
+	expect(fds[0], 0, -1, POLLHUP, "hangup without asking");
+	close(fds[0]);
+
+	/* closed fds */
+	expect(fds[0], POLLIN, 0, POLLNVAL, "closed fd");
+	if (poll(pfds, 1025, 0) != -1 || errno != EINVAL) {
+		errx(1, "poll of too many fds didn't fail with EINVAL");
+	}
+
+	printf("polltest passed\n");
+	return 0;
+}
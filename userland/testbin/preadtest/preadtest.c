@@ -0,0 +1,172 @@
+/*
+ * preadtest - exercise pread()/pwrite().
+ *
+ * Writes a file of NBLOCKS blocks where every byte says which block
+ * it is in, then reads the blocks back with pread in reverse order
+ * and overwrites every other one with pwrite, checking each time that
+ * the file's seek position hasn't moved. Then forks NPROCS children
+ * that share the open file and pread random blocks from it at the
+ * same time, and checks that pread on the console fails with ESPIPE.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define FILENAME	"preadtest.dat"
+#define BLOCKSIZE	512
+#define NBLOCKS		32
+#define NPROCS		4
+#define LOOPS		200
+
+static char buf[BLOCKSIZE];
+
+static
+void
+checkpos(int fd, off_t expected)
+{
+	off_t pos;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos != expected) {
+		errx(1, "FAILED: seek position is %ld, expected %ld",
+		     (long)pos, (long)expected);
+	}
+}
+
+static
+void
+checkblock(int fd, int block, int value)
+{
+	ssize_t r;
+	int i;
+
+	r = pread(fd, buf, BLOCKSIZE, (off_t)block * BLOCKSIZE);
+	if (r < 0) {
+		err(1, "pread");
+	}
+	if (r != BLOCKSIZE) {
+		errx(1, "FAILED: short pread of block %d: %ld", block, (long)r);
+	}
+	for (i = 0; i < BLOCKSIZE; i++) {
+		if (buf[i] != (char)value) {
+			errx(1, "FAILED: block %d byte %d is %d, expected %d",
+			     block, i, buf[i], value);
+		}
+	}
+}
+
+static
+void
+seqtest(int fd)
+{
+	ssize_t r;
+	int i;
+
+	for (i = 0; i < NBLOCKS; i++) {
+		memset(buf, i, BLOCKSIZE);
+		r = write(fd, buf, BLOCKSIZE);
+		if (r != BLOCKSIZE) {
+			err(1, "write");
+		}
+	}
+	checkpos(fd, NBLOCKS * BLOCKSIZE);
+
+	/* read them back out of order; the position stays at the end */
+	for (i = NBLOCKS - 1; i >= 0; i--) {
+		checkblock(fd, i, i);
+	}
+	checkpos(fd, NBLOCKS * BLOCKSIZE);
+
+	/* overwrite every other block in place */
+	for (i = 0; i < NBLOCKS; i += 2) {
+		memset(buf, i + 100, BLOCKSIZE);
+		r = pwrite(fd, buf, BLOCKSIZE, (off_t)i * BLOCKSIZE);
+		if (r != BLOCKSIZE) {
+			err(1, "pwrite");
+		}
+	}
+	checkpos(fd, NBLOCKS * BLOCKSIZE);
+	for (i = 0; i < NBLOCKS; i++) {
+		checkblock(fd, i, (i % 2 == 0) ? i + 100 : i);
+	}
+
+	/* reading at the end gives end of file */
+	r = pread(fd, buf, BLOCKSIZE, NBLOCKS * BLOCKSIZE);
+	if (r != 0) {
+		errx(1, "FAILED: pread at end of file returned %ld", (long)r);
+	}
+	if (pread(fd, buf, BLOCKSIZE, -1) != -1 || errno != EINVAL) {
+		errx(1, "FAILED: pread at a negative offset didn't fail with EINVAL");
+	}
+	printf("preadtest: sequential checks passed\n");
+}
+
+static
+void
+partest(int fd)
+{
+	pid_t pids[NPROCS];
+	int i, j, block, status, failed = 0;
+
+	for (i = 0; i < NPROCS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			srandom(i + 1);
+			for (j = 0; j < LOOPS; j++) {
+				block = random() % NBLOCKS;
+				checkblock(fd, block,
+					   (block % 2 == 0) ? block + 100 : block);
+			}
+			_exit(0);
+		}
+	}
+
+	for (i = 0; i < NPROCS; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			warnx("child %d failed", i);
+			failed = 1;
+		}
+	}
+	if (failed) {
+		errx(1, "FAILED");
+	}
+	/* the children shared our file and its position, which nobody moved */
+	checkpos(fd, NBLOCKS * BLOCKSIZE);
+	printf("preadtest: %d processes did %d preads each\n", NPROCS, LOOPS);
+}
+
+int
+main(void)
+{
+	int fd;
+
+	fd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	seqtest(fd);
+	partest(fd);
+
+	if (pread(STDIN_FILENO, buf, 1, 0) != -1 || errno != ESPIPE) {
+		errx(1, "FAILED: pread on the console didn't fail with ESPIPE");
+	}
+
+	close(fd);
+	remove(FILENAME);
+	printf("preadtest: SUCCESS\n");
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * procbench - time process creation.
+ *
+ * Usage: procbench [samples]
+ *
+ * Times, SAMPLES times each (default 30):
+ *    fork.exit         fork, child _exits, parent waitpid
+ *    fork.exec.true    fork, child execs /bin/true, parent waitpid
+ *    spawn.true        spawn /bin/true and waitpid
+ *    fork.exec.big     fork, child execs this program, which is big
+ *                      (BALLAST bytes of initialized data) and exits
+ *                      straight away, parent waitpid
+ * and then fork.exit again with the parent's heap grown to, and every
+ * page of it touched, each size in rss_kb[], to show how fork scales
+ * with the size of the address space. Output is BENCH lines (see
+ * bench.h), one operation per sample.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <err.h>
+#include <bench.h>
+
+#define DEFSAMPLES	30
+#define MAXSAMPLES	1000
+#define PAGE		4096
+
+#define TRUEPROG	"/bin/true"
+#define MYSELF		"/testbin/procbench"
+#define EXITFLAG	"-exit"
+
+/* makes the executable big; initialized, so it's in the file */
+#define BALLAST		(512*1024)
+static char ballast[BALLAST] = { 1 };
+
+static const unsigned rss_kb[] = { 0, 256, 1024, 4096 };
+
+static uint64_t samples[MAXSAMPLES];
+static unsigned nsamples = DEFSAMPLES;
+
+static
+void
+waitfor(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "pid %d failed", (int)pid);
+	}
+}
+
+static
+void
+forkexit(void)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		_exit(0);
+	}
+	waitfor(pid);
+}
+
+static
+void
+forkexec(const char *prog, const char *arg)
+{
+	char *args[3];
+	pid_t pid;
+
+	args[0] = (char *)prog;
+	args[1] = (char *)arg;
+	args[2] = NULL;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		execv(prog, args);
+		warn("%s", prog);
+		_exit(1);
+	}
+	waitfor(pid);
+}
+
+static void b_forkexit(void) { forkexit(); }
+static void b_forkexectrue(void) { forkexec(TRUEPROG, NULL); }
+static void b_forkexecbig(void) { forkexec(MYSELF, EXITFLAG); }
+
+static
+void
+b_spawntrue(void)
+{
+	char *args[2];
+	pid_t pid;
+
+	args[0] = (char *)TRUEPROG;
+	args[1] = NULL;
+	pid = spawn(TRUEPROG, args, NULL, 0);
+	if (pid < 0) {
+		err(1, "spawn %s", TRUEPROG);
+	}
+	waitfor(pid);
+}
+
+static
+void
+run(const char *name, void (*func)(void), const char *extra)
+{
+	uint64_t start;
+	unsigned i;
+
+	/* once to warm up (get the programs into the buffer cache) */
+	func();
+
+	for (i=0; i<nsamples; i++) {
+		start = bench_ns();
+		func();
+		samples[i] = bench_ns() - start;
+	}
+	bench_report(name, samples, nsamples, 1, extra);
+}
+
+/* Grow the heap by KB and touch every page of it. */
+static
+void
+growheap(unsigned kb)
+{
+	char *p;
+	unsigned i;
+
+	p = sbrk(kb * 1024);
+	if (p == (void *)-1) {
+		err(1, "sbrk %uK", kb);
+	}
+	for (i=0; i<kb * 1024; i+=PAGE) {
+		p[i] = i;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	char name[32], extra[32];
+	unsigned i;
+
+	if (argc == 2 && !strcmp(argv[1], EXITFLAG)) {
+		/* exec'd by fork.exec.big; use ballast so it isn't lost */
+		return ballast[0] != 1;
+	}
+	if (argc == 2) {
+		nsamples = atoi(argv[1]);
+		if (nsamples < 1 || nsamples > MAXSAMPLES) {
+			errx(1, "samples must be from 1 to %d", MAXSAMPLES);
+		}
+	}
+	else if (argc != 1) {
+		errx(1, "Usage: procbench [samples]");
+	}
+
+	printf("procbench: %u samples each\n", nsamples);
+	run("fork.exit", b_forkexit, NULL);
+	run("fork.exec.true", b_forkexectrue, NULL);
+	run("spawn.true", b_spawntrue, NULL);
+	run("fork.exec.big", b_forkexecbig, NULL);
+
+	for (i=0; i<sizeof(rss_kb)/sizeof(rss_kb[0]); i++) {
+		growheap(rss_kb[i]);
+		snprintf(name, sizeof(name), "fork.exit.rss%uk", rss_kb[i]);
+		snprintf(extra, sizeof(extra), "rsskb=%u", rss_kb[i]);
+		run(name, b_forkexit, extra);
+		if (sbrk(-(int)(rss_kb[i] * 1024)) == (void *)-1) {
+			err(1, "sbrk");
+		}
+	}
+	return 0;
+}
@@ -47,6 +47,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#ifndef HOST
+#include <task.h>
+#endif
 
 #ifndef RANDOM_MAX
 /* Note: this is correct for OS/161 but not for some Unix C libraries */
@@ -100,6 +103,11 @@
  * Also note that you can set numprocs and numkeys on the command
  * line, but not WORKNUM.
  *
+ * With -t N, each process sorts its bins with N worker threads
+ * (libtask; 0 means one per cpu it may use), so -p 1 -t N does the
+ * sorting on N cpus in one address space. The other phases are I/O
+ * and stay one per process.
+ *
  * FUTURE: maybe make a build option to malloc the work space instead
  * of using a static buffer, which would allow choosing WORKNUM on the
  * command line too, at the cost of depending on malloc working.
@@ -109,6 +117,7 @@
 #define WORKNUM      (96*1024)
 static int numprocs = 4;
 static int numkeys = 128*1024;
+static int numworkers = 1;
 
 /* Per-process work buffer */
 static int workspace[WORKNUM];
@@ -127,6 +136,27 @@ static const char *progname;
 
 ////////////////////////////////////////////////////////////
 
+/* Pieces smaller than this aren't worth handing to another worker. */
+#define SORT_TASKMIN 4096
+
+static void sortints(int *v, int num);
+
+#ifndef HOST
+struct sortjob {
+	int *v;
+	int num;
+};
+
+static
+void
+sortints_task(void *vjob)
+{
+	struct sortjob *job = vjob;
+
+	sortints(job->v, job->num);
+}
+#endif
+
 static
 void
 sortints(int *v, int num)
@@ -134,6 +164,10 @@ sortints(int *v, int num)
 	int pivotval, pivotpoint, pivotcount;
 	int frontpos, readpos, endpos, i, j;
 	int tmp;
+#ifndef HOST
+	struct sortjob job;
+	struct task t;
+#endif
 
 	if (num < 2) {
 		return;
@@ -173,6 +207,17 @@ sortints(int *v, int num)
 		v[j] = tmp;
 	}
 
+#ifndef HOST
+	if (num - endpos >= SORT_TASKMIN) {
+		/* the top part can go to another worker */
+		job.v = &v[endpos];
+		job.num = num - endpos;
+		task_spawn(&t, sortints_task, &job);
+		sortints(v, frontpos);
+		task_sync(&t);
+		return;
+	}
+#endif
 	sortints(v, frontpos);
 	sortints(&v[endpos], num-endpos);
 }
@@ -728,6 +773,14 @@ sortbins(void)
 	int i, fd;
 	off_t binsize;
 
+#ifndef HOST
+	/* threads don't come through fork, so each process starts its own */
+	if (numworkers != 1 && task_init(numworkers) < 0) {
+		complain("task_init");
+		exit(1);
+	}
+#endif
+
 	for (i=0; i<numprocs; i++) {
 		name = binname(me, i);
 		binsize = getsize(name);
@@ -1152,7 +1205,8 @@ static
 void
 usage(void)
 {
-	complain("Usage: %s [-p procs] [-k keys] [-s seed] [-r]", progname);
+	complain("Usage: %s [-p procs] [-k keys] [-s seed] [-r] [-t workers]",
+		 progname);
 	exit(1);
 }
 
@@ -1172,6 +1226,7 @@ doargs(int argc, char *argv[])
 		    case 'p': arg = 1; break;
 		    case 'k': arg = 1; break;
 		    case 's': arg = 1; break;
+		    case 't': arg = 1; break;
 		    case 'r': arg = 0; break;
 		    default: usage(); return;
 		}
@@ -1192,6 +1247,7 @@ doargs(int argc, char *argv[])
 			    case 'p': numprocs = val; break;
 			    case 'k': numkeys = val; break;
 			    case 's': randomseed = val; break;
+			    case 't': numworkers = val; break;
 			    default: assert(0); break;
 			}
 		}
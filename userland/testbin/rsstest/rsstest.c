@@ -0,0 +1,99 @@
+/*
+ * rsstest - check RLIMIT_RSS and the memory pressure report.
+ *
+ * Lowers the soft RSS limit, then writes and rereads a buffer several
+ * times that size, so with swap the kernel has to page our own pages
+ * out as we go and bring them back intact. Without swap the limit
+ * can't be kept and we only check the data. Also checks that
+ * mempressure() answers straight away for MEMPRESSURE_ANY and reports
+ * something sensible.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/mempressure.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define PAGE      4096
+#define LIMIT     64		/* pages we ask to stay under */
+#define NPAGES    (8 * LIMIT)	/* pages we touch */
+
+static
+void
+pressuretest(void)
+{
+	struct mempressure mp;
+
+	if (mempressure(MEMPRESSURE_ANY, &mp)) {
+		err(1, "mempressure");
+	}
+	if (mp.mp_level < MEMPRESSURE_NONE ||
+	    mp.mp_level > MEMPRESSURE_CRITICAL) {
+		errx(1, "mempressure gave level %d", mp.mp_level);
+	}
+	if (mp.mp_minwater > mp.mp_lowater) {
+		errx(1, "min watermark %u above low watermark %u",
+		     (unsigned)mp.mp_minwater, (unsigned)mp.mp_lowater);
+	}
+	printf("pressure level %d, %u frames free\n", mp.mp_level,
+	       (unsigned)mp.mp_free);
+}
+
+static
+void
+rsslimittest(void)
+{
+	struct rlimit rl;
+	struct rusage ru;
+	char *buf;
+	int pass, i;
+
+	if (getrlimit(RLIMIT_RSS, &rl)) {
+		err(1, "getrlimit");
+	}
+	rl.rlim_cur = LIMIT * PAGE;
+	if (setrlimit(RLIMIT_RSS, &rl)) {
+		err(1, "setrlimit");
+	}
+
+	buf = malloc(NPAGES * PAGE);
+	if (buf == NULL) {
+		errx(1, "malloc of %d pages failed", NPAGES);
+	}
+	for (pass = 0; pass < 3; pass++) {
+		for (i = 0; i < NPAGES; i++) {
+			buf[i * PAGE] = (char)(i + pass);
+			buf[i * PAGE + PAGE - 1] = (char)(i - pass);
+		}
+		for (i = 0; i < NPAGES; i++) {
+			if (buf[i * PAGE] != (char)(i + pass) ||
+			    buf[i * PAGE + PAGE - 1] != (char)(i - pass)) {
+				errx(1, "pass %d: page %d lost its contents",
+				     pass, i);
+			}
+		}
+	}
+	free(buf);
+
+	if (getrusage(RUSAGE_SELF, &ru)) {
+		err(1, "getrusage");
+	}
+	printf("touched %d pages under a %d page limit, max rss %u kb\n",
+	       NPAGES, LIMIT, (unsigned)ru.ru_maxrss);
+
+	if (getrlimit(RLIMIT_RSS, &rl) || rl.rlim_cur != LIMIT * PAGE) {
+		errx(1, "getrlimit doesn't give back the RSS limit");
+	}
+}
+
+int
+main(void)
+{
+	pressuretest();
+	rsslimittest();
+	printf("rsstest passed\n");
+	return 0;
+}
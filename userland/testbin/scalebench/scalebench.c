@@ -0,0 +1,250 @@
+/*
+ * scalebench - how well parallel workloads scale with the number of cpus.
+ *
+ * Usage: scalebench [-c maxcpus] [workload ...]
+ *
+ * Runs each workload (default all of them) on 1, 2, ... up to MAXCPUS
+ * cpus (default however many there are), by setting the affinity of
+ * the processes it starts to the first that many cpus, and prints a
+ * table of how it went:
+ *    psort       psort -p <cpus>: one sort split between that many
+ *                processes, so this is strong scaling
+ *    matmult     <cpus> copies of matmult at once, one per cpu; the
+ *                work grows with the cpus (weak scaling)
+ *    psort-t     psort -p 1 -t <cpus>: one process, sorting with
+ *                that many libtask workers (strong)
+ *    matmult-t   matmult -t <cpus>: one matmult, its rows spread over
+ *                that many libtask workers (strong)
+ *    parallelvm  parallelvm, which always runs its 24 jobs at once;
+ *                strong scaling
+ * For each run the table has the wall time, the CPU time (user and
+ * system) of everything the workload ran, the speedup over 1 cpu
+ * (scaled by the amount of work for matmult), the efficiency, which
+ * is the speedup over the number of cpus, and how busy the cpus were:
+ * CPU time over wall time times cpus. Low busy means processes were
+ * waiting on something (locks, I/O, each other), low efficiency with
+ * high busy means they were busy doing more work than with 1 cpu.
+ *
+ * The workloads' own output is thrown away; a workload that exits
+ * with an error stops the run.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <err.h>
+#include <bench.h>
+
+#define MAXCPUS		32
+
+struct workload {
+	const char *name;
+	const char *prog;
+	bool weak;		/* one copy of prog per cpu */
+	const char *flag;	/* pass <flag> <cpus>, unless NULL */
+	const char *extra;	/* and this argument too, unless NULL */
+};
+
+static const struct workload workloads[] = {
+	{ "psort",      "/testbin/psort",      false, "-p", NULL },
+	{ "matmult",    "/testbin/matmult",    true,  NULL, NULL },
+	{ "parallelvm", "/testbin/parallelvm", false, NULL, NULL },
+	{ "psort-t",    "/testbin/psort",      false, "-t", "-p1" },
+	{ "matmult-t",  "/testbin/matmult",    false, "-t", NULL },
+};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+/* how many cpus there are: the ones setaffinity lets us have */
+static
+unsigned
+countcpus(void)
+{
+	uint32_t mask;
+	unsigned n;
+
+	if (sched_setaffinity(0, 0xffffffff) < 0 ||
+	    sched_getaffinity(0, &mask) < 0) {
+		err(1, "sched_setaffinity");
+	}
+	for (n=0; mask != 0; mask >>= 1) {
+		n += mask & 1;
+	}
+	return n;
+}
+
+/* total CPU time of our waited-for children, in microseconds */
+static
+uint64_t
+childtime(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_CHILDREN, &ru) < 0) {
+		err(1, "getrusage");
+	}
+	return ru.ru_utime.tv_sec * 1000000ULL + ru.ru_utime.tv_usec +
+		ru.ru_stime.tv_sec * 1000000ULL + ru.ru_stime.tv_usec;
+}
+
+/* start one process of W on the cpus in MASK */
+static
+pid_t
+start(const struct workload *w, uint32_t mask, unsigned ncpus)
+{
+	char val[16];
+	char *args[5];
+	unsigned n;
+	pid_t pid;
+	int fd;
+
+	n = 0;
+	args[n++] = (char *)w->prog;
+	if (w->flag != NULL) {
+		snprintf(val, sizeof(val), "%u", ncpus);
+		args[n++] = (char *)w->flag;
+		args[n++] = val;
+	}
+	if (w->extra != NULL) {
+		args[n++] = (char *)w->extra;
+	}
+	args[n] = NULL;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (sched_setaffinity(0, mask) < 0) {
+			warn("sched_setaffinity");
+			_exit(1);
+		}
+		fd = open("null:", O_WRONLY);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		}
+		execv(args[0], args);
+		warn("%s", args[0]);
+		_exit(1);
+	}
+	return pid;
+}
+
+/* run W on the first NCPUS cpus; returns the wall time in ns */
+static
+uint64_t
+run(const struct workload *w, unsigned ncpus, uint64_t *cpuus)
+{
+	pid_t pids[MAXCPUS];
+	unsigned nprocs, i;
+	uint64_t start_ns, wall, cpu0;
+	uint32_t mask;
+	int status;
+
+	mask = ncpus >= 32 ? 0xffffffff : (1U << ncpus) - 1;
+	nprocs = w->weak ? ncpus : 1;
+
+	cpu0 = childtime();
+	start_ns = bench_ns();
+	for (i=0; i<nprocs; i++) {
+		/* one cpu each for the copies */
+		pids[i] = start(w, w->weak ? 1U << i : mask, ncpus);
+	}
+	for (i=0; i<nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "%s on %u cpus failed", w->name, ncpus);
+		}
+	}
+	wall = bench_ns() - start_ns;
+	*cpuus = childtime() - cpu0;
+	return wall > 0 ? wall : 1;
+}
+
+static
+void
+scale(const struct workload *w, unsigned maxcpus)
+{
+	uint64_t wall1, wall, cpuus;
+	unsigned long speedup, eff, busy;
+	unsigned ncpus;
+
+	printf("\n%-10s %4s %10s %10s %8s %6s %6s\n", w->name,
+	       "cpus", "wall ms", "cpu ms", "speedup", "eff%", "busy%");
+
+	wall1 = 0;
+	for (ncpus=1; ncpus<=maxcpus; ncpus++) {
+		wall = run(w, ncpus, &cpuus);
+		if (ncpus == 1) {
+			wall1 = wall;
+		}
+		/* hundredths */
+		speedup = (unsigned long)(wall1 * 100 *
+					  (w->weak ? ncpus : 1) / wall);
+		eff = speedup / ncpus;
+		busy = (unsigned long)(cpuus * 1000 * 100 / (wall * ncpus));
+
+		printf("%-10s %4u %10lu %10lu %5lu.%02lu %6lu %6lu\n", "",
+		       ncpus,
+		       (unsigned long)(wall / 1000000),
+		       (unsigned long)(cpuus / 1000),
+		       speedup / 100, speedup % 100, eff, busy);
+	}
+}
+
+static
+const struct workload *
+findworkload(const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<NWORKLOADS; i++) {
+		if (!strcmp(workloads[i].name, name)) {
+			return &workloads[i];
+		}
+	}
+	errx(1, "No workload %s (there's psort, matmult, parallelvm, psort-t, "
+	     "matmult-t)", name);
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned ncpus, maxcpus, i;
+	int argn;
+
+	ncpus = countcpus();
+	maxcpus = ncpus;
+
+	argn = 1;
+	if (argn + 1 < argc && !strcmp(argv[argn], "-c")) {
+		maxcpus = atoi(argv[argn + 1]);
+		argn += 2;
+	}
+	if (maxcpus < 1 || maxcpus > ncpus) {
+		errx(1, "Usage: scalebench [-c maxcpus] [workload ...] "
+		     "(maxcpus 1-%u)", ncpus);
+	}
+
+	printf("scalebench: %u cpus\n", ncpus);
+	if (argn == argc) {
+		for (i=0; i<NWORKLOADS; i++) {
+			scale(&workloads[i], maxcpus);
+		}
+	}
+	for (; argn < argc; argn++) {
+		scale(findworkload(argv[argn]), maxcpus);
+	}
+	return 0;
+}
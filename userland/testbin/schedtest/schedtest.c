@@ -0,0 +1,189 @@
+/*
+ * schedtest - check sched_setattr and sched_getattr.
+ *
+ * Puts itself in each scheduling class and reads it back, checks the
+ * errors for attributes that make no sense, and fills up the cpus
+ * with SCHED_DEADLINE children until admission control turns one
+ * down, then checks their share comes back once they've exited.
+ * Whether the classes really get the cpu time they should needs a
+ * loaded system and a stopwatch; this only shows the calls work.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <sched.h>
+#include <errno.h>
+#include <err.h>
+
+#define MAXKIDS 64	/* enough to fill 32 cpus at half a cpu each */
+
+static
+void
+setattr(int policy, unsigned priority, unsigned budget, unsigned period)
+{
+	struct sched_attr sa;
+
+	sa.sa_policy = policy;
+	sa.sa_priority = priority;
+	sa.sa_budget = budget;
+	sa.sa_period = period;
+	if (sched_setattr(0, &sa) < 0) {
+		err(1, "sched_setattr policy %d", policy);
+	}
+}
+
+static
+void
+check(int policy, unsigned priority, unsigned budget, unsigned period)
+{
+	struct sched_attr sa;
+
+	if (sched_getattr(0, &sa) < 0) {
+		err(1, "sched_getattr");
+	}
+	if (sa.sa_policy != policy || sa.sa_priority != priority ||
+	    sa.sa_budget != budget || sa.sa_period != period) {
+		errx(1, "got policy %d priority %u budget %u period %u, "
+		     "expected %d %u %u %u", sa.sa_policy, sa.sa_priority,
+		     sa.sa_budget, sa.sa_period, policy, priority, budget,
+		     period);
+	}
+}
+
+static
+void
+expect(int policy, unsigned priority, unsigned budget, unsigned period,
+       int code, const char *what)
+{
+	struct sched_attr sa;
+
+	sa.sa_policy = policy;
+	sa.sa_priority = priority;
+	sa.sa_budget = budget;
+	sa.sa_period = period;
+	if (sched_setattr(0, &sa) != -1) {
+		errx(1, "%s: succeeded", what);
+	}
+	if (errno != code) {
+		errx(1, "%s: got %s, expected %s", what, strerror(errno),
+		     strerror(code));
+	}
+}
+
+/*
+ * Fork children that each ask for half a cpu and wait, until one is
+ * refused. Returns how many got it.
+ */
+static
+int
+fill(void)
+{
+	pid_t kids[MAXKIDS];
+	struct sched_attr sa;
+	int status[2], hold[2];
+	int i, n, admitted;
+	char c;
+
+	if (pipe(status) || pipe(hold)) {
+		err(1, "pipe");
+	}
+
+	admitted = 0;
+	for (n = 0; n < MAXKIDS; n++) {
+		kids[n] = fork();
+		if (kids[n] < 0) {
+			err(1, "fork");
+		}
+		if (kids[n] == 0) {
+			close(status[0]);
+			close(hold[1]);
+			sa.sa_policy = SCHED_DEADLINE;
+			sa.sa_budget = 500;
+			sa.sa_period = 1000;
+			if (sched_setattr(0, &sa) == 0) {
+				c = 'y';
+			}
+			else if (errno == EBUSY) {
+				c = 'n';
+			}
+			else {
+				c = 'e';
+			}
+			write(status[1], &c, 1);
+			/* keep our share until the parent's done */
+			read(hold[0], &c, 1);
+			_exit(0);
+		}
+		if (read(status[0], &c, 1) != 1) {
+			err(1, "read");
+		}
+		if (c == 'e') {
+			errx(1, "child's sched_setattr failed");
+		}
+		if (c == 'n') {
+			n++;
+			break;
+		}
+		admitted++;
+	}
+	if (admitted == MAXKIDS) {
+		errx(1, "%d children at half a cpu each all admitted",
+		     MAXKIDS);
+	}
+
+	close(hold[1]);
+	for (i = 0; i < n; i++) {
+		if (waitpid(kids[i], NULL, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	close(hold[0]);
+	close(status[0]);
+	close(status[1]);
+	return admitted;
+}
+
+int
+main(void)
+{
+	struct sched_attr sa;
+	int admitted;
+
+	check(SCHED_OTHER, 0, 0, 0);
+
+	setattr(SCHED_FIFO, 2, 0, 0);
+	check(SCHED_FIFO, 2, 0, 0);
+	setattr(SCHED_FIFO, SCHED_FIFO_MAXPRIO, 0, 0);
+	check(SCHED_FIFO, SCHED_FIFO_MAXPRIO, 0, 0);
+
+	/* whole ticks: 10ms, on System/161 */
+	setattr(SCHED_DEADLINE, 0, 30, 100);
+	check(SCHED_DEADLINE, 0, 30, 100);
+	setattr(SCHED_OTHER, 0, 0, 0);
+	check(SCHED_OTHER, 0, 0, 0);
+
+	expect(7, 0, 0, 0, EINVAL, "bad policy");
+	expect(SCHED_FIFO, 0, 0, 0, EINVAL, "FIFO priority 0");
+	expect(SCHED_FIFO, SCHED_FIFO_MAXPRIO + 1, 0, 0, EINVAL,
+	       "FIFO priority too high");
+	expect(SCHED_DEADLINE, 0, 0, 100, EINVAL, "no budget");
+	expect(SCHED_DEADLINE, 0, 200, 100, EINVAL, "budget past period");
+	check(SCHED_OTHER, 0, 0, 0);
+
+	if (sched_getattr(getpid() + 1000, &sa) != -1 || errno != ESRCH) {
+		errx(1, "sched_getattr of a stranger didn't fail with ESRCH");
+	}
+
+	admitted = fill();
+	printf("schedtest: %d children at half a cpu admitted\n", admitted);
+	/* they've exited, so there's room again */
+	setattr(SCHED_DEADLINE, 0, 500, 1000);
+	check(SCHED_DEADLINE, 0, 500, 1000);
+	setattr(SCHED_OTHER, 0, 0, 0);
+
+	printf("schedtest passed\n");
+	return 0;
+}
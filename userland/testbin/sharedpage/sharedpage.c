@@ -0,0 +1,60 @@
+/*
+ * sharedpage - run with the end of the text and the start of the data
+ * in the same page.
+ *
+ * The Makefile links it with a tiny maximum page size, so the data
+ * segment follows straight on from the text segment instead of being
+ * moved to a page of its own, and the two segments share a page with
+ * different permissions and different file data. Checks the layout
+ * came out that way, then that the initialized data has its values
+ * and can be written, that the bss is zero, and (by printing and
+ * returning at all) that the text in the shared page runs.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#define PAGE	4096
+
+/* From the linker: the end of the text and the start of the data. */
+extern char etext[], _fdata[];
+
+static volatile int data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+static const char rodata[] = "read only data";
+static int bss[256];
+
+int
+main(void)
+{
+	unsigned i;
+
+	if (((uintptr_t)etext - 1) / PAGE != (uintptr_t)_fdata / PAGE) {
+		errx(1, "text ends at %p and data starts at %p: "
+		     "not in one page, check the link flags", etext, _fdata);
+	}
+
+	for (i = 0; i < 8; i++) {
+		if (data[i] != (int)i + 1) {
+			errx(1, "data[%u] is %d, not %u", i, data[i], i + 1);
+		}
+		data[i] = -data[i];
+	}
+	for (i = 0; i < 8; i++) {
+		if (data[i] != -((int)i + 1)) {
+			errx(1, "data[%u] didn't keep what was stored", i);
+		}
+	}
+	for (i = 0; i < 256; i++) {
+		if (bss[i] != 0) {
+			errx(1, "bss[%u] is %d, not 0", i, bss[i]);
+		}
+	}
+	if (strcmp(rodata, "read only data") != 0) {
+		errx(1, "read only data is wrong: %s", rodata);
+	}
+
+	printf("sharedpage: passed\n");
+	return 0;
+}
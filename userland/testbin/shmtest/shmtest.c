@@ -0,0 +1,215 @@
+/*
+ * shmtest - exercise shmget()/shmat()/shmdt()/shmctl() and shared
+ * anonymous mmap.
+ *
+ * Checks that a child forked from a MAP_SHARED|MAP_ANON mapping shares
+ * even the pages neither process had touched, that two processes
+ * attaching a segment by key on their own see each other's writes,
+ * that the segment outlives shmctl(IPC_RMID) while it is attached,
+ * and that the calls fail the way they should.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define NPAGES 4
+#define SEGSIZE (NPAGES * 4096)
+#define TESTKEY 0x5161
+
+static
+void
+waitchild(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+}
+
+static
+void
+anontest(void)
+{
+	char *p;
+	pid_t pid;
+	int i;
+
+	p = mmap(NULL, SEGSIZE, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap shared anon");
+	}
+
+	/* nobody has touched any of it before the fork */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		for (i = 0; i < NPAGES; i++) {
+			p[i * 4096] = 'a' + i;
+		}
+		_exit(0);
+	}
+	waitchild(pid);
+
+	for (i = 0; i < NPAGES; i++) {
+		if (p[i * 4096] != 'a' + i) {
+			errx(1, "page %d: parent doesn't see the child's write",
+			     i);
+		}
+	}
+	if (munmap(p, SEGSIZE)) {
+		err(1, "munmap");
+	}
+	printf("shared anonymous mapping ok\n");
+}
+
+static
+void
+keytest(void)
+{
+	volatile char *p;
+	int id, id2, i;
+	pid_t pid;
+
+	id = shmget(TESTKEY, SEGSIZE, IPC_CREAT | IPC_EXCL | 0600);
+	if (id < 0) {
+		err(1, "shmget create");
+	}
+	if (shmget(TESTKEY, SEGSIZE, IPC_CREAT | IPC_EXCL | 0600) >= 0 ||
+	    errno != EEXIST) {
+		errx(1, "second IPC_EXCL shmget didn't fail with EEXIST");
+	}
+	if (shmget(TESTKEY, SEGSIZE * 2, 0) >= 0 || errno != EINVAL) {
+		errx(1, "shmget bigger than the segment didn't fail");
+	}
+
+	p = shmat(id, NULL, 0);
+	if (p == SHM_FAILED) {
+		err(1, "shmat");
+	}
+	for (i = 0; i < SEGSIZE; i++) {
+		if (p[i] != 0) {
+			errx(1, "new segment byte %d is not zero", i);
+		}
+	}
+
+	/*
+	 * The child finds the segment by key and attaches it itself,
+	 * the way an unrelated process would, and the two hand a
+	 * counter back and forth through it.
+	 */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		volatile char *q;
+
+		if (shmdt((const void *)p)) {
+			err(1, "child shmdt");
+		}
+		id2 = shmget(TESTKEY, 0, 0);
+		if (id2 != id) {
+			errx(1, "child got id %d, not %d", id2, id);
+		}
+		q = shmat(id2, NULL, 0);
+		if (q == SHM_FAILED) {
+			err(1, "child shmat");
+		}
+		for (i = 0; i < 20; i += 2) {
+			while (q[SEGSIZE - 1] != i) {
+				/* wait for the parent */
+			}
+			q[SEGSIZE - 1] = i + 1;
+		}
+		_exit(0);
+	}
+	for (i = 0; i < 20; i += 2) {
+		p[SEGSIZE - 1] = i;
+		while (p[SEGSIZE - 1] != i + 1) {
+			/* wait for the child */
+		}
+	}
+	waitchild(pid);
+	printf("segment shared by key ok\n");
+
+	/* removing the id leaves the memory to whoever has it attached */
+	if (shmctl(id, IPC_RMID)) {
+		err(1, "shmctl IPC_RMID");
+	}
+	if (shmget(TESTKEY, 0, 0) >= 0 || errno != ENOENT) {
+		errx(1, "removed key still found");
+	}
+	if (shmat(id, NULL, 0) != SHM_FAILED || errno != EINVAL) {
+		errx(1, "shmat of removed id didn't fail");
+	}
+	p[0] = 'x';
+	if (p[SEGSIZE - 1] != 19) {
+		errx(1, "attached segment lost its contents");
+	}
+	if (shmdt((const void *)p)) {
+		err(1, "shmdt");
+	}
+	if (shmdt((const void *)p) == 0 || errno != EINVAL) {
+		errx(1, "second shmdt didn't fail");
+	}
+	printf("IPC_RMID ok\n");
+}
+
+static
+void
+privatetest(void)
+{
+	int id1, id2;
+	char *p;
+
+	id1 = shmget(IPC_PRIVATE, 100, 0);
+	id2 = shmget(IPC_PRIVATE, 100, 0);
+	if (id1 < 0 || id2 < 0) {
+		err(1, "shmget IPC_PRIVATE");
+	}
+	if (id1 == id2) {
+		errx(1, "IPC_PRIVATE gave the same segment twice");
+	}
+
+	p = shmat(id1, NULL, SHM_RDONLY);
+	if (p == SHM_FAILED) {
+		err(1, "shmat read only");
+	}
+	if (p[0] != 0) {
+		errx(1, "read only segment isn't zero");
+	}
+	if (shmdt(p)) {
+		err(1, "shmdt");
+	}
+	if (shmctl(id1, IPC_RMID) || shmctl(id2, IPC_RMID)) {
+		err(1, "shmctl IPC_RMID");
+	}
+	if (shmctl(id1, IPC_RMID) == 0 || errno != EINVAL) {
+		errx(1, "second IPC_RMID didn't fail");
+	}
+	printf("IPC_PRIVATE ok\n");
+}
+
+int
+main(void)
+{
+	anontest();
+	keytest();
+	privatetest();
+	printf("shmtest: passed\n");
+	return 0;
+}
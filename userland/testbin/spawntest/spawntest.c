@@ -0,0 +1,142 @@
+/*
+ * spawntest - exercise spawn().
+ *
+ * Checks that spawn fails with the right error for a program
+ * that isn't there and for a bad file action, that the exit status
+ * of a spawned /bin/true and /bin/false comes back through waitpid,
+ * and that file actions take effect in the child: /bin/cat is run
+ * with its stdin and stdout opened on files by the kernel, and the
+ * output file must end up a copy of the input.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define INFILE "spawntest.in"
+#define OUTFILE "spawntest.out"
+
+static const char slogan[] = "spawned, not forked\n";
+
+static
+int
+run(const char *path, const struct spawn_action *actions, int nactions)
+{
+	char *args[2];
+	pid_t pid;
+	int status;
+
+	args[0] = (char *)path;
+	args[1] = NULL;
+	pid = spawn(path, args, actions, nactions);
+	if (pid < 0) {
+		err(1, "spawn %s", path);
+	}
+	if (waitpid(pid, &status, 0) != pid) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status)) {
+		errx(1, "%s didn't exit normally", path);
+	}
+	return WEXITSTATUS(status);
+}
+
+static
+void
+failtest(void)
+{
+	char *args[] = { (char *)"/bin/nonexistent", NULL };
+	struct spawn_action sa;
+
+	if (spawn(args[0], args, NULL, 0) != -1 || errno != ENOENT) {
+		errx(1, "spawn of a missing program didn't fail with ENOENT");
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_op = SPAWN_DUP2;
+	sa.sa_fd = 99;
+	sa.sa_newfd = 0;
+	args[0] = (char *)"/bin/true";
+	if (spawn(args[0], args, &sa, 1) != -1 || errno != EBADF) {
+		errx(1, "spawn with a bad dup2 didn't fail with EBADF");
+	}
+	printf("spawntest: failure cases passed\n");
+}
+
+static
+void
+statustest(void)
+{
+	if (run("/bin/true", NULL, 0) != 0) {
+		errx(1, "/bin/true didn't exit 0");
+	}
+	if (run("/bin/false", NULL, 0) == 0) {
+		errx(1, "/bin/false exited 0");
+	}
+	printf("spawntest: exit status passed\n");
+}
+
+static
+void
+redirecttest(void)
+{
+	struct spawn_action sa[2];
+	char buf[256];
+	ssize_t r;
+	int fd;
+
+	fd = open(INFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", INFILE);
+	}
+	if (write(fd, slogan, strlen(slogan)) != (ssize_t)strlen(slogan)) {
+		err(1, "%s: write", INFILE);
+	}
+	close(fd);
+
+	memset(sa, 0, sizeof(sa));
+	sa[0].sa_op = SPAWN_OPEN;
+	sa[0].sa_fd = STDIN_FILENO;
+	sa[0].sa_path = INFILE;
+	sa[0].sa_flags = O_RDONLY;
+	sa[1].sa_op = SPAWN_OPEN;
+	sa[1].sa_fd = STDOUT_FILENO;
+	sa[1].sa_path = OUTFILE;
+	sa[1].sa_flags = O_WRONLY|O_CREAT|O_TRUNC;
+	sa[1].sa_mode = 0664;
+	if (run("/bin/cat", sa, 2) != 0) {
+		errx(1, "/bin/cat failed");
+	}
+
+	fd = open(OUTFILE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", OUTFILE);
+	}
+	r = read(fd, buf, sizeof(buf) - 1);
+	if (r < 0) {
+		err(1, "%s: read", OUTFILE);
+	}
+	close(fd);
+	buf[r] = 0;
+	if (strcmp(buf, slogan) != 0) {
+		errx(1, "%s doesn't match %s", OUTFILE, INFILE);
+	}
+	printf("spawntest: file actions passed\n");
+}
+
+int
+main(void)
+{
+	failtest();
+	statustest();
+	redirecttest();
+
+	printf("spawntest: SUCCESS\n");
+	return 0;
+}
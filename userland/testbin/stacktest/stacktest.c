@@ -0,0 +1,132 @@
+/*
+ * stacktest - check that the stack grows on demand, and stops at
+ * RLIMIT_STACK.
+ *
+ * Recurses through about a megabyte of stack frames and checks they
+ * all kept their contents, then lowers the soft stack limit and makes
+ * sure a child that recurses past it is killed rather than given the
+ * memory. Also checks getrlimit/setrlimit's errors.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define FRAMESIZE 4096
+#define DEEP      256		/* frames, about 1MB */
+#define SMALL     (64 * 1024)	/* the lowered limit */
+
+/* fills a frame, recurses, and then checks the frame is still intact */
+static
+int
+recurse(int depth)
+{
+	volatile char frame[FRAMESIZE];
+	int i, sum;
+
+	for (i = 0; i < FRAMESIZE; i += 512) {
+		frame[i] = (char)(depth + i);
+	}
+	sum = depth > 0 ? recurse(depth - 1) : 0;
+	for (i = 0; i < FRAMESIZE; i += 512) {
+		if (frame[i] != (char)(depth + i)) {
+			errx(1, "frame at depth %d lost its contents", depth);
+		}
+	}
+	return sum + 1;
+}
+
+static
+void
+growtest(void)
+{
+	if (recurse(DEEP) != DEEP + 1) {
+		errx(1, "recursion came back wrong");
+	}
+	printf("grew the stack by %d frames ok\n", DEEP);
+}
+
+static
+void
+limittest(void)
+{
+	struct rlimit rl;
+	pid_t pid;
+	int status;
+
+	if (getrlimit(RLIMIT_STACK, &rl)) {
+		err(1, "getrlimit");
+	}
+	if (rl.rlim_cur < DEEP * FRAMESIZE) {
+		errx(1, "default stack limit is only %lu bytes",
+		     (unsigned long)rl.rlim_cur);
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		rl.rlim_cur = SMALL;
+		if (setrlimit(RLIMIT_STACK, &rl)) {
+			err(1, "setrlimit");
+		}
+		recurse(DEEP);
+		/* shouldn't get here */
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFSIGNALED(status)) {
+		errx(1, "child recursed past RLIMIT_STACK and lived");
+	}
+	printf("child past RLIMIT_STACK killed ok\n");
+}
+
+static
+void
+errortest(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_STACK, &rl)) {
+		err(1, "getrlimit");
+	}
+
+	rl.rlim_cur = rl.rlim_max;
+	rl.rlim_max = SMALL;
+	if (rl.rlim_cur > rl.rlim_max &&
+	    (setrlimit(RLIMIT_STACK, &rl) == 0 || errno != EINVAL)) {
+		errx(1, "setrlimit with soft above hard didn't give EINVAL");
+	}
+
+	if (getrlimit(__RLIMIT_NUM, &rl) == 0 || errno != EINVAL) {
+		errx(1, "getrlimit of a bad resource didn't give EINVAL");
+	}
+
+	/* lower the hard limit, then raising it again must fail */
+	rl.rlim_cur = rl.rlim_max = 4 * 1024 * 1024;
+	if (setrlimit(RLIMIT_STACK, &rl)) {
+		err(1, "setrlimit lowering the hard limit");
+	}
+	rl.rlim_max = RLIM_INFINITY;
+	if (setrlimit(RLIMIT_STACK, &rl) == 0 || errno != EPERM) {
+		errx(1, "raising the hard limit didn't give EPERM");
+	}
+	printf("rlimit errors ok\n");
+}
+
+int
+main(void)
+{
+	growtest();
+	limittest();
+	errortest();
+	printf("stacktest passed\n");
+	return 0;
+}
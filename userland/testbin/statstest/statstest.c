@@ -0,0 +1,171 @@
+/*
+ * statstest - check the event counters in stats:.
+ *
+ * Reads stats:syscall, makes some system calls, reads it again, and
+ * checks that the call count went up by at least as many. Also checks
+ * the directory lists the groups (and maybe intr, the interrupt
+ * histograms, which depend on the kernel config), every group reads
+ * as "name value" lines, and that the files can't be written.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define NCALLS 100
+
+static const char *const groups[] = {
+	"vm", "sched", "bio", "cache", "syscall", "disk", "kmem",
+};
+#define NGROUPS (sizeof(groups) / sizeof(groups[0]))
+
+static char buf[4096];
+
+/*
+ * Read stats:NAME into buf, and check every line looks right.
+ */
+static
+void
+readgroup(const char *name)
+{
+	char path[64];
+	char *s, *end;
+	ssize_t len, r;
+	int fd;
+
+	snprintf(path, sizeof(path), "stats:%s", name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", path);
+	}
+	len = 0;
+	do {
+		r = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (r < 0) {
+			err(1, "%s: read", path);
+		}
+		len += r;
+	} while (r > 0 && len < (ssize_t)sizeof(buf) - 1);
+	close(fd);
+	buf[len] = 0;
+
+	/*
+	 * (stats:disk has nothing if there aren't any disks, and
+	 * stats:kmem nothing without options kmtags)
+	 */
+	if (len == 0 && strcmp(name, "disk") && strcmp(name, "kmem")) {
+		errx(1, "%s is empty", path);
+	}
+	for (s = buf; *s; s = end + 1) {
+		end = strchr(s, '\n');
+		if (end == NULL) {
+			errx(1, "%s: last line has no newline", path);
+		}
+		if (strchr(s, ' ') == NULL || strchr(s, ' ') > end) {
+			errx(1, "%s: bad line", path);
+		}
+	}
+}
+
+/*
+ * The value of counter NAME in buf.
+ */
+static
+unsigned long long
+value(const char *name)
+{
+	unsigned long long v;
+	char *s;
+	size_t len;
+
+	len = strlen(name);
+	for (s = buf; *s; s = strchr(s, '\n') + 1) {
+		if (!memcmp(s, name, len) && s[len] == ' ') {
+			v = 0;
+			for (s += len + 1; *s >= '0' && *s <= '9'; s++) {
+				v = v * 10 + (*s - '0');
+			}
+			return v;
+		}
+	}
+	errx(1, "no counter %s", name);
+}
+
+int
+main(void)
+{
+	unsigned long long before, after;
+	struct stat st;
+	char name[64];
+	unsigned i;
+	int fd, r;
+
+	for (i = 0; i < NGROUPS; i++) {
+		readgroup(groups[i]);
+	}
+
+	/* the directory lists them */
+	fd = open("stats:", O_RDONLY);
+	if (fd < 0) {
+		err(1, "stats:");
+	}
+	for (i = 0; i < NGROUPS; i++) {
+		r = getdirentry(fd, name, sizeof(name) - 1);
+		if (r <= 0) {
+			errx(1, "stats: lists only %u files", i);
+		}
+		name[r] = 0;
+		if (strcmp(name, groups[i])) {
+			errx(1, "stats: lists %s, expected %s", name,
+			     groups[i]);
+		}
+	}
+	r = getdirentry(fd, name, sizeof(name) - 1);
+	if (r > 0) {
+		name[r] = 0;
+		if (strcmp(name, "intr")) {
+			errx(1, "stats: lists %s as well", name);
+		}
+		r = getdirentry(fd, name, sizeof(name) - 1);
+	}
+	if (r != 0) {
+		errx(1, "stats: lists too many files");
+	}
+	close(fd);
+
+	readgroup("syscall");
+	before = value("calls");
+	for (i = 0; i < NCALLS; i++) {
+		getpid();
+	}
+	readgroup("syscall");
+	after = value("calls");
+	if (after < before + NCALLS) {
+		errx(1, "calls went from %llu to %llu after %d calls",
+		     before, after, NCALLS);
+	}
+
+	if (stat("stats:syscall", &st)) {
+		err(1, "stat of stats:syscall");
+	}
+	if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+		errx(1, "stats:syscall has a bad type or size");
+	}
+
+	fd = open("stats:syscall", O_WRONLY);
+	if (fd >= 0 || errno != EROFS) {
+		errx(1, "opening stats:syscall for writing didn't fail");
+	}
+	fd = open("stats:nosuch", O_RDWR|O_CREAT, 0664);
+	if (fd >= 0 || errno != EROFS) {
+		errx(1, "creating a file in stats: didn't fail");
+	}
+
+	printf("statstest passed\n");
+	return 0;
+}
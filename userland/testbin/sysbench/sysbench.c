@@ -0,0 +1,297 @@
+/*
+ * sysbench - time system calls.
+ *
+ * Usage: sysbench [samples]
+ *
+ * Times getpid, 1-byte and 4K reads and writes on null: and on a file,
+ * lseek, open+close, dup2, and sbrk. Each benchmark takes SAMPLES
+ * samples (default 200) of as many calls as take a millisecond (see
+ * bench_run), and prints a BENCH line (see bench.h) with ns per call
+ * and percentiles, so the cost of
+ * getting into and out of the kernel can be compared from one build
+ * to the next. The file is made in the current directory and removed
+ * afterwards.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <bench.h>
+
+#define DEFSAMPLES	200
+#define MAXSAMPLES	1000
+#define FILENAME	"sysbench.tmp"
+#define DUPFD		20
+#define PAGE		4096
+
+static unsigned nsamples = DEFSAMPLES;
+static char buf[PAGE];
+static int nullfd, filefd;
+
+/*
+ * The benchmarks. Each does N of its call, and dies if one fails,
+ * since timing calls that fail isn't timing the calls.
+ */
+
+static
+void
+b_getpid(void *arg, unsigned n)
+{
+	unsigned i;
+
+	(void)arg;
+
+	for (i=0; i<n; i++) {
+		getpid();
+	}
+}
+
+static
+void
+doread(int fd, size_t len, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		if (read(fd, buf, len) < 0) {
+			err(1, "read");
+		}
+	}
+}
+
+static
+void
+dowrite(int fd, size_t len, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		if (write(fd, buf, len) != (ssize_t)len) {
+			err(1, "write");
+		}
+	}
+}
+
+static
+void
+b_nullread1(void *arg, unsigned n)
+{
+	(void)arg;
+	doread(nullfd, 1, n);
+}
+
+static
+void
+b_nullread4k(void *arg, unsigned n)
+{
+	(void)arg;
+	doread(nullfd, PAGE, n);
+}
+
+static
+void
+b_nullwrite1(void *arg, unsigned n)
+{
+	(void)arg;
+	dowrite(nullfd, 1, n);
+}
+
+static
+void
+b_nullwrite4k(void *arg, unsigned n)
+{
+	(void)arg;
+	dowrite(nullfd, PAGE, n);
+}
+
+static
+void
+dopread(size_t len, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		if (pread(filefd, buf, len, 0) != (ssize_t)len) {
+			err(1, "pread");
+		}
+	}
+}
+
+static
+void
+dopwrite(size_t len, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		if (pwrite(filefd, buf, len, 0) != (ssize_t)len) {
+			err(1, "pwrite");
+		}
+	}
+}
+
+static
+void
+b_fileread1(void *arg, unsigned n)
+{
+	(void)arg;
+	dopread(1, n);
+}
+
+static
+void
+b_fileread4k(void *arg, unsigned n)
+{
+	(void)arg;
+	dopread(PAGE, n);
+}
+
+static
+void
+b_filewrite1(void *arg, unsigned n)
+{
+	(void)arg;
+	dopwrite(1, n);
+}
+
+static
+void
+b_filewrite4k(void *arg, unsigned n)
+{
+	(void)arg;
+	dopwrite(PAGE, n);
+}
+
+static
+void
+b_lseek(void *arg, unsigned n)
+{
+	unsigned i;
+
+	(void)arg;
+
+	for (i=0; i<n; i++) {
+		if (lseek(filefd, i, SEEK_SET) < 0) {
+			err(1, "lseek");
+		}
+	}
+}
+
+static
+void
+b_openclose(void *arg, unsigned n)
+{
+	unsigned i;
+
+	(void)arg;
+	int fd;
+
+	for (i=0; i<n; i++) {
+		fd = open(FILENAME, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s", FILENAME);
+		}
+		close(fd);
+	}
+}
+
+static
+void
+b_dup2(void *arg, unsigned n)
+{
+	unsigned i;
+
+	(void)arg;
+
+	for (i=0; i<n; i++) {
+		if (dup2(filefd, DUPFD) < 0) {
+			err(1, "dup2");
+		}
+	}
+}
+
+/* a page up and down again, without touching it: a call each way */
+static
+void
+b_sbrk(void *arg, unsigned n)
+{
+	unsigned i;
+
+	(void)arg;
+
+	for (i=0; i<n; i++) {
+		if (sbrk(i % 2 == 0 ? PAGE : -PAGE) == (void *)-1) {
+			err(1, "sbrk");
+		}
+	}
+	if (n % 2 != 0 && sbrk(-PAGE) == (void *)-1) {
+		err(1, "sbrk");
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*func)(void *arg, unsigned n);
+} benches[] = {
+	{ "getpid",		b_getpid },
+	{ "read.null.1",	b_nullread1 },
+	{ "read.null.4k",	b_nullread4k },
+	{ "write.null.1",	b_nullwrite1 },
+	{ "write.null.4k",	b_nullwrite4k },
+	{ "pread.file.1",	b_fileread1 },
+	{ "pread.file.4k",	b_fileread4k },
+	{ "pwrite.file.1",	b_filewrite1 },
+	{ "pwrite.file.4k",	b_filewrite4k },
+	{ "lseek",		b_lseek },
+	{ "open+close",		b_openclose },
+	{ "dup2",		b_dup2 },
+	{ "sbrk",		b_sbrk },
+};
+
+int
+main(int argc, char *argv[])
+{
+	unsigned i;
+
+	if (argc == 2) {
+		nsamples = atoi(argv[1]);
+		if (nsamples < 1 || nsamples > MAXSAMPLES) {
+			errx(1, "samples must be from 1 to %d", MAXSAMPLES);
+		}
+	}
+	else if (argc != 1) {
+		errx(1, "Usage: sysbench [samples]");
+	}
+
+	nullfd = open("null:", O_RDWR);
+	if (nullfd < 0) {
+		err(1, "null:");
+	}
+	filefd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (filefd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	memset(buf, 'x', sizeof(buf));
+	if (write(filefd, buf, sizeof(buf)) != sizeof(buf)) {
+		err(1, "%s: write", FILENAME);
+	}
+
+	printf("sysbench: %u samples each\n", nsamples);
+	for (i=0; i<sizeof(benches)/sizeof(benches[0]); i++) {
+		bench_run(benches[i].name, benches[i].func, NULL, nsamples,
+			  NULL);
+	}
+
+	close(DUPFD);
+	close(filefd);
+	close(nullfd);
+	if (remove(FILENAME) < 0) {
+		warn("%s: remove", FILENAME);
+	}
+	return 0;
+}
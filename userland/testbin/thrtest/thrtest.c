@@ -0,0 +1,145 @@
+/*
+ * thrtest - exercise thr_create()/thr_exit()/thr_join().
+ *
+ * Starts NTHREADS threads that each add to a shared counter LOOPS
+ * times under a futex lock and hand back their number, and joins them
+ * all: every value must come back and the counter must be exact. Then
+ * does it again to reuse the stacks of the joined threads. Last, a
+ * child process starts a thread that spins forever and calls _exit;
+ * the spinner has to go too, so the parent can collect the child's
+ * exit status.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <futex.h>
+#include <atomic.h>
+#include <thr.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NTHREADS	6
+#define LOOPS		1000
+
+static volatile int lock;	/* 0 free, 1 held, 2 held with waiters */
+static volatile int counter;
+
+static
+void
+futexlock(volatile int *m)
+{
+	while (atomic_xchg(m, 2) != 0) {
+		if (futex_wait(m, 2) < 0 && errno != EAGAIN) {
+			err(1, "futex_wait");
+		}
+	}
+}
+
+static
+void
+futexunlock(volatile int *m)
+{
+	if (atomic_xchg(m, 0) == 2) {
+		if (futex_wake(m, 1) < 0) {
+			err(1, "futex_wake");
+		}
+	}
+}
+
+static
+void *
+adder(void *arg)
+{
+	int i;
+
+	for (i = 0; i < LOOPS; i++) {
+		futexlock(&lock);
+		counter = counter + 1;
+		futexunlock(&lock);
+	}
+	return arg;
+}
+
+static
+void
+jointest(int round)
+{
+	int tids[NTHREADS];
+	void *value;
+	int i;
+
+	counter = 0;
+	for (i = 0; i < NTHREADS; i++) {
+		tids[i] = thr_create(adder, (void *)(i + 1));
+		if (tids[i] < 0) {
+			err(1, "thr_create");
+		}
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		if (thr_join(tids[i], &value) < 0) {
+			err(1, "thr_join");
+		}
+		if (value != (void *)(i + 1)) {
+			errx(1, "FAILED: thread %d returned %p", i, value);
+		}
+	}
+	if (thr_join(tids[0], NULL) != -1 || errno != ESRCH) {
+		errx(1, "FAILED: joining a thread twice didn't fail with ESRCH");
+	}
+	if (counter != NTHREADS * LOOPS) {
+		errx(1, "FAILED: counter is %d, expected %d",
+		     counter, NTHREADS * LOOPS);
+	}
+	printf("thrtest: round %d: %d threads counted to %d\n",
+	       round, NTHREADS, counter);
+}
+
+static
+void *
+spinner(void *arg)
+{
+	(void)arg;
+	while (counter >= 0) {
+		counter = (counter + 1) & 0xffff;
+	}
+	return NULL;
+}
+
+static
+void
+exittest(void)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (thr_create(spinner, NULL) < 0) {
+			err(1, "thr_create");
+		}
+		_exit(3);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 3) {
+		errx(1, "FAILED: child status 0x%x", status);
+	}
+	printf("thrtest: _exit took the other thread with it\n");
+}
+
+int
+main(void)
+{
+	jointest(1);
+	jointest(2);
+	exittest();
+
+	printf("thrtest: SUCCESS\n");
+	return 0;
+}
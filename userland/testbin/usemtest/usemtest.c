@@ -157,19 +157,16 @@ usem_cleanup(struct usem *sem)
 	(void)remove(sem->name);
 }
 
+/*
+ * P and V use sem_op, which skips the uio setup read and write go
+ * through. (parallelvm and multiexec still use read and write.)
+ */
 static
 void
 P(struct usem *sem)
 {
-	ssize_t r;
-	char c;
-
-	r = read(sem->fd, &c, 1);
-	if (r < 0) {
-		err(1, "%s: read", sem->name);
-	}
-	if (r == 0) {
-		errx(1, "%s: read: unexpected EOF", sem->name);
+	if (sem_op(sem->fd, -1) < 0) {
+		err(1, "%s: sem_op", sem->name);
 	}
 }
 
@@ -177,15 +174,8 @@ static
 void
 V(struct usem *sem)
 {
-	ssize_t r;
-	char c = 0;
-
-	r = write(sem->fd, &c, 1);
-	if (r < 0) {
-		err(1, "%s: write", sem->name);
-	}
-	if (r == 0) {
-		errx(1, "%s: write: short count", sem->name);
+	if (sem_op(sem->fd, 1) < 0) {
+		err(1, "%s: sem_op", sem->name);
 	}
 }
 
@@ -32,17 +32,11 @@
  * forks 3 threads off 2 to functions, each of which displays a string
  * every once in a while.
  *
- * This won't do much of anything unless you implement user-level
- * threads.
- *
- * It also makes various assumptions about the thread API. In
- * particular, it believes (1) that you create a thread by calling
- * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
- * return from the function they started in. If any or all of these
- * assumptions are not met by your user-level threads, you will need
- * to patch this test accordingly.
+ * Threads are made with thr_create() (see <thr.h>). The parent
+ * thread leaves with thr_exit() rather than returning from main,
+ * since that would exit the whole process; the others keep running,
+ * and the process exits when the last of them returns from the
+ * function it started in.
  *
  * This is also a rather basic test and you'll probably want to write
  * some more of your own.
@@ -51,6 +45,8 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <err.h>
+#include <thr.h>
 
 #define NTHREADS  3
 #define MAX       1<<25
@@ -61,8 +57,8 @@
 volatile int count = 0;
 
 /* the 2 threads : */
-void ThreadRunner(void);
-void BladeRunner(void);
+void *ThreadRunner(void *);
+void *BladeRunner(void *);
 
 int
 main(int argc, char *argv[])
@@ -73,14 +69,12 @@ main(int argc, char *argv[])
     (void)argv;
 
     for (i=0; i<NTHREADS; i++) {
-	if (i)
-	    threadfork(ThreadRunner);
-        else
-	    threadfork(BladeRunner);
+	if (thr_create(i ? ThreadRunner : BladeRunner, NULL) < 0)
+	    err(1, "thr_create");
     }
 
     printf("Parent has left.\n");
-    return 0;
+    thr_exit(NULL);
 }
 
 /* multiple threads will simply print out the global variable.
@@ -88,22 +82,26 @@ main(int argc, char *argv[])
    random results.
 */
 
-void
-BladeRunner()
+void *
+BladeRunner(void *arg)
 {
+    (void)arg;
     while (count < MAX) {
 	if (count % 500 == 0)
 	    printf("Blade ");
 	count++;
     }
+    return NULL;
 }
 
-void
-ThreadRunner()
+void *
+ThreadRunner(void *arg)
 {
+    (void)arg;
     while (count < MAX) {
 	if (count % 513 == 0)
 	    printf(" Runner\n");
 	count++;
     }
+    return NULL;
 }
@@ -0,0 +1,259 @@
+/*
+ * vmbench - time page faults and TLB misses.
+ *
+ * Usage: vmbench [passes]
+ *
+ * Runs, on pages got from sbrk:
+ *    touch.first       first write to each of NPAGES new pages (zero
+ *                      fill faults), BATCH pages per sample
+ *    seq.<n>, rand.<n> reads of one word per page over working sets
+ *                      of n pages, in order and in a fixed shuffled
+ *                      order, PASSES passes (default 20) of the whole
+ *                      set per benchmark; a pass is a sample. Sets
+ *                      bigger than the 64-entry TLB keep evicting
+ *                      their own entries, so those pay for re-faults.
+ *    sbrk.cycle        grow the heap by CYCLEPAGES pages, touch them,
+ *                      and shrink it again; a cycle is a sample
+ *
+ * Each prints a BENCH line (see bench.h) with, from getrusage,
+ * the TLB misses that reached vm_fault and the zero fills per
+ * operation, and faults (both together) per second.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <bench.h>
+
+#define PAGE		4096
+#define NPAGES		256
+#define BATCH		16
+#define CYCLEPAGES	64
+#define NCYCLES		50
+#define DEFPASSES	20
+#define MAXPASSES	1000
+
+static const unsigned wsets[] = { 16, 32, 64, 128, 256 };
+
+static uint64_t samples[MAXPASSES > NPAGES ? MAXPASSES : NPAGES];
+static unsigned passes = DEFPASSES;
+static unsigned order[NPAGES];
+
+/* read with volatile so the loops aren't optimized away */
+static volatile unsigned sink;
+
+struct vmcount {
+	unsigned long tlbmiss;
+	unsigned long zerofill;
+};
+
+static
+void
+getcount(struct vmcount *vc)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0) {
+		err(1, "getrusage");
+	}
+	vc->tlbmiss = ru.ru_tlbmiss;
+	vc->zerofill = ru.ru_zerofill;
+}
+
+/* Per-op counts (to two places) and fault rate, for bench_report. */
+static
+void
+mkextra(char *buf, size_t len, const struct vmcount *before,
+	const struct vmcount *after, unsigned long ops, uint64_t ns)
+{
+	unsigned long tlb, zero, faults, rate;
+
+	tlb = (after->tlbmiss - before->tlbmiss) * 100 / ops;
+	zero = (after->zerofill - before->zerofill) * 100 / ops;
+	faults = (after->tlbmiss - before->tlbmiss) +
+		(after->zerofill - before->zerofill);
+	rate = ns > 0 ? (unsigned long)(faults * (uint64_t)1000000000 / ns) : 0;
+	snprintf(buf, len, "tlbmiss/op=%lu.%02lu zerofill/op=%lu.%02lu "
+		 "faults/s=%lu", tlb / 100, tlb % 100, zero / 100, zero % 100,
+		 rate);
+}
+
+static
+uint64_t
+total(unsigned n)
+{
+	uint64_t t = 0;
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		t += samples[i];
+	}
+	return t;
+}
+
+static
+void
+report(const char *name, unsigned n, unsigned opsper,
+       const struct vmcount *before)
+{
+	struct vmcount after;
+	char extra[96];
+
+	getcount(&after);
+	mkextra(extra, sizeof(extra), before, &after,
+		(unsigned long)n * opsper, total(n));
+	bench_report(name, samples, n, opsper, extra);
+}
+
+static
+char *
+getpages(unsigned npages)
+{
+	char *p;
+
+	p = sbrk(npages * PAGE);
+	if (p == (void *)-1) {
+		err(1, "sbrk %u pages", npages);
+	}
+	return p;
+}
+
+static
+void
+putpages(unsigned npages)
+{
+	if (sbrk(-(int)(npages * PAGE)) == (void *)-1) {
+		err(1, "sbrk -%u pages", npages);
+	}
+}
+
+static
+void
+touchfirst(char *mem)
+{
+	struct vmcount before;
+	uint64_t start;
+	unsigned i, j;
+
+	getcount(&before);
+	for (i=0; i<NPAGES/BATCH; i++) {
+		start = bench_ns();
+		for (j=0; j<BATCH; j++) {
+			mem[(i * BATCH + j) * PAGE] = 1;
+		}
+		samples[i] = bench_ns() - start;
+	}
+	report("touch.first", NPAGES/BATCH, BATCH, &before);
+}
+
+/* A fixed shuffle of 0..n-1 into order[]. */
+static
+void
+shuffle(unsigned n)
+{
+	unsigned i, j, t, seed = 12345;
+
+	for (i=0; i<n; i++) {
+		order[i] = i;
+	}
+	for (i=n; i>1; i--) {
+		seed = seed * 1103515245 + 12345;
+		j = (seed >> 16) % i;
+		t = order[i-1];
+		order[i-1] = order[j];
+		order[j] = t;
+	}
+}
+
+static
+void
+walk(const char *kind, char *mem, unsigned ws, int random)
+{
+	struct vmcount before;
+	char name[32];
+	uint64_t start;
+	unsigned i, p;
+
+	if (random) {
+		shuffle(ws);
+	}
+	else {
+		for (i=0; i<ws; i++) {
+			order[i] = i;
+		}
+	}
+
+	/* one pass to settle, so no zero fills get counted */
+	for (i=0; i<ws; i++) {
+		sink += mem[order[i] * PAGE];
+	}
+
+	getcount(&before);
+	for (p=0; p<passes; p++) {
+		start = bench_ns();
+		for (i=0; i<ws; i++) {
+			sink += mem[order[i] * PAGE];
+		}
+		samples[p] = bench_ns() - start;
+	}
+	snprintf(name, sizeof(name), "%s.%u", kind, ws);
+	report(name, passes, ws, &before);
+}
+
+static
+void
+sbrkcycle(void)
+{
+	struct vmcount before;
+	uint64_t start;
+	unsigned c, i;
+	char *p;
+
+	getcount(&before);
+	for (c=0; c<NCYCLES; c++) {
+		start = bench_ns();
+		p = getpages(CYCLEPAGES);
+		for (i=0; i<CYCLEPAGES; i++) {
+			p[i * PAGE] = 1;
+		}
+		putpages(CYCLEPAGES);
+		samples[c] = bench_ns() - start;
+	}
+	report("sbrk.cycle", NCYCLES, 1, &before);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *mem;
+	unsigned i;
+
+	if (argc == 2) {
+		passes = atoi(argv[1]);
+		if (passes < 1 || passes > MAXPASSES) {
+			errx(1, "passes must be from 1 to %d", MAXPASSES);
+		}
+	}
+	else if (argc != 1) {
+		errx(1, "Usage: vmbench [passes]");
+	}
+
+	printf("vmbench: %d pages, %u passes per working set\n",
+	       NPAGES, passes);
+
+	mem = getpages(NPAGES);
+	touchfirst(mem);
+	for (i=0; i<sizeof(wsets)/sizeof(wsets[0]); i++) {
+		walk("seq", mem, wsets[i], 0);
+		walk("rand", mem, wsets[i], 1);
+	}
+	putpages(NPAGES);
+
+	sbrkcycle();
+	return 0;
+}
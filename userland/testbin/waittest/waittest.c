@@ -0,0 +1,74 @@
+/*
+ * waittest - exercise waitpid() with WNOHANG and with pid -1.
+ *
+ * Forks NKIDS children that each sleep a little (the later ones
+ * longer) and exit with their own number. While they're all still
+ * asleep, waitpid with WNOHANG must return 0. Then waitpid(-1) must
+ * collect every one of them, each exactly once, and once they're all
+ * gone it must fail with ECHILD.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NKIDS	5
+
+int
+main(void)
+{
+	pid_t pids[NKIDS], pid;
+	int seen[NKIDS];
+	struct timespec ts;
+	int i, status;
+
+	for (i = 0; i < NKIDS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			ts.tv_sec = 1 + i / 2;
+			ts.tv_nsec = 0;
+			nanosleep(&ts, NULL);
+			_exit(i);
+		}
+		seen[i] = 0;
+	}
+
+	pid = waitpid(-1, &status, WNOHANG);
+	if (pid != 0) {
+		errx(1, "waitpid WNOHANG returned %d with everyone asleep",
+		     pid);
+	}
+	printf("waittest: WNOHANG passed\n");
+
+	for (i = 0; i < NKIDS; i++) {
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) < 0 ||
+		    WEXITSTATUS(status) >= NKIDS) {
+			errx(1, "bad status %d from pid %d", status, pid);
+		}
+		if (pids[WEXITSTATUS(status)] != pid ||
+		    seen[WEXITSTATUS(status)]++) {
+			errx(1, "pid %d exited %d, which isn't right", pid,
+			     WEXITSTATUS(status));
+		}
+	}
+	printf("waittest: collected %d children\n", NKIDS);
+
+	if (waitpid(-1, &status, 0) != -1 || errno != ECHILD) {
+		errx(1, "waitpid with no children left didn't fail "
+		     "with ECHILD");
+	}
+
+	printf("waittest: SUCCESS\n");
+	return 0;
+}